@@ -0,0 +1,98 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/async_input.h"
+
+#include <jxl/decode.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+AsyncJxlDecoder::AsyncJxlDecoder(JxlDecoder* dec, EventFunc on_event)
+    : dec_(dec), on_event_(std::move(on_event)) {
+  thread_ = std::thread([this]() { Run(); });
+}
+
+AsyncJxlDecoder::~AsyncJxlDecoder() { (void)Finish(); }
+
+void AsyncJxlDecoder::AppendInput(const uint8_t* data, size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (done_ || input_closed_) return;
+  pending_.insert(pending_.end(), data, data + size);
+  cv_.notify_all();
+}
+
+void AsyncJxlDecoder::CloseInput() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  input_closed_ = true;
+  cv_.notify_all();
+}
+
+Status AsyncJxlDecoder::Finish() {
+  CloseInput();
+  if (thread_.joinable()) thread_.join();
+  std::lock_guard<std::mutex> lock(mutex_);
+  return status_;
+}
+
+void AsyncJxlDecoder::Run() {
+  // The bytes given to the decoder, which keeps a pointer to them until
+  // JxlDecoderReleaseInput.
+  std::vector<uint8_t> input;
+  Status status = true;
+  for (;;) {
+    bool closed;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return !pending_.empty() || input_closed_; });
+      input.insert(input.end(), pending_.begin(), pending_.end());
+      pending_.clear();
+      closed = input_closed_;
+    }
+    if (JXL_DEC_SUCCESS !=
+        JxlDecoderSetInput(dec_, input.data(), input.size())) {
+      status = JXL_FAILURE("JxlDecoderSetInput failed");
+      break;
+    }
+    if (closed) JxlDecoderCloseInput(dec_);
+    JxlDecoderStatus event;
+    for (;;) {
+      event = JxlDecoderProcessInput(dec_);
+      if (event == JXL_DEC_NEED_MORE_INPUT || event == JXL_DEC_SUCCESS ||
+          event == JXL_DEC_ERROR) {
+        break;
+      }
+      status = on_event_(dec_, event);
+      if (!status) break;
+    }
+    const size_t remaining = JxlDecoderReleaseInput(dec_);
+    input.erase(input.begin(), input.end() - remaining);
+    if (!status || event == JXL_DEC_SUCCESS) break;
+    if (event == JXL_DEC_ERROR) {
+      status = JXL_FAILURE("Decoding failed");
+      break;
+    }
+    if (closed) {
+      status = JXL_FAILURE("Truncated input");
+      break;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  status_ = status;
+  done_ = true;
+  pending_.clear();
+}
+
+}  // namespace extras
+}  // namespace jxl
@@ -0,0 +1,72 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_EXTRAS_ASYNC_INPUT_H_
+#define LIB_EXTRAS_ASYNC_INPUT_H_
+
+#include <jxl/decode.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+// Runs the event loop of a JxlDecoder on its own thread, so that the sections
+// whose bytes have arrived are decoded while the application is still
+// receiving the next ones, e.g. from the network. The application only appends
+// the bytes as they arrive, and is notified of the decoder events.
+class AsyncJxlDecoder {
+ public:
+  // Called on the decoding thread for each event but JXL_DEC_NEED_MORE_INPUT,
+  // JXL_DEC_SUCCESS and JXL_DEC_ERROR, e.g. to set the output buffers once the
+  // basic info is known. An error stops the decoding.
+  using EventFunc = std::function<Status(JxlDecoder* dec, JxlDecoderStatus)>;
+
+  // `dec` must have its events, and usually its parallel runner, already set.
+  // It is only used by the decoding thread until Finish returns.
+  AsyncJxlDecoder(JxlDecoder* dec, EventFunc on_event);
+  AsyncJxlDecoder(const AsyncJxlDecoder&) = delete;
+  AsyncJxlDecoder& operator=(const AsyncJxlDecoder&) = delete;
+  ~AsyncJxlDecoder();
+
+  // Copies the next bytes of the input and returns without waiting for them to
+  // be decoded. Does nothing after the decoding has stopped.
+  void AppendInput(const uint8_t* data, size_t size);
+
+  // Signals that all the input was appended.
+  void CloseInput();
+
+  // Closes the input, waits until the decoding and all the callbacks are done,
+  // and returns whether the whole input was decoded successfully.
+  Status Finish();
+
+ private:
+  void Run();
+
+  JxlDecoder* dec_;
+  EventFunc on_event_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Bytes appended since the decoding thread last took the input.
+  std::vector<uint8_t> pending_;
+  bool input_closed_ = false;
+  bool done_ = false;
+  Status status_ = true;
+  std::thread thread_;
+};
+
+}  // namespace extras
+}  // namespace jxl
+
+#endif  // LIB_EXTRAS_ASYNC_INPUT_H_
@@ -0,0 +1,102 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/async_input.h"
+
+#include <jxl/decode.h>
+#include <jxl/decode_cxx.h>
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lib/extras/dec/jxl.h"
+#include "lib/extras/enc/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/test_image.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace extras {
+namespace {
+
+std::vector<uint8_t> EncodeTestImage() {
+  test::TestImage image;
+  EXPECT_TRUE(image.SetDimensions(300, 200));
+  image.SetDataType(JXL_TYPE_UINT8);
+  EXPECT_TRUE(image.SetChannels(3));
+  image.SetAllBitDepths(8);
+  JXL_TEST_ASSIGN_OR_DIE(auto frame, image.AddFrame());
+  frame.RandomFill();
+  std::vector<uint8_t> compressed;
+  EXPECT_TRUE(EncodeImageJXL(JXLCompressParams(), image.ppf(),
+                             /*jpeg_bytes=*/nullptr, &compressed));
+  return compressed;
+}
+
+// Decodes `compressed` appended in chunks of `chunk_size` bytes.
+Status DecodeInChunks(const std::vector<uint8_t>& compressed,
+                      size_t chunk_size, std::vector<uint8_t>* pixels) {
+  const JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  auto dec = JxlDecoderMake(nullptr);
+  JXL_RETURN_IF_ERROR(JXL_DEC_SUCCESS ==
+                      JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+  size_t num_images = 0;
+  AsyncJxlDecoder async_dec(
+      dec.get(), [&](JxlDecoder* d, JxlDecoderStatus event) -> Status {
+        if (event == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+          size_t size;
+          JXL_RETURN_IF_ERROR(JXL_DEC_SUCCESS ==
+                              JxlDecoderImageOutBufferSize(d, &format, &size));
+          pixels->resize(size);
+          JXL_RETURN_IF_ERROR(
+              JXL_DEC_SUCCESS ==
+              JxlDecoderSetImageOutBuffer(d, &format, pixels->data(), size));
+        } else if (event == JXL_DEC_FULL_IMAGE) {
+          num_images++;
+        }
+        return true;
+      });
+  for (size_t pos = 0; pos < compressed.size(); pos += chunk_size) {
+    async_dec.AppendInput(compressed.data() + pos,
+                          std::min(chunk_size, compressed.size() - pos));
+  }
+  JXL_RETURN_IF_ERROR(async_dec.Finish());
+  JXL_RETURN_IF_ERROR(num_images == 1);
+  return true;
+}
+
+TEST(AsyncInputTest, DecodesAppendedChunks) {
+  const std::vector<uint8_t> compressed = EncodeTestImage();
+  PackedPixelFile expected;
+  JXLDecompressParams dparams;
+  dparams.accepted_formats = {{3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}};
+  ASSERT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(), dparams,
+                             /*decoded_bytes=*/nullptr, &expected));
+  const PackedImage& color = expected.frames[0].color;
+  const uint8_t* expected_pixels =
+      static_cast<const uint8_t*>(color.pixels());
+  for (size_t chunk_size : {1 << 8, 1 << 12, 1 << 20}) {
+    std::vector<uint8_t> pixels;
+    ASSERT_TRUE(DecodeInChunks(compressed, chunk_size, &pixels));
+    ASSERT_EQ(pixels.size(), color.pixels_size);
+    EXPECT_TRUE(std::equal(pixels.begin(), pixels.end(), expected_pixels));
+  }
+}
+
+TEST(AsyncInputTest, FailsOnTruncatedInput) {
+  std::vector<uint8_t> compressed = EncodeTestImage();
+  compressed.resize(compressed.size() / 2);
+  std::vector<uint8_t> pixels;
+  EXPECT_FALSE(DecodeInChunks(compressed, 1 << 10, &pixels));
+}
+
+}  // namespace
+}  // namespace extras
+}  // namespace jxl
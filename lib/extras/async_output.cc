@@ -0,0 +1,139 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/async_output.h"
+
+#include <jxl/encode.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "lib/jxl/base/c_callback_support.h"
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+AsyncOutputProcessor::AsyncOutputProcessor(WriteFunc write,
+                                           FinalizedFunc on_finalized,
+                                           bool seekable, size_t buffer_size)
+    : write_(std::move(write)),
+      on_finalized_(std::move(on_finalized)),
+      seekable_(seekable) {
+  for (auto& buffer : buffers_) buffer.resize(buffer_size);
+  thread_ = std::thread([this]() { Run(); });
+}
+
+AsyncOutputProcessor::~AsyncOutputProcessor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    cv_.notify_all();
+  }
+  thread_.join();
+}
+
+JxlEncoderOutputProcessor AsyncOutputProcessor::GetOutputProcessor() {
+  return JxlEncoderOutputProcessor{
+      this, METHOD_TO_C_CALLBACK(&AsyncOutputProcessor::GetBuffer),
+      METHOD_TO_C_CALLBACK(&AsyncOutputProcessor::ReleaseBuffer),
+      seekable_ ? METHOD_TO_C_CALLBACK(&AsyncOutputProcessor::Seek) : nullptr,
+      METHOD_TO_C_CALLBACK(&AsyncOutputProcessor::SetFinalizedPosition)};
+}
+
+Status AsyncOutputProcessor::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return requests_.empty() && !writing_; });
+  return status_;
+}
+
+Status AsyncOutputProcessor::Reset() {
+  JXL_RETURN_IF_ERROR(Flush());
+  position_ = 0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  finalized_position_ = 0;
+  return true;
+}
+
+uint64_t AsyncOutputProcessor::finalized_position() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return finalized_position_;
+}
+
+void* AsyncOutputProcessor::GetBuffer(size_t* size) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const auto free_buffer = [this]() {
+    return std::find(buffer_in_use_, buffer_in_use_ + kNumBuffers, false) -
+           buffer_in_use_;
+  };
+  cv_.wait(lock, [&] { return free_buffer() != kNumBuffers || !status_; });
+  if (!status_) {
+    // Asks the encoder to stop.
+    *size = 0;
+    return nullptr;
+  }
+  active_buffer_ = free_buffer();
+  buffer_in_use_[active_buffer_] = true;
+  std::vector<uint8_t>& buffer = buffers_[active_buffer_];
+  if (*size == 0 || *size > buffer.size()) *size = buffer.size();
+  return buffer.data();
+}
+
+void AsyncOutputProcessor::ReleaseBuffer(size_t written_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const size_t buffer = active_buffer_;
+  active_buffer_ = kNoBuffer;
+  if (written_bytes == 0) {
+    buffer_in_use_[buffer] = false;
+  } else {
+    requests_.push_back({buffer, position_, written_bytes});
+    position_ += written_bytes;
+  }
+  cv_.notify_all();
+}
+
+void AsyncOutputProcessor::Seek(uint64_t position) { position_ = position; }
+
+void AsyncOutputProcessor::SetFinalizedPosition(uint64_t finalized_position) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  requests_.push_back({kNoBuffer, finalized_position, 0});
+  cv_.notify_all();
+}
+
+void AsyncOutputProcessor::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    cv_.wait(lock, [this] { return !requests_.empty() || stopped_; });
+    // Pending requests are still written when stopping.
+    if (requests_.empty()) return;
+    const Request request = requests_.front();
+    requests_.pop_front();
+    writing_ = true;
+    Status status = status_;
+    lock.unlock();
+    if (request.buffer == kNoBuffer) {
+      if (status && on_finalized_) on_finalized_(request.position);
+    } else if (status) {
+      status = write_(request.position, buffers_[request.buffer].data(),
+                      request.size);
+    }
+    lock.lock();
+    writing_ = false;
+    if (request.buffer == kNoBuffer) {
+      finalized_position_ = request.position;
+    } else {
+      buffer_in_use_[request.buffer] = false;
+    }
+    if (!status) status_ = status;
+    cv_.notify_all();
+  }
+}
+
+}  // namespace extras
+}  // namespace jxl
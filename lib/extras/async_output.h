@@ -0,0 +1,109 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_EXTRAS_ASYNC_OUTPUT_H_
+#define LIB_EXTRAS_ASYNC_OUTPUT_H_
+
+#include <jxl/encode.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+// Output processor for JxlEncoderSetOutputProcessor that writes the encoded
+// data on its own thread, so that the encoder fills the next buffer while the
+// previous one is still being written, e.g. to the network. When all the
+// buffers are waiting to be written, the encoder waits for one of them.
+class AsyncOutputProcessor {
+ public:
+  // Writes `size` bytes at `position` in the output. Called on the writer
+  // thread, in the order of the writes of the encoder; later writes at the
+  // same positions replace the earlier ones. The first error stops the
+  // encoder.
+  using WriteFunc =
+      std::function<Status(uint64_t position, const uint8_t* data, size_t size)>;
+  // Called on the writer thread once all the bytes before `position` are
+  // written and will not change anymore, i.e. can be uploaded or flushed.
+  using FinalizedFunc = std::function<void(uint64_t position)>;
+
+  // With `seekable`, the encoder writes the sections of the output that it
+  // completes later (e.g. the table of contents) directly at their position.
+  // Otherwise, it keeps them in memory until all the bytes before them are
+  // known, and `write` is only called at increasing positions.
+  explicit AsyncOutputProcessor(WriteFunc write,
+                                FinalizedFunc on_finalized = nullptr,
+                                bool seekable = true,
+                                size_t buffer_size = 1 << 20);
+  AsyncOutputProcessor(const AsyncOutputProcessor&) = delete;
+  AsyncOutputProcessor& operator=(const AsyncOutputProcessor&) = delete;
+  ~AsyncOutputProcessor();
+
+  JxlEncoderOutputProcessor GetOutputProcessor();
+
+  // Waits until all the buffers released so far are written, and returns the
+  // first error of `write`, if any.
+  Status Flush();
+
+  // Flushes, then starts again at the beginning of the output.
+  Status Reset();
+
+  // Position finalized by the encoder, which is the size of the output once
+  // the encoding is done.
+  uint64_t finalized_position() const;
+
+ private:
+  // Number of buffers, the one that the encoder fills and the one that is
+  // being written.
+  static constexpr size_t kNumBuffers = 2;
+  // Index of the write requests that only finalize a position.
+  static constexpr size_t kNoBuffer = kNumBuffers;
+
+  struct Request {
+    size_t buffer;
+    uint64_t position;
+    size_t size;
+  };
+
+  void* GetBuffer(size_t* size);
+  void ReleaseBuffer(size_t written_bytes);
+  void Seek(uint64_t position);
+  void SetFinalizedPosition(uint64_t finalized_position);
+
+  void Run();
+
+  WriteFunc write_;
+  FinalizedFunc on_finalized_;
+  bool seekable_;
+  std::vector<uint8_t> buffers_[kNumBuffers];
+  bool buffer_in_use_[kNumBuffers] = {};
+
+  // Only used by the encoder thread.
+  size_t active_buffer_ = kNoBuffer;
+  uint64_t position_ = 0;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Request> requests_;
+  bool writing_ = false;
+  bool stopped_ = false;
+  uint64_t finalized_position_ = 0;
+  Status status_ = true;
+  std::thread thread_;
+};
+
+}  // namespace extras
+}  // namespace jxl
+
+#endif  // LIB_EXTRAS_ASYNC_OUTPUT_H_
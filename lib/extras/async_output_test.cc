@@ -0,0 +1,107 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/async_output.h"
+
+#include <jxl/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "lib/extras/dec/jxl.h"
+#include "lib/extras/enc/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/test_image.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace extras {
+namespace {
+
+constexpr size_t kXSize = 300;
+constexpr size_t kYSize = 200;
+
+void MakeImage(test::TestImage* image) {
+  ASSERT_TRUE(image->SetDimensions(kXSize, kYSize));
+  image->SetDataType(JXL_TYPE_UINT8);
+  ASSERT_TRUE(image->SetChannels(3));
+  image->SetAllBitDepths(8);
+  JXL_TEST_ASSIGN_OR_DIE(auto frame, image->AddFrame());
+  frame.RandomFill();
+}
+
+class AsyncOutputTest : public ::testing::TestWithParam<bool> {};
+
+JXL_GTEST_INSTANTIATE_TEST_SUITE_P(AsyncOutputTestInstantiation,
+                                   AsyncOutputTest, testing::Bool());
+
+TEST_P(AsyncOutputTest, WritesDecodableOutput) {
+  const bool seekable = GetParam();
+  test::TestImage image;
+  MakeImage(&image);
+  std::vector<uint8_t> output;
+  uint64_t last_finalized = 0;
+  // Small buffers, so that the writes of the encoder span many of them.
+  AsyncOutputProcessor processor(
+      [&](uint64_t position, const uint8_t* data, size_t size) -> Status {
+        if (!seekable && position != output.size()) {
+          return JXL_FAILURE("Unexpected write at %d",
+                             static_cast<int>(position));
+        }
+        if (output.size() < position + size) output.resize(position + size);
+        memcpy(output.data() + position, data, size);
+        return true;
+      },
+      [&](uint64_t position) {
+        EXPECT_GE(position, last_finalized);
+        EXPECT_LE(position, output.size());
+        last_finalized = position;
+      },
+      seekable, /*buffer_size=*/256);
+  JXLCompressParams params;
+  params.output_processor = processor.GetOutputProcessor();
+  ASSERT_TRUE(EncodeImageJXL(params, image.ppf(), /*jpeg_bytes=*/nullptr,
+                             /*compressed=*/nullptr));
+  ASSERT_TRUE(processor.Flush());
+  EXPECT_EQ(processor.finalized_position(), output.size());
+  EXPECT_EQ(last_finalized, output.size());
+
+  PackedPixelFile decoded;
+  ASSERT_TRUE(DecodeImageJXL(output.data(), output.size(),
+                             JXLDecompressParams(), /*decoded_bytes=*/nullptr,
+                             &decoded));
+  EXPECT_EQ(decoded.info.xsize, kXSize);
+  EXPECT_EQ(decoded.info.ysize, kYSize);
+}
+
+TEST(AsyncOutputTest, StopsEncoderAfterWriteError) {
+  test::TestImage image;
+  MakeImage(&image);
+  size_t num_writes = 0;
+  AsyncOutputProcessor processor(
+      [&](uint64_t /*position*/, const uint8_t* /*data*/,
+          size_t /*size*/) -> Status {
+        num_writes++;
+        return JXL_FAILURE("Write error");
+      },
+      nullptr, /*seekable=*/true, /*buffer_size=*/64);
+  JXLCompressParams params;
+  params.output_processor = processor.GetOutputProcessor();
+  const bool encoded = EncodeImageJXL(params, image.ppf(),
+                                      /*jpeg_bytes=*/nullptr,
+                                      /*compressed=*/nullptr);
+  const bool flushed = processor.Flush();
+  EXPECT_FALSE(encoded && flushed);
+  EXPECT_FALSE(flushed);
+  EXPECT_EQ(num_writes, 1u);
+}
+
+}  // namespace
+}  // namespace extras
+}  // namespace jxl
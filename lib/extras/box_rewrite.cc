@@ -0,0 +1,210 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/box_rewrite.h"
+
+#include <jxl/decode.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+namespace {
+
+constexpr uint8_t kContainerHeader[] = {
+    0, 0, 0, 0xC, 'J', 'X', 'L', ' ', 0xD, 0xA, 0x87, 0xA,  // signature box
+    0, 0, 0, 0x14, 'f', 't', 'y', 'p', 'j', 'x', 'l', ' ',  // ftyp box
+    0, 0, 0, 0, 'j', 'x', 'l', ' '};
+
+bool IsType(const char* type, const char* expected) {
+  return memcmp(type, expected, 4) == 0;
+}
+
+void AppendBE32(uint32_t value, std::vector<uint8_t>* out) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out->push_back(static_cast<uint8_t>(value >> shift));
+  }
+}
+
+void AppendBox(const char* type, const uint8_t* prefix, size_t prefix_size,
+               const uint8_t* contents, size_t contents_size,
+               std::vector<uint8_t>* out) {
+  const uint64_t box_size = 8 + prefix_size + contents_size;
+  if (box_size <= UINT32_MAX) {
+    AppendBE32(static_cast<uint32_t>(box_size), out);
+    out->insert(out->end(), type, type + 4);
+  } else {
+    AppendBE32(1, out);
+    out->insert(out->end(), type, type + 4);
+    AppendBE32(static_cast<uint32_t>((box_size + 8) >> 32), out);
+    AppendBE32(static_cast<uint32_t>(box_size + 8), out);
+  }
+  out->insert(out->end(), prefix, prefix + prefix_size);
+  out->insert(out->end(), contents, contents + contents_size);
+}
+
+}  // namespace
+
+Status RewriteJXLBoxes(const uint8_t* data, size_t size,
+                       const JXLBoxRewriteParams& params,
+                       std::vector<uint8_t>* out) {
+  out->clear();
+  for (const auto& box : params.add_boxes) {
+    const char* type = box.type.c_str();
+    if (box.type.size() != 4 || IsType(type, "JXL ") ||
+        IsType(type, "ftyp") || IsType(type, "jxlc") ||
+        IsType(type, "jxlp") || IsType(type, "brob")) {
+      return JXL_FAILURE("Cannot add a box of type %s", type);
+    }
+  }
+  size_t num_boxes = 0;
+  if (JxlScanBoxes(data, size, nullptr, 0, &num_boxes) != JXL_DEC_SUCCESS) {
+    return JXL_FAILURE("Invalid or truncated file");
+  }
+  std::vector<JxlBoxIndexEntry> boxes(num_boxes);
+  if (JxlScanBoxes(data, size, boxes.data(), num_boxes, &num_boxes) !=
+      JXL_DEC_SUCCESS) {
+    return JXL_FAILURE("Invalid or truncated file");
+  }
+
+  // The codestream, and the boxes to keep before and after it.
+  std::vector<uint8_t> codestream;
+  std::vector<const JxlBoxIndexEntry*> before;
+  std::vector<const JxlBoxIndexEntry*> after;
+  if (boxes.empty()) {
+    codestream.assign(data, data + size);
+  }
+  bool found_codestream = false;
+  bool last_jxlp = false;
+  uint32_t jxlp_index = 0;
+  for (const JxlBoxIndexEntry& box : boxes) {
+    if (box.contents_offset + box.contents_size > size) {
+      return JXL_FAILURE("Truncated file");
+    }
+    const uint8_t* contents = data + box.contents_offset;
+    if (box.compressed) {
+      // Neither the container itself nor the codestream can be compressed.
+      if (IsType(box.type, "jxlc") || IsType(box.type, "jxlp")) {
+        return JXL_FAILURE("Invalid brob box");
+      }
+    } else if (IsType(box.type, "JXL ") || IsType(box.type, "ftyp")) {
+      continue;
+    } else if (IsType(box.type, "jxlc")) {
+      if (found_codestream) return JXL_FAILURE("Several codestream boxes");
+      found_codestream = true;
+      last_jxlp = true;
+      codestream.assign(contents, contents + box.contents_size);
+      continue;
+    } else if (IsType(box.type, "jxlp")) {
+      if (box.contents_size < 4 || last_jxlp) {
+        return JXL_FAILURE("Invalid jxlp box");
+      }
+      uint32_t index = (static_cast<uint32_t>(contents[0]) << 24) |
+                       (static_cast<uint32_t>(contents[1]) << 16) |
+                       (static_cast<uint32_t>(contents[2]) << 8) | contents[3];
+      if ((index & 0x7FFFFFFF) != jxlp_index) {
+        return JXL_FAILURE("Out of order jxlp box");
+      }
+      found_codestream = true;
+      last_jxlp = (index & 0x80000000) != 0;
+      jxlp_index++;
+      codestream.insert(codestream.end(), contents + 4,
+                        contents + box.contents_size);
+      continue;
+    }
+    const auto& remove = params.remove_types;
+    if (std::find(remove.begin(), remove.end(),
+                  std::string(box.type, box.type + 4)) != remove.end()) {
+      continue;
+    }
+    (found_codestream ? after : before).push_back(&box);
+  }
+  if (!boxes.empty() && !last_jxlp) {
+    return JXL_FAILURE("Missing codestream");
+  }
+
+  if (!params.use_container) {
+    for (const auto* box_list : {&before, &after}) {
+      for (const JxlBoxIndexEntry* box : *box_list) {
+        // A level 5 box only states the default of bare codestreams.
+        if (!box->compressed && IsType(box->type, "jxll") &&
+            box->contents_size == 1 && data[box->contents_offset] == 5) {
+          continue;
+        }
+        return JXL_FAILURE("The %.4s box needs a container", box->type);
+      }
+    }
+    if (!params.add_boxes.empty()) {
+      return JXL_FAILURE("The added boxes need a container");
+    }
+    *out = std::move(codestream);
+    return true;
+  }
+
+  out->reserve(codestream.size() + size / 64 + 64);
+  out->assign(kContainerHeader, kContainerHeader + sizeof(kContainerHeader));
+  const auto append_kept = [&](const JxlBoxIndexEntry* box) {
+    const uint8_t* contents = data + box->contents_offset;
+    if (box->compressed) {
+      // The compressed box type is the start of the brob box contents.
+      AppendBox("brob", contents - 4, 4, contents, box->contents_size, out);
+    } else {
+      AppendBox(box->type, nullptr, 0, contents, box->contents_size, out);
+    }
+  };
+  for (const JxlBoxIndexEntry* box : before) append_kept(box);
+  for (const auto& box : params.add_boxes) {
+    AppendBox(box.type.c_str(), nullptr, 0, box.contents.data(),
+              box.contents.size(), out);
+  }
+  if (params.jxlp_size == 0 || codestream.size() <= params.jxlp_size) {
+    AppendBox("jxlc", nullptr, 0, codestream.data(), codestream.size(), out);
+  } else {
+    uint32_t index = 0;
+    for (size_t pos = 0; pos < codestream.size(); pos += params.jxlp_size) {
+      const size_t part = std::min(params.jxlp_size, codestream.size() - pos);
+      uint32_t value = index++;
+      if (pos + part == codestream.size()) value |= 0x80000000;
+      const uint8_t prefix[4] = {
+          static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16),
+          static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+      AppendBox("jxlp", prefix, 4, codestream.data() + pos, part, out);
+    }
+  }
+  for (const JxlBoxIndexEntry* box : after) append_kept(box);
+  return true;
+}
+
+Status ExtractJXLCodestream(const uint8_t* data, size_t size,
+                            std::vector<uint8_t>* codestream) {
+  size_t num_boxes = 0;
+  if (JxlScanBoxes(data, size, nullptr, 0, &num_boxes) != JXL_DEC_SUCCESS) {
+    return JXL_FAILURE("Invalid or truncated file");
+  }
+  std::vector<JxlBoxIndexEntry> boxes(num_boxes);
+  if (JxlScanBoxes(data, size, boxes.data(), num_boxes, &num_boxes) !=
+      JXL_DEC_SUCCESS) {
+    return JXL_FAILURE("Invalid or truncated file");
+  }
+  JXLBoxRewriteParams params;
+  params.use_container = false;
+  // The container and codestream boxes are not affected by the list.
+  for (const JxlBoxIndexEntry& box : boxes) {
+    params.remove_types.emplace_back(box.type, box.type + 4);
+  }
+  return RewriteJXLBoxes(data, size, params, codestream);
+}
+
+}  // namespace extras
+}  // namespace jxl
@@ -0,0 +1,59 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_EXTRAS_BOX_REWRITE_H_
+#define LIB_EXTRAS_BOX_REWRITE_H_
+
+// Rewrites the boxes of JPEG XL files without decoding their codestream.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+struct JXLBoxRewriteParams {
+  struct Box {
+    // Four characters, e.g. "Exif", "xml " or "jhgm".
+    std::string type;
+    std::vector<uint8_t> contents;
+  };
+  // Types of the boxes to remove. A "brob" box is removed if the type of its
+  // compressed box is listed.
+  std::vector<std::string> remove_types;
+  // Boxes to add before the codestream, after the kept boxes that were before
+  // it. They are stored uncompressed.
+  std::vector<Box> add_boxes;
+  // If false, the output is a bare codestream, which fails if boxes other than
+  // those of the container itself remain.
+  bool use_container = true;
+  // If not zero, the codestream is split into "jxlp" boxes of at most this
+  // many bytes, otherwise it is stored in a single "jxlc" box.
+  size_t jxlp_size = 0;
+};
+
+// Writes to `out` the JPEG XL file `data`, either a bare codestream or a
+// container, with its boxes changed as given by `params`. The codestream is
+// copied byte for byte, and so are the contents of the kept boxes, including
+// the still compressed "brob" boxes. The kept boxes stay in the same order,
+// and before or after the codestream as they were. The frame index box "jxli"
+// stays valid, since its offsets are within the codestream.
+Status RewriteJXLBoxes(const uint8_t* data, size_t size,
+                       const JXLBoxRewriteParams& params,
+                       std::vector<uint8_t>* out);
+
+// Writes to `codestream` the codestream of the JPEG XL file `data`, without
+// its boxes.
+Status ExtractJXLCodestream(const uint8_t* data, size_t size,
+                            std::vector<uint8_t>* codestream);
+
+}  // namespace extras
+}  // namespace jxl
+
+#endif  // LIB_EXTRAS_BOX_REWRITE_H_
@@ -0,0 +1,136 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/box_rewrite.h"
+
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "lib/extras/dec/jxl.h"
+#include "lib/extras/enc/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/test_image.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace extras {
+namespace {
+
+std::vector<uint8_t> Bytes(const std::string& s) {
+  return std::vector<uint8_t>(s.begin(), s.end());
+}
+
+std::vector<uint8_t> EncodeTestImage() {
+  test::TestImage image;
+  EXPECT_TRUE(image.SetDimensions(300, 200));
+  image.SetDataType(JXL_TYPE_UINT8);
+  EXPECT_TRUE(image.SetChannels(3));
+  image.SetAllBitDepths(8);
+  JXL_TEST_ASSIGN_OR_DIE(auto frame, image.AddFrame());
+  frame.RandomFill();
+  PackedPixelFile& ppf = image.ppf();
+  ppf.metadata.xmp = Bytes("<x:xmpmeta>original</x:xmpmeta>");
+  JXLCompressParams params;
+  params.use_container = true;
+  params.compress_boxes = true;
+  std::vector<uint8_t> compressed;
+  EXPECT_TRUE(EncodeImageJXL(params, ppf, /*jpeg_bytes=*/nullptr,
+                             &compressed));
+  return compressed;
+}
+
+PackedPixelFile Decode(const std::vector<uint8_t>& compressed) {
+  PackedPixelFile ppf;
+  JXLDecompressParams dparams;
+  dparams.accepted_formats = {{3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}};
+  EXPECT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(), dparams,
+                             /*decoded_bytes=*/nullptr, &ppf));
+  return ppf;
+}
+
+bool SamePixels(const PackedPixelFile& a, const PackedPixelFile& b) {
+  const PackedImage& ca = a.frames[0].color;
+  const PackedImage& cb = b.frames[0].color;
+  const uint8_t* pa = static_cast<const uint8_t*>(ca.pixels());
+  const uint8_t* pb = static_cast<const uint8_t*>(cb.pixels());
+  return ca.pixels_size == cb.pixels_size &&
+         std::equal(pa, pa + ca.pixels_size, pb);
+}
+
+std::vector<uint8_t> Codestream(const std::vector<uint8_t>& compressed) {
+  JXLBoxRewriteParams params;
+  params.use_container = false;
+  params.remove_types = {"xml "};
+  std::vector<uint8_t> codestream;
+  EXPECT_TRUE(RewriteJXLBoxes(compressed.data(), compressed.size(), params,
+                              &codestream));
+  return codestream;
+}
+
+TEST(BoxRewriteTest, ReplacesMetadataAndSplitsCodestream) {
+  const std::vector<uint8_t> compressed = EncodeTestImage();
+  const PackedPixelFile expected = Decode(compressed);
+  ASSERT_EQ(expected.metadata.xmp, Bytes("<x:xmpmeta>original</x:xmpmeta>"));
+
+  JXLBoxRewriteParams params;
+  params.remove_types = {"xml "};
+  params.add_boxes = {{"xml ", Bytes("<x:xmpmeta>new</x:xmpmeta>")}};
+  params.jxlp_size = 100;
+  std::vector<uint8_t> rewritten;
+  ASSERT_TRUE(RewriteJXLBoxes(compressed.data(), compressed.size(), params,
+                              &rewritten));
+  const PackedPixelFile decoded = Decode(rewritten);
+  EXPECT_EQ(decoded.metadata.xmp, Bytes("<x:xmpmeta>new</x:xmpmeta>"));
+  EXPECT_TRUE(SamePixels(decoded, expected));
+  EXPECT_EQ(Codestream(rewritten), Codestream(compressed));
+}
+
+TEST(BoxRewriteTest, KeepsCompressedBoxes) {
+  const std::vector<uint8_t> compressed = EncodeTestImage();
+  JXLBoxRewriteParams params;
+  params.jxlp_size = 1000;
+  std::vector<uint8_t> rewritten;
+  ASSERT_TRUE(RewriteJXLBoxes(compressed.data(), compressed.size(), params,
+                              &rewritten));
+  const PackedPixelFile decoded = Decode(rewritten);
+  EXPECT_EQ(decoded.metadata.xmp, Bytes("<x:xmpmeta>original</x:xmpmeta>"));
+  EXPECT_TRUE(SamePixels(decoded, Decode(compressed)));
+
+  // Back to a single jxlc box.
+  std::vector<uint8_t> joined;
+  ASSERT_TRUE(RewriteJXLBoxes(rewritten.data(), rewritten.size(),
+                              JXLBoxRewriteParams(), &joined));
+  EXPECT_EQ(Codestream(joined), Codestream(compressed));
+}
+
+TEST(BoxRewriteTest, BareCodestream) {
+  const std::vector<uint8_t> compressed = EncodeTestImage();
+  JXLBoxRewriteParams params;
+  params.use_container = false;
+  std::vector<uint8_t> rewritten;
+  // The metadata box needs the container.
+  EXPECT_FALSE(RewriteJXLBoxes(compressed.data(), compressed.size(), params,
+                               &rewritten));
+
+  const std::vector<uint8_t> codestream = Codestream(compressed);
+  EXPECT_TRUE(SamePixels(Decode(codestream), Decode(compressed)));
+  // From a bare codestream to a container and back.
+  params.use_container = true;
+  params.add_boxes = {{"xml ", Bytes("<x:xmpmeta>added</x:xmpmeta>")}};
+  ASSERT_TRUE(RewriteJXLBoxes(codestream.data(), codestream.size(), params,
+                              &rewritten));
+  EXPECT_EQ(Decode(rewritten).metadata.xmp,
+            Bytes("<x:xmpmeta>added</x:xmpmeta>"));
+  EXPECT_EQ(Codestream(rewritten), codestream);
+}
+
+}  // namespace
+}  // namespace extras
+}  // namespace jxl
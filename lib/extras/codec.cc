@@ -74,6 +74,8 @@ Status Encode(const extras::PackedPixelFile& ppf, const extras::Codec codec,
       break;
     case extras::Codec::kGIF:
       return JXL_FAILURE("Encoding to GIF is not implemented");
+    case extras::Codec::kY4M:
+      return JXL_FAILURE("Encoding to Y4M is not implemented");
     case extras::Codec::kEXR:
       encoder = extras::GetEXREncoder();
       if (encoder) {
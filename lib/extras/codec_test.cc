@@ -24,6 +24,7 @@
 #include "lib/extras/dec/color_hints.h"
 #include "lib/extras/dec/decode.h"
 #include "lib/extras/enc/encode.h"
+#include "lib/extras/enc/exr.h"
 #include "lib/extras/packed_image.h"
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/compiler_specific.h"
@@ -496,6 +497,52 @@ TEST(CodecTest, EncodeToPNG) {
                   decoded_ppf.info.bits_per_sample);
 }
 
+TEST(CodecTest, EXRHalfRoundtrip) {
+  std::unique_ptr<Encoder> exr_encoder = GetEXREncoder();
+  if (!exr_encoder || !CanDecode(Codec::kEXR)) {
+    GTEST_SKIP() << "EXR is not supported";
+  }
+  ThreadPoolForTests pool(4);
+  PackedPixelFile ppf;
+  ppf.info.xsize = 13;
+  ppf.info.ysize = 5;
+  ppf.info.num_color_channels = 3;
+  ppf.info.bits_per_sample = 16;
+  ppf.info.exponent_bits_per_sample = 5;
+  ppf.info.alpha_bits = 16;
+  ppf.info.alpha_exponent_bits = 5;
+  ppf.info.alpha_premultiplied = JXL_TRUE;
+  ppf.color_encoding.color_space = JXL_COLOR_SPACE_RGB;
+  ppf.color_encoding.white_point = JXL_WHITE_POINT_D65;
+  ppf.color_encoding.primaries = JXL_PRIMARIES_SRGB;
+  ppf.color_encoding.transfer_function = JXL_TRANSFER_FUNCTION_LINEAR;
+  const JxlPixelFormat format = {4, JXL_TYPE_FLOAT16, JXL_LITTLE_ENDIAN, 0};
+  JXL_TEST_ASSIGN_OR_DIE(
+      PackedFrame frame,
+      PackedFrame::Create(ppf.info.xsize, ppf.info.ysize, format));
+  // Positive halves below 1, which are premultiplied as they are.
+  Rng rng(0);
+  uint16_t* samples = static_cast<uint16_t*>(frame.color.pixels());
+  for (size_t i = 0; i < frame.color.pixels_size / 2; ++i) {
+    samples[i] = rng.UniformU(0, 0x3C00);
+  }
+  ppf.frames.emplace_back(std::move(frame));
+
+  EncodedImage encoded;
+  ASSERT_TRUE(exr_encoder->Encode(ppf, &encoded, pool.get()));
+  ASSERT_EQ(encoded.bitstreams.size(), 1);
+  PackedPixelFile decoded_ppf;
+  ASSERT_TRUE(DecodeBytes(Bytes(encoded.bitstreams[0]), ColorHints(),
+                          &decoded_ppf));
+  ASSERT_EQ(decoded_ppf.frames.size(), 1);
+  const PackedImage& decoded = decoded_ppf.frames[0].color;
+  ASSERT_EQ(decoded.format.data_type, JXL_TYPE_FLOAT16);
+  ASSERT_EQ(decoded.pixels_size, ppf.frames[0].color.pixels_size);
+  // The halves are not converted on the way.
+  EXPECT_EQ(0, memcmp(decoded.pixels(), ppf.frames[0].color.pixels(),
+                      decoded.pixels_size));
+}
+
 }  // namespace
 }  // namespace extras
 }  // namespace jxl
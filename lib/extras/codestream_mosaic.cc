@@ -0,0 +1,274 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/codestream_mosaic.h"
+
+#include <jxl/memory_manager.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "lib/extras/box_rewrite.h"
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/span.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/coeff_order_fwd.h"
+#include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/enc_aux_out.h"
+#include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/enc_fields.h"
+#include "lib/jxl/enc_icc_codec.h"
+#include "lib/jxl/enc_toc.h"
+#include "lib/jxl/fields.h"
+#include "lib/jxl/frame_dimensions.h"
+#include "lib/jxl/frame_header.h"
+#include "lib/jxl/headers.h"
+#include "lib/jxl/icc_codec.h"
+#include "lib/jxl/image_metadata.h"
+#include "lib/jxl/padded_bytes.h"
+#include "lib/jxl/toc.h"
+
+namespace jxl {
+namespace extras {
+
+namespace {
+
+// Reads the codestream headers and ICC profile, and sets `frames_begin` to the
+// start of the first frame.
+Status ReadHeaders(JxlMemoryManager* memory_manager,
+                   const std::vector<uint8_t>& codestream,
+                   CodecMetadata* metadata, std::vector<uint8_t>* icc,
+                   size_t* frames_begin) {
+  if (codestream.size() < 2 || codestream[0] != 0xFF ||
+      codestream[1] != kCodestreamMarker) {
+    return JXL_FAILURE("Invalid codestream signature");
+  }
+  Status ret = true;
+  {
+    BitReader reader(Bytes(codestream.data() + 2, codestream.size() - 2));
+    BitReaderScopedCloser reader_closer(reader, ret);
+    JXL_RETURN_IF_ERROR(ReadSizeHeader(&reader, &metadata->size));
+    JXL_RETURN_IF_ERROR(ReadImageMetadata(&reader, &metadata->m));
+    metadata->transform_data.nonserialized_xyb_encoded =
+        metadata->m.xyb_encoded;
+    JXL_RETURN_IF_ERROR(Bundle::Read(&reader, &metadata->transform_data));
+    icc->clear();
+    if (metadata->m.color_encoding.WantICC()) {
+      ICCReader icc_reader(memory_manager);
+      JXL_RETURN_IF_ERROR(icc_reader.Init(&reader, /*output_limit=*/0));
+      PaddedBytes decoded_icc(memory_manager);
+      JXL_RETURN_IF_ERROR(icc_reader.Process(&reader, &decoded_icc));
+      icc->assign(decoded_icc.data(), decoded_icc.data() + decoded_icc.size());
+    }
+    JXL_RETURN_IF_ERROR(reader.JumpToByteBoundary());
+    JXL_RETURN_IF_ERROR(reader.AllReadsWithinBounds());
+    *frames_begin = 2 + reader.TotalBitsConsumed() / kBitsPerByte;
+  }
+  return ret;
+}
+
+Status WriteHeaders(JxlMemoryManager* memory_manager, CodecMetadata* metadata,
+                    const std::vector<uint8_t>& icc,
+                    std::vector<uint8_t>* out) {
+  BitWriter writer(memory_manager);
+  JXL_RETURN_IF_ERROR(WriteCodestreamHeaders(metadata, &writer, nullptr));
+  if (metadata->m.color_encoding.WantICC()) {
+    JXL_RETURN_IF_ERROR(
+        WriteICC(Bytes(icc), &writer, LayerType::Header, nullptr));
+  }
+  BitWriter::Allotment allotment(&writer, 8);
+  writer.ZeroPadToByte();
+  JXL_RETURN_IF_ERROR(
+      allotment.ReclaimAndCharge(&writer, LayerType::Header, nullptr));
+  const Span<const uint8_t> bytes = writer.GetSpan();
+  out->assign(bytes.begin(), bytes.end());
+  return true;
+}
+
+// The header and TOC of a frame, and where its sections are.
+struct TileFrame {
+  explicit TileFrame(const CodecMetadata* metadata) : header(metadata) {}
+  FrameHeader header;
+  std::vector<uint32_t> sizes;
+  std::vector<coeff_order_t> permutation;
+  size_t sections_begin = 0;
+  size_t sections_end = 0;
+};
+
+Status ReadFrame(JxlMemoryManager* memory_manager,
+                 const std::vector<uint8_t>& codestream, size_t pos,
+                 TileFrame* frame) {
+  if (pos >= codestream.size()) return JXL_FAILURE("Missing frame");
+  Status ret = true;
+  {
+    BitReader reader(Bytes(codestream.data() + pos, codestream.size() - pos));
+    BitReaderScopedCloser reader_closer(reader, ret);
+    JXL_RETURN_IF_ERROR(ReadFrameHeader(&reader, &frame->header));
+    const FrameDimensions frame_dim = frame->header.ToFrameDimensions();
+    const size_t toc_entries =
+        NumTocEntries(frame_dim.num_groups, frame_dim.num_dc_groups,
+                      frame->header.passes.num_passes);
+    JXL_RETURN_IF_ERROR(ReadToc(memory_manager, toc_entries, &reader,
+                                &frame->sizes, &frame->permutation));
+    JXL_RETURN_IF_ERROR(reader.AllReadsWithinBounds());
+    frame->sections_begin = pos + reader.TotalBitsConsumed() / kBitsPerByte;
+  }
+  JXL_RETURN_IF_ERROR(ret);
+  uint64_t sections_size = 0;
+  for (uint32_t size : frame->sizes) sections_size += size;
+  if (sections_size > codestream.size() - frame->sections_begin) {
+    return JXL_FAILURE("Truncated frame");
+  }
+  frame->sections_end = frame->sections_begin + sections_size;
+  return true;
+}
+
+// Changes the header of a frame of `tile` for the mosaic. The regular frame
+// of a tile is moved to its position, and saved in the reference slot 0 on
+// which the next tile is blended. The frames before it can only be patch
+// sources, which are kept in the other slots.
+Status PlaceFrame(const JXLMosaicTile& tile,
+                  const CodecMetadata& tile_metadata, bool is_last_tile,
+                  FrameHeader* header) {
+  if (header->extensions != 0) {
+    return JXL_FAILURE("Unknown frame header extensions");
+  }
+  const int64_t xsize = tile_metadata.xsize();
+  const int64_t ysize = tile_metadata.ysize();
+  if (header->frame_type == FrameType::kReferenceOnly) {
+    if (!header->save_before_color_transform ||
+        header->save_as_reference == 0) {
+      return JXL_FAILURE("Unsupported reference frame");
+    }
+    // Its default size is the one of the image.
+    if (!header->custom_size_or_origin) {
+      header->custom_size_or_origin = true;
+      header->frame_size.xsize = xsize;
+      header->frame_size.ysize = ysize;
+    }
+    return true;
+  }
+  if (header->frame_type != FrameType::kRegularFrame || !header->is_last ||
+      (header->flags & FrameHeader::kUseDcFrame) != 0) {
+    return JXL_FAILURE("Only tiles of a single regular frame are supported");
+  }
+  bool replace_all = header->blending_info.mode == BlendMode::kReplace;
+  for (const BlendingInfo& info : header->extra_channel_blending_info) {
+    replace_all &= info.mode == BlendMode::kReplace;
+  }
+  if (!replace_all) return JXL_FAILURE("Unsupported frame blending");
+  if (!header->custom_size_or_origin) {
+    header->custom_size_or_origin = true;
+    header->frame_origin.x0 = 0;
+    header->frame_origin.y0 = 0;
+    header->frame_size.xsize = xsize;
+    header->frame_size.ysize = ysize;
+  }
+  const int64_t x0 = static_cast<int64_t>(header->frame_origin.x0) + tile.x0;
+  const int64_t y0 = static_cast<int64_t>(header->frame_origin.y0) + tile.y0;
+  constexpr int64_t kMaxOrigin = std::numeric_limits<int32_t>::max() / 2;
+  if (x0 < -kMaxOrigin || x0 > kMaxOrigin || y0 < -kMaxOrigin ||
+      y0 > kMaxOrigin) {
+    return JXL_FAILURE("Tile position out of range");
+  }
+  header->frame_origin.x0 = static_cast<int32_t>(x0);
+  header->frame_origin.y0 = static_cast<int32_t>(y0);
+  header->blending_info.source = 0;
+  for (BlendingInfo& info : header->extra_channel_blending_info) {
+    info.source = 0;
+  }
+  header->is_last = is_last_tile;
+  header->save_as_reference = 0;
+  header->save_before_color_transform = false;
+  return true;
+}
+
+}  // namespace
+
+Status ComposeJXLMosaic(JxlMemoryManager* memory_manager,
+                        const std::vector<JXLMosaicTile>& tiles, size_t xsize,
+                        size_t ysize, std::vector<uint8_t>* out) {
+  out->clear();
+  if (tiles.empty()) return JXL_FAILURE("No tiles");
+  // The headers of the mosaic, which the frame headers depend on.
+  CodecMetadata metadata;
+  std::vector<uint8_t> headers;
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    const JXLMosaicTile& tile = tiles[i];
+    std::vector<uint8_t> codestream;
+    JXL_RETURN_IF_ERROR(
+        ExtractJXLCodestream(tile.data, tile.size, &codestream));
+    CodecMetadata tile_metadata;
+    std::vector<uint8_t> icc;
+    size_t pos;
+    JXL_RETURN_IF_ERROR(
+        ReadHeaders(memory_manager, codestream, &tile_metadata, &icc, &pos));
+    if (tile_metadata.m.have_animation) {
+      return JXL_FAILURE("Animated tiles are not supported");
+    }
+    if (tile_metadata.m.extensions != 0) {
+      return JXL_FAILURE("Unknown image header extensions");
+    }
+
+    CodecMetadata tile_in_mosaic = tile_metadata;
+    JXL_RETURN_IF_ERROR(tile_in_mosaic.size.Set(xsize, ysize));
+    tile_in_mosaic.m.have_preview = false;
+    std::vector<uint8_t> tile_headers;
+    JXL_RETURN_IF_ERROR(
+        WriteHeaders(memory_manager, &tile_in_mosaic, icc, &tile_headers));
+    if (i == 0) {
+      metadata = tile_in_mosaic;
+      headers = tile_headers;
+      out->insert(out->end(), headers.begin(), headers.end());
+    } else if (tile_headers != headers) {
+      return JXL_FAILURE("Tile %" PRIuS " has different image headers", i);
+    }
+
+    if (tile_metadata.m.have_preview) {
+      TileFrame preview(&tile_metadata);
+      preview.header.nonserialized_is_preview = true;
+      JXL_RETURN_IF_ERROR(ReadFrame(memory_manager, codestream, pos, &preview));
+      pos = preview.sections_end;
+    }
+    bool is_last = false;
+    while (!is_last) {
+      TileFrame frame(&tile_metadata);
+      JXL_RETURN_IF_ERROR(ReadFrame(memory_manager, codestream, pos, &frame));
+      is_last = frame.header.is_last;
+      FrameHeader header = frame.header;
+      header.nonserialized_metadata = &metadata;
+      JXL_RETURN_IF_ERROR(
+          PlaceFrame(tile, tile_metadata, i + 1 == tiles.size(), &header));
+      BitWriter writer(memory_manager);
+      JXL_RETURN_IF_ERROR(WriteFrameHeader(header, &writer, nullptr));
+      JXL_RETURN_IF_ERROR(
+          WriteGroupOffsets(frame.sizes, frame.permutation, &writer, nullptr));
+      const Span<const uint8_t> frame_headers = writer.GetSpan();
+      out->insert(out->end(), frame_headers.begin(), frame_headers.end());
+      out->insert(out->end(), codestream.begin() + frame.sections_begin,
+                  codestream.begin() + frame.sections_end);
+      pos = frame.sections_end;
+    }
+  }
+  return true;
+}
+
+Status CropJXL(JxlMemoryManager* memory_manager, const uint8_t* data,
+               size_t size, size_t x0, size_t y0, size_t xsize, size_t ysize,
+               std::vector<uint8_t>* out) {
+  if (x0 > std::numeric_limits<int32_t>::max() ||
+      y0 > std::numeric_limits<int32_t>::max()) {
+    return JXL_FAILURE("Crop position out of range");
+  }
+  const JXLMosaicTile tile = {data, size, -static_cast<int32_t>(x0),
+                              -static_cast<int32_t>(y0)};
+  return ComposeJXLMosaic(memory_manager, {tile}, xsize, ysize, out);
+}
+
+}  // namespace extras
+}  // namespace jxl
@@ -0,0 +1,56 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_EXTRAS_CODESTREAM_MOSAIC_H_
+#define LIB_EXTRAS_CODESTREAM_MOSAIC_H_
+
+// Combines and crops JPEG XL images without decoding or re-encoding them.
+
+#include <jxl/memory_manager.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+struct JXLMosaicTile {
+  // A JPEG XL file, either a bare codestream or a container.
+  const uint8_t* data;
+  size_t size;
+  // Position of the top-left corner of the tile in the mosaic, which may be
+  // outside of it.
+  int32_t x0;
+  int32_t y0;
+};
+
+// Writes to `out` a codestream of `xsize` x `ysize` pixels which shows the
+// given tiles, later tiles over earlier ones, and zeros where there is no
+// tile. Each tile becomes a layer: only its frame headers, TOCs and the
+// codestream headers are rewritten, its sections are copied byte for byte.
+//
+// The tiles must have the same image headers, apart from their size and
+// preview, which is dropped, and be still images of a single regular frame,
+// which may use patches, with kReplace blending. The boxes of the tiles, such
+// as their Exif or XMP metadata, are not kept.
+Status ComposeJXLMosaic(JxlMemoryManager* memory_manager,
+                        const std::vector<JXLMosaicTile>& tiles, size_t xsize,
+                        size_t ysize, std::vector<uint8_t>* out);
+
+// Writes to `out` the `xsize` x `ysize` crop at (`x0`, `y0`) of the JPEG XL
+// image `data`, with the same constraints as ComposeJXLMosaic. The frame keeps
+// all its sections and is cropped by the decoder, so the output is not
+// smaller than the input.
+Status CropJXL(JxlMemoryManager* memory_manager, const uint8_t* data,
+               size_t size, size_t x0, size_t y0, size_t xsize, size_t ysize,
+               std::vector<uint8_t>* out);
+
+}  // namespace extras
+}  // namespace jxl
+
+#endif  // LIB_EXTRAS_CODESTREAM_MOSAIC_H_
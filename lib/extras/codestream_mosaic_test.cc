@@ -0,0 +1,114 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/codestream_mosaic.h"
+
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "lib/extras/dec/jxl.h"
+#include "lib/extras/enc/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/test_image.h"
+#include "lib/jxl/test_memory_manager.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace extras {
+namespace {
+
+std::vector<uint8_t> EncodeTile(size_t xsize, size_t ysize, float distance,
+                                uint16_t seed) {
+  test::TestImage image;
+  EXPECT_TRUE(image.SetDimensions(xsize, ysize));
+  image.SetDataType(JXL_TYPE_UINT8);
+  EXPECT_TRUE(image.SetChannels(3));
+  image.SetAllBitDepths(8);
+  JXL_TEST_ASSIGN_OR_DIE(auto frame, image.AddFrame());
+  frame.RandomFill(seed);
+  JXLCompressParams params;
+  params.distance = distance;
+  std::vector<uint8_t> compressed;
+  EXPECT_TRUE(EncodeImageJXL(params, image.ppf(), /*jpeg_bytes=*/nullptr,
+                             &compressed));
+  return compressed;
+}
+
+PackedImage Decode(const std::vector<uint8_t>& compressed) {
+  PackedPixelFile ppf;
+  JXLDecompressParams dparams;
+  dparams.accepted_formats = {{3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}};
+  EXPECT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(), dparams,
+                             /*decoded_bytes=*/nullptr, &ppf));
+  EXPECT_EQ(ppf.frames.size(), 1);
+  return std::move(ppf.frames[0].color);
+}
+
+// Returns the largest difference between `part` and the pixels of `image` at
+// (x0, y0).
+int MaxDifference(const PackedImage& image, size_t x0, size_t y0,
+                  const PackedImage& part) {
+  int max_diff = 0;
+  for (size_t y = 0; y < part.ysize; ++y) {
+    for (size_t x = 0; x < part.xsize; ++x) {
+      for (size_t c = 0; c < 3; ++c) {
+        const int diff = *image.const_pixels(y0 + y, x0 + x, c) -
+                         *part.const_pixels(y, x, c);
+        max_diff = std::max(max_diff, std::abs(diff));
+      }
+    }
+  }
+  return max_diff;
+}
+
+TEST(CodestreamMosaicTest, ComposesTiles) {
+  const std::vector<uint8_t> left = EncodeTile(300, 100, 0.0f, 1);
+  const std::vector<uint8_t> right = EncodeTile(200, 100, 0.0f, 2);
+  std::vector<uint8_t> mosaic;
+  ASSERT_TRUE(ComposeJXLMosaic(test::MemoryManager(),
+                               {{left.data(), left.size(), 0, 0},
+                                {right.data(), right.size(), 300, 0}},
+                               500, 100, &mosaic));
+  // Only the headers are rewritten.
+  EXPECT_LT(mosaic.size(), left.size() + right.size() + 16);
+  const PackedImage image = Decode(mosaic);
+  ASSERT_EQ(image.xsize, 500);
+  ASSERT_EQ(image.ysize, 100);
+  EXPECT_EQ(MaxDifference(image, 0, 0, Decode(left)), 0);
+  EXPECT_EQ(MaxDifference(image, 300, 0, Decode(right)), 0);
+}
+
+TEST(CodestreamMosaicTest, CropsImage) {
+  const std::vector<uint8_t> compressed = EncodeTile(600, 400, 1.0f, 3);
+  std::vector<uint8_t> cropped;
+  ASSERT_TRUE(CropJXL(test::MemoryManager(), compressed.data(),
+                      compressed.size(), 256, 128, 256, 256, &cropped));
+  const PackedImage crop = Decode(cropped);
+  ASSERT_EQ(crop.xsize, 256);
+  ASSERT_EQ(crop.ysize, 256);
+  EXPECT_LE(MaxDifference(Decode(compressed), 256, 128, crop), 1);
+}
+
+TEST(CodestreamMosaicTest, RejectsDifferentHeaders) {
+  const std::vector<uint8_t> lossless = EncodeTile(100, 100, 0.0f, 4);
+  // XYB instead of the original color space.
+  const std::vector<uint8_t> lossy = EncodeTile(100, 100, 1.0f, 5);
+  std::vector<uint8_t> mosaic;
+  EXPECT_FALSE(ComposeJXLMosaic(test::MemoryManager(),
+                                {{lossless.data(), lossless.size(), 0, 0},
+                                 {lossy.data(), lossy.size(), 100, 0}},
+                                200, 100, &mosaic));
+}
+
+}  // namespace
+}  // namespace extras
+}  // namespace jxl
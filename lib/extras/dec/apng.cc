@@ -39,19 +39,24 @@
 #include <jxl/codestream_header.h>
 #include <jxl/encode.h>
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cstdint>
 #include <cstring>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "lib/extras/frame_queue.h"
+#include "lib/extras/mmap.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/size_constraints.h"
 #include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/c_callback_support.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/printf_macros.h"
@@ -73,6 +78,23 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
                        const SizeConstraints* constraints) {
   return false;
 }
+Status DecodeImageAPNGPipelined(const Span<const uint8_t> bytes,
+                                const ColorHints& color_hints,
+                                PackedPixelFile* ppf,
+                                const SizeConstraints* constraints) {
+  return false;
+}
+
+struct ChunkedPNGDecoderImpl {};
+
+StatusOr<ChunkedPNGDecoder> ChunkedPNGDecoder::Init(const char* file_path) {
+  return JXL_FAILURE("PNG is not supported");
+}
+
+Status ChunkedPNGDecoder::InitializePPF(const ColorHints& color_hints,
+                                        PackedPixelFile* ppf) {
+  return JXL_FAILURE("PNG is not supported");
+}
 
 #else  // JPEGXL_ENABLE_APNG
 
@@ -780,9 +802,13 @@ bool CanDecodeAPNG() { return true; }
  *  - fcTL and fdAT seq# must be in order fro 0, with no gaps or duplicates
  *  - fcTL before corresponding IDAT / fdAT
  */
-Status DecodeImageAPNG(const Span<const uint8_t> bytes,
-                       const ColorHints& color_hints, PackedPixelFile* ppf,
-                       const SizeConstraints* constraints) {
+namespace {
+
+// Decodes `bytes` into `ppf`, or hands the frames over to `queue` as they are
+// decoded, if not null.
+Status DecodeAPNG(const Span<const uint8_t> bytes,
+                  const ColorHints& color_hints, PackedPixelFile* ppf,
+                  const SizeConstraints* constraints, PackedFrameQueue* queue) {
   // Initialize output (default settings in case e.g. only gAMA is given).
   ppf->frames.clear();
   ppf->info.exponent_bits_per_sample = 0;
@@ -844,10 +870,125 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
   uint32_t num_channels;
   JxlPixelFormat format = {};
   size_t bytes_per_pixel = 0;
-  std::vector<Frame> frames;
+  size_t num_frames = 0;
   FrameControl current_frame = {/*delay_num=*/1, /*delay_den=*/10, image_rect,
                                 DisposeOp::NONE, BlendOp::SOURCE};
 
+  bool has_nontrivial_background = false;
+  bool previous_frame_should_be_cleared = false;
+  RectT<uint64_t> previous_viewport;
+  // Adds the frame to ppf->frames, after a blank frame if it is needed to
+  // clear the previous one.
+  const auto add_frame = [&](Frame& frame) -> Status {
+    const FrameControl& fc = frame.metadata;
+    const RectT<uint64_t> vp = fc.viewport;
+    const auto& pixels = frame.pixels;
+    size_t xsize = pixels.xsize;
+    size_t ysize = pixels.ysize;
+    JXL_ENSURE(xsize == vp.xsize());
+    JXL_ENSURE(ysize == vp.ysize());
+
+    // Before encountering a DISPOSE_OP_NONE frame, the canvas is filled with
+    // 0, so DISPOSE_OP_BACKGROUND and DISPOSE_OP_PREVIOUS are equivalent.
+    if (fc.dispose_op == DisposeOp::NONE) {
+      has_nontrivial_background = true;
+    }
+    bool should_blend = fc.blend_op == BlendOp::OVER;
+    bool use_for_next_frame =
+        has_nontrivial_background && fc.dispose_op != DisposeOp::PREVIOUS;
+    size_t x0 = vp.x0();
+    size_t y0 = vp.y0();
+    if (previous_frame_should_be_cleared) {
+      const auto& pvp = previous_viewport;
+      size_t px0 = pvp.x0();
+      size_t py0 = pvp.y0();
+      size_t pxs = pvp.xsize();
+      size_t pys = pvp.ysize();
+      if (px0 >= x0 && py0 >= y0 && px0 + pxs <= x0 + xsize &&
+          py0 + pys <= y0 + ysize && fc.blend_op == BlendOp::SOURCE &&
+          use_for_next_frame) {
+        // If the previous frame is entirely contained in the current frame
+        // and we are using BLEND_OP_SOURCE, nothing special needs to be done.
+        ppf->frames.emplace_back(std::move(frame.pixels));
+      } else if (px0 == x0 && py0 == y0 && px0 + pxs == x0 + xsize &&
+                 py0 + pys == y0 + ysize && use_for_next_frame) {
+        // If the new frame has the same size as the old one, but we are
+        // blending, we can instead just not blend.
+        should_blend = false;
+        ppf->frames.emplace_back(std::move(frame.pixels));
+      } else if (px0 <= x0 && py0 <= y0 && px0 + pxs >= x0 + xsize &&
+                 py0 + pys >= y0 + ysize && use_for_next_frame) {
+        // If the new frame is contained within the old frame, we can pad the
+        // new frame with zeros and not blend.
+        JXL_ASSIGN_OR_RETURN(PackedImage new_data,
+                             PackedImage::Create(pxs, pys, pixels.format));
+        memset(new_data.pixels(), 0, new_data.pixels_size);
+        for (size_t y = 0; y < ysize; y++) {
+          JXL_RETURN_IF_ERROR(
+              PackedImage::ValidateDataType(new_data.format.data_type));
+          size_t bytes_per_pixel =
+              PackedImage::BitsPerChannel(new_data.format.data_type) *
+              new_data.format.num_channels / 8;
+          memcpy(
+              static_cast<uint8_t*>(new_data.pixels()) +
+                  new_data.stride * (y + y0 - py0) +
+                  bytes_per_pixel * (x0 - px0),
+              static_cast<const uint8_t*>(pixels.pixels()) + pixels.stride * y,
+              xsize * bytes_per_pixel);
+        }
+
+        x0 = px0;
+        y0 = py0;
+        xsize = pxs;
+        ysize = pys;
+        should_blend = false;
+        ppf->frames.emplace_back(std::move(new_data));
+      } else {
+        // If all else fails, insert a placeholder blank frame with kReplace.
+        JXL_ASSIGN_OR_RETURN(PackedImage blank,
+                             PackedImage::Create(pxs, pys, pixels.format));
+        memset(blank.pixels(), 0, blank.pixels_size);
+        ppf->frames.emplace_back(std::move(blank));
+        auto& pframe = ppf->frames.back();
+        pframe.frame_info.layer_info.crop_x0 = px0;
+        pframe.frame_info.layer_info.crop_y0 = py0;
+        pframe.frame_info.layer_info.xsize = pxs;
+        pframe.frame_info.layer_info.ysize = pys;
+        pframe.frame_info.duration = 0;
+        bool is_full_size = px0 == 0 && py0 == 0 && pxs == ppf->info.xsize &&
+                            pys == ppf->info.ysize;
+        pframe.frame_info.layer_info.have_crop = is_full_size ? 0 : 1;
+        pframe.frame_info.layer_info.blend_info.blendmode = JXL_BLEND_REPLACE;
+        pframe.frame_info.layer_info.blend_info.source = 1;
+        pframe.frame_info.layer_info.save_as_reference = 1;
+        ppf->frames.emplace_back(std::move(frame.pixels));
+      }
+    } else {
+      ppf->frames.emplace_back(std::move(frame.pixels));
+    }
+
+    auto& pframe = ppf->frames.back();
+    pframe.frame_info.layer_info.crop_x0 = x0;
+    pframe.frame_info.layer_info.crop_y0 = y0;
+    pframe.frame_info.layer_info.xsize = xsize;
+    pframe.frame_info.layer_info.ysize = ysize;
+    pframe.frame_info.duration =
+        fc.delay_num * 1000 / (fc.delay_den ? fc.delay_den : 100);
+    pframe.frame_info.layer_info.blend_info.blendmode =
+        should_blend ? JXL_BLEND_BLEND : JXL_BLEND_REPLACE;
+    bool is_full_size = x0 == 0 && y0 == 0 && xsize == ppf->info.xsize &&
+                        ysize == ppf->info.ysize;
+    pframe.frame_info.layer_info.have_crop = is_full_size ? 0 : 1;
+    pframe.frame_info.layer_info.blend_info.source = 1;
+    pframe.frame_info.layer_info.blend_info.alpha = 0;
+    pframe.frame_info.layer_info.save_as_reference = use_for_next_frame ? 1 : 0;
+
+    previous_frame_should_be_cleared =
+        has_nontrivial_background && (fc.dispose_op == DisposeOp::BACKGROUND);
+    previous_viewport = vp;
+    return true;
+  };
+
   // Copies frame pixels / metadata from temporary storage.
   // TODO(eustas): avoid copying.
   const auto finalize_frame = [&]() -> Status {
@@ -871,8 +1012,19 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
       memcpy(static_cast<uint8_t*>(image.pixels()) + image.stride * y,
              ctx.frameRaw.rows[y], bytes_per_pixel * xsize);
     }
-    frames.push_back(Frame{std::move(image), current_frame});
+    Frame frame{std::move(image), current_frame};
+    JXL_RETURN_IF_ERROR(add_frame(frame));
+    num_frames++;
     seen_pixel_data = false;
+    if (queue) {
+      if (num_frames == 1) {
+        // The chunks after the first IDAT were checked to only hold frames.
+        JXL_RETURN_IF_ERROR(ApplyColorHints(
+            color_hints, color_info_type != ColorInfoType::NONE,
+            ppf->info.num_color_channels == 1, ppf));
+      }
+      JXL_RETURN_IF_ERROR(queue->PushFrames(ppf));
+    }
     return true;
   };
 
@@ -972,7 +1124,7 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
       }
 
       case MakeTag('I', 'D', 'A', 'T'): {
-        if (!frames.empty()) {
+        if (num_frames > 0) {
           return JXL_FAILURE("IDAT after default image is over");
         }
         if (!seen_idat) {
@@ -1141,129 +1293,438 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
     }
   }
 
+  if (num_frames == 0) return JXL_FAILURE("No frames decoded");
+  if (queue) return true;
+
   bool color_is_already_set = (color_info_type != ColorInfoType::NONE);
   bool is_gray = (ppf->info.num_color_channels == 1);
   JXL_RETURN_IF_ERROR(
       ApplyColorHints(color_hints, color_is_already_set, is_gray, ppf));
+  ppf->frames.back().frame_info.is_last = JXL_TRUE;
 
-  bool has_nontrivial_background = false;
-  bool previous_frame_should_be_cleared = false;
-  for (size_t i = 0; i < frames.size(); i++) {
-    Frame& frame = frames[i];
-    const FrameControl& fc = frame.metadata;
-    const RectT<uint64_t> vp = fc.viewport;
-    const auto& pixels = frame.pixels;
-    size_t xsize = pixels.xsize;
-    size_t ysize = pixels.ysize;
-    JXL_ENSURE(xsize == vp.xsize());
-    JXL_ENSURE(ysize == vp.ysize());
+  return true;
+}
 
-    // Before encountering a DISPOSE_OP_NONE frame, the canvas is filled with
-    // 0, so DISPOSE_OP_BACKGROUND and DISPOSE_OP_PREVIOUS are equivalent.
-    if (fc.dispose_op == DisposeOp::NONE) {
-      has_nontrivial_background = true;
+// Whether all the chunks after the first IDAT only hold the frames, so that
+// the header is complete once the first frame is decoded.
+bool OnlyFramesAfterIDAT(const Span<const uint8_t> bytes) {
+  Reader input(bytes);
+  Bytes sig = input.Read(kPngSignature.size());
+  if (sig.size() != 8 ||
+      memcmp(sig.data(), kPngSignature.data(), kPngSignature.size()) != 0) {
+    return false;
+  }
+  bool seen_idat = false;
+  while (!input.Eof()) {
+    Bytes chunk = input.ReadChunk();
+    if (chunk.empty()) return false;
+    uint32_t id = LoadLE32(chunk.data() + 4);
+    if (id == MakeTag('I', 'D', 'A', 'T')) {
+      seen_idat = true;
+    } else if (seen_idat && id != MakeTag('f', 'c', 'T', 'L') &&
+               id != MakeTag('f', 'd', 'A', 'T') &&
+               id != MakeTag('I', 'E', 'N', 'D')) {
+      return false;
     }
-    bool should_blend = fc.blend_op == BlendOp::OVER;
-    bool use_for_next_frame =
-        has_nontrivial_background && fc.dispose_op != DisposeOp::PREVIOUS;
-    size_t x0 = vp.x0();
-    size_t y0 = vp.y0();
-    if (previous_frame_should_be_cleared) {
-      const auto& pvp = frames[i - 1].metadata.viewport;
-      size_t px0 = pvp.x0();
-      size_t py0 = pvp.y0();
-      size_t pxs = pvp.xsize();
-      size_t pys = pvp.ysize();
-      if (px0 >= x0 && py0 >= y0 && px0 + pxs <= x0 + xsize &&
-          py0 + pys <= y0 + ysize && fc.blend_op == BlendOp::SOURCE &&
-          use_for_next_frame) {
-        // If the previous frame is entirely contained in the current frame
-        // and we are using BLEND_OP_SOURCE, nothing special needs to be done.
-        ppf->frames.emplace_back(std::move(frame.pixels));
-      } else if (px0 == x0 && py0 == y0 && px0 + pxs == x0 + xsize &&
-                 py0 + pys == y0 + ysize && use_for_next_frame) {
-        // If the new frame has the same size as the old one, but we are
-        // blending, we can instead just not blend.
-        should_blend = false;
-        ppf->frames.emplace_back(std::move(frame.pixels));
-      } else if (px0 <= x0 && py0 <= y0 && px0 + pxs >= x0 + xsize &&
-                 py0 + pys >= y0 + ysize && use_for_next_frame) {
-        // If the new frame is contained within the old frame, we can pad the
-        // new frame with zeros and not blend.
-        JXL_ASSIGN_OR_RETURN(PackedImage new_data,
-                             PackedImage::Create(pxs, pys, pixels.format));
-        memset(new_data.pixels(), 0, new_data.pixels_size);
-        for (size_t y = 0; y < ysize; y++) {
-          JXL_RETURN_IF_ERROR(
-              PackedImage::ValidateDataType(new_data.format.data_type));
-          size_t bytes_per_pixel =
-              PackedImage::BitsPerChannel(new_data.format.data_type) *
-              new_data.format.num_channels / 8;
-          memcpy(
-              static_cast<uint8_t*>(new_data.pixels()) +
-                  new_data.stride * (y + y0 - py0) +
-                  bytes_per_pixel * (x0 - px0),
-              static_cast<const uint8_t*>(pixels.pixels()) + pixels.stride * y,
-              xsize * bytes_per_pixel);
-        }
+  }
+  return seen_idat;
+}
 
-        x0 = px0;
-        y0 = py0;
-        xsize = pxs;
-        ysize = pys;
-        should_blend = false;
-        ppf->frames.emplace_back(std::move(new_data));
+}  // namespace
+
+Status DecodeImageAPNG(const Span<const uint8_t> bytes,
+                       const ColorHints& color_hints, PackedPixelFile* ppf,
+                       const SizeConstraints* constraints) {
+  return DecodeAPNG(bytes, color_hints, ppf, constraints, /*queue=*/nullptr);
+}
+
+Status DecodeImageAPNGPipelined(const Span<const uint8_t> bytes,
+                                const ColorHints& color_hints,
+                                PackedPixelFile* ppf,
+                                const SizeConstraints* constraints) {
+  if (!OnlyFramesAfterIDAT(bytes)) {
+    return DecodeImageAPNG(bytes, color_hints, ppf, constraints);
+  }
+  const JxlBasicInfo info = ppf->info;
+  const bool have_constraints = constraints != nullptr;
+  const SizeConstraints size_constraints =
+      have_constraints ? *constraints : SizeConstraints();
+  return PackedFrameQueue::Start(
+      [=](PackedFrameQueue* queue) -> Status {
+        PackedPixelFile own_ppf;
+        own_ppf.info = info;
+        return DecodeAPNG(bytes, color_hints, &own_ppf,
+                          have_constraints ? &size_constraints : nullptr,
+                          queue);
+      },
+      ppf);
+}
+
+namespace {
+
+void ReadFromMappedFile(png_structp png_ptr, png_bytep data,
+                        png_size_t length);
+
+}  // namespace
+
+// State of the row by row decoding of a PNG file for ChunkedPNGDecoder.
+struct ChunkedPNGDecoderImpl {
+  ~ChunkedPNGDecoderImpl() { ResetPngDecoder(); }
+
+  void ResetPngDecoder() {
+    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    png_ptr = nullptr;
+    info_ptr = nullptr;
+  }
+
+  // (Re)starts decoding from the first row, up to the first pixel data.
+  bool StartDecoding() {
+    ResetPngDecoder();
+    read_pos = 0;
+    window_y0 = 0;
+    window_rows = 0;
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr,
+                                     nullptr);
+    if (png_ptr == nullptr) return false;
+    info_ptr = png_create_info_struct(png_ptr);
+    if (info_ptr == nullptr) return false;
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+      return false;
+    }
+
+    // See the comment in Context::InitPngDecoder.
+    constexpr std::array<uint8_t, 5> kIgnoredChunks = {'h', 'I', 'S', 'T', 0};
+    png_set_keep_unknown_chunks(png_ptr, 1, kIgnoredChunks.data(),
+                                static_cast<int>(kIgnoredChunks.size() / 5));
+    png_set_crc_action(png_ptr, PNG_CRC_QUIET_USE, PNG_CRC_QUIET_USE);
+    png_set_read_fn(png_ptr, this, ReadFromMappedFile);
+    png_read_info(png_ptr, info_ptr);
+    png_set_expand(png_ptr);
+    png_set_palette_to_rgb(png_ptr);
+    png_set_tRNS_to_alpha(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+    return true;
+  }
+
+  // Makes the rows [y0, y1) available in the window. Rows are only decoded
+  // forward, so a request that starts before the window restarts decoding.
+  bool DecodeRows(size_t y0, size_t y1) {
+    if (y0 < window_y0 && !StartDecoding()) return false;
+    // Rows before `keep` are not needed by this request nor by the buffers
+    // that are not released yet.
+    size_t keep = y0;
+    for (const Buffer& buffer : buffers) keep = std::min(keep, buffer.y0);
+    if (keep > window_y0) {
+      size_t drop = std::min(keep - window_y0, window_rows);
+      memmove(window.data(), window.data() + drop * row_bytes,
+              (window_rows - drop) * row_bytes);
+      window_y0 += drop;
+      window_rows -= drop;
+    }
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+      return false;
+    }
+
+    while (window_y0 + window_rows < y1) {
+      if ((window_rows + 1) * row_bytes > window.size()) {
+        window.resize((window_rows + 1) * row_bytes);
+      }
+      png_read_row(png_ptr, window.data() + window_rows * row_bytes, nullptr);
+      // A row before `keep` is decoded only to be skipped; it is overwritten
+      // by the next one.
+      if (window_y0 < keep) {
+        window_y0++;
       } else {
-        // If all else fails, insert a placeholder blank frame with kReplace.
-        JXL_ASSIGN_OR_RETURN(PackedImage blank,
-                             PackedImage::Create(pxs, pys, pixels.format));
-        memset(blank.pixels(), 0, blank.pixels_size);
-        ppf->frames.emplace_back(std::move(blank));
-        auto& pframe = ppf->frames.back();
-        pframe.frame_info.layer_info.crop_x0 = px0;
-        pframe.frame_info.layer_info.crop_y0 = py0;
-        pframe.frame_info.layer_info.xsize = pxs;
-        pframe.frame_info.layer_info.ysize = pys;
-        pframe.frame_info.duration = 0;
-        bool is_full_size = px0 == 0 && py0 == 0 && pxs == ppf->info.xsize &&
-                            pys == ppf->info.ysize;
-        pframe.frame_info.layer_info.have_crop = is_full_size ? 0 : 1;
-        pframe.frame_info.layer_info.blend_info.blendmode = JXL_BLEND_REPLACE;
-        pframe.frame_info.layer_info.blend_info.source = 1;
-        pframe.frame_info.layer_info.save_as_reference = 1;
-        ppf->frames.emplace_back(std::move(frame.pixels));
+        window_rows++;
       }
-    } else {
-      ppf->frames.emplace_back(std::move(frame.pixels));
     }
+    return true;
+  }
 
-    auto& pframe = ppf->frames.back();
-    pframe.frame_info.layer_info.crop_x0 = x0;
-    pframe.frame_info.layer_info.crop_y0 = y0;
-    pframe.frame_info.layer_info.xsize = xsize;
-    pframe.frame_info.layer_info.ysize = ysize;
-    pframe.frame_info.duration =
-        fc.delay_num * 1000 / (fc.delay_den ? fc.delay_den : 100);
-    pframe.frame_info.layer_info.blend_info.blendmode =
-        should_blend ? JXL_BLEND_BLEND : JXL_BLEND_REPLACE;
-    bool is_full_size = x0 == 0 && y0 == 0 && xsize == ppf->info.xsize &&
-                        ysize == ppf->info.ysize;
-    pframe.frame_info.layer_info.have_crop = is_full_size ? 0 : 1;
-    pframe.frame_info.layer_info.blend_info.source = 1;
-    pframe.frame_info.layer_info.blend_info.alpha = 0;
-    pframe.frame_info.layer_info.save_as_reference = use_for_next_frame ? 1 : 0;
+  // Copy of a requested rectangle, owned until the encoder releases it.
+  struct Buffer {
+    std::unique_ptr<uint8_t[]> pixels;
+    size_t y0;
+  };
 
-    previous_frame_should_be_cleared =
-        has_nontrivial_background && (fc.dispose_op == DisposeOp::BACKGROUND);
+  MemoryMappedFile file;
+  size_t read_pos = 0;
+  png_structp png_ptr = nullptr;
+  png_infop info_ptr = nullptr;
+  size_t xsize = 0;
+  size_t ysize = 0;
+  size_t row_bytes = 0;
+  JxlPixelFormat format = {};
+  // Decoded rows [window_y0, window_y0 + window_rows); the next row produced
+  // by libpng is the one after them.
+  std::vector<uint8_t> window;
+  size_t window_y0 = 0;
+  size_t window_rows = 0;
+  std::vector<Buffer> buffers;
+  // The encoder may request rectangles from several threads.
+  std::mutex mutex;
+};
+
+namespace {
+
+void ReadFromMappedFile(png_structp png_ptr, png_bytep data,
+                        png_size_t length) {
+  ChunkedPNGDecoderImpl* impl =
+      reinterpret_cast<ChunkedPNGDecoderImpl*>(png_get_io_ptr(png_ptr));
+  if (length > impl->file.size() - impl->read_pos) {
+    png_error(png_ptr, "Unexpected end of PNG file");
+  }
+  memcpy(data, impl->file.data() + impl->read_pos, length);
+  impl->read_pos += length;
+}
+
+struct PNGChunkedInputFrame {
+  JxlChunkedFrameInputSource operator()() {
+    return JxlChunkedFrameInputSource{
+        this,
+        METHOD_TO_C_CALLBACK(
+            &PNGChunkedInputFrame::GetColorChannelsPixelFormat),
+        METHOD_TO_C_CALLBACK(&PNGChunkedInputFrame::GetColorChannelDataAt),
+        METHOD_TO_C_CALLBACK(&PNGChunkedInputFrame::GetExtraChannelPixelFormat),
+        METHOD_TO_C_CALLBACK(&PNGChunkedInputFrame::GetExtraChannelDataAt),
+        METHOD_TO_C_CALLBACK(&PNGChunkedInputFrame::ReleaseCurrentData)};
   }
 
-  if (ppf->frames.empty()) return JXL_FAILURE("No frames decoded");
-  ppf->frames.back().frame_info.is_last = JXL_TRUE;
+  void /* NOLINT */ GetColorChannelsPixelFormat(JxlPixelFormat* pixel_format) {
+    *pixel_format = impl->format;
+  }
 
+  const void* GetColorChannelDataAt(size_t xpos, size_t ypos, size_t xsize,
+                                    size_t ysize, size_t* row_offset) {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    const size_t bytes_per_pixel = impl->row_bytes / impl->xsize;
+    *row_offset = xsize * bytes_per_pixel;
+    if (!impl->DecodeRows(ypos, ypos + ysize)) {
+      JXL_WARNING("Failed to decode PNG rows");
+      return nullptr;
+    }
+    ChunkedPNGDecoderImpl::Buffer buffer;
+    buffer.pixels.reset(new uint8_t[*row_offset * ysize]);
+    buffer.y0 = ypos;
+    for (size_t y = 0; y < ysize; ++y) {
+      const uint8_t* row =
+          impl->window.data() + (ypos + y - impl->window_y0) * impl->row_bytes;
+      memcpy(buffer.pixels.get() + y * *row_offset,
+             row + xpos * bytes_per_pixel, *row_offset);
+    }
+    const void* result = buffer.pixels.get();
+    impl->buffers.emplace_back(std::move(buffer));
+    return result;
+  }
+
+  void GetExtraChannelPixelFormat(size_t ec_index,
+                                  JxlPixelFormat* pixel_format) {
+    (void)this;
+    *pixel_format = {};
+    JXL_DEBUG_ABORT("Not implemented");
+  }
+
+  const void* GetExtraChannelDataAt(size_t ec_index, size_t xpos, size_t ypos,
+                                    size_t xsize, size_t ysize,
+                                    size_t* row_offset) {
+    (void)this;
+    *row_offset = 0;
+    JXL_DEBUG_ABORT("Not implemented");
+    return nullptr;
+  }
+
+  void ReleaseCurrentData(const void* buffer) {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    auto& buffers = impl->buffers;
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      if (buffers[i].pixels.get() == buffer) {
+        buffers.erase(buffers.begin() + i);
+        return;
+      }
+    }
+  }
+
+  ChunkedPNGDecoderImpl* impl;
+};
+
+}  // namespace
+
+StatusOr<ChunkedPNGDecoder> ChunkedPNGDecoder::Init(const char* file_path) {
+  ChunkedPNGDecoder dec;
+  dec.impl_ = jxl::make_unique<ChunkedPNGDecoderImpl>();
+  ChunkedPNGDecoderImpl& impl = *dec.impl_;
+  JXL_ASSIGN_OR_RETURN(impl.file, MemoryMappedFile::Init(file_path));
+
+  Reader input(Bytes(impl.file.data(), impl.file.size()));
+  Bytes sig = input.Read(kPngSignature.size());
+  if (sig.size() != 8 ||
+      memcmp(sig.data(), kPngSignature.data(), kPngSignature.size()) != 0) {
+    return JXL_FAILURE("Not a PNG file");
+  }
+  // Only the default image is decoded, so reject animations, where it might
+  // not even be the first frame.
+  while (true) {
+    Bytes chunk = input.ReadChunk();
+    if (chunk.empty()) return JXL_FAILURE("Malformed chunk");
+    uint32_t id = LoadLE32(chunk.data() + 4);
+    if (id == MakeTag('I', 'D', 'A', 'T')) break;
+    if (id == MakeTag('a', 'c', 'T', 'L')) {
+      return JXL_FAILURE("Animated PNG can not be decoded in chunks");
+    }
+  }
+
+  if (!impl.StartDecoding()) {
+    return JXL_FAILURE("Failed to initialize PNG decoder");
+  }
+  if (png_get_interlace_type(impl.png_ptr, impl.info_ptr) !=
+      PNG_INTERLACE_NONE) {
+    return JXL_FAILURE("Interlaced PNG can not be decoded in chunks");
+  }
+  impl.xsize = png_get_image_width(impl.png_ptr, impl.info_ptr);
+  impl.ysize = png_get_image_height(impl.png_ptr, impl.info_ptr);
+  if (!ValidateViewport(RectT<uint64_t>(0, 0, impl.xsize, impl.ysize))) {
+    return JXL_FAILURE("PNG image dimensions are too large");
+  }
+  const uint32_t num_channels = png_get_channels(impl.png_ptr, impl.info_ptr);
+  const bool is_16bit = png_get_bit_depth(impl.png_ptr, impl.info_ptr) == 16;
+  impl.format = {
+      /*num_channels=*/num_channels,
+      /*data_type=*/is_16bit ? JXL_TYPE_UINT16 : JXL_TYPE_UINT8,
+      /*endianness=*/JXL_BIG_ENDIAN,
+      /*align=*/0,
+  };
+  impl.row_bytes = png_get_rowbytes(impl.png_ptr, impl.info_ptr);
+  if (impl.xsize == 0 ||
+      impl.row_bytes != impl.xsize * num_channels * (is_16bit ? 2 : 1)) {
+    return JXL_FAILURE("Unexpected PNG row size");
+  }
+  return dec;
+}
+
+Status ChunkedPNGDecoder::InitializePPF(const ColorHints& color_hints,
+                                        PackedPixelFile* ppf) {
+  ChunkedPNGDecoderImpl& impl = *impl_;
+  ppf->info.xsize = impl.xsize;
+  ppf->info.ysize = impl.ysize;
+  ppf->info.exponent_bits_per_sample = 0;
+  ppf->info.alpha_exponent_bits = 0;
+  ppf->info.orientation = JXL_ORIENT_IDENTITY;
+  ppf->info.num_extra_channels = 0;
+  ppf->color_encoding.color_space = JXL_COLOR_SPACE_RGB;
+  ppf->color_encoding.white_point = JXL_WHITE_POINT_D65;
+  ppf->color_encoding.primaries = JXL_PRIMARIES_SRGB;
+  ppf->color_encoding.transfer_function = JXL_TRANSFER_FUNCTION_SRGB;
+  ppf->color_encoding.rendering_intent = JXL_RENDERING_INTENT_RELATIVE;
+
+  png_color_8p sig_bits = nullptr;
+  // Error is OK -> sig_bits remains nullptr.
+  png_get_sBIT(impl.png_ptr, impl.info_ptr, &sig_bits);
+  SetColorData(ppf, png_get_color_type(impl.png_ptr, impl.info_ptr),
+               png_get_bit_depth(impl.png_ptr, impl.info_ptr), sig_bits,
+               png_get_valid(impl.png_ptr, impl.info_ptr, PNG_INFO_tRNS));
+  if (ppf->info.num_color_channels + (ppf->info.alpha_bits ? 1 : 0) !=
+      impl.format.num_channels) {
+    return JXL_FAILURE("Inconsistent number of PNG channels");
+  }
+
+  // The color and metadata chunks all precede the first IDAT; the same
+  // priorities as in DecodeImageAPNG apply.
+  ColorInfoType color_info_type = ColorInfoType::NONE;
+  Reader input(Bytes(impl.file.data(), impl.file.size()));
+  input.Read(kPngSignature.size());
+  while (true) {
+    Bytes chunk = input.ReadChunk();
+    if (chunk.empty()) return JXL_FAILURE("Malformed chunk");
+    uint32_t id = LoadLE32(chunk.data() + 4);
+    Bytes payload(chunk.data() + 8, chunk.size() - 12);
+    if (id == MakeTag('I', 'D', 'A', 'T')) break;
+    switch (id) {
+      case MakeTag('c', 'I', 'C', 'P'):
+        if (color_info_type == ColorInfoType::CICP) continue;
+        JXL_RETURN_IF_ERROR(DecodeCicpChunk(payload, &ppf->color_encoding));
+        ppf->icc.clear();
+        ppf->primary_color_representation =
+            PackedPixelFile::kColorEncodingIsPrimary;
+        color_info_type = ColorInfoType::CICP;
+        continue;
+
+      case MakeTag('i', 'C', 'C', 'P'): {
+        if (color_info_type > ColorInfoType::ICCP_OR_SRGB) continue;
+        // libpng has already decompressed the profile.
+        int compression_type = 0;
+        png_bytep profile = nullptr;
+        png_charp name = nullptr;
+        png_uint_32 profile_len = 0;
+        png_uint_32 ok =
+            png_get_iCCP(impl.png_ptr, impl.info_ptr, &name, &compression_type,
+                         &profile, &profile_len);
+        if (!ok || !profile_len) {
+          return JXL_FAILURE("Malformed / incomplete iCCP chunk");
+        }
+        ppf->icc.assign(profile, profile + profile_len);
+        ppf->primary_color_representation = PackedPixelFile::kIccIsPrimary;
+        color_info_type = ColorInfoType::ICCP_OR_SRGB;
+        continue;
+      }
+
+      case MakeTag('s', 'R', 'G', 'B'):
+        if (color_info_type >= ColorInfoType::ICCP_OR_SRGB) continue;
+        JXL_RETURN_IF_ERROR(DecodeSrgbChunk(payload, &ppf->color_encoding));
+        color_info_type = ColorInfoType::ICCP_OR_SRGB;
+        continue;
+
+      case MakeTag('g', 'A', 'M', 'A'):
+        if (color_info_type >= ColorInfoType::GAMA_OR_CHRM) continue;
+        JXL_RETURN_IF_ERROR(DecodeGamaChunk(payload, &ppf->color_encoding));
+        color_info_type = ColorInfoType::GAMA_OR_CHRM;
+        continue;
+
+      case MakeTag('c', 'H', 'R', 'M'):
+        if (color_info_type >= ColorInfoType::GAMA_OR_CHRM) continue;
+        JXL_RETURN_IF_ERROR(DecodeChrmChunk(payload, &ppf->color_encoding));
+        color_info_type = ColorInfoType::GAMA_OR_CHRM;
+        continue;
+
+      case MakeTag('e', 'X', 'I', 'f'):
+        ppf->metadata.exif.assign(payload.data(),
+                                  payload.data() + payload.size());
+        continue;
+
+      default:
+        continue;
+    }
+  }
+  // Text chunks after the pixel data are not seen without decoding the whole
+  // image first.
+  png_textp text_ptr;
+  int num_text = 0;
+  png_get_text(impl.png_ptr, impl.info_ptr, &text_ptr, &num_text);
+  for (int i = 0; i < num_text; i++) {
+    Status result = DecodeBlob(text_ptr[i], &ppf->metadata);
+    // Ignore unknown / malformed blob.
+    (void)result;
+  }
+
+  bool color_is_already_set = (color_info_type != ColorInfoType::NONE);
+  bool is_gray = (ppf->info.num_color_channels == 1);
+  JXL_RETURN_IF_ERROR(
+      ApplyColorHints(color_hints, color_is_already_set, is_gray, ppf));
+
+  PNGChunkedInputFrame frame;
+  frame.impl = impl_.get();
+  ppf->chunked_frames.emplace_back(impl.xsize, impl.ysize, frame);
   return true;
 }
 
 #endif  // JPEGXL_ENABLE_APNG
 
+ChunkedPNGDecoder::ChunkedPNGDecoder() = default;
+ChunkedPNGDecoder::~ChunkedPNGDecoder() = default;
+ChunkedPNGDecoder::ChunkedPNGDecoder(ChunkedPNGDecoder&&) noexcept = default;
+ChunkedPNGDecoder& ChunkedPNGDecoder::operator=(ChunkedPNGDecoder&&) noexcept =
+    default;
+
 }  // namespace extras
 }  // namespace jxl
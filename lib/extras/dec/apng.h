@@ -9,6 +9,7 @@
 // Decodes APNG images in memory.
 
 #include <cstdint>
+#include <memory>
 
 #include "lib/extras/dec/color_hints.h"
 #include "lib/extras/packed_image.h"
@@ -28,6 +29,34 @@ Status DecodeImageAPNG(Span<const uint8_t> bytes, const ColorHints& color_hints,
                        PackedPixelFile* ppf,
                        const SizeConstraints* constraints = nullptr);
 
+// Like DecodeImageAPNG, but returns after the first frame and decodes the
+// others on another thread, handing them over through ppf->frame_queue, when
+// the header is complete at that point. `bytes` must outlive the queue.
+Status DecodeImageAPNGPipelined(Span<const uint8_t> bytes,
+                                const ColorHints& color_hints,
+                                PackedPixelFile* ppf,
+                                const SizeConstraints* constraints = nullptr);
+
+struct ChunkedPNGDecoderImpl;
+
+// Decodes a non-interlaced, non-animated PNG file row by row, as the encoder
+// requests the pixels, so that only the rows of the requested rectangles are
+// kept in memory.
+class ChunkedPNGDecoder {
+ public:
+  static StatusOr<ChunkedPNGDecoder> Init(const char* file_path);
+  // Initializes `ppf` with a pointer to this `ChunkedPNGDecoder`.
+  Status InitializePPF(const ColorHints& color_hints, PackedPixelFile* ppf);
+
+  ChunkedPNGDecoder();                                         // NOLINT
+  ~ChunkedPNGDecoder();                                        // NOLINT
+  ChunkedPNGDecoder(ChunkedPNGDecoder&&) noexcept;             // NOLINT
+  ChunkedPNGDecoder& operator=(ChunkedPNGDecoder&&) noexcept;  // NOLINT
+
+ private:
+  std::unique_ptr<ChunkedPNGDecoderImpl> impl_;
+};
+
 }  // namespace extras
 }  // namespace jxl
 
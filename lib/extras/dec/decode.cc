@@ -14,6 +14,7 @@
 #include "lib/extras/dec/jxl.h"
 #include "lib/extras/dec/pgx.h"
 #include "lib/extras/dec/pnm.h"
+#include "lib/extras/dec/y4m.h"
 
 namespace jxl {
 namespace extras {
@@ -69,6 +70,8 @@ Codec CodecFromPath(const std::string& path,
 
   if (ext == ".exr") return Codec::kEXR;
 
+  if (ext == ".y4m") return Codec::kY4M;
+
   return Codec::kUnknown;
 }
 
@@ -85,6 +88,7 @@ bool CanDecode(Codec codec) {
     case Codec::kPNM:
     case Codec::kPGX:
     case Codec::kJXL:
+    case Codec::kY4M:
       return true;
     default:
       return false;
@@ -92,7 +96,7 @@ bool CanDecode(Codec codec) {
 }
 
 std::string ListOfDecodeCodecs() {
-  std::string list_of_codecs("JXL, PPM, PNM, PFM, PAM, PGX");
+  std::string list_of_codecs("JXL, PPM, PNM, PFM, PAM, PGX, Y4M");
   if (CanDecode(Codec::kPNG)) list_of_codecs.append(", PNG, APNG");
   if (CanDecode(Codec::kGIF)) list_of_codecs.append(", GIF");
   if (CanDecode(Codec::kJPG)) list_of_codecs.append(", JPEG");
@@ -100,9 +104,13 @@ std::string ListOfDecodeCodecs() {
   return list_of_codecs;
 }
 
-Status DecodeBytes(const Span<const uint8_t> bytes,
-                   const ColorHints& color_hints, extras::PackedPixelFile* ppf,
-                   const SizeConstraints* constraints, Codec* orig_codec) {
+namespace {
+
+Status DecodeBytesImpl(const Span<const uint8_t> bytes,
+                       const ColorHints& color_hints,
+                       extras::PackedPixelFile* ppf,
+                       const SizeConstraints* constraints, Codec* orig_codec,
+                       bool pipelined) {
   if (bytes.size() < kMinBytes) return JXL_FAILURE("Too few bytes");
 
   *ppf = extras::PackedPixelFile();
@@ -112,7 +120,9 @@ Status DecodeBytes(const Span<const uint8_t> bytes,
   ppf->info.orientation = JXL_ORIENT_IDENTITY;
 
   const auto choose_codec = [&]() -> Codec {
-    if (DecodeImageAPNG(bytes, color_hints, ppf, constraints)) {
+    if (pipelined
+            ? DecodeImageAPNGPipelined(bytes, color_hints, ppf, constraints)
+            : DecodeImageAPNG(bytes, color_hints, ppf, constraints)) {
       return Codec::kPNG;
     }
     if (DecodeImagePGX(bytes, color_hints, ppf, constraints)) {
@@ -121,6 +131,11 @@ Status DecodeBytes(const Span<const uint8_t> bytes,
     if (DecodeImagePNM(bytes, color_hints, ppf, constraints)) {
       return Codec::kPNM;
     }
+    if (pipelined
+            ? DecodeImageY4MPipelined(bytes, color_hints, ppf, constraints)
+            : DecodeImageY4M(bytes, color_hints, ppf, constraints)) {
+      return Codec::kY4M;
+    }
     JXLDecompressParams dparams = {};
     for (const uint32_t num_channels : {1, 2, 3, 4}) {
       dparams.accepted_formats.push_back(
@@ -134,7 +149,9 @@ Status DecodeBytes(const Span<const uint8_t> bytes,
                         ppf)) {
       return Codec::kJXL;
     }
-    if (DecodeImageGIF(bytes, color_hints, ppf, constraints)) {
+    if (pipelined
+            ? DecodeImageGIFPipelined(bytes, color_hints, ppf, constraints)
+            : DecodeImageGIF(bytes, color_hints, ppf, constraints)) {
       return Codec::kGIF;
     }
     if (DecodeImageJPG(bytes, color_hints, ppf, constraints)) {
@@ -155,5 +172,23 @@ Status DecodeBytes(const Span<const uint8_t> bytes,
   return true;
 }
 
+}  // namespace
+
+Status DecodeBytes(const Span<const uint8_t> bytes,
+                   const ColorHints& color_hints, extras::PackedPixelFile* ppf,
+                   const SizeConstraints* constraints, Codec* orig_codec) {
+  return DecodeBytesImpl(bytes, color_hints, ppf, constraints, orig_codec,
+                         /*pipelined=*/false);
+}
+
+Status DecodeBytesPipelined(const Span<const uint8_t> bytes,
+                            const ColorHints& color_hints,
+                            extras::PackedPixelFile* ppf,
+                            const SizeConstraints* constraints,
+                            Codec* orig_codec) {
+  return DecodeBytesImpl(bytes, color_hints, ppf, constraints, orig_codec,
+                         /*pipelined=*/true);
+}
+
 }  // namespace extras
 }  // namespace jxl
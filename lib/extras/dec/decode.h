@@ -31,7 +31,8 @@ enum class Codec : uint32_t {
   kJPG,
   kGIF,
   kEXR,
-  kJXL
+  kJXL,
+  kY4M
 };
 
 bool CanDecode(Codec codec);
@@ -51,6 +52,15 @@ Status DecodeBytes(Span<const uint8_t> bytes, const ColorHints& color_hints,
                    const SizeConstraints* constraints = nullptr,
                    Codec* orig_codec = nullptr);
 
+// Like DecodeBytes, but animated PNG, GIF and Y4M images may be returned after
+// their first frame, with the other frames to be taken from ppf->frame_queue
+// while they are decoded. `bytes` must outlive the queue.
+Status DecodeBytesPipelined(Span<const uint8_t> bytes,
+                            const ColorHints& color_hints,
+                            extras::PackedPixelFile* ppf,
+                            const SizeConstraints* constraints = nullptr,
+                            Codec* orig_codec = nullptr);
+
 }  // namespace extras
 }  // namespace jxl
 
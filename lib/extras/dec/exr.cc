@@ -8,6 +8,7 @@
 #include <cstdint>
 
 #include "lib/extras/dec/color_hints.h"
+#include "lib/extras/mmap.h"
 #include "lib/extras/packed_image.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/span.h"
@@ -28,6 +29,17 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
   (void)constraints;
   return JXL_FAILURE("EXR is not supported");
 }
+
+struct ChunkedEXRDecoderImpl {};
+
+StatusOr<ChunkedEXRDecoder> ChunkedEXRDecoder::Init(const char* file_path) {
+  return JXL_FAILURE("EXR is not supported");
+}
+
+Status ChunkedEXRDecoder::InitializePPF(const ColorHints& color_hints,
+                                        PackedPixelFile* ppf) {
+  return JXL_FAILURE("EXR is not supported");
+}
 }  // namespace extras
 }  // namespace jxl
 
@@ -37,9 +49,15 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
 #include <ImfIO.h>
 #include <ImfRgbaFile.h>
 #include <ImfStandardAttributes.h>
+#include <ImfThreading.h>
 
+#include <algorithm>
+#include <mutex>
+#include <thread>
 #include <vector>
 
+#include "lib/jxl/base/c_callback_support.h"
+
 #ifdef __EXCEPTIONS
 #include <stdexcept>
 #define JXL_EXR_THROW_LENGTH_ERROR() throw std::length_error("");
@@ -97,6 +115,52 @@ class InMemoryIStream : public OpenEXR::IStream {
   size_t pos_ = 0;
 };
 
+// Lets OpenEXR decompress the scanlines or tiles of the files opened after
+// this on its global thread pool.
+void EnableEXRThreads() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    if (OpenEXR::globalThreadCount() == 0) {
+      OpenEXR::setGlobalThreadCount(
+          std::max(1u, std::thread::hardware_concurrency()));
+    }
+  });
+}
+
+// Sets the color encoding and the sample format of `ppf` from the header.
+void SetInfoFromHeader(const OpenEXR::Header& header, bool has_alpha,
+                       PackedPixelFile* ppf) {
+  ppf->color_encoding.transfer_function = JXL_TRANSFER_FUNCTION_LINEAR;
+  ppf->color_encoding.color_space = JXL_COLOR_SPACE_RGB;
+  ppf->color_encoding.primaries = JXL_PRIMARIES_SRGB;
+  ppf->color_encoding.white_point = JXL_WHITE_POINT_D65;
+  if (OpenEXR::hasChromaticities(header)) {
+    ppf->color_encoding.primaries = JXL_PRIMARIES_CUSTOM;
+    ppf->color_encoding.white_point = JXL_WHITE_POINT_CUSTOM;
+    const auto& chromaticities = OpenEXR::chromaticities(header);
+    ppf->color_encoding.primaries_red_xy[0] = chromaticities.red.x;
+    ppf->color_encoding.primaries_red_xy[1] = chromaticities.red.y;
+    ppf->color_encoding.primaries_green_xy[0] = chromaticities.green.x;
+    ppf->color_encoding.primaries_green_xy[1] = chromaticities.green.y;
+    ppf->color_encoding.primaries_blue_xy[0] = chromaticities.blue.x;
+    ppf->color_encoding.primaries_blue_xy[1] = chromaticities.blue.y;
+    ppf->color_encoding.white_point_xy[0] = chromaticities.white.x;
+    ppf->color_encoding.white_point_xy[1] = chromaticities.white.y;
+  }
+
+  // EXR uses binary16 or binary32 floating point format.
+  ppf->info.bits_per_sample = kExrBitsPerSample;
+  ppf->info.exponent_bits_per_sample = kExrBitsPerSample == 16 ? 5 : 8;
+  if (has_alpha) {
+    ppf->info.alpha_bits = kExrAlphaBits;
+    ppf->info.alpha_exponent_bits = ppf->info.exponent_bits_per_sample;
+    ppf->info.alpha_premultiplied = JXL_TRUE;
+  }
+  ppf->info.intensity_target = OpenEXR::hasWhiteLuminance(header)
+                                   ? OpenEXR::whiteLuminance(header)
+                                   : 0;
+}
+
 }  // namespace
 
 bool CanDecodeEXR() { return true; }
@@ -105,6 +169,7 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
                       PackedPixelFile* ppf,
                       const SizeConstraints* constraints) {
   InMemoryIStream is(bytes);
+  EnableEXRThreads();
 
 #ifdef __EXCEPTIONS
   std::unique_ptr<OpenEXR::RgbaInputFile> input_ptr;
@@ -126,10 +191,6 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
   const bool has_alpha = (input.channels() & OpenEXR::RgbaChannels::WRITE_A) ==
                          OpenEXR::RgbaChannels::WRITE_A;
 
-  const float intensity_target = OpenEXR::hasWhiteLuminance(input.header())
-                                     ? OpenEXR::whiteLuminance(input.header())
-                                     : 0;
-
   auto image_size = input.displayWindow().size();
   // Size is computed as max - min, but both bounds are inclusive.
   ++image_size.x;
@@ -157,6 +218,20 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
   }
   const auto& frame = ppf->frames.back();
 
+  if (has_alpha && input.dataWindow() == input.displayWindow()) {
+    // The frame has the layout of OpenEXR::Rgba, the halves are decoded into
+    // it directly.
+    static_assert(sizeof(OpenEXR::Rgba) == 8, "Rgba must be 4 halves");
+    const int row_size = static_cast<int>(image_size.x);
+    OpenEXR::Rgba* pixels = static_cast<OpenEXR::Rgba*>(frame.color.pixels());
+    input.setFrameBuffer(pixels - input.dataWindow().min.x -
+                             input.dataWindow().min.y * row_size,
+                         /*xStride=*/1, /*yStride=*/row_size);
+    input.readPixels(input.dataWindow().min.y, input.dataWindow().max.y);
+    SetInfoFromHeader(input.header(), has_alpha, ppf);
+    return true;
+  }
+
   const int row_size = input.dataWindow().size().x + 1;
   // Number of rows to read at a time.
   // https://www.openexr.com/documentation/ReadingAndWritingImageFiles.pdf
@@ -197,33 +272,182 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
     }
   }
 
-  ppf->color_encoding.transfer_function = JXL_TRANSFER_FUNCTION_LINEAR;
-  ppf->color_encoding.color_space = JXL_COLOR_SPACE_RGB;
-  ppf->color_encoding.primaries = JXL_PRIMARIES_SRGB;
-  ppf->color_encoding.white_point = JXL_WHITE_POINT_D65;
-  if (OpenEXR::hasChromaticities(input.header())) {
-    ppf->color_encoding.primaries = JXL_PRIMARIES_CUSTOM;
-    ppf->color_encoding.white_point = JXL_WHITE_POINT_CUSTOM;
-    const auto& chromaticities = OpenEXR::chromaticities(input.header());
-    ppf->color_encoding.primaries_red_xy[0] = chromaticities.red.x;
-    ppf->color_encoding.primaries_red_xy[1] = chromaticities.red.y;
-    ppf->color_encoding.primaries_green_xy[0] = chromaticities.green.x;
-    ppf->color_encoding.primaries_green_xy[1] = chromaticities.green.y;
-    ppf->color_encoding.primaries_blue_xy[0] = chromaticities.blue.x;
-    ppf->color_encoding.primaries_blue_xy[1] = chromaticities.blue.y;
-    ppf->color_encoding.white_point_xy[0] = chromaticities.white.x;
-    ppf->color_encoding.white_point_xy[1] = chromaticities.white.y;
+  SetInfoFromHeader(input.header(), has_alpha, ppf);
+  return true;
+}
+
+// The whole-row scanlines most recently read are kept, since the encoder
+// requests the groups of a row of groups one after the other.
+struct ChunkedEXRDecoderImpl {
+  // Reads the image rows [y0, y1) into `rows`, unless they are already there.
+  Status ReadRows(size_t y0, size_t y1) {
+    if (y0 >= rows_y0 && y1 <= rows_y1) return true;
+    rows.resize(xsize * (y1 - y0));
+    const int row_size = static_cast<int>(xsize);
+    const int start_y = input->dataWindow().min.y + static_cast<int>(y0);
+    const int end_y = start_y + static_cast<int>(y1 - y0) - 1;
+#ifdef __EXCEPTIONS
+    try {
+#endif
+      input->setFrameBuffer(
+          rows.data() - input->dataWindow().min.x - start_y * row_size,
+          /*xStride=*/1, /*yStride=*/row_size);
+      input->readPixels(start_y, end_y);
+#ifdef __EXCEPTIONS
+    } catch (...) {
+      rows_y0 = rows_y1 = 0;
+      return JXL_FAILURE("Failed to read EXR scanlines");
+    }
+#endif
+    rows_y0 = y0;
+    rows_y1 = y1;
+    return true;
   }
 
-  // EXR uses binary16 or binary32 floating point format.
-  ppf->info.bits_per_sample = kExrBitsPerSample;
-  ppf->info.exponent_bits_per_sample = kExrBitsPerSample == 16 ? 5 : 8;
-  if (has_alpha) {
-    ppf->info.alpha_bits = kExrAlphaBits;
-    ppf->info.alpha_exponent_bits = ppf->info.exponent_bits_per_sample;
-    ppf->info.alpha_premultiplied = JXL_TRUE;
+  MemoryMappedFile file;
+  std::unique_ptr<InMemoryIStream> stream;
+  std::unique_ptr<OpenEXR::RgbaInputFile> input;
+  size_t xsize = 0;
+  size_t ysize = 0;
+  bool has_alpha = false;
+  JxlPixelFormat format = {};
+  // The scanlines [rows_y0, rows_y1) of the image.
+  std::vector<OpenEXR::Rgba> rows;
+  size_t rows_y0 = 0;
+  size_t rows_y1 = 0;
+  // Copies of the requested rectangles, until the encoder releases them.
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  // The encoder may request rectangles from several threads.
+  std::mutex mutex;
+};
+
+namespace {
+
+struct EXRChunkedInputFrame {
+  JxlChunkedFrameInputSource operator()() {
+    return JxlChunkedFrameInputSource{
+        this,
+        METHOD_TO_C_CALLBACK(
+            &EXRChunkedInputFrame::GetColorChannelsPixelFormat),
+        METHOD_TO_C_CALLBACK(&EXRChunkedInputFrame::GetColorChannelDataAt),
+        METHOD_TO_C_CALLBACK(&EXRChunkedInputFrame::GetExtraChannelPixelFormat),
+        METHOD_TO_C_CALLBACK(&EXRChunkedInputFrame::GetExtraChannelDataAt),
+        METHOD_TO_C_CALLBACK(&EXRChunkedInputFrame::ReleaseCurrentData)};
   }
-  ppf->info.intensity_target = intensity_target;
+
+  void /* NOLINT */ GetColorChannelsPixelFormat(JxlPixelFormat* pixel_format) {
+    *pixel_format = impl->format;
+  }
+
+  const void* GetColorChannelDataAt(size_t xpos, size_t ypos, size_t xsize,
+                                    size_t ysize, size_t* row_offset) {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    const size_t pixel_size = impl->format.num_channels * kExrBitsPerSample / 8;
+    *row_offset = xsize * pixel_size;
+    if (!impl->ReadRows(ypos, ypos + ysize)) return nullptr;
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[*row_offset * ysize]);
+    for (size_t y = 0; y < ysize; ++y) {
+      const OpenEXR::Rgba* JXL_RESTRICT input_row =
+          &impl->rows[(ypos + y - impl->rows_y0) * impl->xsize];
+      uint8_t* row = buffer.get() + y * *row_offset;
+      for (size_t x = 0; x < xsize; ++x) {
+        // TODO(eustas): UB: OpenEXR::Rgba is not TriviallyCopyable
+        memcpy(row + x * pixel_size, input_row + xpos + x, pixel_size);
+      }
+    }
+    const void* result = buffer.get();
+    impl->buffers.emplace_back(std::move(buffer));
+    return result;
+  }
+
+  void GetExtraChannelPixelFormat(size_t ec_index,
+                                  JxlPixelFormat* pixel_format) {
+    (void)this;
+    *pixel_format = {};
+    JXL_DEBUG_ABORT("Not implemented");
+  }
+
+  const void* GetExtraChannelDataAt(size_t ec_index, size_t xpos, size_t ypos,
+                                    size_t xsize, size_t ysize,
+                                    size_t* row_offset) {
+    (void)this;
+    *row_offset = 0;
+    JXL_DEBUG_ABORT("Not implemented");
+    return nullptr;
+  }
+
+  void ReleaseCurrentData(const void* buffer) {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    auto& buffers = impl->buffers;
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      if (buffers[i].get() == buffer) {
+        buffers.erase(buffers.begin() + i);
+        return;
+      }
+    }
+  }
+
+  ChunkedEXRDecoderImpl* impl;
+};
+
+}  // namespace
+
+StatusOr<ChunkedEXRDecoder> ChunkedEXRDecoder::Init(const char* file_path) {
+  ChunkedEXRDecoder dec;
+  dec.impl_ = jxl::make_unique<ChunkedEXRDecoderImpl>();
+  ChunkedEXRDecoderImpl& impl = *dec.impl_;
+  JXL_ASSIGN_OR_RETURN(impl.file, MemoryMappedFile::Init(file_path));
+  EnableEXRThreads();
+  impl.stream = jxl::make_unique<InMemoryIStream>(
+      Bytes(impl.file.data(), impl.file.size()));
+#ifdef __EXCEPTIONS
+  try {
+    impl.input = jxl::make_unique<OpenEXR::RgbaInputFile>(*impl.stream);
+  } catch (...) {
+    return JXL_FAILURE("Not an EXR file");
+  }
+#else
+  impl.input = jxl::make_unique<OpenEXR::RgbaInputFile>(*impl.stream);
+#endif
+  const OpenEXR::RgbaInputFile& input = *impl.input;
+
+  if ((input.channels() & OpenEXR::RgbaChannels::WRITE_RGB) !=
+      OpenEXR::RgbaChannels::WRITE_RGB) {
+    return JXL_FAILURE("only RGB OpenEXR files are supported");
+  }
+  if (input.dataWindow() != input.displayWindow()) {
+    return JXL_FAILURE(
+        "EXR data window must match the display window to be decoded in "
+        "chunks");
+  }
+  impl.has_alpha = (input.channels() & OpenEXR::RgbaChannels::WRITE_A) ==
+                   OpenEXR::RgbaChannels::WRITE_A;
+  auto image_size = input.displayWindow().size();
+  // Size is computed as max - min, but both bounds are inclusive.
+  impl.xsize = image_size.x + 1;
+  impl.ysize = image_size.y + 1;
+  impl.format = {
+      /*num_channels=*/3u + (impl.has_alpha ? 1u : 0u),
+      /*data_type=*/kExrBitsPerSample == 16 ? JXL_TYPE_FLOAT16 : JXL_TYPE_FLOAT,
+      /*endianness=*/JXL_NATIVE_ENDIAN,
+      /*align=*/0,
+  };
+  return dec;
+}
+
+Status ChunkedEXRDecoder::InitializePPF(const ColorHints& color_hints,
+                                        PackedPixelFile* ppf) {
+  ChunkedEXRDecoderImpl& impl = *impl_;
+  ppf->info.xsize = impl.xsize;
+  ppf->info.ysize = impl.ysize;
+  ppf->info.num_color_channels = 3;
+  ppf->info.num_extra_channels = 0;
+  ppf->info.orientation = JXL_ORIENT_IDENTITY;
+  SetInfoFromHeader(impl.input->header(), impl.has_alpha, ppf);
+
+  EXRChunkedInputFrame frame;
+  frame.impl = impl_.get();
+  ppf->chunked_frames.emplace_back(impl.xsize, impl.ysize, frame);
   return true;
 }
 
@@ -231,3 +455,15 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
 }  // namespace jxl
 
 #endif  // JPEGXL_ENABLE_EXR
+
+namespace jxl {
+namespace extras {
+
+ChunkedEXRDecoder::ChunkedEXRDecoder() = default;
+ChunkedEXRDecoder::~ChunkedEXRDecoder() = default;
+ChunkedEXRDecoder::ChunkedEXRDecoder(ChunkedEXRDecoder&&) noexcept = default;
+ChunkedEXRDecoder& ChunkedEXRDecoder::operator=(ChunkedEXRDecoder&&) noexcept =
+    default;
+
+}  // namespace extras
+}  // namespace jxl
@@ -9,6 +9,7 @@
 // Decodes OpenEXR images in memory.
 
 #include <cstdint>
+#include <memory>
 
 #include "lib/extras/dec/color_hints.h"
 #include "lib/extras/packed_image.h"
@@ -29,6 +30,26 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, const ColorHints& color_hints,
                       PackedPixelFile* ppf,
                       const SizeConstraints* constraints = nullptr);
 
+struct ChunkedEXRDecoderImpl;
+
+// Reads the scanlines of an OpenEXR file as the encoder requests them, instead
+// of decoding the whole image up front. The data window must match the display
+// window.
+class ChunkedEXRDecoder {
+ public:
+  static StatusOr<ChunkedEXRDecoder> Init(const char* file_path);
+  // Initializes `ppf` with a pointer to this `ChunkedEXRDecoder`.
+  Status InitializePPF(const ColorHints& color_hints, PackedPixelFile* ppf);
+
+  ChunkedEXRDecoder();                                         // NOLINT
+  ~ChunkedEXRDecoder();                                        // NOLINT
+  ChunkedEXRDecoder(ChunkedEXRDecoder&&) noexcept;             // NOLINT
+  ChunkedEXRDecoder& operator=(ChunkedEXRDecoder&&) noexcept;  // NOLINT
+
+ private:
+  std::unique_ptr<ChunkedEXRDecoderImpl> impl_;
+};
+
 }  // namespace extras
 }  // namespace jxl
 
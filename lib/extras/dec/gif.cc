@@ -12,11 +12,13 @@
 #endif
 #include <jxl/codestream_header.h>
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 #include <utility>
 #include <vector>
 
+#include "lib/extras/frame_queue.h"
 #include "lib/extras/size_constraints.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/rect.h"
@@ -62,21 +64,97 @@ Status ensure_have_alpha(PackedFrame* frame) {
               frame->color.xsize * frame->color.ysize, 255u);
   return true;
 }
-}  // namespace
-#endif
 
-bool CanDecodeGIF() {
-#if JPEGXL_ENABLE_GIF
-  return true;
-#else
+// The smallest rectangle that contains both `a` and `b`.
+Rect BoundingRect(const Rect& a, const Rect& b) {
+  const size_t xbegin = std::min(a.x0(), b.x0());
+  const size_t ybegin = std::min(a.y0(), b.y0());
+  const size_t xend = std::max(a.x0() + a.xsize(), b.x0() + b.xsize());
+  const size_t yend = std::max(a.y0() + a.ysize(), b.y0() + b.ysize());
+  return Rect(xbegin, ybegin, xend - xbegin, yend - ybegin);
+}
+
+// Whether any frame needs an alpha channel, which DecodeGIF otherwise only
+// knows after decoding all the frames. Follows the same updates of the canvas
+// as DecodeGIF, for the alpha values only.
+bool NeedsAlpha(GifFileType* gif, bool have_animation) {
+  const Rect canvas_rect(0, 0, gif->SWidth, gif->SHeight);
+  // The background is transparent.
+  std::vector<uint8_t> canvas(canvas_rect.xsize() * canvas_rect.ysize(), 0);
+  Rect previous_rect_if_restore_to_background;
+  bool last_base_was_none = true;
+  for (int i = 0; i < gif->ImageCount; ++i) {
+    const SavedImage& image = gif->SavedImages[i];
+    const Rect image_rect(image.ImageDesc.Left, image.ImageDesc.Top,
+                          image.ImageDesc.Width, image.ImageDesc.Height);
+    // Decoding fails on such frames.
+    if (!image_rect.IsInside(canvas_rect)) return false;
+    Rect total_rect = image_rect;
+    bool replace = false;
+    if (previous_rect_if_restore_to_background.xsize() != 0 ||
+        previous_rect_if_restore_to_background.ysize() != 0) {
+      total_rect =
+          BoundingRect(image_rect, previous_rect_if_restore_to_background);
+      previous_rect_if_restore_to_background = Rect();
+      replace = true;
+    }
+    if (have_animation && last_base_was_none) replace = true;
+    GraphicsControlBlock gcb;
+    DGifSavedExtensionToGCB(gif, i, &gcb);
+    msan::UnpoisonMemory(&gcb, sizeof(gcb));
+
+    std::vector<uint8_t> new_canvas = canvas;
+    bool has_transparent_pixels = false;
+    for (size_t y = 0, byte_index = 0; y < image_rect.ysize(); ++y) {
+      uint8_t* row = new_canvas.data() +
+                     (y + image_rect.y0()) * canvas_rect.xsize() +
+                     image_rect.x0();
+      for (size_t x = 0; x < image_rect.xsize(); ++x, ++byte_index) {
+        if (image.RasterBits[byte_index] == gcb.TransparentColor) {
+          has_transparent_pixels = true;
+        } else {
+          row[x] = 255;
+        }
+      }
+    }
+    if (!replace && has_transparent_pixels) return true;
+    if (replace) {
+      for (size_t y = 0; y < total_rect.ysize(); ++y) {
+        const uint8_t* row = new_canvas.data() +
+                             (y + total_rect.y0()) * canvas_rect.xsize() +
+                             total_rect.x0();
+        for (size_t x = 0; x < total_rect.xsize(); ++x) {
+          if (row[x] != 255) return true;
+        }
+      }
+    }
+
+    switch (gcb.DisposalMode) {
+      case DISPOSE_DO_NOT:
+        canvas = std::move(new_canvas);
+        last_base_was_none = false;
+        break;
+      case DISPOSE_BACKGROUND:
+        std::fill(canvas.begin(), canvas.end(), 0);
+        previous_rect_if_restore_to_background = image_rect;
+        last_base_was_none = false;
+        break;
+      case DISPOSE_PREVIOUS:
+        break;
+      case DISPOSAL_UNSPECIFIED:
+      default:
+        std::fill(canvas.begin(), canvas.end(), 0);
+        last_base_was_none = true;
+    }
+  }
   return false;
-#endif
 }
 
-Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
-                      PackedPixelFile* ppf,
-                      const SizeConstraints* constraints) {
-#if JPEGXL_ENABLE_GIF
+// Decodes `bytes` into `ppf`, or hands the frames over to `queue` as they are
+// decoded, if not null.
+Status DecodeGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
+                 PackedPixelFile* ppf, const SizeConstraints* constraints,
+                 PackedFrameQueue* queue) {
   int error = GIF_OK;
   ReadState state = {bytes};
   const auto ReadFromSpan = [](GifFileType* const gif, GifByteType* const bytes,
@@ -158,6 +236,10 @@ Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
   // alpha_bits is later set to 8 if we find a frame with transparent pixels.
   ppf->info.alpha_bits = 0;
   ppf->info.alpha_exponent_bits = 0;
+  // The frames that are handed over must all have alpha from the start.
+  if (queue && NeedsAlpha(gif.get(), ppf->info.have_animation)) {
+    ppf->info.alpha_bits = 8;
+  }
   JXL_RETURN_IF_ERROR(ApplyColorHints(color_hints, /*color_already_set=*/false,
                                       /*is_gray=*/false, ppf));
 
@@ -214,19 +296,8 @@ Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
     Rect total_rect;
     if (previous_rect_if_restore_to_background.xsize() != 0 ||
         previous_rect_if_restore_to_background.ysize() != 0) {
-      const size_t xbegin = std::min(
-          image_rect.x0(), previous_rect_if_restore_to_background.x0());
-      const size_t ybegin = std::min(
-          image_rect.y0(), previous_rect_if_restore_to_background.y0());
-      const size_t xend =
-          std::max(image_rect.x0() + image_rect.xsize(),
-                   previous_rect_if_restore_to_background.x0() +
-                       previous_rect_if_restore_to_background.xsize());
-      const size_t yend =
-          std::max(image_rect.y0() + image_rect.ysize(),
-                   previous_rect_if_restore_to_background.y0() +
-                       previous_rect_if_restore_to_background.ysize());
-      total_rect = Rect(xbegin, ybegin, xend - xbegin, yend - ybegin);
+      total_rect =
+          BoundingRect(image_rect, previous_rect_if_restore_to_background);
       previous_rect_if_restore_to_background = Rect();
       replace = true;
     } else {
@@ -247,6 +318,9 @@ Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
     }
 
     PackedFrame* frame = &ppf->frames.back();
+    if (queue && ppf->info.alpha_bits != 0) {
+      JXL_RETURN_IF_ERROR(ensure_have_alpha(frame));
+    }
 
     // We cannot tell right from the start whether there will be a
     // need for an alpha channel. This is discovered only as soon as
@@ -385,6 +459,8 @@ Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
     }
 
     if (!frame->extra_channels.empty()) {
+      // NeedsAlpha must agree with the pixels.
+      JXL_ENSURE(!queue || ppf->info.alpha_bits != 0);
       ppf->info.alpha_bits = 8;
     }
 
@@ -407,6 +483,7 @@ Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
         std::fill_n(static_cast<PackedRgba*>(canvas.color.pixels()),
                     canvas.color.xsize * canvas.color.ysize, background_rgba);
     }
+    if (queue) JXL_RETURN_IF_ERROR(queue->PushFrames(ppf));
   }
   // Finally, if any frame has an alpha-channel, every frame will need
   // to have an alpha-channel.
@@ -423,6 +500,47 @@ Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
     }
   }
   return true;
+}
+}  // namespace
+#endif
+
+bool CanDecodeGIF() {
+#if JPEGXL_ENABLE_GIF
+  return true;
+#else
+  return false;
+#endif
+}
+
+Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
+                      PackedPixelFile* ppf,
+                      const SizeConstraints* constraints) {
+#if JPEGXL_ENABLE_GIF
+  return DecodeGIF(bytes, color_hints, ppf, constraints, /*queue=*/nullptr);
+#else
+  return false;
+#endif
+}
+
+Status DecodeImageGIFPipelined(Span<const uint8_t> bytes,
+                               const ColorHints& color_hints,
+                               PackedPixelFile* ppf,
+                               const SizeConstraints* constraints) {
+#if JPEGXL_ENABLE_GIF
+  // Not a GIF file, no need for a thread to find out.
+  if (bytes.size() < 3 || memcmp(bytes.data(), "GIF", 3) != 0) return false;
+  const JxlBasicInfo info = ppf->info;
+  const bool have_constraints = constraints != nullptr;
+  const SizeConstraints size_constraints =
+      have_constraints ? *constraints : SizeConstraints();
+  return PackedFrameQueue::Start(
+      [=](PackedFrameQueue* queue) -> Status {
+        PackedPixelFile own_ppf;
+        own_ppf.info = info;
+        return DecodeGIF(bytes, color_hints, &own_ppf,
+                         have_constraints ? &size_constraints : nullptr, queue);
+      },
+      ppf);
 #else
   return false;
 #endif
@@ -29,6 +29,14 @@ Status DecodeImageGIF(Span<const uint8_t> bytes, const ColorHints& color_hints,
                       PackedPixelFile* ppf,
                       const SizeConstraints* constraints = nullptr);
 
+// Like DecodeImageGIF, but returns after the first frame, with the frames
+// handed over through ppf->frame_queue as they are decoded. `bytes` must
+// outlive the queue.
+Status DecodeImageGIFPipelined(Span<const uint8_t> bytes,
+                               const ColorHints& color_hints,
+                               PackedPixelFile* ppf,
+                               const SizeConstraints* constraints = nullptr);
+
 }  // namespace extras
 }  // namespace jxl
 
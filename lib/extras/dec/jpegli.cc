@@ -17,6 +17,7 @@
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/sanitizers.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/color_encoding_internal.h"
 
 namespace jxl {
 namespace extras {
@@ -70,6 +71,14 @@ void ReadExif(jpeg_decompress_struct* const cinfo,
   }
 }
 
+// Whether `icc` is the profile that the jpegli encoder writes in XYB mode.
+bool IsJpegliXYBProfile(const std::vector<uint8_t>& icc) {
+  ColorEncoding xyb_encoding;
+  xyb_encoding.SetColorSpace(ColorSpace::kXYB);
+  xyb_encoding.SetRenderingIntent(RenderingIntent::kPerceptual);
+  return xyb_encoding.CreateICC() && xyb_encoding.ICC() == icc;
+}
+
 JpegliDataType ConvertDataType(JxlDataType type) {
   switch (type) {
     case JXL_TYPE_UINT8:
@@ -192,7 +201,14 @@ Status DecodeJpeg(const std::vector<uint8_t>& compressed,
     } else if (dparams.force_grayscale) {
       cinfo.out_color_space = JCS_GRAYSCALE;
     }
-    if (ReadICCProfile(&cinfo, &ppf->icc)) {
+    bool has_icc = ReadICCProfile(&cinfo, &ppf->icc);
+    if (has_icc && dparams.xyb_to_srgb && nbcomp == 3 &&
+        cinfo.jpeg_color_space == JCS_RGB && cinfo.out_color_space == JCS_RGB &&
+        IsJpegliXYBProfile(ppf->icc)) {
+      jpegli_set_xyb_to_srgb(&cinfo, TRUE);
+      has_icc = false;
+    }
+    if (has_icc) {
       ppf->primary_color_representation = PackedPixelFile::kIccIsPrimary;
     } else {
       ppf->primary_color_representation =
@@ -29,6 +29,10 @@ struct JpegDecompressParams {
   bool two_pass_quant = true;
   // 0 = none, 1 = ordered, 2 = Floyd-Steinberg
   int dither_mode = 2;
+  // If the image has the XYB ICC profile that jpegli writes in XYB mode, the
+  // decoder converts the pixels to sRGB, which is faster than returning them
+  // with the ICC profile for a CMS transform.
+  bool xyb_to_srgb = false;
 };
 
 Status DecodeJpeg(const std::vector<uint8_t>& compressed,
@@ -16,6 +16,10 @@
 #include <cstdint>
 #include <cstdio>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 #include "lib/extras/common.h"
@@ -112,6 +116,10 @@ void SetBitDepthFromDataType(JxlDataType data_type, uint32_t* bits_per_sample,
       *bits_per_sample = 32;
       *exponent_bits_per_sample = 8;
       break;
+    case JXL_TYPE_RGB10A2:
+      *bits_per_sample = 10;
+      *exponent_bits_per_sample = 0;
+      break;
   }
 }
 
@@ -126,6 +134,72 @@ void UpdateBitDepth(JxlBitDepth bit_depth, JxlDataType data_type, T* info) {
   }
 }
 
+// Passes the pixels given to the image out callback, which arrive in any
+// order and possibly from several threads, to a JXLRowOutput in top to bottom
+// order, as soon as each row is complete.
+class RowReorderer {
+ public:
+  RowReorderer(JXLRowOutput* output, size_t xsize, size_t ysize,
+               size_t pixel_size)
+      : output_(output),
+        xsize_(xsize),
+        ysize_(ysize),
+        pixel_size_(pixel_size) {}
+
+  static void Callback(void* opaque, size_t x, size_t y, size_t num_pixels,
+                       const void* pixels) {
+    static_cast<RowReorderer*>(opaque)->AddPixels(x, y, num_pixels, pixels);
+  }
+
+  // Whether all the rows were passed to the output.
+  bool Done() const { return ok_ && next_row_ == ysize_; }
+
+ private:
+  struct Row {
+    std::vector<uint8_t> pixels;
+    size_t num_pixels = 0;
+  };
+
+  void AddPixels(size_t x, size_t y, size_t num_pixels, const void* pixels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ok_ || y < next_row_ || y >= ysize_) return;
+    Row& row = pending_[y];
+    if (row.pixels.empty()) {
+      if (free_rows_.empty()) {
+        row.pixels.resize(xsize_ * pixel_size_);
+      } else {
+        row.pixels = std::move(free_rows_.back());
+        free_rows_.pop_back();
+      }
+    }
+    memcpy(row.pixels.data() + x * pixel_size_, pixels,
+           num_pixels * pixel_size_);
+    row.num_pixels += num_pixels;
+    while (!pending_.empty() && pending_.begin()->first == next_row_ &&
+           pending_.begin()->second.num_pixels >= xsize_) {
+      Row& next = pending_.begin()->second;
+      if (!output_->AddRow(next.pixels.data())) {
+        ok_ = false;
+        return;
+      }
+      free_rows_.emplace_back(std::move(next.pixels));
+      pending_.erase(pending_.begin());
+      ++next_row_;
+    }
+  }
+
+  JXLRowOutput* output_;
+  size_t xsize_;
+  size_t ysize_;
+  size_t pixel_size_;
+  std::mutex mutex_;
+  bool ok_ = true;
+  size_t next_row_ = 0;
+  // Rows that are not complete yet, or wait for a row above them.
+  std::map<size_t, Row> pending_;
+  std::vector<std::vector<uint8_t>> free_rows_;
+};
+
 }  // namespace
 
 bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
@@ -212,6 +286,11 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
       fprintf(stderr, "JxlDecoderSetUnpremultiplyAlpha failed\n");
       return false;
     }
+    if (JXL_DEC_SUCCESS != JxlDecoderSetPremultiplyAlpha(
+                               dec, TO_JXL_BOOL(dparams.premultiply_alpha))) {
+      fprintf(stderr, "JxlDecoderSetPremultiplyAlpha failed\n");
+      return false;
+    }
     if (dparams.display_nits > 0 &&
         JXL_DEC_SUCCESS !=
             JxlDecoderSetDesiredIntensityTarget(dec, dparams.display_nits)) {
@@ -223,12 +302,21 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
       return false;
     }
   }
-  if (JXL_DEC_SUCCESS != JxlDecoderSetInput(dec, bytes, bytes_size)) {
+  if (dparams.persistent_input && !dparams.allow_partial_input) {
+    if (JXL_DEC_SUCCESS !=
+        JxlDecoderSetPersistentInput(dec, bytes, bytes_size)) {
+      fprintf(stderr, "Decoder failed to set input\n");
+      return false;
+    }
+  } else if (JXL_DEC_SUCCESS != JxlDecoderSetInput(dec, bytes, bytes_size)) {
     fprintf(stderr, "Decoder failed to set input\n");
     return false;
   }
   uint32_t progression_index = 0;
   bool codestream_done = jpeg_bytes == nullptr && accepted_formats.empty();
+  JXLRowOutput* row_output = accepted_formats.empty() ? nullptr
+                                                      : dparams.row_output;
+  std::unique_ptr<RowReorderer> row_reorderer;
   BoxProcessor boxes(dec);
   for (;;) {
     JxlDecoderStatus status = JxlDecoderProcessInput(dec);
@@ -341,6 +429,10 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
           // Mark in the basic info that alpha was unpremultiplied.
           ppf->info.alpha_premultiplied = JXL_FALSE;
         }
+        if (dparams.premultiply_alpha) {
+          // Mark in the basic info that alpha was premultiplied.
+          ppf->info.alpha_premultiplied = JXL_TRUE;
+        }
       }
       bool alpha_found = false;
       for (uint32_t i = 0; i < ppf->info.num_extra_channels; ++i) {
@@ -365,6 +457,14 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
         name.resize(eci.name_length);
         ppf->extra_channels_info.push_back({eci, i, name});
       }
+      if (row_output && (ppf->info.have_animation ||
+                         !ppf->extra_channels_info.empty() ||
+                         max_passes_defined || dparams.max_downsampling > 1)) {
+        fprintf(stderr,
+                "Row output requires a full resolution still image without "
+                "extra channels\n");
+        return false;
+      }
     } else if (status == JXL_DEC_COLOR_ENCODING) {
       if (!dparams.color_space.empty()) {
         if (ppf->info.uses_original_profile) {
@@ -418,12 +518,12 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
         }
       }
     } else if (status == JXL_DEC_FRAME) {
-      auto frame_or = jxl::extras::PackedFrame::Create(ppf->info.xsize,
-                                                       ppf->info.ysize, format);
-      JXL_ASSIGN_OR_QUIT(jxl::extras::PackedFrame frame,
-                         jxl::extras::PackedFrame::Create(
-                             ppf->info.xsize, ppf->info.ysize, format),
-                         "Failed to create image frame.");
+      // With row output, the pixels are not stored.
+      JXL_ASSIGN_OR_QUIT(
+          jxl::extras::PackedFrame frame,
+          jxl::extras::PackedFrame::Create(
+              ppf->info.xsize, row_output ? 0 : ppf->info.ysize, format),
+          "Failed to create image frame.");
       if (JXL_DEC_SUCCESS != JxlDecoderGetFrameHeader(dec, &frame.frame_info)) {
         fprintf(stderr, "JxlDecoderGetFrameHeader failed\n");
         return false;
@@ -491,13 +591,21 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
         return false;
       }
       jxl::extras::PackedFrame& frame = ppf->frames.back();
-      if (buffer_size != frame.color.pixels_size) {
+      if (row_output) {
+        row_reorderer = jxl::make_unique<RowReorderer>(
+            row_output, ppf->info.xsize, ppf->info.ysize,
+            frame.color.pixel_stride());
+        if (JXL_DEC_SUCCESS !=
+            JxlDecoderSetImageOutCallback(dec, &format, RowReorderer::Callback,
+                                          row_reorderer.get())) {
+          fprintf(stderr, "JxlDecoderSetImageOutCallback failed\n");
+          return false;
+        }
+      } else if (buffer_size != frame.color.pixels_size) {
         fprintf(stderr, "Invalid out buffer size %" PRIuS " %" PRIuS "\n",
                 buffer_size, frame.color.pixels_size);
         return false;
-      }
-
-      if (dparams.use_image_callback) {
+      } else if (dparams.use_image_callback) {
         auto callback = [](void* opaque, size_t x, size_t y, size_t num_pixels,
                            const void* pixels) {
           auto* ppf = reinterpret_cast<jxl::extras::PackedPixelFile*>(opaque);
@@ -563,12 +671,20 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
         UpdateBitDepth(dparams.output_bitdepth, ec_format.data_type,
                        &eci.ec_info);
       }
+      if (row_output && !row_output->Start(*ppf, format)) {
+        fprintf(stderr, "Failed to start the row output\n");
+        return false;
+      }
     } else if (status == JXL_DEC_SUCCESS) {
       // Decoding finished successfully.
       break;
     } else if (status == JXL_DEC_PREVIEW_IMAGE) {
       // Nothing to do.
     } else if (status == JXL_DEC_FULL_IMAGE) {
+      if (row_reorderer && !row_reorderer->Done()) {
+        fprintf(stderr, "Failed to output the decoded rows\n");
+        return false;
+      }
       if (jpeg_bytes != nullptr || ppf->frames.back().frame_info.is_last) {
         codestream_done = true;
       }
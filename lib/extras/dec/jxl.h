@@ -19,10 +19,26 @@
 #include <vector>
 
 #include "lib/extras/packed_image.h"
+#include "lib/jxl/base/status.h"
 
 namespace jxl {
 namespace extras {
 
+// Receives the rows of a still image, in top to bottom order, as they are
+// decoded.
+class JXLRowOutput {
+ public:
+  virtual ~JXLRowOutput() = default;
+
+  // Called before the first row, once the basic info and the color encoding
+  // of `ppf` are final. The rows are in `format`.
+  virtual Status Start(const PackedPixelFile& ppf,
+                       const JxlPixelFormat& format) = 0;
+
+  // Called with each row of ppf.info.xsize pixels.
+  virtual Status AddRow(const uint8_t* row) = 0;
+};
+
 struct JXLDecompressParams {
   // If empty, little endian float formats will be accepted.
   std::vector<JxlPixelFormat> accepted_formats;
@@ -46,6 +62,11 @@ struct JXLDecompressParams {
   // Whether truncated input should be treated as an error.
   bool allow_partial_input = false;
 
+  // Whether the input is the whole file and stays valid until decoding is
+  // done, e.g. because it is memory-mapped, so that the decoder can read the
+  // sections in place. Ignored with allow_partial_input.
+  bool persistent_input = false;
+
   // How many passes to decode at most. By default, decode everything.
   uint32_t max_passes = std::numeric_limits<uint32_t>::max();
 
@@ -58,9 +79,17 @@ struct JXLDecompressParams {
   bool use_image_callback = true;
   // Whether to unpremultiply colors for associated alpha channels.
   bool unpremultiply_alpha = false;
+  // Whether to premultiply colors for unassociated alpha channels.
+  bool premultiply_alpha = false;
 
   // Controls the effective bit depth of the output pixels.
   JxlBitDepth output_bitdepth = {JXL_BIT_DEPTH_FROM_PIXEL_FORMAT, 0, 0};
+
+  // If set, the pixels are passed to row_output as the rows are completed,
+  // and the frame in the output only holds the frame header. This requires a
+  // still image without extra channels apart from interleaved alpha, decoded
+  // at full resolution.
+  JXLRowOutput* row_output = nullptr;
 };
 
 bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
@@ -12,6 +12,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "lib/extras/size_constraints.h"
 #include "lib/jxl/base/bits.h"
@@ -315,6 +316,28 @@ class Parser {
   const uint8_t* const end_;
 };
 
+// Splits a row of PAM tuples into the interleaved color (and alpha) samples
+// and the extra channel samples. The sample size is a constant so that the
+// copies of single samples are inlined.
+template <size_t kSampleSize>
+void SplitRow(const uint8_t* JXL_RESTRICT in, size_t xsize,
+              size_t num_interleaved, uint8_t* JXL_RESTRICT out,
+              std::vector<uint8_t*>* ec_out) {
+  const size_t pixel_size = num_interleaved * kSampleSize;
+  for (size_t x = 0; x < xsize; ++x) {
+    for (size_t c = 0; c < num_interleaved; ++c) {
+      memcpy(out + c * kSampleSize, in, kSampleSize);
+      in += kSampleSize;
+    }
+    out += pixel_size;
+    for (uint8_t*& p : *ec_out) {
+      memcpy(p, in, kSampleSize);
+      in += kSampleSize;
+      p += kSampleSize;
+    }
+  }
+}
+
 }  // namespace
 
 struct PNMChunkedInputFrame {
@@ -339,9 +362,22 @@ struct PNMChunkedInputFrame {
         DivCeil(dec->header_.bits_per_sample, jxl::kBitsPerByte);
     const size_t num_channels = dec->header_.is_gray ? 1 : 3;
     const size_t bytes_per_pixel = num_channels * bytes_per_channel;
-    *row_offset = dec->header_.xsize * bytes_per_pixel;
-    const size_t offset = ypos * *row_offset + xpos * bytes_per_pixel;
-    return dec->pnm_.data() + offset + dec->data_start_;
+    const size_t row_size = dec->header_.xsize * bytes_per_pixel;
+    const uint8_t* data = dec->pnm_.data() + dec->data_start_;
+    if (!dec->header_.floating_point) {
+      *row_offset = row_size;
+      return data + ypos * row_size + xpos * bytes_per_pixel;
+    }
+    // PFM rows are stored bottom to top, so the requested rows are copied in
+    // the right order. The buffer is freed by ReleaseCurrentData.
+    *row_offset = xsize * bytes_per_pixel;
+    uint8_t* buffer = new uint8_t[*row_offset * ysize];
+    for (size_t y = 0; y < ysize; ++y) {
+      const size_t y_in = dec->header_.ysize - 1 - (ypos + y);
+      memcpy(buffer + y * *row_offset,
+             data + y_in * row_size + xpos * bytes_per_pixel, *row_offset);
+    }
+    return buffer;
   }
 
   void GetExtraChannelPixelFormat(size_t ec_index,
@@ -360,7 +396,12 @@ struct PNMChunkedInputFrame {
     return nullptr;
   }
 
-  void ReleaseCurrentData(const void* buffer) {}
+  void ReleaseCurrentData(const void* buffer) {
+    // Only the rows of PFM files are not used in place from the mapped file.
+    if (dec->header_.floating_point) {
+      delete[] static_cast<const uint8_t*>(buffer);
+    }
+  }
 
   JxlPixelFormat format;
   const ChunkedPNMDecoder* dec;
@@ -381,11 +422,12 @@ StatusOr<ChunkedPNMDecoder> ChunkedPNMDecoder::Init(const char* path) {
   }
   dec.data_start_ = pos - span.data();
 
-  if (header.bits_per_sample == 0 || header.bits_per_sample > 16) {
+  if (!header.floating_point &&
+      (header.bits_per_sample == 0 || header.bits_per_sample > 16)) {
     return JXL_FAILURE("Invalid bits_per_sample");
   }
-  if (header.has_alpha || !header.ec_types.empty() || header.floating_point) {
-    return JXL_FAILURE("Only PGM and PPM inputs are supported");
+  if (header.has_alpha || !header.ec_types.empty()) {
+    return JXL_FAILURE("Only PGM, PPM and PFM inputs are supported");
   }
 
   const size_t bytes_per_channel =
@@ -410,15 +452,17 @@ jxl::Status ChunkedPNMDecoder::InitializePPF(const ColorHints& color_hints,
   ppf->info.xsize = header_.xsize;
   ppf->info.ysize = header_.ysize;
   ppf->info.bits_per_sample = header_.bits_per_sample;
-  ppf->info.exponent_bits_per_sample = 0;
+  ppf->info.exponent_bits_per_sample = header_.floating_point ? 8 : 0;
   ppf->info.orientation = JXL_ORIENT_IDENTITY;
   ppf->info.alpha_bits = 0;
   ppf->info.alpha_exponent_bits = 0;
   ppf->info.num_color_channels = (header_.is_gray ? 1 : 3);
   ppf->info.num_extra_channels = 0;
 
-  const JxlDataType data_type =
-      header_.bits_per_sample > 8 ? JXL_TYPE_UINT16 : JXL_TYPE_UINT8;
+  const JxlDataType data_type = header_.floating_point ? JXL_TYPE_FLOAT
+                                 : header_.bits_per_sample > 8
+                                     ? JXL_TYPE_UINT16
+                                     : JXL_TYPE_UINT8;
   const JxlPixelFormat format{
       /*num_channels=*/ppf->info.num_color_channels,
       /*data_type=*/data_type,
@@ -524,10 +568,12 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
   for (size_t i = 0; i < ec_out.size(); ++i) {
     ec_out[i] = reinterpret_cast<uint8_t*>(frame->extra_channels[i].pixels());
   }
-  if (ec_out.empty()) {
-    const bool flipped_y = header.bits_per_sample == 32;  // PFMs are flipped
+  if (ec_out.empty() && !header.floating_point) {
+    memcpy(out, pos, frame->color.pixels_size);
+  } else if (ec_out.empty()) {
+    // PFMs are flipped.
     for (size_t y = 0; y < header.ysize; ++y) {
-      size_t y_in = flipped_y ? header.ysize - 1 - y : y;
+      size_t y_in = header.ysize - 1 - y;
       const uint8_t* row_in = &pos[y_in * frame->color.stride];
       uint8_t* row_out = &out[y * frame->color.stride];
       memcpy(row_out, row_in, frame->color.stride);
@@ -535,17 +581,17 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
   } else {
     JXL_RETURN_IF_ERROR(PackedImage::ValidateDataType(data_type));
     size_t pwidth = PackedImage::BitsPerChannel(data_type) / 8;
+    const auto split_row = pwidth == 1   ? SplitRow<1>
+                           : pwidth == 2 ? SplitRow<2>
+                                         : SplitRow<4>;
+    const size_t row_size =
+        frame->color.stride + ec_out.size() * header.xsize * pwidth;
+    if (pnm_remaining_size < row_size * header.ysize) {
+      return JXL_FAILURE("PNM file too small");
+    }
     for (size_t y = 0; y < header.ysize; ++y) {
-      for (size_t x = 0; x < header.xsize; ++x) {
-        memcpy(out, pos, frame->color.pixel_stride());
-        out += frame->color.pixel_stride();
-        pos += frame->color.pixel_stride();
-        for (auto& p : ec_out) {
-          memcpy(p, pos, pwidth);
-          pos += pwidth;
-          p += pwidth;
-        }
-      }
+      split_row(pos + y * row_size, header.xsize, num_interleaved_channels,
+                out + y * frame->color.stride, &ec_out);
     }
   }
   if (ppf->info.exponent_bits_per_sample == 0) {
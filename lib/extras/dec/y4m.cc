@@ -0,0 +1,444 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/dec/y4m.h"
+
+#include <jxl/codestream_header.h>
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lib/extras/frame_queue.h"
+#include "lib/extras/size_constraints.h"
+#include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/span.h"
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+namespace {
+
+constexpr char kSignature[] = "YUV4MPEG2 ";
+constexpr size_t kSignatureSize = sizeof(kSignature) - 1;
+// Longer header lines are either corrupt or not Y4M.
+constexpr size_t kMaxLineSize = 4096;
+
+// The stream of a Y4M sequence, from memory or from a file.
+class Source {
+ public:
+  explicit Source(Span<const uint8_t> bytes) : bytes_(bytes) {}
+  explicit Source(FILE* file) : file_(file) {}
+
+  // Reads exactly `size` bytes.
+  Status Read(uint8_t* data, size_t size) {
+    if (file_ != nullptr) {
+      if (fread(data, 1, size, file_) != size) {
+        return JXL_FAILURE("Y4M: truncated frame");
+      }
+      return true;
+    }
+    if (bytes_.size() < size) return JXL_FAILURE("Y4M: truncated frame");
+    memcpy(data, bytes_.data(), size);
+    return bytes_.remove_prefix(size);
+  }
+
+  // Reads the next line without its '\n', or sets `eof` if the stream ends
+  // before it.
+  Status ReadLine(std::string* line, bool* eof) {
+    line->clear();
+    *eof = false;
+    for (;;) {
+      int c;
+      if (file_ != nullptr) {
+        c = fgetc(file_);
+      } else if (bytes_.empty()) {
+        c = EOF;
+      } else {
+        c = bytes_[0];
+        JXL_RETURN_IF_ERROR(bytes_.remove_prefix(1));
+      }
+      if (c == EOF) {
+        if (!line->empty()) return JXL_FAILURE("Y4M: truncated line");
+        *eof = true;
+        return true;
+      }
+      if (c == '\n') return true;
+      if (line->size() == kMaxLineSize) return JXL_FAILURE("Y4M: long line");
+      line->push_back(static_cast<char>(c));
+    }
+  }
+
+ private:
+  Span<const uint8_t> bytes_;
+  FILE* file_ = nullptr;
+};
+
+struct HeaderY4M {
+  size_t xsize = 0;
+  size_t ysize = 0;
+  uint32_t fps_numerator = 25;
+  uint32_t fps_denominator = 1;
+  size_t bits_per_sample = 8;
+  bool is_gray = false;
+  // Log2 of the chroma subsampling factors.
+  size_t chroma_shift_x = 1;
+  size_t chroma_shift_y = 1;
+  bool full_range = false;
+
+  size_t BytesPerSample() const { return bits_per_sample > 8 ? 2 : 1; }
+  size_t ChromaXSize() const {
+    return (xsize + (1 << chroma_shift_x) - 1) >> chroma_shift_x;
+  }
+  size_t ChromaYSize() const {
+    return (ysize + (1 << chroma_shift_y) - 1) >> chroma_shift_y;
+  }
+  size_t FrameSize() const {
+    size_t samples = xsize * ysize;
+    if (!is_gray) samples += 2 * ChromaXSize() * ChromaYSize();
+    return samples * BytesPerSample();
+  }
+};
+
+// Parses the decimal number at the start of `str`, followed by `end`.
+bool ParseNumber(const char* str, char end, size_t* value, const char** rest) {
+  char* stop;
+  const unsigned long long number = strtoull(str, &stop, 10);  // NOLINT
+  if (stop == str || *stop != end || number > (1ull << 30)) return false;
+  *value = number;
+  *rest = stop;
+  return true;
+}
+
+Status ParseColorSpace(const std::string& value, HeaderY4M* header) {
+  std::string suffix;
+  if (value.compare(0, 4, "mono") == 0) {
+    header->is_gray = true;
+    suffix = value.substr(4);
+  } else {
+    const std::string sampling = value.substr(0, 3);
+    if (sampling == "420") {
+      header->chroma_shift_x = header->chroma_shift_y = 1;
+    } else if (sampling == "422") {
+      header->chroma_shift_x = 1;
+      header->chroma_shift_y = 0;
+    } else if (sampling == "444") {
+      header->chroma_shift_x = header->chroma_shift_y = 0;
+    } else {
+      return JXL_FAILURE("Y4M: unsupported color space %s", value.c_str());
+    }
+    suffix = value.substr(3);
+    // The chroma sample positions are not told apart.
+    if (sampling == "420" &&
+        (suffix == "jpeg" || suffix == "paldv" || suffix == "mpeg2")) {
+      suffix.clear();
+    }
+    if (!suffix.empty() && suffix[0] == 'p') suffix = suffix.substr(1);
+  }
+  if (suffix.empty()) {
+    header->bits_per_sample = 8;
+    return true;
+  }
+  size_t bits;
+  const char* rest;
+  if (!ParseNumber(suffix.c_str(), '\0', &bits, &rest) || bits < 8 ||
+      bits > 16) {
+    return JXL_FAILURE("Y4M: unsupported color space %s", value.c_str());
+  }
+  header->bits_per_sample = bits;
+  return true;
+}
+
+Status ParseHeader(const std::string& line, HeaderY4M* header) {
+  size_t pos = kSignatureSize;
+  while (pos < line.size()) {
+    size_t end = line.find(' ', pos);
+    if (end == std::string::npos) end = line.size();
+    const std::string token = line.substr(pos, end - pos);
+    pos = end + 1;
+    if (token.empty()) continue;
+    const std::string value = token.substr(1);
+    const char* rest;
+    switch (token[0]) {
+      case 'W':
+        if (!ParseNumber(value.c_str(), '\0', &header->xsize, &rest)) {
+          return JXL_FAILURE("Y4M: invalid width");
+        }
+        break;
+      case 'H':
+        if (!ParseNumber(value.c_str(), '\0', &header->ysize, &rest)) {
+          return JXL_FAILURE("Y4M: invalid height");
+        }
+        break;
+      case 'F': {
+        size_t numerator;
+        size_t denominator;
+        if (!ParseNumber(value.c_str(), ':', &numerator, &rest) ||
+            !ParseNumber(rest + 1, '\0', &denominator, &rest) ||
+            numerator == 0 || denominator == 0) {
+          return JXL_FAILURE("Y4M: invalid frame rate");
+        }
+        header->fps_numerator = numerator;
+        header->fps_denominator = denominator;
+        break;
+      }
+      case 'I':
+        if (value != "p" && value != "?") {
+          return JXL_FAILURE("Y4M: interlaced video is not supported");
+        }
+        break;
+      case 'C':
+        JXL_RETURN_IF_ERROR(ParseColorSpace(value, header));
+        break;
+      case 'X':
+        if (value == "COLORRANGE=FULL") header->full_range = true;
+        break;
+      default:
+        // The pixel aspect ratio, and unknown parameters.
+        break;
+    }
+  }
+  if (header->xsize == 0 || header->ysize == 0) {
+    return JXL_FAILURE("Y4M: missing dimensions");
+  }
+  if (header->xsize * header->ysize > (1ull << 40)) {
+    return JXL_FAILURE("Y4M: image too large");
+  }
+  return true;
+}
+
+template <typename T>
+float Sample(const uint8_t* plane, size_t stride, size_t x, size_t y) {
+  const uint8_t* p = plane + (y * stride + x) * sizeof(T);
+  return sizeof(T) == 1 ? p[0] : LoadLE16(p);
+}
+
+// Weights of the nearest samples of a chroma row or column subsampled by
+// 1 << `shift`, at the JPEG sample positions, for the luma sample `i`.
+void ChromaTaps(size_t i, size_t shift, size_t size, size_t* near,
+                size_t* far, float* far_weight) {
+  *near = i >> shift;
+  *far = *near;
+  *far_weight = 0.0f;
+  if (shift == 0) return;
+  if (i & 1) {
+    *far = std::min(*near + 1, size - 1);
+  } else {
+    *far = *near == 0 ? 0 : *near - 1;
+  }
+  *far_weight = 0.25f;
+}
+
+// Converts the planes of one frame to the RGB, or gray, samples of `image`.
+template <typename T>
+void ConvertFrame(const HeaderY4M& header, const uint8_t* planes,
+                  PackedImage* image) {
+  const float max_value = (1u << header.bits_per_sample) - 1;
+  const float scale = 1 << (header.bits_per_sample - 8);
+  // Offsets and multipliers that map the samples to [0, 1] and [-0.5, 0.5].
+  const float luma_offset = header.full_range ? 0.0f : 16.0f * scale;
+  const float luma_mul =
+      header.full_range ? 1.0f / max_value : 1.0f / (219.0f * scale);
+  const float chroma_offset = 128.0f * scale;
+  const float chroma_mul =
+      header.full_range ? 1.0f / max_value : 1.0f / (224.0f * scale);
+  const size_t cxsize = header.ChromaXSize();
+  const size_t cysize = header.ChromaYSize();
+  const uint8_t* luma = planes;
+  const uint8_t* cb_plane = luma + header.xsize * header.ysize * sizeof(T);
+  const uint8_t* cr_plane = cb_plane + cxsize * cysize * sizeof(T);
+  const size_t num_channels = header.is_gray ? 1 : 3;
+  std::vector<float> cb_row(cxsize);
+  std::vector<float> cr_row(cxsize);
+  for (size_t y = 0; y < header.ysize; ++y) {
+    T* out = reinterpret_cast<T*>(static_cast<uint8_t*>(image->pixels()) +
+                                  y * image->stride);
+    if (!header.is_gray) {
+      // Interpolates the chroma rows first.
+      size_t near;
+      size_t far;
+      float w;
+      ChromaTaps(y, header.chroma_shift_y, cysize, &near, &far, &w);
+      for (size_t x = 0; x < cxsize; ++x) {
+        cb_row[x] = (1.0f - w) * Sample<T>(cb_plane, cxsize, x, near) +
+                    w * Sample<T>(cb_plane, cxsize, x, far);
+        cr_row[x] = (1.0f - w) * Sample<T>(cr_plane, cxsize, x, near) +
+                    w * Sample<T>(cr_plane, cxsize, x, far);
+      }
+    }
+    for (size_t x = 0; x < header.xsize; ++x) {
+      const float l =
+          (Sample<T>(luma, header.xsize, x, y) - luma_offset) * luma_mul;
+      float rgb[3] = {l, l, l};
+      if (!header.is_gray) {
+        size_t near;
+        size_t far;
+        float w;
+        ChromaTaps(x, header.chroma_shift_x, cxsize, &near, &far, &w);
+        const float cb =
+            ((1.0f - w) * cb_row[near] + w * cb_row[far] - chroma_offset) *
+            chroma_mul;
+        const float cr =
+            ((1.0f - w) * cr_row[near] + w * cr_row[far] - chroma_offset) *
+            chroma_mul;
+        rgb[0] = l + 1.402f * cr;
+        rgb[1] = l - 0.344136f * cb - 0.714136f * cr;
+        rgb[2] = l + 1.772f * cb;
+      }
+      for (size_t c = 0; c < num_channels; ++c) {
+        const float v = std::min(std::max(rgb[c], 0.0f), 1.0f);
+        out[x * num_channels + c] =
+            static_cast<T>(std::lround(v * max_value));
+      }
+    }
+  }
+}
+
+// Decodes the sequence of `source` into `ppf`, or hands the frames over to
+// `queue` as they are decoded, if not null.
+Status DecodeY4M(Source* source, const ColorHints& color_hints,
+                 PackedPixelFile* ppf, const SizeConstraints* constraints,
+                 PackedFrameQueue* queue) {
+  std::string line;
+  bool eof;
+  JXL_RETURN_IF_ERROR(source->ReadLine(&line, &eof));
+  if (eof || line.compare(0, kSignatureSize, kSignature) != 0) {
+    return JXL_FAILURE("Y4M: invalid signature");
+  }
+  HeaderY4M header;
+  JXL_RETURN_IF_ERROR(ParseHeader(line, &header));
+  JXL_RETURN_IF_ERROR(
+      VerifyDimensions(constraints, header.xsize, header.ysize));
+
+  // Y4M has no color space, its samples are taken as sRGB unless told
+  // otherwise.
+  JXL_RETURN_IF_ERROR(ApplyColorHints(color_hints, /*color_already_set=*/false,
+                                      header.is_gray, ppf));
+  ppf->info.xsize = header.xsize;
+  ppf->info.ysize = header.ysize;
+  ppf->info.bits_per_sample = header.bits_per_sample;
+  ppf->info.exponent_bits_per_sample = 0;
+  ppf->info.orientation = JXL_ORIENT_IDENTITY;
+  ppf->info.alpha_bits = 0;
+  ppf->info.alpha_exponent_bits = 0;
+  ppf->info.num_color_channels = header.is_gray ? 1 : 3;
+  ppf->info.num_extra_channels = 0;
+  // Only known to be an animation once the second frame is read.
+  ppf->info.have_animation = JXL_TRUE;
+  ppf->info.animation.tps_numerator = header.fps_numerator;
+  ppf->info.animation.tps_denominator = header.fps_denominator;
+  ppf->info.animation.num_loops = 0;
+  ppf->frames.clear();
+
+  const JxlPixelFormat format{
+      /*num_channels=*/ppf->info.num_color_channels,
+      /*data_type=*/header.bits_per_sample > 8 ? JXL_TYPE_UINT16
+                                               : JXL_TYPE_UINT8,
+      /*endianness=*/JXL_NATIVE_ENDIAN,
+      /*align=*/0,
+  };
+  std::vector<uint8_t> planes(header.FrameSize());
+  size_t num_frames = 0;
+  for (;;) {
+    JXL_RETURN_IF_ERROR(source->ReadLine(&line, &eof));
+    if (eof) break;
+    if (line.compare(0, 5, "FRAME") != 0 ||
+        (line.size() > 5 && line[5] != ' ')) {
+      return JXL_FAILURE("Y4M: invalid frame header");
+    }
+    JXL_RETURN_IF_ERROR(source->Read(planes.data(), planes.size()));
+    JXL_ASSIGN_OR_RETURN(
+        PackedFrame frame,
+        PackedFrame::Create(header.xsize, header.ysize, format));
+    frame.frame_info.duration = 1;
+    if (header.bits_per_sample > 8) {
+      ConvertFrame<uint16_t>(header, planes.data(), &frame.color);
+    } else {
+      ConvertFrame<uint8_t>(header, planes.data(), &frame.color);
+    }
+    ppf->frames.emplace_back(std::move(frame));
+    num_frames++;
+    if (queue != nullptr && num_frames >= 2) {
+      JXL_RETURN_IF_ERROR(queue->PushFrames(ppf));
+    }
+  }
+  if (num_frames == 0) return JXL_FAILURE("Y4M: no frames");
+  if (num_frames == 1) {
+    ppf->info.have_animation = JXL_FALSE;
+    ppf->info.animation = {};
+    ppf->frames[0].frame_info.duration = 0;
+  }
+  if (queue != nullptr) JXL_RETURN_IF_ERROR(queue->PushFrames(ppf));
+  return true;
+}
+
+bool HasSignature(Span<const uint8_t> bytes) {
+  return bytes.size() >= kSignatureSize &&
+         memcmp(bytes.data(), kSignature, kSignatureSize) == 0;
+}
+
+}  // namespace
+
+Status DecodeImageY4M(const Span<const uint8_t> bytes,
+                      const ColorHints& color_hints, PackedPixelFile* ppf,
+                      const SizeConstraints* constraints) {
+  // Return silently if it is not a Y4M sequence.
+  if (!HasSignature(bytes)) return false;
+  Source source(bytes);
+  return DecodeY4M(&source, color_hints, ppf, constraints, /*queue=*/nullptr);
+}
+
+Status DecodeImageY4MPipelined(const Span<const uint8_t> bytes,
+                               const ColorHints& color_hints,
+                               PackedPixelFile* ppf,
+                               const SizeConstraints* constraints) {
+  // Not a Y4M sequence, no need for a thread to find out.
+  if (!HasSignature(bytes)) return false;
+  const bool have_constraints = constraints != nullptr;
+  const SizeConstraints size_constraints =
+      have_constraints ? *constraints : SizeConstraints();
+  return PackedFrameQueue::Start(
+      [=](PackedFrameQueue* queue) -> Status {
+        PackedPixelFile own_ppf;
+        Source source(bytes);
+        return DecodeY4M(&source, color_hints, &own_ppf,
+                         have_constraints ? &size_constraints : nullptr,
+                         queue);
+      },
+      ppf);
+}
+
+Status DecodeY4MFilePipelined(const char* path, const ColorHints& color_hints,
+                              PackedPixelFile* ppf,
+                              const SizeConstraints* constraints) {
+  std::shared_ptr<FILE> file(fopen(path, "rb"), [](FILE* f) {
+    if (f != nullptr) fclose(f);
+  });
+  if (!file) return JXL_FAILURE("Y4M: could not open %s", path);
+  const bool have_constraints = constraints != nullptr;
+  const SizeConstraints size_constraints =
+      have_constraints ? *constraints : SizeConstraints();
+  return PackedFrameQueue::Start(
+      [=](PackedFrameQueue* queue) -> Status {
+        PackedPixelFile own_ppf;
+        Source source(file.get());
+        return DecodeY4M(&source, color_hints, &own_ppf,
+                         have_constraints ? &size_constraints : nullptr,
+                         queue);
+      },
+      ppf);
+}
+
+}  // namespace extras
+}  // namespace jxl
@@ -0,0 +1,50 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_EXTRAS_DEC_Y4M_H_
+#define LIB_EXTRAS_DEC_Y4M_H_
+
+// Decodes YUV4MPEG2 (Y4M) video sequences into animations.
+
+#include <cstdint>
+
+#include "lib/extras/dec/color_hints.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/span.h"
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+
+struct SizeConstraints;
+
+namespace extras {
+
+// Decodes `bytes` into `ppf`, one frame per video frame. The 4:2:0, 4:2:2,
+// 4:4:4 and monochrome formats are supported at 8 to 16 bits per sample, and
+// the samples are converted to RGB with the BT.601 matrix, in limited range
+// unless the header has XCOLORRANGE=FULL. color_hints may specify the
+// "color_space" of the RGB samples, which defaults to sRGB.
+Status DecodeImageY4M(Span<const uint8_t> bytes, const ColorHints& color_hints,
+                      PackedPixelFile* ppf,
+                      const SizeConstraints* constraints = nullptr);
+
+// Like DecodeImageY4M, but returns after the first frames, with the others
+// handed over through ppf->frame_queue as they are decoded. `bytes` must
+// outlive the queue.
+Status DecodeImageY4MPipelined(Span<const uint8_t> bytes,
+                               const ColorHints& color_hints,
+                               PackedPixelFile* ppf,
+                               const SizeConstraints* constraints = nullptr);
+
+// Like DecodeImageY4MPipelined, but reads the file at `path` as its frames are
+// decoded, so that only the frames waiting in the queue are in memory.
+Status DecodeY4MFilePipelined(const char* path, const ColorHints& color_hints,
+                              PackedPixelFile* ppf,
+                              const SizeConstraints* constraints = nullptr);
+
+}  // namespace extras
+}  // namespace jxl
+
+#endif  // LIB_EXTRAS_DEC_Y4M_H_
@@ -0,0 +1,134 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/dec/y4m.h"
+
+#include <jxl/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lib/extras/dec/color_hints.h"
+#include "lib/extras/frame_queue.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/span.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace extras {
+namespace {
+
+// Appends a frame with constant planes.
+void AppendFrame(size_t luma_size, size_t chroma_size, uint8_t y, uint8_t cb,
+                 uint8_t cr, std::string* y4m) {
+  y4m->append("FRAME\n");
+  y4m->append(luma_size, static_cast<char>(y));
+  y4m->append(chroma_size, static_cast<char>(cb));
+  y4m->append(chroma_size, static_cast<char>(cr));
+}
+
+Span<const uint8_t> MakeSpan(const std::string& str) {
+  return Bytes(reinterpret_cast<const uint8_t*>(str.data()), str.size());
+}
+
+TEST(CodecY4MTest, Decodes420Frames) {
+  std::string y4m = "YUV4MPEG2 W5 H3 F30000:1001 Ip A1:1 C420jpeg\n";
+  // 3x2 chroma samples.
+  AppendFrame(15, 6, 16, 128, 128, &y4m);
+  AppendFrame(15, 6, 235, 128, 128, &y4m);
+  AppendFrame(15, 6, 126, 128, 240, &y4m);
+
+  PackedPixelFile ppf;
+  ASSERT_TRUE(DecodeImageY4M(MakeSpan(y4m), ColorHints(), &ppf));
+  EXPECT_EQ(ppf.info.xsize, 5);
+  EXPECT_EQ(ppf.info.ysize, 3);
+  EXPECT_EQ(ppf.info.bits_per_sample, 8);
+  EXPECT_EQ(ppf.info.num_color_channels, 3);
+  EXPECT_TRUE(ppf.info.have_animation);
+  EXPECT_EQ(ppf.info.animation.tps_numerator, 30000);
+  EXPECT_EQ(ppf.info.animation.tps_denominator, 1001);
+  ASSERT_EQ(ppf.frames.size(), 3);
+  for (const PackedFrame& frame : ppf.frames) {
+    EXPECT_EQ(frame.frame_info.duration, 1);
+    EXPECT_EQ(frame.color.format.data_type, JXL_TYPE_UINT8);
+  }
+  // Limited range black and white.
+  for (size_t c = 0; c < 3; ++c) {
+    EXPECT_EQ(*ppf.frames[0].color.const_pixels(2, 4, c), 0);
+    EXPECT_EQ(*ppf.frames[1].color.const_pixels(2, 4, c), 255);
+  }
+  // Red.
+  EXPECT_NEAR(*ppf.frames[2].color.const_pixels(1, 2, 0), 255, 1);
+  EXPECT_NEAR(*ppf.frames[2].color.const_pixels(1, 2, 1), 37, 1);
+  EXPECT_NEAR(*ppf.frames[2].color.const_pixels(1, 2, 2), 128, 1);
+}
+
+TEST(CodecY4MTest, DecodesFullRangeHighBitDepth) {
+  // Single frame of 2x1 10-bit 4:4:4 samples.
+  std::string y4m = "YUV4MPEG2 W2 H1 F25:1 C444p10 XCOLORRANGE=FULL\nFRAME\n";
+  const uint16_t samples[6] = {0, 1023, 512, 512, 512, 512};
+  for (uint16_t sample : samples) {
+    y4m.push_back(static_cast<char>(sample & 0xFF));
+    y4m.push_back(static_cast<char>(sample >> 8));
+  }
+
+  PackedPixelFile ppf;
+  ASSERT_TRUE(DecodeImageY4M(MakeSpan(y4m), ColorHints(), &ppf));
+  EXPECT_EQ(ppf.info.bits_per_sample, 10);
+  EXPECT_FALSE(ppf.info.have_animation);
+  ASSERT_EQ(ppf.frames.size(), 1);
+  const PackedImage& color = ppf.frames[0].color;
+  EXPECT_EQ(color.format.data_type, JXL_TYPE_UINT16);
+  // The samples keep their 10-bit range.
+  for (size_t c = 0; c < 3; ++c) {
+    EXPECT_NEAR(color.GetPixelValue(0, 0, c) * 65535, 0, 0.5);
+    EXPECT_NEAR(color.GetPixelValue(0, 1, c) * 65535, 1023, 0.5);
+  }
+}
+
+TEST(CodecY4MTest, HandsFramesOverThroughQueue) {
+  std::string y4m = "YUV4MPEG2 W4 H4 F10:1 Cmono\n";
+  const size_t kNumFrames = 7;
+  for (size_t i = 0; i < kNumFrames; ++i) {
+    y4m.append("FRAME\n");
+    y4m.append(16, static_cast<char>(16 + i));
+  }
+
+  PackedPixelFile ppf;
+  ASSERT_TRUE(DecodeImageY4MPipelined(MakeSpan(y4m), ColorHints(), &ppf));
+  ASSERT_TRUE(ppf.frame_queue);
+  EXPECT_TRUE(ppf.info.have_animation);
+  EXPECT_EQ(ppf.info.num_color_channels, 1);
+  size_t num_frames = 0;
+  while (std::unique_ptr<PackedFrame> frame = ppf.frame_queue->Pop()) {
+    EXPECT_EQ(frame->color.xsize, 4);
+    num_frames++;
+  }
+  EXPECT_TRUE(ppf.frame_queue->Finish());
+  EXPECT_EQ(ppf.frames.size() + num_frames, kNumFrames);
+}
+
+TEST(CodecY4MTest, RejectsInvalidSequences) {
+  PackedPixelFile ppf;
+  // Not Y4M.
+  EXPECT_FALSE(DecodeImageY4M(MakeSpan("P5\n4 4\n255\n"), ColorHints(), &ppf));
+  // Interlaced.
+  EXPECT_FALSE(DecodeImageY4M(MakeSpan("YUV4MPEG2 W2 H2 It C444\nFRAME\n"
+                                       "123456789012"),
+                              ColorHints(), &ppf));
+  // Truncated frame.
+  EXPECT_FALSE(DecodeImageY4M(MakeSpan("YUV4MPEG2 W2 H2 C444\nFRAME\n1234"),
+                              ColorHints(), &ppf));
+  // No frames.
+  EXPECT_FALSE(
+      DecodeImageY4M(MakeSpan("YUV4MPEG2 W2 H2 C444\n"), ColorHints(), &ppf));
+}
+
+}  // namespace
+}  // namespace extras
+}  // namespace jxl
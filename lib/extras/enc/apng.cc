@@ -36,14 +36,22 @@
  *
  */
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <string>
 #include <vector>
 
 #include "lib/extras/exif.h"
 #include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #if JPEGXL_ENABLE_APNG
+#include <zlib.h>
+
 #include "png.h" /* original (unpatched) libpng is ok */
 #endif
 
@@ -56,6 +64,15 @@ namespace {
 constexpr unsigned char kExifSignature[6] = {0x45, 0x78, 0x69,
                                              0x66, 0x00, 0x00};
 
+// The filtered image data is compressed in parallel, in bands of about this
+// many bytes, which only depends on the image, so that the output does not
+// depend on the number of threads.
+constexpr size_t kBandSize = 1 << 18;
+// Size of the deflate window, the part of the previous band that is used as
+// dictionary for the next one.
+constexpr size_t kWindowSize = 1 << 15;
+constexpr size_t kMaxIDATSize = 1 << 16;
+
 class APNGEncoder : public Encoder {
  public:
   std::vector<JxlPixelFormat> AcceptedFormats() const override {
@@ -90,6 +107,8 @@ class APNGEncoder : public Encoder {
     return true;
   }
 
+  std::unique_ptr<RowEncoder> CreateRowEncoder() const override;
+
  private:
   Status EncodePackedPixelFileToAPNG(const PackedPixelFile& ppf,
                                      ThreadPool* pool,
@@ -279,6 +298,298 @@ void MaybeAddCLLi(const JxlColorEncoding& c_enc, const float intensity_target,
   png_set_unknown_chunks(png_ptr, info_ptr, &chunk, 1);
 }
 
+// Converts samples in `format` to big endian samples of 8 or 16 bits.
+void ConvertSamples(const uint8_t* in, const JxlPixelFormat& format,
+                    uint32_t bits_per_sample, size_t num_samples,
+                    uint8_t* out) {
+  if (format.data_type == JXL_TYPE_UINT8) {
+    if (bits_per_sample < 8) {
+      float mul = 255.0 / ((1u << bits_per_sample) - 1);
+      for (size_t i = 0; i < num_samples; ++i) {
+        out[i] = static_cast<uint8_t>(std::lroundf(in[i] * mul));
+      }
+    } else {
+      memcpy(out, in, num_samples);
+    }
+  } else if (format.data_type == JXL_TYPE_UINT16) {
+    if (bits_per_sample < 16 || format.endianness != JXL_BIG_ENDIAN) {
+      float mul = 65535.0 / ((1u << bits_per_sample) - 1);
+      const uint8_t* p_in = in;
+      uint8_t* p_out = out;
+      for (size_t i = 0; i < num_samples; ++i, p_in += 2, p_out += 2) {
+        uint32_t val = (format.endianness == JXL_BIG_ENDIAN ? LoadBE16(p_in)
+                                                            : LoadLE16(p_in));
+        StoreBE16(static_cast<uint32_t>(std::lroundf(val * mul)), p_out);
+      }
+    } else {
+      memcpy(out, in, num_samples * 2);
+    }
+  }
+}
+
+uint32_t AbsSum(const uint8_t* row, size_t size) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < size; ++i) {
+    sum += row[i] < 128 ? row[i] : 256 - row[i];
+  }
+  return sum;
+}
+
+uint8_t Paeth(uint8_t a, uint8_t b, uint8_t c) {
+  int pa = std::abs(b - c);
+  int pb = std::abs(a - c);
+  int pc = std::abs(a + b - 2 * c);
+  if (pa <= pb && pa <= pc) return a;
+  return pb <= pc ? b : c;
+}
+
+// Writes the filter type and the filtered bytes of `row` to `out`, with the
+// filter that minimizes the sum of the absolute values of the filtered bytes,
+// as libpng does. `prev` is the previous row, or nullptr for the first row.
+// `scratch` holds the candidate rows, and is resized as needed.
+void FilterRow(const uint8_t* row, const uint8_t* prev, size_t size,
+               size_t bpp, std::vector<uint8_t>* scratch, uint8_t* out) {
+  scratch->resize(4 * size);
+  uint8_t* sub = scratch->data();
+  uint8_t* up = sub + size;
+  uint8_t* avg = up + size;
+  uint8_t* paeth = avg + size;
+  const size_t head = std::min(bpp, size);
+  for (size_t i = 0; i < head; ++i) {
+    const uint8_t b = prev ? prev[i] : 0;
+    sub[i] = row[i];
+    up[i] = row[i] - b;
+    avg[i] = row[i] - (b >> 1);
+    paeth[i] = row[i] - b;
+  }
+  for (size_t i = head; i < size; ++i) {
+    sub[i] = row[i] - row[i - bpp];
+  }
+  if (prev) {
+    for (size_t i = head; i < size; ++i) {
+      up[i] = row[i] - prev[i];
+      avg[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+      paeth[i] = row[i] - Paeth(row[i - bpp], prev[i], prev[i - bpp]);
+    }
+  } else {
+    // Without a previous row, Up is None and Paeth is Sub.
+    for (size_t i = head; i < size; ++i) {
+      up[i] = row[i];
+      avg[i] = row[i] - (row[i - bpp] >> 1);
+      paeth[i] = sub[i];
+    }
+  }
+  const uint8_t* filtered = row;
+  uint8_t filter = 0;
+  uint32_t best = AbsSum(row, size);
+  const uint8_t* candidates[4] = {sub, up, avg, paeth};
+  for (uint8_t f = 1; f <= 4; ++f) {
+    const uint32_t sum = AbsSum(candidates[f - 1], size);
+    if (sum < best) {
+      best = sum;
+      filter = f;
+      filtered = candidates[f - 1];
+    }
+  }
+  out[0] = filter;
+  memcpy(out + 1, filtered, size);
+}
+
+// Compresses `size` bytes at `data` as a part of a raw deflate stream, using
+// the `dict_size` bytes before `data` as dictionary. All but the last part end
+// at a byte boundary without the final block, so that the parts can be
+// concatenated.
+Status CompressBand(const uint8_t* data, size_t size, size_t dict_size,
+                    bool last, std::vector<uint8_t>* out) {
+  z_stream strm = {};
+  if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                   /*memLevel=*/8, Z_FILTERED) != Z_OK) {
+    return JXL_FAILURE("Could not init zlib");
+  }
+  if (dict_size > 0) {
+    deflateSetDictionary(&strm, data - dict_size, dict_size);
+  }
+  // Room for the empty block of the sync flush.
+  out->resize(deflateBound(&strm, size) + 16);
+  strm.next_in = const_cast<Bytef*>(data);
+  strm.avail_in = size;
+  strm.next_out = out->data();
+  strm.avail_out = out->size();
+  const int ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+  const bool ok = (ret == (last ? Z_STREAM_END : Z_OK)) &&
+                  strm.avail_in == 0 && strm.avail_out > 0;
+  out->resize(strm.total_out);
+  deflateEnd(&strm);
+  if (!ok) return JXL_FAILURE("zlib compression failed");
+  return true;
+}
+
+// Filters the rows of an image, stored with the given stride, and compresses
+// them in a zlib stream, the content of the IDAT or fdAT chunks. Both steps
+// run in parallel on `pool`.
+Status CompressImageData(const uint8_t* pixels, size_t ysize, size_t stride,
+                         size_t bpp, ThreadPool* pool,
+                         std::vector<uint8_t>* compressed) {
+  const size_t filtered_stride = stride + 1;
+  std::vector<uint8_t> filtered(ysize * filtered_stride);
+  std::vector<std::vector<uint8_t>> scratch;
+  const auto init_scratch = [&](size_t num_threads) -> Status {
+    scratch.resize(num_threads);
+    return true;
+  };
+  const auto filter_row = [&](uint32_t y, size_t thread) -> Status {
+    FilterRow(pixels + y * stride, y > 0 ? pixels + (y - 1) * stride : nullptr,
+              stride, bpp, &scratch[thread],
+              filtered.data() + y * filtered_stride);
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(
+      RunOnPool(pool, 0, ysize, init_scratch, filter_row, "FilterPNGRows"));
+
+  const size_t rows_per_band = std::max<size_t>(1, kBandSize / filtered_stride);
+  const size_t num_bands = DivCeil(ysize, rows_per_band);
+  std::vector<std::vector<uint8_t>> bands(num_bands);
+  std::vector<uint32_t> adlers(num_bands);
+  const auto compress_band = [&](uint32_t band, size_t /*thread*/) -> Status {
+    const size_t begin = band * rows_per_band * filtered_stride;
+    const size_t end =
+        std::min(ysize, (band + 1) * rows_per_band) * filtered_stride;
+    const uint8_t* data = filtered.data() + begin;
+    adlers[band] = adler32(1, data, end - begin);
+    return CompressBand(data, end - begin, std::min(begin, kWindowSize),
+                        band + 1 == num_bands, &bands[band]);
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_bands, ThreadPool::NoInit,
+                                compress_band, "CompressPNGBands"));
+
+  // zlib header for the default compression level, without dictionary.
+  compressed->assign({0x78, 0x9C});
+  uLong adler = 1;
+  for (size_t band = 0; band < num_bands; ++band) {
+    const size_t begin = band * rows_per_band;
+    const size_t end = std::min(ysize, begin + rows_per_band);
+    adler = adler32_combine(adler, adlers[band],
+                            (end - begin) * filtered_stride);
+    compressed->insert(compressed->end(), bands[band].begin(),
+                       bands[band].end());
+  }
+  const size_t pos = compressed->size();
+  compressed->resize(pos + 4);
+  StoreBE32(adler, compressed->data() + pos);
+  return true;
+}
+
+// Adds the color encoding and the metadata of `ppf` to the PNG header.
+Status AddColorAndMetadataChunks(const PackedPixelFile& ppf,
+                                 png_structp png_ptr, png_infop info_ptr) {
+  if (!MaybeAddSRGB(ppf.color_encoding, png_ptr, info_ptr)) {
+    MaybeAddCICP(ppf.color_encoding, png_ptr, info_ptr);
+    if (!ppf.icc.empty()) {
+      png_set_benign_errors(png_ptr, 1);
+      png_set_iCCP(png_ptr, info_ptr, "1", 0, ppf.icc.data(), ppf.icc.size());
+    }
+    MaybeAddCHRM(ppf.color_encoding, png_ptr, info_ptr);
+    MaybeAddGAMA(ppf.color_encoding, png_ptr, info_ptr);
+  }
+  MaybeAddCLLi(ppf.color_encoding, ppf.info.intensity_target, png_ptr,
+               info_ptr);
+
+  std::vector<std::string> textstrings;
+  JXL_RETURN_IF_ERROR(BlobsWriterPNG::Encode(ppf.metadata, &textstrings));
+  for (size_t kk = 0; kk + 1 < textstrings.size(); kk += 2) {
+    png_text text;
+    text.key = const_cast<png_charp>(textstrings[kk].c_str());
+    text.text = const_cast<png_charp>(textstrings[kk + 1].c_str());
+    text.compression = PNG_TEXT_COMPRESSION_zTXt;
+    png_set_text(png_ptr, info_ptr, &text, 1);
+  }
+  return true;
+}
+
+// Writes the rows of a still image to a non-interlaced PNG as they come; the
+// compressed data produced so far is moved to the caller after each call.
+class APNGRowEncoder : public RowEncoder {
+ public:
+  ~APNGRowEncoder() override {
+    png_destroy_write_struct(&png_ptr_, &info_ptr_);
+  }
+
+  Status StartImage(const PackedPixelFile& ppf, const JxlPixelFormat& format,
+                    std::vector<uint8_t>* bytes) override {
+    JXL_RETURN_IF_ERROR(Encoder::VerifyBasicInfo(ppf.info));
+    if (ppf.info.have_animation) {
+      return JXL_FAILURE("Animations can not be encoded row by row");
+    }
+    const bool has_alpha = (ppf.info.alpha_bits != 0);
+    const bool is_gray = (ppf.info.num_color_channels == 1);
+    const size_t num_channels =
+        ppf.info.num_color_channels + (has_alpha ? 1 : 0);
+    if (format.num_channels != num_channels) {
+      return JXL_FAILURE("Unexpected number of channels");
+    }
+    if (format.data_type != JXL_TYPE_UINT8 &&
+        format.data_type != JXL_TYPE_UINT16) {
+      return JXL_FAILURE("Unsupported data type for PNG rows");
+    }
+    JXL_RETURN_IF_ERROR(Encoder::VerifyBitDepth(
+        format.data_type, ppf.info.bits_per_sample, /*exponent_bits=*/0));
+    format_ = format;
+    bits_per_sample_ = ppf.info.bits_per_sample;
+    num_samples_ = ppf.info.xsize * format.num_channels;
+    const size_t out_bytes_per_sample =
+        format.data_type == JXL_TYPE_UINT16 ? 2 : 1;
+    row_.resize(num_samples_ * out_bytes_per_sample);
+
+    png_ptr_ = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr,
+                                       nullptr);
+    if (!png_ptr_) return JXL_FAILURE("Could not init png encoder");
+    info_ptr_ = png_create_info_struct(png_ptr_);
+    if (!info_ptr_) return JXL_FAILURE("Could not init png info struct");
+    png_set_write_fn(png_ptr_, &pending_, PngWrite, nullptr);
+
+    png_byte color_type = (is_gray ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB);
+    if (has_alpha) color_type |= PNG_COLOR_MASK_ALPHA;
+    png_set_IHDR(png_ptr_, info_ptr_, ppf.info.xsize, ppf.info.ysize,
+                 out_bytes_per_sample * 8, color_type, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    JXL_RETURN_IF_ERROR(AddColorAndMetadataChunks(ppf, png_ptr_, info_ptr_));
+    png_write_info(png_ptr_, info_ptr_);
+    MovePending(bytes);
+    return true;
+  }
+
+  Status AddRow(const uint8_t* row, std::vector<uint8_t>* bytes) override {
+    ConvertSamples(row, format_, bits_per_sample_, num_samples_, row_.data());
+    png_write_row(png_ptr_, row_.data());
+    MovePending(bytes);
+    return true;
+  }
+
+  Status Finish(std::vector<uint8_t>* bytes) override {
+    png_write_end(png_ptr_, nullptr);
+    MovePending(bytes);
+    return true;
+  }
+
+ private:
+  void MovePending(std::vector<uint8_t>* bytes) {
+    bytes->insert(bytes->end(), pending_.begin(), pending_.end());
+    pending_.clear();
+  }
+
+  png_structp png_ptr_ = nullptr;
+  png_infop info_ptr_ = nullptr;
+  JxlPixelFormat format_ = {};
+  uint32_t bits_per_sample_ = 0;
+  size_t num_samples_ = 0;
+  std::vector<uint8_t> row_;
+  std::vector<uint8_t> pending_;
+};
+
+std::unique_ptr<RowEncoder> APNGEncoder::CreateRowEncoder() const {
+  return jxl::make_unique<APNGRowEncoder>();
+}
+
 Status APNGEncoder::EncodePackedPixelFileToAPNG(
     const PackedPixelFile& ppf, ThreadPool* pool, std::vector<uint8_t>* bytes,
     bool encode_extra_channels, size_t extra_channel_index) const {
@@ -310,7 +621,6 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
 
     size_t xsize = color.xsize;
     size_t ysize = color.ysize;
-    size_t num_samples = num_channels * xsize * ysize;
 
     uint32_t bits_per_sample = encode_extra_channels ? ec_info.bits_per_sample
                                                      : ppf.info.bits_per_sample;
@@ -331,30 +641,17 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
     size_t out_stride = xsize * num_channels * out_bytes_per_sample;
     size_t out_size = ysize * out_stride;
     std::vector<uint8_t> out(out_size);
-
-    if (format.data_type == JXL_TYPE_UINT8) {
-      if (bits_per_sample < 8) {
-        float mul = 255.0 / ((1u << bits_per_sample) - 1);
-        for (size_t i = 0; i < num_samples; ++i) {
-          out[i] = static_cast<uint8_t>(std::lroundf(in[i] * mul));
-        }
-      } else {
-        memcpy(out.data(), in, out_size);
-      }
-    } else if (format.data_type == JXL_TYPE_UINT16) {
-      if (bits_per_sample < 16 || format.endianness != JXL_BIG_ENDIAN) {
-        float mul = 65535.0 / ((1u << bits_per_sample) - 1);
-        const uint8_t* p_in = in;
-        uint8_t* p_out = out.data();
-        for (size_t i = 0; i < num_samples; ++i, p_in += 2, p_out += 2) {
-          uint32_t val = (format.endianness == JXL_BIG_ENDIAN ? LoadBE16(p_in)
-                                                              : LoadLE16(p_in));
-          StoreBE16(static_cast<uint32_t>(std::lroundf(val * mul)), p_out);
-        }
-      } else {
-        memcpy(out.data(), in, out_size);
-      }
-    }
+    const auto convert_row = [&](uint32_t y, size_t /*thread*/) -> Status {
+      ConvertSamples(in + y * color.stride, format, bits_per_sample,
+                     xsize * num_channels, out.data() + y * out_stride);
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, ysize, ThreadPool::NoInit,
+                                  convert_row, "ConvertPNGRows"));
+    std::vector<uint8_t> compressed;
+    JXL_RETURN_IF_ERROR(CompressImageData(out.data(), ysize, out_stride,
+                                          num_channels * out_bytes_per_sample,
+                                          pool, &compressed));
     png_structp png_ptr;
     png_infop info_ptr;
 
@@ -380,29 +677,7 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
                  PNG_FILTER_TYPE_BASE);
     if (count == 0 && !encode_extra_channels) {
-      if (!MaybeAddSRGB(ppf.color_encoding, png_ptr, info_ptr)) {
-        MaybeAddCICP(ppf.color_encoding, png_ptr, info_ptr);
-        if (!ppf.icc.empty()) {
-          png_set_benign_errors(png_ptr, 1);
-          png_set_iCCP(png_ptr, info_ptr, "1", 0, ppf.icc.data(),
-                       ppf.icc.size());
-        }
-        MaybeAddCHRM(ppf.color_encoding, png_ptr, info_ptr);
-        MaybeAddGAMA(ppf.color_encoding, png_ptr, info_ptr);
-      }
-      MaybeAddCLLi(ppf.color_encoding, ppf.info.intensity_target, png_ptr,
-                   info_ptr);
-
-      std::vector<std::string> textstrings;
-      JXL_RETURN_IF_ERROR(BlobsWriterPNG::Encode(ppf.metadata, &textstrings));
-      for (size_t kk = 0; kk + 1 < textstrings.size(); kk += 2) {
-        png_text text;
-        text.key = const_cast<png_charp>(textstrings[kk].c_str());
-        text.text = const_cast<png_charp>(textstrings[kk + 1].c_str());
-        text.compression = PNG_TEXT_COMPRESSION_zTXt;
-        png_set_text(png_ptr, info_ptr, &text, 1);
-      }
-
+      JXL_RETURN_IF_ERROR(AddColorAndMetadataChunks(ppf, png_ptr, info_ptr));
       png_write_info(png_ptr, info_ptr);
     } else {
       // fake writing a header, otherwise libpng gets confused
@@ -435,38 +710,26 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
       png_write_chunk(png_ptr, fctl, fdata, 26);
     }
 
-    std::vector<uint8_t*> rows(height);
-    for (int y = 0; y < height; ++y) {
-      rows[y] = out.data() + y * out_stride;
-    }
-
-    png_write_flush(png_ptr);
-    const size_t pos = bytes->size();
-    png_write_image(png_ptr, rows.data());
-    png_write_flush(png_ptr);
-    if (count > 0) {
+    if (count == 0) {
+      png_byte idat[5] = "IDAT";
+      for (size_t pos = 0; pos < compressed.size(); pos += kMaxIDATSize) {
+        png_write_chunk(png_ptr, idat, compressed.data() + pos,
+                        std::min(kMaxIDATSize, compressed.size() - pos));
+      }
+    } else {
       std::vector<uint8_t> fdata(4);
       png_save_uint_32(fdata.data(), anim_chunks++);
-      size_t p = pos;
-      while (p + 8 < bytes->size()) {
-        size_t len = png_get_uint_32(bytes->data() + p);
-        JXL_ENSURE(bytes->operator[](p + 4) == 'I');
-        JXL_ENSURE(bytes->operator[](p + 5) == 'D');
-        JXL_ENSURE(bytes->operator[](p + 6) == 'A');
-        JXL_ENSURE(bytes->operator[](p + 7) == 'T');
-        fdata.insert(fdata.end(), bytes->data() + p + 8,
-                     bytes->data() + p + 8 + len);
-        p += len + 12;
-      }
-      bytes->resize(pos);
-
+      fdata.insert(fdata.end(), compressed.begin(), compressed.end());
       png_byte fdat[5] = "fdAT";
       png_write_chunk(png_ptr, fdat, fdata.data(), fdata.size());
     }
 
     count++;
     if (count == ppf.frames.size() || !ppf.info.have_animation) {
-      png_write_end(png_ptr, nullptr);
+      // libpng does not know about the image data written above, so
+      // png_write_end would fail.
+      png_byte iend[5] = "IEND";
+      png_write_chunk(png_ptr, iend, nullptr, 0);
     }
 
     png_destroy_write_struct(&png_ptr, &info_ptr);
@@ -44,6 +44,26 @@ struct EncodedImage {
   std::vector<uint8_t> metadata;
 };
 
+// Encodes a still image row by row, in top to bottom order, so that the
+// pixels never have to be stored whole. The bytes produced by each call are
+// appended to `bytes`, to be written out by the caller.
+class RowEncoder {
+ public:
+  virtual ~RowEncoder() = default;
+
+  // Encodes the header for the image described by `ppf`, whose frames are not
+  // used, with rows of pixels in `format`.
+  virtual Status StartImage(const PackedPixelFile& ppf,
+                            const JxlPixelFormat& format,
+                            std::vector<uint8_t>* bytes) = 0;
+
+  // Encodes the next row of ppf.info.xsize pixels.
+  virtual Status AddRow(const uint8_t* row, std::vector<uint8_t>* bytes) = 0;
+
+  // Called after the last row.
+  virtual Status Finish(std::vector<uint8_t>* bytes) = 0;
+};
+
 class Encoder {
  public:
   static std::unique_ptr<Encoder> FromExtension(std::string extension);
@@ -58,6 +78,13 @@ class Encoder {
   virtual Status Encode(const PackedPixelFile& ppf, EncodedImage* encoded_image,
                         ThreadPool* pool) const = 0;
 
+  // Returns an encoder for the same format that takes the pixels of a still
+  // image without extra channels row by row, or nullptr if the format can not
+  // be written that way.
+  virtual std::unique_ptr<RowEncoder> CreateRowEncoder() const {
+    return nullptr;
+  }
+
   void SetOption(std::string name, std::string value) {
     options_[std::move(name)] = std::move(value);
   }
@@ -10,13 +10,18 @@
 #include <ImfIO.h>
 #include <ImfRgbaFile.h>
 #include <ImfStandardAttributes.h>
+#include <ImfThreading.h>
 #endif
 #include <jxl/codestream_header.h>
 
+#include <algorithm>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "lib/extras/packed_image.h"
 #include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/data_parallel.h"
 
 namespace jxl {
 namespace extras {
@@ -76,10 +81,22 @@ float LoadLEFloat(const uint8_t* p) {
   return result;
 }
 
+// Lets OpenEXR compress the scanlines of the files opened after this on its
+// global thread pool.
+void EnableEXRThreads() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    if (OpenEXR::globalThreadCount() == 0) {
+      OpenEXR::setGlobalThreadCount(
+          std::max(1u, std::thread::hardware_concurrency()));
+    }
+  });
+}
+
 Status EncodeImageEXR(const PackedImage& image, const JxlBasicInfo& info,
                       const JxlColorEncoding& c_enc, ThreadPool* pool,
                       std::vector<uint8_t>* bytes) {
-  OpenEXR::setGlobalThreadCount(0);
+  EnableEXRThreads();
 
   const size_t xsize = info.xsize;
   const size_t ysize = info.ysize;
@@ -95,12 +112,15 @@ Status EncodeImageEXR(const PackedImage& image, const JxlBasicInfo& info,
   const size_t num_channels = 3 + (has_alpha ? 1 : 0);
   const JxlPixelFormat format = image.format;
 
-  if (format.data_type != JXL_TYPE_FLOAT) {
+  if (format.data_type != JXL_TYPE_FLOAT &&
+      format.data_type != JXL_TYPE_FLOAT16) {
     return JXL_FAILURE("Unsupported pixel format for OpenEXR output");
   }
+  const bool is_half = format.data_type == JXL_TYPE_FLOAT16;
+  const size_t sample_size = is_half ? 2 : 4;
 
   const uint8_t* in = reinterpret_cast<const uint8_t*>(image.pixels());
-  size_t in_stride = num_channels * 4 * xsize;
+  size_t in_stride = num_channels * sample_size * xsize;
 
   OpenEXR::Header header(xsize, ysize);
   OpenEXR::Chromaticities chromaticities;
@@ -115,10 +135,52 @@ Status EncodeImageEXR(const PackedImage& image, const JxlBasicInfo& info,
   OpenEXR::addChromaticities(header, chromaticities);
   OpenEXR::addWhiteLuminance(header, info.intensity_target);
 
-  auto loadFloat =
-      format.endianness == JXL_BIG_ENDIAN ? LoadBEFloat : LoadLEFloat;
-  auto loadAlpha =
-      has_alpha ? loadFloat : [](const uint8_t* p) -> float { return 1.0f; };
+  const bool big_endian = format.endianness == JXL_BIG_ENDIAN;
+  auto loadFloat = big_endian ? LoadBEFloat : LoadLEFloat;
+  auto loadHalf = big_endian ? LoadBE16 : LoadLE16;
+
+  // The whole image is written in one call, as the OpenEXR documentation
+  // recommends.
+  std::vector<OpenEXR::Rgba> output_rows(xsize * ysize);
+  const auto convert_row = [&](const uint32_t y, size_t /*thread*/) -> Status {
+    const uint8_t* in_row = &in[y * in_stride];
+    OpenEXR::Rgba* const JXL_RESTRICT row_data = &output_rows[y * xsize];
+    for (size_t x = 0; x < xsize; ++x) {
+      const uint8_t* in_pixel = &in_row[sample_size * num_channels * x];
+      OpenEXR::Rgba& out = row_data[x];
+      if (is_half) {
+        // Half samples are kept as they are, unless they are premultiplied.
+        out.r.setBits(static_cast<uint16_t>(loadHalf(&in_pixel[0])));
+        out.g.setBits(static_cast<uint16_t>(loadHalf(&in_pixel[2])));
+        out.b.setBits(static_cast<uint16_t>(loadHalf(&in_pixel[4])));
+        if (has_alpha) {
+          out.a.setBits(static_cast<uint16_t>(loadHalf(&in_pixel[6])));
+        } else {
+          out.a = 1.0f;
+        }
+        if (has_alpha && !alpha_is_premultiplied) {
+          const float alpha = out.a;
+          out.r = static_cast<float>(out.r) * alpha;
+          out.g = static_cast<float>(out.g) * alpha;
+          out.b = static_cast<float>(out.b) * alpha;
+        }
+        continue;
+      }
+      float r = loadFloat(&in_pixel[0]);
+      float g = loadFloat(&in_pixel[4]);
+      float b = loadFloat(&in_pixel[8]);
+      const float alpha = has_alpha ? loadFloat(&in_pixel[12]) : 1.0f;
+      if (!alpha_is_premultiplied) {
+        r *= alpha;
+        g *= alpha;
+        b *= alpha;
+      }
+      out = OpenEXR::Rgba(r, g, b, alpha);
+    }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, ysize, ThreadPool::NoInit,
+                                convert_row, "ConvertEXRRows"));
 
   // Ensure that the destructor of RgbaOutputFile has run before we look at the
   // size of `bytes`.
@@ -126,36 +188,9 @@ Status EncodeImageEXR(const PackedImage& image, const JxlBasicInfo& info,
     InMemoryOStream os(bytes);
     OpenEXR::RgbaOutputFile output(
         os, header, has_alpha ? OpenEXR::WRITE_RGBA : OpenEXR::WRITE_RGB);
-    // How many rows to write at once. Again, the OpenEXR documentation
-    // recommends writing the whole image in one call.
-    const int y_chunk_size = ysize;
-    std::vector<OpenEXR::Rgba> output_rows(xsize * y_chunk_size);
-
-    for (size_t start_y = 0; start_y < ysize; start_y += y_chunk_size) {
-      // Inclusive.
-      const size_t end_y = std::min(start_y + y_chunk_size - 1, ysize - 1);
-      output.setFrameBuffer(output_rows.data() - start_y * xsize,
-                            /*xStride=*/1, /*yStride=*/xsize);
-      for (size_t y = start_y; y <= end_y; ++y) {
-        const uint8_t* in_row = &in[(y - start_y) * in_stride];
-        OpenEXR::Rgba* const JXL_RESTRICT row_data =
-            &output_rows[(y - start_y) * xsize];
-        for (size_t x = 0; x < xsize; ++x) {
-          const uint8_t* in_pixel = &in_row[4 * num_channels * x];
-          float r = loadFloat(&in_pixel[0]);
-          float g = loadFloat(&in_pixel[4]);
-          float b = loadFloat(&in_pixel[8]);
-          const float alpha = loadAlpha(&in_pixel[12]);
-          if (!alpha_is_premultiplied) {
-            r *= alpha;
-            g *= alpha;
-            b *= alpha;
-          }
-          row_data[x] = OpenEXR::Rgba(r, g, b, alpha);
-        }
-      }
-      output.writePixels(/*numScanLines=*/end_y - start_y + 1);
-    }
+    output.setFrameBuffer(output_rows.data(), /*xStride=*/1,
+                          /*yStride=*/xsize);
+    output.writePixels(/*numScanLines=*/ysize);
   }
 
   return true;
@@ -165,7 +200,7 @@ class EXREncoder : public Encoder {
   std::vector<JxlPixelFormat> AcceptedFormats() const override {
     std::vector<JxlPixelFormat> formats;
     for (const uint32_t num_channels : {1, 2, 3, 4}) {
-      for (const JxlDataType data_type : {JXL_TYPE_FLOAT}) {
+      for (const JxlDataType data_type : {JXL_TYPE_FLOAT, JXL_TYPE_FLOAT16}) {
         for (JxlEndianness endianness : {JXL_BIG_ENDIAN, JXL_LITTLE_ENDIAN}) {
           formats.push_back(JxlPixelFormat{/*num_channels=*/num_channels,
                                            /*data_type=*/data_type,
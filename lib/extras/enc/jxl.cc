@@ -14,10 +14,13 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <memory>
 #include <vector>
 
+#include "lib/extras/frame_queue.h"
 #include "lib/extras/packed_image.h"
 #include "lib/jxl/base/exif.h"
+#include "lib/jxl/base/printf_macros.h"
 
 namespace jxl {
 namespace extras {
@@ -94,10 +97,11 @@ bool SetupFrame(JxlEncoder* enc, JxlEncoderFrameSettings* settings,
   return true;
 }
 
+// Appends the output for the input added so far to `compressed`.
 bool ReadCompressedOutput(JxlEncoder* enc, std::vector<uint8_t>* compressed) {
-  compressed->clear();
-  compressed->resize(4096);
-  uint8_t* next_out = compressed->data();
+  const size_t pos = compressed->size();
+  compressed->resize(pos + 4096);
+  uint8_t* next_out = compressed->data() + pos;
   size_t avail_out = compressed->size() - (next_out - compressed->data());
   JxlEncoderStatus result = JXL_ENC_NEED_MORE_OUTPUT;
   while (result == JXL_ENC_NEED_MORE_OUTPUT) {
@@ -122,6 +126,7 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
                     std::vector<uint8_t>* compressed) {
   auto encoder = JxlEncoderMake(params.memory_manager);
   JxlEncoder* enc = encoder.get();
+  if (!params.HasOutputProcessor()) compressed->clear();
 
   if (params.allow_expert_options) {
     JxlEncoderAllowExpertOptions(enc);
@@ -325,8 +330,8 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
       JxlEncoderCloseBoxes(enc);
     }
 
-    for (size_t num_frame = 0; num_frame < ppf.frames.size(); ++num_frame) {
-      const jxl::extras::PackedFrame& pframe = ppf.frames[num_frame];
+    const auto add_frame = [&](const PackedFrame& pframe,
+                               size_t num_frame) -> bool {
       const jxl::extras::PackedImage& pimage = pframe.color;
       JxlPixelFormat ppixelformat = pimage.format;
       size_t num_interleaved_alpha =
@@ -353,6 +358,45 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
           return false;
         }
       }
+      return true;
+    };
+    for (size_t num_frame = 0; num_frame < ppf.frames.size(); ++num_frame) {
+      if (!add_frame(ppf.frames[num_frame], num_frame)) return false;
+    }
+    if (ppf.frame_queue) {
+      // Each frame that is still being decoded is added once the next one is
+      // available, since the last frame must be known before it is encoded,
+      // and then encoded while the following frames are decoded.
+      PackedFrameQueue* queue = ppf.frame_queue.get();
+      size_t num_frame = ppf.frames.size();
+      std::unique_ptr<PackedFrame> pframe = queue->Pop();
+      while (pframe) {
+        std::unique_ptr<PackedFrame> next = queue->Pop();
+        if (!next && !queue->Finish()) {
+          fprintf(stderr, "Decoding the input frames failed.\n");
+          return false;
+        }
+        if (!add_frame(*pframe, num_frame++)) {
+          (void)queue->Finish();
+          return false;
+        }
+        if (next) {
+          bool ok = params.HasOutputProcessor()
+                        ? JXL_ENC_SUCCESS == JxlEncoderFlushInput(enc)
+                        : ReadCompressedOutput(enc, compressed);
+          if (!ok) {
+            fprintf(stderr, "Encoding frame %" PRIuS " failed.\n",
+                    num_frame - 1);
+            (void)queue->Finish();
+            return false;
+          }
+        }
+        pframe = std::move(next);
+      }
+      if (num_frame == ppf.frames.size() && !queue->Finish()) {
+        fprintf(stderr, "Decoding the input frames failed.\n");
+        return false;
+      }
     }
     for (size_t fi = 0; fi < ppf.chunked_frames.size(); ++fi) {
       ChunkedPackedFrame& chunked_frame = ppf.chunked_frames[fi];
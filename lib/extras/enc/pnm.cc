@@ -14,6 +14,7 @@
 
 #include "lib/extras/packed_image.h"
 #include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/status.h"
 
@@ -23,6 +24,27 @@ namespace {
 
 constexpr size_t kMaxHeaderSize = 2000;
 
+// Interleaves a row of color (and alpha) samples with the extra channel
+// samples into PAM tuples. The sample size is a constant so that the copies
+// of single samples are inlined.
+template <size_t kSampleSize>
+void InterleaveRow(const uint8_t* JXL_RESTRICT in, size_t xsize,
+                   size_t num_interleaved,
+                   const std::vector<const uint8_t*>& ec_in,
+                   uint8_t* JXL_RESTRICT out) {
+  for (size_t x = 0; x < xsize; ++x) {
+    for (size_t c = 0; c < num_interleaved; ++c) {
+      memcpy(out, in, kSampleSize);
+      in += kSampleSize;
+      out += kSampleSize;
+    }
+    for (const uint8_t* p : ec_in) {
+      memcpy(out, p + x * kSampleSize, kSampleSize);
+      out += kSampleSize;
+    }
+  }
+}
+
 class BasePNMEncoder : public Encoder {
  public:
   Status Encode(const PackedPixelFile& ppf, EncodedImage* encoded_image,
@@ -39,7 +61,7 @@ class BasePNMEncoder : public Encoder {
       JXL_RETURN_IF_ERROR(VerifyPackedImage(frame.color, ppf.info));
       encoded_image->bitstreams.emplace_back();
       JXL_RETURN_IF_ERROR(
-          EncodeFrame(ppf, frame, &encoded_image->bitstreams.back()));
+          EncodeFrame(ppf, frame, pool, &encoded_image->bitstreams.back()));
     }
     for (size_t i = 0; i < ppf.extra_channels_info.size(); ++i) {
       const auto& ec_info = ppf.extra_channels_info[i].ec_info;
@@ -48,7 +70,7 @@ class BasePNMEncoder : public Encoder {
       for (const auto& frame : ppf.frames) {
         ec_bitstreams.emplace_back();
         JXL_RETURN_IF_ERROR(EncodeExtraChannel(frame.extra_channels[i],
-                                               ec_info.bits_per_sample,
+                                               ec_info.bits_per_sample, pool,
                                                &ec_bitstreams.back()));
       }
     }
@@ -57,13 +79,56 @@ class BasePNMEncoder : public Encoder {
 
  protected:
   virtual Status EncodeFrame(const PackedPixelFile& ppf,
-                             const PackedFrame& frame,
+                             const PackedFrame& frame, ThreadPool* pool,
                              std::vector<uint8_t>* bytes) const = 0;
   virtual Status EncodeExtraChannel(const PackedImage& image,
-                                    size_t bits_per_sample,
+                                    size_t bits_per_sample, ThreadPool* pool,
                                     std::vector<uint8_t>* bytes) const = 0;
 };
 
+// Writes binary PGM / PPM rows as they come, since they are stored top to
+// bottom without any compression.
+class PNMRowEncoder : public RowEncoder {
+ public:
+  Status StartImage(const PackedPixelFile& ppf, const JxlPixelFormat& format,
+                    std::vector<uint8_t>* bytes) override {
+    JXL_RETURN_IF_ERROR(Encoder::VerifyBasicInfo(ppf.info));
+    if (ppf.info.have_animation || ppf.info.alpha_bits != 0) {
+      return JXL_FAILURE("PNM rows can only hold a still image without alpha");
+    }
+    if ((format.num_channels != 1 && format.num_channels != 3) ||
+        (format.data_type != JXL_TYPE_UINT8 &&
+         format.data_type != JXL_TYPE_UINT16) ||
+        (format.data_type == JXL_TYPE_UINT16 &&
+         format.endianness == JXL_LITTLE_ENDIAN)) {
+      return JXL_FAILURE("Unsupported pixel format for PNM rows");
+    }
+    JXL_RETURN_IF_ERROR(Encoder::VerifyBitDepth(
+        format.data_type, ppf.info.bits_per_sample, /*exponent_bits=*/0));
+    row_size_ = ppf.info.xsize * format.num_channels *
+                PackedImage::BitsPerChannel(format.data_type) / kBitsPerByte;
+    uint32_t maxval = (1u << ppf.info.bits_per_sample) - 1;
+    char type = format.num_channels == 1 ? '5' : '6';
+    char header[kMaxHeaderSize];
+    size_t header_size =
+        snprintf(header, kMaxHeaderSize, "P%c\n%u %u\n%u\n", type,
+                 ppf.info.xsize, ppf.info.ysize, maxval);
+    JXL_RETURN_IF_ERROR(header_size < kMaxHeaderSize);
+    bytes->insert(bytes->end(), header, header + header_size);
+    return true;
+  }
+
+  Status AddRow(const uint8_t* row, std::vector<uint8_t>* bytes) override {
+    bytes->insert(bytes->end(), row, row + row_size_);
+    return true;
+  }
+
+  Status Finish(std::vector<uint8_t>* bytes) override { return true; }
+
+ private:
+  size_t row_size_ = 0;
+};
+
 class PNMEncoder : public BasePNMEncoder {
  public:
   static const std::vector<JxlPixelFormat> kAcceptedFormats;
@@ -72,11 +137,17 @@ class PNMEncoder : public BasePNMEncoder {
     return kAcceptedFormats;
   }
 
+  std::unique_ptr<RowEncoder> CreateRowEncoder() const override {
+    return jxl::make_unique<PNMRowEncoder>();
+  }
+
   Status EncodeFrame(const PackedPixelFile& ppf, const PackedFrame& frame,
+                     ThreadPool* pool,
                      std::vector<uint8_t>* bytes) const override {
     return EncodeImage(frame.color, ppf.info.bits_per_sample, bytes);
   }
   Status EncodeExtraChannel(const PackedImage& image, size_t bits_per_sample,
+                            ThreadPool* pool,
                             std::vector<uint8_t>* bytes) const override {
     return EncodeImage(image, bits_per_sample, bytes);
   }
@@ -147,16 +218,18 @@ class PFMEncoder : public BasePNMEncoder {
     return formats;
   }
   Status EncodeFrame(const PackedPixelFile& ppf, const PackedFrame& frame,
+                     ThreadPool* pool,
                      std::vector<uint8_t>* bytes) const override {
-    return EncodeImage(frame.color, bytes);
+    return EncodeImage(frame.color, pool, bytes);
   }
   Status EncodeExtraChannel(const PackedImage& image, size_t bits_per_sample,
+                            ThreadPool* pool,
                             std::vector<uint8_t>* bytes) const override {
-    return EncodeImage(image, bytes);
+    return EncodeImage(image, pool, bytes);
   }
 
  private:
-  static Status EncodeImage(const PackedImage& image,
+  static Status EncodeImage(const PackedImage& image, ThreadPool* pool,
                             std::vector<uint8_t>* bytes) {
     char type = image.format.num_channels == 1 ? 'f' : 'F';
     double scale = image.format.endianness == JXL_LITTLE_ENDIAN ? -1.0 : 1.0;
@@ -169,12 +242,15 @@ class PFMEncoder : public BasePNMEncoder {
     memcpy(bytes->data(), header, header_size);
     const uint8_t* in = reinterpret_cast<const uint8_t*>(image.pixels());
     uint8_t* out = bytes->data() + header_size;
-    for (size_t y = 0; y < image.ysize; ++y) {
+    const auto flip_row = [&](const uint32_t y, size_t /*thread*/) -> Status {
       size_t y_out = image.ysize - 1 - y;
       const uint8_t* row_in = &in[y * image.stride];
       uint8_t* row_out = &out[y_out * image.stride];
       memcpy(row_out, row_in, image.stride);
-    }
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, image.ysize, ThreadPool::NoInit,
+                                  flip_row, "FlipPFMRows"));
     return true;
   }
 };
@@ -194,6 +270,7 @@ class PAMEncoder : public BasePNMEncoder {
     return formats;
   }
   Status EncodeFrame(const PackedPixelFile& ppf, const PackedFrame& frame,
+                     ThreadPool* pool,
                      std::vector<uint8_t>* bytes) const override {
     const PackedImage& color = frame.color;
     const auto& ec_info = ppf.extra_channels_info;
@@ -259,21 +336,24 @@ class PAMEncoder : public BasePNMEncoder {
     uint8_t* out = bytes->data() + pos;
     JXL_RETURN_IF_ERROR(PackedImage::ValidateDataType(color.format.data_type));
     size_t pwidth = PackedImage::BitsPerChannel(color.format.data_type) / 8;
-    for (size_t y = 0; y < color.ysize; ++y) {
-      for (size_t x = 0; x < color.xsize; ++x) {
-        memcpy(out, in, color.pixel_stride());
-        out += color.pixel_stride();
-        in += color.pixel_stride();
-        for (auto& p : ec_in) {
-          memcpy(out, p, pwidth);
-          out += pwidth;
-          p += pwidth;
-        }
+    const auto interleave_row =
+        pwidth == 1 ? InterleaveRow<1> : InterleaveRow<2>;
+    const size_t row_size = color.xsize * depth * pwidth;
+    const auto encode_row = [&](const uint32_t y, size_t /*thread*/) -> Status {
+      std::vector<const uint8_t*> ec_rows(ec_in.size());
+      for (size_t i = 0; i < ec_in.size(); ++i) {
+        ec_rows[i] = ec_in[i] + y * frame.extra_channels[i].stride;
       }
-    }
+      interleave_row(in + y * color.stride, color.xsize,
+                     color.format.num_channels, ec_rows, out + y * row_size);
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, color.ysize, ThreadPool::NoInit,
+                                  encode_row, "InterleavePAMRows"));
     return true;
   }
   Status EncodeExtraChannel(const PackedImage& image, size_t bits_per_sample,
+                            ThreadPool* pool,
                             std::vector<uint8_t>* bytes) const override {
     return true;
   }
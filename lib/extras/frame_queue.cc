@@ -0,0 +1,107 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/frame_queue.h"
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+Status PackedFrameQueue::Start(Producer producer, PackedPixelFile* ppf) {
+  std::shared_ptr<PackedFrameQueue> queue(new PackedFrameQueue(ppf));
+  PackedFrameQueue* q = queue.get();
+  q->thread_ = std::thread([q, producer]() {
+    Status status = producer(q);
+    std::lock_guard<std::mutex> lock(q->mutex_);
+    q->status_ = status;
+    q->done_ = true;
+    q->cv_.notify_all();
+  });
+  bool have_header;
+  {
+    std::unique_lock<std::mutex> lock(q->mutex_);
+    q->cv_.wait(lock, [q] { return q->have_header_ || q->done_; });
+    have_header = q->have_header_;
+  }
+  if (!have_header) {
+    Status status = q->Finish();
+    JXL_RETURN_IF_ERROR(status);
+    return JXL_FAILURE("No frames decoded");
+  }
+  ppf->frame_queue = std::move(queue);
+  return true;
+}
+
+PackedFrameQueue::~PackedFrameQueue() { (void)Finish(); }
+
+Status PackedFrameQueue::PushFrames(PackedPixelFile* ppf) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!have_header_) {
+    // The producer goes on using its own header, so it is copied.
+    header_->info = ppf->info;
+    header_->extra_channels_info = ppf->extra_channels_info;
+    header_->primary_color_representation = ppf->primary_color_representation;
+    header_->color_encoding = ppf->color_encoding;
+    header_->icc = ppf->icc;
+    header_->orig_icc = ppf->orig_icc;
+    header_->input_bitdepth = ppf->input_bitdepth;
+    header_->metadata = ppf->metadata;
+    if (ppf->preview_frame) {
+      JXL_ASSIGN_OR_RETURN(PackedFrame preview, ppf->preview_frame->Copy());
+      header_->preview_frame =
+          jxl::make_unique<PackedFrame>(std::move(preview));
+    }
+    header_ = nullptr;
+    have_header_ = true;
+    cv_.notify_all();
+  }
+  for (PackedFrame& frame : ppf->frames) {
+    cv_.wait(lock, [this] { return frames_.size() < kCapacity || stopped_; });
+    if (stopped_) return JXL_FAILURE("The encoder stopped taking frames");
+    frames_.emplace_back(std::move(frame));
+    cv_.notify_all();
+  }
+  ppf->frames.clear();
+  return true;
+}
+
+std::unique_ptr<PackedFrame> PackedFrameQueue::Pop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return !frames_.empty() || done_; });
+  if (frames_.empty()) return nullptr;
+  auto frame = jxl::make_unique<PackedFrame>(std::move(frames_.front()));
+  frames_.pop_front();
+  num_popped_++;
+  cv_.notify_all();
+  return frame;
+}
+
+Status PackedFrameQueue::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    cv_.notify_all();
+  }
+  if (thread_.joinable()) thread_.join();
+  std::lock_guard<std::mutex> lock(mutex_);
+  return status_;
+}
+
+size_t PackedFrameQueue::num_frames() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_popped_;
+}
+
+}  // namespace extras
+}  // namespace jxl
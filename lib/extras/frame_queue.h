@@ -0,0 +1,80 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_EXTRAS_FRAME_QUEUE_H_
+#define LIB_EXTRAS_FRAME_QUEUE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+// Hands the frames of an image over from a decoder, running on its own thread,
+// to the encoder as soon as each one is decoded, so that decoding the next
+// frames overlaps with encoding the previous ones.
+class PackedFrameQueue {
+ public:
+  // Decodes the image into its own PackedPixelFile, and calls PushFrames after
+  // each decoded frame.
+  using Producer = std::function<Status(PackedFrameQueue* queue)>;
+
+  // Runs `producer` on a new thread and waits until it pushes its first frames,
+  // then stores the header of the image in `ppf`, with ppf->frame_queue set to
+  // the queue to pop the frames from. Returns the status of the producer if it
+  // ends before pushing any frame.
+  static Status Start(Producer producer, PackedPixelFile* ppf);
+
+  PackedFrameQueue(const PackedFrameQueue&) = delete;
+  PackedFrameQueue& operator=(const PackedFrameQueue&) = delete;
+  ~PackedFrameQueue();
+
+  // For the producer: moves the frames of `ppf` to the queue, waiting while it
+  // is full, together with the rest of `ppf` the first time. Fails if the
+  // consumer has stopped.
+  Status PushFrames(PackedPixelFile* ppf);
+
+  // Waits for the next frame, or returns nullptr after the last one.
+  std::unique_ptr<PackedFrame> Pop();
+
+  // Stops the producer if it is still running, waits for it, and returns
+  // whether it decoded all the frames.
+  Status Finish();
+
+  // Number of frames popped so far.
+  size_t num_frames() const;
+
+ private:
+  // Number of decoded frames that can wait for the encoder.
+  static constexpr size_t kCapacity = 2;
+
+  explicit PackedFrameQueue(PackedPixelFile* header) : header_(header) {}
+
+  // Receives the header at the first PushFrames, while Start waits for it.
+  PackedPixelFile* header_;
+  std::thread thread_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<PackedFrame> frames_;
+  size_t num_popped_ = 0;
+  bool have_header_ = false;
+  bool done_ = false;
+  bool stopped_ = false;
+  Status status_ = true;
+};
+
+}  // namespace extras
+}  // namespace jxl
+
+#endif  // LIB_EXTRAS_FRAME_QUEUE_H_
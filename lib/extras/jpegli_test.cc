@@ -159,6 +159,31 @@ TEST(JpegliTest, JpegliXYBEncodeTest) {
   EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(ppf_in, ppf_out), 1.32f);
 }
 
+TEST(JpegliTest, JpegliXYBDecodeToSRGBTest) {
+  TEST_LIBJPEG_SUPPORT();
+  std::string testimage = "jxl/flower/flower_small.rgb.depth8.ppm";
+  PackedPixelFile ppf_in;
+  ASSERT_TRUE(ReadTestImage(testimage, &ppf_in));
+
+  std::vector<uint8_t> compressed;
+  JpegSettings settings;
+  settings.xyb = true;
+  ASSERT_TRUE(EncodeJpeg(ppf_in, settings, nullptr, &compressed));
+
+  PackedPixelFile ppf_icc;
+  JpegDecompressParams dparams;
+  ASSERT_TRUE(DecodeJpeg(compressed, dparams, nullptr, &ppf_icc));
+  EXPECT_FALSE(ppf_icc.icc.empty());
+
+  PackedPixelFile ppf_srgb;
+  dparams.xyb_to_srgb = true;
+  ASSERT_TRUE(DecodeJpeg(compressed, dparams, nullptr, &ppf_srgb));
+  EXPECT_TRUE(ppf_srgb.icc.empty());
+  EXPECT_EQ("RGB_D65_SRG_Per_SRG", Description(ppf_srgb.color_encoding));
+  EXPECT_LT(ButteraugliDistance(ppf_icc, ppf_srgb), 0.2f);
+  EXPECT_LT(ButteraugliDistance(ppf_in, ppf_srgb), 1.4f);
+}
+
 TEST(JpegliTest, JpegliDecodeTestLargeSmoothArea) {
   TEST_LIBJPEG_SUPPORT();
   TestImage t;
@@ -260,6 +260,8 @@ struct PackedExtraChannel {
   std::string name;
 };
 
+class PackedFrameQueue;
+
 // Helper class representing a JXL image file as decoded to pixels from the API.
 class PackedPixelFile {
  public:
@@ -291,6 +293,9 @@ class PackedPixelFile {
   std::unique_ptr<PackedFrame> preview_frame;
   std::vector<PackedFrame> frames;
   mutable std::vector<ChunkedPackedFrame> chunked_frames;
+  // Frames that are still being decoded, which follow `frames`. They can only
+  // be taken from the queue once.
+  std::shared_ptr<PackedFrameQueue> frame_queue;
 
   PackedMetadata metadata;
   PackedPixelFile() { JxlEncoderInitBasicInfo(&info); };
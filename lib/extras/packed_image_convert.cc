@@ -329,16 +329,14 @@ Status ConvertCodecInOutToPackedPixelFile(const CodecInOut& io,
                   : ppf->info.bits_per_sample;
     packed_frame.name = frame.name;
     packed_frame.frame_info.name_length = frame.name.size();
-    // Color transform
-    JXL_ASSIGN_OR_RETURN(ImageBundle ib, frame.Copy());
-    const ImageBundle* to_color_transform = &ib;
+    // Color transform. The frame is only read from, and converted straight
+    // into the packed frame when it already has the desired color encoding.
     ImageMetadata metadata = io.metadata.m;
     ImageBundle store(memory_manager, &metadata);
     const ImageBundle* transformed;
     // TODO(firsching): handle the transform here.
-    JXL_RETURN_IF_ERROR(TransformIfNeeded(*to_color_transform, c_desired,
-                                          *JxlGetDefaultCms(), pool, &store,
-                                          &transformed));
+    JXL_RETURN_IF_ERROR(TransformIfNeeded(frame, c_desired, *JxlGetDefaultCms(),
+                                          pool, &store, &transformed));
 
     JXL_RETURN_IF_ERROR(ConvertToExternal(
         *transformed, bits_per_sample, float_out, format.num_channels,
@@ -0,0 +1,87 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/pyramid.h"
+
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+namespace {
+
+StatusOr<PackedImage> Downsample(const PackedImage& image) {
+  if (image.format.data_type == JXL_TYPE_FLOAT16) {
+    return JXL_FAILURE("Cannot downsample float16 images");
+  }
+  const size_t xsize = DivCeil(image.xsize, 2);
+  const size_t ysize = DivCeil(image.ysize, 2);
+  JXL_ASSIGN_OR_RETURN(PackedImage out,
+                       PackedImage::Create(xsize, ysize, image.format));
+  for (size_t y = 0; y < ysize; ++y) {
+    // The last row and column of odd sizes are averaged with themselves.
+    const size_t y0 = 2 * y;
+    const size_t y1 = std::min(y0 + 1, image.ysize - 1);
+    for (size_t x = 0; x < xsize; ++x) {
+      const size_t x0 = 2 * x;
+      const size_t x1 = std::min(x0 + 1, image.xsize - 1);
+      for (size_t c = 0; c < image.format.num_channels; ++c) {
+        float sum = image.GetPixelValue(y0, x0, c) +
+                    image.GetPixelValue(y0, x1, c) +
+                    image.GetPixelValue(y1, x0, c) +
+                    image.GetPixelValue(y1, x1, c);
+        out.SetPixelValue(y, x, c, sum * 0.25f);
+      }
+    }
+  }
+  return out;
+}
+
+}  // namespace
+
+StatusOr<PackedPixelFile> DownsamplePackedPixelFile(
+    const PackedPixelFile& ppf) {
+  if (!ppf.chunked_frames.empty() || ppf.frame_queue) {
+    return JXL_FAILURE("Cannot downsample chunked frames");
+  }
+  PackedPixelFile out;
+  out.info = ppf.info;
+  out.info.xsize = DivCeil(ppf.info.xsize, 2);
+  out.info.ysize = DivCeil(ppf.info.ysize, 2);
+  out.info.have_preview = JXL_FALSE;
+  out.extra_channels_info = ppf.extra_channels_info;
+  out.primary_color_representation = ppf.primary_color_representation;
+  out.color_encoding = ppf.color_encoding;
+  out.icc = ppf.icc;
+  out.orig_icc = ppf.orig_icc;
+  out.input_bitdepth = ppf.input_bitdepth;
+  out.metadata = ppf.metadata;
+  for (const PackedFrame& frame : ppf.frames) {
+    if (frame.frame_info.layer_info.have_crop) {
+      return JXL_FAILURE("Cannot downsample cropped frames");
+    }
+    JXL_ASSIGN_OR_RETURN(PackedImage color, Downsample(frame.color));
+    PackedFrame level(std::move(color));
+    level.frame_info = frame.frame_info;
+    level.name = frame.name;
+    for (const PackedImage& ec : frame.extra_channels) {
+      JXL_ASSIGN_OR_RETURN(PackedImage level_ec, Downsample(ec));
+      level.extra_channels.emplace_back(std::move(level_ec));
+    }
+    out.frames.emplace_back(std::move(level));
+  }
+  return out;
+}
+
+}  // namespace extras
+}  // namespace jxl
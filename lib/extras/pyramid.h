@@ -0,0 +1,28 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_EXTRAS_PYRAMID_H_
+#define LIB_EXTRAS_PYRAMID_H_
+
+// Levels of a multi-resolution pyramid, e.g. for deep-zoom viewers.
+
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+// Returns the next level of the pyramid of `ppf`: all its frames with both
+// dimensions halved (rounded up), each pixel being the average of a 2x2 block
+// in the pixel format of `ppf`. Applying it to the previous level, rather than
+// to the full resolution input, reads every input pixel only once for the
+// whole pyramid. The preview frame is dropped. Frames must not be cropped nor
+// chunked, and their samples must not be float16.
+StatusOr<PackedPixelFile> DownsamplePackedPixelFile(const PackedPixelFile& ppf);
+
+}  // namespace extras
+}  // namespace jxl
+
+#endif  // LIB_EXTRAS_PYRAMID_H_
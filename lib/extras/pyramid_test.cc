@@ -0,0 +1,81 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/extras/pyramid.h"
+
+#include <jxl/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace extras {
+namespace {
+
+TEST(PyramidTest, AveragesBlocks) {
+  // Odd sizes, so that the last row and column are averaged with themselves.
+  constexpr size_t kXSize = 5;
+  constexpr size_t kYSize = 3;
+  const JxlPixelFormat format = {2, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  PackedPixelFile ppf;
+  ppf.info.xsize = kXSize;
+  ppf.info.ysize = kYSize;
+  JXL_TEST_ASSIGN_OR_DIE(PackedFrame frame,
+                         PackedFrame::Create(kXSize, kYSize, format));
+  JXL_TEST_ASSIGN_OR_DIE(
+      PackedImage ec,
+      PackedImage::Create(kXSize, kYSize,
+                          {1, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}));
+  for (size_t y = 0; y < kYSize; ++y) {
+    for (size_t x = 0; x < kXSize; ++x) {
+      frame.color.SetPixelValue(y, x, 0, (y * kXSize + x) / 16.0f);
+      frame.color.SetPixelValue(y, x, 1, 1.0f);
+      ec.SetPixelValue(y, x, 0, x == 0 ? 1.0f : 0.0f);
+    }
+  }
+  frame.extra_channels.emplace_back(std::move(ec));
+  ppf.frames.emplace_back(std::move(frame));
+
+  JXL_TEST_ASSIGN_OR_DIE(PackedPixelFile level, DownsamplePackedPixelFile(ppf));
+  EXPECT_EQ(level.info.xsize, 3u);
+  EXPECT_EQ(level.info.ysize, 2u);
+  ASSERT_EQ(level.frames.size(), 1u);
+  const PackedImage& color = level.frames[0].color;
+  EXPECT_EQ(color.xsize, 3u);
+  EXPECT_EQ(color.ysize, 2u);
+  EXPECT_EQ(color.format.endianness, JXL_BIG_ENDIAN);
+  const float kTolerance = 1.0f / 65535;
+  EXPECT_NEAR(color.GetPixelValue(0, 0, 0), (0 + 1 + 5 + 6) / 64.0f,
+              kTolerance);
+  EXPECT_NEAR(color.GetPixelValue(0, 2, 0), (4 + 9) / 32.0f, kTolerance);
+  EXPECT_NEAR(color.GetPixelValue(1, 1, 0), (12 + 13) / 32.0f, kTolerance);
+  EXPECT_NEAR(color.GetPixelValue(1, 2, 0), 14 / 16.0f, kTolerance);
+  EXPECT_NEAR(color.GetPixelValue(1, 2, 1), 1.0f, kTolerance);
+  ASSERT_EQ(level.frames[0].extra_channels.size(), 1u);
+  const PackedImage& level_ec = level.frames[0].extra_channels[0];
+  EXPECT_NEAR(level_ec.GetPixelValue(0, 0, 0), 128 / 255.0f, 1e-6);
+  EXPECT_EQ(level_ec.GetPixelValue(1, 1, 0), 0.0f);
+}
+
+TEST(PyramidTest, RejectsCroppedFrames) {
+  PackedPixelFile ppf;
+  ppf.info.xsize = 4;
+  ppf.info.ysize = 4;
+  JXL_TEST_ASSIGN_OR_DIE(
+      PackedFrame frame,
+      PackedFrame::Create(4, 4, {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}));
+  frame.frame_info.layer_info.have_crop = JXL_TRUE;
+  ppf.frames.emplace_back(std::move(frame));
+  EXPECT_FALSE(DownsamplePackedPixelFile(ppf).ok());
+}
+
+}  // namespace
+}  // namespace extras
+}  // namespace jxl
@@ -21,6 +21,19 @@ namespace HWY_NAMESPACE {
 
 static constexpr Vector3 rec2020_luminances{0.2627f, 0.6780f, 0.0593f};
 
+// Skips the color transform when the frame is already linear Rec. 2020, e.g.
+// when gamut mapping right after tone mapping.
+Status ToLinearRec2020(ImageBundle* const ib, ThreadPool* const pool) {
+  ColorEncoding linear_rec2020;
+  linear_rec2020.SetColorSpace(ColorSpace::kRGB);
+  JXL_RETURN_IF_ERROR(linear_rec2020.SetPrimariesType(Primaries::k2100));
+  JXL_RETURN_IF_ERROR(linear_rec2020.SetWhitePointType(WhitePoint::kD65));
+  linear_rec2020.Tf().SetTransferFunction(TransferFunction::kLinear);
+  if (ib->c_current().SameColorEncoding(linear_rec2020)) return true;
+  JXL_RETURN_IF_ERROR(linear_rec2020.CreateICC());
+  return ib->TransformTo(linear_rec2020, *JxlGetDefaultCms(), pool);
+}
+
 Status ToneMapFrame(const std::pair<float, float> display_nits,
                     ImageBundle* const ib, ThreadPool* const pool) {
   // Perform tone mapping as described in Report ITU-R BT.2390-8, section 5.4
@@ -30,14 +43,7 @@ Status ToneMapFrame(const std::pair<float, float> display_nits,
   HWY_FULL(float) df;
   using V = decltype(Zero(df));
 
-  ColorEncoding linear_rec2020;
-  linear_rec2020.SetColorSpace(ColorSpace::kRGB);
-  JXL_RETURN_IF_ERROR(linear_rec2020.SetPrimariesType(Primaries::k2100));
-  JXL_RETURN_IF_ERROR(linear_rec2020.SetWhitePointType(WhitePoint::kD65));
-  linear_rec2020.Tf().SetTransferFunction(TransferFunction::kLinear);
-  JXL_RETURN_IF_ERROR(linear_rec2020.CreateICC());
-  JXL_RETURN_IF_ERROR(
-      ib->TransformTo(linear_rec2020, *JxlGetDefaultCms(), pool));
+  JXL_RETURN_IF_ERROR(ToLinearRec2020(ib, pool));
 
   Rec2408ToneMapper<decltype(df)> tone_mapper(
       {ib->metadata()->tone_mapping.min_nits,
@@ -70,14 +76,7 @@ Status GamutMapFrame(ImageBundle* const ib, float preserve_saturation,
   HWY_FULL(float) df;
   using V = decltype(Zero(df));
 
-  ColorEncoding linear_rec2020;
-  linear_rec2020.SetColorSpace(ColorSpace::kRGB);
-  JXL_RETURN_IF_ERROR(linear_rec2020.SetPrimariesType(Primaries::k2100));
-  JXL_RETURN_IF_ERROR(linear_rec2020.SetWhitePointType(WhitePoint::kD65));
-  linear_rec2020.Tf().SetTransferFunction(TransferFunction::kLinear);
-  JXL_RETURN_IF_ERROR(linear_rec2020.CreateICC());
-  JXL_RETURN_IF_ERROR(
-      ib->TransformTo(linear_rec2020, *JxlGetDefaultCms(), pool));
+  JXL_RETURN_IF_ERROR(ToLinearRec2020(ib, pool));
 
   const auto process_row = [&](const uint32_t y, size_t /* thread*/) -> Status {
     float* const JXL_RESTRICT row_r = ib->color()->PlaneRow(0, y);
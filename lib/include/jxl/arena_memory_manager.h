@@ -0,0 +1,71 @@
+/* Copyright (c) the JPEG XL Project Authors. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/** @addtogroup libjxl_common
+ * @{
+ * @file arena_memory_manager.h
+ * @brief Memory manager that serves allocations from large chunks.
+ */
+
+#ifndef JXL_ARENA_MEMORY_MANAGER_H_
+#define JXL_ARENA_MEMORY_MANAGER_H_
+
+#include <jxl/jxl_export.h>
+#include <jxl/memory_manager.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates a memory manager that carves allocations out of large chunks,
+ * obtained from @p memory_manager, instead of requesting every allocation
+ * separately. It can be passed to @ref JxlEncoderCreate and @ref
+ * JxlDecoderCreate, and shared by encoders and decoders running on different
+ * threads.
+ *
+ * Freeing an allocation only updates a counter; a chunk is recycled as a whole
+ * once all the allocations made from it are freed, which for the temporary
+ * buffers of a frame happens when the frame is done. Recycled chunks are kept
+ * for later allocations until @ref JxlArenaMemoryManagerTrim or @ref
+ * JxlArenaMemoryManagerDestroy is called. Allocations larger than a quarter of
+ * a chunk are forwarded to @p memory_manager directly.
+ *
+ * @param memory_manager memory manager used to allocate the chunks. It may be
+ *     NULL, in which case the default allocator is used.
+ * @param chunk_size size of the chunks in bytes, or 0 for the default of
+ *     4 MiB.
+ * @return @c NULL if the instance can not be allocated or initialized
+ * @return pointer to the memory manager otherwise; it remains valid until
+ *     @ref JxlArenaMemoryManagerDestroy is called.
+ */
+JXL_EXPORT JxlMemoryManager* JxlArenaMemoryManagerCreate(
+    const JxlMemoryManager* memory_manager, size_t chunk_size);
+
+/**
+ * Returns the recycled chunks that are not in use to the underlying memory
+ * manager.
+ *
+ * @param arena memory manager created by @ref JxlArenaMemoryManagerCreate.
+ */
+JXL_EXPORT void JxlArenaMemoryManagerTrim(JxlMemoryManager* arena);
+
+/**
+ * Frees all the memory of the arena. All the encoders and decoders using it
+ * must have been destroyed, and all its allocations freed, before.
+ *
+ * @param arena memory manager created by @ref JxlArenaMemoryManagerCreate.
+ */
+JXL_EXPORT void JxlArenaMemoryManagerDestroy(JxlMemoryManager* arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JXL_ARENA_MEMORY_MANAGER_H_ */
+
+/** @}*/
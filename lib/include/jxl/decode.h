@@ -16,9 +16,11 @@
 #include <jxl/cms_interface.h>
 #include <jxl/codestream_header.h>
 #include <jxl/color_encoding.h>
+#include <jxl/gain_map.h>
 #include <jxl/jxl_export.h>
 #include <jxl/memory_manager.h>
 #include <jxl/parallel_runner.h>
+#include <jxl/stats.h>
 #include <jxl/types.h>
 #include <jxl/version.h>  // TODO(eustas): remove before v1.0
 #include <stddef.h>
@@ -100,7 +102,8 @@ JXL_EXPORT JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager);
 /**
  * Re-initializes a @ref JxlDecoder instance, so it can be re-used for decoding
  * another image. All state and settings are reset as if the object was
- * newly created with @ref JxlDecoderCreate, but the memory manager is kept.
+ * newly created with @ref JxlDecoderCreate, but the memory manager and the
+ * setting of @ref JxlDecoderSetKeepBuffers are kept.
  *
  * @param dec instance to be re-initialized.
  */
@@ -189,6 +192,13 @@ typedef enum {
    */
   JXL_DEC_BOX_NEED_MORE_OUTPUT = 7,
 
+  /** The callback set with @ref JxlDecoderSetCancelCallback stopped the
+   * decoding of the current frame. The groups decoded so far can be rendered
+   * with @ref JxlDecoderFlushImage. Calling @ref JxlDecoderProcessInput again
+   * resumes the decoding where it stopped.
+   */
+  JXL_DEC_CANCELLED = 8,
+
   /** Informative event by @ref JxlDecoderProcessInput
    * "JxlDecoderProcessInput": Basic information such as image dimensions and
    * extra channels. This event occurs max once per image.
@@ -379,13 +389,29 @@ typedef enum {
  * as before.
  * The difference to @ref JxlDecoderReset is that some state is kept, namely
  * settings set by a call to
+ *  - @ref JxlDecoderCollectStats,
+ *  - @ref JxlDecoderSetCmsLutSize,
  *  - @ref JxlDecoderSetCoalescing,
+ *  - @ref JxlDecoderSetCropRegion,
+ *  - @ref JxlDecoderSetDecodingSpeed,
  *  - @ref JxlDecoderSetDesiredIntensityTarget,
  *  - @ref JxlDecoderSetDecompressBoxes,
+ *  - @ref JxlDecoderSetDownscaling,
+ *  - @ref JxlDecoderSetGainMap,
+ *  - @ref JxlDecoderSetKeepBuffers,
  *  - @ref JxlDecoderSetKeepOrientation,
+ *  - @ref JxlDecoderSetLimit,
+ *  - @ref JxlDecoderSetLumaOnly,
+ *  - @ref JxlDecoderSetMemoryLimit,
+ *  - @ref JxlDecoderSetOutputSize,
+ *  - @ref JxlDecoderSetPriorityRegion,
  *  - @ref JxlDecoderSetUnpremultiplyAlpha,
  *  - @ref JxlDecoderSetParallelRunner,
- *  - @ref JxlDecoderSetRenderSpotcolors, and
+ *  - @ref JxlDecoderSetParallelFrames,
+ *  - @ref JxlDecoderSetReducedPrecisionBuffers,
+ *  - @ref JxlDecoderSetRenderHook,
+ *  - @ref JxlDecoderSetRenderSpotcolors,
+ *  - @ref JxlDecoderSetToneMappingLutSize, and
  *  - @ref JxlDecoderSubscribeEvents.
  *
  * @param dec decoder object
@@ -407,11 +433,33 @@ JXL_EXPORT void JxlDecoderRewind(JxlDecoder* dec);
  * to the file format but are not rendered as part of an animation, or are not
  * the final still frame of a still image, are not counted.
  *
+ * If the input was set with @ref JxlDecoderSetPersistentInput and has a frame
+ * index ("jxli") box, and coalescing is enabled, the decoder directly jumps to
+ * the last keyframe of the index that is not after the frame skipped to,
+ * without processing the frames before it at all.
+ *
  * @param dec decoder object
  * @param amount the amount of frames to skip
  */
 JXL_EXPORT void JxlDecoderSkipFrames(JxlDecoder* dec, size_t amount);
 
+/** Makes the decoder skip the next frames of an animation that end before or
+ * at `ticks`, the time since the start of the animation in ticks of @ref
+ * JxlAnimationHeader, so that the next frame it emits is the one displayed at
+ * that time, or the last one. Like @ref JxlDecoderSkipFrames, this jumps to
+ * the nearest keyframe of the frame index box of a persistent input, and
+ * starts from the next frame if one is being processed.
+ *
+ * @param dec decoder object
+ * @param ticks the time to skip to
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if the image is not
+ *     an animation, if coalescing is disabled, if the time is before the start
+ *     of the next frame, or if that is not known after jumping to a keyframe
+ *     whose time in the frame index is not exact in ticks of the animation.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSkipToTime(JxlDecoder* dec,
+                                                 uint64_t ticks);
+
 /**
  * Skips processing the current frame. Can be called after frame processing
  * already started, signaled by a ::JXL_DEC_NEED_IMAGE_OUT_BUFFER event,
@@ -527,6 +575,25 @@ JxlDecoderSetKeepOrientation(JxlDecoder* dec, JXL_BOOL skip_reorientation);
 JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetUnpremultiplyAlpha(JxlDecoder* dec, JXL_BOOL unpremul_alpha);
 
+/**
+ * Enables or disables premultiplying the colors of unassociated alpha
+ * channels. If premul_alpha is set to ::JXL_TRUE, the colors of images with an
+ * unassociated alpha channel are multiplied by the alpha channel when they are
+ * converted to the output format, as wanted by most compositors. This function
+ * has no effect if the image does not have an unassociated alpha channel, or if
+ * the output pixel format has no alpha channel.
+ *
+ * By default, this option is disabled, and the returned pixel data "as is".
+ *
+ * This function must be called at the beginning, before decoding is performed.
+ *
+ * @param dec decoder object
+ * @param premul_alpha JXL_TRUE to enable, JXL_FALSE to disable.
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus
+JxlDecoderSetPremultiplyAlpha(JxlDecoder* dec, JXL_BOOL premul_alpha);
+
 /** Enables or disables rendering spot colors. By default, spot colors
  * are rendered, which is OK for viewing the decoded image. If render_spotcolors
  * is ::JXL_FALSE, then spot colors are not rendered, and have to be
@@ -540,6 +607,118 @@ JxlDecoderSetUnpremultiplyAlpha(JxlDecoder* dec, JXL_BOOL unpremul_alpha);
 JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetRenderSpotcolors(JxlDecoder* dec, JXL_BOOL render_spotcolors);
 
+/** Enables or disables reduced precision intermediate buffers. By default,
+ * the decoder keeps all intermediate pixel data as 32-bit floats. When
+ * enabled, the pixels at the borders between groups, which are kept until the
+ * neighbouring groups are decoded, are stored as 16-bit floats instead. This
+ * halves the memory used for them in exchange for small rounding differences
+ * near group boundaries, which are below the precision of 8-bit output.
+ * Frames that are referenced by later frames are always decoded with full
+ * precision, but in images with up to 8 bits per sample, the frames saved for
+ * blending later frames of an animation or layered image are then also kept
+ * as 16-bit floats, which halves the memory used by them.
+ *
+ * @param dec decoder object
+ * @param enabled JXL_TRUE to enable, JXL_FALSE to disable (default).
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus
+JxlDecoderSetReducedPrecisionBuffers(JxlDecoder* dec, JXL_BOOL enabled);
+
+/** Makes the decoder render the image faster and with lower fidelity, for
+ * example for a first paint while scrolling, which a second decode at full
+ * fidelity can then refine. Unlike ::JXL_ENC_FRAME_SETTING_DECODING_SPEED,
+ * this works with any file, but the decoded image differs from the one
+ * intended by the encoder:
+ *  - 0: full fidelity (default).
+ *  - 1: the restoration filters (gaborish and edge-preserving filter), noise
+ *    and splines are not rendered.
+ *  - 2: additionally, upsampled frames and extra channels repeat their pixels
+ *    instead of using the upsampling kernels.
+ *
+ * Must be called before starting.
+ *
+ * @param dec decoder object
+ * @param speed decoding speed tier, from 0 to 2.
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetDecodingSpeed(JxlDecoder* dec,
+                                                       uint32_t speed);
+
+/** Makes the decoder skip the chroma of lossy (VarDCT) frames in XYB when the
+ * output is grayscale, e.g. with a gray color encoding set with @ref
+ * JxlDecoderSetOutputColorProfile. Only the luma (Y) channel is dequantized,
+ * transformed and filtered, and the gray output is computed as if the image
+ * had no chroma, which is much faster but only approximates the luminance of
+ * colorful areas. Frames that are referenced by later frames, and other
+ * images, are decoded as usual.
+ *
+ * Must be called before starting.
+ *
+ * @param dec decoder object
+ * @param enabled JXL_TRUE to enable, JXL_FALSE to disable (default).
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetLumaOnly(JxlDecoder* dec,
+                                                  JXL_BOOL enabled);
+
+/**
+ * Function checked by the decoder between the groups of each frame, see @ref
+ * JxlDecoderSetCancelCallback. It can be called concurrently from the threads
+ * of the parallel runner.
+ *
+ * @param opaque user supplied parameter.
+ * @return JXL_TRUE to cancel the decoding.
+ */
+typedef JXL_BOOL (*JxlDecoderCancelCallback)(void* opaque);
+
+/**
+ * Sets a function that the decoder checks between the groups of each frame,
+ * for example to enforce a deadline. Once it returns JXL_TRUE, the groups that
+ * did not start decoding are left for later and @ref JxlDecoderProcessInput
+ * returns ::JXL_DEC_CANCELLED.
+ *
+ * @param dec decoder object
+ * @param callback function returning whether to cancel, or NULL to remove it.
+ * @param opaque user supplied parameter passed to the callback.
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetCancelCallback(
+    JxlDecoder* dec, JxlDecoderCancelCallback callback, void* opaque);
+
+/** Makes the decoder output the image scaled down by the given factor in both
+ * dimensions, e.g. for thumbnails. The only supported factors are 1 (default,
+ * no downscaling) and 8: each output pixel then approximates the average of an
+ * 8x8 block of the image. The decoder renders it from the DC of the frame,
+ * without decoding the AC coefficients or applying the loop filters, which is
+ * much faster than decoding the image at full resolution. The output buffers
+ * have dimensions of ceil(xsize / factor) by ceil(ysize / factor), as returned
+ * by @ref JxlDecoderImageOutBufferSize. Previews are not downscaled.
+ *
+ * The frame is complete once its DC sections are decoded: ::JXL_DEC_FULL_IMAGE
+ * is returned without reading the rest of the frame, which does not need to be
+ * available. Since the DC sections come first in the frame, this gives a low
+ * quality placeholder from the first part of the file. In combination with
+ * @ref JxlDecoderSetOutputSize, the downscaled image is resampled to the
+ * output size instead, e.g. upsampled to the image size.
+ *
+ * Downscaling only supports displayed frames that are lossy (VarDCT), have no
+ * extra channels, no patches or splines, are not blended and are not
+ * referenced by later frames. For other frames, and in combination with a
+ * crop region, YCbCr planes output or disabled coalescing, setting the output
+ * buffer succeeds but the next call to @ref JxlDecoderProcessInput returns
+ * ::JXL_DEC_ERROR; such images must be decoded again at full resolution.
+ * Progression events are not emitted for downscaled frames.
+ *
+ * Must be called before starting.
+ *
+ * @param dec decoder object
+ * @param factor downscaling factor, 1 or 8.
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetDownscaling(JxlDecoder* dec,
+                                                     uint32_t factor);
+
 /** Enables or disables coalescing of zero-duration frames. By default, frames
  * are returned with coalescing enabled, i.e. all frames have the image
  * dimensions, and are blended if needed. When coalescing is disabled, frames
@@ -556,6 +735,254 @@ JxlDecoderSetRenderSpotcolors(JxlDecoder* dec, JXL_BOOL render_spotcolors);
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec,
                                                     JXL_BOOL coalescing);
 
+/** Lets the decoder decode up to @p max_frames independent frames of an
+ * animation at once on the parallel runner, one frame per thread, instead of
+ * one frame after another using several threads for each. This is faster for
+ * animations of small frames, that cannot use many threads each. A frame is
+ * independent if it replaces the whole image, uses no patches, and no later
+ * frame refers to it. The frames are still returned one by one and in order,
+ * but the pixels of the frames decoded ahead are kept by the decoder until
+ * they are returned, which uses more memory.
+ *
+ * Only frames whose codestream is fully available in the input are decoded
+ * ahead, which works best with @ref JxlDecoderSetPersistentInput or the whole
+ * file given as input. Frames are decoded as usual when coalescing is disabled,
+ * when frames are skipped, when progressive events, JPEG reconstruction, a
+ * crop region, extra channel buffers or per-channel buffers are used.
+ *
+ * @param dec decoder object
+ * @param max_frames maximum amount of frames decoded at once, 0 or 1 to decode
+ *     frames one after another (default).
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetParallelFrames(JxlDecoder* dec,
+                                                        size_t max_frames);
+
+/** Restricts the decoded pixels to a rectangular region of the image. When a
+ * crop region is set, the image out buffer, image out callback and extra
+ * channel buffers only receive the pixels inside the region, with the top-left
+ * corner of the region at position (0, 0), and @ref
+ * JxlDecoderImageOutBufferSize and @ref JxlDecoderExtraChannelBufferSize
+ * return sizes for the region. Groups of the codestream that do not contribute
+ * to the region are skipped when possible, which makes decoding small regions
+ * of a large image much faster.
+ *
+ * The coordinates are given in the orientation in which the image is output,
+ * that is, they take @ref JxlDecoderSetKeepOrientation into account. The
+ * region is clamped to the image dimensions. The crop region only applies
+ * when coalescing is enabled, and does not apply to the preview frame.
+ *
+ * This function can be called before decoding starts, or between frames, for
+ * example after ::JXL_DEC_BASIC_INFO to choose a region based on the image
+ * size. Setting @p xsize or @p ysize to 0 removes the crop region.
+ *
+ * @param dec decoder object
+ * @param x0 horizontal offset of the region.
+ * @param y0 vertical offset of the region.
+ * @param xsize width of the region, or 0 to disable cropping.
+ * @param ysize height of the region, or 0 to disable cropping.
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR if a frame is being
+ *     decoded or if the region lies outside of the image.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetCropRegion(JxlDecoder* dec,
+                                                    uint32_t x0, uint32_t y0,
+                                                    uint32_t xsize,
+                                                    uint32_t ysize);
+
+/** Sets a region of the image, such as the visible viewport of a viewer, whose
+ * groups are decoded before the other groups of the frames. Unlike @ref
+ * JxlDecoderSetCropRegion, all the pixels of the image are still decoded and
+ * output; only the order changes, so that the region reaches its final quality
+ * sooner, for example as seen with @ref JxlDecoderFlushImage or @ref
+ * JxlDecoderSetImageOutTileCallback. The prioritization applies among the
+ * groups whose data is available at the same time, it does not change the
+ * order in which the groups are read from the input.
+ *
+ * The coordinates are given in the orientation in which the image is output,
+ * before applying the crop region if any. The region is clamped to the image
+ * dimensions. It does not apply to the preview frame.
+ *
+ * This function can be called at any time, including between calls to
+ * @ref JxlDecoderProcessInput while a frame is being decoded, for example when
+ * the viewport moves. Setting @p xsize or @p ysize to 0 removes the region.
+ *
+ * @param dec decoder object
+ * @param x0 horizontal offset of the region.
+ * @param y0 vertical offset of the region.
+ * @param xsize width of the region, or 0 to disable the prioritization.
+ * @param ysize height of the region, or 0 to disable the prioritization.
+ * @return ::JXL_DEC_SUCCESS
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetPriorityRegion(JxlDecoder* dec,
+                                                        uint32_t x0,
+                                                        uint32_t y0,
+                                                        uint32_t xsize,
+                                                        uint32_t ysize);
+
+/** Filters for resampling the output image, see @ref JxlDecoderSetOutputSize.
+ */
+typedef enum {
+  /** Each output pixel is the average of the input pixels it covers. Fast,
+   * and a good choice for downscaling by large factors.
+   */
+  JXL_RESAMPLE_FILTER_BOX = 0,
+  /** Lanczos filter with 3 lobes, widened when downscaling. Sharper than the
+   * box filter, for both downscaling and upscaling.
+   */
+  JXL_RESAMPLE_FILTER_LANCZOS3 = 1,
+} JxlResampleFilter;
+
+/** Makes the decoder output the image resampled to the given size, for
+ * example to display it in a window of a different size. The resampling is
+ * done while the image is rendered, so the decoder never stores the image at
+ * its full resolution, and the image out buffer and callback receive pixels at
+ * the requested size only, as returned by @ref JxlDecoderImageOutBufferSize.
+ * The size is given in the orientation in which the image is output, that is,
+ * it takes @ref JxlDecoderSetKeepOrientation into account. Previews are not
+ * resampled.
+ *
+ * With @ref JxlDecoderSetDownscaling, the image rendered from the DC of the
+ * frame is resampled, which is a fast way to get a placeholder at any size.
+ *
+ * Resampling cannot be combined with extra channel buffers, per-channel
+ * buffers, YCbCr planes, a crop region, disabled coalescing, progression
+ * events or @ref JxlDecoderFlushImage, and
+ * does not support modular frames with several passes. In those cases,
+ * setting the output buffer succeeds but the next call to @ref
+ * JxlDecoderProcessInput returns ::JXL_DEC_ERROR.
+ *
+ * This function must be called before the image out buffer is set, and can be
+ * called between frames. Setting @p xsize or @p ysize to 0 disables
+ * resampling (default).
+ *
+ * @param dec decoder object
+ * @param xsize width of the output image, or 0 to disable resampling.
+ * @param ysize height of the output image, or 0 to disable resampling.
+ * @param filter resampling filter.
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR if a frame is being
+ *     decoded or if the filter is not supported.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetOutputSize(JxlDecoder* dec,
+                                                    uint32_t xsize,
+                                                    uint32_t ysize,
+                                                    JxlResampleFilter filter);
+
+/** Enables or disables keeping the internal frame buffers of the decoder when
+ * it is reset with @ref JxlDecoderReset or @ref JxlDecoderRewind. The next
+ * image then reuses them, and only reallocates those that are too small for
+ * it, which avoids most of the allocations when decoding many images of
+ * similar dimensions with the same decoder. Unlike other settings, this one is
+ * not reset by @ref JxlDecoderReset.
+ *
+ * By default, the buffers are freed when the decoder is reset. Disabling the
+ * setting frees the buffers that are being kept.
+ *
+ * @param dec decoder object
+ * @param keep_buffers @ref JXL_TRUE to keep the buffers, @ref JXL_FALSE to
+ *     free them when the decoder is reset.
+ * @return ::JXL_DEC_SUCCESS
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetKeepBuffers(JxlDecoder* dec,
+                                                     JXL_BOOL keep_buffers);
+
+/** Preallocates the internal frame buffers for decoding images with the
+ * dimensions of @p info, so that they are not allocated during decoding.
+ * Buffers that are already large enough are kept as they are. Combined with
+ * @ref JxlDecoderSetKeepBuffers, this allows sizing the buffers once for the
+ * largest image that will be decoded.
+ *
+ * This function can be called before decoding starts, or between frames, for
+ * example with the basic info obtained at ::JXL_DEC_BASIC_INFO.
+ *
+ * @param dec decoder object
+ * @param info basic info of the images to prepare for; only the dimensions
+ *     and orientation are used.
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR if a frame is being
+ *     decoded or the allocation failed.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderReserveBuffers(JxlDecoder* dec,
+                                                     const JxlBasicInfo* info);
+
+/** An image decoded by @ref JxlDecoderDecodeBatch.
+ */
+typedef struct {
+  /** The whole JPEG XL file or codestream.
+   */
+  const uint8_t* data;
+  size_t size;
+  /** Buffer for the pixels of the first displayed frame, in the pixel format
+   * of the batch, which must be at least as large as @ref
+   * JxlDecoderImageOutBufferSize gives for the image.
+   */
+  void* buffer;
+  size_t buffer_size;
+  /** Set to ::JXL_DEC_SUCCESS if the image was decoded, and to
+   * ::JXL_DEC_ERROR otherwise, such as when the file is truncated or the
+   * buffer is too small.
+   */
+  JxlDecoderStatus status;
+  /** Set to the dimensions of the image, as given in its basic info, once the
+   * basic info is decoded.
+   */
+  uint32_t xsize;
+  uint32_t ysize;
+} JxlDecoderBatchItem;
+
+/** Decodes the first displayed frame of many images, each given as a whole,
+ * to their pixel buffers. This is faster than decoding the images one by one
+ * when they are small, such as icons or thumbnails: each image is decoded by
+ * a single thread of the parallel runner, which decodes several images at
+ * once and so does not have to dispatch tasks for the groups of each image,
+ * and each thread reuses one decoder with @ref JxlDecoderSetKeepBuffers for
+ * all its images, so that the frame buffers are allocated only once.
+ *
+ * The images are decoded with the default settings of the decoder.
+ *
+ * @param memory_manager custom allocator function. It may be NULL.
+ * @param parallel_runner function pointer to runner for multithreading. It may
+ *     be NULL to decode the images one after another.
+ * @param parallel_runner_opaque opaque pointer for parallel_runner.
+ * @param format pixel format of the output buffers of all the images.
+ * @param items the images, whose status and dimensions are set.
+ * @param num_items amount of images.
+ * @return ::JXL_DEC_SUCCESS if all images were decoded, ::JXL_DEC_ERROR
+ *     otherwise; the status of each image tells which failed.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderDecodeBatch(
+    const JxlMemoryManager* memory_manager, JxlParallelRunner parallel_runner,
+    void* parallel_runner_opaque, const JxlPixelFormat* format,
+    JxlDecoderBatchItem* items, size_t num_items);
+
+/** Reads the basic info and the ICC profile of an image from the beginning
+ * of its file, without creating a decoder. This is much cheaper than a
+ * decoder when only the headers are needed, e.g. to validate the dimensions
+ * of many uploaded images: only the signature, the codestream headers and,
+ * when requested, the compressed ICC profile are parsed.
+ *
+ * The basic info is as given by @ref JxlDecoderGetBasicInfo with the default
+ * decoder settings, and so with the orientation applied.
+ *
+ * @param memory_manager custom allocator function, used only to decompress
+ *     the ICC profile. May be NULL to use the default allocator.
+ * @param data the beginning of the file; more bytes are needed for a
+ *     container with boxes before the codestream.
+ * @param size size of @p data.
+ * @param info output for the basic info, may be NULL.
+ * @param icc_profile output buffer for the ICC profile, may be NULL.
+ * @param icc_size size of @p icc_profile. The ICC profile is only written if
+ *     it fits.
+ * @param icc_required_size output for the size of the ICC profile, or 0 if
+ *     the color encoding is not an ICC profile. May be NULL to not read the
+ *     ICC profile at all.
+ * @return ::JXL_DEC_SUCCESS if the headers were read,
+ *     ::JXL_DEC_NEED_MORE_INPUT if @p data ends before them, ::JXL_DEC_ERROR
+ *     if the file is invalid.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderProbeHeader(
+    const JxlMemoryManager* memory_manager, const uint8_t* data, size_t size,
+    JxlBasicInfo* info, uint8_t* icc_profile, size_t icc_size,
+    size_t* icc_required_size);
+
 /**
  * Decodes JPEG XL file using the available bytes. Requires input has been
  * set with @ref JxlDecoderSetInput. After @ref JxlDecoderProcessInput, input
@@ -657,6 +1084,30 @@ JXL_EXPORT size_t JxlDecoderReleaseInput(JxlDecoder* dec);
  */
 JXL_EXPORT void JxlDecoderCloseInput(JxlDecoder* dec);
 
+/**
+ * Sets the whole input file at once, typically a memory-mapped file, and
+ * guarantees that it stays valid and unchanged until the decoder is destroyed,
+ * reset or rewound, or until @ref JxlDecoderReleaseInput is called. This is
+ * the same as @ref JxlDecoderSetInput followed by @ref JxlDecoderCloseInput,
+ * except that the decoder can then read the frame sections in place, using
+ * the table of contents of the frames, instead of copying the codestream when
+ * it is split in several `jxlp` boxes, and that it does not read the sections
+ * of the groups that are outside of the output crop, so that their pages of a
+ * memory-mapped file are never loaded.
+ *
+ * Must be called before the first @ref JxlDecoderProcessInput, in place of
+ * @ref JxlDecoderSetInput.
+ *
+ * @param dec decoder object
+ * @param data pointer to the whole input file.
+ * @param size amount of bytes of the file.
+ * @return ::JXL_DEC_ERROR if input was already set or decoding has already
+ *     started, ::JXL_DEC_SUCCESS otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetPersistentInput(JxlDecoder* dec,
+                                                         const uint8_t* data,
+                                                         size_t size);
+
 /**
  * Outputs the basic image information, such as image dimensions, bit depth and
  * all other JxlBasicInfo fields, if available.
@@ -841,6 +1292,23 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetPreferredColorProfile(
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetDesiredIntensityTarget(
     JxlDecoder* dec, float desired_intensity_target);
 
+/**
+ * Makes the tone mapping requested with @ref
+ * JxlDecoderSetDesiredIntensityTarget interpolate the luminance curve from a
+ * table of @c lut_size entries, computed once per frame, instead of evaluating
+ * it for every pixel. Larger tables are more accurate: 256 is enough for 8-bit
+ * output, 1024 for 10-bit. Gamut mapping is still computed for every pixel,
+ * and so is the curve for pixels outside of the nominal range. The default, 0,
+ * disables the table. May only be set before starting decoding.
+ *
+ * @param dec decoder object
+ * @param lut_size number of entries of the table, 0 or 16 to 4096.
+ * @return ::JXL_DEC_SUCCESS if the table size was set, ::JXL_DEC_ERROR
+ *     otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetToneMappingLutSize(JxlDecoder* dec,
+                                                           uint32_t lut_size);
+
 /**
  * Sets the desired output color profile of the decoded image either from a
  * color encoding or an ICC profile. Valid calls of this function have either @c
@@ -900,6 +1368,49 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetOutputColorProfile(
  */
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetCms(JxlDecoder* dec,
                                              JxlCmsInterface cms);
+
+/**
+ * Makes the decoder sample the color conversion done by the CMS set with @ref
+ * JxlDecoderSetCms on a 3D grid of @c grid_size points per channel, and
+ * convert the pixels by tetrahedral interpolation of that grid instead of
+ * calling the CMS for every pixel. This is much faster for conversions between
+ * ICC profiles that the CMS evaluates with lookup tables, at the cost of
+ * some accuracy; 33 and 65 are typical grid sizes. Rows with input values
+ * outside of [0, 1] are still converted by the CMS. Only applies to
+ * conversions between RGB color spaces. The default, 0, disables the grid.
+ * May only be set before starting decoding.
+ *
+ * @param dec decoder object
+ * @param grid_size number of grid points per channel, 0 or 2 to 65.
+ * @return ::JXL_DEC_SUCCESS if the grid size was set, ::JXL_DEC_ERROR
+ *     otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetCmsLutSize(JxlDecoder* dec,
+                                                    uint32_t grid_size);
+
+/**
+ * Applies a gain map (ISO 21496-1) to the displayed frames while they are
+ * rendered, to output the rendition adapted to a display whose peak
+ * luminance is @c display_headroom times its SDR white luminance. The gain map
+ * codestream of @c bundle, e.g. read from the "jhgm" box with @ref
+ * JxlGainMapReadBundle, is decoded by this call and stretched over the frames.
+ *
+ * The gain map is applied to the linear pixels, where (1, 1, 1) is the
+ * intensity target of the image, before the conversion to the output color
+ * space. Output values above 1 are only kept by floating point pixel formats.
+ * The alternate color space of the bundle is not used.
+ *
+ * May only be set before starting decoding. Passing NULL for @c bundle
+ * removes the gain map.
+ *
+ * @param dec decoder object
+ * @param bundle gain map bundle; its contents are copied.
+ * @param display_headroom ratio of the display peak to SDR white, at least 1.
+ * @return ::JXL_DEC_SUCCESS if the gain map was decoded and set, @ref
+ *     JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetGainMap(
+    JxlDecoder* dec, const JxlGainMapBundle* bundle, float display_headroom);
 // TODO(firsching): add a function JxlDecoderSetDefaultCms() for setting a
 // default in case libjxl is build with a CMS.
 
@@ -966,6 +1477,50 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderGetFrameHeader(const JxlDecoder* dec,
 JXL_EXPORT JxlDecoderStatus JxlDecoderGetFrameName(const JxlDecoder* dec,
                                                    char* name, size_t size);
 
+/** A range of bytes of the input file, see @ref JxlDecoderGetFrameByteRanges.
+ */
+typedef struct {
+  /** Position of the first byte, from the start of the file. */
+  uint64_t offset;
+  /** Number of bytes. */
+  uint64_t size;
+} JxlByteRange;
+
+/**
+ * Outputs the ranges of bytes of the input file that contain the sections of
+ * the current frame needed to decode it up to a given progressive step, e.g.
+ * to fetch only those with HTTP range requests. The headers of the frame are
+ * before the first range, and the frames it depends on, such as reference
+ * frames for patches or DC frames, are before the frame in the file.
+ *
+ * With @p num_passes 0, the ranges contain the DC of the frame, which is all
+ * @ref JxlDecoderSetDownscaling needs. Otherwise they contain the first @p
+ * num_passes passes, or all of them if the frame has fewer passes, e.g. with
+ * `UINT32_MAX` for the whole frame. If a crop region was set with @ref
+ * JxlDecoderSetCropRegion, which can be done after ::JXL_DEC_FRAME, only the
+ * groups needed for the region are included. Sections that are not needed
+ * can be left out of the input when it is decoded with the same settings,
+ * e.g. replaced by zeros; ranges that follow each other are merged.
+ *
+ * This function can be called when ::JXL_DEC_FRAME occurred for the current
+ * frame. It fails if the codestream of the frame is split over several boxes.
+ *
+ * @param dec decoder object
+ * @param num_passes number of progressive passes, or 0 for the DC only.
+ * @param ranges output ranges in the order of the file, can be NULL if @p
+ *     max_ranges is 0.
+ * @param max_ranges maximum number of ranges to write to @p ranges.
+ * @param num_ranges output value, total number of ranges, which can be larger
+ *     than @p max_ranges.
+ * @return ::JXL_DEC_SUCCESS if the value is available, ::JXL_DEC_ERROR if no
+ *     frame header is available or the frame is not contiguous in the file.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetFrameByteRanges(const JxlDecoder* dec,
+                                                         uint32_t num_passes,
+                                                         JxlByteRange* ranges,
+                                                         size_t max_ranges,
+                                                         size_t* num_ranges);
+
 /**
  * Outputs the blend information for the current frame for a specific extra
  * channel. This function can be called once the ::JXL_DEC_FRAME event occurred
@@ -1018,6 +1573,93 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderImageOutBufferSize(
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetImageOutBuffer(
     JxlDecoder* dec, const JxlPixelFormat* format, void* buffer, size_t size);
 
+/**
+ * Location of one channel of the output image, for @ref
+ * JxlDecoderSetImageOutChannelBuffers. The sample of the pixel at (x, y) is
+ * stored at byte offset `y * row_stride + x * pixel_stride` from @ref base.
+ */
+typedef struct {
+  /** Address of the sample of the top-left pixel. */
+  void* base;
+  /** Distance in bytes between the samples of horizontally adjacent pixels,
+   * which must be at least the size of a sample. */
+  size_t pixel_stride;
+  /** Distance in bytes between the samples of vertically adjacent pixels. */
+  size_t row_stride;
+} JxlChannelBuffer;
+
+/**
+ * Sets the buffers of the channels of the full resolution image, as an
+ * alternative to @ref JxlDecoderSetImageOutBuffer for layouts that are not
+ * tightly packed and interleaved: rows with padding, planar layouts, or
+ * samples written into a larger structure. The decoder writes the pixels
+ * directly into these buffers.
+ *
+ * The channels are given in the order of the interleaved output of the same
+ * pixel format, e.g. R, G, B and A for 4 channels. The buffers must be large
+ * enough for the dimensions of the image, as oriented and cropped by @ref
+ * JxlDecoderSetCropRegion, and the buffers of different channels must not
+ * overlap. The same rules as for @ref JxlDecoderSetImageOutBuffer apply for
+ * when to call this function, and it replaces a buffer set by @ref
+ * JxlDecoderSetImageOutBuffer.
+ *
+ * @param dec decoder object
+ * @param format format of the pixels. The align field is ignored. Object
+ *     owned by user and its contents are copied internally.
+ * @param channels array of @c format->num_channels channel buffers. Object
+ *     owned by user and its contents are copied internally.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR on error, such as
+ *     an unsupported format or a @c NULL channel base.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetImageOutChannelBuffers(
+    JxlDecoder* dec, const JxlPixelFormat* format,
+    const JxlChannelBuffer* channels);
+
+/**
+ * Returns the dimensions of a plane for @ref
+ * JxlDecoderSetYCbCrPlanesOutBuffer, which depend on the chroma subsampling
+ * of the current frame.
+ *
+ * @param dec decoder object
+ * @param plane index of the plane: 0 for Y, 1 for Cb, 2 for Cr.
+ * @param xsize output value, width of the plane in pixels.
+ * @param ysize output value, height of the plane in pixels.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if the current frame
+ *     can not be output as YCbCr planes, see @ref
+ *     JxlDecoderSetYCbCrPlanesOutBuffer.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderYCbCrPlaneSize(const JxlDecoder* dec,
+                                                     uint32_t plane,
+                                                     size_t* xsize,
+                                                     size_t* ysize);
+
+/**
+ * Sets buffers for the Y, Cb and Cr planes of the current frame, as stored in
+ * the codestream, instead of an RGB image. This is available for frames in
+ * YCbCr, such as the ones of JPEG files recompressed losslessly, and avoids
+ * the chroma upsampling and the conversion to RGB: subsampled planes are
+ * written at their native resolution, which @ref JxlDecoderYCbCrPlaneSize
+ * returns.
+ *
+ * The samples are full-range JFIF values: for ::JXL_TYPE_UINT8, in the range
+ * 0 to 255 with Cb and Cr centered at 128; for ::JXL_TYPE_FLOAT, the same
+ * values divided by 255. No color management is applied.
+ *
+ * This can be called instead of @ref JxlDecoderSetImageOutBuffer when the
+ * decoder returns ::JXL_DEC_NEED_IMAGE_OUT_BUFFER, and fails if the frame
+ * needs processing that is defined on the full resolution image, such as
+ * blending, filters or upsampling, or if the image must be oriented (see @ref
+ * JxlDecoderSetKeepOrientation) or cropped. Extra channels are not written.
+ *
+ * @param dec decoder object
+ * @param data_type type of the samples, ::JXL_TYPE_UINT8 or ::JXL_TYPE_FLOAT.
+ * @param planes array of 3 buffers, for Y, Cb and Cr. Object owned by user
+ *     and its contents are copied internally.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR on error.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetYCbCrPlanesOutBuffer(
+    JxlDecoder* dec, JxlDataType data_type, const JxlChannelBuffer* planes);
+
 /**
  * Function type for @ref JxlDecoderSetImageOutCallback.
  *
@@ -1151,6 +1793,227 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
     JxlImageOutInitCallback init_callback, JxlImageOutRunCallback run_callback,
     JxlImageOutDestroyCallback destroy_callback, void* init_opaque);
 
+/**
+ * Callback for @ref JxlDecoderSetImageOutTileCallback.
+ *
+ * @param opaque user data, as given to @ref JxlDecoderSetImageOutTileCallback.
+ * @param thread_id number identifying the thread of the current invocation of
+ *     the callback, smaller than the number of threads of the parallel runner.
+ * @param x horizontal position of the leftmost column of the tile.
+ * @param y vertical position of the top row of the tile.
+ * @param xsize width of the tile.
+ * @param ysize height of the tile.
+ * @param pixels pixel data of the tile, in the format passed to @ref
+ *     JxlDecoderSetImageOutTileCallback. The data remains owned by the decoder
+ *     and is only valid during the callback invocation.
+ * @param stride distance in bytes between the starts of consecutive rows of
+ *     @p pixels.
+ */
+typedef void (*JxlImageOutTileCallback)(void* opaque, size_t thread_id,
+                                        size_t x, size_t y, size_t xsize,
+                                        size_t ysize, const void* pixels,
+                                        size_t stride);
+
+/**
+ * Sets a pixel output callback receiving whole rectangles of the image instead
+ * of rows. This is an alternative to @ref JxlDecoderSetImageOutBuffer and @ref
+ * JxlDecoderSetMultithreadedImageOutCallback, with the same rules for when it
+ * can be set.
+ *
+ * Each call delivers a rectangle that is completely rendered, such as a
+ * group or the part of a group that no longer depends on its neighbours; it
+ * is at most the group size times the upsampling factor in each direction.
+ * The rectangles of different calls do not overlap, so calls from different
+ * threads need no synchronization. The positions and sizes are in the output
+ * image, after applying the orientation and the crop region if any.
+ *
+ * As with the other callbacks, @ref JxlDecoderFlushImage may deliver pixels
+ * of a lower quality that are delivered again later. Resampled output (see
+ * @ref JxlDecoderSetOutputSize) is not supported with this callback.
+ *
+ * @param dec decoder object
+ * @param format format of the pixels. Object owned by user; its contents are
+ *     copied internally. The @c align field is ignored: rows of a tile are
+ *     contiguous.
+ * @param callback the callback function receiving the tiles.
+ * @param opaque optional user data, which will be passed on to the callback,
+ *     may be NULL.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR on error, such
+ *     as @ref JxlDecoderSetImageOutBuffer having already been called.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetImageOutTileCallback(
+    JxlDecoder* dec, const JxlPixelFormat* format,
+    JxlImageOutTileCallback callback, void* opaque);
+
+/**
+ * Worker callback for @ref JxlDecoderSetRenderHook.
+ *
+ * @param run_opaque user data returned by the @c init callback.
+ * @param thread_id number in `[0, num_threads)` identifying the thread of the
+ *     current invocation of the callback.
+ * @param x horizontal position of the first (leftmost) pixel, in the frame.
+ * @param y vertical position of the pixels, in the frame.
+ * @param num_pixels number of pixels in each row, at most the @c
+ *     num_pixels_per_thread that was passed to @c init.
+ * @param channels one row of 32-bit floats per channel: the three color
+ *     channels followed by the extra channels. The values can be modified in
+ *     place. The rows are only valid during the callback invocation.
+ */
+typedef void (*JxlRenderHookRunCallback)(void* run_opaque, size_t thread_id,
+                                         size_t x, size_t y, size_t num_pixels,
+                                         float* const* channels);
+
+/**
+ * Inserts custom processing into the rendering of frames, for example to run
+ * parts of it on a GPU. The hook receives the frame in the decoder's internal
+ * floating point representation, after the restoration filters, patches,
+ * splines, upsampling and noise, and before the color transform: XYB for
+ * frames encoded in XYB (see @ref JxlBasicInfo::uses_original_profile), the
+ * color space of the image otherwise. The hook can modify the values in place,
+ * which changes the decoded output.
+ *
+ * For each frame that is rendered, @c init_callback is called with the number
+ * of threads and the width of the frame, then @c run_callback is called on
+ * rows of the frame, possibly from several threads at once and in any order,
+ * then @c destroy_callback is called. Each pixel is passed once per frame,
+ * unless the frame is rendered again, for example with @ref
+ * JxlDecoderFlushImage or progressive events.
+ *
+ * Must be called before starting.
+ *
+ * @param dec decoder object
+ * @param init_callback initialization callback.
+ * @param run_callback the callback function receiving the rows.
+ * @param destroy_callback clean-up callback invoked after all calls to @c
+ *     run_callback. May be NULL if no clean-up is necessary.
+ * @param init_opaque optional user data passed to @c init_callback, may be
+ *     NULL.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR on error, such as
+ *     missing callbacks or the decoder having already started.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetRenderHook(
+    JxlDecoder* dec, JxlImageOutInitCallback init_callback,
+    JxlRenderHookRunCallback run_callback,
+    JxlImageOutDestroyCallback destroy_callback, void* init_opaque);
+
+/**
+ * Sets the given stats object for gathering the sizes of the sections, the
+ * time spent in each phase and the peak memory while decoding, see @ref
+ * JxlDecoderStatsKey. The values are added to those already in @p stats, which
+ * must outlive the decoder or be unset by calling this function with NULL;
+ * several decoders can share it.
+ *
+ * Collecting statistics adds some overhead, in particular to the memory
+ * allocations, which are then counted.
+ *
+ * Must be called before starting.
+ *
+ * @param dec decoder object
+ * @param stats object that can be used to query the gathered stats (created
+ *     by @ref JxlDecoderStatsCreate), or NULL to stop collecting.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if the decoder has
+ *     already started.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderCollectStats(JxlDecoder* dec,
+                                                   JxlDecoderStats* stats);
+
+/**
+ * Estimates the peak memory that the decoder allocates through its memory
+ * manager, not counting the image output buffers.
+ *
+ * After ::JXL_DEC_FRAME, this is the estimate for the current frame, on top of
+ * the memory kept from previous frames, e.g. frames referenced for blending.
+ * Before that, from ::JXL_DEC_BASIC_INFO on, it is the estimate for the
+ * largest frame that an image of these dimensions and channels may have. This
+ * is an estimate for planning, not a guarantee; use @ref
+ * JxlDecoderSetMemoryLimit to enforce a limit.
+ *
+ * @param dec decoder object
+ * @param num_threads number of threads of the parallel runner, the decoder
+ *     allocates storage for each thread that decodes groups.
+ * @param bytes output value, estimated memory in bytes
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if the basic info is
+ *     not yet available.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetMemoryEstimate(const JxlDecoder* dec,
+                                                        size_t num_threads,
+                                                        size_t* bytes);
+
+/**
+ * Limits the memory that the decoder allocates through its memory manager,
+ * for applications with a memory budget. For each frame, the decoder then
+ * uses as many threads of the parallel runner as fit in the memory left
+ * according to @ref JxlDecoderGetMemoryEstimate, and it does not decode
+ * frames ahead (see @ref JxlDecoderSetParallelFrames). If the frame does not
+ * fit with a single thread, the decoder returns ::JXL_DEC_ERROR before
+ * decoding it. Allocations that would still exceed the limit fail, which
+ * makes the decoder return ::JXL_DEC_ERROR.
+ *
+ * The image output buffers of the application are not counted.
+ * @ref JxlDecoderSetReducedPrecisionBuffers further reduces the memory used.
+ *
+ * Must be called before starting.
+ *
+ * @param dec decoder object
+ * @param max_bytes maximum amount of memory in bytes, or 0 for no limit.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if the decoder has
+ *     already started.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetMemoryLimit(JxlDecoder* dec,
+                                                     size_t max_bytes);
+
+/** Limits on the decoding work that an image can require, see @ref
+ * JxlDecoderSetLimit.
+ */
+typedef enum {
+  /** Maximum number of pixels of the image and of each frame, after
+   * upsampling.
+   */
+  JXL_DEC_LIMIT_PIXELS = 0,
+
+  /** Maximum number of frames in the codestream, including the frames that
+   * are not displayed, such as the reference frames for patches.
+   */
+  JXL_DEC_LIMIT_FRAMES = 1,
+
+  /** Maximum number of nodes of each MA tree of the modular encoding.
+   */
+  JXL_DEC_LIMIT_TREE_NODES = 2,
+
+  /** Maximum number of spline control points of each frame.
+   */
+  JXL_DEC_LIMIT_SPLINE_CONTROL_POINTS = 3,
+
+  /** Maximum number of patches of each frame.
+   */
+  JXL_DEC_LIMIT_PATCHES = 4,
+
+  /** Maximum number of pixels processed by upsampling and by the restoration
+   * filters (gaborish and each edge preserving filter pass), summed over all
+   * frames.
+   */
+  JXL_DEC_LIMIT_FILTER_WORK = 5,
+} JxlDecoderLimit;
+
+/**
+ * Limits the decoding work that an image can require, for applications that
+ * decode untrusted input. The limits are checked while decoding the headers
+ * of the image and of each frame, before the work is done, and the decoder
+ * returns ::JXL_DEC_ERROR for images that exceed a limit. The decoder always
+ * applies its own limits, derived from the image size, in addition to these.
+ *
+ * Must be called before starting.
+ *
+ * @param dec decoder object
+ * @param limit the limit to set
+ * @param value maximum value, or 0 for no limit.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if the decoder has
+ *     already started or the limit is unknown.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetLimit(JxlDecoder* dec,
+                                               JxlDecoderLimit limit,
+                                               uint64_t value);
+
 /**
  * Returns the minimum size in bytes of an extra channel pixel buffer for the
  * given format. This is the buffer for @ref JxlDecoderSetExtraChannelBuffer.
@@ -1204,6 +2067,34 @@ JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetExtraChannelBuffer(JxlDecoder* dec, const JxlPixelFormat* format,
                                 void* buffer, size_t size, uint32_t index);
 
+/**
+ * Marks an extra channel as not needed by the application, e.g. a depth or
+ * thermal channel of an image that is only displayed. By default, all extra
+ * channels are needed. This can be called after the ::JXL_DEC_BASIC_INFO
+ * event, and applies to the frames whose decoding has not started yet.
+ *
+ * The decoder then does not entropy decode the channel where the format of a
+ * frame allows it: only the trailing extra channels of the groups of frames
+ * without global modular transforms can be skipped, so it helps most when the
+ * unneeded channels come last. An extra channel is still decoded if a buffer
+ * is set for it with @ref JxlDecoderSetExtraChannelBuffer, if it is the alpha
+ * channel of the image out buffer or used for blending, if it is a spot color
+ * that is rendered or the black channel of a CMYK image, and in frames that
+ * are saved as reference for later frames.
+ *
+ * @param dec decoder object
+ * @param index which extra channel, matching the index used in @ref
+ *     JxlDecoderGetExtraChannelInfo. Must be smaller than num_extra_channels in
+ *     the associated @ref JxlBasicInfo.
+ * @param needed JXL_FALSE if the channel is not needed, JXL_TRUE (default)
+ *     otherwise.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR on error, such as
+ *     basic info not available yet or invalid index.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetExtraChannelNeeded(JxlDecoder* dec,
+                                                            uint32_t index,
+                                                            JXL_BOOL needed);
+
 /**
  * Sets output buffer for reconstructed JPEG codestream.
  *
@@ -1243,6 +2134,116 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetJPEGBuffer(JxlDecoder* dec,
  */
 JXL_EXPORT size_t JxlDecoderReleaseJPEGBuffer(JxlDecoder* dec);
 
+/**
+ * Enables or disables streaming of the JPEG reconstruction. When enabled, the
+ * JPEG bytes are written to the buffer set with @ref JxlDecoderSetJPEGBuffer
+ * while the frame is decoded, one row of groups at a time, and the decoder
+ * only keeps the DCT coefficients of the current row instead of those of the
+ * whole image. If the buffer is full, the decoder returns
+ * ::JXL_DEC_JPEG_NEED_MORE_OUTPUT; the bytes written so far are final, and
+ * after @ref JxlDecoderReleaseJPEGBuffer, a new buffer for the next bytes must
+ * be set before calling @ref JxlDecoderProcessInput again.
+ *
+ * Streaming is only used for JPEGs with a single sequential scan containing
+ * all the components, when the JPEG XL frame has a single pass, and when the
+ * Exif and XMP boxes needed for the reconstruction come before the
+ * codestream. Otherwise, and when @ref JxlDecoderSetJPEGCoefficientsOutput is
+ * enabled, the JPEG is written after the frame is decoded as usual.
+ *
+ * Must be called before starting decoding.
+ *
+ * @param dec decoder object
+ * @param enabled whether to stream the JPEG reconstruction.
+ * @return ::JXL_DEC_SUCCESS if the setting was changed, ::JXL_DEC_ERROR if
+ *     decoding already started, or if JPEG reconstruction is not supported.
+ */
+JXL_EXPORT JxlDecoderStatus
+JxlDecoderSetStreamingJPEGReconstruction(JxlDecoder* dec, JXL_BOOL enabled);
+
+/**
+ * Enables or disables access to the quantized DCT coefficients of a JPEG
+ * reconstruction frame, without reconstructing the JPEG bytes and without
+ * decoding the frame to pixels. When enabled, a frame that has JPEG
+ * reconstruction data is decoded like when a buffer is set with @ref
+ * JxlDecoderSetJPEGBuffer, and once ::JXL_DEC_FULL_IMAGE is returned, @ref
+ * JxlDecoderGetJPEGComponentCount, @ref JxlDecoderGetJPEGComponentInfo and
+ * @ref JxlDecoderGetJPEGCoefficients give access to the coefficients, until
+ * the decoder is reset, rewound or destroyed. If no JPEG buffer is set, no JPEG
+ * bytes are written.
+ *
+ * Must be called before the frame is decoded, e.g. when the decoder returns
+ * ::JXL_DEC_JPEG_RECONSTRUCTION. Frames without JPEG reconstruction data are
+ * decoded to pixels regardless of this setting.
+ *
+ * @param dec decoder object
+ * @param enabled whether to keep the coefficients.
+ * @return ::JXL_DEC_SUCCESS if the setting was changed, ::JXL_DEC_ERROR if
+ *     called after the frame started, or if JPEG reconstruction is not
+ *     supported.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetJPEGCoefficientsOutput(
+    JxlDecoder* dec, JXL_BOOL enabled);
+
+/** Properties of a component of a JPEG reconstruction frame, see @ref
+ * JxlDecoderGetJPEGComponentInfo.
+ */
+typedef struct {
+  /** Component identifier, as in the JPEG frame header. */
+  uint32_t id;
+  /** Horizontal and vertical sampling factors of the component. */
+  uint32_t h_samp_factor;
+  uint32_t v_samp_factor;
+  /** Dimensions of the component in 8x8 blocks. */
+  uint32_t width_in_blocks;
+  uint32_t height_in_blocks;
+  /** Quantization table of the component, in natural (row-major) order. */
+  uint16_t quant_table[64];
+} JxlJPEGComponentInfo;
+
+/**
+ * Returns the number of components of the JPEG reconstruction frame, see
+ * @ref JxlDecoderSetJPEGCoefficientsOutput.
+ *
+ * @param dec decoder object
+ * @param count output value: number of components, 1 for grayscale and 3 for
+ *     YCbCr images.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if no coefficients
+ *     are available.
+ */
+JXL_EXPORT JxlDecoderStatus
+JxlDecoderGetJPEGComponentCount(const JxlDecoder* dec, uint32_t* count);
+
+/**
+ * Returns the properties of a component of the JPEG reconstruction frame, see
+ * @ref JxlDecoderSetJPEGCoefficientsOutput.
+ *
+ * @param dec decoder object
+ * @param index index of the component, in the order of the JPEG frame header.
+ * @param info output value: properties of the component.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if no coefficients
+ *     are available or the index is invalid.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetJPEGComponentInfo(
+    const JxlDecoder* dec, uint32_t index, JxlJPEGComponentInfo* info);
+
+/**
+ * Copies the quantized DCT coefficients of a component of the JPEG
+ * reconstruction frame, see @ref JxlDecoderSetJPEGCoefficientsOutput. The
+ * coefficients are written block by block, in row-major order of the blocks,
+ * with the 64 coefficients of each block in natural (row-major) order; they
+ * are not multiplied by the quantization table.
+ *
+ * @param dec decoder object
+ * @param index index of the component.
+ * @param coefficients buffer for `width_in_blocks * height_in_blocks * 64`
+ *     coefficients.
+ * @param size size of the buffer in bytes.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if no coefficients
+ *     are available, the index is invalid or the buffer is too small.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetJPEGCoefficients(
+    const JxlDecoder* dec, uint32_t index, int16_t* coefficients, size_t size);
+
 /**
  * Sets output buffer for box output codestream.
  *
@@ -1406,6 +2407,62 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderGetBoxSizeRaw(const JxlDecoder* dec,
 JXL_EXPORT JxlDecoderStatus JxlDecoderGetBoxSizeContents(const JxlDecoder* dec,
                                                          uint64_t* size);
 
+/** Entry of the index of container boxes returned by @ref JxlScanBoxes.
+ */
+typedef struct {
+  /** Type of the box. For a "brob" box, this is the type of the compressed
+   * box, e.g. "Exif" or "xml ".
+   */
+  JxlBoxType type;
+
+  /** Whether this is a Brotli-compressed "brob" box. */
+  JXL_BOOL compressed;
+
+  /** Whether the box has no size in its header and extends until the end of
+   * the file. Only possible for the last box.
+   */
+  JXL_BOOL until_eof;
+
+  /** Offset of the box header from the start of the file. */
+  uint64_t box_offset;
+
+  /** Offset of the box contents from the start of the file. For a "brob" box,
+   * this is the start of the Brotli stream, after the compressed box type.
+   */
+  uint64_t contents_offset;
+
+  /** Size of the box contents starting at contents_offset. For a box that
+   * extends until the end of the file, this is the size until the end of the
+   * passed data.
+   */
+  uint64_t contents_size;
+} JxlBoxIndexEntry;
+
+/**
+ * Lists the boxes of a JPEG XL container without decoding the codestream or
+ * any box contents, so that callers can read or decompress only the boxes
+ * they need, e.g. with the Brotli decoder for the contents of "brob" boxes.
+ *
+ * Only the box headers need to be within @p data: the contents of a box that
+ * ends after @p size are not needed, but the boxes after it are not listed.
+ * A bare codestream without container has no boxes.
+ *
+ * @param data the beginning of the file.
+ * @param size size of @p data.
+ * @param entries output for the first @p max_entries boxes, may be NULL.
+ * @param max_entries size of @p entries.
+ * @param num_entries output for the number of boxes found, which may be
+ *     larger than @p max_entries.
+ * @return ::JXL_DEC_SUCCESS if all the boxes within @p data were listed,
+ *     ::JXL_DEC_NEED_MORE_INPUT if @p data ends within a box header or the
+ *     signature, ::JXL_DEC_ERROR if the signature or a box header is invalid.
+ *     The boxes before the end or the error are listed in all cases.
+ */
+JXL_EXPORT JxlDecoderStatus JxlScanBoxes(const uint8_t* data, size_t size,
+                                         JxlBoxIndexEntry* entries,
+                                         size_t max_entries,
+                                         size_t* num_entries);
+
 /**
  * Configures at which progressive steps in frame decoding these @ref
  * JXL_DEC_FRAME_PROGRESSION event occurs. The default value for the level
@@ -103,6 +103,11 @@ typedef enum {
    */
   JXL_ENC_ERR_BAD_INPUT = 4,
 
+  /** The encoding was cancelled with the callback set with @ref
+   * JxlEncoderSetCancelCallback.
+   */
+  JXL_ENC_ERR_CANCELLED = 5,
+
   /** The encoder doesn't (yet) support this. Either no version of libjxl
    * supports this, and the API is used incorrectly, or the libjxl version
    * should have been checked before trying to do this.
@@ -352,7 +357,10 @@ typedef enum {
    *
    * When using streaming input and output the encoder minimizes memory usage at
    * the cost of compression density. Also note that images produced with
-   * streaming mode might not be progressively decodeable.
+   * streaming mode might not be progressively decodeable. At effort 8 and
+   * above, the butteraugli iterations then run on each 2048 x 2048 region of
+   * a lossy frame separately. Forcing patches or noise on, progressive DC,
+   * resampling and max error mode still buffer the whole image.
    */
   JXL_ENC_FRAME_SETTING_BUFFERING = 34,
 
@@ -393,6 +401,153 @@ typedef enum {
    */
   JXL_ENC_FRAME_SETTING_DISABLE_PERCEPTUAL_HEURISTICS = 39,
 
+  /** Indexes every N-th displayed frame of an animation as a keyframe in the
+   * frame index box, so that a decoder can seek to it directly, counting from
+   * the first frame. The keyframes must not be cropped nor blended with
+   * previous frames (@ref JXL_ENC_ERROR otherwise), and the frames after them
+   * must not reference frames saved before them. Frames that follow a frame
+   * with zero duration are not indexed. -1 = default (no keyframes), 0 = no
+   * keyframes, N > 0 = interval in displayed frames.
+   */
+  JXL_ENC_FRAME_SETTING_KEYFRAME_INTERVAL = 40,
+
+  /** Use built-in static entropy codes for the frame instead of histograms
+   * built from its data. This skips gathering symbol statistics and clustering
+   * histograms, which dominate the entropy coding time of small images at low
+   * effort, at the cost of some compression. Streaming encoding (see @ref
+   * JXL_ENC_FRAME_SETTING_BUFFERING) always builds histograms. -1 = default
+   * (disabled), 0 = disabled, 1 = enabled.
+   */
+  JXL_ENC_FRAME_SETTING_STATIC_ENTROPY_CODES = 41,
+
+  /** Target butteraugli score for lossy (VarDCT) frames. The encoder searches
+   * the quantization of the frame so that the butteraugli score of its own
+   * reconstruction is close to, and if possible not above, this value,
+   * starting from the distance set with @ref JxlEncoderSetFrameDistance. Each
+   * search step costs about one butteraugli comparison, without a full
+   * encode or decode. The search is skipped for frames encoded in streaming
+   * mode (see @ref JXL_ENC_FRAME_SETTING_BUFFERING). Set this with @ref
+   * JxlEncoderFrameSettingsSetFloatOption. 0 = disabled (default), positive
+   * values = target score.
+   */
+  JXL_ENC_FRAME_SETTING_TARGET_BUTTERAUGLI_SCORE = 42,
+
+  /** Target size in bytes for lossy (VarDCT) frames. The encoder scales the
+   * AC quantization chosen for the distance set with @ref
+   * JxlEncoderSetFrameDistance so that the size of the frame, estimated from
+   * the entropy of its coefficients, is close to and if possible not above
+   * this value. The block sizes and the adaptive quantization are computed
+   * once and kept, so this is much cheaper than re-encoding; the actual size
+   * can still differ from the target by a few percent. The search is skipped
+   * for frames encoded in streaming mode (see @ref
+   * JXL_ENC_FRAME_SETTING_BUFFERING) or with progressive DC. -1 = default
+   * (disabled), 0 = disabled, N > 0 = target size in bytes.
+   */
+  JXL_ENC_FRAME_SETTING_TARGET_SIZE = 43,
+
+  /** Aggressiveness of the pre-screen that skips the exact cost estimate of
+   * large transform candidates during the block size search of lossy
+   * (VarDCT) frames, trading some compression for encoding speed. -1 =
+   * default (depends on the effort), 0 = disabled, 1 to 3 = increasingly
+   * aggressive.
+   */
+  JXL_ENC_FRAME_SETTING_AC_STRATEGY_PRUNING = 44,
+
+  /** Lays out the frame for progressive delivery, e.g. over HTTP range
+   * requests: the AC is split in progressive passes unless @ref
+   * JXL_ENC_FRAME_SETTING_PROGRESSIVE_AC is set to 0, and the DC groups as
+   * well as the AC groups of each pass are stored center-first, around the
+   * center set with @ref JXL_ENC_FRAME_SETTING_GROUP_ORDER_CENTER_X and @ref
+   * JXL_ENC_FRAME_SETTING_GROUP_ORDER_CENTER_Y. The byte range of each pass
+   * can be found with JxlDecoderGetFrameByteRanges. Disables streaming
+   * encoding (see @ref JXL_ENC_FRAME_SETTING_BUFFERING). -1 = default
+   * (disabled), 0 = disabled, 1 = enabled.
+   */
+  JXL_ENC_FRAME_SETTING_PROGRESSIVE_LAYOUT = 45,
+
+  /** Keeps the encoded data that cannot be written to the output yet in a
+   * temporary file instead of memory. This applies to the output processors
+   * that cannot seek, which only get the groups of a frame once its TOC is
+   * written, and to the output not yet taken with @ref
+   * JxlEncoderProcessOutput. Together with streaming encoding (see @ref
+   * JXL_ENC_FRAME_SETTING_BUFFERING) and @ref JxlEncoderAddChunkedFrame, this
+   * keeps the memory used for very large images bounded. Once a frame sets
+   * it, the output of the following frames is also spilled. -1 = default
+   * (disabled), 0 = disabled, 1 = enabled.
+   */
+  JXL_ENC_FRAME_SETTING_SPILL_TO_DISK = 46,
+
+  /** Seeds the heuristics of a lossy (VarDCT) frame with the results of the
+   * previous frame that set this option, for animations and bursts of
+   * similar frames: the block sizes of the tiles whose content barely
+   * changed are kept, and the clustering of the AC histograms starts from
+   * the one of the previous frame. The frames are then encoded one after the
+   * other. Has no effect with streaming encoding (see @ref
+   * JXL_ENC_FRAME_SETTING_BUFFERING). -1 = default (disabled), 0 = disabled,
+   * 1 = enabled.
+   */
+  JXL_ENC_FRAME_SETTING_REUSE_PREVIOUS_HEURISTICS = 47,
+
+  /** Encodes each frame of an animation as a crop of the region that changed
+   * since the previous frame added with this option, which replaces that
+   * region of the previous frame, e.g. for screen recordings or imported GIF
+   * and APNG files. The comparison is exact, on the input pixels. Only
+   * applies to frames added with @ref JxlEncoderAddImageFrame or a
+   * non-streaming @ref JxlEncoderAddChunkedFrame, without a crop, a blend
+   * mode, a reference slot or a frame index of their own, and to images
+   * without extra channels other than an interleaved alpha channel; the
+   * reference slot 1 is then used for the previous frame. -1 = default
+   * (disabled), 0 = disabled, 1 = enabled.
+   */
+  JXL_ENC_FRAME_SETTING_AUTO_CROP = 48,
+
+  /** Wall-clock time budget in milliseconds for the encoding of each frame,
+   * for a predictable latency with inputs of unpredictable size. The effort
+   * (see @ref JXL_ENC_FRAME_SETTING_EFFORT) is the upper bound: as the frame
+   * uses up its budget, the searches that only improve the compression are
+   * shortened or skipped, i.e. the patch and spline search, the block size
+   * search, the butteraugli iterations and the MA tree learning (see @ref
+   * JXL_ENC_FRAME_SETTING_MODULAR_MA_TREE_LEARNING_PERCENT). The output stays
+   * valid, but the encoding can still exceed the budget, e.g. for the entropy
+   * coding which cannot be skipped. -1 = default (no budget), 0 = no budget,
+   * N > 0 = budget in milliseconds.
+   */
+  JXL_ENC_FRAME_SETTING_TIME_BUDGET = 49,
+
+  /** Favors the coding choices for which the decoder has a faster code path,
+   * for clients whose decoding time matters more than a few percent of size:
+   * MA trees that only split on the gradient property with the gradient
+   * predictor, which are decoded with a lookup table, fewer histogram
+   * clusters, no LZ77, and at most the two cheapest EPF iterations. Unlike
+   * @ref JXL_ENC_FRAME_SETTING_DECODING_SPEED, this keeps all the coding
+   * tools, and the explicit settings (e.g. the predictor, @ref
+   * JXL_ENC_FRAME_SETTING_EPF and @ref JXL_ENC_FRAME_SETTING_GABORISH) take
+   * precedence. -1 = default (disabled), 0 = disabled, 1 = enabled.
+   */
+  JXL_ENC_FRAME_SETTING_DECODER_FAST_PATHS = 50,
+
+  /** Reuses the patch dictionary stored by a previous frame of the codestream
+   * for the frames whose patches (see @ref JXL_ENC_FRAME_SETTING_PATCHES) it
+   * all has, instead of storing a new dictionary, e.g. for the frames of
+   * animations or of layered images that repeat the same sprites or glyphs.
+   * A new dictionary also keeps the patches of the previous one, so that they
+   * stay available to the next frames. Only the frames that are encoded with
+   * this setting share the dictionary, and they are not encoded concurrently
+   * (see @ref JxlEncoderSetParallelFrames). Separate codestreams cannot share
+   * a dictionary, since they cannot refer to frames outside of themselves.
+   * -1 = default (disabled), 0 = disabled, 1 = enabled.
+   */
+  JXL_ENC_FRAME_SETTING_SHARED_PATCHES = 51,
+
+  /** Estimates the histograms of the entropy coding from about a quarter of
+   * the groups instead of all of them, and adds all the symbols to them so
+   * that the other groups can still be coded. This costs a little size. For
+   * the largest VarDCT frames, whose AC tokens are computed again when they
+   * are written, the other groups are only tokenized when they are written.
+   * -1 = default (disabled), 0 = disabled, 1 = enabled.
+   */
+  JXL_ENC_FRAME_SETTING_SAMPLED_HISTOGRAMS = 52,
+
   /** Enum value not to be used as an option. This value is added to force the
    * C compiler to have the enum to take a known size.
    */
@@ -457,6 +612,58 @@ JXL_EXPORT JxlEncoderStatus
 JxlEncoderSetParallelRunner(JxlEncoder* enc, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque);
 
+/**
+ * Lets the encoder encode up to @p max_frames queued frames at once on the
+ * parallel runner, one frame per thread, instead of one frame after another
+ * using several threads for each. This is faster for animations of small
+ * frames, that cannot use many threads each. The frames are still written in
+ * order, but the codestream of the frames encoded ahead is kept by the encoder
+ * until it is output, which uses more memory.
+ *
+ * Frames are only encoded at once when several of them are queued, that is,
+ * when they are added before calling @ref JxlEncoderProcessOutput or @ref
+ * JxlEncoderFlushInput. Until @ref JxlEncoderCloseFrames is called, the last
+ * queued frame is not encoded ahead, since it could still become the last
+ * frame. The encoder does not use the pixels of previous frames to encode a
+ * frame, so blended and cropped frames are encoded ahead as well. JPEG frames,
+ * fast lossless frames and frames that collect statistics with @ref
+ * JxlEncoderCollectStats are encoded one after another.
+ *
+ * @param enc encoder object.
+ * @param max_frames maximum amount of frames encoded at once, 0 or 1 to encode
+ *     frames one after another (default).
+ * @return ::JXL_ENC_SUCCESS if no error, ::JXL_ENC_ERROR if it is called after
+ *     output was produced.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetParallelFrames(JxlEncoder* enc,
+                                                        size_t max_frames);
+
+/**
+ * Function checked by the encoder between the groups of each frame, see @ref
+ * JxlEncoderSetCancelCallback. It can be called concurrently from the threads
+ * of the parallel runner.
+ *
+ * @param opaque user supplied parameter.
+ * @return JXL_TRUE to cancel the encoding.
+ */
+typedef JXL_BOOL (*JxlEncoderCancelCallback)(void* opaque);
+
+/**
+ * Sets a function that the encoder checks between the groups of each frame,
+ * for example to enforce a deadline. Once it returns JXL_TRUE, @ref
+ * JxlEncoderProcessOutput and @ref JxlEncoderFlushInput return
+ * ::JXL_ENC_ERROR and @ref JxlEncoderGetError returns
+ * ::JXL_ENC_ERR_CANCELLED. The encoder must then be reset or destroyed. Frames
+ * encoded with the fast lossless mode (effort 1) are not cancelled.
+ *
+ * @param enc encoder object.
+ * @param callback function returning whether to cancel, or NULL to remove it.
+ * @param opaque user supplied parameter passed to the callback.
+ * @return ::JXL_ENC_SUCCESS if no error, ::JXL_ENC_ERROR otherwise.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetCancelCallback(
+    JxlEncoder* enc, JxlEncoderCancelCallback callback, void* opaque);
+
 /**
  * Get the (last) error code in case ::JXL_ENC_ERROR was returned.
  *
@@ -628,6 +835,45 @@ JXL_EXPORT JxlEncoderStatus
 JxlEncoderAddJPEGFrame(const JxlEncoderFrameSettings* frame_settings,
                        const uint8_t* buffer, size_t size);
 
+/**
+ * Planar 8-bit YCbCr pixels, as decoded from most video codecs.
+ */
+typedef struct {
+  /** The Y, Cb and Cr planes. Owned by the caller. */
+  const uint8_t* planes[3];
+  /** Distance in bytes between the starts of consecutive rows of each plane.
+   */
+  size_t row_strides[3];
+  /** Whether Cb and Cr have half the width of Y, rounded up. */
+  JXL_BOOL chroma_half_width;
+  /** Whether Cb and Cr have half the height of Y, rounded up. */
+  JXL_BOOL chroma_half_height;
+} JxlYCbCrImage;
+
+/**
+ * Adds a frame of planar YCbCr pixels, such as 4:2:0 video frames, for lossy
+ * encoding without converting them to RGB or upsampling the chroma. The
+ * samples are full-range BT.601 YCbCr as in JFIF, with the chroma sample
+ * positions of JPEG, of an image in the color space set with @ref
+ * JxlEncoderSetColorEncoding, or sRGB if none is set.
+ *
+ * The frame is encoded like a JPEG of the pixels with quantization tables
+ * scaled by the distance of @p frame_settings. This is faster than @ref
+ * JxlEncoderAddImageFrame but compresses less well, and only the distance of
+ * the frame settings affects the quality.
+ *
+ * @ref JxlEncoderSetBasicInfo must be called first, with uses_original_profile
+ * set, three color channels and no extra channels. This can not be used for
+ * lossless frames, nor with @ref JxlEncoderStoreJPEGMetadata.
+ *
+ * @param frame_settings set of options and metadata for this frame. Also
+ * includes reference to the encoder object.
+ * @param image the pixels of the frame, which are read before this returns.
+ * @return ::JXL_ENC_SUCCESS on success, ::JXL_ENC_ERROR on error
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderAddYCbCrFrame(
+    const JxlEncoderFrameSettings* frame_settings, const JxlYCbCrImage* image);
+
 /**
  * Sets the buffer to read pixels from for the next image to encode. Must call
  * @ref JxlEncoderSetBasicInfo before @ref JxlEncoderAddImageFrame.
@@ -1039,7 +1285,10 @@ JXL_EXPORT JxlEncoderStatus JxlEncoderSetExtraChannelBuffer(
  *   registered with MP4RA (mp4ra.org).
  *
  * These boxes can be stored uncompressed or Brotli-compressed (using a "brob"
- * box), depending on the compress_box parameter.
+ * box), depending on the compress_box parameter. The "brob" boxes queued
+ * before a frame are compressed at once on the parallel runner, and the
+ * compressed form of a box with the same type and contents is reused after
+ * @ref JxlEncoderReset.
  *
  * @param enc encoder object.
  * @param type the box type, e.g. "Exif" for EXIF metadata, "xml " for XMP or
@@ -1593,6 +1842,126 @@ JXL_EXPORT void JxlEncoderSetDebugImageCallback(
 JXL_EXPORT void JxlEncoderCollectStats(JxlEncoderFrameSettings* frame_settings,
                                        JxlEncoderStats* stats);
 
+/**
+ * Opaque structure that holds a meta-adaptive (MA) context tree, which
+ * decides the predictor and the entropy coding context of each sample of a
+ * modular image. Reusing the tree of one image for images with similar
+ * statistics saves the time spent learning it.
+ *
+ * Allocated and initialized with @ref JxlEncoderMATreeCreate().
+ * Cleaned up and deallocated with @ref JxlEncoderMATreeDestroy().
+ */
+typedef struct JxlEncoderMATreeStruct JxlEncoderMATree;
+
+/**
+ * Creates an empty JxlEncoderMATree, to be filled by @ref
+ * JxlEncoderCollectMATree.
+ *
+ * @return pointer to initialized @ref JxlEncoderMATree instance
+ */
+JXL_EXPORT JxlEncoderMATree* JxlEncoderMATreeCreate(void);
+
+/**
+ * Deinitializes and frees JxlEncoderMATree instance.
+ *
+ * @param tree instance to be cleaned up and deallocated. No-op if tree is
+ * null pointer.
+ */
+JXL_EXPORT void JxlEncoderMATreeDestroy(JxlEncoderMATree* tree);
+
+/**
+ * Sets the given tree object to receive the MA tree of lossless frames added
+ * with these frame settings, once they are encoded. Such frames learn a single
+ * tree for the whole frame, even at the efforts that would otherwise learn a
+ * tree per group. Lossy frames and frames coded with the effort 1 fast path
+ * leave the tree unchanged. If several frames are collected, the tree is the
+ * one of the last frame encoded.
+ *
+ * The tree object must outlive the encoding of these frames.
+ *
+ * @param frame_settings set of options and metadata for this frame. Also
+ * includes reference to the encoder object.
+ * @param tree object to receive the tree (created by @ref
+ *   JxlEncoderMATreeCreate), or NULL to stop collecting.
+ * @return ::JXL_ENC_SUCCESS if the operation was successful, ::JXL_ENC_ERROR
+ *   otherwise.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderCollectMATree(
+    JxlEncoderFrameSettings* frame_settings, JxlEncoderMATree* tree);
+
+/**
+ * Codes the modular frames added with these frame settings with the given MA
+ * tree, instead of learning one. The tree is copied, so the tree object can be
+ * destroyed after this call. Any tree gives a valid codestream, but it only
+ * compresses well images whose statistics resemble those of the image it was
+ * collected from; trees are best collected from, and used for, lossless
+ * frames.
+ *
+ * @param frame_settings set of options and metadata for this frame. Also
+ * includes reference to the encoder object.
+ * @param tree tree collected with @ref JxlEncoderCollectMATree, or NULL to
+ *   learn the tree again.
+ * @return ::JXL_ENC_SUCCESS if the operation was successful, ::JXL_ENC_ERROR
+ *   if the tree was not collected from any frame.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderFrameSettingsSetMATree(
+    JxlEncoderFrameSettings* frame_settings, const JxlEncoderMATree* tree);
+
+/**
+ * Opaque structure that holds the analysis of a frame that does not depend on
+ * the distance or the resampling, i.e. its input pixels converted to XYB, to
+ * encode the same image at several distances without repeating it, e.g. for
+ * the ladder of sizes of responsive delivery.
+ *
+ * Allocated and initialized with @ref JxlEncoderAnalysisCreate().
+ * Cleaned up and deallocated with @ref JxlEncoderAnalysisDestroy().
+ */
+typedef struct JxlEncoderAnalysisStruct JxlEncoderAnalysis;
+
+/**
+ * Creates an empty JxlEncoderAnalysis, to be filled by the first frame
+ * encoded with it, see @ref JxlEncoderFrameSettingsSetAnalysis.
+ *
+ * @return pointer to initialized @ref JxlEncoderAnalysis instance
+ */
+JXL_EXPORT JxlEncoderAnalysis* JxlEncoderAnalysisCreate(void);
+
+/**
+ * Deinitializes and frees JxlEncoderAnalysis instance.
+ *
+ * @param analysis instance to be cleaned up and deallocated. No-op if analysis
+ * is null pointer.
+ */
+JXL_EXPORT void JxlEncoderAnalysisDestroy(JxlEncoderAnalysis* analysis);
+
+/**
+ * Shares the given analysis object between the encodings of the frame added
+ * with these frame settings: the first one fills it and the following ones
+ * reuse it, e.g. with other encoders or after @ref JxlEncoderReset, with
+ * other distances, resampling factors or efforts. This skips the conversion
+ * of the input pixels to XYB, which all these encodings would repeat.
+ *
+ * The frames must be the same image, with the same basic info and color
+ * encoding; only their width and height are checked. As the frame settings
+ * are copied when a frame is added, an animation sets another analysis
+ * object, or NULL, before adding its next frame. Only the frames encoded in
+ * XYB (see @ref JxlEncoderSetFrameLossless and @ref
+ * JXL_ENC_FRAME_SETTING_COLOR_TRANSFORM) without streaming encoding (see @ref
+ * JXL_ENC_FRAME_SETTING_BUFFERING) use the analysis object.
+ *
+ * The analysis object must outlive the encoding of these frames, and must not
+ * be used by two encoders at the same time.
+ *
+ * @param frame_settings set of options and metadata for this frame. Also
+ * includes reference to the encoder object.
+ * @param analysis object to fill or reuse (created by @ref
+ *   JxlEncoderAnalysisCreate), or NULL to stop sharing.
+ * @return ::JXL_ENC_SUCCESS if the operation was successful, ::JXL_ENC_ERROR
+ *   otherwise.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderFrameSettingsSetAnalysis(
+    JxlEncoderFrameSettings* frame_settings, JxlEncoderAnalysis* analysis);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,89 @@
+/* Copyright (c) the JPEG XL Project Authors. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/** @addtogroup libjxl_threads
+ * @{
+ * @file shared_parallel_runner.h
+ * @brief implementation using std::thread of a ::JxlParallelRunner that shares
+ * one thread pool between many encoders and decoders.
+ */
+
+/** Implementation of JxlParallelRunner for processes that run many encoders or
+ * decoders at the same time. The worker threads belong to a shared pool,
+ * created with @ref JxlSharedThreadPoolCreate (or the process-wide one returned
+ * by @ref JxlSharedThreadPoolGetDefault), whose size caps the number of worker
+ * threads in use. Every encoder or decoder gets its own runner, created with
+ * @ref JxlSharedParallelRunnerCreate, which is passed as the opaque runner.
+ *
+ * Workers are assigned to the pending calls with the highest priority first;
+ * calls with the same priority share the workers evenly. Workers move to
+ * newly submitted calls as soon as they finish their current task. The thread
+ * calling @ref JxlSharedParallelRunner always executes tasks of its own call,
+ * so every call makes progress even if all workers are busy, and calls may be
+ * nested.
+ */
+
+#ifndef JXL_SHARED_PARALLEL_RUNNER_H_
+#define JXL_SHARED_PARALLEL_RUNNER_H_
+
+#include <jxl/jxl_threads_export.h>
+#include <jxl/memory_manager.h>
+#include <jxl/parallel_runner.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Creates a thread pool with the given number of worker threads, to be shared
+ * by runners created with @ref JxlSharedParallelRunnerCreate.
+ */
+JXL_THREADS_EXPORT void* JxlSharedThreadPoolCreate(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads);
+
+/** Destroys the pool created by @ref JxlSharedThreadPoolCreate. All runners
+ * using it must have been destroyed before.
+ */
+JXL_THREADS_EXPORT void JxlSharedThreadPoolDestroy(void* pool);
+
+/** Returns a process-wide pool with one worker thread per hyperthread. It is
+ * created on first use and must not be destroyed.
+ */
+JXL_THREADS_EXPORT void* JxlSharedThreadPoolGetDefault(void);
+
+/** Parallel runner using the threads of a shared pool. Use as @ref
+ * JxlParallelRunner.
+ */
+JXL_THREADS_EXPORT JxlParallelRetCode JxlSharedParallelRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
+
+/** Creates a runner for @ref JxlSharedParallelRunner that uses the threads of
+ * @p pool. Use as the opaque runner. Calls with a higher @p priority are
+ * served first.
+ */
+JXL_THREADS_EXPORT void* JxlSharedParallelRunnerCreate(void* pool,
+                                                       int32_t priority);
+
+/** Changes the priority of the runner, for the calls started afterwards.
+ */
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerSetPriority(void* runner_opaque,
+                                                           int32_t priority);
+
+/** Destroys the runner created by @ref JxlSharedParallelRunnerCreate. No call
+ * to @ref JxlSharedParallelRunner may be in progress with this runner.
+ */
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerDestroy(void* runner_opaque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JXL_SHARED_PARALLEL_RUNNER_H_ */
+
+/** @}*/
@@ -0,0 +1,88 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+/// @addtogroup libjxl_cpp
+/// @{
+///
+/// @file shared_parallel_runner_cxx.h
+/// @ingroup libjxl_threads
+/// @brief C++ header-only helper for @ref shared_parallel_runner.h.
+///
+/// There's no binary library associated with the header since this is a header
+/// only library.
+
+#ifndef JXL_SHARED_PARALLEL_RUNNER_CXX_H_
+#define JXL_SHARED_PARALLEL_RUNNER_CXX_H_
+
+#include <jxl/memory_manager.h>
+#include <jxl/shared_parallel_runner.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#ifndef __cplusplus
+#error "This a C++ only header. Use jxl/shared_parallel_runner.h from C" \
+    "sources."
+#endif
+
+/// Struct to call JxlSharedThreadPoolDestroy from the JxlSharedThreadPoolPtr
+/// unique_ptr.
+struct JxlSharedThreadPoolDestroyStruct {
+  /// Calls @ref JxlSharedThreadPoolDestroy() on the passed pool.
+  void operator()(void* pool) { JxlSharedThreadPoolDestroy(pool); }
+};
+
+/// std::unique_ptr<> type that calls JxlSharedThreadPoolDestroy() when
+/// releasing the pool.
+typedef std::unique_ptr<void, JxlSharedThreadPoolDestroyStruct>
+    JxlSharedThreadPoolPtr;
+
+/// Creates a thread pool into a JxlSharedThreadPoolPtr. See @ref
+/// JxlSharedThreadPoolCreate for details on the instance creation.
+///
+/// @param memory_manager custom allocator function. It may be NULL. The memory
+///        manager will be copied internally.
+/// @param num_worker_threads the number of worker threads to create.
+/// @return a @c NULL JxlSharedThreadPoolPtr if the instance can not be
+/// allocated or initialized
+/// @return initialized JxlSharedThreadPoolPtr instance otherwise.
+static inline JxlSharedThreadPoolPtr JxlSharedThreadPoolMake(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads) {
+  return JxlSharedThreadPoolPtr(
+      JxlSharedThreadPoolCreate(memory_manager, num_worker_threads));
+}
+
+/// Struct to call JxlSharedParallelRunnerDestroy from the
+/// JxlSharedParallelRunnerPtr unique_ptr.
+struct JxlSharedParallelRunnerDestroyStruct {
+  /// Calls @ref JxlSharedParallelRunnerDestroy() on the passed runner.
+  void operator()(void* runner) { JxlSharedParallelRunnerDestroy(runner); }
+};
+
+/// std::unique_ptr<> type that calls JxlSharedParallelRunnerDestroy() when
+/// releasing the runner.
+typedef std::unique_ptr<void, JxlSharedParallelRunnerDestroyStruct>
+    JxlSharedParallelRunnerPtr;
+
+/// Creates a runner using the threads of @p pool into a
+/// JxlSharedParallelRunnerPtr. See @ref JxlSharedParallelRunnerCreate for
+/// details on the instance creation.
+///
+/// @param pool the pool, created by @ref JxlSharedThreadPoolCreate or returned
+///        by @ref JxlSharedThreadPoolGetDefault.
+/// @param priority the priority of the calls of this runner.
+/// @return a @c NULL JxlSharedParallelRunnerPtr if the instance can not be
+/// allocated or initialized
+/// @return initialized JxlSharedParallelRunnerPtr instance otherwise.
+static inline JxlSharedParallelRunnerPtr JxlSharedParallelRunnerMake(
+    void* pool, int32_t priority) {
+  return JxlSharedParallelRunnerPtr(
+      JxlSharedParallelRunnerCreate(pool, priority));
+}
+
+#endif  // JXL_SHARED_PARALLEL_RUNNER_CXX_H_
+
+/// @}
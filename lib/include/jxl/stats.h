@@ -7,7 +7,7 @@
 /** @addtogroup libjxl_encoder
  * @{
  * @file stats.h
- * @brief API to collect various statistics from JXL encoder.
+ * @brief API to collect various statistics from JXL encoder and decoder.
  */
 
 #ifndef JXL_STATS_H_
@@ -15,6 +15,7 @@
 
 #include <jxl/jxl_export.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -94,6 +95,111 @@ JXL_EXPORT size_t JxlEncoderStatsGet(const JxlEncoderStats* stats,
 JXL_EXPORT void JxlEncoderStatsMerge(JxlEncoderStats* stats,
                                      const JxlEncoderStats* other);
 
+/**
+ * Opaque structure that holds the decoder statistics.
+ *
+ * Allocated and initialized with @ref JxlDecoderStatsCreate().
+ * Cleaned up and deallocated with @ref JxlDecoderStatsDestroy().
+ */
+typedef struct JxlDecoderStatsStruct JxlDecoderStats;
+
+/**
+ * Creates an instance of JxlDecoderStats with all values at zero.
+ *
+ * @return pointer to initialized @ref JxlDecoderStats instance
+ */
+JXL_EXPORT JxlDecoderStats* JxlDecoderStatsCreate(void);
+
+/**
+ * Deinitializes and frees JxlDecoderStats instance.
+ *
+ * @param stats instance to be cleaned up and deallocated. No-op if stats is
+ * null pointer.
+ */
+JXL_EXPORT void JxlDecoderStatsDestroy(JxlDecoderStats* stats);
+
+/** Data type for querying @ref JxlDecoderStats object.
+ *
+ * The times are in microseconds. Except for the wall time, they are summed
+ * over the threads of the decoder, so that the thread utilization is the sum
+ * of the DC, AC, render and CMS times divided by the wall time.
+ */
+typedef enum {
+  /** Bytes of the codestream headers before the first frame, including the
+   * ICC profile.
+   */
+  JXL_DEC_STATS_HEADER_BYTES,
+  /** Bytes of the frame headers and TOCs.
+   */
+  JXL_DEC_STATS_FRAME_HEADER_BYTES,
+  /** Bytes of the DC global sections, or of the whole frame for frames that
+   * consist of a single section.
+   */
+  JXL_DEC_STATS_DC_GLOBAL_BYTES,
+  /** Bytes of the DC group sections.
+   */
+  JXL_DEC_STATS_DC_GROUP_BYTES,
+  /** Bytes of the AC global sections.
+   */
+  JXL_DEC_STATS_AC_GLOBAL_BYTES,
+  /** Bytes of the AC group sections, for all the passes.
+   */
+  JXL_DEC_STATS_AC_GROUP_BYTES,
+  /** Number of decoded frames, including the frames that are not displayed.
+   */
+  JXL_DEC_STATS_NUM_FRAMES,
+  /** Time spent parsing the codestream, frame and ICC headers.
+   */
+  JXL_DEC_STATS_HEADERS_TIME_US,
+  /** Time spent decoding the DC global and DC group sections.
+   */
+  JXL_DEC_STATS_DC_TIME_US,
+  /** Time spent decoding the AC global and AC group sections and finalizing
+   * the frames.
+   */
+  JXL_DEC_STATS_AC_TIME_US,
+  /** Time spent in the stages of the render pipeline, except for the color
+   * management stage.
+   */
+  JXL_DEC_STATS_RENDER_TIME_US,
+  /** Time spent in the color management stage of the render pipeline.
+   */
+  JXL_DEC_STATS_CMS_TIME_US,
+  /** Wall time spent decoding the sections of the frames.
+   */
+  JXL_DEC_STATS_FRAME_WALL_TIME_US,
+  /** Peak amount of memory allocated at once through the memory manager of the
+   * decoder. Not added up by @ref JxlDecoderStatsMerge, which keeps the
+   * largest value.
+   */
+  JXL_DEC_STATS_PEAK_MEMORY_BYTES,
+  JXL_DEC_STATS_NUM_KEYS,
+} JxlDecoderStatsKey;
+
+/** Returns the value of the statistics corresponding the given key.
+ *
+ * The values are updated while decoding, so that the difference between the
+ * values at two events, e.g. two consecutive ::JXL_DEC_FULL_IMAGE events, is
+ * that of the frame decoded in between.
+ *
+ * @param stats object that was passed to the decoder with
+ *   @ref JxlDecoderCollectStats
+ * @param key the particular statistics to query
+ *
+ * @return the value of the statistics
+ */
+JXL_EXPORT uint64_t JxlDecoderStatsGet(const JxlDecoderStats* stats,
+                                       JxlDecoderStatsKey key);
+
+/** Updates the values of the given stats object with that of an other, e.g.
+ * to aggregate the statistics of several decoders.
+ *
+ * @param stats object whose values will be updated (usually added together)
+ * @param other stats object whose values will be merged with stats
+ */
+JXL_EXPORT void JxlDecoderStatsMerge(JxlDecoderStats* stats,
+                                     const JxlDecoderStats* other);
+
 #ifdef __cplusplus
 }
 #endif
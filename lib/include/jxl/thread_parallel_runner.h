@@ -33,6 +33,7 @@
 #include <jxl/jxl_threads_export.h>
 #include <jxl/memory_manager.h>
 #include <jxl/parallel_runner.h>
+#include <jxl/types.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -57,6 +58,38 @@ JXL_THREADS_EXPORT void* JxlThreadParallelRunnerCreate(
  */
 JXL_THREADS_EXPORT void JxlThreadParallelRunnerDestroy(void* runner_opaque);
 
+/** Pins the worker threads of a runner created by @ref
+ * JxlThreadParallelRunnerCreate: worker i only runs on the CPU
+ * cpus[i % num_cpus]. Listing the CPUs of several NUMA nodes interleaved
+ * spreads the workers over the nodes.
+ *
+ * With the default memory manager, the pages of large buffers are usually
+ * placed on the NUMA node of the thread that first writes them, so pinned
+ * workers also keep the group buffers they produce node-local.
+ *
+ * Must not be called while the runner is running tasks.
+ *
+ * @param runner_opaque runner created by @ref JxlThreadParallelRunnerCreate.
+ * @param cpus array of CPU indices, as numbered by the operating system.
+ * @param num_cpus number of entries of cpus, must be at least 1.
+ * @return JXL_TRUE on success, JXL_FALSE if pinning is not supported on this
+ *     platform (it is only implemented on Linux) or the OS rejected a CPU.
+ */
+JXL_THREADS_EXPORT JXL_BOOL JxlThreadParallelRunnerSetAffinity(
+    void* runner_opaque, const uint32_t* cpus, size_t num_cpus);
+
+/** Same as @ref JxlThreadParallelRunnerSetAffinity, but worker i may run on
+ * all the CPUs of the NUMA node nodes[i % num_nodes].
+ *
+ * @param runner_opaque runner created by @ref JxlThreadParallelRunnerCreate.
+ * @param nodes array of NUMA node indices, as numbered by the OS.
+ * @param num_nodes number of entries of nodes, must be at least 1.
+ * @return JXL_TRUE on success, JXL_FALSE if not supported on this platform
+ *     or a node does not exist.
+ */
+JXL_THREADS_EXPORT JXL_BOOL JxlThreadParallelRunnerSetNodeAffinity(
+    void* runner_opaque, const uint32_t* nodes, size_t num_nodes);
+
 /** Returns a default num_worker_threads value for
  * @ref JxlThreadParallelRunnerCreate.
  */
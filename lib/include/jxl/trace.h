@@ -0,0 +1,72 @@
+/* Copyright (c) the JPEG XL Project Authors. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/** @addtogroup libjxl_common
+ * @{
+ * @file trace.h
+ * @brief Opt-in recording of the time spent in the stages of the encoder and
+ * the decoder, for profiling.
+ */
+
+#ifndef JXL_TRACE_H_
+#define JXL_TRACE_H_
+
+#include <jxl/jxl_export.h>
+#include <jxl/types.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Starts recording the durations of the stages of all the encoders and
+ * decoders of the process, discarding what was recorded before. The
+ * stages include the encoder heuristics, the tokenization, the decoding of
+ * each group and each stage of the render pipeline.
+ *
+ * Tracing is only available if the library was built with
+ * JPEGXL_ENABLE_TRACING; it otherwise has no cost.
+ *
+ * @return ::JXL_TRUE if recording started, ::JXL_FALSE if the library was
+ * built without tracing.
+ */
+JXL_EXPORT JXL_BOOL JxlTraceStart(void);
+
+/**
+ * Stops recording; what was recorded stays available to
+ * @ref JxlTraceWriteJSON.
+ */
+JXL_EXPORT void JxlTraceStop(void);
+
+/**
+ * Function receiving consecutive pieces of the output of
+ * @ref JxlTraceWriteJSON.
+ *
+ * @param opaque user data passed to @ref JxlTraceWriteJSON.
+ * @param data next piece of the output, not null-terminated.
+ * @param size size of @p data in bytes.
+ */
+typedef void (*JxlTraceWriteFunc)(void* opaque, const char* data, size_t size);
+
+/**
+ * Writes what was recorded between @ref JxlTraceStart and
+ * @ref JxlTraceStop in the Chrome trace event JSON format, which can be
+ * loaded in Perfetto or chrome://tracing. Must not be called while
+ * recording.
+ *
+ * @param write function called with each piece of the output.
+ * @param opaque user data passed to @p write.
+ */
+JXL_EXPORT void JxlTraceWriteJSON(JxlTraceWriteFunc write, void* opaque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JXL_TRACE_H_ */
+
+/** @}*/
@@ -55,6 +55,14 @@ typedef enum {
 
   /** Use 16-bit IEEE 754 half-precision floating point values */
   JXL_TYPE_FLOAT16 = 5,
+
+  /** Use one 32-bit word per pixel with 10 bits for each color channel and 2
+   * bits for alpha: red in the least significant bits, then green, blue and
+   * alpha. This is the layout of DXGI_FORMAT_R10G10B10A2_UNORM and of OpenGL's
+   * GL_RGBA with GL_UNSIGNED_INT_2_10_10_10_REV. Only supported for the image
+   * output of the decoder, with 4 channels; the alpha bits are set if the image
+   * has no alpha channel. The endianness applies to the 32-bit word. */
+  JXL_TYPE_RGB10A2 = 6,
 } JxlDataType;
 
 /** Ordering of multi-byte data.
@@ -93,7 +101,8 @@ typedef struct {
   JxlDataType data_type;
 
   /** Whether multi-byte data types are represented in big endian or little
-   * endian format. This applies to ::JXL_TYPE_UINT16 and ::JXL_TYPE_FLOAT.
+   * endian format. This applies to ::JXL_TYPE_UINT16, ::JXL_TYPE_FLOAT16,
+   * ::JXL_TYPE_FLOAT and ::JXL_TYPE_RGB10A2.
    */
   JxlEndianness endianness;
 
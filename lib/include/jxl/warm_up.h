@@ -0,0 +1,45 @@
+/* Copyright (c) the JPEG XL Project Authors. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/** @addtogroup libjxl_common
+ * @{
+ * @file warm_up.h
+ * @brief Optional one-time initialization of the library, to reduce the
+ * latency of the first encoder or decoder of the process.
+ */
+
+#ifndef JXL_WARM_UP_H_
+#define JXL_WARM_UP_H_
+
+#include <jxl/jxl_export.h>
+#include <jxl/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Does ahead of time the process-wide initialization that the first encoder
+ * or decoder otherwise does on demand: detecting the CPU features used to
+ * choose the SIMD implementations, computing the default quantization tables
+ * of all the transforms, and creating the predefined color encodings and
+ * their ICC profiles.
+ *
+ * Calling it is never required, e.g. when starting an instance that will
+ * serve requests with a latency budget. It is thread-safe, and cheap after
+ * the first call. The computed tables stay in memory until the process exits.
+ *
+ * @return ::JXL_TRUE on success, ::JXL_FALSE if an allocation failed.
+ */
+JXL_EXPORT JXL_BOOL JxlWarmUp(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JXL_WARM_UP_H_ */
+
+/** @}*/
@@ -0,0 +1,76 @@
+/* Copyright (c) the JPEG XL Project Authors. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/** @addtogroup libjxl_threads
+ * @{
+ * @file work_stealing_parallel_runner.h
+ * @brief implementation using std::thread of a work-stealing
+ * ::JxlParallelRunner.
+ */
+
+/** Implementation of JxlParallelRunner than can be used to enable
+ * multithreading when using the JPEG XL library. This uses std::thread
+ * internally and related synchronization functions. The number of threads
+ * created is fixed at construction time.
+ *
+ * Every thread owns a deque of task ranges. Ranges are split lazily in halves,
+ * and idle threads steal the largest pending ranges from other threads, which
+ * keeps all threads busy when the cost of tasks is uneven.
+ *
+ * Unlike @ref JxlThreadParallelRunner, this runner supports nested and
+ * concurrent @ref JxlWorkStealingParallelRunner calls: a task may itself call
+ * the runner, and several threads may use the same instance at the same time.
+ * A thread waiting for its call to complete only executes tasks of that call,
+ * so the `thread_id` passed to the tasks of a call is never used by two tasks
+ * of that call at the same time.
+ */
+
+#ifndef JXL_WORK_STEALING_PARALLEL_RUNNER_H_
+#define JXL_WORK_STEALING_PARALLEL_RUNNER_H_
+
+#include <jxl/jxl_threads_export.h>
+#include <jxl/memory_manager.h>
+#include <jxl/parallel_runner.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Parallel runner internally using std::thread. Use as @ref JxlParallelRunner.
+ */
+JXL_THREADS_EXPORT JxlParallelRetCode JxlWorkStealingParallelRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
+
+/** Creates the runner for @ref JxlWorkStealingParallelRunner. Use as the
+ * opaque runner. If num_worker_threads is zero, all tasks run on the calling
+ * thread.
+ */
+JXL_THREADS_EXPORT void* JxlWorkStealingParallelRunnerCreate(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads);
+
+/** Destroys the runner created by @ref JxlWorkStealingParallelRunnerCreate.
+ * No call to @ref JxlWorkStealingParallelRunner may be in progress.
+ */
+JXL_THREADS_EXPORT void JxlWorkStealingParallelRunnerDestroy(
+    void* runner_opaque);
+
+/** Returns a default num_worker_threads value for
+ * @ref JxlWorkStealingParallelRunnerCreate.
+ */
+JXL_THREADS_EXPORT size_t
+JxlWorkStealingParallelRunnerDefaultNumWorkerThreads(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JXL_WORK_STEALING_PARALLEL_RUNNER_H_ */
+
+/** @}*/
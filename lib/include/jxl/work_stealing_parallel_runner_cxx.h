@@ -0,0 +1,70 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+/// @addtogroup libjxl_cpp
+/// @{
+///
+/// @file work_stealing_parallel_runner_cxx.h
+/// @ingroup libjxl_threads
+/// @brief C++ header-only helper for @ref work_stealing_parallel_runner.h.
+///
+/// There's no binary library associated with the header since this is a header
+/// only library.
+
+#ifndef JXL_WORK_STEALING_PARALLEL_RUNNER_CXX_H_
+#define JXL_WORK_STEALING_PARALLEL_RUNNER_CXX_H_
+
+#include <jxl/memory_manager.h>
+#include <jxl/work_stealing_parallel_runner.h>
+
+#include <cstddef>
+#include <memory>
+
+#ifndef __cplusplus
+#error \
+    "This a C++ only header. Use jxl/work_stealing_parallel_runner.h from C" \
+    "sources."
+#endif
+
+/// Struct to call JxlWorkStealingParallelRunnerDestroy from the
+/// JxlWorkStealingParallelRunnerPtr unique_ptr.
+struct JxlWorkStealingParallelRunnerDestroyStruct {
+  /// Calls @ref JxlWorkStealingParallelRunnerDestroy() on the passed runner.
+  void operator()(void* runner) {
+    JxlWorkStealingParallelRunnerDestroy(runner);
+  }
+};
+
+/// std::unique_ptr<> type that calls JxlWorkStealingParallelRunnerDestroy()
+/// when releasing the runner.
+///
+/// Use this helper type from C++ sources to ensure the runner is destroyed and
+/// their internal resources released.
+typedef std::unique_ptr<void, JxlWorkStealingParallelRunnerDestroyStruct>
+    JxlWorkStealingParallelRunnerPtr;
+
+/// Creates an instance of JxlWorkStealingParallelRunner into a
+/// JxlWorkStealingParallelRunnerPtr and initializes it.
+///
+/// This function returns a unique_ptr that will call
+/// JxlWorkStealingParallelRunnerDestroy() when releasing the pointer. See @ref
+/// JxlWorkStealingParallelRunnerCreate for details on the instance creation.
+///
+/// @param memory_manager custom allocator function. It may be NULL. The memory
+///        manager will be copied internally.
+/// @param num_worker_threads the number of worker threads to create.
+/// @return a @c NULL JxlWorkStealingParallelRunnerPtr if the instance can not
+/// be allocated or initialized
+/// @return initialized JxlWorkStealingParallelRunnerPtr instance otherwise.
+static inline JxlWorkStealingParallelRunnerPtr
+JxlWorkStealingParallelRunnerMake(const JxlMemoryManager* memory_manager,
+                                  size_t num_worker_threads) {
+  return JxlWorkStealingParallelRunnerPtr(
+      JxlWorkStealingParallelRunnerCreate(memory_manager, num_worker_threads));
+}
+
+#endif  // JXL_WORK_STEALING_PARALLEL_RUNNER_CXX_H_
+
+/// @}
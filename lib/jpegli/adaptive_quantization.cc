@@ -257,36 +257,12 @@ V SimpleGamma(const D d, V v) {
 }
 */
 
+// Change precision in 8x8 blocks that have high frequency content, and
+// correct for the gamma of the block. Both modulations are computed in a single
+// pass over the pixels of the block.
 template <class D, class V>
-V GammaModulation(const D d, const size_t x, const size_t y,
-                  const RowBuffer<float>& input, const V out_val) {
-  static const float kBias = 0.16f / kInputScaling;
-  static const float kScale = kInputScaling / 64.0f;
-  auto overall_ratio = Zero(d);
-  const auto bias = Set(d, kBias);
-  const auto scale = Set(d, kScale);
-  const float* const JXL_RESTRICT block_start = input.Row(y) + x;
-  for (size_t dy = 0; dy < 8; ++dy) {
-    const float* const JXL_RESTRICT row_in = block_start + dy * input.stride();
-    for (size_t dx = 0; dx < 8; dx += Lanes(d)) {
-      const auto iny = Add(Load(d, row_in + dx), bias);
-      const auto ratio_g =
-          RatioOfDerivativesOfCubicRootToSimpleGamma</*invert=*/true>(d, iny);
-      overall_ratio = Add(overall_ratio, ratio_g);
-    }
-  }
-  overall_ratio = Mul(SumOfLanes(d, overall_ratio), scale);
-  // ideally -1.0, but likely optimal correction adds some entropy, so slightly
-  // less than that.
-  // ln(2) constant folded in because we want std::log but have FastLog2f.
-  const auto kGam = Set(d, -0.15526878023684174f * 0.693147180559945f);
-  return MulAdd(kGam, FastLog2f(d, overall_ratio), out_val);
-}
-
-// Change precision in 8x8 blocks that have high frequency content.
-template <class D, class V>
-V HfModulation(const D d, const size_t x, const size_t y,
-               const RowBuffer<float>& input, const V out_val) {
+V HfAndGammaModulation(const D d, const size_t x, const size_t y,
+                       const RowBuffer<float>& input, const V out_val) {
   // Zero out the invalid differences for the rightmost value per row.
   const Rebind<uint32_t, D> du;
   HWY_ALIGN constexpr uint32_t kMaskRight[8] = {~0u, ~0u, ~0u, ~0u,
@@ -296,6 +272,12 @@ V HfModulation(const D d, const size_t x, const size_t y,
   static const float kSumCoeff = -2.0052193233688884f * kInputScaling / 112.0;
   auto sumcoeff = Set(d, kSumCoeff);
 
+  static const float kBias = 0.16f / kInputScaling;
+  static const float kScale = kInputScaling / 64.0f;
+  auto overall_ratio = Zero(d);
+  const auto bias = Set(d, kBias);
+  const auto scale = Set(d, kScale);
+
   const float* const JXL_RESTRICT block_start = input.Row(y) + x;
   for (size_t dy = 0; dy < 8; ++dy) {
     const float* JXL_RESTRICT row_in = block_start + dy * input.stride();
@@ -309,13 +291,25 @@ V HfModulation(const D d, const size_t x, const size_t y,
       sum = Add(sum, And(mask, AbsDiff(p, pr)));
       const auto pd = Load(d, row_in_next + dx);
       sum = Add(sum, AbsDiff(p, pd));
+      const auto iny = Add(p, bias);
+      const auto ratio_g =
+          RatioOfDerivativesOfCubicRootToSimpleGamma</*invert=*/true>(d, iny);
+      overall_ratio = Add(overall_ratio, ratio_g);
     }
   }
 
   sum = SumOfLanes(d, sum);
-  return MulAdd(sum, sumcoeff, out_val);
+  const auto hf_val = MulAdd(sum, sumcoeff, out_val);
+  overall_ratio = Mul(SumOfLanes(d, overall_ratio), scale);
+  // ideally -1.0, but likely optimal correction adds some entropy, so slightly
+  // less than that.
+  // ln(2) constant folded in because we want std::log but have FastLog2f.
+  const auto kGam = Set(d, -0.15526878023684174f * 0.693147180559945f);
+  return MulAdd(kGam, FastLog2f(d, overall_ratio), hf_val);
 }
 
+// Stores the per-block quantization field, in the form used by the
+// quantization, to the rows [yb0, yb0 + yblen) of aq_map.
 void PerBlockModulations(const float y_quant_01, const RowBuffer<float>& input,
                          const size_t yb0, const size_t yblen,
                          RowBuffer<float>* aq_map) {
@@ -342,11 +336,11 @@ void PerBlockModulations(const float y_quant_01, const RowBuffer<float>& input,
       size_t x = ix * 8;
       auto out_val = Set(df, row_out[ix]);
       out_val = ComputeMask(df, out_val);
-      out_val = HfModulation(df, x, y, input, out_val);
-      out_val = GammaModulation(df, x, y, input, out_val);
+      out_val = HfAndGammaModulation(df, x, y, input, out_val);
       // We want multiplicative quantization field, so everything
       // until this point has been modulating the exponent.
-      row_out[ix] = FastPow2f(GetLane(out_val) * 1.442695041f) * mul + add;
+      const float qf = FastPow2f(GetLane(out_val) * 1.442695041f) * mul + add;
+      row_out[ix] = std::max(0.0f, (0.6f / qf) - 1.0f);
     }
   }
 }
@@ -551,12 +545,6 @@ void ComputeAdaptiveQuantField(j_compress_ptr cinfo) {
   (m->pre_erosion, yb0, yblen, &m->fuzzy_erosion_tmp, &m->quant_field);
   HWY_DYNAMIC_DISPATCH(PerBlockModulations)
   (y_quant_01, input, yb0, yblen, &m->quant_field);
-  for (int y = 0; y < cinfo->max_v_samp_factor; ++y) {
-    float* row = m->quant_field.Row(yb0 + y);
-    for (size_t x = 0; x < xsize_blocks; ++x) {
-      row[x] = std::max(0.0f, (0.6f / row[x]) - 1.0f);
-    }
-  }
 }
 
 }  // namespace jpegli
@@ -37,6 +37,8 @@ void WriteBlock(const int32_t* JXL_RESTRICT symbols,
                 const HuffmanCodeTable* JXL_RESTRICT ac_code,
                 JpegBitWriter* JXL_RESTRICT bw);
 void WriteScanData(j_compress_ptr cinfo, int scan_index);
+// Writes the tokens of the first scan computed so far without ending the scan.
+void WriteStreamingTokens(j_compress_ptr cinfo);
 
 }  // namespace jpegli
 
@@ -6,8 +6,11 @@
 #include "lib/jpegli/color_quantize.h"
 
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <limits>
 #include <unordered_map>
+#include <vector>
 
 #include "lib/jpegli/decode_internal.h"
 #include "lib/jpegli/error.h"
@@ -16,9 +19,6 @@ namespace jpegli {
 
 namespace {
 
-constexpr int kNumColorCellBits[kMaxComponents] = {3, 4, 3, 3};
-constexpr int kCompW[kMaxComponents] = {2, 3, 1, 1};
-
 int Pow(int a, int b) {
   int r = 1;
   for (int i = 0; i < b; ++i) {
@@ -444,11 +444,21 @@ void CreateInverseColorMap(j_decompress_ptr cinfo) {
     num_cells *= (1 << kNumColorCellBits[c]);
   }
   m->candidate_lists_.resize(num_cells);
+  m->candidate_colors_.resize(num_cells);
 
   int next_cell[kMaxComponents] = {0};
   for (int i = 0; i < num_cells; ++i) {
     m->candidate_lists_[i].clear();
     FindCandidatesForCell(cinfo, ncomp, next_cell, &m->candidate_lists_[i]);
+    const std::vector<uint8_t>& candidates = m->candidate_lists_[i];
+    const size_t stride = RoundUpTo(candidates.size(), 8);
+    std::vector<int32_t>& colors = m->candidate_colors_[i];
+    colors.assign(ncomp * stride, kCandidateColorPadding);
+    for (int c = 0; c < ncomp; ++c) {
+      for (size_t k = 0; k < candidates.size(); ++k) {
+        colors[c * stride + k] = cinfo->colormap[c][candidates[k]] * kCompW[c];
+      }
+    }
     int c = ncomp - 1;
     while (c > 0 && next_cell[c] + 1 == (1 << kNumColorCellBits[c])) {
       next_cell[c--] = 0;
@@ -458,6 +468,16 @@ void CreateInverseColorMap(j_decompress_ptr cinfo) {
   m->regenerate_inverse_colormap_ = false;
 }
 
+size_t ColorCellIndex(j_decompress_ptr cinfo, const JSAMPLE* pixel) {
+  size_t cell_idx = 0;
+  size_t stride = 1;
+  for (int c = cinfo->out_color_components - 1; c >= 0; --c) {
+    cell_idx += (pixel[c] >> (8 - kNumColorCellBits[c])) * stride;
+    stride <<= kNumColorCellBits[c];
+  }
+  return cell_idx;
+}
+
 int LookupColorIndex(j_decompress_ptr cinfo, const JSAMPLE* pixel) {
   jpeg_decomp_master* m = cinfo->master;
   int num_channels = cinfo->out_color_components;
@@ -467,12 +487,7 @@ int LookupColorIndex(j_decompress_ptr cinfo, const JSAMPLE* pixel) {
       index += m->colormap_lut_[c * 256 + pixel[c]];
     }
   } else {
-    size_t cell_idx = 0;
-    size_t stride = 1;
-    for (int c = num_channels - 1; c >= 0; --c) {
-      cell_idx += (pixel[c] >> (8 - kNumColorCellBits[c])) * stride;
-      stride <<= kNumColorCellBits[c];
-    }
+    size_t cell_idx = ColorCellIndex(cinfo, pixel);
     JPEGLI_CHECK(cell_idx < m->candidate_lists_.size());
     int mindist = std::numeric_limits<int>::max();
     const auto& candidates = m->candidate_lists_[cell_idx];
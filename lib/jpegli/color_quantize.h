@@ -6,10 +6,22 @@
 #ifndef LIB_JPEGLI_COLOR_QUANTIZE_H_
 #define LIB_JPEGLI_COLOR_QUANTIZE_H_
 
+#include <cstddef>
+
 #include "lib/jpegli/common.h"
+#include "lib/jpegli/common_internal.h"
 
 namespace jpegli {
 
+// Number of bits of each component used to index the cells of the inverse
+// colormap.
+constexpr int kNumColorCellBits[kMaxComponents] = {3, 4, 3, 3};
+// Weights of the components in the color distance.
+constexpr int kCompW[kMaxComponents] = {2, 3, 1, 1};
+
+// Entries of the weighted candidate colors beyond the last candidate of a cell.
+constexpr int32_t kCandidateColorPadding = 1 << 12;
+
 void ChooseColorMap1Pass(j_decompress_ptr cinfo);
 
 void ChooseColorMap2Pass(j_decompress_ptr cinfo);
@@ -20,6 +32,9 @@ void CreateOrderedDitherTables(j_decompress_ptr cinfo);
 
 void InitFSDitherState(j_decompress_ptr cinfo);
 
+// Index of the inverse colormap cell that contains the pixel.
+size_t ColorCellIndex(j_decompress_ptr cinfo, const JSAMPLE* pixel);
+
 int LookupColorIndex(j_decompress_ptr cinfo, const JSAMPLE* pixel);
 
 }  // namespace jpegli
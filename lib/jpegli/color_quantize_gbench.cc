@@ -0,0 +1,108 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jpegli/common.h"
+#include "lib/jpegli/decode.h"
+#include "lib/jpegli/encode.h"
+#include "lib/jxl/base/random.h"
+
+namespace jpegli {
+namespace {
+
+struct QuantizeParams {
+  bool two_pass;
+  J_DITHER_MODE dither_mode;
+};
+
+std::vector<uint8_t> EncodeTestImage(size_t xsize, size_t ysize) {
+  std::vector<uint8_t> pixels(xsize * ysize * 3);
+  jxl::Rng rng(0);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      uint8_t* pixel = &pixels[(y * xsize + x) * 3];
+      pixel[0] = (x + rng.UniformU(0, 16)) & 0xFF;
+      pixel[1] = (y + rng.UniformU(0, 16)) & 0xFF;
+      pixel[2] = ((x + y) / 2 + rng.UniformU(0, 16)) & 0xFF;
+    }
+  }
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpegli_std_error(&jerr);
+  jpegli_create_compress(&cinfo);
+  unsigned char* buffer = nullptr;
+  unsigned long buffer_size = 0;  // NOLINT
+  jpegli_mem_dest(&cinfo, &buffer, &buffer_size);
+  cinfo.image_width = xsize;
+  cinfo.image_height = ysize;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpegli_set_defaults(&cinfo);
+  jpegli_start_compress(&cinfo, TRUE);
+  for (size_t y = 0; y < ysize; ++y) {
+    JSAMPROW row = &pixels[y * xsize * 3];
+    jpegli_write_scanlines(&cinfo, &row, 1);
+  }
+  jpegli_finish_compress(&cinfo);
+  jpegli_destroy_compress(&cinfo);
+  std::vector<uint8_t> compressed(buffer, buffer + buffer_size);
+  free(buffer);
+  return compressed;
+}
+
+void BM_ColorQuantize(benchmark::State& state, QuantizeParams params) {
+  const size_t xsize = state.range();
+  const size_t ysize = state.range();
+  const std::vector<uint8_t> compressed = EncodeTestImage(xsize, ysize);
+  std::vector<uint8_t> output(xsize);
+
+  for (auto _ : state) {
+    (void)_;
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpegli_std_error(&jerr);
+    jpegli_create_decompress(&cinfo);
+    jpegli_mem_src(&cinfo, compressed.data(), compressed.size());
+    jpegli_read_header(&cinfo, TRUE);
+    cinfo.quantize_colors = TRUE;
+    cinfo.two_pass_quantize = params.two_pass ? TRUE : FALSE;
+    cinfo.dither_mode = params.dither_mode;
+    cinfo.desired_number_of_colors = 256;
+    jpegli_start_decompress(&cinfo);
+    while (cinfo.output_scanline < cinfo.output_height) {
+      JSAMPROW row = output.data();
+      jpegli_read_scanlines(&cinfo, &row, 1);
+    }
+    jpegli_finish_decompress(&cinfo);
+    jpegli_destroy_decompress(&cinfo);
+  }
+
+  // Pixels per second.
+  state.SetItemsProcessed(state.iterations() * xsize * ysize);
+}
+
+BENCHMARK_CAPTURE(BM_ColorQuantize, OnePassNone, {false, JDITHER_NONE})
+    ->RangeMultiplier(2)
+    ->Range(256, 1024);
+BENCHMARK_CAPTURE(BM_ColorQuantize, OnePassOrdered, {false, JDITHER_ORDERED})
+    ->RangeMultiplier(2)
+    ->Range(256, 1024);
+BENCHMARK_CAPTURE(BM_ColorQuantize, OnePassFS, {false, JDITHER_FS})
+    ->RangeMultiplier(2)
+    ->Range(256, 1024);
+BENCHMARK_CAPTURE(BM_ColorQuantize, TwoPassNone, {true, JDITHER_NONE})
+    ->RangeMultiplier(2)
+    ->Range(256, 1024);
+BENCHMARK_CAPTURE(BM_ColorQuantize, TwoPassFS, {true, JDITHER_FS})
+    ->RangeMultiplier(2)
+    ->Range(256, 1024);
+
+}  // namespace
+}  // namespace jpegli
@@ -0,0 +1,56 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#if defined(LIB_JPEGLI_COLOR_TRANSFORM_INL_H_) == defined(HWY_TARGET_TOGGLE)
+#ifdef LIB_JPEGLI_COLOR_TRANSFORM_INL_H_
+#undef LIB_JPEGLI_COLOR_TRANSFORM_INL_H_
+#else
+#define LIB_JPEGLI_COLOR_TRANSFORM_INL_H_
+#endif
+
+#include <hwy/highway.h>
+
+#include "lib/jxl/base/compiler_specific.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jpegli {
+namespace HWY_NAMESPACE {
+namespace {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::Sub;
+
+// Converts RGB samples in the [0, 255] range to full-range BT.601 YCbCr as
+// defined by JFIF Clause 7:
+// https://www.itu.int/rec/T-REC-T.871-201105-I/en
+template <class DF, class V>
+JXL_INLINE void RGBToYCbCrVec(DF df, V r, V g, V b, V* JXL_RESTRICT y,
+                              V* JXL_RESTRICT cb, V* JXL_RESTRICT cr) {
+  constexpr float kR = 0.299f;  // NTSC luma
+  constexpr float kG = 0.587f;
+  constexpr float kB = 0.114f;
+  constexpr float kAmpR = 0.701f;
+  constexpr float kAmpB = 0.886f;
+  const auto c128 = Set(df, 128.0f);
+  const auto r_base = Mul(r, Set(df, kR));
+  const auto r_diff = Mul(r, Set(df, kAmpR + kR));
+  const auto g_base = Mul(g, Set(df, kG));
+  const auto b_base = Mul(b, Set(df, kB));
+  const auto b_diff = Mul(b, Set(df, kAmpB + kB));
+  const auto y_base = Add(r_base, Add(g_base, b_base));
+  *y = y_base;
+  *cb = MulAdd(Sub(b_diff, y_base), Set(df, 1.0f / (kR + (kG + kAmpB))), c128);
+  *cr = MulAdd(Sub(r_diff, y_base), Set(df, 1.0f / (kAmpR + (kG + kB))), c128);
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace
+}  // namespace HWY_NAMESPACE
+}  // namespace jpegli
+HWY_AFTER_NAMESPACE();
+#endif  // LIB_JPEGLI_COLOR_TRANSFORM_INL_H_
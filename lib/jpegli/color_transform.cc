@@ -5,15 +5,20 @@
 
 #include "lib/jpegli/color_transform.h"
 
+#include <cmath>
+
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jpegli/color_transform.cc"
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
+#include "lib/jpegli/color_transform-inl.h"
 #include "lib/jpegli/decode_internal.h"
 #include "lib/jpegli/encode_internal.h"
 #include "lib/jpegli/error.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/cms/opsin_params.h"
+#include "lib/jxl/cms/transfer_functions-inl.h"
 
 HWY_BEFORE_NAMESPACE();
 namespace jpegli {
@@ -21,10 +26,11 @@ namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Add;
-using hwy::HWY_NAMESPACE::Div;
 using hwy::HWY_NAMESPACE::Mul;
 using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::MulSub;
 using hwy::HWY_NAMESPACE::Sub;
+using hwy::HWY_NAMESPACE::Vec;
 
 template <int kRed, int kGreen, int kBlue, int kAlpha>
 void YCbCrToExtRGB(float* row[kMaxComponents], size_t xsize) {
@@ -108,32 +114,13 @@ void ExtRGBToYCbCr(float* row[kMaxComponents], size_t xsize) {
   float* row_y = row[0];
   float* row_cb = row[1];
   float* row_cr = row[2];
-  // Full-range BT.601 as defined by JFIF Clause 7:
-  // https://www.itu.int/rec/T-REC-T.871-201105-I/en
-  const auto c128 = Set(df, 128.0f);
-  const auto kR = Set(df, 0.299f);  // NTSC luma
-  const auto kG = Set(df, 0.587f);
-  const auto kB = Set(df, 0.114f);
-  const auto kAmpR = Set(df, 0.701f);
-  const auto kAmpB = Set(df, 0.886f);
-  const auto kDiffR = Add(kAmpR, kR);
-  const auto kDiffB = Add(kAmpB, kB);
-  const auto kNormR = Div(Set(df, 1.0f), (Add(kAmpR, Add(kG, kB))));
-  const auto kNormB = Div(Set(df, 1.0f), (Add(kR, Add(kG, kAmpB))));
-
+  Vec<decltype(df)> y_vec, cb_vec, cr_vec;  // NOLINT
   for (size_t x = 0; x < xsize; x += Lanes(df)) {
     const auto r = Load(df, row_r + x);
     const auto g = Load(df, row_g + x);
     const auto b = Load(df, row_b + x);
-    const auto r_base = Mul(r, kR);
-    const auto r_diff = Mul(r, kDiffR);
-    const auto g_base = Mul(g, kG);
-    const auto b_base = Mul(b, kB);
-    const auto b_diff = Mul(b, kDiffB);
-    const auto y_base = Add(r_base, Add(g_base, b_base));
-    const auto cb_vec = MulAdd(Sub(b_diff, y_base), kNormB, c128);
-    const auto cr_vec = MulAdd(Sub(r_diff, y_base), kNormR, c128);
-    Store(y_base, df, row_y + x);
+    RGBToYCbCrVec(df, r, g, b, &y_vec, &cb_vec, &cr_vec);
+    Store(y_vec, df, row_y + x);
     Store(cb_vec, df, row_cb + x);
     Store(cr_vec, df, row_cr + x);
   }
@@ -155,6 +142,65 @@ void ABGRToYCbCr(float* row[kMaxComponents], size_t xsize) {
   ExtRGBToYCbCr<3, 2, 1>(row, xsize);
 }
 
+// Converts the scaled XYB samples written by jpegli_set_xyb_mode() to sRGB.
+// This is the inverse of LinearRGBRowToXYB() and ScaleXYBRow() in
+// lib/jxl/enc_xyb.cc followed by the sRGB transfer function, i.e. what the CMS
+// transform of the XYB ICC profile computes. Both the input and the output
+// samples are centered around zero. Out of gamut colors are clamped only when
+// writing the output.
+void XYBToSRGB(float* row[kMaxComponents], size_t xsize) {
+  using jxl::cms::kDefaultInverseOpsinAbsorbanceMatrix;
+  using jxl::cms::kOpsinAbsorbanceBias;
+  using jxl::cms::kScaledXYBOffset;
+  using jxl::cms::kScaledXYBScale;
+  const HWY_CAPPED(float, 8) df;
+  const jxl::HWY_NAMESPACE::TF_SRGB tf_srgb;
+  float* JXL_RESTRICT row_x = row[0];
+  float* JXL_RESTRICT row_y = row[1];
+  float* JXL_RESTRICT row_b = row[2];
+  const float* m = &kDefaultInverseOpsinAbsorbanceMatrix[0][0];
+  // Undoes the centering together with ScaleXYBRow().
+  constexpr float kCenter = 128.0f / 255;
+  const auto mul_x = Set(df, 1.0f / kScaledXYBScale[0]);
+  const auto mul_y = Set(df, 1.0f / kScaledXYBScale[1]);
+  const auto mul_b = Set(df, 1.0f / kScaledXYBScale[2]);
+  const auto add_x =
+      Set(df, kCenter / kScaledXYBScale[0] - kScaledXYBOffset[0]);
+  const auto add_y =
+      Set(df, kCenter / kScaledXYBScale[1] - kScaledXYBOffset[1]);
+  const auto add_b =
+      Set(df, kCenter / kScaledXYBScale[2] - kScaledXYBOffset[2]);
+  const auto bias_r = Set(df, kOpsinAbsorbanceBias[0]);
+  const auto bias_g = Set(df, kOpsinAbsorbanceBias[1]);
+  const auto bias_b = Set(df, kOpsinAbsorbanceBias[2]);
+  const auto bias_cbrt_r = Set(df, std::cbrt(kOpsinAbsorbanceBias[0]));
+  const auto bias_cbrt_g = Set(df, std::cbrt(kOpsinAbsorbanceBias[1]));
+  const auto bias_cbrt_b = Set(df, std::cbrt(kOpsinAbsorbanceBias[2]));
+  const auto center = Set(df, kCenter);
+  for (size_t x = 0; x < xsize; x += Lanes(df)) {
+    const auto opsin_x = MulAdd(Load(df, row_x + x), mul_x, add_x);
+    const auto opsin_y = MulAdd(Load(df, row_y + x), mul_y, add_y);
+    const auto opsin_b =
+        Add(MulAdd(Load(df, row_b + x), mul_b, add_b), opsin_y);
+    // Undoes the gamma, which is 3, and the opsin absorbance bias.
+    const auto gamma_r = Add(Add(opsin_y, opsin_x), bias_cbrt_r);
+    const auto gamma_g = Add(Sub(opsin_y, opsin_x), bias_cbrt_g);
+    const auto gamma_b = Add(opsin_b, bias_cbrt_b);
+    const auto mixed_r = MulSub(Mul(gamma_r, gamma_r), gamma_r, bias_r);
+    const auto mixed_g = MulSub(Mul(gamma_g, gamma_g), gamma_g, bias_g);
+    const auto mixed_b = MulSub(Mul(gamma_b, gamma_b), gamma_b, bias_b);
+    // Unmixes to linear sRGB.
+    float* JXL_RESTRICT out[3] = {row_x, row_y, row_b};
+    for (size_t c = 0; c < 3; ++c) {
+      auto linear = Mul(Set(df, m[3 * c + 0]), mixed_r);
+      linear = MulAdd(Set(df, m[3 * c + 1]), mixed_g, linear);
+      linear = MulAdd(Set(df, m[3 * c + 2]), mixed_b, linear);
+      const auto encoded = tf_srgb.EncodedFromDisplay(df, linear);
+      Store(Sub(encoded, center), df, out[c] + x);
+    }
+  }
+}
+
 void CMYKToYCCK(float* row[kMaxComponents], size_t xsize) {
   const HWY_CAPPED(float, 8) df;
   float* JXL_RESTRICT row0 = row[0];
@@ -179,6 +225,7 @@ namespace jpegli {
 
 HWY_EXPORT(CMYKToYCCK);
 HWY_EXPORT(YCCKToCMYK);
+HWY_EXPORT(XYBToSRGB);
 HWY_EXPORT(YCbCrToRGB);
 HWY_EXPORT(YCbCrToBGR);
 HWY_EXPORT(YCbCrToRGBA);
@@ -388,8 +435,83 @@ void ChooseColorTransform(j_compress_ptr cinfo) {
   }
 }
 
+// For the RGB output colorspaces, the output channels are taken from the R, G
+// and B rows, or from the grayscale row, with the alpha and padding channels
+// taken from the opaque row. The output writer then reorders the channels and
+// fills the alpha while interleaving them, instead of a color transform that
+// shuffles the rows. Returns false for the other colorspaces, and when the
+// output rows are modified in place for color quantization.
+bool ChooseRGBOutputLayout(j_decompress_ptr cinfo) {
+  jpeg_decomp_master* m = cinfo->master;
+  if (cinfo->quantize_colors) return false;
+  // The R, G, B rows for each output channel, -1 for opaque.
+  static constexpr int kRGB[4] = {0, 1, 2, -1};
+  static constexpr int kBGR[4] = {2, 1, 0, -1};
+  static constexpr int kARGB[4] = {-1, 0, 1, 2};
+  static constexpr int kABGR[4] = {-1, 2, 1, 0};
+  const int* order;
+  switch (cinfo->out_color_space) {
+    case JCS_RGB:
+      order = kRGB;
+      break;
+#ifdef JCS_EXTENSIONS
+    case JCS_EXT_RGB:
+    case JCS_EXT_RGBX:
+      order = kRGB;
+      break;
+    case JCS_EXT_BGR:
+    case JCS_EXT_BGRX:
+      order = kBGR;
+      break;
+    case JCS_EXT_XRGB:
+      order = kARGB;
+      break;
+    case JCS_EXT_XBGR:
+      order = kABGR;
+      break;
+#endif
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_RGBA:
+      order = kRGB;
+      break;
+    case JCS_EXT_BGRA:
+      order = kBGR;
+      break;
+    case JCS_EXT_ARGB:
+      order = kARGB;
+      break;
+    case JCS_EXT_ABGR:
+      order = kABGR;
+      break;
+#endif
+    default:
+      return false;
+  }
+  if (cinfo->jpeg_color_space == JCS_GRAYSCALE) {
+    m->color_transform = NullTransform;
+    m->num_transformed_rows_ = 1;
+  } else if (cinfo->jpeg_color_space == JCS_RGB) {
+    m->color_transform = NullTransform;
+    m->num_transformed_rows_ = 3;
+  } else if (cinfo->jpeg_color_space == JCS_YCbCr) {
+    m->color_transform = HWY_DYNAMIC_DISPATCH(YCbCrToRGB);
+    m->num_transformed_rows_ = 3;
+  } else {
+    return false;
+  }
+  for (int c = 0; c < cinfo->out_color_components; ++c) {
+    const bool gray = m->num_transformed_rows_ == 1;
+    m->output_channel_row_[c] = (gray && order[c] > 0) ? 0 : order[c];
+  }
+  return true;
+}
+
 void ChooseColorTransform(j_decompress_ptr cinfo) {
   jpeg_decomp_master* m = cinfo->master;
+  m->num_transformed_rows_ = cinfo->out_color_components;
+  for (int c = 0; c < kMaxComponents; ++c) {
+    m->output_channel_row_[c] = c;
+  }
   if (!CheckColorSpaceComponents(cinfo->out_color_components,
                                  cinfo->out_color_space)) {
     JPEGLI_ERROR("Invalid number of output components %d for colorspace %d",
@@ -400,6 +522,16 @@ void ChooseColorTransform(j_decompress_ptr cinfo) {
     JPEGLI_ERROR("Invalid number of components %d for colorspace %d",
                  cinfo->num_components, cinfo->jpeg_color_space);
   }
+  if (m->xyb_to_srgb_) {
+    if (cinfo->jpeg_color_space != JCS_RGB ||
+        cinfo->out_color_space != JCS_RGB) {
+      JPEGLI_ERROR("Unsupported color transform %d -> %d for XYB to sRGB",
+                   cinfo->jpeg_color_space, cinfo->out_color_space);
+    }
+    m->color_transform = HWY_DYNAMIC_DISPATCH(XYBToSRGB);
+    return;
+  }
+  if (ChooseRGBOutputLayout(cinfo)) return;
   if (cinfo->jpeg_color_space == cinfo->out_color_space) {
     if (cinfo->num_components != cinfo->out_color_components) {
       JPEGLI_ERROR("Input/output components mismatch:  %d vs %d",
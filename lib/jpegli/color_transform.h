@@ -6,7 +6,10 @@
 #ifndef LIB_JPEGLI_COLOR_TRANSFORM_H_
 #define LIB_JPEGLI_COLOR_TRANSFORM_H_
 
+#include <cstddef>
+
 #include "lib/jpegli/common.h"
+#include "lib/jpegli/common_internal.h"
 #include "lib/jxl/base/compiler_specific.h"
 
 namespace jpegli {
@@ -15,6 +18,8 @@ void ChooseColorTransform(j_compress_ptr cinfo);
 
 void ChooseColorTransform(j_decompress_ptr cinfo);
 
+void NullTransform(float* row[kMaxComponents], size_t len);
+
 }  // namespace jpegli
 
 #endif  // LIB_JPEGLI_COLOR_TRANSFORM_H_
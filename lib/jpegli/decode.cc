@@ -7,6 +7,7 @@
 
 #include <string.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "lib/jpegli/color_quantize.h"
@@ -202,6 +203,18 @@ void BuildHuffmanLookupTable(j_decompress_ptr cinfo, JHUFF_TBL* table,
 
 void PrepareForScan(j_decompress_ptr cinfo) {
   jpeg_decomp_master* m = cinfo->master;
+  m->skip_scan_ =
+      m->max_scans_ > 0 && cinfo->input_scan_number >= m->max_scans_;
+  if (m->skip_scan_) {
+    // The coefficients and coef_bits are left as they are after the last
+    // decoded scan, so that the missing coefficients are predicted with block
+    // smoothing, as for an incomplete progressive image.
+    m->codestream_bits_ahead_ = 0;
+    ++cinfo->input_scan_number;
+    cinfo->input_iMCU_row = 0;
+    cinfo->global_state = kDecProcessScan;
+    return;
+  }
   for (int i = 0; i < cinfo->comps_in_scan; ++i) {
     int comp_idx = cinfo->cur_comp_info[i]->component_index;
     int* prev_coef_bits = cinfo->coef_bits[comp_idx + cinfo->num_components];
@@ -518,11 +531,18 @@ void AllocateOutputBuffers(j_decompress_ptr cinfo) {
                                   output_stride);
   }
   m->idct_scratch_ = Allocate<float>(cinfo, 5 * DCTSIZE2, JPOOL_IMAGE_ALIGNED);
+  m->thread_idct_scratch_ = nullptr;
+  m->thread_smoothing_scratch_ = nullptr;
+  m->num_thread_scratch_ = 0;
   // Padding for horizontal chroma upsampling.
   constexpr size_t kPaddingLeft = 64;
   constexpr size_t kPaddingRight = 64;
   m->upsample_scratch_ = Allocate<float>(
       cinfo, output_stride + kPaddingLeft + kPaddingRight, JPOOL_IMAGE_ALIGNED);
+  const size_t opaque_row_size = output_stride + kPaddingRight;
+  m->opaque_row_ =
+      Allocate<float>(cinfo, opaque_row_size, JPOOL_IMAGE_ALIGNED);
+  std::fill(m->opaque_row_, m->opaque_row_ + opaque_row_size, 1.0f);
   size_t bytes_per_sample = jpegli_bytes_per_sample(m->output_data_type_);
   size_t bytes_per_pixel = cinfo->out_color_components * bytes_per_sample;
   size_t scratch_stride = RoundUpTo(output_stride, HWY_ALIGNMENT);
@@ -1033,6 +1053,42 @@ void jpegli_new_colormap(j_decompress_ptr cinfo) {
   cinfo->master->regenerate_inverse_colormap_ = true;
 }
 
+void jpegli_set_decompress_parallel_runner(j_decompress_ptr cinfo,
+                                           JxlParallelRunner runner,
+                                           void* runner_opaque) {
+  if (cinfo->global_state != jpegli::kDecStart &&
+      cinfo->global_state != jpegli::kDecInHeader &&
+      cinfo->global_state != jpegli::kDecHeaderDone) {
+    JPEGLI_ERROR("jpegli_set_decompress_parallel_runner: unexpected state %d",
+                 cinfo->global_state);
+  }
+  cinfo->master->runner_ = runner;
+  cinfo->master->runner_opaque_ = runner_opaque;
+}
+
+void jpegli_set_max_scans(j_decompress_ptr cinfo, int max_scans) {
+  if (cinfo->global_state != jpegli::kDecStart &&
+      cinfo->global_state != jpegli::kDecInHeader &&
+      cinfo->global_state != jpegli::kDecHeaderDone) {
+    JPEGLI_ERROR("jpegli_set_max_scans: unexpected state %d",
+                 cinfo->global_state);
+  }
+  if (max_scans < 0) {
+    JPEGLI_ERROR("Invalid maximum number of scans %d", max_scans);
+  }
+  cinfo->master->max_scans_ = max_scans;
+}
+
+void jpegli_set_xyb_to_srgb(j_decompress_ptr cinfo, boolean enable) {
+  if (cinfo->global_state != jpegli::kDecStart &&
+      cinfo->global_state != jpegli::kDecInHeader &&
+      cinfo->global_state != jpegli::kDecHeaderDone) {
+    JPEGLI_ERROR("jpegli_set_xyb_to_srgb: unexpected state %d",
+                 cinfo->global_state);
+  }
+  cinfo->master->xyb_to_srgb_ = FROM_JXL_BOOL(enable);
+}
+
 void jpegli_set_output_format(j_decompress_ptr cinfo, JpegliDataType data_type,
                               JpegliEndianness endianness) {
   switch (data_type) {
@@ -20,6 +20,8 @@
 #ifndef LIB_JPEGLI_DECODE_H_
 #define LIB_JPEGLI_DECODE_H_
 
+#include <jxl/parallel_runner.h>
+
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/types.h"
 
@@ -100,6 +102,34 @@ void jpegli_new_colormap(j_decompress_ptr cinfo);
 void jpegli_set_output_format(j_decompress_ptr cinfo, JpegliDataType data_type,
                               JpegliEndianness endianness);
 
+// Sets a parallel runner that is used to decode the restart intervals of each
+// iMCU row of sequential scans, and to compute the inverse DCT of the blocks
+// of each iMCU row, on multiple threads. Restart intervals are only decoded in
+// parallel when all of them are in the input buffer. The decoded image does
+// not depend on the runner. The runner opaque pointer must outlive the
+// decompressor, or the runner must be reset by passing nullptr. Must be
+// called before jpegli_start_decompress().
+void jpegli_set_decompress_parallel_runner(j_decompress_ptr cinfo,
+                                           JxlParallelRunner runner,
+                                           void* runner_opaque);
+
+// Sets the number of scans that are decoded, or 0 to decode all scans (the
+// default). The entropy-coded data of the later scans is skipped, which makes
+// decoding a lower quality version of a progressive image faster. Block
+// smoothing then predicts the missing low frequency coefficients, as for an
+// incomplete image. In buffered image mode, the skipped scans are still
+// counted in input_scan_number, but their output is the same as that of the
+// last decoded scan. Must be called before jpegli_start_decompress().
+void jpegli_set_max_scans(j_decompress_ptr cinfo, int max_scans);
+
+// Declares that the three RGB components of the image are the scaled XYB
+// written by jpegli_set_xyb_mode(), and makes the decoder convert them to sRGB
+// instead of outputting them unchanged for the CMS transform of their ICC
+// profile. The caller is responsible for checking the ICC profile. Requires
+// JCS_RGB as both the jpeg and the output colorspace, and does not apply to
+// jpegli_read_raw_data(). Must be called before jpegli_start_decompress().
+void jpegli_set_xyb_to_srgb(j_decompress_ptr cinfo, boolean enable);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
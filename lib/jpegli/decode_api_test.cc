@@ -598,6 +598,79 @@ TEST(DecodeAPITest, AbbreviatedStreams) {
   if (data_stream) free(data_stream);
 }
 
+TEST(DecodeAPITest, ParallelRunner) {
+  for (int samp : {1, 2}) {
+    for (size_t r : {1, 4, 17}) {
+      for (size_t chunk_size : {1, 65536}) {
+        TestConfig config;
+        config.jparams.h_sampling = {samp, 1, 1};
+        config.jparams.v_sampling = {samp, 1, 1};
+        config.jparams.restart_interval = r;
+        config.dparams.chunk_size = chunk_size;
+        JXL_ASSIGN_OR_QUIT(std::vector<uint8_t> compressed,
+                           GetTestJpegData(config),
+                           "Failed to create test data");
+        TestImage output[2];
+        for (int use_runner = 0; use_runner < 2; ++use_runner) {
+          SourceManager src(compressed.data(), compressed.size(), chunk_size);
+          jpeg_decompress_struct cinfo;
+          const auto try_catch_block = [&]() -> bool {
+            ERROR_HANDLER_SETUP(jpegli);
+            jpegli_create_decompress(&cinfo);
+            if (use_runner) {
+              jpegli_set_decompress_parallel_runner(&cinfo, TestParallelRunner,
+                                                    nullptr);
+            }
+            cinfo.src = reinterpret_cast<jpeg_source_mgr*>(&src);
+            TestAPINonBuffered(config.jparams, config.dparams, config.input,
+                               &cinfo, &output[use_runner]);
+            return true;
+          };
+          ASSERT_TRUE(try_catch_block());
+          jpegli_destroy_decompress(&cinfo);
+        }
+        VerifyOutputImage(output[0], output[1], 0.0, 0.0);
+      }
+    }
+  }
+}
+
+TEST(DecodeAPITest, MaxScans) {
+  TestConfig config;
+  config.jparams.progressive_mode = 2;
+  JXL_ASSIGN_OR_QUIT(std::vector<uint8_t> compressed, GetTestJpegData(config),
+                     "Failed to create test data");
+  std::vector<TestImage> expected_progression;
+  DecodeAllScansWithLibjpeg(config.jparams, config.dparams, compressed,
+                            &expected_progression);
+  const int num_scans = expected_progression.size();
+  ASSERT_GT(num_scans, 1);
+  TestImage full_output;
+  for (int max_scans : {num_scans + 1, num_scans, 1, 2, num_scans - 1}) {
+    SourceManager src(compressed.data(), compressed.size(), 1u << 12);
+    TestImage output;
+    jpeg_decompress_struct cinfo;
+    const auto try_catch_block = [&]() -> bool {
+      ERROR_HANDLER_SETUP(jpegli);
+      jpegli_create_decompress(&cinfo);
+      jpegli_set_max_scans(&cinfo, max_scans);
+      cinfo.src = reinterpret_cast<jpeg_source_mgr*>(&src);
+      TestAPINonBuffered(config.jparams, config.dparams, config.input, &cinfo,
+                         &output);
+      return true;
+    };
+    ASSERT_TRUE(try_catch_block());
+    jpegli_destroy_decompress(&cinfo);
+    if (max_scans > num_scans) {
+      full_output = std::move(output);
+    } else if (max_scans == num_scans) {
+      VerifyOutputImage(full_output, output, 0.0, 0.0);
+    } else {
+      VerifyOutputImage(expected_progression[max_scans - 1], output, 1.0);
+    }
+  }
+}
+
 class DecodeAPITestParam : public ::testing::TestWithParam<TestConfig> {};
 
 TEST_P(DecodeAPITestParam, TestAPI) {
@@ -932,6 +1005,18 @@ std::vector<TestConfig> GenerateTests(bool buffered) {
       all_tests.push_back(config);
     }
   }
+  for (J_COLOR_SPACE out_color_space :
+       {JCS_EXT_BGR, JCS_EXT_RGBA, JCS_EXT_BGRA, JCS_EXT_ARGB}) {
+    for (JpegliDataType type : {JPEGLI_TYPE_UINT16, JPEGLI_TYPE_FLOAT}) {
+      TestConfig config;
+      config.input.xsize = config.input.ysize = 256;
+      config.dparams.data_type = type;
+      config.dparams.endianness = JPEGLI_BIG_ENDIAN;
+      config.dparams.set_out_color_space = true;
+      config.dparams.out_color_space = out_color_space;
+      all_tests.push_back(config);
+    }
+  }
   for (J_COLOR_SPACE jpeg_color_space : {JCS_CMYK, JCS_YCCK}) {
     for (J_COLOR_SPACE out_color_space : {JCS_CMYK, JCS_YCCK}) {
       if (jpeg_color_space == JCS_CMYK && out_color_space == JCS_YCCK) continue;
@@ -6,6 +6,7 @@
 #ifndef LIB_JPEGLI_DECODE_INTERNAL_H_
 #define LIB_JPEGLI_DECODE_INTERNAL_H_
 
+#include <jxl/parallel_runner.h>
 #include <sys/types.h>
 
 #include <cstdint>
@@ -34,6 +35,20 @@ struct MCUCodingState {
   coeff_t coeffs[D_MAX_BLOCKS_IN_MCU * DCTSIZE2];
 };
 
+// Location and decoding result of one restart interval of the current scan.
+struct RestartSegment {
+  // Position of the first byte of the entropy-coded segment, and of the
+  // marker that ends it.
+  size_t start;
+  size_t end;
+  bool ok;
+  // Position and bit position after the last decoded MCU.
+  size_t pos;
+  size_t bit_pos;
+  coeff_t last_dc_coeff[kMaxComponents];
+  int eobrun;
+};
+
 }  // namespace jpegli
 
 // Use this forward-declared libjpeg struct to hold all our private variables.
@@ -96,6 +111,21 @@ struct jpeg_decomp_master {
 
   jpegli::MCUCodingState mcu_;
 
+  // Optional runner for decoding the restart intervals of an iMCU row and
+  // for the inverse DCT in parallel.
+  JxlParallelRunner runner_ = nullptr;
+  void* runner_opaque_ = nullptr;
+  std::vector<jpegli::RestartSegment> restart_segments_;
+
+  // If positive, the scans after the first max_scans_ scans are skipped
+  // without decoding their entropy-coded data.
+  int max_scans_ = 0;
+  bool skip_scan_ = false;
+
+  // If set, the RGB components hold the scaled XYB of jpegli's XYB mode, and
+  // the color transform converts them to sRGB.
+  bool xyb_to_srgb_ = false;
+
   //
   // Rendering state.
   //
@@ -120,8 +150,20 @@ struct jpeg_decomp_master {
       float* JXL_RESTRICT output, size_t output_stride, size_t dctsize);
 
   void (*color_transform)(float* row[jpegli::kMaxComponents], size_t len);
+  // The row of the color transform output that goes to each output channel,
+  // or -1 for opaque_row_, and the number of these rows. The output writer
+  // then does the reordering and alpha fill of the extended RGB colorspaces.
+  int output_channel_row_[jpegli::kMaxComponents];
+  int num_transformed_rows_;
+  // Opaque alpha samples, also used for the padding channel of RGBX layouts.
+  float* opaque_row_;
 
   float* idct_scratch_;
+  // Per-thread versions of idct_scratch_ and smoothing_scratch_ for the
+  // parallel runner, for num_thread_scratch_ threads.
+  float* thread_idct_scratch_;
+  int16_t* thread_smoothing_scratch_;
+  size_t num_thread_scratch_;
   float* upsample_scratch_;
   uint8_t* output_scratch_;
   int16_t* smoothing_scratch_;
@@ -134,6 +176,9 @@ struct jpeg_decomp_master {
   uint8_t* pixels_;
   JSAMPARRAY scanlines_;
   std::vector<std::vector<uint8_t>> candidate_lists_;
+  // The colors of candidate_lists_ multiplied by the component weights, one
+  // row per component with a stride that is a multiple of 8.
+  std::vector<std::vector<int32_t>> candidate_colors_;
   float* dither_[jpegli::kMaxComponents];
   float* error_row_[2 * jpegli::kMaxComponents];
   size_t dither_size_;
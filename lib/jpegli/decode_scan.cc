@@ -7,10 +7,13 @@
 
 #include <string.h>
 
+#include <algorithm>
 #include <hwy/base.h>
+#include <vector>
 
 #include "lib/jpegli/decode_internal.h"
 #include "lib/jpegli/error.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 
 namespace jpegli {
@@ -339,6 +342,54 @@ bool RefineDCTBlock(const HuffmanTableEntry* ac_huff, int Ss, int Se, int Al,
   return true;
 }
 
+// Decodes the MCU at the given position of the current scan into coeff_rows.
+// The blocks of the MCU that are outside of the image are decoded to
+// sink_block.
+bool DecodeMCU(j_decompress_ptr cinfo, size_t mcu_row, size_t mcu_col,
+               coeff_t* sink_block, BitReaderState* br, coeff_t* last_dc_coeff,
+               int* eobrun) {
+  jpeg_decomp_master* m = cinfo->master;
+  bool scan_ok = true;
+  for (int i = 0; i < cinfo->comps_in_scan; ++i) {
+    const jpeg_component_info* comp = cinfo->cur_comp_info[i];
+    int c = comp->component_index;
+    const HuffmanTableEntry* dc_lut =
+        &m->dc_huff_lut_[comp->dc_tbl_no * kJpegHuffmanLutSize];
+    const HuffmanTableEntry* ac_lut =
+        &m->ac_huff_lut_[comp->ac_tbl_no * kJpegHuffmanLutSize];
+    for (int iy = 0; iy < comp->MCU_height; ++iy) {
+      size_t block_y = mcu_row * comp->MCU_height + iy;
+      int biy = block_y % comp->v_samp_factor;
+      for (int ix = 0; ix < comp->MCU_width; ++ix) {
+        size_t block_x = mcu_col * comp->MCU_width + ix;
+        coeff_t* coeffs;
+        if (block_x >= comp->width_in_blocks ||
+            block_y >= comp->height_in_blocks) {
+          // Note that it is OK that sink_block is uninitialized because
+          // it will never be used in any branches, even in the RefineDCTBlock
+          // case, because only DC scans can be interleaved and we don't use
+          // the zero-ness of the DC coeff in the DC refinement code-path.
+          coeffs = sink_block;
+        } else {
+          coeffs = &m->coeff_rows[c][biy][block_x][0];
+        }
+        if (cinfo->Ah == 0) {
+          if (!DecodeDCTBlock(dc_lut, ac_lut, cinfo->Ss, cinfo->Se, cinfo->Al,
+                              eobrun, br, &last_dc_coeff[c], coeffs)) {
+            scan_ok = false;
+          }
+        } else {
+          if (!RefineDCTBlock(ac_lut, cinfo->Ss, cinfo->Se, cinfo->Al, eobrun,
+                              br, coeffs)) {
+            scan_ok = false;
+          }
+        }
+      }
+    }
+  }
+  return scan_ok;
+}
+
 void SaveMCUCodingState(j_decompress_ptr cinfo) {
   jpeg_decomp_master* m = cinfo->master;
   memcpy(m->mcu_.last_dc_coeff, m->last_dc_coeff_, sizeof(m->last_dc_coeff_));
@@ -414,6 +465,153 @@ bool FinishScan(j_decompress_ptr cinfo, const uint8_t* data, const size_t len,
   return true;
 }
 
+// Returns the position of the first marker at or after pos, i.e. of a 0xff
+// byte that is not followed by a 0x00 or 0xff byte, or len if there is none.
+size_t FindNextMarker(const uint8_t* data, const size_t len, size_t pos) {
+  while (pos + 1 < len) {
+    const void* p = memchr(data + pos, 0xff, len - 1 - pos);
+    if (p == nullptr) break;
+    pos = static_cast<const uint8_t*>(p) - data;
+    if (data[pos + 1] != 0 && data[pos + 1] != 0xff) {
+      return pos;
+    }
+    ++pos;
+  }
+  return len;
+}
+
+// Decodes the current iMCU row of a sequential scan by decoding its restart
+// intervals in parallel, if there is a parallel runner, the iMCU row starts
+// with a restart interval and all of its intervals are in the input buffer.
+// Returns false if the iMCU row has to be decoded MCU by MCU; in that case
+// the decoder state and the coefficients are the same as before the call.
+bool DecodeRestartIntervalsInParallel(j_decompress_ptr cinfo,
+                                      const uint8_t* data, const size_t len,
+                                      size_t* pos, size_t* bit_pos) {
+  jpeg_decomp_master* m = cinfo->master;
+  const size_t interval = cinfo->restart_interval;
+  if (!m->runner_ || interval == 0 || *bit_pos != 0 ||
+      m->scan_mcu_col_ != 0 ||
+      m->restarts_to_go_ != static_cast<int>(interval) || cinfo->Ss != 0 ||
+      cinfo->Se != DCTSIZE2 - 1 || cinfo->Ah != 0 || cinfo->Al != 0) {
+    return false;
+  }
+  const size_t mcu_row0 = m->scan_mcu_row_;
+  const size_t mcu_row1 =
+      std::min<size_t>(RoundUpTo(mcu_row0 + 1, m->mcu_rows_per_iMCU_row_),
+                       cinfo->MCU_rows_in_scan);
+  const size_t mcus_per_row = cinfo->MCUs_per_row;
+  const size_t num_mcus = (mcu_row1 - mcu_row0) * mcus_per_row;
+  const size_t num_segments = DivCeil(num_mcus, interval);
+  if (num_segments < 2) {
+    return false;
+  }
+  // Index the restart markers. Every interval, including the last one, must
+  // be followed by a marker in the input buffer.
+  std::vector<RestartSegment>& segments = m->restart_segments_;
+  segments.resize(num_segments);
+  size_t start = *pos;
+  for (size_t s = 0; s < num_segments; ++s) {
+    segments[s].start = start;
+    segments[s].end = FindNextMarker(data, len, start);
+    if (segments[s].end + 2 > len) {
+      return false;
+    }
+    if (s + 1 < num_segments) {
+      const int marker = 0xd0 + ((m->next_restart_marker_ + s) & 7);
+      if (data[segments[s].end + 1] != marker) {
+        return false;
+      }
+    }
+    start = segments[s].end + 2;
+  }
+  const auto decode_segment = [&](uint32_t s, size_t /* thread */) {
+    RestartSegment* seg = &segments[s];
+    // The decoder state is reset at the start of each restart interval.
+    memset(seg->last_dc_coeff, 0, sizeof(seg->last_dc_coeff));
+    seg->eobrun = -1;
+    seg->ok = true;
+    HWY_ALIGN_MAX coeff_t sink_block[DCTSIZE2];
+    BitReaderState br(data, len, seg->start);
+    const size_t mcu_end = std::min((s + 1) * interval, num_mcus);
+    for (size_t i = s * interval; i < mcu_end && seg->ok; ++i) {
+      seg->ok = DecodeMCU(cinfo, mcu_row0 + i / mcus_per_row,
+                          i % mcus_per_row, sink_block, &br,
+                          seg->last_dc_coeff, &seg->eobrun);
+    }
+    if (!br.FinishStream(&seg->pos, &seg->bit_pos)) {
+      seg->ok = false;
+    }
+    return jxl::Status(true);
+  };
+  jxl::ThreadPool pool(m->runner_, m->runner_opaque_);
+  bool ok = static_cast<bool>(pool.Run(0, num_segments, jxl::ThreadPool::NoInit,
+                                       decode_segment, "DecodeRestarts"));
+  for (size_t s = 0; ok && s < num_segments; ++s) {
+    const RestartSegment& seg = segments[s];
+    ok = seg.ok;
+    if (ok && s + 1 < num_segments) {
+      // The intervals must end right before their restart marker, otherwise
+      // the MCU by MCU decoding warns about the skipped bytes.
+      size_t end = seg.pos;
+      if (seg.bit_pos > 0) {
+        end += data[seg.pos] == 0xff ? 2 : 1;
+      }
+      ok = end == seg.end;
+    }
+  }
+  if (!ok) {
+    // Sequential scans set every coefficient of their blocks, which were
+    // zero before, so clearing them restores the previous state.
+    for (int i = 0; i < cinfo->comps_in_scan; ++i) {
+      const jpeg_component_info* comp = cinfo->cur_comp_info[i];
+      int c = comp->component_index;
+      for (size_t mcu_row = mcu_row0; mcu_row < mcu_row1; ++mcu_row) {
+        for (int iy = 0; iy < comp->MCU_height; ++iy) {
+          size_t block_y = mcu_row * comp->MCU_height + iy;
+          if (block_y >= comp->height_in_blocks) {
+            continue;
+          }
+          int biy = block_y % comp->v_samp_factor;
+          memset(&m->coeff_rows[c][biy][0][0], 0,
+                 comp->width_in_blocks * sizeof(JBLOCK));
+        }
+      }
+    }
+    return false;
+  }
+  const RestartSegment& last = segments.back();
+  *pos = last.pos;
+  *bit_pos = last.bit_pos;
+  memcpy(m->last_dc_coeff_, last.last_dc_coeff, sizeof(m->last_dc_coeff_));
+  m->eobrun_ = last.eobrun;
+  m->next_restart_marker_ = (m->next_restart_marker_ + num_segments - 1) & 7;
+  m->restarts_to_go_ = num_segments * interval - num_mcus;
+  m->scan_mcu_row_ = mcu_row1;
+  return true;
+}
+
+// Skips the entropy-coded data of the current scan, including its restart
+// markers, up to the next other marker.
+int SkipScan(j_decompress_ptr cinfo, const uint8_t* const data,
+             const size_t len, size_t* pos) {
+  for (;;) {
+    size_t marker = FindNextMarker(data, len, *pos);
+    if (marker + 2 > len) {
+      // Keep the last byte, it can be the first byte of a marker.
+      *pos = std::max(*pos, len - 1);
+      return kNeedMoreInput;
+    }
+    if (data[marker + 1] < 0xd0 || data[marker + 1] > 0xd7) {
+      *pos = marker;
+      break;
+    }
+    *pos = marker + 2;
+  }
+  cinfo->input_iMCU_row = cinfo->total_iMCU_rows;
+  return JPEG_SCAN_COMPLETED;
+}
+
 }  // namespace
 
 void PrepareForiMCURow(j_decompress_ptr cinfo) {
@@ -437,6 +635,9 @@ int ProcessScan(j_decompress_ptr cinfo, const uint8_t* const data,
     return kNeedMoreInput;
   }
   jpeg_decomp_master* m = cinfo->master;
+  if (m->skip_scan_) {
+    return SkipScan(cinfo, data, len, pos);
+  }
   for (;;) {
     // Handle the restart intervals.
     if (cinfo->restart_interval > 0 && m->restarts_to_go_ == 0) {
@@ -462,6 +663,15 @@ int ProcessScan(j_decompress_ptr cinfo, const uint8_t* const data,
       return kHandleRestart;
     }
 
+    if (DecodeRestartIntervalsInParallel(cinfo, data, len, pos, bit_pos)) {
+      if (m->scan_mcu_row_ == cinfo->MCU_rows_in_scan) {
+        if (!FinishScan(cinfo, data, len, pos, bit_pos)) {
+          return kNeedMoreInput;
+        }
+      }
+      break;
+    }
+
     size_t start_pos = *pos;
     BitReaderState br(data, len, start_pos);
     if (*bit_pos > 0) {
@@ -473,46 +683,9 @@ int ProcessScan(j_decompress_ptr cinfo, const uint8_t* const data,
 
     // Decode one MCU.
     HWY_ALIGN_MAX static coeff_t sink_block[DCTSIZE2] = {0};
-    bool scan_ok = true;
-    for (int i = 0; i < cinfo->comps_in_scan; ++i) {
-      const jpeg_component_info* comp = cinfo->cur_comp_info[i];
-      int c = comp->component_index;
-      const HuffmanTableEntry* dc_lut =
-          &m->dc_huff_lut_[comp->dc_tbl_no * kJpegHuffmanLutSize];
-      const HuffmanTableEntry* ac_lut =
-          &m->ac_huff_lut_[comp->ac_tbl_no * kJpegHuffmanLutSize];
-      for (int iy = 0; iy < comp->MCU_height; ++iy) {
-        size_t block_y = m->scan_mcu_row_ * comp->MCU_height + iy;
-        int biy = block_y % comp->v_samp_factor;
-        for (int ix = 0; ix < comp->MCU_width; ++ix) {
-          size_t block_x = m->scan_mcu_col_ * comp->MCU_width + ix;
-          coeff_t* coeffs;
-          if (block_x >= comp->width_in_blocks ||
-              block_y >= comp->height_in_blocks) {
-            // Note that it is OK that sink_block is uninitialized because
-            // it will never be used in any branches, even in the RefineDCTBlock
-            // case, because only DC scans can be interleaved and we don't use
-            // the zero-ness of the DC coeff in the DC refinement code-path.
-            coeffs = sink_block;
-          } else {
-            coeffs = &m->coeff_rows[c][biy][block_x][0];
-          }
-          if (cinfo->Ah == 0) {
-            if (!DecodeDCTBlock(dc_lut, ac_lut, cinfo->Ss, cinfo->Se, cinfo->Al,
-                                &m->eobrun_, &br,
-                                &m->last_dc_coeff_[comp->component_index],
-                                coeffs)) {
-              scan_ok = false;
-            }
-          } else {
-            if (!RefineDCTBlock(ac_lut, cinfo->Ss, cinfo->Se, cinfo->Al,
-                                &m->eobrun_, &br, coeffs)) {
-              scan_ok = false;
-            }
-          }
-        }
-      }
-    }
+    bool scan_ok =
+        DecodeMCU(cinfo, m->scan_mcu_row_, m->scan_mcu_col_, sink_block, &br,
+                  m->last_dc_coeff_, &m->eobrun_);
     size_t new_pos;
     size_t new_bit_pos;
     bool stream_ok = br.FinishStream(&new_pos, &new_bit_pos);
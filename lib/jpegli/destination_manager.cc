@@ -85,6 +85,74 @@ struct MemoryDestinationManager {
   }
 };
 
+struct ChunkedMemoryDestinationManager {
+  jpeg_destination_mgr pub;
+  // First chunk of the chain supplied by the application.
+  JpegliOutputChunk** chunks;
+  JpegliOutputChunk* current;
+  size_t chunk_size;
+
+  static void StartChunk(j_compress_ptr cinfo, JpegliOutputChunk* chunk) {
+    auto* dest =
+        reinterpret_cast<ChunkedMemoryDestinationManager*>(cinfo->dest);
+    if (chunk->data == nullptr || chunk->size == 0) {
+      JPEGLI_ERROR("jpegli_chunked_mem_dest: Invalid output chunk.");
+    }
+    chunk->used = 0;
+    dest->current = chunk;
+    dest->pub.next_output_byte = chunk->data;
+    dest->pub.free_in_buffer = chunk->size;
+  }
+
+  // Allocates the chunk and its data together, so that the application can
+  // release both with one free().
+  static JpegliOutputChunk* NewChunk(j_compress_ptr cinfo) {
+    auto* dest =
+        reinterpret_cast<ChunkedMemoryDestinationManager*>(cinfo->dest);
+    void* mem = malloc(sizeof(JpegliOutputChunk) + dest->chunk_size);
+    if (mem == nullptr) {
+      JPEGLI_ERROR("jpegli_chunked_mem_dest: Failed to allocate chunk.");
+    }
+    auto* chunk = reinterpret_cast<JpegliOutputChunk*>(mem);
+    chunk->data = reinterpret_cast<uint8_t*>(chunk + 1);
+    chunk->size = dest->chunk_size;
+    chunk->used = 0;
+    chunk->next = nullptr;
+    return chunk;
+  }
+
+  static void init_destination(j_compress_ptr cinfo) {
+    auto* dest =
+        reinterpret_cast<ChunkedMemoryDestinationManager*>(cinfo->dest);
+    if (*dest->chunks == nullptr) {
+      *dest->chunks = NewChunk(cinfo);
+    }
+    for (JpegliOutputChunk* chunk = *dest->chunks; chunk != nullptr;
+         chunk = chunk->next) {
+      chunk->used = 0;
+    }
+    StartChunk(cinfo, *dest->chunks);
+  }
+
+  static boolean empty_output_buffer(j_compress_ptr cinfo) {
+    auto* dest =
+        reinterpret_cast<ChunkedMemoryDestinationManager*>(cinfo->dest);
+    JpegliOutputChunk* chunk = dest->current;
+    chunk->used = chunk->size;
+    if (chunk->next == nullptr) {
+      chunk->next = NewChunk(cinfo);
+    }
+    StartChunk(cinfo, chunk->next);
+    return TRUE;
+  }
+
+  static void term_destination(j_compress_ptr cinfo) {
+    auto* dest =
+        reinterpret_cast<ChunkedMemoryDestinationManager*>(cinfo->dest);
+    dest->current->used = dest->current->size - dest->pub.free_in_buffer;
+  }
+};
+
 }  // namespace jpegli
 
 void jpegli_stdio_dest(j_compress_ptr cinfo, FILE* outfile) {
@@ -146,3 +214,32 @@ void jpegli_mem_dest(j_compress_ptr cinfo, unsigned char** outbuffer,
   dest->pub.next_output_byte = dest->current_buffer;
   dest->pub.free_in_buffer = dest->buffer_size;
 }
+
+void jpegli_chunked_mem_dest(j_compress_ptr cinfo, JpegliOutputChunk** chunks,
+                             size_t chunk_size) {
+  if (chunks == nullptr || chunk_size == 0) {
+    JPEGLI_ERROR("jpegli_chunked_mem_dest: Invalid destination.");
+  }
+  using jpegli::ChunkedMemoryDestinationManager;
+  if (cinfo->dest && cinfo->dest->init_destination !=
+                         ChunkedMemoryDestinationManager::init_destination) {
+    JPEGLI_ERROR(
+        "jpegli_chunked_mem_dest: a different dest manager was already set");
+  }
+  if (!cinfo->dest) {
+    cinfo->dest = reinterpret_cast<jpeg_destination_mgr*>(
+        jpegli::Allocate<ChunkedMemoryDestinationManager>(cinfo, 1));
+  }
+  auto* dest = reinterpret_cast<ChunkedMemoryDestinationManager*>(cinfo->dest);
+  dest->pub.init_destination =
+      ChunkedMemoryDestinationManager::init_destination;
+  dest->pub.empty_output_buffer =
+      ChunkedMemoryDestinationManager::empty_output_buffer;
+  dest->pub.term_destination =
+      ChunkedMemoryDestinationManager::term_destination;
+  dest->pub.next_output_byte = nullptr;
+  dest->pub.free_in_buffer = 0;
+  dest->chunks = chunks;
+  dest->current = nullptr;
+  dest->chunk_size = chunk_size;
+}
@@ -442,6 +442,15 @@ void AllocateBuffers(j_compress_ptr cinfo) {
   }
   m->dct_buffer = Allocate<float>(cinfo, 2 * DCTSIZE2, JPOOL_IMAGE_ALIGNED);
   m->block_tmp = Allocate<int32_t>(cinfo, DCTSIZE2 * 4, JPOOL_IMAGE_ALIGNED);
+  m->row_blocks = nullptr;
+  m->row_dc = nullptr;
+  m->thread_dct_buffer = nullptr;
+  m->num_dct_buffers = 0;
+  if (m->runner) {
+    m->row_blocks = Allocate<int32_t>(cinfo, m->blocks_per_iMCU_row * DCTSIZE2,
+                                      JPOOL_IMAGE_ALIGNED);
+    m->row_dc = Allocate<float>(cinfo, m->blocks_per_iMCU_row, JPOOL_IMAGE);
+  }
   if (!IsStreamingSupported(cinfo)) {
     m->coeff_buffers =
         Allocate<jvirt_barray_ptr>(cinfo, cinfo->num_components, JPOOL_IMAGE);
@@ -508,6 +517,7 @@ void InitCompress(j_compress_ptr cinfo, boolean write_all_tables) {
     ChooseInputMethod(cinfo);
     if (!cinfo->raw_data_in) {
       ChooseColorTransform(cinfo);
+      ChooseFusedInputMethod(cinfo);
       ChooseDownsampleMethods(cinfo);
     }
     QuantPass pass = m->psnr_target > 0 ? QuantPass::SEARCH_FIRST_PASS
@@ -527,6 +537,7 @@ void InitCompress(j_compress_ptr cinfo, boolean write_all_tables) {
   m->next_iMCU_row = 0;
   m->last_restart_interval = 0;
   m->next_dht_index = 0;
+  m->sampled_huffman_codes = false;
 }
 
 //
@@ -556,6 +567,9 @@ void ReadInputRow(j_compress_ptr cinfo, const uint8_t* scanline,
     for (int c = 0; c < cinfo->input_components; ++c) {
       memset(row[c], 0, cinfo->image_width * sizeof(row[c][0]));
     }
+    if (m->fused_color_transform) {
+      (*m->fused_color_transform)(row, cinfo->image_width);
+    }
     return;
   }
   (*m->input_method)(scanline, cinfo->image_width, row);
@@ -594,8 +608,21 @@ void ProcessiMCURow(j_compress_ptr cinfo) {
   }
   ComputeAdaptiveQuantField(cinfo);
   if (IsStreamingSupported(cinfo)) {
-    if (cinfo->optimize_coding) {
+    jpeg_comp_master* m = cinfo->master;
+    if (cinfo->optimize_coding && !m->sampled_huffman_codes) {
       ComputeTokensForiMCURow(cinfo);
+      if (m->next_iMCU_row + 1 ==
+              static_cast<size_t>(m->huffman_sample_rows) &&
+          m->next_iMCU_row + 1 < cinfo->total_iMCU_rows) {
+        // Build the Huffman codes from the tokens so far and write them out,
+        // the remaining rows are encoded without storing their tokens.
+        OptimizeHuffmanCodes(cinfo, /*code_all_symbols=*/true);
+        InitEntropyCoder(cinfo);
+        WriteFrameHeader(cinfo);
+        WriteScanHeader(cinfo, 0);
+        WriteStreamingTokens(cinfo);
+        m->sampled_huffman_codes = true;
+      }
     } else {
       WriteiMCURow(cinfo);
     }
@@ -687,6 +714,10 @@ void jpegli_CreateCompress(j_compress_ptr cinfo, int version,
   cinfo->master->data_type = JPEGLI_TYPE_UINT8;
   cinfo->master->endianness = JPEGLI_NATIVE_ENDIAN;
   cinfo->master->coeff_buffers = nullptr;
+  cinfo->master->runner = nullptr;
+  cinfo->master->runner_opaque = nullptr;
+  cinfo->master->huffman_sample_rows = 0;
+  cinfo->master->sampled_huffman_codes = false;
 }
 
 void jpegli_set_xyb_mode(j_compress_ptr cinfo) {
@@ -930,6 +961,21 @@ void jpegli_set_progressive_level(j_compress_ptr cinfo, int level) {
   cinfo->master->progressive_level = level;
 }
 
+void jpegli_set_parallel_runner(j_compress_ptr cinfo, JxlParallelRunner runner,
+                                void* runner_opaque) {
+  CheckState(cinfo, jpegli::kEncStart);
+  cinfo->master->runner = runner;
+  cinfo->master->runner_opaque = runner_opaque;
+}
+
+void jpegli_set_huffman_sample_rows(j_compress_ptr cinfo, int num_rows) {
+  CheckState(cinfo, jpegli::kEncStart);
+  if (num_rows < 0) {
+    JPEGLI_ERROR("Invalid number of Huffman sample rows %d", num_rows);
+  }
+  cinfo->master->huffman_sample_rows = num_rows;
+}
+
 void jpegli_set_input_format(j_compress_ptr cinfo, JpegliDataType data_type,
                              JpegliEndianness endianness) {
   CheckState(cinfo, jpegli::kEncStart);
@@ -1234,14 +1280,15 @@ void jpegli_finish_compress(j_compress_ptr cinfo) {
 
   const bool tokens_done = jpegli::IsStreamingSupported(cinfo);
   const bool bitstream_done =
-      tokens_done && !FROM_JXL_BOOL(cinfo->optimize_coding);
+      tokens_done && (!FROM_JXL_BOOL(cinfo->optimize_coding) ||
+                      m->sampled_huffman_codes);
 
   if (!tokens_done) {
     jpegli::TokenizeJpeg(cinfo);
   }
 
-  if (cinfo->optimize_coding || cinfo->progressive_mode) {
-    jpegli::OptimizeHuffmanCodes(cinfo);
+  if ((cinfo->optimize_coding || cinfo->progressive_mode) && !bitstream_done) {
+    jpegli::OptimizeHuffmanCodes(cinfo, /*code_all_symbols=*/false);
     jpegli::InitEntropyCoder(cinfo);
   }
 
@@ -20,6 +20,8 @@
 #ifndef LIB_JPEGLI_ENCODE_H_
 #define LIB_JPEGLI_ENCODE_H_
 
+#include <jxl/parallel_runner.h>
+
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/types.h"
 
@@ -152,6 +154,48 @@ void jpegli_set_progressive_level(j_compress_ptr cinfo, int level);
 // AC coefficients. Must be called before jpegli_set_defaults().
 void jpegli_use_standard_quant_tables(j_compress_ptr cinfo);
 
+// Sets a parallel runner that is used to compute the DCT coefficients of the
+// blocks of each iMCU row on multiple threads. The compressed output does not
+// depend on the runner or on the number of threads. The runner opaque pointer
+// must outlive the compressor, or the runner must be reset by passing nullptr.
+// Must be called before jpegli_start_compress(). By default the compressor
+// runs on the calling thread only.
+void jpegli_set_parallel_runner(j_compress_ptr cinfo, JxlParallelRunner runner,
+                                void* runner_opaque);
+
+// Limits the memory used for optimize_coding with a single sequential scan and
+// no restart markers: the Huffman codes are built from the first num_rows iMCU
+// rows, and the rest of the image is written without storing its tokens, so
+// the memory does not grow with the image height. The codes include every
+// symbol, at a small cost in compression for the symbols not seen in the
+// sample. Output suspension is not supported in the row where the codes are
+// written. A value of 0, the default, or a value that is not smaller than the
+// number of iMCU rows uses the whole image.
+void jpegli_set_huffman_sample_rows(j_compress_ptr cinfo, int num_rows);
+
+// A fixed size output buffer in a chain of buffers, see
+// jpegli_chunked_mem_dest().
+typedef struct JpegliOutputChunk {
+  unsigned char* data;
+  // Capacity of data in bytes.
+  size_t size;
+  // Number of bytes of data holding compressed output, set by the compressor.
+  size_t used;
+  struct JpegliOutputChunk* next;
+} JpegliOutputChunk;
+
+// Sets a destination that writes the compressed data into the chain of
+// buffers starting at *chunks, filling each buffer before moving on to the
+// next one, so that the output is never copied or reallocated. After
+// jpegli_finish_compress() the used member of every chunk in the chain holds
+// its part of the output. When the chain runs out, chunks with chunk_size
+// bytes of data are appended to it; each of them is allocated with a single
+// malloc() and must be released by the application with free(). If *chunks
+// is nullptr, the whole chain is allocated this way. The chain is reused from
+// its start if the compressor is reused for another image.
+void jpegli_chunked_mem_dest(j_compress_ptr cinfo, JpegliOutputChunk** chunks,
+                             size_t chunk_size);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
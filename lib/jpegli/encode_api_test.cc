@@ -183,6 +183,120 @@ TEST(EncodeAPITest, ReuseCinfoSameStdOutput) {
   }
 }
 
+TEST(EncodeAPITest, ChunkedMemOutput) {
+  std::vector<TestConfig> all_configs = GenerateBasicConfigs();
+  // The first chunks of the chain are owned by the test, the rest are
+  // allocated by the destination manager.
+  std::vector<uint8_t> data0(1000);
+  std::vector<uint8_t> data1(3000);
+  JpegliOutputChunk chunk1 = {data1.data(), data1.size(), 0, nullptr};
+  JpegliOutputChunk chunk0 = {data0.data(), data0.size(), 0, &chunk1};
+  JpegliOutputChunk* chunks = &chunk0;
+  for (const TestConfig& config : all_configs) {
+    std::vector<uint8_t> expected;
+    ASSERT_TRUE(EncodeWithJpegli(config.input, config.jparams, &expected));
+    jpeg_compress_struct cinfo;
+    const auto try_catch_block = [&]() -> bool {
+      ERROR_HANDLER_SETUP(jpegli);
+      jpegli_create_compress(&cinfo);
+      jpegli_chunked_mem_dest(&cinfo, &chunks, 5000);
+      EncodeWithJpegli(config.input, config.jparams, &cinfo);
+      return true;
+    };
+    EXPECT_TRUE(try_catch_block());
+    jpegli_destroy_compress(&cinfo);
+    std::vector<uint8_t> compressed;
+    for (JpegliOutputChunk* chunk = chunks; chunk; chunk = chunk->next) {
+      ASSERT_LE(chunk->used, chunk->size);
+      compressed.insert(compressed.end(), chunk->data,
+                        chunk->data + chunk->used);
+    }
+    EXPECT_EQ(expected, compressed);
+  }
+  EXPECT_EQ(data0.size(), chunk0.used);
+  JpegliOutputChunk* chunk = chunk1.next;
+  while (chunk) {
+    JpegliOutputChunk* next = chunk->next;
+    EXPECT_EQ(5000u, chunk->size);
+    free(chunk);
+    chunk = next;
+  }
+}
+
+TEST(EncodeAPITest, ParallelRunner) {
+  std::vector<TestConfig> all_configs = GenerateBasicConfigs();
+  for (const TestConfig& config : all_configs) {
+    std::vector<uint8_t> compressed[2];
+    for (int use_runner = 0; use_runner < 2; ++use_runner) {
+      uint8_t* buffer = nullptr;
+      unsigned long buffer_size = 0;  // NOLINT
+      jpeg_compress_struct cinfo;
+      const auto try_catch_block = [&]() -> bool {
+        ERROR_HANDLER_SETUP(jpegli);
+        jpegli_create_compress(&cinfo);
+        if (use_runner) {
+          jpegli_set_parallel_runner(&cinfo, TestParallelRunner, nullptr);
+        }
+        jpegli_mem_dest(&cinfo, &buffer, &buffer_size);
+        EncodeWithJpegli(config.input, config.jparams, &cinfo);
+        return true;
+      };
+      EXPECT_TRUE(try_catch_block());
+      jpegli_destroy_compress(&cinfo);
+      compressed[use_runner].assign(buffer, buffer + buffer_size);
+      if (buffer) free(buffer);
+    }
+    EXPECT_EQ(compressed[0], compressed[1]);
+  }
+}
+
+TEST(EncodeAPITest, HuffmanSampleRows) {
+  for (int samp : {1, 2}) {
+    TestConfig config;
+    config.input.xsize = 257;
+    config.input.ysize = 265;
+    config.jparams.h_sampling = {samp, 1, 1};
+    config.jparams.v_sampling = {samp, 1, 1};
+    config.jparams.optimize_coding = 1;
+    GeneratePixels(&config.input);
+    const int num_iMCU_rows = DivCeil(config.input.ysize, 8 * samp);
+    std::vector<uint8_t> expected;
+    TestImage expected_output;
+    for (int sample_rows : {0, 1, 3, num_iMCU_rows}) {
+      uint8_t* buffer = nullptr;
+      unsigned long buffer_size = 0;  // NOLINT
+      jpeg_compress_struct cinfo;
+      const auto try_catch_block = [&]() -> bool {
+        ERROR_HANDLER_SETUP(jpegli);
+        jpegli_create_compress(&cinfo);
+        jpegli_set_huffman_sample_rows(&cinfo, sample_rows);
+        jpegli_mem_dest(&cinfo, &buffer, &buffer_size);
+        EncodeWithJpegli(config.input, config.jparams, &cinfo);
+        return true;
+      };
+      EXPECT_TRUE(try_catch_block());
+      jpegli_destroy_compress(&cinfo);
+      std::vector<uint8_t> compressed(buffer, buffer + buffer_size);
+      if (buffer) free(buffer);
+      TestImage output;
+      DecodeWithLibjpeg(config.jparams, DecompressParams(), compressed,
+                        &output);
+      if (sample_rows == 0) {
+        expected = compressed;
+        expected_output = std::move(output);
+        continue;
+      }
+      // Only the Huffman codes depend on the sample.
+      VerifyOutputImage(expected_output, output, 0.0, 0.0);
+      if (sample_rows >= num_iMCU_rows) {
+        EXPECT_EQ(expected, compressed);
+      } else {
+        EXPECT_LT(compressed.size(), expected.size() * 1.1);
+      }
+    }
+  }
+}
+
 TEST(EncodeAPITest, ReuseCinfoChangeParams) {
   TestImage input;
   TestImage output;
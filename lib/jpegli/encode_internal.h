@@ -6,6 +6,7 @@
 #ifndef LIB_JPEGLI_ENCODE_INTERNAL_H_
 #define LIB_JPEGLI_ENCODE_INTERNAL_H_
 
+#include <jxl/parallel_runner.h>
 #include <stdint.h>
 
 #include "lib/jpegli/bit_writer.h"
@@ -83,6 +84,9 @@ struct jpeg_comp_master {
   void (*input_method)(const uint8_t* row_in, size_t len,
                        float* row_out[jpegli::kMaxComponents]);
   void (*color_transform)(float* row[jpegli::kMaxComponents], size_t len);
+  // The color transform that input_method applies, if any.
+  void (*fused_color_transform)(float* row[jpegli::kMaxComponents],
+                                size_t len);
   void (*downsample_method[jpegli::kMaxComponents])(
       float* rows_in[MAX_SAMP_FACTOR], size_t len, float* row_out);
   float* quant_mul[jpegli::kMaxComponents];
@@ -125,6 +129,22 @@ struct jpeg_comp_master {
   jpegli::JpegBitWriter bw;
   float* dct_buffer;
   int32_t* block_tmp;
+  // Optional runner for computing the coefficients of each iMCU row in
+  // parallel. If set, row_blocks and row_dc hold the quantized blocks and the
+  // unquantized DC values of the current iMCU row, and thread_dct_buffer has
+  // num_dct_buffers scratch buffers of the size of dct_buffer.
+  JxlParallelRunner runner;
+  void* runner_opaque;
+  int32_t* row_blocks;
+  float* row_dc;
+  float* thread_dct_buffer;
+  size_t num_dct_buffers;
+  // If positive, optimized Huffman codes of a streaming sequential image are
+  // built from the tokens of the first huffman_sample_rows iMCU rows, after
+  // which sampled_huffman_codes is set and the remaining rows are written
+  // directly to the output.
+  int huffman_sample_rows;
+  bool sampled_huffman_codes;
   jpegli::TokenArray* token_arrays;
   size_t cur_token_array;
   jpegli::Token* next_token;
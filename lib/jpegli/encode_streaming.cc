@@ -13,6 +13,7 @@
 #include "lib/jpegli/error.h"
 #include "lib/jpegli/memory_manager.h"
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/data_parallel.h"
 
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jpegli/encode_streaming.cc"
@@ -100,6 +101,73 @@ void ZigZagShuffle(int32_t* JXL_RESTRICT block) {
   tmp[63] = block[63];
   memcpy(block, tmp, DCTSIZE2 * sizeof(tmp[0]));
 }
+
+// Number of blocks of a block row that are computed by one parallel task.
+constexpr int kBlocksPerTask = 64;
+
+// Computes the AC coefficients and the unquantized DC values of all blocks of
+// the current iMCU row on the parallel runner. The blocks of component c are
+// stored in raster order starting at block_offset[c] in m->row_blocks and
+// m->row_dc. Blocks outside of the component are not computed.
+void ComputeACForiMCURow(j_compress_ptr cinfo, const float* const* imcu_start,
+                         const size_t* block_offset) {
+  jpeg_comp_master* m = cinfo->master;
+  const int xsize_mcus =
+      DivCeil(cinfo->image_width, 8 * cinfo->max_h_samp_factor);
+  const int mcu_y = m->next_iMCU_row;
+  const bool adaptive_quant =
+      m->use_adaptive_quantization && m->psnr_target == 0;
+  const float* qf = adaptive_quant ? m->quant_field.Row(0) : nullptr;
+  const size_t qf_stride = m->quant_field.stride();
+  // Each task is a range of kBlocksPerTask blocks of one block row of one
+  // component.
+  uint32_t tasks_per_row[kMaxComponents];
+  uint32_t num_tasks = 0;
+  for (int c = 0; c < cinfo->num_components; ++c) {
+    jpeg_component_info* comp = &cinfo->comp_info[c];
+    tasks_per_row[c] = DivCeil(comp->width_in_blocks, kBlocksPerTask);
+    num_tasks += tasks_per_row[c] * comp->v_samp_factor;
+  }
+  const auto init = [&](size_t num_threads) -> jxl::Status {
+    if (num_threads > m->num_dct_buffers) {
+      m->thread_dct_buffer = Allocate<float>(
+          cinfo, num_threads * 2 * DCTSIZE2, JPOOL_IMAGE_ALIGNED);
+      m->num_dct_buffers = num_threads;
+    }
+    return true;
+  };
+  const auto process_task = [&](uint32_t task, size_t thread) -> jxl::Status {
+    int c = 0;
+    while (task >= tasks_per_row[c] * cinfo->comp_info[c].v_samp_factor) {
+      task -= tasks_per_row[c] * cinfo->comp_info[c].v_samp_factor;
+      ++c;
+    }
+    jpeg_component_info* comp = &cinfo->comp_info[c];
+    const int iy = task / tasks_per_row[c];
+    const size_t by = mcu_y * comp->v_samp_factor + iy;
+    if (by >= comp->height_in_blocks) return true;
+    const size_t bx0 = (task % tasks_per_row[c]) * kBlocksPerTask;
+    const size_t bx1 =
+        std::min<size_t>(bx0 + kBlocksPerTask, comp->width_in_blocks);
+    const size_t blocks_per_row = xsize_mcus * comp->h_samp_factor;
+    const size_t stride = m->raw_data[c]->stride();
+    float* JXL_RESTRICT tmp = m->thread_dct_buffer + thread * 2 * DCTSIZE2;
+    for (size_t bx = bx0; bx < bx1; ++bx) {
+      const size_t idx = block_offset[c] + iy * blocks_per_row + bx;
+      const float aq_strength =
+          adaptive_quant ? qf[iy * qf_stride + bx * m->h_factor[c]] : 0.0f;
+      const float* pixels = imcu_start[c] + (iy * stride + bx) * DCTSIZE;
+      m->row_dc[idx] = ComputeACBlock(
+          pixels, stride, m->quant_mul[c], aq_strength, m->zero_bias_offset[c],
+          m->zero_bias_mul[c], tmp, m->row_blocks + idx * DCTSIZE2);
+    }
+    return true;
+  };
+  jxl::ThreadPool pool(m->runner, m->runner_opaque);
+  if (!pool.Run(0, num_tasks, init, process_task, "ComputeAC")) {
+    JPEGLI_ERROR("Parallel runner failed.");
+  }
+}
 }  // namespace
 
 template <int kMode>
@@ -147,6 +215,16 @@ void ProcessiMCURow(j_compress_ptr cinfo) {
     jpeg_component_info* comp = &cinfo->comp_info[c];
     imcu_start[c] = m->raw_data[c]->Row(mcu_y * comp->v_samp_factor * DCTSIZE);
   }
+  size_t block_offset[kMaxComponents];
+  if (m->runner) {
+    size_t offset = 0;
+    for (int c = 0; c < cinfo->num_components; ++c) {
+      jpeg_component_info* comp = &cinfo->comp_info[c];
+      block_offset[c] = offset;
+      offset += xsize_mcus * comp->h_samp_factor * comp->v_samp_factor;
+    }
+    ComputeACForiMCURow(cinfo, imcu_start, block_offset);
+  }
   const float* qf = nullptr;
   if (adaptive_quant) {
     qf = m->quant_field.Row(0);
@@ -184,10 +262,19 @@ void ProcessiMCURow(j_compress_ptr cinfo) {
           if (adaptive_quant) {
             aq_strength = qf[iy * qf_stride + bx * h_factor];
           }
-          const float* pixels = imcu_start[c] + (iy * stride + bx) * DCTSIZE;
-          ComputeCoefficientBlock(pixels, stride, qmc, last_dc_coeff[c],
-                                  aq_strength, zero_bias_offset, zero_bias_mul,
-                                  m->dct_buffer, block);
+          if (m->runner) {
+            const size_t idx = block_offset[c] +
+                               iy * xsize_mcus * comp->h_samp_factor + bx;
+            block = m->row_blocks + idx * DCTSIZE2;
+            QuantizeDC(m->row_dc[idx], last_dc_coeff[c], aq_strength,
+                       zero_bias_offset, zero_bias_mul, block);
+          } else {
+            const float* pixels =
+                imcu_start[c] + (iy * stride + bx) * DCTSIZE;
+            ComputeCoefficientBlock(pixels, stride, qmc, last_dc_coeff[c],
+                                    aq_strength, zero_bias_offset,
+                                    zero_bias_mul, m->dct_buffer, block);
+          }
           if (kMode == kStreamingModeCoefficients) {
             JCOEF* cblock = &blocks[c][iy][bx][0];
             for (int k = 0; k < DCTSIZE2; ++k) {
@@ -708,11 +708,28 @@ void CopyHuffmanTables(j_compress_ptr cinfo) {
   }
 }
 
-void OptimizeHuffmanCodes(j_compress_ptr cinfo) {
+void OptimizeHuffmanCodes(j_compress_ptr cinfo, bool code_all_symbols) {
   jpeg_comp_master* m = cinfo->master;
   // Build DC and AC histograms.
   std::vector<Histogram> histograms(m->num_contexts);
   BuildHistograms(cinfo, histograms.data());
+  if (code_all_symbols) {
+    for (int c = 0; c < cinfo->num_components; ++c) {
+      for (int s = 0; s < kJpegDCAlphabetSize; ++s) {
+        histograms[c].count[s] += 1;
+      }
+    }
+    for (size_t i = 4; i < m->num_contexts; ++i) {
+      // End of block, run of 16 zeros and all (run, size) pairs.
+      histograms[i].count[0x00] += 1;
+      histograms[i].count[0xf0] += 1;
+      for (int r = 0; r < 16; ++r) {
+        for (int s = 1; s < kJpegDCAlphabetSize; ++s) {
+          histograms[i].count[(r << 4) | s] += 1;
+        }
+      }
+    }
+  }
 
   // Cluster DC histograms.
   JpegClusteredHistograms dc_clusters;
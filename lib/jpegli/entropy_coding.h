@@ -19,7 +19,10 @@ void TokenizeJpeg(j_compress_ptr cinfo);
 
 void CopyHuffmanTables(j_compress_ptr cinfo);
 
-void OptimizeHuffmanCodes(j_compress_ptr cinfo);
+// Builds the Huffman codes from the tokens. If code_all_symbols is true, each
+// code contains all symbols that a sequential scan can use, even those that do
+// not occur in the tokens.
+void OptimizeHuffmanCodes(j_compress_ptr cinfo, bool code_all_symbols);
 
 void InitEntropyCoder(j_compress_ptr cinfo);
 
@@ -202,6 +202,11 @@ void InverseTransformBlock8x8(const int16_t* JXL_RESTRICT qblock,
 // array is at most 8 values long, values in[8:N-1] are assumed to be 0.
 void Compute1dIDCT(const float* in, float* out, size_t N) {
   switch (N) {
+    case 2: {
+      out[0] = in[0] + in[1];
+      out[1] = in[0] - in[1];
+      break;
+    }
     case 3: {
       static constexpr float kC3[3] = {
           1.414213562373,
@@ -216,6 +221,23 @@ void Compute1dIDCT(const float* in, float* out, size_t N) {
       out[1] = even1;
       break;
     }
+    case 4: {
+      static constexpr float kC4[4] = {
+          1.414213562373,
+          1.306562964876,
+          1.000000000000,
+          0.541196100146,
+      };
+      float even0 = in[0] + kC4[2] * in[2];
+      float even1 = in[0] - kC4[2] * in[2];
+      float odd0 = kC4[1] * in[1] + kC4[3] * in[3];
+      float odd1 = kC4[3] * in[1] - kC4[1] * in[3];
+      out[0] = even0 + odd0;
+      out[3] = even0 - odd0;
+      out[1] = even1 + odd1;
+      out[2] = even1 - odd1;
+      break;
+    }
     case 5: {
       static constexpr float kC5[5] = {
           1.414213562373, 1.344997023928, 1.144122805635,
@@ -625,50 +647,33 @@ void InverseTransformBlockGeneric(const int16_t* JXL_RESTRICT qblock,
                                   size_t output_stride, size_t dctsize) {
   float* JXL_RESTRICT block0 = scratch_space;
   float* JXL_RESTRICT block1 = scratch_space + DCTSIZE2;
-  DequantBlock(qblock, dequant, biases, block0);
   if (dctsize == 1) {
-    *output = *block0;
-  } else if (dctsize == 2 || dctsize == 4) {
-    float* JXL_RESTRICT block2 = scratch_space + 2 * DCTSIZE2;
-    ComputeScaledIDCT(block0, block1, block2, 8);
-    if (dctsize == 4) {
-      for (size_t iy = 0; iy < 4; ++iy) {
-        for (size_t ix = 0; ix < 4; ++ix) {
-          float* block = &block2[16 * iy + 2 * ix];
-          output[iy * output_stride + ix] =
-              0.25f * (block[0] + block[1] + block[8] + block[9]);
-        }
-      }
-    } else {
-      for (size_t iy = 0; iy < 2; ++iy) {
-        for (size_t ix = 0; ix < 2; ++ix) {
-          float* block = &block2[32 * iy + 4 * ix];
-          output[iy * output_stride + ix] =
-              0.0625f *
-              (block[0] + block[1] + block[2] + block[3] + block[8] + block[9] +
-               block[10] + block[11] + block[16] + block[17] + block[18] +
-               block[19] + block[24] + block[25] + block[26] + block[27]);
-        }
-      }
-    }
-  } else {
-    float dctin[DCTSIZE];
-    float dctout[DCTSIZE * 2];
-    size_t insize = std::min<size_t>(dctsize, DCTSIZE);
-    for (size_t ix = 0; ix < insize; ++ix) {
-      for (size_t iy = 0; iy < insize; ++iy) {
-        dctin[iy] = block0[iy * DCTSIZE + ix];
-      }
-      Compute1dIDCT(dctin, dctout, dctsize);
-      for (size_t iy = 0; iy < dctsize; ++iy) {
-        block1[iy * dctsize + ix] = dctout[iy];
-      }
+    // Only the DC coefficient contributes to the 1x1 output, dequantize it the
+    // same way as DequantBlock() does.
+    const float quant = qblock[0];
+    const float bias = quant < 0 ? -biases[0] : biases[0];
+    *output = quant == 0 ? 0.0f : (quant - bias) * dequant[0];
+    return;
+  }
+  DequantBlock(qblock, dequant, biases, block0);
+  // For dctsize < 8, this is a reduced size IDCT of the lowest frequency
+  // dctsize x dctsize coefficients.
+  float dctin[DCTSIZE];
+  float dctout[DCTSIZE * 2];
+  size_t insize = std::min<size_t>(dctsize, DCTSIZE);
+  for (size_t ix = 0; ix < insize; ++ix) {
+    for (size_t iy = 0; iy < insize; ++iy) {
+      dctin[iy] = block0[iy * DCTSIZE + ix];
     }
+    Compute1dIDCT(dctin, dctout, dctsize);
     for (size_t iy = 0; iy < dctsize; ++iy) {
-      Compute1dIDCT(block1 + iy * dctsize, output + iy * output_stride,
-                    dctsize);
+      block1[iy * dctsize + ix] = dctout[iy];
     }
   }
+  for (size_t iy = 0; iy < dctsize; ++iy) {
+    Compute1dIDCT(block1 + iy * dctsize, output + iy * output_stride,
+                  dctsize);
+  }
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -10,6 +10,8 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
+#include "lib/jpegli/color_transform-inl.h"
+#include "lib/jpegli/color_transform.h"
 #include "lib/jpegli/encode_internal.h"
 #include "lib/jpegli/error.h"
 #include "lib/jxl/base/byte_order.h"
@@ -19,8 +21,13 @@ HWY_BEFORE_NAMESPACE();
 namespace jpegli {
 namespace HWY_NAMESPACE {
 
+using hwy::HWY_NAMESPACE::And;
+using hwy::HWY_NAMESPACE::BitCast;
 using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::Or;
 using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::ShiftLeft;
+using hwy::HWY_NAMESPACE::ShiftRight;
 using hwy::HWY_NAMESPACE::Vec;
 
 using D = HWY_FULL(float);
@@ -209,24 +216,84 @@ void ReadUint16RowInterleaved4(const uint8_t* row_in, size_t len,
   ReadUint16Row<4>(row_in, simd_len, len, row_out);
 }
 
+// Byte-swapped 16-bit samples, scaled like the native ones.
+Vec<D> SwappedUint16ToFloat(Vec<DU16> v, Vec<D> mul) {
+  const Vec<DU16> swapped = Or(ShiftLeft<8>(v), ShiftRight<8>(v));
+  return Mul(mul, ConvertTo(d, PromoteTo(du, swapped)));
+}
+
 void ReadUint16RowSingleSwap(const uint8_t* row_in, size_t len,
                              float* row_out[kMaxComponents]) {
-  ReadUint16Row<1, true>(row_in, 0, len, row_out);
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMul16);
+  const uint16_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint16_t*>(row_in);
+  float* JXL_RESTRICT const row0 = row_out[0];
+  for (size_t x = 0; x < simd_len; x += N) {
+    Store(SwappedUint16ToFloat(LoadU(du16, row + x), mul), d, row0 + x);
+  }
+  ReadUint16Row<1, true>(row_in, simd_len, len, row_out);
 }
 
 void ReadUint16RowInterleaved2Swap(const uint8_t* row_in, size_t len,
                                    float* row_out[kMaxComponents]) {
-  ReadUint16Row<2, true>(row_in, 0, len, row_out);
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMul16);
+  const uint16_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint16_t*>(row_in);
+  float* JXL_RESTRICT const row0 = row_out[0];
+  float* JXL_RESTRICT const row1 = row_out[1];
+  Vec<DU16> out0, out1;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved2(du16, row + 2 * x, out0, out1);
+    Store(SwappedUint16ToFloat(out0, mul), d, row0 + x);
+    Store(SwappedUint16ToFloat(out1, mul), d, row1 + x);
+  }
+  ReadUint16Row<2, true>(row_in, simd_len, len, row_out);
 }
 
 void ReadUint16RowInterleaved3Swap(const uint8_t* row_in, size_t len,
                                    float* row_out[kMaxComponents]) {
-  ReadUint16Row<3, true>(row_in, 0, len, row_out);
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMul16);
+  const uint16_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint16_t*>(row_in);
+  float* JXL_RESTRICT const row0 = row_out[0];
+  float* JXL_RESTRICT const row1 = row_out[1];
+  float* JXL_RESTRICT const row2 = row_out[2];
+  Vec<DU16> out0, out1, out2;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved3(du16, row + 3 * x, out0, out1, out2);
+    Store(SwappedUint16ToFloat(out0, mul), d, row0 + x);
+    Store(SwappedUint16ToFloat(out1, mul), d, row1 + x);
+    Store(SwappedUint16ToFloat(out2, mul), d, row2 + x);
+  }
+  ReadUint16Row<3, true>(row_in, simd_len, len, row_out);
 }
 
 void ReadUint16RowInterleaved4Swap(const uint8_t* row_in, size_t len,
                                    float* row_out[kMaxComponents]) {
-  ReadUint16Row<4, true>(row_in, 0, len, row_out);
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMul16);
+  const uint16_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint16_t*>(row_in);
+  float* JXL_RESTRICT const row0 = row_out[0];
+  float* JXL_RESTRICT const row1 = row_out[1];
+  float* JXL_RESTRICT const row2 = row_out[2];
+  float* JXL_RESTRICT const row3 = row_out[3];
+  Vec<DU16> out0, out1, out2, out3;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved4(du16, row + 4 * x, out0, out1, out2, out3);
+    Store(SwappedUint16ToFloat(out0, mul), d, row0 + x);
+    Store(SwappedUint16ToFloat(out1, mul), d, row1 + x);
+    Store(SwappedUint16ToFloat(out2, mul), d, row2 + x);
+    Store(SwappedUint16ToFloat(out3, mul), d, row3 + x);
+  }
+  ReadUint16Row<4, true>(row_in, simd_len, len, row_out);
 }
 
 void ReadFloatRowSingle(const uint8_t* row_in, size_t len,
@@ -299,24 +366,195 @@ void ReadFloatRowInterleaved4(const uint8_t* row_in, size_t len,
   ReadFloatRow<4>(row_in, simd_len, len, row_out);
 }
 
+// Byte-swapped float samples, scaled like the native ones.
+Vec<D> SwappedFloat(Vec<DU> v, Vec<D> mul) {
+  const Vec<DU> swapped =
+      Or(Or(ShiftLeft<24>(v), ShiftRight<24>(v)),
+         Or(And(ShiftLeft<8>(v), Set(du, 0x00FF0000u)),
+            And(ShiftRight<8>(v), Set(du, 0x0000FF00u))));
+  return Mul(mul, BitCast(d, swapped));
+}
+
 void ReadFloatRowSingleSwap(const uint8_t* row_in, size_t len,
                             float* row_out[kMaxComponents]) {
-  ReadFloatRow<1, true>(row_in, 0, len, row_out);
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMulFloat);
+  const uint32_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint32_t*>(row_in);
+  float* JXL_RESTRICT const row0 = row_out[0];
+  for (size_t x = 0; x < simd_len; x += N) {
+    Store(SwappedFloat(LoadU(du, row + x), mul), d, row0 + x);
+  }
+  ReadFloatRow<1, true>(row_in, simd_len, len, row_out);
 }
 
 void ReadFloatRowInterleaved2Swap(const uint8_t* row_in, size_t len,
                                   float* row_out[kMaxComponents]) {
-  ReadFloatRow<2, true>(row_in, 0, len, row_out);
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMulFloat);
+  const uint32_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint32_t*>(row_in);
+  float* JXL_RESTRICT const row0 = row_out[0];
+  float* JXL_RESTRICT const row1 = row_out[1];
+  Vec<DU> out0, out1;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved2(du, row + 2 * x, out0, out1);
+    Store(SwappedFloat(out0, mul), d, row0 + x);
+    Store(SwappedFloat(out1, mul), d, row1 + x);
+  }
+  ReadFloatRow<2, true>(row_in, simd_len, len, row_out);
 }
 
 void ReadFloatRowInterleaved3Swap(const uint8_t* row_in, size_t len,
                                   float* row_out[kMaxComponents]) {
-  ReadFloatRow<3, true>(row_in, 0, len, row_out);
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMulFloat);
+  const uint32_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint32_t*>(row_in);
+  float* JXL_RESTRICT const row0 = row_out[0];
+  float* JXL_RESTRICT const row1 = row_out[1];
+  float* JXL_RESTRICT const row2 = row_out[2];
+  Vec<DU> out0, out1, out2;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved3(du, row + 3 * x, out0, out1, out2);
+    Store(SwappedFloat(out0, mul), d, row0 + x);
+    Store(SwappedFloat(out1, mul), d, row1 + x);
+    Store(SwappedFloat(out2, mul), d, row2 + x);
+  }
+  ReadFloatRow<3, true>(row_in, simd_len, len, row_out);
 }
 
 void ReadFloatRowInterleaved4Swap(const uint8_t* row_in, size_t len,
                                   float* row_out[kMaxComponents]) {
-  ReadFloatRow<4, true>(row_in, 0, len, row_out);
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMulFloat);
+  const uint32_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint32_t*>(row_in);
+  float* JXL_RESTRICT const row0 = row_out[0];
+  float* JXL_RESTRICT const row1 = row_out[1];
+  float* JXL_RESTRICT const row2 = row_out[2];
+  float* JXL_RESTRICT const row3 = row_out[3];
+  Vec<DU> out0, out1, out2, out3;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved4(du, row + 4 * x, out0, out1, out2, out3);
+    Store(SwappedFloat(out0, mul), d, row0 + x);
+    Store(SwappedFloat(out1, mul), d, row1 + x);
+    Store(SwappedFloat(out2, mul), d, row2 + x);
+    Store(SwappedFloat(out3, mul), d, row3 + x);
+  }
+  ReadFloatRow<4, true>(row_in, simd_len, len, row_out);
+}
+
+// The readers below convert interleaved RGB samples to YCbCr as they read
+// them, replacing the separate RGBToYCbCr color transform pass.
+
+void StoreYCbCr(Vec<D> r, Vec<D> g, Vec<D> b, size_t x,
+                float* row_out[kMaxComponents]) {
+  Vec<D> y, cb, cr;  // NOLINT
+  RGBToYCbCrVec(d, r, g, b, &y, &cb, &cr);
+  Store(y, d, row_out[0] + x);
+  Store(cb, d, row_out[1] + x);
+  Store(cr, d, row_out[2] + x);
+}
+
+// Converts the RGB samples that the scalar readers wrote to [x0, len) of the
+// rows to YCbCr.
+void RGBToYCbCrTail(size_t x0, size_t len, float* row_out[kMaxComponents]) {
+  const HWY_CAPPED(float, 1) d1;
+  Vec<decltype(d1)> y, cb, cr;  // NOLINT
+  for (size_t x = x0; x < len; ++x) {
+    RGBToYCbCrVec(d1, LoadU(d1, row_out[0] + x), LoadU(d1, row_out[1] + x),
+                  LoadU(d1, row_out[2] + x), &y, &cb, &cr);
+    StoreU(y, d1, row_out[0] + x);
+    StoreU(cb, d1, row_out[1] + x);
+    StoreU(cr, d1, row_out[2] + x);
+  }
+}
+
+void ReadUint8RowRGBToYCbCr(const uint8_t* row_in, size_t len,
+                            float* row_out[kMaxComponents]) {
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  Vec<DU8> out0, out1, out2;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved3(du8, row_in + 3 * x, out0, out1, out2);
+    StoreYCbCr(ConvertTo(d, PromoteTo(du, out0)),
+               ConvertTo(d, PromoteTo(du, out1)),
+               ConvertTo(d, PromoteTo(du, out2)), x, row_out);
+  }
+  ReadUint8Row<3>(row_in, simd_len, len, row_out);
+  RGBToYCbCrTail(simd_len, len, row_out);
+}
+
+void ReadUint16RowRGBToYCbCr(const uint8_t* row_in, size_t len,
+                             float* row_out[kMaxComponents]) {
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMul16);
+  const uint16_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint16_t*>(row_in);
+  Vec<DU16> out0, out1, out2;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved3(du16, row + 3 * x, out0, out1, out2);
+    StoreYCbCr(Mul(mul, ConvertTo(d, PromoteTo(du, out0))),
+               Mul(mul, ConvertTo(d, PromoteTo(du, out1))),
+               Mul(mul, ConvertTo(d, PromoteTo(du, out2))), x, row_out);
+  }
+  ReadUint16Row<3>(row_in, simd_len, len, row_out);
+  RGBToYCbCrTail(simd_len, len, row_out);
+}
+
+void ReadUint16RowRGBToYCbCrSwap(const uint8_t* row_in, size_t len,
+                                 float* row_out[kMaxComponents]) {
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMul16);
+  const uint16_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint16_t*>(row_in);
+  Vec<DU16> out0, out1, out2;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved3(du16, row + 3 * x, out0, out1, out2);
+    StoreYCbCr(SwappedUint16ToFloat(out0, mul), SwappedUint16ToFloat(out1, mul),
+               SwappedUint16ToFloat(out2, mul), x, row_out);
+  }
+  ReadUint16Row<3, true>(row_in, simd_len, len, row_out);
+  RGBToYCbCrTail(simd_len, len, row_out);
+}
+
+void ReadFloatRowRGBToYCbCr(const uint8_t* row_in, size_t len,
+                            float* row_out[kMaxComponents]) {
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMulFloat);
+  const float* JXL_RESTRICT const row = reinterpret_cast<const float*>(row_in);
+  Vec<D> out0, out1, out2;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved3(d, row + 3 * x, out0, out1, out2);
+    StoreYCbCr(Mul(mul, out0), Mul(mul, out1), Mul(mul, out2), x, row_out);
+  }
+  ReadFloatRow<3>(row_in, simd_len, len, row_out);
+  RGBToYCbCrTail(simd_len, len, row_out);
+}
+
+void ReadFloatRowRGBToYCbCrSwap(const uint8_t* row_in, size_t len,
+                                float* row_out[kMaxComponents]) {
+  const size_t N = Lanes(d);
+  const size_t simd_len = len & (~(N - 1));
+  const auto mul = Set(d, kMulFloat);
+  const uint32_t* JXL_RESTRICT const row =
+      reinterpret_cast<const uint32_t*>(row_in);
+  Vec<DU> out0, out1, out2;  // NOLINT
+  for (size_t x = 0; x < simd_len; x += N) {
+    LoadInterleaved3(du, row + 3 * x, out0, out1, out2);
+    StoreYCbCr(SwappedFloat(out0, mul), SwappedFloat(out1, mul),
+               SwappedFloat(out2, mul), x, row_out);
+  }
+  ReadFloatRow<3, true>(row_in, simd_len, len, row_out);
+  RGBToYCbCrTail(simd_len, len, row_out);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -347,12 +585,21 @@ HWY_EXPORT(ReadFloatRowSingleSwap);
 HWY_EXPORT(ReadFloatRowInterleaved2Swap);
 HWY_EXPORT(ReadFloatRowInterleaved3Swap);
 HWY_EXPORT(ReadFloatRowInterleaved4Swap);
+HWY_EXPORT(ReadUint8RowRGBToYCbCr);
+HWY_EXPORT(ReadUint16RowRGBToYCbCr);
+HWY_EXPORT(ReadUint16RowRGBToYCbCrSwap);
+HWY_EXPORT(ReadFloatRowRGBToYCbCr);
+HWY_EXPORT(ReadFloatRowRGBToYCbCrSwap);
+
+bool SwapEndianness(j_compress_ptr cinfo) {
+  jpeg_comp_master* m = cinfo->master;
+  return (m->endianness == JPEGLI_LITTLE_ENDIAN && !IsLittleEndian()) ||
+         (m->endianness == JPEGLI_BIG_ENDIAN && IsLittleEndian());
+}
 
 void ChooseInputMethod(j_compress_ptr cinfo) {
   jpeg_comp_master* m = cinfo->master;
-  bool swap_endianness =
-      (m->endianness == JPEGLI_LITTLE_ENDIAN && !IsLittleEndian()) ||
-      (m->endianness == JPEGLI_BIG_ENDIAN && IsLittleEndian());
+  bool swap_endianness = SwapEndianness(cinfo);
   m->input_method = nullptr;
   if (m->data_type == JPEGLI_TYPE_UINT8) {
     if (cinfo->raw_data_in || cinfo->input_components == 1) {
@@ -410,5 +657,37 @@ void ChooseInputMethod(j_compress_ptr cinfo) {
   }
 }
 
+void ChooseFusedInputMethod(j_compress_ptr cinfo) {
+  jpeg_comp_master* m = cinfo->master;
+  m->fused_color_transform = nullptr;
+  bool rgb_input = cinfo->in_color_space == JCS_RGB;
+#ifdef JCS_EXTENSIONS
+  rgb_input |= cinfo->in_color_space == JCS_EXT_RGB;
+#endif
+  if (cinfo->raw_data_in || cinfo->input_components != 3 || !rgb_input ||
+      m->xyb_mode ||
+      (cinfo->jpeg_color_space != JCS_YCbCr &&
+       cinfo->jpeg_color_space != JCS_GRAYSCALE)) {
+    return;
+  }
+  bool swap_endianness = SwapEndianness(cinfo);
+  if (m->data_type == JPEGLI_TYPE_UINT8) {
+    m->input_method = HWY_DYNAMIC_DISPATCH(ReadUint8RowRGBToYCbCr);
+  } else if (m->data_type == JPEGLI_TYPE_UINT16 && !swap_endianness) {
+    m->input_method = HWY_DYNAMIC_DISPATCH(ReadUint16RowRGBToYCbCr);
+  } else if (m->data_type == JPEGLI_TYPE_UINT16 && swap_endianness) {
+    m->input_method = HWY_DYNAMIC_DISPATCH(ReadUint16RowRGBToYCbCrSwap);
+  } else if (m->data_type == JPEGLI_TYPE_FLOAT && !swap_endianness) {
+    m->input_method = HWY_DYNAMIC_DISPATCH(ReadFloatRowRGBToYCbCr);
+  } else if (m->data_type == JPEGLI_TYPE_FLOAT && swap_endianness) {
+    m->input_method = HWY_DYNAMIC_DISPATCH(ReadFloatRowRGBToYCbCrSwap);
+  } else {
+    return;
+  }
+  // Missing input rows still need the transform.
+  m->fused_color_transform = m->color_transform;
+  m->color_transform = NullTransform;
+}
+
 }  // namespace jpegli
 #endif  // HWY_ONCE
@@ -12,6 +12,11 @@ namespace jpegli {
 
 void ChooseInputMethod(j_compress_ptr cinfo);
 
+// Replaces the input method and the color transform chosen by
+// ChooseInputMethod() and ChooseColorTransform() with a reader that converts
+// RGB input to YCbCr as it reads it, if the input allows it.
+void ChooseFusedInputMethod(j_compress_ptr cinfo);
+
 }  // namespace jpegli
 
 #endif  // LIB_JPEGLI_INPUT_H_
@@ -5,12 +5,14 @@
 
 #include "lib/jpegli/render.h"
 
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <hwy/aligned_allocator.h>
+#include <limits>
 #include <vector>
 
 #include "lib/jpegli/color_quantize.h"
@@ -18,9 +20,11 @@
 #include "lib/jpegli/decode_internal.h"
 #include "lib/jpegli/error.h"
 #include "lib/jpegli/idct.h"
+#include "lib/jpegli/memory_manager.h"
 #include "lib/jpegli/upsample.h"
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 
 #ifdef MEMORY_SANITIZER
 #define JXL_MEMORY_SANITIZER 1
@@ -50,14 +54,19 @@ namespace HWY_NAMESPACE {
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Abs;
 using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::And;
 using hwy::HWY_NAMESPACE::Clamp;
 using hwy::HWY_NAMESPACE::Gt;
 using hwy::HWY_NAMESPACE::IfThenElseZero;
+using hwy::HWY_NAMESPACE::Min;
+using hwy::HWY_NAMESPACE::MinOfLanes;
 using hwy::HWY_NAMESPACE::Mul;
 using hwy::HWY_NAMESPACE::NearestInt;
 using hwy::HWY_NAMESPACE::Or;
 using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::ShiftLeft;
 using hwy::HWY_NAMESPACE::ShiftLeftSame;
+using hwy::HWY_NAMESPACE::ShiftRight;
 using hwy::HWY_NAMESPACE::ShiftRightSame;
 using hwy::HWY_NAMESPACE::Vec;
 using D = HWY_FULL(float);
@@ -94,11 +103,58 @@ void DitherRow(j_decompress_ptr cinfo, float* row, int c, size_t y,
   if (!m->dither_[c]) return;
   const float* dither_row =
       &m->dither_[c][(y & m->dither_mask_) * m->dither_size_];
-  for (size_t x = 0; x < xsize; ++x) {
+  const HWY_CAPPED(float, 8) df;
+  // The dither row repeated, so that a vector can be loaded at any offset
+  // within the dither period.
+  HWY_ALIGN float pattern[16];
+  JPEGLI_CHECK(m->dither_size_ <= 8);
+  for (size_t k = 0; k < 16; ++k) {
+    pattern[k] = dither_row[k & m->dither_mask_];
+  }
+  size_t x = 0;
+  for (; x + Lanes(df) <= xsize; x += Lanes(df)) {
+    const auto dither = LoadU(df, pattern + (x & m->dither_mask_));
+    StoreU(Add(LoadU(df, row + x), dither), df, row + x);
+  }
+  for (; x < xsize; ++x) {
     row[x] += dither_row[x & m->dither_mask_];
   }
 }
 
+// Same as LookupColorIndex, but computes the distances to the candidate colors
+// of the inverse colormap cell of the pixel in parallel. Ties are resolved in
+// favour of the first candidate, like in the scalar version.
+int LookupColorIndexSIMD(j_decompress_ptr cinfo, const JSAMPLE* pixel) {
+  jpeg_decomp_master* m = cinfo->master;
+  if (m->quant_mode_ != 2) return LookupColorIndex(cinfo, pixel);
+  const int num_channels = cinfo->out_color_components;
+  size_t cell_idx = ColorCellIndex(cinfo, pixel);
+  JPEGLI_CHECK(cell_idx < m->candidate_colors_.size());
+  const std::vector<uint8_t>& candidates = m->candidate_lists_[cell_idx];
+  if (candidates.empty()) return 0;
+  const int32_t* colors = m->candidate_colors_[cell_idx].data();
+  const size_t stride = m->candidate_colors_[cell_idx].size() / num_channels;
+  const HWY_CAPPED(int32_t, 8) di;
+  HWY_ALIGN int32_t dist[256];
+  auto mindist = Set(di, std::numeric_limits<int32_t>::max());
+  for (size_t k = 0; k < stride; k += Lanes(di)) {
+    auto d = Zero(di);
+    for (int c = 0; c < num_channels; ++c) {
+      const auto color = LoadU(di, colors + c * stride + k);
+      const auto diff = Sub(color, Set(di, pixel[c] * kCompW[c]));
+      d = Add(d, Mul(diff, diff));
+    }
+    mindist = Min(mindist, d);
+    Store(d, di, dist + k);
+  }
+  const int32_t best = GetLane(MinOfLanes(di, mindist));
+  size_t i = 0;
+  while (dist[i] != best) ++i;
+  int index = candidates[i];
+  JPEGLI_CHECK(index < cinfo->actual_number_of_colors);
+  return index;
+}
+
 template <typename T>
 void StoreUnsignedRow(float* JXL_RESTRICT input[], size_t x0, size_t len,
                       size_t num_channels, float multiplier, T* output) {
@@ -230,7 +286,7 @@ void WriteToOutput(j_decompress_ptr cinfo, float* JXL_RESTRICT rows[],
           pixel[c] = std::round(std::min(255.0f, std::max(0.0f, val)));
         }
       }
-      int index = LookupColorIndex(cinfo, pixel);
+      int index = LookupColorIndexSIMD(cinfo, pixel);
       output[i] = index;
       if (dither_mode == JDITHER_FS) {
         size_t prev_i = i > 0 ? i - 1 : 0;
@@ -266,9 +322,16 @@ void WriteToOutput(j_decompress_ptr cinfo, float* JXL_RESTRICT rows[],
     float* tmp = reinterpret_cast<float*>(scratch_space);
     StoreFloatRow(rows, xoffset, len, num_channels, tmp);
     if (m->swap_endianness_) {
+      const HWY_CAPPED(uint32_t, 8) du;
+      const auto mask = Set(du, 0xFF00u);
+      uint32_t* tmp32 = reinterpret_cast<uint32_t*>(tmp);
       size_t output_len = len * num_channels;
-      for (size_t j = 0; j < output_len; ++j) {
-        tmp[j] = BSwapFloat(tmp[j]);
+      for (size_t j = 0; j < output_len; j += Lanes(du)) {
+        auto v = LoadU(du, tmp32 + j);
+        auto vswap = Or(Or(ShiftLeft<24>(v), ShiftRight<24>(v)),
+                        Or(ShiftLeft<8>(And(v, mask)),
+                           And(ShiftRight<8>(v), mask)));
+        StoreU(vswap, du, tmp32 + j);
       }
     }
     memcpy(output, tmp, len * num_channels * 4);
@@ -388,9 +451,8 @@ bool do_smoothing(j_decompress_ptr cinfo) {
 }
 
 void PredictSmooth(j_decompress_ptr cinfo, JBLOCKARRAY blocks, int component,
-                   size_t bx, int iy) {
+                   size_t bx, int iy, int16_t* scratch) {
   const size_t imcu_row = cinfo->output_iMCU_row;
-  int16_t* scratch = cinfo->master->smoothing_scratch_;
   std::vector<int> Q_VAL(SAVED_COEFS);
   int* coef_bits;
 
@@ -608,33 +670,87 @@ void DecodeCurrentiMCURow(j_decompress_ptr cinfo) {
                                       &m->biases_[k0]);
       }
     }
+  }
+  // Transforms the blocks [bx0, bx1) of the block row iy of component c.
+  const auto transform_blocks = [&](int c, int iy, size_t bx0, size_t bx1,
+                                    float* idct_scratch,
+                                    int16_t* smoothing_scratch) {
+    size_t k0 = c * DCTSIZE2;
+    auto& compinfo = cinfo->comp_info[c];
+    size_t by = imcu_row * compinfo.v_samp_factor + iy;
+    if (by >= compinfo.height_in_blocks) {
+      return;
+    }
     RowBuffer<float>* raw_out = &m->raw_output_[c];
-    for (int iy = 0; iy < compinfo.v_samp_factor; ++iy) {
-      size_t by = block_row + iy;
-      if (by >= compinfo.height_in_blocks) {
-        continue;
-      }
-      size_t dctsize = m->scaled_dct_size[c];
-      int16_t* JXL_RESTRICT row_in = &blocks[c][iy][0][0];
-      float* JXL_RESTRICT row_out = raw_out->Row(by * dctsize);
-      for (size_t bx = 0; bx < compinfo.width_in_blocks; ++bx) {
-        if (m->apply_smoothing) {
-          PredictSmooth(cinfo, blocks[c], c, bx, iy);
-          (*m->inverse_transform[c])(m->smoothing_scratch_, &m->dequant_[k0],
-                                     &m->biases_[k0], m->idct_scratch_,
-                                     &row_out[bx * dctsize], raw_out->stride(),
-                                     dctsize);
-        } else {
-          (*m->inverse_transform[c])(&row_in[bx * DCTSIZE2], &m->dequant_[k0],
-                                     &m->biases_[k0], m->idct_scratch_,
-                                     &row_out[bx * dctsize], raw_out->stride(),
-                                     dctsize);
-        }
+    size_t dctsize = m->scaled_dct_size[c];
+    int16_t* JXL_RESTRICT row_in = &blocks[c][iy][0][0];
+    float* JXL_RESTRICT row_out = raw_out->Row(by * dctsize);
+    for (size_t bx = bx0; bx < bx1; ++bx) {
+      if (m->apply_smoothing) {
+        PredictSmooth(cinfo, blocks[c], c, bx, iy, smoothing_scratch);
+        (*m->inverse_transform[c])(smoothing_scratch, &m->dequant_[k0],
+                                   &m->biases_[k0], idct_scratch,
+                                   &row_out[bx * dctsize], raw_out->stride(),
+                                   dctsize);
+      } else {
+        (*m->inverse_transform[c])(&row_in[bx * DCTSIZE2], &m->dequant_[k0],
+                                   &m->biases_[k0], idct_scratch,
+                                   &row_out[bx * dctsize], raw_out->stride(),
+                                   dctsize);
       }
-      if (m->streaming_mode_) {
-        memset(row_in, 0, compinfo.width_in_blocks * sizeof(JBLOCK));
+    }
+    if (m->streaming_mode_) {
+      memset(&row_in[bx0 * DCTSIZE2], 0, (bx1 - bx0) * sizeof(JBLOCK));
+    }
+  };
+  if (!m->runner_) {
+    for (int c = 0; c < cinfo->num_components; ++c) {
+      for (int iy = 0; iy < cinfo->comp_info[c].v_samp_factor; ++iy) {
+        transform_blocks(c, iy, 0, cinfo->comp_info[c].width_in_blocks,
+                         m->idct_scratch_, m->smoothing_scratch_);
       }
     }
+    return;
+  }
+  // Each task is a range of kBlocksPerTask blocks of one block row of one
+  // component. Smoothing, which reads the neighbouring blocks, is only done
+  // for progressive images, which are never decoded in streaming mode, so the
+  // blocks are not cleared while they are read by other tasks.
+  constexpr size_t kBlocksPerTask = 64;
+  uint32_t tasks_per_row[kMaxComponents];
+  uint32_t num_tasks = 0;
+  for (int c = 0; c < cinfo->num_components; ++c) {
+    const jpeg_component_info* comp = &cinfo->comp_info[c];
+    tasks_per_row[c] = DivCeil(comp->width_in_blocks, kBlocksPerTask);
+    num_tasks += tasks_per_row[c] * comp->v_samp_factor;
+  }
+  const auto init = [&](size_t num_threads) -> jxl::Status {
+    if (num_threads > m->num_thread_scratch_) {
+      m->thread_idct_scratch_ = Allocate<float>(
+          cinfo, num_threads * 5 * DCTSIZE2, JPOOL_IMAGE_ALIGNED);
+      m->thread_smoothing_scratch_ =
+          Allocate<int16_t>(cinfo, num_threads * DCTSIZE2, JPOOL_IMAGE_ALIGNED);
+      m->num_thread_scratch_ = num_threads;
+    }
+    return true;
+  };
+  const auto process_task = [&](uint32_t task, size_t thread) -> jxl::Status {
+    int c = 0;
+    while (task >= tasks_per_row[c] * cinfo->comp_info[c].v_samp_factor) {
+      task -= tasks_per_row[c] * cinfo->comp_info[c].v_samp_factor;
+      ++c;
+    }
+    const size_t bx0 = (task % tasks_per_row[c]) * kBlocksPerTask;
+    const size_t bx1 = std::min<size_t>(bx0 + kBlocksPerTask,
+                                        cinfo->comp_info[c].width_in_blocks);
+    transform_blocks(c, task / tasks_per_row[c], bx0, bx1,
+                     m->thread_idct_scratch_ + thread * 5 * DCTSIZE2,
+                     m->thread_smoothing_scratch_ + thread * DCTSIZE2);
+    return true;
+  };
+  jxl::ThreadPool pool(m->runner_, m->runner_opaque_);
+  if (!pool.Run(0, num_tasks, init, process_task, "InverseTransform")) {
+    JPEGLI_ERROR("Parallel runner failed.");
   }
 }
 
@@ -735,13 +851,18 @@ void ProcessOutput(j_decompress_ptr cinfo, size_t* num_output_rows,
           rows[c] = m->render_output_[c].Row(yix);
         }
         (*m->color_transform)(rows, output_width);
-        for (int c = 0; c < cinfo->out_color_components; ++c) {
+        for (int c = 0; c < m->num_transformed_rows_; ++c) {
           // Undo the centering of the sample values around zero.
           DecenterRow(rows[c], output_width);
         }
         if (scanlines) {
+          float* channels[kMaxComponents];
+          for (int c = 0; c < cinfo->out_color_components; ++c) {
+            const int row = m->output_channel_row_[c];
+            channels[c] = row < 0 ? m->opaque_row_ : rows[row];
+          }
           uint8_t* output = scanlines[*num_output_rows];
-          WriteToOutput(cinfo, rows, m->xoffset_, cinfo->output_width,
+          WriteToOutput(cinfo, channels, m->xoffset_, cinfo->output_width,
                         cinfo->out_color_components, output);
         }
         JPEGLI_CHECK(cinfo->output_scanline == y + yix);
@@ -5,11 +5,14 @@
 
 #include "lib/jpegli/test_utils.h"
 
+#include <atomic>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 #include "lib/jpegli/decode.h"
 #include "lib/jpegli/encode.h"
@@ -864,4 +867,25 @@ void VerifyOutputImage(const TestImage& input, const TestImage& output,
   }
 }
 
+JxlParallelRetCode TestParallelRunner(void* runner_opaque, void* jpegxl_opaque,
+                                      JxlParallelRunInit init,
+                                      JxlParallelRunFunction func,
+                                      uint32_t start_range,
+                                      uint32_t end_range) {
+  constexpr size_t kNumThreads = 4;
+  JxlParallelRetCode ret = init(jpegxl_opaque, kNumThreads);
+  if (ret != JXL_PARALLEL_RET_SUCCESS) return ret;
+  std::atomic<uint32_t> next_task{start_range};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (uint32_t task = next_task++; task < end_range; task = next_task++) {
+        func(jpegxl_opaque, task, t);
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  return JXL_PARALLEL_RET_SUCCESS;
+}
+
 }  // namespace jpegli
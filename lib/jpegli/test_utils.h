@@ -6,6 +6,8 @@
 #ifndef LIB_JPEGLI_TEST_UTILS_H_
 #define LIB_JPEGLI_TEST_UTILS_H_
 
+#include <jxl/parallel_runner.h>
+
 #include <cstddef>
 #include <cstdint>
 #include <string>
@@ -118,6 +120,14 @@ void VerifyOutputImage(const TestImage& input, const TestImage& output,
 void VerifyOutputImage(const TestImage& input, const TestImage& output,
                        double max_rms, double max_diff = 255.0);
 
+// Parallel runner that runs the tasks on four threads, which take the next
+// task in turn.
+JxlParallelRetCode TestParallelRunner(void* runner_opaque, void* jpegxl_opaque,
+                                      JxlParallelRunInit init,
+                                      JxlParallelRunFunction func,
+                                      uint32_t start_range,
+                                      uint32_t end_range);
+
 }  // namespace jpegli
 
 #endif  // LIB_JPEGLI_TEST_UTILS_H_
@@ -260,6 +260,14 @@ class AcStrategyImage {
 
   JxlMemoryManager* memory_manager() const { return layers_.memory_manager(); }
 
+  // Used by ReuseOrCreate(); rows keep their position in the storage.
+  bool CanShrinkTo(size_t xsize, size_t ysize) const {
+    return layers_.CanShrinkTo(xsize, ysize);
+  }
+  Status ShrinkTo(size_t xsize, size_t ysize) {
+    return layers_.ShrinkTo(xsize, ysize);
+  }
+
  private:
   ImageB layers_;
   uint8_t* JXL_RESTRICT row_;
@@ -5,6 +5,7 @@
 
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <vector>
@@ -12,11 +13,14 @@
 #include "lib/jxl/ans_params.h"
 #include "lib/jxl/base/random.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/common.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/dec_bit_reader.h"
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/enc_cluster.h"
+#include "lib/jxl/enc_context_map.h"
 #include "lib/jxl/test_memory_manager.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
@@ -25,7 +29,8 @@ namespace jxl {
 namespace {
 
 void RoundtripTestcase(int n_histograms, int alphabet_size,
-                       const std::vector<Token>& input_values) {
+                       const std::vector<Token>& input_values,
+                       ThreadPool* pool = nullptr) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
   constexpr uint16_t kMagic1 = 0x9e33;
   constexpr uint16_t kMagic2 = 0x8b04;
@@ -67,7 +72,8 @@ void RoundtripTestcase(int n_histograms, int alphabet_size,
   std::vector<uint8_t> dec_context_map;
   ANSCode decoded_codes;
   ASSERT_TRUE(DecodeHistograms(memory_manager, &br, n_histograms,
-                               &decoded_codes, &dec_context_map));
+                               &decoded_codes, &dec_context_map,
+                               /*disallow_lz77=*/false, pool));
   ASSERT_EQ(dec_context_map, context_map);
   JXL_TEST_ASSIGN_OR_DIE(ANSSymbolReader reader,
                          ANSSymbolReader::Create(&decoded_codes, &br));
@@ -168,6 +174,22 @@ TEST(ANSTest, RandomUnbalancedStreamRoundtripBig) {
   RoundtripRandomUnbalancedStream(ANS_MAX_ALPHABET_SIZE);
 }
 
+TEST(ANSTest, ManyHistogramsRoundtripWithPool) {
+  // Different ranges of values, so that enough histograms remain after
+  // clustering for their alias tables to be built on the pool.
+  constexpr int kNumHistograms = 64;
+  Rng rng(0);
+  std::vector<Token> symbols;
+  for (int j = 0; j < 1 << 16; j++) {
+    int context = rng.UniformI(0, kNumHistograms);
+    int value = context * 4 + rng.UniformU(0, 4);
+    symbols.emplace_back(context, value);
+  }
+  test::ThreadPoolForTests pool(4);
+  RoundtripTestcase(kNumHistograms, ANS_MAX_ALPHABET_SIZE, symbols,
+                    pool.get());
+}
+
 TEST(ANSTest, UintConfigRoundtrip) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
   for (size_t log_alpha_size = 5; log_alpha_size <= 8; log_alpha_size++) {
@@ -199,7 +221,7 @@ TEST(ANSTest, UintConfigRoundtrip) {
   }
 }
 
-void TestCheckpointing(bool ans, bool lz77) {
+void TestCheckpointing(bool ans, HistogramParams::LZ77Method lz77_method) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
   std::vector<std::vector<Token>> input_values(1);
   for (size_t i = 0; i < 1024; i++) {
@@ -218,8 +240,7 @@ void TestCheckpointing(bool ans, bool lz77) {
   std::vector<uint8_t> context_map;
   EntropyEncodingData codes;
   HistogramParams params;
-  params.lz77_method = lz77 ? HistogramParams::LZ77Method::kLZ77
-                            : HistogramParams::LZ77Method::kNone;
+  params.lz77_method = lz77_method;
   params.force_huffman = !ans;
 
   BitWriter writer{memory_manager};
@@ -281,19 +302,223 @@ void TestCheckpointing(bool ans, bool lz77) {
 }
 
 TEST(ANSTest, TestCheckpointingANS) {
-  TestCheckpointing(/*ans=*/true, /*lz77=*/false);
+  TestCheckpointing(/*ans=*/true, HistogramParams::LZ77Method::kNone);
 }
 
 TEST(ANSTest, TestCheckpointingPrefix) {
-  TestCheckpointing(/*ans=*/false, /*lz77=*/false);
+  TestCheckpointing(/*ans=*/false, HistogramParams::LZ77Method::kNone);
 }
 
 TEST(ANSTest, TestCheckpointingANSLZ77) {
-  TestCheckpointing(/*ans=*/true, /*lz77=*/true);
+  TestCheckpointing(/*ans=*/true, HistogramParams::LZ77Method::kLZ77);
 }
 
 TEST(ANSTest, TestCheckpointingPrefixLZ77) {
-  TestCheckpointing(/*ans=*/false, /*lz77=*/true);
+  TestCheckpointing(/*ans=*/false, HistogramParams::LZ77Method::kLZ77);
+}
+
+TEST(ANSTest, TestCheckpointingANSOptimalLZ77) {
+  TestCheckpointing(/*ans=*/true, HistogramParams::LZ77Method::kOptimal);
+}
+
+void TestSingleValue(bool ans) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  constexpr uint32_t kValue = 5;
+  constexpr size_t kNumValues = 1000;
+  std::vector<std::vector<Token>> input_values(1);
+  for (size_t i = 0; i < kNumValues; i++) {
+    input_values[0].emplace_back(0, kValue);
+  }
+
+  std::vector<uint8_t> context_map;
+  EntropyEncodingData codes;
+  HistogramParams params;
+  params.lz77_method = HistogramParams::LZ77Method::kNone;
+  params.force_huffman = !ans;
+
+  BitWriter writer{memory_manager};
+  JXL_TEST_ASSIGN_OR_DIE(
+      size_t cost,
+      BuildAndEncodeHistograms(memory_manager, params, 1, input_values, &codes,
+                               &context_map, &writer, LayerType::Header,
+                               nullptr));
+  (void)cost;
+  ASSERT_TRUE(WriteTokens(input_values[0], codes, context_map, 0, &writer,
+                          LayerType::Header, nullptr));
+  writer.ZeroPadToByte();
+
+  BitReader br(writer.GetSpan());
+  Status status = true;
+  {
+    BitReaderScopedCloser bc(br, status);
+    std::vector<uint8_t> dec_context_map;
+    ANSCode decoded_codes;
+    ASSERT_TRUE(DecodeHistograms(memory_manager, &br, 1, &decoded_codes,
+                                 &dec_context_map));
+    JXL_TEST_ASSIGN_OR_DIE(ANSSymbolReader reader,
+                           ANSSymbolReader::Create(&decoded_codes, &br));
+    uint32_t value = 0;
+    ASSERT_TRUE(reader.IsSingleValueAndAdvance(dec_context_map[0], &value,
+                                               kNumValues));
+    EXPECT_EQ(value, kValue);
+    ASSERT_TRUE(reader.CheckANSFinalState());
+  }
+  EXPECT_TRUE(status);
+}
+
+TEST(ANSTest, SingleValueFastPathANS) { TestSingleValue(/*ans=*/true); }
+
+TEST(ANSTest, SingleValueFastPathPrefix) { TestSingleValue(/*ans=*/false); }
+
+void TestClusteredRow(bool ans, uint32_t max_value) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  constexpr size_t kNumValues = 10000;
+  Rng rng(max_value);
+  std::vector<std::vector<Token>> input_values(1);
+  for (size_t i = 0; i < kNumValues; i++) {
+    input_values[0].emplace_back(0, rng.UniformU(0, max_value + 1));
+  }
+
+  std::vector<uint8_t> context_map;
+  EntropyEncodingData codes;
+  HistogramParams params;
+  params.lz77_method = HistogramParams::LZ77Method::kNone;
+  params.force_huffman = !ans;
+
+  BitWriter writer{memory_manager};
+  JXL_TEST_ASSIGN_OR_DIE(
+      size_t cost,
+      BuildAndEncodeHistograms(memory_manager, params, 1, input_values, &codes,
+                               &context_map, &writer, LayerType::Header,
+                               nullptr));
+  (void)cost;
+  ASSERT_TRUE(WriteTokens(input_values[0], codes, context_map, 0, &writer,
+                          LayerType::Header, nullptr));
+  writer.ZeroPadToByte();
+
+  BitReader br(writer.GetSpan());
+  Status status = true;
+  {
+    BitReaderScopedCloser bc(br, status);
+    std::vector<uint8_t> dec_context_map;
+    ANSCode decoded_codes;
+    ASSERT_TRUE(DecodeHistograms(memory_manager, &br, 1, &decoded_codes,
+                                 &dec_context_map));
+    JXL_TEST_ASSIGN_OR_DIE(ANSSymbolReader reader,
+                           ANSSymbolReader::Create(&decoded_codes, &br));
+    // Rows of different lengths, the last one ends at the end of the stream.
+    std::vector<uint32_t> values(kNumValues);
+    size_t pos = 0;
+    for (size_t row = 1; pos < kNumValues; row *= 3) {
+      size_t num = std::min(row, kNumValues - pos);
+      reader.ReadHybridUintClusteredRow(dec_context_map[0], &br,
+                                        values.data() + pos, num);
+      pos += num;
+    }
+    for (size_t i = 0; i < kNumValues; i++) {
+      ASSERT_EQ(values[i], input_values[0][i].value);
+    }
+    ASSERT_TRUE(reader.CheckANSFinalState());
+  }
+  EXPECT_TRUE(status);
+}
+
+// Small values fit two tokens per refill, large ones only one.
+TEST(ANSTest, ClusteredRowANS) {
+  TestClusteredRow(/*ans=*/true, 255);
+  TestClusteredRow(/*ans=*/true, 1u << 30);
+}
+
+TEST(ANSTest, ClusteredRowPrefix) {
+  TestClusteredRow(/*ans=*/false, 255);
+  TestClusteredRow(/*ans=*/false, 1u << 30);
+}
+
+TEST(ANSTest, HistogramsFromCountsMatchTokens) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  constexpr size_t kNumContexts = 4;
+  Rng rng(0);
+  std::vector<std::vector<Token>> tokens(2);
+  for (std::vector<Token>& stream : tokens) {
+    for (size_t i = 0; i < 10000; i++) {
+      // Mostly small values, with a long tail.
+      uint32_t value = rng.UniformU(0, 1u << rng.UniformU(0, 20));
+      stream.emplace_back(rng.UniformU(0, kNumContexts), value);
+    }
+  }
+  for (SpeedTier tier : {SpeedTier::kThunder, SpeedTier::kWombat}) {
+    HistogramParams params(tier, kNumContexts);
+    params.lz77_method = HistogramParams::LZ77Method::kNone;
+    ASSERT_TRUE(CanBuildHistogramsFromCounts(params));
+
+    BitWriter writer{memory_manager};
+    EntropyEncodingData codes;
+    std::vector<uint8_t> context_map;
+    JXL_TEST_ASSIGN_OR_DIE(
+        size_t cost,
+        BuildAndEncodeHistograms(memory_manager, params, kNumContexts, tokens,
+                                 &codes, &context_map, &writer,
+                                 LayerType::Header, nullptr));
+    (void)cost;
+
+    std::vector<Histogram> histograms(kNumContexts);
+    for (const std::vector<Token>& stream : tokens) {
+      AddTokensToHistograms(stream, &histograms);
+    }
+    BitWriter counts_writer{memory_manager};
+    EntropyEncodingData counts_codes;
+    std::vector<uint8_t> counts_context_map;
+    JXL_TEST_ASSIGN_OR_DIE(
+        cost, BuildAndEncodeHistogramsFromCounts(
+                  memory_manager, params, std::move(histograms), &counts_codes,
+                  &counts_context_map, &counts_writer, LayerType::Header,
+                  nullptr));
+
+    EXPECT_EQ(context_map, counts_context_map);
+    EXPECT_EQ(codes.use_prefix_code, counts_codes.use_prefix_code);
+    ASSERT_EQ(writer.BitsWritten(), counts_writer.BitsWritten());
+    for (const std::vector<Token>& stream : tokens) {
+      ASSERT_TRUE(WriteTokens(stream, codes, context_map, 0, &writer,
+                              LayerType::Header, nullptr));
+      ASSERT_TRUE(WriteTokens(stream, counts_codes, counts_context_map, 0,
+                              &counts_writer, LayerType::Header, nullptr));
+    }
+    for (BitWriter* w : {&writer, &counts_writer}) {
+      BitWriter::Allotment allotment(w, 8);
+      w->ZeroPadToByte();
+      ASSERT_TRUE(allotment.ReclaimAndCharge(w, LayerType::Header, nullptr));
+    }
+    EXPECT_EQ(writer.GetSpan().Copy(), counts_writer.GetSpan().Copy());
+  }
+}
+
+TEST(ANSTest, ClusterHistogramsWithPool) {
+  constexpr size_t kNumHistograms = 300;
+  Rng rng(0);
+  std::vector<Histogram> histograms(kNumHistograms);
+  for (Histogram& histogram : histograms) {
+    // A few families of similar distributions.
+    const size_t family = rng.UniformU(0, 8);
+    for (size_t i = 0; i < 500; i++) {
+      histogram.Add(family + rng.UniformU(0, 4 + 2 * family));
+    }
+  }
+  test::ThreadPoolForTests pool(4);
+  HistogramParams params;
+  std::vector<Histogram> clustered;
+  std::vector<uint32_t> symbols;
+  ASSERT_TRUE(ClusterHistograms(params, histograms, kClustersLimit,
+                                &clustered, &symbols));
+  params.pool = pool.get();
+  std::vector<Histogram> clustered_with_pool;
+  std::vector<uint32_t> symbols_with_pool;
+  ASSERT_TRUE(ClusterHistograms(params, histograms, kClustersLimit,
+                                &clustered_with_pool, &symbols_with_pool));
+  EXPECT_EQ(symbols, symbols_with_pool);
+  ASSERT_EQ(clustered.size(), clustered_with_pool.size());
+  for (size_t i = 0; i < clustered.size(); i++) {
+    EXPECT_EQ(clustered[i].data_, clustered_with_pool[i].data_);
+  }
 }
 
 }  // namespace
@@ -0,0 +1,200 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/arena_memory_manager.h>
+#include <jxl/memory_manager.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/memory_manager_internal.h"
+
+namespace jxl {
+namespace {
+
+// Every allocation is preceded by a header pointing to its chunk, or to
+// nullptr for allocations forwarded to the underlying memory manager. The
+// header size keeps the alignment guaranteed by malloc.
+constexpr size_t kHeaderSize = alignof(std::max_align_t) < sizeof(void*)
+                                   ? sizeof(void*)
+                                   : alignof(std::max_align_t);
+constexpr size_t kDefaultChunkSize = size_t{4} << 20;
+// Threads allocate from different chunks, chosen by thread id, to avoid
+// contending for a single lock.
+constexpr size_t kNumShards = 16;
+
+class ArenaMemoryManager {
+ public:
+  ArenaMemoryManager(const JxlMemoryManager& memory_manager, size_t chunk_size)
+      : memory_manager_(memory_manager), chunk_size_(chunk_size) {
+    self_.opaque = this;
+    self_.alloc = &ArenaMemoryManager::Alloc;
+    self_.free = &ArenaMemoryManager::Free;
+  }
+
+  ~ArenaMemoryManager() {
+    for (Shard& shard : shards_) {
+      if (shard.current != nullptr) Unref(shard.current);
+    }
+    Trim();
+  }
+
+  ArenaMemoryManager(const ArenaMemoryManager&) = delete;
+  ArenaMemoryManager& operator=(const ArenaMemoryManager&) = delete;
+
+  JxlMemoryManager* self() { return &self_; }
+  const JxlMemoryManager& memory_manager() const { return memory_manager_; }
+
+  void Trim() {
+    std::unique_lock<std::mutex> l(free_chunks_mutex_);
+    while (free_chunks_ != nullptr) {
+      Chunk* chunk = free_chunks_;
+      free_chunks_ = chunk->next_free;
+      MemoryManagerFree(&memory_manager_, chunk);
+    }
+  }
+
+ private:
+  struct Chunk {
+    // Bytes of data already handed out, protected by the mutex of the shard
+    // allocating from this chunk.
+    size_t used;
+    // Number of live allocations, plus one while a shard allocates from it.
+    std::atomic<size_t> live;
+    Chunk* next_free;
+
+    uint8_t* data() {
+      return reinterpret_cast<uint8_t*>(this) +
+             RoundUpTo(sizeof(Chunk), kHeaderSize);
+    }
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    Chunk* current = nullptr;
+    // Keeps the shards on different cache lines.
+    uint8_t padding[64];
+  };
+
+  static void* Alloc(void* opaque, size_t size) {
+    return static_cast<ArenaMemoryManager*>(opaque)->Allocate(size);
+  }
+
+  static void Free(void* opaque, void* address) {
+    if (address == nullptr) return;
+    uint8_t* header = static_cast<uint8_t*>(address) - kHeaderSize;
+    Chunk* chunk = *reinterpret_cast<Chunk**>(header);
+    auto* self = static_cast<ArenaMemoryManager*>(opaque);
+    if (chunk == nullptr) {
+      MemoryManagerFree(&self->memory_manager_, header);
+    } else {
+      self->Unref(chunk);
+    }
+  }
+
+  void* Allocate(size_t size) {
+    size_t needed = RoundUpTo(size, kHeaderSize) + kHeaderSize;
+    if (needed < size) return nullptr;  // overflow
+    uint8_t* header;
+    Chunk* chunk = nullptr;
+    if (needed > chunk_size_ / 4) {
+      header =
+          static_cast<uint8_t*>(MemoryManagerAlloc(&memory_manager_, needed));
+      if (header == nullptr) return nullptr;
+    } else {
+      size_t thread_hash =
+          std::hash<std::thread::id>()(std::this_thread::get_id());
+      Shard& shard = shards_[thread_hash % kNumShards];
+      std::unique_lock<std::mutex> l(shard.mutex);
+      if (shard.current == nullptr ||
+          shard.current->used + needed > chunk_size_) {
+        Chunk* next = NewChunk();
+        if (next == nullptr) return nullptr;
+        if (shard.current != nullptr) Unref(shard.current);
+        shard.current = next;
+      }
+      chunk = shard.current;
+      header = chunk->data() + chunk->used;
+      chunk->used += needed;
+      chunk->live.fetch_add(1, std::memory_order_relaxed);
+    }
+    *reinterpret_cast<Chunk**>(header) = chunk;
+    return header + kHeaderSize;
+  }
+
+  // Returns a chunk with no allocations, referenced by the calling shard.
+  Chunk* NewChunk() {
+    Chunk* chunk = nullptr;
+    {
+      std::unique_lock<std::mutex> l(free_chunks_mutex_);
+      if (free_chunks_ != nullptr) {
+        chunk = free_chunks_;
+        free_chunks_ = chunk->next_free;
+      }
+    }
+    if (chunk == nullptr) {
+      size_t chunk_bytes = RoundUpTo(sizeof(Chunk), kHeaderSize) + chunk_size_;
+      void* memory = MemoryManagerAlloc(&memory_manager_, chunk_bytes);
+      if (memory == nullptr) return nullptr;
+      chunk = new (memory) Chunk();
+    }
+    chunk->used = 0;
+    chunk->live.store(1, std::memory_order_relaxed);
+    chunk->next_free = nullptr;
+    return chunk;
+  }
+
+  void Unref(Chunk* chunk) {
+    if (chunk->live.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    std::unique_lock<std::mutex> l(free_chunks_mutex_);
+    chunk->next_free = free_chunks_;
+    free_chunks_ = chunk;
+  }
+
+  JxlMemoryManager self_;
+  const JxlMemoryManager memory_manager_;
+  const size_t chunk_size_;
+  Shard shards_[kNumShards];
+
+  std::mutex free_chunks_mutex_;
+  // Chunks without allocations, linked through next_free.
+  Chunk* free_chunks_ = nullptr;
+};
+
+}  // namespace
+}  // namespace jxl
+
+JxlMemoryManager* JxlArenaMemoryManagerCreate(
+    const JxlMemoryManager* memory_manager, size_t chunk_size) {
+  JxlMemoryManager local_memory_manager;
+  if (!jxl::MemoryManagerInit(&local_memory_manager, memory_manager)) {
+    return nullptr;
+  }
+  if (chunk_size == 0) chunk_size = jxl::kDefaultChunkSize;
+  void* alloc = jxl::MemoryManagerAlloc(&local_memory_manager,
+                                        sizeof(jxl::ArenaMemoryManager));
+  if (!alloc) return nullptr;
+  auto* arena =
+      new (alloc) jxl::ArenaMemoryManager(local_memory_manager, chunk_size);
+  return arena->self();
+}
+
+void JxlArenaMemoryManagerTrim(JxlMemoryManager* arena) {
+  static_cast<jxl::ArenaMemoryManager*>(arena->opaque)->Trim();
+}
+
+void JxlArenaMemoryManagerDestroy(JxlMemoryManager* arena) {
+  if (!arena) return;
+  auto* self = static_cast<jxl::ArenaMemoryManager*>(arena->opaque);
+  JxlMemoryManager local_memory_manager = self->memory_manager();
+  self->~ArenaMemoryManager();
+  jxl::MemoryManagerFree(&local_memory_manager, self);
+}
@@ -0,0 +1,101 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/arena_memory_manager.h>
+#include <jxl/memory_manager.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace {
+
+struct CountingAllocator {
+  static void* Alloc(void* opaque, size_t size) {
+    static_cast<CountingAllocator*>(opaque)->num_allocs++;
+    static_cast<CountingAllocator*>(opaque)->num_live++;
+    return malloc(size);
+  }
+  static void Free(void* opaque, void* address) {
+    if (address == nullptr) return;
+    static_cast<CountingAllocator*>(opaque)->num_live--;
+    free(address);
+  }
+  JxlMemoryManager Get() { return {this, &Alloc, &Free}; }
+
+  std::atomic<size_t> num_allocs{0};
+  std::atomic<int> num_live{0};
+};
+
+// Allocates and frees buffers of various sizes, checking that they do not
+// overlap.
+void AllocateAndFree(JxlMemoryManager* arena, uint8_t seed) {
+  std::vector<uint8_t*> buffers;
+  std::vector<size_t> sizes;
+  for (size_t i = 0; i < 200; ++i) {
+    size_t size = (i * 37) % 3000 + (i % 50 == 0 ? 100000 : 0);
+    uint8_t* buffer = static_cast<uint8_t*>(arena->alloc(arena->opaque, size));
+    ASSERT_NE(nullptr, buffer);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(buffer) % alignof(void*));
+    memset(buffer, seed + i, size);
+    buffers.push_back(buffer);
+    sizes.push_back(size);
+  }
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    for (size_t j = 0; j < sizes[i]; ++j) {
+      ASSERT_EQ(static_cast<uint8_t>(seed + i), buffers[i][j]);
+    }
+    arena->free(arena->opaque, buffers[i]);
+  }
+}
+
+TEST(ArenaMemoryManagerTest, RecyclesChunks) {
+  CountingAllocator allocator;
+  JxlMemoryManager backing = allocator.Get();
+  JxlMemoryManager* arena = JxlArenaMemoryManagerCreate(&backing, 64 << 10);
+  ASSERT_NE(nullptr, arena);
+  arena->free(arena->opaque, nullptr);
+
+  AllocateAndFree(arena, 1);
+  size_t num_allocs = allocator.num_allocs;
+  // The chunks of the first round are all reused, so only the allocations
+  // that are too large for a chunk go to the backing allocator.
+  AllocateAndFree(arena, 2);
+  EXPECT_EQ(num_allocs + 4, allocator.num_allocs.load());
+
+  int num_live = allocator.num_live;
+  JxlArenaMemoryManagerTrim(arena);
+  EXPECT_LT(allocator.num_live.load(), num_live);
+  AllocateAndFree(arena, 3);
+
+  JxlArenaMemoryManagerDestroy(arena);
+  EXPECT_EQ(0, allocator.num_live.load());
+}
+
+TEST(ArenaMemoryManagerTest, ConcurrentThreads) {
+  CountingAllocator allocator;
+  JxlMemoryManager backing = allocator.Get();
+  JxlMemoryManager* arena = JxlArenaMemoryManagerCreate(&backing, 0);
+  ASSERT_NE(nullptr, arena);
+  std::vector<std::thread> threads;
+  for (uint8_t t = 0; t < 8; ++t) {
+    threads.emplace_back([arena, t]() {
+      for (int iter = 0; iter < 5; ++iter) AllocateAndFree(arena, t * 17);
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  JxlArenaMemoryManagerDestroy(arena);
+  EXPECT_EQ(0, allocator.num_live.load());
+}
+
+}  // namespace
+}  // namespace jxl
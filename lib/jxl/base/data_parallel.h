@@ -11,10 +11,12 @@
 
 #include <jxl/parallel_runner.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
 
+#include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/status.h"
 #if JXL_COMPILER_MSVC
@@ -137,6 +139,38 @@ Status RunOnPool(ThreadPool* pool, const uint32_t begin, const uint32_t end,
   }
 }
 
+// Smallest amount of work, in the units of the cost hint of RunOnPool, that is
+// worth a separate call of the runner function: about 16K pixels.
+constexpr uint64_t kMinCostPerBatch = 1 << 14;
+
+// Same as above, with `cost_per_task` a hint of the work of a single task,
+// e.g. the number of pixels of a row. Consecutive tasks are coalesced into
+// batches of at least kMinCostPerBatch, so that the runner does not dispatch
+// (and wake up workers for) tasks that are cheaper than the synchronization.
+// data_func is still called once per task, with the thread running the batch.
+template <class InitFunc, class DataFunc>
+Status RunOnPool(ThreadPool* pool, const uint32_t begin, const uint32_t end,
+                 const uint64_t cost_per_task, const InitFunc& init_func,
+                 const DataFunc& data_func, const char* caller) {
+  JXL_ENSURE(begin <= end);
+  const uint64_t grain =
+      kMinCostPerBatch / std::max<uint64_t>(cost_per_task, 1);
+  if (grain <= 1) {
+    return RunOnPool(pool, begin, end, init_func, data_func, caller);
+  }
+  const uint32_t num_batches = DivCeil<uint64_t>(end - begin, grain);
+  const auto process_batch = [&](const uint32_t batch,
+                                 const size_t thread) -> Status {
+    const uint64_t batch_begin = begin + batch * grain;
+    const uint64_t batch_end = std::min<uint64_t>(batch_begin + grain, end);
+    for (uint64_t task = batch_begin; task < batch_end; ++task) {
+      JXL_RETURN_IF_ERROR(data_func(static_cast<uint32_t>(task), thread));
+    }
+    return true;
+  };
+  return RunOnPool(pool, 0, num_batches, init_func, process_batch, caller);
+}
+
 }  // namespace jxl
 #if JXL_COMPILER_MSVC
 #pragma warning(default : 4180)
@@ -40,6 +40,32 @@ static JXL_INLINE float LoadFloat16(uint16_t bits16) {
   memcpy(&result, &bits32, 4);
   return result;
 }
+
+// Inverse of LoadFloat16, rounding to nearest. Values that are out of range
+// (including infinities and NaN) saturate to the largest finite half float.
+static JXL_INLINE uint16_t StoreFloat16(float value) {
+  uint32_t bits32;
+  memcpy(&bits32, &value, 4);
+  const uint32_t sign = bits32 >> 31;
+  const int32_t exp = static_cast<int32_t>((bits32 >> 23) & 0xFF) - 127;
+  const uint32_t mantissa32 = bits32 & 0x7FFFFF;
+
+  if (exp > 15) return (sign << 15) | 0x7BFF;
+  // Too small even for subnormals.
+  if (exp < -25) return sign << 15;
+
+  uint32_t bits16;
+  if (exp < -14) {
+    // Subnormal; rounding up may produce the smallest normal value.
+    const uint32_t shift = -exp - 1;
+    bits16 = ((mantissa32 | 0x800000) + (1u << (shift - 1))) >> shift;
+  } else {
+    bits16 = ((exp + 15) << 10) | (mantissa32 >> 13);
+    bits16 += (mantissa32 >> 12) & 1;
+    if (bits16 >= 0x7C00) bits16 = 0x7BFF;
+  }
+  return (sign << 15) | bits16;
+}
 }  // namespace detail
 
 template <typename SaveFloatAtFn>
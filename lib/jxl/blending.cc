@@ -12,14 +12,94 @@
 #include <vector>
 
 #include "lib/jxl/alpha.h"
+#include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/dec_patch_dictionary.h"
 #include "lib/jxl/frame_header.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_metadata.h"
 
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/blending.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::AllTrue;
+using hwy::HWY_NAMESPACE::Eq;
+
+// out = bg + fg. `out` may be the same row as `bg`.
+void AddRow(const float* bg, const float* JXL_RESTRICT fg, float* out,
+            size_t xsize) {
+  const HWY_FULL(float) d;
+  const size_t N = Lanes(d);
+  size_t x = 0;
+  for (; x + N <= xsize; x += N) {
+    StoreU(Add(LoadU(d, bg + x), LoadU(d, fg + x)), d, out + x);
+  }
+  for (; x < xsize; x++) {
+    out[x] = bg[x] + fg[x];
+  }
+}
+
+// Whether all the `xsize` values of the alpha row are exactly 1.
+bool IsOpaqueRow(const float* JXL_RESTRICT alpha, size_t xsize) {
+  const HWY_FULL(float) d;
+  const size_t N = Lanes(d);
+  const auto one = Set(d, 1.0f);
+  size_t x = 0;
+  for (; x + N <= xsize; x += N) {
+    if (!AllTrue(d, Eq(LoadU(d, alpha + x), one))) return false;
+  }
+  for (; x < xsize; x++) {
+    if (alpha[x] != 1.0f) return false;
+  }
+  return true;
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
 namespace jxl {
 
+HWY_EXPORT(AddRow);
+HWY_EXPORT(IsOpaqueRow);
+
+namespace {
+
+// Modes in which each channel only depends on the same channel of the
+// inputs, which can be blended directly into the output.
+bool IsPerChannel(PatchBlendMode mode) {
+  return mode == PatchBlendMode::kAdd || mode == PatchBlendMode::kReplace ||
+         mode == PatchBlendMode::kNone;
+}
+
+void BlendPerChannel(PatchBlendMode mode, const float* bg,
+                     const float* JXL_RESTRICT fg, float* out, size_t xsize) {
+  if (xsize == 0) return;
+  switch (mode) {
+    case PatchBlendMode::kAdd:
+      HWY_DYNAMIC_DISPATCH(AddRow)(bg, fg, out, xsize);
+      return;
+    case PatchBlendMode::kReplace:
+      memcpy(out, fg, xsize * sizeof(*out));
+      return;
+    default:
+      if (out != bg) memmove(out, bg, xsize * sizeof(*out));
+      return;
+  }
+}
+
+}  // namespace
+
 bool NeedsBlending(const FrameHeader& frame_header) {
   if (!(frame_header.frame_type == FrameType::kRegularFrame ||
         frame_header.frame_type == FrameType::kSkipProgressive)) {
@@ -52,6 +132,35 @@ Status PerformBlending(
       break;
     }
   }
+  // Patches of text and of other screen content usually only add to or
+  // replace the image, and are small enough that the temporary image below
+  // would dominate.
+  // Blending above an opaque foreground is a replacement, which is the
+  // common case for the rows of layers that are not at their border.
+  const auto mode_of = [&](const PatchBlending& blending) {
+    if (!has_alpha || blending.mode != PatchBlendMode::kBlendAbove) {
+      return blending.mode;
+    }
+    return HWY_DYNAMIC_DISPATCH(IsOpaqueRow)(
+               fg[3 + blending.alpha_channel] + x0, xsize)
+               ? PatchBlendMode::kReplace
+               : blending.mode;
+  };
+  // Computed before writing any output, since `out` may be `fg`.
+  const PatchBlendMode color_mode = mode_of(color_blending);
+  std::vector<PatchBlendMode> ec_modes(num_ec);
+  bool per_channel = IsPerChannel(color_mode);
+  for (size_t i = 0; i < num_ec; i++) {
+    ec_modes[i] = mode_of(ec_blending[i]);
+    per_channel = per_channel && IsPerChannel(ec_modes[i]);
+  }
+  if (per_channel) {
+    for (size_t c = 0; c < 3 + num_ec; c++) {
+      BlendPerChannel(c < 3 ? color_mode : ec_modes[c - 3], bg[c] + x0,
+                      fg[c] + x0, out[c] + x0, xsize);
+    }
+    return true;
+  }
   JXL_ASSIGN_OR_RETURN(ImageF tmp,
                        ImageF::Create(memory_manager, xsize, 3 + num_ec));
   // Blend extra channels first so that we use the pre-blending alpha.
@@ -190,3 +299,4 @@ Status PerformBlending(
 }
 
 }  // namespace jxl
+#endif  // HWY_ONCE
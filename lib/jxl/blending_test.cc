@@ -5,6 +5,7 @@
 
 #include <jxl/types.h>
 
+#include <cstddef>
 #include <cstdint>
 #include <sstream>
 #include <utility>
@@ -14,6 +15,10 @@
 #include "lib/extras/dec/jxl.h"
 #include "lib/extras/packed_image.h"
 #include "lib/jxl/base/span.h"
+#include "lib/jxl/blending.h"
+#include "lib/jxl/dec_patch_dictionary.h"
+#include "lib/jxl/image_metadata.h"
+#include "lib/jxl/test_memory_manager.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
 
@@ -53,5 +58,44 @@ TEST(BlendingTest, Crops) {
   }
 }
 
+TEST(BlendingTest, BlendAboveOpaqueRow) {
+  constexpr size_t kXSize = 37;
+  std::vector<ExtraChannelInfo> extra_channel_info(1);
+  extra_channel_info[0].type = ExtraChannel::kAlpha;
+  const PatchBlending blending{PatchBlendMode::kBlendAbove, 0, false};
+  std::vector<std::vector<float>> bg(4), fg(4), out(4);
+  for (size_t c = 0; c < 4; ++c) {
+    bg[c].assign(kXSize, 0.25f);
+    fg[c].resize(kXSize);
+    for (size_t x = 0; x < kXSize; ++x) fg[c][x] = (c + x) * (1.0f / 64);
+    out[c].assign(kXSize, 0.0f);
+  }
+  fg[3].assign(kXSize, 1.0f);
+  const auto blend = [&]() {
+    const float* bg_rows[4] = {bg[0].data(), bg[1].data(), bg[2].data(),
+                               bg[3].data()};
+    const float* fg_rows[4] = {fg[0].data(), fg[1].data(), fg[2].data(),
+                               fg[3].data()};
+    float* out_rows[4] = {out[0].data(), out[1].data(), out[2].data(),
+                          out[3].data()};
+    ASSERT_TRUE(PerformBlending(test::MemoryManager(), bg_rows, fg_rows,
+                                out_rows, 0, kXSize, blending, &blending,
+                                extra_channel_info));
+  };
+  blend();
+  for (size_t c = 0; c < 4; ++c) {
+    for (size_t x = 0; x < kXSize; ++x) EXPECT_EQ(out[c][x], fg[c][x]);
+  }
+
+  // A single translucent pixel needs the actual blending.
+  fg[3][kXSize - 1] = 0.5f;
+  blend();
+  const float new_a = 1.0f - 0.5f * (1.0f - 0.25f);
+  EXPECT_FLOAT_EQ(out[3][kXSize - 1], new_a);
+  EXPECT_FLOAT_EQ(out[0][kXSize - 1],
+                  (fg[0][kXSize - 1] * 0.5f + 0.25f * 0.25f * 0.5f) / new_a);
+  EXPECT_EQ(out[0][0], fg[0][0]);
+}
+
 }  // namespace
 }  // namespace jxl
@@ -39,6 +39,8 @@
 #define HWY_TARGET_INCLUDE "lib/jxl/butteraugli/butteraugli.cc"
 #include <hwy/foreach_target.h>
 
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/fast_math-inl.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
@@ -103,9 +105,14 @@ void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
   }
 }
 
+// Number of input rows of ConvolutionWithTranspose per pool task; keeps the
+// transposed writes of different tasks in different cache lines.
+constexpr size_t kConvolutionRowsPerTask = 32;
+
 // Computes a horizontal convolution and transposes the result.
 Status ConvolutionWithTranspose(const ImageF& in,
                                 const std::vector<float>& kernel,
+                                ThreadPool* pool,
                                 ImageF* BUTTERAUGLI_RESTRICT out) {
   JXL_ENSURE(out->xsize() == in.ysize());
   JXL_ENSURE(out->ysize() == in.xsize());
@@ -123,100 +130,121 @@ Status ConvolutionWithTranspose(const ImageF& in,
     scaled_kernel[i] = kernel[i] * scale_no_border;
   }
 
-  // middle
-  switch (len) {
-    case 7: {
-      const float sk0 = scaled_kernel[0];
-      const float sk1 = scaled_kernel[1];
-      const float sk2 = scaled_kernel[2];
-      const float sk3 = scaled_kernel[3];
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          const float sum0 = (row_in[0] + row_in[6]) * sk0;
-          const float sum1 = (row_in[1] + row_in[5]) * sk1;
-          const float sum2 = (row_in[2] + row_in[4]) * sk2;
-          const float sum = (row_in[3]) * sk3 + sum0 + sum1 + sum2;
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum;
+  if (len != 7 && len != 13 && len != 15 && len != 33) {
+    return JXL_UNREACHABLE("kernel size %d not implemented",
+                           static_cast<int>(len));
+  }
+  const auto convolve_rows = [&](const uint32_t task,
+                                 size_t /*thread*/) -> Status {
+    const size_t y_begin = task * kConvolutionRowsPerTask;
+    const size_t y_end =
+        std::min(in.ysize(), y_begin + kConvolutionRowsPerTask);
+    // middle
+    switch (len) {
+      case 7: {
+        const float sk0 = scaled_kernel[0];
+        const float sk1 = scaled_kernel[1];
+        const float sk2 = scaled_kernel[2];
+        const float sk3 = scaled_kernel[3];
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            const float sum0 = (row_in[0] + row_in[6]) * sk0;
+            const float sum1 = (row_in[1] + row_in[5]) * sk1;
+            const float sum2 = (row_in[2] + row_in[4]) * sk2;
+            const float sum = (row_in[3]) * sk3 + sum0 + sum1 + sum2;
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum;
+          }
         }
-      }
-    } break;
-    case 13: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          float sum0 = (row_in[0] + row_in[12]) * scaled_kernel[0];
-          float sum1 = (row_in[1] + row_in[11]) * scaled_kernel[1];
-          float sum2 = (row_in[2] + row_in[10]) * scaled_kernel[2];
-          float sum3 = (row_in[3] + row_in[9]) * scaled_kernel[3];
-          sum0 += (row_in[4] + row_in[8]) * scaled_kernel[4];
-          sum1 += (row_in[5] + row_in[7]) * scaled_kernel[5];
-          const float sum = (row_in[6]) * scaled_kernel[6];
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+      } break;
+      case 13: {
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            float sum0 = (row_in[0] + row_in[12]) * scaled_kernel[0];
+            float sum1 = (row_in[1] + row_in[11]) * scaled_kernel[1];
+            float sum2 = (row_in[2] + row_in[10]) * scaled_kernel[2];
+            float sum3 = (row_in[3] + row_in[9]) * scaled_kernel[3];
+            sum0 += (row_in[4] + row_in[8]) * scaled_kernel[4];
+            sum1 += (row_in[5] + row_in[7]) * scaled_kernel[5];
+            const float sum = (row_in[6]) * scaled_kernel[6];
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+          }
         }
+        break;
       }
-      break;
-    }
-    case 15: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          float sum0 = (row_in[0] + row_in[14]) * scaled_kernel[0];
-          float sum1 = (row_in[1] + row_in[13]) * scaled_kernel[1];
-          float sum2 = (row_in[2] + row_in[12]) * scaled_kernel[2];
-          float sum3 = (row_in[3] + row_in[11]) * scaled_kernel[3];
-          sum0 += (row_in[4] + row_in[10]) * scaled_kernel[4];
-          sum1 += (row_in[5] + row_in[9]) * scaled_kernel[5];
-          sum2 += (row_in[6] + row_in[8]) * scaled_kernel[6];
-          const float sum = (row_in[7]) * scaled_kernel[7];
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+      case 15: {
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            float sum0 = (row_in[0] + row_in[14]) * scaled_kernel[0];
+            float sum1 = (row_in[1] + row_in[13]) * scaled_kernel[1];
+            float sum2 = (row_in[2] + row_in[12]) * scaled_kernel[2];
+            float sum3 = (row_in[3] + row_in[11]) * scaled_kernel[3];
+            sum0 += (row_in[4] + row_in[10]) * scaled_kernel[4];
+            sum1 += (row_in[5] + row_in[9]) * scaled_kernel[5];
+            sum2 += (row_in[6] + row_in[8]) * scaled_kernel[6];
+            const float sum = (row_in[7]) * scaled_kernel[7];
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+          }
         }
+        break;
       }
-      break;
-    }
-    case 33: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          float sum0 = (row_in[0] + row_in[32]) * scaled_kernel[0];
-          float sum1 = (row_in[1] + row_in[31]) * scaled_kernel[1];
-          float sum2 = (row_in[2] + row_in[30]) * scaled_kernel[2];
-          float sum3 = (row_in[3] + row_in[29]) * scaled_kernel[3];
-          sum0 += (row_in[4] + row_in[28]) * scaled_kernel[4];
-          sum1 += (row_in[5] + row_in[27]) * scaled_kernel[5];
-          sum2 += (row_in[6] + row_in[26]) * scaled_kernel[6];
-          sum3 += (row_in[7] + row_in[25]) * scaled_kernel[7];
-          sum0 += (row_in[8] + row_in[24]) * scaled_kernel[8];
-          sum1 += (row_in[9] + row_in[23]) * scaled_kernel[9];
-          sum2 += (row_in[10] + row_in[22]) * scaled_kernel[10];
-          sum3 += (row_in[11] + row_in[21]) * scaled_kernel[11];
-          sum0 += (row_in[12] + row_in[20]) * scaled_kernel[12];
-          sum1 += (row_in[13] + row_in[19]) * scaled_kernel[13];
-          sum2 += (row_in[14] + row_in[18]) * scaled_kernel[14];
-          sum3 += (row_in[15] + row_in[17]) * scaled_kernel[15];
-          const float sum = (row_in[16]) * scaled_kernel[16];
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+      case 33: {
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            float sum0 = (row_in[0] + row_in[32]) * scaled_kernel[0];
+            float sum1 = (row_in[1] + row_in[31]) * scaled_kernel[1];
+            float sum2 = (row_in[2] + row_in[30]) * scaled_kernel[2];
+            float sum3 = (row_in[3] + row_in[29]) * scaled_kernel[3];
+            sum0 += (row_in[4] + row_in[28]) * scaled_kernel[4];
+            sum1 += (row_in[5] + row_in[27]) * scaled_kernel[5];
+            sum2 += (row_in[6] + row_in[26]) * scaled_kernel[6];
+            sum3 += (row_in[7] + row_in[25]) * scaled_kernel[7];
+            sum0 += (row_in[8] + row_in[24]) * scaled_kernel[8];
+            sum1 += (row_in[9] + row_in[23]) * scaled_kernel[9];
+            sum2 += (row_in[10] + row_in[22]) * scaled_kernel[10];
+            sum3 += (row_in[11] + row_in[21]) * scaled_kernel[11];
+            sum0 += (row_in[12] + row_in[20]) * scaled_kernel[12];
+            sum1 += (row_in[13] + row_in[19]) * scaled_kernel[13];
+            sum2 += (row_in[14] + row_in[18]) * scaled_kernel[14];
+            sum3 += (row_in[15] + row_in[17]) * scaled_kernel[15];
+            const float sum = (row_in[16]) * scaled_kernel[16];
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+          }
         }
+        break;
       }
-      break;
+      default:
+        break;
     }
-    default:
-      return JXL_UNREACHABLE("kernel size %d not implemented",
-                             static_cast<int>(len));
-  }
-  // left border
-  for (size_t x = 0; x < border1; ++x) {
-    ConvolveBorderColumn(in, kernel, x, out->Row(x));
-  }
-
-  // right border
-  for (size_t x = border2; x < in.xsize(); ++x) {
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(
+      pool, 0, DivCeil(in.ysize(), kConvolutionRowsPerTask),
+      ThreadPool::NoInit, convolve_rows, "ButteraugliConvolution"));
+
+  // left and right border
+  const size_t num_right = in.xsize() - std::max(border1, border2);
+  const auto convolve_border = [&](const uint32_t task,
+                                   size_t /*thread*/) -> Status {
+    const size_t x =
+        task < border1 ? task : in.xsize() - num_right + (task - border1);
     ConvolveBorderColumn(in, kernel, x, out->Row(x));
-  }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, border1 + num_right,
+                                ThreadPool::NoInit, convolve_border,
+                                "ButteraugliConvolutionBorder"));
   return true;
 }
 
@@ -231,7 +259,7 @@ Status ConvolutionWithTranspose(const ImageF& in,
 // optionally use gauss_blur followed by fixup of the borders for large images,
 // or fall back to the previous truncated FIR followed by a transpose.
 Status Blur(const ImageF& in, float sigma, const ButteraugliParams& params,
-            BlurTemp* temp, ImageF* out) {
+            BlurTemp* temp, ThreadPool* pool, ImageF* out) {
   std::vector<float> kernel = ComputeKernel(sigma);
   // Separable5 does an in-place convolution, so this fast path is not safe if
   // in aliases out.
@@ -249,14 +277,14 @@ Status Blur(const ImageF& in, float sigma, const ButteraugliParams& params,
         {HWY_REP4(w0), HWY_REP4(w1), HWY_REP4(w2)},
     };
     JXL_RETURN_IF_ERROR(
-        Separable5(in, Rect(in), weights, /*pool=*/nullptr, out));
+        Separable5(in, Rect(in), weights, pool, out));
     return true;
   }
 
   ImageF* temp_t;
   JXL_RETURN_IF_ERROR(temp->GetTransposed(in, &temp_t));
-  JXL_RETURN_IF_ERROR(ConvolutionWithTranspose(in, kernel, temp_t));
-  JXL_RETURN_IF_ERROR(ConvolutionWithTranspose(*temp_t, kernel, out));
+  JXL_RETURN_IF_ERROR(ConvolutionWithTranspose(in, kernel, pool, temp_t));
+  JXL_RETURN_IF_ERROR(ConvolutionWithTranspose(*temp_t, kernel, pool, out));
   return true;
 }
 
@@ -399,12 +427,13 @@ void Subtract(const ImageF& a, const ImageF& b, ImageF* c) {
 }
 
 Status SeparateLFAndMF(const ButteraugliParams& params, const Image3F& xyb,
-                       Image3F* lf, Image3F* mf, BlurTemp* blur_temp) {
+                       Image3F* lf, Image3F* mf, BlurTemp* blur_temp,
+                       ThreadPool* pool) {
   static const double kSigmaLf = 7.15593339443;
   for (int i = 0; i < 3; ++i) {
     // Extract lf ...
     JXL_RETURN_IF_ERROR(
-        Blur(xyb.Plane(i), kSigmaLf, params, blur_temp, &lf->Plane(i)));
+        Blur(xyb.Plane(i), kSigmaLf, params, blur_temp, pool, &lf->Plane(i)));
     // ... and keep everything else in mf.
     Subtract(xyb.Plane(i), lf->Plane(i), &mf->Plane(i));
   }
@@ -413,7 +442,7 @@ Status SeparateLFAndMF(const ButteraugliParams& params, const Image3F& xyb,
 }
 
 Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
-                       BlurTemp* blur_temp) {
+                       BlurTemp* blur_temp, ThreadPool* pool) {
   const HWY_FULL(float) d;
   static const double kSigmaHf = 3.22489901262;
   const size_t xsize = mf->xsize();
@@ -423,8 +452,8 @@ Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
   JXL_ASSIGN_OR_RETURN(hf[1], ImageF::Create(memory_manager, xsize, ysize));
   for (int i = 0; i < 3; ++i) {
     if (i == 2) {
-      JXL_RETURN_IF_ERROR(
-          Blur(mf->Plane(i), kSigmaHf, params, blur_temp, &mf->Plane(i)));
+      JXL_RETURN_IF_ERROR(Blur(mf->Plane(i), kSigmaHf, params, blur_temp, pool,
+                               &mf->Plane(i)));
       break;
     }
     for (size_t y = 0; y < ysize; ++y) {
@@ -434,8 +463,8 @@ Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
         Store(Load(d, row_mf + x), d, row_hf + x);
       }
     }
-    JXL_RETURN_IF_ERROR(
-        Blur(mf->Plane(i), kSigmaHf, params, blur_temp, &mf->Plane(i)));
+    JXL_RETURN_IF_ERROR(Blur(mf->Plane(i), kSigmaHf, params, blur_temp, pool,
+                             &mf->Plane(i)));
     static const double kRemoveMfRange = 0.29;
     static const double kAddMfRange = 0.1;
     if (i == 0) {
@@ -471,7 +500,7 @@ Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
 }
 
 Status SeparateHFAndUHF(const ButteraugliParams& params, ImageF* hf,
-                        ImageF* uhf, BlurTemp* blur_temp) {
+                        ImageF* uhf, BlurTemp* blur_temp, ThreadPool* pool) {
   const HWY_FULL(float) d;
   const size_t xsize = hf[0].xsize();
   const size_t ysize = hf[0].ysize();
@@ -488,7 +517,8 @@ Status SeparateHFAndUHF(const ButteraugliParams& params, ImageF* hf,
         row_uhf[x] = row_hf[x];
       }
     }
-    JXL_RETURN_IF_ERROR(Blur(hf[i], kSigmaUhf, params, blur_temp, &hf[i]));
+    JXL_RETURN_IF_ERROR(
+        Blur(hf[i], kSigmaUhf, params, blur_temp, pool, &hf[i]));
     static const double kRemoveHfRange = 1.5;
     static const double kAddHfRange = 0.132;
     static const double kRemoveUhfRange = 0.04;
@@ -541,16 +571,19 @@ void DeallocateHFAndUHF(ImageF* hf, ImageF* uhf) {
 
 Status SeparateFrequencies(size_t xsize, size_t ysize,
                            const ButteraugliParams& params, BlurTemp* blur_temp,
-                           const Image3F& xyb, PsychoImage& ps) {
+                           ThreadPool* pool, const Image3F& xyb,
+                           PsychoImage& ps) {
   JxlMemoryManager* memory_manager = xyb.memory_manager();
   JXL_ASSIGN_OR_RETURN(
       ps.lf, Image3F::Create(memory_manager, xyb.xsize(), xyb.ysize()));
   JXL_ASSIGN_OR_RETURN(
       ps.mf, Image3F::Create(memory_manager, xyb.xsize(), xyb.ysize()));
-  JXL_RETURN_IF_ERROR(SeparateLFAndMF(params, xyb, &ps.lf, &ps.mf, blur_temp));
-  JXL_RETURN_IF_ERROR(SeparateMFAndHF(params, &ps.mf, &ps.hf[0], blur_temp));
   JXL_RETURN_IF_ERROR(
-      SeparateHFAndUHF(params, &ps.hf[0], &ps.uhf[0], blur_temp));
+      SeparateLFAndMF(params, xyb, &ps.lf, &ps.mf, blur_temp, pool));
+  JXL_RETURN_IF_ERROR(
+      SeparateMFAndHF(params, &ps.mf, &ps.hf[0], blur_temp, pool));
+  JXL_RETURN_IF_ERROR(
+      SeparateHFAndUHF(params, &ps.hf[0], &ps.uhf[0], blur_temp, pool));
   return true;
 }
 
@@ -981,16 +1014,20 @@ static BUTTERAUGLI_INLINE float PaddedMaltaUnit(const ImageF& diffs,
   return GetLane(MaltaUnit(Tag(), df, &borderimage[4 * 12 + 4], 12));
 }
 
+// Number of rows of MaltaDiffMapT per pool task.
+constexpr size_t kMaltaRowsPerTask = 16;
+
 template <class Tag>
 static Status MaltaDiffMapT(const Tag tag, const ImageF& lum0,
                             const ImageF& lum1, const double w_0gt1,
                             const double w_0lt1, const double norm1,
                             const double len, const double mulli,
-                            ImageF* HWY_RESTRICT diffs,
+                            ThreadPool* pool, ImageF* HWY_RESTRICT diffs,
                             ImageF* HWY_RESTRICT block_diff_ac) {
   JXL_ENSURE(SameSize(lum0, lum1) && SameSize(lum0, *diffs));
   const size_t xsize_ = lum0.xsize();
   const size_t ysize_ = lum0.ysize();
+  const size_t num_tasks = DivCeil(ysize_, kMaltaRowsPerTask);
 
   const float kWeight0 = 0.5;
   const float kWeight1 = 0.33;
@@ -1000,107 +1037,109 @@ static Status MaltaDiffMapT(const Tag tag, const ImageF& lum0,
   const float norm2_0gt1 = w_pre0gt1 * norm1;
   const float norm2_0lt1 = w_pre0lt1 * norm1;
 
-  for (size_t y = 0; y < ysize_; ++y) {
-    const float* HWY_RESTRICT row0 = lum0.ConstRow(y);
-    const float* HWY_RESTRICT row1 = lum1.ConstRow(y);
-    float* HWY_RESTRICT row_diffs = diffs->Row(y);
-    for (size_t x = 0; x < xsize_; ++x) {
-      const float absval = 0.5f * (std::abs(row0[x]) + std::abs(row1[x]));
-      const float diff = row0[x] - row1[x];
-      const float scaler = norm2_0gt1 / (static_cast<float>(norm1) + absval);
-
-      // Primary symmetric quadratic objective.
-      row_diffs[x] = scaler * diff;
-
-      const float scaler2 = norm2_0lt1 / (static_cast<float>(norm1) + absval);
-      const double fabs0 = std::fabs(row0[x]);
-
-      // Secondary half-open quadratic objectives.
-      const double too_small = 0.55 * fabs0;
-      const double too_big = 1.05 * fabs0;
-
-      if (row0[x] < 0) {
-        if (row1[x] > -too_small) {
-          double impact = scaler2 * (row1[x] + too_small);
-          row_diffs[x] -= impact;
-        } else if (row1[x] < -too_big) {
-          double impact = scaler2 * (-row1[x] - too_big);
-          row_diffs[x] += impact;
-        }
-      } else {
-        if (row1[x] < too_small) {
-          double impact = scaler2 * (too_small - row1[x]);
-          row_diffs[x] += impact;
-        } else if (row1[x] > too_big) {
-          double impact = scaler2 * (row1[x] - too_big);
-          row_diffs[x] -= impact;
-        }
+  const HWY_FULL(float) df;
+  const auto compute_diffs = [&](const uint32_t task,
+                                 size_t /*thread*/) -> Status {
+    const auto vnorm1 = Set(df, norm1);
+    const auto vnorm2_0gt1 = Set(df, norm2_0gt1);
+    const auto vnorm2_0lt1 = Set(df, norm2_0lt1);
+    const auto too_small_mul = Set(df, 0.55f);
+    const auto too_big_mul = Set(df, 1.05f);
+    const size_t y_end = std::min(ysize_, (task + 1) * kMaltaRowsPerTask);
+    for (size_t y = task * kMaltaRowsPerTask; y < y_end; ++y) {
+      const float* HWY_RESTRICT row0 = lum0.ConstRow(y);
+      const float* HWY_RESTRICT row1 = lum1.ConstRow(y);
+      float* HWY_RESTRICT row_diffs = diffs->Row(y);
+      for (size_t x = 0; x < xsize_; x += Lanes(df)) {
+        const auto val0 = Load(df, row0 + x);
+        const auto val1 = Load(df, row1 + x);
+        const auto fabs0 = Abs(val0);
+        const auto absval = Mul(Set(df, 0.5f), Add(fabs0, Abs(val1)));
+        const auto inv_denom = Div(Set(df, 1.0f), Add(vnorm1, absval));
+
+        // Primary symmetric quadratic objective.
+        const auto primary = Mul(Mul(vnorm2_0gt1, inv_denom), Sub(val0, val1));
+
+        // Secondary half-open quadratic objectives. With val1 mirrored to
+        // the sign of val0, the penalty grows below too_small and above
+        // too_big; the two ranges do not overlap.
+        const auto negative = Lt(val0, Zero(df));
+        const auto mirrored1 = IfThenElse(negative, Neg(val1), val1);
+        const auto too_small = Mul(too_small_mul, fabs0);
+        const auto too_big = Mul(too_big_mul, fabs0);
+        const auto below = ZeroIfNegative(Sub(too_small, mirrored1));
+        const auto above = ZeroIfNegative(Sub(mirrored1, too_big));
+        const auto secondary =
+            Mul(Mul(vnorm2_0lt1, inv_denom), Sub(below, above));
+        Store(Add(primary, IfThenElse(negative, Neg(secondary), secondary)),
+              df, row_diffs + x);
       }
     }
-  }
-
-  size_t y0 = 0;
-  // Top
-  for (; y0 < 4; ++y0) {
-    float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
-    for (size_t x0 = 0; x0 < xsize_; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
-    }
-  }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_tasks, ThreadPool::NoInit,
+                                compute_diffs, "ButteraugliMaltaDiffs"));
 
-  const HWY_FULL(float) df;
   const size_t aligned_x = std::max(static_cast<size_t>(4), Lanes(df));
   const intptr_t stride = diffs->PixelsPerRow();
+  const auto accumulate_malta = [&](const uint32_t task,
+                                    size_t /*thread*/) -> Status {
+    const size_t y_end = std::min(ysize_, (task + 1) * kMaltaRowsPerTask);
+    for (size_t y0 = task * kMaltaRowsPerTask; y0 < y_end; ++y0) {
+      float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
+      if (y0 < 4 || y0 + 4 >= ysize_) {
+        // Top and bottom
+        for (size_t x0 = 0; x0 < xsize_; ++x0) {
+          row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
+        }
+        continue;
+      }
+      // Middle
+      const float* BUTTERAUGLI_RESTRICT row_in = diffs->ConstRow(y0);
+      size_t x0 = 0;
+      for (; x0 < aligned_x; ++x0) {
+        row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
+      }
+      for (; x0 + Lanes(df) + 4 <= xsize_; x0 += Lanes(df)) {
+        auto diff = Load(df, row_diff + x0);
+        diff = Add(diff, MaltaUnit(Tag(), df, row_in + x0, stride));
+        Store(diff, df, row_diff + x0);
+      }
 
-  // Middle
-  for (; y0 < ysize_ - 4; ++y0) {
-    const float* BUTTERAUGLI_RESTRICT row_in = diffs->ConstRow(y0);
-    float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
-    size_t x0 = 0;
-    for (; x0 < aligned_x; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
-    }
-    for (; x0 + Lanes(df) + 4 <= xsize_; x0 += Lanes(df)) {
-      auto diff = Load(df, row_diff + x0);
-      diff = Add(diff, MaltaUnit(Tag(), df, row_in + x0, stride));
-      Store(diff, df, row_diff + x0);
-    }
-
-    for (; x0 < xsize_; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
-    }
-  }
-
-  // Bottom
-  for (; y0 < ysize_; ++y0) {
-    float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
-    for (size_t x0 = 0; x0 < xsize_; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
+      for (; x0 < xsize_; ++x0) {
+        row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
+      }
     }
-  }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_tasks, ThreadPool::NoInit,
+                                accumulate_malta, "ButteraugliMalta"));
   return true;
 }
 
 // Need non-template wrapper functions for HWY_EXPORT.
 Status MaltaDiffMap(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
-                    const double w_0lt1, const double norm1,
+                    const double w_0lt1, const double norm1, ThreadPool* pool,
                     ImageF* HWY_RESTRICT diffs,
                     ImageF* HWY_RESTRICT block_diff_ac) {
   const double len = 3.75;
   static const double mulli = 0.39905817637;
   JXL_RETURN_IF_ERROR(MaltaDiffMapT(MaltaTag(), lum0, lum1, w_0gt1, w_0lt1,
-                                    norm1, len, mulli, diffs, block_diff_ac));
+                                    norm1, len, mulli, pool, diffs,
+                                    block_diff_ac));
   return true;
 }
 
 Status MaltaDiffMapLF(const ImageF& lum0, const ImageF& lum1,
                       const double w_0gt1, const double w_0lt1,
-                      const double norm1, ImageF* HWY_RESTRICT diffs,
+                      const double norm1, ThreadPool* pool,
+                      ImageF* HWY_RESTRICT diffs,
                       ImageF* HWY_RESTRICT block_diff_ac) {
   const double len = 3.75;
   static const double mulli = 0.611612573796;
   JXL_RETURN_IF_ERROR(MaltaDiffMapT(MaltaTagLF(), lum0, lum1, w_0gt1, w_0lt1,
-                                    norm1, len, mulli, diffs, block_diff_ac));
+                                    norm1, len, mulli, pool, diffs,
+                                    block_diff_ac));
   return true;
 }
 
@@ -1218,7 +1257,7 @@ void FuzzyErosion(const ImageF& from, ImageF* to) {
 // in the two images. img_diff_ac may be null.
 Status Mask(const ImageF& mask0, const ImageF& mask1,
             const ButteraugliParams& params, BlurTemp* blur_temp,
-            ImageF* BUTTERAUGLI_RESTRICT mask,
+            ThreadPool* pool, ImageF* BUTTERAUGLI_RESTRICT mask,
             ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
   const size_t xsize = mask0.xsize();
   const size_t ysize = mask0.ysize();
@@ -1237,9 +1276,11 @@ Status Mask(const ImageF& mask0, const ImageF& mask1,
                        ImageF::Create(memory_manager, xsize, ysize));
   DiffPrecompute(mask0, kMul, kBias, &diff0);
   DiffPrecompute(mask1, kMul, kBias, &diff1);
-  JXL_RETURN_IF_ERROR(Blur(diff0, kRadius, params, blur_temp, &blurred0));
+  JXL_RETURN_IF_ERROR(
+      Blur(diff0, kRadius, params, blur_temp, pool, &blurred0));
   FuzzyErosion(blurred0, &diff0);
-  JXL_RETURN_IF_ERROR(Blur(diff1, kRadius, params, blur_temp, &blurred1));
+  JXL_RETURN_IF_ERROR(
+      Blur(diff1, kRadius, params, blur_temp, pool, &blurred1));
   for (size_t y = 0; y < ysize; ++y) {
     for (size_t x = 0; x < xsize; ++x) {
       mask->Row(y)[x] = diff0.Row(y)[x];
@@ -1257,7 +1298,7 @@ Status Mask(const ImageF& mask0, const ImageF& mask1,
 Status MaskPsychoImage(const PsychoImage& pi0, const PsychoImage& pi1,
                        const size_t xsize, const size_t ysize,
                        const ButteraugliParams& params, BlurTemp* blur_temp,
-                       ImageF* BUTTERAUGLI_RESTRICT mask,
+                       ThreadPool* pool, ImageF* BUTTERAUGLI_RESTRICT mask,
                        ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
   JxlMemoryManager* memory_manager = pi0.hf[0].memory_manager();
   JXL_ASSIGN_OR_RETURN(ImageF mask0,
@@ -1266,7 +1307,8 @@ Status MaskPsychoImage(const PsychoImage& pi0, const PsychoImage& pi1,
                        ImageF::Create(memory_manager, xsize, ysize));
   CombineChannelsForMasking(&pi0.hf[0], &pi0.uhf[0], &mask0);
   CombineChannelsForMasking(&pi1.hf[0], &pi1.uhf[0], &mask1);
-  JXL_RETURN_IF_ERROR(Mask(mask0, mask1, params, blur_temp, mask, diff_ac));
+  JXL_RETURN_IF_ERROR(
+      Mask(mask0, mask1, params, blur_temp, pool, mask, diff_ac));
   return true;
 }
 
@@ -1296,11 +1338,11 @@ inline float MaskColor(const float color[3], const float mask) {
 Status CombineChannelsToDiffmap(const ImageF& mask,
                                 const Image3F& block_diff_dc,
                                 const Image3F& block_diff_ac, float xmul,
-                                ImageF* result) {
+                                ThreadPool* pool, ImageF* result) {
   JXL_ENSURE(SameSize(mask, *result));
   size_t xsize = mask.xsize();
   size_t ysize = mask.ysize();
-  for (size_t y = 0; y < ysize; ++y) {
+  const auto combine_row = [&](const uint32_t y, size_t /*thread*/) -> Status {
     float* BUTTERAUGLI_RESTRICT row_out = result->Row(y);
     for (size_t x = 0; x < xsize; ++x) {
       float val = mask.Row(y)[x];
@@ -1317,8 +1359,10 @@ Status CombineChannelsToDiffmap(const ImageF& mask,
       row_out[x] = std::sqrt(MaskColor(diff_dc, dc_maskval) +
                              MaskColor(diff_ac, maskval));
     }
-  }
-  return true;
+    return true;
+  };
+  return RunOnPool(pool, 0, ysize, ThreadPool::NoInit, combine_row,
+                   "ButteraugliCombineChannels");
 }
 
 // Adds weighted L2 difference between i0 and i1 to diffmap.
@@ -1471,18 +1515,17 @@ BUTTERAUGLI_INLINE void OpsinAbsorbance(const DF df, const V& in0, const V& in1,
 
 // `blurred` is a temporary image used inside this function and not returned.
 Status OpsinDynamicsImage(const Image3F& rgb, const ButteraugliParams& params,
-                          Image3F* blurred, BlurTemp* blur_temp, Image3F* xyb) {
+                          Image3F* blurred, BlurTemp* blur_temp,
+                          ThreadPool* pool, Image3F* xyb) {
   JXL_ENSURE(blurred != nullptr);
   const double kSigma = 1.2;
-  JXL_RETURN_IF_ERROR(
-      Blur(rgb.Plane(0), kSigma, params, blur_temp, &blurred->Plane(0)));
-  JXL_RETURN_IF_ERROR(
-      Blur(rgb.Plane(1), kSigma, params, blur_temp, &blurred->Plane(1)));
-  JXL_RETURN_IF_ERROR(
-      Blur(rgb.Plane(2), kSigma, params, blur_temp, &blurred->Plane(2)));
+  for (size_t c = 0; c < 3; ++c) {
+    JXL_RETURN_IF_ERROR(Blur(rgb.Plane(c), kSigma, params, blur_temp, pool,
+                             &blurred->Plane(c)));
+  }
   const HWY_FULL(float) df;
-  const auto intensity_target_multiplier = Set(df, params.intensity_target);
-  for (size_t y = 0; y < rgb.ysize(); ++y) {
+  const auto process_row = [&](const uint32_t y, size_t /*thread*/) -> Status {
+    const auto intensity_target_multiplier = Set(df, params.intensity_target);
     const float* row_r = rgb.ConstPlaneRow(0, y);
     const float* row_g = rgb.ConstPlaneRow(1, y);
     const float* row_b = rgb.ConstPlaneRow(2, y);
@@ -1540,13 +1583,15 @@ Status OpsinDynamicsImage(const Image3F& rgb, const ButteraugliParams& params,
       Store(Add(cur_mixed0, cur_mixed1), df, row_out_y + x);
       Store(cur_mixed2, df, row_out_b + x);
     }
-  }
-  return true;
+    return true;
+  };
+  return RunOnPool(pool, 0, rgb.ysize(), ThreadPool::NoInit, process_row,
+                   "ButteraugliOpsinDynamics");
 }
 
 Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
                                  const ButteraugliParams& params,
-                                 ImageF& diffmap) {
+                                 ThreadPool* pool, ImageF& diffmap) {
   // image0 and image1 are in linear sRGB color space
   const size_t xsize = image0.xsize();
   const size_t ysize = image0.ysize();
@@ -1557,9 +1602,9 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
     JXL_ASSIGN_OR_RETURN(Image3F temp,
                          Image3F::Create(memory_manager, xsize, ysize));
     JXL_RETURN_IF_ERROR(
-        OpsinDynamicsImage(image0, params, &temp, &blur_temp, &image0));
+        OpsinDynamicsImage(image0, params, &temp, &blur_temp, pool, &image0));
     JXL_RETURN_IF_ERROR(
-        OpsinDynamicsImage(image1, params, &temp, &blur_temp, &image1));
+        OpsinDynamicsImage(image1, params, &temp, &blur_temp, pool, &image1));
   }
   // image0 and image1 are in XYB color space
   JXL_ASSIGN_OR_RETURN(ImageF block_diff_dc,
@@ -1573,9 +1618,9 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
     JXL_ASSIGN_OR_RETURN(Image3F lf1,
                          Image3F::Create(memory_manager, xsize, ysize));
     JXL_RETURN_IF_ERROR(
-        SeparateLFAndMF(params, image0, &lf0, &image0, &blur_temp));
+        SeparateLFAndMF(params, image0, &lf0, &image0, &blur_temp, pool));
     JXL_RETURN_IF_ERROR(
-        SeparateLFAndMF(params, image1, &lf1, &image1, &blur_temp));
+        SeparateLFAndMF(params, image1, &lf1, &image1, &blur_temp, pool));
     for (size_t c = 0; c < 3; ++c) {
       L2Diff(lf0.Plane(c), lf1.Plane(c), wmul[6 + c], &block_diff_dc);
     }
@@ -1583,8 +1628,10 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
   // image0 and image1 are MF residuals (before blurring) in XYB color space
   ImageF hf0[2];
   ImageF hf1[2];
-  JXL_RETURN_IF_ERROR(SeparateMFAndHF(params, &image0, &hf0[0], &blur_temp));
-  JXL_RETURN_IF_ERROR(SeparateMFAndHF(params, &image1, &hf1[0], &blur_temp));
+  JXL_RETURN_IF_ERROR(
+      SeparateMFAndHF(params, &image0, &hf0[0], &blur_temp, pool));
+  JXL_RETURN_IF_ERROR(
+      SeparateMFAndHF(params, &image1, &hf1[0], &blur_temp, pool));
   // image0 and image1 are MF-images in XYB color space
 
   JXL_ASSIGN_OR_RETURN(ImageF block_diff_ac,
@@ -1595,11 +1642,11 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
     JXL_ASSIGN_OR_RETURN(ImageF diffs,
                          ImageF::Create(memory_manager, xsize, ysize));
     JXL_RETURN_IF_ERROR(MaltaDiffMapLF(image0.Plane(1), image1.Plane(1),
-                                       wMfMalta, wMfMalta, norm1Mf, &diffs,
-                                       &block_diff_ac));
+                                       wMfMalta, wMfMalta, norm1Mf, pool,
+                                       &diffs, &block_diff_ac));
     JXL_RETURN_IF_ERROR(MaltaDiffMapLF(image0.Plane(0), image1.Plane(0),
-                                       wMfMaltaX, wMfMaltaX, norm1MfX, &diffs,
-                                       &block_diff_ac));
+                                       wMfMaltaX, wMfMaltaX, norm1MfX, pool,
+                                       &diffs, &block_diff_ac));
   }
   for (size_t c = 0; c < 3; ++c) {
     L2Diff(image0.Plane(c), image1.Plane(c), wmul[3 + c], &block_diff_ac);
@@ -1611,8 +1658,10 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
 
   ImageF uhf0[2];
   ImageF uhf1[2];
-  JXL_RETURN_IF_ERROR(SeparateHFAndUHF(params, &hf0[0], &uhf0[0], &blur_temp));
-  JXL_RETURN_IF_ERROR(SeparateHFAndUHF(params, &hf1[0], &uhf1[0], &blur_temp));
+  JXL_RETURN_IF_ERROR(
+      SeparateHFAndUHF(params, &hf0[0], &uhf0[0], &blur_temp, pool));
+  JXL_RETURN_IF_ERROR(
+      SeparateHFAndUHF(params, &hf1[0], &uhf1[0], &blur_temp, pool));
 
   // continue accumulating ac diff image from HF and UHF images
   const float hf_asymmetry = params.hf_asymmetry;
@@ -1620,17 +1669,19 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
     JXL_ASSIGN_OR_RETURN(ImageF diffs,
                          ImageF::Create(memory_manager, xsize, ysize));
     JXL_RETURN_IF_ERROR(MaltaDiffMap(uhf0[1], uhf1[1], wUhfMalta * hf_asymmetry,
-                                     wUhfMalta / hf_asymmetry, norm1Uhf, &diffs,
-                                     &block_diff_ac));
+                                     wUhfMalta / hf_asymmetry, norm1Uhf, pool,
+                                     &diffs, &block_diff_ac));
     JXL_RETURN_IF_ERROR(MaltaDiffMap(
         uhf0[0], uhf1[0], wUhfMaltaX * hf_asymmetry, wUhfMaltaX / hf_asymmetry,
-        norm1UhfX, &diffs, &block_diff_ac));
+        norm1UhfX, pool, &diffs, &block_diff_ac));
     JXL_RETURN_IF_ERROR(MaltaDiffMapLF(
         hf0[1], hf1[1], wHfMalta * std::sqrt(hf_asymmetry),
-        wHfMalta / std::sqrt(hf_asymmetry), norm1Hf, &diffs, &block_diff_ac));
+        wHfMalta / std::sqrt(hf_asymmetry), norm1Hf, pool, &diffs,
+        &block_diff_ac));
     JXL_RETURN_IF_ERROR(MaltaDiffMapLF(
         hf0[0], hf1[0], wHfMaltaX * std::sqrt(hf_asymmetry),
-        wHfMaltaX / std::sqrt(hf_asymmetry), norm1HfX, &diffs, &block_diff_ac));
+        wHfMaltaX / std::sqrt(hf_asymmetry), norm1HfX, pool, &diffs,
+        &block_diff_ac));
   }
   for (size_t c = 0; c < 2; ++c) {
     L2DiffAsymmetric(hf0[c], hf1[c], wmul[c] * hf_asymmetry,
@@ -1650,7 +1701,7 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
     DeallocateHFAndUHF(&hf1[0], &uhf1[0]);
     DeallocateHFAndUHF(&hf0[0], &uhf0[0]);
     JXL_RETURN_IF_ERROR(
-        Mask(mask0, mask1, params, &blur_temp, &mask, &block_diff_ac));
+        Mask(mask0, mask1, params, &blur_temp, pool, &mask, &block_diff_ac));
   }
 
   // compute final diffmap from mask image and ac and dc diff images
@@ -1791,17 +1842,18 @@ Image3F* ButteraugliComparator::Temp() const {
 void ButteraugliComparator::ReleaseTemp() const { temp_in_use_.clear(); }
 
 ButteraugliComparator::ButteraugliComparator(size_t xsize, size_t ysize,
-                                             const ButteraugliParams& params)
-    : xsize_(xsize), ysize_(ysize), params_(params) {}
+                                             const ButteraugliParams& params,
+                                             ThreadPool* pool)
+    : xsize_(xsize), ysize_(ysize), params_(params), pool_(pool) {}
 
 StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
-    const Image3F& rgb0, const ButteraugliParams& params) {
+    const Image3F& rgb0, const ButteraugliParams& params, ThreadPool* pool) {
   size_t xsize = rgb0.xsize();
   size_t ysize = rgb0.ysize();
   JxlMemoryManager* memory_manager = rgb0.memory_manager();
   std::unique_ptr<ButteraugliComparator> result =
       std::unique_ptr<ButteraugliComparator>(
-          new ButteraugliComparator(xsize, ysize, params));
+          new ButteraugliComparator(xsize, ysize, params, pool));
   JXL_ASSIGN_OR_RETURN(result->temp_,
                        Image3F::Create(memory_manager, xsize, ysize));
 
@@ -1812,23 +1864,108 @@ StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
   JXL_ASSIGN_OR_RETURN(Image3F xyb0,
                        Image3F::Create(memory_manager, xsize, ysize));
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-      rgb0, params, result->Temp(), &result->blur_temp_, &xyb0));
+      rgb0, params, result->Temp(), &result->blur_temp_, pool, &xyb0));
   result->ReleaseTemp();
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(SeparateFrequencies)(
-      xsize, ysize, params, &result->blur_temp_, xyb0, result->pi0_));
+      xsize, ysize, params, &result->blur_temp_, pool, xyb0, result->pi0_));
 
   // Awful recursive construction of samples of different resolution.
   // This is an after-thought and possibly somewhat parallel in
   // functionality with the PsychoImage multi-resolution approach.
   JXL_ASSIGN_OR_RETURN(Image3F subsampledRgb0, SubSample2x(rgb0));
-  JXL_ASSIGN_OR_RETURN(result->sub_,
-                       ButteraugliComparator::Make(subsampledRgb0, params));
+  JXL_ASSIGN_OR_RETURN(
+      result->sub_, ButteraugliComparator::Make(subsampledRgb0, params, pool));
+  return result;
+}
+
+StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Crop(
+    const Rect& rect, bool with_sub) const {
+  JxlMemoryManager* memory_manager = temp_.memory_manager();
+  const size_t xsize = rect.xsize();
+  const size_t ysize = rect.ysize();
+  std::unique_ptr<ButteraugliComparator> result =
+      std::unique_ptr<ButteraugliComparator>(
+          new ButteraugliComparator(xsize, ysize, params_, pool_));
+  JXL_ASSIGN_OR_RETURN(result->temp_,
+                       Image3F::Create(memory_manager, xsize, ysize));
+  if (xsize_ < 8 || ysize_ < 8 || xsize < 8 || ysize < 8) {
+    return result;
+  }
+
+  const auto crop_plane = [&](const ImageF& from, ImageF* to) -> Status {
+    JXL_ASSIGN_OR_RETURN(*to, ImageF::Create(memory_manager, xsize, ysize));
+    return CopyImageTo(rect, from, Rect(*to), to);
+  };
+  const auto crop_image = [&](const Image3F& from, Image3F* to) -> Status {
+    JXL_ASSIGN_OR_RETURN(*to, Image3F::Create(memory_manager, xsize, ysize));
+    return CopyImageTo(rect, from, Rect(*to), to);
+  };
+  for (size_t i = 0; i < 2; ++i) {
+    JXL_RETURN_IF_ERROR(crop_plane(pi0_.uhf[i], &result->pi0_.uhf[i]));
+    JXL_RETURN_IF_ERROR(crop_plane(pi0_.hf[i], &result->pi0_.hf[i]));
+  }
+  JXL_RETURN_IF_ERROR(crop_image(pi0_.mf, &result->pi0_.mf));
+  JXL_RETURN_IF_ERROR(crop_image(pi0_.lf, &result->pi0_.lf));
+
+  if (with_sub && sub_) {
+    // The caller keeps rect.x0() and rect.y0() even, so that the subsampled
+    // pixels of the crop are those of the full image.
+    const Rect sub_rect(rect.x0() / 2, rect.y0() / 2, DivCeil(xsize, 2),
+                        DivCeil(ysize, 2), sub_->xsize_, sub_->ysize_);
+    JXL_ASSIGN_OR_RETURN(result->sub_,
+                         sub_->Crop(sub_rect, /*with_sub=*/false));
+  }
   return result;
 }
 
+Status ButteraugliComparator::UpdateDiffmap(const Image3F& rgb1,
+                                            const Rect& rect,
+                                            ImageF& diffmap) const {
+  if (rgb1.xsize() != xsize_ || rgb1.ysize() != ysize_) {
+    return JXL_FAILURE("Butteraugli: image sizes differ");
+  }
+  if (diffmap.xsize() != xsize_ || diffmap.ysize() != ysize_) {
+    return JXL_FAILURE("Butteraugli: diffmap does not match the image");
+  }
+  const Rect full(0, 0, xsize_, ysize_);
+  if (!rect.IsInside(full)) {
+    return JXL_FAILURE("Butteraugli: changed rect outside of the image");
+  }
+  if (rect.xsize() == 0 || rect.ysize() == 0) return true;
+
+  // Pixels of the diffmap that the change can affect, and the region they
+  // depend on; the latter starts at even coordinates, see Crop().
+  const Rect affected = rect.Extend(kDiffmapSupport, full);
+  const Rect extended = affected.Extend(kDiffmapSupport, full);
+  const size_t x0 = extended.x0() & ~static_cast<size_t>(1);
+  const size_t y0 = extended.y0() & ~static_cast<size_t>(1);
+  const Rect context(x0, y0, extended.x1() - x0, extended.y1() - y0);
+  // Below 16 pixels the cropped sub_ would fall under the 8 pixel minimum
+  // that the full one may still have.
+  if (context.xsize() < 16 || context.ysize() < 16 ||
+      (context.xsize() == xsize_ && context.ysize() == ysize_)) {
+    return Diffmap(rgb1, diffmap);
+  }
+
+  JxlMemoryManager* memory_manager = rgb1.memory_manager();
+  JXL_ASSIGN_OR_RETURN(std::unique_ptr<ButteraugliComparator> cropped,
+                       Crop(context, /*with_sub=*/true));
+  JXL_ASSIGN_OR_RETURN(
+      Image3F rgb1_crop,
+      Image3F::Create(memory_manager, context.xsize(), context.ysize()));
+  JXL_RETURN_IF_ERROR(
+      CopyImageTo(context, rgb1, Rect(rgb1_crop), &rgb1_crop));
+  ImageF local;
+  JXL_RETURN_IF_ERROR(cropped->Diffmap(rgb1_crop, local));
+  const Rect local_affected(affected.x0() - context.x0(),
+                            affected.y0() - context.y0(), affected.xsize(),
+                            affected.ysize());
+  return CopyImageTo(local_affected, local, affected, &diffmap);
+}
+
 Status ButteraugliComparator::Mask(ImageF* BUTTERAUGLI_RESTRICT mask) const {
   return HWY_DYNAMIC_DISPATCH(MaskPsychoImage)(
-      pi0_, pi0_, xsize_, ysize_, params_, &blur_temp_, mask, nullptr);
+      pi0_, pi0_, xsize_, ysize_, params_, &blur_temp_, pool_, mask, nullptr);
 }
 
 Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
@@ -1841,7 +1978,7 @@ Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
   JXL_ASSIGN_OR_RETURN(Image3F xyb1,
                        Image3F::Create(memory_manager, xsize_, ysize_));
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-      rgb1, params_, Temp(), &blur_temp_, &xyb1));
+      rgb1, params_, Temp(), &blur_temp_, pool_, &xyb1));
   ReleaseTemp();
   JXL_RETURN_IF_ERROR(DiffmapOpsinDynamicsImage(xyb1, result));
   if (sub_) {
@@ -1853,7 +1990,8 @@ Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
         Image3F::Create(memory_manager, sub_->xsize_, sub_->ysize_));
     JXL_ASSIGN_OR_RETURN(Image3F subsampledRgb1, SubSample2x(rgb1));
     JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-        subsampledRgb1, params_, sub_->Temp(), &sub_->blur_temp_, &sub_xyb));
+        subsampledRgb1, params_, sub_->Temp(), &sub_->blur_temp_, pool_,
+        &sub_xyb));
     sub_->ReleaseTemp();
     ImageF subresult;
     JXL_RETURN_IF_ERROR(sub_->DiffmapOpsinDynamicsImage(sub_xyb, subresult));
@@ -1871,7 +2009,7 @@ Status ButteraugliComparator::DiffmapOpsinDynamicsImage(const Image3F& xyb1,
   }
   PsychoImage pi1;
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(SeparateFrequencies)(
-      xsize_, ysize_, params_, &blur_temp_, xyb1, pi1));
+      xsize_, ysize_, params_, &blur_temp_, pool_, xyb1, pi1));
   JXL_ASSIGN_OR_RETURN(result, ImageF::Create(memory_manager, xsize_, ysize_));
   return DiffmapPsychoImage(pi1, result);
 }
@@ -1879,19 +2017,22 @@ Status ButteraugliComparator::DiffmapOpsinDynamicsImage(const Image3F& xyb1,
 namespace {
 
 Status MaltaDiffMap(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
-                    const double w_0lt1, const double norm1,
+                    const double w_0lt1, const double norm1, ThreadPool* pool,
                     ImageF* HWY_RESTRICT diffs,
                     Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
   return HWY_DYNAMIC_DISPATCH(MaltaDiffMap)(lum0, lum1, w_0gt1, w_0lt1, norm1,
-                                            diffs, &block_diff_ac->Plane(c));
+                                            pool, diffs,
+                                            &block_diff_ac->Plane(c));
 }
 
 Status MaltaDiffMapLF(const ImageF& lum0, const ImageF& lum1,
                       const double w_0gt1, const double w_0lt1,
-                      const double norm1, ImageF* HWY_RESTRICT diffs,
+                      const double norm1, ThreadPool* pool,
+                      ImageF* HWY_RESTRICT diffs,
                       Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
   return HWY_DYNAMIC_DISPATCH(MaltaDiffMapLF)(lum0, lum1, w_0gt1, w_0lt1, norm1,
-                                              diffs, &block_diff_ac->Plane(c));
+                                              pool, diffs,
+                                              &block_diff_ac->Plane(c));
 }
 
 }  // namespace
@@ -1914,23 +2055,25 @@ Status ButteraugliComparator::DiffmapPsychoImage(const PsychoImage& pi1,
   ZeroFillImage(&block_diff_ac);
   JXL_RETURN_IF_ERROR(MaltaDiffMap(
       pi0_.uhf[1], pi1.uhf[1], wUhfMalta * hf_asymmetry_,
-      wUhfMalta / hf_asymmetry_, norm1Uhf, &diffs, &block_diff_ac, 1));
+      wUhfMalta / hf_asymmetry_, norm1Uhf, pool_, &diffs, &block_diff_ac, 1));
   JXL_RETURN_IF_ERROR(MaltaDiffMap(
       pi0_.uhf[0], pi1.uhf[0], wUhfMaltaX * hf_asymmetry_,
-      wUhfMaltaX / hf_asymmetry_, norm1UhfX, &diffs, &block_diff_ac, 0));
+      wUhfMaltaX / hf_asymmetry_, norm1UhfX, pool_, &diffs, &block_diff_ac, 0));
   JXL_RETURN_IF_ERROR(MaltaDiffMapLF(
       pi0_.hf[1], pi1.hf[1], wHfMalta * std::sqrt(hf_asymmetry_),
-      wHfMalta / std::sqrt(hf_asymmetry_), norm1Hf, &diffs, &block_diff_ac, 1));
+      wHfMalta / std::sqrt(hf_asymmetry_), norm1Hf, pool_, &diffs,
+      &block_diff_ac, 1));
   JXL_RETURN_IF_ERROR(MaltaDiffMapLF(pi0_.hf[0], pi1.hf[0],
                                      wHfMaltaX * std::sqrt(hf_asymmetry_),
                                      wHfMaltaX / std::sqrt(hf_asymmetry_),
-                                     norm1HfX, &diffs, &block_diff_ac, 0));
+                                     norm1HfX, pool_, &diffs, &block_diff_ac,
+                                     0));
   JXL_RETURN_IF_ERROR(MaltaDiffMapLF(pi0_.mf.Plane(1), pi1.mf.Plane(1),
-                                     wMfMalta, wMfMalta, norm1Mf, &diffs,
-                                     &block_diff_ac, 1));
+                                     wMfMalta, wMfMalta, norm1Mf, pool_,
+                                     &diffs, &block_diff_ac, 1));
   JXL_RETURN_IF_ERROR(MaltaDiffMapLF(pi0_.mf.Plane(0), pi1.mf.Plane(0),
-                                     wMfMaltaX, wMfMaltaX, norm1MfX, &diffs,
-                                     &block_diff_ac, 0));
+                                     wMfMaltaX, wMfMaltaX, norm1MfX, pool_,
+                                     &diffs, &block_diff_ac, 0));
 
   JXL_ASSIGN_OR_RETURN(Image3F block_diff_dc,
                        Image3F::Create(memory_manager, xsize_, ysize_));
@@ -1948,11 +2091,11 @@ Status ButteraugliComparator::DiffmapPsychoImage(const PsychoImage& pi1,
 
   ImageF mask;
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(MaskPsychoImage)(
-      pi0_, pi1, xsize_, ysize_, params_, &blur_temp_, &mask,
+      pi0_, pi1, xsize_, ysize_, params_, &blur_temp_, pool_, &mask,
       &block_diff_ac.Plane(1)));
 
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(CombineChannelsToDiffmap)(
-      mask, block_diff_dc, block_diff_ac, xmul_, &diffmap));
+      mask, block_diff_dc, block_diff_ac, xmul_, pool_, &diffmap));
   return true;
 }
 
@@ -2016,7 +2159,8 @@ bool ButteraugliDiffmapSmall(const Image3F& rgb0, const Image3F& rgb1,
 }
 
 Status ButteraugliDiffmap(const Image3F& rgb0, const Image3F& rgb1,
-                          const ButteraugliParams& params, ImageF& diffmap) {
+                          const ButteraugliParams& params, ImageF& diffmap,
+                          ThreadPool* pool) {
   const size_t xsize = rgb0.xsize();
   const size_t ysize = rgb0.ysize();
   if (xsize < 1 || ysize < 1) {
@@ -2030,11 +2174,60 @@ Status ButteraugliDiffmap(const Image3F& rgb0, const Image3F& rgb1,
     return ButteraugliDiffmapSmall<kMax>(rgb0, rgb1, params, diffmap);
   }
   JXL_ASSIGN_OR_RETURN(std::unique_ptr<ButteraugliComparator> butteraugli,
-                       ButteraugliComparator::Make(rgb0, params));
+                       ButteraugliComparator::Make(rgb0, params, pool));
   JXL_RETURN_IF_ERROR(butteraugli->Diffmap(rgb1, diffmap));
   return true;
 }
 
+Status ButteraugliDiffmapTiled(const Image3F& rgb0, const Image3F& rgb1,
+                               const ButteraugliParams& params,
+                               size_t tile_size, ImageF& diffmap,
+                               ThreadPool* pool) {
+  const size_t xsize = rgb0.xsize();
+  const size_t ysize = rgb0.ysize();
+  if (!SameSize(rgb0, rgb1)) {
+    return JXL_FAILURE("Size mismatch");
+  }
+  if (tile_size == 0) {
+    return JXL_FAILURE("Invalid tile size");
+  }
+  if (xsize <= tile_size && ysize <= tile_size) {
+    return ButteraugliDiffmap(rgb0, rgb1, params, diffmap, pool);
+  }
+  JxlMemoryManager* memory_manager = rgb0.memory_manager();
+  JXL_ASSIGN_OR_RETURN(diffmap, ImageF::Create(memory_manager, xsize, ysize));
+  const Rect full(0, 0, xsize, ysize);
+  for (size_t y = 0; y < ysize; y += tile_size) {
+    for (size_t x = 0; x < xsize; x += tile_size) {
+      const Rect tile(x, y, tile_size, tile_size, xsize, ysize);
+      // Starts at even coordinates, so that the subsampled pixels of the crops
+      // are those of the full images.
+      const Rect extended =
+          tile.Extend(ButteraugliComparator::kDiffmapSupport, full);
+      const size_t x0 = extended.x0() & ~static_cast<size_t>(1);
+      const size_t y0 = extended.y0() & ~static_cast<size_t>(1);
+      const Rect context(x0, y0, extended.x1() - x0, extended.y1() - y0);
+      JXL_ASSIGN_OR_RETURN(
+          Image3F rgb0_crop,
+          Image3F::Create(memory_manager, context.xsize(), context.ysize()));
+      JXL_RETURN_IF_ERROR(
+          CopyImageTo(context, rgb0, Rect(rgb0_crop), &rgb0_crop));
+      JXL_ASSIGN_OR_RETURN(
+          Image3F rgb1_crop,
+          Image3F::Create(memory_manager, context.xsize(), context.ysize()));
+      JXL_RETURN_IF_ERROR(
+          CopyImageTo(context, rgb1, Rect(rgb1_crop), &rgb1_crop));
+      ImageF local;
+      JXL_RETURN_IF_ERROR(
+          ButteraugliDiffmap(rgb0_crop, rgb1_crop, params, local, pool));
+      const Rect local_tile(tile.x0() - context.x0(), tile.y0() - context.y0(),
+                            tile.xsize(), tile.ysize());
+      JXL_RETURN_IF_ERROR(CopyImageTo(local_tile, local, tile, &diffmap));
+    }
+  }
+  return true;
+}
+
 bool ButteraugliInterface(const Image3F& rgb0, const Image3F& rgb1,
                           float hf_asymmetry, float xmul, ImageF& diffmap,
                           double& diffvalue) {
@@ -2046,8 +2239,8 @@ bool ButteraugliInterface(const Image3F& rgb0, const Image3F& rgb1,
 
 bool ButteraugliInterface(const Image3F& rgb0, const Image3F& rgb1,
                           const ButteraugliParams& params, ImageF& diffmap,
-                          double& diffvalue) {
-  if (!ButteraugliDiffmap(rgb0, rgb1, params, diffmap)) {
+                          double& diffvalue, ThreadPool* pool) {
+  if (!ButteraugliDiffmap(rgb0, rgb1, params, diffmap, pool)) {
     return false;
   }
   diffvalue = ButteraugliScoreFromDiffmap(diffmap, &params);
@@ -2056,7 +2249,8 @@ bool ButteraugliInterface(const Image3F& rgb0, const Image3F& rgb1,
 
 Status ButteraugliInterfaceInPlace(Image3F&& rgb0, Image3F&& rgb1,
                                    const ButteraugliParams& params,
-                                   ImageF& diffmap, double& diffvalue) {
+                                   ImageF& diffmap, double& diffvalue,
+                                   ThreadPool* pool) {
   const size_t xsize = rgb0.xsize();
   const size_t ysize = rgb0.ysize();
   if (xsize < 1 || ysize < 1) {
@@ -2076,10 +2270,10 @@ Status ButteraugliInterfaceInPlace(Image3F&& rgb0, Image3F&& rgb1,
     JXL_ASSIGN_OR_RETURN(Image3F rgb0_sub, SubSample2x(rgb0));
     JXL_ASSIGN_OR_RETURN(Image3F rgb1_sub, SubSample2x(rgb1));
     JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ButteraugliDiffmapInPlace)(
-        rgb0_sub, rgb1_sub, params, subdiffmap));
+        rgb0_sub, rgb1_sub, params, pool, subdiffmap));
   }
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ButteraugliDiffmapInPlace)(
-      rgb0, rgb1, params, diffmap));
+      rgb0, rgb1, params, pool, diffmap));
   if (xsize >= 15 && ysize >= 15) {
     AddSupersampled2x(subdiffmap, 0.5, diffmap);
   }
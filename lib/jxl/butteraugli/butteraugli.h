@@ -17,6 +17,8 @@
 #include <memory>
 
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/image.h"
 
@@ -76,10 +78,12 @@ struct ButteraugliParams {
 // A diffvalue between kButteraugliGood and kButteraugliBad indicates that
 // a subtle difference can be observed between the images.
 //
+// The work is split over rows of the image on `pool`, which may be null.
+//
 // Returns true on success.
 bool ButteraugliInterface(const Image3F &rgb0, const Image3F &rgb1,
                           const ButteraugliParams &params, ImageF &diffmap,
-                          double &diffvalue);
+                          double &diffvalue, ThreadPool *pool = nullptr);
 
 // Deprecated (calls the previous function)
 bool ButteraugliInterface(const Image3F &rgb0, const Image3F &rgb1,
@@ -91,7 +95,8 @@ bool ButteraugliInterface(const Image3F &rgb0, const Image3F &rgb1,
 // params.xmul.
 Status ButteraugliInterfaceInPlace(Image3F &&rgb0, Image3F &&rgb1,
                                    const ButteraugliParams &params,
-                                   ImageF &diffmap, double &diffvalue);
+                                   ImageF &diffmap, double &diffvalue,
+                                   ThreadPool *pool = nullptr);
 
 // Converts the butteraugli score into fuzzy class values that are continuous
 // at the class boundary. The class boundary location is based on human
@@ -170,8 +175,11 @@ class ButteraugliComparator {
   // improve results at higher Butteraugli values.
   virtual ~ButteraugliComparator() = default;
 
+  // All computations of the comparator, including those of Make(), run on
+  // `pool` if it is not null; it must outlive the comparator.
   static StatusOr<std::unique_ptr<ButteraugliComparator>> Make(
-      const Image3F &rgb0, const ButteraugliParams &params);
+      const Image3F &rgb0, const ButteraugliParams &params,
+      ThreadPool *pool = nullptr);
 
   // Computes the butteraugli map between the original image given in the
   // constructor and the distorted image give here.
@@ -185,15 +193,33 @@ class ButteraugliComparator {
 
   Status Mask(ImageF *BUTTERAUGLI_RESTRICT mask) const;
 
+  // Updates `diffmap`, as computed by Diffmap() for an earlier distorted image,
+  // for a distorted image `rgb1` that only differs from that one inside
+  // `rect`. Only the part of the map that is within kDiffmapSupport pixels of
+  // `rect` is recomputed, from crops of both images that keep as much context
+  // again around it, so the result closely approximates a full Diffmap().
+  Status UpdateDiffmap(const Image3F &rgb1, const Rect &rect,
+                       ImageF &diffmap) const;
+
+  // Distance in pixels over which a change of the distorted image affects the
+  // diffmap noticeably.
+  static constexpr size_t kDiffmapSupport = 64;
+
  private:
   ButteraugliComparator(size_t xsize, size_t ysize,
-                        const ButteraugliParams &params);
+                        const ButteraugliParams &params, ThreadPool *pool);
+  // Returns a comparator for the `rect` region of the reference image that
+  // shares the already computed frequency decomposition; `with_sub` also
+  // crops the next coarser scale, which is all Diffmap() uses of sub_.
+  StatusOr<std::unique_ptr<ButteraugliComparator>> Crop(const Rect &rect,
+                                                        bool with_sub) const;
   Image3F *Temp() const;
   void ReleaseTemp() const;
 
   const size_t xsize_;
   const size_t ysize_;
   ButteraugliParams params_;
+  ThreadPool *pool_;
   PsychoImage pi0_;
 
   // Shared temporary image storage to reduce the number of allocations;
@@ -210,7 +236,20 @@ Status ButteraugliDiffmap(const Image3F &rgb0, const Image3F &rgb1,
                           double hf_asymmetry, double xmul, ImageF &diffmap);
 
 Status ButteraugliDiffmap(const Image3F &rgb0, const Image3F &rgb1,
-                          const ButteraugliParams &params, ImageF &diffmap);
+                          const ButteraugliParams &params, ImageF &diffmap,
+                          ThreadPool *pool = nullptr);
+
+// Same as ButteraugliDiffmap, but computed one `tile_size` x `tile_size` tile
+// at a time from crops of both images that extend
+// ButteraugliComparator::kDiffmapSupport pixels beyond it, so that the
+// temporary images only scale with the tile size and not with the images, e.g.
+// to compare gigapixel images; only the diffmap itself is full-size. Like
+// ButteraugliComparator::UpdateDiffmap, the result closely approximates a full
+// ButteraugliDiffmap().
+Status ButteraugliDiffmapTiled(const Image3F &rgb0, const Image3F &rgb1,
+                               const ButteraugliParams &params,
+                               size_t tile_size, ImageF &diffmap,
+                               ThreadPool *pool = nullptr);
 
 double ButteraugliScoreFromDiffmap(const ImageF &diffmap,
                                    const ButteraugliParams *params = nullptr);
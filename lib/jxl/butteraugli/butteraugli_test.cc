@@ -9,13 +9,16 @@
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <utility>
 
 #include "lib/extras/metrics.h"
 #include "lib/extras/packed_image.h"
 #include "lib/jxl/base/random.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/enc_external_image.h"
 #include "lib/jxl/image.h"
@@ -128,5 +131,109 @@ TEST(ButteraugliInPlaceTest, LargeImage) {
   EXPECT_NEAR(distp, distp2, 1e-7);
 }
 
+TEST(ButteraugliTest, PoolMatchesSequential) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const size_t xsize = 613;
+  const size_t ysize = 411;
+  TestImage img;
+  ASSERT_TRUE(img.SetDimensions(xsize, ysize));
+  JXL_TEST_ASSIGN_OR_DIE(auto frame, img.AddFrame());
+  frame.RandomFill(777);
+  JXL_TEST_ASSIGN_OR_DIE(Image3F rgb0, GetColorImage(img.ppf()));
+  JXL_TEST_ASSIGN_OR_DIE(Image3F rgb1,
+                         Image3F::Create(memory_manager, xsize, ysize));
+  ASSERT_TRUE(CopyImageTo(rgb0, &rgb1));
+  AddUniformNoise(&rgb1, 0.02f, 7777);
+  AddEdge(&rgb1, 0.1f, xsize / 2, ysize / 2);
+  ButteraugliParams butteraugli_params;
+  ImageF diffmap;
+  double diffval;
+  ASSERT_TRUE(
+      ButteraugliInterface(rgb0, rgb1, butteraugli_params, diffmap, diffval));
+  test::ThreadPoolForTests pool(4);
+  ImageF diffmap2;
+  double diffval2;
+  ASSERT_TRUE(ButteraugliInterface(rgb0, rgb1, butteraugli_params, diffmap2,
+                                   diffval2, pool.get()));
+  EXPECT_EQ(diffval, diffval2);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      ASSERT_EQ(diffmap.Row(y)[x], diffmap2.Row(y)[x]);
+    }
+  }
+}
+
+TEST(ButteraugliComparatorTest, UpdateDiffmap) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const size_t xsize = 512;
+  const size_t ysize = 384;
+  TestImage img;
+  ASSERT_TRUE(img.SetDimensions(xsize, ysize));
+  JXL_TEST_ASSIGN_OR_DIE(auto frame, img.AddFrame());
+  frame.RandomFill(777);
+  JXL_TEST_ASSIGN_OR_DIE(Image3F rgb0, GetColorImage(img.ppf()));
+  JXL_TEST_ASSIGN_OR_DIE(Image3F rgb1,
+                         Image3F::Create(memory_manager, xsize, ysize));
+  ASSERT_TRUE(CopyImageTo(rgb0, &rgb1));
+  AddUniformNoise(&rgb1, 0.02f, 7777);
+  ButteraugliParams butteraugli_params;
+  JXL_TEST_ASSIGN_OR_DIE(
+      std::unique_ptr<ButteraugliComparator> comparator,
+      ButteraugliComparator::Make(rgb0, butteraugli_params));
+  ImageF diffmap;
+  ASSERT_TRUE(comparator->Diffmap(rgb1, diffmap));
+
+  AddEdge(&rgb1, 0.1f, 301, 97);
+  const Rect changed(301, 97, 5, 100);
+  ASSERT_TRUE(comparator->UpdateDiffmap(rgb1, changed, diffmap));
+  ImageF expected;
+  ASSERT_TRUE(comparator->Diffmap(rgb1, expected));
+  float max_error = 0.0f;
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      max_error = std::max(
+          max_error, std::abs(diffmap.Row(y)[x] - expected.Row(y)[x]));
+    }
+  }
+  EXPECT_LT(max_error, 1e-3f);
+  EXPECT_NEAR(ButteraugliScoreFromDiffmap(diffmap, &butteraugli_params),
+              ButteraugliScoreFromDiffmap(expected, &butteraugli_params),
+              1e-4);
+}
+
+TEST(ButteraugliTest, DiffmapTiled) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const size_t xsize = 512;
+  const size_t ysize = 384;
+  TestImage img;
+  ASSERT_TRUE(img.SetDimensions(xsize, ysize));
+  JXL_TEST_ASSIGN_OR_DIE(auto frame, img.AddFrame());
+  frame.RandomFill(777);
+  JXL_TEST_ASSIGN_OR_DIE(Image3F rgb0, GetColorImage(img.ppf()));
+  JXL_TEST_ASSIGN_OR_DIE(Image3F rgb1,
+                         Image3F::Create(memory_manager, xsize, ysize));
+  ASSERT_TRUE(CopyImageTo(rgb0, &rgb1));
+  AddUniformNoise(&rgb1, 0.02f, 7777);
+  AddEdge(&rgb1, 0.1f, 301, 97);
+  ButteraugliParams butteraugli_params;
+  ImageF expected;
+  ASSERT_TRUE(ButteraugliDiffmap(rgb0, rgb1, butteraugli_params, expected));
+  ImageF diffmap;
+  ASSERT_TRUE(ButteraugliDiffmapTiled(rgb0, rgb1, butteraugli_params,
+                                      /*tile_size=*/100, diffmap));
+  ASSERT_TRUE(SameSize(diffmap, expected));
+  float max_error = 0.0f;
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      max_error = std::max(
+          max_error, std::abs(diffmap.Row(y)[x] - expected.Row(y)[x]));
+    }
+  }
+  EXPECT_LT(max_error, 1e-3f);
+  EXPECT_NEAR(ButteraugliScoreFromDiffmap(diffmap, &butteraugli_params),
+              ButteraugliScoreFromDiffmap(expected, &butteraugli_params),
+              1e-4);
+}
+
 }  // namespace
 }  // namespace jxl
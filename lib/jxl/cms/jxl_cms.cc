@@ -17,7 +17,11 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jxl/cms/jxl_cms.cc"
@@ -51,12 +55,17 @@ namespace {
 
 using ::jxl::cms::ColorEncoding;
 
-struct JxlCms {
+// The part of the state of a transform that only depends on the input and
+// output profiles. It is immutable once created and shared by all the JxlCms
+// instances between the same profiles.
+struct JxlCmsTransform {
 #if JPEGXL_ENABLE_SKCMS
+  // The profiles point into these.
   IccBytes icc_src, icc_dst;
   skcms_ICCProfile profile_src, profile_dst;
 #else
-  void* lcms_transform;
+  ~JxlCmsTransform();
+  void* lcms_transform = nullptr;
 #endif
 
   // These fields are used when the HLG OOTF or inverse OOTF must be applied.
@@ -68,15 +77,25 @@ struct JxlCms {
   size_t channels_src;
   size_t channels_dst;
 
+  bool skip_lcms = false;
+  ExtraTF preprocess = ExtraTF::kNone;
+  ExtraTF postprocess = ExtraTF::kNone;
+
+  // Whether the linear values are converted with `matrix` instead of lcms or
+  // skcms.
+  bool use_matrix = false;
+  Matrix3x3 matrix;
+};
+
+struct JxlCms {
+  std::shared_ptr<const JxlCmsTransform> transform;
+
   std::vector<float> src_storage;
   std::vector<float*> buf_src;
   std::vector<float> dst_storage;
   std::vector<float*> buf_dst;
 
   float intensity_target;
-  bool skip_lcms = false;
-  ExtraTF preprocess = ExtraTF::kNone;
-  ExtraTF postprocess = ExtraTF::kNone;
 };
 
 Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
@@ -90,6 +109,11 @@ HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
 
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::Vec;
+
 #if JXL_CMS_VERBOSE >= 2
 const size_t kX = 0;  // pixel index, multiplied by 3 for RGB
 #endif
@@ -97,7 +121,8 @@ const size_t kX = 0;  // pixel index, multiplied by 3 for RGB
 // xform_src = UndoGammaCompression(buf_src).
 Status BeforeTransform(JxlCms* t, const float* buf_src, float* xform_src,
                        size_t buf_size) {
-  switch (t->preprocess) {
+  const JxlCmsTransform* tr = t->transform.get();
+  switch (tr->preprocess) {
     case ExtraTF::kNone:
       JXL_ENSURE(false);  // unreachable
       break;
@@ -123,7 +148,7 @@ Status BeforeTransform(JxlCms* t, const float* buf_src, float* xform_src,
         xform_src[i] = static_cast<float>(
             TF_HLG_Base::DisplayFromEncoded(static_cast<double>(buf_src[i])));
       }
-      if (t->apply_hlg_ootf) {
+      if (tr->apply_hlg_ootf) {
         JXL_RETURN_IF_ERROR(
             ApplyHlgOotf(t, xform_src, buf_size, /*forward=*/true));
       }
@@ -153,7 +178,8 @@ Status BeforeTransform(JxlCms* t, const float* buf_src, float* xform_src,
 
 // Applies gamma compression in-place.
 Status AfterTransform(JxlCms* t, float* JXL_RESTRICT buf_dst, size_t buf_size) {
-  switch (t->postprocess) {
+  const JxlCmsTransform* tr = t->transform.get();
+  switch (tr->postprocess) {
     case ExtraTF::kNone:
       JXL_DEBUG_ABORT("Unreachable");
       break;
@@ -172,7 +198,7 @@ Status AfterTransform(JxlCms* t, float* JXL_RESTRICT buf_dst, size_t buf_size) {
       break;
     }
     case ExtraTF::kHLG:
-      if (t->apply_hlg_ootf) {
+      if (tr->apply_hlg_ootf) {
         JXL_RETURN_IF_ERROR(
             ApplyHlgOotf(t, buf_dst, buf_size, /*forward=*/false));
       }
@@ -201,22 +227,58 @@ Status AfterTransform(JxlCms* t, float* JXL_RESTRICT buf_dst, size_t buf_size) {
   return true;
 }
 
+// buf_dst = matrix * xform_src for interleaved RGB pixels, possibly in-place.
+void ApplyMatrix(const Matrix3x3& matrix, const float* xform_src,
+                 float* buf_dst, size_t xsize) {
+  const HWY_FULL(float) df;
+  const auto m00 = Set(df, matrix[0][0]);
+  const auto m01 = Set(df, matrix[0][1]);
+  const auto m02 = Set(df, matrix[0][2]);
+  const auto m10 = Set(df, matrix[1][0]);
+  const auto m11 = Set(df, matrix[1][1]);
+  const auto m12 = Set(df, matrix[1][2]);
+  const auto m20 = Set(df, matrix[2][0]);
+  const auto m21 = Set(df, matrix[2][1]);
+  const auto m22 = Set(df, matrix[2][2]);
+  size_t x = 0;
+  for (; x + Lanes(df) <= xsize; x += Lanes(df)) {
+    Vec<decltype(df)> r;
+    Vec<decltype(df)> g;
+    Vec<decltype(df)> b;
+    LoadInterleaved3(df, xform_src + 3 * x, r, g, b);
+    const auto out_r = MulAdd(m02, b, MulAdd(m01, g, Mul(m00, r)));
+    const auto out_g = MulAdd(m12, b, MulAdd(m11, g, Mul(m10, r)));
+    const auto out_b = MulAdd(m22, b, MulAdd(m21, g, Mul(m20, r)));
+    StoreInterleaved3(out_r, out_g, out_b, df, buf_dst + 3 * x);
+  }
+  for (; x < xsize; ++x) {
+    const float r = xform_src[3 * x];
+    const float g = xform_src[3 * x + 1];
+    const float b = xform_src[3 * x + 2];
+    for (size_t c = 0; c < 3; ++c) {
+      buf_dst[3 * x + c] =
+          matrix[c][0] * r + matrix[c][1] * g + matrix[c][2] * b;
+    }
+  }
+}
+
 Status DoColorSpaceTransform(void* cms_data, const size_t thread,
                              const float* buf_src, float* buf_dst,
                              size_t xsize) {
   // No lock needed.
   JxlCms* t = reinterpret_cast<JxlCms*>(cms_data);
+  const JxlCmsTransform* tr = t->transform.get();
 
   const float* xform_src = buf_src;  // Read-only.
-  if (t->preprocess != ExtraTF::kNone) {
+  if (tr->preprocess != ExtraTF::kNone) {
     float* mutable_xform_src = t->buf_src[thread];  // Writable buffer.
     JXL_RETURN_IF_ERROR(BeforeTransform(t, buf_src, mutable_xform_src,
-                                        xsize * t->channels_src));
+                                        xsize * tr->channels_src));
     xform_src = mutable_xform_src;
   }
 
 #if JPEGXL_ENABLE_SKCMS
-  if (t->channels_src == 1 && !t->skip_lcms) {
+  if (tr->channels_src == 1 && !tr->skip_lcms) {
     // Expand from 1 to 3 channels, starting from the end in case
     // xform_src == t->buf_src[thread].
     float* mutable_xform_src = t->buf_src[thread];
@@ -228,7 +290,7 @@ Status DoColorSpaceTransform(void* cms_data, const size_t thread,
     xform_src = mutable_xform_src;
   }
 #else
-  if (t->channels_src == 4 && !t->skip_lcms) {
+  if (tr->channels_src == 4 && !tr->skip_lcms) {
     // LCMS does CMYK in a weird way: 0 = white, 100 = max ink
     float* mutable_xform_src = t->buf_src[thread];
     for (size_t x = 0; x < xsize * 4; ++x) {
@@ -245,32 +307,34 @@ Status DoColorSpaceTransform(void* cms_data, const size_t thread,
   const float in2 = xform_src[3 * kX + 2];
 #endif
 
-  if (t->skip_lcms) {
+  if (tr->skip_lcms) {
     if (buf_dst != xform_src) {
-      memcpy(buf_dst, xform_src, xsize * t->channels_src * sizeof(*buf_dst));
+      memcpy(buf_dst, xform_src, xsize * tr->channels_src * sizeof(*buf_dst));
     }  // else: in-place, no need to copy
+  } else if (tr->use_matrix) {
+    ApplyMatrix(tr->matrix, xform_src, buf_dst, xsize);
   } else {
 #if JPEGXL_ENABLE_SKCMS
     JXL_ENSURE(
         skcms_Transform(xform_src,
-                        (t->channels_src == 4 ? skcms_PixelFormat_RGBA_ffff
+                        (tr->channels_src == 4 ? skcms_PixelFormat_RGBA_ffff
                                               : skcms_PixelFormat_RGB_fff),
-                        skcms_AlphaFormat_Opaque, &t->profile_src, buf_dst,
+                        skcms_AlphaFormat_Opaque, &tr->profile_src, buf_dst,
                         skcms_PixelFormat_RGB_fff, skcms_AlphaFormat_Opaque,
-                        &t->profile_dst, xsize));
+                        &tr->profile_dst, xsize));
 #else   // JPEGXL_ENABLE_SKCMS
-    cmsDoTransform(t->lcms_transform, xform_src, buf_dst,
+    cmsDoTransform(tr->lcms_transform, xform_src, buf_dst,
                    static_cast<cmsUInt32Number>(xsize));
 #endif  // JPEGXL_ENABLE_SKCMS
   }
 #if JXL_CMS_VERBOSE >= 2
   printf("xform skip%d: %.4f %.4f %.4f (%p) -> (%p) %.4f %.4f %.4f\n",
-         t->skip_lcms, in0, in1, in2, xform_src, buf_dst, buf_dst[3 * kX],
+         tr->skip_lcms, in0, in1, in2, xform_src, buf_dst, buf_dst[3 * kX],
          buf_dst[3 * kX + 1], buf_dst[3 * kX + 2]);
 #endif
 
 #if JPEGXL_ENABLE_SKCMS
-  if (t->channels_dst == 1 && !t->skip_lcms) {
+  if (tr->channels_dst == 1 && !tr->skip_lcms) {
     // Contract back from 3 to 1 channel, this time forward.
     float* grayscale_buf_dst = t->buf_dst[thread];
     for (size_t x = 0; x < xsize; ++x) {
@@ -280,8 +344,8 @@ Status DoColorSpaceTransform(void* cms_data, const size_t thread,
   }
 #endif
 
-  if (t->postprocess != ExtraTF::kNone) {
-    JXL_RETURN_IF_ERROR(AfterTransform(t, buf_dst, xsize * t->channels_dst));
+  if (tr->postprocess != ExtraTF::kNone) {
+    JXL_RETURN_IF_ERROR(AfterTransform(t, buf_dst, xsize * tr->channels_dst));
   }
   return true;
 }
@@ -854,8 +918,73 @@ Status GetPrimariesLuminances(const ColorEncoding& encoding,
   return true;
 }
 
+// Returns whether the conversions to and from the encoding can be done with a
+// matrix between linear values, and the transfer function that is applied on
+// top of the linear values. The profile of an encoding with fields is
+// equivalent to the fields, so no LUT-based profile gets here.
+bool GetMatrixTransferFunction(const ColorEncoding& c, ExtraTF* tf) {
+  if (!c.have_fields || c.cmyk || c.color_space != ColorSpace::kRGB) {
+    return false;
+  }
+  if (c.tf.IsLinear()) {
+    *tf = ExtraTF::kNone;
+  } else if (c.tf.IsSRGB()) {
+    *tf = ExtraTF::kSRGB;
+  } else if (c.tf.IsPQ()) {
+    *tf = ExtraTF::kPQ;
+  } else if (c.tf.IsHLG()) {
+    *tf = ExtraTF::kHLG;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+Status GetToXYZD50Matrix(const ColorEncoding& c, Matrix3x3& matrix) {
+  PrimariesCIExy p;
+  JXL_RETURN_IF_ERROR(c.GetPrimaries(p));
+  const CIExy wp = c.GetWhitePoint();
+  return PrimariesToXYZD50(p.r.x, p.r.y, p.g.x, p.g.y, p.b.x, p.b.y, wp.x, wp.y,
+                           matrix);
+}
+
+// Sets up `t` to convert between the RGB encodings with a matrix and the
+// transfer functions of TF_* instead of lcms or skcms, and returns false if
+// this is not possible. For matrix/TRC profiles, the CMS does the same
+// colorimetric conversion, via the D50 PCS, for all rendering intents except
+// the absolute one.
+bool SetUpMatrixTransform(const ColorEncoding& c_src,
+                          const ColorEncoding& c_dst, JxlCmsTransform* t) {
+  ExtraTF preprocess;
+  ExtraTF postprocess;
+  if (!GetMatrixTransferFunction(c_src, &preprocess) ||
+      !GetMatrixTransferFunction(c_dst, &postprocess) ||
+      c_dst.rendering_intent == RenderingIntent::kAbsolute) {
+    return false;
+  }
+  if (c_src.SameColorSpace(c_dst)) {
+    // Only the transfer functions differ.
+    t->skip_lcms = true;
+  } else {
+    Matrix3x3 src_to_xyz;
+    Matrix3x3 dst_to_xyz;
+    if (!GetToXYZD50Matrix(c_src, src_to_xyz) ||
+        !GetToXYZD50Matrix(c_dst, dst_to_xyz) || !Inv3x3Matrix(dst_to_xyz)) {
+      return false;
+    }
+    Mul3x3Matrix(dst_to_xyz, src_to_xyz, t->matrix);
+    t->use_matrix = true;
+  }
+  t->preprocess = preprocess;
+  t->postprocess = postprocess;
+  t->channels_src = 3;
+  t->channels_dst = 3;
+  return true;
+}
+
 Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
                     bool forward) {
+  const JxlCmsTransform* tr = t->transform.get();
   if (295 <= t->intensity_target && t->intensity_target <= 305) {
     // The gamma is approximately 1 so this can essentially be skipped.
     return true;
@@ -863,7 +992,7 @@ Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
   float gamma = 1.2f * std::pow(1.111f, std::log2(t->intensity_target * 1e-3f));
   if (!forward) gamma = 1.f / gamma;
 
-  switch (t->hlg_ootf_num_channels) {
+  switch (tr->hlg_ootf_num_channels) {
     case 1:
       for (size_t x = 0; x < xsize; ++x) {
         buf[x] = std::pow(buf[x], gamma);
@@ -872,9 +1001,9 @@ Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
 
     case 3:
       for (size_t x = 0; x < xsize; x += 3) {
-        const float luminance = buf[x] * t->hlg_ootf_luminances[0] +
-                                buf[x + 1] * t->hlg_ootf_luminances[1] +
-                                buf[x + 2] * t->hlg_ootf_luminances[2];
+        const float luminance = buf[x] * tr->hlg_ootf_luminances[0] +
+                                buf[x + 1] * tr->hlg_ootf_luminances[1] +
+                                buf[x + 2] * tr->hlg_ootf_luminances[2];
         const float ratio = std::pow(luminance, gamma - 1);
         if (std::isfinite(ratio)) {
           buf[x] *= ratio;
@@ -903,7 +1032,7 @@ Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
 
     default:
       return JXL_FAILURE("HLG OOTF not implemented for %" PRIuS " channels",
-                         t->hlg_ootf_num_channels);
+                         tr->hlg_ootf_num_channels);
   }
   return true;
 }
@@ -1078,13 +1207,15 @@ JXL_BOOL JxlCmsSetFieldsFromICC(void* user_data, const uint8_t* icc_data,
 
 namespace {
 
-void JxlCmsDestroy(void* cms_data) {
-  if (cms_data == nullptr) return;
-  JxlCms* t = reinterpret_cast<JxlCms*>(cms_data);
 #if !JPEGXL_ENABLE_SKCMS
-  TransformDeleter()(t->lcms_transform);
+JxlCmsTransform::~JxlCmsTransform() {
+  if (lcms_transform != nullptr) TransformDeleter()(lcms_transform);
+}
 #endif
-  delete t;
+
+void JxlCmsDestroy(void* cms_data) {
+  if (cms_data == nullptr) return;
+  delete reinterpret_cast<JxlCms*>(cms_data);
 }
 
 void AllocateBuffer(size_t length, size_t num_threads,
@@ -1102,15 +1233,12 @@ void AllocateBuffer(size_t length, size_t num_threads,
   }
 }
 
-void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
-                 const JxlColorProfile* input, const JxlColorProfile* output,
-                 float intensity_target) {
-  if (init_data == nullptr) {
-    JXL_NOTIFY_ERROR("JxlCmsInit: init_data is nullptr");
-    return nullptr;
-  }
-  const auto* cms = static_cast<const JxlCmsInterface*>(init_data);
-  auto t = jxl::make_unique<JxlCms>();
+// Returns the part of the transform between the two profiles that does not
+// depend on the image, or nullptr on failure.
+std::shared_ptr<const JxlCmsTransform> CreateTransform(
+    const JxlCmsInterface& cms, const JxlColorProfile* input,
+    const JxlColorProfile* output) {
+  auto t = std::make_shared<JxlCmsTransform>();
   IccBytes icc_src;
   IccBytes icc_dst;
   if (input->icc.size == 0) {
@@ -1123,13 +1251,13 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
   }
   icc_src.assign(input->icc.data, input->icc.data + input->icc.size);
   ColorEncoding c_src;
-  if (!c_src.SetFieldsFromICC(std::move(icc_src), *cms)) {
+  if (!c_src.SetFieldsFromICC(std::move(icc_src), cms)) {
     JXL_NOTIFY_ERROR("JxlCmsInit: failed to parse input ICC");
     return nullptr;
   }
   icc_dst.assign(output->icc.data, output->icc.data + output->icc.size);
   ColorEncoding c_dst;
-  if (!c_dst.SetFieldsFromICC(std::move(icc_dst), *cms)) {
+  if (!c_dst.SetFieldsFromICC(std::move(icc_dst), cms)) {
     JXL_NOTIFY_ERROR("JxlCmsInit: failed to parse output ICC");
     return nullptr;
   }
@@ -1138,11 +1266,14 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
 #endif
 
 #if JPEGXL_ENABLE_SKCMS
-  if (!DecodeProfile(input->icc.data, input->icc.size, &t->profile_src)) {
+  // The transform can outlive the profiles of the caller.
+  t->icc_src.assign(input->icc.data, input->icc.data + input->icc.size);
+  t->icc_dst.assign(output->icc.data, output->icc.data + output->icc.size);
+  if (!DecodeProfile(t->icc_src.data(), t->icc_src.size(), &t->profile_src)) {
     JXL_NOTIFY_ERROR("JxlCmsInit: skcms failed to parse input ICC");
     return nullptr;
   }
-  if (!DecodeProfile(output->icc.data, output->icc.size, &t->profile_dst)) {
+  if (!DecodeProfile(t->icc_dst.data(), t->icc_dst.size(), &t->profile_dst)) {
     JXL_NOTIFY_ERROR("JxlCmsInit: skcms failed to parse output ICC");
     return nullptr;
   }
@@ -1179,6 +1310,13 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
     }
   }
 
+  if (!t->skip_lcms && SetUpMatrixTransform(c_src, c_dst, t.get())) {
+#if JXL_CMS_VERBOSE
+    printf("Matrix transform\n");
+#endif
+    return t;
+  }
+
   // Special-case SRGB <=> linear if the primaries / white point are the same,
   // or any conversion where PQ or HLG is involved:
   bool src_linear = c_src.tf.IsLinear();
@@ -1286,8 +1424,7 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
   const size_t channels_src = (c_src.cmyk ? 4 : c_src.Channels());
   const size_t channels_dst = c_dst.Channels();
 #if JXL_CMS_VERBOSE
-  printf("Channels: %" PRIuS "; Threads: %" PRIuS "\n", channels_src,
-         num_threads);
+  printf("Channels: %" PRIuS " -> %" PRIuS "\n", channels_src, channels_dst);
 #endif
 
 #if !JPEGXL_ENABLE_SKCMS
@@ -1308,6 +1445,101 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
   }
 #endif  // !JPEGXL_ENABLE_SKCMS
 
+  t->channels_src = channels_src;
+  t->channels_dst = channels_dst;
+  return t;
+}
+
+uint64_t HashProfile(const JxlColorProfile* profile, uint64_t hash) {
+  // FNV-1a
+  for (size_t i = 0; i < profile->icc.size; ++i) {
+    hash = (hash ^ profile->icc.data[i]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+bool SameProfile(const IccBytes& icc, const JxlColorProfile* profile) {
+  return icc.size() == profile->icc.size &&
+         std::equal(icc.begin(), icc.end(), profile->icc.data);
+}
+
+// The most recently used transforms of the process, shared by all the
+// JxlCmsInit calls. Creating the transform from the ICC profiles is the most
+// expensive part of JxlCmsInit, and most images use one of a few profiles.
+// The pixel formats and the rendering intent of a transform are derived from
+// the profiles, so the profiles are the whole key.
+class TransformCache {
+ public:
+  static TransformCache* Get() {
+    static TransformCache* cache = new TransformCache();
+    return cache;
+  }
+
+  std::shared_ptr<const JxlCmsTransform> Find(const JxlColorProfile* input,
+                                              const JxlColorProfile* output) {
+    const uint64_t hash = Hash(input, output);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->hash == hash && SameProfile(it->icc_src, input) &&
+          SameProfile(it->icc_dst, output)) {
+        // Move to the front.
+        entries_.splice(entries_.begin(), entries_, it);
+        return it->transform;
+      }
+    }
+    return nullptr;
+  }
+
+  void Insert(const JxlColorProfile* input, const JxlColorProfile* output,
+              std::shared_ptr<const JxlCmsTransform> transform) {
+    Entry entry;
+    entry.hash = Hash(input, output);
+    entry.icc_src.assign(input->icc.data, input->icc.data + input->icc.size);
+    entry.icc_dst.assign(output->icc.data,
+                         output->icc.data + output->icc.size);
+    entry.transform = std::move(transform);
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_front(std::move(entry));
+    if (entries_.size() > kCapacity) entries_.pop_back();
+  }
+
+ private:
+  static constexpr size_t kCapacity = 32;
+
+  struct Entry {
+    uint64_t hash;
+    IccBytes icc_src;
+    IccBytes icc_dst;
+    std::shared_ptr<const JxlCmsTransform> transform;
+  };
+
+  static uint64_t Hash(const JxlColorProfile* input,
+                       const JxlColorProfile* output) {
+    constexpr uint64_t kOffsetBasis = 0xCBF29CE484222325ull;
+    return HashProfile(output, HashProfile(input, kOffsetBasis) ^ 0xFF);
+  }
+
+  std::mutex mutex_;
+  std::list<Entry> entries_;
+};
+
+void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
+                 const JxlColorProfile* input, const JxlColorProfile* output,
+                 float intensity_target) {
+  if (init_data == nullptr) {
+    JXL_NOTIFY_ERROR("JxlCmsInit: init_data is nullptr");
+    return nullptr;
+  }
+  const auto* cms = static_cast<const JxlCmsInterface*>(init_data);
+  auto t = jxl::make_unique<JxlCms>();
+  TransformCache* cache = TransformCache::Get();
+  t->transform = cache->Find(input, output);
+  if (t->transform == nullptr) {
+    t->transform = CreateTransform(*cms, input, output);
+    if (t->transform == nullptr) return nullptr;
+    cache->Insert(input, output, t->transform);
+  }
+
   // Ideally LCMS would convert directly from External to Image3. However,
   // cmsDoTransformLineStride only accepts 32-bit BytesPerPlaneIn, whereas our
   // planes can be more than 4 GiB apart. Hence, transform inputs/outputs must
@@ -1316,8 +1548,8 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
   // buffers. To avoid separate allocations, we use the rows of an image.
   // Because LCMS apparently also cannot handle <= 16 bit inputs and 32-bit
   // outputs (or vice versa), we use floating point input/output.
-  t->channels_src = channels_src;
-  t->channels_dst = channels_dst;
+  const size_t channels_src = t->transform->channels_src;
+  const size_t channels_dst = t->transform->channels_dst;
 #if !JPEGXL_ENABLE_SKCMS
   size_t actual_channels_src = channels_src;
   size_t actual_channels_dst = channels_dst;
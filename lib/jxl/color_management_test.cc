@@ -272,6 +272,42 @@ TEST_F(ColorManagementTest, D2700ToSRGB) {
   EXPECT_ARRAY_NEAR(sRGB_values, sRGB_expected, 1e-3);
 }
 
+TEST_F(ColorManagementTest, SharedTransform) {
+  std::vector<uint8_t> icc_data =
+      jxl::test::ReadTestData("jxl/color_management/sRGB-D2700.icc");
+  IccBytes icc;
+  Bytes(icc_data).AppendTo(icc);
+  ColorEncoding sRGB_D2700;
+  ASSERT_TRUE(sRGB_D2700.SetICC(std::move(icc), JxlGetDefaultCms()));
+  Color sRGB_D2700_values{0.863, 0.737, 0.490};
+  Color expected;
+  {
+    ColorSpaceTransform transform(*JxlGetDefaultCms());
+    ASSERT_TRUE(transform.Init(sRGB_D2700, ColorEncoding::SRGB(),
+                               kDefaultIntensityTarget, 1, 1));
+    ASSERT_TRUE(
+        transform.Run(0, sRGB_D2700_values.data(), expected.data(), 1));
+  }
+  // The transforms between the same profiles share their state, which must
+  // outlive the transform that created it and the profiles of the caller.
+  ColorEncoding source = sRGB_D2700;
+  ColorSpaceTransform transform0(*JxlGetDefaultCms());
+  ASSERT_TRUE(transform0.Init(source, ColorEncoding::SRGB(),
+                              kDefaultIntensityTarget, 4, 2));
+  source = ColorEncoding::SRGB();
+  ColorSpaceTransform transform1(*JxlGetDefaultCms());
+  ASSERT_TRUE(transform1.Init(sRGB_D2700, ColorEncoding::SRGB(),
+                              kDefaultIntensityTarget, 1, 1));
+  Color values;
+  for (size_t thread = 0; thread < 2; ++thread) {
+    ASSERT_TRUE(
+        transform0.Run(thread, sRGB_D2700_values.data(), values.data(), 1));
+    EXPECT_EQ(values, expected);
+  }
+  ASSERT_TRUE(transform1.Run(0, sRGB_D2700_values.data(), values.data(), 1));
+  EXPECT_EQ(values, expected);
+}
+
 TEST_F(ColorManagementTest, P3HlgTo2020Hlg) {
   ColorEncoding p3_hlg;
   p3_hlg.SetColorSpace(ColorSpace::kRGB);
@@ -294,6 +330,36 @@ TEST_F(ColorManagementTest, P3HlgTo2020Hlg) {
   EXPECT_ARRAY_NEAR(rec2020_hlg_values, rec2020_hlg_expected, 1e-4);
 }
 
+TEST_F(ColorManagementTest, P3ToLinearSRGB) {
+  ColorEncoding p3;
+  p3.SetColorSpace(ColorSpace::kRGB);
+  ASSERT_TRUE(p3.SetWhitePointType(WhitePoint::kD65));
+  ASSERT_TRUE(p3.SetPrimariesType(Primaries::kP3));
+  p3.Tf().SetTransferFunction(TransferFunction::kSRGB);
+  ASSERT_TRUE(p3.CreateICC());
+
+  // Enough pixels for both the vector and the scalar code.
+  constexpr size_t kNumPixels = 19;
+  ColorSpaceTransform transform(*JxlGetDefaultCms());
+  ASSERT_TRUE(transform.Init(p3, ColorEncoding::LinearSRGB(),
+                             kDefaultIntensityTarget, kNumPixels, 1));
+  std::vector<float> p3_values(3 * kNumPixels);
+  for (size_t x = 0; x < kNumPixels; ++x) {
+    p3_values[3 * x + x % 3] = 1.0f;
+  }
+  std::vector<float> linear_srgb_values(3 * kNumPixels);
+  ASSERT_TRUE(transform.Run(0, p3_values.data(), linear_srgb_values.data(),
+                            kNumPixels));
+  const Color expected[3] = {{1.2249, -0.0420, -0.0197},
+                             {-0.2249, 1.0419, -0.0786},
+                             {0.0, 0.0, 1.0979}};
+  for (size_t x = 0; x < kNumPixels; ++x) {
+    Color values{linear_srgb_values[3 * x], linear_srgb_values[3 * x + 1],
+                 linear_srgb_values[3 * x + 2]};
+    EXPECT_ARRAY_NEAR(values, expected[x % 3], 2e-3);
+  }
+}
+
 TEST_F(ColorManagementTest, HlgOotf) {
   ColorEncoding p3_hlg;
   p3_hlg.SetColorSpace(ColorSpace::kRGB);
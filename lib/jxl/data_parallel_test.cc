@@ -9,6 +9,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/test_utils.h"
@@ -99,4 +100,36 @@ TEST_F(DataParallelTest, RunnerNotCalledOnEmptyRange) {
   EXPECT_EQ(0, runner_called_);
 }
 
+TEST_F(DataParallelTest, CheapTasksAreBatched) {
+  // Rows of 1024 pixels are coalesced by 16.
+  EXPECT_TRUE(RunOnPool(
+      &pool_, 10, 110, /*cost_per_task=*/1024, ThreadPool::NoInit,
+      [](uint32_t /* task */, size_t /* thread */) -> Status { return true; },
+      "TestA"));
+  EXPECT_EQ(1, runner_called_);
+  EXPECT_EQ(0u, start_range_);
+  EXPECT_EQ(7u, end_range_);
+
+  std::vector<uint32_t> tasks;
+  EXPECT_TRUE(RunOnPool(
+      nullptr, 10, 110, /*cost_per_task=*/1024, ThreadPool::NoInit,
+      [&](uint32_t task, size_t /* thread */) -> Status {
+        tasks.push_back(task);
+        return true;
+      },
+      "TestB"));
+  ASSERT_EQ(100u, tasks.size());
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    EXPECT_EQ(10 + i, tasks[i]);
+  }
+
+  // Expensive tasks are dispatched one by one.
+  EXPECT_TRUE(RunOnPool(
+      &pool_, 10, 110, /*cost_per_task=*/1 << 20, ThreadPool::NoInit,
+      [](uint32_t /* task */, size_t /* thread */) -> Status { return true; },
+      "TestC"));
+  EXPECT_EQ(10u, start_range_);
+  EXPECT_EQ(110u, end_range_);
+}
+
 }  // namespace jxl
@@ -0,0 +1,112 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <cstddef>
+#include <cstdint>
+#include <hwy/aligned_allocator.h>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/ac_strategy.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/frame_dimensions.h"
+#include "lib/jxl/simd_util.h"
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/dct_gbench.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/jxl/dec_transforms-inl.h"
+#include "lib/jxl/enc_transforms-inl.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+namespace {
+
+// Runs the forward or inverse transform of the strategy state.range() on many
+// blocks of random pixels, which measures the code of the target selected by
+// Highway, e.g. NEON or SVE on Arm.
+template <bool kForward>
+void RunTransform(benchmark::State& state) {
+  constexpr size_t kNumBlocks = 16;
+  const AcStrategyType type = static_cast<AcStrategyType>(state.range());
+  const AcStrategy acs = AcStrategy::FromRawStrategy(type);
+  const size_t stride = acs.covered_blocks_x() * kBlockDim;
+  const size_t dct_scratch_size =
+      3 * (MaxVectorSize() / sizeof(float)) * AcStrategy::kMaxBlockDim;
+  auto mem = hwy::AllocateAligned<float>(
+      2 * kNumBlocks * AcStrategy::kMaxCoeffArea + dct_scratch_size);
+  float* pixels = mem.get();
+  float* coeffs = pixels + kNumBlocks * AcStrategy::kMaxCoeffArea;
+  float* scratch_space = coeffs + kNumBlocks * AcStrategy::kMaxCoeffArea;
+  Rng rng(0);
+  for (size_t i = 0; i < kNumBlocks * AcStrategy::kMaxCoeffArea; ++i) {
+    pixels[i] = rng.UniformF(-0.5f, 0.5f);
+    coeffs[i] = pixels[i];
+  }
+  for (auto _ : state) {
+    for (size_t i = 0; i < kNumBlocks; ++i) {
+      float* block_pixels = pixels + i * AcStrategy::kMaxCoeffArea;
+      float* block_coeffs = coeffs + i * AcStrategy::kMaxCoeffArea;
+      if (kForward) {
+        TransformFromPixels(type, block_pixels, stride, block_coeffs,
+                            scratch_space);
+      } else {
+        TransformToPixels(type, block_coeffs, block_pixels, stride,
+                          scratch_space);
+      }
+    }
+    benchmark::DoNotOptimize(kForward ? coeffs[0] : pixels[0]);
+  }
+  // Pixels per second.
+  state.SetItemsProcessed(state.iterations() * kNumBlocks *
+                          acs.covered_blocks_x() * acs.covered_blocks_y() *
+                          kDCTBlockSize);
+}
+
+HWY_NOINLINE void BM_TransformFromPixels(benchmark::State& state) {
+  RunTransform</*kForward=*/true>(state);
+}
+
+HWY_NOINLINE void BM_TransformToPixels(benchmark::State& state) {
+  RunTransform</*kForward=*/false>(state);
+}
+
+}  // namespace
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+namespace {
+
+HWY_EXPORT(BM_TransformFromPixels);
+HWY_EXPORT(BM_TransformToPixels);
+
+void BM_TransformFromPixels(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_TransformFromPixels)(state);
+}
+void BM_TransformToPixels(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_TransformToPixels)(state);
+}
+
+void TransformArgs(benchmark::internal::Benchmark* b) {
+  for (AcStrategyType type :
+       {AcStrategyType::DCT, AcStrategyType::DCT16X16, AcStrategyType::DCT32X32,
+        AcStrategyType::DCT64X64, AcStrategyType::DCT16X8,
+        AcStrategyType::AFV0}) {
+    b->Arg(static_cast<int64_t>(type));
+  }
+}
+
+BENCHMARK(BM_TransformFromPixels)->Apply(TransformArgs);
+BENCHMARK(BM_TransformToPixels)->Apply(TransformArgs);
+
+}  // namespace
+}  // namespace jxl
+#endif
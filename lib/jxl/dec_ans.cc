@@ -8,6 +8,7 @@
 #include <jxl/memory_manager.h>
 
 #include <cstdint>
+#include <utility>
 #include <vector>
 
 #include "lib/jxl/ans_common.h"
@@ -184,14 +185,19 @@ Status ReadHistogram(int precision_bits, std::vector<int32_t>* counts,
   return true;
 }
 
+// Below this number of histograms, building their alias tables takes less
+// time than handing them to a thread pool.
+constexpr size_t kMinHistogramsForPool = 32;
+
 }  // namespace
 
 Status DecodeANSCodes(JxlMemoryManager* memory_manager,
                       const size_t num_histograms,
                       const size_t max_alphabet_size, BitReader* in,
-                      ANSCode* result) {
+                      ANSCode* result, ThreadPool* pool) {
   result->memory_manager = memory_manager;
   result->degenerate_symbols.resize(num_histograms, -1);
+  result->max_extra_bits.assign(num_histograms, 0);
   if (result->use_prefix_code) {
     JXL_ENSURE(max_alphabet_size <= 1 << PREFIX_MAX_BITS);
     result->huffman_data.resize(num_histograms);
@@ -232,8 +238,11 @@ Status DecodeANSCodes(JxlMemoryManager* memory_manager,
                          AlignedMemory::Create(memory_manager, alloc_size));
     AliasTable::Entry* alias_tables =
         result->alias_tables.address<AliasTable::Entry>();
+    // The histograms are read first, so that their alias tables, which do not
+    // depend on the bitstream, can be built in parallel.
+    std::vector<std::vector<int32_t>> all_counts(num_histograms);
     for (size_t c = 0; c < num_histograms; ++c) {
-      std::vector<int32_t> counts;
+      std::vector<int32_t>& counts = all_counts[c];
       if (!ReadHistogram(ANS_LOG_TAB_SIZE, &counts, in)) {
         return JXL_FAILURE("Invalid histogram bitstream.");
       }
@@ -257,10 +266,17 @@ Status DecodeANSCodes(JxlMemoryManager* memory_manager,
         }
       }
       result->degenerate_symbols[c] = degenerate_symbol;
-      JXL_RETURN_IF_ERROR(
-          InitAliasTable(counts, ANS_LOG_TAB_SIZE, result->log_alpha_size,
-                         alias_tables + c * (1 << result->log_alpha_size)));
     }
+    const size_t log_alpha_size = result->log_alpha_size;
+    const auto init_table = [&](const uint32_t c, size_t /*thread*/) -> Status {
+      return InitAliasTable(std::move(all_counts[c]), ANS_LOG_TAB_SIZE,
+                            log_alpha_size,
+                            alias_tables + (c << log_alpha_size));
+    };
+    JXL_RETURN_IF_ERROR(
+        RunOnPool(num_histograms >= kMinHistogramsForPool ? pool : nullptr, 0,
+                  num_histograms, ThreadPool::NoInit, init_table,
+                  "InitAliasTables"));
   }
   return true;
 }
@@ -331,11 +347,17 @@ void ANSCode::UpdateMaxNumBits(size_t ctx, size_t symbol) {
       ((symbol - split_token) >> (msb_in_token + lsb_in_token));
   size_t total_bits = msb_in_token + lsb_in_token + n_extra_bits + 1;
   max_num_bits = std::max(max_num_bits, total_bits);
+  if (ctx < max_extra_bits.size()) {
+    // ReadHybridUintConfig reads at most 31 bits.
+    max_extra_bits[ctx] = std::max<uint8_t>(
+        max_extra_bits[ctx], std::min<uint32_t>(n_extra_bits, 31));
+  }
 }
 
 Status DecodeHistograms(JxlMemoryManager* memory_manager, BitReader* br,
                         size_t num_contexts, ANSCode* code,
-                        std::vector<uint8_t>* context_map, bool disallow_lz77) {
+                        std::vector<uint8_t>* context_map, bool disallow_lz77,
+                        ThreadPool* pool) {
   JXL_RETURN_IF_ERROR(Bundle::Read(br, &code->lz77));
   if (code->lz77.enabled) {
     num_contexts++;
@@ -366,7 +388,7 @@ Status DecodeHistograms(JxlMemoryManager* memory_manager, BitReader* br,
       DecodeUintConfigs(code->log_alpha_size, &code->uint_config, br));
   const size_t max_alphabet_size = 1 << code->log_alpha_size;
   JXL_RETURN_IF_ERROR(DecodeANSCodes(memory_manager, num_histograms,
-                                     max_alphabet_size, br, code));
+                                     max_alphabet_size, br, code, pool));
   return true;
 }
 
@@ -393,6 +415,9 @@ ANSSymbolReader::ANSSymbolReader(const ANSCode* code,
       use_prefix_code_(code->use_prefix_code),
       configs(code->uint_config.data()),
       lz77_window_storage_(std::move(lz77_window_storage)) {
+  if (code->max_extra_bits.size() == code->uint_config.size()) {
+    max_extra_bits_ = code->max_extra_bits.data();
+  }
   if (!use_prefix_code_) {
     state_ = static_cast<uint32_t>(br->ReadFixedBits<32>());
     log_alpha_size_ = code->log_alpha_size;
@@ -22,6 +22,7 @@
 #include "lib/jxl/ans_params.h"
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/dec_bit_reader.h"
 #include "lib/jxl/dec_huffman.h"
@@ -153,6 +154,8 @@ struct ANSCode {
   // Maximum number of bits necessary to represent the result of a
   // ReadHybridUint call done with this ANSCode.
   size_t max_num_bits = 0;
+  // For each histogram, the maximum number of extra bits of its tokens.
+  std::vector<uint8_t> max_extra_bits;
   JxlMemoryManager* memory_manager;
   void UpdateMaxNumBits(size_t ctx, size_t symbol);
 };
@@ -373,24 +376,48 @@ class ANSSymbolReader {
     return ReadHybridUintClustered</*uses_lz77=*/true>(context_map[ctx], br);
   }
 
+  // Decodes `num` values of the *clustered* context `ctx` into `values`.
+  // Cannot be used with LZ77. Reads two tokens per refill when their bits are
+  // known to fit in the buffer, and skips the bounds checks of the refills
+  // that cannot reach the end of the stream.
+  void ReadHybridUintClusteredRow(size_t ctx, BitReader* JXL_RESTRICT br,
+                                  uint32_t* JXL_RESTRICT values, size_t num) {
+    JXL_DASSERT(lz77_window_ == nullptr);
+    if (use_prefix_code_) {
+      ReadHybridUintClusteredRow<true>(ctx, br, values, num);
+    } else {
+      ReadHybridUintClusteredRow<false>(ctx, br, values, num);
+    }
+  }
+
   // ctx is a *clustered* context!
   // This function will modify the ANS state as if `count` symbols have been
   // decoded.
   bool IsSingleValueAndAdvance(size_t ctx, uint32_t* value, size_t count) {
-    // TODO(veluca): No optimization for Huffman mode yet.
-    if (use_prefix_code_) return false;
-    // TODO(eustas): propagate "degenerate_symbol" to simplify this method.
-    const uint32_t res = state_ & (ANS_TAB_SIZE - 1u);
-    const AliasTable::Entry* table = &alias_tables_[ctx << log_alpha_size_];
-    AliasTable::Symbol symbol =
-        AliasTable::Lookup(table, res, log_entry_size_, entry_size_minus_1_);
-    if (symbol.freq != ANS_TAB_SIZE) return false;
-    if (configs[ctx].split_token <= symbol.value) return false;
-    if (symbol.value >= lz77_threshold_) return false;
-    *value = symbol.value;
+    // A pending LZ77 copy decides the next values, not the histogram.
+    if (num_to_copy_ > 0) return false;
+    uint32_t symbol_value;
+    if (use_prefix_code_) {
+      // A prefix code with a single symbol takes no bits at all, so there is
+      // nothing to read; such codes fill the whole table with 0-bit entries.
+      const HuffmanCode& code = huffman_data_[ctx].table_[0];
+      if (code.bits != 0) return false;
+      symbol_value = code.value;
+    } else {
+      // TODO(eustas): propagate "degenerate_symbol" to simplify this method.
+      const uint32_t res = state_ & (ANS_TAB_SIZE - 1u);
+      const AliasTable::Entry* table = &alias_tables_[ctx << log_alpha_size_];
+      AliasTable::Symbol symbol =
+          AliasTable::Lookup(table, res, log_entry_size_, entry_size_minus_1_);
+      if (symbol.freq != ANS_TAB_SIZE) return false;
+      symbol_value = symbol.value;
+    }
+    if (configs[ctx].split_token <= symbol_value) return false;
+    if (symbol_value >= lz77_threshold_) return false;
+    *value = symbol_value;
     if (lz77_window_) {
       for (size_t i = 0; i < count; i++) {
-        lz77_window_[(num_decoded_++) & kWindowMask] = symbol.value;
+        lz77_window_[(num_decoded_++) & kWindowMask] = symbol_value;
       }
     }
     return true;
@@ -450,11 +477,48 @@ class ANSSymbolReader {
                   size_t distance_multiplier,
                   AlignedMemory&& lz77_window_storage);
 
+  template <bool prefix_code>
+  JXL_INLINE uint32_t ReadHybridUintWithoutRefill(size_t ctx,
+                                                  BitReader* JXL_RESTRICT br) {
+    size_t token = prefix_code ? ReadSymbolHuffWithoutRefill(ctx, br)
+                               : ReadSymbolANSWithoutRefill(ctx, br);
+    return ReadHybridUintConfig(configs[ctx], token, br);
+  }
+
+  template <bool prefix_code>
+  void ReadHybridUintClusteredRow(size_t ctx, BitReader* JXL_RESTRICT br,
+                                  uint32_t* JXL_RESTRICT values, size_t num) {
+    // Bits read for one token: the symbol, and at most 31 extra bits.
+    const size_t token_bits = (prefix_code ? PREFIX_MAX_BITS : 16) +
+                              (max_extra_bits_ ? max_extra_bits_[ctx] : 31);
+    // A refill leaves at least 56 bits in the buffer.
+    const size_t tokens_per_refill = 2 * token_bits <= 56 ? 2 : 1;
+    size_t i = 0;
+    while (i < num) {
+      size_t num_refills = std::min(br->NumUncheckedRefills(),
+                                    DivCeil(num - i, tokens_per_refill));
+      if (num_refills == 0) {
+        br->Refill();
+        values[i++] = ReadHybridUintWithoutRefill<prefix_code>(ctx, br);
+        continue;
+      }
+      for (; num_refills > 0; num_refills--) {
+        br->RefillUnchecked();
+        values[i++] = ReadHybridUintWithoutRefill<prefix_code>(ctx, br);
+        if (tokens_per_refill == 2 && i < num) {
+          values[i++] = ReadHybridUintWithoutRefill<prefix_code>(ctx, br);
+        }
+      }
+    }
+  }
+
   const AliasTable::Entry* JXL_RESTRICT alias_tables_;  // not owned
   const HuffmanDecodingData* huffman_data_;
   bool use_prefix_code_;
   uint32_t state_ = ANS_SIGNATURE << 16u;
   const HybridUintConfig* JXL_RESTRICT configs;
+  // Per histogram, or nullptr if unknown.
+  const uint8_t* max_extra_bits_ = nullptr;
   uint32_t log_alpha_size_{};
   uint32_t log_entry_size_{};
   uint32_t entry_size_minus_1_{};
@@ -476,10 +540,12 @@ class ANSSymbolReader {
   uint32_t num_special_distances_{};
 };
 
+// If `pool` is not null, the alias tables of codes with many histograms are
+// built on it once all the histograms are read.
 Status DecodeHistograms(JxlMemoryManager* memory_manager, BitReader* br,
                         size_t num_contexts, ANSCode* code,
                         std::vector<uint8_t>* context_map,
-                        bool disallow_lz77 = false);
+                        bool disallow_lz77 = false, ThreadPool* pool = nullptr);
 
 // Exposed for tests.
 Status DecodeUintConfigs(size_t log_alpha_size,
@@ -85,21 +85,35 @@ class BitReader {
     if (JXL_UNLIKELY(next_byte_ > end_minus_8_)) {
       BoundsCheckedRefill();
     } else {
-      // It's safe to load 64 bits; insert valid (possibly nonzero) bits above
-      // bits_in_buf_. The shift requires bits_in_buf_ < 64.
-      buf_ |= LoadLE64(next_byte_) << bits_in_buf_;
-
-      // Advance by bytes fully absorbed into the buffer.
-      next_byte_ += (63 - bits_in_buf_) >> 3;
-
-      // We absorbed a multiple of 8 bits, so the lower 3 bits of bits_in_buf_
-      // must remain unchanged, otherwise the next refill's shifted bits will
-      // not align with buf_. Set the three upper bits so the result >= 56.
-      bits_in_buf_ |= 56;
-      JXL_DASSERT(56 <= bits_in_buf_ && bits_in_buf_ < 64);
+      RefillUnchecked();
     }
   }
 
+  // Number of the next Refill calls that cannot reach the end of the stream,
+  // e.g. of a section whose size is given by the TOC: each refill advances by
+  // at most 7 bytes. These can use RefillUnchecked.
+  JXL_INLINE size_t NumUncheckedRefills() const {
+    if (next_byte_ > end_minus_8_) return 0;
+    return static_cast<size_t>(end_minus_8_ - next_byte_) / 7 + 1;
+  }
+
+  // Refill without the bounds check, see NumUncheckedRefills.
+  JXL_INLINE void RefillUnchecked() {
+    JXL_DASSERT(next_byte_ <= end_minus_8_);
+    // It's safe to load 64 bits; insert valid (possibly nonzero) bits above
+    // bits_in_buf_. The shift requires bits_in_buf_ < 64.
+    buf_ |= LoadLE64(next_byte_) << bits_in_buf_;
+
+    // Advance by bytes fully absorbed into the buffer.
+    next_byte_ += (63 - bits_in_buf_) >> 3;
+
+    // We absorbed a multiple of 8 bits, so the lower 3 bits of bits_in_buf_
+    // must remain unchanged, otherwise the next refill's shifted bits will
+    // not align with buf_. Set the three upper bits so the result >= 56.
+    bits_in_buf_ |= 56;
+    JXL_DASSERT(56 <= bits_in_buf_ && bits_in_buf_ < 64);
+  }
+
   // Returns the bits that would be returned by Read without calling Advance().
   // It is legal to PEEK at more bits than present in the bitstream (required
   // by Huffman), and those bits will be zero.
@@ -8,6 +8,7 @@
 #include <jxl/memory_manager.h>
 
 #include <algorithm>
+#include <utility>
 
 #include "lib/jxl/ac_strategy.h"
 #include "lib/jxl/base/status.h"
@@ -20,8 +21,11 @@
 #include "lib/jxl/render_pipeline/stage_epf.h"
 #include "lib/jxl/render_pipeline/stage_from_linear.h"
 #include "lib/jxl/render_pipeline/stage_gaborish.h"
+#include "lib/jxl/render_pipeline/stage_gain_map.h"
+#include "lib/jxl/render_pipeline/stage_hook.h"
 #include "lib/jxl/render_pipeline/stage_noise.h"
 #include "lib/jxl/render_pipeline/stage_patches.h"
+#include "lib/jxl/render_pipeline/stage_resample.h"
 #include "lib/jxl/render_pipeline/stage_splines.h"
 #include "lib/jxl/render_pipeline/stage_spot.h"
 #include "lib/jxl/render_pipeline/stage_to_linear.h"
@@ -30,6 +34,7 @@
 #include "lib/jxl/render_pipeline/stage_write.h"
 #include "lib/jxl/render_pipeline/stage_xyb.h"
 #include "lib/jxl/render_pipeline/stage_ycbcr.h"
+#include "lib/jxl/render_pipeline/stage_ycbcr_planes.h"
 
 namespace jxl {
 
@@ -90,6 +95,104 @@ Status PassesDecoderState::InitForAC(size_t num_passes, ThreadPool* pool) {
   return true;
 }
 
+void PassesDecoderState::ReleaseBuffers(ReusableDecoderBuffers* buffers) {
+  buffers->ac_strategy = std::move(shared_storage.ac_strategy);
+  buffers->raw_quant_field = std::move(shared_storage.raw_quant_field);
+  buffers->epf_sharpness = std::move(shared_storage.epf_sharpness);
+  buffers->quant_dc = std::move(shared_storage.quant_dc);
+  buffers->dc_storage = std::move(shared_storage.dc_storage);
+  buffers->sigma = std::move(sigma);
+  buffers->group_dec_caches = std::move(group_dec_caches);
+}
+
+void PassesDecoderState::AdoptBuffers(ReusableDecoderBuffers* buffers) {
+  shared_storage.ac_strategy = std::move(buffers->ac_strategy);
+  shared_storage.raw_quant_field = std::move(buffers->raw_quant_field);
+  shared_storage.epf_sharpness = std::move(buffers->epf_sharpness);
+  shared_storage.quant_dc = std::move(buffers->quant_dc);
+  shared_storage.dc_storage = std::move(buffers->dc_storage);
+  sigma = std::move(buffers->sigma);
+  group_dec_caches = std::move(buffers->group_dec_caches);
+}
+
+Status PassesDecoderState::ReserveBuffers(JxlMemoryManager* memory_manager,
+                                          size_t xsize, size_t ysize,
+                                          ReusableDecoderBuffers* buffers) {
+  // Rounded up to a multiple of 2 blocks, which covers the padding of frames
+  // with chroma subsampling.
+  size_t xsize_blocks = RoundUpTo(DivCeil(xsize, kBlockDim), 2);
+  size_t ysize_blocks = RoundUpTo(DivCeil(ysize, kBlockDim), 2);
+  JXL_RETURN_IF_ERROR(ReuseOrCreate(memory_manager, xsize_blocks,
+                                    ysize_blocks, &buffers->ac_strategy));
+  JXL_RETURN_IF_ERROR(ReuseOrCreate(memory_manager, xsize_blocks,
+                                    ysize_blocks, &buffers->raw_quant_field));
+  JXL_RETURN_IF_ERROR(ReuseOrCreate(memory_manager, xsize_blocks,
+                                    ysize_blocks, &buffers->epf_sharpness));
+  JXL_RETURN_IF_ERROR(ReuseOrCreate(memory_manager, xsize_blocks,
+                                    ysize_blocks, &buffers->quant_dc));
+  JXL_RETURN_IF_ERROR(ReuseOrCreate(memory_manager, xsize_blocks,
+                                    ysize_blocks, &buffers->dc_storage));
+  JXL_RETURN_IF_ERROR(ReuseOrCreate(
+      memory_manager, xsize_blocks + 2 * kSigmaPadding,
+      ysize_blocks + 2 * kSigmaPadding, &buffers->sigma));
+  return true;
+}
+
+Status PassesDecoderState::AddYCbCrPlanesStages(
+    const FrameHeader& frame_header, RenderPipeline::Builder* builder) {
+  JXL_ENSURE(frame_header.color_transform == ColorTransform::kYCbCr);
+  JXL_ENSURE(ycbcr_planes.size() == 3);
+  const YCbCrChromaSubsampling& cs = frame_header.chroma_subsampling;
+  // The planes are given as Y, Cb, Cr; the channels are Cb, Y, Cr.
+  const size_t kPlaneForChannel[3] = {1, 0, 2};
+  const auto add_write_stage = [&](size_t c) {
+    return builder->AddStage(GetWriteToYCbCrPlaneStage(
+        c, ycbcr_data_type, ycbcr_planes[kPlaneForChannel[c]]));
+  };
+  // Subsampled channels are written before the stages that bring them to the
+  // full resolution, and the other channels after them, as the last stages
+  // of the pipeline must operate at full resolution.
+  bool has_full_resolution_channel = false;
+  for (size_t c = 0; c < 3; c++) {
+    if (cs.HShift(c) != 0 || cs.VShift(c) != 0) {
+      JXL_RETURN_IF_ERROR(add_write_stage(c));
+    }
+  }
+  for (size_t c = 0; c < 3; c++) {
+    if (cs.HShift(c) != 0) {
+      JXL_RETURN_IF_ERROR(builder->AddStage(
+          GetSkipChromaUpsamplingStage(c, /*horizontal=*/true)));
+    }
+    if (cs.VShift(c) != 0) {
+      JXL_RETURN_IF_ERROR(builder->AddStage(
+          GetSkipChromaUpsamplingStage(c, /*horizontal=*/false)));
+    }
+  }
+  for (size_t c = 0; c < 3; c++) {
+    if (cs.HShift(c) == 0 && cs.VShift(c) == 0) {
+      JXL_RETURN_IF_ERROR(add_write_stage(c));
+      has_full_resolution_channel = true;
+    }
+  }
+  if (!has_full_resolution_channel) {
+    return JXL_FAILURE("YCbCr planes output needs a full resolution channel");
+  }
+  return true;
+}
+
+FrameDimensions PassesDecoderState::DCOutputDimensions(
+    const FrameHeader& frame_header) const {
+  const FrameDimensions& frame_dim = shared->frame_dim;
+  FrameDimensions dc_dim;
+  // No padding, so that the output has exactly one pixel per block.
+  dc_dim.Set(DivCeil(frame_dim.xsize, kBlockDim),
+             DivCeil(frame_dim.ysize, kBlockDim), frame_header.group_size_shift,
+             frame_header.chroma_subsampling.MaxHShift(),
+             frame_header.chroma_subsampling.MaxVShift(),
+             /*modular_mode=*/true, /*upsampling=*/1);
+  return dc_dim;
+}
+
 Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
                                            const ImageMetadata* metadata,
                                            ImageBundle* decoded,
@@ -97,7 +200,8 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
   JxlMemoryManager* memory_manager = this->memory_manager();
   size_t num_c = 3 + frame_header.nonserialized_metadata->m.num_extra_channels;
   bool render_noise =
-      (options.render_noise && (frame_header.flags & FrameHeader::kNoise) != 0);
+      (options.render_noise && !options.dc_only_output &&
+       (frame_header.flags & FrameHeader::kNoise) != 0);
   size_t num_tmp_c = render_noise ? 3 : 0;
 
   if (frame_header.CanBeReferenced()) {
@@ -110,6 +214,25 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
   if (options.use_slow_render_pipeline) {
     builder.UseSimpleImplementation();
   }
+  if (options.half_precision_borders) {
+    builder.UseHalfPrecisionBorders();
+  }
+  builder.SetStats(stats);
+  const FrameDimensions frame_dim = options.dc_only_output
+                                        ? DCOutputDimensions(frame_header)
+                                        : shared->frame_dim;
+  if (options.dc_only_output) {
+    JXL_ENSURE(ycbcr_planes.empty() && frame_header.upsampling == 1);
+    JXL_ENSURE((frame_header.flags &
+                (FrameHeader::kPatches | FrameHeader::kSplines)) == 0);
+  }
+
+  if (!ycbcr_planes.empty()) {
+    JXL_RETURN_IF_ERROR(AddYCbCrPlanesStages(frame_header, &builder));
+    JXL_ASSIGN_OR_RETURN(render_pipeline,
+                         std::move(builder).Finalize(frame_dim));
+    return render_pipeline->IsInitialized();
+  }
 
   if (!frame_header.chroma_subsampling.Is444()) {
     for (size_t c = 0; c < 3; c++) {
@@ -124,27 +247,44 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }
   }
 
-  if (frame_header.loop_filter.gab) {
-    JXL_RETURN_IF_ERROR(
-        builder.AddStage(GetGaborishStage(frame_header.loop_filter)));
+  const bool loop_filters =
+      !options.dc_only_output && !options.skip_loop_filters;
+  if (frame_header.loop_filter.gab && loop_filters) {
+    JXL_RETURN_IF_ERROR(builder.AddStage(
+        GetGaborishStage(frame_header.loop_filter, options.luma_only)));
   }
 
-  {
+  if (loop_filters) {
     const LoopFilter& lf = frame_header.loop_filter;
     if (lf.epf_iters >= 3) {
-      JXL_RETURN_IF_ERROR(
-          builder.AddStage(GetEPFStage(lf, sigma, EpfStage::Zero)));
+      JXL_RETURN_IF_ERROR(builder.AddStage(
+          GetEPFStage(lf, sigma, EpfStage::Zero, options.luma_only)));
     }
     if (lf.epf_iters >= 1) {
-      JXL_RETURN_IF_ERROR(
-          builder.AddStage(GetEPFStage(lf, sigma, EpfStage::One)));
+      JXL_RETURN_IF_ERROR(builder.AddStage(
+          GetEPFStage(lf, sigma, EpfStage::One, options.luma_only)));
     }
     if (lf.epf_iters >= 2) {
-      JXL_RETURN_IF_ERROR(
-          builder.AddStage(GetEPFStage(lf, sigma, EpfStage::Two)));
+      JXL_RETURN_IF_ERROR(builder.AddStage(
+          GetEPFStage(lf, sigma, EpfStage::Two, options.luma_only)));
     }
   }
 
+  if (options.luma_only) {
+    JXL_ENSURE(frame_header.color_transform == ColorTransform::kXYB);
+    JXL_RETURN_IF_ERROR(builder.AddStage(GetNeutralChromaStage()));
+  }
+
+  const auto add_upsampling_stage = [&](size_t c, size_t factor) {
+    if (options.nearest_upsampling) {
+      return builder.AddStage(
+          GetNearestUpsamplingStage(c, CeilLog2Nonzero(factor)));
+    }
+    return builder.AddStage(
+        GetUpsamplingStage(frame_header.nonserialized_metadata->transform_data,
+                           c, CeilLog2Nonzero(factor)));
+  };
+
   bool late_ec_upsample = frame_header.upsampling != 1;
   for (auto ecups : frame_header.extra_channel_upsampling) {
     if (ecups != frame_header.upsampling) {
@@ -158,9 +298,8 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     for (size_t ec = 0; ec < frame_header.extra_channel_upsampling.size();
          ec++) {
       if (frame_header.extra_channel_upsampling[ec] != 1) {
-        JXL_RETURN_IF_ERROR(builder.AddStage(GetUpsamplingStage(
-            frame_header.nonserialized_metadata->transform_data, 3 + ec,
-            CeilLog2Nonzero(frame_header.extra_channel_upsampling[ec]))));
+        JXL_RETURN_IF_ERROR(add_upsampling_stage(
+            3 + ec, frame_header.extra_channel_upsampling[ec]));
       }
     }
   }
@@ -170,7 +309,8 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
         &shared->image_features.patches,
         &frame_header.nonserialized_metadata->m.extra_channel_info)));
   }
-  if ((frame_header.flags & FrameHeader::kSplines) != 0) {
+  if ((frame_header.flags & FrameHeader::kSplines) != 0 &&
+      options.render_splines) {
     JXL_RETURN_IF_ERROR(
         builder.AddStage(GetSplineStage(&shared->image_features.splines)));
   }
@@ -180,9 +320,7 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
         3 +
         (late_ec_upsample ? frame_header.extra_channel_upsampling.size() : 0);
     for (size_t c = 0; c < nb_channels; c++) {
-      JXL_RETURN_IF_ERROR(builder.AddStage(GetUpsamplingStage(
-          frame_header.nonserialized_metadata->transform_data, c,
-          CeilLog2Nonzero(frame_header.upsampling))));
+      JXL_RETURN_IF_ERROR(add_upsampling_stage(c, frame_header.upsampling));
     }
   }
   if (render_noise) {
@@ -201,6 +339,11 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
         &frame_storage_for_referencing, output_encoding_info)));
   }
 
+  if (options.render_hook && options.render_hook->IsPresent()) {
+    JXL_RETURN_IF_ERROR(
+        builder.AddStage(GetRenderHookStage(*options.render_hook)));
+  }
+
   bool has_alpha = false;
   size_t alpha_c = 0;
   for (size_t i = 0; i < metadata->extra_channel_info.size(); i++) {
@@ -225,13 +368,52 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
                                is_rgba, has_alpha, alpha_c)));
 #endif
   } else {
+    const bool has_spot_colors =
+        options.render_spotcolors &&
+        frame_header.nonserialized_metadata->m.Find(ExtraChannel::kSpotColor);
+    auto tone_mapping_stage = GetToneMappingStage(output_encoding_info);
+    const size_t channels_src =
+        (output_encoding_info.orig_color_encoding.IsCMYK()
+             ? 4
+             : output_encoding_info.orig_color_encoding.Channels());
+    const size_t channels_dst = output_encoding_info.color_encoding.Channels();
+    bool mixing_color_and_grey = (channels_dst != channels_src);
+    // In those cases we only need a linear stage in other cases we attempt
+    // to obtain a cms stage: the cases are
+    // - output_encoding_info.color_encoding_is_original: no cms stage
+    // needed because it would be a no-op
+    // - !output_encoding_info.cms_set: can't use the cms, so no point in
+    // trying to add a cms stage
+    // - mixing_color_and_grey: cms stage can't handle that
+    // TODO(firsching): remove "mixing_color_and_grey" condition after
+    // adding support for greyscale to cms stage.
+    const bool from_linear_without_cms =
+        output_encoding_info.color_encoding_is_original ||
+        !output_encoding_info.cms_set || mixing_color_and_grey;
+    // Whether the linear pixels only go through the FromLinear stage right
+    // after the XYB stage, so that both can be done in one pass.
+    const bool from_linear_after_xyb =
+        (options.coalescing &&
+         (NeedsBlending(frame_header) ||
+          (frame_header.CanBeReferenced() &&
+           !frame_header.save_before_color_transform))) ||
+        (!has_spot_colors && !options.gain_map && !tone_mapping_stage &&
+         from_linear_without_cms);
+
     bool linear = false;
     if (frame_header.color_transform == ColorTransform::kYCbCr) {
       JXL_RETURN_IF_ERROR(builder.AddStage(GetYCbCrStage()));
     } else if (frame_header.color_transform == ColorTransform::kXYB) {
-      JXL_RETURN_IF_ERROR(builder.AddStage(GetXYBStage(output_encoding_info)));
-      if (output_encoding_info.color_encoding.GetColorSpace() !=
+      if (output_encoding_info.color_encoding.GetColorSpace() ==
           ColorSpace::kXYB) {
+        JXL_RETURN_IF_ERROR(
+            builder.AddStage(GetXYBStage(output_encoding_info)));
+      } else if (from_linear_after_xyb) {
+        JXL_RETURN_IF_ERROR(
+            builder.AddStage(GetXYBToEncodedStage(output_encoding_info)));
+      } else {
+        JXL_RETURN_IF_ERROR(
+            builder.AddStage(GetXYBStage(output_encoding_info)));
         linear = true;
       }
     }  // Nothing to do for kNone.
@@ -257,8 +439,7 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
           &frame_storage_for_referencing, output_encoding_info)));
     }
 
-    if (options.render_spotcolors &&
-        frame_header.nonserialized_metadata->m.Find(ExtraChannel::kSpotColor)) {
+    if (has_spot_colors) {
       for (size_t i = 0; i < metadata->extra_channel_info.size(); i++) {
         // Don't use Find() because there may be multiple spot color channels.
         const ExtraChannelInfo& eci = metadata->extra_channel_info[i];
@@ -269,7 +450,18 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
       }
     }
 
-    auto tone_mapping_stage = GetToneMappingStage(output_encoding_info);
+    if (options.gain_map) {
+      if (!linear) {
+        auto to_linear_stage = GetToLinearStage(output_encoding_info);
+        if (!to_linear_stage) {
+          return JXL_FAILURE("Cannot apply a gain map to this colorspace");
+        }
+        JXL_RETURN_IF_ERROR(builder.AddStage(std::move(to_linear_stage)));
+        linear = true;
+      }
+      JXL_RETURN_IF_ERROR(builder.AddStage(GetGainMapStage(options.gain_map)));
+    }
+
     if (tone_mapping_stage) {
       if (!linear) {
         auto to_linear_stage = GetToLinearStage(output_encoding_info);
@@ -290,24 +482,7 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }
 
     if (linear) {
-      const size_t channels_src =
-          (output_encoding_info.orig_color_encoding.IsCMYK()
-               ? 4
-               : output_encoding_info.orig_color_encoding.Channels());
-      const size_t channels_dst =
-          output_encoding_info.color_encoding.Channels();
-      bool mixing_color_and_grey = (channels_dst != channels_src);
-      if ((output_encoding_info.color_encoding_is_original) ||
-          (!output_encoding_info.cms_set) || mixing_color_and_grey) {
-        // in those cases we only need a linear stage in other cases we attempt
-        // to obtain a cms stage: the cases are
-        // - output_encoding_info.color_encoding_is_original: no cms stage
-        // needed because it would be a no-op
-        // - !output_encoding_info.cms_set: can't use the cms, so no point in
-        // trying to add a cms stage
-        // - mixing_color_and_grey: cms stage can't handle that
-        // TODO(firsching): remove "mixing_color_and_grey" condition after
-        // adding support for greyscale to cms stage.
+      if (from_linear_without_cms) {
         JXL_RETURN_IF_ERROR(
             builder.AddStage(GetFromLinearStage(output_encoding_info)));
       } else {
@@ -323,17 +498,27 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }
     (void)linear;
 
-    if (main_output.callback.IsPresent() || main_output.buffer) {
+    if (resampled_output) {
+      JXL_RETURN_IF_ERROR(
+          builder.AddStage(GetResampleStage(resampled_output.get())));
+    } else if (main_output.callback.IsPresent() ||
+               main_output.tile_callback.IsPresent() || main_output.buffer ||
+               !main_output.channels.empty()) {
+      Rect output_rect =
+          has_output_crop ? output_crop : Rect(0, 0, width, height);
       JXL_RETURN_IF_ERROR(builder.AddStage(GetWriteToOutputStage(
-          main_output, width, height, has_alpha, unpremul_alpha, alpha_c,
-          undo_orientation, extra_output, memory_manager)));
+          main_output, output_rect, has_alpha, unpremul_alpha, premul_alpha,
+          alpha_c, undo_orientation, extra_output, memory_manager)));
     } else {
       JXL_RETURN_IF_ERROR(builder.AddStage(
           GetWriteToImageBundleStage(decoded, output_encoding_info)));
     }
   }
   JXL_ASSIGN_OR_RETURN(render_pipeline,
-                       std::move(builder).Finalize(shared->frame_dim));
+                       std::move(builder).Finalize(frame_dim));
+  if (has_output_crop && options.skip_cropped_groups) {
+    render_pipeline->SetRenderRect(output_crop);
+  }
   return render_pipeline->IsInitialized();
 }
 
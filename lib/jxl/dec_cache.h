@@ -21,10 +21,12 @@
 #include "lib/jxl/base/common.h"  // kMaxNumPasses
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/dct_util.h"
 #include "lib/jxl/dec_ans.h"
+#include "lib/jxl/dec_stats.h"
 #include "lib/jxl/dec_xyb.h"
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/frame_header.h"
@@ -34,6 +36,9 @@
 #include "lib/jxl/passes_state.h"
 #include "lib/jxl/render_pipeline/render_pipeline.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+#include "lib/jxl/render_pipeline/stage_gain_map.h"
+#include "lib/jxl/render_pipeline/stage_hook.h"
+#include "lib/jxl/render_pipeline/stage_resample.h"
 #include "lib/jxl/render_pipeline/stage_upsampling.h"
 
 namespace jxl {
@@ -67,6 +72,13 @@ struct PixelCallback {
   void* init_opaque = nullptr;
 };
 
+struct TileCallback {
+  bool IsPresent() const { return run != nullptr; }
+
+  JxlImageOutTileCallback run = nullptr;
+  void* opaque = nullptr;
+};
+
 struct ImageOutput {
   // Pixel format of the output pixels, used for buffer and callback output.
   JxlPixelFormat format;
@@ -74,11 +86,80 @@ struct ImageOutput {
   size_t bits_per_sample;
   // Callback for line-by-line output.
   PixelCallback callback;
+  // Callback for output of whole rendered rectangles, used instead of callback
+  // and buffer if present.
+  TileCallback tile_callback;
   // Pixel buffer for image output.
   void* buffer;
   size_t buffer_size;
   // Length of a row of image_buffer in bytes (based on oriented width).
   size_t stride;
+  // Per-channel pixel buffers, used instead of buffer if not empty.
+  std::vector<JxlChannelBuffer> channels;
+};
+
+// Temp images required for decoding a single group. Reduces memory allocations
+// for large images because we only initialize min(#threads, #groups) instances.
+struct GroupDecCache {
+  Status InitOnce(JxlMemoryManager* memory_manager, size_t num_passes,
+                  size_t used_acs);
+
+  Status InitDCBufferOnce(JxlMemoryManager* memory_manager) {
+    if (dc_buffer.xsize() == 0) {
+      JXL_ASSIGN_OR_RETURN(
+          dc_buffer,
+          ImageF::Create(memory_manager,
+                         kGroupDimInBlocks + kRenderPipelineXOffset * 2,
+                         kGroupDimInBlocks + 4));
+    }
+    return true;
+  }
+
+  // Scratch space used by DecGroupImpl().
+  float* dec_group_block;
+  int32_t* dec_group_qblock;
+  int16_t* dec_group_qblock16;
+
+  // For TransformToPixels.
+  float* scratch_space;
+  // Note that scratch_space is never used at the same time as dec_group_qblock.
+  // Moreover, only one of dec_group_qblock16 is ever used.
+  // TODO(veluca): figure out if we can save allocations.
+
+  // AC decoding
+  Image3I num_nzeroes[kMaxNumPasses];
+
+  // Buffer for DC upsampling.
+  ImageF dc_buffer;
+
+ private:
+  hwy::AlignedFreeUniquePtr<float[]> float_memory_;
+  hwy::AlignedFreeUniquePtr<int32_t[]> int32_memory_;
+  hwy::AlignedFreeUniquePtr<int16_t[]> int16_memory_;
+  size_t max_block_area_ = 0;
+};
+
+// Buffers that do not carry information between frames. They are moved out of
+// a PassesDecoderState that is no longer needed, so that the next one only has
+// to reallocate them if it needs larger ones.
+struct ReusableDecoderBuffers {
+  AcStrategyImage ac_strategy;
+  ImageI raw_quant_field;
+  ImageB epf_sharpness;
+  ImageB quant_dc;
+  Image3F dc_storage;
+  ImageF sigma;
+  std::vector<GroupDecCache> group_dec_caches;
+};
+
+// Limits set with JxlDecoderSetLimit, where 0 means no limit.
+struct DecoderLimits {
+  uint64_t pixels = 0;
+  uint64_t frames = 0;
+  uint64_t tree_nodes = 0;
+  uint64_t spline_control_points = 0;
+  uint64_t patches = 0;
+  uint64_t filter_work = 0;
 };
 
 // Per-frame decoder state. All the images here should be accessed through a
@@ -103,22 +184,48 @@ struct PassesDecoderState {
   float x_dm_multiplier;
   float b_dm_multiplier;
 
+  // Whether only the Y channel of the VarDCT groups is dequantized and
+  // transformed, see PipelineOptions::luma_only.
+  bool luma_only = false;
+
   // Sigma values for EPF.
   ImageF sigma;
 
+  // Temp images for decoding groups, see FrameDecoder::PrepareStorage().
+  std::vector<GroupDecCache> group_dec_caches;
+
   // Image dimensions before applying undo_orientation.
   size_t width;
   size_t height;
+  // If set, only this region of the image (before applying undo_orientation)
+  // is written to the outputs; its size is width x height.
+  bool has_output_crop;
+  Rect output_crop;
   ImageOutput main_output;
   std::vector<ImageOutput> extra_output;
+  // If not empty, the Y, Cb and Cr channels of a YCbCr frame are written to
+  // these planes at their native resolution, instead of any other output.
+  std::vector<JxlChannelBuffer> ycbcr_planes;
+  JxlDataType ycbcr_data_type;
+  // If set, the image is resampled into this instead of any other output.
+  std::unique_ptr<ResampledImage> resampled_output;
 
   // Whether to use int16 float-XYB-to-uint8-srgb conversion.
   bool fast_xyb_srgb8_conversion;
 
+  // If true, the groups of a lossless modular frame are written straight from
+  // their integer channels to main_output.buffer, and the render pipeline
+  // receives no input.
+  bool modular_int_output;
+
   // If true, the RGBA output will be unpremultiplied before writing to the
   // output.
   bool unpremul_alpha;
 
+  // If true, the colors of the RGBA output will be multiplied by the alpha
+  // when writing to the output.
+  bool premul_alpha;
+
   // The render pipeline will apply this orientation to bring the image to the
   // intended display orientation.
   Orientation undo_orientation;
@@ -136,6 +243,12 @@ struct PassesDecoderState {
   // Rendering pipeline.
   std::unique_ptr<RenderPipeline> render_pipeline;
 
+  // If not null, the statistics of the decoding are accumulated here.
+  DecoderStats* stats = nullptr;
+
+  // If not null, the limits set with JxlDecoderSetLimit.
+  const DecoderLimits* limits = nullptr;
+
   // Storage for the current frame if it can be referenced by future frames.
   ImageBundle frame_storage_for_referencing;
 
@@ -144,14 +257,45 @@ struct PassesDecoderState {
     bool coalescing;
     bool render_spotcolors;
     bool render_noise;
+    bool render_splines = true;
+    // Whether gaborish and EPF are skipped, for faster low fidelity decoding.
+    bool skip_loop_filters = false;
+    // Whether upsampling repeats the pixels instead of using the upsampling
+    // kernels, for faster low fidelity decoding.
+    bool nearest_upsampling = false;
+    // Whether groups that do not contribute to output_crop may be skipped.
+    bool skip_cropped_groups = false;
+    // Whether the borders between groups may be stored in half precision.
+    bool half_precision_borders = false;
+    // Whether only the DC image is rendered, at DCOutputDimensions(), without
+    // the loop filters. Patches, splines, noise and upsampling are not
+    // supported in this mode.
+    bool dc_only_output = false;
+    // Whether only the Y channel of an XYB frame is filtered; the X and B
+    // channels are then replaced with the ones of neutral colors before the
+    // other stages. Only sensible if the output is grayscale.
+    bool luma_only = false;
+    // If not null and present, called on the rows before the color transform.
+    const RenderHook* render_hook = nullptr;
+    // If not null, applied to the linear color channels of the frame.
+    const GainMap* gain_map = nullptr;
   };
 
+  // Dimensions of the frame when rendering one pixel per 8x8 block of its DC
+  // image; each group of the result corresponds to a DC group of the frame.
+  FrameDimensions DCOutputDimensions(const FrameHeader& frame_header) const;
+
   JxlMemoryManager* memory_manager() const { return shared->memory_manager; }
 
   Status PreparePipeline(const FrameHeader& frame_header,
                          const ImageMetadata* metadata, ImageBundle* decoded,
                          PipelineOptions options);
 
+  // Adds the stages writing the channels to ycbcr_planes, which replace all
+  // the other stages of the pipeline.
+  Status AddYCbCrPlanesStages(const FrameHeader& frame_header,
+                              RenderPipeline::Builder* builder);
+
   // Information for colour conversions.
   OutputEncodingInfo output_encoding_info;
 
@@ -162,69 +306,45 @@ struct PassesDecoderState {
     b_dm_multiplier = std::pow(1 / (1.25f), frame_header.b_qm_scale - 2.0f);
 
     main_output.callback = PixelCallback();
+    main_output.tile_callback = TileCallback();
     main_output.buffer = nullptr;
+    main_output.channels.clear();
     extra_output.clear();
+    ycbcr_planes.clear();
+    resampled_output.reset();
+    has_output_crop = false;
 
     fast_xyb_srgb8_conversion = false;
+    modular_int_output = false;
     unpremul_alpha = false;
+    premul_alpha = false;
     undo_orientation = Orientation::kIdentity;
 
     used_acs = 0;
 
     upsampler8x = GetUpsamplingStage(shared->metadata->transform_data, 0, 3);
     if (frame_header.loop_filter.epf_iters > 0) {
-      JXL_ASSIGN_OR_RETURN(
-          sigma,
-          ImageF::Create(memory_manager,
-                         shared->frame_dim.xsize_blocks + 2 * kSigmaPadding,
-                         shared->frame_dim.ysize_blocks + 2 * kSigmaPadding));
+      JXL_RETURN_IF_ERROR(ReuseOrCreate(
+          memory_manager, shared->frame_dim.xsize_blocks + 2 * kSigmaPadding,
+          shared->frame_dim.ysize_blocks + 2 * kSigmaPadding, &sigma));
     }
     return true;
   }
 
-  // Initialize the decoder state after all of DC is decoded.
-  Status InitForAC(size_t num_passes, ThreadPool* pool);
-};
+  // Moves the buffers that can be reused by another image out of this state.
+  void ReleaseBuffers(ReusableDecoderBuffers* buffers);
 
-// Temp images required for decoding a single group. Reduces memory allocations
-// for large images because we only initialize min(#threads, #groups) instances.
-struct GroupDecCache {
-  Status InitOnce(JxlMemoryManager* memory_manager, size_t num_passes,
-                  size_t used_acs);
+  // Takes the buffers released by a previous state, which must have used the
+  // same memory manager.
+  void AdoptBuffers(ReusableDecoderBuffers* buffers);
 
-  Status InitDCBufferOnce(JxlMemoryManager* memory_manager) {
-    if (dc_buffer.xsize() == 0) {
-      JXL_ASSIGN_OR_RETURN(
-          dc_buffer,
-          ImageF::Create(memory_manager,
-                         kGroupDimInBlocks + kRenderPipelineXOffset * 2,
-                         kGroupDimInBlocks + 4));
-    }
-    return true;
-  }
+  // Preallocates the buffers for decoding frames of up to xsize x ysize
+  // pixels.
+  static Status ReserveBuffers(JxlMemoryManager* memory_manager, size_t xsize,
+                               size_t ysize, ReusableDecoderBuffers* buffers);
 
-  // Scratch space used by DecGroupImpl().
-  float* dec_group_block;
-  int32_t* dec_group_qblock;
-  int16_t* dec_group_qblock16;
-
-  // For TransformToPixels.
-  float* scratch_space;
-  // Note that scratch_space is never used at the same time as dec_group_qblock.
-  // Moreover, only one of dec_group_qblock16 is ever used.
-  // TODO(veluca): figure out if we can save allocations.
-
-  // AC decoding
-  Image3I num_nzeroes[kMaxNumPasses];
-
-  // Buffer for DC upsampling.
-  ImageF dc_buffer;
-
- private:
-  hwy::AlignedFreeUniquePtr<float[]> float_memory_;
-  hwy::AlignedFreeUniquePtr<int32_t[]> int32_memory_;
-  hwy::AlignedFreeUniquePtr<int16_t[]> int16_memory_;
-  size_t max_block_area_ = 0;
+  // Initialize the decoder state after all of DC is decoded.
+  Status InitForAC(size_t num_passes, ThreadPool* pool);
 };
 
 }  // namespace jxl
@@ -472,24 +472,34 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
                          jxl::ThreadPool* pool, void* out_image,
                          size_t out_size, const PixelCallback& out_callback,
                          jxl::Orientation undo_orientation,
-                         bool unpremul_alpha) {
+                         bool unpremul_alpha, bool premul_alpha) {
   bool want_alpha = num_channels == 2 || num_channels == 4;
   size_t color_channels = num_channels <= 2 ? 1 : 3;
 
   const Image3F* color = &ib.color();
   JxlMemoryManager* memory_manager = color->memory_manager();
-  // Undo premultiplied alpha.
+  // Undo premultiplied alpha, or premultiply unassociated alpha.
   Image3F unpremul;
-  if (ib.AlphaIsPremultiplied() && ib.HasAlpha() && unpremul_alpha) {
+  const bool undo_premul =
+      ib.AlphaIsPremultiplied() && ib.HasAlpha() && unpremul_alpha;
+  const bool do_premul =
+      !ib.AlphaIsPremultiplied() && ib.HasAlpha() && premul_alpha && want_alpha;
+  if (undo_premul || do_premul) {
     JXL_ASSIGN_OR_RETURN(
         unpremul,
         Image3F::Create(memory_manager, color->xsize(), color->ysize()));
     JXL_RETURN_IF_ERROR(CopyImageTo(*color, &unpremul));
     const ImageF* alpha = ib.alpha();
     for (size_t y = 0; y < unpremul.ysize(); y++) {
-      UnpremultiplyAlpha(unpremul.PlaneRow(0, y), unpremul.PlaneRow(1, y),
+      if (undo_premul) {
+        UnpremultiplyAlpha(unpremul.PlaneRow(0, y), unpremul.PlaneRow(1, y),
+                           unpremul.PlaneRow(2, y), alpha->Row(y),
+                           unpremul.xsize());
+      } else {
+        PremultiplyAlpha(unpremul.PlaneRow(0, y), unpremul.PlaneRow(1, y),
                          unpremul.PlaneRow(2, y), alpha->Row(y),
                          unpremul.xsize());
+      }
     }
     color = &unpremul;
   }
@@ -58,7 +58,8 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
                          jxl::ThreadPool* thread_pool, void* out_image,
                          size_t out_size, const PixelCallback& out_callback,
                          jxl::Orientation undo_orientation,
-                         bool unpremul_alpha = false);
+                         bool unpremul_alpha = false,
+                         bool premul_alpha = false);
 
 }  // namespace jxl
 
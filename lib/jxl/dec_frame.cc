@@ -13,6 +13,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <memory>
+#include <numeric>
 #include <utility>
 #include <vector>
 
@@ -25,6 +26,7 @@
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/blending.h"
 #include "lib/jxl/chroma_from_luma.h"
 #include "lib/jxl/coeff_order.h"
 #include "lib/jxl/coeff_order_fwd.h"
@@ -38,6 +40,7 @@
 #include "lib/jxl/dec_modular.h"
 #include "lib/jxl/dec_noise.h"
 #include "lib/jxl/dec_patch_dictionary.h"
+#include "lib/jxl/dec_stats.h"
 #include "lib/jxl/entropy_coder.h"
 #include "lib/jxl/epf.h"
 #include "lib/jxl/fields.h"
@@ -52,8 +55,10 @@
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/quantizer.h"
 #include "lib/jxl/render_pipeline/render_pipeline.h"
+#include "lib/jxl/render_pipeline/stage_tone_mapping.h"
 #include "lib/jxl/splines.h"
 #include "lib/jxl/toc.h"
+#include "lib/jxl/trace_internal.h"
 
 namespace jxl {
 
@@ -229,6 +234,12 @@ Status FrameDecoder::InitFrameOutput() {
     if (frame_header_.nonserialized_metadata->m.xyb_encoded) {
       return JXL_FAILURE("Cannot decode to JPEG an XYB image");
     }
+    if (jpeg_stream_writer_ != nullptr &&
+        (frame_header_.passes.num_passes != 1 ||
+         !jpeg::JpegStreamWriter::CanStream(*jpeg_data))) {
+      jpeg_stream_writer_ = nullptr;
+    }
+    jpeg_stream_group_row_ = 0;
     auto jpeg_c_map = JpegOrder(ColorTransform::kYCbCr, num_components == 1);
     decoded_->jpeg_data->width = frame_dim_.xsize;
     decoded_->jpeg_data->height = frame_dim_.ysize;
@@ -242,9 +253,18 @@ Status FrameDecoder::InitFrameOutput() {
           1 << frame_header_.chroma_subsampling.RawHShift(c);
       component.v_samp_factor =
           1 << frame_header_.chroma_subsampling.RawVShift(c);
-      component.coeffs.resize(component.width_in_blocks *
-                              component.height_in_blocks * jxl::kDCTBlockSize);
+      size_t num_rows = component.height_in_blocks;
+      if (jpeg_stream_writer_ != nullptr) {
+        num_rows = std::min<size_t>(
+            num_rows, (frame_dim_.group_dim / kBlockDim) >>
+                          frame_header_.chroma_subsampling.VShift(c));
+      }
+      component.first_block_row = 0;
+      component.coeffs.resize(component.width_in_blocks * num_rows *
+                              jxl::kDCTBlockSize);
     }
+  } else {
+    jpeg_stream_writer_ = nullptr;
   }
 
   // Clear the state.
@@ -252,6 +272,7 @@ Status FrameDecoder::InitFrameOutput() {
   decoded_ac_global_ = false;
   is_finalized_ = false;
   finalized_dc_ = false;
+  rendered_dc_output_ = false;
   num_sections_done_ = 0;
   decoded_dc_groups_.clear();
   decoded_dc_groups_.resize(frame_dim_.num_dc_groups);
@@ -260,17 +281,25 @@ Status FrameDecoder::InitFrameOutput() {
   processed_section_.clear();
   processed_section_.resize(toc_.size());
   allocated_ = false;
+  if (dec_state_->limits) {
+    modular_frame_decoder_.SetTreeNodeLimit(dec_state_->limits->tree_nodes);
+  }
   return true;
 }
 
 Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
+  JXL_TRACE_SCOPE("FrameDecoder::ProcessDCGlobal");
+  DecoderStatsTimer stats_timer(dec_state_->stats, JXL_DEC_STATS_DC_TIME_US);
   PassesSharedState& shared = dec_state_->shared_storage;
   JxlMemoryManager* memory_manager = shared.memory_manager;
+  const DecoderLimits limits =
+      dec_state_->limits ? *dec_state_->limits : DecoderLimits();
   if (frame_header_.flags & FrameHeader::kPatches) {
     bool uses_extra_channels = false;
     JXL_RETURN_IF_ERROR(shared.image_features.patches.Decode(
         memory_manager, br, frame_dim_.xsize_padded, frame_dim_.ysize_padded,
-        shared.metadata->m.num_extra_channels, &uses_extra_channels));
+        shared.metadata->m.num_extra_channels, &uses_extra_channels,
+        limits.patches));
     if (uses_extra_channels && frame_header_.upsampling != 1) {
       for (size_t ecups : frame_header_.extra_channel_upsampling) {
         if (ecups != frame_header_.upsampling) {
@@ -286,7 +315,8 @@ Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
   shared.image_features.splines.Clear();
   if (frame_header_.flags & FrameHeader::kSplines) {
     JXL_RETURN_IF_ERROR(shared.image_features.splines.Decode(
-        memory_manager, br, frame_dim_.xsize * frame_dim_.ysize));
+        memory_manager, br, frame_dim_.xsize * frame_dim_.ysize,
+        limits.spline_control_points));
   }
   if (frame_header_.flags & FrameHeader::kNoise) {
     JXL_RETURN_IF_ERROR(DecodeNoise(br, &shared.image_features.noise_params));
@@ -298,7 +328,7 @@ Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
         jxl::DecodeGlobalDCInfo(br, decoded_->IsJPEG(), dec_state_, pool_));
   }
   // Splines' draw cache uses the color correlation map.
-  if (frame_header_.flags & FrameHeader::kSplines) {
+  if ((frame_header_.flags & FrameHeader::kSplines) && decoding_speed_ == 0) {
     JXL_RETURN_IF_ERROR(shared.image_features.splines.InitializeDrawCache(
         frame_dim_.xsize_upsampled, frame_dim_.ysize_upsampled,
         dec_state_->shared->cmap.base()));
@@ -313,6 +343,8 @@ Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
 }
 
 Status FrameDecoder::ProcessDCGroup(size_t dc_group_id, BitReader* br) {
+  JXL_TRACE_SCOPE("FrameDecoder::ProcessDCGroup", dc_group_id);
+  DecoderStatsTimer stats_timer(dec_state_->stats, JXL_DEC_STATS_DC_TIME_US);
   const size_t gx = dc_group_id % frame_dim_.xsize_dc_groups;
   const size_t gy = dc_group_id / frame_dim_.xsize_dc_groups;
   const LoopFilter& lf = frame_header_.loop_filter;
@@ -357,14 +389,129 @@ Status FrameDecoder::FinalizeDC() {
 Status FrameDecoder::AllocateOutput() {
   if (allocated_) return true;
   modular_frame_decoder_.MaybeDropFullImage();
+  dec_state_->modular_int_output = CanUseModularIntOutput();
   decoded_->origin = frame_header_.frame_origin;
-  JXL_RETURN_IF_ERROR(
-      dec_state_->InitForAC(frame_header_.passes.num_passes, nullptr));
+  if (!dc_only_output_) {
+    JXL_RETURN_IF_ERROR(
+        dec_state_->InitForAC(frame_header_.passes.num_passes, nullptr));
+  }
   allocated_ = true;
   return true;
 }
 
+bool FrameDecoder::SupportsDCOnlyOutput() const {
+  constexpr uint64_t kFullResolutionFeatures =
+      FrameHeader::kPatches | FrameHeader::kSplines;
+  return frame_header_.encoding == FrameEncoding::kVarDCT &&
+         (frame_header_.frame_type == FrameType::kRegularFrame ||
+          frame_header_.frame_type == FrameType::kSkipProgressive) &&
+         !frame_header_.CanBeReferenced() && !NeedsBlending(frame_header_) &&
+         !frame_header_.custom_size_or_origin &&
+         frame_header_.upsampling == 1 &&
+         (frame_header_.flags & kFullResolutionFeatures) == 0 &&
+         frame_header_.nonserialized_metadata->m.num_extra_channels == 0 &&
+         !decoded_->IsJPEG();
+}
+
+Status FrameDecoder::RenderDCOutput() {
+  const FrameDimensions dc_dim =
+      dec_state_->DCOutputDimensions(frame_header_);
+  const YCbCrChromaSubsampling& cs = frame_header_.chroma_subsampling;
+  const Image3F& dc = *dec_state_->shared->dc;
+  RenderPipeline* render_pipeline = dec_state_->render_pipeline.get();
+  const auto prepare_storage = [&](const size_t num_threads) -> Status {
+    return render_pipeline->PrepareForThreads(num_threads,
+                                              /*use_group_ids=*/false);
+  };
+  const auto render_group = [&](const uint32_t g, size_t thread) -> Status {
+    RenderPipelineInput input = render_pipeline->GetInputBuffers(g, thread);
+    const Rect group_rect = dc_dim.GroupRect(g);
+    for (size_t c = 0; c < 3; c++) {
+      const auto& buffer = input.GetBuffer(c);
+      // The DC of subsampled channels is stored at their own resolution.
+      const Rect dc_rect(group_rect.x0() >> cs.HShift(c),
+                         group_rect.y0() >> cs.VShift(c),
+                         buffer.second.xsize(), buffer.second.ysize());
+      JXL_ENSURE(dc_rect.IsInside(dc.Plane(c)));
+      JXL_RETURN_IF_ERROR(
+          CopyImageTo(dc_rect, dc.Plane(c), buffer.second, buffer.first));
+    }
+    return input.Done();
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, dc_dim.num_groups, prepare_storage,
+                                render_group, "RenderDCOutput"));
+  rendered_dc_output_ = true;
+  return true;
+}
+
+bool FrameDecoder::CanUseModularIntOutput() const {
+  if (frame_header_.encoding != FrameEncoding::kModular ||
+      modular_frame_decoder_.UsesFullImage() || decoded_->IsJPEG()) {
+    return false;
+  }
+  // Only a plain interleaved buffer covering the whole image.
+  const ImageOutput& output = dec_state_->main_output;
+  if (output.buffer == nullptr || output.callback.IsPresent() ||
+      !output.channels.empty() || !dec_state_->extra_output.empty() ||
+      !dec_state_->ycbcr_planes.empty() || dec_state_->has_output_crop ||
+      dec_state_->unpremul_alpha || dec_state_->premul_alpha ||
+      render_hook_.IsPresent() || gain_map_ ||
+      dec_state_->undo_orientation != Orientation::kIdentity ||
+      dec_state_->width != frame_dim_.xsize ||
+      dec_state_->height != frame_dim_.ysize) {
+    return false;
+  }
+  // Nothing for the render pipeline to do but convert the samples.
+  constexpr uint64_t kRenderedFeatures =
+      FrameHeader::kNoise | FrameHeader::kPatches | FrameHeader::kSplines;
+  if (frame_header_.frame_type != FrameType::kRegularFrame ||
+      frame_header_.CanBeReferenced() || NeedsBlending(frame_header_) ||
+      frame_header_.custom_size_or_origin ||
+      frame_header_.color_transform != ColorTransform::kNone ||
+      !frame_header_.chroma_subsampling.Is444() ||
+      frame_header_.passes.num_passes != 1 || frame_header_.upsampling != 1 ||
+      (frame_header_.flags & kRenderedFeatures) != 0 ||
+      frame_header_.loop_filter.gab ||
+      frame_header_.loop_filter.epf_iters != 0) {
+    return false;
+  }
+  for (uint32_t ecups : frame_header_.extra_channel_upsampling) {
+    if (ecups != 1) return false;
+  }
+  const OutputEncodingInfo& output_encoding = dec_state_->output_encoding_info;
+  if (!output_encoding.color_encoding_is_original ||
+      GetToneMappingStage(output_encoding) != nullptr) {
+    return false;
+  }
+  // The samples must already have the requested range.
+  const ImageMetadata& metadata = frame_header_.nonserialized_metadata->m;
+  const BitDepth& bit_depth = metadata.bit_depth;
+  const size_t max_bits =
+      output.format.data_type == JXL_TYPE_UINT8    ? 8
+      : output.format.data_type == JXL_TYPE_UINT16 ? 16
+                                                   : 0;
+  if (bit_depth.floating_point_sample ||
+      bit_depth.bits_per_sample > max_bits ||
+      bit_depth.bits_per_sample != output.bits_per_sample) {
+    return false;
+  }
+  const size_t num_color = metadata.color_encoding.IsGray() ? 1 : 3;
+  if (output.format.num_channels < num_color) return false;
+  if (metadata.num_extra_channels > 1) return false;
+  if (metadata.num_extra_channels == 1) {
+    const ExtraChannelInfo& eci = metadata.extra_channel_info[0];
+    if (eci.type != ExtraChannel::kAlpha ||
+        eci.bit_depth.floating_point_sample ||
+        eci.bit_depth.bits_per_sample != bit_depth.bits_per_sample) {
+      return false;
+    }
+  }
+  return true;
+}
+
 Status FrameDecoder::ProcessACGlobal(BitReader* br) {
+  JXL_TRACE_SCOPE("FrameDecoder::ProcessACGlobal");
+  DecoderStatsTimer stats_timer(dec_state_->stats, JXL_DEC_STATS_AC_TIME_US);
   JXL_ENSURE(finalized_dc_);
   JxlMemoryManager* memory_manager = dec_state_->memory_manager();
 
@@ -400,9 +547,9 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
       size_t num_contexts =
           dec_state_->shared->num_histograms *
           dec_state_->shared_storage.block_ctx_map.NumACContexts();
-      JXL_RETURN_IF_ERROR(DecodeHistograms(memory_manager, br, num_contexts,
-                                           &dec_state_->code[i],
-                                           &dec_state_->context_map[i]));
+      JXL_RETURN_IF_ERROR(DecodeHistograms(
+          memory_manager, br, num_contexts, &dec_state_->code[i],
+          &dec_state_->context_map[i], /*disallow_lz77=*/false, pool_));
       // Add extra values to enable the cheat in hot loop of DecodeACVarBlock.
       dec_state_->context_map[i].resize(
           num_contexts + kZeroDensityContextLimit - kZeroDensityContextCount);
@@ -478,7 +625,10 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
 Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
                                     BitReader* JXL_RESTRICT* br,
                                     size_t num_passes, size_t thread,
-                                    bool force_draw, bool dc_only) {
+                                    bool force_draw, bool dc_only,
+                                    ThreadPool* pool) {
+  JXL_TRACE_SCOPE("FrameDecoder::ProcessACGroup", ac_group_id);
+  DecoderStatsTimer stats_timer(dec_state_->stats, JXL_DEC_STATS_AC_TIME_US);
   size_t group_dim = frame_dim_.group_dim;
   const size_t gx = ac_group_id % frame_dim_.xsize_groups;
   const size_t gy = ac_group_id / frame_dim_.xsize_groups;
@@ -497,11 +647,11 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
   bool should_run_pipeline = true;
 
   if (frame_header_.encoding == FrameEncoding::kVarDCT) {
-    JXL_RETURN_IF_ERROR(group_dec_caches_[thread].InitOnce(
+    JXL_RETURN_IF_ERROR(dec_state_->group_dec_caches[thread].InitOnce(
         memory_manager, frame_header_.passes.num_passes, dec_state_->used_acs));
     JXL_RETURN_IF_ERROR(DecodeGroup(
         frame_header_, br, num_passes, ac_group_id, dec_state_,
-        &group_dec_caches_[thread], thread, render_pipeline_input,
+        &dec_state_->group_dec_caches[thread], thread, render_pipeline_input,
         decoded_->jpeg_data.get(), decoded_passes_per_ac_group_[ac_group_id],
         force_draw, dc_only, &should_run_pipeline));
   }
@@ -527,7 +677,7 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
           frame_header_, mrect, br[i - pass0], minShift, maxShift,
           ModularStreamId::ModularAC(ac_group_id, i),
           /*zerofill=*/false, dec_state_, &render_pipeline_input,
-          /*allow_truncated=*/false, &modular_pass_ready));
+          /*allow_truncated=*/false, &modular_pass_ready, pool));
     } else {
       JXL_RETURN_IF_ERROR(modular_frame_decoder_.DecodeGroup(
           frame_header_, mrect, nullptr, minShift, maxShift,
@@ -544,7 +694,8 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
                       thread);
   }
 
-  if (!modular_frame_decoder_.UsesFullImage() && !decoded_->IsJPEG()) {
+  if (!modular_frame_decoder_.UsesFullImage() && !decoded_->IsJPEG() &&
+      !dec_state_->modular_int_output) {
     if (should_run_pipeline && modular_ready) {
       JXL_RETURN_IF_ERROR(render_pipeline_input.Done());
     } else if (force_draw) {
@@ -561,14 +712,29 @@ void FrameDecoder::MarkSections(const SectionInfo* sections, size_t num,
     if (section_status[i] != SectionStatus::kDone) {
       processed_section_[sections[i].id] = JXL_FALSE;
       num_sections_done_--;
+    } else if (dec_state_->stats) {
+      dec_state_->stats->Add(SectionStatsKey(sections[i].id),
+                             sections[i].br->TotalBytes());
     }
   }
 }
 
+JxlDecoderStatsKey FrameDecoder::SectionStatsKey(size_t id) const {
+  const size_t ac_global_index = frame_dim_.num_dc_groups + 1;
+  if (id == 0) return JXL_DEC_STATS_DC_GLOBAL_BYTES;
+  if (id < ac_global_index) return JXL_DEC_STATS_DC_GROUP_BYTES;
+  if (id == ac_global_index) return JXL_DEC_STATS_AC_GLOBAL_BYTES;
+  return JXL_DEC_STATS_AC_GROUP_BYTES;
+}
+
 Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
                                      SectionStatus* section_status) {
   if (num == 0) return true;  // Nothing to process
+  DecoderStatsTimer wall_timer(dec_state_->stats,
+                               JXL_DEC_STATS_FRAME_WALL_TIME_US);
   std::fill(section_status, section_status + num, SectionStatus::kSkipped);
+  cancelled_ = false;
+  if (rendered_dc_output_) return true;
   size_t dc_global_sec = num;
   size_t ac_global_sec = num;
   std::vector<size_t> dc_group_sec(frame_dim_.num_dc_groups, num);
@@ -643,7 +809,7 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
     const auto process_section = [this, &dc_group_sec, &num, &sections,
                                   &section_status](size_t i,
                                                    size_t thread) -> Status {
-      if (dc_group_sec[i] != num) {
+      if (dc_group_sec[i] != num && !CheckCancelled()) {
         JXL_RETURN_IF_ERROR(ProcessDCGroup(i, sections[dc_group_sec[i]].br));
         section_status[dc_group_sec[i]] = SectionStatus::kDone;
       }
@@ -659,12 +825,53 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
     pipeline_options.use_slow_render_pipeline = use_slow_rendering_pipeline_;
     pipeline_options.coalescing = coalescing_;
     pipeline_options.render_spotcolors = render_spotcolors_;
-    pipeline_options.render_noise = true;
+    pipeline_options.render_noise = decoding_speed_ == 0;
+    pipeline_options.render_splines = decoding_speed_ == 0;
+    pipeline_options.skip_loop_filters = decoding_speed_ >= 1;
+    pipeline_options.nearest_upsampling = decoding_speed_ >= 2;
+    pipeline_options.render_hook = &render_hook_;
+    if (frame_header_.frame_type == FrameType::kRegularFrame ||
+        frame_header_.frame_type == FrameType::kSkipProgressive) {
+      pipeline_options.gain_map = gain_map_;
+    }
+    // Skipping groups is only possible if this frame is displayed as is and
+    // its groups are rendered independently.
+    pipeline_options.skip_cropped_groups =
+        (frame_header_.frame_type == FrameType::kRegularFrame ||
+         frame_header_.frame_type == FrameType::kSkipProgressive) &&
+        !frame_header_.CanBeReferenced() &&
+        !frame_header_.custom_size_or_origin &&
+        !modular_frame_decoder_.UsesFullImage() && !decoded_->IsJPEG();
+    // Frames that are referenced later keep full precision, so that errors
+    // do not accumulate across frames.
+    pipeline_options.half_precision_borders =
+        reduced_precision_buffers_ && !frame_header_.CanBeReferenced();
+    if (dc_only_output_) {
+      JXL_ENSURE(SupportsDCOnlyOutput());
+      pipeline_options.dc_only_output = true;
+    }
+    // The chroma only matters for the luma of the gray output, unless the
+    // frame is kept for later frames.
+    dec_state_->luma_only =
+        luma_only_ && frame_header_.encoding == FrameEncoding::kVarDCT &&
+        frame_header_.color_transform == ColorTransform::kXYB &&
+        (frame_header_.frame_type == FrameType::kRegularFrame ||
+         frame_header_.frame_type == FrameType::kSkipProgressive) &&
+        !frame_header_.CanBeReferenced() && !decoded_->IsJPEG() &&
+        dec_state_->output_encoding_info.color_encoding.IsGray();
+    pipeline_options.luma_only = dec_state_->luma_only;
     JXL_RETURN_IF_ERROR(dec_state_->PreparePipeline(
         frame_header_, &frame_header_.nonserialized_metadata->m, decoded_,
         pipeline_options));
     JXL_RETURN_IF_ERROR(FinalizeDC());
     JXL_RETURN_IF_ERROR(AllocateOutput());
+    if (dc_only_output_) {
+      JXL_RETURN_IF_ERROR(RenderDCOutput());
+      // The remaining sections are not needed, HasDecodedAll() now returns
+      // true.
+      MarkSections(sections, num, section_status);
+      return true;
+    }
     if (progressive_detail_ >= JxlProgressiveDetail::kDC) {
       MarkSections(sections, num, section_status);
       return true;
@@ -686,9 +893,21 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
     }
   }
 
-  if (decoded_ac_global_) {
+  // When streaming a JPEG, the groups are decoded one row at a time, as long
+  // as the writer has no output pending.
+  size_t group_begin = 0;
+  size_t group_end = ac_group_sec.size();
+  while (decoded_ac_global_) {
+    if (jpeg_stream_writer_ != nullptr) {
+      if (jpeg_stream_group_row_ >= frame_dim_.ysize_groups ||
+          jpeg_stream_writer_->HasPendingOutput()) {
+        break;
+      }
+      group_begin = jpeg_stream_group_row_ * frame_dim_.xsize_groups;
+      group_end = group_begin + frame_dim_.xsize_groups;
+    }
     // Mark all the AC groups that we received as not complete yet.
-    for (size_t i = 0; i < ac_group_sec.size(); i++) {
+    for (size_t i = group_begin; i < group_end; i++) {
       if (desired_num_ac_passes[i] != 0) {
         dec_state_->render_pipeline->ClearDone(i);
       }
@@ -699,15 +918,28 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
           PrepareStorage(num_threads, decoded_passes_per_ac_group_.size()));
       return true;
     };
+    // Set when the only group is processed outside of the pool.
+    ThreadPool* group_pool = nullptr;
     const auto process_group = [this, &ac_group_sec, &desired_num_ac_passes,
-                                &num, &sections, &section_status](
+                                &num, &sections, &section_status, &group_pool](
                                    size_t g, size_t thread) -> Status {
       if (desired_num_ac_passes[g] == 0) {
         // no new AC pass, nothing to do
         return true;
       }
+      // The sections stay skipped, to be decoded by the next call.
+      if (CheckCancelled()) return true;
       (void)num;
       size_t first_pass = decoded_passes_per_ac_group_[g];
+      if (!dec_state_->render_pipeline->GroupNeeded(g)) {
+        // Outside of the output crop: consume the sections without decoding.
+        for (size_t i = 0; i < desired_num_ac_passes[g]; i++) {
+          section_status[ac_group_sec[g][first_pass + i]] =
+              SectionStatus::kDone;
+        }
+        decoded_passes_per_ac_group_[g] += desired_num_ac_passes[g];
+        return true;
+      }
       BitReader* JXL_RESTRICT readers[kMaxNumPasses];
       for (size_t i = 0; i < desired_num_ac_passes[g]; i++) {
         JXL_ENSURE(ac_group_sec[g][first_pass + i] != num);
@@ -715,21 +947,96 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
       }
       JXL_RETURN_IF_ERROR(ProcessACGroup(
           g, readers, desired_num_ac_passes[g], GetStorageLocation(thread, g),
-          /*force_draw=*/false, /*dc_only=*/false));
+          /*force_draw=*/false, /*dc_only=*/false, group_pool));
       for (size_t i = 0; i < desired_num_ac_passes[g]; i++) {
         section_status[ac_group_sec[g][first_pass + i]] = SectionStatus::kDone;
       }
       return true;
     };
-    JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, ac_group_sec.size(),
-                                  prepare_storage, process_group,
-                                  "DecodeGroup"));
+    // Groups contributing to the priority rect are started first, so that
+    // they are rendered before the others.
+    std::vector<size_t> group_order(group_end - group_begin);
+    std::iota(group_order.begin(), group_order.end(), group_begin);
+    if (priority_rect_.xsize() != 0 && priority_rect_.ysize() != 0) {
+      std::stable_partition(
+          group_order.begin(), group_order.end(), [this](size_t g) {
+            return dec_state_->render_pipeline->GroupContributesTo(
+                g, priority_rect_);
+          });
+    }
+    // The entropy-coded stream of a modular group can only be decoded
+    // sequentially, so when a single group is decoded (small images with
+    // large groups, or input arriving one group at a time), it runs on this
+    // thread and the pool is used for the work within the group instead.
+    size_t num_groups_to_decode = 0;
+    for (size_t i = group_begin; i < group_end; i++) {
+      if (desired_num_ac_passes[i] == 0 ||
+          !dec_state_->render_pipeline->GroupNeeded(i)) {
+        continue;
+      }
+      num_groups_to_decode++;
+    }
+    if (pool_ != nullptr && num_groups_to_decode == 1 &&
+        frame_header_.encoding == FrameEncoding::kModular) {
+      JXL_RETURN_IF_ERROR(prepare_storage(1));
+      group_pool = pool_;
+      for (size_t g : group_order) {
+        JXL_RETURN_IF_ERROR(process_group(g, 0));
+      }
+    } else {
+      const auto process_ordered_group = [&](size_t i,
+                                             size_t thread) -> Status {
+        return process_group(group_order[i], thread);
+      };
+      JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, group_order.size(),
+                                    prepare_storage, process_ordered_group,
+                                    "DecodeGroup"));
+    }
+    if (jpeg_stream_writer_ == nullptr) break;
+    for (size_t i = group_begin; i < group_end; i++) {
+      if (decoded_passes_per_ac_group_[i] < frame_header_.passes.num_passes) {
+        MarkSections(sections, num, section_status);
+        return true;
+      }
+    }
+    JXL_RETURN_IF_ERROR(WriteJpegStreamRow());
   }
 
   MarkSections(sections, num, section_status);
   return true;
 }
 
+bool FrameDecoder::SectionNeeded(size_t id) const {
+  size_t ac_global_index = frame_dim_.num_dc_groups + 1;
+  if (toc_.size() == 1 || id <= ac_global_index || !finalized_dc_ ||
+      !dec_state_->render_pipeline) {
+    return true;
+  }
+  if (dc_only_output_) return false;
+  size_t group = (id - ac_global_index - 1) % frame_dim_.num_groups;
+  return dec_state_->render_pipeline->GroupNeeded(group);
+}
+
+Status FrameDecoder::WriteJpegStreamRow() {
+  jpeg::JPEGData* jpeg_data = decoded_->jpeg_data.get();
+  const size_t group_dim_in_blocks = frame_dim_.group_dim / kBlockDim;
+  size_t max_v_samp_factor = 1;
+  for (const auto& component : jpeg_data->components) {
+    max_v_samp_factor =
+        std::max<size_t>(max_v_samp_factor, component.v_samp_factor);
+  }
+  ++jpeg_stream_group_row_;
+  JXL_RETURN_IF_ERROR(jpeg_stream_writer_->WriteMcuRows(
+      *jpeg_data,
+      jpeg_stream_group_row_ * group_dim_in_blocks / max_v_samp_factor));
+  for (auto& component : jpeg_data->components) {
+    component.first_block_row = static_cast<uint32_t>(
+        jpeg_stream_group_row_ * group_dim_in_blocks *
+        component.v_samp_factor / max_v_samp_factor);
+  }
+  return true;
+}
+
 Status FrameDecoder::Flush() {
   bool has_blending = frame_header_.blending_info.mode != BlendMode::kReplace ||
                       frame_header_.custom_size_or_origin;
@@ -751,6 +1058,10 @@ Status FrameDecoder::Flush() {
     // Nothing to do.
     return true;
   }
+  if (dc_only_output_) {
+    // The output is complete once the DC is rendered.
+    return rendered_dc_output_;
+  }
   JXL_RETURN_IF_ERROR(AllocateOutput());
 
   uint32_t completely_decoded_ac_pass = *std::min_element(
@@ -774,6 +1085,10 @@ Status FrameDecoder::Flush() {
         // This group was drawn already, nothing to do.
         return true;
       }
+      if (!dec_state_->render_pipeline->GroupNeeded(g)) {
+        // Outside of the output crop, nothing to draw.
+        return true;
+      }
       BitReader* JXL_RESTRICT readers[kMaxNumPasses] = {};
       JXL_RETURN_IF_ERROR(ProcessACGroup(
           g, readers, /*num_passes=*/0, GetStorageLocation(thread, g),
@@ -854,12 +1169,20 @@ int FrameDecoder::References() const {
 }
 
 Status FrameDecoder::FinalizeFrame() {
+  JXL_TRACE_SCOPE("FrameDecoder::FinalizeFrame");
   if (is_finalized_) {
     return JXL_FAILURE("FinalizeFrame called multiple times");
   }
   is_finalized_ = true;
+  DecoderStats* stats = dec_state_->stats;
+  DecoderStatsTimer wall_timer(stats, JXL_DEC_STATS_FRAME_WALL_TIME_US);
+  DecoderStatsTimer stats_timer(stats, JXL_DEC_STATS_AC_TIME_US);
+  if (stats) stats->Add(JXL_DEC_STATS_NUM_FRAMES, 1);
   if (decoded_->IsJPEG()) {
-    // Nothing to do.
+    if (jpeg_stream_writer_ != nullptr &&
+        jpeg_stream_group_row_ != frame_dim_.ysize_groups) {
+      return JXL_FAILURE("JPEG stream incomplete");
+    }
     return true;
   }
 
@@ -873,6 +1196,22 @@ Status FrameDecoder::FinalizeFrame() {
                      .reference_frames[frame_header_.save_as_reference];
     *info.frame = std::move(dec_state_->frame_storage_for_referencing);
     info.ib_is_in_xyb = frame_header_.save_before_color_transform;
+    info.half_planes.clear();
+    // Frames saved after the color transform are only read by blending, and
+    // 16-bit floats keep integer samples of up to 8 bits exact after rounding.
+    const ImageMetadata& metadata = frame_header_.nonserialized_metadata->m;
+    bool store_as_half = reduced_precision_buffers_ && !info.ib_is_in_xyb &&
+                         !metadata.bit_depth.floating_point_sample &&
+                         metadata.bit_depth.bits_per_sample <= 8;
+    for (const ExtraChannelInfo& eci : metadata.extra_channel_info) {
+      store_as_half = store_as_half && !eci.bit_depth.floating_point_sample &&
+                      eci.bit_depth.bits_per_sample <= 8;
+    }
+    if (store_as_half) JXL_RETURN_IF_ERROR(info.StoreAsHalf());
+  }
+  if (dec_state_->resampled_output) {
+    JXL_RETURN_IF_ERROR(dec_state_->resampled_output->ToImageBundle(
+        dec_state_->output_encoding_info.color_encoding, decoded_));
   }
   return true;
 }
@@ -7,9 +7,11 @@
 #define LIB_JXL_DEC_FRAME_H_
 
 #include <jxl/decode.h>
+#include <jxl/stats.h>
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <limits>
@@ -19,6 +21,7 @@
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"  // JXL_HIGH_PRECISION
 #include "lib/jxl/dec_bit_reader.h"
@@ -27,6 +30,7 @@
 #include "lib/jxl/frame_header.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_metadata.h"
+#include "lib/jxl/jpeg/dec_jpeg_data_writer.h"
 
 namespace jxl {
 
@@ -52,8 +56,54 @@ class FrameDecoder {
         modular_frame_decoder_(dec_state_->memory_manager()),
         use_slow_rendering_pipeline_(use_slow_rendering_pipeline) {}
 
+  // Replaces the pool passed to the constructor. Must be called before any
+  // section is processed.
+  void SetThreadPool(ThreadPool* pool) { pool_ = pool; }
   void SetRenderSpotcolors(bool rsc) { render_spotcolors_ = rsc; }
   void SetCoalescing(bool c) { coalescing_ = c; }
+  void SetReducedPrecisionBuffers(bool rp) { reduced_precision_buffers_ = rp; }
+  // The extra channels from `ec` on are not needed by the outputs nor by the
+  // rendering of the frame, and read as zero where they can be skipped. Must be
+  // called before the DC global section is processed.
+  void SetFirstSkippedExtraChannel(size_t ec) {
+    modular_frame_decoder_.SetFirstSkippedExtraChannel(ec);
+  }
+  // Trades rendering fidelity for speed, see JxlDecoderSetDecodingSpeed. Must
+  // be called before the DC global section is processed.
+  void SetDecodingSpeed(uint32_t speed) { decoding_speed_ = speed; }
+  // Skips the chroma of VarDCT frames in XYB when the output is grayscale, see
+  // JxlDecoderSetLumaOnly. Must be called before the DC global section is
+  // processed.
+  void SetLumaOnly(bool luma_only) { luma_only_ = luma_only; }
+  // Checked between the groups of the frame, see JxlDecoderSetCancelCallback.
+  void SetCancelCallback(JxlDecoderCancelCallback callback, void* opaque) {
+    cancel_callback_ = callback;
+    cancel_opaque_ = opaque;
+  }
+  // Returns whether the last ProcessSections call left groups undecoded
+  // because of the cancel callback.
+  bool Cancelled() const { return cancelled_; }
+  // Calls `hook` on the rows of the frame before the color transform, see
+  // JxlDecoderSetRenderHook. Must be called before SetImageOutput.
+  void SetRenderHook(const RenderHook& hook) { render_hook_ = hook; }
+  // Applies `gain_map` to the displayed frames, see JxlDecoderSetGainMap. Must
+  // be called before SetImageOutput.
+  void SetGainMap(const GainMap* gain_map) { gain_map_ = gain_map; }
+  // Decodes the AC groups that contribute to `rect`, in upsampled frame
+  // coordinates, before the other groups available at the same time, see
+  // JxlDecoderSetPriorityRegion. An empty rect disables the prioritization.
+  void SetPriorityRect(const Rect& rect) { priority_rect_ = rect; }
+
+  // If enabled, the frame is rendered at 1/8 resolution from its DC image as
+  // soon as the DC groups are decoded, and its AC sections are not decoded;
+  // the output set with SetImageOutput must have that size. Only allowed if
+  // SupportsDCOnlyOutput returns true.
+  void SetDCOnlyOutput(bool dc_only) { dc_only_output_ = dc_only; }
+  // Returns whether the frame can be rendered from its DC image alone, i.e.
+  // it is a VarDCT frame that is displayed as is and needs no features that
+  // are drawn at full resolution (patches, splines, extra channels).
+  // Must be called after InitFrame.
+  bool SupportsDCOnlyOutput() const;
 
   // Read FrameHeader and table of contents from the given BitReader.
   Status InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
@@ -125,7 +175,14 @@ class FrameDecoder {
   // Returns whether a DC image has been decoded, accessible at low resolution
   // at passes.shared_storage.dc_storage
   bool HasDecodedDC() const { return finalized_dc_; }
-  bool HasDecodedAll() const { return toc_.size() == num_sections_done_; }
+  bool HasDecodedAll() const {
+    return toc_.size() == num_sections_done_ || rendered_dc_output_;
+  }
+
+  // Returns whether the contents of section `id` are read when it is
+  // processed: once the DC is decoded, the AC groups that are outside of the
+  // output crop are not.
+  bool SectionNeeded(size_t id) const;
 
   size_t NumCompletePasses() const {
     return *std::min_element(decoded_passes_per_ac_group_.begin(),
@@ -192,7 +249,8 @@ class FrameDecoder {
   void SetImageOutput(const PixelCallback& pixel_callback, void* image_buffer,
                       size_t image_buffer_size, size_t xsize, size_t ysize,
                       JxlPixelFormat format, size_t bits_per_sample,
-                      bool unpremul_alpha, bool undo_orientation) const {
+                      bool unpremul_alpha, bool premul_alpha,
+                      bool undo_orientation) const {
     dec_state_->width = xsize;
     dec_state_->height = ysize;
     dec_state_->main_output.format = format;
@@ -201,11 +259,15 @@ class FrameDecoder {
     dec_state_->main_output.buffer = image_buffer;
     dec_state_->main_output.buffer_size = image_buffer_size;
     dec_state_->main_output.stride = GetStride(xsize, format);
+    dec_state_->main_output.channels.clear();
     const jxl::ExtraChannelInfo* alpha =
         decoded_->metadata()->Find(jxl::ExtraChannel::kAlpha);
     if (alpha && alpha->alpha_associated && unpremul_alpha) {
       dec_state_->unpremul_alpha = true;
     }
+    if (alpha && !alpha->alpha_associated && premul_alpha) {
+      dec_state_->premul_alpha = true;
+    }
     if (undo_orientation) {
       dec_state_->undo_orientation = decoded_->metadata()->GetOrientation();
       if (static_cast<int>(dec_state_->undo_orientation) > 4) {
@@ -216,19 +278,85 @@ class FrameDecoder {
 #if !JXL_HIGH_PRECISION
     if (dec_state_->main_output.buffer &&
         (format.data_type == JXL_TYPE_UINT8) && (format.num_channels >= 3) &&
-        !dec_state_->unpremul_alpha &&
+        !dec_state_->unpremul_alpha && !dec_state_->premul_alpha &&
         (dec_state_->undo_orientation == Orientation::kIdentity) &&
         decoded_->metadata()->xyb_encoded &&
         dec_state_->output_encoding_info.color_encoding.IsSRGB() &&
         dec_state_->output_encoding_info.all_default_opsin &&
         (dec_state_->output_encoding_info.desired_intensity_target ==
          dec_state_->output_encoding_info.orig_intensity_target) &&
-        HasFastXYBTosRGB8() && frame_header_.needs_color_transform()) {
+        !render_hook_.IsPresent() && !gain_map_ && HasFastXYBTosRGB8() &&
+        frame_header_.needs_color_transform()) {
       dec_state_->fast_xyb_srgb8_conversion = true;
     }
 #endif
   }
 
+  // Writes the output set with SetImageOutput to the given per-channel
+  // buffers instead of the interleaved image buffer.
+  void SetImageOutputChannels(
+      const std::vector<JxlChannelBuffer>& channels) const {
+    dec_state_->main_output.channels = channels;
+    dec_state_->fast_xyb_srgb8_conversion = false;
+  }
+
+  // Writes the output set with SetImageOutput to the given callback, one
+  // rendered rectangle at a time.
+  void SetImageOutputTiles(const TileCallback& tile_callback) const {
+    dec_state_->main_output.tile_callback = tile_callback;
+  }
+
+  // Writes the Y, Cb and Cr channels of the frame, which must use the YCbCr
+  // color transform, to the given planes at their native resolution instead
+  // of producing an RGB image.
+  void SetYCbCrPlanesOutput(JxlDataType data_type,
+                            const std::vector<JxlChannelBuffer>& planes) const {
+    dec_state_->ycbcr_planes = planes;
+    dec_state_->ycbcr_data_type = data_type;
+  }
+
+  // Resamples the frame to the given size, in coordinates before applying
+  // the orientation, instead of writing it to an image output. The result is
+  // stored in the decoded ImageBundle by FinalizeFrame. Only allowed if
+  // SupportsResampledOutput returns true. Later calls for the same frame have
+  // no effect.
+  void SetResampledOutput(size_t xsize, size_t ysize,
+                          JxlResampleFilter filter) const {
+    if (dec_state_->resampled_output) return;
+    dec_state_->resampled_output = jxl::make_unique<ResampledImage>(
+        dec_state_->memory_manager(), xsize, ysize, filter);
+  }
+  // Returns whether each row of the frame is rendered only once, as required
+  // by SetResampledOutput; modular frames with several passes render their
+  // groups again as the passes are decoded. Must be called after InitFrame.
+  bool SupportsResampledOutput() const {
+    return frame_header_.encoding == FrameEncoding::kVarDCT ||
+           frame_header_.passes.num_passes == 1;
+  }
+
+  // Decodes the AC groups of a JPEG reconstruction frame one row of groups at
+  // a time into a window of coefficients, which `writer` serializes as each
+  // row is complete, instead of keeping the coefficients of the whole image.
+  // Must be called before InitFrameOutput, which disables it if the frame or
+  // the JPEG does not allow it (see StreamsJpeg).
+  void SetJpegStreamWriter(jpeg::JpegStreamWriter* writer) {
+    jpeg_stream_writer_ = writer;
+  }
+  bool StreamsJpeg() const { return jpeg_stream_writer_ != nullptr; }
+
+  // Restricts the output set with SetImageOutput to the given region of the
+  // image, in coordinates before applying the orientation. The size of the
+  // region must match the (unoriented) xsize and ysize given there. AC groups
+  // that do not contribute to the region may be skipped if the frame is not
+  // needed by later frames.
+  void SetOutputCrop(const Rect& crop) const {
+    JXL_DASSERT(crop.xsize() == dec_state_->width &&
+                crop.ysize() == dec_state_->height);
+    dec_state_->has_output_crop = true;
+    dec_state_->output_crop = crop;
+    dec_state_->fast_xyb_srgb8_conversion = false;
+  }
+
   void AddExtraChannelOutput(void* buffer, size_t buffer_size, size_t xsize,
                              JxlPixelFormat format, size_t bits_per_sample) {
     ImageOutput out;
@@ -245,12 +373,24 @@ class FrameDecoder {
   Status ProcessDCGroup(size_t dc_group_id, BitReader* br);
   Status FinalizeDC();
   Status AllocateOutput();
+  // Renders the whole DC image to the outputs, see SetDCOnlyOutput.
+  Status RenderDCOutput();
+  // Whether the frame only needs its integer samples copied to the output
+  // buffer, so that the modular groups can bypass the render pipeline.
+  bool CanUseModularIntOutput() const;
   Status ProcessACGlobal(BitReader* br);
+  // `pool`, if not null, is used within the group; this must not be called
+  // from a task running on that pool.
   Status ProcessACGroup(size_t ac_group_id, BitReader* JXL_RESTRICT* br,
                         size_t num_passes, size_t thread, bool force_draw,
-                        bool dc_only);
+                        bool dc_only, ThreadPool* pool = nullptr);
   void MarkSections(const SectionInfo* sections, size_t num,
                     const SectionStatus* section_status);
+  // The statistics accounting the bytes of the section with the given id.
+  JxlDecoderStatsKey SectionStatsKey(size_t id) const;
+  // Serializes the MCU rows of the current row of groups and moves the
+  // coefficient window to the next row.
+  Status WriteJpegStreamRow();
 
   // Allocates storage for parallel decoding using up to `num_threads` threads
   // of up to `num_tasks` tasks. The value of `thread` passed to
@@ -259,8 +399,8 @@ class FrameDecoder {
   // than the value of `num_tasks` passed here.
   Status PrepareStorage(size_t num_threads, size_t num_tasks) {
     size_t storage_size = std::min(num_threads, num_tasks);
-    if (storage_size > group_dec_caches_.size()) {
-      group_dec_caches_.resize(storage_size);
+    if (storage_size > dec_state_->group_dec_caches.size()) {
+      dec_state_->group_dec_caches.resize(storage_size);
     }
     use_task_id_ = num_threads > num_tasks;
     bool use_noise = (frame_header_.flags & FrameHeader::kNoise) != 0;
@@ -299,6 +439,16 @@ class FrameDecoder {
                        [](uint8_t ready) { return ready == 0; });
   }
 
+  // Returns true once the cancel callback returned true during the current
+  // ProcessSections call.
+  bool CheckCancelled() {
+    if (!cancelled_ && cancel_callback_ != nullptr &&
+        cancel_callback_(cancel_opaque_)) {
+      cancelled_ = true;
+    }
+    return cancelled_;
+  }
+
   PassesDecoderState* dec_state_;
   ThreadPool* pool_;
   std::vector<TocEntry> toc_;
@@ -310,6 +460,17 @@ class FrameDecoder {
   ModularFrameDecoder modular_frame_decoder_;
   bool render_spotcolors_ = true;
   bool coalescing_ = true;
+  bool reduced_precision_buffers_ = false;
+  uint32_t decoding_speed_ = 0;
+  bool luma_only_ = false;
+  JxlDecoderCancelCallback cancel_callback_ = nullptr;
+  void* cancel_opaque_ = nullptr;
+  std::atomic<bool> cancelled_{false};
+  RenderHook render_hook_;
+  const GainMap* gain_map_ = nullptr;
+  Rect priority_rect_;
+  bool dc_only_output_ = false;
+  bool rendered_dc_output_ = false;
 
   std::vector<uint8_t> processed_section_;
   std::vector<uint8_t> decoded_passes_per_ac_group_;
@@ -322,8 +483,6 @@ class FrameDecoder {
   bool is_finalized_ = true;
   bool allocated_ = false;
 
-  std::vector<GroupDecCache> group_dec_caches_;
-
   // Whether or not the task id should be used for storage indexing, instead of
   // the thread id.
   bool use_task_id_ = false;
@@ -331,6 +490,10 @@ class FrameDecoder {
   // Testing setting: whether or not to use the slow rendering pipeline.
   bool use_slow_rendering_pipeline_;
 
+  jpeg::JpegStreamWriter* jpeg_stream_writer_ = nullptr;
+  // Row of groups held in the coefficient window when streaming a JPEG.
+  size_t jpeg_stream_group_row_ = 0;
+
   JxlProgressiveDetail progressive_detail_ = kFrames;
   // Number of completed passes where section decoding should pause.
   // Used for progressive details at least kLastPasses.
@@ -35,6 +35,7 @@
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/quantizer-inl.h"
 #include "lib/jxl/quantizer.h"
+#include "lib/jxl/trace_internal.h"
 
 #ifndef LIB_JXL_DEC_GROUP_CC
 #define LIB_JXL_DEC_GROUP_CC
@@ -69,12 +70,15 @@ namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::AllFalse;
+using hwy::HWY_NAMESPACE::AllTrue;
+using hwy::HWY_NAMESPACE::Eq;
 using hwy::HWY_NAMESPACE::Gt;
 using hwy::HWY_NAMESPACE::Le;
 using hwy::HWY_NAMESPACE::MaskFromVec;
 using hwy::HWY_NAMESPACE::Or;
 using hwy::HWY_NAMESPACE::Rebind;
 using hwy::HWY_NAMESPACE::ShiftRight;
+using hwy::HWY_NAMESPACE::Zero;
 
 using D = HWY_FULL(float);
 using DU = HWY_FULL(uint32_t);
@@ -165,6 +169,159 @@ void DequantBlock(const AcStrategy& acs, float inv_global_scale, int quant,
   }
 }
 
+// Same as DequantBlock, for the Y channel only.
+template <ACType ac_type>
+void DequantBlockY(const AcStrategy& acs, float inv_global_scale, int quant,
+                   AcStrategyType kind, size_t size,
+                   const Quantizer& quantizer, size_t covered_blocks,
+                   const size_t* sbx,
+                   const float* JXL_RESTRICT* JXL_RESTRICT dc_row,
+                   size_t dc_stride, const float* JXL_RESTRICT biases,
+                   ACPtr qblock[3], float* JXL_RESTRICT block,
+                   float* JXL_RESTRICT scratch) {
+  const auto scaled_dequant_y = Set(d, inv_global_scale / quant);
+
+  const float* dequant_matrices = quantizer.DequantMatrix(kind, 0);
+
+  for (size_t k = 0; k < covered_blocks * kDCTBlockSize; k += Lanes(d)) {
+    const auto y_mul =
+        Mul(Load(d, dequant_matrices + size + k), scaled_dequant_y);
+    Vec<DI> quantized_y_int;
+    if (ac_type == ACType::k16) {
+      Rebind<int16_t, DI> di16;
+      quantized_y_int = PromoteTo(di, Load(di16, qblock[1].ptr16 + k));
+    } else {
+      quantized_y_int = Load(di, qblock[1].ptr32 + k);
+    }
+    Store(Mul(AdjustQuantBias(di, 1, quantized_y_int, biases), y_mul), d,
+          block + size + k);
+  }
+  LowestFrequenciesFromDC(acs.Strategy(), dc_row[1] + sbx[1], dc_stride,
+                          block + size, scratch);
+}
+
+// Returns whether the `size` quantized coefficients of the three channels are
+// all zero.
+template <ACType ac_type>
+bool IsZeroBlock(ACPtr qblock[3], size_t size) {
+  auto nonzero = Zero(di);
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t k = 0; k < size; k += Lanes(di)) {
+      if (ac_type == ACType::k16) {
+        nonzero = Or(nonzero, PromoteTo(di, Load(di16, qblock[c].ptr16 + k)));
+      } else {
+        nonzero = Or(nonzero, Load(di, qblock[c].ptr32 + k));
+      }
+    }
+  }
+  return AllTrue(di, Eq(nonzero, Zero(di)));
+}
+
+// Dequantization, CfL and IDCT of a square DCT of side `kDim`, specialized at
+// compile time, for the common case of three non-subsampled channels. The IDCT
+// writes directly into the render pipeline input rows; only the dequantized
+// block of the current channel goes through `block`, which stays in L1.
+template <ACType ac_type, size_t kDim>
+void DequantAndTransformBlock(float inv_global_scale, int quant,
+                              float x_dm_multiplier, float b_dm_multiplier,
+                              Vec<D> x_cc_mul, Vec<D> b_cc_mul,
+                              const Quantizer& quantizer, const size_t* sbx,
+                              const float* JXL_RESTRICT* JXL_RESTRICT dc_row,
+                              size_t dc_stride,
+                              const float* JXL_RESTRICT biases,
+                              ACPtr qblock[3], float* JXL_RESTRICT block,
+                              float* JXL_RESTRICT scratch,
+                              float* JXL_RESTRICT* JXL_RESTRICT idct_row,
+                              const size_t* idct_stride) {
+  constexpr AcStrategyType kStrategy =
+      kDim == 8    ? AcStrategyType::DCT
+      : kDim == 16 ? AcStrategyType::DCT16X16
+                   : AcStrategyType::DCT32X32;
+  constexpr size_t kSize = kDim * kDim;
+  // Without AC, the IDCT of a DCT8 fills the block with its DC, exactly, so
+  // these blocks, which are common at low rates, skip dequantization and IDCT.
+  if (kDim == 8 && IsZeroBlock<ac_type>(qblock, kSize)) {
+    for (size_t c = 0; c < 3; c++) {
+      const float dc = dc_row[c][sbx[c]];
+      float* JXL_RESTRICT pixels = idct_row[c] + sbx[c] * kBlockDim;
+      for (size_t y = 0; y < kBlockDim; y++) {
+        std::fill(pixels + y * idct_stride[c],
+                  pixels + y * idct_stride[c] + kBlockDim, dc);
+      }
+    }
+    return;
+  }
+  const auto scaled_dequant_s = inv_global_scale / quant;
+
+  const auto scaled_dequant_x = Set(d, scaled_dequant_s * x_dm_multiplier);
+  const auto scaled_dequant_y = Set(d, scaled_dequant_s);
+  const auto scaled_dequant_b = Set(d, scaled_dequant_s * b_dm_multiplier);
+
+  const float* dequant_matrices = quantizer.DequantMatrix(kStrategy, 0);
+
+  for (size_t k = 0; k < kSize; k += Lanes(d)) {
+    DequantLane<ac_type>(scaled_dequant_x, scaled_dequant_y, scaled_dequant_b,
+                         dequant_matrices, kSize, k, x_cc_mul, b_cc_mul, biases,
+                         qblock, block);
+  }
+  for (size_t c : {1, 0, 2}) {
+    float* JXL_RESTRICT coefficients = block + c * kSize;
+    if (kDim == 8) {
+      coefficients[0] = dc_row[c][sbx[c]];
+    } else {
+      LowestFrequenciesFromDC(kStrategy, dc_row[c] + sbx[c], dc_stride,
+                              coefficients, scratch);
+    }
+    ComputeScaledIDCT<kDim, kDim>()(
+        coefficients,
+        DCTTo(idct_row[c] + sbx[c] * kBlockDim, idct_stride[c]), scratch);
+  }
+}
+
+// Dequantization and IDCT of channel `c` of a DCT8 block without CfL, for
+// frames with chroma subsampling, in which each channel of a block is present
+// or not on its own; this is the case of most recompressed JPEGs. Neither the
+// other channels nor the unused chroma blocks are dequantized.
+template <ACType ac_type>
+void DequantAndTransformChannelDCT8(size_t c, float scaled_dequant,
+                                    const Quantizer& quantizer, float dc,
+                                    const float* JXL_RESTRICT biases,
+                                    ACPtr qblock, float* JXL_RESTRICT block,
+                                    float* JXL_RESTRICT scratch,
+                                    float* JXL_RESTRICT pixels, size_t stride) {
+  const auto scale = Set(d, scaled_dequant);
+  const float* dequant_matrix =
+      quantizer.DequantMatrix(AcStrategyType::DCT, c);
+  for (size_t k = 0; k < kDCTBlockSize; k += Lanes(d)) {
+    Vec<DI> quantized;
+    if (ac_type == ACType::k16) {
+      quantized = PromoteTo(di, Load(di16, qblock.ptr16 + k));
+    } else {
+      quantized = Load(di, qblock.ptr32 + k);
+    }
+    const auto mul = Mul(Load(d, dequant_matrix + k), scale);
+    Store(Mul(AdjustQuantBias(di, c, quantized, biases), mul), d, block + k);
+  }
+  block[0] = dc;
+  ComputeScaledIDCT<kBlockDim, kBlockDim>()(block, DCTTo(pixels, stride),
+                                            scratch);
+}
+
+// Returns the specialized DequantAndTransformBlock for `strategy`, if any.
+template <typename Fn>
+Fn FusedTransform(AcStrategyType strategy, Fn dct8, Fn dct16, Fn dct32) {
+  switch (strategy) {
+    case AcStrategyType::DCT:
+      return dct8;
+    case AcStrategyType::DCT16X16:
+      return dct16;
+    case AcStrategyType::DCT32X32:
+      return dct32;
+    default:
+      return nullptr;
+  }
+}
+
 Status DecodeGroupImpl(const FrameHeader& frame_header,
                        GetBlock* JXL_RESTRICT get_block,
                        GroupDecCache* JXL_RESTRICT group_dec_cache,
@@ -199,6 +356,25 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
   ACType ac_type = dec_state->coefficients->Type();
   auto dequant_block = ac_type == ACType::k16 ? DequantBlock<ACType::k16>
                                               : DequantBlock<ACType::k32>;
+  auto dequant_block_y = ac_type == ACType::k16 ? DequantBlockY<ACType::k16>
+                                                : DequantBlockY<ACType::k32>;
+  auto dequant_transform_dct8 =
+      ac_type == ACType::k16 ? DequantAndTransformBlock<ACType::k16, 8>
+                             : DequantAndTransformBlock<ACType::k32, 8>;
+  auto dequant_transform_dct16 =
+      ac_type == ACType::k16 ? DequantAndTransformBlock<ACType::k16, 16>
+                             : DequantAndTransformBlock<ACType::k32, 16>;
+  auto dequant_transform_dct32 =
+      ac_type == ACType::k16 ? DequantAndTransformBlock<ACType::k16, 32>
+                             : DequantAndTransformBlock<ACType::k32, 32>;
+  auto dequant_transform_channel_dct8 =
+      ac_type == ACType::k16 ? DequantAndTransformChannelDCT8<ACType::k16>
+                             : DequantAndTransformChannelDCT8<ACType::k32>;
+  // The X and B channels are then left as is, see GetNeutralChromaStage.
+  const bool luma_only = dec_state->luma_only;
+  // Without chroma subsampling, all the channels of a block are transformed
+  // together, which allows the specialized paths above.
+  const bool fused_transforms = !luma_only && cs.Is444();
   // Whether or not coefficients should be stored for future usage, and/or read
   // from past usage.
   bool accumulate = !dec_state->coefficients->IsEmpty();
@@ -288,7 +464,9 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
         auto& component = jpeg_data->components[jpeg_c_map[c]];
         jpeg_row[c] =
             component.coeffs.data() +
-            (component.width_in_blocks * (r[c].y0() + sby[c]) + r[c].x0()) *
+            (component.width_in_blocks *
+                 (r[c].y0() + sby[c] - component.first_block_row) +
+             r[c].x0()) *
                 kDCTBlockSize;
       }
     }
@@ -297,8 +475,14 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
     for (size_t tx = 0; tx < DivCeil(xsize_blocks, kColorTileDimInBlocks);
          tx++) {
       size_t abs_tx = tx + block_rect.x0() / kColorTileDimInBlocks;
-      auto x_cc_mul = Set(d, color_correlation.YtoXRatio(row_cmap[0][abs_tx]));
-      auto b_cc_mul = Set(d, color_correlation.YtoBRatio(row_cmap[2][abs_tx]));
+      const float x_cc = color_correlation.YtoXRatio(row_cmap[0][abs_tx]);
+      const float b_cc = color_correlation.YtoBRatio(row_cmap[2][abs_tx]);
+      auto x_cc_mul = Set(d, x_cc);
+      auto b_cc_mul = Set(d, b_cc);
+      // The channels of subsampled DCT8 blocks can then be transformed
+      // separately.
+      const bool per_channel_dct8 =
+          !luma_only && !cs.Is444() && x_cc == 0.0f && b_cc == 0.0f;
       // Increment bx by llf_x because those iterations would otherwise
       // immediately continue (!IsFirstBlock). Reduces mispredictions.
       for (; bx < xsize_blocks && bx < (tx + 1) * kColorTileDimInBlocks;) {
@@ -414,20 +598,68 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
           }
         } else {
           HWY_ALIGN float* const block = group_dec_cache->dec_group_block;
+          auto dequant_transform = fused_transforms
+                                       ? FusedTransform(acs.Strategy(),
+                                                        dequant_transform_dct8,
+                                                        dequant_transform_dct16,
+                                                        dequant_transform_dct32)
+                                       : nullptr;
+          if (dequant_transform != nullptr) {
+            dequant_transform(
+                inv_global_scale, row_quant[bx], dec_state->x_dm_multiplier,
+                dec_state->b_dm_multiplier, x_cc_mul, b_cc_mul,
+                dec_state->shared->quantizer, sbx, dc_rows, dc_stride,
+                dec_state->output_encoding_info.opsin_params.quant_biases,
+                qblock, block, group_dec_cache->scratch_space, idct_row,
+                idct_stride);
+            bx += llf_x;
+            continue;
+          }
+          if (per_channel_dct8 && acs.Strategy() == AcStrategyType::DCT) {
+            const float scaled_dequant = inv_global_scale / row_quant[bx];
+            const float dm_multipliers[3] = {dec_state->x_dm_multiplier, 1.0f,
+                                             dec_state->b_dm_multiplier};
+            for (size_t c : {1, 0, 2}) {
+              if ((sbx[c] << hshift[c] != bx) ||
+                  (sby[c] << vshift[c] != by)) {
+                continue;
+              }
+              dequant_transform_channel_dct8(
+                  c, scaled_dequant * dm_multipliers[c],
+                  dec_state->shared->quantizer, dc_rows[c][sbx[c]],
+                  dec_state->output_encoding_info.opsin_params.quant_biases,
+                  qblock[c], block, group_dec_cache->scratch_space,
+                  idct_row[c] + sbx[c] * kBlockDim, idct_stride[c]);
+            }
+            bx += llf_x;
+            continue;
+          }
           // Dequantize and add predictions.
-          dequant_block(
-              acs, inv_global_scale, row_quant[bx], dec_state->x_dm_multiplier,
-              dec_state->b_dm_multiplier, x_cc_mul, b_cc_mul, acs.Strategy(),
-              size, dec_state->shared->quantizer,
-              acs.covered_blocks_y() * acs.covered_blocks_x(), sbx, dc_rows,
-              dc_stride,
-              dec_state->output_encoding_info.opsin_params.quant_biases, qblock,
-              block, group_dec_cache->scratch_space);
+          if (luma_only) {
+            dequant_block_y(
+                acs, inv_global_scale, row_quant[bx], acs.Strategy(), size,
+                dec_state->shared->quantizer,
+                acs.covered_blocks_y() * acs.covered_blocks_x(), sbx, dc_rows,
+                dc_stride,
+                dec_state->output_encoding_info.opsin_params.quant_biases,
+                qblock, block, group_dec_cache->scratch_space);
+          } else {
+            dequant_block(
+                acs, inv_global_scale, row_quant[bx],
+                dec_state->x_dm_multiplier, dec_state->b_dm_multiplier,
+                x_cc_mul, b_cc_mul, acs.Strategy(), size,
+                dec_state->shared->quantizer,
+                acs.covered_blocks_y() * acs.covered_blocks_x(), sbx, dc_rows,
+                dc_stride,
+                dec_state->output_encoding_info.opsin_params.quant_biases,
+                qblock, block, group_dec_cache->scratch_space);
+          }
 
           for (size_t c : {1, 0, 2}) {
             if ((sbx[c] << hshift[c] != bx) || (sby[c] << vshift[c] != by)) {
               continue;
             }
+            if (luma_only && c != 1) continue;
             // IDCT
             float* JXL_RESTRICT idct_pos = idct_row[c] + sbx[c] * kBlockDim;
             TransformToPixels(acs.Strategy(), block + c * size, idct_pos,
@@ -702,6 +934,7 @@ Status DecodeGroup(const FrameHeader& frame_header,
                    RenderPipelineInput& render_pipeline_input,
                    jpeg::JPEGData* JXL_RESTRICT jpeg_data, size_t first_pass,
                    bool force_draw, bool dc_only, bool* should_run_pipeline) {
+  JXL_TRACE_SCOPE("DecodeGroup", group_idx);
   JxlMemoryManager* memory_manager = dec_state->memory_manager();
   DrawMode draw =
       (num_passes + first_pass == frame_header.passes.num_passes) || force_draw
@@ -0,0 +1,199 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/dec_memory.h"
+
+#include <jxl/parallel_runner.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/frame_dimensions.h"
+#include "lib/jxl/frame_header.h"
+#include "lib/jxl/image_metadata.h"
+
+namespace jxl {
+
+namespace {
+
+constexpr uint64_t kSampleBytes = 4;
+// Histograms, context maps, trees and the other fixed-size tables.
+constexpr uint64_t kTablesBytes = 1 << 20;
+
+uint64_t NumChannels(const FrameHeader& frame_header) {
+  return 3 + frame_header.nonserialized_metadata->m.num_extra_channels;
+}
+
+// The input and output buffers of a group with its borders for each thread,
+// and the rows and columns kept on both sides of the borders between groups.
+uint64_t RenderPipelineMemory(const FrameHeader& frame_header,
+                              const FrameDimensions& frame_dim,
+                              uint64_t num_threads) {
+  uint64_t num_c = NumChannels(frame_header);
+  if (frame_header.flags & FrameHeader::kNoise) num_c += 3;
+  // Upsampling needs 2 more pixels.
+  const uint64_t border =
+      (frame_header.loop_filter.Padding() + 2) * frame_header.upsampling;
+  const uint64_t group_dim =
+      frame_dim.group_dim * frame_header.upsampling + 2 * border;
+  const uint64_t group_buffers =
+      2 * num_c * group_dim * group_dim * kSampleBytes;
+  const uint64_t saved_borders =
+      2 * border * num_c * kSampleBytes *
+      (frame_dim.xsize_upsampled * frame_dim.ysize_groups +
+       frame_dim.ysize_upsampled * frame_dim.xsize_groups);
+  return num_threads * group_buffers + saved_borders;
+}
+
+uint64_t VarDCTMemory(const FrameHeader& frame_header,
+                      const FrameDimensions& frame_dim, uint64_t group_threads,
+                      uint64_t dc_group_threads) {
+  const uint64_t num_blocks =
+      static_cast<uint64_t>(frame_dim.xsize_blocks) * frame_dim.ysize_blocks;
+  const uint64_t num_pixels =
+      static_cast<uint64_t>(frame_dim.xsize_padded) * frame_dim.ysize_padded;
+  // The DC and its smoothed copy, the quantization field, the sharpness and
+  // sigma of EPF, and the transform types.
+  uint64_t bytes = num_blocks * (2 * 3 * kSampleBytes + 2 * kSampleBytes + 2);
+  // The modular images of the DC and the AC metadata of each DC group.
+  const uint64_t dc_group_blocks = frame_dim.dc_group_dim / kBlockDim;
+  bytes += dc_group_threads * 4 * dc_group_blocks * dc_group_blocks *
+           kSampleBytes;
+  // Coefficients accumulated over the passes.
+  if (frame_header.passes.num_passes > 1) {
+    bytes += 3 * num_pixels * kSampleBytes;
+  }
+  // Coefficients and dequantized blocks of each group.
+  bytes += group_threads * 2 * 3 * frame_dim.group_dim * frame_dim.group_dim *
+           kSampleBytes;
+  return bytes;
+}
+
+uint64_t ModularMemory(const FrameHeader& frame_header,
+                       const FrameDimensions& frame_dim,
+                       uint64_t group_threads) {
+  const uint64_t num_pixels =
+      static_cast<uint64_t>(frame_dim.xsize) * frame_dim.ysize;
+  // The full image, unless it can be dropped, and a channel of scratch space
+  // for the inverse transforms.
+  uint64_t bytes = (NumChannels(frame_header) + 1) * num_pixels * kSampleBytes;
+  // The channels of each group while decoding it.
+  bytes += group_threads * 2 * NumChannels(frame_header) *
+           frame_dim.group_dim * frame_dim.group_dim * kSampleBytes;
+  return bytes;
+}
+
+}  // namespace
+
+uint64_t EstimateFrameMemory(const FrameHeader& frame_header,
+                             size_t num_threads, bool jpeg_data) {
+  const FrameDimensions frame_dim = frame_header.ToFrameDimensions();
+  const uint64_t threads = std::max<size_t>(num_threads, 1);
+  const uint64_t group_threads = std::min<uint64_t>(threads,
+                                                    frame_dim.num_groups);
+  const uint64_t dc_group_threads =
+      std::min<uint64_t>(threads, frame_dim.num_dc_groups);
+  uint64_t bytes = kTablesBytes;
+  if (frame_header.encoding == FrameEncoding::kVarDCT) {
+    bytes += VarDCTMemory(frame_header, frame_dim, group_threads,
+                          dc_group_threads);
+  } else {
+    bytes += ModularMemory(frame_header, frame_dim, group_threads);
+  }
+  bytes += RenderPipelineMemory(frame_header, frame_dim, group_threads);
+  if (jpeg_data) {
+    // The 16-bit coefficients of the JPEG.
+    bytes += 3 * 2 * static_cast<uint64_t>(frame_dim.xsize_padded) *
+             frame_dim.ysize_padded;
+  }
+  if (frame_header.CanBeReferenced()) {
+    bytes += NumChannels(frame_header) * kSampleBytes *
+             frame_dim.xsize_upsampled * frame_dim.ysize_upsampled;
+  }
+  return bytes;
+}
+
+uint64_t EstimateImageMemory(const CodecMetadata& metadata,
+                             size_t num_threads) {
+  FrameHeader frame_header(&metadata);
+  // The frames of animations are usually kept for the next ones.
+  frame_header.is_last = !metadata.m.have_animation;
+  uint64_t bytes = EstimateFrameMemory(frame_header, num_threads,
+                                       /*jpeg_data=*/false);
+  frame_header.encoding = FrameEncoding::kModular;
+  return std::max(bytes, EstimateFrameMemory(frame_header, num_threads,
+                                             /*jpeg_data=*/false));
+}
+
+size_t MaxThreadsWithinMemory(const FrameHeader& frame_header,
+                              bool jpeg_data, uint64_t budget,
+                              size_t max_threads) {
+  // More threads than tasks use no more memory.
+  const FrameDimensions frame_dim = frame_header.ToFrameDimensions();
+  size_t threads = std::min(
+      max_threads, std::max(frame_dim.num_groups, frame_dim.num_dc_groups));
+  for (; threads > 0; --threads) {
+    if (EstimateFrameMemory(frame_header, threads, jpeg_data) <= budget) break;
+  }
+  return threads;
+}
+
+CappedThreadPool::CappedThreadPool(ThreadPool* base, size_t max_threads)
+    : base_(base),
+      max_threads_(std::max<size_t>(max_threads, 1)),
+      pool_(base->runner() ? &Run : nullptr, this) {}
+
+JxlParallelRetCode CappedThreadPool::Run(void* runner_opaque,
+                                         void* jpegxl_opaque,
+                                         JxlParallelRunInit init,
+                                         JxlParallelRunFunction func,
+                                         uint32_t start_range,
+                                         uint32_t end_range) {
+  auto* self = static_cast<CappedThreadPool*>(runner_opaque);
+  self->jpegxl_opaque_ = jpegxl_opaque;
+  self->init_ = init;
+  self->func_ = func;
+  return (*self->base_->runner())(self->base_->runner_opaque(), self,
+                                  &CappedInit, &CappedFunc, start_range,
+                                  end_range);
+}
+
+JxlParallelRetCode CappedThreadPool::CappedInit(void* opaque,
+                                                size_t num_threads) {
+  auto* self = static_cast<CappedThreadPool*>(opaque);
+  self->remap_threads_ = num_threads > self->max_threads_;
+  const size_t capped = std::min(num_threads, self->max_threads_);
+  self->free_threads_.clear();
+  for (size_t i = 0; i < capped; ++i) self->free_threads_.push_back(i);
+  return self->init_(self->jpegxl_opaque_, capped);
+}
+
+void CappedThreadPool::CappedFunc(void* opaque, uint32_t value,
+                                  size_t thread_id) {
+  auto* self = static_cast<CappedThreadPool*>(opaque);
+  if (!self->remap_threads_) {
+    self->func_(self->jpegxl_opaque_, value, thread_id);
+    return;
+  }
+  size_t thread;
+  {
+    std::unique_lock<std::mutex> lock(self->mutex_);
+    self->thread_freed_.wait(lock,
+                             [self] { return !self->free_threads_.empty(); });
+    thread = self->free_threads_.back();
+    self->free_threads_.pop_back();
+  }
+  self->func_(self->jpegxl_opaque_, value, thread);
+  {
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    self->free_threads_.push_back(thread);
+  }
+  self->thread_freed_.notify_one();
+}
+
+}  // namespace jxl
@@ -0,0 +1,82 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_DEC_MEMORY_H_
+#define LIB_JXL_DEC_MEMORY_H_
+
+// Estimates of the memory used by the decoder, and the means to keep it under
+// the limit set by JxlDecoderSetMemoryLimit.
+
+#include <jxl/parallel_runner.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/frame_header.h"
+#include "lib/jxl/image_metadata.h"
+
+namespace jxl {
+
+// Estimates the memory that the decoder allocates through its memory manager
+// to decode the frame with `frame_header`, using up to `num_threads` threads,
+// on top of the memory kept from previous frames. The image output buffers of
+// the application are not included; `jpeg_data` is whether the frame is kept
+// for JPEG reconstruction.
+uint64_t EstimateFrameMemory(const FrameHeader& frame_header,
+                             size_t num_threads, bool jpeg_data);
+
+// Same for the largest frame of an image with the given metadata, when only
+// the basic info is known.
+uint64_t EstimateImageMemory(const CodecMetadata& metadata,
+                             size_t num_threads);
+
+// Largest number of threads, up to `max_threads`, with which the frame is
+// estimated to fit in `budget` bytes, or 0 if it does not fit with 1 thread.
+size_t MaxThreadsWithinMemory(const FrameHeader& frame_header,
+                              bool jpeg_data, uint64_t budget,
+                              size_t max_threads);
+
+// Runs the tasks of another thread pool with at most `max_threads` of them at
+// once, so that the storage that the callers allocate per thread is bounded.
+class CappedThreadPool {
+ public:
+  CappedThreadPool(ThreadPool* base, size_t max_threads);
+
+  CappedThreadPool(const CappedThreadPool&) = delete;
+  CappedThreadPool& operator=(const CappedThreadPool&) = delete;
+
+  ThreadPool* pool() { return &pool_; }
+
+ private:
+  static JxlParallelRetCode Run(void* runner_opaque, void* jpegxl_opaque,
+                                JxlParallelRunInit init,
+                                JxlParallelRunFunction func,
+                                uint32_t start_range, uint32_t end_range);
+  static JxlParallelRetCode CappedInit(void* opaque, size_t num_threads);
+  static void CappedFunc(void* opaque, uint32_t value, size_t thread_id);
+
+  ThreadPool* base_;
+  size_t max_threads_;
+  ThreadPool pool_;
+
+  // State of the current Run call.
+  void* jpegxl_opaque_;
+  JxlParallelRunInit init_;
+  JxlParallelRunFunction func_;
+  // Whether the base pool uses more threads than max_threads_, in which case
+  // the tasks take one of the free_threads_ ids.
+  bool remap_threads_;
+  std::mutex mutex_;
+  std::condition_variable thread_freed_;
+  std::vector<size_t> free_threads_;
+};
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_DEC_MEMORY_H_
@@ -0,0 +1,74 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/dec_memory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/frame_header.h"
+#include "lib/jxl/image_metadata.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace {
+
+TEST(DecMemoryTest, CappedThreadPool) {
+  test::ThreadPoolForTests base(8);
+  for (size_t max_threads : {1, 3, 16}) {
+    CappedThreadPool capped(base.get(), max_threads);
+    size_t num_threads = 0;
+    std::atomic<size_t> running{0};
+    std::atomic<size_t> max_running{0};
+    std::atomic<bool> thread_in_range{true};
+    std::vector<std::atomic<int>> done(100);
+    const auto init = [&](size_t threads) -> Status {
+      num_threads = threads;
+      return true;
+    };
+    const auto run = [&](uint32_t task, size_t thread) -> Status {
+      size_t now = ++running;
+      size_t max = max_running.load();
+      while (now > max && !max_running.compare_exchange_weak(max, now)) {
+      }
+      if (thread >= num_threads) thread_in_range = false;
+      done[task]++;
+      --running;
+      return true;
+    };
+    ASSERT_TRUE(RunOnPool(capped.pool(), 0, done.size(), init, run, "Test"));
+    EXPECT_EQ(std::min<size_t>(max_threads, 8), num_threads);
+    EXPECT_LE(max_running.load(), num_threads);
+    EXPECT_TRUE(thread_in_range);
+    for (const auto& count : done) EXPECT_EQ(1, count.load());
+  }
+}
+
+TEST(DecMemoryTest, FrameEstimate) {
+  CodecMetadata metadata;
+  ASSERT_TRUE(metadata.size.Set(2000, 1500));
+  FrameHeader frame_header(&metadata);
+  const uint64_t one_thread = EstimateFrameMemory(frame_header, 1, false);
+  const uint64_t four_threads = EstimateFrameMemory(frame_header, 4, false);
+  // At least the DC of the frame, and more storage with more threads.
+  EXPECT_LT(3 * 4 * 2000 * 1500 / 64, one_thread);
+  EXPECT_LT(one_thread, four_threads);
+  EXPECT_LT(one_thread, EstimateFrameMemory(frame_header, 1, true));
+  EXPECT_LE(four_threads, EstimateImageMemory(metadata, 4));
+
+  EXPECT_EQ(0u, MaxThreadsWithinMemory(frame_header, false, one_thread - 1, 8));
+  EXPECT_EQ(1u, MaxThreadsWithinMemory(frame_header, false, one_thread, 8));
+  EXPECT_EQ(4u, MaxThreadsWithinMemory(frame_header, false, four_threads, 8));
+  EXPECT_EQ(8u, MaxThreadsWithinMemory(frame_header, false, UINT64_MAX, 8));
+}
+
+}  // namespace
+}  // namespace jxl
@@ -17,6 +17,8 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
+#include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/rect.h"
@@ -25,7 +27,9 @@
 #include "lib/jxl/epf.h"
 #include "lib/jxl/modular/encoding/encoding.h"
 #include "lib/jxl/modular/modular_image.h"
+#include "lib/jxl/modular/transform/rct.h"
 #include "lib/jxl/modular/transform/transform.h"
+#include "lib/jxl/trace_internal.h"
 
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
@@ -152,6 +156,51 @@ Status int_to_float(const pixel_type* const JXL_RESTRICT row_in,
   return true;
 }
 
+// Interleaves `num_channels` rows of samples, clamped to [0, maxval], as
+// unsigned integers of kBytes bytes. A null row is written as maxval.
+template <size_t kBytes, bool kBigEndian>
+void StoreIntRow(const pixel_type* const* rows, size_t num_channels,
+                 size_t xsize, pixel_type maxval, uint8_t* JXL_RESTRICT out) {
+  for (size_t x = 0; x < xsize; x++) {
+    for (size_t c = 0; c < num_channels; c++, out += kBytes) {
+      const pixel_type v =
+          rows[c] ? Clamp1<pixel_type>(rows[c][x], 0, maxval) : maxval;
+      if (kBytes == 1) {
+        *out = static_cast<uint8_t>(v);
+      } else if (kBigEndian) {
+        StoreBE16(v, out);
+      } else {
+        StoreLE16(v, out);
+      }
+    }
+  }
+}
+
+// Channels of full_image are compact up to this bit depth, which leaves room
+// for the range expansion of the transforms.
+constexpr int kMaxCompactBitDepth = 14;
+
+// Copies `from` into `rect` of `to`, unless one of the values does not fit.
+bool CopyToCompact(const Plane<pixel_type>& from, const Rect& rect,
+                   Plane<int16_t>* to) {
+  for (size_t y = 0; y < rect.ysize(); ++y) {
+    const pixel_type* JXL_RESTRICT row_in = from.ConstRow(y);
+    bool fits = true;
+    for (size_t x = 0; x < rect.xsize(); ++x) {
+      fits &= row_in[x] == static_cast<int16_t>(row_in[x]);
+    }
+    if (!fits) return false;
+  }
+  for (size_t y = 0; y < rect.ysize(); ++y) {
+    const pixel_type* JXL_RESTRICT row_in = from.ConstRow(y);
+    int16_t* JXL_RESTRICT row_out = rect.Row(to, y);
+    for (size_t x = 0; x < rect.xsize(); ++x) {
+      row_out[x] = static_cast<int16_t>(row_in[x]);
+    }
+  }
+  return true;
+}
+
 #if JXL_DEBUG_V_LEVEL >= 1
 std::string ModularStreamId::DebugString() const {
   std::ostringstream os;
@@ -197,6 +246,10 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
           std::min(static_cast<size_t>(1 << 22),
                    1024 + frame_dim.xsize * frame_dim.ysize *
                               (nb_chans + nb_extra) / 16);
+      if (tree_node_limit_ != 0) {
+        tree_size_limit = static_cast<size_t>(
+            std::min<uint64_t>(tree_size_limit, tree_node_limit_));
+      }
       JXL_RETURN_IF_ERROR(
           DecodeTree(memory_manager, reader, &tree, tree_size_limit));
       JXL_RETURN_IF_ERROR(DecodeHistograms(
@@ -204,6 +257,9 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
     }
   }
   if (!do_color) nb_chans = 0;
+  first_skipped_channel_ = first_skipped_extra_channel_ < nb_extra
+                               ? nb_chans + first_skipped_extra_channel_
+                               : kNoSkippedChannels;
 
   bool fp = metadata.bit_depth.floating_point_sample;
 
@@ -217,10 +273,16 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
     }
   }
 
+  // The planes are only allocated once they are known to be needed: when
+  // there are no global transforms, the groups are decoded and rendered
+  // without ever storing the whole image.
   JXL_ASSIGN_OR_RETURN(
-      Image gi,
-      Image::Create(memory_manager, frame_dim.xsize, frame_dim.ysize,
-                    metadata.bit_depth.bits_per_sample, nb_chans + nb_extra));
+      Image gi, Image::Create(memory_manager, frame_dim.xsize, frame_dim.ysize,
+                              metadata.bit_depth.bits_per_sample, 0));
+  for (size_t c = 0; c < nb_chans + nb_extra; c++) {
+    gi.channel.emplace_back(Channel::CreateUnallocated(
+        memory_manager, frame_dim.xsize, frame_dim.ysize));
+  }
 
   all_same_shift = true;
   if (frame_header.color_transform == ColorTransform::kYCbCr) {
@@ -253,6 +315,7 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
   JXL_DEBUG_V(6, "DecodeGlobalInfo: full_image (w/o transforms) %s",
               gi.DebugString().c_str());
   ModularOptions options;
+  options.max_tree_nodes = tree_node_limit_;
   options.max_chan_size = frame_dim.group_dim;
   options.group_dim = frame_dim.group_dim;
   Status dec_status = ModularGenericDecompress(
@@ -282,18 +345,40 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
     }
   }
   full_image = std::move(gi);
+  overflow_.clear();
   JXL_DEBUG_V(6, "DecodeGlobalInfo: full_image (with transforms) %s",
               full_image.DebugString().c_str());
+  if (!CanDropFullImage()) {
+    const bool compact =
+        full_image.bitdepth <= kMaxCompactBitDepth &&
+        frame_header.color_transform != ColorTransform::kXYB;
+    for (auto& ch : full_image.channel) {
+      bool allocated = ch.plane.xsize() != 0;
+      if (!allocated && compact) {
+        JXL_RETURN_IF_ERROR(ch.AllocateCompact());
+        if (!dec_status) ZeroFillImage(&ch.compact_plane);
+        continue;
+      }
+      JXL_RETURN_IF_ERROR(ch.EnsureAllocated());
+      // Channels missing from a truncated section read as zero.
+      if (!allocated && !dec_status) ZeroFillImage(&ch.plane);
+    }
+  }
   return dec_status;
 }
 
+bool ModularFrameDecoder::CanDropFullImage() const {
+  return full_image.transform.empty() && !have_something && all_same_shift;
+}
+
 void ModularFrameDecoder::MaybeDropFullImage() {
-  if (full_image.transform.empty() && !have_something && all_same_shift) {
+  if (CanDropFullImage()) {
     use_full_image = false;
     JXL_DEBUG_V(6, "Dropping full image");
     for (auto& ch : full_image.channel) {
       // keep metadata on channels around, but dealloc their planes
       ch.plane = Plane<pixel_type>();
+      ch.compact_plane = Plane<int16_t>();
     }
   }
 }
@@ -302,7 +387,8 @@ Status ModularFrameDecoder::DecodeGroup(
     const FrameHeader& frame_header, const Rect& rect, BitReader* reader,
     int minShift, int maxShift, const ModularStreamId& stream, bool zerofill,
     PassesDecoderState* dec_state, RenderPipelineInput* render_pipeline_input,
-    bool allow_truncated, bool* should_run_pipeline) {
+    bool allow_truncated, bool* should_run_pipeline, ThreadPool* pool) {
+  JXL_TRACE_SCOPE("ModularFrameDecoder::DecodeGroup");
   JXL_DEBUG_V(6, "Decoding %s with rect %s and shift bracket %d..%d %s",
               stream.DebugString().c_str(), Description(rect).c_str(), minShift,
               maxShift, zerofill ? "using zerofill" : "");
@@ -327,7 +413,12 @@ Status ModularFrameDecoder::DecodeGroup(
     Rect r(rect.x0() >> fc.hshift, rect.y0() >> fc.vshift,
            rect.xsize() >> fc.hshift, rect.ysize() >> fc.vshift, fc.w, fc.h);
     if (r.xsize() == 0 || r.ysize() == 0) continue;
-    if (zerofill && use_full_image) {
+    if (zerofill && use_full_image && fc.compact()) {
+      for (size_t y = 0; y < r.ysize(); ++y) {
+        int16_t* const JXL_RESTRICT row_out = r.Row(&fc.compact_plane, y);
+        memset(row_out, 0, r.xsize() * sizeof(*row_out));
+      }
+    } else if (zerofill && use_full_image) {
       for (size_t y = 0; y < r.ysize(); ++y) {
         pixel_type* const JXL_RESTRICT row_out = r.Row(&fc.plane, y);
         memset(row_out, 0, r.xsize() * sizeof(*row_out));
@@ -357,22 +448,41 @@ Status ModularFrameDecoder::DecodeGroup(
     return true;
   }
   ModularOptions options;
+  options.max_tree_nodes = tree_node_limit_;
+  // Without global transforms, the channels of the group are those of the
+  // full image.
+  if (!use_full_image) options.skip_channels_from = first_skipped_channel_;
   if (!zerofill) {
     auto status = ModularGenericDecompress(
         reader, gi, /*header=*/nullptr, stream.ID(frame_dim), &options,
-        /*undo_transforms=*/true, &tree, &code, &context_map, allow_truncated);
+        /*undo_transforms=*/true, &tree, &code, &context_map, allow_truncated,
+        pool);
     if (!allow_truncated) JXL_RETURN_IF_ERROR(status);
     if (status.IsFatalError()) return status;
   }
   // Undo global transforms that have been pushed to the group level
   if (!use_full_image) {
     JXL_ENSURE(render_pipeline_input);
+    // A color RCT is undone row by row while converting to float, instead of
+    // in a separate pass over the whole group. Permute-only RCTs just swap
+    // channels and are cheaper to undo up front.
+    size_t fused_rct_type = 0;
     for (const auto& t : global_transform) {
-      JXL_RETURN_IF_ERROR(t.Inverse(gi, global_header.wp_header));
+      if (t.id == TransformId::kRCT && t.begin_c == 0 && t.rct_type % 7 != 0 &&
+          CanFuseRCT(frame_header, gi)) {
+        JXL_ENSURE(global_transform.size() == 1);
+        fused_rct_type = t.rct_type;
+        continue;
+      }
+      JXL_RETURN_IF_ERROR(t.Inverse(gi, global_header.wp_header, pool));
+    }
+    if (dec_state != nullptr && dec_state->modular_int_output) {
+      return ModularImageToOutput(frame_header, gi, dec_state, pool, rect,
+                                  fused_rct_type);
     }
     JXL_RETURN_IF_ERROR(ModularImageToDecodedRect(
-        frame_header, gi, dec_state, nullptr, *render_pipeline_input,
-        Rect(0, 0, gi.w, gi.h)));
+        frame_header, gi, dec_state, pool, *render_pipeline_input,
+        Rect(0, 0, gi.w, gi.h), fused_rct_type));
     return true;
   }
   int gic = 0;
@@ -385,10 +495,19 @@ Status ModularFrameDecoder::DecodeGroup(
            rect.xsize() >> fc.hshift, rect.ysize() >> fc.vshift, fc.w, fc.h);
     if (r.xsize() == 0 || r.ysize() == 0) continue;
     JXL_ENSURE(use_full_image);
-    JXL_RETURN_IF_ERROR(
-        CopyImageTo(/*rect_from=*/Rect(0, 0, r.xsize(), r.ysize()),
-                    /*from=*/gi.channel[gic].plane,
-                    /*rect_to=*/r, /*to=*/&fc.plane));
+    if (fc.compact()) {
+      if (!CopyToCompact(gi.channel[gic].plane, r, &fc.compact_plane)) {
+        // Other groups may be writing to the channel, so it is only expanded
+        // once the frame is decoded.
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        overflow_.push_back({c, r, std::move(gi.channel[gic].plane)});
+      }
+    } else {
+      JXL_RETURN_IF_ERROR(
+          CopyImageTo(/*rect_from=*/Rect(0, 0, r.xsize(), r.ysize()),
+                      /*from=*/gi.channel[gic].plane,
+                      /*rect_to=*/r, /*to=*/&fc.plane));
+    }
     gic++;
   }
   return true;
@@ -414,6 +533,7 @@ Status ModularFrameDecoder::DecodeVarDCTDC(const FrameHeader& frame_header,
   size_t extra_precision = reader->ReadFixedBits<2>();
   float mul = 1.0f / (1 << extra_precision);
   ModularOptions options;
+  options.max_tree_nodes = tree_node_limit_;
   for (size_t c = 0; c < 3; c++) {
     Channel& ch = image.channel[c < 2 ? c ^ 1 : c];
     ch.w >>= frame_header.chroma_subsampling.HShift(c);
@@ -459,6 +579,7 @@ Status ModularFrameDecoder::DecodeAcMetadata(const FrameHeader& frame_header,
   JXL_ASSIGN_OR_RETURN(image.channel[2],
                        Channel::Create(memory_manager, count, 2, 0, 0));
   ModularOptions options;
+  options.max_tree_nodes = tree_node_limit_;
   if (!ModularGenericDecompress(
           reader, image, /*header=*/nullptr, stream_id, &options,
           /*undo_transforms=*/true, &tree, &code, &context_map)) {
@@ -531,10 +652,30 @@ Status ModularFrameDecoder::DecodeAcMetadata(const FrameHeader& frame_header,
   return true;
 }
 
+bool ModularFrameDecoder::CanFuseRCT(const FrameHeader& frame_header,
+                                     const Image& gi) const {
+  const auto* metadata = frame_header.nonserialized_metadata;
+  if (!do_color || gi.channel.size() < 3 ||
+      frame_header.color_transform == ColorTransform::kXYB ||
+      (metadata->m.color_encoding.IsGray() &&
+       frame_header.color_transform == ColorTransform::kNone)) {
+    return false;
+  }
+  const Channel& ch0 = gi.channel[0];
+  for (size_t c = 1; c < 3; c++) {
+    const Channel& ch = gi.channel[c];
+    if (ch.w != ch0.w || ch.h != ch0.h || ch.hshift != ch0.hshift ||
+        ch.vshift != ch0.vshift) {
+      return false;
+    }
+  }
+  return true;
+}
+
 Status ModularFrameDecoder::ModularImageToDecodedRect(
     const FrameHeader& frame_header, Image& gi, PassesDecoderState* dec_state,
     jxl::ThreadPool* pool, RenderPipelineInput& render_pipeline_input,
-    Rect modular_rect) const {
+    Rect modular_rect, size_t fused_rct_type) const {
   const auto* metadata = frame_header.nonserialized_metadata;
   JXL_ENSURE(gi.transform.empty());
 
@@ -550,6 +691,54 @@ Status ModularFrameDecoder::ModularImageToDecodedRect(
         frame_header.color_transform == ColorTransform::kNone;
     const bool fp = metadata->m.bit_depth.floating_point_sample &&
                     frame_header.color_transform != ColorTransform::kXYB;
+    if (fused_rct_type != 0) {
+      JXL_ENSURE(CanFuseRCT(frame_header, gi));
+      const double factor = full_image.bitdepth < 32
+                                ? 1.0 / ((1u << full_image.bitdepth) - 1)
+                                : 0;
+      int bits = metadata->m.bit_depth.bits_per_sample;
+      int exp_bits = metadata->m.bit_depth.exponent_bits_per_sample;
+      const Channel& ch0 = gi.channel[0];
+      if (ch0.w == 0 || ch0.h == 0) {
+        return JXL_FAILURE("Empty image");
+      }
+      Rect mr(modular_rect.x0() >> ch0.hshift, modular_rect.y0() >> ch0.vshift,
+              DivCeil(modular_rect.xsize(), 1 << ch0.hshift),
+              DivCeil(modular_rect.ysize(), 1 << ch0.vshift));
+      mr = mr.Crop(ch0.plane);
+      for (; c < 3; c++) {
+        Rect r = render_pipeline_input.GetBuffer(c).second;
+        if (r.ysize() != mr.ysize() || r.xsize() != mr.xsize()) {
+          return JXL_FAILURE("Dimension mismatch: trying to fit a %" PRIuS
+                             "x%" PRIuS
+                             " modular channel into "
+                             "a %" PRIuS "x%" PRIuS " rect",
+                             mr.xsize(), mr.ysize(), r.xsize(), r.ysize());
+        }
+      }
+      const auto process_row = [&](const uint32_t task,
+                                   size_t /* thread */) -> Status {
+        const size_t y = task;
+        InvRCTImageRow(gi, 0, fused_rct_type, mr.y0() + y);
+        for (size_t cc = 0; cc < 3; cc++) {
+          const pixel_type* const JXL_RESTRICT row_in =
+              mr.Row(&gi.channel[cc].plane, y);
+          float* const JXL_RESTRICT row_out = get_row(cc, y);
+          if (fp) {
+            JXL_RETURN_IF_ERROR(
+                int_to_float(row_in, row_out, mr.xsize(), bits, exp_bits));
+          } else if (full_image.bitdepth < 23) {
+            HWY_DYNAMIC_DISPATCH(SingleFromSingle)
+            (mr.xsize(), row_in, factor, row_out);
+          } else {
+            SingleFromSingleAccurate(mr.xsize(), row_in, factor, row_out);
+          }
+        }
+        return true;
+      };
+      JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, mr.ysize(), ThreadPool::NoInit,
+                                    process_row, "ModularIntToFloat_rct"));
+    }
     for (; c < 3; c++) {
       double factor = full_image.bitdepth < 32
                           ? 1.0 / ((1u << full_image.bitdepth) - 1)
@@ -688,7 +877,9 @@ Status ModularFrameDecoder::ModularImageToDecodedRect(
                          "a %" PRIuS "x%" PRIuS " rect",
                          mr.xsize(), mr.ysize(), r.xsize(), r.ysize());
     }
-    for (size_t y = 0; y < r.ysize(); ++y) {
+    const auto process_row = [&](const uint32_t task,
+                                 size_t /* thread */) -> Status {
+      const size_t y = task;
       float* const JXL_RESTRICT row_out = r.Row(buffer.first, y);
       const pixel_type* const JXL_RESTRICT row_in = mr.Row(&ch_in.plane, y);
       if (fp) {
@@ -702,8 +893,68 @@ Status ModularFrameDecoder::ModularImageToDecodedRect(
           SingleFromSingleAccurate(r.xsize(), row_in, factor, row_out);
         }
       }
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, r.ysize(), ThreadPool::NoInit,
+                                  process_row, "ModularIntToFloat_ec"));
+  }
+  return true;
+}
+
+Status ModularFrameDecoder::ModularImageToOutput(
+    const FrameHeader& frame_header, Image& gi, PassesDecoderState* dec_state,
+    jxl::ThreadPool* pool, const Rect& rect, size_t fused_rct_type) const {
+  const auto* metadata = frame_header.nonserialized_metadata;
+  const ImageOutput& output = dec_state->main_output;
+  const size_t num_color = metadata->m.color_encoding.IsGray() ? 1 : 3;
+  const size_t num_channels = output.format.num_channels;
+  const bool has_alpha = (num_channels == 2 || num_channels == 4);
+  const size_t num_out_color = has_alpha ? num_channels - 1 : num_channels;
+  JXL_ENSURE(num_color <= num_out_color);
+  if (gi.channel.size() < num_color) {
+    return JXL_FAILURE("Missing color channels in modular group");
+  }
+  const Channel& ch0 = gi.channel[0];
+  for (const Channel& ch : gi.channel) {
+    if (ch.w != ch0.w || ch.h != ch0.h || ch.hshift != 0 || ch.vshift != 0) {
+      return JXL_FAILURE("Unexpected channel size in modular group");
     }
   }
+  if (rect.x0() + ch0.w > dec_state->width ||
+      rect.y0() + ch0.h > dec_state->height) {
+    return JXL_FAILURE("Modular group outside of the image");
+  }
+  const bool alpha_in = has_alpha && gi.channel.size() > num_color;
+  const pixel_type maxval = (1u << metadata->m.bit_depth.bits_per_sample) - 1;
+  const size_t bytes_per_sample =
+      output.format.data_type == JXL_TYPE_UINT8 ? 1 : 2;
+  const bool big_endian =
+      output.format.endianness == JXL_BIG_ENDIAN ||
+      (output.format.endianness == JXL_NATIVE_ENDIAN && !IsLittleEndian());
+  const auto store_row = bytes_per_sample == 1 ? StoreIntRow<1, false>
+                         : big_endian          ? StoreIntRow<2, true>
+                                               : StoreIntRow<2, false>;
+  uint8_t* const base = static_cast<uint8_t*>(output.buffer) +
+                        rect.y0() * output.stride +
+                        rect.x0() * num_channels * bytes_per_sample;
+  const auto process_row = [&](const uint32_t task,
+                               size_t /* thread */) -> Status {
+    const size_t y = task;
+    if (fused_rct_type != 0) {
+      InvRCTImageRow(gi, 0, fused_rct_type, y);
+    }
+    const pixel_type* rows[4];
+    for (size_t c = 0; c < num_out_color; c++) {
+      rows[c] = gi.channel[std::min(c, num_color - 1)].Row(y);
+    }
+    if (has_alpha) {
+      rows[num_out_color] = alpha_in ? gi.channel[num_color].Row(y) : nullptr;
+    }
+    store_row(rows, num_channels, ch0.w, maxval, base + y * output.stride);
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, ch0.h, ThreadPool::NoInit,
+                                process_row, "ModularIntToOutput"));
   return true;
 }
 
@@ -719,6 +970,8 @@ Status ModularFrameDecoder::FinalizeDecoding(const FrameHeader& frame_header,
   } else {
     JXL_ASSIGN_OR_RETURN(gi, Image::Clone(full_image));
   }
+  JXL_RETURN_IF_ERROR(ExpandCompactChannels(gi));
+  if (inplace) overflow_.clear();
   size_t xsize = gi.w;
   size_t ysize = gi.h;
 
@@ -760,6 +1013,19 @@ Status ModularFrameDecoder::FinalizeDecoding(const FrameHeader& frame_header,
   return true;
 }
 
+Status ModularFrameDecoder::ExpandCompactChannels(Image& gi) const {
+  for (Channel& ch : gi.channel) {
+    JXL_RETURN_IF_ERROR(ch.Expand());
+  }
+  for (const OverflowRect& overflow : overflow_) {
+    JXL_RETURN_IF_ERROR(CopyImageTo(
+        /*rect_from=*/Rect(0, 0, overflow.rect.xsize(), overflow.rect.ysize()),
+        /*from=*/overflow.plane, /*rect_to=*/overflow.rect,
+        /*to=*/&gi.channel[overflow.c].plane));
+  }
+  return true;
+}
+
 static constexpr const float kAlmostZero = 1e-8f;
 
 Status ModularFrameDecoder::DecodeQuantTable(
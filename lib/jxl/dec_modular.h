@@ -10,6 +10,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -23,6 +24,7 @@
 #include "lib/jxl/modular/encoding/dec_ma.h"
 #include "lib/jxl/modular/encoding/encoding.h"
 #include "lib/jxl/modular/modular_image.h"
+#include "lib/jxl/modular/options.h"
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/render_pipeline/render_pipeline.h"
 
@@ -96,14 +98,24 @@ class ModularFrameDecoder {
   explicit ModularFrameDecoder(JxlMemoryManager* memory_manager)
       : memory_manager_(memory_manager), full_image(memory_manager) {}
   void Init(const FrameDimensions& frame_dim) { this->frame_dim = frame_dim; }
+  // Limits the number of nodes of the global and local MA trees, if not 0.
+  void SetTreeNodeLimit(uint64_t limit) { tree_node_limit_ = limit; }
+  // The extra channels from `ec` on are not decoded in the groups where this
+  // is possible, and read as zero. Must be called before DecodeGlobalInfo.
+  void SetFirstSkippedExtraChannel(size_t ec) {
+    first_skipped_extra_channel_ = ec;
+  }
   Status DecodeGlobalInfo(BitReader* reader, const FrameHeader& frame_header,
                           bool allow_truncated_group);
+  // Entropy decoding of a group is sequential; if `pool` is not null, it is
+  // used for undoing the transforms and converting the decoded channels.
   Status DecodeGroup(const FrameHeader& frame_header, const Rect& rect,
                      BitReader* reader, int minShift, int maxShift,
                      const ModularStreamId& stream, bool zerofill,
                      PassesDecoderState* dec_state,
                      RenderPipelineInput* render_pipeline_input,
-                     bool allow_truncated, bool* should_run_pipeline = nullptr);
+                     bool allow_truncated, bool* should_run_pipeline = nullptr,
+                     ThreadPool* pool = nullptr);
   // Decodes a VarDCT DC group (`group_id`) from the given `reader`.
   Status DecodeVarDCTDC(const FrameHeader& frame_header, size_t group_id,
                         BitReader* reader, PassesDecoderState* dec_state);
@@ -125,18 +137,48 @@ class ModularFrameDecoder {
                           PassesDecoderState* dec_state, jxl::ThreadPool* pool,
                           bool inplace);
   bool have_dc() const { return have_something; }
+  // Whether the groups can be decoded without storing the full image, which
+  // is then only allocated when this is false.
+  bool CanDropFullImage() const;
   void MaybeDropFullImage();
   bool UsesFullImage() const { return use_full_image; }
   JxlMemoryManager* memory_manager() const { return memory_manager_; }
 
  private:
+  // If `fused_rct_type` is nonzero, the inverse of that RCT on the first three
+  // channels of `gi` is applied as part of the conversion.
   Status ModularImageToDecodedRect(const FrameHeader& frame_header, Image& gi,
                                    PassesDecoderState* dec_state,
                                    jxl::ThreadPool* pool,
                                    RenderPipelineInput& render_pipeline_input,
-                                   Rect modular_rect) const;
+                                   Rect modular_rect,
+                                   size_t fused_rct_type = 0) const;
+  // Writes the channels of the group image `gi`, whose top-left corner is at
+  // `rect`, straight to the integer buffer of dec_state->main_output, which
+  // must be set up as checked by FrameDecoder before enabling
+  // PassesDecoderState::modular_int_output.
+  Status ModularImageToOutput(const FrameHeader& frame_header, Image& gi,
+                              PassesDecoderState* dec_state,
+                              jxl::ThreadPool* pool, const Rect& rect,
+                              size_t fused_rct_type) const;
+  // Whether a global RCT on the first three channels of the group image `gi`
+  // can be undone by ModularImageToDecodedRect as part of the conversion.
+  bool CanFuseRCT(const FrameHeader& frame_header, const Image& gi) const;
+  // Restores the 32-bit planes of the compact channels of `gi`, a copy of
+  // full_image, including the group data stored in overflow_.
+  Status ExpandCompactChannels(Image& gi) const;
   JxlMemoryManager* memory_manager_;
+  // The channels decoded by the groups are compact (16-bit) while the frame is
+  // decoded, for images of small enough bit depths.
   Image full_image;
+  // Group data of compact channels of full_image that does not fit in 16 bits.
+  struct OverflowRect {
+    size_t c;
+    Rect rect;
+    Plane<pixel_type> plane;
+  };
+  std::mutex overflow_mutex_;
+  std::vector<OverflowRect> overflow_;
   std::vector<Transform> global_transform;
   FrameDimensions frame_dim;
   bool do_color;
@@ -147,6 +189,10 @@ class ModularFrameDecoder {
   ANSCode code;
   std::vector<uint8_t> context_map;
   GroupHeader global_header;
+  uint64_t tree_node_limit_ = 0;
+  size_t first_skipped_extra_channel_ = kNoSkippedChannels;
+  // Index of the first skipped extra channel in the modular image.
+  size_t first_skipped_channel_ = kNoSkippedChannels;
 };
 
 }  // namespace jxl
@@ -5,8 +5,10 @@
 
 #include "lib/jxl/dec_noise.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <utility>
 
 #undef HWY_TARGET_INCLUDE
@@ -14,6 +16,7 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
+#include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/frame_dimensions.h"
@@ -25,37 +28,24 @@ namespace jxl {
 namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
-using hwy::HWY_NAMESPACE::Or;
-using hwy::HWY_NAMESPACE::ShiftRight;
 using hwy::HWY_NAMESPACE::Vec;
 
 using D = HWY_CAPPED(float, kBlockDim);
 using DI = hwy::HWY_NAMESPACE::Rebind<int, D>;
 using DI8 = hwy::HWY_NAMESPACE::Repartition<uint8_t, D>;
 
-// Converts one vector's worth of random bits to floats in [1, 2).
-// NOTE: as the convolution kernel sums to 0, it doesn't matter if inputs are in
-// [0, 1) or in [1, 2).
-void BitsToFloat(const uint32_t* JXL_RESTRICT random_bits,
-                 float* JXL_RESTRICT floats) {
-  const HWY_FULL(float) df;
-  const HWY_FULL(uint32_t) du;
-
-  const auto bits = Load(du, random_bits);
-  // 1.0 + 23 random mantissa bits = [1, 2)
-  const auto rand12 = BitCast(df, Or(ShiftRight<9>(bits), Set(du, 0x3F800000)));
-  Store(rand12, df, floats);
-}
-
 void RandomImage(Xorshift128Plus* rng, const Rect& rect,
                  ImageF* JXL_RESTRICT noise) {
   const size_t xsize = rect.xsize();
   const size_t ysize = rect.ysize();
 
-  // May exceed the vector size, hence we have two loops over x below.
+  // Floats in [1, 2). NOTE: as the convolution kernel sums to 0, it doesn't
+  // matter if inputs are in [0, 1) or in [1, 2).
+  // May exceed the vector size; the generator converts all of its lanes at
+  // once.
   constexpr size_t kFloatsPerBatch =
       Xorshift128Plus::N * sizeof(uint64_t) / sizeof(float);
-  HWY_ALIGN uint64_t batch[Xorshift128Plus::N] = {};
+  HWY_ALIGN float batch[kFloatsPerBatch];
 
   const HWY_FULL(float) df;
   const size_t N = Lanes(df);
@@ -66,20 +56,13 @@ void RandomImage(Xorshift128Plus* rng, const Rect& rect,
     size_t x = 0;
     // Only entire batches (avoids exceeding the image padding).
     for (; x + kFloatsPerBatch < xsize; x += kFloatsPerBatch) {
-      rng->Fill(batch);
-      for (size_t i = 0; i < kFloatsPerBatch; i += Lanes(df)) {
-        BitsToFloat(reinterpret_cast<const uint32_t*>(batch) + i, row + x + i);
-      }
+      rng->FillFloats(row + x);
     }
 
     // Any remaining pixels, rounded up to vectors (safe due to padding).
-    rng->Fill(batch);
-    size_t batch_pos = 0;  // < kFloatsPerBatch
-    for (; x < xsize; x += N) {
-      BitsToFloat(reinterpret_cast<const uint32_t*>(batch) + batch_pos,
-                  row + x);
-      batch_pos += N;
-    }
+    rng->FillFloats(batch);
+    const size_t num = std::min(RoundUpTo(xsize - x, N), kFloatsPerBatch);
+    memcpy(row + x, batch, num * sizeof(*row));
   }
 }
 void Random3Planes(size_t visible_frame_index, size_t nonvisible_frame_index,
@@ -14,6 +14,8 @@
 #include <utility>
 #include <vector>
 
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/float.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/blending.h"
@@ -26,10 +28,57 @@
 
 namespace jxl {
 
+Status ReferceFrame::StoreAsHalf() {
+  JXL_ENSURE(!ib_is_in_xyb);
+  half_planes.clear();
+  const ImageBundle& ib = *frame;
+  if (ib.IsJPEG() || !ib.HasColor() || ib.xsize() == 0) return true;
+  JxlMemoryManager* memory_manager = ib.memory_manager();
+  const size_t xsize = ib.xsize();
+  const size_t ysize = ib.ysize();
+  const size_t num_c = 3 + ib.extra_channels().size();
+  for (size_t c = 0; c < num_c; ++c) {
+    const ImageF& plane =
+        c < 3 ? ib.color().Plane(c) : ib.extra_channels()[c - 3];
+    JXL_ENSURE(plane.xsize() == xsize && plane.ysize() == ysize);
+    JXL_ASSIGN_OR_RETURN(Plane<uint16_t> half,
+                         Plane<uint16_t>::Create(memory_manager, xsize, ysize));
+    for (size_t y = 0; y < ysize; ++y) {
+      const float* JXL_RESTRICT row_from = plane.ConstRow(y);
+      uint16_t* JXL_RESTRICT row_to = half.Row(y);
+      for (size_t x = 0; x < xsize; ++x) {
+        row_to[x] = detail::StoreFloat16(row_from[x]);
+      }
+    }
+    half_planes.emplace_back(std::move(half));
+  }
+  const FrameOrigin origin = ib.origin;
+  *frame = ImageBundle(memory_manager, ib.metadata());
+  frame->origin = origin;
+  return true;
+}
+
+const float* ReferceFrame::ConstRow(size_t c, size_t y, size_t x0,
+                                    size_t xsize,
+                                    float* JXL_RESTRICT buffer) const {
+  if (half_planes.empty()) {
+    const ImageBundle& ib = *frame;
+    return (c < 3 ? ib.color().ConstPlaneRow(c, y)
+                  : ib.extra_channels()[c - 3].ConstRow(y)) +
+           x0;
+  }
+  const uint16_t* JXL_RESTRICT row = half_planes[c].ConstRow(y) + x0;
+  for (size_t x = 0; x < xsize; ++x) {
+    buffer[x] = detail::LoadFloat16(row[x]);
+  }
+  return buffer;
+}
+
 Status PatchDictionary::Decode(JxlMemoryManager* memory_manager, BitReader* br,
                                size_t xsize, size_t ysize,
                                size_t num_extra_channels,
-                               bool* uses_extra_channels) {
+                               bool* uses_extra_channels,
+                               size_t max_patches_limit) {
   positions_.clear();
   blendings_stride_ = num_extra_channels + 1;
   std::vector<uint8_t> context_map;
@@ -49,9 +98,13 @@ Status PatchDictionary::Decode(JxlMemoryManager* memory_manager, BitReader* br,
   // bytes per size_t)
   const size_t num_pixels = xsize * ysize;
   const size_t max_ref_patches = 1024 + num_pixels / 4;
-  const size_t max_patches = max_ref_patches * 4;
+  size_t max_patches = max_ref_patches * 4;
   const size_t max_blending_infos = max_patches * 4;
-  if (num_ref_patch > max_ref_patches) {
+  if (max_patches_limit != 0) {
+    max_patches = std::min(max_patches, max_patches_limit);
+  }
+  // Each reference patch has at least one patch.
+  if (num_ref_patch > max_ref_patches || num_ref_patch > max_patches) {
     return JXL_FAILURE("Too many patches in dictionary");
   }
 
@@ -62,7 +115,7 @@ Status PatchDictionary::Decode(JxlMemoryManager* memory_manager, BitReader* br,
     PatchReferencePosition ref_pos;
     ref_pos.ref = read_num(kReferenceFrameContext);
     if (ref_pos.ref >= kMaxNumReferenceFrames ||
-        reference_frames_->at(ref_pos.ref).frame->xsize() == 0) {
+        reference_frames_->at(ref_pos.ref).xsize() == 0) {
       return JXL_FAILURE("Invalid reference frame ID");
     }
     if (!reference_frames_->at(ref_pos.ref).ib_is_in_xyb) {
@@ -195,6 +248,7 @@ void PatchDictionary::ComputePatchTree() {
   num_patches_.clear();
   sorted_patches_y0_.clear();
   sorted_patches_y1_.clear();
+  ComputePatchTiles();
   if (positions_.empty()) {
     return;
   }
@@ -281,6 +335,58 @@ void PatchDictionary::ComputePatchTree() {
   }
 }
 
+void PatchDictionary::ComputePatchTiles() {
+  tile_patches_.clear();
+  tile_patch_start_.clear();
+  num_tiles_x_ = 0;
+  num_tiles_y_ = 0;
+  if (positions_.empty()) {
+    return;
+  }
+  // Range of tiles [tx0, tx1) x [ty0, ty1) that a patch overlaps.
+  const auto tile_range = [this](const PatchPosition& pos, size_t* tx0,
+                                 size_t* tx1, size_t* ty0, size_t* ty1) {
+    const PatchReferencePosition& ref_pos = ref_positions_[pos.ref_pos_idx];
+    *tx0 = pos.x / kPatchTileDim;
+    *tx1 = DivCeil(pos.x + ref_pos.xsize, kPatchTileDim);
+    *ty0 = pos.y / kPatchTileDim;
+    *ty1 = DivCeil(pos.y + ref_pos.ysize, kPatchTileDim);
+  };
+  size_t tx0;
+  size_t tx1;
+  size_t ty0;
+  size_t ty1;
+  for (const PatchPosition& pos : positions_) {
+    tile_range(pos, &tx0, &tx1, &ty0, &ty1);
+    num_tiles_x_ = std::max(num_tiles_x_, tx1);
+    num_tiles_y_ = std::max(num_tiles_y_, ty1);
+  }
+  // Count the patches of each tile, then place them in order.
+  tile_patch_start_.resize(num_tiles_x_ * num_tiles_y_ + 1);
+  for (const PatchPosition& pos : positions_) {
+    tile_range(pos, &tx0, &tx1, &ty0, &ty1);
+    for (size_t ty = ty0; ty < ty1; ty++) {
+      for (size_t tx = tx0; tx < tx1; tx++) {
+        tile_patch_start_[ty * num_tiles_x_ + tx + 1]++;
+      }
+    }
+  }
+  for (size_t i = 1; i < tile_patch_start_.size(); i++) {
+    tile_patch_start_[i] += tile_patch_start_[i - 1];
+  }
+  tile_patches_.resize(tile_patch_start_.back());
+  std::vector<size_t> next(tile_patch_start_.begin(),
+                           tile_patch_start_.end() - 1);
+  for (size_t i = 0; i < positions_.size(); i++) {
+    tile_range(positions_[i], &tx0, &tx1, &ty0, &ty1);
+    for (size_t ty = ty0; ty < ty1; ty++) {
+      for (size_t tx = tx0; tx < tx1; tx++) {
+        tile_patches_[next[ty * num_tiles_x_ + tx]++] = i;
+      }
+    }
+  }
+}
+
 std::vector<size_t> PatchDictionary::GetPatchesForRow(size_t y) const {
   std::vector<size_t> result;
   if (y < num_patches_.size() && num_patches_[y] > 0) {
@@ -319,37 +425,48 @@ Status PatchDictionary::AddOneRow(
     const std::vector<ExtraChannelInfo>& extra_channel_info) const {
   size_t num_ec = extra_channel_info.size();
   JXL_ENSURE(num_ec + 1 <= blendings_stride_);
+  const size_t ty = y / kPatchTileDim;
+  if (ty >= num_tiles_y_) return true;
   std::vector<const float*> fg_ptrs(3 + num_ec);
-  for (size_t pos_idx : GetPatchesForRow(y)) {
-    const size_t blending_idx = pos_idx * blendings_stride_;
-    const PatchPosition& pos = positions_[pos_idx];
-    const PatchReferencePosition& ref_pos = ref_positions_[pos.ref_pos_idx];
-    size_t by = pos.y;
-    size_t bx = pos.x;
-    size_t patch_xsize = ref_pos.xsize;
-    JXL_ENSURE(y >= by);
-    JXL_ENSURE(y < by + ref_pos.ysize);
-    size_t iy = y - by;
-    size_t ref = ref_pos.ref;
-    if (bx >= x0 + xsize) continue;
-    if (bx + patch_xsize < x0) continue;
-    size_t patch_x0 = std::max(bx, x0);
-    size_t patch_x1 = std::min(bx + patch_xsize, x0 + xsize);
-    for (size_t c = 0; c < 3; c++) {
-      fg_ptrs[c] = reference_frames_->at(ref).frame->color()->ConstPlaneRow(
-                       c, ref_pos.y0 + iy) +
-                   ref_pos.x0 + x0 - bx;
-    }
-    for (size_t i = 0; i < num_ec; i++) {
-      fg_ptrs[3 + i] =
-          reference_frames_->at(ref).frame->extra_channels()[i].ConstRow(
-              ref_pos.y0 + iy) +
-          ref_pos.x0 + x0 - bx;
+  // Each tile only draws its own columns, so that the patches that overlap
+  // a pixel are still applied in increasing order, which matters for the
+  // blend modes other than kAdd.
+  for (size_t tx = x0 / kPatchTileDim;
+       tx < num_tiles_x_ && tx * kPatchTileDim < x0 + xsize; tx++) {
+    const size_t tile_x0 = std::max(x0, tx * kPatchTileDim);
+    const size_t tile_x1 = std::min(x0 + xsize, (tx + 1) * kPatchTileDim);
+    const size_t tile = ty * num_tiles_x_ + tx;
+    for (size_t k = tile_patch_start_[tile]; k < tile_patch_start_[tile + 1];
+         k++) {
+      const size_t pos_idx = tile_patches_[k];
+      const size_t blending_idx = pos_idx * blendings_stride_;
+      const PatchPosition& pos = positions_[pos_idx];
+      const PatchReferencePosition& ref_pos = ref_positions_[pos.ref_pos_idx];
+      size_t by = pos.y;
+      size_t bx = pos.x;
+      size_t patch_xsize = ref_pos.xsize;
+      if (y < by || y >= by + ref_pos.ysize) continue;
+      size_t iy = y - by;
+      size_t ref = ref_pos.ref;
+      size_t patch_x0 = std::max(bx, tile_x0);
+      size_t patch_x1 = std::min(bx + patch_xsize, tile_x1);
+      if (patch_x0 >= patch_x1) continue;
+      for (size_t c = 0; c < 3; c++) {
+        fg_ptrs[c] = reference_frames_->at(ref).frame->color()->ConstPlaneRow(
+                         c, ref_pos.y0 + iy) +
+                     ref_pos.x0 + x0 - bx;
+      }
+      for (size_t i = 0; i < num_ec; i++) {
+        fg_ptrs[3 + i] =
+            reference_frames_->at(ref).frame->extra_channels()[i].ConstRow(
+                ref_pos.y0 + iy) +
+            ref_pos.x0 + x0 - bx;
+      }
+      JXL_RETURN_IF_ERROR(PerformBlending(
+          memory_manager_, inout, fg_ptrs.data(), inout, patch_x0 - x0,
+          patch_x1 - patch_x0, blendings_[blending_idx],
+          blendings_.data() + blending_idx + 1, extra_channel_info));
     }
-    JXL_RETURN_IF_ERROR(PerformBlending(
-        memory_manager_, inout, fg_ptrs.data(), inout, patch_x0 - x0,
-        patch_x1 - patch_x0, blendings_[blending_idx],
-        blendings_.data() + blending_idx + 1, extra_channel_info));
   }
   return true;
 }
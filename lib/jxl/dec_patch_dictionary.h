@@ -30,6 +30,27 @@ struct ReferceFrame {
   std::unique_ptr<ImageBundle> frame;
   // ImageBundle doesn't yet have a simple way to state it is in XYB.
   bool ib_is_in_xyb = false;
+  // If not empty, the pixels are stored here as 16-bit floats instead of in
+  // `frame`, which then only keeps the metadata: the three color channels,
+  // followed by the extra channels.
+  std::vector<Plane<uint16_t>> half_planes;
+
+  size_t xsize() const {
+    return half_planes.empty() ? frame->xsize() : half_planes[0].xsize();
+  }
+  size_t ysize() const {
+    return half_planes.empty() ? frame->ysize() : half_planes[0].ysize();
+  }
+
+  // Moves the pixels of `frame` to `half_planes`. Only for frames saved after
+  // the color transform, which are read by blending but never by patches.
+  Status StoreAsHalf();
+
+  // Returns the pixels of channel `c` (color channels, then extra channels)
+  // in row `y`, starting at `x0`. For frames stored as 16-bit floats, `xsize`
+  // of them are converted to `buffer`.
+  const float* ConstRow(size_t c, size_t y, size_t x0, size_t xsize,
+                        float* JXL_RESTRICT buffer) const;
 };
 
 enum class PatchBlendMode : uint8_t {
@@ -99,6 +120,9 @@ struct PatchPosition {
 
 struct PassesSharedState;
 
+// Size of the tiles of the index of patches used when drawing.
+constexpr size_t kPatchTileDim = 64;
+
 // Encoder-side helper class to encode the PatchesDictionary.
 class PatchDictionaryEncoder;
 
@@ -113,9 +137,11 @@ class PatchDictionary {
 
   bool HasAny() const { return !positions_.empty(); }
 
+  // If `max_patches_limit` is not 0, it further limits the number of patches
+  // on top of the limit derived from the frame size.
   Status Decode(JxlMemoryManager* memory_manager, BitReader* br, size_t xsize,
                 size_t ysize, size_t num_extra_channels,
-                bool* uses_extra_channels);
+                bool* uses_extra_channels, size_t max_patches_limit = 0);
 
   void Clear() {
     positions_.clear();
@@ -160,7 +186,18 @@ class PatchDictionary {
   std::vector<std::pair<size_t, size_t>> sorted_patches_y0_;
   std::vector<std::pair<size_t, size_t>> sorted_patches_y1_;
 
+  // Indices of the patches that overlap each tile of kPatchTileDim x
+  // kPatchTileDim pixels, in increasing order, for the tile
+  // `ty * num_tiles_x_ + tx` between tile_patch_start_[ty * num_tiles_x_ + tx]
+  // and the next start. Used by AddOneRow, which only needs to look at the
+  // patches near the pixels it draws.
+  std::vector<size_t> tile_patches_;
+  std::vector<size_t> tile_patch_start_;
+  size_t num_tiles_x_ = 0;
+  size_t num_tiles_y_ = 0;
+
   void ComputePatchTree();
+  void ComputePatchTiles();
 };
 
 }  // namespace jxl
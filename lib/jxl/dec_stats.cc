@@ -0,0 +1,91 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/dec_stats.h"
+
+#include <jxl/stats.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace jxl {
+
+namespace {
+
+// Render pipeline time of the calling thread, in nanoseconds.
+thread_local uint64_t render_nanos = 0;
+
+bool IsTimeKey(JxlDecoderStatsKey key) {
+  switch (key) {
+    case JXL_DEC_STATS_HEADERS_TIME_US:
+    case JXL_DEC_STATS_DC_TIME_US:
+    case JXL_DEC_STATS_AC_TIME_US:
+    case JXL_DEC_STATS_RENDER_TIME_US:
+    case JXL_DEC_STATS_CMS_TIME_US:
+    case JXL_DEC_STATS_FRAME_WALL_TIME_US:
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+void DecoderStats::UpdateMax(JxlDecoderStatsKey key, uint64_t value) {
+  uint64_t current = values_[key].load(std::memory_order_relaxed);
+  while (current < value &&
+         !values_[key].compare_exchange_weak(current, value,
+                                             std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t DecoderStats::Get(JxlDecoderStatsKey key) const {
+  uint64_t value = values_[key].load(std::memory_order_relaxed);
+  return IsTimeKey(key) ? value / 1000 : value;
+}
+
+void DecoderStats::Merge(const DecoderStats& other) {
+  for (size_t i = 0; i < values_.size(); ++i) {
+    const auto key = static_cast<JxlDecoderStatsKey>(i);
+    uint64_t value = other.values_[i].load(std::memory_order_relaxed);
+    if (key == JXL_DEC_STATS_PEAK_MEMORY_BYTES) {
+      UpdateMax(key, value);
+    } else {
+      Add(key, value);
+    }
+  }
+}
+
+void DecoderStats::AddRenderTime(JxlDecoderStatsKey key, uint64_t nanos) {
+  Add(key, nanos);
+  render_nanos += nanos;
+}
+
+uint64_t DecoderStatsNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+DecoderStatsTimer::DecoderStatsTimer(DecoderStats* stats,
+                                     JxlDecoderStatsKey key)
+    : stats_(stats),
+      key_(key),
+      start_(stats ? DecoderStatsNow() : 0),
+      render_start_(render_nanos) {}
+
+DecoderStatsTimer::~DecoderStatsTimer() {
+  if (!stats_) return;
+  uint64_t elapsed = DecoderStatsNow() - start_;
+  if (key_ != JXL_DEC_STATS_FRAME_WALL_TIME_US) {
+    elapsed -= std::min(elapsed, render_nanos - render_start_);
+  }
+  stats_->Add(key_, elapsed);
+}
+
+}  // namespace jxl
@@ -0,0 +1,61 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_DEC_STATS_H_
+#define LIB_JXL_DEC_STATS_H_
+
+// Counters behind JxlDecoderStats, see jxl/stats.h.
+
+#include <jxl/stats.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace jxl {
+
+// Updated concurrently by the threads of the decoder. Times are kept in
+// nanoseconds and reported in microseconds.
+class DecoderStats {
+ public:
+  void Add(JxlDecoderStatsKey key, uint64_t value) {
+    values_[key].fetch_add(value, std::memory_order_relaxed);
+  }
+  void UpdateMax(JxlDecoderStatsKey key, uint64_t value);
+  uint64_t Get(JxlDecoderStatsKey key) const;
+  void Merge(const DecoderStats& other);
+
+  // Adds the time of a render pipeline stage to `key`; it is then excluded
+  // from the enclosing DecoderStatsTimer of the calling thread.
+  void AddRenderTime(JxlDecoderStatsKey key, uint64_t nanos);
+
+ private:
+  std::array<std::atomic<uint64_t>, JXL_DEC_STATS_NUM_KEYS> values_{};
+};
+
+// Monotonic time in nanoseconds.
+uint64_t DecoderStatsNow();
+
+// Adds the lifetime of the object to `key` of `stats`, if not null. Except for
+// the wall time of frames, the render pipeline time of the same thread
+// meanwhile is excluded.
+class DecoderStatsTimer {
+ public:
+  DecoderStatsTimer(DecoderStats* stats, JxlDecoderStatsKey key);
+  ~DecoderStatsTimer();
+
+  DecoderStatsTimer(const DecoderStatsTimer&) = delete;
+  DecoderStatsTimer& operator=(const DecoderStatsTimer&) = delete;
+
+ private:
+  DecoderStats* stats_;
+  JxlDecoderStatsKey key_;
+  uint64_t start_;
+  uint64_t render_start_;
+};
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_DEC_STATS_H_
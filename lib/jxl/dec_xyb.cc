@@ -63,8 +63,9 @@ Status OpsinToLinearInplace(Image3F* JXL_RESTRICT inout, ThreadPool* pool,
     }
     return true;
   };
-  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, inout->ysize(), ThreadPool::NoInit,
-                                process_row, "OpsinToLinear"));
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, inout->ysize(), inout->xsize(),
+                                ThreadPool::NoInit, process_row,
+                                "OpsinToLinear"));
   return true;
 }
 
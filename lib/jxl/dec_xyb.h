@@ -67,6 +67,12 @@ struct OutputEncodingInfo {
   float desired_intensity_target;
   bool cms_set = false;
   JxlCmsInterface color_management_system;
+  // Grid points per channel of a 3D lookup table sampled from the CMS, or 0
+  // to call the CMS for every pixel.
+  size_t cms_lut_size = 0;
+  // Entries of a lookup table of the tone mapping luminance curve, or 0 to
+  // evaluate the curve for every pixel.
+  size_t tone_mapping_lut_size = 0;
 
   Status SetFromMetadata(const CodecMetadata& metadata);
   Status MaybeSetColorEncoding(const ColorEncoding& c_desired);
@@ -4,21 +4,31 @@
 // license that can be found in the LICENSE file.
 
 #include <jxl/decode.h>
+#include <jxl/stats.h>
 #include <jxl/types.h>
 #include <jxl/version.h>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <cinttypes>
+#include <deque>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/blending.h"
 #include "lib/jxl/padded_bytes.h"
 
 // JPEGXL_ENABLE_BOXES, JPEGXL_ENABLE_TRANSCODE_JPEG
@@ -27,7 +37,10 @@
 #if JPEGXL_ENABLE_BOXES || JPEGXL_ENABLE_TRANSCODE_JPEG
 #include "lib/jxl/box_content_decoder.h"
 #endif
+#include "lib/jxl/dec_external_image.h"
 #include "lib/jxl/dec_frame.h"
+#include "lib/jxl/dec_memory.h"
+#include "lib/jxl/dec_stats.h"
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
 #include "lib/jxl/decode_to_jpeg.h"
 #endif
@@ -38,6 +51,7 @@
 #include "lib/jxl/icc_codec.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/memory_manager_internal.h"
+#include "lib/jxl/toc.h"
 
 namespace {
 
@@ -156,6 +170,8 @@ size_t BitsPerChannel(JxlDataType data_type) {
       return 32;
     case JXL_TYPE_FLOAT16:
       return 16;
+    case JXL_TYPE_RGB10A2:
+      return 8;  // 32 bits for the 4 channels of a pixel
     default:
       return 0;  // signals unhandled JxlDataType
   }
@@ -291,6 +307,24 @@ std::vector<size_t> GetFrameDependencies(size_t index,
   return result;
 }
 
+// A keyframe listed in the frame index (jxli) box.
+struct FrameIndexEntry {
+  // Offset of the start of the frame in the codestream.
+  uint64_t codestream_offset;
+  // External index of the frame.
+  size_t frame;
+  // Animation ticks at which the frame starts, if has_ticks.
+  uint64_t ticks;
+  bool has_ticks;
+};
+
+// A frame decoded before the decoder reached it, see DecodeFramesAhead.
+struct FrameAhead {
+  // Offset of the start of the frame in the codestream.
+  uint64_t codestream_offset;
+  std::unique_ptr<jxl::ImageBundle> ib;
+};
+
 // Parameters for user-requested extra channel output.
 struct ExtraChannelOutput {
   JxlPixelFormat format;
@@ -342,14 +376,111 @@ typedef struct JxlDecoderFrameIndexBoxStruct {
   }
 } JxlDecoderFrameIndexBox;
 
+// Forwards to the memory manager of the application, and accounts the bytes
+// allocated through it meanwhile for JxlDecoderStats and the memory limit.
+// Memory allocated before it was installed is only forwarded when freed.
+class CountingMemoryManager {
+ public:
+  explicit CountingMemoryManager(const JxlMemoryManager& base) : base_(base) {
+    manager_.opaque = this;
+    manager_.alloc = &Alloc;
+    manager_.free = &Free;
+  }
+
+  const JxlMemoryManager& base() const { return base_; }
+  const JxlMemoryManager& manager() const { return manager_; }
+
+  // Starts updating the peak memory of `stats`, if not null, from the memory
+  // allocated now.
+  void SetStats(DecoderStats* stats) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_ = stats;
+    if (stats_) stats_->UpdateMax(JXL_DEC_STATS_PEAK_MEMORY_BYTES, allocated_);
+  }
+
+  // Allocations fail instead of exceeding `limit` bytes, unless it is 0.
+  void SetLimit(uint64_t limit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limit_ = limit;
+  }
+
+  uint64_t Allocated() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return allocated_;
+  }
+
+ private:
+  static void* Alloc(void* opaque, size_t size) {
+    auto* self = static_cast<CountingMemoryManager*>(opaque);
+    {
+      // Reserves the size, so that concurrent allocations stay in the limit.
+      std::lock_guard<std::mutex> lock(self->mutex_);
+      if (self->limit_ != 0 && size > self->limit_ - self->allocated_) {
+        return nullptr;
+      }
+      self->allocated_ += size;
+    }
+    void* address = self->base_.alloc(self->base_.opaque, size);
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    if (address == nullptr) {
+      self->allocated_ -= size;
+      return nullptr;
+    }
+    self->sizes_[address] = size;
+    if (self->stats_) {
+      self->stats_->UpdateMax(JXL_DEC_STATS_PEAK_MEMORY_BYTES,
+                              self->allocated_);
+    }
+    return address;
+  }
+
+  static void Free(void* opaque, void* address) {
+    auto* self = static_cast<CountingMemoryManager*>(opaque);
+    if (address == nullptr) return;
+    {
+      std::lock_guard<std::mutex> lock(self->mutex_);
+      auto it = self->sizes_.find(address);
+      if (it != self->sizes_.end()) {
+        self->allocated_ -= it->second;
+        self->sizes_.erase(it);
+      }
+    }
+    self->base_.free(self->base_.opaque, address);
+  }
+
+  JxlMemoryManager base_;
+  JxlMemoryManager manager_;
+  std::mutex mutex_;
+  std::unordered_map<void*, size_t> sizes_;
+  uint64_t allocated_ = 0;
+  uint64_t limit_ = 0;
+  DecoderStats* stats_ = nullptr;
+};
+
 }  // namespace jxl
 
+struct JxlDecoderStatsStruct {
+  jxl::DecoderStats stats;
+};
+
 // NOLINTNEXTLINE(clang-analyzer-optin.performance.Padding)
 struct JxlDecoderStruct {
   JxlDecoderStruct() = default;
 
   JxlMemoryManager memory_manager;
+  // Set by JxlDecoderCollectStats or JxlDecoderSetMemoryLimit, then
+  // memory_manager is its manager(). Kept until the decoder is destroyed, since
+  // it must outlive everything allocated through it, which is declared below.
+  std::unique_ptr<jxl::CountingMemoryManager> counting_memory_manager;
+  jxl::DecoderStats* stats;
+  size_t memory_limit;
+  jxl::DecoderLimits limits;
+  // Upsampling and restoration filter work of the frames so far, checked
+  // against limits.filter_work.
+  uint64_t used_filter_work;
   std::unique_ptr<jxl::ThreadPool> thread_pool;
+  // Fewer threads for the current frame, to stay under the memory limit.
+  std::unique_ptr<jxl::CappedThreadPool> capped_thread_pool;
 
   DecoderStage stage;
 
@@ -409,9 +540,47 @@ struct JxlDecoderStruct {
   // Settings
   bool keep_orientation;
   bool unpremul_alpha;
+  bool premul_alpha;
   bool render_spotcolors;
   bool coalescing;
+  bool reduced_precision_buffers;
+  // Extra channels marked as not needed, see JxlDecoderSetExtraChannelNeeded.
+  std::vector<bool> skipped_extra_channels;
+  // 0 for full fidelity, see JxlDecoderSetDecodingSpeed.
+  uint32_t decoding_speed;
+  // Whether the chroma is skipped for gray output, see JxlDecoderSetLumaOnly.
+  bool luma_only;
+  // See JxlDecoderSetCancelCallback.
+  JxlDecoderCancelCallback cancel_callback;
+  void* cancel_opaque;
+  jxl::RenderHook render_hook;
+  // Downscaling factor of the output of displayed frames, 1 or 8.
+  uint32_t downscaling;
   float desired_intensity_target;
+  // Grid points per channel of the CMS lookup table, 0 if disabled.
+  uint32_t cms_lut_size;
+  // Entries of the tone mapping lookup table, 0 if disabled.
+  uint32_t tone_mapping_lut_size;
+  // Set with JxlDecoderSetGainMap.
+  std::unique_ptr<jxl::GainMap> gain_map;
+  // Crop region in output (oriented) coordinates; disabled if crop_xsize is 0.
+  size_t crop_x0;
+  size_t crop_y0;
+  size_t crop_xsize;
+  size_t crop_ysize;
+  // Region whose groups are decoded first, in output (oriented) coordinates;
+  // disabled if priority_xsize is 0.
+  size_t priority_x0;
+  size_t priority_y0;
+  size_t priority_xsize;
+  size_t priority_ysize;
+  // Size to which displayed frames are resampled, in output (oriented)
+  // coordinates; disabled if output_xsize is 0.
+  size_t output_xsize;
+  size_t output_ysize;
+  JxlResampleFilter output_filter;
+  // Not reset by JxlDecoderReset.
+  bool keep_buffers;
 
   // Bitfield, for which informative events (JXL_DEC_BASIC_INFO, etc...) the
   // decoder returns a status. By default, do not return for any of the events,
@@ -437,10 +606,20 @@ struct JxlDecoderStruct {
 
   // Owned by the caller, buffer for preview or full resolution image.
   void* image_out_buffer;
+  // Owned by the caller, per-channel buffers for the full resolution image,
+  // used instead of image_out_buffer if not empty.
+  std::vector<JxlChannelBuffer> image_out_channels;
+  // Owned by the caller, Y, Cb and Cr planes of the current frame, used
+  // instead of any other image output if not empty.
+  std::vector<JxlChannelBuffer> ycbcr_planes_out;
+  JxlDataType ycbcr_planes_data_type;
   JxlImageOutInitCallback image_out_init_callback;
   JxlImageOutRunCallback image_out_run_callback;
   JxlImageOutDestroyCallback image_out_destroy_callback;
   void* image_out_init_opaque;
+  // Used instead of the callbacks above if set.
+  JxlImageOutTileCallback image_out_tile_callback;
+  void* image_out_tile_opaque;
   struct SimpleImageOutCallback {
     JxlImageOutCallback callback;
     void* opaque;
@@ -463,6 +642,9 @@ struct JxlDecoderStruct {
   std::unique_ptr<jxl::ImageBundle> ib;
 
   std::unique_ptr<jxl::PassesDecoderState> passes_state;
+  // Buffers kept from the previous image or reserved for the next one, moved
+  // into passes_state when it is created.
+  jxl::ReusableDecoderBuffers reusable_buffers;
   std::unique_ptr<jxl::FrameDecoder> frame_dec;
   size_t next_section;
   std::vector<char> section_processed;
@@ -506,6 +688,36 @@ struct JxlDecoderStruct {
   // vector, it must be treated as a required frame.
   std::vector<char> frame_required;
 
+  // The keyframes of the frame index box of the persistent input, which is only
+  // looked for once, used to jump to the nearest keyframe when skipping frames.
+  std::vector<FrameIndexEntry> frame_index;
+  bool frame_index_loaded;
+  // Whether frames were jumped over to a keyframe that was not seen before, so
+  // that frame_refs and frame_external_to_internal are no longer filled in.
+  bool frame_refs_incomplete;
+  // Amount of codestream bytes consumed so far.
+  uint64_t codestream_offset;
+  // Animation ticks at which the next frame starts, unless jumped to a
+  // keyframe with an unknown time.
+  uint64_t animation_ticks;
+  bool animation_ticks_known;
+  // Skipping the frames that end before skip_to_ticks.
+  bool skip_to_time;
+  uint64_t skip_to_ticks;
+  // Offset of the start of the current frame in the codestream.
+  uint64_t frame_start_offset;
+  // Position in the file of the first section of the current frame, if
+  // frame_sections_in_file, i.e. all its sections are in the current box.
+  uint64_t frame_sections_file_pos;
+  bool frame_sections_in_file;
+
+  // Maximum amount of independent frames decoded at once, see
+  // JxlDecoderSetParallelFrames.
+  size_t parallel_frames;
+  // The next frames, starting with the current one, if they were decoded
+  // ahead.
+  std::deque<FrameAhead> frames_ahead;
+
   // Codestream input data is copied here temporarily when the decoder needs
   // more input bytes to process the next part of the stream. We copy the input
   // data in order to be able to release it all through the API it when
@@ -541,6 +753,12 @@ struct JxlDecoderStruct {
   size_t recon_exif_size;  // Expected exif size as read from the jbrd box
   size_t recon_xmp_size;   // Expected exif size as read from the jbrd box
   JpegReconStage recon_output_jpeg;
+  // Whether ib->jpeg_data holds the coefficients of the decoded JPEG
+  // reconstruction frame, for JxlDecoderGetJPEGCoefficients.
+  bool jpeg_coefficients_ready;
+  // Whether the JPEG reconstruction may be written while the frame is
+  // decoded, see JxlDecoderSetStreamingJPEGReconstruction.
+  bool stream_jpeg_reconstruction;
 
   bool JbrdNeedMoreBoxes() const {
     // jbrd box wants exif but exif box not yet seen
@@ -554,6 +772,10 @@ struct JxlDecoderStruct {
   const uint8_t* next_in;
   size_t avail_in;
   bool input_closed;
+  // The whole file, if given with JxlDecoderSetPersistentInput: it stays
+  // valid, so sections in later codestream boxes are read from it in place.
+  const uint8_t* persistent_input;
+  size_t persistent_input_size;
 
   void AdvanceInput(size_t size) {
     JXL_DASSERT(avail_in >= size);
@@ -572,6 +794,7 @@ struct JxlDecoderStruct {
   }
 
   void AdvanceCodestream(size_t size) {
+    codestream_offset += size;
     size_t avail_codestream = AvailableCodestream();
     if (codestream_copy.empty()) {
       if (size <= avail_codestream) {
@@ -678,6 +901,51 @@ bool CheckSizeLimit(JxlDecoder* dec, size_t xsize, size_t ysize) {
   return true;
 }
 
+// Returns x * y, or the maximum value if it overflows.
+uint64_t SaturatingMul(uint64_t x, uint64_t y) {
+  if (x != 0 && y > std::numeric_limits<uint64_t>::max() / x) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  return x * y;
+}
+
+bool WithinPixelLimit(const JxlDecoder* dec, uint64_t xsize, uint64_t ysize) {
+  return dec->limits.pixels == 0 ||
+         SaturatingMul(xsize, ysize) <= dec->limits.pixels;
+}
+
+// Checks the frame header against the limits set with JxlDecoderSetLimit,
+// before the frame is decoded.
+JxlDecoderStatus CheckFrameLimits(JxlDecoder* dec,
+                                  const jxl::FrameHeader& frame_header,
+                                  const jxl::FrameDimensions& frame_dim) {
+  if (!WithinPixelLimit(dec, frame_dim.xsize_upsampled,
+                        frame_dim.ysize_upsampled)) {
+    return JXL_INPUT_ERROR("frame exceeds the pixel limit");
+  }
+  if (dec->limits.frames != 0 && !dec->preview_frame &&
+      dec->internal_frames >= dec->limits.frames) {
+    return JXL_INPUT_ERROR("image exceeds the frame limit");
+  }
+  if (dec->limits.filter_work != 0) {
+    const uint64_t num_pixels = SaturatingMul(frame_dim.xsize, frame_dim.ysize);
+    const auto& loop_filter = frame_header.loop_filter;
+    uint64_t work = SaturatingMul(
+        num_pixels, loop_filter.epf_iters + (loop_filter.gab ? 1 : 0));
+    if (frame_header.upsampling != 1) {
+      const uint64_t upsampled = SaturatingMul(frame_dim.xsize_upsampled,
+                                               frame_dim.ysize_upsampled);
+      work = std::min(work, std::numeric_limits<uint64_t>::max() - upsampled);
+      work += upsampled;
+    }
+    if (work > dec->limits.filter_work - dec->used_filter_work) {
+      return JXL_INPUT_ERROR("image exceeds the filter work limit");
+    }
+    dec->used_filter_work += work;
+  }
+  return JXL_DEC_SUCCESS;
+}
+
 }  // namespace
 
 // Resets the state that must be reset for both Rewind and Reset
@@ -720,6 +988,9 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->recon_exif_size = 0;
   dec->recon_xmp_size = 0;
   dec->recon_output_jpeg = JpegReconStage::kNone;
+  dec->jpeg_coefficients_ready = false;
+  dec->jpeg_decoder.SetKeepJpegData(false);
+  dec->jpeg_decoder.StopStream();
 #endif
 
   dec->events_wanted = dec->orig_events_wanted;
@@ -729,17 +1000,28 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->downsampling_target = 8;
   dec->image_out_buffer_set = false;
   dec->image_out_buffer = nullptr;
+  dec->image_out_channels.clear();
+  dec->ycbcr_planes_out.clear();
   dec->image_out_init_callback = nullptr;
   dec->image_out_run_callback = nullptr;
   dec->image_out_destroy_callback = nullptr;
   dec->image_out_init_opaque = nullptr;
+  dec->image_out_tile_callback = nullptr;
+  dec->image_out_tile_opaque = nullptr;
   dec->image_out_size = 0;
   dec->image_out_bit_depth.type = JXL_BIT_DEPTH_FROM_PIXEL_FORMAT;
   dec->extra_channel_output.clear();
   dec->next_in = nullptr;
   dec->avail_in = 0;
   dec->input_closed = false;
+  dec->persistent_input = nullptr;
+  dec->persistent_input_size = 0;
 
+  if (!dec->keep_buffers) {
+    dec->reusable_buffers = jxl::ReusableDecoderBuffers();
+  } else if (dec->passes_state) {
+    dec->passes_state->ReleaseBuffers(&dec->reusable_buffers);
+  }
   dec->passes_state.reset();
   dec->frame_dec.reset();
   dec->next_section = 0;
@@ -763,23 +1045,71 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->skipping_frame = false;
   dec->internal_frames = 0;
   dec->external_frames = 0;
+  dec->used_filter_work = 0;
+  dec->frame_refs_incomplete = false;
+  dec->codestream_offset = 0;
+  dec->animation_ticks = 0;
+  dec->animation_ticks_known = true;
+  dec->skip_to_time = false;
+  dec->skip_to_ticks = 0;
+  dec->frame_start_offset = 0;
+  dec->frame_sections_file_pos = 0;
+  dec->frame_sections_in_file = false;
+  dec->frames_ahead.clear();
 }
 
 void JxlDecoderReset(JxlDecoder* dec) {
   JxlDecoderRewindDecodingState(dec);
 
+  dec->capped_thread_pool.reset();
   dec->thread_pool.reset();
   dec->keep_orientation = false;
   dec->unpremul_alpha = false;
+  dec->premul_alpha = false;
   dec->render_spotcolors = true;
   dec->coalescing = true;
+  dec->reduced_precision_buffers = false;
+  dec->skipped_extra_channels.clear();
+  dec->decoding_speed = 0;
+  dec->luma_only = false;
+  dec->cancel_callback = nullptr;
+  dec->cancel_opaque = nullptr;
+  dec->render_hook = jxl::RenderHook();
+  dec->downscaling = 1;
+  dec->parallel_frames = 0;
   dec->desired_intensity_target = 0;
+  dec->cms_lut_size = 0;
+  dec->tone_mapping_lut_size = 0;
+  dec->gain_map.reset();
+  dec->crop_x0 = 0;
+  dec->crop_y0 = 0;
+  dec->crop_xsize = 0;
+  dec->crop_ysize = 0;
+  dec->priority_x0 = 0;
+  dec->priority_y0 = 0;
+  dec->priority_xsize = 0;
+  dec->priority_ysize = 0;
+  dec->output_xsize = 0;
+  dec->output_ysize = 0;
+  dec->output_filter = JXL_RESAMPLE_FILTER_BOX;
   dec->orig_events_wanted = 0;
   dec->events_wanted = 0;
   dec->frame_refs.clear();
   dec->frame_external_to_internal.clear();
   dec->frame_required.clear();
+  dec->frame_index.clear();
+  dec->frame_index_loaded = false;
   dec->decompress_boxes = false;
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  dec->stream_jpeg_reconstruction = false;
+#endif
+  dec->stats = nullptr;
+  dec->memory_limit = 0;
+  dec->limits = jxl::DecoderLimits();
+  if (dec->counting_memory_manager) {
+    dec->counting_memory_manager->SetStats(nullptr);
+    dec->counting_memory_manager->SetLimit(0);
+  }
 }
 
 JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
@@ -793,6 +1123,7 @@ JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
   // Placement new constructor on allocated memory
   JxlDecoder* dec = new (alloc) JxlDecoder();
   dec->memory_manager = local_memory_manager;
+  dec->keep_buffers = false;
 
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
   if (!memory_manager) {
@@ -811,7 +1142,9 @@ JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
 
 void JxlDecoderDestroy(JxlDecoder* dec) {
   if (dec) {
-    JxlMemoryManager local_memory_manager = dec->memory_manager;
+    JxlMemoryManager local_memory_manager =
+        dec->counting_memory_manager ? dec->counting_memory_manager->base()
+                                     : dec->memory_manager;
     // Call destructor directly since custom free function is used.
     dec->~JxlDecoder();
     jxl::MemoryManagerFree(&local_memory_manager, dec);
@@ -852,6 +1185,27 @@ void JxlDecoderSkipFrames(JxlDecoder* dec, size_t amount) {
   }
 }
 
+JxlDecoderStatus JxlDecoderSkipToTime(JxlDecoder* dec, uint64_t ticks) {
+  if (!dec->got_basic_info || !dec->metadata.m.have_animation) {
+    return JXL_API_ERROR("can only skip to a time in an animation");
+  }
+  if (!dec->coalescing) {
+    return JXL_API_ERROR("can only skip to a time with coalescing enabled");
+  }
+  if (!dec->animation_ticks_known) {
+    return JXL_API_ERROR("time of the current frame is not known");
+  }
+  if (ticks < dec->animation_ticks) {
+    return JXL_API_ERROR("can only skip to a time after the current frame");
+  }
+  dec->skip_to_time = true;
+  dec->skip_to_ticks = ticks;
+  // The frame skipped to is not known yet, so all frames that can be
+  // referenced are decoded.
+  dec->frame_required.clear();
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderSkipCurrentFrame(JxlDecoder* dec) {
   if (dec->frame_stage != FrameStage::kFull) {
     return JXL_API_ERROR("JxlDecoderSkipCurrentFrame called at the wrong time");
@@ -861,6 +1215,8 @@ JxlDecoderStatus JxlDecoderSkipCurrentFrame(JxlDecoder* dec) {
   dec->AdvanceCodestream(dec->remaining_frame_size);
   if (dec->is_last_of_still) {
     dec->image_out_buffer_set = false;
+    dec->image_out_channels.clear();
+    dec->ycbcr_planes_out.clear();
   }
   return JXL_DEC_SUCCESS;
 }
@@ -912,6 +1268,15 @@ JxlDecoderStatus JxlDecoderSetUnpremultiplyAlpha(JxlDecoder* dec,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetPremultiplyAlpha(JxlDecoder* dec,
+                                               JXL_BOOL premul_alpha) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set premul_alpha option before starting");
+  }
+  dec->premul_alpha = FROM_JXL_BOOL(premul_alpha);
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderSetRenderSpotcolors(JxlDecoder* dec,
                                                JXL_BOOL render_spotcolors) {
   if (dec->stage != DecoderStage::kInited) {
@@ -921,6 +1286,137 @@ JxlDecoderStatus JxlDecoderSetRenderSpotcolors(JxlDecoder* dec,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetReducedPrecisionBuffers(JxlDecoder* dec,
+                                                      JXL_BOOL enabled) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR(
+        "Must set reduced_precision_buffers option before starting");
+  }
+  dec->reduced_precision_buffers = FROM_JXL_BOOL(enabled);
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetDecodingSpeed(JxlDecoder* dec, uint32_t speed) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set decoding speed option before starting");
+  }
+  if (speed > 2) {
+    return JXL_API_ERROR("Unsupported decoding speed");
+  }
+  dec->decoding_speed = speed;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetLumaOnly(JxlDecoder* dec, JXL_BOOL enabled) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set luma only option before starting");
+  }
+  dec->luma_only = FROM_JXL_BOOL(enabled);
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetCancelCallback(JxlDecoder* dec,
+                                             JxlDecoderCancelCallback callback,
+                                             void* opaque) {
+  dec->cancel_callback = callback;
+  dec->cancel_opaque = opaque;
+  if (dec->frame_dec) dec->frame_dec->SetCancelCallback(callback, opaque);
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetRenderHook(
+    JxlDecoder* dec, JxlImageOutInitCallback init_callback,
+    JxlRenderHookRunCallback run_callback,
+    JxlImageOutDestroyCallback destroy_callback, void* init_opaque) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set render hook before starting");
+  }
+  if (init_callback == nullptr || run_callback == nullptr) {
+    return JXL_API_ERROR("Init and run callbacks are required");
+  }
+  dec->render_hook.init = init_callback;
+  dec->render_hook.run = run_callback;
+  dec->render_hook.destroy = destroy_callback;
+  dec->render_hook.init_opaque = init_opaque;
+  return JXL_DEC_SUCCESS;
+}
+
+namespace {
+void EnsureCountingMemoryManager(JxlDecoder* dec) {
+  if (dec->counting_memory_manager) return;
+  dec->counting_memory_manager =
+      jxl::make_unique<jxl::CountingMemoryManager>(dec->memory_manager);
+  dec->memory_manager = dec->counting_memory_manager->manager();
+}
+}  // namespace
+
+JxlDecoderStatus JxlDecoderCollectStats(JxlDecoder* dec,
+                                        JxlDecoderStats* stats) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must collect stats before starting");
+  }
+  if (stats) EnsureCountingMemoryManager(dec);
+  dec->stats = stats ? &stats->stats : nullptr;
+  if (dec->counting_memory_manager) {
+    dec->counting_memory_manager->SetStats(dec->stats);
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetMemoryLimit(JxlDecoder* dec,
+                                          size_t max_bytes) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set memory limit before starting");
+  }
+  if (max_bytes != 0) EnsureCountingMemoryManager(dec);
+  dec->memory_limit = max_bytes;
+  if (dec->counting_memory_manager) {
+    dec->counting_memory_manager->SetLimit(max_bytes);
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetLimit(JxlDecoder* dec, JxlDecoderLimit limit,
+                                    uint64_t value) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set limits before starting");
+  }
+  switch (limit) {
+    case JXL_DEC_LIMIT_PIXELS:
+      dec->limits.pixels = value;
+      break;
+    case JXL_DEC_LIMIT_FRAMES:
+      dec->limits.frames = value;
+      break;
+    case JXL_DEC_LIMIT_TREE_NODES:
+      dec->limits.tree_nodes = value;
+      break;
+    case JXL_DEC_LIMIT_SPLINE_CONTROL_POINTS:
+      dec->limits.spline_control_points = value;
+      break;
+    case JXL_DEC_LIMIT_PATCHES:
+      dec->limits.patches = value;
+      break;
+    case JXL_DEC_LIMIT_FILTER_WORK:
+      dec->limits.filter_work = value;
+      break;
+    default:
+      return JXL_API_ERROR("Unknown limit");
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetDownscaling(JxlDecoder* dec, uint32_t factor) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set downscaling option before starting");
+  }
+  if (factor != 1 && factor != 8) {
+    return JXL_API_ERROR("Unsupported downscaling factor");
+  }
+  dec->downscaling = factor;
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec, JXL_BOOL coalescing) {
   if (dec->stage != DecoderStage::kInited) {
     return JXL_API_ERROR("Must set coalescing option before starting");
@@ -929,7 +1425,234 @@ JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec, JXL_BOOL coalescing) {
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetParallelFrames(JxlDecoder* dec,
+                                             size_t max_frames) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set parallel frames before starting");
+  }
+  dec->parallel_frames = max_frames;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetCropRegion(JxlDecoder* dec, uint32_t x0,
+                                         uint32_t y0, uint32_t xsize,
+                                         uint32_t ysize) {
+  if (dec->frame_stage == FrameStage::kFull || dec->image_out_buffer_set) {
+    return JXL_API_ERROR("Must set crop region before the image out buffer");
+  }
+  if (xsize == 0 || ysize == 0) {
+    x0 = y0 = xsize = ysize = 0;
+  } else if (dec->got_basic_info) {
+    size_t image_xsize = dec->metadata.oriented_xsize(dec->keep_orientation);
+    size_t image_ysize = dec->metadata.oriented_ysize(dec->keep_orientation);
+    if (x0 >= image_xsize || y0 >= image_ysize) {
+      return JXL_API_ERROR("Crop region outside of the image");
+    }
+  }
+  dec->crop_x0 = x0;
+  dec->crop_y0 = y0;
+  dec->crop_xsize = xsize;
+  dec->crop_ysize = ysize;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetPriorityRegion(JxlDecoder* dec, uint32_t x0,
+                                             uint32_t y0, uint32_t xsize,
+                                             uint32_t ysize) {
+  if (xsize == 0 || ysize == 0) x0 = y0 = xsize = ysize = 0;
+  dec->priority_x0 = x0;
+  dec->priority_y0 = y0;
+  dec->priority_xsize = xsize;
+  dec->priority_ysize = ysize;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetOutputSize(JxlDecoder* dec, uint32_t xsize,
+                                         uint32_t ysize,
+                                         JxlResampleFilter filter) {
+  if (dec->frame_stage == FrameStage::kFull || dec->image_out_buffer_set) {
+    return JXL_API_ERROR("Must set output size before the image out buffer");
+  }
+  if (filter != JXL_RESAMPLE_FILTER_BOX &&
+      filter != JXL_RESAMPLE_FILTER_LANCZOS3) {
+    return JXL_API_ERROR("Unsupported resample filter");
+  }
+  if (xsize == 0 || ysize == 0) xsize = ysize = 0;
+  dec->output_xsize = xsize;
+  dec->output_ysize = ysize;
+  dec->output_filter = filter;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetKeepBuffers(JxlDecoder* dec,
+                                          JXL_BOOL keep_buffers) {
+  dec->keep_buffers = FROM_JXL_BOOL(keep_buffers);
+  if (!dec->keep_buffers) dec->reusable_buffers = jxl::ReusableDecoderBuffers();
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderReserveBuffers(JxlDecoder* dec,
+                                          const JxlBasicInfo* info) {
+  if (dec->frame_stage != FrameStage::kHeader) {
+    return JXL_API_ERROR("Must reserve buffers before or between frames");
+  }
+  // The frame buffers have the dimensions before applying the orientation.
+  size_t xsize = info->orientation > 4 ? info->ysize : info->xsize;
+  size_t ysize = info->orientation > 4 ? info->xsize : info->ysize;
+  if (dec->passes_state) {
+    dec->passes_state->ReleaseBuffers(&dec->reusable_buffers);
+  }
+  jxl::Status status = jxl::PassesDecoderState::ReserveBuffers(
+      &dec->memory_manager, xsize, ysize, &dec->reusable_buffers);
+  if (dec->passes_state) {
+    dec->passes_state->AdoptBuffers(&dec->reusable_buffers);
+  }
+  if (!status) return JXL_API_ERROR("failed to allocate buffers");
+  return JXL_DEC_SUCCESS;
+}
+
 namespace {
+// Decodes the first displayed frame of the item with `dec`, which is reset
+// first.
+JxlDecoderStatus DecodeBatchItem(JxlDecoder* dec, const JxlPixelFormat* format,
+                                 JxlDecoderBatchItem* item) {
+  JxlDecoderReset(dec);
+  if (JxlDecoderSubscribeEvents(
+          dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS ||
+      JxlDecoderSetInput(dec, item->data, item->size) != JXL_DEC_SUCCESS) {
+    return JXL_DEC_ERROR;
+  }
+  JxlDecoderCloseInput(dec);
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    if (status == JXL_DEC_BASIC_INFO) {
+      item->xsize = dec->metadata.oriented_xsize(dec->keep_orientation);
+      item->ysize = dec->metadata.oriented_ysize(dec->keep_orientation);
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      status = JxlDecoderSetImageOutBuffer(dec, format, item->buffer,
+                                           item->buffer_size);
+      if (status != JXL_DEC_SUCCESS) return JXL_DEC_ERROR;
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      return JXL_DEC_SUCCESS;
+    } else {
+      return JXL_DEC_ERROR;
+    }
+  }
+}
+}  // namespace
+
+JxlDecoderStatus JxlDecoderDecodeBatch(const JxlMemoryManager* memory_manager,
+                                       JxlParallelRunner parallel_runner,
+                                       void* parallel_runner_opaque,
+                                       const JxlPixelFormat* format,
+                                       JxlDecoderBatchItem* items,
+                                       size_t num_items) {
+  if (num_items > std::numeric_limits<uint32_t>::max()) {
+    return JXL_API_ERROR("too many images in the batch");
+  }
+  jxl::ThreadPool pool(parallel_runner, parallel_runner_opaque);
+  // One decoder per thread, which keeps its buffers between images.
+  std::vector<std::unique_ptr<JxlDecoder, void (*)(JxlDecoder*)>> decoders;
+  const auto init_decoders = [&](size_t num_threads) -> jxl::Status {
+    for (size_t i = 0; i < num_threads; ++i) {
+      decoders.emplace_back(JxlDecoderCreate(memory_manager),
+                            &JxlDecoderDestroy);
+      if (!decoders.back()) return JXL_FAILURE("failed to create a decoder");
+      JxlDecoderSetKeepBuffers(decoders.back().get(), JXL_TRUE);
+    }
+    return true;
+  };
+  std::atomic<bool> all_decoded{true};
+  const auto decode_item = [&](const uint32_t i, size_t thread) -> jxl::Status {
+    items[i].status =
+        DecodeBatchItem(decoders[thread].get(), format, &items[i]);
+    if (items[i].status != JXL_DEC_SUCCESS) all_decoded = false;
+    return true;
+  };
+  if (!jxl::RunOnPool(&pool, 0, num_items, init_decoders, decode_item,
+                      "DecodeBatch")) {
+    return JXL_API_ERROR("failed to decode the batch");
+  }
+  return all_decoded ? JXL_DEC_SUCCESS : JXL_DEC_ERROR;
+}
+
+namespace {
+// Creates the decoder state if needed, giving it the buffers kept from a
+// previous image or reserved with JxlDecoderReserveBuffers.
+void EnsurePassesState(JxlDecoder* dec) {
+  if (dec->passes_state) return;
+  dec->passes_state =
+      jxl::make_unique<jxl::PassesDecoderState>(&dec->memory_manager);
+  dec->passes_state->AdoptBuffers(&dec->reusable_buffers);
+  dec->passes_state->stats = dec->stats;
+  dec->passes_state->limits = &dec->limits;
+}
+
+// Returns whether the crop region applies to the current frame. If so,
+// `crop` is set to the region clamped to the image, in output coordinates.
+bool GetCropRegion(const JxlDecoder* dec, jxl::Rect* crop) {
+  if (dec->crop_xsize == 0 || !dec->coalescing ||
+      dec->frame_header->nonserialized_is_preview) {
+    return false;
+  }
+  *crop = jxl::Rect(dec->crop_x0, dec->crop_y0, dec->crop_xsize,
+                    dec->crop_ysize)
+              .Crop(dec->metadata.oriented_xsize(dec->keep_orientation),
+                    dec->metadata.oriented_ysize(dec->keep_orientation));
+  return true;
+}
+
+// Converts a crop region in output coordinates to image coordinates before
+// applying the orientation.
+jxl::Rect UnorientCropRegion(const JxlDecoder* dec, const jxl::Rect& crop) {
+  if (dec->keep_orientation) return crop;
+  size_t orientation = dec->metadata.m.orientation;
+  size_t W = dec->metadata.oriented_xsize(false);
+  size_t H = dec->metadata.oriented_ysize(false);
+  size_t x0 = crop.x0();
+  size_t y0 = crop.y0();
+  size_t xsize = crop.xsize();
+  size_t ysize = crop.ysize();
+  // Inverse of the crop offset orientation in JxlDecoderGetFrameHeader.
+  size_t o = (orientation - 1) & 3;
+  if (o > 0 && o < 3) x0 = W - xsize - x0;
+  if (o > 1) y0 = H - ysize - y0;
+  if (orientation > 4) {
+    std::swap(x0, y0);
+    std::swap(xsize, ysize);
+  }
+  return jxl::Rect(x0, y0, xsize, ysize);
+}
+
+// Passes the priority region to the frame decoder, in frame coordinates.
+void SetFramePriorityRect(JxlDecoder* dec) {
+  if (dec->priority_xsize == 0 ||
+      dec->frame_header->nonserialized_is_preview) {
+    dec->frame_dec->SetPriorityRect(jxl::Rect());
+    return;
+  }
+  jxl::Rect region =
+      UnorientCropRegion(dec, jxl::Rect(dec->priority_x0, dec->priority_y0,
+                                        dec->priority_xsize,
+                                        dec->priority_ysize)
+                                  .Crop(dec->metadata.oriented_xsize(
+                                            dec->keep_orientation),
+                                        dec->metadata.oriented_ysize(
+                                            dec->keep_orientation)));
+  jxl::RectT<ssize_t> rect(region.x0(), region.y0(), region.xsize(),
+                           region.ysize());
+  const jxl::FrameHeader& header = *dec->frame_header;
+  if (dec->coalescing) {
+    // The region is given in image coordinates.
+    rect = rect.Translate(-header.frame_origin.x0, -header.frame_origin.y0);
+  }
+  const jxl::FrameDimensions frame_dim = header.ToFrameDimensions();
+  rect = rect.Intersection(jxl::RectT<ssize_t>(0, 0, frame_dim.xsize_upsampled,
+                                               frame_dim.ysize_upsampled));
+  dec->frame_dec->SetPriorityRect(
+      jxl::Rect(rect.x0(), rect.y0(), rect.xsize(), rect.ysize()));
+}
+
 // helper function to get the dimensions of the current image buffer
 void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
   if (dec->frame_header->nonserialized_is_preview) {
@@ -937,8 +1660,24 @@ void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
     ysize = dec->metadata.oriented_preview_ysize(dec->keep_orientation);
     return;
   }
+  if (dec->output_xsize != 0) {
+    xsize = dec->output_xsize;
+    ysize = dec->output_ysize;
+    return;
+  }
+  jxl::Rect crop;
+  if (GetCropRegion(dec, &crop)) {
+    xsize = crop.xsize();
+    ysize = crop.ysize();
+    return;
+  }
   xsize = dec->metadata.oriented_xsize(dec->keep_orientation);
   ysize = dec->metadata.oriented_ysize(dec->keep_orientation);
+  if (dec->downscaling != 1) {
+    xsize = jxl::DivCeil(xsize, dec->downscaling);
+    ysize = jxl::DivCeil(ysize, dec->downscaling);
+    return;
+  }
   if (!dec->coalescing) {
     const auto frame_dim = dec->frame_header->ToFrameDimensions();
     xsize = frame_dim.xsize_upsampled;
@@ -951,6 +1690,83 @@ void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
 }
 }  // namespace
 
+static JxlDecoderStatus ParseBoxHeader(const uint8_t* in, size_t size,
+                                       size_t pos, size_t file_pos,
+                                       JxlBoxType type, uint64_t* box_size,
+                                       uint64_t* header_size) {
+  if (OutOfBounds(pos, 8, size)) {
+    *header_size = 8;
+    return JXL_DEC_NEED_MORE_INPUT;
+  }
+  size_t box_start = pos;
+  // Box size, including this header itself.
+  *box_size = LoadBE32(in + pos);
+  pos += 4;
+  memcpy(type, in + pos, 4);
+  pos += 4;
+  if (*box_size == 1) {
+    *header_size = 16;
+    if (OutOfBounds(pos, 8, size)) return JXL_DEC_NEED_MORE_INPUT;
+    *box_size = LoadBE64(in + pos);
+    pos += 8;
+  }
+  *header_size = pos - box_start;
+  if (*box_size > 0 && *box_size < *header_size) {
+    return JXL_INPUT_ERROR("invalid box size");
+  }
+  if (file_pos + *box_size < file_pos) {
+    return JXL_INPUT_ERROR("Box size overflow");
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlScanBoxes(const uint8_t* data, size_t size,
+                              JxlBoxIndexEntry* entries, size_t max_entries,
+                              size_t* num_entries) {
+  *num_entries = 0;
+  JxlSignature sig = JxlSignatureCheck(data, size);
+  if (sig == JXL_SIG_NOT_ENOUGH_BYTES) return JXL_DEC_NEED_MORE_INPUT;
+  if (sig == JXL_SIG_INVALID) return JXL_INPUT_ERROR("invalid signature");
+  if (sig == JXL_SIG_CODESTREAM) return JXL_DEC_SUCCESS;
+  // The signature is itself the first box.
+  size_t pos = 0;
+  while (pos < size) {
+    JxlBoxIndexEntry entry;
+    uint64_t box_size;
+    uint64_t header_size;
+    JxlDecoderStatus status = ParseBoxHeader(data, size, pos, pos, entry.type,
+                                             &box_size, &header_size);
+    if (status != JXL_DEC_SUCCESS) return status;
+    entry.compressed = TO_JXL_BOOL(memcmp(entry.type, "brob", 4) == 0);
+    entry.until_eof = TO_JXL_BOOL(box_size == 0);
+    entry.box_offset = pos;
+    entry.contents_offset = pos + header_size;
+    const uint64_t end = box_size == 0 ? size : pos + box_size;
+    if (end < entry.contents_offset) {
+      return JXL_INPUT_ERROR("box contents end before the box header");
+    }
+    if (entry.compressed) {
+      if (end - entry.contents_offset < 4) {
+        return JXL_INPUT_ERROR("brob box is too small");
+      }
+      if (OutOfBounds(entry.contents_offset, 4, size)) {
+        return JXL_DEC_NEED_MORE_INPUT;
+      }
+      memcpy(entry.type, data + entry.contents_offset, 4);
+      if (memcmp(entry.type, "brob", 4) == 0) {
+        return JXL_INPUT_ERROR("recursive brob box");
+      }
+      entry.contents_offset += 4;
+    }
+    entry.contents_size = end - entry.contents_offset;
+    if (*num_entries < max_entries) entries[*num_entries] = entry;
+    ++*num_entries;
+    if (end >= size) break;
+    pos = end;
+  }
+  return JXL_DEC_SUCCESS;
+}
+
 namespace jxl {
 namespace {
 
@@ -1023,6 +1839,10 @@ JxlDecoderStatus JxlDecoderReadBasicInfo(JxlDecoder* dec) {
                       dec->metadata.size.ysize())) {
     return JXL_INPUT_ERROR("image is too large");
   }
+  if (!WithinPixelLimit(dec, dec->metadata.size.xsize(),
+                        dec->metadata.size.ysize())) {
+    return JXL_INPUT_ERROR("image exceeds the pixel limit");
+  }
 
   return JXL_DEC_SUCCESS;
 }
@@ -1087,10 +1907,7 @@ JxlDecoderStatus JxlDecoderReadAllHeaders(JxlDecoder* dec) {
   dec->AdvanceCodestream(reader->TotalBitsConsumed() / jxl::kBitsPerByte);
   dec->codestream_bits_ahead = 0;
 
-  if (!dec->passes_state) {
-    dec->passes_state =
-        jxl::make_unique<jxl::PassesDecoderState>(&dec->memory_manager);
-  }
+  EnsurePassesState(dec);
 
   JXL_API_RETURN_IF_ERROR(
       dec->passes_state->output_encoding_info.SetFromMetadata(dec->metadata));
@@ -1098,74 +1915,592 @@ JxlDecoderStatus JxlDecoderReadAllHeaders(JxlDecoder* dec) {
     dec->passes_state->output_encoding_info.desired_intensity_target =
         dec->desired_intensity_target;
   }
+  dec->passes_state->output_encoding_info.cms_lut_size = dec->cms_lut_size;
+  dec->passes_state->output_encoding_info.tone_mapping_lut_size =
+      dec->tone_mapping_lut_size;
   dec->image_metadata = dec->metadata.m;
 
   return JXL_DEC_SUCCESS;
 }
 
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+// Sets the Exif and XMP metadata read from the boxes in the app markers of the
+// JPEG reconstruction data.
+JxlDecoderStatus SetJPEGReconstructionMetadata(JxlDecoder* dec) {
+  jxl::jpeg::JPEGData* jpeg_data = dec->ib->jpeg_data.get();
+  if (dec->recon_exif_size) {
+    JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetExif(
+        dec->exif_metadata.data(), dec->exif_metadata.size(), jpeg_data);
+    if (status != JXL_DEC_SUCCESS) return status;
+  }
+  if (dec->recon_xmp_size) {
+    JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetXmp(
+        dec->xmp_metadata.data(), dec->xmp_metadata.size(), jpeg_data);
+    if (status != JXL_DEC_SUCCESS) return status;
+  }
+  return JXL_DEC_SUCCESS;
+}
+#endif
+
+// Returns the contents of the jxlp boxes that follow the codestream box being
+// read in the persistent input.
+std::vector<Span<const uint8_t>> NextPersistentCodestreamParts(
+    const JxlDecoder* dec) {
+  std::vector<Span<const uint8_t>> parts;
+  if (!dec->persistent_input || !dec->have_container ||
+      dec->box_contents_unbounded || memcmp(dec->box_type, "jxlp", 4) != 0 ||
+      !dec->codestream_copy.empty() ||
+      dec->file_pos + dec->AvailableCodestream() != dec->box_contents_end) {
+    return parts;
+  }
+  const uint8_t* in = dec->persistent_input;
+  const size_t size = dec->persistent_input_size;
+  size_t pos = dec->box_contents_end;
+  while (pos < size) {
+    JxlBoxType type;
+    uint64_t box_size;
+    uint64_t header_size;
+    if (ParseBoxHeader(in, size, pos, pos, type, &box_size, &header_size) !=
+        JXL_DEC_SUCCESS) {
+      break;
+    }
+    size_t end = (box_size == 0 || box_size > size - pos) ? size
+                                                          : pos + box_size;
+    if (memcmp(type, "jxlp", 4) == 0) {
+      size_t begin = pos + header_size + 4;
+      if (begin > end) break;
+      parts.emplace_back(in + begin, end - begin);
+      if (LoadBE32(in + begin - 4) & 0x80000000) break;
+    }
+    if (box_size == 0) break;
+    pos = end;
+  }
+  return parts;
+}
+
+// Returns in `section` the `size` bytes at `pos` after the end of `span`,
+// which are in the following codestream `parts`, copying them to `storage`
+// only if they span several parts. Returns false if they are not available.
+bool GetSectionFromParts(const std::vector<Span<const uint8_t>>& parts,
+                         size_t pos, size_t size,
+                         std::vector<uint8_t>* storage,
+                         Span<const uint8_t>* section) {
+  size_t i = 0;
+  for (; i < parts.size() && pos >= parts[i].size(); ++i) {
+    pos -= parts[i].size();
+  }
+  if (i == parts.size()) return false;
+  if (pos + size <= parts[i].size()) {
+    *section = Bytes(parts[i].data() + pos, size);
+    return true;
+  }
+  storage->clear();
+  for (; i < parts.size() && storage->size() < size; ++i) {
+    size_t n = std::min(size - storage->size(), parts[i].size() - pos);
+    storage->insert(storage->end(), parts[i].data() + pos,
+                    parts[i].data() + pos + n);
+    pos = 0;
+  }
+  if (storage->size() < size) return false;
+  *section = Bytes(storage->data(), size);
+  return true;
+}
+
 JxlDecoderStatus JxlDecoderProcessSections(JxlDecoder* dec) {
   Span<const uint8_t> span;
   JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span));
   const auto& toc = dec->frame_dec->Toc();
+  const size_t num_dc_groups =
+      dec->frame_header->ToFrameDimensions().num_dc_groups;
+  // With a persistent input, the AC groups are only looked at once the DC is
+  // decoded, so that those the output does not need are never read.
+  bool defer_ac = dec->persistent_input != nullptr &&
+                  !dec->frame_dec->HasDecodedDC() &&
+                  dec->frame_prog_detail < JxlProgressiveDetail::kDC;
+  std::vector<Span<const uint8_t>> parts;
+  bool have_parts = false;
+  for (int round = 0; round < (defer_ac ? 2 : 1); ++round) {
+    const bool skip_ac = defer_ac && round == 0;
+    size_t pos = 0;
+    std::vector<jxl::FrameDecoder::SectionInfo> section_info;
+    std::vector<jxl::FrameDecoder::SectionStatus> section_status;
+    std::vector<std::vector<uint8_t>> section_storage;
+    for (size_t i = dec->next_section; i < toc.size(); ++i) {
+      size_t id = toc[i].id;
+      size_t size = toc[i].size;
+      if (dec->section_processed[i] || (skip_ac && id > num_dc_groups + 1)) {
+        pos += size;
+        continue;
+      }
+      Span<const uint8_t> section;
+      if (dec->persistent_input && !dec->frame_dec->SectionNeeded(id)) {
+        // Never read, so its pages of the input are not touched.
+        section = Bytes(span.data(), 0);
+      } else if (!OutOfBounds(pos, size, span.size())) {
+        section = Bytes(span.data() + pos, size);
+      } else {
+        if (!have_parts) {
+          parts = NextPersistentCodestreamParts(dec);
+          have_parts = true;
+        }
+        // A section that starts in this box is read once it is complete.
+        if (pos < span.size()) break;
+        section_storage.emplace_back();
+        if (!GetSectionFromParts(parts, pos - span.size(), size,
+                                 &section_storage.back(), &section)) {
+          break;
+        }
+      }
+      auto* br = new jxl::BitReader(section);
+      section_info.emplace_back(jxl::FrameDecoder::SectionInfo{br, id, i});
+      section_status.emplace_back();
+      pos += size;
+    }
+    jxl::Status status = dec->frame_dec->ProcessSections(
+        section_info.data(), section_info.size(), section_status.data());
+    bool out_of_bounds = false;
+    bool has_error = false;
+    for (const auto& info : section_info) {
+      if (!info.br->AllReadsWithinBounds()) {
+        // Mark out of bounds section, but keep closing and deleting the next
+        // ones as well.
+        out_of_bounds = true;
+      }
+      if (!info.br->Close()) has_error = true;
+      delete info.br;
+    }
+    if (has_error) {
+      return JXL_INPUT_ERROR("internal: bit-reader failed to close");
+    }
+    if (out_of_bounds) {
+      // If any bit reader indicates out of bounds, it's an error, not just
+      // needing more input, since we ensure only bit readers containing
+      // a complete section are provided to the FrameDecoder.
+      return JXL_INPUT_ERROR("frame out of bounds");
+    }
+    if (!status) {
+      return JXL_INPUT_ERROR("frame processing failed");
+    }
+    for (size_t i = 0; i < section_status.size(); ++i) {
+      auto status = section_status[i];
+      if (status == jxl::FrameDecoder::kDone) {
+        dec->section_processed[section_info[i].index] = 1;
+      } else if (status != jxl::FrameDecoder::kSkipped) {
+        return JXL_INPUT_ERROR("unexpected section status");
+      }
+    }
+  }
+  size_t completed_prefix_bytes = 0;
+  while (dec->next_section < dec->section_processed.size() &&
+         dec->section_processed[dec->next_section] == 1) {
+    completed_prefix_bytes += toc[dec->next_section].size;
+    ++dec->next_section;
+  }
+  dec->remaining_frame_size -= completed_prefix_bytes;
+  dec->AdvanceCodestream(completed_prefix_bytes);
+  if (dec->frame_dec->Cancelled()) return JXL_DEC_CANCELLED;
+  return JXL_DEC_SUCCESS;
+}
+
+bool ReadFrameIndexVarInt(Span<const uint8_t> data, size_t* pos,
+                          uint64_t* value) {
+  *value = 0;
+  for (size_t i = 0; i < 9; ++i) {
+    if (*pos >= data.size()) return false;
+    uint8_t byte = data[(*pos)++];
+    *value |= static_cast<uint64_t>(byte & 127) << (7 * i);
+    if ((byte & 128) == 0) return true;
+  }
+  return false;
+}
+
+// Parses the contents of a frame index box into the keyframes it lists, with
+// their times converted from the ticks of the index to those of `animation`,
+// when that is exact. Returns false if the index is invalid.
+bool ParseFrameIndex(Span<const uint8_t> data, const AnimationHeader* animation,
+                     std::vector<FrameIndexEntry>* entries) {
   size_t pos = 0;
-  std::vector<jxl::FrameDecoder::SectionInfo> section_info;
-  std::vector<jxl::FrameDecoder::SectionStatus> section_status;
-  for (size_t i = dec->next_section; i < toc.size(); ++i) {
-    if (dec->section_processed[i]) {
-      pos += toc[i].size;
+  uint64_t num_frames;
+  if (!ReadFrameIndexVarInt(data, &pos, &num_frames)) return false;
+  if (OutOfBounds(pos, 8, data.size())) return false;
+  uint64_t tnum = LoadBE32(data.data() + pos);
+  uint64_t tden = LoadBE32(data.data() + pos + 4);
+  pos += 8;
+  // An index tick is tnum / tden seconds, an animation tick is
+  // tps_denominator / tps_numerator seconds.
+  uint64_t num = 0;
+  uint64_t den = 0;
+  if (animation != nullptr && tden != 0 && animation->tps_denominator != 0) {
+    num = tnum * animation->tps_numerator;
+    den = tden * animation->tps_denominator;
+    uint64_t a = num;
+    uint64_t b = den;
+    while (b != 0) {
+      uint64_t t = a % b;
+      a = b;
+      b = t;
+    }
+    if (a != 0) {
+      num /= a;
+      den /= a;
+    }
+  }
+  FrameIndexEntry entry = {0, 0, 0, den != 0};
+  uint64_t index_ticks = 0;
+  for (uint64_t i = 0; i < num_frames; ++i) {
+    uint64_t offset;
+    uint64_t ticks;
+    uint64_t frames;
+    if (!ReadFrameIndexVarInt(data, &pos, &offset) ||
+        !ReadFrameIndexVarInt(data, &pos, &ticks) ||
+        !ReadFrameIndexVarInt(data, &pos, &frames)) {
+      return false;
+    }
+    if ((i > 0 && offset == 0) || frames == 0 ||
+        entry.codestream_offset + offset < entry.codestream_offset) {
+      return false;
+    }
+    entry.codestream_offset += offset;
+    if (entry.has_ticks) {
+      if (index_ticks % den != 0 ||
+          index_ticks / den > std::numeric_limits<uint64_t>::max() / num) {
+        entry.has_ticks = false;
+      } else {
+        entry.ticks = index_ticks / den * num;
+      }
+    }
+    entries->push_back(entry);
+    if (index_ticks + ticks < index_ticks ||
+        frames > std::numeric_limits<size_t>::max() - entry.frame) {
+      return false;
+    }
+    index_ticks += ticks;
+    entry.frame += frames;
+  }
+  return true;
+}
+
+// Looks for the frame index box in the boxes of the persistent input.
+void LoadFrameIndex(JxlDecoder* dec) {
+  if (!dec->persistent_input) return;
+  dec->frame_index_loaded = true;
+  if (!dec->have_container) return;
+  const uint8_t* in = dec->persistent_input;
+  const size_t size = dec->persistent_input_size;
+  size_t pos = 0;
+  while (pos < size) {
+    JxlBoxType type;
+    uint64_t box_size;
+    uint64_t header_size;
+    if (ParseBoxHeader(in, size, pos, pos, type, &box_size, &header_size) !=
+        JXL_DEC_SUCCESS) {
+      return;
+    }
+    size_t end = (box_size == 0 || box_size > size - pos) ? size
+                                                          : pos + box_size;
+    if (memcmp(type, "jxli", 4) == 0) {
+      std::vector<FrameIndexEntry> entries;
+      const AnimationHeader* animation =
+          dec->metadata.m.have_animation ? &dec->metadata.m.animation : nullptr;
+      size_t begin = pos + header_size;
+      if (ParseFrameIndex(Bytes(in + begin, end - begin), animation,
+                          &entries)) {
+        dec->frame_index = std::move(entries);
+      }
+      return;
+    }
+    if (box_size == 0) return;
+    pos = end;
+  }
+}
+
+// When skipping frames, jumps to the last keyframe of the frame index that is
+// ahead of the next frame and not after the frame being skipped to, without
+// looking at the frames in between.
+void JumpToKeyframe(JxlDecoder* dec) {
+  if (dec->skip_frames == 0 && !dec->skip_to_time) return;
+  if (!dec->coalescing || dec->preview_frame) return;
+  // Only at the start of a displayed frame.
+  if (dec->internal_frames != 0 && !dec->is_last_of_still) return;
+  if (!dec->frame_index_loaded) LoadFrameIndex(dec);
+  const FrameIndexEntry* keyframe = nullptr;
+  for (const FrameIndexEntry& entry : dec->frame_index) {
+    if (entry.frame <= dec->external_frames ||
+        entry.codestream_offset <= dec->codestream_offset) {
       continue;
     }
-    size_t id = toc[i].id;
-    size_t size = toc[i].size;
-    if (OutOfBounds(pos, size, span.size())) {
+    if (dec->skip_frames > 0
+            ? entry.frame > dec->external_frames + dec->skip_frames
+            : (!entry.has_ticks || !dec->animation_ticks_known ||
+               entry.ticks > dec->skip_to_ticks)) {
       break;
     }
-    auto* br = new jxl::BitReader(jxl::Bytes(span.data() + pos, size));
-    section_info.emplace_back(jxl::FrameDecoder::SectionInfo{br, id, i});
-    section_status.emplace_back();
-    pos += size;
+    keyframe = &entry;
+  }
+  if (keyframe == nullptr) return;
+  dec->AdvanceCodestream(keyframe->codestream_offset - dec->codestream_offset);
+  if (dec->skip_frames > 0) {
+    dec->skip_frames -= keyframe->frame - dec->external_frames;
+  }
+  if (!dec->frame_refs_incomplete &&
+      keyframe->frame < dec->frame_external_to_internal.size()) {
+    dec->internal_frames = dec->frame_external_to_internal[keyframe->frame];
+  } else {
+    dec->frame_refs_incomplete = true;
+  }
+  dec->external_frames = keyframe->frame;
+  dec->animation_ticks = keyframe->ticks;
+  dec->animation_ticks_known = keyframe->has_ticks;
+  // The noise of a frame depends on how many frames were displayed before it.
+  if (dec->passes_state) {
+    dec->passes_state->visible_frame_index = keyframe->frame;
+    dec->passes_state->nonvisible_frame_index = 0;
+  }
+}
+
+// Whether the frame can be decoded on its own: it replaces the whole image, it
+// uses no patches or DC frame, and no later frame can reference it.
+bool IsIndependentFrame(const FrameHeader& frame_header) {
+  return frame_header.frame_type == FrameType::kRegularFrame &&
+         !frame_header.CanBeReferenced() && !NeedsBlending(frame_header) &&
+         !(frame_header.flags &
+           (FrameHeader::kPatches | FrameHeader::kUseDcFrame));
+}
+
+// Returns the first of the trailing extra channels that the application marked
+// as not needed and that the current frame needs neither for its outputs nor
+// for rendering its color channels, or the number of extra channels.
+size_t FirstSkippedExtraChannel(const JxlDecoder* dec) {
+  const std::vector<ExtraChannelInfo>& ec_info =
+      dec->metadata.m.extra_channel_info;
+  const FrameHeader& frame_header = *dec->frame_header;
+  // Saved frames may be displayed with all their extra channels later.
+  if (dec->skipped_extra_channels.empty() || frame_header.CanBeReferenced()) {
+    return ec_info.size();
   }
-  jxl::Status status = dec->frame_dec->ProcessSections(
-      section_info.data(), section_info.size(), section_status.data());
-  bool out_of_bounds = false;
-  bool has_error = false;
-  for (const auto& info : section_info) {
-    if (!info.br->AllReadsWithinBounds()) {
-      // Mark out of bounds section, but keep closing and deleting the next
-      // ones as well.
-      out_of_bounds = true;
+  const ExtraChannelInfo* main_alpha =
+      dec->metadata.m.Find(ExtraChannel::kAlpha);
+  const bool alpha_output = dec->unpremul_alpha ||
+                            dec->image_out_format.num_channels == 2 ||
+                            dec->image_out_format.num_channels == 4;
+  // Blending and patches composite the color channels with the alpha ones.
+  const bool alpha_blending = NeedsBlending(frame_header) ||
+                              (frame_header.flags & FrameHeader::kPatches);
+  size_t first = ec_info.size();
+  for (; first > 0; --first) {
+    const size_t ec = first - 1;
+    const ExtraChannelInfo& info = ec_info[ec];
+    if (!dec->skipped_extra_channels[ec] ||
+        (ec < dec->extra_channel_output.size() &&
+         dec->extra_channel_output[ec].buffer != nullptr) ||
+        info.type == ExtraChannel::kBlack ||
+        (info.type == ExtraChannel::kSpotColor && dec->render_spotcolors) ||
+        (info.type == ExtraChannel::kAlpha &&
+         (alpha_blending || (&info == main_alpha && alpha_output)))) {
+      break;
     }
-    if (!info.br->Close()) has_error = true;
-    delete info.br;
   }
-  if (has_error) {
-    return JXL_INPUT_ERROR("internal: bit-reader failed to close");
+  return first;
+}
+
+bool CanDecodeFramesAhead(const JxlDecoder* dec) {
+  if (dec->parallel_frames < 2 || dec->memory_limit != 0 ||
+      dec->preview_frame || !dec->coalescing ||
+      !dec->render_spotcolors || dec->skip_frames > 0 || dec->skip_to_time ||
+      dec->downscaling != 1 || dec->output_xsize != 0 ||
+      dec->decoding_speed != 0 || dec->luma_only ||
+      dec->cancel_callback != nullptr || dec->render_hook.IsPresent() ||
+      dec->gain_map || dec->image_out_format.data_type == JXL_TYPE_RGB10A2 ||
+      !(dec->events_wanted & JXL_DEC_FULL_IMAGE) ||
+      (dec->events_wanted & JXL_DEC_FRAME_PROGRESSION)) {
+    return false;
+  }
+  // The frame and filter work limits are only checked frame by frame.
+  if (dec->limits.frames != 0 || dec->limits.filter_work != 0) return false;
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (dec->jpeg_decoder.WantsJpegData()) return false;
+#endif
+  return true;
+}
+
+// Decodes the independent frames that follow in the available codestream,
+// starting with the current one, at once on the parallel runner, unless they
+// were decoded already. Each frame is an ImageBundle in the output color
+// encoding, which is converted to the image out buffer when the decoder gets
+// there. A frame that fails to decode here is left to the regular decoding,
+// which reports the error.
+JxlDecoderStatus DecodeFramesAhead(JxlDecoder* dec) {
+  while (!dec->frames_ahead.empty() &&
+         dec->frames_ahead.front().codestream_offset < dec->codestream_offset) {
+    dec->frames_ahead.pop_front();
   }
-  if (out_of_bounds) {
-    // If any bit reader indicates out of bounds, it's an error, not just
-    // needing more input, since we ensure only bit readers containing
-    // a complete section are provided to the FrameDecoder.
-    return JXL_INPUT_ERROR("frame out of bounds");
+  if (!dec->frames_ahead.empty() || !CanDecodeFramesAhead(dec)) {
+    return JXL_DEC_SUCCESS;
   }
-  if (!status) {
-    return JXL_INPUT_ERROR("frame processing failed");
+  Span<const uint8_t> span;
+  if (dec->GetCodestreamInput(&span) != JXL_DEC_SUCCESS) {
+    return JXL_DEC_SUCCESS;
   }
-  for (size_t i = 0; i < section_status.size(); ++i) {
-    auto status = section_status[i];
-    if (status == jxl::FrameDecoder::kDone) {
-      dec->section_processed[section_info[i].index] = 1;
-    } else if (status != jxl::FrameDecoder::kSkipped) {
-      return JXL_INPUT_ERROR("unexpected section status");
+  // Start and size of the frames in span.
+  std::vector<std::pair<size_t, size_t>> frames;
+  size_t pos = 0;
+  bool is_last = false;
+  while (frames.size() < dec->parallel_frames && !is_last) {
+    auto reader = GetBitReader(Bytes(span.data() + pos, span.size() - pos));
+    FrameHeader frame_header(&dec->metadata);
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> sizes;
+    uint64_t sections_size;
+    if (!ReadFrameHeader(reader.get(), &frame_header) ||
+        !IsIndependentFrame(frame_header)) {
+      break;
     }
+    FrameDimensions frame_dim = frame_header.ToFrameDimensions();
+    size_t toc_entries =
+        NumTocEntries(frame_dim.num_groups, frame_dim.num_dc_groups,
+                      frame_header.passes.num_passes);
+    if (!CheckSizeLimit(dec, frame_dim.xsize_upsampled_padded,
+                        frame_dim.ysize_upsampled_padded) ||
+        !WithinPixelLimit(dec, frame_dim.xsize_upsampled,
+                          frame_dim.ysize_upsampled) ||
+        !ReadGroupOffsets(&dec->memory_manager, toc_entries, reader.get(),
+                          &offsets, &sizes, &sections_size) ||
+        !reader->AllReadsWithinBounds()) {
+      break;
+    }
+    size_t header_size = reader->TotalBitsConsumed() / kBitsPerByte;
+    if (OutOfBounds(pos, header_size + sections_size, span.size())) break;
+    frames.emplace_back(pos, header_size + sections_size);
+    pos += header_size + sections_size;
+    is_last = frame_header.is_last;
   }
-  size_t completed_prefix_bytes = 0;
-  while (dec->next_section < dec->section_processed.size() &&
-         dec->section_processed[dec->next_section] == 1) {
-    completed_prefix_bytes += toc[dec->next_section].size;
-    ++dec->next_section;
+  if (frames.size() < 2) return JXL_DEC_SUCCESS;
+
+  std::vector<std::unique_ptr<ImageBundle>> decoded(frames.size());
+  const auto decode_frame = [&](const uint32_t i, size_t /*thread*/) -> Status {
+    auto state = jxl::make_unique<PassesDecoderState>(&dec->memory_manager);
+    state->output_encoding_info = dec->passes_state->output_encoding_info;
+    state->stats = dec->stats;
+    state->limits = &dec->limits;
+    // All the frames are displayed, which seeds their noise.
+    state->visible_frame_index = dec->passes_state->visible_frame_index + i;
+    auto ib = jxl::make_unique<ImageBundle>(&dec->memory_manager,
+                                            &dec->image_metadata);
+    if (DecodeFrame(state.get(), /*pool=*/nullptr,
+                    span.data() + frames[i].first, frames[i].second,
+                    /*frame_header=*/nullptr, ib.get(), dec->metadata)) {
+      decoded[i] = std::move(ib);
+    }
+    return true;
+  };
+  JXL_API_RETURN_IF_ERROR(RunOnPool(dec->thread_pool.get(), 0, frames.size(),
+                                    ThreadPool::NoInit, decode_frame,
+                                    "DecodeFramesAhead"));
+  for (size_t i = 0; i < frames.size() && decoded[i]; ++i) {
+    dec->frames_ahead.push_back(
+        FrameAhead{dec->codestream_offset + frames[i].first,
+                   std::move(decoded[i])});
   }
-  dec->remaining_frame_size -= completed_prefix_bytes;
-  dec->AdvanceCodestream(completed_prefix_bytes);
+  return JXL_DEC_SUCCESS;
+}
+
+bool FrameKeepsJpegData(const JxlDecoder* dec) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  return dec->ib && dec->ib->jpeg_data != nullptr;
+#else
+  return false;
+#endif
+}
+
+// Decodes the current frame with as many threads as fit in the memory limit,
+// or fails before allocating anything if it does not fit with one thread.
+JxlDecoderStatus LimitFrameMemory(JxlDecoder* dec) {
+  const uint64_t allocated = dec->counting_memory_manager->Allocated();
+  const uint64_t budget =
+      dec->memory_limit > allocated ? dec->memory_limit - allocated : 0;
+  const FrameDimensions frame_dim = dec->frame_header->ToFrameDimensions();
+  const size_t max_threads =
+      std::max(frame_dim.num_groups, frame_dim.num_dc_groups);
+  const bool jpeg_data = FrameKeepsJpegData(dec);
+  size_t num_threads = jxl::MaxThreadsWithinMemory(
+      *dec->frame_header, jpeg_data, budget, max_threads);
+  if (num_threads == 0) {
+    return JXL_API_ERROR(
+        "frame needs about %" PRIu64 " bytes, over the memory limit",
+        jxl::EstimateFrameMemory(*dec->frame_header, 1, jpeg_data));
+  }
+  if (num_threads < max_threads) {
+    dec->capped_thread_pool = jxl::make_unique<jxl::CappedThreadPool>(
+        dec->thread_pool.get(), num_threads);
+    dec->frame_dec->SetThreadPool(dec->capped_thread_pool->pool());
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+// Returns the current frame if it was decoded ahead and the image output can
+// be written from it, or nullptr.
+const ImageBundle* GetFrameAhead(const JxlDecoder* dec) {
+  if (dec->frames_ahead.empty() ||
+      dec->frames_ahead.front().codestream_offset != dec->frame_start_offset ||
+      !dec->image_out_buffer_set || !dec->is_last_of_still ||
+      dec->skipping_frame || !dec->image_out_channels.empty() ||
+      !dec->ycbcr_planes_out.empty() || !dec->extra_channel_output.empty() ||
+      dec->crop_xsize != 0 || dec->output_xsize != 0 ||
+      dec->image_out_tile_callback != nullptr ||
+      dec->image_out_format.data_type == JXL_TYPE_RGB10A2) {
+    return nullptr;
+  }
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (dec->ib && dec->ib->jpeg_data != nullptr) return nullptr;
+#endif
+  return dec->frames_ahead.front().ib.get();
+}
+
+// Writes a frame decoded ahead or resampled to the image out buffer or
+// callback.
+// Sets the position in the file of the sections of the frame whose header
+// was just read, which is known if they are all in the current box.
+void FindFrameSectionsInFile(JxlDecoder* dec) {
+  // The bytes of the codestream copy that are not in the input any more were
+  // before the input, the others are at its start.
+  const uint64_t pos = static_cast<uint64_t>(dec->file_pos) +
+                       dec->codestream_unconsumed + dec->codestream_pos;
+  const uint64_t size = dec->frame_dec->SumSectionSizes();
+  dec->frame_sections_in_file =
+      pos >= dec->codestream_copy.size() &&
+      pos - dec->codestream_copy.size() >= dec->box_contents_begin &&
+      (dec->box_contents_unbounded ||
+       pos - dec->codestream_copy.size() + size <= dec->box_contents_end);
+  dec->frame_sections_file_pos = pos - dec->codestream_copy.size();
+}
+
+JxlDecoderStatus WriteImageBundle(JxlDecoder* dec, const ImageBundle& ib) {
+  const JxlPixelFormat& format = dec->image_out_format;
+  if (format.data_type == JXL_TYPE_RGB10A2) {
+    return JXL_API_ERROR("Packed RGB10A2 output cannot be resampled");
+  }
+  size_t xsize;
+  size_t ysize;
+  GetCurrentDimensions(dec, xsize, ysize);
+  size_t stride = DivCeil(
+      xsize * format.num_channels * BitsPerChannel(format.data_type),
+      kBitsPerByte);
+  if (format.align > 1) stride = DivCeil(stride, format.align) * format.align;
+  size_t bits_per_sample =
+      GetBitDepth(dec->image_out_bit_depth, dec->metadata.m, format);
+  bool float_out = format.data_type == JXL_TYPE_FLOAT ||
+                   format.data_type == JXL_TYPE_FLOAT16;
+  Orientation undo_orientation = dec->keep_orientation
+                                     ? Orientation::kIdentity
+                                     : dec->metadata.m.GetOrientation();
+  JXL_API_RETURN_IF_ERROR(ConvertToExternal(
+      ib, bits_per_sample, float_out, format.num_channels, format.endianness,
+      stride, dec->thread_pool.get(), dec->image_out_buffer,
+      dec->image_out_size,
+      PixelCallback{dec->image_out_init_callback, dec->image_out_run_callback,
+                    dec->image_out_destroy_callback,
+                    dec->image_out_init_opaque},
+      undo_orientation, dec->unpremul_alpha, dec->premul_alpha));
   return JXL_DEC_SUCCESS;
 }
 
@@ -1180,6 +2515,8 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
 
   // No matter what events are wanted, the basic info is always required.
   if (!dec->got_basic_info) {
+    jxl::DecoderStatsTimer stats_timer(dec->stats,
+                                       JXL_DEC_STATS_HEADERS_TIME_US);
     JxlDecoderStatus status = JxlDecoderReadBasicInfo(dec);
     if (status != JXL_DEC_SUCCESS) return status;
   }
@@ -1199,8 +2536,13 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
   }
 
   if (!dec->got_all_headers) {
+    jxl::DecoderStatsTimer stats_timer(dec->stats,
+                                       JXL_DEC_STATS_HEADERS_TIME_US);
     JxlDecoderStatus status = JxlDecoderReadAllHeaders(dec);
     if (status != JXL_DEC_SUCCESS) return status;
+    if (dec->stats) {
+      dec->stats->Add(JXL_DEC_STATS_HEADER_BYTES, dec->codestream_offset);
+    }
   }
 
   if (dec->events_wanted & JXL_DEC_COLOR_ENCODING) {
@@ -1242,6 +2584,9 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
             "cannot decode a next frame after JPEG reconstruction frame");
       }
 #endif
+      JumpToKeyframe(dec);
+      dec->frame_start_offset = dec->codestream_offset;
+      JXL_API_RETURN_IF_ERROR(DecodeFramesAhead(dec));
       if (!dec->ib) {
         dec->ib = jxl::make_unique<jxl::ImageBundle>(&dec->memory_manager,
                                                      &dec->image_metadata);
@@ -1259,27 +2604,62 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       Span<const uint8_t> span;
       JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span));
       auto reader = GetBitReader(span);
-      jxl::Status status = dec->frame_dec->InitFrame(
-          reader.get(), dec->ib.get(), dec->preview_frame);
+      jxl::Status status = true;
+      {
+        jxl::DecoderStatsTimer stats_timer(dec->stats,
+                                           JXL_DEC_STATS_HEADERS_TIME_US);
+        status = dec->frame_dec->InitFrame(reader.get(), dec->ib.get(),
+                                           dec->preview_frame);
+      }
       if (!reader->AllReadsWithinBounds() ||
           status.code() == StatusCode::kNotEnoughBytes) {
         return dec->RequestMoreInput();
       } else if (!status) {
         return JXL_INPUT_ERROR("invalid frame header");
       }
+      if (dec->stats) {
+        dec->stats->Add(JXL_DEC_STATS_FRAME_HEADER_BYTES,
+                        reader->TotalBitsConsumed() / kBitsPerByte);
+      }
       dec->AdvanceCodestream(reader->TotalBitsConsumed() / kBitsPerByte);
+      FindFrameSectionsInFile(dec);
       *dec->frame_header = dec->frame_dec->GetFrameHeader();
       jxl::FrameDimensions frame_dim = dec->frame_header->ToFrameDimensions();
       if (!CheckSizeLimit(dec, frame_dim.xsize_upsampled_padded,
                           frame_dim.ysize_upsampled_padded)) {
         return JXL_INPUT_ERROR("frame is too large");
       }
+      JXL_API_RETURN_IF_ERROR(
+          CheckFrameLimits(dec, *dec->frame_header, frame_dim));
+      if (dec->memory_limit != 0) {
+        JXL_API_RETURN_IF_ERROR(LimitFrameMemory(dec));
+      }
       int output_type =
           dec->preview_frame ? JXL_DEC_PREVIEW_IMAGE : JXL_DEC_FULL_IMAGE;
       bool output_needed = ((dec->events_wanted & output_type) != 0);
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+      // Stream the JPEG reconstruction if possible, which needs the metadata
+      // boxes to have been read already.
+      if (output_needed && !dec->preview_frame &&
+          dec->stream_jpeg_reconstruction && dec->ib->jpeg_data != nullptr &&
+          dec->jpeg_decoder.IsOutputSet() &&
+          !dec->jpeg_decoder.KeepsJpegData() && !dec->JbrdNeedMoreBoxes()) {
+        dec->frame_dec->SetJpegStreamWriter(dec->jpeg_decoder.StartStream());
+      }
+#endif
       if (output_needed) {
         JXL_API_RETURN_IF_ERROR(dec->frame_dec->InitFrameOutput());
       }
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+      if (dec->jpeg_decoder.IsStreaming()) {
+        if (!dec->frame_dec->StreamsJpeg()) {
+          dec->jpeg_decoder.StopStream();
+        } else {
+          JxlDecoderStatus status = SetJPEGReconstructionMetadata(dec);
+          if (status != JXL_DEC_SUCCESS) return status;
+        }
+      }
+#endif
       if (dec->cpu_limit_base != 0) {
         // No overflow, checked in CheckSizeLimit.
         size_t num_pixels = frame_dim.xsize * frame_dim.ysize;
@@ -1318,17 +2698,27 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       const size_t external_frame_index = dec->external_frames;
       if (dec->is_last_of_still) dec->external_frames++;
       dec->internal_frames++;
+      dec->animation_ticks += dec->frame_header->animation_frame.duration;
 
       if (dec->skip_frames > 0) {
         dec->skipping_frame = true;
         if (dec->is_last_of_still) {
           dec->skip_frames--;
         }
+      } else if (dec->skip_to_time && dec->is_last_of_still) {
+        // The layers before the last one of a still are decoded, since it is
+        // not known yet when the still ends.
+        dec->skipping_frame = !dec->is_last_total &&
+                              dec->animation_ticks <= dec->skip_to_ticks;
+        dec->skip_to_time = dec->skipping_frame;
       } else {
         dec->skipping_frame = false;
       }
 
-      if (external_frame_index >= dec->frame_external_to_internal.size()) {
+      // After a jump to an unseen keyframe, the internal indices of the frames
+      // are not known, and neither are their references.
+      if (!dec->frame_refs_incomplete &&
+          external_frame_index >= dec->frame_external_to_internal.size()) {
         dec->frame_external_to_internal.push_back(internal_frame_index);
         if (dec->frame_external_to_internal.size() !=
             external_frame_index + 1) {
@@ -1336,7 +2726,8 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         }
       }
 
-      if (internal_frame_index >= dec->frame_refs.size()) {
+      if (!dec->frame_refs_incomplete &&
+          internal_frame_index >= dec->frame_refs.size()) {
         // add the value 0xff (which means all references) to new slots: we only
         // know the references of the frame at FinalizeFrame, and fill in the
         // correct values there. As long as this information is not known, the
@@ -1354,7 +2745,8 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         bool referenceable =
             dec->frame_header->CanBeReferenced() ||
             dec->frame_header->frame_type == FrameType::kDCFrame;
-        if (internal_frame_index < dec->frame_required.size() &&
+        if (!dec->frame_refs_incomplete &&
+            internal_frame_index < dec->frame_required.size() &&
             !dec->frame_required[internal_frame_index]) {
           referenceable = false;
         }
@@ -1380,8 +2772,18 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
     if (dec->frame_stage == FrameStage::kTOC) {
       dec->frame_dec->SetRenderSpotcolors(dec->render_spotcolors);
       dec->frame_dec->SetCoalescing(dec->coalescing);
-
-      if (!dec->preview_frame &&
+      dec->frame_dec->SetReducedPrecisionBuffers(
+          dec->reduced_precision_buffers);
+      dec->frame_dec->SetDecodingSpeed(dec->decoding_speed);
+      dec->frame_dec->SetLumaOnly(dec->luma_only);
+      dec->frame_dec->SetCancelCallback(dec->cancel_callback,
+                                        dec->cancel_opaque);
+      dec->frame_dec->SetRenderHook(dec->render_hook);
+      dec->frame_dec->SetGainMap(dec->gain_map.get());
+      dec->frame_dec->SetDCOnlyOutput(false);
+
+      // A downscaled frame is complete as soon as its DC is decoded.
+      if (!dec->preview_frame && dec->downscaling == 1 &&
           (dec->events_wanted & JXL_DEC_FRAME_PROGRESSION)) {
         dec->frame_prog_detail =
             dec->frame_dec->SetPauseAtProgressive(dec->prog_detail);
@@ -1413,7 +2815,7 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         }
         if (
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
-            (!dec->jpeg_decoder.IsOutputSet() ||
+            (!dec->jpeg_decoder.WantsJpegData() ||
              dec->ib->jpeg_data == nullptr) &&
 #endif
             dec->is_last_of_still && !dec->skipping_frame) {
@@ -1424,7 +2826,68 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         }
       }
 
-      if (dec->image_out_buffer_set) {
+      if (const ImageBundle* frame_ahead = GetFrameAhead(dec)) {
+        JXL_API_RETURN_IF_ERROR(WriteImageBundle(dec, *frame_ahead));
+        dec->frames_ahead.pop_front();
+        if (!dec->frame_refs_incomplete) {
+          size_t internal_index = dec->internal_frames - 1;
+          if (dec->frame_refs.size() <= internal_index) {
+            return JXL_API_ERROR("internal");
+          }
+          // Independent frames do not use any reference.
+          dec->frame_refs[internal_index].reference = 0;
+        }
+        dec->AdvanceCodestream(dec->remaining_frame_size);
+        dec->image_out_buffer_set = false;
+        dec->frame_stage = FrameStage::kHeader;
+        dec->ib.reset();
+        return JXL_DEC_FULL_IMAGE;
+      }
+
+      if (dec->image_out_buffer_set && !dec->preview_frame &&
+          dec->downscaling != 1) {
+        if (!dec->ycbcr_planes_out.empty() || dec->crop_xsize != 0 ||
+            !dec->coalescing) {
+          return JXL_API_ERROR(
+              "Downscaling is not supported with YCbCr planes output, a crop "
+              "region or coalescing disabled");
+        }
+        if (!dec->frame_dec->SupportsDCOnlyOutput()) {
+          return JXL_API_ERROR("Downscaling is not supported for this frame");
+        }
+        dec->frame_dec->SetDCOnlyOutput(true);
+      }
+
+      bool resample = dec->image_out_buffer_set && !dec->preview_frame &&
+                      dec->output_xsize != 0;
+      if (resample) {
+        if (!dec->ycbcr_planes_out.empty() || dec->crop_xsize != 0 ||
+            !dec->coalescing || !dec->image_out_channels.empty() ||
+            !dec->extra_channel_output.empty() ||
+            dec->image_out_tile_callback != nullptr ||
+            (dec->events_wanted & JXL_DEC_FRAME_PROGRESSION)) {
+          return JXL_API_ERROR(
+              "Output size is not supported with YCbCr planes, per-channel or "
+              "extra channel buffers, a tile callback, a crop region, "
+              "progression events or coalescing disabled");
+        }
+        if (!dec->frame_dec->SupportsResampledOutput()) {
+          return JXL_API_ERROR("Output size is not supported for this frame");
+        }
+      }
+
+      if (dec->image_out_buffer_set && !dec->ycbcr_planes_out.empty()) {
+        dec->frame_dec->SetYCbCrPlanesOutput(dec->ycbcr_planes_data_type,
+                                             dec->ycbcr_planes_out);
+      } else if (resample) {
+        size_t xsize = dec->output_xsize;
+        size_t ysize = dec->output_ysize;
+        if (!dec->keep_orientation &&
+            static_cast<int>(dec->metadata.m.GetOrientation()) > 4) {
+          std::swap(xsize, ysize);
+        }
+        dec->frame_dec->SetResampledOutput(xsize, ysize, dec->output_filter);
+      } else if (dec->image_out_buffer_set) {
         size_t xsize;
         size_t ysize;
         GetCurrentDimensions(dec, xsize, ysize);
@@ -1436,7 +2899,22 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
                 dec->image_out_destroy_callback, dec->image_out_init_opaque},
             reinterpret_cast<uint8_t*>(dec->image_out_buffer),
             dec->image_out_size, xsize, ysize, dec->image_out_format,
-            bits_per_sample, dec->unpremul_alpha, !dec->keep_orientation);
+            bits_per_sample, dec->unpremul_alpha, dec->premul_alpha,
+            !dec->keep_orientation);
+        if (!dec->image_out_channels.empty()) {
+          dec->frame_dec->SetImageOutputChannels(dec->image_out_channels);
+        }
+        if (dec->image_out_tile_callback != nullptr && !dec->preview_frame) {
+          dec->frame_dec->SetImageOutputTiles(TileCallback{
+              dec->image_out_tile_callback, dec->image_out_tile_opaque});
+        }
+        jxl::Rect crop;
+        if (GetCropRegion(dec, &crop)) {
+          if (crop.xsize() == 0 || crop.ysize() == 0) {
+            return JXL_API_ERROR("Crop region outside of the image");
+          }
+          dec->frame_dec->SetOutputCrop(UnorientCropRegion(dec, crop));
+        }
         for (size_t i = 0; i < dec->extra_channel_output.size(); ++i) {
           const auto& extra = dec->extra_channel_output[i];
           size_t ec_bits_per_sample =
@@ -1448,8 +2926,19 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         }
       }
 
+      dec->frame_dec->SetFirstSkippedExtraChannel(
+          FirstSkippedExtraChannel(dec));
+
       size_t next_num_passes_to_pause = dec->frame_dec->NextNumPassesToPause();
 
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+      if (dec->jpeg_decoder.IsStreaming()) {
+        // Write what is left of the previous rows before decoding more.
+        JxlDecoderStatus status = dec->jpeg_decoder.FlushStream();
+        if (status != JXL_DEC_SUCCESS) return status;
+      }
+#endif
+      SetFramePriorityRect(dec);
       JXL_API_RETURN_IF_ERROR(JxlDecoderProcessSections(dec));
 
       bool all_sections_done = dec->frame_dec->HasDecodedAll();
@@ -1475,11 +2964,18 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       }
 
       if (!all_sections_done) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+        if (dec->jpeg_decoder.IsStreaming()) {
+          // The frame decoder stops at a full output buffer.
+          JxlDecoderStatus status = dec->jpeg_decoder.FlushStream();
+          if (status != JXL_DEC_SUCCESS) return status;
+        }
+#endif
         // Not all sections have been processed yet
         return dec->RequestMoreInput();
       }
 
-      if (!dec->preview_frame) {
+      if (!dec->preview_frame && !dec->frame_refs_incomplete) {
         size_t internal_index = dec->internal_frames - 1;
         if (dec->frame_refs.size() <= internal_index) {
           return JXL_API_ERROR("internal");
@@ -1494,17 +2990,33 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       if (!dec->frame_dec->FinalizeFrame()) {
         return JXL_INPUT_ERROR("decoding frame failed");
       }
+      // Skips the sections that were not needed, e.g. the AC of a frame that
+      // is output from its DC, without requiring them to be available.
+      dec->AdvanceCodestream(dec->remaining_frame_size);
+      dec->remaining_frame_size = 0;
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
       // If jpeg output was requested, we merely return the JXL_DEC_FULL_IMAGE
       // status without outputting pixels.
-      if (dec->jpeg_decoder.IsOutputSet() && dec->ib->jpeg_data != nullptr) {
+      if (dec->jpeg_decoder.WantsJpegData() && dec->ib->jpeg_data != nullptr) {
         dec->frame_stage = FrameStage::kHeader;
-        dec->recon_output_jpeg = JpegReconStage::kSettingMetadata;
+        // Only a window of the coefficients is kept when streaming.
+        dec->jpeg_coefficients_ready = !dec->jpeg_decoder.IsStreaming();
+        if (dec->jpeg_decoder.IsStreaming()) {
+          // The metadata was set when the stream started.
+          dec->recon_output_jpeg = JpegReconStage::kOutputting;
+        } else if (dec->jpeg_decoder.IsOutputSet()) {
+          dec->recon_output_jpeg = JpegReconStage::kSettingMetadata;
+        }
         return JXL_DEC_FULL_IMAGE;
       }
 #endif
+      if (resample) {
+        JXL_API_RETURN_IF_ERROR(WriteImageBundle(dec, *dec->ib));
+      }
       if (dec->preview_frame || dec->is_last_of_still) {
         dec->image_out_buffer_set = false;
+        dec->image_out_channels.clear();
+        dec->ycbcr_planes_out.clear();
         dec->extra_channel_output.clear();
       }
     }
@@ -1552,11 +3064,27 @@ size_t JxlDecoderReleaseInput(JxlDecoder* dec) {
   size_t result = dec->avail_in;
   dec->next_in = nullptr;
   dec->avail_in = 0;
+  dec->persistent_input = nullptr;
+  dec->persistent_input_size = 0;
   return result;
 }
 
 void JxlDecoderCloseInput(JxlDecoder* dec) { dec->input_closed = true; }
 
+JxlDecoderStatus JxlDecoderSetPersistentInput(JxlDecoder* dec,
+                                              const uint8_t* data,
+                                              size_t size) {
+  if (dec->file_pos != 0) {
+    return JXL_API_ERROR("must set persistent input before starting");
+  }
+  JxlDecoderStatus status = JxlDecoderSetInput(dec, data, size);
+  if (status != JXL_DEC_SUCCESS) return status;
+  dec->persistent_input = data;
+  dec->persistent_input_size = size;
+  JxlDecoderCloseInput(dec);
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderSetJPEGBuffer(JxlDecoder* dec, uint8_t* data,
                                          size_t size) {
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
@@ -1583,52 +3111,123 @@ size_t JxlDecoderReleaseJPEGBuffer(JxlDecoder* dec) {
 #endif
 }
 
-// Parses the header of the box, outputting the 4-character type and the box
-// size, including header size, as stored in the box header.
-// @param in current input bytes.
-// @param size available input size.
-// @param pos position in the input, must begin at the header of the box.
-// @param file_pos position of pos since the start of the JXL file, rather than
-// the current input, used for integer overflow checking.
-// @param type the output box type.
-// @param box_size output the total box size, including header, in bytes, or 0
-// if it's a final unbounded box.
-// @param header_size output size of the box header.
-// @return JXL_DEC_SUCCESS if the box header was fully parsed. In that case the
-// parsing position must be incremented by header_size bytes.
-// JXL_DEC_NEED_MORE_INPUT if not enough input bytes available, in that case
-// header_size indicates a lower bound for the known size the header has to be
-// at least. JXL_DEC_ERROR if the box header is invalid.
-static JxlDecoderStatus ParseBoxHeader(const uint8_t* in, size_t size,
-                                       size_t pos, size_t file_pos,
-                                       JxlBoxType type, uint64_t* box_size,
-                                       uint64_t* header_size) {
-  if (OutOfBounds(pos, 8, size)) {
-    *header_size = 8;
-    return JXL_DEC_NEED_MORE_INPUT;
+JxlDecoderStatus JxlDecoderSetStreamingJPEGReconstruction(JxlDecoder* dec,
+                                                          JXL_BOOL enabled) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR(
+        "Must set streaming JPEG reconstruction option before starting");
   }
-  size_t box_start = pos;
-  // Box size, including this header itself.
-  *box_size = LoadBE32(in + pos);
-  pos += 4;
-  memcpy(type, in + pos, 4);
-  pos += 4;
-  if (*box_size == 1) {
-    *header_size = 16;
-    if (OutOfBounds(pos, 8, size)) return JXL_DEC_NEED_MORE_INPUT;
-    *box_size = LoadBE64(in + pos);
-    pos += 8;
+  dec->stream_jpeg_reconstruction = FROM_JXL_BOOL(enabled);
+  return JXL_DEC_SUCCESS;
+#else
+  return JXL_API_ERROR("JPEG reconstruction is not supported.");
+#endif
+}
+
+JxlDecoderStatus JxlDecoderSetJPEGCoefficientsOutput(JxlDecoder* dec,
+                                                     JXL_BOOL enabled) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (dec->internal_frames > 1 || dec->frame_stage != FrameStage::kHeader) {
+    return JXL_API_ERROR("Must set JPEG coefficients output before the frame");
   }
-  *header_size = pos - box_start;
-  if (*box_size > 0 && *box_size < *header_size) {
-    return JXL_INPUT_ERROR("invalid box size");
+  dec->jpeg_decoder.SetKeepJpegData(FROM_JXL_BOOL(enabled));
+  return JXL_DEC_SUCCESS;
+#else
+  return JXL_API_ERROR("JPEG reconstruction is not supported.");
+#endif
+}
+
+namespace {
+
+// Returns the component `index` of the decoded JPEG reconstruction frame, or
+// nullptr if it is not available.
+const jxl::jpeg::JPEGComponent* GetJPEGComponent(const JxlDecoder* dec,
+                                                 uint32_t index) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (!dec->jpeg_coefficients_ready || !dec->ib || !dec->ib->jpeg_data) {
+    return nullptr;
   }
-  if (file_pos + *box_size < file_pos) {
-    return JXL_INPUT_ERROR("Box size overflow");
+  const jxl::jpeg::JPEGData& jpeg_data = *dec->ib->jpeg_data;
+  if (index >= jpeg_data.components.size()) return nullptr;
+  return &jpeg_data.components[index];
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace
+
+JxlDecoderStatus JxlDecoderGetJPEGComponentCount(const JxlDecoder* dec,
+                                                 uint32_t* count) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (!dec->jpeg_coefficients_ready || !dec->ib || !dec->ib->jpeg_data) {
+    return JXL_API_ERROR("No JPEG coefficients available");
+  }
+  *count = dec->ib->jpeg_data->components.size();
+  return JXL_DEC_SUCCESS;
+#else
+  return JXL_API_ERROR("JPEG reconstruction is not supported.");
+#endif
+}
+
+JxlDecoderStatus JxlDecoderGetJPEGComponentInfo(const JxlDecoder* dec,
+                                                uint32_t index,
+                                                JxlJPEGComponentInfo* info) {
+  const jxl::jpeg::JPEGComponent* component = GetJPEGComponent(dec, index);
+  if (!component) return JXL_API_ERROR("No such JPEG component");
+  const jxl::jpeg::JPEGData& jpeg_data = *dec->ib->jpeg_data;
+  if (component->quant_idx >= jpeg_data.quant.size()) {
+    return JXL_API_ERROR("Invalid JPEG quantization table");
+  }
+  info->id = component->id;
+  info->h_samp_factor = component->h_samp_factor;
+  info->v_samp_factor = component->v_samp_factor;
+  info->width_in_blocks = component->width_in_blocks;
+  info->height_in_blocks = component->height_in_blocks;
+  const jxl::jpeg::JPEGQuantTable& quant =
+      jpeg_data.quant[component->quant_idx];
+  for (size_t i = 0; i < jxl::kDCTBlockSize; ++i) {
+    info->quant_table[i] = quant.values[i];
   }
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderGetJPEGCoefficients(const JxlDecoder* dec,
+                                               uint32_t index,
+                                               int16_t* coefficients,
+                                               size_t size) {
+  const jxl::jpeg::JPEGComponent* component = GetJPEGComponent(dec, index);
+  if (!component) return JXL_API_ERROR("No such JPEG component");
+  size_t num_coeffs = static_cast<size_t>(component->width_in_blocks) *
+                      component->height_in_blocks * jxl::kDCTBlockSize;
+  if (component->coeffs.size() < num_coeffs) {
+    return JXL_API_ERROR("Invalid JPEG component");
+  }
+  if (size < num_coeffs * sizeof(int16_t)) {
+    return JXL_API_ERROR("Buffer too small for the JPEG coefficients");
+  }
+  memcpy(coefficients, component->coeffs.data(),
+         num_coeffs * sizeof(int16_t));
+  return JXL_DEC_SUCCESS;
+}
+
+// Parses the header of the box, outputting the 4-character type and the box
+// size, including header size, as stored in the box header.
+// @param in current input bytes.
+// @param size available input size.
+// @param pos position in the input, must begin at the header of the box.
+// @param file_pos position of pos since the start of the JXL file, rather than
+// the current input, used for integer overflow checking.
+// @param type the output box type.
+// @param box_size output the total box size, including header, in bytes, or 0
+// if it's a final unbounded box.
+// @param header_size output size of the box header.
+// @return JXL_DEC_SUCCESS if the box header was fully parsed. In that case the
+// parsing position must be incremented by header_size bytes.
+// JXL_DEC_NEED_MORE_INPUT if not enough input bytes available, in that case
+// header_size indicates a lower bound for the known size the header has to be
+// at least. JXL_DEC_ERROR if the box header is invalid.
 // This includes handling the codestream if it is not a box-based jxl file.
 static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
   // Box handling loop
@@ -1706,17 +3305,8 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
     if (dec->recon_output_jpeg == JpegReconStage::kSettingMetadata &&
         !dec->JbrdNeedMoreBoxes()) {
-      jxl::jpeg::JPEGData* jpeg_data = dec->ib->jpeg_data.get();
-      if (dec->recon_exif_size) {
-        JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetExif(
-            dec->exif_metadata.data(), dec->exif_metadata.size(), jpeg_data);
-        if (status != JXL_DEC_SUCCESS) return status;
-      }
-      if (dec->recon_xmp_size) {
-        JxlDecoderStatus status = jxl::JxlToJpegDecoder::SetXmp(
-            dec->xmp_metadata.data(), dec->xmp_metadata.size(), jpeg_data);
-        if (status != JXL_DEC_SUCCESS) return status;
-      }
+      JxlDecoderStatus status = jxl::SetJPEGReconstructionMetadata(dec);
+      if (status != JXL_DEC_SUCCESS) return status;
       dec->recon_output_jpeg = JpegReconStage::kOutputting;
     }
 
@@ -2096,82 +3686,212 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
 static_assert(sizeof(JxlBasicInfo) == 204,
               "JxlBasicInfo struct size should remain constant");
 
-JxlDecoderStatus JxlDecoderGetBasicInfo(const JxlDecoder* dec,
-                                        JxlBasicInfo* info) {
-  if (!dec->got_basic_info) return JXL_DEC_NEED_MORE_INPUT;
+namespace {
 
-  if (info) {
-    memset(info, 0, sizeof(*info));
+// Fills the basic info of the image with the given codestream headers.
+void SetBasicInfo(const jxl::CodecMetadata& metadata, bool have_container,
+                  bool keep_orientation, float desired_intensity_target,
+                  JxlBasicInfo* info) {
+  memset(info, 0, sizeof(*info));
 
-    const jxl::ImageMetadata& meta = dec->metadata.m;
+  const jxl::ImageMetadata& meta = metadata.m;
 
-    info->have_container = TO_JXL_BOOL(dec->have_container);
-    info->xsize = dec->metadata.size.xsize();
-    info->ysize = dec->metadata.size.ysize();
-    info->uses_original_profile = TO_JXL_BOOL(!meta.xyb_encoded);
+  info->have_container = TO_JXL_BOOL(have_container);
+  info->xsize = metadata.size.xsize();
+  info->ysize = metadata.size.ysize();
+  info->uses_original_profile = TO_JXL_BOOL(!meta.xyb_encoded);
 
-    info->bits_per_sample = meta.bit_depth.bits_per_sample;
-    info->exponent_bits_per_sample = meta.bit_depth.exponent_bits_per_sample;
+  info->bits_per_sample = meta.bit_depth.bits_per_sample;
+  info->exponent_bits_per_sample = meta.bit_depth.exponent_bits_per_sample;
 
-    info->have_preview = TO_JXL_BOOL(meta.have_preview);
-    info->have_animation = TO_JXL_BOOL(meta.have_animation);
-    info->orientation = static_cast<JxlOrientation>(meta.orientation);
+  info->have_preview = TO_JXL_BOOL(meta.have_preview);
+  info->have_animation = TO_JXL_BOOL(meta.have_animation);
+  info->orientation = static_cast<JxlOrientation>(meta.orientation);
 
-    if (!dec->keep_orientation) {
-      if (info->orientation >= JXL_ORIENT_TRANSPOSE) {
-        std::swap(info->xsize, info->ysize);
-      }
-      info->orientation = JXL_ORIENT_IDENTITY;
+  if (!keep_orientation) {
+    if (info->orientation >= JXL_ORIENT_TRANSPOSE) {
+      std::swap(info->xsize, info->ysize);
     }
+    info->orientation = JXL_ORIENT_IDENTITY;
+  }
 
-    info->intensity_target = meta.IntensityTarget();
-    if (dec->desired_intensity_target > 0) {
-      info->intensity_target = dec->desired_intensity_target;
-    }
-    info->min_nits = meta.tone_mapping.min_nits;
-    info->relative_to_max_display =
-        TO_JXL_BOOL(meta.tone_mapping.relative_to_max_display);
-    info->linear_below = meta.tone_mapping.linear_below;
+  info->intensity_target = meta.IntensityTarget();
+  if (desired_intensity_target > 0) {
+    info->intensity_target = desired_intensity_target;
+  }
+  info->min_nits = meta.tone_mapping.min_nits;
+  info->relative_to_max_display =
+      TO_JXL_BOOL(meta.tone_mapping.relative_to_max_display);
+  info->linear_below = meta.tone_mapping.linear_below;
+
+  const jxl::ExtraChannelInfo* alpha = meta.Find(jxl::ExtraChannel::kAlpha);
+  if (alpha != nullptr) {
+    info->alpha_bits = alpha->bit_depth.bits_per_sample;
+    info->alpha_exponent_bits = alpha->bit_depth.exponent_bits_per_sample;
+    info->alpha_premultiplied = TO_JXL_BOOL(alpha->alpha_associated);
+  } else {
+    info->alpha_bits = 0;
+    info->alpha_exponent_bits = 0;
+    info->alpha_premultiplied = 0;
+  }
 
-    const jxl::ExtraChannelInfo* alpha = meta.Find(jxl::ExtraChannel::kAlpha);
-    if (alpha != nullptr) {
-      info->alpha_bits = alpha->bit_depth.bits_per_sample;
-      info->alpha_exponent_bits = alpha->bit_depth.exponent_bits_per_sample;
-      info->alpha_premultiplied = TO_JXL_BOOL(alpha->alpha_associated);
-    } else {
-      info->alpha_bits = 0;
-      info->alpha_exponent_bits = 0;
-      info->alpha_premultiplied = 0;
-    }
+  info->num_color_channels =
+      meta.color_encoding.GetColorSpace() == jxl::ColorSpace::kGray ? 1 : 3;
 
-    info->num_color_channels =
-        meta.color_encoding.GetColorSpace() == jxl::ColorSpace::kGray ? 1 : 3;
+  info->num_extra_channels = meta.num_extra_channels;
 
-    info->num_extra_channels = meta.num_extra_channels;
+  if (info->have_preview) {
+    info->preview.xsize = metadata.m.preview_size.xsize();
+    info->preview.ysize = metadata.m.preview_size.ysize();
+  }
 
-    if (info->have_preview) {
-      info->preview.xsize = dec->metadata.m.preview_size.xsize();
-      info->preview.ysize = dec->metadata.m.preview_size.ysize();
-    }
+  if (info->have_animation) {
+    info->animation.tps_numerator = metadata.m.animation.tps_numerator;
+    info->animation.tps_denominator = metadata.m.animation.tps_denominator;
+    info->animation.num_loops = metadata.m.animation.num_loops;
+    info->animation.have_timecodes =
+        TO_JXL_BOOL(metadata.m.animation.have_timecodes);
+  }
 
-    if (info->have_animation) {
-      info->animation.tps_numerator = dec->metadata.m.animation.tps_numerator;
-      info->animation.tps_denominator =
-          dec->metadata.m.animation.tps_denominator;
-      info->animation.num_loops = dec->metadata.m.animation.num_loops;
-      info->animation.have_timecodes =
-          TO_JXL_BOOL(dec->metadata.m.animation.have_timecodes);
-    }
+  if (meta.have_intrinsic_size) {
+    info->intrinsic_xsize = metadata.m.intrinsic_size.xsize();
+    info->intrinsic_ysize = metadata.m.intrinsic_size.ysize();
+  } else {
+    info->intrinsic_xsize = info->xsize;
+    info->intrinsic_ysize = info->ysize;
+  }
+}
 
-    if (meta.have_intrinsic_size) {
-      info->intrinsic_xsize = dec->metadata.m.intrinsic_size.xsize();
-      info->intrinsic_ysize = dec->metadata.m.intrinsic_size.ysize();
-    } else {
-      info->intrinsic_xsize = info->xsize;
-      info->intrinsic_ysize = info->ysize;
+}  // namespace
+
+JxlDecoderStatus JxlDecoderGetBasicInfo(const JxlDecoder* dec,
+                                        JxlBasicInfo* info) {
+  if (!dec->got_basic_info) return JXL_DEC_NEED_MORE_INPUT;
+
+  if (info) {
+    SetBasicInfo(dec->metadata, dec->have_container, dec->keep_orientation,
+                 dec->desired_intensity_target, info);
+  }
+
+  return JXL_DEC_SUCCESS;
+}
+
+namespace {
+
+// Like ReadBundle, without a decoder to request more input from.
+template <class T>
+JxlDecoderStatus ReadProbedBundle(jxl::Span<const uint8_t> data,
+                                  jxl::BitReader* reader, T* JXL_RESTRICT t) {
+  jxl::BitReader reader2(data);
+  reader2.SkipBits(reader->TotalBitsConsumed());
+  bool can_read = jxl::Bundle::CanRead(&reader2, t);
+  JXL_API_RETURN_IF_ERROR(reader2.Close());
+  if (!can_read) return JXL_DEC_NEED_MORE_INPUT;
+  if (!jxl::Bundle::Read(reader, t)) return JXL_DEC_ERROR;
+  return JXL_DEC_SUCCESS;
+}
+
+// Finds the codestream available in `data`. It points into `data`, unless the
+// codestream is split in several "jxlp" boxes, which are then concatenated in
+// `parts`.
+JxlDecoderStatus FindProbedCodestream(const uint8_t* data, size_t size,
+                                      std::vector<uint8_t>* parts,
+                                      jxl::Span<const uint8_t>* codestream,
+                                      bool* have_container) {
+  JxlSignature sig = JxlSignatureCheck(data, size);
+  if (sig == JXL_SIG_NOT_ENOUGH_BYTES) return JXL_DEC_NEED_MORE_INPUT;
+  if (sig == JXL_SIG_INVALID) return JXL_INPUT_ERROR("invalid signature");
+  *have_container = (sig == JXL_SIG_CONTAINER);
+  if (!*have_container) {
+    *codestream = jxl::Bytes(data, size);
+    return JXL_DEC_SUCCESS;
+  }
+  size_t num_parts = 0;
+  size_t pos = 0;
+  while (pos < size) {
+    JxlBoxType type;
+    uint64_t box_size;
+    uint64_t header_size;
+    JXL_API_RETURN_IF_ERROR(
+        ParseBoxHeader(data, size, pos, pos, type, &box_size, &header_size));
+    const uint64_t end = box_size == 0 ? size : pos + box_size;
+    uint64_t start = pos + header_size;
+    const bool is_jxlc = memcmp(type, "jxlc", 4) == 0;
+    const bool is_jxlp = memcmp(type, "jxlp", 4) == 0;
+    if (is_jxlp) start += 4;  // The index of the part.
+    if (end < start) return JXL_INPUT_ERROR("invalid box size");
+    if ((is_jxlc || is_jxlp) && start < size) {
+      const jxl::Span<const uint8_t> part =
+          jxl::Bytes(data + start, std::min<uint64_t>(end, size) - start);
+      if (num_parts == 1) codestream->AppendTo(*parts);
+      if (num_parts >= 1) {
+        part.AppendTo(*parts);
+        *codestream = jxl::Bytes(*parts);
+      } else {
+        *codestream = part;
+      }
+      ++num_parts;
     }
+    if (is_jxlc || end >= size) break;
+    pos = end;
+  }
+  return num_parts == 0 ? JXL_DEC_NEED_MORE_INPUT : JXL_DEC_SUCCESS;
+}
+
+}  // namespace
+
+JxlDecoderStatus JxlDecoderProbeHeader(const JxlMemoryManager* memory_manager,
+                                       const uint8_t* data, size_t size,
+                                       JxlBasicInfo* info,
+                                       uint8_t* icc_profile, size_t icc_size,
+                                       size_t* icc_required_size) {
+  std::vector<uint8_t> parts;
+  jxl::Span<const uint8_t> span;
+  bool have_container;
+  JXL_API_RETURN_IF_ERROR(
+      FindProbedCodestream(data, size, &parts, &span, &have_container));
+  if (span.size() < 2) return JXL_DEC_NEED_MORE_INPUT;
+  if (span[0] != 0xff || span[1] != jxl::kCodestreamMarker) {
+    return JXL_INPUT_ERROR("invalid signature");
+  }
+  JXL_API_RETURN_IF_ERROR(span.remove_prefix(2));
+
+  jxl::CodecMetadata metadata;
+  auto reader = jxl::GetBitReader(span);
+  JXL_API_RETURN_IF_ERROR(ReadProbedBundle(span, reader.get(), &metadata.size));
+  JXL_API_RETURN_IF_ERROR(ReadProbedBundle(span, reader.get(), &metadata.m));
+  if (info) {
+    SetBasicInfo(metadata, have_container, /*keep_orientation=*/false,
+                 /*desired_intensity_target=*/0, info);
   }
+  if (icc_required_size == nullptr) return JXL_DEC_SUCCESS;
+  *icc_required_size = 0;
+  if (!metadata.m.color_encoding.WantICC()) return JXL_DEC_SUCCESS;
 
+  metadata.transform_data.nonserialized_xyb_encoded = metadata.m.xyb_encoded;
+  JXL_API_RETURN_IF_ERROR(
+      ReadProbedBundle(span, reader.get(), &metadata.transform_data));
+  JxlMemoryManager local_memory_manager;
+  if (!jxl::MemoryManagerInit(&local_memory_manager, memory_manager)) {
+    return JXL_API_ERROR("invalid memory manager");
+  }
+  jxl::ICCReader icc_reader(&local_memory_manager);
+  jxl::Status status = icc_reader.Init(reader.get(), /*output_limit=*/0);
+  if (!reader->AllReadsWithinBounds() ||
+      status.code() == jxl::StatusCode::kNotEnoughBytes) {
+    return JXL_DEC_NEED_MORE_INPUT;
+  }
+  if (!status) return JXL_DEC_ERROR;
+  jxl::PaddedBytes decoded_icc{&local_memory_manager};
+  status = icc_reader.Process(reader.get(), &decoded_icc);
+  if (status.code() == jxl::StatusCode::kNotEnoughBytes) {
+    return JXL_DEC_NEED_MORE_INPUT;
+  }
+  if (!status || decoded_icc.empty()) return JXL_DEC_ERROR;
+  *icc_required_size = decoded_icc.size();
+  if (icc_profile != nullptr && icc_size >= decoded_icc.size()) {
+    memcpy(icc_profile, decoded_icc.data(), decoded_icc.size());
+  }
   return JXL_DEC_SUCCESS;
 }
 
@@ -2333,6 +4053,9 @@ JxlDecoderStatus PrepareSizeCheck(const JxlDecoder* dec,
   if (*bits == 0) {
     return JXL_API_ERROR("Invalid/unsupported data type");
   }
+  if (format->data_type == JXL_TYPE_RGB10A2 && format->num_channels != 4) {
+    return JXL_API_ERROR("Packed RGB10A2 output must have 4 channels");
+  }
 
   return JXL_DEC_SUCCESS;
 }
@@ -2345,6 +4068,8 @@ size_t JxlDecoderGetIntendedDownsamplingRatio(JxlDecoder* dec) {
 
 JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec) {
   if (!dec->image_out_buffer_set) return JXL_DEC_ERROR;
+  // The resampled image is only available once the frame is complete.
+  if (dec->output_xsize != 0) return JXL_DEC_ERROR;
   if (dec->frame_stage != FrameStage::kFull) {
     return JXL_DEC_ERROR;
   }
@@ -2364,15 +4089,104 @@ JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec) {
 
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetCms(JxlDecoder* dec,
                                              const JxlCmsInterface cms) {
-  if (!dec->passes_state) {
-    dec->passes_state =
-        jxl::make_unique<jxl::PassesDecoderState>(&dec->memory_manager);
-  }
+  EnsurePassesState(dec);
   dec->passes_state->output_encoding_info.color_management_system = cms;
   dec->passes_state->output_encoding_info.cms_set = true;
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetCmsLutSize(JxlDecoder* dec, uint32_t grid_size) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set CMS lookup table size before starting");
+  }
+  if (grid_size == 1 || grid_size > 65) {
+    return JXL_API_ERROR("Invalid CMS lookup table size %u", grid_size);
+  }
+  dec->cms_lut_size = grid_size;
+  return JXL_DEC_SUCCESS;
+}
+
+namespace {
+
+// Decodes the first frame of the gain map codestream into `gain_map`.
+jxl::Status DecodeGainMap(JxlMemoryManager* memory_manager,
+                          const uint8_t* data, size_t size,
+                          jxl::GainMap* gain_map) {
+  std::unique_ptr<JxlDecoder, decltype(&JxlDecoderDestroy)> dec(
+      JxlDecoderCreate(memory_manager), JxlDecoderDestroy);
+  JXL_ENSURE(dec);
+  JXL_ENSURE(JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO |
+                                                      JXL_DEC_FULL_IMAGE) ==
+             JXL_DEC_SUCCESS);
+  JXL_ENSURE(JxlDecoderSetInput(dec.get(), data, size) == JXL_DEC_SUCCESS);
+  JxlDecoderCloseInput(dec.get());
+  JxlBasicInfo info;
+  JxlPixelFormat format = {1, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0};
+  std::vector<float> pixels;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_BASIC_INFO) {
+      JXL_ENSURE(JxlDecoderGetBasicInfo(dec.get(), &info) == JXL_DEC_SUCCESS);
+      format.num_channels = info.num_color_channels;
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      pixels.resize(static_cast<size_t>(info.xsize) * info.ysize *
+                    format.num_channels);
+      JXL_ENSURE(JxlDecoderSetImageOutBuffer(dec.get(), &format, pixels.data(),
+                                             pixels.size() * sizeof(float)) ==
+                 JXL_DEC_SUCCESS);
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      break;
+    } else {
+      return JXL_FAILURE("Invalid gain map codestream");
+    }
+  }
+  gain_map->planes.clear();
+  for (size_t c = 0; c < format.num_channels; c++) {
+    JXL_ASSIGN_OR_RETURN(
+        jxl::ImageF plane,
+        jxl::ImageF::Create(memory_manager, info.xsize, info.ysize));
+    for (size_t y = 0; y < info.ysize; y++) {
+      const float* JXL_RESTRICT row_in =
+          pixels.data() + y * info.xsize * format.num_channels;
+      float* JXL_RESTRICT row_out = plane.Row(y);
+      for (size_t x = 0; x < info.xsize; x++) {
+        row_out[x] = row_in[x * format.num_channels + c];
+      }
+    }
+    gain_map->planes.emplace_back(std::move(plane));
+  }
+  return true;
+}
+
+}  // namespace
+
+JxlDecoderStatus JxlDecoderSetGainMap(JxlDecoder* dec,
+                                      const JxlGainMapBundle* bundle,
+                                      float display_headroom) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set the gain map before starting");
+  }
+  if (bundle == nullptr) {
+    dec->gain_map.reset();
+    return JXL_DEC_SUCCESS;
+  }
+  if (!(display_headroom >= 1.0f)) {
+    return JXL_API_ERROR("Display headroom must be at least 1");
+  }
+  auto gain_map = jxl::make_unique<jxl::GainMap>();
+  if (!gain_map->SetMetadata(bundle->gain_map_metadata,
+                             bundle->gain_map_metadata_size,
+                             display_headroom)) {
+    return JXL_API_ERROR("Invalid gain map metadata");
+  }
+  if (!DecodeGainMap(&dec->memory_manager, bundle->gain_map,
+                     bundle->gain_map_size, gain_map.get())) {
+    return JXL_API_ERROR("Failed to decode the gain map");
+  }
+  dec->gain_map = std::move(gain_map);
+  return JXL_DEC_SUCCESS;
+}
+
 static JxlDecoderStatus GetMinSize(const JxlDecoder* dec,
                                    const JxlPixelFormat* format,
                                    size_t num_channels, size_t* min_size,
@@ -2380,6 +4194,9 @@ static JxlDecoderStatus GetMinSize(const JxlDecoder* dec,
   size_t bits;
   JxlDecoderStatus status = PrepareSizeCheck(dec, format, &bits);
   if (status != JXL_DEC_SUCCESS) return status;
+  if (num_channels != 0 && format->data_type == JXL_TYPE_RGB10A2) {
+    return JXL_API_ERROR("Packed RGB10A2 output is only for the color image");
+  }
   size_t xsize;
   size_t ysize;
   if (preview) {
@@ -2430,6 +4247,8 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetPreviewOutBuffer(
 
   dec->image_out_buffer_set = true;
   dec->image_out_buffer = buffer;
+  dec->image_out_channels.clear();
+  dec->ycbcr_planes_out.clear();
   dec->image_out_size = size;
   dec->image_out_format = *format;
 
@@ -2446,13 +4265,22 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderImageOutBufferSize(
   return GetMinSize(dec, format, 0, size, false);
 }
 
+namespace {
+
+bool HasImageOutCallback(const JxlDecoder* dec) {
+  return dec->image_out_run_callback != nullptr ||
+         dec->image_out_tile_callback != nullptr;
+}
+
+}  // namespace
+
 JxlDecoderStatus JxlDecoderSetImageOutBuffer(JxlDecoder* dec,
                                              const JxlPixelFormat* format,
                                              void* buffer, size_t size) {
   if (!dec->got_basic_info || !(dec->orig_events_wanted & JXL_DEC_FULL_IMAGE)) {
     return JXL_API_ERROR("No image out buffer needed at this time");
   }
-  if (dec->image_out_buffer_set && !!dec->image_out_run_callback) {
+  if (dec->image_out_buffer_set && HasImageOutCallback(dec)) {
     return JXL_API_ERROR(
         "Cannot change from image out callback to image out buffer");
   }
@@ -2470,13 +4298,144 @@ JxlDecoderStatus JxlDecoderSetImageOutBuffer(JxlDecoder* dec,
   if (size < min_size) return JXL_DEC_ERROR;
 
   dec->image_out_buffer_set = true;
+  dec->image_out_tile_callback = nullptr;
   dec->image_out_buffer = buffer;
+  dec->image_out_channels.clear();
+  dec->ycbcr_planes_out.clear();
   dec->image_out_size = size;
   dec->image_out_format = *format;
 
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetImageOutChannelBuffers(
+    JxlDecoder* dec, const JxlPixelFormat* format,
+    const JxlChannelBuffer* channels) {
+  if (!dec->got_basic_info || !(dec->orig_events_wanted & JXL_DEC_FULL_IMAGE)) {
+    return JXL_API_ERROR("No image out buffer needed at this time");
+  }
+  if (dec->image_out_buffer_set && HasImageOutCallback(dec)) {
+    return JXL_API_ERROR(
+        "Cannot change from image out callback to image out buffer");
+  }
+  if (format->num_channels < 3 &&
+      !dec->image_metadata.color_encoding.IsGray()) {
+    return JXL_API_ERROR("Number of channels is too low for color output");
+  }
+  if (format->num_channels == 0) {
+    return JXL_API_ERROR("At least one channel is required");
+  }
+  if (format->data_type == JXL_TYPE_RGB10A2) {
+    return JXL_API_ERROR("Packed RGB10A2 output needs an interleaved buffer");
+  }
+  size_t bits;
+  JxlDecoderStatus status = PrepareSizeCheck(dec, format, &bits);
+  if (status != JXL_DEC_SUCCESS) return status;
+  for (size_t c = 0; c < format->num_channels; ++c) {
+    if (channels[c].base == nullptr) {
+      return JXL_API_ERROR("Channel buffer must not be NULL");
+    }
+    if (channels[c].pixel_stride * jxl::kBitsPerByte < bits) {
+      return JXL_API_ERROR("Pixel stride smaller than a sample");
+    }
+  }
+
+  dec->image_out_buffer_set = true;
+  dec->image_out_tile_callback = nullptr;
+  dec->image_out_buffer = nullptr;
+  dec->image_out_channels.assign(channels, channels + format->num_channels);
+  dec->ycbcr_planes_out.clear();
+  dec->image_out_size = 0;
+  dec->image_out_format = *format;
+
+  return JXL_DEC_SUCCESS;
+}
+
+namespace {
+
+// Checks that the current frame can be output as YCbCr planes.
+JxlDecoderStatus CheckYCbCrPlanesOutput(const JxlDecoder* dec) {
+  if (!dec->got_basic_info || !(dec->orig_events_wanted & JXL_DEC_FULL_IMAGE)) {
+    return JXL_API_ERROR("No image out buffer needed at this time");
+  }
+  if (!dec->frame_header || dec->frame_stage != FrameStage::kFull) {
+    return JXL_API_ERROR("Don't know frame header yet");
+  }
+  const jxl::FrameHeader& header = *dec->frame_header;
+  if (header.color_transform != jxl::ColorTransform::kYCbCr) {
+    return JXL_API_ERROR("Frame is not in YCbCr");
+  }
+  if (header.upsampling != 1 || header.loop_filter.gab ||
+      header.loop_filter.epf_iters != 0 || header.flags != 0) {
+    return JXL_API_ERROR("YCbCr frame needs more than chroma upsampling");
+  }
+  if (header.CanBeReferenced() || jxl::NeedsBlending(header) ||
+      header.nonserialized_is_preview) {
+    return JXL_API_ERROR("YCbCr frame is not a complete image");
+  }
+  if (!dec->keep_orientation && dec->metadata.m.orientation != 1) {
+    return JXL_API_ERROR("YCbCr planes can not be oriented");
+  }
+  jxl::Rect crop;
+  if (GetCropRegion(dec, &crop)) {
+    return JXL_API_ERROR("YCbCr planes can not be cropped");
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+}  // namespace
+
+JxlDecoderStatus JxlDecoderYCbCrPlaneSize(const JxlDecoder* dec,
+                                          uint32_t plane, size_t* xsize,
+                                          size_t* ysize) {
+  JxlDecoderStatus status = CheckYCbCrPlanesOutput(dec);
+  if (status != JXL_DEC_SUCCESS) return status;
+  if (plane >= 3) return JXL_API_ERROR("Invalid plane index");
+  // Planes are Y, Cb, Cr; channels are Cb, Y, Cr.
+  const size_t kChannelForPlane[3] = {1, 0, 2};
+  const jxl::YCbCrChromaSubsampling& cs = dec->frame_header->chroma_subsampling;
+  size_t c = kChannelForPlane[plane];
+  *xsize = jxl::DivCeil(dec->metadata.size.xsize(), size_t{1} << cs.HShift(c));
+  *ysize = jxl::DivCeil(dec->metadata.size.ysize(), size_t{1} << cs.VShift(c));
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetYCbCrPlanesOutBuffer(
+    JxlDecoder* dec, JxlDataType data_type, const JxlChannelBuffer* planes) {
+  JxlDecoderStatus status = CheckYCbCrPlanesOutput(dec);
+  if (status != JXL_DEC_SUCCESS) return status;
+  if (dec->image_out_buffer_set && HasImageOutCallback(dec)) {
+    return JXL_API_ERROR(
+        "Cannot change from image out callback to image out buffer");
+  }
+  size_t sample_size;
+  if (data_type == JXL_TYPE_UINT8) {
+    sample_size = 1;
+  } else if (data_type == JXL_TYPE_FLOAT) {
+    sample_size = sizeof(float);
+  } else {
+    return JXL_API_ERROR("Invalid/unsupported data type");
+  }
+  for (size_t p = 0; p < 3; ++p) {
+    if (planes[p].base == nullptr) {
+      return JXL_API_ERROR("Plane buffer must not be NULL");
+    }
+    if (planes[p].pixel_stride < sample_size) {
+      return JXL_API_ERROR("Pixel stride smaller than a sample");
+    }
+  }
+
+  dec->image_out_buffer_set = true;
+  dec->image_out_tile_callback = nullptr;
+  dec->image_out_buffer = nullptr;
+  dec->image_out_channels.clear();
+  dec->ycbcr_planes_out.assign(planes, planes + 3);
+  dec->ycbcr_planes_data_type = data_type;
+  dec->image_out_size = 0;
+
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderExtraChannelBufferSize(const JxlDecoder* dec,
                                                   const JxlPixelFormat* format,
                                                   size_t* size,
@@ -2520,6 +4479,21 @@ JxlDecoderStatus JxlDecoderSetExtraChannelBuffer(JxlDecoder* dec,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetExtraChannelNeeded(JxlDecoder* dec,
+                                                 uint32_t index,
+                                                 JXL_BOOL needed) {
+  if (!dec->got_basic_info) {
+    return JXL_API_ERROR("Basic info not yet available");
+  }
+  if (index >= dec->metadata.m.num_extra_channels) {
+    return JXL_API_ERROR("Invalid extra channel index");
+  }
+  dec->skipped_extra_channels.resize(dec->metadata.m.num_extra_channels,
+                                     false);
+  dec->skipped_extra_channels[index] = !FROM_JXL_BOOL(needed);
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderSetImageOutCallback(JxlDecoder* dec,
                                                const JxlPixelFormat* format,
                                                JxlImageOutCallback callback,
@@ -2549,7 +4523,9 @@ JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
     JxlDecoder* dec, const JxlPixelFormat* format,
     JxlImageOutInitCallback init_callback, JxlImageOutRunCallback run_callback,
     JxlImageOutDestroyCallback destroy_callback, void* init_opaque) {
-  if (dec->image_out_buffer_set && !!dec->image_out_buffer) {
+  if (dec->image_out_buffer_set &&
+      (!!dec->image_out_buffer || !dec->image_out_channels.empty() ||
+       !dec->ycbcr_planes_out.empty())) {
     return JXL_API_ERROR(
         "Cannot change from image out buffer to image out callback");
   }
@@ -2565,6 +4541,7 @@ JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
   if (status != JXL_DEC_SUCCESS) return status;
 
   dec->image_out_buffer_set = true;
+  dec->image_out_tile_callback = nullptr;
   dec->image_out_init_callback = init_callback;
   dec->image_out_run_callback = run_callback;
   dec->image_out_destroy_callback = destroy_callback;
@@ -2574,6 +4551,55 @@ JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetImageOutTileCallback(
+    JxlDecoder* dec, const JxlPixelFormat* format,
+    JxlImageOutTileCallback callback, void* opaque) {
+  if (dec->image_out_buffer_set &&
+      (!!dec->image_out_buffer || !dec->image_out_channels.empty() ||
+       !dec->ycbcr_planes_out.empty())) {
+    return JXL_API_ERROR(
+        "Cannot change from image out buffer to image out callback");
+  }
+
+  if (callback == nullptr) {
+    return JXL_API_ERROR("The callback is required");
+  }
+
+  // Perform error checking for invalid format.
+  size_t bits_sink;
+  JxlDecoderStatus status = PrepareSizeCheck(dec, format, &bits_sink);
+  if (status != JXL_DEC_SUCCESS) return status;
+
+  dec->image_out_buffer_set = true;
+  dec->image_out_init_callback = nullptr;
+  dec->image_out_run_callback = nullptr;
+  dec->image_out_destroy_callback = nullptr;
+  dec->image_out_init_opaque = nullptr;
+  dec->image_out_tile_callback = callback;
+  dec->image_out_tile_opaque = opaque;
+  dec->image_out_format = *format;
+
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderGetMemoryEstimate(const JxlDecoder* dec,
+                                             size_t num_threads,
+                                             size_t* bytes) {
+  if (!dec->got_basic_info) {
+    return JXL_API_ERROR("basic info not yet available");
+  }
+  uint64_t estimate;
+  if (dec->frame_dec && dec->frame_stage != FrameStage::kHeader) {
+    estimate = jxl::EstimateFrameMemory(*dec->frame_header, num_threads,
+                                        jxl::FrameKeepsJpegData(dec));
+  } else {
+    estimate = jxl::EstimateImageMemory(dec->metadata, num_threads);
+  }
+  *bytes = static_cast<size_t>(
+      std::min<uint64_t>(estimate, std::numeric_limits<size_t>::max()));
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderGetFrameHeader(const JxlDecoder* dec,
                                           JxlFrameHeader* header) {
   if (!dec->frame_header || dec->frame_stage == FrameStage::kHeader) {
@@ -2673,6 +4699,84 @@ JxlDecoderStatus JxlDecoderGetFrameName(const JxlDecoder* dec, char* name,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderGetFrameByteRanges(const JxlDecoder* dec,
+                                              uint32_t num_passes,
+                                              JxlByteRange* ranges,
+                                              size_t max_ranges,
+                                              size_t* num_ranges) {
+  if (!dec->frame_header || !dec->frame_dec ||
+      dec->frame_stage == FrameStage::kHeader) {
+    return JXL_API_ERROR("no frame header available");
+  }
+  if (!dec->frame_sections_in_file) {
+    return JXL_API_ERROR("frame is split over several boxes");
+  }
+  const jxl::FrameHeader& frame_header = *dec->frame_header;
+  const jxl::FrameDimensions frame_dim = frame_header.ToFrameDimensions();
+  // The region needed for the crop, in pixels of the frame before upsampling,
+  // with a border for the filters.
+  size_t x0 = 0;
+  size_t y0 = 0;
+  size_t x1 = frame_dim.xsize_padded;
+  size_t y1 = frame_dim.ysize_padded;
+  jxl::Rect crop;
+  if (!frame_header.custom_size_or_origin && GetCropRegion(dec, &crop)) {
+    constexpr size_t kBorder = 2 * jxl::kBlockDim;
+    crop = UnorientCropRegion(dec, crop);
+    const size_t upsampling = frame_header.upsampling;
+    x0 = crop.x0() / upsampling;
+    y0 = crop.y0() / upsampling;
+    x0 = x0 > kBorder ? x0 - kBorder : 0;
+    y0 = y0 > kBorder ? y0 - kBorder : 0;
+    x1 = jxl::DivCeil(crop.x1(), upsampling) + kBorder;
+    y1 = jxl::DivCeil(crop.y1(), upsampling) + kBorder;
+  }
+  // Whether the group at (gx, gy) of groups of `dim` pixels is needed.
+  const auto group_needed = [&](size_t gx, size_t gy, size_t dim) {
+    return gx * dim < x1 && x0 < (gx + 1) * dim && gy * dim < y1 &&
+           y0 < (gy + 1) * dim;
+  };
+  const size_t num_dc_groups = frame_dim.num_dc_groups;
+  const size_t ac_global_id = num_dc_groups + 1;
+  const size_t dc_group_dim = frame_dim.dc_group_dim;
+  const auto section_needed = [&](size_t id) {
+    if (id == 0) return true;
+    if (id < ac_global_id) {
+      const size_t g = id - 1;
+      return group_needed(g % frame_dim.xsize_dc_groups,
+                          g / frame_dim.xsize_dc_groups, dc_group_dim);
+    }
+    if (num_passes == 0) return false;
+    if (id == ac_global_id) return true;
+    const size_t pass = (id - ac_global_id - 1) / frame_dim.num_groups;
+    const size_t g = (id - ac_global_id - 1) % frame_dim.num_groups;
+    return pass < num_passes &&
+           group_needed(g % frame_dim.xsize_groups, g / frame_dim.xsize_groups,
+                        frame_dim.group_dim);
+  };
+
+  const auto& toc = dec->frame_dec->Toc();
+  uint64_t pos = dec->frame_sections_file_pos;
+  size_t count = 0;
+  // Whether the previous section was needed, so that the next one extends
+  // its range.
+  bool extend = false;
+  for (const auto& entry : toc) {
+    // A single section contains the whole frame.
+    const bool needed = toc.size() == 1 || section_needed(entry.id);
+    if (needed && extend) {
+      if (count <= max_ranges) ranges[count - 1].size += entry.size;
+    } else if (needed) {
+      if (count < max_ranges) ranges[count] = {pos, entry.size};
+      ++count;
+    }
+    extend = needed;
+    pos += entry.size;
+  }
+  *num_ranges = count;
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderSetPreferredColorProfile(
     JxlDecoder* dec, const JxlColorEncoding* color_encoding) {
   return JxlDecoderSetOutputColorProfile(dec, color_encoding,
@@ -2743,6 +4847,20 @@ JxlDecoderStatus JxlDecoderSetDesiredIntensityTarget(
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetToneMappingLutSize(JxlDecoder* dec,
+                                                 uint32_t lut_size) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR(
+        "Must set tone mapping lookup table size before starting");
+  }
+  if (lut_size != 0 && (lut_size < 16 || lut_size > 4096)) {
+    return JXL_API_ERROR("Invalid tone mapping lookup table size %u",
+                         lut_size);
+  }
+  dec->tone_mapping_lut_size = lut_size;
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderSetBoxBuffer(JxlDecoder* dec, uint8_t* data,
                                         size_t size) {
   if (dec->box_out_buffer_set) {
@@ -2862,3 +4980,19 @@ JxlDecoderStatus JxlDecoderSetImageOutBitDepth(JxlDecoder* dec,
   dec->image_out_bit_depth = *bit_depth;
   return JXL_DEC_SUCCESS;
 }
+
+JxlDecoderStats* JxlDecoderStatsCreate() { return new JxlDecoderStats(); }
+
+void JxlDecoderStatsDestroy(JxlDecoderStats* stats) { delete stats; }
+
+uint64_t JxlDecoderStatsGet(const JxlDecoderStats* stats,
+                            JxlDecoderStatsKey key) {
+  if (!stats || key < 0 || key >= JXL_DEC_STATS_NUM_KEYS) return 0;
+  return stats->stats.Get(key);
+}
+
+void JxlDecoderStatsMerge(JxlDecoderStats* stats,
+                          const JxlDecoderStats* other) {
+  if (!stats || !other) return;
+  stats->stats.Merge(other->stats);
+}
@@ -0,0 +1,414 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// End-to-end decoding benchmarks through the public API. Each benchmark reports
+// "MP/s" and the peak heap use of the decoder, "peak_MiB"; the
+// jxl_decode_gbench target runs all of them and writes the results as JSON.
+
+#include <jxl/codestream_header.h>
+#include <jxl/decode.h>
+#include <jxl/decode_cxx.h>
+#include <jxl/encode.h>
+#include <jxl/encode_cxx.h>
+#include <jxl/memory_manager.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/random.h"
+#include "tools/file_io.h"
+
+namespace jxl {
+namespace {
+
+#define QUIT(M)           \
+  state.SkipWithError(M); \
+  return;
+
+#define BM_CHECK(C) \
+  if (!(C)) {       \
+    QUIT(#C)        \
+  }
+
+// Keeps track of the peak number of bytes allocated through it.
+class PeakMemoryManager {
+ public:
+  PeakMemoryManager() {
+    manager_.opaque = this;
+    manager_.alloc = &Alloc;
+    manager_.free = &Free;
+  }
+
+  JxlMemoryManager* get() { return &manager_; }
+  size_t peak() const { return peak_; }
+  void Reset() { peak_ = current_.load(); }
+
+ private:
+  // Room for the size of each allocation in front of it, keeping the
+  // alignment of malloc.
+  static constexpr size_t kHeader = 16;
+
+  static void* Alloc(void* opaque, size_t size) {
+    auto* self = static_cast<PeakMemoryManager*>(opaque);
+    auto* block = static_cast<uint8_t*>(malloc(size + kHeader));
+    if (block == nullptr) return nullptr;
+    *reinterpret_cast<size_t*>(block) = size;
+    size_t current = self->current_ += size;
+    size_t peak = self->peak_;
+    while (current > peak &&
+           !self->peak_.compare_exchange_weak(peak, current)) {
+    }
+    return block + kHeader;
+  }
+
+  static void Free(void* opaque, void* address) {
+    if (address == nullptr) return;
+    auto* self = static_cast<PeakMemoryManager*>(opaque);
+    uint8_t* block = static_cast<uint8_t*>(address) - kHeader;
+    self->current_ -= *reinterpret_cast<size_t*>(block);
+    free(block);
+  }
+
+  JxlMemoryManager manager_;
+  std::atomic<size_t> current_{0};
+  std::atomic<size_t> peak_{0};
+};
+
+// Smooth gradients with some noise, so that neither mode compresses it
+// unrealistically well.
+std::vector<uint8_t> GenerateImage(size_t xsize, size_t ysize) {
+  std::vector<uint8_t> pixels(xsize * ysize * 3);
+  Rng rng(0);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      uint8_t* pixel = &pixels[(y * xsize + x) * 3];
+      pixel[0] = (x * 255 / xsize + rng.UniformU(0, 8)) & 0xFF;
+      pixel[1] = (y * 255 / ysize + rng.UniformU(0, 8)) & 0xFF;
+      pixel[2] = ((x + y) * 127 / (xsize + ysize) + rng.UniformU(0, 8)) & 0xFF;
+    }
+  }
+  return pixels;
+}
+
+struct EncodeParams {
+  bool modular = false;
+  int effort = 7;
+  bool progressive = false;
+  // Value of JXL_ENC_FRAME_SETTING_RESAMPLING, 1 to code at full resolution.
+  int resampling = 1;
+};
+
+bool EncodeImage(size_t xsize, size_t ysize, const EncodeParams& params,
+                 std::vector<uint8_t>* compressed) {
+  std::vector<uint8_t> pixels = GenerateImage(xsize, ysize);
+  JxlEncoderPtr enc = JxlEncoderMake(/*memory_manager=*/nullptr);
+  JxlBasicInfo info;
+  JxlEncoderInitBasicInfo(&info);
+  info.xsize = xsize;
+  info.ysize = ysize;
+  info.uses_original_profile = TO_JXL_BOOL(params.modular);
+  if (JxlEncoderSetBasicInfo(enc.get(), &info) != JXL_ENC_SUCCESS) {
+    return false;
+  }
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  if (JxlEncoderSetColorEncoding(enc.get(), &color_encoding) !=
+      JXL_ENC_SUCCESS) {
+    return false;
+  }
+  JxlEncoderFrameSettings* settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+  JxlEncoderFrameSettingsSetOption(settings, JXL_ENC_FRAME_SETTING_EFFORT,
+                                   params.effort);
+  if (params.modular) {
+    JxlEncoderSetFrameLossless(settings, JXL_TRUE);
+  } else {
+    JxlEncoderSetFrameDistance(settings, 1.0f);
+  }
+  if (params.progressive) {
+    JxlEncoderFrameSettingsSetOption(settings,
+                                     JXL_ENC_FRAME_SETTING_PROGRESSIVE_DC, 1);
+    JxlEncoderFrameSettingsSetOption(
+        settings, params.modular ? JXL_ENC_FRAME_SETTING_RESPONSIVE
+                                 : JXL_ENC_FRAME_SETTING_QPROGRESSIVE_AC,
+        1);
+  }
+  if (params.resampling > 1) {
+    JxlEncoderFrameSettingsSetOption(settings, JXL_ENC_FRAME_SETTING_RESAMPLING,
+                                     params.resampling);
+  }
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  if (JxlEncoderAddImageFrame(settings, &format, pixels.data(),
+                              pixels.size()) != JXL_ENC_SUCCESS) {
+    return false;
+  }
+  JxlEncoderCloseInput(enc.get());
+  compressed->resize(4096);
+  uint8_t* next_out = compressed->data();
+  size_t avail_out = compressed->size();
+  JxlEncoderStatus status = JXL_ENC_NEED_MORE_OUTPUT;
+  while (status == JXL_ENC_NEED_MORE_OUTPUT) {
+    status = JxlEncoderProcessOutput(enc.get(), &next_out, &avail_out);
+    if (status == JXL_ENC_NEED_MORE_OUTPUT) {
+      size_t offset = next_out - compressed->data();
+      compressed->resize(compressed->size() * 2);
+      next_out = compressed->data() + offset;
+      avail_out = compressed->size() - offset;
+    }
+  }
+  compressed->resize(next_out - compressed->data());
+  return status == JXL_ENC_SUCCESS;
+}
+
+// Recompresses a JPEG file of the test data losslessly.
+bool EncodeJPEG(const std::string& path, std::vector<uint8_t>* compressed) {
+  std::vector<uint8_t> jpeg;
+  if (!jpegxl::tools::ReadFile(std::string(TEST_DATA_PATH "/") + path,
+                               &jpeg)) {
+    return false;
+  }
+  JxlEncoderPtr enc = JxlEncoderMake(/*memory_manager=*/nullptr);
+  if (JxlEncoderStoreJPEGMetadata(enc.get(), JXL_TRUE) != JXL_ENC_SUCCESS) {
+    return false;
+  }
+  JxlEncoderFrameSettings* settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+  if (JxlEncoderAddJPEGFrame(settings, jpeg.data(), jpeg.size()) !=
+      JXL_ENC_SUCCESS) {
+    return false;
+  }
+  JxlEncoderCloseInput(enc.get());
+  compressed->resize(jpeg.size() + 4096);
+  uint8_t* next_out = compressed->data();
+  size_t avail_out = compressed->size();
+  if (JxlEncoderProcessOutput(enc.get(), &next_out, &avail_out) !=
+      JXL_ENC_SUCCESS) {
+    return false;
+  }
+  compressed->resize(next_out - compressed->data());
+  return true;
+}
+
+enum class DecodeMode {
+  // Decodes to a full image buffer.
+  kFull,
+  // Receives the pixels row by row through an image out callback.
+  kStreaming,
+  // Gets the input in 16 KiB chunks, and flushes the image at each
+  // progression step.
+  kProgressive,
+  // Reconstructs the original JPEG file.
+  kJPEG,
+};
+
+struct DecodeResult {
+  size_t xsize = 0;
+  size_t ysize = 0;
+};
+
+bool DecodeOnce(const std::vector<uint8_t>& compressed, DecodeMode mode,
+                void* runner, JxlMemoryManager* memory_manager,
+                DecodeResult* result) {
+  JxlDecoderPtr dec = JxlDecoderMake(memory_manager);
+  int events = JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE;
+  if (mode == DecodeMode::kProgressive) events |= JXL_DEC_FRAME_PROGRESSION;
+  if (mode == DecodeMode::kJPEG) events |= JXL_DEC_JPEG_RECONSTRUCTION;
+  if (JxlDecoderSubscribeEvents(dec.get(), events) != JXL_DEC_SUCCESS) {
+    return false;
+  }
+  if (runner != nullptr &&
+      JxlDecoderSetParallelRunner(dec.get(), JxlThreadParallelRunner,
+                                  runner) != JXL_DEC_SUCCESS) {
+    return false;
+  }
+  if (mode == DecodeMode::kProgressive &&
+      JxlDecoderSetProgressiveDetail(dec.get(), kPasses) != JXL_DEC_SUCCESS) {
+    return false;
+  }
+  const size_t chunk_size =
+      mode == DecodeMode::kProgressive ? 16384 : compressed.size();
+  size_t input_end = std::min(chunk_size, compressed.size());
+  JxlDecoderSetInput(dec.get(), compressed.data(), input_end);
+  if (input_end == compressed.size()) JxlDecoderCloseInput(dec.get());
+
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels;
+  std::vector<uint8_t> jpeg;
+  size_t checksum = 0;
+  const auto row_callback = [](void* opaque, size_t /*x*/, size_t /*y*/,
+                               size_t /*num_pixels*/, const void* pixels) {
+    *static_cast<size_t*>(opaque) += static_cast<const uint8_t*>(pixels)[0];
+  };
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_ERROR) return false;
+    if (status == JXL_DEC_SUCCESS) break;
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      if (input_end == compressed.size()) return false;
+      size_t remaining = JxlDecoderReleaseInput(dec.get());
+      size_t input_start = input_end - remaining;
+      input_end = std::min(input_end + chunk_size, compressed.size());
+      JxlDecoderSetInput(dec.get(), compressed.data() + input_start,
+                         input_end - input_start);
+      if (input_end == compressed.size()) JxlDecoderCloseInput(dec.get());
+    } else if (status == JXL_DEC_BASIC_INFO) {
+      JxlBasicInfo info;
+      if (JxlDecoderGetBasicInfo(dec.get(), &info) != JXL_DEC_SUCCESS) {
+        return false;
+      }
+      result->xsize = info.xsize;
+      result->ysize = info.ysize;
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      if (mode == DecodeMode::kStreaming) {
+        if (JxlDecoderSetImageOutCallback(dec.get(), &format, row_callback,
+                                          &checksum) != JXL_DEC_SUCCESS) {
+          return false;
+        }
+        continue;
+      }
+      size_t buffer_size;
+      if (JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size) !=
+          JXL_DEC_SUCCESS) {
+        return false;
+      }
+      pixels.resize(buffer_size);
+      if (JxlDecoderSetImageOutBuffer(dec.get(), &format, pixels.data(),
+                                      pixels.size()) != JXL_DEC_SUCCESS) {
+        return false;
+      }
+    } else if (status == JXL_DEC_FRAME_PROGRESSION) {
+      if (JxlDecoderFlushImage(dec.get()) != JXL_DEC_SUCCESS) return false;
+    } else if (status == JXL_DEC_JPEG_RECONSTRUCTION) {
+      jpeg.resize(compressed.size() * 2);
+      if (JxlDecoderSetJPEGBuffer(dec.get(), jpeg.data(), jpeg.size()) !=
+          JXL_DEC_SUCCESS) {
+        return false;
+      }
+    } else if (status == JXL_DEC_JPEG_NEED_MORE_OUTPUT) {
+      size_t used = jpeg.size() - JxlDecoderReleaseJPEGBuffer(dec.get());
+      jpeg.resize(jpeg.size() * 2);
+      if (JxlDecoderSetJPEGBuffer(dec.get(), jpeg.data() + used,
+                                  jpeg.size() - used) != JXL_DEC_SUCCESS) {
+        return false;
+      }
+    } else if (status != JXL_DEC_FULL_IMAGE) {
+      return false;
+    }
+  }
+  benchmark::DoNotOptimize(checksum);
+  benchmark::DoNotOptimize(pixels.data());
+  benchmark::DoNotOptimize(jpeg.data());
+  return true;
+}
+
+void RunDecodeBenchmark(benchmark::State& state,
+                        const std::vector<uint8_t>& compressed,
+                        DecodeMode mode, size_t num_threads) {
+  // With one thread, everything runs on the calling thread.
+  JxlThreadParallelRunnerPtr runner =
+      num_threads > 1
+          ? JxlThreadParallelRunnerMake(/*memory_manager=*/nullptr, num_threads)
+          : nullptr;
+  PeakMemoryManager memory_manager;
+  DecodeResult result;
+  size_t peak_memory = 0;
+  for (auto _ : state) {
+    (void)_;
+    memory_manager.Reset();
+    BM_CHECK(DecodeOnce(compressed, mode, runner.get(), memory_manager.get(),
+                        &result));
+    peak_memory = std::max(peak_memory, memory_manager.peak());
+  }
+  const double num_pixels = static_cast<double>(result.xsize) * result.ysize;
+  state.counters["MP/s"] = benchmark::Counter(
+      num_pixels * 1e-6 * state.iterations(), benchmark::Counter::kIsRate);
+  state.counters["peak_MiB"] = peak_memory / (1024.0 * 1024.0);
+  state.counters["compressed_bytes"] = compressed.size();
+  state.SetItemsProcessed(state.iterations() * num_pixels);
+}
+
+// Arguments: image size, effort, threads.
+void BM_DecodeImage(benchmark::State& state, EncodeParams params,
+                    DecodeMode mode) {
+  params.effort = state.range(1);
+  std::vector<uint8_t> compressed;
+  BM_CHECK(EncodeImage(state.range(0), state.range(0), params, &compressed));
+  RunDecodeBenchmark(state, compressed, mode, state.range(2));
+}
+
+// Arguments: image size, resampling factor. The decoding of the images coded
+// at a lower resolution is dominated by the upsampling stage.
+void BM_DecodeResampledImage(benchmark::State& state) {
+  EncodeParams params;
+  params.effort = 3;
+  params.resampling = state.range(1);
+  std::vector<uint8_t> compressed;
+  BM_CHECK(EncodeImage(state.range(0), state.range(0), params, &compressed));
+  RunDecodeBenchmark(state, compressed, DecodeMode::kFull, /*num_threads=*/1);
+}
+
+// Arguments: threads.
+void BM_DecodeJPEGReconstruction(benchmark::State& state) {
+  std::vector<uint8_t> compressed;
+  BM_CHECK(EncodeJPEG("jxl/flower/flower.png.im_q85_420.jpg", &compressed));
+  RunDecodeBenchmark(state, compressed, DecodeMode::kJPEG, state.range(0));
+}
+
+void ImageArgs(benchmark::internal::Benchmark* b) {
+  for (int size : {256, 1024, 2048}) {
+    for (int effort : {3, 7}) {
+      for (int threads : {1, 2, 4, 8}) {
+        b->Args({size, effort, threads});
+      }
+    }
+  }
+}
+
+void ResamplingArgs(benchmark::internal::Benchmark* b) {
+  for (int size : {1024, 2048}) {
+    for (int resampling : {1, 2, 4, 8}) {
+      b->Args({size, resampling});
+    }
+  }
+}
+
+void ThreadArgs(benchmark::internal::Benchmark* b) {
+  for (int threads : {1, 2, 4, 8}) b->Arg(threads);
+}
+
+BENCHMARK_CAPTURE(BM_DecodeImage, VarDCT, EncodeParams{false, 7, false},
+                  DecodeMode::kFull)
+    ->Apply(ImageArgs)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_DecodeImage, Modular, EncodeParams{true, 7, false},
+                  DecodeMode::kFull)
+    ->Apply(ImageArgs)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_DecodeImage, VarDCTStreaming,
+                  EncodeParams{false, 7, false}, DecodeMode::kStreaming)
+    ->Apply(ImageArgs)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_DecodeImage, VarDCTProgressive,
+                  EncodeParams{false, 7, true}, DecodeMode::kProgressive)
+    ->Apply(ImageArgs)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_DecodeImage, ModularProgressive,
+                  EncodeParams{true, 7, true}, DecodeMode::kProgressive)
+    ->Apply(ImageArgs)
+    ->UseRealTime();
+BENCHMARK(BM_DecodeResampledImage)->Apply(ResamplingArgs)->UseRealTime();
+BENCHMARK(BM_DecodeJPEGReconstruction)->Apply(ThreadArgs)->UseRealTime();
+
+}  // namespace
+}  // namespace jxl
@@ -5,6 +5,7 @@
 
 #include "lib/extras/dec/decode.h"
 
+#include <jxl/arena_memory_manager.h>
 #include <jxl/cms.h>
 #include <jxl/codestream_header.h>
 #include <jxl/color_encoding.h>
@@ -19,6 +20,7 @@
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -1943,8 +1945,10 @@ TEST_P(DecodeAllEncodingsVariantsTest, SetPreferredColorProfileTest) {
 void DecodeImageWithColorEncoding(const std::vector<uint8_t>& compressed,
                                   jxl::ColorEncoding& color_encoding,
                                   bool with_cms, std::vector<uint8_t>& out,
-                                  JxlBasicInfo& info) {
+                                  JxlBasicInfo& info,
+                                  uint32_t cms_lut_size = 0) {
   JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCmsLutSize(dec, cms_lut_size));
   int events = JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING | JXL_DEC_FULL_IMAGE;
   EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSubscribeEvents(dec, events));
   EXPECT_EQ(JXL_DEC_SUCCESS,
@@ -2025,6 +2029,136 @@ TEST_P(DecodeAllEncodingsWithCMSTest, DecodeWithCMS) {
   EXPECT_LT(dist, .1);
 }
 
+TEST(DecodeTest, CmsLutSizeTest) {
+  size_t xsize = 177;
+  size_t ysize = 123;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  std::vector<uint8_t> data = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+
+  jxl::ColorEncoding color_encoding;
+  ASSERT_TRUE(color_encoding.SetWhitePointType(jxl::WhitePoint::kD65));
+  ASSERT_TRUE(color_encoding.SetPrimariesType(jxl::Primaries::kP3));
+  color_encoding.Tf().SetTransferFunction(jxl::TransferFunction::kSRGB);
+  std::vector<uint8_t> out_exact;
+  JxlBasicInfo info_exact;
+  DecodeImageWithColorEncoding(data, color_encoding, true, out_exact,
+                               info_exact);
+  std::vector<uint8_t> out_lut;
+  JxlBasicInfo info_lut;
+  DecodeImageWithColorEncoding(data, color_encoding, true, out_lut, info_lut,
+                               /*cms_lut_size=*/33);
+  ASSERT_EQ(out_exact.size(), out_lut.size());
+  int max_diff = 0;
+  for (size_t i = 0; i + 1 < out_exact.size(); i += 2) {
+    int exact = (out_exact[i] << 8) | out_exact[i + 1];
+    int lut = (out_lut[i] << 8) | out_lut[i + 1];
+    max_diff = std::max(max_diff, std::abs(exact - lut));
+  }
+  EXPECT_LE(max_diff, 128);
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCmsLutSize(dec.get(), 1));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCmsLutSize(dec.get(), 66));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCmsLutSize(dec.get(), 65));
+}
+
+TEST(DecodeTest, PixelTestRGB10A2) {
+  size_t xsize = 123;
+  size_t ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  jxl::TestCodestreamParams params;
+  params.cparams.SetLossless();
+  std::vector<uint8_t> data = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 4, params);
+
+  JxlPixelFormat format = {4, JXL_TYPE_RGB10A2, JXL_LITTLE_ENDIAN, 0};
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec.get(), data.data(), data.size()));
+  EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec.get()));
+  size_t buffer_size;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size));
+  EXPECT_EQ(xsize * ysize * 4, buffer_size);
+  JxlPixelFormat rgb_format = format;
+  rgb_format.num_channels = 3;
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderImageOutBufferSize(
+                               dec.get(), &rgb_format, &buffer_size));
+  std::vector<uint8_t> out(xsize * ysize * 4);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                 dec.get(), &format, out.data(), out.size()));
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+
+  // The input pixels are 16-bit big endian RGBA.
+  for (size_t i = 0; i < xsize * ysize; i++) {
+    uint32_t packed = LoadLE32(out.data() + 4 * i);
+    for (size_t c = 0; c < 4; c++) {
+      uint32_t bits = c < 3 ? 10 : 2;
+      uint32_t max = (1u << bits) - 1;
+      uint32_t expected = static_cast<uint32_t>(std::lround(
+          LoadBE16(pixels.data() + 8 * i + 2 * c) * max / 65535.0));
+      ASSERT_NEAR(expected, (packed >> (10 * c)) & max, 1);
+    }
+  }
+}
+
+std::vector<float> DecodeToneMapped(const std::vector<uint8_t>& compressed,
+                                    uint32_t tone_mapping_lut_size) {
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetToneMappingLutSize(
+                                 dec.get(), tone_mapping_lut_size));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetDesiredIntensityTarget(dec.get(), 255));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec.get()));
+  JxlPixelFormat format = {3, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0};
+  size_t buffer_size;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size));
+  std::vector<float> out(buffer_size / sizeof(float));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutBuffer(dec.get(), &format, out.data(),
+                                        out.size() * sizeof(float)));
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+  return out;
+}
+
+TEST(DecodeTest, ToneMappingLutSizeTest) {
+  size_t xsize = 177;
+  size_t ysize = 123;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::ColorEncoding color_encoding;
+  ASSERT_TRUE(color_encoding.SetWhitePointType(jxl::WhitePoint::kD65));
+  ASSERT_TRUE(color_encoding.SetPrimariesType(jxl::Primaries::k2100));
+  color_encoding.Tf().SetTransferFunction(jxl::TransferFunction::kPQ);
+  jxl::TestCodestreamParams params;
+  params.color_space = Description(color_encoding);
+  params.intensity_target = 4000;
+  std::vector<uint8_t> data = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+
+  std::vector<float> out_exact = DecodeToneMapped(data, 0);
+  std::vector<float> out_lut = DecodeToneMapped(data, 1024);
+  ASSERT_EQ(out_exact.size(), out_lut.size());
+  float max_diff = 0;
+  for (size_t i = 0; i < out_exact.size(); i++) {
+    max_diff = std::max(max_diff, std::abs(out_exact[i] - out_lut[i]));
+  }
+  EXPECT_LE(max_diff, 2e-3f);
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetToneMappingLutSize(dec.get(), 15));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetToneMappingLutSize(dec.get(), 4097));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetToneMappingLutSize(dec.get(), 16));
+}
+
 // Tests the case of lossy sRGB image without alpha channel, decoded to RGB8
 // and to RGBA8
 TEST(DecodeTest, PixelTestOpaqueSrgbLossy) {
@@ -3019,6 +3153,49 @@ TEST(DecodeTest, SkipCurrentFrameTest) {
   JxlDecoderDestroy(dec);
 }
 
+// An extra channel that is not needed does not change the color channels.
+TEST(DecodeTest, ExtraChannelNotNeededTest) {
+  size_t xsize = 300;
+  size_t ysize = 280;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  JxlPixelFormat format_orig = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+
+  jxl::TestCodestreamParams params;
+  params.cparams.SetLossless();
+  params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 4, params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetExtraChannelNeeded(dec.get(), 0, JXL_FALSE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(),
+                                      JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetExtraChannelNeeded(dec.get(), 1, JXL_FALSE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetExtraChannelNeeded(dec.get(), 0, JXL_FALSE));
+
+  EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec.get()));
+  size_t buffer_size;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size));
+  std::vector<uint8_t> image(buffer_size);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutBuffer(dec.get(), &format, image.data(),
+                                        image.size()));
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec.get()));
+
+  EXPECT_EQ(0u, jxl::test::ComparePixels(pixels.data(), image.data(), xsize,
+                                         ysize, format_orig, format));
+}
+
 TEST(DecodeTest, SkipFrameTest) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
   size_t xsize = 90;
@@ -4006,112 +4183,1355 @@ void VerifyProgression(size_t xsize, size_t ysize, uint32_t num_channels,
   JxlDecoderDestroy(dec);
 }
 
-TEST(DecodeTest, ProgressionTest) {
-  size_t xsize = 508;
-  size_t ysize = 470;
-  uint32_t num_channels = 3;
-  std::vector<uint8_t> pixels =
-      jxl::test::GetSomeTestImage(xsize, ysize, num_channels, 0);
-  jxl::TestCodestreamParams params;
-  params.cparams.progressive_dc = 1;
-  params.preview_mode = jxl::kSmallPreview;
-  std::vector<uint8_t> data =
-      jxl::CreateTestJXLCodestream(jxl::Bytes(pixels.data(), pixels.size()),
-                                   xsize, ysize, num_channels, params);
-  StreamPositions streampos;
-  AnalyzeCodestream(data, &streampos);
-  const std::vector<FramePositions>& fp = streampos.frames;
-  // We have preview, dc frame and regular frame.
-  EXPECT_EQ(3, fp.size());
-  EXPECT_EQ(7, fp[2].section_end.size());
-  EXPECT_EQ(data.size(), fp[2].section_end[6]);
-  std::vector<Breakpoint> breakpoints{
-      {fp[0].frame_start, NO_FLUSH},           // headers
-      {fp[1].frame_start, NO_FLUSH},           // preview
-      {fp[2].frame_start, NO_FLUSH},           // dc frame
-      {fp[2].section_end[0], NO_FLUSH},        // DC global
-      {fp[2].section_end[1] - 1, NO_FLUSH},    // partial DC group
-      {fp[2].section_end[1], NEW_FLUSH},       // DC group
-      {fp[2].section_end[2], SAME_FLUSH},      // AC global
-      {fp[2].section_end[3], NEW_FLUSH},       // AC group 0
-      {fp[2].section_end[4] - 1, SAME_FLUSH},  // partial AC group 1
-      {fp[2].section_end[4], NEW_FLUSH},       // AC group 1
-      {fp[2].section_end[5], NEW_FLUSH},       // AC group 2
-      {data.size() - 1, SAME_FLUSH},           // partial AC group 3
-      {data.size(), NEW_FLUSH}};               // full image
-  VerifyProgression(xsize, ysize, num_channels, pixels, data, breakpoints);
+TEST(DecodeTest, CropRegionTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  size_t xsize = 700;
+  size_t ysize = 600;
+  JxlPixelFormat format_orig = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  // 16-bit output, so that no position-dependent dithering is applied.
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_LITTLE_ENDIAN, 0};
+
+  for (uint32_t orientation : {1, 6}) {
+    jxl::CodecInOut io{memory_manager};
+    ASSERT_TRUE(io.SetSize(xsize, ysize));
+    io.metadata.m.SetUintSamples(16);
+    io.metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+    io.metadata.m.orientation = orientation;
+    EXPECT_TRUE(ConvertFromExternal(
+        jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize,
+        jxl::ColorEncoding::SRGB(/*is_gray=*/false),
+        /*bits_per_sample=*/16, format_orig, /*pool=*/nullptr, &io.Main()));
+    jxl::CompressParams cparams;
+    cparams.speed_tier = jxl::SpeedTier::kSquirrel;
+    std::vector<uint8_t> compressed;
+    ASSERT_TRUE(jxl::test::EncodeFile(cparams, &io, &compressed));
+
+    size_t oxsize = orientation > 4 ? ysize : xsize;
+    size_t oysize = orientation > 4 ? xsize : ysize;
+
+    // Decodes the region (x0, y0, w, h), or the full image if w is 0.
+    const auto decode = [&](uint32_t x0, uint32_t y0, uint32_t w, uint32_t h) {
+      JxlDecoder* dec = JxlDecoderCreate(nullptr);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSubscribeEvents(
+                    dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+      EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCropRegion(dec, x0, y0, w, h));
+      EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+      size_t buffer_size;
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderImageOutBufferSize(dec, &format, &buffer_size));
+      EXPECT_EQ((w == 0 ? oxsize * oysize : w * h) * 6, buffer_size);
+      std::vector<uint8_t> out(buffer_size);
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                     dec, &format, out.data(), out.size()));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+      JxlDecoderDestroy(dec);
+      return out;
+    };
+
+    std::vector<uint8_t> full = decode(0, 0, 0, 0);
+    const uint32_t crops[][4] = {
+        {0, 0, 1, 1}, {300, 270, 40, 50}, {250, 100, 300, 280}, {17, 3, 1, 5}};
+    for (const auto& crop : crops) {
+      std::vector<uint8_t> cropped = decode(crop[0], crop[1], crop[2], crop[3]);
+      for (size_t y = 0; y < crop[3]; ++y) {
+        size_t offset = ((crop[1] + y) * oxsize + crop[0]) * 6;
+        ASSERT_EQ(0, memcmp(full.data() + offset,
+                            cropped.data() + y * crop[2] * 6, crop[2] * 6));
+      }
+    }
+  }
+
+  // The crop region can not start outside of the image.
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCropRegion(dec, xsize, 0, 10, 10));
+  JxlDecoderDestroy(dec);
 }
 
-TEST(DecodeTest, ProgressionTestLosslessAlpha) {
-  size_t xsize = 508;
-  size_t ysize = 470;
-  uint32_t num_channels = 4;
-  std::vector<uint8_t> pixels =
-      jxl::test::GetSomeTestImage(xsize, ysize, num_channels, 0);
+// A persistent input split in several codestream boxes decodes to the same
+// pixels, also when cropped.
+TEST(DecodeTest, PersistentInputTest) {
+  size_t xsize = 700;
+  size_t ysize = 600;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
   jxl::TestCodestreamParams params;
-  params.cparams.SetLossless();
-  params.cparams.speed_tier = jxl::SpeedTier::kThunder;
-  params.cparams.responsive = 1;
-  std::vector<uint8_t> data =
-      jxl::CreateTestJXLCodestream(jxl::Bytes(pixels.data(), pixels.size()),
-                                   xsize, ysize, num_channels, params);
-  StreamPositions streampos;
-  AnalyzeCodestream(data, &streampos);
-  const std::vector<FramePositions>& fp = streampos.frames;
-  // We have preview, dc frame and regular frame.
-  EXPECT_EQ(1, fp.size());
-  EXPECT_EQ(7, fp[0].section_end.size());
-  EXPECT_EQ(data.size(), fp[0].section_end[6]);
-  std::vector<Breakpoint> breakpoints{
-      {fp[0].frame_start, NO_FLUSH},           // headers
-      {fp[0].section_end[0] - 1, NO_FLUSH},    // partial DC global
-      {fp[0].section_end[0], NEW_FLUSH},       // DC global
-      {fp[0].section_end[1], SAME_FLUSH},      // DC group
-      {fp[0].section_end[2], SAME_FLUSH},      // AC global
-      {fp[0].section_end[3], NEW_FLUSH},       // AC group 0
-      {fp[0].section_end[4] - 1, SAME_FLUSH},  // partial AC group 1
-      {fp[0].section_end[4], NEW_FLUSH},       // AC group 1
-      {fp[0].section_end[5], NEW_FLUSH},       // AC group 2
-      {data.size() - 1, SAME_FLUSH},           // partial AC group 3
-      {data.size(), NEW_FLUSH}};               // full image
-  VerifyProgression(xsize, ysize, num_channels, pixels, data, breakpoints);
-}
+  params.box_format = kCSBF_Multi_Other_Terminated;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_LITTLE_ENDIAN, 0};
 
-void VerifyFilePosition(size_t expected_pos, const std::vector<uint8_t>& data,
-                        JxlDecoder* dec) {
-  size_t remaining = JxlDecoderReleaseInput(dec);
-  size_t pos = data.size() - remaining;
-  EXPECT_EQ(expected_pos, pos);
+  // Decodes the region (x0, y0, w, h), or the full image if w is 0.
+  const auto decode = [&](bool persistent, uint32_t x0, uint32_t y0,
+                          uint32_t w, uint32_t h) {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(
+                  dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+    if (persistent) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetPersistentInput(dec, compressed.data(),
+                                             compressed.size()));
+    } else {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+      JxlDecoderCloseInput(dec);
+    }
+    EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCropRegion(dec, x0, y0, w, h));
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    size_t buffer_size;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderImageOutBufferSize(dec, &format, &buffer_size));
+    std::vector<uint8_t> out(buffer_size);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                   dec, &format, out.data(), out.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+    return out;
+  };
+
+  std::vector<uint8_t> full = decode(/*persistent=*/false, 0, 0, 0, 0);
+  EXPECT_EQ(full, decode(/*persistent=*/true, 0, 0, 0, 0));
+  const uint32_t crop[4] = {300, 270, 40, 50};
+  std::vector<uint8_t> cropped =
+      decode(/*persistent=*/true, crop[0], crop[1], crop[2], crop[3]);
+  for (size_t y = 0; y < crop[3]; ++y) {
+    size_t offset = ((crop[1] + y) * xsize + crop[0]) * 6;
+    ASSERT_EQ(0, memcmp(full.data() + offset, cropped.data() + y * crop[2] * 6,
+                        crop[2] * 6));
+  }
+
+  // The persistent input must be set before decoding starts.
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
   EXPECT_EQ(JXL_DEC_SUCCESS,
-            JxlDecoderSetInput(dec, data.data() + pos, remaining));
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  JxlDecoderReleaseInput(dec);
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetPersistentInput(
+                               dec, compressed.data(), compressed.size()));
+  JxlDecoderDestroy(dec);
 }
 
-TEST(DecodeTest, InputHandlingTestOneShot) {
-  size_t xsize = 508;
-  size_t ysize = 470;
-  uint32_t num_channels = 3;
-  std::vector<uint8_t> pixels =
-      jxl::test::GetSomeTestImage(xsize, ysize, num_channels, 0);
-  for (int i = 0; i < kCSBF_NUM_ENTRIES; ++i) {
-    printf("Testing with box format %d\n", i);
-    jxl::TestCodestreamParams params;
-    params.cparams.progressive_dc = 1;
-    params.preview_mode = jxl::kSmallPreview;
-    params.box_format = static_cast<CodeStreamBoxFormat>(i);
-    std::vector<uint8_t> data =
-        jxl::CreateTestJXLCodestream(jxl::Bytes(pixels.data(), pixels.size()),
-                                     xsize, ysize, num_channels, params);
-    JxlPixelFormat format = {num_channels, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
-    StreamPositions streampos;
-    AnalyzeCodestream(data, &streampos);
-    const std::vector<FramePositions>& fp = streampos.frames;
-    // We have preview, dc frame and regular frame.
-    EXPECT_EQ(3, fp.size());
-
-    std::vector<uint8_t> pixels2;
-    pixels2.resize(pixels.size());
+// Decoding into strided and planar channel buffers gives the same pixels as
+// decoding into an interleaved buffer.
+TEST(DecodeTest, ChannelBuffersTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  size_t xsize = 300;
+  size_t ysize = 200;
+  JxlPixelFormat format_orig = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  JxlPixelFormat format = {4, JXL_TYPE_UINT16, JXL_LITTLE_ENDIAN, 0};
+  const size_t kSampleSize = 2;
 
-    int kNumEvents = 6;
+  for (uint32_t orientation : {1, 6}) {
+    jxl::CodecInOut io{memory_manager};
+    ASSERT_TRUE(io.SetSize(xsize, ysize));
+    io.metadata.m.SetUintSamples(16);
+    io.metadata.m.SetAlphaBits(16);
+    io.metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+    io.metadata.m.orientation = orientation;
+    EXPECT_TRUE(ConvertFromExternal(
+        jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize,
+        jxl::ColorEncoding::SRGB(/*is_gray=*/false),
+        /*bits_per_sample=*/16, format_orig, /*pool=*/nullptr, &io.Main()));
+    jxl::CompressParams cparams;
+    cparams.speed_tier = jxl::SpeedTier::kSquirrel;
+    std::vector<uint8_t> compressed;
+    ASSERT_TRUE(jxl::test::EncodeFile(cparams, &io, &compressed));
+
+    size_t oxsize = orientation > 4 ? ysize : xsize;
+    size_t oysize = orientation > 4 ? xsize : ysize;
+    std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+        jxl::Bytes(compressed.data(), compressed.size()), format,
+        /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+    ASSERT_EQ(oxsize * oysize * 4 * kSampleSize, expected.size());
+
+    // Decodes into `out` with the given channel layout.
+    const auto decode = [&](const JxlChannelBuffer* channels) {
+      JxlDecoder* dec = JxlDecoderCreate(nullptr);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSubscribeEvents(
+                    dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+      EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutChannelBuffers(dec, &format, channels));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+      JxlDecoderDestroy(dec);
+    };
+    const auto expected_sample = [&](size_t x, size_t y, size_t c) {
+      return expected.data() + ((y * oxsize + x) * 4 + c) * kSampleSize;
+    };
+
+    // Interleaved rows with padding at the end of each row.
+    size_t row_stride = oxsize * 4 * kSampleSize + 10;
+    std::vector<uint8_t> padded(row_stride * oysize);
+    JxlChannelBuffer interleaved[4];
+    for (size_t c = 0; c < 4; ++c) {
+      interleaved[c] = {padded.data() + c * kSampleSize, 4 * kSampleSize,
+                        row_stride};
+    }
+    decode(interleaved);
+    for (size_t y = 0; y < oysize; ++y) {
+      ASSERT_EQ(0, memcmp(expected_sample(0, y, 0),
+                          padded.data() + y * row_stride,
+                          oxsize * 4 * kSampleSize));
+    }
+
+    // One plane per channel, with a different padding for each plane.
+    std::vector<uint8_t> planes[4];
+    JxlChannelBuffer planar[4];
+    for (size_t c = 0; c < 4; ++c) {
+      size_t plane_stride = (oxsize + c * 3) * kSampleSize;
+      planes[c].resize(plane_stride * oysize);
+      planar[c] = {planes[c].data(), kSampleSize, plane_stride};
+    }
+    decode(planar);
+    for (size_t c = 0; c < 4; ++c) {
+      for (size_t y = 0; y < oysize; ++y) {
+        for (size_t x = 0; x < oxsize; ++x) {
+          const uint8_t* sample = planes[c].data() + y * planar[c].row_stride +
+                                  x * kSampleSize;
+          ASSERT_EQ(0, memcmp(expected_sample(x, y, c), sample, kSampleSize));
+        }
+      }
+    }
+  }
+}
+
+// Decoding images one after another with a decoder that keeps its buffers
+// gives the same pixels as decoding each image with a new decoder.
+TEST(DecodeTest, KeepBuffersTest) {
+  const size_t sizes[][2] = {{300, 200}, {150, 260}, {300, 200}, {64, 1}};
+  std::vector<std::vector<uint8_t>> codestreams;
+  for (const auto& size : sizes) {
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(size[0], size[1], 3, size[0]);
+    codestreams.push_back(jxl::CreateTestJXLCodestream(
+        jxl::Bytes(pixels.data(), pixels.size()), size[0], size[1], 3,
+        jxl::TestCodestreamParams()));
+  }
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetKeepBuffers(dec, JXL_TRUE));
+  JxlBasicInfo info = {};
+  info.orientation = JXL_ORIENT_IDENTITY;
+  info.xsize = 300;
+  info.ysize = 260;
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderReserveBuffers(dec, &info));
+  for (const auto& compressed : codestreams) {
+    std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+        jxl::Bytes(compressed), format, /*use_callback=*/false,
+        /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true);
+    JxlDecoderReset(dec);
+    std::vector<uint8_t> pixels = jxl::DecodeWithAPI(
+        dec, jxl::Bytes(compressed), format, /*use_callback=*/false,
+        /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true);
+    EXPECT_EQ(expected, pixels);
+  }
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetKeepBuffers(dec, JXL_FALSE));
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, ReducedPrecisionBuffersTest) {
+  size_t xsize = 600;
+  size_t ysize = 400;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  params.cparams.epf = 2;
+  params.cparams.gaborish = jxl::Override::kOn;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+      jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetReducedPrecisionBuffers(dec, JXL_TRUE));
+  std::vector<uint8_t> decoded = jxl::DecodeWithAPI(
+      dec, jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  // Setting options after starting is not allowed.
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetReducedPrecisionBuffers(dec, JXL_FALSE));
+  JxlDecoderDestroy(dec);
+
+  ASSERT_EQ(expected.size(), decoded.size());
+  int max_diff = 0;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    max_diff = std::max(max_diff, std::abs(static_cast<int>(expected[i]) -
+                                           static_cast<int>(decoded[i])));
+  }
+  EXPECT_LE(max_diff, 1);
+}
+
+// The saved reference frames of an 8-bit animation are kept as 16-bit floats
+// with reduced precision buffers.
+TEST(DecodeTest, ReducedPrecisionReferenceFramesTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  size_t xsize = 90;
+  size_t ysize = 120;
+  constexpr size_t num_frames = 6;
+  JxlPixelFormat input_format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+
+  jxl::CodecInOut io{memory_manager};
+  ASSERT_TRUE(io.SetSize(xsize, ysize));
+  io.metadata.m.SetUintSamples(8);
+  io.metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+  io.metadata.m.have_animation = true;
+  io.frames.clear();
+  for (size_t i = 0; i < num_frames; ++i) {
+    std::vector<uint8_t> frame =
+        jxl::test::GetSomeTestImage(xsize, ysize, 3, i);
+    jxl::ImageBundle bundle(memory_manager, &io.metadata.m);
+    ASSERT_TRUE(ConvertFromExternal(
+        jxl::Bytes(frame.data(), frame.size()), xsize, ysize,
+        jxl::ColorEncoding::SRGB(/*is_gray=*/false),
+        /*bits_per_sample=*/16, input_format, /*pool=*/nullptr, &bundle));
+    bundle.duration = 5;
+    bundle.use_for_next_frame = true;
+    if (i != 0) {
+      bundle.blend = true;
+      bundle.blendmode = jxl::BlendMode::kMul;
+    }
+    io.frames.push_back(std::move(bundle));
+  }
+  jxl::CompressParams cparams;
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(jxl::test::EncodeFile(cparams, &io, &compressed));
+
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  auto decode_all = [&](bool reduced_precision) {
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetReducedPrecisionBuffers(
+                                   dec.get(), TO_JXL_BOOL(reduced_precision)));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                  compressed.size()));
+    JxlDecoderCloseInput(dec.get());
+    std::vector<uint8_t> pixels;
+    for (size_t i = 0; i < num_frames; ++i) {
+      EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER,
+                JxlDecoderProcessInput(dec.get()));
+      const size_t offset = pixels.size();
+      pixels.resize(offset + xsize * ysize * 3);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec.get(), &format,
+                                            pixels.data() + offset,
+                                            xsize * ysize * 3));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+    }
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec.get()));
+    return pixels;
+  };
+  std::vector<uint8_t> expected = decode_all(false);
+  std::vector<uint8_t> decoded = decode_all(true);
+
+  ASSERT_EQ(expected.size(), decoded.size());
+  int max_diff = 0;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    max_diff = std::max(max_diff, std::abs(static_cast<int>(expected[i]) -
+                                           static_cast<int>(decoded[i])));
+  }
+  EXPECT_LE(max_diff, 1);
+}
+
+TEST(DecodeTest, DownscalingTest) {
+  size_t xsize = 613;
+  size_t ysize = 405;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  params.cparams.patches = jxl::Override::kOff;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetDownscaling(dec, 2));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDownscaling(dec, 8));
+  std::vector<uint8_t> downscaled = jxl::DecodeWithAPI(
+      dec, jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  JxlDecoderDestroy(dec);
+
+  size_t dxsize = jxl::DivCeil(xsize, 8);
+  size_t dysize = jxl::DivCeil(ysize, 8);
+  ASSERT_EQ(dxsize * dysize * 3, downscaled.size());
+  // Compare with the average of the 8x8 blocks of the full resolution image.
+  double total_diff = 0;
+  for (size_t y = 0; y < dysize; ++y) {
+    for (size_t x = 0; x < dxsize; ++x) {
+      for (size_t c = 0; c < 3; ++c) {
+        double sum = 0;
+        size_t count = 0;
+        for (size_t iy = y * 8; iy < std::min(ysize, y * 8 + 8); ++iy) {
+          for (size_t ix = x * 8; ix < std::min(xsize, x * 8 + 8); ++ix) {
+            sum += full[(iy * xsize + ix) * 3 + c];
+            ++count;
+          }
+        }
+        total_diff +=
+            std::abs(sum / count - downscaled[(y * dxsize + x) * 3 + c]);
+      }
+    }
+  }
+  EXPECT_LE(total_diff / downscaled.size(), 4.0);
+
+  // The rest of the frame is not needed once the DC is decoded.
+  dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDownscaling(dec, 8));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+  std::vector<uint8_t> placeholder(downscaled.size());
+  // The input is given in small steps, up to `end`.
+  size_t end = 256;
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, compressed.data(), end));
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      ASSERT_LT(end, compressed.size());
+      size_t pos = end - JxlDecoderReleaseInput(dec);
+      end = std::min(compressed.size(), end + 256);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetInput(dec, compressed.data() + pos, end - pos));
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec, &format, placeholder.data(),
+                                            placeholder.size()));
+    } else {
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, status);
+      break;
+    }
+  }
+  JxlDecoderDestroy(dec);
+  EXPECT_LT(end, compressed.size() / 2);
+  EXPECT_EQ(downscaled, placeholder);
+
+  // Frames that need full resolution features are not downscaled.
+  std::vector<uint8_t> rgba = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(rgba.data(), rgba.size()), xsize, ysize, 4, params);
+  dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDownscaling(dec, 8));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+  size_t buffer_size;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderImageOutBufferSize(dec, &format, &buffer_size));
+  EXPECT_EQ(dxsize * dysize * 3, buffer_size);
+  std::vector<uint8_t> out(buffer_size);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutBuffer(dec, &format, out.data(), out.size()));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, FrameByteRangesTest) {
+  size_t xsize = 613;
+  size_t ysize = 405;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  params.cparams.patches = jxl::Override::kOff;
+  params.cparams.progressive_mode = jxl::Override::kOn;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  size_t num_ranges;
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderGetFrameByteRanges(dec.get(), 0, nullptr,
+                                                        0, &num_ranges));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FRAME));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  EXPECT_EQ(JXL_DEC_FRAME, JxlDecoderProcessInput(dec.get()));
+  const auto get_ranges = [&](uint32_t num_passes) {
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetFrameByteRanges(dec.get(), num_passes, nullptr, 0,
+                                           &num_ranges));
+    std::vector<JxlByteRange> ranges(num_ranges);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetFrameByteRanges(dec.get(), num_passes,
+                                           ranges.data(), ranges.size(),
+                                           &num_ranges));
+    EXPECT_EQ(ranges.size(), num_ranges);
+    return ranges;
+  };
+  const auto total_size = [](const std::vector<JxlByteRange>& ranges) {
+    uint64_t total = 0;
+    for (const JxlByteRange& range : ranges) total += range.size;
+    return total;
+  };
+  // The sections are in the order of the passes, each a single range.
+  std::vector<JxlByteRange> all = get_ranges(UINT32_MAX);
+  ASSERT_EQ(1u, all.size());
+  EXPECT_EQ(compressed.size(), all[0].offset + all[0].size);
+  std::vector<JxlByteRange> dc = get_ranges(0);
+  ASSERT_EQ(1u, dc.size());
+  EXPECT_EQ(all[0].offset, dc[0].offset);
+  EXPECT_LT(dc[0].size, all[0].size / 2);
+  std::vector<JxlByteRange> first_pass = get_ranges(1);
+  ASSERT_EQ(1u, first_pass.size());
+  EXPECT_LT(dc[0].size, first_pass[0].size);
+  EXPECT_LT(first_pass[0].size, all[0].size);
+  // Only the first of the 3x2 groups of each pass for a corner.
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCropRegion(dec.get(), 0, 0, 64, 64));
+  std::vector<JxlByteRange> corner = get_ranges(UINT32_MAX);
+  EXPECT_GT(corner.size(), 1u);
+  EXPECT_LT(total_size(corner), first_pass[0].size + all[0].size / 4);
+  dec.reset();
+
+  // The frame downscaled from its DC only needs the DC ranges.
+  std::vector<uint8_t> partial(compressed.size());
+  std::copy(compressed.begin(), compressed.begin() + dc[0].offset + dc[0].size,
+            partial.begin());
+  const auto decode_downscaled = [&](const std::vector<uint8_t>& input) {
+    JxlDecoder* downscaling_dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDownscaling(downscaling_dec, 8));
+    std::vector<uint8_t> decoded = jxl::DecodeWithAPI(
+        downscaling_dec, jxl::Bytes(input), format, /*use_callback=*/false,
+        /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true);
+    JxlDecoderDestroy(downscaling_dec);
+    return decoded;
+  };
+  EXPECT_EQ(decode_downscaled(compressed), decode_downscaled(partial));
+}
+
+TEST(DecodeTest, OutputSizeTest) {
+  size_t xsize = 512;
+  size_t ysize = 384;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 4,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  const size_t rxsize = xsize / 4;
+  const size_t rysize = ysize / 4;
+  for (JxlResampleFilter filter :
+       {JXL_RESAMPLE_FILTER_BOX, JXL_RESAMPLE_FILTER_LANCZOS3}) {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetOutputSize(dec, rxsize, rysize, filter));
+    std::vector<uint8_t> resampled = jxl::DecodeWithAPI(
+        dec, jxl::Bytes(compressed), format, /*use_callback=*/false,
+        /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true);
+    JxlDecoderDestroy(dec);
+    ASSERT_EQ(rxsize * rysize * 4, resampled.size());
+    // Compare with the average of the 4x4 blocks of the full image, which is
+    // what the box filter computes before rounding.
+    double total_diff = 0;
+    for (size_t y = 0; y < rysize; ++y) {
+      for (size_t x = 0; x < rxsize; ++x) {
+        for (size_t c = 0; c < 4; ++c) {
+          double sum = 0;
+          for (size_t iy = y * 4; iy < y * 4 + 4; ++iy) {
+            for (size_t ix = x * 4; ix < x * 4 + 4; ++ix) {
+              sum += full[(iy * xsize + ix) * 4 + c];
+            }
+          }
+          total_diff +=
+              std::abs(sum / 16 - resampled[(y * rxsize + x) * 4 + c]);
+        }
+      }
+    }
+    EXPECT_LE(total_diff / resampled.size(),
+              filter == JXL_RESAMPLE_FILTER_BOX ? 1.0 : 8.0);
+  }
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetOutputSize(dec, rxsize, rysize,
+                                    static_cast<JxlResampleFilter>(2)));
+  JxlDecoderDestroy(dec);
+
+  // With downscaling, the DC is upsampled to the output size.
+  std::vector<uint8_t> rgb = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(rgb.data(), rgb.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  format.num_channels = 3;
+  full = jxl::DecodeWithAPI(
+      jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetOutputSize(
+                                 dec, xsize, ysize, JXL_RESAMPLE_FILTER_BOX));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDownscaling(dec, 8));
+  std::vector<uint8_t> upsampled = jxl::DecodeWithAPI(
+      dec, jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  JxlDecoderDestroy(dec);
+  ASSERT_EQ(full.size(), upsampled.size());
+  double total_diff = 0;
+  for (size_t i = 0; i < full.size(); ++i) {
+    total_diff += std::abs(static_cast<int>(full[i]) - upsampled[i]);
+  }
+  // Only the details within the 8x8 blocks are lost.
+  EXPECT_LE(total_diff / full.size(), 16.0);
+}
+
+TEST(DecodeTest, DecodingSpeedTest) {
+  size_t xsize = 256;
+  size_t ysize = 256;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  for (uint32_t speed = 1; speed <= 2; ++speed) {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDecodingSpeed(dec, speed));
+    std::vector<uint8_t> fast = jxl::DecodeWithAPI(
+        dec, jxl::Bytes(compressed), format, /*use_callback=*/false,
+        /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true);
+    JxlDecoderDestroy(dec);
+    ASSERT_EQ(full.size(), fast.size());
+    // The restoration filters are skipped, so the image is close to, but not
+    // the same as, the full decode.
+    EXPECT_NE(full, fast);
+    double total_diff = 0;
+    for (size_t i = 0; i < full.size(); ++i) {
+      total_diff += std::abs(static_cast<int>(full[i]) - fast[i]);
+    }
+    EXPECT_LE(total_diff / full.size(), 4.0);
+  }
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetDecodingSpeed(dec, 3));
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, CancelCallbackTest) {
+  size_t xsize = 512;
+  size_t ysize = 512;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+
+  // Cancels from the third group on: the DC group and the first of the four AC
+  // groups are decoded.
+  struct CancelState {
+    std::atomic<size_t> num_calls{0};
+    size_t max_calls = 2;
+  } state;
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetCancelCallback(
+                dec,
+                [](void* opaque) {
+                  CancelState* state = static_cast<CancelState*>(opaque);
+                  return TO_JXL_BOOL(++state->num_calls > state->max_calls);
+                },
+                &state));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  JxlDecoderCloseInput(dec);
+  std::vector<uint8_t> result(full.size());
+  EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutBuffer(dec, &format, result.data(),
+                                        result.size()));
+  EXPECT_EQ(JXL_DEC_CANCELLED, JxlDecoderProcessInput(dec));
+  // The decoded groups can be rendered.
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderFlushImage(dec));
+  EXPECT_NE(full, result);
+
+  // Decoding resumes where it stopped.
+  state.max_calls = ~static_cast<size_t>(0);
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+  EXPECT_EQ(full, result);
+}
+
+TEST(DecodeTest, LumaOnlyTest) {
+  size_t xsize = 256;
+  size_t ysize = 256;
+  // A color image with neutral colors, of which the chroma is close to zero.
+  std::vector<uint8_t> gray = jxl::test::GetSomeTestImage(xsize, ysize, 1, 0);
+  std::vector<uint8_t> pixels(gray.size() * 3);
+  for (size_t i = 0; i < gray.size(); ++i) {
+    pixels[3 * i] = pixels[3 * i + 1] = pixels[3 * i + 2] = gray[i];
+  }
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {1, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  const auto decode_gray = [&](bool luma_only) {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetLumaOnly(dec, TO_JXL_BOOL(luma_only)));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(
+                  dec, JXL_DEC_COLOR_ENCODING | JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+    JxlDecoderCloseInput(dec);
+    EXPECT_EQ(JXL_DEC_COLOR_ENCODING, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetLumaOnly(dec, JXL_TRUE));
+    JxlColorEncoding gray_encoding =
+        jxl::ColorEncoding::SRGB(/*is_gray=*/true).ToExternal();
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetOutputColorProfile(dec, &gray_encoding, nullptr, 0));
+    std::vector<uint8_t> result(xsize * ysize);
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetImageOutBuffer(dec, &format, result.data(),
+                                          result.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+    return result;
+  };
+
+  std::vector<uint8_t> full = decode_gray(/*luma_only=*/false);
+  std::vector<uint8_t> luma = decode_gray(/*luma_only=*/true);
+  ASSERT_EQ(full.size(), luma.size());
+  // Only the residual chroma of the neutral colors is lost.
+  double total_diff = 0;
+  for (size_t i = 0; i < full.size(); ++i) {
+    total_diff += std::abs(static_cast<int>(full[i]) - luma[i]);
+  }
+  EXPECT_LE(total_diff / full.size(), 2.0);
+}
+
+namespace {
+
+struct RenderHookState {
+  std::atomic<size_t> num_pixels{0};
+  bool clear_green = false;
+};
+
+void* RenderHookInit(void* init_opaque, size_t num_threads,
+                     size_t num_pixels_per_thread) {
+  return init_opaque;
+}
+
+void RenderHookRun(void* run_opaque, size_t thread_id, size_t x, size_t y,
+                   size_t num_pixels, float* const* channels) {
+  RenderHookState* state = static_cast<RenderHookState*>(run_opaque);
+  state->num_pixels += num_pixels;
+  if (state->clear_green) {
+    std::fill(channels[1], channels[1] + num_pixels, 0.0f);
+  }
+}
+
+}  // namespace
+
+TEST(DecodeTest, RenderHookTest) {
+  size_t xsize = 300;
+  size_t ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  params.cparams.SetLossless();
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  for (bool clear_green : {false, true}) {
+    RenderHookState state;
+    state.clear_green = clear_green;
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetRenderHook(dec, RenderHookInit, RenderHookRun,
+                                      /*destroy_callback=*/nullptr, &state));
+    std::vector<uint8_t> hooked = jxl::DecodeWithAPI(
+        dec, jxl::Bytes(compressed), format, /*use_callback=*/false,
+        /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true);
+    JxlDecoderDestroy(dec);
+    // Each pixel is passed once.
+    EXPECT_EQ(xsize * ysize, state.num_pixels.load());
+    ASSERT_EQ(full.size(), hooked.size());
+    for (size_t i = 0; i < full.size(); ++i) {
+      if (clear_green && i % 3 == 1) {
+        ASSERT_EQ(0, hooked[i]);
+      } else {
+        ASSERT_EQ(full[i], hooked[i]);
+      }
+    }
+  }
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetRenderHook(dec, RenderHookInit, nullptr, nullptr,
+                                    nullptr));
+  JxlDecoderDestroy(dec);
+}
+
+namespace {
+
+struct TileOutput {
+  size_t xsize;
+  size_t bytes_per_pixel;
+  std::vector<uint8_t> pixels;
+  std::atomic<size_t> num_pixels{0};
+  std::atomic<size_t> num_tiles{0};
+  // Only used without parallel runner.
+  jxl::Rect region;
+  size_t region_pixels = 0;
+  size_t tiles_until_region_done = 0;
+};
+
+void CopyTile(void* opaque, size_t thread_id, size_t x, size_t y, size_t xsize,
+              size_t ysize, const void* pixels, size_t stride) {
+  TileOutput* out = static_cast<TileOutput*>(opaque);
+  const uint8_t* rows = static_cast<const uint8_t*>(pixels);
+  for (size_t iy = 0; iy < ysize; ++iy) {
+    memcpy(&out->pixels[((y + iy) * out->xsize + x) * out->bytes_per_pixel],
+           rows + iy * stride, xsize * out->bytes_per_pixel);
+  }
+  out->num_pixels += xsize * ysize;
+  out->num_tiles++;
+  if (out->region.xsize() != 0) {
+    jxl::Rect tile = jxl::Rect(x, y, xsize, ysize).Intersection(out->region);
+    out->region_pixels += tile.xsize() * tile.ysize();
+    if (out->tiles_until_region_done == 0 &&
+        out->region_pixels == out->region.xsize() * out->region.ysize()) {
+      out->tiles_until_region_done = out->num_tiles;
+    }
+  }
+}
+
+}  // namespace
+
+TEST(DecodeTest, ImageOutTileCallbackTest) {
+  size_t xsize = 600;
+  size_t ysize = 400;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  for (JxlOrientation orientation :
+       {JXL_ORIENT_IDENTITY, JXL_ORIENT_ROTATE_90_CW}) {
+    jxl::TestCodestreamParams params;
+    params.orientation = orientation;
+    std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+        jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 4, params);
+    std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+        jxl::Bytes(compressed), format, /*use_callback=*/false,
+        /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true);
+
+    TileOutput out;
+    out.xsize = orientation == JXL_ORIENT_IDENTITY ? xsize : ysize;
+    out.bytes_per_pixel = 4;
+    out.pixels.resize(expected.size());
+    auto runner = JxlThreadParallelRunnerMake(nullptr, 4);
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetParallelRunner(dec.get(), JxlThreadParallelRunner,
+                                          runner.get()));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                  compressed.size()));
+    JxlDecoderCloseInput(dec.get());
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec.get()));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutTileCallback(
+                                   dec.get(), &format, CopyTile, &out));
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetImageOutBuffer(dec.get(), &format, out.pixels.data(),
+                                          out.pixels.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec.get()));
+
+    // Each pixel is delivered once, in tiles smaller than the image.
+    EXPECT_EQ(xsize * ysize, out.num_pixels.load());
+    EXPECT_LT(1u, out.num_tiles.load());
+    EXPECT_EQ(expected, out.pixels);
+  }
+}
+
+TEST(DecodeTest, PriorityRegionTest) {
+  size_t xsize = 600;
+  size_t ysize = 400;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+      jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+
+  // The bottom right corner, in the last groups of the default order.
+  const jxl::Rect region(384, 256, 216, 144);
+  size_t tiles_until_region_done[2];
+  for (bool prioritize : {false, true}) {
+    TileOutput out;
+    out.xsize = xsize;
+    out.bytes_per_pixel = 3;
+    out.pixels.resize(expected.size());
+    out.region = region;
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    if (prioritize) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetPriorityRegion(dec.get(), region.x0(), region.y0(),
+                                            region.xsize(), region.ysize()));
+    }
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                  compressed.size()));
+    JxlDecoderCloseInput(dec.get());
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec.get()));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutTileCallback(
+                                   dec.get(), &format, CopyTile, &out));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec.get()));
+    // The order does not change the pixels.
+    EXPECT_EQ(expected, out.pixels);
+    ASSERT_NE(0u, out.tiles_until_region_done);
+    tiles_until_region_done[prioritize ? 1 : 0] = out.tiles_until_region_done;
+  }
+  EXPECT_LT(tiles_until_region_done[1], tiles_until_region_done[0]);
+}
+
+TEST(DecodeTest, CollectStatsTest) {
+  size_t xsize = 300;
+  size_t ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  JxlDecoderStats* stats = JxlDecoderStatsCreate();
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderCollectStats(dec, stats));
+  jxl::DecodeWithAPI(dec, jxl::Bytes(compressed), format,
+                     /*use_callback=*/false, /*set_buffer_early=*/false,
+                     /*use_resizable_runner=*/false, /*require_boxes=*/false,
+                     /*expect_success=*/true);
+  // Too late once started.
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderCollectStats(dec, nullptr));
+  JxlDecoderDestroy(dec);
+
+  const auto get = [&](JxlDecoderStatsKey key) {
+    return JxlDecoderStatsGet(stats, key);
+  };
+  // The statistics cover each byte of the codestream once.
+  EXPECT_EQ(compressed.size(),
+            get(JXL_DEC_STATS_HEADER_BYTES) +
+                get(JXL_DEC_STATS_FRAME_HEADER_BYTES) +
+                get(JXL_DEC_STATS_DC_GLOBAL_BYTES) +
+                get(JXL_DEC_STATS_DC_GROUP_BYTES) +
+                get(JXL_DEC_STATS_AC_GLOBAL_BYTES) +
+                get(JXL_DEC_STATS_AC_GROUP_BYTES));
+  EXPECT_NE(0u, get(JXL_DEC_STATS_HEADER_BYTES));
+  EXPECT_NE(0u, get(JXL_DEC_STATS_DC_GROUP_BYTES));
+  EXPECT_NE(0u, get(JXL_DEC_STATS_AC_GROUP_BYTES));
+  EXPECT_EQ(1u, get(JXL_DEC_STATS_NUM_FRAMES));
+  // At least the image buffers of the frame.
+  EXPECT_LT(xsize * ysize * 3, get(JXL_DEC_STATS_PEAK_MEMORY_BYTES));
+  EXPECT_EQ(0u, get(JXL_DEC_STATS_NUM_KEYS));
+
+  JxlDecoderStats* total = JxlDecoderStatsCreate();
+  JxlDecoderStatsMerge(total, stats);
+  JxlDecoderStatsMerge(total, stats);
+  EXPECT_EQ(2u, JxlDecoderStatsGet(total, JXL_DEC_STATS_NUM_FRAMES));
+  EXPECT_EQ(2 * get(JXL_DEC_STATS_AC_GROUP_BYTES),
+            JxlDecoderStatsGet(total, JXL_DEC_STATS_AC_GROUP_BYTES));
+  // The peak is not added up.
+  EXPECT_EQ(get(JXL_DEC_STATS_PEAK_MEMORY_BYTES),
+            JxlDecoderStatsGet(total, JXL_DEC_STATS_PEAK_MEMORY_BYTES));
+  JxlDecoderStatsDestroy(total);
+  JxlDecoderStatsDestroy(stats);
+}
+
+TEST(DecodeTest, MemoryLimitTest) {
+  size_t xsize = 600;
+  size_t ysize = 400;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  size_t estimate;
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderGetMemoryEstimate(dec, 4, &estimate));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO | JXL_DEC_FRAME));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  size_t image_estimate;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderGetMemoryEstimate(dec, 4, &image_estimate));
+  EXPECT_EQ(JXL_DEC_FRAME, JxlDecoderProcessInput(dec));
+  size_t frame_estimate;
+  size_t one_thread_estimate;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderGetMemoryEstimate(dec, 4, &frame_estimate));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderGetMemoryEstimate(dec, 1, &one_thread_estimate));
+  JxlDecoderDestroy(dec);
+  EXPECT_LT(xsize * ysize, frame_estimate);
+  EXPECT_LE(frame_estimate, image_estimate);
+  EXPECT_LT(one_thread_estimate, frame_estimate);
+
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+      jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  // Room for fewer threads than the runner has.
+  dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetMemoryLimit(dec, 2 * one_thread_estimate));
+  std::vector<uint8_t> decoded = jxl::DecodeWithAPI(
+      dec, jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetMemoryLimit(dec, 0));
+  JxlDecoderDestroy(dec);
+  EXPECT_EQ(expected, decoded);
+
+  // Not enough for the frame, which fails before it is decoded.
+  dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetMemoryLimit(dec, one_thread_estimate / 2));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO | JXL_DEC_FRAME));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+}
+
+namespace {
+
+// Returns JXL_DEC_SUCCESS or JXL_DEC_ERROR for decoding `compressed` with
+// `limit` set to `value`.
+JxlDecoderStatus DecodeWithLimit(const std::vector<uint8_t>& compressed,
+                                 JxlDecoderLimit limit, uint64_t value) {
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> pixels;
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetLimit(dec.get(), limit, value));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  JxlDecoderCloseInput(dec.get());
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      size_t buffer_size;
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderImageOutBufferSize(
+                                     dec.get(), &format, &buffer_size));
+      pixels.resize(buffer_size);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec.get(), &format, pixels.data(),
+                                            pixels.size()));
+    } else if (status != JXL_DEC_FULL_IMAGE) {
+      return status;
+    }
+  }
+}
+
+}  // namespace
+
+TEST(DecodeTest, LimitTest) {
+  size_t xsize = 300;
+  size_t ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  // With a DC frame, which is a second frame in the codestream.
+  params.cparams.progressive_dc = 1;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            DecodeWithLimit(compressed, JXL_DEC_LIMIT_PIXELS, xsize * ysize));
+  EXPECT_EQ(JXL_DEC_ERROR, DecodeWithLimit(compressed, JXL_DEC_LIMIT_PIXELS,
+                                           xsize * ysize - 1));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            DecodeWithLimit(compressed, JXL_DEC_LIMIT_FRAMES, 2));
+  EXPECT_EQ(JXL_DEC_ERROR,
+            DecodeWithLimit(compressed, JXL_DEC_LIMIT_FRAMES, 1));
+  EXPECT_EQ(JXL_DEC_SUCCESS, DecodeWithLimit(compressed,
+                                             JXL_DEC_LIMIT_FILTER_WORK, 0));
+  // Gaborish and the edge preserving filter process each pixel at least once.
+  EXPECT_EQ(JXL_DEC_ERROR,
+            DecodeWithLimit(compressed, JXL_DEC_LIMIT_FILTER_WORK, 1000));
+
+  params = jxl::TestCodestreamParams();
+  params.cparams.SetLossless();
+  compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            DecodeWithLimit(compressed, JXL_DEC_LIMIT_TREE_NODES, 0));
+  EXPECT_EQ(JXL_DEC_ERROR,
+            DecodeWithLimit(compressed, JXL_DEC_LIMIT_TREE_NODES, 1));
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  const JxlDecoderLimit unknown_limit = static_cast<JxlDecoderLimit>(100);
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetLimit(dec.get(), unknown_limit, 1));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetLimit(dec.get(), JXL_DEC_LIMIT_PIXELS, 1));
+}
+
+TEST(DecodeTest, DecodeBatchTest) {
+  const size_t sizes[][2] = {{30, 20}, {15, 26}, {64, 1}, {40, 40}, {7, 9}};
+  const size_t num_images = sizeof(sizes) / sizeof(sizes[0]);
+  JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<std::vector<uint8_t>> codestreams;
+  std::vector<std::vector<uint8_t>> expected;
+  std::vector<std::vector<uint8_t>> pixels;
+  std::vector<JxlDecoderBatchItem> items(num_images + 1);
+  for (size_t i = 0; i < num_images; ++i) {
+    std::vector<uint8_t> image =
+        jxl::test::GetSomeTestImage(sizes[i][0], sizes[i][1], 4, i);
+    codestreams.push_back(jxl::CreateTestJXLCodestream(
+        jxl::Bytes(image.data(), image.size()), sizes[i][0], sizes[i][1], 4,
+        jxl::TestCodestreamParams()));
+    expected.push_back(jxl::DecodeWithAPI(
+        jxl::Bytes(codestreams[i]), format, /*use_callback=*/false,
+        /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true));
+    pixels.emplace_back(expected[i].size());
+    items[i].data = codestreams[i].data();
+    items[i].size = codestreams[i].size();
+    items[i].buffer = pixels[i].data();
+    items[i].buffer_size = pixels[i].size();
+  }
+  // A truncated image.
+  items[num_images] = items[0];
+  items[num_images].size /= 2;
+  std::vector<uint8_t> unused(expected[0].size());
+  items[num_images].buffer = unused.data();
+
+  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(nullptr, 3);
+  for (JxlParallelRunner parallel_runner :
+       {static_cast<JxlParallelRunner>(nullptr), JxlThreadParallelRunner}) {
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderDecodeBatch(nullptr, parallel_runner, runner.get(),
+                                    &format, items.data(), items.size()));
+    EXPECT_EQ(JXL_DEC_ERROR, items[num_images].status);
+    for (size_t i = 0; i < num_images; ++i) {
+      EXPECT_EQ(JXL_DEC_SUCCESS, items[i].status);
+      EXPECT_EQ(sizes[i][0], items[i].xsize);
+      EXPECT_EQ(sizes[i][1], items[i].ysize);
+      EXPECT_EQ(expected[i], pixels[i]);
+      std::fill(pixels[i].begin(), pixels[i].end(), 0);
+    }
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderDecodeBatch(nullptr, parallel_runner, runner.get(),
+                                    &format, items.data(), num_images));
+    for (size_t i = 0; i < num_images; ++i) {
+      EXPECT_EQ(expected[i], pixels[i]);
+    }
+  }
+}
+
+TEST(DecodeTest, ArenaMemoryManagerTest) {
+  size_t xsize = 300;
+  size_t ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+      jxl::Bytes(compressed), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+
+  JxlMemoryManager* arena = JxlArenaMemoryManagerCreate(nullptr, 0);
+  ASSERT_NE(nullptr, arena);
+  for (int i = 0; i < 2; ++i) {
+    JxlDecoder* dec = JxlDecoderCreate(arena);
+    ASSERT_NE(nullptr, dec);
+    std::vector<uint8_t> decoded = jxl::DecodeWithAPI(
+        dec, jxl::Bytes(compressed), format, /*use_callback=*/false,
+        /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+        /*require_boxes=*/false, /*expect_success=*/true);
+    JxlDecoderDestroy(dec);
+    EXPECT_EQ(expected, decoded);
+  }
+  JxlArenaMemoryManagerDestroy(arena);
+}
+
+TEST(DecodeTest, ProgressionTest) {
+  size_t xsize = 508;
+  size_t ysize = 470;
+  uint32_t num_channels = 3;
+  std::vector<uint8_t> pixels =
+      jxl::test::GetSomeTestImage(xsize, ysize, num_channels, 0);
+  jxl::TestCodestreamParams params;
+  params.cparams.progressive_dc = 1;
+  params.preview_mode = jxl::kSmallPreview;
+  std::vector<uint8_t> data =
+      jxl::CreateTestJXLCodestream(jxl::Bytes(pixels.data(), pixels.size()),
+                                   xsize, ysize, num_channels, params);
+  StreamPositions streampos;
+  AnalyzeCodestream(data, &streampos);
+  const std::vector<FramePositions>& fp = streampos.frames;
+  // We have preview, dc frame and regular frame.
+  EXPECT_EQ(3, fp.size());
+  EXPECT_EQ(7, fp[2].section_end.size());
+  EXPECT_EQ(data.size(), fp[2].section_end[6]);
+  std::vector<Breakpoint> breakpoints{
+      {fp[0].frame_start, NO_FLUSH},           // headers
+      {fp[1].frame_start, NO_FLUSH},           // preview
+      {fp[2].frame_start, NO_FLUSH},           // dc frame
+      {fp[2].section_end[0], NO_FLUSH},        // DC global
+      {fp[2].section_end[1] - 1, NO_FLUSH},    // partial DC group
+      {fp[2].section_end[1], NEW_FLUSH},       // DC group
+      {fp[2].section_end[2], SAME_FLUSH},      // AC global
+      {fp[2].section_end[3], NEW_FLUSH},       // AC group 0
+      {fp[2].section_end[4] - 1, SAME_FLUSH},  // partial AC group 1
+      {fp[2].section_end[4], NEW_FLUSH},       // AC group 1
+      {fp[2].section_end[5], NEW_FLUSH},       // AC group 2
+      {data.size() - 1, SAME_FLUSH},           // partial AC group 3
+      {data.size(), NEW_FLUSH}};               // full image
+  VerifyProgression(xsize, ysize, num_channels, pixels, data, breakpoints);
+}
+
+TEST(DecodeTest, ProgressionTestLosslessAlpha) {
+  size_t xsize = 508;
+  size_t ysize = 470;
+  uint32_t num_channels = 4;
+  std::vector<uint8_t> pixels =
+      jxl::test::GetSomeTestImage(xsize, ysize, num_channels, 0);
+  jxl::TestCodestreamParams params;
+  params.cparams.SetLossless();
+  params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+  params.cparams.responsive = 1;
+  std::vector<uint8_t> data =
+      jxl::CreateTestJXLCodestream(jxl::Bytes(pixels.data(), pixels.size()),
+                                   xsize, ysize, num_channels, params);
+  StreamPositions streampos;
+  AnalyzeCodestream(data, &streampos);
+  const std::vector<FramePositions>& fp = streampos.frames;
+  // We have preview, dc frame and regular frame.
+  EXPECT_EQ(1, fp.size());
+  EXPECT_EQ(7, fp[0].section_end.size());
+  EXPECT_EQ(data.size(), fp[0].section_end[6]);
+  std::vector<Breakpoint> breakpoints{
+      {fp[0].frame_start, NO_FLUSH},           // headers
+      {fp[0].section_end[0] - 1, NO_FLUSH},    // partial DC global
+      {fp[0].section_end[0], NEW_FLUSH},       // DC global
+      {fp[0].section_end[1], SAME_FLUSH},      // DC group
+      {fp[0].section_end[2], SAME_FLUSH},      // AC global
+      {fp[0].section_end[3], NEW_FLUSH},       // AC group 0
+      {fp[0].section_end[4] - 1, SAME_FLUSH},  // partial AC group 1
+      {fp[0].section_end[4], NEW_FLUSH},       // AC group 1
+      {fp[0].section_end[5], NEW_FLUSH},       // AC group 2
+      {data.size() - 1, SAME_FLUSH},           // partial AC group 3
+      {data.size(), NEW_FLUSH}};               // full image
+  VerifyProgression(xsize, ysize, num_channels, pixels, data, breakpoints);
+}
+
+void VerifyFilePosition(size_t expected_pos, const std::vector<uint8_t>& data,
+                        JxlDecoder* dec) {
+  size_t remaining = JxlDecoderReleaseInput(dec);
+  size_t pos = data.size() - remaining;
+  EXPECT_EQ(expected_pos, pos);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, data.data() + pos, remaining));
+}
+
+TEST(DecodeTest, InputHandlingTestOneShot) {
+  size_t xsize = 508;
+  size_t ysize = 470;
+  uint32_t num_channels = 3;
+  std::vector<uint8_t> pixels =
+      jxl::test::GetSomeTestImage(xsize, ysize, num_channels, 0);
+  for (int i = 0; i < kCSBF_NUM_ENTRIES; ++i) {
+    printf("Testing with box format %d\n", i);
+    jxl::TestCodestreamParams params;
+    params.cparams.progressive_dc = 1;
+    params.preview_mode = jxl::kSmallPreview;
+    params.box_format = static_cast<CodeStreamBoxFormat>(i);
+    std::vector<uint8_t> data =
+        jxl::CreateTestJXLCodestream(jxl::Bytes(pixels.data(), pixels.size()),
+                                     xsize, ysize, num_channels, params);
+    JxlPixelFormat format = {num_channels, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+    StreamPositions streampos;
+    AnalyzeCodestream(data, &streampos);
+    const std::vector<FramePositions>& fp = streampos.frames;
+    // We have preview, dc frame and regular frame.
+    EXPECT_EQ(3, fp.size());
+
+    std::vector<uint8_t> pixels2;
+    pixels2.resize(pixels.size());
+
+    int kNumEvents = 6;
     int events[] = {
         JXL_DEC_BASIC_INFO, JXL_DEC_COLOR_ENCODING, JXL_DEC_PREVIEW_IMAGE,
         JXL_DEC_FRAME,      JXL_DEC_FULL_IMAGE,     JXL_DEC_FRAME_PROGRESSION,
@@ -5012,6 +6432,242 @@ JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionTest) {
   VerifyJPEGReconstruction(jxl::Bytes(container), jxl::Bytes(orig));
 }
 
+// The Y, Cb and Cr planes of a recompressed 4:2:0 JPEG are consistent with
+// the RGB output.
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, YCbCrPlanesTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const std::vector<uint8_t> orig = jxl::test::ReadTestData(jpeg_path);
+  jxl::CodecInOut orig_io{memory_manager};
+  ASSERT_TRUE(jxl::jpeg::DecodeImageJPG(jxl::Bytes(orig), &orig_io));
+  orig_io.metadata.m.xyb_encoded = false;
+  jxl::BitWriter writer{memory_manager};
+  ASSERT_TRUE(WriteCodestreamHeaders(&orig_io.metadata, &writer, nullptr));
+  writer.ZeroPadToByte();
+  jxl::CompressParams cparams;
+  cparams.color_transform = jxl::ColorTransform::kNone;
+  ASSERT_TRUE(jxl::EncodeFrame(memory_manager, cparams, jxl::FrameInfo{},
+                               &orig_io.metadata, orig_io.Main(),
+                               *JxlGetDefaultCms(),
+                               /*pool=*/nullptr, &writer,
+                               /*aux_out=*/nullptr));
+  jxl::PaddedBytes codestream = std::move(writer).TakeBytes();
+  size_t xsize = orig_io.xsize();
+  size_t ysize = orig_io.ysize();
+
+  JxlPixelFormat format = {3, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> rgb_bytes = jxl::DecodeWithAPI(
+      jxl::Bytes(codestream), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 3 * sizeof(float), rgb_bytes.size());
+  std::vector<float> rgb(xsize * ysize * 3);
+  memcpy(rgb.data(), rgb_bytes.data(), rgb_bytes.size());
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, codestream.data(), codestream.size()));
+  EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+  size_t plane_xsize[3];
+  size_t plane_ysize[3];
+  std::vector<float> planes[3];
+  JxlChannelBuffer buffers[3];
+  for (uint32_t p = 0; p < 3; ++p) {
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderYCbCrPlaneSize(
+                                   dec, p, &plane_xsize[p], &plane_ysize[p]));
+    size_t subsampling = p == 0 ? 1 : 2;
+    EXPECT_EQ(jxl::DivCeil(xsize, subsampling), plane_xsize[p]);
+    EXPECT_EQ(jxl::DivCeil(ysize, subsampling), plane_ysize[p]);
+    planes[p].resize(plane_xsize[p] * plane_ysize[p]);
+    buffers[p] = {planes[p].data(), sizeof(float),
+                  plane_xsize[p] * sizeof(float)};
+  }
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderYCbCrPlaneSize(
+                               dec, 3, &plane_xsize[0], &plane_ysize[0]));
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetYCbCrPlanesOutBuffer(dec, JXL_TYPE_UINT16, buffers));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetYCbCrPlanesOutBuffer(dec, JXL_TYPE_FLOAT, buffers));
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+
+  // Y is a per-pixel combination of RGB; the chroma planes are compared on
+  // average, since the RGB output uses upsampled chroma.
+  double cb_sum = 0;
+  double cr_sum = 0;
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      const float* px = &rgb[(y * xsize + x) * 3];
+      float luma = 0.299f * px[0] + 0.587f * px[1] + 0.114f * px[2];
+      ASSERT_NEAR(luma, planes[0][y * xsize + x], 2e-4f);
+      cb_sum += (px[2] - luma) / 1.772 + 128.0 / 255;
+      cr_sum += (px[0] - luma) / 1.402 + 128.0 / 255;
+    }
+  }
+  double num_pixels = xsize * ysize;
+  double num_chroma_pixels = plane_xsize[1] * plane_ysize[1];
+  double cb_plane_sum = 0;
+  double cr_plane_sum = 0;
+  for (size_t i = 0; i < planes[1].size(); ++i) {
+    cb_plane_sum += planes[1][i];
+    cr_plane_sum += planes[2][i];
+  }
+  EXPECT_NEAR(cb_sum / num_pixels, cb_plane_sum / num_chroma_pixels, 2e-3);
+  EXPECT_NEAR(cr_sum / num_pixels, cr_plane_sum / num_chroma_pixels, 2e-3);
+}
+
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGCoefficientsTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const std::vector<uint8_t> orig = jxl::test::ReadTestData(jpeg_path);
+  jxl::CodecInOut orig_io{memory_manager};
+  ASSERT_TRUE(jxl::jpeg::DecodeImageJPG(jxl::Bytes(orig), &orig_io));
+  jxl::jpeg::JPEGData jpeg_data_copy = *orig_io.Main().jpeg_data;
+  orig_io.metadata.m.xyb_encoded = false;
+  jxl::BitWriter writer{memory_manager};
+  ASSERT_TRUE(WriteCodestreamHeaders(&orig_io.metadata, &writer, nullptr));
+  writer.ZeroPadToByte();
+  jxl::CompressParams cparams;
+  cparams.color_transform = jxl::ColorTransform::kNone;
+  ASSERT_TRUE(jxl::EncodeFrame(memory_manager, cparams, jxl::FrameInfo{},
+                               &orig_io.metadata, orig_io.Main(),
+                               *JxlGetDefaultCms(),
+                               /*pool=*/nullptr, &writer,
+                               /*aux_out=*/nullptr));
+  std::vector<uint8_t> jpeg_data;
+  ASSERT_TRUE(
+      EncodeJPEGData(memory_manager, jpeg_data_copy, &jpeg_data, cparams));
+  std::vector<uint8_t> container;
+  jxl::Bytes(jxl::kContainerHeader).AppendTo(container);
+  jxl::AppendBoxHeader(jxl::MakeBoxType("jbrd"), jpeg_data.size(), false,
+                       &container);
+  jxl::Bytes(jpeg_data).AppendTo(container);
+  jxl::AppendBoxHeader(jxl::MakeBoxType("jxlc"), 0, true, &container);
+  jxl::PaddedBytes codestream = std::move(writer).TakeBytes();
+  jxl::Bytes(codestream).AppendTo(container);
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(
+                dec.get(), JXL_DEC_JPEG_RECONSTRUCTION | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), container.data(),
+                                                container.size()));
+  uint32_t num_components;
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderGetJPEGComponentCount(dec.get(), &num_components));
+  EXPECT_EQ(JXL_DEC_JPEG_RECONSTRUCTION, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetJPEGCoefficientsOutput(dec.get(), JXL_TRUE));
+  // No image out buffer is needed.
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderGetJPEGComponentCount(dec.get(), &num_components));
+  ASSERT_EQ(jpeg_data_copy.components.size(), num_components);
+  for (uint32_t c = 0; c < num_components; ++c) {
+    const jxl::jpeg::JPEGComponent& expected = jpeg_data_copy.components[c];
+    JxlJPEGComponentInfo info;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetJPEGComponentInfo(dec.get(), c, &info));
+    EXPECT_EQ(expected.id, info.id);
+    EXPECT_EQ(expected.h_samp_factor, static_cast<int>(info.h_samp_factor));
+    EXPECT_EQ(expected.v_samp_factor, static_cast<int>(info.v_samp_factor));
+    EXPECT_EQ(expected.width_in_blocks, info.width_in_blocks);
+    EXPECT_EQ(expected.height_in_blocks, info.height_in_blocks);
+    const auto& quant = jpeg_data_copy.quant[expected.quant_idx].values;
+    for (size_t i = 0; i < 64; ++i) {
+      EXPECT_EQ(quant[i], info.quant_table[i]);
+    }
+    size_t num_coeffs = info.width_in_blocks * info.height_in_blocks * 64;
+    std::vector<int16_t> coeffs(num_coeffs);
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderGetJPEGCoefficients(
+                                 dec.get(), c, coeffs.data(),
+                                 (num_coeffs - 1) * sizeof(int16_t)));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetJPEGCoefficients(dec.get(), c, coeffs.data(),
+                                            num_coeffs * sizeof(int16_t)));
+    ASSERT_EQ(0, memcmp(expected.coeffs.data(), coeffs.data(),
+                        num_coeffs * sizeof(int16_t)));
+  }
+  JxlJPEGComponentInfo info;
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderGetJPEGComponentInfo(dec.get(), num_components, &info));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec.get()));
+}
+
+// The streamed JPEG fills each small output buffer completely while the frame
+// is decoded, and matches the original.
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionStreamingTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const std::vector<uint8_t> orig = jxl::test::ReadTestData(jpeg_path);
+  jxl::CodecInOut orig_io{memory_manager};
+  ASSERT_TRUE(jxl::jpeg::DecodeImageJPG(jxl::Bytes(orig), &orig_io));
+  jxl::jpeg::JPEGData jpeg_data_copy = *orig_io.Main().jpeg_data;
+  orig_io.metadata.m.xyb_encoded = false;
+  jxl::BitWriter writer{memory_manager};
+  ASSERT_TRUE(WriteCodestreamHeaders(&orig_io.metadata, &writer, nullptr));
+  writer.ZeroPadToByte();
+  jxl::CompressParams cparams;
+  cparams.color_transform = jxl::ColorTransform::kNone;
+  ASSERT_TRUE(jxl::EncodeFrame(memory_manager, cparams, jxl::FrameInfo{},
+                               &orig_io.metadata, orig_io.Main(),
+                               *JxlGetDefaultCms(),
+                               /*pool=*/nullptr, &writer,
+                               /*aux_out=*/nullptr));
+  std::vector<uint8_t> jpeg_data;
+  ASSERT_TRUE(
+      EncodeJPEGData(memory_manager, jpeg_data_copy, &jpeg_data, cparams));
+  std::vector<uint8_t> container;
+  jxl::Bytes(jxl::kContainerHeader).AppendTo(container);
+  jxl::AppendBoxHeader(jxl::MakeBoxType("jbrd"), jpeg_data.size(), false,
+                       &container);
+  jxl::Bytes(jpeg_data).AppendTo(container);
+  jxl::AppendBoxHeader(jxl::MakeBoxType("jxlc"), 0, true, &container);
+  jxl::PaddedBytes codestream = std::move(writer).TakeBytes();
+  jxl::Bytes(codestream).AppendTo(container);
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetStreamingJPEGReconstruction(dec.get(), JXL_TRUE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(
+                dec.get(), JXL_DEC_JPEG_RECONSTRUCTION | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), container.data(),
+                                                container.size()));
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetStreamingJPEGReconstruction(dec.get(), JXL_FALSE));
+  EXPECT_EQ(JXL_DEC_JPEG_RECONSTRUCTION, JxlDecoderProcessInput(dec.get()));
+
+  constexpr size_t kChunkSize = 4096;
+  std::vector<uint8_t> reconstructed;
+  std::vector<uint8_t> chunk(kChunkSize);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetJPEGBuffer(dec.get(), chunk.data(), chunk.size()));
+  size_t num_chunks = 0;
+  JxlDecoderStatus status;
+  while ((status = JxlDecoderProcessInput(dec.get())) ==
+         JXL_DEC_JPEG_NEED_MORE_OUTPUT) {
+    EXPECT_EQ(0, JxlDecoderReleaseJPEGBuffer(dec.get()));
+    reconstructed.insert(reconstructed.end(), chunk.begin(), chunk.end());
+    ++num_chunks;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetJPEGBuffer(dec.get(), chunk.data(), chunk.size()));
+  }
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, status);
+  size_t remaining = JxlDecoderReleaseJPEGBuffer(dec.get());
+  reconstructed.insert(reconstructed.end(), chunk.begin(),
+                       chunk.end() - remaining);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec.get()));
+
+  EXPECT_EQ(orig.size() / kChunkSize, num_chunks);
+  ASSERT_EQ(orig.size(), reconstructed.size());
+  EXPECT_EQ(0, memcmp(orig.data(), reconstructed.data(), orig.size()));
+}
+
 JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionMetadataTest) {
   const std::string jpeg_path = "jxl/jpeg_reconstruction/1x1_exif_xmp.jpg";
   const std::string jxl_path = "jxl/jpeg_reconstruction/1x1_exif_xmp.jxl";
@@ -5200,6 +6856,135 @@ JXL_BOXES_TEST(DecodeTest, BoxTest) {
   JxlDecoderDestroy(dec);
 }
 
+TEST(DecodeTest, ScanBoxesTest) {
+  size_t xsize = 1;
+  size_t ysize = 1;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  jxl::TestCodestreamParams params;
+  params.box_format = kCSBF_Brob_Exif;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 4, params);
+
+  std::vector<JxlBoxIndexEntry> entries(8);
+  size_t num_entries;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlScanBoxes(compressed.data(), compressed.size(), entries.data(),
+                         entries.size(), &num_entries));
+  ASSERT_EQ(4, num_entries);
+  const char* expected_types[4] = {"JXL ", "ftyp", "Exif", "jxlc"};
+  const uint64_t expected_offsets[4] = {0, 12, 32, 96};
+  for (size_t i = 0; i < num_entries; ++i) {
+    EXPECT_TRUE(BoxTypeEquals(expected_types[i], entries[i].type));
+    EXPECT_EQ(expected_offsets[i], entries[i].box_offset);
+    EXPECT_EQ(i == 2, entries[i].compressed);
+    EXPECT_FALSE(entries[i].until_eof);
+  }
+  // The Brotli stream of the brob box follows the compressed box type.
+  EXPECT_EQ(44, entries[2].contents_offset);
+  EXPECT_EQ(box_brob_exif_size - 12, entries[2].contents_size);
+  EXPECT_EQ(0, memcmp(compressed.data() + entries[2].contents_offset,
+                      box_brob_exif + 12, entries[2].contents_size));
+  EXPECT_EQ(104, entries[3].contents_offset);
+  EXPECT_EQ(compressed.size(),
+            entries[3].contents_offset + entries[3].contents_size);
+
+  // Only counts the boxes that do not fit in the entries.
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlScanBoxes(compressed.data(), compressed.size(),
+                                          nullptr, 0, &num_entries));
+  EXPECT_EQ(4, num_entries);
+
+  // The contents of the last listed box are not needed.
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlScanBoxes(compressed.data(), 104, entries.data(),
+                         entries.size(), &num_entries));
+  EXPECT_EQ(4, num_entries);
+
+  // Truncated within the compressed box type of the brob box.
+  EXPECT_EQ(JXL_DEC_NEED_MORE_INPUT,
+            JxlScanBoxes(compressed.data(), 42, entries.data(), entries.size(),
+                         &num_entries));
+  EXPECT_EQ(2, num_entries);
+
+  // A bare codestream has no boxes.
+  params.box_format = kCSBF_None;
+  compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 4, params);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlScanBoxes(compressed.data(), compressed.size(), entries.data(),
+                         entries.size(), &num_entries));
+  EXPECT_EQ(0, num_entries);
+
+  const uint8_t invalid[12] = {0, 0, 0, 12, 'J', 'X', 'L', 'X'};
+  EXPECT_EQ(JXL_DEC_ERROR, JxlScanBoxes(invalid, sizeof(invalid),
+                                        entries.data(), entries.size(),
+                                        &num_entries));
+}
+
+TEST(DecodeTest, ProbeHeaderTest) {
+  size_t xsize = 123;
+  size_t ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  for (int i = 0; i < kCSBF_NUM_ENTRIES; ++i) {
+    SCOPED_TRACE(testing::Message() << "box format " << i);
+    jxl::TestCodestreamParams params;
+    params.box_format = static_cast<CodeStreamBoxFormat>(i);
+    params.add_icc_profile = true;
+    std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+        jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 4, params);
+
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSubscribeEvents(
+                                   dec.get(), JXL_DEC_COLOR_ENCODING));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                  compressed.size()));
+    ASSERT_EQ(JXL_DEC_COLOR_ENCODING, JxlDecoderProcessInput(dec.get()));
+    JxlBasicInfo expected_info;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetBasicInfo(dec.get(), &expected_info));
+    size_t expected_icc_size;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetICCProfileSize(
+                  dec.get(), JXL_COLOR_PROFILE_TARGET_ORIGINAL,
+                  &expected_icc_size));
+    std::vector<uint8_t> expected_icc(expected_icc_size);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetColorAsICCProfile(
+                  dec.get(), JXL_COLOR_PROFILE_TARGET_ORIGINAL,
+                  expected_icc.data(), expected_icc.size()));
+
+    JxlBasicInfo info;
+    size_t icc_size;
+    // Gets the ICC profile size first, then the ICC profile.
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderProbeHeader(nullptr, compressed.data(),
+                                    compressed.size(), &info, nullptr, 0,
+                                    &icc_size));
+    EXPECT_EQ(0, memcmp(&expected_info, &info, sizeof(info)));
+    ASSERT_EQ(expected_icc_size, icc_size);
+    std::vector<uint8_t> icc(icc_size);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderProbeHeader(nullptr, compressed.data(),
+                                    compressed.size(), nullptr, icc.data(),
+                                    icc.size(), &icc_size));
+    EXPECT_EQ(expected_icc, icc);
+
+    // The prefixes before the end of the headers need more input.
+    bool found = false;
+    for (size_t size = 0; size <= compressed.size() && !found; ++size) {
+      JxlDecoderStatus status = JxlDecoderProbeHeader(
+          nullptr, compressed.data(), size, &info, nullptr, 0, &icc_size);
+      if (status == JXL_DEC_SUCCESS) {
+        found = true;
+        EXPECT_EQ(0, memcmp(&expected_info, &info, sizeof(info)));
+        EXPECT_EQ(expected_icc_size, icc_size);
+      } else {
+        EXPECT_EQ(JXL_DEC_NEED_MORE_INPUT, status);
+      }
+    }
+    EXPECT_TRUE(found);
+  }
+}
+
 JXL_BOXES_TEST(DecodeTest, ExifBrobBoxTest) {
   size_t xsize = 1;
   size_t ysize = 1;
@@ -37,6 +37,15 @@ class JxlToJpegDecoder {
   // Returns whether an output buffer is set.
   bool IsOutputSet() const { return next_out_ != nullptr; }
 
+  // Sets whether the JPEGData must be decoded even without an output buffer,
+  // to give access to the coefficients.
+  void SetKeepJpegData(bool keep) { keep_jpeg_data_ = keep; }
+
+  bool KeepsJpegData() const { return keep_jpeg_data_; }
+
+  // Returns whether the frame must be decoded to JPEGData instead of pixels.
+  bool WantsJpegData() const { return IsOutputSet() || keep_jpeg_data_; }
+
   // Returns whether the decoder is parsing a boxa JPEG box was parsed.
   bool IsParsingBox() const { return inside_box_; }
 
@@ -107,7 +116,7 @@ class JxlToJpegDecoder {
   // Sets the JpegData of the ImageBundle passed if there is anything to set.
   // Releases the JpegData from this decoder if set.
   Status SetImageBundleJpegData(ImageBundle* ib) {
-    if (IsOutputSet() && jpeg_data_ != nullptr) {
+    if (WantsJpegData() && jpeg_data_ != nullptr) {
       if (!jpeg::SetJPEGDataFromICC(ib->metadata()->color_encoding.ICC(),
                                     jpeg_data_.get())) {
         return false;
@@ -117,7 +126,40 @@ class JxlToJpegDecoder {
     return true;
   }
 
+  // Starts writing the JPEG to the output buffers while the frame is being
+  // decoded, and returns the writer to give to the frame decoder.
+  jpeg::JpegStreamWriter* StartStream() {
+    stream_writer_.Start([this](const uint8_t* buf, size_t len) {
+      size_t to_write = std::min<size_t>(avail_size_, len);
+      if (to_write != 0) memcpy(next_out_, buf, to_write);
+      next_out_ += to_write;
+      avail_size_ -= to_write;
+      return to_write;
+    });
+    streaming_ = true;
+    return &stream_writer_;
+  }
+
+  // Returns to writing the whole JPEG with WriteOutput.
+  void StopStream() { streaming_ = false; }
+
+  // Returns whether the JPEG is written with StartStream.
+  bool IsStreaming() const { return streaming_; }
+
+  // Writes the bytes of the streamed JPEG not yet written to the output.
+  // Returns JXL_DEC_JPEG_NEED_MORE_OUTPUT if they do not fit.
+  JxlDecoderStatus FlushStream() {
+    if (!stream_writer_.Flush()) return JXL_DEC_ERROR;
+    return stream_writer_.HasPendingOutput() ? JXL_DEC_JPEG_NEED_MORE_OUTPUT
+                                             : JXL_DEC_SUCCESS;
+  }
+
   JxlDecoderStatus WriteOutput(const jpeg::JPEGData& jpeg_data) {
+    if (streaming_) {
+      JxlDecoderStatus status = FlushStream();
+      if (status != JXL_DEC_SUCCESS) return status;
+      return stream_writer_.IsDone() ? JXL_DEC_SUCCESS : JXL_DEC_ERROR;
+    }
     // Copy JPEG bytestream if desired.
     uint8_t* tmp_next_out = next_out_;
     size_t tmp_avail_size = avail_size_;
@@ -163,6 +205,13 @@ class JxlToJpegDecoder {
   uint8_t* next_out_ = nullptr;
   // Available bytes to write JPEG reconstruction to.
   size_t avail_size_ = 0;
+
+  // Whether the JPEGData is decoded without an output buffer.
+  bool keep_jpeg_data_ = false;
+
+  // Writer of the JPEG when it is streamed.
+  jpeg::JpegStreamWriter stream_writer_;
+  bool streaming_ = false;
 };
 
 #else
@@ -171,6 +220,8 @@ class JxlToJpegDecoder {
 class JxlToJpegDecoder {
  public:
   bool IsOutputSet() const { return false; }
+  void SetKeepJpegData(bool /* keep */) {}
+  bool WantsJpegData() const { return false; }
   bool IsParsingBox() const { return false; }
 
   JxlDecoderStatus SetOutputBuffer(uint8_t* /* data */, size_t /* size */) {
@@ -32,6 +32,7 @@
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/enc_transforms-inl.h"
 #include "lib/jxl/simd_util.h"
+#include "lib/jxl/trace_internal.h"
 
 // Some of the floating point constants in this file and in other
 // files in the libjxl project have been obtained using the
@@ -591,6 +592,30 @@ Status FindBest8x8Transform(size_t x, size_t y, int encoding_speed_tier,
   return true;
 }
 
+// Cheap pre-screen of a candidate transform covering xblocks * yblocks blocks
+// from (cx, cy), before its exact entropy estimate. Large transforms rarely
+// beat the 8x8 transforms of a region whose 8x8 costs are very uneven, such as
+// one crossed by a single edge, so such candidates are skipped. `entropy_8x8`
+// holds the cost of the best 8x8 transform of each block of the 64x64 area.
+bool PruneCandidate(const ACSConfig& config,
+                    const float* JXL_RESTRICT entropy_8x8, size_t cx,
+                    size_t cy, size_t xblocks, size_t yblocks) {
+  const size_t num_blocks = xblocks * yblocks;
+  if (config.prune_ratio == 0 || num_blocks < config.prune_min_blocks) {
+    return false;
+  }
+  float sum = 0;
+  float max = 0;
+  for (size_t iy = 0; iy < yblocks; iy++) {
+    for (size_t ix = 0; ix < xblocks; ix++) {
+      const float entropy = entropy_8x8[(cy + iy) * 8 + cx + ix];
+      sum += entropy;
+      max = std::max(max, entropy);
+    }
+  }
+  return max * num_blocks > config.prune_ratio * sum;
+}
+
 // bx, by addresses the 64x64 block at 8x8 subresolution
 // cx, cy addresses the left, upper 8x8 block position of the candidate
 // transform.
@@ -600,8 +625,13 @@ Status TryMergeAcs(AcStrategyType acs_raw, size_t bx, size_t by, size_t cx,
                    AcStrategyImage* JXL_RESTRICT ac_strategy,
                    const float entropy_mul, const uint8_t candidate_priority,
                    uint8_t* priority, float* JXL_RESTRICT entropy_estimate,
-                   float* block, float* scratch_space, uint32_t* quantized) {
+                   const float* JXL_RESTRICT entropy_8x8, float* block,
+                   float* scratch_space, uint32_t* quantized) {
   AcStrategy acs = AcStrategy::FromRawStrategy(acs_raw);
+  if (PruneCandidate(config, entropy_8x8, cx, cy, acs.covered_blocks_x(),
+                     acs.covered_blocks_y())) {
+    return true;
+  }
   float entropy_current = 0;
   for (size_t iy = 0; iy < acs.covered_blocks_y(); ++iy) {
     for (size_t ix = 0; ix < acs.covered_blocks_x(); ++ix) {
@@ -684,7 +714,8 @@ Status FindBestFirstLevelDivisionForSquare(
     size_t cy, const ACSConfig& config, const float* JXL_RESTRICT cmap_factors,
     AcStrategyImage* JXL_RESTRICT ac_strategy, const float entropy_mul_JXK,
     const float entropy_mul_JXJ, float* JXL_RESTRICT entropy_estimate,
-    float* block, float* scratch_space, uint32_t* quantized) {
+    const float* JXL_RESTRICT entropy_8x8, float* block, float* scratch_space,
+    uint32_t* quantized) {
   // We denote J for the larger dimension here, and K for the smaller.
   // For example, for 32x32 block splitting, J would be 32, K 16.
   const size_t blocks_half = blocks / 2;
@@ -711,6 +742,9 @@ Status FindBestFirstLevelDivisionForSquare(
                                                  by + cy, by + cy + blocks)) {
     return true;  // not suitable for JxJ analysis, some transforms leak out.
   }
+  if (PruneCandidate(config, entropy_8x8, cx, cy, blocks, blocks)) {
+    return true;
+  }
   // For floating transforms there may be
   // already blocks selected that make either or both JXK and
   // KXJ not feasible for this location.
@@ -855,6 +889,10 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
       entropy_estimate[iy * 8 + ix] = entropy * mul8x8;
     }
   }
+  // The merges below overwrite entropy_estimate; the pre-screen of the
+  // candidates uses the costs of the 8x8 transforms.
+  float entropy_8x8[64];
+  memcpy(entropy_8x8, entropy_estimate, sizeof(entropy_8x8));
   // Merge when a larger transform is better than the previously
   // searched best combination of 8x8 transforms.
   struct MergeTry {
@@ -930,8 +968,8 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
             if ((cy | cx) % 8 == 0) {
               JXL_RETURN_IF_ERROR(FindBestFirstLevelDivisionForSquare(
                   8, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-                  tx.entropy_mul, entropy_mul64X64, entropy_estimate, block,
-                  scratch_space, quantized));
+                  tx.entropy_mul, entropy_mul64X64, entropy_estimate,
+                  entropy_8x8, block, scratch_space, quantized));
             }
             continue;
           } else if (tx.type == AcStrategyType::DCT32X16) {
@@ -955,7 +993,8 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
               JXL_RETURN_IF_ERROR(FindBestFirstLevelDivisionForSquare(
                   4, enable_32x32, bx, by, cx, cy, config, cmap_factors,
                   ac_strategy, tx.entropy_mul, entropy_mul32X32,
-                  entropy_estimate, block, scratch_space, quantized));
+                  entropy_estimate, entropy_8x8, block, scratch_space,
+                  quantized));
             }
             continue;
           } else if (tx.type == AcStrategyType::DCT32X16) {
@@ -977,8 +1016,8 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
             if ((cy | cx) % 2 == 0) {
               JXL_RETURN_IF_ERROR(FindBestFirstLevelDivisionForSquare(
                   2, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-                  tx.entropy_mul, entropy_mul16X16, entropy_estimate, block,
-                  scratch_space, quantized));
+                  tx.entropy_mul, entropy_mul16X16, entropy_estimate,
+                  entropy_8x8, block, scratch_space, quantized));
             }
             continue;
           } else if (tx.type == AcStrategyType::DCT16X8) {
@@ -1002,13 +1041,19 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
         JXL_RETURN_IF_ERROR(
             TryMergeAcs(tx.type, bx, by, cx, cy, config, cmap_factors,
                         ac_strategy, tx.entropy_mul, tx.priority, &priority[0],
-                        entropy_estimate, block, scratch_space, quantized));
+                        entropy_estimate, entropy_8x8, block, scratch_space,
+                        quantized));
       }
     }
   }
   if (cparams.speed_tier >= SpeedTier::kHare) {
     return true;
   }
+  // Text and user interfaces are made of edges and flat areas, which the
+  // aligned merges above already cover.
+  if (config.IsScreenContent(bx, by)) {
+    return true;
+  }
   // Here we still try to do some non-aligned matching, find a few more
   // 16X8, 8X16 and 16X16s between the non-2-aligned blocks.
   for (size_t cy = 0; cy + 1 < rect.ysize(); ++cy) {
@@ -1016,8 +1061,8 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
       if ((cy | cx) % 2 != 0) {
         JXL_RETURN_IF_ERROR(FindBestFirstLevelDivisionForSquare(
             2, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-            entropy_mul16X8, entropy_mul16X16, entropy_estimate, block,
-            scratch_space, quantized));
+            entropy_mul16X8, entropy_mul16X16, entropy_estimate, entropy_8x8,
+            block, scratch_space, quantized));
       }
     }
   }
@@ -1030,8 +1075,8 @@ Status ProcessRectACS(const CompressParams& cparams, const ACSConfig& config,
       }
       JXL_RETURN_IF_ERROR(FindBestFirstLevelDivisionForSquare(
           4, enable_32x32, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-          entropy_mul16X32, entropy_mul32X32, entropy_estimate, block,
-          scratch_space, quantized));
+          entropy_mul16X32, entropy_mul32X32, entropy_estimate, entropy_8x8,
+          block, scratch_space, quantized));
     }
   }
   return true;
@@ -1046,10 +1091,19 @@ HWY_AFTER_NAMESPACE();
 namespace jxl {
 HWY_EXPORT(ProcessRectACS);
 
+namespace {
+// Indexed by the level of JXL_ENC_FRAME_SETTING_AC_STRATEGY_PRUNING.
+constexpr int kMaxPruning = 3;
+constexpr float kPruneRatio[kMaxPruning + 1] = {0.0f, 4.0f, 3.0f, 2.0f};
+constexpr size_t kPruneMinBlocks[kMaxPruning + 1] = {0, 8, 4, 4};
+}  // namespace
+
 Status AcStrategyHeuristics::Init(const Image3F& src, const Rect& rect_in,
                                   const ImageF& quant_field, const ImageF& mask,
                                   const ImageF& mask1x1,
-                                  DequantMatrices* matrices) {
+                                  DequantMatrices* matrices,
+                                  const ImageB* group_content,
+                                  size_t group_dim) {
   config.dequant = matrices;
 
   if (cparams.speed_tier >= SpeedTier::kCheetah) {
@@ -1081,6 +1135,13 @@ Status AcStrategyHeuristics::Init(const Image3F& src, const Rect& rect_in,
   config.src_rows[2] = rect_in.ConstPlaneRow(src, 2, 0);
   config.src_stride = src.PixelsPerRow();
 
+  config.group_content_row = nullptr;
+  if (group_content != nullptr && group_content->xsize() > 0) {
+    config.group_content_row = group_content->Row(0);
+    config.group_content_stride = group_content->PixelsPerRow();
+    config.group_dim_in_blocks = group_dim / kBlockDim;
+  }
+
   // Entropy estimate is composed of two factors:
   //  - estimate of the number of bits that will be used by the block
   //  - information loss due to quantization
@@ -1098,6 +1159,19 @@ Status AcStrategyHeuristics::Init(const Image3F& src, const Rect& rect_in,
   config.info_loss_multiplier *= std::pow(ratio, kPow1);
   config.zeros_mul *= std::pow(ratio, kPow2);
   config.cost_delta *= std::pow(ratio, kPow3);
+
+  // Pre-screen of the candidate transforms: a candidate is skipped when the
+  // largest 8x8 cost within it is more than prune_ratio times their mean.
+  // Higher levels also prune smaller candidates.
+  int pruning = cparams.ac_strategy_pruning;
+  if (pruning < 0) {
+    pruning = cparams.speed_tier >= SpeedTier::kWombat    ? 2
+              : cparams.speed_tier >= SpeedTier::kSquirrel ? 1
+                                                           : 0;
+  }
+  pruning = std::min(pruning, kMaxPruning);
+  config.prune_ratio = kPruneRatio[pruning];
+  config.prune_min_blocks = kPruneMinBlocks[pruning];
   return true;
 }
 
@@ -1114,13 +1188,22 @@ Status AcStrategyHeuristics::ProcessRect(const Rect& rect,
                                          const ColorCorrelationMap& cmap,
                                          AcStrategyImage* ac_strategy,
                                          size_t thread) {
+  JXL_TRACE_SCOPE("AcStrategyHeuristics");
+  // With a time budget, the search narrows as the frame uses it up: first
+  // with the most aggressive pruning, then with DCT8 everywhere.
+  const double budget_used = TimeBudgetUsed(cparams);
   // In Falcon mode, use DCT8 everywhere and uniform quantization.
-  if (cparams.speed_tier >= SpeedTier::kCheetah) {
+  if (cparams.speed_tier >= SpeedTier::kCheetah || budget_used > 0.6) {
     ac_strategy->FillDCT8(rect);
     return true;
   }
+  ACSConfig tile_config = config;
+  if (budget_used > 0.4) {
+    tile_config.prune_ratio = kPruneRatio[kMaxPruning];
+    tile_config.prune_min_blocks = kPruneMinBlocks[kMaxPruning];
+  }
   return HWY_DYNAMIC_DISPATCH(ProcessRectACS)(
-      cparams, config, rect, cmap, mem.get() + thread * mem_per_thread,
+      cparams, tile_config, rect, cmap, mem.get() + thread * mem_per_thread,
       qmem.get() + thread * qmem_per_thread, ac_strategy);
 }
 
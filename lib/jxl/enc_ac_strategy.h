@@ -15,6 +15,7 @@
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/chroma_from_luma.h"
 #include "lib/jxl/enc_cache.h"
+#include "lib/jxl/enc_content_classifier.h"
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/image.h"
@@ -43,6 +44,14 @@ struct ACSConfig {
   float info_loss_multiplier;
   float cost_delta;
   float zeros_mul;
+  // Pre-screen of the candidate transforms of at least prune_min_blocks
+  // blocks; 0 = disabled.
+  float prune_ratio;
+  size_t prune_min_blocks;
+  // GroupContent of each group, or nullptr if unknown.
+  const uint8_t* JXL_RESTRICT group_content_row;
+  size_t group_content_stride;
+  size_t group_dim_in_blocks;
   const float& Pixel(size_t c, size_t x, size_t y) const {
     return src_rows[c][y * src_stride + x];
   }
@@ -58,6 +67,12 @@ struct ACSConfig {
     JXL_DASSERT(quant_field_row[by * quant_field_stride + bx] > 0);
     return quant_field_row[by * quant_field_stride + bx];
   }
+  bool IsScreenContent(size_t bx, size_t by) const {
+    if (group_content_row == nullptr) return false;
+    return group_content_row[by / group_dim_in_blocks * group_content_stride +
+                             bx / group_dim_in_blocks] ==
+           static_cast<uint8_t>(GroupContent::kScreen);
+  }
 };
 
 struct AcStrategyHeuristics {
@@ -65,7 +80,9 @@ struct AcStrategyHeuristics {
       : cparams(cparams), mem_per_thread(0), qmem_per_thread(0) {}
   Status Init(const Image3F& src, const Rect& rect_in,
               const ImageF& quant_field, const ImageF& mask,
-              const ImageF& mask1x1, DequantMatrices* matrices);
+              const ImageF& mask1x1, DequantMatrices* matrices,
+              const ImageB* group_content = nullptr,
+              size_t group_dim = kGroupDim);
   void PrepareForThreads(std::size_t num_threads);
   Status ProcessRect(const Rect& rect, const ColorCorrelationMap& cmap,
                      AcStrategyImage* ac_strategy, size_t thread);
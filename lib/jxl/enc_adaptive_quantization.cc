@@ -12,6 +12,8 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -28,6 +30,7 @@
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/butteraugli/butteraugli.h"
+#include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/convolve.h"
 #include "lib/jxl/dec_cache.h"
 #include "lib/jxl/dec_group.h"
@@ -36,6 +39,7 @@
 #include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_debug_image.h"
 #include "lib/jxl/enc_group.h"
+#include "lib/jxl/enc_image_bundle.h"
 #include "lib/jxl/enc_modular.h"
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/enc_transforms-inl.h"
@@ -45,6 +49,8 @@
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/quant_weights.h"
+#include "lib/jxl/quantizer.h"
+#include "lib/jxl/trace_internal.h"
 
 // Set JXL_DEBUG_ADAPTIVE_QUANTIZATION to 1 to enable debugging.
 #ifndef JXL_DEBUG_ADAPTIVE_QUANTIZATION
@@ -872,6 +878,158 @@ StatusOr<ImageBundle> RoundtripImage(const FrameHeader& frame_header,
   return decoded;
 }
 
+// Compares the images of the butteraugli iterations with the reference tile
+// by tile, in parallel. Each tile is compared with kMargin pixels of context
+// on every side, which covers most of the support of the butteraugli filters.
+// After the first comparison, only the tiles around blocks whose quantization
+// changed are compared again; the others keep their previous diffmap.
+class TiledButteraugliComparator {
+ public:
+  static constexpr size_t kTileDim = 512;
+  static constexpr size_t kMargin = 32;
+
+  static bool ShouldUse(const Image3F& linear) {
+    return linear.xsize() > kTileDim || linear.ysize() > kTileDim;
+  }
+
+  Status SetLinearReferenceImage(const Image3F& linear,
+                                 const ButteraugliParams& params,
+                                 ThreadPool* pool) {
+    JxlMemoryManager* memory_manager = linear.memory_manager();
+    xsize_ = linear.xsize();
+    ysize_ = linear.ysize();
+    tiles_.clear();
+    for (size_t y = 0; y < ysize_; y += kTileDim) {
+      for (size_t x = 0; x < xsize_; x += kTileDim) {
+        Tile tile;
+        tile.rect = Rect(x, y, kTileDim, kTileDim, xsize_, ysize_);
+        size_t x0 = x >= kMargin ? x - kMargin : 0;
+        size_t y0 = y >= kMargin ? y - kMargin : 0;
+        tile.padded = Rect(x0, y0, tile.rect.x1() + kMargin - x0,
+                           tile.rect.y1() + kMargin - y0, xsize_, ysize_);
+        tiles_.emplace_back(std::move(tile));
+      }
+    }
+    const auto make_comparator = [&](const uint32_t i,
+                                     size_t /* thread */) -> Status {
+      Tile& tile = tiles_[i];
+      JXL_ASSIGN_OR_RETURN(Image3F crop,
+                           Image3F::Create(memory_manager, tile.padded.xsize(),
+                                           tile.padded.ysize()));
+      JXL_RETURN_IF_ERROR(CopyImageTo(tile.padded, linear, Rect(crop), &crop));
+      JXL_ASSIGN_OR_RETURN(tile.comparator,
+                           ButteraugliComparator::Make(crop, params));
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, tiles_.size(), ThreadPool::NoInit,
+                                  make_comparator, "ButteraugliTileRef"));
+    JXL_ASSIGN_OR_RETURN(diffmap_,
+                         ImageF::Create(memory_manager, xsize_, ysize_));
+    last_raw_quant_field_ = ImageI();
+    return true;
+  }
+
+  // Sets `diffmap` to the butteraugli diffmap of `actual`, which was encoded
+  // with the given quantization.
+  Status CompareWith(const ImageBundle& actual, const Quantizer& quantizer,
+                     const ImageI& raw_quant_field, const JxlCmsInterface& cms,
+                     ThreadPool* pool, ImageF* diffmap) {
+    JxlMemoryManager* memory_manager = actual.memory_manager();
+    if (xsize_ != actual.xsize() || ysize_ != actual.ysize()) {
+      return JXL_FAILURE("Images must have same size");
+    }
+    const ImageBundle* actual_linear_srgb;
+    ImageMetadata metadata = *actual.metadata();
+    ImageBundle store(memory_manager, &metadata);
+    JXL_RETURN_IF_ERROR(TransformIfNeeded(
+        actual, ColorEncoding::LinearSRGB(actual.IsGray()), cms, pool, &store,
+        &actual_linear_srgb));
+    const Image3F& linear = actual_linear_srgb->color();
+
+    std::vector<uint8_t> changed(tiles_.size(), 1);
+    if (last_raw_quant_field_.xsize() != 0 &&
+        quantizer.Scale() == last_scale_ &&
+        quantizer.inv_quant_dc() == last_inv_quant_dc_) {
+      for (size_t i = 0; i < tiles_.size(); i++) {
+        changed[i] = QuantChanged(tiles_[i].padded, raw_quant_field);
+      }
+    }
+    const auto compare_tile = [&](const uint32_t i,
+                                  size_t /* thread */) -> Status {
+      if (!changed[i]) return true;
+      const Tile& tile = tiles_[i];
+      const Rect& padded = tile.padded;
+      JXL_ASSIGN_OR_RETURN(
+          Image3F crop,
+          Image3F::Create(memory_manager, padded.xsize(), padded.ysize()));
+      JXL_RETURN_IF_ERROR(CopyImageTo(padded, linear, Rect(crop), &crop));
+      JXL_ASSIGN_OR_RETURN(
+          ImageF tile_diffmap,
+          ImageF::Create(memory_manager, padded.xsize(), padded.ysize()));
+      JXL_RETURN_IF_ERROR(tile.comparator->Diffmap(crop, tile_diffmap));
+      const Rect inner(tile.rect.x0() - padded.x0(),
+                       tile.rect.y0() - padded.y0(), tile.rect.xsize(),
+                       tile.rect.ysize());
+      JXL_RETURN_IF_ERROR(
+          CopyImageTo(inner, tile_diffmap, tile.rect, &diffmap_));
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, tiles_.size(), ThreadPool::NoInit,
+                                  compare_tile, "ButteraugliTile"));
+
+    if (last_raw_quant_field_.xsize() == 0) {
+      JXL_ASSIGN_OR_RETURN(
+          last_raw_quant_field_,
+          ImageI::Create(memory_manager, raw_quant_field.xsize(),
+                         raw_quant_field.ysize()));
+    }
+    JXL_RETURN_IF_ERROR(CopyImageTo(raw_quant_field, &last_raw_quant_field_));
+    last_scale_ = quantizer.Scale();
+    last_inv_quant_dc_ = quantizer.inv_quant_dc();
+
+    JXL_ASSIGN_OR_RETURN(*diffmap,
+                         ImageF::Create(memory_manager, xsize_, ysize_));
+    return CopyImageTo(diffmap_, diffmap);
+  }
+
+ private:
+  struct Tile {
+    // Region of the diffmap computed by this tile.
+    Rect rect;
+    // Region of the image compared, rect with the margins.
+    Rect padded;
+    std::unique_ptr<ButteraugliComparator> comparator;
+  };
+
+  // Whether the quantization of the blocks overlapping `padded` differs from
+  // the last comparison.
+  bool QuantChanged(const Rect& padded, const ImageI& raw_quant_field) const {
+    const size_t bx0 = padded.x0() / kBlockDim;
+    const size_t by0 = padded.y0() / kBlockDim;
+    const Rect block_rect(bx0, by0, DivCeil(padded.x1(), kBlockDim) - bx0,
+                          DivCeil(padded.y1(), kBlockDim) - by0,
+                          raw_quant_field.xsize(), raw_quant_field.ysize());
+    for (size_t y = 0; y < block_rect.ysize(); y++) {
+      const int32_t* JXL_RESTRICT row = block_rect.ConstRow(raw_quant_field, y);
+      const int32_t* JXL_RESTRICT last_row =
+          block_rect.ConstRow(last_raw_quant_field_, y);
+      if (memcmp(row, last_row, block_rect.xsize() * sizeof(*row)) != 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+  std::vector<Tile> tiles_;
+  ImageF diffmap_;
+  // Empty until the first comparison.
+  ImageI last_raw_quant_field_;
+  float last_scale_ = 0;
+  float last_inv_quant_dc_ = 0;
+};
+
 constexpr int kMaxButteraugliIters = 4;
 
 Status FindBestQuantization(const FrameHeader& frame_header,
@@ -896,9 +1054,17 @@ Status FindBestQuantization(const FrameHeader& frame_header,
   ButteraugliParams params;
   params.intensity_target = 80.f;
   JxlButteraugliComparator comparator(params, cms);
-  JXL_RETURN_IF_ERROR(comparator.SetLinearReferenceImage(linear));
   bool lower_is_better =
       (comparator.GoodQualityScore() < comparator.BadQualityScore());
+  TiledButteraugliComparator tiled_comparator;
+  const bool use_tiles =
+      lower_is_better && TiledButteraugliComparator::ShouldUse(linear);
+  if (use_tiles) {
+    JXL_RETURN_IF_ERROR(
+        tiled_comparator.SetLinearReferenceImage(linear, params, pool));
+  } else {
+    JXL_RETURN_IF_ERROR(comparator.SetLinearReferenceImage(linear));
+  }
   const float initial_quant_dc = InitialQuantDC(butteraugli_target);
   JXL_RETURN_IF_ERROR(AdjustQuantField(enc_state->shared.ac_strategy,
                                        Rect(quant_field), original_butteraugli,
@@ -921,6 +1087,18 @@ Status FindBestQuantization(const FrameHeader& frame_header,
 
   JXL_ENSURE(qf_higher / qf_lower < 253);
 
+  // In streaming mode, the global scale of the quantizer was already chosen
+  // for the whole frame, and only the quant field of the window is updated.
+  const auto set_quant_field = [&]() -> Status {
+    if (enc_state->streaming_mode) {
+      quantizer.SetQuantFieldRect(quant_field, Rect(quant_field),
+                                  &raw_quant_field);
+      return true;
+    }
+    return quantizer.SetQuantField(initial_quant_dc, quant_field,
+                                   &raw_quant_field);
+  };
+
   constexpr int kOriginalComparisonRound = 1;
   int iters = kMaxButteraugliIters;
   if (cparams.speed_tier != SpeedTier::kTortoise) {
@@ -936,14 +1114,20 @@ Status FindBestQuantization(const FrameHeader& frame_header,
         printf("\n");
       }
     }
-    JXL_RETURN_IF_ERROR(quantizer.SetQuantField(initial_quant_dc, quant_field,
-                                                &raw_quant_field));
+    JXL_RETURN_IF_ERROR(set_quant_field());
     JXL_ASSIGN_OR_RETURN(
         ImageBundle dec_linear,
         RoundtripImage(frame_header, opsin, enc_state, cms, pool));
     float score;
     ImageF diffmap;
-    JXL_RETURN_IF_ERROR(comparator.CompareWith(dec_linear, &diffmap, &score));
+    if (use_tiles) {
+      JXL_RETURN_IF_ERROR(tiled_comparator.CompareWith(
+          dec_linear, quantizer, raw_quant_field, cms, pool, &diffmap));
+      score = ButteraugliScoreFromDiffmap(diffmap, &params);
+    } else {
+      JXL_RETURN_IF_ERROR(
+          comparator.CompareWith(dec_linear, &diffmap, &score));
+    }
     if (!lower_is_better) {
       score = -score;
       ScaleImage(-1.0f, &diffmap);
@@ -972,7 +1156,9 @@ Status FindBestQuantization(const FrameHeader& frame_header,
       }
     }
 
-    if (i == iters) break;
+    // With a time budget, the last iterations are skipped once the frame used
+    // most of it.
+    if (i == iters || TimeBudgetUsed(cparams) > 0.8) break;
 
     double kPow[8] = {
         0.2, 0.2, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
@@ -1053,8 +1239,7 @@ Status FindBestQuantization(const FrameHeader& frame_header,
       }
     }
   }
-  JXL_RETURN_IF_ERROR(
-      quantizer.SetQuantField(initial_quant_dc, quant_field, &raw_quant_field));
+  JXL_RETURN_IF_ERROR(set_quant_field());
   return true;
 }
 
@@ -1137,6 +1322,92 @@ Status FindBestQuantizationMaxError(const FrameHeader& frame_header,
   return true;
 }
 
+// Scales the quantization of the whole frame so that the butteraugli score of
+// the encoder-side reconstruction gets close to the target score, searching
+// the distance in the log domain. Only the global scale of `quant_field` and
+// the DC quantization change between probes, so the AC strategy, the masking
+// and the XYB image of the frame are reused.
+Status FindQuantScaleForTargetScore(const FrameHeader& frame_header,
+                                    const Image3F& linear, const Image3F& opsin,
+                                    ImageF& quant_field,
+                                    PassesEncoderState* enc_state,
+                                    const JxlCmsInterface& cms,
+                                    ThreadPool* pool, AuxOut* aux_out) {
+  const CompressParams& cparams = enc_state->cparams;
+  JxlMemoryManager* memory_manager = enc_state->memory_manager();
+  Quantizer& quantizer = enc_state->shared.quantizer;
+  ImageI& raw_quant_field = enc_state->shared.raw_quant_field;
+
+  const float target = cparams.target_butteraugli_score;
+  const float initial_distance = cparams.butteraugli_distance;
+  ButteraugliParams params;
+  params.intensity_target = 80.f;
+  JxlButteraugliComparator comparator(params, cms, pool);
+  JXL_RETURN_IF_ERROR(comparator.SetLinearReferenceImage(linear));
+
+  JXL_ASSIGN_OR_RETURN(
+      ImageF probe_field,
+      ImageF::Create(memory_manager, quant_field.xsize(), quant_field.ysize()));
+  const auto set_distance = [&](float distance) -> Status {
+    JXL_RETURN_IF_ERROR(CopyImageTo(quant_field, &probe_field));
+    ScaleImage(initial_distance / distance, &probe_field);
+    return quantizer.SetQuantField(InitialQuantDC(distance), probe_field,
+                                   &raw_quant_field);
+  };
+  const auto probe = [&](float distance) -> StatusOr<float> {
+    JXL_RETURN_IF_ERROR(set_distance(distance));
+    JXL_ASSIGN_OR_RETURN(
+        ImageBundle dec_linear,
+        RoundtripImage(frame_header, opsin, enc_state, cms, pool));
+    ImageF diffmap;
+    float score;
+    JXL_RETURN_IF_ERROR(comparator.CompareWith(dec_linear, &diffmap, &score));
+    if (aux_out != nullptr) ++aux_out->num_butteraugli_iters;
+    if (JXL_DEBUG_ADAPTIVE_QUANTIZATION) {
+      printf("Target search: distance %f, score %f (target = %f)\n", distance,
+             score, target);
+    }
+    return score;
+  };
+
+  // The score grows roughly linearly with the distance, so the first probes
+  // extrapolate from the last one until the target is bracketed, and the
+  // remaining ones bisect the bracket.
+  constexpr int kMaxTargetIters = 6;
+  constexpr float kTolerance = 0.02f;
+  constexpr float kMinDistance = 0.05f;
+  constexpr float kMaxDistance = 25.0f;
+  float lo = 0;  // Largest distance known to be within the target.
+  float hi = 0;  // Smallest distance known to be above the target.
+  float best = initial_distance;
+  float distance = initial_distance;
+  for (int i = 0; i < kMaxTargetIters; ++i) {
+    JXL_ASSIGN_OR_RETURN(float score, probe(distance));
+    if (score <= target) {
+      lo = std::max(lo, distance);
+      best = lo;
+    } else {
+      hi = hi == 0 ? distance : std::min(hi, distance);
+      if (lo == 0) best = std::min(best, distance);
+    }
+    if (std::abs(score - target) <= kTolerance * target) break;
+    float next;
+    if (lo != 0 && hi != 0) {
+      next = std::sqrt(lo * hi);
+    } else {
+      next = distance * target / std::max(score, 1e-3f);
+      next = std::min(std::max(next, distance * 0.25f), distance * 4.0f);
+    }
+    next = std::min(std::max(next, kMinDistance), kMaxDistance);
+    if (std::abs(next - distance) <= 1e-3f * distance) break;
+    distance = next;
+  }
+  // Keep the largest distance that was within the target, or the smallest
+  // probed one if none was.
+  JXL_RETURN_IF_ERROR(set_distance(best));
+  return CopyImageTo(probe_field, &quant_field);
+}
+
 }  // namespace
 
 Status AdjustQuantField(const AcStrategyImage& ac_strategy, const Rect& rect,
@@ -1209,6 +1480,7 @@ StatusOr<ImageF> InitialQuantField(const float butteraugli_target,
                                    const Image3F& opsin, const Rect& rect,
                                    ThreadPool* pool, float rescale,
                                    ImageF* mask, ImageF* mask1x1) {
+  JXL_TRACE_SCOPE("InitialQuantField");
   const float quant_ac = kAcQuant / butteraugli_target;
   return HWY_DYNAMIC_DISPATCH(AdaptiveQuantizationMap)(
       butteraugli_target, opsin, rect, quant_ac * rescale, pool, mask, mask1x1);
@@ -1223,12 +1495,20 @@ Status FindBestQuantizer(const FrameHeader& frame_header, const Image3F* linear,
   if (cparams.max_error_mode) {
     JXL_RETURN_IF_ERROR(FindBestQuantizationMaxError(
         frame_header, opsin, quant_field, enc_state, cms, pool, aux_out));
-  } else if (linear && cparams.speed_tier <= SpeedTier::kKitten) {
-    // Normal encoding to a butteraugli score.
+  } else if (linear && cparams.speed_tier <= SpeedTier::kKitten &&
+             TimeBudgetUsed(cparams) < 0.5) {
+    // Normal encoding to a butteraugli score, unless the frame already used
+    // half of its time budget.
     JXL_RETURN_IF_ERROR(FindBestQuantization(frame_header, *linear, opsin,
                                              quant_field, enc_state, cms, pool,
                                              aux_out));
   }
+  if (linear && cparams.target_butteraugli_score > 0 &&
+      !cparams.max_error_mode && !enc_state->streaming_mode) {
+    JXL_RETURN_IF_ERROR(FindQuantScaleForTargetScore(
+        frame_header, *linear, opsin, quant_field, enc_state, cms, pool,
+        aux_out));
+  }
   return true;
 }
 
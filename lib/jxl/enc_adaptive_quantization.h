@@ -46,7 +46,9 @@ Status AdjustQuantField(const AcStrategyImage& ac_strategy, const Rect& rect,
 // Returns a quantizer that uses an adjusted version of the provided
 // quant_field. Also computes the dequant_map corresponding to the given
 // dequant_float_map and chosen quantization levels.
-// `linear` is only used in Kitten mode or slower.
+// `linear` is only used in Kitten mode or slower, and to reach
+// `target_butteraugli_score` if that is set. In streaming mode, the global
+// scale of the quantizer is kept and `target_butteraugli_score` is ignored.
 Status FindBestQuantizer(const FrameHeader& frame_header, const Image3F* linear,
                          const Image3F& opsin, ImageF& quant_field,
                          PassesEncoderState* enc_state,
@@ -29,6 +29,7 @@
 #include "lib/jxl/enc_huffman.h"
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/fields.h"
+#include "lib/jxl/trace_internal.h"
 
 namespace jxl {
 
@@ -722,6 +723,8 @@ class HistogramBuilder {
  public:
   explicit HistogramBuilder(const size_t num_contexts)
       : histograms_(num_contexts) {}
+  explicit HistogramBuilder(std::vector<Histogram> histograms)
+      : histograms_(std::move(histograms)) {}
 
   void VisitSymbol(int symbol, size_t histo_idx) {
     JXL_DASSERT(histo_idx < histograms_.size());
@@ -744,7 +747,11 @@ class HistogramBuilder {
     size_t context_offset = context_map->size();
     context_map->resize(context_offset + histograms_.size());
     if (histograms_.size() > 1) {
-      if (!ans_fuzzer_friendly_) {
+      if (!ans_fuzzer_friendly_ && prev_histograms == 0 &&
+          context_offset == 0 && MatchesContexts(params)) {
+        MergeByContextMap(*params.initial_context_map, &clustered_histograms,
+                          context_map);
+      } else if (!ans_fuzzer_friendly_) {
         std::vector<uint32_t> histogram_symbols;
         JXL_RETURN_IF_ERROR(
             ClusterHistograms(params, histograms_, kClustersLimit,
@@ -852,6 +859,44 @@ class HistogramBuilder {
   const Histogram& Histo(size_t i) const { return histograms_[i]; }
 
  private:
+  // Returns whether params.initial_context_map can cluster `histograms_`.
+  bool MatchesContexts(const HistogramParams& params) const {
+    const std::vector<uint8_t>* initial = params.initial_context_map;
+    if (initial == nullptr || initial->size() != histograms_.size()) {
+      return false;
+    }
+    const size_t num_clusters =
+        *std::max_element(initial->begin(), initial->end()) + 1;
+    return num_clusters <= std::min(params.max_histograms, kClustersLimit);
+  }
+
+  // Clusters `histograms_` as in `initial`, without the clusters that are
+  // empty now.
+  void MergeByContextMap(const std::vector<uint8_t>& initial,
+                         std::vector<Histogram>* clustered_histograms,
+                         std::vector<uint8_t>* context_map) const {
+    const size_t num_clusters =
+        *std::max_element(initial.begin(), initial.end()) + 1;
+    std::vector<Histogram> merged(num_clusters);
+    for (size_t c = 0; c < histograms_.size(); ++c) {
+      merged[initial[c]].AddHistogram(histograms_[c]);
+    }
+    // The contexts of the empty clusters are empty too, and can use any of
+    // the remaining ones.
+    std::vector<uint8_t> remap(num_clusters, 0);
+    for (size_t i = 0; i < num_clusters; ++i) {
+      if (merged[i].total_count_ == 0) continue;
+      remap[i] = static_cast<uint8_t>(clustered_histograms->size());
+      clustered_histograms->push_back(merged[i]);
+    }
+    if (clustered_histograms->empty()) {
+      clustered_histograms->push_back(merged[0]);
+    }
+    for (size_t c = 0; c < histograms_.size(); ++c) {
+      (*context_map)[c] = remap[initial[c]];
+    }
+  }
+
   std::vector<Histogram> histograms_;
 };
 
@@ -927,6 +972,7 @@ void ApplyLZ77_RLE(const HistogramParams& params, size_t num_contexts,
                    const std::vector<std::vector<Token>>& tokens,
                    LZ77Params& lz77,
                    std::vector<std::vector<Token>>& tokens_lz77) {
+  JXL_TRACE_SCOPE("ApplyLZ77_RLE");
   // TODO(veluca): tune heuristics here.
   SymbolCostEstimator sce(num_contexts, params.force_huffman, tokens, lz77);
   float bit_decrease = 0;
@@ -1000,9 +1046,9 @@ struct HashChain {
   size_t size_;
   std::vector<uint32_t> data_;
 
-  unsigned hash_num_values_ = 32768;
-  unsigned hash_mask_ = hash_num_values_ - 1;
-  unsigned hash_shift_ = 5;
+  static constexpr unsigned kHashBits = 15;
+  static constexpr uint32_t kHashMul = 0x1E35A7BD;
+  unsigned hash_num_values_ = 1u << kHashBits;
 
   std::vector<int> head;
   std::vector<uint32_t> chain;
@@ -1024,6 +1070,8 @@ struct HashChain {
   size_t num_special_distances_ = 0;
 
   uint32_t maxchainlength = 256;  // window_size_ to allow all
+  // Matches at least this long end the search.
+  uint32_t nice_length = 256;
 
   HashChain(const Token* data, size_t size, size_t window_size,
             size_t min_length, size_t max_length, size_t distance_multiplier)
@@ -1062,18 +1110,14 @@ struct HashChain {
   }
 
   uint32_t GetHash(size_t pos) const {
-    uint32_t result = 0;
-    if (pos + 2 < size_) {
-      // TODO(lode): take the MSB's of the uint32_t values into account as well,
-      // given that the hash code itself is less than 32 bits.
-      result ^= static_cast<uint32_t>(data_[pos + 0] << 0u);
-      result ^= static_cast<uint32_t>(data_[pos + 1] << hash_shift_);
-      result ^= static_cast<uint32_t>(data_[pos + 2] << (hash_shift_ * 2));
-    } else {
-      // No need to compute hash of last 2 bytes, the length 2 is too short.
-      return 0;
-    }
-    return result & hash_mask_;
+    // No need to compute hash of last 2 bytes, the length 2 is too short.
+    if (pos + 2 >= size_) return 0;
+    // Multiplicative hash, which also takes the high bits of large values
+    // into account.
+    uint32_t result = data_[pos];
+    result = result * kHashMul + data_[pos + 1];
+    result = result * kHashMul + data_[pos + 2];
+    return (result * kHashMul) >> (32 - kHashBits);
   }
 
   uint32_t CountZeros(size_t pos, uint32_t prevzeros) const {
@@ -1158,7 +1202,7 @@ struct HashChain {
       }
 
       chainlength++;
-      if (chainlength >= maxchainlength) break;
+      if (chainlength >= maxchainlength || best_len >= nice_length) break;
 
       if (numzeros >= 3 && len > numzeros) {
         if (hashpos == chainz[hashpos]) break;
@@ -1267,6 +1311,7 @@ void ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
                     const std::vector<std::vector<Token>>& tokens,
                     LZ77Params& lz77,
                     std::vector<std::vector<Token>>& tokens_lz77) {
+  JXL_TRACE_SCOPE("ApplyLZ77_LZ77");
   // TODO(veluca): tune heuristics here.
   SymbolCostEstimator sce(num_contexts, params.force_huffman, tokens, lz77);
   float bit_decrease = 0;
@@ -1302,10 +1347,13 @@ void ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
 
     HashChain chain(in.data(), in.size(), window_size, min_length, max_length,
                     distance_multiplier);
+    chain.maxchainlength = params.lz77_max_chain_length;
+    chain.nice_length = params.lz77_nice_length;
     size_t len;
     size_t dist_symbol;
 
-    const size_t max_lazy_match_len = 256;  // 0 to disable lazy matching
+    // Matches this long are taken without lazy matching.
+    const size_t max_lazy_match_len = params.lz77_nice_length;
 
     // Whether the next symbol was already updated (to test lazy matching)
     bool already_updated = false;
@@ -1372,6 +1420,7 @@ void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
                        const std::vector<std::vector<Token>>& tokens,
                        LZ77Params& lz77,
                        std::vector<std::vector<Token>>& tokens_lz77) {
+  JXL_TRACE_SCOPE("ApplyLZ77_Optimal");
   std::vector<std::vector<Token>> tokens_for_cost_estimate;
   ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_for_cost_estimate);
   // If greedy-LZ77 does not give better compression than no-lz77, no reason to
@@ -1410,6 +1459,8 @@ void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
 
     HashChain chain(in.data(), in.size(), window_size, min_length, max_length,
                     distance_multiplier);
+    chain.maxchainlength = params.lz77_max_chain_length;
+    chain.nice_length = params.lz77_nice_length;
 
     struct MatchInfo {
       uint32_t len;
@@ -1481,6 +1532,12 @@ void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
       if (rle_length >= 8 && dist_symbols.size() > 9) {
         skip_lz77 = dist_symbols.size() - 10;
         rle_length = 0;
+      } else if (dist_symbols.size() > std::max<size_t>(
+                                          params.lz77_nice_length, 10)) {
+        // Likewise within long repetitions of longer sequences, e.g. rows of
+        // screenshots or pixel art, which would otherwise be matched again at
+        // every position.
+        skip_lz77 = dist_symbols.size() - 10;
       }
     }
     size_t pos = in.size();
@@ -1525,6 +1582,79 @@ void ApplyLZ77(const HistogramParams& params, size_t num_contexts,
       return;
   }
 }
+
+// Symbol counts of the built-in static codes. They cover the whole alphabet of
+// the default HybridUintConfig, so that any token can be coded, and decay
+// geometrically: quickly for VarDCT AC coefficients, which are mostly zeros,
+// and more slowly for modular residuals.
+std::vector<ANSHistBin> StaticCodeCounts(HistogramParams::StaticCodes codes) {
+  constexpr size_t kAlphabetSize = 128;
+  const float decay =
+      codes == HistogramParams::StaticCodes::kVarDCT ? 0.45f : 0.7f;
+  std::vector<ANSHistBin> counts(kAlphabetSize);
+  float count = ANS_TAB_SIZE;
+  for (ANSHistBin& c : counts) {
+    c = std::max(1, static_cast<int>(count));
+    count *= decay;
+  }
+  return counts;
+}
+
+// Writes a single built-in histogram shared by all the contexts, without
+// looking at the tokens.
+StatusOr<size_t> EncodeStaticCodes(JxlMemoryManager* memory_manager,
+                                   const HistogramParams& params,
+                                   size_t num_contexts,
+                                   EntropyEncodingData* codes,
+                                   std::vector<uint8_t>* context_map,
+                                   BitWriter* writer, LayerType layer,
+                                   AuxOut* aux_out) {
+  JXL_ENSURE(codes->encoding_info.empty());
+  const std::vector<ANSHistBin> counts = StaticCodeCounts(params.static_codes);
+  const size_t alphabet_size = counts.size();
+  codes->lz77.enabled = false;
+  if (params.initialize_global_state) {
+    codes->use_prefix_code =
+        params.force_huffman ||
+        params.clustering == HistogramParams::ClusteringType::kFastest;
+  }
+  codes->uint_config.assign(1, HybridUintConfig());
+  context_map->resize(context_map->size() + num_contexts, 0);
+
+  const size_t log_alpha_size =
+      codes->use_prefix_code ? PREFIX_MAX_BITS : CeilLog2Nonzero(alphabet_size);
+  BitWriter::Allotment allotment(writer, 128 + alphabet_size * 24);
+  const size_t start = writer->BitsWritten();
+  JXL_RETURN_IF_ERROR(Bundle::Write(codes->lz77, writer, layer, aux_out));
+  if (num_contexts > 1) {
+    JXL_RETURN_IF_ERROR(
+        EncodeContextMap(*context_map, 1, writer, layer, aux_out));
+  }
+  writer->Write(1, TO_JXL_BOOL(codes->use_prefix_code));
+  if (codes->use_prefix_code) {
+    EncodeUintConfigs(codes->uint_config, writer, log_alpha_size);
+    StoreVarLenUint16(alphabet_size - 1, writer);
+  } else {
+    writer->Write(2, log_alpha_size - 5);
+    EncodeUintConfigs(codes->uint_config, writer, log_alpha_size);
+  }
+  codes->encoding_info.emplace_back(alphabet_size);
+  JXL_ASSIGN_OR_RETURN(
+      size_t ans_cost,
+      BuildAndStoreANSEncodingData(memory_manager,
+                                   params.ans_histogram_strategy, counts.data(),
+                                   alphabet_size, log_alpha_size,
+                                   codes->use_prefix_code,
+                                   codes->encoding_info.back().data(), writer));
+  (void)ans_cost;
+  size_t cost = writer->BitsWritten() - start;
+  JXL_RETURN_IF_ERROR(allotment.FinishedHistogram(writer));
+  JXL_RETURN_IF_ERROR(allotment.ReclaimAndCharge(writer, layer, aux_out));
+  if (aux_out != nullptr) {
+    aux_out->layer(layer).num_clustered_histograms += 1;
+  }
+  return cost;
+}
 }  // namespace
 
 Status EncodeHistograms(const std::vector<uint8_t>& context_map,
@@ -1560,11 +1690,99 @@ Status EncodeHistograms(const std::vector<uint8_t>& context_map,
   return true;
 }
 
+namespace {
+
+// Chooses the entropy codes of the histograms gathered in `builder` and writes
+// them, after the LZ77 parameters already written by the caller.
+StatusOr<size_t> FinishAndEncodeHistograms(
+    JxlMemoryManager* memory_manager, const HistogramParams& params,
+    size_t num_contexts, size_t total_tokens, HistogramBuilder& builder,
+    const std::vector<std::vector<Token>>& tokens, EntropyEncodingData* codes,
+    std::vector<uint8_t>* context_map, BitWriter* writer, LayerType layer,
+    AuxOut* aux_out, BitWriter::Allotment& allotment) {
+  size_t cost = 0;
+  if (params.add_missing_symbols || params.sample_streams) {
+    for (size_t c = 0; c < num_contexts; ++c) {
+      for (int symbol = 0; symbol < ANS_MAX_ALPHABET_SIZE; ++symbol) {
+        builder.VisitSymbol(symbol, c);
+      }
+    }
+  }
+
+  if (params.initialize_global_state) {
+    bool use_prefix_code =
+        params.force_huffman || total_tokens < 100 ||
+        params.clustering == HistogramParams::ClusteringType::kFastest ||
+        ans_fuzzer_friendly_;
+    if (!use_prefix_code) {
+      bool all_singleton = true;
+      for (size_t i = 0; i < num_contexts; i++) {
+        if (builder.Histo(i).ShannonEntropy() >= 1e-5) {
+          all_singleton = false;
+        }
+      }
+      if (all_singleton) {
+        use_prefix_code = true;
+      }
+    }
+    codes->use_prefix_code = use_prefix_code;
+  }
+
+  if (params.add_fixed_histograms) {
+    // TODO(szabadka) Add more fixed histograms.
+    // TODO(szabadka) Reduce alphabet size by choosing a non-default
+    // uint_config.
+    const size_t alphabet_size = ANS_MAX_ALPHABET_SIZE;
+    const size_t log_alpha_size = 8;
+    JXL_ENSURE(alphabet_size == 1u << log_alpha_size);
+    static_assert(ANS_MAX_ALPHABET_SIZE <= ANS_TAB_SIZE);
+    std::vector<int32_t> counts =
+        CreateFlatHistogram(alphabet_size, ANS_TAB_SIZE);
+    codes->encoding_info.emplace_back();
+    codes->encoding_info.back().resize(alphabet_size);
+    codes->encoded_histograms.emplace_back(memory_manager);
+    BitWriter* histo_writer = &codes->encoded_histograms.back();
+    BitWriter::Allotment histo_allotment(histo_writer,
+                                         256 + alphabet_size * 24);
+    JXL_ASSIGN_OR_RETURN(
+        size_t ans_cost,
+        BuildAndStoreANSEncodingData(
+            memory_manager, params.ans_histogram_strategy, counts.data(),
+            alphabet_size, log_alpha_size, codes->use_prefix_code,
+            codes->encoding_info.back().data(), histo_writer));
+    (void)ans_cost;
+    JXL_RETURN_IF_ERROR(histo_allotment.ReclaimAndCharge(
+        histo_writer, LayerType::Header, nullptr));
+  }
+
+  // Encode histograms.
+  JXL_ASSIGN_OR_RETURN(
+      size_t entropy_bits,
+      builder.BuildAndStoreEntropyCodes(memory_manager, params, tokens, codes,
+                                        context_map, writer, layer, aux_out));
+  cost += entropy_bits;
+  JXL_RETURN_IF_ERROR(allotment.FinishedHistogram(writer));
+  JXL_RETURN_IF_ERROR(allotment.ReclaimAndCharge(writer, layer, aux_out));
+
+  if (aux_out != nullptr) {
+    aux_out->layer(layer).num_clustered_histograms +=
+        codes->encoding_info.size();
+  }
+  return cost;
+}
+
+}  // namespace
+
 StatusOr<size_t> BuildAndEncodeHistograms(
     JxlMemoryManager* memory_manager, const HistogramParams& params,
     size_t num_contexts, std::vector<std::vector<Token>>& tokens,
     EntropyEncodingData* codes, std::vector<uint8_t>* context_map,
     BitWriter* writer, LayerType layer, AuxOut* aux_out) {
+  if (params.static_codes != HistogramParams::StaticCodes::kNone &&
+      !params.streaming_mode && writer != nullptr) {
+    return EncodeStaticCodes(memory_manager, params, num_contexts, codes,
+                             context_map, writer, layer, aux_out);
+  }
   size_t cost = 0;
   codes->lz77.nonserialized_distance_context = num_contexts;
   std::vector<std::vector<Token>> tokens_lz77;
@@ -1613,7 +1831,9 @@ StatusOr<size_t> BuildAndEncodeHistograms(
   if (ans_fuzzer_friendly_) {
     uint_config = HybridUintConfig(10, 0, 0);
   }
-  for (const auto& stream : tokens) {
+  for (size_t i = 0; i < tokens.size(); i++) {
+    if (params.sample_streams && !IsSampledStream(i, tokens.size())) continue;
+    const std::vector<Token>& stream = tokens[i];
     if (codes->lz77.enabled) {
       for (const auto& token : stream) {
         total_tokens++;
@@ -1640,73 +1860,79 @@ StatusOr<size_t> BuildAndEncodeHistograms(
     }
   }
 
-  if (params.add_missing_symbols) {
-    for (size_t c = 0; c < num_contexts; ++c) {
-      for (int symbol = 0; symbol < ANS_MAX_ALPHABET_SIZE; ++symbol) {
-        builder.VisitSymbol(symbol, c);
-      }
-    }
+  JXL_ASSIGN_OR_RETURN(
+      size_t histo_cost,
+      FinishAndEncodeHistograms(memory_manager, params, num_contexts,
+                                total_tokens, builder, tokens, codes,
+                                context_map, writer, layer, aux_out,
+                                allotment));
+  return cost + histo_cost;
+}
+
+bool IsSampledStream(size_t index, size_t num_streams) {
+  constexpr size_t kMinStreamsForSampling = 8;
+  if (num_streams < kMinStreamsForSampling) return true;
+  // The top two bits of a multiplicative hash, which is zero for stream 0.
+  return ((static_cast<uint32_t>(index) * 0x9E3779B9u) >> 30) == 0;
+}
+
+bool CanBuildHistogramsFromCounts(const HistogramParams& params) {
+  return params.lz77_method == HistogramParams::LZ77Method::kNone &&
+         params.uint_method == HistogramParams::HybridUintMethod::kNone &&
+         !params.add_fixed_histograms && !ans_fuzzer_friendly_;
+}
+
+void AddTokensToHistograms(const std::vector<Token>& tokens,
+                           std::vector<Histogram>* histograms) {
+  HybridUintConfig uint_config;  // Default config, as with kNone.
+  for (const Token& token : tokens) {
+    uint32_t tok, nbits, bits;
+    uint_config.Encode(token.value, &tok, &nbits, &bits);
+    JXL_DASSERT(token.context < histograms->size());
+    (*histograms)[token.context].Add(tok);
   }
+}
 
+StatusOr<size_t> BuildAndEncodeHistogramsFromCounts(
+    JxlMemoryManager* memory_manager, const HistogramParams& params,
+    std::vector<Histogram> histograms, EntropyEncodingData* codes,
+    std::vector<uint8_t>* context_map, BitWriter* writer, LayerType layer,
+    AuxOut* aux_out) {
+  JXL_ENSURE(CanBuildHistogramsFromCounts(params));
+  const size_t num_contexts = histograms.size();
+  if (params.static_codes != HistogramParams::StaticCodes::kNone &&
+      !params.streaming_mode && writer != nullptr) {
+    return EncodeStaticCodes(memory_manager, params, num_contexts, codes,
+                             context_map, writer, layer, aux_out);
+  }
+  size_t cost = 0;
+  codes->lz77.nonserialized_distance_context = num_contexts;
   if (params.initialize_global_state) {
-    bool use_prefix_code =
-        params.force_huffman || total_tokens < 100 ||
-        params.clustering == HistogramParams::ClusteringType::kFastest ||
-        ans_fuzzer_friendly_;
-    if (!use_prefix_code) {
-      bool all_singleton = true;
-      for (size_t i = 0; i < num_contexts; i++) {
-        if (builder.Histo(i).ShannonEntropy() >= 1e-5) {
-          all_singleton = false;
-        }
-      }
-      if (all_singleton) {
-        use_prefix_code = true;
-      }
-    }
-    codes->use_prefix_code = use_prefix_code;
+    codes->lz77.enabled = false;
   }
-
-  if (params.add_fixed_histograms) {
-    // TODO(szabadka) Add more fixed histograms.
-    // TODO(szabadka) Reduce alphabet size by choosing a non-default
-    // uint_config.
-    const size_t alphabet_size = ANS_MAX_ALPHABET_SIZE;
-    const size_t log_alpha_size = 8;
-    JXL_ENSURE(alphabet_size == 1u << log_alpha_size);
-    static_assert(ANS_MAX_ALPHABET_SIZE <= ANS_TAB_SIZE);
-    std::vector<int32_t> counts =
-        CreateFlatHistogram(alphabet_size, ANS_TAB_SIZE);
-    codes->encoding_info.emplace_back();
-    codes->encoding_info.back().resize(alphabet_size);
-    codes->encoded_histograms.emplace_back(memory_manager);
-    BitWriter* histo_writer = &codes->encoded_histograms.back();
-    BitWriter::Allotment allotment(histo_writer, 256 + alphabet_size * 24);
-    JXL_ASSIGN_OR_RETURN(
-        size_t ans_cost,
-        BuildAndStoreANSEncodingData(
-            memory_manager, params.ans_histogram_strategy, counts.data(),
-            alphabet_size, log_alpha_size, codes->use_prefix_code,
-            codes->encoding_info.back().data(), histo_writer));
-    (void)ans_cost;
-    JXL_RETURN_IF_ERROR(
-        allotment.ReclaimAndCharge(histo_writer, LayerType::Header, nullptr));
+  JXL_ENSURE(!codes->lz77.enabled);
+  const size_t max_contexts = std::min(num_contexts, kClustersLimit);
+  BitWriter::Allotment allotment(writer,
+                                 128 + num_contexts * 40 + max_contexts * 96);
+  if (writer) {
+    JXL_RETURN_IF_ERROR(Bundle::Write(codes->lz77, writer, layer, aux_out));
+  } else {
+    size_t ebits, bits;
+    JXL_RETURN_IF_ERROR(Bundle::CanEncode(codes->lz77, &ebits, &bits));
+    cost += bits;
   }
-
-  // Encode histograms.
-  JXL_ASSIGN_OR_RETURN(
-      size_t entropy_bits,
-      builder.BuildAndStoreEntropyCodes(memory_manager, params, tokens, codes,
-                                        context_map, writer, layer, aux_out));
-  cost += entropy_bits;
-  JXL_RETURN_IF_ERROR(allotment.FinishedHistogram(writer));
-  JXL_RETURN_IF_ERROR(allotment.ReclaimAndCharge(writer, layer, aux_out));
-
-  if (aux_out != nullptr) {
-    aux_out->layer(layer).num_clustered_histograms +=
-        codes->encoding_info.size();
+  size_t total_tokens = 0;
+  for (const Histogram& histo : histograms) {
+    total_tokens += histo.total_count_;
   }
-  return cost;
+  HistogramBuilder builder(std::move(histograms));
+  JXL_ASSIGN_OR_RETURN(
+      size_t histo_cost,
+      FinishAndEncodeHistograms(memory_manager, params, num_contexts,
+                                total_tokens, builder, /*tokens=*/{}, codes,
+                                context_map, writer, layer, aux_out,
+                                allotment));
+  return cost + histo_cost;
 }
 
 size_t WriteTokens(const std::vector<Token>& tokens,
@@ -1862,6 +2088,23 @@ HistogramParams HistogramParams::ForModular(
     params.uint_method = HistogramParams::HybridUintMethod::k000;
     params.force_huffman = true;
   }
+  if (cparams.decoder_fast_paths) {
+    // Fewer clusters keep the decoding tables in cache, and without LZ77 the
+    // decoder reads the tokens of a whole row at once.
+    params.max_histograms = std::min<size_t>(params.max_histograms, 8);
+    params.lz77_method = HistogramParams::LZ77Method::kNone;
+  }
+  if (ApplyOverride(cparams.static_entropy_codes, false)) {
+    params.static_codes = HistogramParams::StaticCodes::kModular;
+  }
+  params.sample_streams = cparams.sampled_histograms && !streaming_mode;
+  if (cparams.speed_tier <= SpeedTier::kGlacier) {
+    params.lz77_max_chain_length = 1024;
+    params.lz77_nice_length = 4096;
+  } else if (cparams.speed_tier > SpeedTier::kKitten) {
+    params.lz77_max_chain_length = 32;
+    params.lz77_nice_length = 128;
+  }
   return params;
 }
 }  // namespace jxl
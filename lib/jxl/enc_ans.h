@@ -20,6 +20,7 @@
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/enc_ans_params.h"
 #include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/enc_cluster.h"
 
 namespace jxl {
 
@@ -117,6 +118,30 @@ StatusOr<size_t> BuildAndEncodeHistograms(
     EntropyEncodingData* codes, std::vector<uint8_t>* context_map,
     BitWriter* writer, LayerType layer, AuxOut* aux_out);
 
+// Whether the tokens of stream `index` out of `num_streams` are counted in the
+// histograms with HistogramParams::sample_streams: about a quarter of them,
+// spread over the streams, or all of them if there are only a few.
+bool IsSampledStream(size_t index, size_t num_streams);
+
+// Whether BuildAndEncodeHistogramsFromCounts can be used with `params`, i.e.
+// the histograms do not depend on anything but the per-context token counts
+// (no LZ77, default hybrid uint config).
+bool CanBuildHistogramsFromCounts(const HistogramParams& params);
+
+// Adds the symbols of `tokens` to the per-context `histograms`, which must
+// have one entry per context.
+void AddTokensToHistograms(const std::vector<Token>& tokens,
+                           std::vector<Histogram>* histograms);
+
+// Same as BuildAndEncodeHistograms, but from the histograms gathered with
+// AddTokensToHistograms, so that the tokens do not need to be kept in memory
+// until they are written.
+StatusOr<size_t> BuildAndEncodeHistogramsFromCounts(
+    JxlMemoryManager* memory_manager, const HistogramParams& params,
+    std::vector<Histogram> histograms, EntropyEncodingData* codes,
+    std::vector<uint8_t>* context_map, BitWriter* writer, LayerType layer,
+    AuxOut* aux_out);
+
 // Write the tokens to a string.
 Status WriteTokens(const std::vector<Token>& tokens,
                    const EntropyEncodingData& codes,
@@ -19,6 +19,7 @@ namespace jxl {
 
 // Forward declaration to break include cycle.
 struct CompressParams;
+class ThreadPool;
 
 // RebalanceHistogram requires a signed type.
 using ANSHistBin = int32_t;
@@ -51,6 +52,12 @@ struct HistogramParams {
     kPrecise,      // Try all methods.
   };
 
+  enum class StaticCodes {
+    kNone,     // build histograms from the tokens.
+    kVarDCT,   // built-in code for VarDCT AC coefficients.
+    kModular,  // built-in code for modular residuals.
+  };
+
   HistogramParams() = default;
 
   HistogramParams(SpeedTier tier, size_t num_ctx) {
@@ -65,7 +72,9 @@ struct HistogramParams {
     if (tier > SpeedTier::kTortoise) {
       uint_method = HybridUintMethod::kNone;
     }
-    if (tier >= SpeedTier::kSquirrel) {
+    if (tier > SpeedTier::kThunder) {
+      ans_histogram_strategy = ANSHistogramStrategy::kFast;
+    } else if (tier >= SpeedTier::kSquirrel) {
       ans_histogram_strategy = ANSHistogramStrategy::kApproximate;
     }
   }
@@ -77,14 +86,32 @@ struct HistogramParams {
   ClusteringType clustering = ClusteringType::kBest;
   HybridUintMethod uint_method = HybridUintMethod::kBest;
   LZ77Method lz77_method = LZ77Method::kRLE;
+  // Hash chain search of kLZ77 and kOptimal: the number of candidates tried
+  // at each position, and the match length that ends the search. The
+  // optimal parse does not try matches inside the repetitions longer than
+  // this, except close to their end.
+  uint32_t lz77_max_chain_length = 256;
+  uint32_t lz77_nice_length = 256;
   ANSHistogramStrategy ans_histogram_strategy = ANSHistogramStrategy::kPrecise;
+  StaticCodes static_codes = StaticCodes::kNone;
   std::vector<size_t> image_widths;
   size_t max_histograms = ~0;
   bool force_huffman = false;
   bool initialize_global_state = true;
   bool streaming_mode = false;
   bool add_missing_symbols = false;
+  // If set, the histograms are estimated from the tokens of a subset of the
+  // streams (see IsSampledStream), and all the symbols are added to them so
+  // that the other streams can still be written.
+  bool sample_streams = false;
   bool add_fixed_histograms = false;
+  // If not null and its contexts match, the clustering of the histograms is
+  // taken from this context map instead of being searched, e.g. from the
+  // previous frame of an animation.
+  const std::vector<uint8_t>* initial_context_map = nullptr;
+  // Used for clustering the histograms, if not null. The result does not
+  // depend on it.
+  ThreadPool* pool = nullptr;
 };
 
 }  // namespace jxl
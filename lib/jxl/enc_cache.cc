@@ -7,6 +7,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 
 #include "lib/jxl/base/common.h"
@@ -33,6 +34,36 @@
 
 namespace jxl {
 
+Status InitDCTCache(size_t xsize_blocks, size_t ysize_blocks,
+                    PassesEncoderState* enc_state) {
+  JXL_ASSIGN_OR_RETURN(
+      enc_state->dct_cache,
+      Image3F::Create(enc_state->memory_manager(),
+                      xsize_blocks * kDCTBlockSize, ysize_blocks));
+  return true;
+}
+
+void StoreCachedCoefficients(const AcStrategy& acs, size_t bx, size_t by,
+                             size_t c, const float* JXL_RESTRICT coeffs,
+                             Image3F* JXL_RESTRICT dct_cache) {
+  const size_t row_size = acs.covered_blocks_x() * kDCTBlockSize;
+  for (size_t iy = 0; iy < acs.covered_blocks_y(); iy++) {
+    memcpy(dct_cache->PlaneRow(c, by + iy) + bx * kDCTBlockSize,
+           coeffs + iy * row_size, row_size * sizeof(float));
+  }
+}
+
+void LoadCachedCoefficients(const Image3F& dct_cache, const AcStrategy& acs,
+                            size_t bx, size_t by, size_t c,
+                            float* JXL_RESTRICT coeffs) {
+  const size_t row_size = acs.covered_blocks_x() * kDCTBlockSize;
+  for (size_t iy = 0; iy < acs.covered_blocks_y(); iy++) {
+    memcpy(coeffs + iy * row_size,
+           dct_cache.ConstPlaneRow(c, by + iy) + bx * kDCTBlockSize,
+           row_size * sizeof(float));
+  }
+}
+
 Status ComputeACMetadata(ThreadPool* pool, PassesEncoderState* enc_state,
                          ModularFrameEncoder* modular_frame_encoder) {
   PassesSharedState& shared = enc_state->shared;
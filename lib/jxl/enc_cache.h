@@ -14,12 +14,15 @@
 #include <memory>
 #include <vector>
 
+#include "lib/jxl/ac_strategy.h"
+#include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/dct_util.h"
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/enc_cluster.h"
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/enc_progressive_split.h"
 #include "lib/jxl/frame_header.h"
@@ -53,8 +56,15 @@ struct PassesEncoderState {
 
   CompressParams cparams;
 
+  // If true, the AC tokens of all the groups are not kept in memory at once:
+  // only their histograms are gathered when tokenizing, and each group is
+  // tokenized again right before being written.
+  bool two_pass_ac_tokens = false;
+
   struct PassData {
     std::vector<std::vector<Token>> ac_tokens;
+    // Histograms of ac_tokens, with two_pass_ac_tokens.
+    std::vector<Histogram> ac_histograms;
     std::vector<uint8_t> context_map;
     EntropyEncodingData codes;
   };
@@ -73,9 +83,32 @@ struct PassesEncoderState {
 
   ImageF initial_quant_masking1x1;
 
+  // Forward DCT coefficients of the varblocks, kept by the CfL heuristics so
+  // that ComputeCoefficients does not transform the blocks again, or empty.
+  // See StoreCachedCoefficients for the layout.
+  Image3F dct_cache;
+
+  // One GroupContent per group of the frame, or empty if the frame was not
+  // classified. See enc_content_classifier.h.
+  ImageB group_content;
+
   JxlMemoryManager* memory_manager() const { return shared.memory_manager; }
 };
 
+// Allocates `dct_cache` for frames of `xsize_blocks` x `ysize_blocks` blocks.
+Status InitDCTCache(size_t xsize_blocks, size_t ysize_blocks,
+                    PassesEncoderState* enc_state);
+
+// The coefficients of channel `c` of the varblock `acs` whose first block is
+// (bx, by) are stored in its covered_blocks_y() rows of blocks, in the
+// kDCTBlockSize * covered_blocks_x() values of each row that it covers.
+void StoreCachedCoefficients(const AcStrategy& acs, size_t bx, size_t by,
+                             size_t c, const float* JXL_RESTRICT coeffs,
+                             Image3F* JXL_RESTRICT dct_cache);
+void LoadCachedCoefficients(const Image3F& dct_cache, const AcStrategy& acs,
+                            size_t bx, size_t by, size_t c,
+                            float* JXL_RESTRICT coeffs);
+
 // Initialize per-frame information.
 class ModularFrameEncoder;
 Status InitializePassesEncoder(const FrameHeader& frame_header,
@@ -24,6 +24,7 @@
 #include "lib/jxl/cms/opsin_params.h"
 #include "lib/jxl/dec_transforms-inl.h"
 #include "lib/jxl/enc_aux_out.h"
+#include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/enc_transforms-inl.h"
 #include "lib/jxl/quantizer.h"
@@ -199,7 +200,8 @@ Status ComputeTile(const Image3F& opsin, const Rect& opsin_rect,
                    const AcStrategyImage* ac_strategy,
                    const ImageI* raw_quant_field, const Quantizer* quantizer,
                    const Rect& rect, bool fast, bool use_dct8, ImageSB* map_x,
-                   ImageSB* map_b, ImageF* dc_values, float* mem) {
+                   ImageSB* map_b, ImageF* dc_values, float* mem,
+                   Image3F* dct_cache) {
   static_assert(kEncTileDimInBlocks == kColorTileDimInBlocks,
                 "Invalid color tile dim");
   size_t xsize_blocks = opsin_rect.xsize() / kBlockDim;
@@ -270,6 +272,11 @@ Status ComputeTile(const Image3F& opsin, const Rect& opsin_rect,
       TransformFromPixels(acs.Strategy(), row_b + x * kBlockDim, stride,
                           block_b, scratch_space);
       DCFromLowestFrequencies(acs.Strategy(), block_b, dc_b, xs);
+      if (dct_cache != nullptr) {
+        StoreCachedCoefficients(acs, x, y, 0, block_x, dct_cache);
+        StoreCachedCoefficients(acs, x, y, 1, block_y, dct_cache);
+        StoreCachedCoefficients(acs, x, y, 2, block_b, dct_cache);
+      }
       const float* const JXL_RESTRICT qm_x =
           dequant.InvMatrix(acs.Strategy(), 0);
       const float* const JXL_RESTRICT qm_b =
@@ -368,12 +375,14 @@ Status CfLHeuristics::ComputeTile(const Rect& r, const Image3F& opsin,
                                   const AcStrategyImage* ac_strategy,
                                   const ImageI* raw_quant_field,
                                   const Quantizer* quantizer, bool fast,
-                                  size_t thread, ColorCorrelationMap* cmap) {
+                                  size_t thread, ColorCorrelationMap* cmap,
+                                  Image3F* dct_cache) {
   bool use_dct8 = ac_strategy == nullptr;
+  JXL_ENSURE(!use_dct8 || dct_cache == nullptr);
   return HWY_DYNAMIC_DISPATCH(ComputeTile)(
       opsin, opsin_rect, dequant, ac_strategy, raw_quant_field, quantizer, r,
       fast, use_dct8, &cmap->ytox_map, &cmap->ytob_map, &dc_values,
-      mem.get() + thread * ItemsPerThread());
+      mem.get() + thread * ItemsPerThread(), dct_cache);
 }
 
 Status ColorCorrelationEncodeDC(const ColorCorrelation& color_correlation,
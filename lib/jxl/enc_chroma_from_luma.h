@@ -41,11 +41,15 @@ struct CfLHeuristics {
     mem = hwy::AllocateAligned<float>(num_threads * ItemsPerThread());
   }
 
+  // If `dct_cache` is not null, stores in it the coefficients of the
+  // varblocks of `ac_strategy` that start in the tile, see
+  // StoreCachedCoefficients.
   Status ComputeTile(const Rect& r, const Image3F& opsin,
                      const Rect& opsin_rect, const DequantMatrices& dequant,
                      const AcStrategyImage* ac_strategy,
                      const ImageI* raw_quant_field, const Quantizer* quantizer,
-                     bool fast, size_t thread, ColorCorrelationMap* cmap);
+                     bool fast, size_t thread, ColorCorrelationMap* cmap,
+                     Image3F* dct_cache = nullptr);
 
   ImageF dc_values;
   hwy::AlignedFreeUniquePtr<float[]> mem;
@@ -13,6 +13,7 @@
 #include <queue>
 #include <tuple>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 
 #undef HWY_TARGET_INCLUDE
@@ -22,6 +23,7 @@
 
 #include "lib/jxl/base/fast_math-inl.h"
 #include "lib/jxl/enc_ans.h"
+#include "lib/jxl/trace_internal.h"
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
@@ -111,9 +113,30 @@ float HistogramKLDivergence(const Histogram& actual, const Histogram& coding) {
   return total_cost - actual.entropy_;
 }
 
+// Number of histograms processed by each task of the parallel loops.
+constexpr size_t kHistogramsPerTask = 32;
+
+// Runs `func(i)` for `i` in [0, num) on the pool, in tasks of
+// kHistogramsPerTask.
+template <typename Func>
+Status RunOnHistograms(ThreadPool* pool, size_t num, const Func& func,
+                       const char* caller) {
+  const auto process_task = [&](const uint32_t task,
+                                size_t /* thread */) -> Status {
+    const size_t end = std::min(num, (task + 1) * kHistogramsPerTask);
+    for (size_t i = task * kHistogramsPerTask; i < end; i++) {
+      JXL_RETURN_IF_ERROR(func(i));
+    }
+    return true;
+  };
+  return RunOnPool(pool, 0, DivCeil(num, kHistogramsPerTask),
+                   ThreadPool::NoInit, process_task, caller);
+}
+
 // First step of a k-means clustering with a fancy distance metric.
 Status FastClusterHistograms(const std::vector<Histogram>& in,
-                             size_t max_histograms, std::vector<Histogram>* out,
+                             size_t max_histograms, ThreadPool* pool,
+                             std::vector<Histogram>* out,
                              std::vector<uint32_t>* histogram_symbols) {
   const size_t prev_histograms = out->size();
   out->reserve(max_histograms);
@@ -121,6 +144,13 @@ Status FastClusterHistograms(const std::vector<Histogram>& in,
   histogram_symbols->resize(in.size(), max_histograms);
 
   std::vector<float> dists(in.size(), std::numeric_limits<float>::max());
+  JXL_RETURN_IF_ERROR(RunOnHistograms(
+      pool, in.size(),
+      [&](size_t i) -> Status {
+        if (in[i].total_count_ != 0) HistogramEntropy(in[i]);
+        return true;
+      },
+      "HistogramEntropy"));
   size_t largest_idx = 0;
   for (size_t i = 0; i < in.size(); i++) {
     if (in[i].total_count_ == 0) {
@@ -128,7 +158,6 @@ Status FastClusterHistograms(const std::vector<Histogram>& in,
       dists[i] = 0.0f;
       continue;
     }
-    HistogramEntropy(in[i]);
     if (in[i].total_count_ > in[largest_idx].total_count_) {
       largest_idx = i;
     }
@@ -138,12 +167,17 @@ Status FastClusterHistograms(const std::vector<Histogram>& in,
     for (size_t j = 0; j < prev_histograms; ++j) {
       HistogramEntropy((*out)[j]);
     }
-    for (size_t i = 0; i < in.size(); i++) {
-      if (dists[i] == 0.0f) continue;
-      for (size_t j = 0; j < prev_histograms; ++j) {
-        dists[i] = std::min(HistogramKLDivergence(in[i], (*out)[j]), dists[i]);
-      }
-    }
+    JXL_RETURN_IF_ERROR(RunOnHistograms(
+        pool, in.size(),
+        [&](size_t i) -> Status {
+          if (dists[i] == 0.0f) return true;
+          for (size_t j = 0; j < prev_histograms; ++j) {
+            dists[i] =
+                std::min(HistogramKLDivergence(in[i], (*out)[j]), dists[i]);
+          }
+          return true;
+        },
+        "HistogramKLDivergence"));
     auto max_dist = std::max_element(dists.begin(), dists.end());
     if (*max_dist > 0.0f) {
       largest_idx = max_dist - dists.begin();
@@ -155,10 +189,16 @@ Status FastClusterHistograms(const std::vector<Histogram>& in,
     (*histogram_symbols)[largest_idx] = out->size();
     out->push_back(in[largest_idx]);
     dists[largest_idx] = 0.0f;
+    JXL_RETURN_IF_ERROR(RunOnHistograms(
+        pool, in.size(),
+        [&](size_t i) -> Status {
+          if (dists[i] == 0.0f) return true;
+          dists[i] = std::min(HistogramDistance(in[i], out->back()), dists[i]);
+          return true;
+        },
+        "HistogramDistance"));
     largest_idx = 0;
     for (size_t i = 0; i < in.size(); i++) {
-      if (dists[i] == 0.0f) continue;
-      dists[i] = std::min(HistogramDistance(in[i], out->back()), dists[i]);
       if (dists[i] > dists[largest_idx]) largest_idx = i;
     }
     if (dists[largest_idx] < kMinDistanceForDistinct) break;
@@ -241,6 +281,7 @@ Status ClusterHistograms(const HistogramParams& params,
                          const std::vector<Histogram>& in,
                          size_t max_histograms, std::vector<Histogram>* out,
                          std::vector<uint32_t>* histogram_symbols) {
+  JXL_TRACE_SCOPE("ClusterHistograms");
   size_t prev_histograms = out->size();
   max_histograms = std::min(max_histograms, params.max_histograms);
   max_histograms = std::min(max_histograms, in.size());
@@ -248,16 +289,33 @@ Status ClusterHistograms(const HistogramParams& params,
     max_histograms = std::min(max_histograms, static_cast<size_t>(4));
   }
 
+  ThreadPool* pool = params.pool;
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(FastClusterHistograms)(
-      in, prev_histograms + max_histograms, out, histogram_symbols));
+      in, prev_histograms + max_histograms, pool, out, histogram_symbols));
 
   if (prev_histograms == 0 &&
       params.clustering == HistogramParams::ClusteringType::kBest) {
-    for (auto& histo : *out) {
+    const size_t num = out->size();
+    const auto compute_entropy = [&](const uint32_t i,
+                                     size_t /* thread */) -> Status {
+      Histogram& histo = (*out)[i];
       JXL_ASSIGN_OR_RETURN(
           histo.entropy_,
           ANSPopulationCost(histo.data_.data(), histo.data_.size()));
-    }
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num, ThreadPool::NoInit,
+                                  compute_entropy, "HistogramEntropy"));
+    // Change of the total cost if clusters `i` and `j` are merged.
+    const auto merge_cost = [&](uint32_t i, uint32_t j, float* cost) -> Status {
+      Histogram histo;
+      histo.AddHistogram((*out)[i]);
+      histo.AddHistogram((*out)[j]);
+      JXL_ASSIGN_OR_RETURN(
+          *cost, ANSPopulationCost(histo.data_.data(), histo.data_.size()));
+      *cost -= (*out)[i].entropy_ + (*out)[j].entropy_;
+      return true;
+    };
     uint32_t next_version = 2;
     std::vector<uint32_t> version(out->size(), 1);
     std::vector<uint32_t> renumbering(out->size());
@@ -280,16 +338,22 @@ Status ClusterHistograms(const HistogramParams& params,
       }
     };
 
-    // Create list of all pairs by increasing merging cost.
+    // Create list of all pairs by increasing merging cost. The costs are
+    // computed in parallel, and enqueued in the same order as serially.
+    std::vector<float> costs(num * num);
+    const auto compute_row_costs = [&](const uint32_t i,
+                                       size_t /* thread */) -> Status {
+      for (uint32_t j = i + 1; j < num; j++) {
+        JXL_RETURN_IF_ERROR(merge_cost(i, j, &costs[i * num + j]));
+      }
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num, ThreadPool::NoInit,
+                                  compute_row_costs, "HistogramMergeCosts"));
     std::priority_queue<HistogramPair> pairs_to_merge;
-    for (uint32_t i = 0; i < out->size(); i++) {
-      for (uint32_t j = i + 1; j < out->size(); j++) {
-        Histogram histo;
-        histo.AddHistogram((*out)[i]);
-        histo.AddHistogram((*out)[j]);
-        JXL_ASSIGN_OR_RETURN(float cost, ANSPopulationCost(histo.data_.data(),
-                                                           histo.data_.size()));
-        cost -= (*out)[i].entropy_ + (*out)[j].entropy_;
+    for (uint32_t i = 0; i < num; i++) {
+      for (uint32_t j = i + 1; j < num; j++) {
+        float cost = costs[i * num + j];
         // Avoid enqueueing pairs that are not advantageous to merge.
         if (cost >= 0) continue;
         pairs_to_merge.push(
@@ -320,15 +384,17 @@ Status ClusterHistograms(const HistogramParams& params,
       }
       version[second] = 0;
       version[first] = next_version++;
-      for (uint32_t j = 0; j < out->size(); j++) {
+      const auto compute_costs = [&](const uint32_t j,
+                                     size_t /* thread */) -> Status {
+        if (j == first || version[j] == 0) return true;
+        return merge_cost(first, j, &costs[j]);
+      };
+      JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num, ThreadPool::NoInit,
+                                    compute_costs, "HistogramMergeCosts"));
+      for (uint32_t j = 0; j < num; j++) {
         if (j == first) continue;
         if (version[j] == 0) continue;
-        Histogram histo;
-        histo.AddHistogram((*out)[first]);
-        histo.AddHistogram((*out)[j]);
-        JXL_ASSIGN_OR_RETURN(float cost, ANSPopulationCost(histo.data_.data(),
-                                                           histo.data_.size()));
-        cost -= (*out)[first].entropy_ + (*out)[j].entropy_;
+        float cost = costs[j];
         // Avoid enqueueing pairs that are not advantageous to merge.
         if (cost >= 0) continue;
         pairs_to_merge.push(
@@ -0,0 +1,83 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/enc_content_classifier.h"
+
+#include <jxl/memory_manager.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/frame_dimensions.h"
+#include "lib/jxl/image.h"
+
+namespace jxl {
+
+namespace {
+
+// Only every kRowStep-th row of a group is looked at.
+constexpr size_t kRowStep = 4;
+// Pixels that differ from their left neighbour by less than this in all
+// channels count as repeated; this matches the patch search.
+constexpr float kSameThreshold = 1e-4f;
+// Groups whose mean absolute horizontal difference of the Y channel is below
+// this are flat.
+constexpr float kFlatMeanDiff = 2e-3f;
+// Groups with more than this share of repeated pixels are screen content.
+constexpr float kScreenSameFraction = 0.5f;
+
+GroupContent ClassifyRect(const Image3F& opsin, const Rect& rect) {
+  size_t num = 0;
+  size_t num_same = 0;
+  double sum_diff = 0;
+  for (size_t y = 0; y < rect.ysize(); y += kRowStep) {
+    const float* JXL_RESTRICT row_x = rect.ConstPlaneRow(opsin, 0, y);
+    const float* JXL_RESTRICT row_y = rect.ConstPlaneRow(opsin, 1, y);
+    const float* JXL_RESTRICT row_b = rect.ConstPlaneRow(opsin, 2, y);
+    for (size_t x = 1; x < rect.xsize(); x++) {
+      const float diff_y = std::abs(row_y[x] - row_y[x - 1]);
+      num_same += diff_y < kSameThreshold &&
+                  std::abs(row_x[x] - row_x[x - 1]) < kSameThreshold &&
+                  std::abs(row_b[x] - row_b[x - 1]) < kSameThreshold;
+      sum_diff += diff_y;
+    }
+    num += rect.xsize() - 1;
+  }
+  if (num == 0) return GroupContent::kFlat;
+  if (sum_diff < kFlatMeanDiff * num) return GroupContent::kFlat;
+  if (num_same > kScreenSameFraction * num) return GroupContent::kScreen;
+  return GroupContent::kPhoto;
+}
+
+}  // namespace
+
+StatusOr<ImageB> ClassifyGroupContent(const Image3F& opsin, const Rect& rect,
+                                      const FrameDimensions& frame_dim,
+                                      ThreadPool* pool) {
+  JxlMemoryManager* memory_manager = opsin.memory_manager();
+  JXL_ASSIGN_OR_RETURN(ImageB content,
+                       ImageB::Create(memory_manager, frame_dim.xsize_groups,
+                                      frame_dim.ysize_groups));
+  const auto classify_group = [&](const uint32_t group_index,
+                                  size_t /* thread */) -> Status {
+    const Rect group_rect = frame_dim.GroupRect(group_index);
+    const Rect r(rect.x0() + group_rect.x0(), rect.y0() + group_rect.y0(),
+                 group_rect.xsize(), group_rect.ysize());
+    const size_t gx = group_index % frame_dim.xsize_groups;
+    const size_t gy = group_index / frame_dim.xsize_groups;
+    content.Row(gy)[gx] = static_cast<uint8_t>(ClassifyRect(opsin, r));
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, frame_dim.num_groups,
+                                ThreadPool::NoInit, classify_group,
+                                "ClassifyGroupContent"));
+  return content;
+}
+
+}  // namespace jxl
@@ -0,0 +1,41 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_ENC_CONTENT_CLASSIFIER_H_
+#define LIB_JXL_ENC_CONTENT_CLASSIFIER_H_
+
+// Fast per-group classification of the content of a frame, used to skip the
+// encoder searches that cannot help on some kinds of content.
+
+#include <cstdint>
+
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/frame_dimensions.h"
+#include "lib/jxl/image.h"
+
+namespace jxl {
+
+enum class GroupContent : uint8_t {
+  // Natural images: noise, gradients and textures.
+  kPhoto = 0,
+  // Text, user interfaces and other synthetic content, with many runs of
+  // exactly repeated pixels.
+  kScreen = 1,
+  // Almost constant areas.
+  kFlat = 2,
+};
+
+// Returns an image with one GroupContent value per group of `frame_dim`,
+// computed from the pixels of `opsin` within `rect`. Only a subset of the
+// rows of each group is looked at.
+StatusOr<ImageB> ClassifyGroupContent(const Image3F& opsin, const Rect& rect,
+                                      const FrameDimensions& frame_dim,
+                                      ThreadPool* pool);
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_ENC_CONTENT_CLASSIFIER_H_
@@ -12,6 +12,8 @@
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <iterator>
 #include <utility>
 #include <vector>
 
@@ -27,6 +29,7 @@
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/convolve.h"
+#include "lib/jxl/enc_content_classifier.h"
 #include "lib/jxl/enc_linalg.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_ops.h"
@@ -42,6 +45,8 @@ namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::Gt;
+using hwy::HWY_NAMESPACE::LoadU;
 using hwy::HWY_NAMESPACE::Mul;
 using hwy::HWY_NAMESPACE::Sub;
 
@@ -84,6 +89,22 @@ StatusOr<ImageF> SumOfSquareDifferences(const Image3F& forig,
   return sum_of_squares;
 }
 
+// Returns the first position in [x, xsize) where `row` is above `threshold`,
+// or xsize if there is none.
+size_t FindAboveThreshold(const float* JXL_RESTRICT row, size_t x,
+                          const size_t xsize, const float threshold) {
+  const HWY_FULL(float) d;
+  const auto vthreshold = Set(d, threshold);
+  for (; x + Lanes(d) <= xsize; x += Lanes(d)) {
+    const intptr_t first = FindFirstTrue(d, Gt(LoadU(d, row + x), vthreshold));
+    if (first >= 0) return x + first;
+  }
+  for (; x < xsize; ++x) {
+    if (row[x] > threshold) return x;
+  }
+  return xsize;
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
@@ -92,6 +113,7 @@ HWY_AFTER_NAMESPACE();
 #if HWY_ONCE
 namespace jxl {
 HWY_EXPORT(SumOfSquareDifferences);  // Local function
+HWY_EXPORT(FindAboveThreshold);      // Local function
 
 const int kEllipseWindowSize = 5;
 
@@ -186,11 +208,16 @@ Pixel operator+(const Pixel& a, const Pixel& b) {
 const size_t kMaxCCSize = 1000;
 
 // Extracts a connected component from a Binary image where seed is part
-// of the component
-bool ExtractComponent(const Rect& rect, ImageF* img, std::vector<Pixel>* pixels,
-                      const Pixel& seed, double threshold) {
+// of the component. `img` holds the rows [window.y0(), window.y1()) of an
+// image of `ysize` rows. Returns false if the component is larger than
+// kMaxCCSize or continues outside of the window, which is then only known to
+// be taller than the margin of the window.
+bool ExtractComponent(const Rect& window, size_t ysize, ImageF* img,
+                      std::vector<Pixel>* pixels, const Pixel& seed,
+                      double threshold) {
   static const std::vector<Pixel> neighbors{{1, -1}, {1, 0},   {1, 1},  {0, -1},
-                                            {0, 1},  {-1, -1}, {-1, 1}, {1, 0}};
+                                            {0, 1},  {-1, -1}, {-1, 1}, {-1, 0}};
+  bool truncated = false;
   std::vector<Pixel> q{seed};
   while (!q.empty()) {
     Pixel current = q.back();
@@ -199,17 +226,23 @@ bool ExtractComponent(const Rect& rect, ImageF* img, std::vector<Pixel>* pixels,
     if (pixels->size() > kMaxCCSize) return false;
     for (const Pixel& delta : neighbors) {
       Pixel child = current + delta;
-      if (child.x >= 0 && static_cast<size_t>(child.x) < rect.xsize() &&
-          child.y >= 0 && static_cast<size_t>(child.y) < rect.ysize()) {
-        float* value = &rect.Row(img, child.y)[child.x];
-        if (*value > threshold) {
-          *value = 0.0;
-          q.push_back(child);
-        }
+      if (child.x < 0 || static_cast<size_t>(child.x) >= window.xsize() ||
+          child.y < 0 || static_cast<size_t>(child.y) >= ysize) {
+        continue;
+      }
+      if (static_cast<size_t>(child.y) < window.y0() ||
+          static_cast<size_t>(child.y) >= window.y1()) {
+        truncated = true;
+        continue;
+      }
+      float* value = &img->Row(child.y - window.y0())[child.x];
+      if (*value > threshold) {
+        *value = 0.0;
+        q.push_back(child);
       }
     }
   }
-  return true;
+  return !truncated;
 }
 
 inline bool PointInRect(const Rect& r, const Pixel& p) {
@@ -292,27 +325,75 @@ Rect BoundingRectangle(const std::vector<Pixel>& pixels) {
   return Rect(low_x, low_y, high_x - low_x + 1, high_y - low_y + 1);
 }
 
+// Rows of the stripes searched in parallel by FindCC.
+constexpr size_t kStripeRows = 256;
+
+// Finds the connected components in stripes of rows, each in a copy of its
+// rows and `maxWindow` rows above and below. A component belongs to the
+// stripe where the raster scan first reaches one of its pixels above t_high,
+// and is the same as in a single scan of the whole image, unless it is too
+// large to be kept anyway.
 StatusOr<std::vector<ConnectedComponent>> FindCC(const ImageF& energy,
                                                  const Rect& rect, double t_low,
                                                  double t_high,
                                                  uint32_t maxWindow,
-                                                 double minScore) {
+                                                 double minScore,
+                                                 ThreadPool* pool) {
   const int kExtraRect = 4;
   JxlMemoryManager* memory_manager = energy.memory_manager();
-  JXL_ASSIGN_OR_RETURN(
-      ImageF img,
-      ImageF::Create(memory_manager, energy.xsize(), energy.ysize()));
-  JXL_RETURN_IF_ERROR(CopyImageTo(energy, &img));
-  std::vector<ConnectedComponent> ans;
-  for (size_t y = 0; y < rect.ysize(); y++) {
-    float* JXL_RESTRICT row = rect.Row(&img, y);
-    for (size_t x = 0; x < rect.xsize(); x++) {
-      if (row[x] > t_high) {
+  const size_t num_stripes = DivCeil(rect.ysize(), kStripeRows);
+  // The largest float that is not above t_high, so that comparing floats to
+  // it gives the same result as comparing them to t_high.
+  float t_high_float = static_cast<float>(t_high);
+  if (t_high_float > t_high) {
+    t_high_float = std::nextafter(t_high_float, -INFINITY);
+  }
+  const auto find_above_threshold = HWY_DYNAMIC_DISPATCH(FindAboveThreshold);
+  std::vector<ImageF> windows;
+  std::vector<std::vector<ConnectedComponent>> stripe_ccs(num_stripes);
+  const auto init = [&](const size_t num_threads) -> Status {
+    windows.clear();
+    for (size_t i = 0; i < num_threads; ++i) {
+      JXL_ASSIGN_OR_RETURN(
+          ImageF window,
+          ImageF::Create(memory_manager, rect.xsize(),
+                         std::min<size_t>(rect.ysize(),
+                                          kStripeRows + 2 * maxWindow)));
+      windows.emplace_back(std::move(window));
+    }
+    return true;
+  };
+  const auto process_stripe = [&](const uint32_t stripe,
+                                  const size_t thread) -> Status {
+    const size_t y0 = stripe * kStripeRows;
+    const size_t y1 = std::min(y0 + kStripeRows, rect.ysize());
+    const size_t wy0 = y0 - std::min<size_t>(y0, maxWindow);
+    const size_t wy1 = std::min<size_t>(y1 + maxWindow, rect.ysize());
+    const Rect window(0, wy0, rect.xsize(), wy1 - wy0);
+    ImageF& img = windows[thread];
+    for (size_t y = wy0; y < wy1; ++y) {
+      memcpy(img.Row(y - wy0), rect.ConstRow(energy, y),
+             rect.xsize() * sizeof(float));
+    }
+    std::vector<ConnectedComponent>& ans = stripe_ccs[stripe];
+    for (size_t y = y0; y < y1; y++) {
+      float* JXL_RESTRICT row = img.Row(y - wy0);
+      for (size_t x = find_above_threshold(row, 0, rect.xsize(), t_high_float);
+           x < rect.xsize();
+           x = find_above_threshold(row, x + 1, rect.xsize(), t_high_float)) {
         std::vector<Pixel> pixels;
         row[x] = 0.0;
         Pixel seed = Pixel{static_cast<int>(x), static_cast<int>(y)};
-        bool success = ExtractComponent(rect, &img, &pixels, seed, t_low);
+        bool success =
+            ExtractComponent(window, rect.ysize(), &img, &pixels, seed, t_low);
         if (!success) continue;
+        // Left to the stripe above, which reached the component first.
+        if (std::any_of(pixels.begin(), pixels.end(), [&](const Pixel& p) {
+              return static_cast<size_t>(p.y) < y0 &&
+                     rect.ConstRow(energy, p.y)[p.x] > t_high;
+            })) {
+          continue;
+        }
 #if JXL_DEBUG_DOT_DETECT
         for (size_t i = 0; i < pixels.size(); i++) {
           fprintf(stderr, "(%d,%d) ", pixels[i].x, pixels[i].y);
@@ -334,6 +415,13 @@ StatusOr<std::vector<ConnectedComponent>> FindCC(const ImageF& energy,
         }
       }
     }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(
+      RunOnPool(pool, 0, num_stripes, init, process_stripe, "FindCC"));
+  std::vector<ConnectedComponent> ans;
+  for (auto& ccs : stripe_ccs) {
+    std::move(ccs.begin(), ccs.end(), std::back_inserter(ans));
   }
   return ans;
 }
@@ -549,16 +637,31 @@ StatusOr<GaussianEllipse> FitGaussian(const ConnectedComponent& cc,
 
 StatusOr<std::vector<PatchInfo>> DetectGaussianEllipses(
     const Image3F& opsin, const Rect& rect, const GaussianDetectParams& params,
-    const EllipseQuantParams& qParams, ThreadPool* pool) {
+    const EllipseQuantParams& qParams, ThreadPool* pool,
+    const ImageB* group_content, size_t group_dim) {
   JxlMemoryManager* memory_manager = opsin.memory_manager();
   std::vector<PatchInfo> dots;
   JXL_ASSIGN_OR_RETURN(
       Image3F smooth,
       Image3F::Create(memory_manager, opsin.xsize(), opsin.ysize()));
   JXL_ASSIGN_OR_RETURN(ImageF energy, ComputeEnergyImage(opsin, &smooth, pool));
+  if (group_content != nullptr && group_content->xsize() > 0) {
+    JXL_ENSURE(group_dim > 0);
+    for (size_t y = 0; y < rect.ysize(); y++) {
+      const uint8_t* JXL_RESTRICT content_row =
+          group_content->ConstRow(y / group_dim);
+      float* JXL_RESTRICT energy_row = rect.Row(&energy, y);
+      for (size_t x = 0; x < rect.xsize(); x++) {
+        if (content_row[x / group_dim] ==
+            static_cast<uint8_t>(GroupContent::kScreen)) {
+          energy_row[x] = 0.0f;
+        }
+      }
+    }
+  }
   JXL_ASSIGN_OR_RETURN(std::vector<ConnectedComponent> components,
                        FindCC(energy, rect, params.t_low, params.t_high,
-                              params.maxWinSize, params.minScore));
+                              params.maxWinSize, params.minScore, pool));
   size_t numCC =
       std::min(params.maxCC, (components.size() * params.percCC) / 100);
   if (components.size() > numCC) {
@@ -569,9 +672,18 @@ StatusOr<std::vector<PatchInfo>> DetectGaussianEllipses(
         });
     components.erase(components.begin() + numCC, components.end());
   }
-  for (const auto& cc : components) {
-    JXL_ASSIGN_OR_RETURN(GaussianEllipse ellipse,
-                         FitGaussian(cc, rect, opsin, smooth));
+  std::vector<GaussianEllipse> ellipses(components.size());
+  const auto fit_component = [&](const uint32_t i,
+                                 const size_t /* thread */) -> Status {
+    JXL_ASSIGN_OR_RETURN(ellipses[i],
+                         FitGaussian(components[i], rect, opsin, smooth));
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, components.size(), ThreadPool::NoInit,
+                                fit_component, "FitGaussian"));
+  for (size_t i = 0; i < components.size(); ++i) {
+    const ConnectedComponent& cc = components[i];
+    const GaussianEllipse& ellipse = ellipses[i];
     if (ellipse.x < 0.0 ||
         std::ceil(ellipse.x) >= static_cast<double>(rect.xsize()) ||
         ellipse.y < 0.0 ||
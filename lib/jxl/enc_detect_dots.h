@@ -57,10 +57,13 @@ struct EllipseQuantParams {
   void QuantPositionSize(size_t* xsize, size_t* ysize) const;
 };
 
-// Detects dots in XYB image.
+// Detects dots in XYB image. If `group_content` is not null, it holds the
+// GroupContent of each `group_dim` sized group of `rect`, and no dots are
+// searched in screen content groups.
 StatusOr<std::vector<PatchInfo>> DetectGaussianEllipses(
     const Image3F& opsin, const Rect& rect, const GaussianDetectParams& params,
-    const EllipseQuantParams& qParams, ThreadPool* pool);
+    const EllipseQuantParams& qParams, ThreadPool* pool,
+    const ImageB* group_content = nullptr, size_t group_dim = 0);
 
 }  // namespace jxl
 
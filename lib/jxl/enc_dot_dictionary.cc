@@ -36,7 +36,8 @@ const std::array<size_t, 3> kEllipseIntensityQ{{10, 36, 10}};
 
 StatusOr<std::vector<PatchInfo>> FindDotDictionary(
     const CompressParams& cparams, const Image3F& opsin, const Rect& rect,
-    const ColorCorrelation& color_correlation, ThreadPool* pool) {
+    const ColorCorrelation& color_correlation, ThreadPool* pool,
+    const ImageB* group_content, size_t group_dim) {
   if (ApplyOverride(cparams.dots,
                     cparams.butteraugli_distance >= kMinButteraugliForDots)) {
     GaussianDetectParams ellipse_params;
@@ -65,7 +66,8 @@ StatusOr<std::vector<PatchInfo>> FindDotDictionary(
                                color_correlation.YtoXRatio(0),
                                color_correlation.YtoBRatio(0)};
 
-    return DetectGaussianEllipses(opsin, rect, ellipse_params, qParams, pool);
+    return DetectGaussianEllipses(opsin, rect, ellipse_params, qParams, pool,
+                                  group_content, group_dim);
   }
   std::vector<PatchInfo> nothing;
   return nothing;
@@ -21,9 +21,11 @@
 
 namespace jxl {
 
+// `group_content` and `group_dim` are passed on to DetectGaussianEllipses.
 StatusOr<std::vector<PatchInfo>> FindDotDictionary(
     const CompressParams& cparams, const Image3F& opsin, const Rect& rect,
-    const ColorCorrelation& color_correlation, ThreadPool* pool);
+    const ColorCorrelation& color_correlation, ThreadPool* pool,
+    const ImageB* group_content = nullptr, size_t group_dim = 0);
 
 }  // namespace jxl
 
@@ -21,6 +21,7 @@
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/coeff_order.h"
 #include "lib/jxl/coeff_order_fwd.h"
+#include "lib/jxl/common.h"  // kMaxNumPasses
 #include "lib/jxl/entropy_coder.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/pack_signed.h"
@@ -145,36 +146,45 @@ int32_t NumNonZero8x8ExceptDC(const int32_t* JXL_RESTRICT block,
 // context; if this number is above 63, a specific context is used.  If the
 // number of nonzeros of a strategy is above 63, it is written directly using a
 // fixed number of bits (that depends on the size of the strategy).
-Status TokenizeCoefficients(const coeff_order_t* JXL_RESTRICT orders,
+Status TokenizeCoefficients(size_t num_passes,
+                            const coeff_order_t* JXL_RESTRICT const orders[],
                             const Rect& rect,
-                            const int32_t* JXL_RESTRICT* JXL_RESTRICT ac_rows,
+                            const int32_t* JXL_RESTRICT const ac_rows[][3],
                             const AcStrategyImage& ac_strategy,
                             const YCbCrChromaSubsampling& cs,
                             Image3I* JXL_RESTRICT tmp_num_nzeroes,
-                            std::vector<Token>* JXL_RESTRICT output,
+                            std::vector<Token>* JXL_RESTRICT outputs,
                             const ImageB& qdc, const ImageI& qf,
                             const BlockCtxMap& block_ctx_map) {
+  JXL_ENSURE(num_passes > 0 && num_passes <= kMaxNumPasses);
   const size_t xsize_blocks = rect.xsize();
   const size_t ysize_blocks = rect.ysize();
-  output->clear();
-  // TODO(user): update the estimate: usually less coefficients are used.
-  output->reserve(3 * xsize_blocks * ysize_blocks * kDCTBlockSize);
+  for (size_t i = 0; i < num_passes; i++) {
+    outputs[i].clear();
+    // TODO(user): update the estimate: usually less coefficients are used.
+    outputs[i].reserve(3 * xsize_blocks * ysize_blocks * kDCTBlockSize);
+  }
 
+  // The blocks have the same layout in all passes.
   size_t offset[3] = {};
-  const size_t nzeros_stride = tmp_num_nzeroes->PixelsPerRow();
+  const size_t nzeros_stride = tmp_num_nzeroes[0].PixelsPerRow();
+  for (size_t i = 0; i < num_passes; i++) {
+    JXL_ENSURE(static_cast<size_t>(tmp_num_nzeroes[i].PixelsPerRow()) ==
+               nzeros_stride);
+  }
   for (size_t by = 0; by < ysize_blocks; ++by) {
     size_t sby[3] = {by >> cs.VShift(0), by >> cs.VShift(1),
                      by >> cs.VShift(2)};
-    int32_t* JXL_RESTRICT row_nzeros[3] = {
-        tmp_num_nzeroes->PlaneRow(0, sby[0]),
-        tmp_num_nzeroes->PlaneRow(1, sby[1]),
-        tmp_num_nzeroes->PlaneRow(2, sby[2]),
-    };
-    const int32_t* JXL_RESTRICT row_nzeros_top[3] = {
-        sby[0] == 0 ? nullptr : tmp_num_nzeroes->ConstPlaneRow(0, sby[0] - 1),
-        sby[1] == 0 ? nullptr : tmp_num_nzeroes->ConstPlaneRow(1, sby[1] - 1),
-        sby[2] == 0 ? nullptr : tmp_num_nzeroes->ConstPlaneRow(2, sby[2] - 1),
-    };
+    int32_t* JXL_RESTRICT row_nzeros[kMaxNumPasses][3];
+    const int32_t* JXL_RESTRICT row_nzeros_top[kMaxNumPasses][3];
+    for (size_t i = 0; i < num_passes; i++) {
+      for (size_t c = 0; c < 3; c++) {
+        row_nzeros[i][c] = tmp_num_nzeroes[i].PlaneRow(c, sby[c]);
+        row_nzeros_top[i][c] =
+            sby[c] == 0 ? nullptr
+                        : tmp_num_nzeroes[i].ConstPlaneRow(c, sby[c] - 1);
+      }
+    }
     const uint8_t* JXL_RESTRICT row_qdc =
         qdc.ConstRow(rect.y0() + by) + rect.x0();
     const int32_t* JXL_RESTRICT row_qf = rect.ConstRow(qf, by);
@@ -196,42 +206,47 @@ Status TokenizeCoefficients(const coeff_order_t* JXL_RESTRICT orders,
       for (int c : {1, 0, 2}) {
         if (sbx[c] << cs.HShift(c) != bx) continue;
         if (sby[c] << cs.VShift(c) != by) continue;
-        const int32_t* JXL_RESTRICT block = ac_rows[c] + offset[c];
-
-        int32_t nzeros =
-            (covered_blocks == 1)
-                ? NumNonZero8x8ExceptDC(block, row_nzeros[c] + sbx[c])
-                : NumNonZeroExceptLLF(cx, cy, acs, covered_blocks,
-                                      log2_covered_blocks, block, nzeros_stride,
-                                      row_nzeros[c] + sbx[c]);
-
         int ord = kStrategyOrder[acs.RawStrategy()];
-        const coeff_order_t* JXL_RESTRICT order =
-            &orders[CoeffOrderOffset(ord, c)];
-
-        int32_t predicted_nzeros =
-            PredictFromTopAndLeft(row_nzeros_top[c], row_nzeros[c], sbx[c], 32);
+        // The block context only depends on the block, not on the pass.
         size_t block_ctx =
             block_ctx_map.Context(row_qdc[bx], row_qf[sbx[c]], ord, c);
-        const int32_t nzero_ctx =
-            block_ctx_map.NonZeroContext(predicted_nzeros, block_ctx);
-
-        output->emplace_back(nzero_ctx, nzeros);
         const size_t histo_offset =
             block_ctx_map.ZeroDensityContextsOffset(block_ctx);
-        // Skip LLF.
-        size_t prev = (nzeros > static_cast<ssize_t>(size / 16) ? 0 : 1);
-        for (size_t k = covered_blocks; k < size && nzeros != 0; ++k) {
-          int32_t coeff = block[order[k]];
-          size_t ctx =
-              histo_offset + ZeroDensityContext(nzeros, k, covered_blocks,
-                                                log2_covered_blocks, prev);
-          uint32_t u_coeff = PackSigned(coeff);
-          output->emplace_back(ctx, u_coeff);
-          prev = (coeff != 0) ? 1 : 0;
-          nzeros -= prev;
+        for (size_t i = 0; i < num_passes; i++) {
+          const int32_t* JXL_RESTRICT block = ac_rows[i][c] + offset[c];
+          std::vector<Token>* JXL_RESTRICT output = &outputs[i];
+
+          int32_t nzeros =
+              (covered_blocks == 1)
+                  ? NumNonZero8x8ExceptDC(block, row_nzeros[i][c] + sbx[c])
+                  : NumNonZeroExceptLLF(cx, cy, acs, covered_blocks,
+                                        log2_covered_blocks, block,
+                                        nzeros_stride,
+                                        row_nzeros[i][c] + sbx[c]);
+
+          const coeff_order_t* JXL_RESTRICT order =
+              &orders[i][CoeffOrderOffset(ord, c)];
+
+          int32_t predicted_nzeros = PredictFromTopAndLeft(
+              row_nzeros_top[i][c], row_nzeros[i][c], sbx[c], 32);
+          const int32_t nzero_ctx =
+              block_ctx_map.NonZeroContext(predicted_nzeros, block_ctx);
+
+          output->emplace_back(nzero_ctx, nzeros);
+          // Skip LLF.
+          size_t prev = (nzeros > static_cast<ssize_t>(size / 16) ? 0 : 1);
+          for (size_t k = covered_blocks; k < size && nzeros != 0; ++k) {
+            int32_t coeff = block[order[k]];
+            size_t ctx =
+                histo_offset + ZeroDensityContext(nzeros, k, covered_blocks,
+                                                  log2_covered_blocks, prev);
+            uint32_t u_coeff = PackSigned(coeff);
+            output->emplace_back(ctx, u_coeff);
+            prev = (coeff != 0) ? 1 : 0;
+            nzeros -= prev;
+          }
+          JXL_ENSURE(nzeros == 0);
         }
-        JXL_ENSURE(nzeros == 0);
         offset[c] += size;
       }
     }
@@ -247,18 +262,19 @@ HWY_AFTER_NAMESPACE();
 #if HWY_ONCE
 namespace jxl {
 HWY_EXPORT(TokenizeCoefficients);
-Status TokenizeCoefficients(const coeff_order_t* JXL_RESTRICT orders,
+Status TokenizeCoefficients(size_t num_passes,
+                            const coeff_order_t* JXL_RESTRICT const orders[],
                             const Rect& rect,
-                            const int32_t* JXL_RESTRICT* JXL_RESTRICT ac_rows,
+                            const int32_t* JXL_RESTRICT const ac_rows[][3],
                             const AcStrategyImage& ac_strategy,
                             const YCbCrChromaSubsampling& cs,
                             Image3I* JXL_RESTRICT tmp_num_nzeroes,
-                            std::vector<Token>* JXL_RESTRICT output,
+                            std::vector<Token>* JXL_RESTRICT outputs,
                             const ImageB& qdc, const ImageI& qf,
                             const BlockCtxMap& block_ctx_map) {
   return HWY_DYNAMIC_DISPATCH(TokenizeCoefficients)(
-      orders, rect, ac_rows, ac_strategy, cs, tmp_num_nzeroes, output, qdc, qf,
-      block_ctx_map);
+      num_passes, orders, rect, ac_rows, ac_strategy, cs, tmp_num_nzeroes,
+      outputs, qdc, qf, block_ctx_map);
 }
 
 }  // namespace jxl
@@ -8,6 +8,7 @@
 
 #include <sys/types.h>
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -29,14 +30,19 @@ class AcStrategyImage;
 
 // Generate DCT NxN quantized AC values tokens.
 // Only the subset "rect" [in units of blocks] within all images.
+// The passes [0, num_passes) are tokenized in one traversal of the blocks, as
+// they are decoded: pass i has the coefficients ac_rows[i], the coefficient
+// order orders[i] and the scratch image tmp_num_nzeroes[i], and its tokens
+// replace the contents of outputs[i].
 // See also DecodeACVarBlock.
-Status TokenizeCoefficients(const coeff_order_t* JXL_RESTRICT orders,
+Status TokenizeCoefficients(size_t num_passes,
+                            const coeff_order_t* JXL_RESTRICT const orders[],
                             const Rect& rect,
-                            const int32_t* JXL_RESTRICT* JXL_RESTRICT ac_rows,
+                            const int32_t* JXL_RESTRICT const ac_rows[][3],
                             const AcStrategyImage& ac_strategy,
                             const YCbCrChromaSubsampling& cs,
                             Image3I* JXL_RESTRICT tmp_num_nzeroes,
-                            std::vector<Token>* JXL_RESTRICT output,
+                            std::vector<Token>* JXL_RESTRICT outputs,
                             const ImageB& qdc, const ImageI& qf,
                             const BlockCtxMap& block_ctx_map);
 
@@ -11,13 +11,189 @@
 #include <cstring>
 #include <utility>
 
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/enc_external_image.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/float.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/status.h"
 
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::And;
+using hwy::HWY_NAMESPACE::ConvertTo;
+using hwy::HWY_NAMESPACE::LoadInterleaved2;
+using hwy::HWY_NAMESPACE::LoadInterleaved3;
+using hwy::HWY_NAMESPACE::LoadInterleaved4;
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::Or;
+using hwy::HWY_NAMESPACE::PromoteTo;
+using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::ShiftLeft;
+using hwy::HWY_NAMESPACE::ShiftRight;
+using hwy::HWY_NAMESPACE::TFromD;
+using hwy::HWY_NAMESPACE::Vec;
+
+// Loads the channel c of vectors of kChannels interleaved samples.
+template <size_t kChannels, class D>
+HWY_INLINE Vec<D> LoadChannel(D d, const TFromD<D>* JXL_RESTRICT in,
+                              size_t c) {
+  if (kChannels == 1) return LoadU(d, in);
+  Vec<D> v0;
+  Vec<D> v1;
+  Vec<D> v2;
+  Vec<D> v3;
+  if (kChannels == 2) {
+    LoadInterleaved2(d, in, v0, v1);
+    return c == 0 ? v0 : v1;
+  }
+  if (kChannels == 3) {
+    LoadInterleaved3(d, in, v0, v1, v2);
+    return c == 0 ? v0 : c == 1 ? v1 : v2;
+  }
+  LoadInterleaved4(d, in, v0, v1, v2, v3);
+  return c == 0 ? v0 : c == 1 ? v1 : c == 2 ? v2 : v3;
+}
+
+template <size_t kChannels, class DI, class Convert>
+size_t ConvertChannel(DI di, const uint8_t* JXL_RESTRICT row, size_t c,
+                      size_t xsize, const Convert& convert,
+                      float* JXL_RESTRICT row_out) {
+  const HWY_FULL(float) df;
+  const size_t N = Lanes(df);
+  const TFromD<DI>* in = reinterpret_cast<const TFromD<DI>*>(row);
+  size_t x = 0;
+  for (; x + N <= xsize; x += N) {
+    StoreU(convert(LoadChannel<kChannels>(di, in + x * kChannels, c)), df,
+           row_out + x);
+  }
+  return x;
+}
+
+template <class DI, class Convert>
+size_t ConvertChannel(DI di, const uint8_t* JXL_RESTRICT row,
+                      size_t num_channels, size_t c, size_t xsize,
+                      const Convert& convert, float* JXL_RESTRICT row_out) {
+  switch (num_channels) {
+    case 1:
+      return ConvertChannel<1>(di, row, c, xsize, convert, row_out);
+    case 2:
+      return ConvertChannel<2>(di, row, c, xsize, convert, row_out);
+    case 3:
+      return ConvertChannel<3>(di, row, c, xsize, convert, row_out);
+    case 4:
+      return ConvertChannel<4>(di, row, c, xsize, convert, row_out);
+    default:
+      return 0;
+  }
+}
+
+template <class D>
+HWY_INLINE Vec<D> SwapBytes16(D d, Vec<D> v) {
+  return Or(ShiftLeft<8>(v), ShiftRight<8>(v));
+}
+
+template <class D>
+HWY_INLINE Vec<D> SwapBytes32(D d, Vec<D> v) {
+  const auto low_bytes = Set(d, 0x00FF00FFu);
+  v = Or(ShiftLeft<16>(v), ShiftRight<16>(v));
+  return Or(ShiftLeft<8>(And(v, low_bytes)), And(ShiftRight<8>(v), low_bytes));
+}
+
+struct ConvertU8 {
+  float scale;
+  template <class V>
+  HWY_INLINE Vec<HWY_FULL(float)> operator()(V v) const {
+    const HWY_FULL(float) df;
+    const Rebind<int32_t, decltype(df)> di;
+    // Same as the integer multiplication by 257 of LoadFloatRow.
+    const auto f = ConvertTo(df, PromoteTo(di, v));
+    return Mul(Mul(f, Set(df, 257.0f)), Set(df, scale));
+  }
+};
+
+struct ConvertU16 {
+  float scale;
+  bool swap;
+  template <class V>
+  HWY_INLINE Vec<HWY_FULL(float)> operator()(V v) const {
+    const HWY_FULL(float) df;
+    const Rebind<int32_t, decltype(df)> di;
+    const Rebind<uint16_t, decltype(df)> du;
+    if (swap) v = SwapBytes16(du, v);
+    return Mul(ConvertTo(df, PromoteTo(di, v)), Set(df, scale));
+  }
+};
+
+struct ConvertF16 {
+  bool swap;
+  template <class V>
+  HWY_INLINE Vec<HWY_FULL(float)> operator()(V v) const {
+    const HWY_FULL(float) df;
+    const Rebind<hwy::float16_t, decltype(df)> df16;
+    const Rebind<uint16_t, decltype(df)> du;
+    if (swap) v = SwapBytes16(du, v);
+    return PromoteTo(df, BitCast(df16, v));
+  }
+};
+
+struct ConvertF32 {
+  bool swap;
+  template <class V>
+  HWY_INLINE Vec<HWY_FULL(float)> operator()(V v) const {
+    const HWY_FULL(float) df;
+    const Rebind<uint32_t, decltype(df)> du;
+    if (swap) v = SwapBytes32(du, v);
+    return BitCast(df, v);
+  }
+};
+
+// Converts the pixels [0, return value) of the channel c of an interleaved row
+// to float, as LoadFloatRow does; the rest is left to LoadFloatRow.
+size_t ConvertRow(const uint8_t* JXL_RESTRICT row, size_t xsize,
+                  size_t num_channels, size_t c, JxlDataType data_type,
+                  bool little_endian, float scale,
+                  float* JXL_RESTRICT row_out) {
+  const HWY_FULL(float) df;
+  const Rebind<uint32_t, decltype(df)> du32;
+  const Rebind<uint16_t, decltype(df)> du16;
+  const Rebind<uint8_t, decltype(df)> du8;
+  const bool swap = little_endian != IsLittleEndian();
+  switch (data_type) {
+    case JXL_TYPE_UINT8:
+      return ConvertChannel(du8, row, num_channels, c, xsize, ConvertU8{scale},
+                            row_out);
+    case JXL_TYPE_UINT16:
+      return ConvertChannel(du16, row, num_channels, c, xsize,
+                            ConvertU16{scale, swap}, row_out);
+    case JXL_TYPE_FLOAT16:
+      return ConvertChannel(du16, row, num_channels, c, xsize,
+                            ConvertF16{swap}, row_out);
+    case JXL_TYPE_FLOAT:
+      return ConvertChannel(du32, row, num_channels, c, xsize,
+                            ConvertF32{swap}, row_out);
+    default:
+      return 0;
+  }
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
 namespace jxl {
+
+HWY_EXPORT(ConvertRow);
+
 namespace {
 
 size_t JxlDataTypeBytes(JxlDataType data_type) {
@@ -74,14 +250,17 @@ Status ConvertFromExternalNoSizeCheck(const uint8_t* data, size_t xsize,
   const auto convert_row = [&](const uint32_t task,
                                size_t /*thread*/) -> Status {
     const size_t y = task;
-    size_t offset = y * stride + pixel_offset;
     float* JXL_RESTRICT row_out = channel->Row(y);
+    const size_t done = HWY_DYNAMIC_DISPATCH(ConvertRow)(
+        data + y * stride, xsize, format.num_channels, c, format.data_type,
+        little_endian, scale, row_out);
+    size_t offset = y * stride + done * bytes_per_pixel + pixel_offset;
     const auto save_value = [&](size_t index, float value) {
-      row_out[index] = value;
+      row_out[done + index] = value;
     };
-    JXL_RETURN_IF_ERROR(LoadFloatRow(data + offset, xsize, bytes_per_pixel,
-                                     format.data_type, little_endian, scale,
-                                     save_value));
+    JXL_RETURN_IF_ERROR(LoadFloatRow(data + offset, xsize - done,
+                                     bytes_per_pixel, format.data_type,
+                                     little_endian, scale, save_value));
     return true;
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, static_cast<uint32_t>(ysize),
@@ -246,3 +425,4 @@ Status BufferToImageBundle(const JxlPixelFormat& pixel_format, uint32_t xsize,
 }
 
 }  // namespace jxl
+#endif  // HWY_ONCE
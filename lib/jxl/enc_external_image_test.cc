@@ -9,13 +9,20 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <vector>
 
+#include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/float.h"
+#include "lib/jxl/base/random.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_metadata.h"
 #include "lib/jxl/test_memory_manager.h"
+#include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
 
 namespace jxl {
@@ -78,5 +85,74 @@ TEST(ExternalImageTest, AlphaPremultiplied) {
                                   ColorEncoding::SRGB(), &ib));
 }
 
+// The vectorized conversion must match LoadFloatRow for all formats.
+TEST(ExternalImageTest, MatchesLoadFloatRow) {
+  const size_t xsize = 37;
+  const size_t ysize = 3;
+  Rng rng(0);
+  for (JxlDataType type : {JXL_TYPE_UINT8, JXL_TYPE_UINT16, JXL_TYPE_FLOAT16,
+                           JXL_TYPE_FLOAT}) {
+    const size_t bytes_per_channel =
+        type == JXL_TYPE_UINT8 ? 1 : type == JXL_TYPE_FLOAT ? 4 : 2;
+    const size_t bits_per_sample =
+        type == JXL_TYPE_UINT8 ? 8 : type == JXL_TYPE_UINT16 ? 12 : 16;
+    for (JxlEndianness endianness : {JXL_LITTLE_ENDIAN, JXL_BIG_ENDIAN}) {
+      const bool little_endian = endianness == JXL_LITTLE_ENDIAN;
+      for (uint32_t num_channels = 1; num_channels <= 4; num_channels++) {
+        JxlPixelFormat format = {num_channels, type, endianness, 0};
+        const size_t bytes_per_pixel = num_channels * bytes_per_channel;
+        const size_t num_samples = xsize * ysize * num_channels;
+        std::vector<uint8_t> buf(num_samples * bytes_per_channel);
+        for (size_t i = 0; i < num_samples; i++) {
+          uint8_t* p = &buf[i * bytes_per_channel];
+          if (type == JXL_TYPE_UINT8) {
+            p[0] = rng.UniformU(0, 256);
+          } else if (type == JXL_TYPE_FLOAT) {
+            const float v = rng.UniformF(-1.0f, 2.0f);
+            uint32_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            little_endian ? StoreLE32(bits, p) : StoreBE32(bits, p);
+          } else {
+            // For half floats, finite values only.
+            const uint32_t v = type == JXL_TYPE_UINT16
+                                   ? rng.UniformU(0, 1 << bits_per_sample)
+                                   : rng.UniformU(0, 0x7C00) |
+                                         (rng.UniformU(0, 2) << 15);
+            little_endian ? StoreLE16(v, p) : StoreBE16(v, p);
+          }
+        }
+        const float scale =
+            type == JXL_TYPE_UINT8
+                ? 1.0f / (257 * ((1u << bits_per_sample) - 1))
+                : 1.0f / ((1u << bits_per_sample) - 1);
+        for (size_t c = 0; c < num_channels; c++) {
+          JXL_TEST_ASSIGN_OR_DIE(
+              ImageF channel,
+              ImageF::Create(jxl::test::MemoryManager(), xsize, ysize));
+          ASSERT_TRUE(ConvertFromExternal(buf.data(), buf.size(), xsize, ysize,
+                                          bits_per_sample, format, c,
+                                          /*pool=*/nullptr, &channel));
+          for (size_t y = 0; y < ysize; y++) {
+            std::vector<float> expected(xsize);
+            const auto save_value = [&](size_t index, float value) {
+              expected[index] = value;
+            };
+            ASSERT_TRUE(LoadFloatRow(
+                buf.data() + y * xsize * bytes_per_pixel +
+                    c * bytes_per_channel,
+                xsize, bytes_per_pixel, type, little_endian, scale,
+                save_value));
+            for (size_t x = 0; x < xsize; x++) {
+              ASSERT_EQ(expected[x], channel.Row(y)[x])
+                  << "type " << type << " channels " << num_channels << " c "
+                  << c << " x " << x << " y " << y;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace jxl
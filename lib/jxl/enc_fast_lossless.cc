@@ -14,6 +14,8 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <cmath>
 #include <limits>
 #include <memory>
 #include <vector>
@@ -299,18 +301,46 @@ struct BitWriter {
   uint64_t buffer = 0;
 };
 
-size_t SectionSize(const std::array<BitWriter, 4>& group_data) {
+// The bit writers of a group, one per channel.
+using GroupData = std::vector<BitWriter>;
+
+size_t SectionSize(const GroupData& group_data) {
   size_t sz = 0;
-  for (size_t j = 0; j < 4; j++) {
-    const auto& writer = group_data[j];
+  for (const auto& writer : group_data) {
     sz += writer.bytes_written * 8 + writer.bits_in_buffer;
   }
   sz = (sz + 7) / 8;
   return sz;
 }
 
+// The standalone encoder has no extra channels other than interleaved alpha.
+const void* GetExtraChannelDataAt(const JxlChunkedFrameInputSource& input,
+                                  size_t ec_index, size_t xpos, size_t ypos,
+                                  size_t xsize, size_t ysize,
+                                  size_t* row_offset) {
+#if FJXL_STANDALONE
+  return nullptr;
+#else
+  return input.get_extra_channel_data_at(input.opaque, ec_index, xpos, ypos,
+                                         xsize, ysize, row_offset);
+#endif
+}
+
+std::vector<GroupData> MakeGroupData(size_t num_groups, size_t num_channels) {
+  std::vector<GroupData> group_data(num_groups);
+  for (auto& section : group_data) section.resize(num_channels);
+  return group_data;
+}
+
 constexpr size_t kMaxFrameHeaderSize = 5;
 
+// Upper bound on the frame header size, without the TOC. Each extra channel
+// adds 4 bits for its upsampling and blending mode.
+size_t MaxFrameHeaderSize(size_t num_extra_channels) {
+  return std::max<size_t>(kMaxFrameHeaderSize,
+                          (30 + 4 * num_extra_channels + 7) / 8);
+}
+
 constexpr size_t kGroupSizeOffset[4] = {
     static_cast<size_t>(0),
     static_cast<size_t>(1024),
@@ -334,14 +364,16 @@ size_t TOCSize(const std::vector<size_t>& group_sizes) {
   return (toc_bits + 7) / 8;
 }
 
-size_t FrameHeaderSize(bool have_alpha, bool is_last) {
-  size_t nbits = 28 + (have_alpha ? 4 : 0) + (is_last ? 0 : 2);
+size_t FrameHeaderSize(size_t num_extra_channels, bool is_last) {
+  size_t nbits = 28 + 4 * num_extra_channels + (is_last ? 0 : 2);
   return (nbits + 7) / 8;
 }
 #endif
 
 void ComputeAcGroupDataOffset(size_t dc_global_size, size_t num_dc_groups,
-                              size_t num_ac_groups, size_t& min_dc_global_size,
+                              size_t num_ac_groups,
+                              size_t max_frame_header_size,
+                              size_t& min_dc_global_size,
                               size_t& ac_group_offset) {
   // Max AC group size is 768 kB, so max AC group TOC bits is 24.
   size_t ac_toc_max_bits = num_ac_groups * 24;
@@ -358,19 +390,19 @@ void ComputeAcGroupDataOffset(size_t dc_global_size, size_t num_dc_groups,
   size_t max_toc_bits =
       kTOCBits[dc_global_bucket] + 12 * (1 + num_dc_groups) + ac_toc_max_bits;
   size_t max_toc_size = (max_toc_bits + 7) / 8;
-  ac_group_offset = kMaxFrameHeaderSize + max_toc_size + min_dc_global_size;
+  ac_group_offset = max_frame_header_size + max_toc_size + min_dc_global_size;
 }
 
 #if !FJXL_STANDALONE
 size_t ComputeDcGlobalPadding(const std::vector<size_t>& group_sizes,
                               size_t ac_group_data_offset,
-                              size_t min_dc_global_size, bool have_alpha,
-                              bool is_last) {
+                              size_t min_dc_global_size,
+                              size_t num_extra_channels, bool is_last) {
   std::vector<size_t> new_group_sizes = group_sizes;
   new_group_sizes[0] = min_dc_global_size;
   size_t toc_size = TOCSize(new_group_sizes);
   size_t actual_offset =
-      FrameHeaderSize(have_alpha, is_last) + toc_size + group_sizes[0];
+      FrameHeaderSize(num_extra_channels, is_last) + toc_size + group_sizes[0];
   return ac_group_data_offset - actual_offset;
 }
 #endif
@@ -382,6 +414,14 @@ constexpr size_t kLZ77CacheSize = 32;
 constexpr size_t kLZ77Offset = 224;
 constexpr size_t kLZ77MinLength = 7;
 
+// The predictors that can be used for a channel, with their identifier in the
+// MA tree.
+enum class Predictor : uint8_t { kLeft = 1, kTop = 2, kGradient = 5 };
+constexpr size_t kNumPredictors = 3;
+// The first one is preferred when the estimated costs are equal.
+constexpr Predictor kPredictors[kNumPredictors] = {
+    Predictor::kGradient, Predictor::kLeft, Predictor::kTop};
+
 void EncodeHybridUintLZ77(uint32_t value, uint32_t* token, uint32_t* nbits,
                           uint32_t* bits) {
   // 400 config
@@ -698,14 +738,24 @@ struct JxlFastLosslessFrameState {
   size_t num_dc_groups_x;
   size_t num_dc_groups_y;
   size_t nb_chans;
+  // Extra channels that are not interleaved with the color channels, which
+  // are the ones from first_planar_channel on.
+  size_t num_planar_channels = 0;
+  size_t first_planar_channel = 0;
   size_t bitdepth;
   int big_endian;
   int effort;
   bool collided;
+  // Whether each group has its own tree and prefix codes, see
+  // FJXL_GROUP_ANALYSIS_EFFORT.
+  bool group_analysis = false;
+  // Predictor of each channel in the global tree.
+  Predictor predictors[4] = {Predictor::kGradient, Predictor::kGradient,
+                             Predictor::kGradient, Predictor::kGradient};
   PrefixCode hcode[4];
   std::vector<int16_t> lookup;
   BitWriter header;
-  std::vector<std::array<BitWriter, 4>> group_data;
+  std::vector<GroupData> group_data;
   std::vector<size_t> group_sizes;
   size_t ac_group_data_offset = 0;
   size_t min_dc_global_size = 0;
@@ -735,6 +785,8 @@ void JxlFastLosslessPrepareHeader(JxlFastLosslessFrameState* frame,
   output->Allocate(1000 + frame->group_sizes.size() * 32);
 
   bool have_alpha = (frame->nb_chans == 2 || frame->nb_chans == 4);
+  size_t num_extra_channels =
+      (have_alpha ? 1 : 0) + frame->num_planar_channels;
 
 #if FJXL_STANDALONE
   if (add_image_header) {
@@ -823,15 +875,15 @@ void JxlFastLosslessPrepareHeader(JxlFastLosslessFrameState* frame,
   output->Write(2, 0b00);  // default flags
   output->Write(1, 0);     // not YCbCr
   output->Write(2, 0b00);  // no upsampling
-  if (have_alpha) {
-    output->Write(2, 0b00);  // no alpha upsampling
+  for (size_t i = 0; i < num_extra_channels; i++) {
+    output->Write(2, 0b00);  // no extra channel upsampling
   }
   output->Write(2, 0b01);  // default group size
   output->Write(2, 0b00);  // exactly one pass
   output->Write(1, 0);     // no custom size or origin
   output->Write(2, 0b00);  // kReplace blending mode
-  if (have_alpha) {
-    output->Write(2, 0b00);  // kReplace blending mode for alpha channel
+  for (size_t i = 0; i < num_extra_channels; i++) {
+    output->Write(2, 0b00);  // kReplace blending mode for extra channel
   }
   output->Write(1, is_last);  // is_last
   if (!is_last) {
@@ -846,7 +898,8 @@ void JxlFastLosslessPrepareHeader(JxlFastLosslessFrameState* frame,
 
   output->Write(1, 0);      // No TOC permutation
   output->ZeroPadToByte();  // TOC is byte-aligned.
-  assert(add_image_header || output->bytes_written <= kMaxFrameHeaderSize);
+  assert(add_image_header ||
+         output->bytes_written <= MaxFrameHeaderSize(num_extra_channels));
   for (size_t group_size : frame->group_sizes) {
     size_t bucket = TOCBucket(group_size);
     output->Write(2, bucket);
@@ -927,13 +980,13 @@ size_t JxlFastLosslessWriteOutput(JxlFastLosslessFrameState* frame,
   while (true) {
     size_t& cur = frame->current_bit_writer;
     size_t& bw_pos = frame->bit_writer_byte_pos;
-    if (cur >= 1 + frame->group_data.size() * frame->nb_chans) {
+    size_t nbc = frame->nb_chans + frame->num_planar_channels;
+    if (cur >= 1 + frame->group_data.size() * nbc) {
       return output - initial_output;
     }
     if (output_size <= 9) {
       return output - initial_output;
     }
-    size_t nbc = frame->nb_chans;
     const BitWriter& writer =
         cur == 0 ? frame->header
                  : frame->group_data[(cur - 1) / nbc][(cur - 1) % nbc];
@@ -1988,9 +2041,8 @@ struct Mask32 {
     return Mask32{vandq_u32(mask, oth.mask)};
   }
   size_t CountPrefix() const {
-    uint32_t val_unset[4] = {0, 1, 2, 3};
-    uint32_t val_set[4] = {4, 4, 4, 4};
-    uint32x4_t val = vbslq_u32(mask, vld1q_u32(val_set), vld1q_u32(val_unset));
+    static constexpr uint32_t kValUnset[4] = {0, 1, 2, 3};
+    uint32x4_t val = vbslq_u32(mask, vdupq_n_u32(4), vld1q_u32(kValUnset));
     return vminvq_u32(val);
   }
 };
@@ -2048,9 +2100,8 @@ struct Mask16 {
     return Mask16{vandq_u16(mask, oth.mask)};
   }
   size_t CountPrefix() const {
-    uint16_t val_unset[8] = {0, 1, 2, 3, 4, 5, 6, 7};
-    uint16_t val_set[8] = {8, 8, 8, 8, 8, 8, 8, 8};
-    uint16x8_t val = vbslq_u16(mask, vld1q_u16(val_set), vld1q_u16(val_unset));
+    static constexpr uint16_t kValUnset[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    uint16x8_t val = vbslq_u16(mask, vdupq_n_u16(8), vld1q_u16(kValUnset));
     return vminvq_u16(val);
   }
 };
@@ -2206,16 +2257,14 @@ struct Bits32 {
   }
 
   Bits64 Merge() const {
-    // TODO(veluca): can probably be optimized.
-    uint64x2_t nbits_lo32 =
-        vandq_u64(vreinterpretq_u64_u32(nbits), vdupq_n_u64(0xFFFFFFFF));
+    // USHL only uses the lowest byte of each lane as the shift amount, which
+    // is the lowest byte of the lower nbits.
     uint64x2_t bits_hi32 =
         vshlq_u64(vshrq_n_u64(vreinterpretq_u64_u32(bits), 32),
-                  vreinterpretq_s64_u64(nbits_lo32));
+                  vreinterpretq_s64_u32(nbits));
     uint64x2_t bits_lo32 =
         vandq_u64(vreinterpretq_u64_u32(bits), vdupq_n_u64(0xFFFFFFFF));
-    uint64x2_t nbits64 =
-        vsraq_n_u64(nbits_lo32, vreinterpretq_u64_u32(nbits), 32);
+    uint64x2_t nbits64 = vpaddlq_u32(nbits);
     uint64x2_t bits64 = vorrq_u64(bits_hi32, bits_lo32);
     return Bits64{nbits64, bits64};
   }
@@ -2255,16 +2304,13 @@ struct Bits16 {
   }
 
   Bits32 Merge() const {
-    // TODO(veluca): can probably be optimized.
-    uint32x4_t nbits_lo16 =
-        vandq_u32(vreinterpretq_u32_u16(nbits), vdupq_n_u32(0xFFFF));
+    // Same as Bits32::Merge above, with 16-bit halves.
     uint32x4_t bits_hi16 =
         vshlq_u32(vshrq_n_u32(vreinterpretq_u32_u16(bits), 16),
-                  vreinterpretq_s32_u32(nbits_lo16));
+                  vreinterpretq_s32_u16(nbits));
     uint32x4_t bits_lo16 =
         vandq_u32(vreinterpretq_u32_u16(bits), vdupq_n_u32(0xFFFF));
-    uint32x4_t nbits32 =
-        vsraq_n_u32(nbits_lo16, vreinterpretq_u32_u16(nbits), 16);
+    uint32x4_t nbits32 = vpaddlq_u16(nbits);
     uint32x4_t bits32 = vorrq_u32(bits_hi16, bits_lo16);
     return Bits32{nbits32, bits32};
   }
@@ -2628,21 +2674,26 @@ using simd_t = typename detail::SIMDType<T>::type;
 template <typename T>
 size_t PredictPixels(const signed_t<T>* pixels, const signed_t<T>* pixels_left,
                      const signed_t<T>* pixels_top,
-                     const signed_t<T>* pixels_topleft,
+                     const signed_t<T>* pixels_topleft, Predictor predictor,
                      unsigned_t<T>* residuals) {
   T px = T::Load((unsigned_t<T>*)pixels);
   T left = T::Load((unsigned_t<T>*)pixels_left);
   T top = T::Load((unsigned_t<T>*)pixels_top);
-  T topleft = T::Load((unsigned_t<T>*)pixels_topleft);
-  T ac = left.Sub(topleft);
-  T ab = left.Sub(top);
-  T bc = top.Sub(topleft);
-  T grad = ac.Add(top);
-  T d = ab.Xor(bc);
   T zero = T::Val(0);
-  T clamp = zero.Gt(d).IfThenElse(top, left);
-  T s = ac.Xor(bc);
-  T pred = zero.Gt(s).IfThenElse(grad, clamp);
+  T pred = top;
+  if (predictor == Predictor::kLeft) {
+    pred = left;
+  } else if (predictor == Predictor::kGradient) {
+    T topleft = T::Load((unsigned_t<T>*)pixels_topleft);
+    T ac = left.Sub(topleft);
+    T ab = left.Sub(top);
+    T bc = top.Sub(topleft);
+    T grad = ac.Add(top);
+    T d = ab.Xor(bc);
+    T clamp = zero.Gt(d).IfThenElse(top, left);
+    T s = ac.Xor(bc);
+    pred = zero.Gt(s).IfThenElse(grad, clamp);
+  }
   T res = px.Sub(pred);
   T res_times_2 = res.Add(res);
   res = zero.Gt(res).IfThenElse(T::Val(-1).Sub(res_times_2), res_times_2);
@@ -2931,12 +2982,14 @@ struct MoreThan14Bits {
 constexpr uint8_t MoreThan14Bits::kMinRawLength[];
 constexpr uint8_t MoreThan14Bits::kMaxRawLength[];
 
-void PrepareDCGlobalCommon(bool is_single_group, size_t width, size_t height,
-                           const PrefixCode code[4], BitWriter* output) {
-  output->Allocate(100000 + (is_single_group ? width * height * 16 : 0));
-  // No patches, spline or noise.
-  output->Write(1, 1);  // default DC dequantization factors (?)
-  output->Write(1, 1);  // use global tree / histograms
+// Upper bound of the size of WriteTreeAndHistograms: 4 prefix codes of at most
+// 286 bits, and less than 300 bits for the rest.
+constexpr size_t kMaxTreeAndHistogramsBits = 2048;
+
+// Writes the tree, with a leaf per channel using `predictors[c]`, and the
+// prefix codes used for the channels.
+void WriteTreeAndHistograms(const Predictor predictors[4],
+                            const PrefixCode code[4], BitWriter* output) {
   output->Write(1, 0);  // no lz77 for the tree
 
   output->Write(1, 1);         // simple code for the tree's context map
@@ -2955,12 +3008,16 @@ void PrepareDCGlobalCommon(bool is_single_group, size_t width, size_t height,
   // Huffman table + extra bits for the tree.
   uint8_t symbol_bits[6] = {0b00, 0b10, 0b001, 0b101, 0b0011, 0b0111};
   uint8_t symbol_nbits[6] = {2, 2, 3, 3, 4, 4};
-  // Write a tree with a leaf per channel, and gradient predictor for every
-  // leaf.
-  for (auto v : {1, 2, 1, 4, 1, 0, 0, 5, 0, 0, 0, 0, 5,
-                 0, 0, 0, 0, 5, 0, 0, 0, 0, 5, 0, 0, 0}) {
+  // Write a tree with a leaf per channel: channel > 1, channel > 2 and
+  // channel > 0 splits, followed by the leaves of channels 3, 2, 1 and 0.
+  for (auto v : {1, 2, 1, 4, 1, 0}) {
     output->Write(symbol_nbits[v], symbol_bits[v]);
   }
+  for (size_t c = 4; c-- > 0;) {
+    for (auto v : {0, static_cast<int>(predictors[c]), 0, 0, 0}) {
+      output->Write(symbol_nbits[v], symbol_bits[v]);
+    }
+  }
 
   output->Write(1, 1);     // Enable lz77 for the main bitstream
   output->Write(2, 0b00);  // lz77 offset 224
@@ -3003,6 +3060,16 @@ void PrepareDCGlobalCommon(bool is_single_group, size_t width, size_t height,
   for (size_t i = 0; i < 4; i++) {
     code[i].WriteTo(output);
   }
+}
+
+void PrepareDCGlobalCommon(bool is_single_group, size_t width, size_t height,
+                           const Predictor predictors[4],
+                           const PrefixCode code[4], BitWriter* output) {
+  output->Allocate(100000 + (is_single_group ? width * height * 16 : 0));
+  // No patches, spline or noise.
+  output->Write(1, 1);  // default DC dequantization factors (?)
+  output->Write(1, 1);  // use global tree / histograms
+  WriteTreeAndHistograms(predictors, code, output);
 
   // Group header for global modular image.
   output->Write(1, 1);  // Global tree
@@ -3010,9 +3077,10 @@ void PrepareDCGlobalCommon(bool is_single_group, size_t width, size_t height,
 }
 
 void PrepareDCGlobal(bool is_single_group, size_t width, size_t height,
-                     size_t nb_chans, const PrefixCode code[4],
-                     BitWriter* output) {
-  PrepareDCGlobalCommon(is_single_group, width, height, code, output);
+                     size_t nb_chans, const Predictor predictors[4],
+                     const PrefixCode code[4], BitWriter* output) {
+  PrepareDCGlobalCommon(is_single_group, width, height, predictors, code,
+                        output);
   if (nb_chans > 2) {
     output->Write(2, 0b01);     // 1 transform
     output->Write(2, 0b00);     // RCT
@@ -3116,9 +3184,9 @@ struct ChannelRowProcessor {
     constexpr size_t kNum =
         sizeof(pixel_t) == 2 ? SIMDVec16::kLanes : SIMDVec32::kLanes;
     for (size_t ix = 0; ix < kChunkSize; ix += kNum) {
-      size_t c =
-          PredictPixels<simd_t<pixel_t>>(row + ix, row_left + ix, row_top + ix,
-                                         row_topleft + ix, residuals + ix);
+      size_t c = PredictPixels<simd_t<pixel_t>>(
+          row + ix, row_left + ix, row_top + ix, row_topleft + ix, predictor,
+          residuals + ix);
       prefix_size =
           prefix_size == required_prefix_size ? prefix_size + c : prefix_size;
       required_prefix_size += kNum;
@@ -3128,16 +3196,21 @@ struct ChannelRowProcessor {
       pixel_t px = row[ix];
       pixel_t left = row_left[ix];
       pixel_t top = row_top[ix];
-      pixel_t topleft = row_topleft[ix];
-      pixel_t ac = left - topleft;
-      pixel_t ab = left - top;
-      pixel_t bc = top - topleft;
-      pixel_t grad = static_cast<pixel_t>(static_cast<upixel_t>(ac) +
-                                          static_cast<upixel_t>(top));
-      pixel_t d = ab ^ bc;
-      pixel_t clamp = d < 0 ? top : left;
-      pixel_t s = ac ^ bc;
-      pixel_t pred = s < 0 ? grad : clamp;
+      pixel_t pred = top;
+      if (predictor == Predictor::kLeft) {
+        pred = left;
+      } else if (predictor == Predictor::kGradient) {
+        pixel_t topleft = row_topleft[ix];
+        pixel_t ac = left - topleft;
+        pixel_t ab = left - top;
+        pixel_t bc = top - topleft;
+        pixel_t grad = static_cast<pixel_t>(static_cast<upixel_t>(ac) +
+                                            static_cast<upixel_t>(top));
+        pixel_t d = ab ^ bc;
+        pixel_t clamp = d < 0 ? top : left;
+        pixel_t s = ac ^ bc;
+        pred = s < 0 ? grad : clamp;
+      }
       residuals[ix] = PackSigned(px - pred);
       prefix_size = prefix_size == required_prefix_size
                         ? prefix_size + (residuals[ix] == 0)
@@ -3169,6 +3242,7 @@ struct ChannelRowProcessor {
   }
 
   void Finalize() { t->Finalize(run); }
+  Predictor predictor = Predictor::kGradient;
   // Invariant: run == 0 or run > kLZ77MinLength.
   size_t run = 0;
 };
@@ -3507,29 +3581,158 @@ void ProcessImageArea(const unsigned char* rgba, size_t x0, size_t y0,
   }
 }
 
+// Scales the sampled counts and adds base counts to them, so that all the
+// symbols that may occur have a code.
+template <typename BitDepth>
+void AddBaseCounts(BitDepth bitdepth, bool large_alphabet,
+                   uint64_t raw_counts[4][kNumRawSymbols],
+                   uint64_t lz77_counts[4][kNumLZ77]) {
+  // TODO(veluca): can probably improve this and make it bitdepth-dependent.
+  uint64_t base_raw_counts[kNumRawSymbols] = {
+      3843, 852, 1270, 1214, 1014, 727, 481, 300, 159, 51,
+      5,    1,   1,    1,    1,    1,   1,   1,   1};
+
+  for (size_t i = bitdepth.NumSymbols(large_alphabet); i < kNumRawSymbols;
+       i++) {
+    base_raw_counts[i] = 0;
+  }
+
+  for (size_t c = 0; c < 4; c++) {
+    for (size_t i = 0; i < kNumRawSymbols; i++) {
+      raw_counts[c][i] = (raw_counts[c][i] << 8) + base_raw_counts[i];
+    }
+  }
+
+  uint64_t base_lz77_counts[kNumLZ77] = {
+      29, 27, 25,  23, 21, 21, 19, 18, 21, 17, 16, 15, 15, 14,
+      13, 13, 137, 98, 61, 34, 1,  1,  1,  1,  1,  1,  1,  1,
+  };
+
+  for (size_t c = 0; c < 4; c++) {
+    for (size_t i = 0; i < kNumLZ77; i++) {
+      lz77_counts[c][i] = (lz77_counts[c][i] << 8) + base_lz77_counts[i];
+    }
+  }
+}
+
+// Estimated number of bits of the symbols with the given counts, including
+// their extra bits.
+double EstimateBits(const uint64_t* raw_counts, const uint64_t* lz77_counts) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < kNumRawSymbols; i++) total += raw_counts[i];
+  for (size_t i = 0; i < kNumLZ77; i++) total += lz77_counts[i];
+  double bits = 0;
+  for (size_t i = 0; i < kNumRawSymbols; i++) {
+    if (raw_counts[i] == 0) continue;
+    // Raw symbol i > 0 has i - 1 extra bits.
+    bits += raw_counts[i] * (std::log2(static_cast<double>(total) /
+                                       static_cast<double>(raw_counts[i])) +
+                             (i == 0 ? 0 : i - 1));
+  }
+  for (size_t i = 0; i < kNumLZ77; i++) {
+    if (lz77_counts[i] == 0) continue;
+    bits += lz77_counts[i] * std::log2(static_cast<double>(total) /
+                                       static_cast<double>(lz77_counts[i]));
+  }
+  return bits;
+}
+
+// Chooses the predictor of each channel of the group by collecting its
+// symbols with all the predictors, and computes the prefix codes of these
+// predictors.
+template <typename BitDepth>
+void AnalyzeGroup(const unsigned char* rgba, size_t xs, size_t ys,
+                  size_t row_stride, BitDepth bitdepth, size_t nb_chans,
+                  bool big_endian, Predictor predictors[4],
+                  PrefixCode code[4]) {
+  uint64_t raw_counts[kNumPredictors][4][kNumRawSymbols] = {};
+  uint64_t lz77_counts[kNumPredictors][4][kNumLZ77] = {};
+  for (size_t p = 0; p < kNumPredictors; p++) {
+    ChunkSampleCollector<BitDepth> sample_collectors[4];
+    ChannelRowProcessor<ChunkSampleCollector<BitDepth>, BitDepth>
+        row_sample_collectors[4];
+    for (size_t c = 0; c < nb_chans; c++) {
+      row_sample_collectors[c].t = &sample_collectors[c];
+      row_sample_collectors[c].predictor = kPredictors[p];
+      sample_collectors[c].raw_counts = raw_counts[p][c];
+      sample_collectors[c].lz77_counts = lz77_counts[p][c];
+    }
+    ProcessImageArea<
+        ChannelRowProcessor<ChunkSampleCollector<BitDepth>, BitDepth>>(
+        rgba, 0, 0, xs, 0, ys, row_stride, bitdepth, nb_chans, big_endian,
+        row_sample_collectors);
+  }
+  uint64_t best_raw_counts[4][kNumRawSymbols];
+  uint64_t best_lz77_counts[4][kNumLZ77];
+  for (size_t c = 0; c < 4; c++) {
+    size_t best = 0;
+    if (c < nb_chans) {
+      double best_bits = EstimateBits(raw_counts[0][c], lz77_counts[0][c]);
+      for (size_t p = 1; p < kNumPredictors; p++) {
+        double bits = EstimateBits(raw_counts[p][c], lz77_counts[p][c]);
+        if (bits < best_bits) {
+          best = p;
+          best_bits = bits;
+        }
+      }
+    }
+    predictors[c] = kPredictors[best];
+    memcpy(best_raw_counts[c], raw_counts[best][c], sizeof(best_raw_counts[c]));
+    memcpy(best_lz77_counts[c], lz77_counts[best][c],
+           sizeof(best_lz77_counts[c]));
+  }
+  AddBaseCounts(bitdepth, /*large_alphabet=*/nb_chans > 2, best_raw_counts,
+                best_lz77_counts);
+  for (size_t c = 0; c < 4; c++) {
+    code[c] = PrefixCode(bitdepth, best_raw_counts[c], best_lz77_counts[c]);
+  }
+}
+
+// Encodes the `nb_chans` channels interleaved in `rgba`, followed by the
+// `planar.size()` channels stored one per buffer in `planar`. Like the global
+// tree, the channels after the 4th one use the prefix code of the 4th one.
+// With `group_analysis`, the group has its own tree and prefix codes instead
+// of `predictors` and `code`, unless it is the only group.
 template <typename BitDepth>
 void WriteACSection(const unsigned char* rgba, size_t x0, size_t y0, size_t xs,
                     size_t ys, size_t row_stride, bool is_single_group,
                     BitDepth bitdepth, size_t nb_chans, bool big_endian,
+                    bool group_analysis, const Predictor predictors[4],
                     const PrefixCode code[4],
-                    std::array<BitWriter, 4>& output) {
-  for (size_t i = 0; i < nb_chans; i++) {
+                    const std::vector<std::pair<const void*, size_t>>& planar,
+                    GroupData& output) {
+  const bool local_tree = group_analysis && !is_single_group;
+  for (size_t i = 0; i < nb_chans + planar.size(); i++) {
     if (is_single_group && i == 0) continue;
-    output[i].Allocate(xs * ys * bitdepth.MaxEncodedBitsPerSample() + 4);
+    output[i].Allocate(xs * ys * bitdepth.MaxEncodedBitsPerSample() + 4 +
+                       (local_tree && i == 0 ? kMaxTreeAndHistogramsBits : 0));
+  }
+  Predictor local_predictors[4];
+  PrefixCode local_code[4];
+  if (local_tree) {
+    AnalyzeGroup(rgba + row_stride * y0 + x0 * nb_chans * BitDepth::kInputBytes,
+                 xs, ys, row_stride, bitdepth, nb_chans, big_endian,
+                 local_predictors, local_code);
+    predictors = local_predictors;
+    code = local_code;
   }
   if (!is_single_group) {
     // Group header for modular image.
     // When the image is single-group, the global modular image is the one
     // that contains the pixel data, and there is no group header.
-    output[0].Write(1, 1);     // Global tree
-    output[0].Write(1, 1);     // All default wp
-    output[0].Write(2, 0b00);  // 0 transforms
+    output[0].Write(1, local_tree ? 0 : 1);  // Global tree
+    output[0].Write(1, 1);                   // All default wp
+    output[0].Write(2, 0b00);                // 0 transforms
+    if (local_tree) {
+      WriteTreeAndHistograms(predictors, code, &output[0]);
+    }
   }
 
   ChunkEncoder<BitDepth> encoders[4];
   ChannelRowProcessor<ChunkEncoder<BitDepth>, BitDepth> row_encoders[4];
   for (size_t c = 0; c < nb_chans; c++) {
     row_encoders[c].t = &encoders[c];
+    row_encoders[c].predictor = predictors[c];
     encoders[c].output = &output[c];
     encoders[c].code = &code[c];
     encoders[c].PrepareForSimd();
@@ -3537,6 +3740,18 @@ void WriteACSection(const unsigned char* rgba, size_t x0, size_t y0, size_t xs,
   ProcessImageArea<ChannelRowProcessor<ChunkEncoder<BitDepth>, BitDepth>>(
       rgba, x0, y0, xs, 0, ys, row_stride, bitdepth, nb_chans, big_endian,
       row_encoders);
+  for (size_t i = 0; i < planar.size(); i++) {
+    ChunkEncoder<BitDepth> encoder;
+    ChannelRowProcessor<ChunkEncoder<BitDepth>, BitDepth> row_encoder;
+    row_encoder.t = &encoder;
+    row_encoder.predictor = predictors[std::min<size_t>(nb_chans + i, 3)];
+    encoder.output = &output[nb_chans + i];
+    encoder.code = &code[std::min<size_t>(nb_chans + i, 3)];
+    encoder.PrepareForSimd();
+    ProcessImageArea<ChannelRowProcessor<ChunkEncoder<BitDepth>, BitDepth>>(
+        static_cast<const unsigned char*>(planar[i].first), 0, 0, xs, 0, ys,
+        planar[i].second, bitdepth, /*nb_chans=*/1, big_endian, &row_encoder);
+  }
 }
 
 constexpr int kHashExp = 16;
@@ -3669,7 +3884,10 @@ void PrepareDCGlobalPalette(bool is_single_group, size_t width, size_t height,
                             size_t nb_chans, const PrefixCode code[4],
                             const std::vector<uint32_t>& palette,
                             size_t pcolors, BitWriter* output) {
-  PrepareDCGlobalCommon(is_single_group, width, height, code, output);
+  const Predictor predictors[4] = {Predictor::kGradient, Predictor::kGradient,
+                                   Predictor::kGradient, Predictor::kGradient};
+  PrepareDCGlobalCommon(is_single_group, width, height, predictors, code,
+                        output);
   output->Write(2, 0b01);     // 1 transform
   output->Write(2, 0b01);     // Palette
   output->Write(5, 0b00000);  // Starting from ch 0
@@ -3769,6 +3987,8 @@ template <typename BitDepth>
 JxlFastLosslessFrameState* LLPrepare(JxlChunkedFrameInputSource input,
                                      size_t width, size_t height,
                                      BitDepth bitdepth, size_t nb_chans,
+                                     size_t num_planar_channels,
+                                     size_t first_planar_channel,
                                      bool big_endian, int effort, int oneshot) {
   assert(width != 0);
   assert(height != 0);
@@ -3778,7 +3998,8 @@ JxlFastLosslessFrameState* LLPrepare(JxlChunkedFrameInputSource input,
   std::vector<int16_t> lookup(kHashSize);
   lookup[0] = 0;
   int pcolors = 0;
-  bool collided = effort < 2 || bitdepth.bitdepth != 8 || !oneshot;
+  bool collided = effort < 2 || bitdepth.bitdepth != 8 || !oneshot ||
+                  num_planar_channels != 0;
   for (size_t y0 = 0; y0 < height && !collided; y0 += 256) {
     size_t ys = std::min<size_t>(height - y0, 256);
     for (size_t x0 = 0; x0 < width && !collided; x0 += 256) {
@@ -3858,6 +4079,9 @@ JxlFastLosslessFrameState* LLPrepare(JxlChunkedFrameInputSource input,
   uint64_t lz77_counts[4][kNumLZ77] = {};
 
   bool onegroup = num_groups_x == 1 && num_groups_y == 1;
+  // The planar channels would need their own leaves in the trees.
+  bool group_analysis = effort >= FJXL_GROUP_ANALYSIS_EFFORT &&
+                        collided && num_planar_channels == 0;
 
   auto sample_rows = [&](size_t xg, size_t yg, size_t num_rows) {
     size_t y0 = yg * 256;
@@ -3872,18 +4096,35 @@ JxlFastLosslessFrameState* LLPrepare(JxlChunkedFrameInputSource input,
         std::max<ssize_t>(
             0, static_cast<ssize_t>(ys) - static_cast<ssize_t>(num_rows)) /
         2;
-    int y_count = std::min<int>(num_rows, ys - y_begin_group);
+    // The row before the sampled ones is read too.
+    int y_count = std::min<int>(num_rows, ys - y_begin_group - 1);
     int x_max = xs / kChunkSize * kChunkSize;
     CollectSamples(rgba, 0, y_begin_group, x_max, stride, y_count, raw_counts,
                    lz77_counts, onegroup, !collided, bitdepth, nb_chans,
                    big_endian, lookup.data());
     input.release_buffer(input.opaque, buffer);
+    // Each planar channel adds its samples to the counts of the prefix code
+    // that it uses.
+    for (size_t c = 0; c < num_planar_channels; c++) {
+      size_t ec_stride;
+      const void* ec_buffer = GetExtraChannelDataAt(
+          input, first_planar_channel + c, x0, y0, xs, ys, &ec_stride);
+      size_t code_index = std::min<size_t>(nb_chans + c, 3);
+      CollectSamples(reinterpret_cast<const unsigned char*>(ec_buffer), 0,
+                     y_begin_group, x_max, ec_stride, y_count,
+                     raw_counts + code_index, lz77_counts + code_index,
+                     onegroup, /*palette=*/false, bitdepth, /*nb_chans=*/1,
+                     big_endian, lookup.data());
+      input.release_buffer(input.opaque, ec_buffer);
+    }
   };
 
   // TODO(veluca): that `64` is an arbitrary constant, meant to correspond to
   // the point where the number of processed rows is large enough that loading
   // the entire image is cost-effective.
-  if (oneshot || effort >= 64) {
+  if (group_analysis) {
+    // The prefix codes come from AnalyzeGroup instead.
+  } else if (oneshot || effort >= 64) {
     for (size_t g = 0; g < num_groups_y * num_groups_x; g++) {
       size_t xg = g % num_groups_x;
       size_t yg = g / num_groups_x;
@@ -3899,23 +4140,10 @@ JxlFastLosslessFrameState* LLPrepare(JxlChunkedFrameInputSource input,
                 2 * effort * num_groups_x * num_groups_y);
   }
 
-  // TODO(veluca): can probably improve this and make it bitdepth-dependent.
-  uint64_t base_raw_counts[kNumRawSymbols] = {
-      3843, 852, 1270, 1214, 1014, 727, 481, 300, 159, 51,
-      5,    1,   1,    1,    1,    1,   1,   1,   1};
-
   bool doing_ycocg = nb_chans > 2 && collided;
   bool large_palette = !collided || pcolors >= 256;
-  for (size_t i = bitdepth.NumSymbols(doing_ycocg || large_palette);
-       i < kNumRawSymbols; i++) {
-    base_raw_counts[i] = 0;
-  }
-
-  for (size_t c = 0; c < 4; c++) {
-    for (size_t i = 0; i < kNumRawSymbols; i++) {
-      raw_counts[c][i] = (raw_counts[c][i] << 8) + base_raw_counts[i];
-    }
-  }
+  AddBaseCounts(bitdepth, doing_ycocg || large_palette, raw_counts,
+                lz77_counts);
 
   if (!collided) {
     unsigned token, nbits, bits;
@@ -3928,21 +4156,20 @@ JxlFastLosslessFrameState* LLPrepare(JxlChunkedFrameInputSource input,
     for (size_t i = token + 1; i < 10; i++) raw_counts[0][i] = 1;
   }
 
-  uint64_t base_lz77_counts[kNumLZ77] = {
-      29, 27, 25,  23, 21, 21, 19, 18, 21, 17, 16, 15, 15, 14,
-      13, 13, 137, 98, 61, 34, 1,  1,  1,  1,  1,  1,  1,  1,
-  };
-
-  for (size_t c = 0; c < 4; c++) {
-    for (size_t i = 0; i < kNumLZ77; i++) {
-      lz77_counts[c][i] = (lz77_counts[c][i] << 8) + base_lz77_counts[i];
-    }
-  }
-
   JxlFastLosslessFrameState* frame_state = new JxlFastLosslessFrameState();
   for (size_t i = 0; i < 4; i++) {
     frame_state->hcode[i] = PrefixCode(bitdepth, raw_counts[i], lz77_counts[i]);
   }
+  if (group_analysis && onegroup) {
+    // The global tree and prefix codes are the ones of the only group.
+    size_t stride;
+    const void* buffer = input.get_color_channel_data_at(
+        input.opaque, 0, 0, width, height, &stride);
+    AnalyzeGroup(reinterpret_cast<const unsigned char*>(buffer), width, height,
+                 stride, bitdepth, nb_chans, big_endian,
+                 frame_state->predictors, frame_state->hcode);
+    input.release_buffer(input.opaque, buffer);
+  }
 
   size_t num_dc_groups = num_dc_groups_x * num_dc_groups_y;
   size_t num_ac_groups = num_groups_x * num_groups_y;
@@ -3955,17 +4182,21 @@ JxlFastLosslessFrameState* LLPrepare(JxlChunkedFrameInputSource input,
   frame_state->num_dc_groups_x = num_dc_groups_x;
   frame_state->num_dc_groups_y = num_dc_groups_y;
   frame_state->nb_chans = nb_chans;
+  frame_state->num_planar_channels = num_planar_channels;
+  frame_state->first_planar_channel = first_planar_channel;
   frame_state->bitdepth = bitdepth.bitdepth;
   frame_state->big_endian = big_endian;
   frame_state->effort = effort;
   frame_state->collided = collided;
+  frame_state->group_analysis = group_analysis;
   frame_state->lookup = lookup;
 
-  frame_state->group_data = std::vector<std::array<BitWriter, 4>>(num_groups);
+  frame_state->group_data =
+      MakeGroupData(num_groups, nb_chans + num_planar_channels);
   frame_state->group_sizes.resize(num_groups);
   if (collided) {
-    PrepareDCGlobal(onegroup, width, height, nb_chans, frame_state->hcode,
-                    &frame_state->group_data[0][0]);
+    PrepareDCGlobal(onegroup, width, height, nb_chans, frame_state->predictors,
+                    frame_state->hcode, &frame_state->group_data[0][0]);
   } else {
     PrepareDCGlobalPalette(onegroup, width, height, nb_chans,
                            frame_state->hcode, palette, pcolors,
@@ -3973,8 +4204,12 @@ JxlFastLosslessFrameState* LLPrepare(JxlChunkedFrameInputSource input,
   }
   frame_state->group_sizes[0] = SectionSize(frame_state->group_data[0]);
   if (!onegroup) {
+    size_t num_extra_channels =
+        (nb_chans == 2 || nb_chans == 4 ? 1 : 0) + num_planar_channels;
     ComputeAcGroupDataOffset(frame_state->group_sizes[0], num_dc_groups,
-                             num_ac_groups, frame_state->min_dc_global_size,
+                             num_ac_groups,
+                             MaxFrameHeaderSize(num_extra_channels),
+                             frame_state->min_dc_global_size,
                              frame_state->ac_group_data_offset);
   }
 
@@ -4004,6 +4239,8 @@ jxl::Status LLProcess(JxlFastLosslessFrameState* frame_state, bool is_last,
   bool streaming = !onegroup && output_processor;
   size_t total_groups = frame_state->num_groups_x * frame_state->num_groups_y;
   size_t max_groups = streaming ? kMaxLocalGroups : total_groups;
+  size_t num_channels =
+      frame_state->nb_chans + frame_state->num_planar_channels;
 #if !FJXL_STANDALONE
   size_t start_pos = 0;
   if (streaming) {
@@ -4016,8 +4253,7 @@ jxl::Status LLProcess(JxlFastLosslessFrameState* frame_state, bool is_last,
     size_t num_groups = std::min(max_groups, total_groups - offset);
     JxlFastLosslessFrameState local_frame_state;
     if (streaming) {
-      local_frame_state.group_data =
-          std::vector<std::array<BitWriter, 4>>(num_groups);
+      local_frame_state.group_data = MakeGroupData(num_groups, num_channels);
     }
     auto run_one = [&](size_t i) {
       size_t g = offset + i;
@@ -4036,13 +4272,21 @@ jxl::Status LLProcess(JxlFastLosslessFrameState* frame_state, bool is_last,
                                                            xs, ys, &stride);
       const unsigned char* rgba =
           reinterpret_cast<const unsigned char*>(buffer);
+      std::vector<std::pair<const void*, size_t>> planar(
+          frame_state->num_planar_channels);
+      for (size_t c = 0; c < planar.size(); c++) {
+        planar[c].first = GetExtraChannelDataAt(
+            input, frame_state->first_planar_channel + c, x0, y0, xs, ys,
+            &planar[c].second);
+      }
 
       auto& gd = streaming ? local_frame_state.group_data[i]
                            : frame_state->group_data[group_id];
       if (frame_state->collided) {
         WriteACSection(rgba, 0, 0, xs, ys, stride, onegroup, bitdepth,
                        frame_state->nb_chans, frame_state->big_endian,
-                       frame_state->hcode, gd);
+                       frame_state->group_analysis, frame_state->predictors,
+                       frame_state->hcode, planar, gd);
       } else {
         WriteACSectionPalette(rgba, 0, 0, xs, ys, stride, onegroup,
                               frame_state->hcode, frame_state->lookup.data(),
@@ -4050,6 +4294,9 @@ jxl::Status LLProcess(JxlFastLosslessFrameState* frame_state, bool is_last,
       }
       frame_state->group_sizes[group_id] = SectionSize(gd);
       input.release_buffer(input.opaque, buffer);
+      for (const auto& channel : planar) {
+        input.release_buffer(input.opaque, channel.first);
+      }
     };
     runner(
         runner_opaque, &run_one,
@@ -4060,6 +4307,7 @@ jxl::Status LLProcess(JxlFastLosslessFrameState* frame_state, bool is_last,
 #if !FJXL_STANDALONE
     if (streaming) {
       local_frame_state.nb_chans = frame_state->nb_chans;
+      local_frame_state.num_planar_channels = frame_state->num_planar_channels;
       local_frame_state.current_bit_writer = 1;
       JXL_RETURN_IF_ERROR(
           JxlFastLosslessOutputFrame(&local_frame_state, output_processor));
@@ -4072,9 +4320,11 @@ jxl::Status LLProcess(JxlFastLosslessFrameState* frame_state, bool is_last,
     JXL_RETURN_IF_ERROR(output_processor->Seek(start_pos));
     frame_state->group_data.resize(1);
     bool have_alpha = frame_state->nb_chans == 2 || frame_state->nb_chans == 4;
+    size_t num_extra_channels =
+        (have_alpha ? 1 : 0) + frame_state->num_planar_channels;
     size_t padding = ComputeDcGlobalPadding(
         frame_state->group_sizes, frame_state->ac_group_data_offset,
-        frame_state->min_dc_global_size, have_alpha, is_last);
+        frame_state->min_dc_global_size, num_extra_channels, is_last);
 
     for (size_t i = 0; i < padding; ++i) {
       frame_state->group_data[0][0].Write(8, 0);
@@ -4101,25 +4351,29 @@ jxl::Status LLProcess(JxlFastLosslessFrameState* frame_state, bool is_last,
 
 JxlFastLosslessFrameState* JxlFastLosslessPrepareImpl(
     JxlChunkedFrameInputSource input, size_t width, size_t height,
-    size_t nb_chans, size_t bitdepth, bool big_endian, int effort,
-    int oneshot) {
+    size_t nb_chans, size_t num_planar_channels, size_t first_planar_channel,
+    size_t bitdepth, bool big_endian, int effort, int oneshot) {
   assert(bitdepth > 0);
   assert(nb_chans <= 4);
   assert(nb_chans != 0);
   if (bitdepth <= 8) {
     return LLPrepare(input, width, height, UpTo8Bits(bitdepth), nb_chans,
-                     big_endian, effort, oneshot);
+                     num_planar_channels, first_planar_channel, big_endian,
+                     effort, oneshot);
   }
   if (bitdepth <= 13) {
     return LLPrepare(input, width, height, From9To13Bits(bitdepth), nb_chans,
-                     big_endian, effort, oneshot);
+                     num_planar_channels, first_planar_channel, big_endian,
+                     effort, oneshot);
   }
   if (bitdepth == 14) {
     return LLPrepare(input, width, height, Exactly14Bits(bitdepth), nb_chans,
-                     big_endian, effort, oneshot);
+                     num_planar_channels, first_planar_channel, big_endian,
+                     effort, oneshot);
   }
   return LLPrepare(input, width, height, MoreThan14Bits(bitdepth), nb_chans,
-                   big_endian, effort, oneshot);
+                   num_planar_channels, first_planar_channel, big_endian,
+                   effort, oneshot);
 }
 
 jxl::Status JxlFastLosslessProcessFrameImpl(
@@ -4220,6 +4474,48 @@ namespace AVX512 {
 
 #endif
 
+namespace {
+
+// The SIMD implementation used for all frames, which is selected only once.
+struct FJxlImplementation {
+  decltype(&default_implementation::JxlFastLosslessPrepareImpl) prepare;
+  decltype(&default_implementation::JxlFastLosslessProcessFrameImpl) process;
+};
+
+const FJxlImplementation& GetImplementation() {
+  static const FJxlImplementation implementation = []() {
+#if FJXL_ENABLE_AVX512
+    if (HasCpuFeature(CpuFeature::kAVX512CD) &&
+        HasCpuFeature(CpuFeature::kVBMI) &&
+        HasCpuFeature(CpuFeature::kAVX512BW) &&
+        HasCpuFeature(CpuFeature::kAVX512F) &&
+        HasCpuFeature(CpuFeature::kAVX512VL)) {
+      return FJxlImplementation{AVX512::JxlFastLosslessPrepareImpl,
+                                AVX512::JxlFastLosslessProcessFrameImpl};
+    }
+#endif
+#if FJXL_ENABLE_AVX2
+    if (HasCpuFeature(CpuFeature::kAVX2)) {
+      return FJxlImplementation{AVX2::JxlFastLosslessPrepareImpl,
+                                AVX2::JxlFastLosslessProcessFrameImpl};
+    }
+#endif
+    return FJxlImplementation{
+        default_implementation::JxlFastLosslessPrepareImpl,
+        default_implementation::JxlFastLosslessProcessFrameImpl};
+  }();
+  return implementation;
+}
+
+void TrivialRunner(void*, void* opaque, void fun(void*, size_t),
+                   size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    fun(opaque, i);
+  }
+}
+
+}  // namespace
+
 extern "C" {
 
 #if FJXL_STANDALONE
@@ -4275,68 +4571,52 @@ size_t JxlFastLosslessEncode(const unsigned char* rgba, size_t width,
   JxlFastLosslessFreeFrameState(frame_state);
   return total;
 }
+
+bool JxlFastLosslessEncodeBatch(JxlFastLosslessImage* images,
+                                size_t num_images, int effort,
+                                void* runner_opaque,
+                                FJxlParallelRunner runner) {
+  if (runner == nullptr) {
+    runner = TrivialRunner;
+  }
+  std::atomic<bool> all_encoded{true};
+  auto encode_one = [&](size_t i) {
+    JxlFastLosslessImage& image = images[i];
+    image.output = nullptr;
+    // The groups of each image are encoded by the thread that runs this task.
+    image.output_size = JxlFastLosslessEncode(
+        image.rgba, image.width, image.row_stride, image.height,
+        image.nb_chans, image.bitdepth, image.big_endian, effort,
+        &image.output, nullptr, nullptr);
+    if (image.output_size == 0) all_encoded = false;
+  };
+  runner(
+      runner_opaque, &encode_one,
+      +[](void* r, size_t i) {
+        (*reinterpret_cast<decltype(&encode_one)>(r))(i);
+      },
+      num_images);
+  return all_encoded;
+}
 #endif
 
 JxlFastLosslessFrameState* JxlFastLosslessPrepareFrame(
     JxlChunkedFrameInputSource input, size_t width, size_t height,
     size_t nb_chans, size_t bitdepth, bool big_endian, int effort,
     int oneshot) {
-#if FJXL_ENABLE_AVX512
-  if (HasCpuFeature(CpuFeature::kAVX512CD) &&
-      HasCpuFeature(CpuFeature::kVBMI) &&
-      HasCpuFeature(CpuFeature::kAVX512BW) &&
-      HasCpuFeature(CpuFeature::kAVX512F) &&
-      HasCpuFeature(CpuFeature::kAVX512VL)) {
-    return AVX512::JxlFastLosslessPrepareImpl(
-        input, width, height, nb_chans, bitdepth, big_endian, effort, oneshot);
-  }
-#endif
-#if FJXL_ENABLE_AVX2
-  if (HasCpuFeature(CpuFeature::kAVX2)) {
-    return AVX2::JxlFastLosslessPrepareImpl(
-        input, width, height, nb_chans, bitdepth, big_endian, effort, oneshot);
-  }
-#endif
-
-  return default_implementation::JxlFastLosslessPrepareImpl(
-      input, width, height, nb_chans, bitdepth, big_endian, effort, oneshot);
+  return GetImplementation().prepare(
+      input, width, height, nb_chans, /*num_planar_channels=*/0,
+      /*first_planar_channel=*/0, bitdepth, big_endian, effort, oneshot);
 }
 
 bool JxlFastLosslessProcessFrame(
     JxlFastLosslessFrameState* frame_state, bool is_last, void* runner_opaque,
     FJxlParallelRunner runner,
     JxlEncoderOutputProcessorWrapper* output_processor) {
-  auto trivial_runner =
-      +[](void*, void* opaque, void fun(void*, size_t), size_t count) {
-        for (size_t i = 0; i < count; i++) {
-          fun(opaque, i);
-        }
-      };
-
   if (runner == nullptr) {
-    runner = trivial_runner;
-  }
-
-#if FJXL_ENABLE_AVX512
-  if (HasCpuFeature(CpuFeature::kAVX512CD) &&
-      HasCpuFeature(CpuFeature::kVBMI) &&
-      HasCpuFeature(CpuFeature::kAVX512BW) &&
-      HasCpuFeature(CpuFeature::kAVX512F) &&
-      HasCpuFeature(CpuFeature::kAVX512VL)) {
-    JXL_RETURN_IF_ERROR(AVX512::JxlFastLosslessProcessFrameImpl(
-        frame_state, is_last, runner_opaque, runner, output_processor));
-    return true;
+    runner = TrivialRunner;
   }
-#endif
-#if FJXL_ENABLE_AVX2
-  if (HasCpuFeature(CpuFeature::kAVX2)) {
-    JXL_RETURN_IF_ERROR(AVX2::JxlFastLosslessProcessFrameImpl(
-        frame_state, is_last, runner_opaque, runner, output_processor));
-    return true;
-  }
-#endif
-
-  JXL_RETURN_IF_ERROR(default_implementation::JxlFastLosslessProcessFrameImpl(
+  JXL_RETURN_IF_ERROR(GetImplementation().process(
       frame_state, is_last, runner_opaque, runner, output_processor));
   return true;
 }
@@ -4344,6 +4624,15 @@ bool JxlFastLosslessProcessFrame(
 }  // extern "C"
 
 #if !FJXL_STANDALONE
+JxlFastLosslessFrameState* JxlFastLosslessPrepareFrameWithExtraChannels(
+    JxlChunkedFrameInputSource input, size_t width, size_t height,
+    size_t nb_chans, size_t num_planar_channels, size_t first_planar_channel,
+    size_t bitdepth, bool big_endian, int effort, int oneshot) {
+  return GetImplementation().prepare(
+      input, width, height, nb_chans, num_planar_channels,
+      first_planar_channel, bitdepth, big_endian, effort, oneshot);
+}
+
 bool JxlFastLosslessOutputFrame(
     JxlFastLosslessFrameState* frame_state,
     JxlEncoderOutputProcessorWrapper* output_processor) {
@@ -41,6 +41,12 @@ struct JxlEncoderOutputProcessorWrapper {
 
 // Simple encoding API.
 
+// The effort mainly sets how many rows are sampled to compute the prefix codes,
+// up to all of them at 127. From this effort on, each group instead chooses the
+// predictor of each channel and gets its own prefix codes, which takes an
+// additional pass over the group per predictor.
+#define FJXL_GROUP_ANALYSIS_EFFORT 128
+
 // A FJxlParallelRunner must call fun(opaque, i) for all i from 0 to count. It
 // may do so in parallel.
 typedef void(FJxlParallelRunner)(void* runner_opaque, void* opaque,
@@ -53,6 +59,31 @@ size_t JxlFastLosslessEncode(const unsigned char* rgba, size_t width,
                              size_t bitdepth, bool big_endian, int effort,
                              unsigned char** output, void* runner_opaque,
                              FJxlParallelRunner runner);
+
+// An image of a JxlFastLosslessEncodeBatch call. `output` and `output_size`
+// are set to what JxlFastLosslessEncode gives for the image, and `output` must
+// be freed with free().
+struct JxlFastLosslessImage {
+  const unsigned char* rgba;
+  size_t width;
+  size_t row_stride;
+  size_t height;
+  size_t nb_chans;
+  size_t bitdepth;
+  bool big_endian;
+  unsigned char* output;
+  size_t output_size;
+};
+
+// Encodes many images, each of which is encoded by a single call of the
+// function given to `runner`. This is faster than calling JxlFastLosslessEncode
+// on each image with the same runner when the images are small, as the
+// overhead of running each group of an image in parallel is then larger than
+// the time spent encoding it. Returns false if any image failed to encode.
+bool JxlFastLosslessEncodeBatch(JxlFastLosslessImage* images,
+                                size_t num_images, int effort,
+                                void* runner_opaque,
+                                FJxlParallelRunner runner);
 #endif
 
 // More complex API for cases in which you may want to allocate your own buffer
@@ -109,6 +140,15 @@ void JxlFastLosslessFreeFrameState(JxlFastLosslessFrameState* frame);
 #endif
 
 #if !FJXL_STANDALONE
+// Like JxlFastLosslessPrepareFrame, but also encodes `num_planar_channels`
+// extra channels after the `nb_chans` interleaved ones, which are read with
+// get_extra_channel_data_at from extra channel index `first_planar_channel`
+// on, and have the same bit depth and sample type as the color channels.
+JxlFastLosslessFrameState* JxlFastLosslessPrepareFrameWithExtraChannels(
+    JxlChunkedFrameInputSource input, size_t width, size_t height,
+    size_t nb_chans, size_t num_planar_channels, size_t first_planar_channel,
+    size_t bitdepth, bool big_endian, int effort, int oneshot);
+
 bool JxlFastLosslessOutputFrame(
     JxlFastLosslessFrameState* frame_state,
     JxlEncoderOutputProcessorWrapper* output_process);
@@ -0,0 +1,112 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/encode.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/enc_fast_lossless.h"
+
+namespace jxl {
+namespace {
+
+struct PixelBuffer {
+  const uint8_t* data;
+  size_t row_stride;
+  size_t bytes_per_pixel;
+};
+
+const void* GetColorChannelDataAt(void* opaque, size_t xpos, size_t ypos,
+                                  size_t /*xsize*/, size_t /*ysize*/,
+                                  size_t* row_offset) {
+  const PixelBuffer* buffer = static_cast<const PixelBuffer*>(opaque);
+  *row_offset = buffer->row_stride;
+  return buffer->data + ypos * buffer->row_stride +
+         xpos * buffer->bytes_per_pixel;
+}
+
+void ReleaseBuffer(void* /*opaque*/, const void* /*buf*/) {}
+
+// Encodes a square image of size state.range() with the fast lossless encoder,
+// on the calling thread. The output is not written, only the frame is encoded.
+void BM_FastLosslessEncode(benchmark::State& state, size_t nb_chans,
+                           size_t bitdepth, int effort) {
+  const size_t xsize = state.range();
+  const size_t ysize = state.range();
+  const size_t bytes_per_pixel = nb_chans * (bitdepth > 8 ? 2 : 1);
+  // Smooth gradients with some noise, in which the predictors matter.
+  std::vector<uint8_t> pixels(xsize * ysize * bytes_per_pixel);
+  Rng rng(0);
+  const size_t max_value = (1u << bitdepth) - 1;
+  for (size_t y = 0; y < ysize; y++) {
+    for (size_t x = 0; x < xsize; x++) {
+      for (size_t c = 0; c < nb_chans; c++) {
+        size_t v = ((x + y) * (c + 1) + rng.UniformU(0, 16)) & max_value;
+        uint8_t* p = &pixels[(y * xsize + x) * bytes_per_pixel];
+        if (bitdepth > 8) {
+          p[2 * c] = v & 0xFF;
+          p[2 * c + 1] = v >> 8;
+        } else {
+          p[c] = v;
+        }
+      }
+    }
+  }
+  PixelBuffer buffer = {pixels.data(), xsize * bytes_per_pixel,
+                        bytes_per_pixel};
+  JxlChunkedFrameInputSource input = {};
+  input.opaque = &buffer;
+  input.get_color_channel_data_at = GetColorChannelDataAt;
+  input.release_buffer = ReleaseBuffer;
+
+  for (auto _ : state) {
+    JxlFastLosslessFrameState* frame_state = JxlFastLosslessPrepareFrame(
+        input, xsize, ysize, nb_chans, bitdepth, /*big_endian=*/false, effort,
+        /*oneshot=*/1);
+    if (!JxlFastLosslessProcessFrame(frame_state, /*is_last=*/true,
+                                     /*runner_opaque=*/nullptr,
+                                     /*runner=*/nullptr,
+                                     /*output_processor=*/nullptr)) {
+      JxlFastLosslessFreeFrameState(frame_state);
+      state.SkipWithError("Failed to encode frame.");
+      return;
+    }
+    benchmark::DoNotOptimize(JxlFastLosslessOutputSize(frame_state));
+    JxlFastLosslessFreeFrameState(frame_state);
+  }
+  state.SetItemsProcessed(xsize * ysize * state.iterations());
+}
+
+void BM_FastLosslessEncodeRGB8(benchmark::State& state) {
+  BM_FastLosslessEncode(state, 3, 8, /*effort=*/2);
+}
+
+void BM_FastLosslessEncodeRGB8GroupAnalysis(benchmark::State& state) {
+  BM_FastLosslessEncode(state, 3, 8, FJXL_GROUP_ANALYSIS_EFFORT);
+}
+
+void BM_FastLosslessEncodeRGBA16(benchmark::State& state) {
+  BM_FastLosslessEncode(state, 4, 16, /*effort=*/2);
+}
+
+void BM_FastLosslessEncodeRGBA16GroupAnalysis(benchmark::State& state) {
+  BM_FastLosslessEncode(state, 4, 16, FJXL_GROUP_ANALYSIS_EFFORT);
+}
+
+BENCHMARK(BM_FastLosslessEncodeRGB8)->RangeMultiplier(4)->Range(256, 2048);
+BENCHMARK(BM_FastLosslessEncodeRGB8GroupAnalysis)
+    ->RangeMultiplier(4)
+    ->Range(256, 2048);
+BENCHMARK(BM_FastLosslessEncodeRGBA16)->RangeMultiplier(4)->Range(256, 2048);
+BENCHMARK(BM_FastLosslessEncodeRGBA16GroupAnalysis)
+    ->RangeMultiplier(4)
+    ->Range(256, 2048);
+
+}  // namespace
+}  // namespace jxl
@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
@@ -41,6 +42,7 @@
 #include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_chroma_from_luma.h"
+#include "lib/jxl/enc_cluster.h"
 #include "lib/jxl/enc_coeff_order.h"
 #include "lib/jxl/enc_context_map.h"
 #include "lib/jxl/enc_entropy_coder.h"
@@ -66,10 +68,12 @@
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
 #include "lib/jxl/loop_filter.h"
 #include "lib/jxl/modular/options.h"
+#include "lib/jxl/pack_signed.h"
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/quantizer.h"
 #include "lib/jxl/splines.h"
 #include "lib/jxl/toc.h"
+#include "lib/jxl/trace_internal.h"
 
 namespace jxl {
 
@@ -105,6 +109,14 @@ Status ParamsPostInit(CompressParams* p) {
 
 namespace {
 
+// Checked between the groups of the frame, see CompressParams::cancel.
+Status CheckCancelled(const CompressParams& cparams) {
+  if (cparams.cancel != nullptr && cparams.cancel(cparams.cancel_opaque)) {
+    return JXL_FAILURE("Encoding cancelled");
+  }
+  return true;
+}
+
 template <typename T>
 uint32_t GetBitDepth(JxlBitDepth bit_depth, const T& metadata,
                      JxlPixelFormat format) {
@@ -218,7 +230,8 @@ void SetProgressiveMode(const CompressParams& cparams,
       {/*num_coefficients=*/8, /*shift=*/0,
        /*suitable_for_downsampling_of_at_least=*/0},
   };
-  bool progressive_mode = ApplyOverride(cparams.progressive_mode, false);
+  bool progressive_mode =
+      ApplyOverride(cparams.progressive_mode, cparams.progressive_layout);
   bool qprogressive_mode = ApplyOverride(cparams.qprogressive_mode, false);
   if (cparams.custom_progressive_mode) {
     progressive_splitter->SetProgressiveMode(*cparams.custom_progressive_mode);
@@ -252,6 +265,23 @@ uint64_t FrameFlagsFromParams(const CompressParams& cparams) {
   return flags;
 }
 
+// Decoding cost per pixel of the loop filters relative to Gaborish, i.e. three
+// 3x3 convolutions, from their number of operations: the EPF steps 0, 1 and 2
+// weigh 12, 4 and 4 neighbors by their distances over 5, 5 and 1 pixels.
+constexpr float kGaborishDecodeCost = 1.0f;
+constexpr float kEpfStepDecodeCost[3] = {8.0f, 2.7f, 0.9f};
+// Largest cost of the loop filters with CompressParams::decoder_fast_paths,
+// which keeps Gaborish and two EPF iterations.
+constexpr float kFastPathsLoopFilterCost = 5.0f;
+
+float LoopFilterDecodeCost(const LoopFilter& loop_filter) {
+  float cost = loop_filter.gab ? kGaborishDecodeCost : 0.0f;
+  if (loop_filter.epf_iters >= 3) cost += kEpfStepDecodeCost[0];
+  if (loop_filter.epf_iters >= 1) cost += kEpfStepDecodeCost[1];
+  if (loop_filter.epf_iters >= 2) cost += kEpfStepDecodeCost[2];
+  return cost;
+}
+
 Status LoopFilterFromParams(const CompressParams& cparams, bool streaming_mode,
                             FrameHeader* JXL_RESTRICT frame_header) {
   LoopFilter* loop_filter = &frame_header->loop_filter;
@@ -284,6 +314,18 @@ Status LoopFilterFromParams(const CompressParams& cparams, bool streaming_mode,
       }
     }
   }
+  // Drop the default EPF iterations, starting with the most expensive one,
+  // then Gaborish, until the loop filters are cheap enough to decode.
+  if (cparams.decoder_fast_paths) {
+    while (cparams.epf == -1 && loop_filter->epf_iters > 0 &&
+           LoopFilterDecodeCost(*loop_filter) > kFastPathsLoopFilterCost) {
+      loop_filter->epf_iters--;
+    }
+    if (cparams.gaborish == Override::kDefault &&
+        LoopFilterDecodeCost(*loop_filter) > kFastPathsLoopFilterCost) {
+      loop_filter->gab = false;
+    }
+  }
   // Strength of EPF in modular mode.
   if (frame_header->encoding == FrameEncoding::kModular &&
       !cparams.IsLossless()) {
@@ -1041,6 +1083,7 @@ Status ComputeJPEGTranscodingData(const jpeg::JPEGData& jpeg_data,
   // disable DC frame for now
   auto compute_dc_coeffs = [&](const uint32_t group_index,
                                size_t /* thread */) -> Status {
+    JXL_RETURN_IF_ERROR(CheckCancelled(enc_state->cparams));
     const Rect r = enc_state->shared.frame_dim.DCGroupRect(group_index);
     JXL_RETURN_IF_ERROR(enc_modular->AddVarDCTDC(frame_header, dc, r,
                                                  group_index,
@@ -1057,39 +1100,6 @@ Status ComputeJPEGTranscodingData(const jpeg::JPEGData& jpeg_data,
   return true;
 }
 
-Status ComputeVarDCTEncodingData(const FrameHeader& frame_header,
-                                 const Image3F* linear,
-                                 Image3F* JXL_RESTRICT opsin, const Rect& rect,
-                                 const JxlCmsInterface& cms, ThreadPool* pool,
-                                 ModularFrameEncoder* enc_modular,
-                                 PassesEncoderState* enc_state,
-                                 AuxOut* aux_out) {
-  JXL_ENSURE((rect.xsize() % kBlockDim) == 0 &&
-             (rect.ysize() % kBlockDim) == 0);
-  JxlMemoryManager* memory_manager = enc_state->memory_manager();
-  // Save pre-Gaborish opsin for AR control field heuristics computation.
-  Image3F orig_opsin;
-  JXL_ASSIGN_OR_RETURN(
-      orig_opsin, Image3F::Create(memory_manager, rect.xsize(), rect.ysize()));
-  JXL_RETURN_IF_ERROR(CopyImageTo(rect, *opsin, Rect(orig_opsin), &orig_opsin));
-  JXL_RETURN_IF_ERROR(orig_opsin.ShrinkTo(enc_state->shared.frame_dim.xsize,
-                                          enc_state->shared.frame_dim.ysize));
-
-  JXL_RETURN_IF_ERROR(LossyFrameHeuristics(frame_header, enc_state, enc_modular,
-                                           linear, opsin, rect, cms, pool,
-                                           aux_out));
-
-  JXL_RETURN_IF_ERROR(InitializePassesEncoder(
-      frame_header, *opsin, rect, cms, pool, enc_state, enc_modular, aux_out));
-
-  JXL_RETURN_IF_ERROR(
-      ComputeARHeuristics(frame_header, enc_state, orig_opsin, rect, pool));
-
-  JXL_RETURN_IF_ERROR(ComputeACMetadata(pool, enc_state, enc_modular));
-
-  return true;
-}
-
 Status ComputeAllCoeffOrders(PassesEncoderState& enc_state,
                              const FrameDimensions& frame_dim) {
   auto used_orders_info = ComputeUsedOrders(
@@ -1110,53 +1120,407 @@ Status ComputeAllCoeffOrders(PassesEncoderState& enc_state,
 // Working area for TokenizeCoefficients (per-group!)
 struct EncCache {
   // Allocates memory when first called.
-  Status InitOnce(JxlMemoryManager* memory_manager) {
-    if (num_nzeroes.xsize() == 0) {
-      JXL_ASSIGN_OR_RETURN(num_nzeroes,
-                           Image3I::Create(memory_manager, kGroupDimInBlocks,
-                                           kGroupDimInBlocks));
+  Status InitOnce(JxlMemoryManager* memory_manager, size_t num_passes) {
+    for (size_t i = 0; i < num_passes; i++) {
+      if (num_nzeroes[i].xsize() == 0) {
+        JXL_ASSIGN_OR_RETURN(num_nzeroes[i],
+                             Image3I::Create(memory_manager, kGroupDimInBlocks,
+                                             kGroupDimInBlocks));
+      }
     }
     return true;
   }
-  // TokenizeCoefficients
-  Image3I num_nzeroes;
+  // TokenizeCoefficients, one per pass.
+  Image3I num_nzeroes[kMaxNumPasses];
+  // Per-pass histograms of the tokens, with two_pass_ac_tokens.
+  std::vector<std::vector<Histogram>> ac_histograms;
 };
 
+// Parameters of the AC histograms of pass `i`; `num_histogram_groups` is set
+// to the number of sets of AC contexts they cover.
+HistogramParams ACHistogramParams(const PassesEncoderState& enc_state,
+                                  size_t i, size_t* num_histogram_groups) {
+  const CompressParams& cparams = enc_state.cparams;
+  const PassesSharedState& shared = enc_state.shared;
+  HistogramParams hist_params(cparams.speed_tier,
+                              shared.block_ctx_map.NumACContexts());
+  if (cparams.speed_tier > SpeedTier::kTortoise) {
+    hist_params.lz77_method = HistogramParams::LZ77Method::kNone;
+  }
+  if (cparams.decoding_speed_tier >= 1) {
+    hist_params.max_histograms = 6;
+  }
+  if (cparams.decoder_fast_paths) {
+    hist_params.max_histograms =
+        std::min<size_t>(hist_params.max_histograms, 4);
+    hist_params.lz77_method = HistogramParams::LZ77Method::kNone;
+  }
+  if (ApplyOverride(cparams.static_entropy_codes, false)) {
+    hist_params.static_codes = HistogramParams::StaticCodes::kVarDCT;
+  }
+  *num_histogram_groups = shared.num_histograms;
+  if (enc_state.streaming_mode) {
+    size_t prev_num_histograms = enc_state.passes[i].codes.encoding_info.size();
+    if (enc_state.initialize_global_state) {
+      prev_num_histograms += kNumFixedHistograms;
+      hist_params.add_fixed_histograms = true;
+    }
+    size_t remaining_histograms = kClustersLimit - prev_num_histograms;
+    // Heuristic to assign budget of new histograms to DC groups.
+    // TODO(szabadka) Tune this together with the DC group ordering.
+    size_t max_histograms = remaining_histograms < 20
+                                ? std::min<size_t>(remaining_histograms, 4)
+                                : remaining_histograms / 4;
+    hist_params.max_histograms =
+        std::min(max_histograms, hist_params.max_histograms);
+    *num_histogram_groups = 1;
+  }
+  hist_params.streaming_mode = enc_state.streaming_mode;
+  hist_params.initialize_global_state = enc_state.initialize_global_state;
+  hist_params.sample_streams =
+      cparams.sampled_histograms && !enc_state.streaming_mode;
+  return hist_params;
+}
+
+// Frames with at least this many pixels use two_pass_ac_tokens, if possible.
+constexpr size_t kMinPixelsForTwoPassACTokens = size_t{1} << 24;
+
+// Tokenizes the AC coefficients of all the passes of a group into their
+// ac_tokens, visiting the blocks of the group once.
+Status TokenizeGroupCoefficients(const FrameHeader& frame_header,
+                                 size_t group_index,
+                                 PassesEncoderState* enc_state,
+                                 EncCache* cache) {
+  PassesSharedState& shared = enc_state->shared;
+  const Rect rect = shared.frame_dim.BlockGroupRect(group_index);
+  const size_t num_passes = enc_state->passes.size();
+  JXL_ENSURE(num_passes <= kMaxNumPasses);
+  const coeff_order_t* JXL_RESTRICT orders[kMaxNumPasses];
+  const int32_t* JXL_RESTRICT ac_rows[kMaxNumPasses][3];
+  std::vector<Token> tokens[kMaxNumPasses];
+  for (size_t i = 0; i < num_passes; i++) {
+    JXL_ENSURE(enc_state->coeffs[i]->Type() == ACType::k32);
+    orders[i] = &shared.coeff_orders[i * shared.coeff_order_size];
+    for (size_t c = 0; c < 3; c++) {
+      ac_rows[i][c] = enc_state->coeffs[i]->PlaneRow(c, group_index, 0).ptr32;
+    }
+    tokens[i].swap(enc_state->passes[i].ac_tokens[group_index]);
+  }
+  // Ensure group cache is initialized.
+  JXL_RETURN_IF_ERROR(
+      cache->InitOnce(enc_state->memory_manager(), num_passes));
+  JXL_RETURN_IF_ERROR(TokenizeCoefficients(
+      num_passes, orders, rect, ac_rows, shared.ac_strategy,
+      frame_header.chroma_subsampling, cache->num_nzeroes, tokens,
+      shared.quant_dc, shared.raw_quant_field, shared.block_ctx_map));
+  for (size_t i = 0; i < num_passes; i++) {
+    tokens[i].swap(enc_state->passes[i].ac_tokens[group_index]);
+  }
+  return true;
+}
+
+// With two_pass_ac_tokens, only the histograms of the tokens are kept; the
+// tokens are computed again by EncodeGroups right before they are written.
 Status TokenizeAllCoefficients(const FrameHeader& frame_header,
                                ThreadPool* pool,
                                PassesEncoderState* enc_state) {
+  JXL_TRACE_SCOPE("TokenizeAllCoefficients");
   PassesSharedState& shared = enc_state->shared;
+  const size_t num_passes = enc_state->passes.size();
+  const bool two_pass = enc_state->two_pass_ac_tokens;
+  const size_t num_groups = shared.frame_dim.num_groups;
+  std::vector<size_t> num_contexts(num_passes);
+  // With two_pass_ac_tokens and sampled histograms, the other groups are only
+  // tokenized when they are written.
+  bool sample_groups = false;
+  for (size_t i = 0; i < num_passes; i++) {
+    size_t num_histogram_groups;
+    const HistogramParams hist_params =
+        ACHistogramParams(*enc_state, i, &num_histogram_groups);
+    sample_groups = two_pass && hist_params.sample_streams;
+    num_contexts[i] =
+        num_histogram_groups * shared.block_ctx_map.NumACContexts();
+  }
   std::vector<EncCache> group_caches;
-  JxlMemoryManager* memory_manager = enc_state->memory_manager();
   const auto tokenize_group_init = [&](const size_t num_threads) -> Status {
     group_caches.resize(num_threads);
+    if (two_pass) {
+      for (EncCache& cache : group_caches) {
+        cache.ac_histograms.resize(num_passes);
+        for (size_t i = 0; i < num_passes; i++) {
+          cache.ac_histograms[i].resize(num_contexts[i]);
+        }
+      }
+    }
     return true;
   };
   const auto tokenize_group = [&](const uint32_t group_index,
                                   const size_t thread) -> Status {
-    // Tokenize coefficients.
-    const Rect rect = shared.frame_dim.BlockGroupRect(group_index);
-    for (size_t idx_pass = 0; idx_pass < enc_state->passes.size(); idx_pass++) {
-      JXL_ENSURE(enc_state->coeffs[idx_pass]->Type() == ACType::k32);
-      const int32_t* JXL_RESTRICT ac_rows[3] = {
-          enc_state->coeffs[idx_pass]->PlaneRow(0, group_index, 0).ptr32,
-          enc_state->coeffs[idx_pass]->PlaneRow(1, group_index, 0).ptr32,
-          enc_state->coeffs[idx_pass]->PlaneRow(2, group_index, 0).ptr32,
-      };
-      // Ensure group cache is initialized.
-      JXL_RETURN_IF_ERROR(group_caches[thread].InitOnce(memory_manager));
-      JXL_RETURN_IF_ERROR(TokenizeCoefficients(
-          &shared.coeff_orders[idx_pass * shared.coeff_order_size], rect,
-          ac_rows, shared.ac_strategy, frame_header.chroma_subsampling,
-          &group_caches[thread].num_nzeroes,
-          &enc_state->passes[idx_pass].ac_tokens[group_index], shared.quant_dc,
-          shared.raw_quant_field, shared.block_ctx_map));
+    JXL_TRACE_SCOPE("TokenizeGroup", group_index);
+    JXL_RETURN_IF_ERROR(CheckCancelled(enc_state->cparams));
+    if (sample_groups && !IsSampledStream(group_index, num_groups)) {
+      return true;
+    }
+    EncCache& cache = group_caches[thread];
+    JXL_RETURN_IF_ERROR(TokenizeGroupCoefficients(frame_header, group_index,
+                                                  enc_state, &cache));
+    for (size_t idx_pass = 0; two_pass && idx_pass < num_passes; idx_pass++) {
+      std::vector<Token>& tokens =
+          enc_state->passes[idx_pass].ac_tokens[group_index];
+      AddTokensToHistograms(tokens, &cache.ac_histograms[idx_pass]);
+      std::vector<Token>().swap(tokens);
+    }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_groups, tokenize_group_init,
+                                tokenize_group, "TokenizeGroup"));
+  if (two_pass) {
+    for (size_t i = 0; i < num_passes; i++) {
+      std::vector<Histogram>& histograms = enc_state->passes[i].ac_histograms;
+      histograms.clear();
+      histograms.resize(num_contexts[i]);
+      for (const EncCache& cache : group_caches) {
+        for (size_t c = 0; c < num_contexts[i]; c++) {
+          histograms[c].AddHistogram(cache.ac_histograms[i][c]);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Rough size in bytes of the DC of the frame, from the entropy of the
+// quantized DC after gradient prediction, ignoring chroma from luma. Needs the
+// DC of the frame in shared.dc_storage.
+double EstimateDCBytes(const PassesSharedState& shared) {
+  const Image3F& dc = shared.dc_storage;
+  const HybridUintConfig uint_config;
+  double bits = 0;
+  for (size_t c = 0; c < 3; c++) {
+    const float inv_step = shared.quantizer.InvMulDC()[c];
+    Histogram histogram;
+    std::vector<int32_t> prev(dc.xsize() + 1);
+    std::vector<int32_t> cur(dc.xsize() + 1);
+    for (size_t y = 0; y < dc.ysize(); y++) {
+      const float* JXL_RESTRICT row = dc.ConstPlaneRow(c, y);
+      for (size_t x = 0; x < dc.xsize(); x++) {
+        cur[x + 1] = static_cast<int32_t>(std::lround(row[x] * inv_step));
+        const int32_t left = x > 0 ? cur[x] : prev[x + 1];
+        const int32_t top = y > 0 ? prev[x + 1] : left;
+        const int32_t topleft = x > 0 && y > 0 ? prev[x] : left;
+        const int32_t pred =
+            Clamp1(left + top - topleft, std::min(left, top),
+                   std::max(left, top));
+        uint32_t tok;
+        uint32_t nbits;
+        uint32_t raw_bits;
+        uint_config.Encode(PackSigned(cur[x + 1] - pred), &tok, &nbits,
+                           &raw_bits);
+        histogram.Add(tok);
+        bits += nbits;
+      }
+      std::swap(prev, cur);
+    }
+    bits += histogram.ShannonEntropy();
+  }
+  return bits / kBitsPerByte;
+}
+
+// Estimates the size in bytes of the AC coefficients of all passes from the
+// entropy of their tokens, with one histogram per context, and the raw bits
+// of the tokens. The tokens are not kept.
+StatusOr<double> EstimateACBytes(const FrameHeader& frame_header,
+                                 ThreadPool* pool,
+                                 PassesEncoderState* enc_state) {
+  PassesSharedState& shared = enc_state->shared;
+  const size_t num_passes = enc_state->passes.size();
+  const size_t num_contexts = shared.block_ctx_map.NumACContexts();
+  std::vector<EncCache> group_caches;
+  std::vector<double> raw_bits;
+  const auto init = [&](const size_t num_threads) -> Status {
+    group_caches.resize(num_threads);
+    for (EncCache& cache : group_caches) {
+      cache.ac_histograms.resize(1);
+      cache.ac_histograms[0].resize(num_passes * num_contexts);
     }
+    raw_bits.resize(num_threads);
     return true;
   };
-  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, shared.frame_dim.num_groups,
-                                tokenize_group_init, tokenize_group,
-                                "TokenizeGroup"));
+  const auto tokenize_group = [&](const uint32_t group_index,
+                                  const size_t thread) -> Status {
+    EncCache& cache = group_caches[thread];
+    const HybridUintConfig uint_config;
+    JXL_RETURN_IF_ERROR(TokenizeGroupCoefficients(frame_header, group_index,
+                                                  enc_state, &cache));
+    for (size_t idx_pass = 0; idx_pass < num_passes; idx_pass++) {
+      std::vector<Token>& tokens =
+          enc_state->passes[idx_pass].ac_tokens[group_index];
+      std::vector<Histogram>& histograms = cache.ac_histograms[0];
+      for (const Token& token : tokens) {
+        uint32_t tok;
+        uint32_t nbits;
+        uint32_t bits;
+        uint_config.Encode(token.value, &tok, &nbits, &bits);
+        histograms[idx_pass * num_contexts + token.context].Add(tok);
+        raw_bits[thread] += nbits;
+      }
+      std::vector<Token>().swap(tokens);
+    }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, shared.frame_dim.num_groups, init,
+                                tokenize_group, "EstimateACBytes"));
+  double bits = std::accumulate(raw_bits.begin(), raw_bits.end(), 0.0);
+  for (size_t c = 0; c < num_passes * num_contexts; c++) {
+    Histogram histogram;
+    for (const EncCache& cache : group_caches) {
+      histogram.AddHistogram(cache.ac_histograms[0][c]);
+    }
+    bits += histogram.ShannonEntropy();
+  }
+  return bits / kBitsPerByte;
+}
+
+// Searches the scale of the AC quantization of the frame so that its estimated
+// size is close to, and if possible not above, cparams.target_size. The AC
+// strategy and the quant field found by the heuristics are kept; each probe
+// only computes and tokenizes the coefficients again with another global
+// scale, and the DC quantization does not change. The result is stored in
+// cparams.quant_ac_rescale, which InitializePassesEncoder applies.
+Status FindACScaleForTargetSize(const FrameHeader& frame_header,
+                                const Image3F& opsin, const Rect& rect,
+                                const JxlCmsInterface& cms, ThreadPool* pool,
+                                PassesEncoderState* enc_state) {
+  JxlMemoryManager* memory_manager = enc_state->memory_manager();
+  PassesSharedState& shared = enc_state->shared;
+  CompressParams& cparams = enc_state->cparams;
+  const Quantizer quantizer = shared.quantizer;
+  float inv_dc_quant[3];
+  for (size_t c = 0; c < 3; c++) {
+    inv_dc_quant[c] = shared.matrices.InvDCQuant(c);
+  }
+  const size_t num_special_frames = enc_state->special_frames.size();
+  const uint32_t used_acs = enc_state->used_acs;
+  const auto restore = [&]() -> Status {
+    shared.quantizer = quantizer;
+    enc_state->used_acs = used_acs;
+    JXL_RETURN_IF_ERROR(DequantMatricesSetCustomDC(
+        memory_manager, &shared.matrices, inv_dc_quant));
+    shared.quantizer.RecomputeFromGlobalScale();
+    enc_state->special_frames.resize(num_special_frames);
+    return true;
+  };
+
+  double dc_bytes = 0;
+  const auto probe = [&](float rescale) -> StatusOr<double> {
+    JXL_RETURN_IF_ERROR(restore());
+    cparams.quant_ac_rescale = rescale;
+    JXL_ASSIGN_OR_RETURN(
+        ModularFrameEncoder modular_frame_encoder,
+        ModularFrameEncoder::Create(memory_manager, frame_header, cparams,
+                                    false));
+    JXL_RETURN_IF_ERROR(InitializePassesEncoder(frame_header, opsin, rect, cms,
+                                                pool, enc_state,
+                                                &modular_frame_encoder,
+                                                nullptr));
+    JXL_RETURN_IF_ERROR(ComputeAllCoeffOrders(*enc_state, shared.frame_dim));
+    // The DC quantization is the same for all probes.
+    if (dc_bytes == 0) dc_bytes = EstimateDCBytes(shared);
+    JXL_ASSIGN_OR_RETURN(double ac_bytes,
+                         EstimateACBytes(frame_header, pool, enc_state));
+    return dc_bytes + ac_bytes;
+  };
+
+  // The size grows roughly as a power of the scale: the exponent is estimated
+  // from the last two probes, and the probes bisect the bracket of the target
+  // once it is known.
+  constexpr int kMaxTargetSizeIters = 6;
+  constexpr double kTolerance = 0.02;
+  const double target = cparams.target_size;
+  const float base_rescale = cparams.quant_ac_rescale;
+  const float global_scale = quantizer.GetParams().global_scale;
+  const float min_rescale =
+      std::max(base_rescale / 16.0f, 2.0f / global_scale);
+  const float max_rescale =
+      std::min(base_rescale * 16.0f, (1 << 15) / global_scale);
+  float lo = 0;  // Largest scale known to be within the target.
+  float hi = 0;  // Smallest scale known to be above the target.
+  float best = 0;
+  float rescale = base_rescale;
+  float prev_rescale = 0;
+  double prev_bytes = 0;
+  for (int i = 0; i < kMaxTargetSizeIters; ++i) {
+    JXL_ASSIGN_OR_RETURN(double bytes, probe(rescale));
+    if (bytes <= target) {
+      lo = std::max(lo, rescale);
+      best = lo;
+    } else {
+      hi = hi == 0 ? rescale : std::min(hi, rescale);
+      if (lo == 0) best = best == 0 ? rescale : std::min(best, rescale);
+    }
+    if (std::abs(bytes - target) <= kTolerance * target) break;
+    double exponent = 1.0;
+    if (prev_rescale != 0 && prev_rescale != rescale &&
+        prev_bytes != bytes) {
+      exponent =
+          std::log(bytes / prev_bytes) / std::log(rescale / prev_rescale);
+      exponent = std::min(std::max(exponent, 0.25), 4.0);
+    }
+    float next =
+        rescale * std::pow(target / std::max(bytes, 1.0), 1.0 / exponent);
+    if (lo != 0 && hi != 0 && (next <= lo || next >= hi)) {
+      next = std::sqrt(lo * hi);
+    }
+    next = std::min(std::max(next, min_rescale), max_rescale);
+    if (std::abs(next - rescale) <= 1e-3f * rescale) break;
+    prev_rescale = rescale;
+    prev_bytes = bytes;
+    rescale = next;
+  }
+  JXL_RETURN_IF_ERROR(restore());
+  cparams.quant_ac_rescale = best;
+  return true;
+}
+
+Status ComputeVarDCTEncodingData(const FrameHeader& frame_header,
+                                 const Image3F* linear,
+                                 Image3F* JXL_RESTRICT opsin, const Rect& rect,
+                                 const JxlCmsInterface& cms, ThreadPool* pool,
+                                 ModularFrameEncoder* enc_modular,
+                                 PassesEncoderState* enc_state,
+                                 AuxOut* aux_out) {
+  JXL_TRACE_SCOPE("ComputeVarDCTEncodingData");
+  JXL_ENSURE((rect.xsize() % kBlockDim) == 0 &&
+             (rect.ysize() % kBlockDim) == 0);
+  JxlMemoryManager* memory_manager = enc_state->memory_manager();
+  // Save pre-Gaborish opsin for AR control field heuristics computation.
+  Image3F orig_opsin;
+  JXL_ASSIGN_OR_RETURN(
+      orig_opsin, Image3F::Create(memory_manager, rect.xsize(), rect.ysize()));
+  JXL_RETURN_IF_ERROR(CopyImageTo(rect, *opsin, Rect(orig_opsin), &orig_opsin));
+  JXL_RETURN_IF_ERROR(orig_opsin.ShrinkTo(enc_state->shared.frame_dim.xsize,
+                                          enc_state->shared.frame_dim.ysize));
+
+  JXL_RETURN_IF_ERROR(LossyFrameHeuristics(frame_header, enc_state, enc_modular,
+                                           linear, opsin, rect, cms, pool,
+                                           aux_out));
+
+  if (enc_state->cparams.target_size > 0 && !enc_state->streaming_mode &&
+      !(frame_header.flags & FrameHeader::kUseDcFrame)) {
+    JXL_RETURN_IF_ERROR(
+        FindACScaleForTargetSize(frame_header, *opsin, rect, cms, pool,
+                                 enc_state));
+  }
+
+  JXL_RETURN_IF_ERROR(InitializePassesEncoder(
+      frame_header, *opsin, rect, cms, pool, enc_state, enc_modular, aux_out));
+  enc_state->dct_cache = Image3F();
+
+  JXL_RETURN_IF_ERROR(
+      ComputeARHeuristics(frame_header, enc_state, orig_opsin, rect, pool));
+
+  JXL_RETURN_IF_ERROR(ComputeACMetadata(pool, enc_state, enc_modular));
+
   return true;
 }
 
@@ -1176,7 +1540,8 @@ Status EncodeGlobalDCInfo(const PassesSharedState& shared, BitWriter* writer,
 // saves the histogram bitstreams in enc_state, the actual AC global bitstream
 // is written in OutputAcGlobal() function after all the groups are processed.
 Status EncodeGlobalACInfo(PassesEncoderState* enc_state, BitWriter* writer,
-                          ModularFrameEncoder* enc_modular, AuxOut* aux_out) {
+                          ModularFrameEncoder* enc_modular, ThreadPool* pool,
+                          AuxOut* aux_out) {
   PassesSharedState& shared = enc_state->shared;
   JxlMemoryManager* memory_manager = enc_state->memory_manager();
   JXL_RETURN_IF_ERROR(DequantMatricesEncode(memory_manager, shared.matrices,
@@ -1208,42 +1573,39 @@ Status EncodeGlobalACInfo(PassesEncoderState* enc_state, BitWriter* writer,
     }
 
     // Encode histograms.
-    HistogramParams hist_params(enc_state->cparams.speed_tier,
-                                shared.block_ctx_map.NumACContexts());
-    if (enc_state->cparams.speed_tier > SpeedTier::kTortoise) {
-      hist_params.lz77_method = HistogramParams::LZ77Method::kNone;
-    }
-    if (enc_state->cparams.decoding_speed_tier >= 1) {
-      hist_params.max_histograms = 6;
-    }
-    size_t num_histogram_groups = shared.num_histograms;
-    if (enc_state->streaming_mode) {
-      size_t prev_num_histograms =
-          enc_state->passes[i].codes.encoding_info.size();
-      if (enc_state->initialize_global_state) {
-        prev_num_histograms += kNumFixedHistograms;
-        hist_params.add_fixed_histograms = true;
-      }
-      size_t remaining_histograms = kClustersLimit - prev_num_histograms;
-      // Heuristic to assign budget of new histograms to DC groups.
-      // TODO(szabadka) Tune this together with the DC group ordering.
-      size_t max_histograms = remaining_histograms < 20
-                                  ? std::min<size_t>(remaining_histograms, 4)
-                                  : remaining_histograms / 4;
-      hist_params.max_histograms =
-          std::min(max_histograms, hist_params.max_histograms);
-      num_histogram_groups = 1;
-    }
-    hist_params.streaming_mode = enc_state->streaming_mode;
-    hist_params.initialize_global_state = enc_state->initialize_global_state;
-    JXL_ASSIGN_OR_RETURN(
-        size_t cost,
-        BuildAndEncodeHistograms(
-            memory_manager, hist_params,
-            num_histogram_groups * shared.block_ctx_map.NumACContexts(),
-            enc_state->passes[i].ac_tokens, &enc_state->passes[i].codes,
-            &enc_state->passes[i].context_map, writer, LayerType::Ac, aux_out));
+    size_t num_histogram_groups;
+    HistogramParams hist_params =
+        ACHistogramParams(*enc_state, i, &num_histogram_groups);
+    hist_params.pool = pool;
+    FrameHeuristicsHistory* history =
+        enc_state->streaming_mode ? nullptr
+                                  : enc_state->cparams.heuristics_history;
+    if (history != nullptr && history->ac_context_maps.size() > i) {
+      hist_params.initial_context_map = &history->ac_context_maps[i];
+    }
+    PassesEncoderState::PassData& pass = enc_state->passes[i];
+    size_t cost;
+    if (enc_state->two_pass_ac_tokens) {
+      JXL_ASSIGN_OR_RETURN(
+          cost, BuildAndEncodeHistogramsFromCounts(
+                    memory_manager, hist_params, std::move(pass.ac_histograms),
+                    &pass.codes, &pass.context_map, writer, LayerType::Ac,
+                    aux_out));
+      pass.ac_histograms.clear();
+    } else {
+      JXL_ASSIGN_OR_RETURN(
+          cost, BuildAndEncodeHistograms(
+                    memory_manager, hist_params,
+                    num_histogram_groups * shared.block_ctx_map.NumACContexts(),
+                    pass.ac_tokens, &pass.codes, &pass.context_map, writer,
+                    LayerType::Ac, aux_out));
+    }
     (void)cost;
+    if (history != nullptr) {
+      history->ac_context_maps.resize(
+          std::max(history->ac_context_maps.size(), i + 1));
+      history->ac_context_maps[i] = pass.context_map;
+    }
   }
 
   return true;
@@ -1254,6 +1616,7 @@ Status EncodeGroups(const FrameHeader& frame_header,
                     ModularFrameEncoder* enc_modular, ThreadPool* pool,
                     std::vector<std::unique_ptr<BitWriter>>* group_codes,
                     AuxOut* aux_out) {
+  JXL_TRACE_SCOPE("EncodeGroups");
   const PassesSharedState& shared = enc_state->shared;
   JxlMemoryManager* memory_manager = shared.memory_manager;
   const FrameDimensions& frame_dim = shared.frame_dim;
@@ -1302,8 +1665,8 @@ Status EncodeGroups(const FrameHeader& frame_header,
     if (frame_header.encoding == FrameEncoding::kVarDCT) {
       JXL_RETURN_IF_ERROR(EncodeGlobalDCInfo(shared, get_output(0), aux_out));
     }
-    JXL_RETURN_IF_ERROR(enc_modular->EncodeGlobalInfo(enc_state->streaming_mode,
-                                                      get_output(0), aux_out));
+    JXL_RETURN_IF_ERROR(enc_modular->EncodeGlobalInfo(
+        enc_state->streaming_mode, get_output(0), pool, aux_out));
     JXL_RETURN_IF_ERROR(enc_modular->EncodeStream(get_output(0), aux_out,
                                                   LayerType::ModularGlobal,
                                                   ModularStreamId::Global()));
@@ -1329,6 +1692,7 @@ Status EncodeGroups(const FrameHeader& frame_header,
   std::atomic<bool> has_error{false};
   const auto process_dc_group = [&](const uint32_t group_index,
                                     const size_t thread) -> Status {
+    JXL_RETURN_IF_ERROR(CheckCancelled(enc_state->cparams));
     AuxOut* my_aux_out = aux_outs[thread].get();
     uint32_t input_index = enc_state->streaming_mode ? 0 : group_index;
     BitWriter* output = get_output(input_index + 1);
@@ -1371,12 +1735,19 @@ Status EncodeGroups(const FrameHeader& frame_header,
   }
   if (has_error) return JXL_FAILURE("EncodeDCGroup failed");
   if (frame_header.encoding == FrameEncoding::kVarDCT) {
-    JXL_RETURN_IF_ERROR(EncodeGlobalACInfo(
-        enc_state, get_output(global_ac_index), enc_modular, aux_out));
+    JXL_RETURN_IF_ERROR(EncodeGlobalACInfo(enc_state,
+                                           get_output(global_ac_index),
+                                           enc_modular, pool, aux_out));
   }
 
+  std::vector<EncCache> group_caches;
+  const auto process_group_init = [&](const size_t num_threads) -> Status {
+    group_caches.resize(num_threads);
+    return resize_aux_outs(num_threads);
+  };
   const auto process_group = [&](const uint32_t group_index,
                                  const size_t thread) -> Status {
+    JXL_RETURN_IF_ERROR(CheckCancelled(enc_state->cparams));
     AuxOut* my_aux_out = aux_outs[thread].get();
 
     size_t ac_group_id =
@@ -1385,6 +1756,11 @@ Status EncodeGroups(const FrameHeader& frame_header,
                   enc_state->dc_group_index, group_index, shared.frame_dim)
             : group_index;
 
+    if (frame_header.encoding == FrameEncoding::kVarDCT &&
+        enc_state->two_pass_ac_tokens) {
+      JXL_RETURN_IF_ERROR(TokenizeGroupCoefficients(
+          frame_header, group_index, enc_state, &group_caches[thread]));
+    }
     for (size_t i = 0; i < num_passes; i++) {
       JXL_DEBUG_V(2, "Encoding AC group %u [abs %" PRIuS "] pass %" PRIuS,
                   group_index, ac_group_id, i);
@@ -1392,6 +1768,11 @@ Status EncodeGroups(const FrameHeader& frame_header,
         JXL_RETURN_IF_ERROR(EncodeGroupTokenizedCoefficients(
             group_index, i, enc_state->histogram_idx[group_index], *enc_state,
             ac_group_code(i, group_index), my_aux_out));
+        if (enc_state->two_pass_ac_tokens) {
+          std::vector<Token>& tokens =
+              enc_state->passes[i].ac_tokens[group_index];
+          std::vector<Token>().swap(tokens);
+        }
       }
       // Write all modular encoded data (color?, alpha, depth, extra channels)
       JXL_RETURN_IF_ERROR(enc_modular->EncodeStream(
@@ -1405,7 +1786,7 @@ Status EncodeGroups(const FrameHeader& frame_header,
     }
     return true;
   };
-  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_groups, resize_aux_outs,
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_groups, process_group_init,
                                 process_group, "EncodeGroupCoefficients"));
   // Resizing aux_outs to 0 also Assimilates the array.
   static_cast<void>(resize_aux_outs(0));
@@ -1427,6 +1808,7 @@ Status ComputeEncodingData(
     FrameHeader& mutable_frame_header, ModularFrameEncoder& enc_modular,
     PassesEncoderState& enc_state,
     std::vector<std::unique_ptr<BitWriter>>* group_codes, AuxOut* aux_out) {
+  JXL_TRACE_SCOPE("ComputeEncodingData");
   JXL_ENSURE(x0 + xsize <= frame_data.xsize);
   JXL_ENSURE(y0 + ysize <= frame_data.ysize);
   JxlMemoryManager* memory_manager = enc_state.memory_manager();
@@ -1502,9 +1884,30 @@ Status ComputeEncodingData(
   }
   ImageF* alpha = alpha_eci ? &extra_channels[alpha_idx] : nullptr;
   ImageF* black = black_eci ? &extra_channels[black_idx] : nullptr;
+  const bool to_xyb = !jpeg_data &&
+                      frame_header.color_transform == ColorTransform::kXYB &&
+                      frame_info.ib_needs_color_transform;
+  const bool need_linear = to_xyb &&
+                           frame_header.encoding == FrameEncoding::kVarDCT &&
+                           (cparams.speed_tier <= SpeedTier::kKitten ||
+                            cparams.target_butteraugli_score > 0);
+  // The analysis of a previous encoding of the frame replaces the conversion
+  // of the input, if it has everything this encoding needs.
+  FrameAnalysis* analysis =
+      to_xyb && !enc_state.streaming_mode ? cparams.analysis : nullptr;
+  const bool reuse_analysis =
+      analysis != nullptr && analysis->opsin.xsize() == patch_rect.xsize() &&
+      analysis->opsin.ysize() == patch_rect.ysize() &&
+      (!analysis->has_interleaved_alpha || alpha != nullptr);
   bool has_interleaved_alpha = false;
   JxlChunkedFrameInputSource input = frame_data.GetInputSource();
-  if (!jpeg_data) {
+  if (reuse_analysis) {
+    JXL_RETURN_IF_ERROR(CopyImageTo(analysis->opsin, &color));
+    has_interleaved_alpha = analysis->has_interleaved_alpha;
+    if (has_interleaved_alpha) {
+      JXL_RETURN_IF_ERROR(CopyImageTo(analysis->alpha, alpha));
+    }
+  } else if (!jpeg_data) {
     JXL_RETURN_IF_ERROR(CopyColorChannels(input, patch_rect, frame_info,
                                           metadata->m, pool, &color, alpha,
                                           &has_interleaved_alpha));
@@ -1519,17 +1922,43 @@ Status ComputeEncodingData(
   Image3F* linear = nullptr;
 
   if (!jpeg_data) {
-    if (frame_header.color_transform == ColorTransform::kXYB &&
-        frame_info.ib_needs_color_transform) {
-      if (frame_header.encoding == FrameEncoding::kVarDCT &&
-          cparams.speed_tier <= SpeedTier::kKitten) {
+    if (to_xyb) {
+      // The linear image is always kept in the analysis, for the encodings
+      // that need it.
+      if (need_linear || (analysis != nullptr && !reuse_analysis)) {
         JXL_ASSIGN_OR_RETURN(linear_storage,
                              Image3F::Create(memory_manager, patch_rect.xsize(),
                                              patch_rect.ysize()));
-        linear = &linear_storage;
       }
-      JXL_RETURN_IF_ERROR(ToXYB(c_enc, metadata->m.IntensityTarget(), black,
-                                pool, &color, cms, linear));
+      if (reuse_analysis) {
+        if (need_linear) {
+          JXL_RETURN_IF_ERROR(CopyImageTo(analysis->linear, &linear_storage));
+        }
+      } else {
+        if (analysis != nullptr && has_interleaved_alpha) {
+          JXL_ASSIGN_OR_RETURN(analysis->alpha,
+                               ImageF::Create(memory_manager, alpha->xsize(),
+                                              alpha->ysize()));
+          JXL_RETURN_IF_ERROR(CopyImageTo(*alpha, &analysis->alpha));
+        }
+        Image3F* xyb_linear =
+            linear_storage.xsize() != 0 ? &linear_storage : nullptr;
+        JXL_RETURN_IF_ERROR(ToXYB(c_enc, metadata->m.IntensityTarget(), black,
+                                  pool, &color, cms, xyb_linear));
+        if (analysis != nullptr) {
+          JXL_ASSIGN_OR_RETURN(analysis->opsin,
+                               Image3F::Create(memory_manager, color.xsize(),
+                                               color.ysize()));
+          JXL_RETURN_IF_ERROR(CopyImageTo(color, &analysis->opsin));
+          JXL_ASSIGN_OR_RETURN(analysis->linear,
+                               Image3F::Create(memory_manager,
+                                               linear_storage.xsize(),
+                                               linear_storage.ysize()));
+          JXL_RETURN_IF_ERROR(CopyImageTo(linear_storage, &analysis->linear));
+          analysis->has_interleaved_alpha = has_interleaved_alpha;
+        }
+      }
+      if (need_linear) linear = &linear_storage;
     } else {
       // Nothing to do.
       // RGB or YCbCr: forward YCbCr is not implemented, this is only used when
@@ -1597,6 +2026,17 @@ Status ComputeEncodingData(
       shared.num_histograms = 1;
       enc_state.histogram_idx.resize(frame_dim.num_groups);
     }
+    // Large frames whose AC histograms only depend on the token counts do not
+    // keep all of their tokens in memory.
+    enc_state.two_pass_ac_tokens =
+        frame_data.xsize * frame_data.ysize >= kMinPixelsForTwoPassACTokens;
+    for (size_t i = 0; i < enc_state.passes.size(); i++) {
+      size_t num_histogram_groups;
+      if (!CanBuildHistogramsFromCounts(
+              ACHistogramParams(enc_state, i, &num_histogram_groups))) {
+        enc_state.two_pass_ac_tokens = false;
+      }
+    }
     JXL_RETURN_IF_ERROR(
         TokenizeAllCoefficients(frame_header, pool, &enc_state));
   }
@@ -1608,11 +2048,13 @@ Status ComputeEncodingData(
         /*do_color=*/cparams.modular_mode));
   }
 
+  // Use local trees if doing lossless modular, unless at very slow speeds.
+  const bool global_tree =
+      cparams.speed_tier < SpeedTier::kTortoise ||
+      !cparams.ModularPartIsLossless() || cparams.responsive ||
+      !cparams.custom_fixed_tree.empty() || cparams.ma_tree_out != nullptr;
   if (!enc_state.streaming_mode) {
-    if (cparams.speed_tier < SpeedTier::kTortoise ||
-        !cparams.ModularPartIsLossless() || cparams.responsive ||
-        !cparams.custom_fixed_tree.empty()) {
-      // Use local trees if doing lossless modular, unless at very slow speeds.
+    if (global_tree) {
       JXL_RETURN_IF_ERROR(enc_modular.ComputeTree(pool));
       JXL_RETURN_IF_ERROR(enc_modular.ComputeTokens(pool));
     }
@@ -1620,6 +2062,14 @@ Status ComputeEncodingData(
                                     FrameHeader::kPatches);
     mutable_frame_header.UpdateFlag(shared.image_features.splines.HasAny(),
                                     FrameHeader::kSplines);
+  } else if (global_tree && cparams.modular_mode) {
+    // The tree is learned from the first DC group only, and then used for the
+    // following ones as they stream in, so that samples are never collected
+    // from more than one DC group.
+    if (enc_state.initialize_global_state) {
+      JXL_RETURN_IF_ERROR(enc_modular.ComputeTree(pool));
+    }
+    JXL_RETURN_IF_ERROR(enc_modular.ComputeTokens(pool));
   }
 
   JXL_RETURN_IF_ERROR(EncodeGroups(frame_header, &enc_state, &enc_modular, pool,
@@ -1633,19 +2083,62 @@ Status ComputeEncodingData(
   return true;
 }
 
+// Sorts `order`, groups of `group_dim` pixels with the top-left corners given
+// by `group_origin`, center-first: in concentric squares around the group
+// that contains (imag_cx, imag_cy), clockwise from its closest side.
+template <typename GroupOrigin>
+void SortCenterFirst(int64_t imag_cx, int64_t imag_cy, int64_t group_dim,
+                     const GroupOrigin& group_origin,
+                     std::vector<coeff_order_t>* order) {
+  // The center of the group containing the center of the image.
+  int64_t cx = (imag_cx / group_dim) * group_dim + group_dim / 2;
+  int64_t cy = (imag_cy / group_dim) * group_dim + group_dim / 2;
+  // This identifies in what area of the central group the center of the image
+  // lies in.
+  double direction = -std::atan2(imag_cy - cy, imag_cx - cx);
+  // This identifies the side of the central group the center of the image
+  // lies closest to. This can take values 0, 1, 2, 3 corresponding to left,
+  // bottom, right, top.
+  int64_t side = std::fmod((direction + 5 * kPi / 4), 2 * kPi) * 2 / kPi;
+  auto get_distance_from_center = [&](size_t gid) {
+    const std::pair<int64_t, int64_t> origin = group_origin(gid);
+    int64_t gcx = origin.first + group_dim / 2;
+    int64_t gcy = origin.second + group_dim / 2;
+    int64_t dx = gcx - cx;
+    int64_t dy = gcy - cy;
+    // The angle is determined by taking atan2 and adding an appropriate
+    // starting point depending on the side we want to start on.
+    double angle = std::remainder(
+        std::atan2(dy, dx) + kPi / 4 + side * (kPi / 2), 2 * kPi);
+    // Concentric squares in clockwise order.
+    return std::make_pair(std::max(std::abs(dx), std::abs(dy)), angle);
+  };
+  std::sort(order->begin(), order->end(),
+            [&](coeff_order_t a, coeff_order_t b) {
+              return get_distance_from_center(a) < get_distance_from_center(b);
+            });
+}
+
+// Returns the position of each element of `order`.
+std::vector<coeff_order_t> InverseOrder(
+    const std::vector<coeff_order_t>& order) {
+  std::vector<coeff_order_t> inverse(order.size(), 0);
+  for (size_t i = 0; i < order.size(); i++) {
+    inverse[order[i]] = i;
+  }
+  return inverse;
+}
+
 Status PermuteGroups(const CompressParams& cparams,
                      const FrameDimensions& frame_dim, size_t num_passes,
                      std::vector<coeff_order_t>* permutation,
                      std::vector<std::unique_ptr<BitWriter>>* group_codes) {
   const size_t num_groups = frame_dim.num_groups;
-  if (!cparams.centerfirst || (num_passes == 1 && num_groups == 1)) {
+  const size_t num_dc_groups = frame_dim.num_dc_groups;
+  if (!(cparams.centerfirst || cparams.progressive_layout) ||
+      (num_passes == 1 && num_groups == 1)) {
     return true;
   }
-  // Don't permute global DC/AC or DC.
-  permutation->resize(frame_dim.num_dc_groups + 2);
-  std::iota(permutation->begin(), permutation->end(), 0);
-  std::vector<coeff_order_t> ac_group_order(num_groups);
-  std::iota(ac_group_order.begin(), ac_group_order.end(), 0);
   size_t group_dim = frame_dim.group_dim;
 
   // The center of the image is either given by parameters or chosen
@@ -1668,37 +2161,37 @@ Status PermuteGroups(const CompressParams& cparams,
     imag_cy = frame_dim.ysize / 2;
   }
 
-  // The center of the group containing the center of the image.
-  int64_t cx = (imag_cx / group_dim) * group_dim + group_dim / 2;
-  int64_t cy = (imag_cy / group_dim) * group_dim + group_dim / 2;
-  // This identifies in what area of the central group the center of the image
-  // lies in.
-  double direction = -std::atan2(imag_cy - cy, imag_cx - cx);
-  // This identifies the side of the central group the center of the image
-  // lies closest to. This can take values 0, 1, 2, 3 corresponding to left,
-  // bottom, right, top.
-  int64_t side = std::fmod((direction + 5 * kPi / 4), 2 * kPi) * 2 / kPi;
-  auto get_distance_from_center = [&](size_t gid) {
-    Rect r = frame_dim.GroupRect(gid);
-    int64_t gcx = r.x0() + group_dim / 2;
-    int64_t gcy = r.y0() + group_dim / 2;
-    int64_t dx = gcx - cx;
-    int64_t dy = gcy - cy;
-    // The angle is determined by taking atan2 and adding an appropriate
-    // starting point depending on the side we want to start on.
-    double angle = std::remainder(
-        std::atan2(dy, dx) + kPi / 4 + side * (kPi / 2), 2 * kPi);
-    // Concentric squares in clockwise order.
-    return std::make_pair(std::max(std::abs(dx), std::abs(dy)), angle);
-  };
-  std::sort(ac_group_order.begin(), ac_group_order.end(),
-            [&](coeff_order_t a, coeff_order_t b) {
-              return get_distance_from_center(a) < get_distance_from_center(b);
-            });
-  std::vector<coeff_order_t> inv_ac_group_order(ac_group_order.size(), 0);
-  for (size_t i = 0; i < ac_group_order.size(); i++) {
-    inv_ac_group_order[ac_group_order[i]] = i;
+  // Global DC/AC stay in place, and so does DC unless the frame is laid out
+  // for progressive delivery.
+  permutation->resize(num_dc_groups + 2);
+  std::iota(permutation->begin(), permutation->end(), 0);
+  if (cparams.progressive_layout && num_dc_groups > 1) {
+    std::vector<coeff_order_t> dc_group_order(num_dc_groups);
+    std::iota(dc_group_order.begin(), dc_group_order.end(), 0);
+    SortCenterFirst(
+        imag_cx, imag_cy, frame_dim.dc_group_dim,
+        [&](size_t gid) {
+          Rect r = frame_dim.DCGroupRect(gid);
+          return std::make_pair<int64_t, int64_t>(r.x0() * kBlockDim,
+                                                  r.y0() * kBlockDim);
+        },
+        &dc_group_order);
+    std::vector<coeff_order_t> inv_dc_group_order =
+        InverseOrder(dc_group_order);
+    for (size_t i = 0; i < num_dc_groups; i++) {
+      (*permutation)[1 + i] = 1 + inv_dc_group_order[i];
+    }
   }
+  std::vector<coeff_order_t> ac_group_order(num_groups);
+  std::iota(ac_group_order.begin(), ac_group_order.end(), 0);
+  SortCenterFirst(
+      imag_cx, imag_cy, group_dim,
+      [&](size_t gid) {
+        Rect r = frame_dim.GroupRect(gid);
+        return std::make_pair<int64_t, int64_t>(r.x0(), r.y0());
+      },
+      &ac_group_order);
+  std::vector<coeff_order_t> inv_ac_group_order = InverseOrder(ac_group_order);
   for (size_t i = 0; i < num_passes; i++) {
     size_t pass_start = permutation->size();
     for (coeff_order_t v : inv_ac_group_order) {
@@ -1745,6 +2238,10 @@ bool CanDoStreamingEncoding(const CompressParams& cparams,
   if (cparams.progressive_dc != 0 || frame_info.dc_level != 0) {
     return false;
   }
+  // The sections are reordered once the whole frame is encoded.
+  if (cparams.progressive_layout) {
+    return false;
+  }
   if (cparams.resampling != 1 || cparams.ec_resampling != 1) {
     return false;
   }
@@ -2147,14 +2644,17 @@ Status EncodeFrame(JxlMemoryManager* memory_manager,
                    const JxlCmsInterface& cms, ThreadPool* pool,
                    JxlEncoderOutputProcessorWrapper* output_processor,
                    AuxOut* aux_out) {
+  JXL_TRACE_SCOPE("EncodeFrame");
   CompressParams cparams = cparams_orig;
   if (cparams.speed_tier == SpeedTier::kTectonicPlate &&
       !cparams.IsLossless()) {
     cparams.speed_tier = SpeedTier::kGlacier;
   }
-  // Lightning mode is handled externally, so switch to Thunder mode to handle
-  // potentially weird cases.
-  if (cparams.speed_tier == SpeedTier::kLightning) {
+  // Lossless Lightning mode is handled externally, so switch to Thunder mode to
+  // handle potentially weird cases. Lossy VarDCT frames keep Lightning mode,
+  // which has its own fast path in LossyFrameHeuristics.
+  if (cparams.speed_tier == SpeedTier::kLightning &&
+      (cparams.modular_mode || frame_data.IsJPEG())) {
     cparams.speed_tier = SpeedTier::kThunder;
   }
   if (cparams.speed_tier == SpeedTier::kTectonicPlate) {
@@ -2163,6 +2663,8 @@ Status EncodeFrame(JxlMemoryManager* memory_manager,
 
     CompressParams cparams_attempt = cparams_orig;
     cparams_attempt.speed_tier = SpeedTier::kGlacier;
+    // The variants are encoded concurrently and not written.
+    cparams_attempt.shared_patches = nullptr;
     cparams_attempt.options.max_properties = 4;
 
     for (float x : {0.0f, 80.f}) {
@@ -2223,9 +2725,11 @@ Status EncodeFrame(JxlMemoryManager* memory_manager,
       }
     }
     cparams = all_params[best_idx];
+    cparams.shared_patches = cparams_orig.shared_patches;
   }
 
   JXL_RETURN_IF_ERROR(ParamsPostInit(&cparams));
+  cparams.time_budget_start = std::chrono::steady_clock::now();
 
   if (cparams.butteraugli_distance < 0) {
     return JXL_FAILURE("Expected non-negative distance");
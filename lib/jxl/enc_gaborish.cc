@@ -7,8 +7,20 @@
 
 #include <jxl/memory_manager.h>
 
-#include <hwy/base.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
 
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/enc_gaborish.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
@@ -16,11 +28,199 @@
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_ops.h"
 
+HWY_BEFORE_NAMESPACE();
 namespace jxl {
+namespace HWY_NAMESPACE {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::LoadU;
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::Set;
+using hwy::HWY_NAMESPACE::StoreU;
+
+// Each task filters a band of this many rows in place. Only the two rows on
+// each side of the band boundaries are saved beforehand, instead of a copy of
+// the whole plane.
+constexpr size_t kBandRows = 64;
+// Number of mirrored pixels on each side of the padded row copies.
+constexpr size_t kPad = 2;
+// Rows saved per band boundary: the two last rows of the band above and the
+// two first rows of the band below.
+constexpr size_t kEdgeRows = 2 * kPad;
+
+// Copies the columns of `xrect` of `row`, padded with kPad pixels on each side
+// that are mirrored at the image edges, as in Symmetric5.
+void CopyPaddedRow(const float* JXL_RESTRICT row, const size_t xsize,
+                   const Rect& xrect, float* JXL_RESTRICT padded) {
+  const int64_t x0 = static_cast<int64_t>(xrect.x0());
+  const int64_t x1 = static_cast<int64_t>(xrect.x1());
+  for (size_t i = 0; i < kPad; ++i) {
+    padded[i] = row[Mirror(x0 - static_cast<int64_t>(kPad - i), xsize)];
+    padded[kPad + xrect.xsize() + i] = row[Mirror(x1 + i, xsize)];
+  }
+  memcpy(padded + kPad, row + xrect.x0(), xrect.xsize() * sizeof(float));
+}
+
+// Filters the pixels [x, x + Lanes(d)) of the center row. `mid`, `sum13` and
+// `sum04` point to the first output column of the padded copies of the center
+// row, the sum of the rows at distance 1 and the sum of the rows at distance 2.
+template <class DF>
+JXL_INLINE void FilterPixels(DF d, const WeightsSymmetric5& w,
+                             const float* JXL_RESTRICT mid,
+                             const float* JXL_RESTRICT sum13,
+                             const float* JXL_RESTRICT sum04, const size_t x,
+                             float* JXL_RESTRICT out) {
+  const auto m0 = LoadU(d, mid + x);
+  const auto m1 = Add(LoadU(d, mid + x - 1), LoadU(d, mid + x + 1));
+  const auto m2 = Add(LoadU(d, mid + x - 2), LoadU(d, mid + x + 2));
+  const auto s0 = LoadU(d, sum13 + x);
+  const auto s1 = Add(LoadU(d, sum13 + x - 1), LoadU(d, sum13 + x + 1));
+  const auto s2 = Add(LoadU(d, sum13 + x - 2), LoadU(d, sum13 + x + 2));
+  const auto t0 = LoadU(d, sum04 + x);
+  const auto t1 = Add(LoadU(d, sum04 + x - 1), LoadU(d, sum04 + x + 1));
+  const auto t2 = Add(LoadU(d, sum04 + x - 2), LoadU(d, sum04 + x + 2));
+  auto sum = Mul(m0, Set(d, w.c[0]));
+  sum = MulAdd(Add(m1, s0), Set(d, w.r[0]), sum);
+  sum = MulAdd(Add(m2, t0), Set(d, w.R[0]), sum);
+  sum = MulAdd(s1, Set(d, w.d[0]), sum);
+  sum = MulAdd(Add(s2, t1), Set(d, w.L[0]), sum);
+  sum = MulAdd(t2, Set(d, w.D[0]), sum);
+  StoreU(sum, d, out + x);
+}
+
+// Computes one output row of `xsize` pixels from the padded copies of the five
+// input rows centered on it. `sums` has room for two padded rows.
+void FilterRow(const WeightsSymmetric5& w, const float* const* rows,
+               const size_t xsize, float* JXL_RESTRICT sums,
+               float* JXL_RESTRICT out) {
+  const HWY_FULL(float) d;
+  const HWY_CAPPED(float, 1) d1;
+  const size_t N = Lanes(d);
+  const size_t padded_xsize = xsize + 2 * kPad;
+  float* JXL_RESTRICT sum13 = sums;
+  float* JXL_RESTRICT sum04 = sums + padded_xsize;
+  size_t x = 0;
+  for (; x + N <= padded_xsize; x += N) {
+    StoreU(Add(LoadU(d, rows[1] + x), LoadU(d, rows[3] + x)), d, sum13 + x);
+    StoreU(Add(LoadU(d, rows[0] + x), LoadU(d, rows[4] + x)), d, sum04 + x);
+  }
+  for (; x < padded_xsize; ++x) {
+    sum13[x] = rows[1][x] + rows[3][x];
+    sum04[x] = rows[0][x] + rows[4][x];
+  }
+  const float* mid = rows[2] + kPad;
+  x = 0;
+  for (; x + N <= xsize; x += N) {
+    FilterPixels(d, w, mid, sum13 + kPad, sum04 + kPad, x, out);
+  }
+  for (; x < xsize; ++x) {
+    FilterPixels(d1, w, mid, sum13 + kPad, sum04 + kPad, x, out);
+  }
+}
+
+Status GaborishInverse(Image3F* in_out, const Rect& rect,
+                       const WeightsSymmetric5* weights, ThreadPool* pool) {
+  JxlMemoryManager* memory_manager = in_out->memory_manager();
+  const Rect xrect = rect.Extend(3, Rect(*in_out));
+  if (xrect.xsize() == 0 || xrect.ysize() == 0) return true;
+  const size_t xsize = in_out->xsize();
+  const size_t ysize = in_out->ysize();
+  const size_t padded_xsize = xrect.xsize() + 2 * kPad;
+  const size_t num_bands = DivCeil(xrect.ysize(), kBandRows);
+
+  // The unfiltered rows around the band boundaries, which the neighbouring
+  // band overwrites while they are still needed.
+  const size_t num_edge_rows = std::max<size_t>(1, (num_bands - 1) * kEdgeRows);
+  JXL_ASSIGN_OR_RETURN(
+      Image3F edges,
+      Image3F::Create(memory_manager, padded_xsize, num_edge_rows));
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t band = 1; band < num_bands; ++band) {
+      const size_t y0 = xrect.y0() + band * kBandRows - kPad;
+      for (size_t i = 0; i < kEdgeRows && y0 + i < xrect.y1(); ++i) {
+        CopyPaddedRow(in_out->ConstPlaneRow(c, y0 + i), xsize, xrect,
+                      edges.PlaneRow(c, (band - 1) * kEdgeRows + i));
+      }
+    }
+  }
+
+  // Per thread: a ring of the padded copies of five input rows and room for
+  // the sums of rows in FilterRow.
+  constexpr size_t kRingRows = 2 * kPad + 1;
+  std::vector<ImageF> scratch;
+  const auto init = [&](const size_t num_threads) -> Status {
+    scratch.clear();
+    for (size_t i = 0; i < num_threads; ++i) {
+      JXL_ASSIGN_OR_RETURN(
+          ImageF rows,
+          ImageF::Create(memory_manager, padded_xsize, kRingRows + 2));
+      scratch.emplace_back(std::move(rows));
+    }
+    return true;
+  };
+  const auto process_band = [&](const uint32_t band,
+                                const size_t thread) -> Status {
+    const size_t by0 = xrect.y0() + band * kBandRows;
+    const size_t by1 = std::min(by0 + kBandRows, xrect.y1());
+    ImageF& ring = scratch[thread];
+    float* JXL_RESTRICT sums = ring.Row(kRingRows);
+    for (size_t c = 0; c < 3; ++c) {
+      // Input row held by each ring slot, which is input row modulo kRingRows.
+      int64_t slot_row[kRingRows];
+      std::fill(slot_row, slot_row + kRingRows, -1);
+      // Returns the padded unfiltered input row `y`, which is in [0, ysize).
+      const auto input_row = [&](const size_t y) -> const float* {
+        for (size_t b = band; b <= band + 1; ++b) {
+          if (b == 0 || b >= num_bands) continue;
+          const size_t y0 = xrect.y0() + b * kBandRows - kPad;
+          if (y >= y0 && y < y0 + kEdgeRows && y < xrect.y1()) {
+            return edges.ConstPlaneRow(c, (b - 1) * kEdgeRows + y - y0);
+          }
+        }
+        float* row = ring.Row(y % kRingRows);
+        if (slot_row[y % kRingRows] != static_cast<int64_t>(y)) {
+          // Rows of this band that were already filtered are still in the
+          // ring, since all input rows of the window are distinct modulo
+          // kRingRows.
+          CopyPaddedRow(in_out->ConstPlaneRow(c, y), xsize, xrect, row);
+          slot_row[y % kRingRows] = y;
+        }
+        return row;
+      };
+      const float* rows[kRingRows];
+      for (size_t i = 0; i + 1 < kRingRows; ++i) {
+        rows[i + 1] = input_row(
+            Mirror(static_cast<int64_t>(by0 + i) - static_cast<int64_t>(kPad),
+                   ysize));
+      }
+      for (size_t y = by0; y < by1; ++y) {
+        for (size_t i = 0; i + 1 < kRingRows; ++i) rows[i] = rows[i + 1];
+        rows[kRingRows - 1] = input_row(Mirror(y + kPad, ysize));
+        FilterRow(weights[c], rows, xrect.xsize(), sums,
+                  in_out->PlaneRow(c, y) + xrect.x0());
+      }
+    }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_bands, init, process_band,
+                                "GaborishInverse"));
+  return true;
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+
+HWY_EXPORT(GaborishInverse);
 
 Status GaborishInverse(Image3F* in_out, const Rect& rect, const float mul[3],
                        ThreadPool* pool) {
-  JxlMemoryManager* memory_manager = in_out->memory_manager();
   WeightsSymmetric5 weights[3];
   // Only an approximation. One or even two 3x3, and rank-1 (separable) 5x5
   // are insufficient. The numbers here have been obtained by butteraugli
@@ -47,28 +247,8 @@ Status GaborishInverse(Image3F* in_out, const Rect& rect, const float mul[3],
                                    {HWY_REP4(normalize_mul * kGaborish[4])},
                                    {HWY_REP4(normalize_mul * kGaborish[3])}};
   }
-  // Reduce memory footprint by only allocating a single plane and swapping it
-  // into the output Image3F. Better still would be tiling.
-  // Note that we cannot *allocate* a plane, as doing so might cause Image3F to
-  // have planes of different stride. Instead, we copy one plane in a temporary
-  // image and reuse the existing planes of the in/out image.
-  ImageF temp;
-  JXL_ASSIGN_OR_RETURN(temp,
-                       ImageF::Create(memory_manager, in_out->Plane(2).xsize(),
-                                      in_out->Plane(2).ysize()));
-  JXL_RETURN_IF_ERROR(CopyImageTo(in_out->Plane(2), &temp));
-  Rect xrect = rect.Extend(3, Rect(*in_out));
-  JXL_RETURN_IF_ERROR(Symmetric5(in_out->Plane(0), xrect, weights[0], pool,
-                                 &in_out->Plane(2), xrect));
-  JXL_RETURN_IF_ERROR(Symmetric5(in_out->Plane(1), xrect, weights[1], pool,
-                                 &in_out->Plane(0), xrect));
-  JXL_RETURN_IF_ERROR(
-      Symmetric5(temp, xrect, weights[2], pool, &in_out->Plane(1), xrect));
-  // Now planes are 1, 2, 0.
-  in_out->Plane(0).Swap(in_out->Plane(1));
-  // 2 1 0
-  in_out->Plane(0).Swap(in_out->Plane(2));
-  return true;
+  return HWY_DYNAMIC_DISPATCH(GaborishInverse)(in_out, rect, weights, pool);
 }
 
 }  // namespace jxl
+#endif  // HWY_ONCE
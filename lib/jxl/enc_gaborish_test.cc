@@ -5,12 +5,18 @@
 
 #include "lib/jxl/enc_gaborish.h"
 
+#include <jxl/memory_manager.h>
 #include <jxl/types.h>
 
 #include <hwy/base.h>
 
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/random.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/convolve.h"
 #include "lib/jxl/image.h"
@@ -87,5 +93,59 @@ TEST(GaborishTest, TestFlat) {
   TestRoundTrip(in, 1E-5f);
 }
 
+// Compares the band-wise in-place filtering to a direct 5x5 convolution with
+// mirroring at the image edges, for rects crossing several bands.
+TEST(GaborishTest, TestMatchesConvolution) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const float mul[3] = {0.9f, 0.8f, 0.7f};
+  // The kernel is the response to a Dirac.
+  JXL_TEST_ASSIGN_OR_DIE(Image3F dirac,
+                         Image3F::Create(memory_manager, 20, 20));
+  ZeroFillImage(&dirac);
+  for (size_t c = 0; c < 3; ++c) dirac.PlaneRow(c, 10)[10] = 1.0f;
+  ASSERT_TRUE(GaborishInverse(&dirac, Rect(dirac), mul, nullptr));
+
+  const size_t xsize = 150;
+  const size_t ysize = 330;
+  JXL_TEST_ASSIGN_OR_DIE(Image3F in,
+                         Image3F::Create(memory_manager, xsize, ysize));
+  Rng rng(0);
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < ysize; ++y) {
+      float* row = in.PlaneRow(c, y);
+      for (size_t x = 0; x < xsize; ++x) row[x] = rng.UniformF(0, 1);
+    }
+  }
+  test::ThreadPoolForTests pool(4);
+  for (const Rect& rect : {Rect(in), Rect(16, 70, 100, 200)}) {
+    JXL_TEST_ASSIGN_OR_DIE(Image3F out,
+                           Image3F::Create(memory_manager, xsize, ysize));
+    ASSERT_TRUE(CopyImageTo(in, &out));
+    ASSERT_TRUE(GaborishInverse(&out, rect, mul, pool.get()));
+    const Rect xrect = rect.Extend(3, Rect(in));
+    for (size_t c = 0; c < 3; ++c) {
+      for (size_t y = 0; y < ysize; ++y) {
+        for (size_t x = 0; x < xsize; ++x) {
+          float expected = in.ConstPlaneRow(c, y)[x];
+          if (x >= xrect.x0() && x < xrect.x1() && y >= xrect.y0() &&
+              y < xrect.y1()) {
+            expected = 0;
+            for (int64_t dy = -2; dy <= 2; ++dy) {
+              const int64_t iy = Mirror(static_cast<int64_t>(y) + dy, ysize);
+              const float* row = in.ConstPlaneRow(c, iy);
+              for (int64_t dx = -2; dx <= 2; ++dx) {
+                expected += dirac.ConstPlaneRow(c, 10 + dy)[10 + dx] *
+                            row[Mirror(static_cast<int64_t>(x) + dx, xsize)];
+              }
+            }
+          }
+          ASSERT_NEAR(out.ConstPlaneRow(c, y)[x], expected, 1E-5f)
+              << "c=" << c << " x=" << x << " y=" << y;
+        }
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace jxl
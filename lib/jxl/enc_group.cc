@@ -27,6 +27,7 @@
 #include "lib/jxl/quantizer-inl.h"
 #include "lib/jxl/quantizer.h"
 #include "lib/jxl/simd_util.h"
+#include "lib/jxl/trace_internal.h"
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
@@ -399,6 +400,7 @@ Status ComputeCoefficients(size_t group_idx, PassesEncoderState* enc_state,
   {
     // Only use error diffusion in Squirrel mode or slower.
     const bool error_diffusion = cparams.speed_tier <= SpeedTier::kSquirrel;
+    const bool use_dct_cache = enc_state->dct_cache.xsize() != 0;
     constexpr HWY_CAPPED(float, kDCTBlockSize) d;
 
     int32_t* JXL_RESTRICT coeffs[3][kMaxNumPasses] = {};
@@ -457,9 +459,16 @@ Status ComputeCoefficients(size_t group_idx, PassesEncoderState* enc_state,
           // DCT Y channel, roundtrip-quantize it and set DC.
           int32_t quant_ac = row_quant_ac[bx];
           for (size_t c : {0, 1, 2}) {
-            TransformFromPixels(acs.Strategy(), opsin_rows[c] + bx * kBlockDim,
-                                opsin_stride, coeffs_in + c * size,
-                                scratch_space);
+            if (use_dct_cache) {
+              LoadCachedCoefficients(enc_state->dct_cache, acs,
+                                     block_group_rect.x0() + bx,
+                                     block_group_rect.y0() + by, c,
+                                     coeffs_in + c * size);
+            } else {
+              TransformFromPixels(acs.Strategy(),
+                                  opsin_rows[c] + bx * kBlockDim, opsin_stride,
+                                  coeffs_in + c * size, scratch_space);
+            }
           }
           DCFromLowestFrequencies(acs.Strategy(), coeffs_in + size,
                                   dc_rows[1] + bx, dc_stride);
@@ -518,6 +527,7 @@ HWY_EXPORT(ComputeCoefficients);
 Status ComputeCoefficients(size_t group_idx, PassesEncoderState* enc_state,
                            const Image3F& opsin, const Rect& rect,
                            Image3F* dc) {
+  JXL_TRACE_SCOPE("ComputeCoefficients", group_idx);
   return HWY_DYNAMIC_DISPATCH(ComputeCoefficients)(group_idx, enc_state, opsin,
                                                    rect, dc);
 }
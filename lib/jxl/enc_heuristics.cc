@@ -39,6 +39,7 @@
 #include "lib/jxl/enc_adaptive_quantization.h"
 #include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_chroma_from_luma.h"
+#include "lib/jxl/enc_content_classifier.h"
 #include "lib/jxl/enc_gaborish.h"
 #include "lib/jxl/enc_modular.h"
 #include "lib/jxl/enc_noise.h"
@@ -54,6 +55,7 @@
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/passes_state.h"
 #include "lib/jxl/quant_weights.h"
+#include "lib/jxl/trace_internal.h"
 
 namespace jxl {
 
@@ -880,6 +882,7 @@ Status ComputeARHeuristics(const FrameHeader& frame_header,
                            PassesEncoderState* enc_state,
                            const Image3F& orig_opsin, const Rect& rect,
                            ThreadPool* pool) {
+  JXL_TRACE_SCOPE("ComputeARHeuristics");
   const CompressParams& cparams = enc_state->cparams;
   PassesSharedState& shared = enc_state->shared;
   const FrameDimensions& frame_dim = shared.frame_dim;
@@ -984,12 +987,134 @@ Status ComputeARHeuristics(const FrameHeader& frame_header,
   return true;
 }
 
+namespace {
+
+// Runs the butteraugli search of FindBestQuantizer on the window of a frame
+// encoded in streaming mode, as if the window were a frame of its own.
+// `rect` is the window within `opsin` and `linear`.
+Status FindBestQuantizerForWindow(const FrameHeader& frame_header,
+                                  const Image3F& linear, const Image3F& opsin,
+                                  const Rect& rect, ImageF& quant_field,
+                                  PassesEncoderState* enc_state,
+                                  const JxlCmsInterface& cms, ThreadPool* pool,
+                                  AuxOut* aux_out) {
+  JxlMemoryManager* memory_manager = enc_state->memory_manager();
+  const FrameDimensions& frame_dim = enc_state->shared.frame_dim;
+  FrameHeader window_header = frame_header;
+  window_header.frame_size.xsize = frame_dim.xsize;
+  window_header.frame_size.ysize = frame_dim.ysize;
+  JXL_ASSIGN_OR_RETURN(
+      Image3F window_opsin,
+      Image3F::Create(memory_manager, rect.xsize(), rect.ysize()));
+  JXL_RETURN_IF_ERROR(
+      CopyImageTo(rect, opsin, Rect(window_opsin), &window_opsin));
+  // Like in the non-streaming case, the reference is not padded.
+  JXL_ASSIGN_OR_RETURN(
+      Image3F window_linear,
+      Image3F::Create(memory_manager, frame_dim.xsize, frame_dim.ysize));
+  JXL_RETURN_IF_ERROR(CopyImageTo(
+      Rect(rect.x0(), rect.y0(), frame_dim.xsize, frame_dim.ysize), linear,
+      Rect(window_linear), &window_linear));
+  // The window is the only DC group of `window_header`.
+  const size_t dc_group_index = enc_state->dc_group_index;
+  enc_state->dc_group_index = 0;
+  Status status =
+      FindBestQuantizer(window_header, &window_linear, window_opsin,
+                        quant_field, enc_state, cms, pool, aux_out);
+  enc_state->dc_group_index = dc_group_index;
+  return status;
+}
+
+// Returns whether every block of `block_rect` is close enough to the same
+// block of the previous frame to keep its block sizes. `rect` is the frame
+// within `opsin`.
+bool SimilarToHistory(const FrameHeuristicsHistory& history,
+                      const Image3F& opsin, const Rect& rect,
+                      const Rect& block_rect, float distance) {
+  // The X channel has a much smaller range than the other two.
+  static constexpr float kChannelWeights[3] = {12.0f, 1.0f, 0.5f};
+  const float max_diff = 0.0015f * distance * kBlockDim * kBlockDim;
+  for (size_t by = block_rect.y0(); by < block_rect.y1(); ++by) {
+    const size_t y1 = std::min((by + 1) * kBlockDim, rect.ysize());
+    for (size_t bx = block_rect.x0(); bx < block_rect.x1(); ++bx) {
+      const size_t x1 = std::min((bx + 1) * kBlockDim, rect.xsize());
+      float diff = 0.0f;
+      for (size_t c = 0; c < 3; ++c) {
+        float channel_diff = 0.0f;
+        for (size_t y = by * kBlockDim; y < y1; ++y) {
+          const float* JXL_RESTRICT row =
+              opsin.ConstPlaneRow(c, rect.y0() + y) + rect.x0();
+          const float* JXL_RESTRICT prev_row =
+              history.opsin.ConstPlaneRow(c, y);
+          for (size_t x = bx * kBlockDim; x < x1; ++x) {
+            channel_diff += std::abs(row[x] - prev_row[x]);
+          }
+        }
+        diff += kChannelWeights[c] * channel_diff;
+      }
+      if (diff > max_diff) return false;
+    }
+  }
+  return true;
+}
+
+// Sets the block sizes of `block_rect` to those of the previous frame. The
+// block size search never crosses the encoder tiles, so neither do these.
+Status CopyHistoryAcStrategy(const FrameHeuristicsHistory& history,
+                             const Rect& block_rect,
+                             AcStrategyImage* ac_strategy) {
+  for (size_t by = block_rect.y0(); by < block_rect.y1(); ++by) {
+    const uint8_t* JXL_RESTRICT row = history.ac_strategy.ConstRow(by);
+    for (size_t bx = block_rect.x0(); bx < block_rect.x1(); ++bx) {
+      if (row[bx] == 0) continue;
+      JXL_RETURN_IF_ERROR(ac_strategy->Set(
+          bx, by, static_cast<AcStrategyType>(row[bx] - 1)));
+    }
+  }
+  return true;
+}
+
+// Stores the image and the block sizes of this frame for the next one.
+Status StoreHeuristicsHistory(const Image3F& opsin, const Rect& rect,
+                              const AcStrategyImage& ac_strategy,
+                              float distance,
+                              FrameHeuristicsHistory* history) {
+  JxlMemoryManager* memory_manager = opsin.memory_manager();
+  if (history->opsin.xsize() != rect.xsize() ||
+      history->opsin.ysize() != rect.ysize()) {
+    JXL_ASSIGN_OR_RETURN(
+        history->opsin,
+        Image3F::Create(memory_manager, rect.xsize(), rect.ysize()));
+  }
+  JXL_RETURN_IF_ERROR(
+      CopyImageTo(rect, opsin, Rect(history->opsin), &history->opsin));
+  if (history->ac_strategy.xsize() != ac_strategy.xsize() ||
+      history->ac_strategy.ysize() != ac_strategy.ysize()) {
+    JXL_ASSIGN_OR_RETURN(history->ac_strategy,
+                         ImageB::Create(memory_manager, ac_strategy.xsize(),
+                                        ac_strategy.ysize()));
+  }
+  for (size_t by = 0; by < ac_strategy.ysize(); ++by) {
+    AcStrategyRow acs_row = ac_strategy.ConstRow(by);
+    uint8_t* JXL_RESTRICT row = history->ac_strategy.Row(by);
+    for (size_t bx = 0; bx < ac_strategy.xsize(); ++bx) {
+      AcStrategy acs = acs_row[bx];
+      row[bx] = acs.IsFirstBlock() ? acs.RawStrategy() + 1 : 0;
+    }
+  }
+  history->butteraugli_distance = distance;
+  return true;
+}
+
+}  // namespace
+
 Status LossyFrameHeuristics(const FrameHeader& frame_header,
                             PassesEncoderState* enc_state,
                             ModularFrameEncoder* modular_frame_encoder,
                             const Image3F* linear, Image3F* opsin,
                             const Rect& rect, const JxlCmsInterface& cms,
                             ThreadPool* pool, AuxOut* aux_out) {
+  JXL_TRACE_SCOPE("LossyFrameHeuristics");
   const CompressParams& cparams = enc_state->cparams;
   const bool streaming_mode = enc_state->streaming_mode;
   const bool initialize_global_state = enc_state->initialize_global_state;
@@ -1005,12 +1130,24 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
   BlockCtxMap& block_ctx_map = shared.block_ctx_map;
   JxlMemoryManager* memory_manager = enc_state->memory_manager();
 
+  // Classify the groups, so that the searches below can skip the ones where
+  // they cannot help.
+  enc_state->group_content = ImageB();
+  if (!streaming_mode && cparams.speed_tier <= SpeedTier::kWombat) {
+    JXL_ASSIGN_OR_RETURN(enc_state->group_content,
+                         ClassifyGroupContent(*opsin, rect, frame_dim, pool));
+  }
+
+  // With a time budget, the searches for splines and patches would not fit
+  // once the conversion of the input already used a tenth of it.
+  const bool search_features = TimeBudgetUsed(cparams) < 0.1;
+
   // Find and subtract splines.
   if (cparams.custom_splines.HasAny()) {
     image_features.splines = cparams.custom_splines;
   }
   if (!streaming_mode && cparams.speed_tier <= SpeedTier::kSquirrel) {
-    if (!cparams.custom_splines.HasAny()) {
+    if (!cparams.custom_splines.HasAny() && search_features) {
       image_features.splines = FindSplines(*opsin);
     }
     JXL_RETURN_IF_ERROR(image_features.splines.InitializeDrawCache(
@@ -1019,7 +1156,7 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
   }
 
   // Find and subtract patches/dots.
-  if (!streaming_mode &&
+  if (!streaming_mode && search_features &&
       ApplyOverride(cparams.patches,
                     cparams.speed_tier <= SpeedTier::kSquirrel)) {
     JXL_RETURN_IF_ERROR(
@@ -1111,64 +1248,110 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
         memory_manager, cparams, modular_frame_encoder, &matrices));
   }
 
-  JXL_RETURN_IF_ERROR(cfl_heuristics.Init(memory_manager, rect));
-  JXL_RETURN_IF_ERROR(acs_heuristics.Init(*opsin, rect, initial_quant_field,
-                                          initial_quant_masking,
-                                          initial_quant_masking1x1, &matrices));
-
-  auto process_tile = [&](const uint32_t tid, const size_t thread) -> Status {
-    size_t n_enc_tiles = DivCeil(frame_dim.xsize_blocks, kEncTileDimInBlocks);
-    size_t tx = tid % n_enc_tiles;
-    size_t ty = tid / n_enc_tiles;
-    size_t by0 = ty * kEncTileDimInBlocks;
-    size_t by1 =
-        std::min((ty + 1) * kEncTileDimInBlocks, frame_dim.ysize_blocks);
-    size_t bx0 = tx * kEncTileDimInBlocks;
-    size_t bx1 =
-        std::min((tx + 1) * kEncTileDimInBlocks, frame_dim.xsize_blocks);
-    Rect r(bx0, by0, bx1 - bx0, by1 - by0);
-
-    // For speeds up to Wombat, we only compute the color correlation map
-    // once we know the transform type and the quantization map.
-    if (cparams.speed_tier <= SpeedTier::kSquirrel) {
-      JXL_RETURN_IF_ERROR(cfl_heuristics.ComputeTile(
-          r, *opsin, rect, matrices,
-          /*ac_strategy=*/nullptr,
-          /*raw_quant_field=*/nullptr,
-          /*quantizer=*/nullptr, /*fast=*/false, thread, &cmap));
+  if (cparams.speed_tier >= SpeedTier::kLightning) {
+    // In Lightning mode, use DCT8 everywhere, the constant initial quant field
+    // and the default color correlation map, so there is nothing to decide
+    // per tile and the whole frame is filled in one go.
+    JXL_RETURN_IF_ERROR(matrices.EnsureComputed(1));  // DCT8 only
+    const Rect block_rect(0, 0, frame_dim.xsize_blocks, frame_dim.ysize_blocks);
+    ac_strategy.FillDCT8(block_rect);
+    quantizer.SetQuantFieldRect(initial_quant_field, block_rect,
+                                &raw_quant_field);
+  } else {
+    JXL_RETURN_IF_ERROR(cfl_heuristics.Init(memory_manager, rect));
+    // The second CfL pass transforms every varblock with its final strategy
+    // and the final opsin image, which ComputeCoefficients would do again.
+    const bool use_dct_cache = cparams.speed_tier <= SpeedTier::kHare;
+    if (use_dct_cache) {
+      JXL_RETURN_IF_ERROR(InitDCTCache(frame_dim.xsize_blocks,
+                                       frame_dim.ysize_blocks, enc_state));
     }
+    JXL_RETURN_IF_ERROR(acs_heuristics.Init(
+        *opsin, rect, initial_quant_field, initial_quant_masking,
+        initial_quant_masking1x1, &matrices, &enc_state->group_content,
+        frame_dim.group_dim));
+    // The previous frame, if its block sizes can be reused.
+    const FrameHeuristicsHistory* history = cparams.heuristics_history;
+    if (history != nullptr &&
+        (streaming_mode || cparams.speed_tier >= SpeedTier::kCheetah ||
+         history->butteraugli_distance != cparams.butteraugli_distance ||
+         history->opsin.xsize() != rect.xsize() ||
+         history->opsin.ysize() != rect.ysize() ||
+         history->ac_strategy.xsize() != frame_dim.xsize_blocks ||
+         history->ac_strategy.ysize() != frame_dim.ysize_blocks)) {
+      history = nullptr;
+    }
+
+    auto process_tile = [&](const uint32_t tid, const size_t thread) -> Status {
+      size_t n_enc_tiles =
+          DivCeil(frame_dim.xsize_blocks, kEncTileDimInBlocks);
+      size_t tx = tid % n_enc_tiles;
+      size_t ty = tid / n_enc_tiles;
+      size_t by0 = ty * kEncTileDimInBlocks;
+      size_t by1 =
+          std::min((ty + 1) * kEncTileDimInBlocks, frame_dim.ysize_blocks);
+      size_t bx0 = tx * kEncTileDimInBlocks;
+      size_t bx1 =
+          std::min((tx + 1) * kEncTileDimInBlocks, frame_dim.xsize_blocks);
+      Rect r(bx0, by0, bx1 - bx0, by1 - by0);
+
+      // Where the image did not change since the previous frame, keep its
+      // block sizes. The first CfL pass below only serves their search.
+      if (history != nullptr &&
+          SimilarToHistory(*history, *opsin, rect, r,
+                           cparams.butteraugli_distance)) {
+        JXL_RETURN_IF_ERROR(CopyHistoryAcStrategy(*history, r, &ac_strategy));
+      } else {
+        // For speeds up to Wombat, we only compute the color correlation map
+        // once we know the transform type and the quantization map.
+        if (cparams.speed_tier <= SpeedTier::kSquirrel) {
+          JXL_RETURN_IF_ERROR(cfl_heuristics.ComputeTile(
+              r, *opsin, rect, matrices,
+              /*ac_strategy=*/nullptr,
+              /*raw_quant_field=*/nullptr,
+              /*quantizer=*/nullptr, /*fast=*/false, thread, &cmap));
+        }
+
+        // Choose block sizes.
+        JXL_RETURN_IF_ERROR(
+            acs_heuristics.ProcessRect(r, cmap, &ac_strategy, thread));
+      }
 
-    // Choose block sizes.
+      // Always set the initial quant field, so we can compute the CfL map with
+      // more accuracy. The initial quant field might change in slower modes,
+      // but adjusting the quant field with butteraugli when all the other
+      // encoding parameters are fixed is likely a more reliable choice anyway.
+      JXL_RETURN_IF_ERROR(AdjustQuantField(
+          ac_strategy, r, cparams.butteraugli_distance, &initial_quant_field));
+      quantizer.SetQuantFieldRect(initial_quant_field, r, &raw_quant_field);
+
+      // Compute a non-default CfL map if we are at Hare speed, or slower.
+      if (cparams.speed_tier <= SpeedTier::kHare) {
+        JXL_RETURN_IF_ERROR(cfl_heuristics.ComputeTile(
+            r, *opsin, rect, matrices, &ac_strategy, &raw_quant_field,
+            &quantizer, /*fast=*/cparams.speed_tier >= SpeedTier::kWombat,
+            thread, &cmap,
+            use_dct_cache ? &enc_state->dct_cache : nullptr));
+      }
+      return true;
+    };
+    size_t num_tiles = DivCeil(frame_dim.xsize_blocks, kEncTileDimInBlocks) *
+                       DivCeil(frame_dim.ysize_blocks, kEncTileDimInBlocks);
+    const auto prepare = [&](const size_t num_threads) -> Status {
+      acs_heuristics.PrepareForThreads(num_threads);
+      cfl_heuristics.PrepareForThreads(num_threads);
+      return true;
+    };
     JXL_RETURN_IF_ERROR(
-        acs_heuristics.ProcessRect(r, cmap, &ac_strategy, thread));
-
-    // Always set the initial quant field, so we can compute the CfL map with
-    // more accuracy. The initial quant field might change in slower modes, but
-    // adjusting the quant field with butteraugli when all the other encoding
-    // parameters are fixed is likely a more reliable choice anyway.
-    JXL_RETURN_IF_ERROR(AdjustQuantField(
-        ac_strategy, r, cparams.butteraugli_distance, &initial_quant_field));
-    quantizer.SetQuantFieldRect(initial_quant_field, r, &raw_quant_field);
-
-    // Compute a non-default CfL map if we are at Hare speed, or slower.
-    if (cparams.speed_tier <= SpeedTier::kHare) {
-      JXL_RETURN_IF_ERROR(cfl_heuristics.ComputeTile(
-          r, *opsin, rect, matrices, &ac_strategy, &raw_quant_field, &quantizer,
-          /*fast=*/cparams.speed_tier >= SpeedTier::kWombat, thread, &cmap));
-    }
-    return true;
-  };
-  size_t num_tiles = DivCeil(frame_dim.xsize_blocks, kEncTileDimInBlocks) *
-                     DivCeil(frame_dim.ysize_blocks, kEncTileDimInBlocks);
-  const auto prepare = [&](const size_t num_threads) -> Status {
-    acs_heuristics.PrepareForThreads(num_threads);
-    cfl_heuristics.PrepareForThreads(num_threads);
-    return true;
-  };
-  JXL_RETURN_IF_ERROR(
-      RunOnPool(pool, 0, num_tiles, prepare, process_tile, "Enc Heuristics"));
+        RunOnPool(pool, 0, num_tiles, prepare, process_tile, "Enc Heuristics"));
+  }
 
   JXL_RETURN_IF_ERROR(acs_heuristics.Finalize(frame_dim, ac_strategy, aux_out));
+  if (cparams.heuristics_history != nullptr && !streaming_mode) {
+    JXL_RETURN_IF_ERROR(StoreHeuristicsHistory(*opsin, rect, ac_strategy,
+                                               cparams.butteraugli_distance,
+                                               cparams.heuristics_history));
+  }
 
   // Refine quantization levels.
   if (!streaming_mode && !cparams.disable_perceptual_optimizations) {
@@ -1177,6 +1360,14 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
     JXL_RETURN_IF_ERROR(FindBestQuantizer(frame_header, linear, *opsin,
                                           initial_quant_field, enc_state, cms,
                                           pool, aux_out));
+  } else if (streaming_mode && linear &&
+             cparams.speed_tier <= SpeedTier::kKitten &&
+             !cparams.disable_perceptual_optimizations) {
+    ImageB& epf_sharpness = shared.epf_sharpness;
+    FillPlane(static_cast<uint8_t>(4), &epf_sharpness, Rect(epf_sharpness));
+    JXL_RETURN_IF_ERROR(FindBestQuantizerForWindow(
+        frame_header, *linear, *opsin, rect, initial_quant_field, enc_state,
+        cms, pool, aux_out));
   }
 
   // Choose a context model that depends on the amount of quantization for AC.
@@ -10,6 +10,9 @@
 
 #include <jxl/cms_interface.h>
 
+#include <cstdint>
+#include <vector>
+
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
@@ -24,6 +27,33 @@ class DequantMatrices;
 class ImageBundle;
 class ModularFrameEncoder;
 
+// What the heuristics of a frame decided, to seed those of the next frame
+// when it is similar enough. Empty until a frame was encoded.
+struct FrameHeuristicsHistory {
+  // The XYB image seen by the AC strategy search, after the inverse Gaborish.
+  Image3F opsin;
+  // One entry per block: the strategy plus one on the first block of each
+  // varblock, and zero on the other blocks.
+  ImageB ac_strategy;
+  // The block sizes are only reused at the same distance.
+  float butteraugli_distance = 0.0f;
+  // The clustering of the AC histograms, per pass.
+  std::vector<std::vector<uint8_t>> ac_context_maps;
+};
+
+// What the encoding of a frame computed before anything that depends on the
+// distance or the resampling, to encode the same frame again with other
+// parameters. Empty until a frame was encoded.
+struct FrameAnalysis {
+  // The color channels converted to XYB, unpadded.
+  Image3F opsin;
+  // The same channels in linear sRGB, for the butteraugli comparisons.
+  Image3F linear;
+  // Set if the alpha channel was interleaved with the color channels.
+  bool has_interleaved_alpha = false;
+  ImageF alpha;
+};
+
 // Initializes encoder structures in `enc_state` using the original image data
 // in `original_pixels`, and the XYB image data in `opsin`. Also modifies the
 // `opsin` image by applying Gaborish, and doing other modifications if
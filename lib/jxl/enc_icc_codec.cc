@@ -7,9 +7,13 @@
 
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <limits>
+#include <list>
 #include <map>
+#include <mutex>
 #include <vector>
 
 #include "lib/jxl/base/status.h"
@@ -435,9 +439,98 @@ Status PredictICC(const uint8_t* icc, size_t size, PaddedBytes* result) {
   return true;
 }
 
-Status WriteICC(const Span<const uint8_t> icc, BitWriter* JXL_RESTRICT writer,
-                LayerType layer, AuxOut* JXL_RESTRICT aux_out) {
-  if (icc.empty()) return JXL_FAILURE("ICC must be non-empty");
+namespace {
+
+// The most recently encoded ICC profiles of the process, shared by all the
+// encoders. Most images use one of a few profiles, and PredictICC and the
+// histogram search are slow for the large profiles of cameras and printers.
+// The entries hold their own copies and do not use the memory manager of the
+// encoder, which may not outlive them.
+class EncodedICCCache {
+ public:
+  static EncodedICCCache* Get() {
+    static EncodedICCCache* cache = new EncodedICCCache();
+    return cache;
+  }
+
+  bool Find(Span<const uint8_t> icc, std::vector<uint8_t>* bits,
+            size_t* num_bits) {
+    const uint64_t hash = Hash(icc);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->hash == hash && it->icc.size() == icc.size() &&
+          std::equal(icc.begin(), icc.end(), it->icc.begin())) {
+        // Move to the front.
+        entries_.splice(entries_.begin(), entries_, it);
+        *bits = it->bits;
+        *num_bits = it->num_bits;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Insert(Span<const uint8_t> icc, const std::vector<uint8_t>& bits,
+              size_t num_bits) {
+    if (icc.size() > kMaxBytes) return;
+    Entry entry;
+    entry.hash = Hash(icc);
+    entry.icc = icc.Copy();
+    entry.bits = bits;
+    entry.num_bits = num_bits;
+    std::lock_guard<std::mutex> lock(mutex_);
+    total_bytes_ += entry.icc.size();
+    entries_.push_front(std::move(entry));
+    while (entries_.size() > kCapacity || total_bytes_ > kMaxBytes) {
+      total_bytes_ -= entries_.back().icc.size();
+      entries_.pop_back();
+    }
+  }
+
+ private:
+  static constexpr size_t kCapacity = 16;
+  // Bound on the sum of the sizes of the cached profiles.
+  static constexpr size_t kMaxBytes = 16 << 20;
+
+  struct Entry {
+    uint64_t hash;
+    std::vector<uint8_t> icc;
+    std::vector<uint8_t> bits;
+    size_t num_bits;
+  };
+
+  // FNV-1a.
+  static uint64_t Hash(Span<const uint8_t> icc) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (uint8_t b : icc) {
+      hash = (hash ^ b) * 0x100000001B3ull;
+    }
+    return hash;
+  }
+
+  std::mutex mutex_;
+  std::list<Entry> entries_;
+  size_t total_bytes_ = 0;
+};
+
+Status AppendBits(const std::vector<uint8_t>& bits, size_t num_bits,
+                  BitWriter* JXL_RESTRICT writer, LayerType layer,
+                  AuxOut* JXL_RESTRICT aux_out) {
+  BitWriter::Allotment allotment(writer, num_bits);
+  size_t full_bytes = num_bits / kBitsPerByte;
+  size_t remaining_bits = num_bits % kBitsPerByte;
+  for (size_t i = 0; i < full_bytes; ++i) {
+    writer->Write(8, bits[i]);
+  }
+  if (remaining_bits > 0) {
+    writer->Write(remaining_bits,
+                  bits[full_bytes] & ((1u << remaining_bits) - 1));
+  }
+  return allotment.ReclaimAndCharge(writer, layer, aux_out);
+}
+
+Status EncodeICC(const Span<const uint8_t> icc, BitWriter* JXL_RESTRICT writer,
+                 LayerType layer, AuxOut* JXL_RESTRICT aux_out) {
   JxlMemoryManager* memory_manager = writer->memory_manager();
   PaddedBytes enc{memory_manager};
   JXL_RETURN_IF_ERROR(PredictICC(icc.data(), icc.size(), &enc));
@@ -467,4 +560,29 @@ Status WriteICC(const Span<const uint8_t> icc, BitWriter* JXL_RESTRICT writer,
   return true;
 }
 
+}  // namespace
+
+Status WriteICC(const Span<const uint8_t> icc, BitWriter* JXL_RESTRICT writer,
+                LayerType layer, AuxOut* JXL_RESTRICT aux_out) {
+  if (icc.empty()) return JXL_FAILURE("ICC must be non-empty");
+  std::vector<uint8_t> bits;
+  size_t num_bits;
+  if (EncodedICCCache::Get()->Find(icc, &bits, &num_bits)) {
+    return AppendBits(bits, num_bits, writer, layer, aux_out);
+  }
+  BitWriter icc_writer{writer->memory_manager()};
+  JXL_RETURN_IF_ERROR(EncodeICC(icc, &icc_writer, layer, aux_out));
+  num_bits = icc_writer.BitsWritten();
+  {
+    BitWriter::Allotment allotment(&icc_writer, kBitsPerByte);
+    icc_writer.ZeroPadToByte();
+    JXL_RETURN_IF_ERROR(
+        allotment.ReclaimAndCharge(&icc_writer, layer, /*aux_out=*/nullptr));
+  }
+  icc_writer.GetSpan().AppendTo(bits);
+  EncodedICCCache::Get()->Insert(icc, bits, num_bits);
+  // Already charged to aux_out by EncodeICC.
+  return AppendBits(bits, num_bits, writer, layer, /*aux_out=*/nullptr);
+}
+
 }  // namespace jxl
@@ -14,6 +14,7 @@
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/image_bundle.h"
+#include "lib/jxl/trace_internal.h"
 
 namespace jxl {
 
@@ -23,6 +24,7 @@ Status ApplyColorTransform(const ColorEncoding& c_current,
                            const ColorEncoding& c_desired,
                            const JxlCmsInterface& cms, ThreadPool* pool,
                            Image3F* out) {
+  JXL_TRACE_SCOPE("ApplyColorTransform");
   ColorSpaceTransform c_transform(cms);
   // Changing IsGray is probably a bug.
   JXL_ENSURE(c_current.IsGray() == c_desired.IsGray());
@@ -7,6 +7,7 @@
 
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <cstdint>
@@ -41,6 +42,7 @@
 #include "lib/jxl/modular/transform/enc_transform.h"
 #include "lib/jxl/pack_signed.h"
 #include "lib/jxl/quant_weights.h"
+#include "lib/jxl/trace_internal.h"
 #include "modular/options.h"
 
 namespace jxl {
@@ -107,6 +109,31 @@ Status MergeTrees(const std::vector<Tree>& trees,
   return true;
 }
 
+// Returns the quantization step of a lossy extra channel encoded without
+// Squeeze, about distance / 128 of its range. It is the largest divisor of
+// `maxval` that does not exceed that, so that 0 and `maxval` (e.g. transparent
+// and opaque alpha) stay exact.
+int FastLossyExtraChannelStep(float distance, pixel_type maxval) {
+  if (maxval <= 1) return 1;
+  int step = 1 + static_cast<int>(2.0f * distance * maxval / 255.f);
+  step = std::min<int>(step, maxval);
+  while (maxval % step != 0) step--;
+  return step;
+}
+
+// If all the channels of the streams [start, stop) have the same quantization
+// factor, returns it, else returns 1.
+uint32_t UniformMultiplier(const std::vector<ModularMultiplierInfo>& infos,
+                           uint32_t start, uint32_t stop) {
+  uint32_t multiplier = 0;
+  for (const ModularMultiplierInfo& info : infos) {
+    if (info.range[1][1] <= start || info.range[1][0] >= stop) continue;
+    if (multiplier != 0 && multiplier != info.multiplier) return 1;
+    multiplier = info.multiplier;
+  }
+  return multiplier == 0 ? 1 : multiplier;
+}
+
 void QuantizeChannel(Channel& ch, const int q) {
   if (q == 1) return;
   for (size_t y = 0; y < ch.plane.ysize(); y++) {
@@ -248,18 +275,40 @@ float EstimateWPCost(const Image& img, size_t i) {
   return histo_cost + extra_bits;
 }
 
-float EstimateCost(const Image& img) {
+// Number of rows of a channel that EstimateCost processes in one task.
+constexpr size_t kEstimateCostRows = 64;
+
+StatusOr<float> EstimateCost(const Image& img,
+                             jxl::ThreadPool* pool = nullptr) {
   // TODO(veluca): consider SIMDfication of this code.
-  size_t extra_bits = 0;
-  float histo_cost = 0;
-  HybridUintConfig config;
-  uint32_t cutoffs[] = {0,  1,  3,  5,   7,   11,  15,  23, 31,
-                        47, 63, 95, 127, 191, 255, 392, 500};
-  constexpr size_t nc = sizeof(cutoffs) / sizeof(*cutoffs) + 1;
-  Histogram histo[nc] = {};
-  for (const Channel& ch : img.channel) {
+  const HybridUintConfig config;
+  static constexpr uint32_t kCutoffs[] = {0,  1,  3,  5,   7,   11,
+                                          15, 23, 31, 47,  63,  95,
+                                          127, 191, 255, 392, 500};
+  constexpr size_t nc = sizeof(kCutoffs) / sizeof(*kCutoffs) + 1;
+  // The histograms only depend on the token counts, so that the stripes of
+  // rows can be processed in parallel and merged in order.
+  struct Stripe {
+    size_t c;
+    size_t y0;
+    size_t y1;
+  };
+  std::vector<Stripe> stripes;
+  for (size_t c = 0; c < img.channel.size(); c++) {
+    const size_t h = img.channel[c].h;
+    for (size_t y0 = 0; y0 < h; y0 += kEstimateCostRows) {
+      stripes.push_back({c, y0, std::min(h, y0 + kEstimateCostRows)});
+    }
+  }
+  std::vector<std::array<Histogram, nc>> stripe_histo(stripes.size());
+  std::vector<size_t> stripe_extra_bits(stripes.size());
+  const auto process_stripe = [&](const uint32_t i, size_t) -> Status {
+    const Stripe& stripe = stripes[i];
+    const Channel& ch = img.channel[stripe.c];
     const intptr_t onerow = ch.plane.PixelsPerRow();
-    for (size_t y = 0; y < ch.h; y++) {
+    std::array<Histogram, nc>& histo = stripe_histo[i];
+    size_t extra_bits = 0;
+    for (size_t y = stripe.y0; y < stripe.y1; y++) {
       const pixel_type* JXL_RESTRICT r = ch.Row(y);
       for (size_t x = 0; x < ch.w; x++) {
         pixel_type_w left = (x ? r[x - 1] : y ? *(r + x - onerow) : 0);
@@ -268,7 +317,7 @@ float EstimateCost(const Image& img) {
         size_t maxdiff = std::max(std::max(left, top), topleft) -
                          std::min(std::min(left, top), topleft);
         size_t ctx = 0;
-        for (uint32_t c : cutoffs) {
+        for (uint32_t c : kCutoffs) {
           ctx += (c > maxdiff) ? 1 : 0;
         }
         pixel_type res = r[x] - ClampedGradient(top, left, topleft);
@@ -280,6 +329,20 @@ float EstimateCost(const Image& img) {
         extra_bits += nbits;
       }
     }
+    stripe_extra_bits[i] = extra_bits;
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, stripes.size(), ThreadPool::NoInit,
+                                process_stripe, "EstimateCost"));
+  size_t extra_bits = 0;
+  float histo_cost = 0;
+  Histogram histo[nc] = {};
+  for (size_t i = 0; i < stripes.size(); i++) {
+    for (size_t ctx = 0; ctx < nc; ctx++) {
+      histo[ctx].AddHistogram(stripe_histo[i][ctx]);
+    }
+    extra_bits += stripe_extra_bits[i];
+    if (i + 1 < stripes.size() && stripes[i + 1].c == stripes[i].c) continue;
     for (auto& h : histo) {
       histo_cost += h.ShannonEntropy();
       h.Clear();
@@ -312,7 +375,7 @@ bool maybe_do_transform(Image& image, const Transform& tr,
   }
   bool did_it = do_transform(image, tr, wp_header, pool);
   if (did_it) {
-    float cost_after = EstimateCost(image);
+    JXL_ASSIGN_OR_RETURN(float cost_after, EstimateCost(image, pool));
     JXL_DEBUG_V(7, "Cost before: %f  cost after: %f", cost_before, cost_after);
     if (cost_after > cost_before) {
       Transform t = image.transform.back();
@@ -324,9 +387,10 @@ bool maybe_do_transform(Image& image, const Transform& tr,
   return did_it;
 }
 
-void try_palettes(Image& gi, int& max_bitdepth, int& maxval,
-                  const CompressParams& cparams_, float channel_colors_percent,
-                  jxl::ThreadPool* pool = nullptr) {
+Status try_palettes(Image& gi, int& max_bitdepth, int& maxval,
+                    const CompressParams& cparams_,
+                    float channel_colors_percent,
+                    jxl::ThreadPool* pool = nullptr) {
   float cost_before = 0.f;
   size_t did_palette = 0;
   float nb_pixels = gi.channel[0].w * gi.channel[0].h;
@@ -336,9 +400,11 @@ void try_palettes(Image& gi, int& max_bitdepth, int& maxval,
 
   if (cparams_.palette_colors != 0 || cparams_.lossy_palette) {
     // when not estimating, assume some arbitrary bpp
-    cost_before = cparams_.speed_tier <= SpeedTier::kSquirrel
-                      ? EstimateCost(gi)
-                      : nb_pixels * arbitrary_bpp_estimate;
+    if (cparams_.speed_tier <= SpeedTier::kSquirrel) {
+      JXL_ASSIGN_OR_RETURN(cost_before, EstimateCost(gi, pool));
+    } else {
+      cost_before = nb_pixels * arbitrary_bpp_estimate;
+    }
     // all-channel palette (e.g. RGBA)
     if (nb_chans > 1) {
       Transform maybe_palette(TransformId::kPalette);
@@ -394,8 +460,10 @@ void try_palettes(Image& gi, int& max_bitdepth, int& maxval,
     int orig_bitdepth = max_bitdepth;
     max_bitdepth = 0;
     if (nb_channels > 0 && (did_palette || cost_before == 0)) {
-      cost_before =
-          cparams_.speed_tier < SpeedTier::kSquirrel ? EstimateCost(gi) : 0;
+      cost_before = 0;
+      if (cparams_.speed_tier < SpeedTier::kSquirrel) {
+        JXL_ASSIGN_OR_RETURN(cost_before, EstimateCost(gi, pool));
+      }
     }
     for (size_t i = did_palette; i < nb_channels + did_palette; i++) {
       int32_t min;
@@ -426,6 +494,23 @@ void try_palettes(Image& gi, int& max_bitdepth, int& maxval,
       }
     }
   }
+  return true;
+}
+
+// The group images are kept from PrepareStreamParams until they are encoded,
+// so they are stored as 16-bit (when their values fit) while they wait.
+Status CompactChannels(Image& image) {
+  for (Channel& ch : image.channel) {
+    JXL_RETURN_IF_ERROR(ch.Compact());
+  }
+  return true;
+}
+
+Status ExpandChannels(Image& image) {
+  for (Channel& ch : image.channel) {
+    JXL_RETURN_IF_ERROR(ch.Expand());
+  }
+  return true;
 }
 
 }  // namespace
@@ -483,6 +568,18 @@ Status ModularFrameEncoder::Init(const FrameHeader& frame_header,
     stream_images_.emplace_back(memory_manager_);
   }
 
+  // At the default effort and faster, the lossy extra channels of VarDCT
+  // frames skip Squeeze and tree learning, which would otherwise take about as
+  // long as encoding the color channels. Their samples are rounded to a
+  // multiple of a step, which the gradient predictor preserves, so that the
+  // fixed gradient tree only has to code the residuals divided by the step.
+  fast_lossy_extra_channels_ =
+      !cparams_.modular_mode && !cparams_.ModularPartIsLossless() &&
+      cparams_.responsive < 0 && cparams_.speed_tier >= SpeedTier::kSquirrel &&
+      cparams_.move_to_front_from_channel <= 0 &&
+      cparams_.custom_fixed_tree.empty();
+  if (fast_lossy_extra_channels_) cparams_.responsive = 0;
+
   // use a sensible default if nothing explicit is specified:
   // Squeeze for lossy, no squeeze for lossless
   if (cparams_.responsive < 0) {
@@ -512,6 +609,12 @@ Status ModularFrameEncoder::Init(const FrameHeader& frame_header,
         prop_order.erase(prop_order.begin() + 1);
       }
     }
+    // In streaming mode, trees never see more than one DC group, so splits on
+    // the group do not carry over to the groups that follow.
+    if (streaming_mode) {
+      prop_order.erase(std::remove(prop_order.begin(), prop_order.end(), 1),
+                       prop_order.end());
+    }
     int max_properties = std::min<int>(
         cparams_.options.max_properties,
         static_cast<int>(
@@ -609,6 +712,15 @@ Status ModularFrameEncoder::Init(const FrameHeader& frame_header,
         cparams_.options.predictor == Predictor::Best)
       cparams_.options.predictor = Predictor::Zero;
   }
+  // The decoder turns the trees that only split on the gradient property, with
+  // the gradient predictor, into a lookup table. Squeeze residuals and lossy
+  // palette keep the zero predictor, whose single-leaf trees are fast anyway.
+  if (cparams_.decoder_fast_paths &&
+      cparams_orig.options.predictor == kUndefinedPredictor &&
+      cparams_.options.predictor != Predictor::Zero) {
+    cparams_.options.predictor = Predictor::Gradient;
+    cparams_.options.wp_tree_mode = ModularOptions::TreeMode::kGradientOnly;
+  }
   tree_splits_.push_back(0);
   if (cparams_.modular_mode == false) {
     JXL_ASSIGN_OR_RETURN(ModularStreamId qt0, ModularStreamId::QuantTable(0));
@@ -631,7 +743,10 @@ Status ModularFrameEncoder::Init(const FrameHeader& frame_header,
   stream_options_[0] = cparams_.options;
   if (cparams_.speed_tier == SpeedTier::kFalcon) {
     stream_options_[0].tree_kind = ModularOptions::TreeKind::kWPFixedDC;
-  } else if (cparams_.speed_tier == SpeedTier::kThunder) {
+  } else if (cparams_.speed_tier >= SpeedTier::kThunder) {
+    stream_options_[0].tree_kind = ModularOptions::TreeKind::kGradientFixedDC;
+  }
+  if (fast_lossy_extra_channels_) {
     stream_options_[0].tree_kind = ModularOptions::TreeKind::kGradientFixedDC;
   }
   stream_options_[0].histogram_params =
@@ -646,6 +761,7 @@ Status ModularFrameEncoder::ComputeEncodingData(
     const Rect& frame_area_rect, PassesEncoderState* JXL_RESTRICT enc_state,
     const JxlCmsInterface& cms, ThreadPool* pool, AuxOut* aux_out,
     bool do_color) {
+  JXL_TRACE_SCOPE("ModularFrameEncoder::ComputeEncodingData");
   JxlMemoryManager* memory_manager = enc_state->memory_manager();
   JXL_DEBUG_V(6, "Computing modular encoding data for frame %s",
               frame_header.DebugString().c_str());
@@ -658,9 +774,12 @@ Status ModularFrameEncoder::ComputeEncodingData(
     JXL_RETURN_IF_ERROR(GaborishInverse(color, Rect(*color), weights, pool));
   }
 
+  // Like in LossyFrameHeuristics, the patch search is skipped when the frame
+  // already used a tenth of its time budget.
   if (do_color && metadata.bit_depth.bits_per_sample <= 16 &&
       cparams_.speed_tier < SpeedTier::kCheetah &&
-      cparams_.decoding_speed_tier < 2 && !groupwise) {
+      cparams_.decoding_speed_tier < 2 && !groupwise &&
+      TimeBudgetUsed(cparams_) < 0.1) {
     JXL_RETURN_IF_ERROR(FindBestPatchDictionary(
         *color, enc_state, cms, nullptr, aux_out,
         cparams_.color_transform == ColorTransform::kXYB));
@@ -843,8 +962,8 @@ Status ModularFrameEncoder::ComputeEncodingData(
     channel_colors_percent = cparams_.channel_colors_pre_transform_percent;
   }
   if (!groupwise) {
-    try_palettes(gi, max_bitdepth, maxval, cparams_, channel_colors_percent,
-                 pool);
+    JXL_RETURN_IF_ERROR(try_palettes(gi, max_bitdepth, maxval, cparams_,
+                                     channel_colors_percent, pool));
   }
 
   // don't do an RCT if we're short on bits
@@ -901,7 +1020,23 @@ Status ModularFrameEncoder::ComputeEncodingData(
   }
   JXL_ENSURE(max_bitdepth <= level_max_bitdepth);
 
-  if (!cparams_.ModularPartIsLossless()) {
+  if (!cparams_.ModularPartIsLossless() && fast_lossy_extra_channels_) {
+    quants_.resize(gi.channel.size(), 1);
+    // Without meta channels, the channels are still the extra channels.
+    for (size_t i = 0; gi.nb_meta_channels == 0 && i < extra_channels.size();
+         i++) {
+      const ExtraChannelInfo& eci = metadata.extra_channel_info[i];
+      if (eci.bit_depth.floating_point_sample) continue;
+      int ec_bitdepth = eci.bit_depth.bits_per_sample;
+      pixel_type ec_maxval = ec_bitdepth < 31 ? (1u << ec_bitdepth) - 1 : 0;
+      float dist = 0;
+      if (i < cparams_.ec_distance.size()) dist = cparams_.ec_distance[i];
+      if (dist < 0) dist = cparams_.butteraugli_distance;
+      int q = FastLossyExtraChannelStep(dist, ec_maxval);
+      QuantizeChannel(gi.channel[i], q);
+      quants_[i] = q;
+    }
+  } else if (!cparams_.ModularPartIsLossless()) {
     quants_.resize(gi.channel.size(), 1);
     float quantizer = 0.25f;
     if (!cparams_.responsive) {
@@ -1038,6 +1173,7 @@ Status ModularFrameEncoder::ComputeEncodingData(
 }
 
 Status ModularFrameEncoder::ComputeTree(ThreadPool* pool) {
+  JXL_TRACE_SCOPE("ModularFrameEncoder::ComputeTree");
   std::vector<ModularMultiplierInfo> multiplier_info;
   if (!quants_.empty()) {
     for (uint32_t stream_id = 0; stream_id < stream_images_.size();
@@ -1118,7 +1254,19 @@ Status ModularFrameEncoder::ComputeTree(ThreadPool* pool) {
     if (useful_splits.empty()) return true;
     useful_splits.push_back(tree_splits_.back());
 
-    std::vector<Tree> trees(useful_splits.size() - 1);
+    // With a time budget, the trees are learned from fewer samples once the
+    // frame used half of it.
+    if (TimeBudgetUsed(cparams_) > 0.5) {
+      for (ModularOptions& options : stream_options_) {
+        options.nb_repeats = std::min(options.nb_repeats, 0.1f);
+      }
+    }
+
+    size_t num_chunks = useful_splits.size() - 1;
+    std::vector<Tree> trees(num_chunks);
+    // Pool tasks cannot use the pool themselves, so with a single chunk (as
+    // in modular mode) the pool is given to the tree search instead.
+    ThreadPool* tree_pool = num_chunks == 1 ? pool : nullptr;
     const auto process_chunk = [&](const uint32_t chunk,
                                    size_t /* thread */) -> Status {
       // TODO(veluca): parallelize more.
@@ -1136,6 +1284,16 @@ Status ModularFrameEncoder::ComputeTree(ThreadPool* pool) {
         }
         trees[chunk] = PredefinedTree(stream_options_[start].tree_kind,
                                       total_pixels, 8, 0);
+        // Gradient predictions of samples that are all multiples of the same
+        // quantization factor are multiples of it too, so the residuals can
+        // be divided by it.
+        uint32_t multiplier = UniformMultiplier(multiplier_info, start, stop);
+        if (multiplier > 1 && stream_options_[start].tree_kind ==
+                                  ModularOptions::TreeKind::kGradientFixedDC) {
+          for (PropertyDecisionNode& node : trees[chunk]) {
+            if (node.property < 0) node.multiplier = multiplier;
+          }
+        }
         return true;
       }
       TreeSamples tree_samples;
@@ -1152,9 +1310,11 @@ Status ModularFrameEncoder::ComputeTree(ThreadPool* pool) {
       std::vector<uint32_t> channel_pixel_count;
       for (size_t i = start; i < stop; i++) {
         max_c = std::max<uint32_t>(stream_images_[i].channel.size(), max_c);
+        JXL_RETURN_IF_ERROR(ExpandChannels(stream_images_[i]));
         CollectPixelSamples(stream_images_[i], stream_options_[i], i,
                             group_pixel_count, channel_pixel_count,
                             pixel_samples, diff_samples);
+        if (i > 0) JXL_RETURN_IF_ERROR(CompactChannels(stream_images_[i]));
       }
       StaticPropRange range;
       range[0] = {{0, max_c}};
@@ -1165,23 +1325,27 @@ Status ModularFrameEncoder::ComputeTree(ThreadPool* pool) {
           pixel_samples, diff_samples,
           stream_options_[start].max_property_values);
       for (size_t i = start; i < stop; i++) {
+        JXL_RETURN_IF_ERROR(ExpandChannels(stream_images_[i]));
         JXL_RETURN_IF_ERROR(
             ModularGenericCompress(stream_images_[i], stream_options_[i],
                                    /*writer=*/nullptr,
                                    /*aux_out=*/nullptr, LayerType::Header, i,
                                    &tree_samples, &total_pixels));
+        if (i > 0) JXL_RETURN_IF_ERROR(CompactChannels(stream_images_[i]));
       }
 
-      // TODO(veluca): parallelize more.
       JXL_ASSIGN_OR_RETURN(
           trees[chunk],
           LearnTree(std::move(tree_samples), total_pixels,
-                    stream_options_[start], multiplier_info, range));
+                    stream_options_[start], multiplier_info, range, tree_pool));
       return true;
     };
-    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, useful_splits.size() - 1,
-                                  ThreadPool::NoInit, process_chunk,
-                                  "LearnTrees"));
+    if (tree_pool != nullptr) {
+      JXL_RETURN_IF_ERROR(process_chunk(0, 0));
+    } else {
+      JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_chunks, ThreadPool::NoInit,
+                                    process_chunk, "LearnTrees"));
+    }
     tree_.clear();
     JXL_RETURN_IF_ERROR(
         MergeTrees(trees, useful_splits, 0, useful_splits.size() - 1, &tree_));
@@ -1212,6 +1376,9 @@ Status ModularFrameEncoder::ComputeTree(ThreadPool* pool) {
   JXL_RETURN_IF_ERROR(TokenizeTree(tree_, tree_tokens_.data(), &decoded_tree));
   JXL_ENSURE(tree_.size() == decoded_tree.size());
   tree_ = std::move(decoded_tree);
+  if (cparams_.ma_tree_out != nullptr && cparams_.IsLossless()) {
+    *cparams_.ma_tree_out = tree_;
+  }
 
   /* TODO(szabadka) Add text output callback to cparams
   if (kPrintTree && WantDebugOutput(aux_out)) {
@@ -1226,6 +1393,7 @@ Status ModularFrameEncoder::ComputeTree(ThreadPool* pool) {
 }
 
 Status ModularFrameEncoder::ComputeTokens(ThreadPool* pool) {
+  JXL_TRACE_SCOPE("ModularFrameEncoder::ComputeTokens");
   size_t num_streams = stream_images_.size();
   stream_headers_.resize(num_streams);
   tokens_.resize(num_streams);
@@ -1234,6 +1402,7 @@ Status ModularFrameEncoder::ComputeTokens(ThreadPool* pool) {
                                   size_t /* thread */) -> Status {
     AuxOut my_aux_out;
     tokens_[stream_id].clear();
+    JXL_RETURN_IF_ERROR(ExpandChannels(stream_images_[stream_id]));
     JXL_RETURN_IF_ERROR(ModularGenericCompress(
         stream_images_[stream_id], stream_options_[stream_id],
         /*writer=*/nullptr, &my_aux_out, LayerType::Header, stream_id,
@@ -1242,6 +1411,9 @@ Status ModularFrameEncoder::ComputeTokens(ThreadPool* pool) {
         /*tree=*/&tree_, /*header=*/&stream_headers_[stream_id],
         /*tokens=*/&tokens_[stream_id],
         /*widths=*/&image_widths_[stream_id]));
+    if (stream_id > 0) {
+      JXL_RETURN_IF_ERROR(CompactChannels(stream_images_[stream_id]));
+    }
     return true;
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_streams, ThreadPool::NoInit,
@@ -1251,6 +1423,7 @@ Status ModularFrameEncoder::ComputeTokens(ThreadPool* pool) {
 
 Status ModularFrameEncoder::EncodeGlobalInfo(bool streaming_mode,
                                              BitWriter* writer,
+                                             ThreadPool* pool,
                                              AuxOut* aux_out) {
   JxlMemoryManager* memory_manager = writer->memory_manager();
   BitWriter::Allotment allotment(writer, 1);
@@ -1268,6 +1441,7 @@ Status ModularFrameEncoder::EncodeGlobalInfo(bool streaming_mode,
   // Write tree
   HistogramParams params =
       HistogramParams::ForModular(cparams_, extra_dc_precision, streaming_mode);
+  params.pool = pool;
   {
     EntropyEncodingData tree_code;
     std::vector<uint8_t> tree_context_map;
@@ -1283,6 +1457,11 @@ Status ModularFrameEncoder::EncodeGlobalInfo(bool streaming_mode,
   }
   params.streaming_mode = streaming_mode;
   params.add_missing_symbols = streaming_mode;
+  if (streaming_mode) {
+    // These codes are also used for the tokens of DC groups that are not
+    // tokenized yet, which could collide with LZ77 length symbols.
+    params.lz77_method = HistogramParams::LZ77Method::kNone;
+  }
   params.image_widths = image_widths_;
   // Write histograms.
   JXL_ASSIGN_OR_RETURN(
@@ -1303,6 +1482,7 @@ Status ModularFrameEncoder::EncodeStream(BitWriter* writer, AuxOut* aux_out,
     return true;  // Image with no channels, header never gets decoded.
   }
   if (tokens_.empty()) {
+    JXL_RETURN_IF_ERROR(ExpandChannels(stream_images_[stream_id]));
     JXL_RETURN_IF_ERROR(ModularGenericCompress(
         stream_images_[stream_id], stream_options_[stream_id], writer, aux_out,
         layer, stream_id));
@@ -1319,6 +1499,9 @@ void ModularFrameEncoder::ClearStreamData(const ModularStreamId& stream) {
   size_t stream_id = stream.ID(frame_dim_);
   Image empty_image(stream_images_[stream_id].memory_manager());
   std::swap(stream_images_[stream_id], empty_image);
+  if (stream_id < tokens_.size()) {
+    std::vector<Token>().swap(tokens_[stream_id]);
+  }
 }
 
 void ModularFrameEncoder::ClearModularStreamData() {
@@ -1394,7 +1577,8 @@ Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
       if (!(cparams_.responsive && cparams_.decoding_speed_tier >= 1)) {
         channel_color_percent = cparams_.channel_colors_percent;
       }
-      try_palettes(gi, max_bitdepth, maxval, cparams_, channel_color_percent);
+      JXL_RETURN_IF_ERROR(try_palettes(gi, max_bitdepth, maxval, cparams_,
+                                       channel_color_percent));
     }
   }
 
@@ -1447,7 +1631,7 @@ Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
       sg.rct_type = i;
       nb_rcts_to_try--;
       if (do_transform(gi, sg, weighted::Header())) {
-        float cost = EstimateCost(gi);
+        JXL_ASSIGN_OR_RETURN(float cost, EstimateCost(gi));
         if (cost < best_cost) {
           best_rct = i;
           best_cost = cost;
@@ -1483,6 +1667,7 @@ Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
       }
     }
   }
+  if (stream_id > 0) JXL_RETURN_IF_ERROR(CompactChannels(gi));
   return true;
 }
 
@@ -1536,7 +1721,7 @@ Status ModularFrameEncoder::AddVarDCTDC(const FrameHeader& frame_header,
         ModularOptions::TreeMode::kDefault;
     stream_options_[stream_id].tree_kind = ModularOptions::TreeKind::kLearn;
   }
-  if (cparams_.decoding_speed_tier >= 1) {
+  if (cparams_.decoding_speed_tier >= 1 || cparams_.decoder_fast_paths) {
     stream_options_[stream_id].tree_kind =
         ModularOptions::TreeKind::kGradientFixedDC;
   }
@@ -53,7 +53,7 @@ class ModularFrameEncoder {
   Status ComputeTokens(ThreadPool* pool);
   // Encodes global info (tree + histograms) in the `writer`.
   Status EncodeGlobalInfo(bool streaming_mode, BitWriter* writer,
-                          AuxOut* aux_out);
+                          ThreadPool* pool, AuxOut* aux_out);
   // Encodes a specific modular image (identified by `stream`) in the `writer`,
   // assigning bits to the provided `layer`.
   Status EncodeStream(BitWriter* writer, AuxOut* aux_out, LayerType layer,
@@ -107,6 +107,10 @@ class ModularFrameEncoder {
   std::vector<Image> stream_images_;
   std::vector<ModularOptions> stream_options_;
   std::vector<uint32_t> quants_;
+  // Whether the lossy extra channels of a VarDCT frame are quantized in place
+  // and encoded with a fixed gradient tree, instead of being squeezed and
+  // encoded with a learned tree.
+  bool fast_lossy_extra_channels_ = false;
 
   Tree tree_;
   std::vector<std::vector<Token>> tree_tokens_;
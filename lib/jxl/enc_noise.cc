@@ -10,7 +10,9 @@
 #include <cstdlib>
 #include <numeric>
 #include <utility>
+#include <vector>
 
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_optimize.h"
@@ -117,25 +119,6 @@ class NoiseHistogram {
   uint32_t bins[kBins];
 };
 
-std::vector<float> GetSADScoresForPatches(const Image3F& opsin,
-                                          const size_t block_s,
-                                          const size_t num_bin,
-                                          NoiseHistogram* sad_histogram) {
-  std::vector<float> sad_scores(
-      (opsin.ysize() / block_s) * (opsin.xsize() / block_s), 0.0f);
-
-  int block_index = 0;
-
-  for (size_t y = 0; y + block_s <= opsin.ysize(); y += block_s) {
-    for (size_t x = 0; x + block_s <= opsin.xsize(); x += block_s) {
-      float sad_sc = GetScoreSumsOfAbsoluteDifferences(opsin, x, y, block_s);
-      sad_scores[block_index++] = sad_sc;
-      sad_histogram->Increment(sad_sc * num_bin);
-    }
-  }
-  return sad_scores;
-}
-
 float GetSADThreshold(const NoiseHistogram& histogram, const int num_bin) {
   // Here we assume that the most patches with similar SAD value is a "flat"
   // patches. However, some images might contain regular texture part and
@@ -226,11 +209,10 @@ void OptimizeNoiseParameters(const std::vector<NoiseLevel>& noise_level,
   }
 }
 
-std::vector<NoiseLevel> GetNoiseLevel(
-    const Image3F& opsin, const std::vector<float>& texture_strength,
-    const float threshold, const size_t block_s) {
-  std::vector<NoiseLevel> noise_level_per_intensity;
-
+// The noise model is built based on channel 0.5 * (X+Y) as we notice that it
+// is similar to the model 0.5 * (Y-X)
+NoiseLevel GetPatchNoiseLevel(const Image3F& opsin, const size_t x,
+                              const size_t y, const size_t block_s) {
   const int filt_size = 1;
   static const float kLaplFilter[filt_size * 2 + 1][filt_size * 2 + 1] = {
       {-0.25f, -1.0f, -0.25f},
@@ -238,81 +220,69 @@ std::vector<NoiseLevel> GetNoiseLevel(
       {-0.25f, -1.0f, -0.25f},
   };
 
-  // The noise model is built based on channel 0.5 * (X+Y) as we notice that it
-  // is similar to the model 0.5 * (Y-X)
-  size_t patch_index = 0;
-
-  for (size_t y = 0; y + block_s <= opsin.ysize(); y += block_s) {
-    for (size_t x = 0; x + block_s <= opsin.xsize(); x += block_s) {
-      if (texture_strength[patch_index] <= threshold) {
-        // Calculate mean value
-        float mean_int = 0;
-        for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
-          for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
-            mean_int += 0.5f * (opsin.PlaneRow(1, y + y_bl)[x + x_bl] +
-                                opsin.PlaneRow(0, y + y_bl)[x + x_bl]);
+  // Calculate mean value
+  float mean_int = 0;
+  for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
+    for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
+      mean_int += 0.5f * (opsin.PlaneRow(1, y + y_bl)[x + x_bl] +
+                          opsin.PlaneRow(0, y + y_bl)[x + x_bl]);
+    }
+  }
+  mean_int /= block_s * block_s;
+
+  // Calculate Noise level
+  float noise_level = 0;
+  size_t count = 0;
+  for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
+    for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
+      float filtered_value = 0;
+      for (int y_f = -1 * filt_size; y_f <= filt_size; ++y_f) {
+        if ((static_cast<ssize_t>(y_bl) + y_f) >= 0 &&
+            (y_bl + y_f) < block_s) {
+          for (int x_f = -1 * filt_size; x_f <= filt_size; ++x_f) {
+            if ((static_cast<ssize_t>(x_bl) + x_f) >= 0 &&
+                (x_bl + x_f) < block_s) {
+              filtered_value +=
+                  0.5f *
+                  (opsin.PlaneRow(1, y + y_bl + y_f)[x + x_bl + x_f] +
+                   opsin.PlaneRow(0, y + y_bl + y_f)[x + x_bl + x_f]) *
+                  kLaplFilter[y_f + filt_size][x_f + filt_size];
+            } else {
+              filtered_value +=
+                  0.5f *
+                  (opsin.PlaneRow(1, y + y_bl + y_f)[x + x_bl - x_f] +
+                   opsin.PlaneRow(0, y + y_bl + y_f)[x + x_bl - x_f]) *
+                  kLaplFilter[y_f + filt_size][x_f + filt_size];
+            }
           }
-        }
-        mean_int /= block_s * block_s;
-
-        // Calculate Noise level
-        float noise_level = 0;
-        size_t count = 0;
-        for (size_t y_bl = 0; y_bl < block_s; ++y_bl) {
-          for (size_t x_bl = 0; x_bl < block_s; ++x_bl) {
-            float filtered_value = 0;
-            for (int y_f = -1 * filt_size; y_f <= filt_size; ++y_f) {
-              if ((static_cast<ssize_t>(y_bl) + y_f) >= 0 &&
-                  (y_bl + y_f) < block_s) {
-                for (int x_f = -1 * filt_size; x_f <= filt_size; ++x_f) {
-                  if ((static_cast<ssize_t>(x_bl) + x_f) >= 0 &&
-                      (x_bl + x_f) < block_s) {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl + y_f)[x + x_bl + x_f] +
-                         opsin.PlaneRow(0, y + y_bl + y_f)[x + x_bl + x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  } else {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl + y_f)[x + x_bl - x_f] +
-                         opsin.PlaneRow(0, y + y_bl + y_f)[x + x_bl - x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  }
-                }
-              } else {
-                for (int x_f = -1 * filt_size; x_f <= filt_size; ++x_f) {
-                  if ((static_cast<ssize_t>(x_bl) + x_f) >= 0 &&
-                      (x_bl + x_f) < block_s) {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl - y_f)[x + x_bl + x_f] +
-                         opsin.PlaneRow(0, y + y_bl - y_f)[x + x_bl + x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  } else {
-                    filtered_value +=
-                        0.5f *
-                        (opsin.PlaneRow(1, y + y_bl - y_f)[x + x_bl - x_f] +
-                         opsin.PlaneRow(0, y + y_bl - y_f)[x + x_bl - x_f]) *
-                        kLaplFilter[y_f + filt_size][x_f + filt_size];
-                  }
-                }
-              }
+        } else {
+          for (int x_f = -1 * filt_size; x_f <= filt_size; ++x_f) {
+            if ((static_cast<ssize_t>(x_bl) + x_f) >= 0 &&
+                (x_bl + x_f) < block_s) {
+              filtered_value +=
+                  0.5f *
+                  (opsin.PlaneRow(1, y + y_bl - y_f)[x + x_bl + x_f] +
+                   opsin.PlaneRow(0, y + y_bl - y_f)[x + x_bl + x_f]) *
+                  kLaplFilter[y_f + filt_size][x_f + filt_size];
+            } else {
+              filtered_value +=
+                  0.5f *
+                  (opsin.PlaneRow(1, y + y_bl - y_f)[x + x_bl - x_f] +
+                   opsin.PlaneRow(0, y + y_bl - y_f)[x + x_bl - x_f]) *
+                  kLaplFilter[y_f + filt_size][x_f + filt_size];
             }
-            noise_level += std::abs(filtered_value);
-            ++count;
           }
         }
-        noise_level /= count;
-        NoiseLevel nl;
-        nl.intensity = mean_int;
-        nl.noise_level = noise_level;
-        noise_level_per_intensity.push_back(nl);
       }
-      ++patch_index;
+      noise_level += std::abs(filtered_value);
+      ++count;
     }
   }
-  return noise_level_per_intensity;
+  noise_level /= count;
+  NoiseLevel nl;
+  nl.intensity = mean_int;
+  nl.noise_level = noise_level;
+  return nl;
 }
 
 Status EncodeFloatParam(float val, float precision, BitWriter* writer) {
@@ -325,18 +295,26 @@ Status EncodeFloatParam(float val, float precision, BitWriter* writer) {
 
 }  // namespace
 
-Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
-                         float quality_coef) {
-  // The size of a patch in decoder might be different from encoder's patch
-  // size.
-  // For encoder: the patch size should be big enough to estimate
-  //              noise level, but, at the same time, it should be not too big
-  //              to be able to estimate intensity value of the patch
-  const size_t block_s = 8;
+void NoiseEstimator::AddPatches(const Image3F& opsin, const Rect& rect) {
+  for (size_t y = 0; y + kBlockSize <= rect.ysize(); y += kBlockSize) {
+    for (size_t x = 0; x + kBlockSize <= rect.xsize(); x += kBlockSize) {
+      Patch patch;
+      patch.sad = GetScoreSumsOfAbsoluteDifferences(
+          opsin, rect.x0() + x, rect.y0() + y, kBlockSize);
+      patch.level =
+          GetPatchNoiseLevel(opsin, rect.x0() + x, rect.y0() + y, kBlockSize);
+      patches_.push_back(patch);
+    }
+  }
+}
+
+Status NoiseEstimator::Estimate(NoiseParams* noise_params,
+                                float quality_coef) const {
   const size_t kNumBin = 256;
   NoiseHistogram sad_histogram;
-  std::vector<float> sad_scores =
-      GetSADScoresForPatches(opsin, block_s, kNumBin, &sad_histogram);
+  for (const Patch& patch : patches_) {
+    sad_histogram.Increment(patch.sad * kNumBin);
+  }
   float sad_threshold = GetSADThreshold(sad_histogram, kNumBin);
   // If threshold is too large, the image has a strong pattern. This pattern
   // fools our model and it will add too much noise. Therefore, we do not add
@@ -345,8 +323,10 @@ Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
     noise_params->Clear();
     return false;
   }
-  std::vector<NoiseLevel> nl =
-      GetNoiseLevel(opsin, sad_scores, sad_threshold, block_s);
+  std::vector<NoiseLevel> nl;
+  for (const Patch& patch : patches_) {
+    if (patch.sad <= sad_threshold) nl.push_back(patch.level);
+  }
 
   OptimizeNoiseParameters(nl, noise_params);
   for (float& i : noise_params->lut) {
@@ -355,6 +335,13 @@ Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
   return noise_params->HasAny();
 }
 
+Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
+                         float quality_coef) {
+  NoiseEstimator estimator;
+  estimator.AddPatches(opsin, Rect(opsin));
+  return estimator.Estimate(noise_params, quality_coef);
+}
+
 Status EncodeNoise(const NoiseParams& noise_params, BitWriter* writer,
                    LayerType layer, AuxOut* aux_out) {
   JXL_ENSURE(noise_params.HasAny());
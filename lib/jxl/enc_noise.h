@@ -8,8 +8,11 @@
 
 // Noise parameter estimation.
 
+#include <cstddef>
 #include <cstdint>
+#include <vector>
 
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/image.h"
@@ -20,6 +23,37 @@ namespace jxl {
 struct AuxOut;
 enum class LayerType : uint8_t;
 
+// Estimates the noise parameters from the 8x8 patches of the opsin image,
+// which can be added band by band, so that the whole image does not need to
+// be available at once.
+class NoiseEstimator {
+ public:
+  // The size of a patch in decoder might be different from encoder's patch
+  // size.
+  // For encoder: the patch size should be big enough to estimate
+  //              noise level, but, at the same time, it should be not too big
+  //              to be able to estimate intensity value of the patch
+  static constexpr size_t kBlockSize = 8;
+
+  // Adds the complete patches of `rect` of `opsin`, which only reads pixels
+  // inside `rect`. Patches start at the top-left corner of `rect`, so bands
+  // should start at multiples of kBlockSize rows of the image. Adding the
+  // bands from top to bottom gives the same result as GetNoiseParameter on the
+  // whole image.
+  void AddPatches(const Image3F& opsin, const Rect& rect);
+
+  // Get parameters of the noise for NoiseParams model
+  // Returns whether a valid noise model (with HasAny()) is set.
+  Status Estimate(NoiseParams* noise_params, float quality_coef) const;
+
+ private:
+  struct Patch {
+    float sad;
+    NoiseLevel level;
+  };
+  std::vector<Patch> patches_;
+};
+
 // Get parameters of the noise for NoiseParams model
 // Returns whether a valid noise model (with HasAny()) is set.
 Status GetNoiseParameter(const Image3F& opsin, NoiseParams* noise_params,
@@ -12,6 +12,7 @@
 #include <jxl/encode.h>
 #include <stddef.h>
 
+#include <chrono>
 #include <vector>
 
 #include "lib/jxl/base/override.h"
@@ -25,6 +26,10 @@
 
 namespace jxl {
 
+struct FrameAnalysis;
+struct FrameHeuristicsHistory;
+struct SharedPatchDictionary;
+
 // NOLINTNEXTLINE(clang-analyzer-optin.performance.Padding)
 struct CompressParams {
   float butteraugli_distance = 1.0f;
@@ -37,6 +42,25 @@ struct CompressParams {
   bool max_error_mode = false;
   float max_error[3] = {0.0, 0.0, 0.0};
 
+  // If positive, the global quantization of VarDCT frames is searched so that
+  // the butteraugli score of the result is close to this value, starting from
+  // butteraugli_distance.
+  float target_butteraugli_score = 0.0f;
+
+  // If positive, the scale of the AC quantization of VarDCT frames is searched
+  // so that the estimated size of the frame in bytes is close to this value.
+  size_t target_size = 0;
+
+  // See JXL_ENC_FRAME_SETTING_AC_STRATEGY_PRUNING option value.
+  int ac_strategy_pruning = -1;
+
+  // If positive, the wall-clock time in milliseconds that the encoding of each
+  // frame should take: the searches that only improve the compression are
+  // shortened or skipped as the frame uses it up, see TimeBudgetUsed.
+  float time_budget_ms = 0.0f;
+  // Set by EncodeFrame when the frame starts encoding.
+  std::chrono::steady_clock::time_point time_budget_start;
+
   bool disable_perceptual_optimizations = false;
 
   SpeedTier speed_tier = SpeedTier::kSquirrel;
@@ -46,6 +70,10 @@ struct CompressParams {
   // 1 = slightly worse quality.
   // 4 = fastest speed, lowest quality
   size_t decoding_speed_tier = 0;
+  // See JXL_ENC_FRAME_SETTING_DECODER_FAST_PATHS option value.
+  bool decoder_fast_paths = false;
+  // See JXL_ENC_FRAME_SETTING_SAMPLED_HISTOGRAMS option value.
+  bool sampled_histograms = false;
 
   ColorTransform color_transform = ColorTransform::kXYB;
 
@@ -76,12 +104,21 @@ struct CompressParams {
   size_t center_x = static_cast<size_t>(-1);
   size_t center_y = static_cast<size_t>(-1);
 
+  // Lay out the frame for progressive delivery over the network: progressive
+  // AC unless set otherwise, and the DC groups also in center-first order.
+  bool progressive_layout = false;
+
   int progressive_dc = -1;
 
   // If on: preserve color of invisible pixels (if off: don't care)
   // Default: on
   Override keep_invisible = Override::kDefault;
 
+  // If on: use the built-in static entropy codes instead of building
+  // histograms from the tokens of the frame (if off: always build them).
+  // Default: off
+  Override static_entropy_codes = Override::kDefault;
+
   JxlCmsInterface cms;
   bool cms_set = false;
   void SetCms(const JxlCmsInterface& cms) {
@@ -169,6 +206,8 @@ struct CompressParams {
 
   // See JXL_ENC_FRAME_SETTING_BUFFERING option value.
   int buffering = -1;
+  // See JXL_ENC_FRAME_SETTING_SPILL_TO_DISK option value.
+  bool spill_to_disk = false;
   // See JXL_ENC_FRAME_SETTING_USE_FULL_IMAGE_HEURISTICS option value.
   bool use_full_image_heuristics = true;
 
@@ -176,13 +215,37 @@ struct CompressParams {
   std::vector<float> manual_xyb_factors;
 
   // If not empty, this tree will be used for dc global section.
-  // Used in jxl_from_tree tool.
+  // Used in jxl_from_tree tool and by JxlEncoderFrameSettingsSetMATree.
   Tree custom_fixed_tree;
+  // If not null, receives the global tree of a lossless modular frame, which
+  // is then learned even where local trees would be used otherwise. Used by
+  // JxlEncoderCollectMATree.
+  Tree* ma_tree_out = nullptr;
   // If not empty, these custom splines will be used instead of the computed
   // ones. Used in jxl_from_tee tool.
   Splines custom_splines;
   // If not null, overrides progressive mode settings. Used in decode_test.
   const ProgressiveMode* custom_progressive_mode = nullptr;
+  // See JXL_ENC_FRAME_SETTING_REUSE_PREVIOUS_HEURISTICS option value.
+  bool reuse_previous_heuristics = false;
+  // If not null, the heuristics of the previous frame are reused where the
+  // image did not change, and those of this frame are stored for the next one.
+  // Set by the encoder API when reuse_previous_heuristics is enabled.
+  FrameHeuristicsHistory* heuristics_history = nullptr;
+  // If not null, filled by the first encoding of the frame and reused by the
+  // following ones, see JxlEncoderFrameSettingsSetAnalysis.
+  FrameAnalysis* analysis = nullptr;
+  // See JXL_ENC_FRAME_SETTING_SHARED_PATCHES option value.
+  bool share_patches = false;
+  // If not null, the patches are taken from this dictionary when it has all of
+  // them, and a new dictionary stored by this frame is kept in it for the next
+  // one. Set by the encoder API when share_patches is enabled.
+  SharedPatchDictionary* shared_patches = nullptr;
+  // If not null, called between the groups of the frame, which fails to encode
+  // once it returns true. Set by the encoder API, see
+  // JxlEncoderSetCancelCallback.
+  JxlEncoderCancelCallback cancel = nullptr;
+  void* cancel_opaque = nullptr;
 
   JxlDebugImageCallback debug_image = nullptr;
   void* debug_image_opaque;
@@ -195,6 +258,15 @@ static constexpr float kMinButteraugliToSubtractOriginalPatches = 3.0f;
 // Always off
 static constexpr float kMinButteraugliForNoise = 99.0f;
 
+// Fraction of CompressParams::time_budget_ms that the current frame used so
+// far, or 0 without a budget.
+static inline double TimeBudgetUsed(const CompressParams& cparams) {
+  if (cparams.time_budget_ms <= 0) return 0.0;
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - cparams.time_budget_start;
+  return elapsed.count() / cparams.time_budget_ms;
+}
+
 // Minimum butteraugli distance the encoder accepts.
 static constexpr float kMinButteraugliDistance = 0.001f;
 
@@ -13,6 +13,7 @@
 #include <atomic>
 #include <cstdint>
 #include <cstdlib>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -28,6 +29,7 @@
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_cache.h"
+#include "lib/jxl/enc_content_classifier.h"
 #include "lib/jxl/enc_debug_image.h"
 #include "lib/jxl/enc_dot_dictionary.h"
 #include "lib/jxl/enc_frame.h"
@@ -37,6 +39,7 @@
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/pack_signed.h"
 #include "lib/jxl/patch_dictionary_internal.h"
+#include "lib/jxl/trace_internal.h"
 
 namespace jxl {
 
@@ -246,12 +249,15 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
                                              opsin.ConstPlaneRow(1, 0),
                                              opsin.ConstPlaneRow(2, 0)};
 
+  // Maximum difference of pixels that are considered equal.
+  constexpr float kSameThreshold = 1e-4f;
+
   auto is_same = [&opsin_rows, opsin_stride](std::pair<uint32_t, uint32_t> p1,
                                              std::pair<uint32_t, uint32_t> p2) {
     for (auto& opsin_row : opsin_rows) {
       float v1 = opsin_row[p1.second * opsin_stride + p1.first];
       float v2 = opsin_row[p2.second * opsin_stride + p2.first];
-      if (std::fabs(v1 - v2) > 1e-4) {
+      if (std::fabs(v1 - v2) > kSameThreshold) {
         return false;
       }
     }
@@ -275,33 +281,57 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
   ZeroFillImage(&is_screenshot_like);
   uint8_t* JXL_RESTRICT screenshot_row = is_screenshot_like.Row(0);
   const size_t screenshot_stride = is_screenshot_like.PixelsPerRow();
+  // Groups classified as photographic content are not searched.
+  const ImageB& group_content = state->group_content;
   const auto process_row = [&](const uint32_t y,
                                size_t /* thread */) -> Status {
+    const uint8_t* content_row =
+        group_content.xsize() == 0
+            ? nullptr
+            : group_content.ConstRow(y * kPatchSide / frame_dim.group_dim);
     for (uint64_t x = 0; x < frame_dim.xsize / kPatchSide; x++) {
+      if (content_row &&
+          content_row[x * kPatchSide / frame_dim.group_dim] ==
+              static_cast<uint8_t>(GroupContent::kPhoto)) {
+        continue;
+      }
+      const size_t x0 = x * kPatchSide;
+      const size_t y0 = y * kPatchSide;
+      const size_t pos0 = y0 * opsin_stride + x0;
+      const float ref[3] = {opsin_rows[0][pos0], opsin_rows[1][pos0],
+                            opsin_rows[2][pos0]};
+      // The loops below have no early exit within a row, so that they can be
+      // vectorized; most squares of photographic content fail on the first
+      // row.
       bool all_same = true;
-      for (size_t iy = 0; iy < static_cast<size_t>(kPatchSide); iy++) {
-        for (size_t ix = 0; ix < static_cast<size_t>(kPatchSide); ix++) {
-          size_t cx = x * kPatchSide + ix;
-          size_t cy = y * kPatchSide + iy;
-          if (!is_same({cx, cy}, {x * kPatchSide, y * kPatchSide})) {
-            all_same = false;
-            break;
+      for (size_t iy = 0; iy < static_cast<size_t>(kPatchSide) && all_same;
+           iy++) {
+        for (size_t c = 0; c < 3; c++) {
+          const float* JXL_RESTRICT row =
+              opsin_rows[c] + (y0 + iy) * opsin_stride + x0;
+          for (size_t ix = 0; ix < static_cast<size_t>(kPatchSide); ix++) {
+            all_same &= std::fabs(row[ix] - ref[c]) <= kSameThreshold;
           }
         }
       }
       if (!all_same) continue;
-      size_t num = 0;
+      const size_t x_begin = x0 - std::min<size_t>(x0, kExtraSide);
+      const size_t x_end =
+          std::min<size_t>(x0 + kPatchSide + kExtraSide, frame_dim.xsize);
+      const size_t y_begin = y0 - std::min<size_t>(y0, kExtraSide);
+      const size_t y_end =
+          std::min<size_t>(y0 + kPatchSide + kExtraSide, frame_dim.ysize);
+      const size_t num = (x_end - x_begin) * (y_end - y_begin);
       size_t num_same = 0;
-      for (int64_t iy = -kExtraSide; iy < kExtraSide + kPatchSide; iy++) {
-        for (int64_t ix = -kExtraSide; ix < kExtraSide + kPatchSide; ix++) {
-          int64_t cx = x * kPatchSide + ix;
-          int64_t cy = y * kPatchSide + iy;
-          if (cx < 0 || static_cast<uint64_t>(cx) >= frame_dim.xsize ||  //
-              cy < 0 || static_cast<uint64_t>(cy) >= frame_dim.ysize) {
-            continue;
-          }
-          num++;
-          if (is_same({cx, cy}, {x * kPatchSide, y * kPatchSide})) num_same++;
+      for (size_t cy = y_begin; cy < y_end; cy++) {
+        const float* JXL_RESTRICT rows[3] = {
+            opsin_rows[0] + cy * opsin_stride,
+            opsin_rows[1] + cy * opsin_stride,
+            opsin_rows[2] + cy * opsin_stride};
+        for (size_t cx = x_begin; cx < x_end; cx++) {
+          num_same += (std::fabs(rows[0][cx] - ref[0]) <= kSameThreshold) &
+                      (std::fabs(rows[1][cx] - ref[1]) <= kSameThreshold) &
+                      (std::fabs(rows[2][cx] - ref[2]) <= kSameThreshold);
         }
       }
       // Too few equal pixels nearby.
@@ -439,6 +469,16 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
   const size_t visited_stride = visited.PixelsPerRow();
   std::vector<std::pair<uint32_t, uint32_t>> cc;
   std::vector<std::pair<uint32_t, uint32_t>> stack;
+  struct Candidate {
+    size_t min_x;
+    size_t min_y;
+    size_t max_x;
+    size_t max_y;
+    std::pair<uint32_t, uint32_t> reference;
+    bool accepted;
+  };
+  std::vector<Candidate> candidates;
+  std::vector<std::vector<std::pair<uint32_t, uint32_t>>> candidate_ccs;
   for (size_t y = 0; y < frame_dim.ysize; y++) {
     for (size_t x = 0; x < frame_dim.xsize; x++) {
       if (is_background_row[y * is_background_stride + x]) continue;
@@ -493,57 +533,94 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
           max_y - min_y >= kMaxPatchSize) {
         continue;
       }
-      size_t bpos = background_stride * reference.second + reference.first;
-      float ref[3] = {background_rows[0][bpos], background_rows[1][bpos],
-                      background_rows[2][bpos]};
-      bool has_similar = false;
-      for (size_t iy = std::max<int>(
-               static_cast<int32_t>(min_y) - kHasSimilarRadius, 0);
-           iy < std::min(max_y + kHasSimilarRadius + 1, frame_dim.ysize);
-           iy++) {
-        for (size_t ix = std::max<int>(
-                 static_cast<int32_t>(min_x) - kHasSimilarRadius, 0);
-             ix < std::min(max_x + kHasSimilarRadius + 1, frame_dim.xsize);
-             ix++) {
-          size_t opos = opsin_stride * iy + ix;
-          float px[3] = {opsin_rows[0][opos], opsin_rows[1][opos],
-                         opsin_rows[2][opos]};
-          if (pci.is_similar_v(ref, px, kHasSimilarThreshold)) {
-            has_similar = true;
-          }
+      candidates.push_back({min_x, min_y, max_x, max_y, reference, false});
+      if (paint_ccs) candidate_ccs.push_back(cc);
+    }
+  }
+
+  // The remaining checks only read the image, and run on the pool.
+  const auto check_candidate = [&](const uint32_t i,
+                                   size_t /* thread */) -> Status {
+    Candidate& cand = candidates[i];
+    size_t bpos =
+        background_stride * cand.reference.second + cand.reference.first;
+    float ref[3] = {background_rows[0][bpos], background_rows[1][bpos],
+                    background_rows[2][bpos]};
+    bool has_similar = false;
+    for (size_t iy = std::max<int>(
+             static_cast<int32_t>(cand.min_y) - kHasSimilarRadius, 0);
+         iy < std::min(cand.max_y + kHasSimilarRadius + 1, frame_dim.ysize) &&
+         !has_similar;
+         iy++) {
+      for (size_t ix = std::max<int>(
+               static_cast<int32_t>(cand.min_x) - kHasSimilarRadius, 0);
+           ix < std::min(cand.max_x + kHasSimilarRadius + 1, frame_dim.xsize);
+           ix++) {
+        size_t opos = opsin_stride * iy + ix;
+        float px[3] = {opsin_rows[0][opos], opsin_rows[1][opos],
+                       opsin_rows[2][opos]};
+        if (pci.is_similar_v(ref, px, kHasSimilarThreshold)) {
+          has_similar = true;
         }
       }
-      if (!has_similar) continue;
-      info.emplace_back();
-      info.back().second.emplace_back(min_x, min_y);
-      QuantizedPatch& patch = info.back().first;
-      patch.xsize = max_x - min_x + 1;
-      patch.ysize = max_y - min_y + 1;
-      int max_value = 0;
-      for (size_t c : {1, 0, 2}) {
-        for (size_t iy = min_y; iy <= max_y; iy++) {
-          for (size_t ix = min_x; ix <= max_x; ix++) {
-            size_t offset = (iy - min_y) * patch.xsize + ix - min_x;
-            patch.fpixels[c][offset] =
-                opsin_rows[c][iy * opsin_stride + ix] - ref[c];
-            int val = pci.Quantize(patch.fpixels[c][offset], c);
-            patch.pixels[c][offset] = val;
-            if (std::abs(val) > max_value) max_value = std::abs(val);
-          }
+    }
+    if (!has_similar) return true;
+    int max_value = 0;
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t iy = cand.min_y; iy <= cand.max_y; iy++) {
+        for (size_t ix = cand.min_x; ix <= cand.max_x; ix++) {
+          int val =
+              pci.Quantize(opsin_rows[c][iy * opsin_stride + ix] - ref[c], c);
+          max_value = std::max(max_value, std::abs(val));
         }
       }
-      if (max_value < kMinPeak) {
-        info.pop_back();
-        continue;
+    }
+    cand.accepted = max_value >= kMinPeak;
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, candidates.size(), ThreadPool::NoInit,
+                                check_candidate, "CheckPatchCandidates"));
+
+  std::vector<size_t> accepted;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (!candidates[i].accepted) continue;
+    accepted.push_back(i);
+    info.emplace_back();
+    info.back().second.emplace_back(candidates[i].min_x, candidates[i].min_y);
+    if (paint_ccs) {
+      float cc_color = rng.UniformF(0.5, 1.0);
+      for (std::pair<uint32_t, uint32_t> p : candidate_ccs[i]) {
+        ccs.Row(p.second)[p.first] = cc_color;
       }
-      if (paint_ccs) {
-        float cc_color = rng.UniformF(0.5, 1.0);
-        for (std::pair<uint32_t, uint32_t> p : cc) {
-          ccs.Row(p.second)[p.first] = cc_color;
+    }
+  }
+
+  const auto extract_patch = [&](const uint32_t i,
+                                 size_t /* thread */) -> Status {
+    const Candidate* cand = &candidates[accepted[i]];
+    const size_t min_x = cand->min_x;
+    const size_t min_y = cand->min_y;
+    QuantizedPatch& patch = info[i].first;
+    size_t bpos =
+        background_stride * cand->reference.second + cand->reference.first;
+    float ref[3] = {background_rows[0][bpos], background_rows[1][bpos],
+                    background_rows[2][bpos]};
+    patch.xsize = cand->max_x - min_x + 1;
+    patch.ysize = cand->max_y - min_y + 1;
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t iy = min_y; iy <= cand->max_y; iy++) {
+        for (size_t ix = min_x; ix <= cand->max_x; ix++) {
+          size_t offset = (iy - min_y) * patch.xsize + ix - min_x;
+          patch.fpixels[c][offset] =
+              opsin_rows[c][iy * opsin_stride + ix] - ref[c];
+          patch.pixels[c][offset] = pci.Quantize(patch.fpixels[c][offset], c);
         }
       }
     }
-  }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, info.size(), ThreadPool::NoInit,
+                                extract_patch, "ExtractPatches"));
 
   if (paint_ccs) {
     JXL_ENSURE(WantDebugOutput(cparams));
@@ -553,25 +630,50 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
     return info;
   }
 
-  // Remove duplicates.
+  // Remove duplicates. Patches are grouped by a hash computed on the pool, so
+  // that the full comparison only runs between patches with the same hash.
   constexpr size_t kMinPatchOccurrences = 2;
-  std::sort(info.begin(), info.end());
-  size_t unique = 0;
-  for (size_t i = 1; i < info.size(); i++) {
-    if (info[i].first == info[unique].first) {
-      info[unique].second.insert(info[unique].second.end(),
-                                 info[i].second.begin(), info[i].second.end());
-    } else {
-      if (info[unique].second.size() >= kMinPatchOccurrences) {
-        unique++;
+  std::vector<uint64_t> hashes(info.size());
+  const auto hash_patch = [&](const uint32_t i, size_t /* thread */) -> Status {
+    const QuantizedPatch& patch = info[i].first;
+    uint64_t hash = patch.xsize * 0x9E3779B97F4A7C15ull + patch.ysize;
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t k = 0; k < patch.xsize * patch.ysize; k++) {
+        hash = (hash ^ static_cast<uint8_t>(patch.pixels[c][k])) *
+               0x100000001B3ull;
       }
-      info[unique] = info[i];
     }
+    hashes[i] = hash;
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, info.size(), ThreadPool::NoInit,
+                                hash_patch, "HashPatches"));
+  std::vector<size_t> order(info.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if (hashes[a] != hashes[b]) return hashes[a] < hashes[b];
+    if (info[a].first < info[b].first) return true;
+    if (info[b].first < info[a].first) return false;
+    return a < b;
+  });
+  std::vector<PatchInfo> unique_info;
+  for (size_t i = 0; i < order.size();) {
+    size_t end = i + 1;
+    while (end < order.size() && hashes[order[end]] == hashes[order[i]] &&
+           info[order[end]].first == info[order[i]].first) {
+      end++;
+    }
+    if (end - i >= kMinPatchOccurrences) {
+      unique_info.emplace_back(std::move(info[order[i]]));
+      auto& positions = unique_info.back().second;
+      for (size_t j = i + 1; j < end; j++) {
+        positions.insert(positions.end(), info[order[j]].second.begin(),
+                         info[order[j]].second.end());
+      }
+    }
+    i = end;
   }
-  if (info[unique].second.size() >= kMinPatchOccurrences) {
-    unique++;
-  }
-  info.resize(unique);
+  info = std::move(unique_info);
 
   size_t max_patch_size = 0;
 
@@ -589,12 +691,87 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
   return info;
 }
 
+// Adds the blendings of one patch position: the patch is added to the color
+// channels and not applied to the extra channels.
+void AddPatchBlendings(size_t num_ec, std::vector<PatchBlending>* blendings) {
+  blendings->push_back({PatchBlendMode::kAdd, 0, false});
+  for (size_t j = 0; j < num_ec; ++j) {
+    blendings->push_back({PatchBlendMode::kNone, 0, false});
+  }
+}
+
+// Uses the current shared dictionary, which the decoder still has as reference
+// frame, if it has all the patches of `info`. Returns false otherwise.
+StatusOr<bool> UseSharedPatches(const std::vector<PatchInfo>& info,
+                                bool is_xyb,
+                                PassesEncoderState* JXL_RESTRICT state) {
+  const SharedPatchDictionary::Dictionary& dict =
+      state->cparams.shared_patches->current;
+  if (!dict.reference || dict.is_xyb != is_xyb) return false;
+  std::vector<PatchReferencePosition> pref_positions;
+  for (const auto& patch : info) {
+    auto it = dict.patches.find(patch.first);
+    if (it == dict.patches.end()) return false;
+    pref_positions.push_back(it->second);
+  }
+  std::vector<PatchPosition> positions;
+  std::vector<PatchBlending> blendings;
+  size_t num_ec = state->shared.metadata->m.num_extra_channels;
+  for (size_t i = 0; i < info.size(); i++) {
+    for (const auto& pos : info[i].second) {
+      positions.emplace_back(PatchPosition{pos.first, pos.second, i});
+      AddPatchBlendings(num_ec, &blendings);
+    }
+  }
+  ReferceFrame& ref = state->shared.reference_frames[kPatchFrameReferenceId];
+  JXL_ASSIGN_OR_RETURN(ImageBundle reference, dict.reference->Copy());
+  ref.frame = jxl::make_unique<ImageBundle>(std::move(reference));
+  ref.ib_is_in_xyb = dict.ib_is_in_xyb;
+  ref.half_planes.clear();
+  PatchDictionaryEncoder::SetPositions(
+      &state->shared.image_features.patches, std::move(positions),
+      std::move(pref_positions), std::move(blendings), num_ec + 1);
+  return true;
+}
+
+// Appends the patches of the current shared dictionary that are not in `info`,
+// without positions, so that they stay available to the next frames, as long as
+// the dictionary stays within `max_pixels`.
+void AddSharedPatches(const SharedPatchDictionary::Dictionary& dict,
+                      bool is_xyb, size_t max_pixels,
+                      std::vector<PatchInfo>* info) {
+  if (!dict.reference || dict.is_xyb != is_xyb) return;
+  size_t total_pixels = 0;
+  std::vector<const QuantizedPatch*> found;
+  for (const auto& patch : *info) {
+    total_pixels += patch.first.xsize * patch.first.ysize;
+    found.push_back(&patch.first);
+  }
+  const auto less = [](const QuantizedPatch* a, const QuantizedPatch* b) {
+    return *a < *b;
+  };
+  std::sort(found.begin(), found.end(), less);
+  for (const auto& patch : dict.patches) {
+    size_t pixels = patch.first.xsize * patch.first.ysize;
+    if (total_pixels + pixels > max_pixels) continue;
+    if (std::binary_search(found.begin(), found.end(), &patch.first, less)) {
+      continue;
+    }
+    info->emplace_back(patch.first,
+                       std::vector<std::pair<uint32_t, uint32_t>>());
+    total_pixels += pixels;
+  }
+}
+
 }  // namespace
 
 Status FindBestPatchDictionary(const Image3F& opsin,
                                PassesEncoderState* JXL_RESTRICT state,
                                const JxlCmsInterface& cms, ThreadPool* pool,
                                AuxOut* aux_out, bool is_xyb) {
+  JXL_TRACE_SCOPE("FindBestPatchDictionary");
+  SharedPatchDictionary* shared_patches = state->cparams.shared_patches;
+  if (shared_patches != nullptr) shared_patches->has_next = false;
   JXL_ASSIGN_OR_RETURN(
       std::vector<PatchInfo> info,
       FindTextLikePatches(state->cparams, opsin, state, pool, aux_out, is_xyb));
@@ -611,13 +788,28 @@ Status FindBestPatchDictionary(const Image3F& opsin,
               !state->cparams.disable_perceptual_optimizations)) {
     Rect rect(0, 0, state->shared.frame_dim.xsize,
               state->shared.frame_dim.ysize);
-    JXL_ASSIGN_OR_RETURN(info,
-                         FindDotDictionary(state->cparams, opsin, rect,
-                                           state->shared.cmap.base(), pool));
+    JXL_ASSIGN_OR_RETURN(
+        info, FindDotDictionary(state->cparams, opsin, rect,
+                                state->shared.cmap.base(), pool,
+                                &state->group_content,
+                                state->shared.frame_dim.group_dim));
   }
 
   if (info.empty()) return true;
 
+  if (shared_patches != nullptr) {
+    JXL_ASSIGN_OR_RETURN(bool used_shared,
+                         UseSharedPatches(info, is_xyb, state));
+    if (used_shared) return true;
+    // The patches of the shared dictionary are kept in the new one, up to
+    // four times the size of the patches of this frame.
+    size_t pixels = 0;
+    for (const auto& patch : info) {
+      pixels += patch.first.xsize * patch.first.ysize;
+    }
+    AddSharedPatches(shared_patches->current, is_xyb, 4 * pixels, &info);
+  }
+
   std::sort(
       info.begin(), info.end(), [&](const PatchInfo& a, const PatchInfo& b) {
         return a.first.xsize * a.first.ysize > b.first.xsize * b.first.ysize;
@@ -747,11 +939,7 @@ Status FindBestPatchDictionary(const Image3F& opsin,
                   ref_pos.xsize, ref_pos.ysize, pos.first, pos.second);
       positions.emplace_back(
           PatchPosition{pos.first, pos.second, pref_positions.size()});
-      // Add blending for color channels, ignore other channels.
-      blendings.push_back({PatchBlendMode::kAdd, 0, false});
-      for (size_t j = 0; j < num_ec; ++j) {
-        blendings.push_back({PatchBlendMode::kNone, 0, false});
-      }
+      AddPatchBlendings(num_ec, &blendings);
     }
     pref_positions.emplace_back(ref_pos);
   }
@@ -759,11 +947,27 @@ Status FindBestPatchDictionary(const Image3F& opsin,
   CompressParams cparams = state->cparams;
   // Recursive application of patches could create very weird issues.
   cparams.patches = Override::kOff;
+  cparams.shared_patches = nullptr;
 
   JXL_RETURN_IF_ERROR(RoundtripPatchFrame(&reference_frame, state,
                                           kPatchFrameReferenceId, cparams, cms,
                                           pool, aux_out, /*subtract=*/true));
 
+  if (shared_patches != nullptr) {
+    SharedPatchDictionary::Dictionary& next = shared_patches->next;
+    const ReferceFrame& ref =
+        state->shared.reference_frames[kPatchFrameReferenceId];
+    JXL_ASSIGN_OR_RETURN(ImageBundle reference, ref.frame->Copy());
+    next.reference = jxl::make_unique<ImageBundle>(std::move(reference));
+    next.ib_is_in_xyb = ref.ib_is_in_xyb;
+    next.is_xyb = is_xyb;
+    next.patches.clear();
+    for (size_t i = 0; i < info.size(); i++) {
+      next.patches.emplace(info[i].first, pref_positions[i]);
+    }
+    shared_patches->has_next = true;
+  }
+
   // TODO(veluca): this assumes that applying patches is commutative, which is
   // not true for all blending modes. This code only produces kAdd patches, so
   // this works out.
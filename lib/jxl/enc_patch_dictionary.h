@@ -14,6 +14,8 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <map>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -25,6 +27,7 @@
 #include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/image.h"
+#include "lib/jxl/image_bundle.h"
 
 namespace jxl {
 
@@ -74,6 +77,27 @@ struct QuantizedPatch {
 using PatchInfo =
     std::pair<QuantizedPatch, std::vector<std::pair<uint32_t, uint32_t>>>;
 
+// A patch dictionary that the decoder keeps as reference frame after the frame
+// that stored it, so that the next frames of the same codestream can use its
+// patches without storing them again. Owned by the encoder API, see
+// JXL_ENC_FRAME_SETTING_SHARED_PATCHES.
+struct SharedPatchDictionary {
+  struct Dictionary {
+    // The patches, and where they are in `reference`.
+    std::map<QuantizedPatch, PatchReferencePosition> patches;
+    // The reference frame as decoded, or null if there is no dictionary.
+    std::unique_ptr<ImageBundle> reference;
+    bool ib_is_in_xyb = false;
+    bool is_xyb = false;
+  };
+  // The dictionary that the decoder has after the last written frame.
+  Dictionary current;
+  // Set by FindBestPatchDictionary if the frame being encoded stores a new
+  // dictionary, which becomes `current` once the frame is written.
+  Dictionary next;
+  bool has_next = false;
+};
+
 // Friend class of PatchDictionary.
 class PatchDictionaryEncoder {
  public:
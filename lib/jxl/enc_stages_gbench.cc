@@ -0,0 +1,194 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Benchmarks of the main stages of the encoder, each measured inside whole
+// single-threaded encodes of images in which it matters. Each benchmark
+// reports "MP/s" and, when libjxl is built with JPEGXL_ENABLE_TRACING, the
+// time per encode spent in each of the stages listed in kStages, as
+// "<stage>_ms" counters. All the counters are always present, so that the JSON
+// written by the jxl_encode_gbench target can be compared between revisions.
+
+#include <jxl/encode.h>
+#include <jxl/trace.h>
+#include <jxl/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/extras/dec/color_hints.h"
+#include "lib/extras/dec/decode.h"
+#include "lib/extras/enc/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/base/span.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/trace_internal.h"
+#include "tools/file_io.h"
+
+namespace jxl {
+namespace {
+
+#define QUIT(M)           \
+  state.SkipWithError(M); \
+  return;
+
+#define BM_CHECK(C) \
+  if (!(C)) {       \
+    QUIT(#C)        \
+  }
+
+// Names of the trace scopes of the stages. ApplyLZ77_Optimal includes a run of
+// ApplyLZ77_LZ77.
+constexpr const char* kStages[] = {
+    "AcStrategyHeuristics",
+    "InitialQuantField",
+    "ComputeCoefficients",
+    "ClusterHistograms",
+    "ApplyLZ77_RLE",
+    "ApplyLZ77_LZ77",
+    "ApplyLZ77_Optimal",
+    "ComputeBestTree",
+    "FindBestPatchDictionary",
+    "FastLosslessProcessFrame",
+};
+
+struct StageParams {
+  // Image of the test data, or nullptr for a synthetic screenshot of text.
+  const char* path;
+  float distance;
+  int effort;
+  int faster_decoding;
+};
+
+Status LoadImage(const char* path, extras::PackedPixelFile* ppf) {
+  std::vector<uint8_t> encoded;
+  JXL_RETURN_IF_ERROR(jpegxl::tools::ReadFile(
+      std::string(TEST_DATA_PATH "/") + path, &encoded));
+  return extras::DecodeBytes(Bytes(encoded), extras::ColorHints(), ppf);
+}
+
+// Dark glyphs from a small alphabet on a light background, in which the
+// patch dictionary finds most of the content.
+Status GenerateText(size_t xsize, size_t ysize, extras::PackedPixelFile* ppf) {
+  constexpr size_t kGlyphs = 16;
+  constexpr size_t kWidth = 8;
+  constexpr size_t kHeight = 12;
+  Rng rng(0);
+  std::vector<uint8_t> glyphs(kGlyphs * kWidth * kHeight);
+  for (uint8_t& value : glyphs) value = rng.UniformU(0, 3) == 0 ? 1 : 0;
+  ppf->info.xsize = xsize;
+  ppf->info.ysize = ysize;
+  ppf->info.bits_per_sample = 8;
+  ppf->info.num_color_channels = 3;
+  ppf->info.uses_original_profile = JXL_FALSE;
+  ppf->color_encoding.color_space = JXL_COLOR_SPACE_RGB;
+  ppf->color_encoding.white_point = JXL_WHITE_POINT_D65;
+  ppf->color_encoding.primaries = JXL_PRIMARIES_SRGB;
+  ppf->color_encoding.transfer_function = JXL_TRANSFER_FUNCTION_SRGB;
+  ppf->color_encoding.rendering_intent = JXL_RENDERING_INTENT_PERCEPTUAL;
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  JXL_ASSIGN_OR_RETURN(extras::PackedFrame frame,
+                       extras::PackedFrame::Create(xsize, ysize, format));
+  uint8_t* pixels = static_cast<uint8_t*>(frame.color.pixels());
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      const size_t line = y / (kHeight + 4);
+      const size_t column = x / (kWidth + 2);
+      const size_t gy = y % (kHeight + 4);
+      const size_t gx = x % (kWidth + 2);
+      const size_t glyph = (line * 7 + column * 3 + line * column) % kGlyphs;
+      const bool ink = gy < kHeight && gx < kWidth &&
+                       glyphs[(glyph * kHeight + gy) * kWidth + gx];
+      uint8_t* pixel = pixels + y * frame.color.stride + x * 3;
+      pixel[0] = pixel[1] = pixel[2] = ink ? 32 : 240;
+    }
+  }
+  ppf->frames.emplace_back(std::move(frame));
+  return true;
+}
+
+// Arguments: size of the synthetic image, ignored for the test data.
+void BM_EncodeStages(benchmark::State& state, StageParams params) {
+  extras::PackedPixelFile ppf;
+  if (params.path != nullptr) {
+    BM_CHECK(LoadImage(params.path, &ppf));
+  } else {
+    BM_CHECK(GenerateText(state.range(0), state.range(0), &ppf));
+  }
+  extras::JXLCompressParams cparams;
+  cparams.distance = params.distance;
+  // Without a runner, everything runs on the calling thread.
+  cparams.runner_opaque = nullptr;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, params.effort);
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_DECODING_SPEED,
+                    params.faster_decoding);
+  const bool traced = FROM_JXL_BOOL(JxlTraceStart());
+  std::vector<uint8_t> compressed;
+  for (auto _ : state) {
+    (void)_;
+    compressed.clear();
+    BM_CHECK(extras::EncodeImageJXL(cparams, ppf, /*jpeg_bytes=*/nullptr,
+                                    &compressed));
+  }
+  JxlTraceStop();
+  const std::map<std::string, uint64_t> totals = TraceTotals();
+  for (const char* stage : kStages) {
+    const auto it = totals.find(stage);
+    const double ms = it == totals.end() ? 0.0 : it->second * 1e-6;
+    state.counters[std::string(stage) + "_ms"] =
+        benchmark::Counter(ms, benchmark::Counter::kAvgIterations);
+  }
+  if (!traced) state.SetLabel("no tracing, stage times are not measured");
+  const double num_pixels = static_cast<double>(ppf.xsize()) * ppf.ysize();
+  state.counters["MP/s"] = benchmark::Counter(
+      num_pixels * 1e-6 * state.iterations(), benchmark::Counter::kIsRate);
+  state.counters["compressed_bytes"] = compressed.size();
+  state.SetItemsProcessed(state.iterations() * num_pixels);
+}
+
+// AcStrategyHeuristics, InitialQuantField, ComputeCoefficients and
+// ClusterHistograms.
+BENCHMARK_CAPTURE(BM_EncodeStages, VarDCT,
+                  StageParams{"jxl/flower/flower.png", 1.0f, 7, 0})
+    ->Arg(0)
+    ->UseRealTime();
+// ApplyLZ77_LZ77.
+BENCHMARK_CAPTURE(BM_EncodeStages, VarDCTEffort8,
+                  StageParams{"jxl/flower/flower.png", 1.0f, 8, 0})
+    ->Arg(0)
+    ->UseRealTime();
+// FindBestPatchDictionary.
+BENCHMARK_CAPTURE(BM_EncodeStages, VarDCTText,
+                  StageParams{nullptr, 1.0f, 7, 0})
+    ->Arg(1024)
+    ->UseRealTime();
+// ComputeBestTree.
+BENCHMARK_CAPTURE(BM_EncodeStages, Lossless,
+                  StageParams{"jxl/flower/flower_small.rgb.png", 0.0f, 7, 0})
+    ->Arg(0)
+    ->UseRealTime();
+// ApplyLZ77_Optimal.
+BENCHMARK_CAPTURE(BM_EncodeStages, LosslessEffort9,
+                  StageParams{"jxl/flower/flower_small.rgb.png", 0.0f, 9, 0})
+    ->Arg(0)
+    ->UseRealTime();
+// ApplyLZ77_RLE.
+BENCHMARK_CAPTURE(BM_EncodeStages, LosslessFasterDecoding,
+                  StageParams{"jxl/flower/flower_small.rgb.png", 0.0f, 3, 3})
+    ->Arg(0)
+    ->UseRealTime();
+// FastLosslessProcessFrame.
+BENCHMARK_CAPTURE(BM_EncodeStages, FastLossless,
+                  StageParams{"jxl/flower/flower.png", 0.0f, 1, 0})
+    ->Arg(0)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace jxl
@@ -5,7 +5,9 @@
 
 #include "lib/jxl/enc_toc.h"
 
+#include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/status.h"
@@ -20,11 +22,23 @@ Status WriteGroupOffsets(
     const std::vector<std::unique_ptr<BitWriter>>& group_codes,
     const std::vector<coeff_order_t>& permutation,
     BitWriter* JXL_RESTRICT writer, AuxOut* aux_out) {
-  BitWriter::Allotment allotment(writer, MaxBits(group_codes.size()));
-  if (!permutation.empty() && !group_codes.empty()) {
-    // Don't write a permutation at all for an empty group_codes.
+  std::vector<uint32_t> group_sizes;
+  group_sizes.reserve(group_codes.size());
+  for (const auto& bw : group_codes) {
+    JXL_ENSURE(bw->BitsWritten() % kBitsPerByte == 0);
+    group_sizes.push_back(bw->BitsWritten() / kBitsPerByte);
+  }
+  return WriteGroupOffsets(group_sizes, permutation, writer, aux_out);
+}
+
+Status WriteGroupOffsets(const std::vector<uint32_t>& group_sizes,
+                         const std::vector<coeff_order_t>& permutation,
+                         BitWriter* JXL_RESTRICT writer, AuxOut* aux_out) {
+  BitWriter::Allotment allotment(writer, MaxBits(group_sizes.size()));
+  if (!permutation.empty() && !group_sizes.empty()) {
+    // Don't write a permutation at all for an empty group_sizes.
     writer->Write(1, 1);  // permutation
-    JXL_ENSURE(permutation.size() == group_codes.size());
+    JXL_ENSURE(permutation.size() == group_sizes.size());
     JXL_RETURN_IF_ERROR(EncodePermutation(permutation.data(), /*skip=*/0,
                                           permutation.size(), writer,
                                           LayerType::Header, aux_out));
@@ -34,9 +48,7 @@ Status WriteGroupOffsets(
   }
   writer->ZeroPadToByte();  // before TOC entries
 
-  for (const auto& bw : group_codes) {
-    JXL_ENSURE(bw->BitsWritten() % kBitsPerByte == 0);
-    const size_t group_size = bw->BitsWritten() / kBitsPerByte;
+  for (uint32_t group_size : group_sizes) {
     JXL_RETURN_IF_ERROR(U32Coder::Write(kTocDist, group_size, writer));
   }
   writer->ZeroPadToByte();  // before first group
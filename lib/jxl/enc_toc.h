@@ -6,6 +6,7 @@
 #ifndef LIB_JXL_ENC_TOC_H_
 #define LIB_JXL_ENC_TOC_H_
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -25,6 +26,11 @@ Status WriteGroupOffsets(
     const std::vector<coeff_order_t>& permutation,
     BitWriter* JXL_RESTRICT writer, AuxOut* aux_out);
 
+// Same, with the sizes in bytes of the groups, in the order of the codestream.
+Status WriteGroupOffsets(const std::vector<uint32_t>& group_sizes,
+                         const std::vector<coeff_order_t>& permutation,
+                         BitWriter* JXL_RESTRICT writer, AuxOut* aux_out);
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_ENC_TOC_H_
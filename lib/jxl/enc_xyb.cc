@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <cstring>
 
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jxl/enc_xyb.cc"
@@ -18,12 +19,10 @@
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/fast_math-inl.h"
-#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/cms/opsin_params.h"
 #include "lib/jxl/cms/transfer_functions-inl.h"
 #include "lib/jxl/color_encoding_internal.h"
-#include "lib/jxl/enc_image_bundle.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_ops.h"
 
@@ -137,7 +136,7 @@ Status LinearSRGBToXYB(const float* JXL_RESTRICT premul_absorb,
     return true;
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, static_cast<uint32_t>(image->ysize()),
-                                ThreadPool::NoInit, process_row,
+                                image->xsize(), ThreadPool::NoInit, process_row,
                                 "LinearToXYB"));
   return true;
 }
@@ -164,7 +163,8 @@ Status SRGBToXYB(const float* JXL_RESTRICT premul_absorb, ThreadPool* pool,
     return true;
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, static_cast<uint32_t>(image->ysize()),
-                                ThreadPool::NoInit, process_row, "SRGBToXYB"));
+                                image->xsize(), ThreadPool::NoInit, process_row,
+                                "SRGBToXYB"));
   return true;
 }
 
@@ -199,11 +199,79 @@ Status SRGBToXYBAndLinear(const float* JXL_RESTRICT premul_absorb,
     return true;
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, static_cast<uint32_t>(image->ysize()),
-                                ThreadPool::NoInit, process_row,
+                                image->xsize(), ThreadPool::NoInit, process_row,
                                 "SRGBToXYBAndLinear"));
   return true;
 }
 
+// Converts `image` to linear sRGB with the CMS and then to XYB, in one pass
+// over the rows. If `linear` is not null, fills it with the linear sRGB pixels.
+Status CmsToXYB(const ColorEncoding& c_current, float intensity_target,
+                const ImageF* black, const float* JXL_RESTRICT premul_absorb,
+                const JxlCmsInterface& cms, ThreadPool* pool,
+                Image3F* JXL_RESTRICT image, Image3F* JXL_RESTRICT linear) {
+  const size_t xsize = image->xsize();
+  const bool is_gray = c_current.IsGray();
+  const bool is_cmyk = c_current.IsCMYK();
+  if (is_cmyk && !black) {
+    return JXL_FAILURE("Black plane is missing for CMYK transform");
+  }
+  const ColorEncoding& c_linear_srgb = ColorEncoding::LinearSRGB(is_gray);
+  ColorSpaceTransform c_transform(cms);
+  const auto init = [&](const size_t num_threads) -> Status {
+    JXL_RETURN_IF_ERROR(c_transform.Init(c_current, c_linear_srgb,
+                                         intensity_target, xsize, num_threads));
+    return true;
+  };
+  const auto process_row = [&](const uint32_t task,
+                               const size_t thread) -> Status {
+    const size_t y = static_cast<size_t>(task);
+    float* JXL_RESTRICT row0 = image->PlaneRow(0, y);
+    float* JXL_RESTRICT row1 = image->PlaneRow(1, y);
+    float* JXL_RESTRICT row2 = image->PlaneRow(2, y);
+    float* mutable_src_buf = c_transform.BufSrc(thread);
+    const float* src_buf = mutable_src_buf;
+    // Interleave input.
+    if (is_gray) {
+      src_buf = row0;
+    } else if (is_cmyk) {
+      const float* JXL_RESTRICT row3 = black->ConstRow(y);
+      for (size_t x = 0; x < xsize; x++) {
+        // CMYK convention in JXL: 0 = max ink, 1 = white
+        mutable_src_buf[4 * x + 0] = row0[x];
+        mutable_src_buf[4 * x + 1] = row1[x];
+        mutable_src_buf[4 * x + 2] = row2[x];
+        mutable_src_buf[4 * x + 3] = row3[x];
+      }
+    } else {
+      for (size_t x = 0; x < xsize; x++) {
+        mutable_src_buf[3 * x + 0] = row0[x];
+        mutable_src_buf[3 * x + 1] = row1[x];
+        mutable_src_buf[3 * x + 2] = row2[x];
+      }
+    }
+    float* JXL_RESTRICT dst_buf = c_transform.BufDst(thread);
+    JXL_RETURN_IF_ERROR(c_transform.Run(thread, src_buf, dst_buf, xsize));
+    // De-interleave output, then convert the row to XYB while it is in cache.
+    const size_t step = is_gray ? 1 : 3;
+    for (size_t x = 0; x < xsize; x++) {
+      row0[x] = dst_buf[step * x];
+      row1[x] = dst_buf[step * x + (is_gray ? 0 : 1)];
+      row2[x] = dst_buf[step * x + (is_gray ? 0 : 2)];
+    }
+    if (linear) {
+      memcpy(linear->PlaneRow(0, y), row0, xsize * sizeof(float));
+      memcpy(linear->PlaneRow(1, y), row1, xsize * sizeof(float));
+      memcpy(linear->PlaneRow(2, y), row2, xsize * sizeof(float));
+    }
+    LinearRGBRowToXYB(row0, row1, row2, premul_absorb, xsize);
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, static_cast<uint32_t>(image->ysize()),
+                                init, process_row, "CmsToXYB"));
+  return true;
+}
+
 void ComputePremulAbsorb(float intensity_target, float* premul_absorb) {
   const HWY_FULL(float) d;
   const size_t N = Lanes(d);
@@ -322,13 +390,8 @@ Status ToXYB(const ColorEncoding& c_current, float intensity_target,
     return true;
   }
 
-  JXL_RETURN_IF_ERROR(ApplyColorTransform(
-      c_current, intensity_target, *image, black, Rect(*image), c_linear_srgb,
-      cms, pool, want_linear ? linear : image));
-  if (want_linear) {
-    JXL_RETURN_IF_ERROR(CopyImageTo(*linear, image));
-  }
-  JXL_RETURN_IF_ERROR(LinearSRGBToXYB(premul_absorb, pool, image));
+  JXL_RETURN_IF_ERROR(CmsToXYB(c_current, intensity_target, black,
+                               premul_absorb, cms, pool, image, linear));
   return true;
 }
 
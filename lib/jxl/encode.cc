@@ -15,6 +15,7 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <utility>
 
@@ -24,6 +25,7 @@
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/exif.h"
 #include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/sanitizers.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
@@ -38,9 +40,11 @@
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/encode_internal.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
+#include "lib/jxl/jpeg/enc_jpeg_ycbcr.h"
 #include "lib/jxl/luminance.h"
 #include "lib/jxl/memory_manager_internal.h"
 #include "lib/jxl/padded_bytes.h"
+#include "lib/jxl/trace_internal.h"
 
 struct JxlErrorOrStatus {
   // NOLINTNEXTLINE(google-explicit-constructor)
@@ -93,6 +97,21 @@ struct JxlErrorOrStatus {
    JxlErrorOrStatus::Error())
 #endif  // JXL_CRASH_ON_ERROR
 
+namespace {
+
+// Spilled output is written out in chunks of this size.
+constexpr size_t kSpillChunkSize = 1 << 20;
+
+bool SeekFile(FILE* file, uint64_t offset) {
+#if defined(_WIN32)
+  return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+  return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+}  // namespace
+
 jxl::StatusOr<JxlOutputProcessorBuffer>
 JxlEncoderOutputProcessorWrapper::GetBuffer(size_t min_size,
                                             size_t requested_size) {
@@ -263,6 +282,12 @@ jxl::Status JxlEncoderOutputProcessorWrapper::ReleaseBuffer(size_t bytes_used) {
       it->second.owned_data.clear();
     }
   }
+  if (spill_file_ && !it->second.owned_data.empty()) {
+    JXL_ASSIGN_OR_RETURN(it->second.spill_offset,
+                         Spill(it->second.owned_data.data(), bytes_used));
+    it->second.spilled = true;
+    it->second.owned_data = jxl::PaddedBytes(memory_manager_);
+  }
   return true;
 }
 
@@ -278,7 +303,28 @@ jxl::Status JxlEncoderOutputProcessorWrapper::FlushOutput() {
     JXL_ENSURE(output_position_ >= it->first);
     JXL_ENSURE(it->second.written_bytes != 0);
     size_t buffer_last_byte = it->first + it->second.written_bytes;
-    if (!it->second.owned_data.empty()) {
+    if (it->second.spilled) {
+      size_t start_in_buffer = output_position_ - it->first;
+      JXL_ENSURE(buffer_last_byte > output_position_);
+      size_t num_to_write =
+          std::min(buffer_last_byte, finalized_position_) - output_position_;
+      uint64_t offset = it->second.spill_offset + start_in_buffer;
+      if (avail_out_ != nullptr) {
+        size_t n = std::min(num_to_write, *avail_out_);
+        JXL_RETURN_IF_ERROR(ReadSpilled(offset, n, *next_out_));
+        *avail_out_ -= n;
+        *next_out_ += n;
+        output_position_ += n;
+      } else {
+        JXL_ENSURE(external_output_processor_);
+        size_t n = std::min(num_to_write, kSpillChunkSize);
+        spill_chunk_.resize(n);
+        JXL_RETURN_IF_ERROR(ReadSpilled(offset, n, spill_chunk_.data()));
+        if (!AppendBufferToExternalProcessor(spill_chunk_.data(), n)) {
+          return true;
+        }
+      }
+    } else if (!it->second.owned_data.empty()) {
       size_t start_in_buffer = output_position_ - it->first;
       // Guaranteed by the invariant on `internal_buffers_`.
       JXL_ENSURE(buffer_last_byte > output_position_);
@@ -335,6 +381,39 @@ bool JxlEncoderOutputProcessorWrapper::AppendBufferToExternalProcessor(
   return true;
 }
 
+jxl::Status JxlEncoderOutputProcessorWrapper::EnableSpilling() {
+  if (spill_file_) return true;
+  spill_file_.reset(tmpfile());
+  if (!spill_file_) {
+    return JXL_FAILURE("Failed to create a temporary file to spill output");
+  }
+  return true;
+}
+
+jxl::StatusOr<uint64_t> JxlEncoderOutputProcessorWrapper::Spill(
+    const uint8_t* data, size_t count) {
+  JXL_ENSURE(spill_file_);
+  if (!SeekFile(spill_file_.get(), spill_file_size_) ||
+      fwrite(data, 1, count, spill_file_.get()) != count) {
+    return JXL_FAILURE("Failed to write to the spill file");
+  }
+  uint64_t offset = spill_file_size_;
+  spill_file_size_ += count;
+  return offset;
+}
+
+jxl::Status JxlEncoderOutputProcessorWrapper::ReadSpilled(uint64_t offset,
+                                                          size_t count,
+                                                          uint8_t* data) {
+  JXL_ENSURE(spill_file_);
+  JXL_ENSURE(offset + count <= spill_file_size_);
+  if (!SeekFile(spill_file_.get(), offset) ||
+      fread(data, 1, count, spill_file_.get()) != count) {
+    return JXL_FAILURE("Failed to read from the spill file");
+  }
+  return true;
+}
+
 namespace jxl {
 
 size_t WriteBoxHeader(const jxl::BoxType& type, size_t size, bool unbounded,
@@ -474,9 +553,9 @@ void QueueBox(JxlEncoder* enc,
 }
 
 // TODO(lode): share this code and the Brotli compression code in enc_jpeg_data
-JxlEncoderStatus BrotliCompress(int quality, const uint8_t* in, size_t in_size,
-                                jxl::PaddedBytes* out) {
-  JxlMemoryManager* memory_manager = out->memory_manager();
+JxlEncoderStatus BrotliCompress(JxlMemoryManager* memory_manager, int quality,
+                                const uint8_t* in, size_t in_size,
+                                std::vector<uint8_t>* out) {
   std::unique_ptr<BrotliEncoderState, decltype(BrotliEncoderDestroyInstance)*>
       enc(BrotliEncoderCreateInstance(nullptr, nullptr, nullptr),
           BrotliEncoderDestroyInstance);
@@ -504,14 +583,28 @@ JxlEncoderStatus BrotliCompress(int quality, const uint8_t* in, size_t in_size,
     }
     size_t out_size = next_out - temp_buffer.data();
     jxl::msan::UnpoisonMemory(next_out - out_size, out_size);
-    out->resize(out->size() + out_size);
-    memcpy(out->data() + out->size() - out_size, temp_buffer.data(), out_size);
+    out->insert(out->end(), temp_buffer.data(), temp_buffer.data() + out_size);
     if (BrotliEncoderIsFinished(enc.get())) break;
   }
 
   return JxlErrorOrStatus::Success();
 }
 
+// Sets `compressed` to the contents of the brob box for `box`. Can run
+// concurrently for different boxes.
+bool CompressBrobBox(JxlMemoryManager* memory_manager, int quality,
+                     jxl::JxlEncoderQueuedBox* box) {
+  box->compressed.clear();
+  // Prepend the original box type in the brob box contents
+  box->compressed.insert(box->compressed.end(), box->type.begin(),
+                         box->type.end());
+  box->compressed_quality = quality;
+  return JXL_ENC_SUCCESS == BrotliCompress(memory_manager, quality,
+                                           box->contents.data(),
+                                           box->contents.size(),
+                                           &box->compressed);
+}
+
 // The JXL codestream can have level 5 or level 10. Levels have certain
 // restrictions such as max allowed image dimensions. This function checks the
 // level required to support the current encoder settings. The debug_string is
@@ -660,11 +753,15 @@ bool EncodeFrameIndexBox(const jxl::JxlEncoderFrameIndexBox& frame_index_box,
   // we store the 'prev' record. That 'prev' record needs to store
   // the offset byte position to previously recorded indexed frame,
   // that's why we also trace previous to the previous frame.
+  // The durations (Ti) and frame counts (Fi) are those until the next indexed
+  // frame, where only the displayed frames are counted, like a decoder does.
   int prev_prev_ix = -1;  // For position offset (OFFi) delta coding.
   int prev_ix = 0;
-  int T_prev = 0;
-  int T = 0;
+  uint64_t T = 0;
+  int32_t F = 0;
   for (size_t i = 1; i < frame_index_box.entries.size(); ++i) {
+    T += frame_index_box.entries[i - 1].duration;
+    if (frame_index_box.entries[i - 1].duration > 0) ++F;
     if (frame_index_box.entries[i].to_be_indexed) {
       // Now we can record the previous entry, since we need to store
       // there how many frames until the next one.
@@ -676,26 +773,23 @@ bool EncodeFrameIndexBox(const jxl::JxlEncoderFrameIndexBox& frame_index_box,
         // XL codestream.
         OFFi -= frame_index_box.entries[prev_prev_ix].OFFi;
       }
-      int32_t Ti = T_prev;
-      int32_t Fi = i - prev_ix;
       ok &= EncodeVarInt(OFFi, buffer_vec.size(), &output_pos, buffer);
-      ok &= EncodeVarInt(Ti, buffer_vec.size(), &output_pos, buffer);
-      ok &= EncodeVarInt(Fi, buffer_vec.size(), &output_pos, buffer);
+      ok &= EncodeVarInt(T, buffer_vec.size(), &output_pos, buffer);
+      ok &= EncodeVarInt(F, buffer_vec.size(), &output_pos, buffer);
       prev_prev_ix = prev_ix;
       prev_ix = i;
-      T_prev = T;
-      T += frame_index_box.entries[i].duration;
+      T = 0;
+      F = 0;
     }
   }
   {
-    // Last frame.
-    size_t i = frame_index_box.entries.size();
+    // Last frame, which is always displayed.
     int64_t OFFi = frame_index_box.entries[prev_ix].OFFi;
     if (prev_prev_ix != -1) {
       OFFi -= frame_index_box.entries[prev_prev_ix].OFFi;
     }
-    int32_t Ti = T_prev;
-    int32_t Fi = i - prev_ix;
+    uint64_t Ti = T + frame_index_box.entries.back().duration;
+    int32_t Fi = F + 1;
     ok &= EncodeVarInt(OFFi, buffer_vec.size(), &output_pos, buffer);
     ok &= EncodeVarInt(Ti, buffer_vec.size(), &output_pos, buffer);
     ok &= EncodeVarInt(Fi, buffer_vec.size(), &output_pos, buffer);
@@ -704,6 +798,49 @@ bool EncodeFrameIndexBox(const jxl::JxlEncoderFrameIndexBox& frame_index_box,
   return ok;
 }
 
+// Returns the frame info with which a queued frame is encoded.
+jxl::FrameInfo GetFrameInfo(const jxl::CodecMetadata& metadata,
+                            const jxl::JxlEncoderFrameSettingsValues& values,
+                            bool last_frame) {
+  const JxlLayerInfo& layer_info = values.header.layer_info;
+  jxl::FrameInfo frame_info;
+  frame_info.is_last = last_frame;
+  frame_info.save_as_reference = layer_info.save_as_reference;
+  frame_info.source = layer_info.blend_info.source;
+  frame_info.clamp = FROM_JXL_BOOL(layer_info.blend_info.clamp);
+  frame_info.alpha_channel = layer_info.blend_info.alpha;
+  frame_info.extra_channel_blending_info.resize(metadata.m.num_extra_channels);
+  // If extra channel blend info has not been set, use the blend mode from
+  // the layer_info.
+  JxlBlendInfo default_blend_info = layer_info.blend_info;
+  for (size_t i = 0; i < metadata.m.num_extra_channels; ++i) {
+    auto& to = frame_info.extra_channel_blending_info[i];
+    const auto& from = i < values.extra_channel_blend_info.size()
+                           ? values.extra_channel_blend_info[i]
+                           : default_blend_info;
+    to.mode = static_cast<jxl::BlendMode>(from.blendmode);
+    to.source = from.source;
+    to.alpha_channel = from.alpha;
+    to.clamp = (from.clamp != 0);
+  }
+  frame_info.origin.x0 = layer_info.crop_x0;
+  frame_info.origin.y0 = layer_info.crop_y0;
+  frame_info.blendmode =
+      static_cast<jxl::BlendMode>(layer_info.blend_info.blendmode);
+  frame_info.blend = layer_info.blend_info.blendmode != JXL_BLEND_REPLACE;
+  frame_info.image_bit_depth = values.image_bit_depth;
+  // If have_animation is false, the encoder should ignore the duration and
+  // timecode values. However, assigning them will cause the encoder to write
+  // an invalid frame header that can't be decoded so keep the default value of
+  // 0 here.
+  if (metadata.m.have_animation) {
+    frame_info.duration = values.header.duration;
+    frame_info.timecode = values.header.timecode;
+  }
+  frame_info.name = values.frame_name;
+  return frame_info;
+}
+
 struct RunnerTicket {
   explicit RunnerTicket(jxl::ThreadPool* pool) : pool(pool) {}
   jxl::ThreadPool* pool;
@@ -840,6 +977,8 @@ jxl::Status JxlEncoderStruct::ProcessOneEnqueuedInput() {
     wrote_bytes = true;
   }
 
+  JXL_RETURN_IF_ERROR(CompressBoxesAhead());
+  JXL_RETURN_IF_ERROR(EncodeFramesAhead());
   JXL_RETURN_IF_ERROR(output_processor.SetFinalizedPosition());
 
   // Choose frame or box processing: exactly one of the two unique pointers (box
@@ -877,18 +1016,9 @@ jxl::Status JxlEncoderStruct::ProcessOneEnqueuedInput() {
       }
     }
 
-    uint32_t duration;
-    uint32_t timecode;
+    uint32_t duration = 0;
     if (input_frame && metadata.m.have_animation) {
       duration = input_frame->option_values.header.duration;
-      timecode = input_frame->option_values.header.timecode;
-    } else {
-      // If have_animation is false, the encoder should ignore the duration and
-      // timecode values. However, assigning them to ib will cause the encoder
-      // to write an invalid frame header that can't be decoded so ensure
-      // they're the default value of 0 here.
-      duration = 0;
-      timecode = 0;
     }
 
     const bool last_frame = frames_closed && (num_queued_frames == 0);
@@ -930,8 +1060,33 @@ jxl::Status JxlEncoderStruct::ProcessOneEnqueuedInput() {
     JXL_RETURN_IF_ERROR(AppendData(output_processor, header_bytes));
 
     if (input_frame) {
+      const jxl::JxlEncoderFrameSettingsValues& values =
+          input_frame->option_values;
+      // A frame can only be indexed if it starts a displayed frame.
+      bool starts_displayed_frame = frame_index_box.entries.empty() ||
+                                    frame_index_box.entries.back().duration > 0;
+      bool to_be_indexed = values.frame_index_box;
+      if (values.keyframe_interval > 0 && starts_displayed_frame &&
+          frame_index_box.num_displayed_frames % values.keyframe_interval ==
+              0) {
+        to_be_indexed = true;
+      }
+      if (to_be_indexed && !frame_index_box.entries.empty()) {
+        const JxlLayerInfo& layer_info = values.header.layer_info;
+        if (!starts_displayed_frame) {
+          return JXL_API_ERROR(this, JXL_ENC_ERR_API_USAGE,
+                               "Cannot index a frame that follows a frame "
+                               "with zero duration");
+        }
+        if (layer_info.have_crop ||
+            layer_info.blend_info.blendmode != JXL_BLEND_REPLACE) {
+          return JXL_API_ERROR(this, JXL_ENC_ERR_API_USAGE,
+                               "Cannot index a frame that is cropped or "
+                               "blended with previous frames");
+        }
+      }
       frame_index_box.AddFrame(codestream_bytes_written_end_of_frame, duration,
-                               input_frame->option_values.frame_index_box);
+                               to_be_indexed);
 
       size_t save_as_reference =
           input_frame->option_values.header.layer_info.save_as_reference;
@@ -942,55 +1097,47 @@ jxl::Status JxlEncoderStruct::ProcessOneEnqueuedInput() {
             static_cast<int>(save_as_reference));
       }
 
-      jxl::FrameInfo frame_info;
-      frame_info.is_last = last_frame;
-      frame_info.save_as_reference = save_as_reference;
-      frame_info.source =
-          input_frame->option_values.header.layer_info.blend_info.source;
-      frame_info.clamp = FROM_JXL_BOOL(
-          input_frame->option_values.header.layer_info.blend_info.clamp);
-      frame_info.alpha_channel =
-          input_frame->option_values.header.layer_info.blend_info.alpha;
-      frame_info.extra_channel_blending_info.resize(
-          metadata.m.num_extra_channels);
-      // If extra channel blend info has not been set, use the blend mode from
-      // the layer_info.
-      JxlBlendInfo default_blend_info =
-          input_frame->option_values.header.layer_info.blend_info;
-      for (size_t i = 0; i < metadata.m.num_extra_channels; ++i) {
-        auto& to = frame_info.extra_channel_blending_info[i];
-        const auto& from =
-            i < input_frame->option_values.extra_channel_blend_info.size()
-                ? input_frame->option_values.extra_channel_blend_info[i]
-                : default_blend_info;
-        to.mode = static_cast<jxl::BlendMode>(from.blendmode);
-        to.source = from.source;
-        to.alpha_channel = from.alpha;
-        to.clamp = (from.clamp != 0);
-      }
-      frame_info.origin.x0 =
-          input_frame->option_values.header.layer_info.crop_x0;
-      frame_info.origin.y0 =
-          input_frame->option_values.header.layer_info.crop_y0;
-      frame_info.blendmode = static_cast<jxl::BlendMode>(
-          input_frame->option_values.header.layer_info.blend_info.blendmode);
-      frame_info.blend =
-          input_frame->option_values.header.layer_info.blend_info.blendmode !=
-          JXL_BLEND_REPLACE;
-      frame_info.image_bit_depth = input_frame->option_values.image_bit_depth;
-      frame_info.duration = duration;
-      frame_info.timecode = timecode;
-      frame_info.name = input_frame->option_values.frame_name;
-
-      if (!jxl::EncodeFrame(&memory_manager, input_frame->option_values.cparams,
-                            frame_info, &metadata, input_frame->frame_data, cms,
-                            thread_pool.get(), &output_processor,
-                            input_frame->option_values.aux_out)) {
+      if (values.cparams.spill_to_disk && !output_processor.EnableSpilling()) {
+        return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                             "Failed to create the spill file");
+      }
+      if (input_frame->option_values.cparams.reuse_previous_heuristics) {
+        input_frame->option_values.cparams.heuristics_history =
+            &heuristics_history;
+      }
+      if (input_frame->option_values.cparams.share_patches) {
+        input_frame->option_values.cparams.shared_patches = &shared_patches;
+      } else {
+        // The patch frame of this frame, if any, replaces the shared one.
+        shared_patches = jxl::SharedPatchDictionary();
+      }
+      if (cancel_callback != nullptr) {
+        input_frame->option_values.cparams.cancel = &CheckCancelled;
+        input_frame->option_values.cparams.cancel_opaque = this;
+      }
+      if (input_frame->encoded_ahead) {
+        JXL_RETURN_IF_ERROR(AppendData(output_processor, input_frame->encoded));
+      } else if (!jxl::EncodeFrame(
+                     &memory_manager, input_frame->option_values.cparams,
+                     GetFrameInfo(metadata, input_frame->option_values,
+                                  last_frame),
+                     &metadata, input_frame->frame_data, cms,
+                     thread_pool.get(), &output_processor,
+                     input_frame->option_values.aux_out)) {
+        if (cancelled) {
+          return JXL_API_ERROR(this, JXL_ENC_ERR_CANCELLED,
+                               "Encoding cancelled");
+        }
         return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
                              "Failed to encode frame");
       }
+      if (shared_patches.has_next) {
+        shared_patches.current = std::move(shared_patches.next);
+        shared_patches.has_next = false;
+      }
     } else {
       JXL_ENSURE(fast_lossless_frame);
+      JXL_TRACE_SCOPE("FastLosslessProcessFrame");
       RunnerTicket ticket{thread_pool.get()};
       bool ok = JxlFastLosslessProcessFrame(
           fast_lossless_frame.get(), last_frame, &ticket,
@@ -1043,6 +1190,11 @@ jxl::Status JxlEncoderStruct::ProcessOneEnqueuedInput() {
     }
     if (last_frame && frame_index_box.StoreFrameIndexBox()) {
       std::vector<uint8_t> index_box_content;
+      if (metadata.m.have_animation) {
+        // The index counts time in ticks of the animation.
+        frame_index_box.TNUM = metadata.m.animation.tps_denominator;
+        frame_index_box.TDEN = metadata.m.animation.tps_numerator;
+      }
       // Enough buffer has been allocated, this function should never fail in
       // writing.
       JXL_ENSURE(EncodeFrameIndexBox(frame_index_box, index_box_content));
@@ -1057,19 +1209,16 @@ jxl::Status JxlEncoderStruct::ProcessOneEnqueuedInput() {
     num_queued_boxes--;
 
     if (box->compress_box) {
-      jxl::PaddedBytes compressed(&memory_manager);
-      // Prepend the original box type in the brob box contents
-      compressed.append(box->type);
-      if (JXL_ENC_SUCCESS !=
-          BrotliCompress((brotli_effort >= 0 ? brotli_effort : 4),
-                         box->contents.data(), box->contents.size(),
-                         &compressed)) {
-        return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
-                             "Brotli compression for brob box failed");
+      if (!box->compressed_ahead ||
+          box->compressed_quality != BrobQuality()) {
+        if (!CompressBrobBox(&memory_manager, BrobQuality(), box.get())) {
+          return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
+                               "Brotli compression for brob box failed");
+        }
       }
 
       JXL_RETURN_IF_ERROR(
-          AppendBoxWithContents(jxl::MakeBoxType("brob"), compressed));
+          AppendBoxWithContents(jxl::MakeBoxType("brob"), box->compressed));
     } else {
       JXL_RETURN_IF_ERROR(AppendBoxWithContents(box->type, box->contents));
     }
@@ -1078,6 +1227,124 @@ jxl::Status JxlEncoderStruct::ProcessOneEnqueuedInput() {
   return jxl::OkStatus();
 }
 
+jxl::Status JxlEncoderStruct::CompressBoxesAhead() {
+  const int quality = BrobQuality();
+  std::vector<jxl::JxlEncoderQueuedBox*> boxes;
+  for (jxl::JxlEncoderQueuedInput& input : input_queue) {
+    jxl::JxlEncoderQueuedBox* box = input.box.get();
+    if (box == nullptr || !box->compress_box ||
+        (box->compressed_ahead && box->compressed_quality == quality)) {
+      continue;
+    }
+    const auto cached = std::find_if(
+        compressed_boxes.begin(), compressed_boxes.end(),
+        [&](const jxl::JxlEncoderCompressedBox& compressed) {
+          return compressed.type == box->type &&
+                 compressed.quality == quality &&
+                 compressed.contents == box->contents;
+        });
+    if (cached != compressed_boxes.end()) {
+      box->compressed = cached->compressed;
+      box->compressed_quality = quality;
+      box->compressed_ahead = true;
+      continue;
+    }
+    boxes.push_back(box);
+  }
+  if (boxes.empty()) return true;
+
+  const auto compress_box = [&](const uint32_t i, size_t /*thread*/) {
+    // A box that fails to compress here is compressed again in order, which
+    // reports the error.
+    boxes[i]->compressed_ahead =
+        CompressBrobBox(&memory_manager, quality, boxes[i]);
+    return jxl::OkStatus();
+  };
+  JXL_RETURN_IF_ERROR(jxl::RunOnPool(thread_pool.get(), 0, boxes.size(),
+                                     jxl::ThreadPool::NoInit, compress_box,
+                                     "CompressBoxesAhead"));
+  for (const jxl::JxlEncoderQueuedBox* box : boxes) {
+    if (!box->compressed_ahead) continue;
+    if (compressed_boxes.size() == kMaxCompressedBoxes) {
+      compressed_boxes.erase(compressed_boxes.begin());
+    }
+    compressed_boxes.push_back(
+        {box->type, quality, box->contents, box->compressed});
+  }
+  return true;
+}
+
+jxl::Status JxlEncoderStruct::EncodeFramesAhead() {
+  if (parallel_frames < 2 || input_queue.empty() || !input_queue[0].frame ||
+      input_queue[0].frame->encoded_ahead) {
+    return true;
+  }
+  // The frames to encode, with whether each is the last frame.
+  std::vector<std::pair<jxl::JxlEncoderQueuedFrame*, bool>> frames;
+  size_t frames_left = num_queued_frames;
+  for (jxl::JxlEncoderQueuedInput& input : input_queue) {
+    if (frames.size() == parallel_frames || input.fast_lossless_frame) break;
+    if (!input.frame) continue;
+    frames_left--;
+    // Until the frames are closed, any frame could still become the last one
+    // once it is the last queued frame.
+    if (!frames_closed && frames_left == 0) break;
+    const jxl::JxlEncoderFrameSettingsValues& values =
+        input.frame->option_values;
+    // Leave the frames that fail the checks of ProcessOneEnqueuedInput, JPEG
+    // frames, frames whose statistics cannot be gathered concurrently, and
+    // frames depending on the heuristics of the previous one, to it.
+    if (values.aux_out != nullptr || values.cparams.ma_tree_out != nullptr ||
+        input.frame->frame_data.IsJPEG() ||
+        values.header.layer_info.save_as_reference >= 3 ||
+        values.cparams.reuse_previous_heuristics ||
+        values.cparams.share_patches ||
+        std::find(input.frame->ec_initialized.begin(),
+                  input.frame->ec_initialized.end(),
+                  0) != input.frame->ec_initialized.end()) {
+      break;
+    }
+    frames.emplace_back(input.frame.get(), frames_closed && frames_left == 0);
+  }
+  if (frames.size() < 2) return true;
+
+  const auto encode_frame = [&](const uint32_t i, size_t /*thread*/) {
+    jxl::JxlEncoderQueuedFrame* frame = frames[i].first;
+    jxl::CompressParams cparams = frame->option_values.cparams;
+    cparams.color_transform = metadata.m.xyb_encoded
+                                  ? jxl::ColorTransform::kXYB
+                                  : jxl::ColorTransform::kNone;
+    if (cancel_callback != nullptr) {
+      cparams.cancel = &CheckCancelled;
+      cparams.cancel_opaque = this;
+    }
+    std::vector<uint8_t> output(64);
+    uint8_t* next_out = output.data();
+    size_t avail_out = output.size();
+    JxlEncoderOutputProcessorWrapper output_processor(&memory_manager);
+    // A frame that fails to encode here is encoded again in order, which
+    // reports the error.
+    if (!output_processor.SetAvailOut(&next_out, &avail_out) ||
+        !jxl::EncodeFrame(&memory_manager, cparams,
+                          GetFrameInfo(metadata, frame->option_values,
+                                       frames[i].second),
+                          &metadata, frame->frame_data, cms,
+                          /*pool=*/nullptr, &output_processor,
+                          /*aux_out=*/nullptr) ||
+        !output_processor.SetFinalizedPosition() ||
+        !output_processor.CopyOutput(output, next_out, avail_out)) {
+      return jxl::OkStatus();
+    }
+    frame->encoded = std::move(output);
+    frame->encoded_ahead = true;
+    return jxl::OkStatus();
+  };
+  JXL_RETURN_IF_ERROR(jxl::RunOnPool(thread_pool.get(), 0, frames.size(),
+                                     jxl::ThreadPool::NoInit, encode_frame,
+                                     "EncodeFramesAhead"));
+  return true;
+}
+
 JxlEncoderStatus JxlEncoderSetColorEncoding(JxlEncoder* enc,
                                             const JxlColorEncoding* color) {
   if (!enc->basic_info_set) {
@@ -1567,6 +1834,14 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetOption(
     case JXL_ENC_FRAME_SETTING_JPEG_KEEP_EXIF:
     case JXL_ENC_FRAME_SETTING_JPEG_KEEP_XMP:
     case JXL_ENC_FRAME_SETTING_JPEG_KEEP_JUMBF:
+    case JXL_ENC_FRAME_SETTING_STATIC_ENTROPY_CODES:
+    case JXL_ENC_FRAME_SETTING_PROGRESSIVE_LAYOUT:
+    case JXL_ENC_FRAME_SETTING_SPILL_TO_DISK:
+    case JXL_ENC_FRAME_SETTING_REUSE_PREVIOUS_HEURISTICS:
+    case JXL_ENC_FRAME_SETTING_AUTO_CROP:
+    case JXL_ENC_FRAME_SETTING_DECODER_FAST_PATHS:
+    case JXL_ENC_FRAME_SETTING_SHARED_PATCHES:
+    case JXL_ENC_FRAME_SETTING_SAMPLED_HISTOGRAMS:
       if (value < -1 || value > 1) {
         return JXL_API_ERROR(
             frame_settings->enc, JXL_ENC_ERR_API_USAGE,
@@ -1777,9 +2052,64 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetOption(
         return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
                              "Option value has to be 0 or 1");
       }
-      frame_settings->values.frame_index_box = true;
+      frame_settings->values.frame_index_box = (value == 1);
+      break;
+    case JXL_ENC_FRAME_SETTING_KEYFRAME_INTERVAL:
+      if (value < -1) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
+                             "Keyframe interval must be -1, 0 or positive");
+      }
+      frame_settings->values.keyframe_interval = std::max<int64_t>(0, value);
+      break;
+    case JXL_ENC_FRAME_SETTING_STATIC_ENTROPY_CODES:
+      frame_settings->values.cparams.static_entropy_codes =
+          static_cast<jxl::Override>(value);
+      break;
+    case JXL_ENC_FRAME_SETTING_TARGET_SIZE:
+      if (value < -1) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "Target size must be -1, 0 or positive");
+      }
+      frame_settings->values.cparams.target_size = std::max<int64_t>(0, value);
+      break;
+    case JXL_ENC_FRAME_SETTING_AC_STRATEGY_PRUNING:
+      if (value < -1 || value > 3) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "Option value has to be in [-1..3]");
+      }
+      frame_settings->values.cparams.ac_strategy_pruning = value;
+      break;
+    case JXL_ENC_FRAME_SETTING_PROGRESSIVE_LAYOUT:
+      frame_settings->values.cparams.progressive_layout = (value == 1);
+      break;
+    case JXL_ENC_FRAME_SETTING_SPILL_TO_DISK:
+      frame_settings->values.cparams.spill_to_disk = (value == 1);
+      break;
+    case JXL_ENC_FRAME_SETTING_REUSE_PREVIOUS_HEURISTICS:
+      frame_settings->values.cparams.reuse_previous_heuristics = (value == 1);
+      break;
+    case JXL_ENC_FRAME_SETTING_AUTO_CROP:
+      frame_settings->values.auto_crop = (value == 1);
+      break;
+    case JXL_ENC_FRAME_SETTING_TIME_BUDGET:
+      if (value < -1) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "Time budget must be -1, 0 or positive");
+      }
+      frame_settings->values.cparams.time_budget_ms =
+          static_cast<float>(std::max<int64_t>(0, value));
+      break;
+    case JXL_ENC_FRAME_SETTING_DECODER_FAST_PATHS:
+      frame_settings->values.cparams.decoder_fast_paths = (value == 1);
+      break;
+    case JXL_ENC_FRAME_SETTING_SHARED_PATCHES:
+      frame_settings->values.cparams.share_patches = (value == 1);
+      break;
+    case JXL_ENC_FRAME_SETTING_SAMPLED_HISTOGRAMS:
+      frame_settings->values.cparams.sampled_histograms = (value == 1);
       break;
     case JXL_ENC_FRAME_SETTING_PHOTON_NOISE:
+    case JXL_ENC_FRAME_SETTING_TARGET_BUTTERAUGLI_SCORE:
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
                            "Float option, try setting it with "
                            "JxlEncoderFrameSettingsSetFloatOption");
@@ -1886,6 +2216,13 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetFloatOption(
         frame_settings->values.cparams.channel_colors_percent = value;
       }
       return JxlErrorOrStatus::Success();
+    case JXL_ENC_FRAME_SETTING_TARGET_BUTTERAUGLI_SCORE:
+      if (!(value >= 0.f)) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "Target butteraugli score must be non-negative");
+      }
+      frame_settings->values.cparams.target_butteraugli_score = value;
+      return JxlErrorOrStatus::Success();
     case JXL_ENC_FRAME_SETTING_EFFORT:
     case JXL_ENC_FRAME_SETTING_DECODING_SPEED:
     case JXL_ENC_FRAME_SETTING_RESAMPLING:
@@ -1922,6 +2259,18 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetFloatOption(
     case JXL_ENC_FRAME_SETTING_JPEG_KEEP_XMP:
     case JXL_ENC_FRAME_SETTING_JPEG_KEEP_JUMBF:
     case JXL_ENC_FRAME_SETTING_USE_FULL_IMAGE_HEURISTICS:
+    case JXL_ENC_FRAME_SETTING_KEYFRAME_INTERVAL:
+    case JXL_ENC_FRAME_SETTING_STATIC_ENTROPY_CODES:
+    case JXL_ENC_FRAME_SETTING_TARGET_SIZE:
+    case JXL_ENC_FRAME_SETTING_AC_STRATEGY_PRUNING:
+    case JXL_ENC_FRAME_SETTING_PROGRESSIVE_LAYOUT:
+    case JXL_ENC_FRAME_SETTING_SPILL_TO_DISK:
+    case JXL_ENC_FRAME_SETTING_REUSE_PREVIOUS_HEURISTICS:
+    case JXL_ENC_FRAME_SETTING_AUTO_CROP:
+    case JXL_ENC_FRAME_SETTING_TIME_BUDGET:
+    case JXL_ENC_FRAME_SETTING_DECODER_FAST_PATHS:
+    case JXL_ENC_FRAME_SETTING_SHARED_PATCHES:
+    case JXL_ENC_FRAME_SETTING_SAMPLED_HISTOGRAMS:
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
                            "Int option, try setting it with "
                            "JxlEncoderFrameSettingsSetOption");
@@ -1971,6 +2320,14 @@ void JxlEncoderReset(JxlEncoder* enc) {
   enc->use_boxes = false;
   enc->store_jpeg_metadata = false;
   enc->codestream_level = -1;
+  enc->parallel_frames = 0;
+  enc->cancel_callback = nullptr;
+  enc->cancel_opaque = nullptr;
+  enc->cancelled = false;
+  enc->heuristics_history = jxl::FrameHeuristicsHistory();
+  enc->shared_patches = jxl::SharedPatchDictionary();
+  enc->auto_crop_pixels.clear();
+  enc->auto_crop_stride = 0;
   enc->output_processor =
       JxlEncoderOutputProcessorWrapper(&enc->memory_manager);
   JxlEncoderInitBasicInfo(&enc->basic_info);
@@ -2050,6 +2407,32 @@ JxlEncoderStatus JxlEncoderSetParallelRunner(JxlEncoder* enc,
   return JxlErrorOrStatus::Success();
 }
 
+JxlEncoderStatus JxlEncoderSetParallelFrames(JxlEncoder* enc,
+                                             size_t max_frames) {
+  if (enc->wrote_bytes) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "parallel frames must be set before encoding");
+  }
+  enc->parallel_frames = max_frames;
+  return JxlErrorOrStatus::Success();
+}
+
+JXL_BOOL JxlEncoderStruct::CheckCancelled(void* opaque) {
+  JxlEncoder* enc = static_cast<JxlEncoder*>(opaque);
+  if (!enc->cancelled && enc->cancel_callback(enc->cancel_opaque)) {
+    enc->cancelled = true;
+  }
+  return TO_JXL_BOOL(enc->cancelled);
+}
+
+JxlEncoderStatus JxlEncoderSetCancelCallback(JxlEncoder* enc,
+                                             JxlEncoderCancelCallback callback,
+                                             void* opaque) {
+  enc->cancel_callback = callback;
+  enc->cancel_opaque = opaque;
+  return JxlErrorOrStatus::Success();
+}
+
 namespace {
 JxlEncoderStatus GetCurrentDimensions(
     const JxlEncoderFrameSettings* frame_settings, size_t& xsize,
@@ -2073,6 +2456,37 @@ JxlEncoderStatus GetCurrentDimensions(
 }
 }  // namespace
 
+// Queues a frame of the quantized DCT coefficients `jpeg_data`.
+static JxlEncoderStatus QueueJPEGDataFrame(
+    const JxlEncoderFrameSettings* frame_settings, size_t xsize, size_t ysize,
+    std::unique_ptr<jxl::jpeg::JPEGData> jpeg_data) {
+  jxl::JxlEncoderChunkedFrameAdapter frame_data(
+      xsize, ysize, frame_settings->enc->metadata.m.num_extra_channels);
+  frame_data.SetJPEGData(std::move(jpeg_data));
+
+  auto queued_frame = jxl::MemoryManagerMakeUnique<jxl::JxlEncoderQueuedFrame>(
+      &frame_settings->enc->memory_manager,
+      // JxlEncoderQueuedFrame is a struct with no constructors, so we use the
+      // default move constructor there.
+      jxl::JxlEncoderQueuedFrame{frame_settings->values,
+                                 std::move(frame_data),
+                                 {},
+                                 /*encoded_ahead=*/false,
+                                 {}});
+  if (!queued_frame) {
+    // TODO(jon): when can this happen? is this an API usage error?
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
+                         "No frame queued?");
+  }
+  queued_frame->ec_initialized.resize(
+      frame_settings->enc->metadata.m.num_extra_channels);
+  // See JXL_ENC_FRAME_SETTING_AUTO_CROP.
+  frame_settings->enc->auto_crop_pixels.clear();
+
+  QueueFrame(frame_settings, queued_frame);
+  return JxlErrorOrStatus::Success();
+}
+
 JxlEncoderStatus JxlEncoderAddJPEGFrame(
     const JxlEncoderFrameSettings* frame_settings, const uint8_t* buffer,
     size_t size) {
@@ -2081,23 +2495,28 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
                          "Frame input is already closed");
   }
 
-  jxl::CodecInOut io{&frame_settings->enc->memory_manager};
-  if (!jxl::jpeg::DecodeImageJPG(jxl::Bytes(buffer, size), &io)) {
+  // Only the coefficients and the metadata of the JPEG are kept, no image is
+  // allocated for its pixels.
+  auto jpeg_data = jxl::make_unique<jxl::jpeg::JPEGData>();
+  jxl::Blobs blobs;
+  if (!jxl::jpeg::ReadJPEGForTranscoding(
+          jxl::Bytes(buffer, size), jpeg_data.get(), &blobs,
+          frame_settings->enc->thread_pool.get())) {
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_BAD_INPUT,
                          "Error during decode of input JPEG");
   }
 
   if (!frame_settings->enc->color_encoding_set) {
     SetColorEncodingFromJpegData(
-        *io.Main().jpeg_data, &frame_settings->enc->metadata.m.color_encoding);
+        *jpeg_data, &frame_settings->enc->metadata.m.color_encoding);
     frame_settings->enc->color_encoding_set = true;
   }
 
   if (!frame_settings->enc->basic_info_set) {
     JxlBasicInfo basic_info;
     JxlEncoderInitBasicInfo(&basic_info);
-    basic_info.xsize = io.Main().jpeg_data->width;
-    basic_info.ysize = io.Main().jpeg_data->height;
+    basic_info.xsize = jpeg_data->width;
+    basic_info.ysize = jpeg_data->height;
     basic_info.uses_original_profile = JXL_TRUE;
     if (JxlEncoderSetBasicInfo(frame_settings->enc, &basic_info) !=
         JXL_ENC_SUCCESS) {
@@ -2112,8 +2531,8 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
                          "bad dimensions");
   }
-  if (xsize != static_cast<size_t>(io.Main().jpeg_data->width) ||
-      ysize != static_cast<size_t>(io.Main().jpeg_data->height)) {
+  if (xsize != static_cast<size_t>(jpeg_data->width) ||
+      ysize != static_cast<size_t>(jpeg_data->height)) {
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
                          "JPEG dimensions don't match frame dimensions");
   }
@@ -2122,14 +2541,14 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
                          "Can't XYB encode a lossless JPEG");
   }
-  if (!io.blobs.exif.empty()) {
+  if (!blobs.exif.empty()) {
     JxlOrientation orientation = static_cast<JxlOrientation>(
         frame_settings->enc->metadata.m.orientation);
-    jxl::InterpretExif(io.blobs.exif, &orientation);
+    jxl::InterpretExif(blobs.exif, &orientation);
     frame_settings->enc->metadata.m.orientation = orientation;
   }
-  if (!io.blobs.exif.empty() && frame_settings->values.cparams.jpeg_keep_exif) {
-    size_t exif_size = io.blobs.exif.size();
+  if (!blobs.exif.empty() && frame_settings->values.cparams.jpeg_keep_exif) {
+    size_t exif_size = blobs.exif.size();
     // Exif data in JPEG is limited to 64k
     if (exif_size > 0xFFFF) {
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
@@ -2137,24 +2556,22 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
     }
     exif_size += 4;  // prefix 4 zero bytes for tiff offset
     std::vector<uint8_t> exif(exif_size);
-    memcpy(exif.data() + 4, io.blobs.exif.data(), io.blobs.exif.size());
+    memcpy(exif.data() + 4, blobs.exif.data(), blobs.exif.size());
     JxlEncoderUseBoxes(frame_settings->enc);
     JxlEncoderAddBox(
         frame_settings->enc, "Exif", exif.data(), exif_size,
         TO_JXL_BOOL(frame_settings->values.cparams.jpeg_compress_boxes));
   }
-  if (!io.blobs.xmp.empty() && frame_settings->values.cparams.jpeg_keep_xmp) {
+  if (!blobs.xmp.empty() && frame_settings->values.cparams.jpeg_keep_xmp) {
     JxlEncoderUseBoxes(frame_settings->enc);
     JxlEncoderAddBox(
-        frame_settings->enc, "xml ", io.blobs.xmp.data(), io.blobs.xmp.size(),
+        frame_settings->enc, "xml ", blobs.xmp.data(), blobs.xmp.size(),
         TO_JXL_BOOL(frame_settings->values.cparams.jpeg_compress_boxes));
   }
-  if (!io.blobs.jumbf.empty() &&
-      frame_settings->values.cparams.jpeg_keep_jumbf) {
+  if (!blobs.jumbf.empty() && frame_settings->values.cparams.jpeg_keep_jumbf) {
     JxlEncoderUseBoxes(frame_settings->enc);
     JxlEncoderAddBox(
-        frame_settings->enc, "jumb", io.blobs.jumbf.data(),
-        io.blobs.jumbf.size(),
+        frame_settings->enc, "jumb", blobs.jumbf.data(), blobs.jumbf.size(),
         TO_JXL_BOOL(frame_settings->values.cparams.jpeg_compress_boxes));
   }
   if (frame_settings->enc->store_jpeg_metadata) {
@@ -2164,43 +2581,97 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
                            "Need to preserve EXIF and XMP to allow JPEG "
                            "bitstream reconstruction");
     }
-    jxl::jpeg::JPEGData data_in = *io.Main().jpeg_data;
-    std::vector<uint8_t> jpeg_data;
+    // EncodeJPEGData does not need the coefficients, which are the bulk of
+    // the JPEGData, so they are not copied.
+    std::vector<std::vector<jxl::jpeg::coeff_t>> coeffs;
+    for (auto& component : jpeg_data->components) {
+      coeffs.emplace_back(std::move(component.coeffs));
+    }
+    jxl::jpeg::JPEGData data_in = *jpeg_data;
+    for (size_t c = 0; c < coeffs.size(); c++) {
+      jpeg_data->components[c].coeffs = std::move(coeffs[c]);
+    }
+    std::vector<uint8_t> jpeg_metadata;
     if (!jxl::jpeg::EncodeJPEGData(&frame_settings->enc->memory_manager,
-                                   data_in, &jpeg_data,
+                                   data_in, &jpeg_metadata,
                                    frame_settings->values.cparams)) {
       return JXL_API_ERROR(
           frame_settings->enc, JXL_ENC_ERR_JBRD,
           "JPEG bitstream reconstruction data cannot be encoded");
     }
-    frame_settings->enc->jpeg_metadata = jpeg_data;
+    frame_settings->enc->jpeg_metadata = jpeg_metadata;
   }
 
-  jxl::JxlEncoderChunkedFrameAdapter frame_data(
-      xsize, ysize, frame_settings->enc->metadata.m.num_extra_channels);
-  frame_data.SetJPEGData(std::move(io.Main().jpeg_data));
+  return QueueJPEGDataFrame(frame_settings, xsize, ysize, std::move(jpeg_data));
+}
 
-  auto queued_frame = jxl::MemoryManagerMakeUnique<jxl::JxlEncoderQueuedFrame>(
-      &frame_settings->enc->memory_manager,
-      // JxlEncoderQueuedFrame is a struct with no constructors, so we use the
-      // default move constructor there.
-      jxl::JxlEncoderQueuedFrame{
-          frame_settings->values, std::move(frame_data), {}});
-  if (!queued_frame) {
-    // TODO(jon): when can this happen? is this an API usage error?
+JxlEncoderStatus JxlEncoderAddYCbCrFrame(
+    const JxlEncoderFrameSettings* frame_settings, const JxlYCbCrImage* image) {
+  if (frame_settings->enc->frames_closed) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "Frame input is already closed");
+  }
+  if (!frame_settings->enc->basic_info_set) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "Basic info has to be set first");
+  }
+  if (frame_settings->enc->metadata.m.xyb_encoded) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "YCbCr frames need uses_original_profile");
+  }
+  if (frame_settings->values.lossless) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "YCbCr frames can not be lossless");
+  }
+  if (frame_settings->enc->store_jpeg_metadata) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "There is no JPEG to reconstruct from YCbCr frames");
+  }
+  if (frame_settings->enc->metadata.m.color_encoding.IsGray() ||
+      frame_settings->enc->metadata.m.num_extra_channels != 0) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
+                         "YCbCr frames need exactly three color channels");
+  }
+  size_t xsize;
+  size_t ysize;
+  if (GetCurrentDimensions(frame_settings, xsize, ysize) != JXL_ENC_SUCCESS) {
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
-                         "No frame queued?");
+                         "bad dimensions");
   }
-  queued_frame->ec_initialized.resize(
-      frame_settings->enc->metadata.m.num_extra_channels);
+  jxl::jpeg::YCbCrPlanes planes;
+  for (size_t c = 0; c < 3; c++) {
+    planes.planes[c] = image->planes[c];
+    planes.row_strides[c] = image->row_strides[c];
+  }
+  planes.chroma_half_width = FROM_JXL_BOOL(image->chroma_half_width);
+  planes.chroma_half_height = FROM_JXL_BOOL(image->chroma_half_height);
+  auto jpeg_data = jxl::make_unique<jxl::jpeg::JPEGData>();
+  const int quality = jxl::jpeg::JPEGQualityFromDistance(
+      frame_settings->values.cparams.butteraugli_distance);
+  if (!jxl::jpeg::JPEGDataFromYCbCr(planes, xsize, ysize, quality,
+                                    frame_settings->enc->thread_pool.get(),
+                                    jpeg_data.get())) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_GENERIC,
+                         "Error computing the DCT of the YCbCr frame");
+  }
+  if (!frame_settings->enc->color_encoding_set) {
+    SetColorEncodingFromJpegData(
+        *jpeg_data, &frame_settings->enc->metadata.m.color_encoding);
+    frame_settings->enc->color_encoding_set = true;
+  }
+  return QueueJPEGDataFrame(frame_settings, xsize, ysize, std::move(jpeg_data));
+}
 
-  QueueFrame(frame_settings, queued_frame);
-  return JxlErrorOrStatus::Success();
+static bool IsBigEndian(const JxlPixelFormat& pixel_format) {
+  return pixel_format.endianness == JXL_BIG_ENDIAN ||
+         (pixel_format.endianness == JXL_NATIVE_ENDIAN && !IsLittleEndian());
 }
 
+// The extra channels after the interleaved alpha channel, if any, are read
+// from `input_source`, which is null if they are not available yet.
 static bool CanDoFastLossless(const JxlEncoderFrameSettings* frame_settings,
                               const JxlPixelFormat* pixel_format,
-                              bool has_alpha) {
+                              const JxlChunkedFrameInputSource* input_source) {
   if (!frame_settings->values.lossless) {
     return false;
   }
@@ -2212,10 +2683,19 @@ static bool CanDoFastLossless(const JxlEncoderFrameSettings* frame_settings,
   if (frame_settings->values.header.layer_info.have_crop) {
     return false;
   }
+  if (frame_settings->values.cparams.ma_tree_out != nullptr ||
+      !frame_settings->values.cparams.custom_fixed_tree.empty()) {
+    return false;
+  }
   if (frame_settings->enc->metadata.m.have_animation) {
     return false;
   }
-  if (frame_settings->values.cparams.speed_tier != jxl::SpeedTier::kLightning) {
+  // Effort 2 uses the slower mode of the fast lossless encoder, unless a
+  // predictor is requested.
+  const jxl::CompressParams& cparams = frame_settings->values.cparams;
+  if (cparams.speed_tier != jxl::SpeedTier::kLightning &&
+      (cparams.speed_tier != jxl::SpeedTier::kThunder ||
+       cparams.options.predictor != jxl::kUndefinedPredictor)) {
     return false;
   }
   if (frame_settings->values.image_bit_depth.type ==
@@ -2234,11 +2714,6 @@ static bool CanDoFastLossless(const JxlEncoderFrameSettings* frame_settings,
   if (!frame_settings->values.frame_name.empty()) {
     return false;
   }
-  // No extra channels other than alpha.
-  if (!(has_alpha && frame_settings->enc->metadata.m.num_extra_channels == 1) &&
-      frame_settings->enc->metadata.m.num_extra_channels != 0) {
-    return false;
-  }
   if (frame_settings->enc->metadata.m.bit_depth.bits_per_sample > 16) {
     return false;
   }
@@ -2252,17 +2727,144 @@ static bool CanDoFastLossless(const JxlEncoderFrameSettings* frame_settings,
        pixel_format->data_type == JxlDataType::JXL_TYPE_FLOAT16)) {
     return false;
   }
-  if (!((pixel_format->num_channels == 1 || pixel_format->num_channels == 3) &&
-        !has_alpha) &&
-      !((pixel_format->num_channels == 2 || pixel_format->num_channels == 4) &&
-        has_alpha)) {
+  const jxl::ImageMetadata& metadata = frame_settings->enc->metadata.m;
+  const bool interleaved_alpha =
+      pixel_format->num_channels == 2 || pixel_format->num_channels == 4;
+  // The interleaved alpha channel must come first in the image.
+  if (interleaved_alpha &&
+      (metadata.num_extra_channels == 0 ||
+       metadata.extra_channel_info[0].type != jxl::ExtraChannel::kAlpha)) {
     return false;
   }
+  const bool big_endian = IsBigEndian(*pixel_format);
+  for (size_t i = interleaved_alpha ? 1 : 0; i < metadata.num_extra_channels;
+       i++) {
+    const jxl::ExtraChannelInfo& eci = metadata.extra_channel_info[i];
+    if (!input_source || eci.dim_shift != 0 ||
+        eci.bit_depth.bits_per_sample != metadata.bit_depth.bits_per_sample ||
+        eci.bit_depth.floating_point_sample !=
+            metadata.bit_depth.floating_point_sample) {
+      return false;
+    }
+    JxlPixelFormat ec_format = *pixel_format;
+    input_source->get_extra_channel_pixel_format(input_source->opaque, i,
+                                                 &ec_format);
+    if (ec_format.data_type != pixel_format->data_type ||
+        (pixel_format->data_type != JXL_TYPE_UINT8 &&
+         IsBigEndian(ec_format) != big_endian)) {
+      return false;
+    }
+  }
 
   return true;
 }
 
 namespace {
+// Returns the smallest rectangle containing the pixels that differ between
+// `previous` and `pixels`, which have the same layout, or an empty rectangle.
+// The rows are compared with memcmp, which the C library vectorizes, and only
+// the rows that changed are scanned for the first and last changed column.
+jxl::Rect ChangedRect(const uint8_t* previous, const uint8_t* pixels,
+                      size_t xsize, size_t ysize, size_t stride,
+                      size_t bytes_per_pixel) {
+  const size_t row_size = xsize * bytes_per_pixel;
+  size_t y0 = 0;
+  while (y0 < ysize && memcmp(previous + y0 * stride, pixels + y0 * stride,
+                              row_size) == 0) {
+    ++y0;
+  }
+  if (y0 == ysize) return jxl::Rect();
+  size_t y1 = ysize;
+  while (memcmp(previous + (y1 - 1) * stride, pixels + (y1 - 1) * stride,
+                row_size) == 0) {
+    --y1;
+  }
+  // In bytes until the end of the loop.
+  size_t x0 = row_size;
+  size_t x1 = 0;
+  for (size_t y = y0; y < y1; ++y) {
+    const uint8_t* prev_row = previous + y * stride;
+    const uint8_t* row = pixels + y * stride;
+    if (x0 > 0 && memcmp(prev_row, row, x0) != 0) {
+      size_t x = 0;
+      while (prev_row[x] == row[x]) ++x;
+      x0 = x;
+    }
+    if (x1 < row_size &&
+        memcmp(prev_row + x1, row + x1, row_size - x1) != 0) {
+      size_t x = row_size;
+      while (prev_row[x - 1] == row[x - 1]) --x;
+      x1 = x;
+    }
+  }
+  x0 /= bytes_per_pixel;
+  x1 = jxl::DivCeil(x1, bytes_per_pixel);
+  return jxl::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+// Whether JXL_ENC_FRAME_SETTING_AUTO_CROP applies to the frame, see its
+// documentation for the conditions.
+bool CanAutoCrop(const JxlEncoderFrameSettings* frame_settings, bool streaming,
+                 size_t has_interleaved_alpha) {
+  const jxl::JxlEncoderFrameSettingsValues& values = frame_settings->values;
+  const JxlLayerInfo& layer_info = values.header.layer_info;
+  return values.auto_crop && !streaming &&
+         frame_settings->enc->metadata.m.have_animation &&
+         frame_settings->enc->metadata.m.num_extra_channels ==
+             has_interleaved_alpha &&
+         !values.frame_index_box && values.keyframe_interval <= 0 &&
+         !layer_info.have_crop && layer_info.save_as_reference == 0 &&
+         layer_info.blend_info.blendmode == JXL_BLEND_REPLACE &&
+         layer_info.blend_info.source == 0 &&
+         values.extra_channel_blend_info.empty() &&
+         !values.cparams.already_downsampled &&
+         values.cparams.resampling <= 1 && values.cparams.ec_resampling <= 1;
+}
+
+// Compares the frame, whose buffers are copied, to the previous frame added
+// with JXL_ENC_FRAME_SETTING_AUTO_CROP, and sets `layer_info` to only replace
+// the region that changed. Returns that region, or an empty rectangle if the
+// whole frame is encoded. Each frame is saved in the reference slot 1 for the
+// next one.
+jxl::Rect AutoCrop(JxlEncoderStruct* enc,
+                   const jxl::JxlEncoderChunkedFrameAdapter& frame_data,
+                   JxlLayerInfo* layer_info) {
+  const JxlPixelFormat format = frame_data.ColorFormat();
+  const size_t bytes_per_pixel = jxl::BytesPerPixel(format);
+  size_t stride;
+  const uint8_t* pixels = frame_data.ColorData(&stride);
+  const size_t size =
+      stride * (frame_data.ysize - 1) + frame_data.xsize * bytes_per_pixel;
+  jxl::Rect crop;
+  if (enc->auto_crop_pixels.size() == size && enc->auto_crop_stride == stride &&
+      enc->auto_crop_format.num_channels == format.num_channels &&
+      enc->auto_crop_format.data_type == format.data_type &&
+      enc->auto_crop_format.endianness == format.endianness) {
+    crop = ChangedRect(enc->auto_crop_pixels.data(), pixels, frame_data.xsize,
+                       frame_data.ysize, stride, bytes_per_pixel);
+    if (crop.xsize() == 0) {
+      // Frames cannot be empty, this one repeats the first pixel.
+      crop = jxl::Rect(0, 0, 1, 1);
+    } else if (crop.xsize() == frame_data.xsize &&
+               crop.ysize() == frame_data.ysize) {
+      crop = jxl::Rect();
+    }
+  }
+  enc->auto_crop_pixels.assign(pixels, pixels + size);
+  enc->auto_crop_format = format;
+  enc->auto_crop_stride = stride;
+  layer_info->save_as_reference = 1;
+  if (crop.xsize() != 0) {
+    layer_info->have_crop = JXL_TRUE;
+    layer_info->crop_x0 = static_cast<int32_t>(crop.x0());
+    layer_info->crop_y0 = static_cast<int32_t>(crop.y0());
+    layer_info->xsize = crop.xsize();
+    layer_info->ysize = crop.ysize();
+    layer_info->blend_info.source = 1;
+  }
+  return crop;
+}
+
 JxlEncoderStatus JxlEncoderAddImageFrameInternal(
     const JxlEncoderFrameSettings* frame_settings, size_t xsize, size_t ysize,
     bool streaming, jxl::JxlEncoderChunkedFrameAdapter&& frame_data) {
@@ -2319,21 +2921,28 @@ JxlEncoderStatus JxlEncoderAddImageFrameInternal(
         "number of extra channels mismatch (need 1 extra channel for alpha)");
   }
 
-  bool has_alpha = frame_settings->enc->metadata.m.HasAlpha();
-
   // All required conditions to do fast-lossless.
-  if (CanDoFastLossless(frame_settings, &pixel_format, has_alpha)) {
-    const bool big_endian =
-        pixel_format.endianness == JXL_BIG_ENDIAN ||
-        (pixel_format.endianness == JXL_NATIVE_ENDIAN && !IsLittleEndian());
+  JxlChunkedFrameInputSource input_source = frame_data.GetInputSource();
+  const JxlChunkedFrameInputSource* extra_channels_source =
+      frame_data.StreamingInput() ? &input_source : nullptr;
+  if (CanDoFastLossless(frame_settings, &pixel_format, extra_channels_source)) {
+    const bool big_endian = IsBigEndian(pixel_format);
+    const size_t num_planar_channels =
+        frame_settings->enc->metadata.m.num_extra_channels -
+        has_interleaved_alpha;
 
     RunnerTicket ticket{frame_settings->enc->thread_pool.get()};
     JXL_BOOL oneshot = TO_JXL_BOOL(!frame_data.StreamingInput());
-    auto* frame_state = JxlFastLosslessPrepareFrame(
-        frame_data.GetInputSource(), xsize, ysize, num_channels,
+    auto* frame_state = JxlFastLosslessPrepareFrameWithExtraChannels(
+        input_source, xsize, ysize, num_channels, num_planar_channels,
+        /*first_planar_channel=*/has_interleaved_alpha,
         frame_settings->enc->metadata.m.bit_depth.bits_per_sample, big_endian,
-        /*effort=*/2, oneshot);
+        frame_settings->values.cparams.speed_tier == jxl::SpeedTier::kLightning
+            ? 2
+            : FJXL_GROUP_ANALYSIS_EFFORT,
+        oneshot);
     if (!streaming) {
+      JXL_TRACE_SCOPE("FastLosslessProcessFrame");
       bool ok =
           JxlFastLosslessProcessFrame(frame_state, /*is_last=*/false, &ticket,
                                       &FastLosslessRunnerAdapter, nullptr);
@@ -2367,12 +2976,31 @@ JxlEncoderStatus JxlEncoderAddImageFrameInternal(
     frame_settings->enc->metadata.m.color_encoding = c_current;
   }
 
+  jxl::JxlEncoderFrameSettingsValues values = frame_settings->values;
+  jxl::Rect crop;
+  if (CanAutoCrop(frame_settings, streaming, has_interleaved_alpha)) {
+    crop = AutoCrop(frame_settings->enc, frame_data, &values.header.layer_info);
+  } else {
+    // The reference slot 1 may not hold the previous frame anymore.
+    frame_settings->enc->auto_crop_pixels.clear();
+  }
+  jxl::JxlEncoderChunkedFrameAdapter cropped_data(
+      crop.xsize(), crop.ysize(),
+      frame_settings->enc->metadata.m.num_extra_channels);
+  if (crop.xsize() != 0) {
+    cropped_data.CopyColorRect(frame_data, crop.x0(), crop.y0());
+  }
+
   auto queued_frame = jxl::MemoryManagerMakeUnique<jxl::JxlEncoderQueuedFrame>(
       &frame_settings->enc->memory_manager,
       // JxlEncoderQueuedFrame is a struct with no constructors, so we use the
       // default move constructor there.
       jxl::JxlEncoderQueuedFrame{
-          frame_settings->values, std::move(frame_data), {}});
+          std::move(values),
+          crop.xsize() != 0 ? std::move(cropped_data) : std::move(frame_data),
+          {},
+          /*encoded_ahead=*/false,
+          {}});
 
   if (!queued_frame) {
     // TODO(jon): when can this happen? is this an API usage error?
@@ -2689,6 +3317,46 @@ JXL_EXPORT void JxlEncoderSetDebugImageCallback(
   frame_settings->values.cparams.debug_image_opaque = opaque;
 }
 
+JxlEncoderMATree* JxlEncoderMATreeCreate() { return new JxlEncoderMATree(); }
+
+void JxlEncoderMATreeDestroy(JxlEncoderMATree* tree) { delete tree; }
+
+JxlEncoderStatus JxlEncoderCollectMATree(
+    JxlEncoderFrameSettings* frame_settings, JxlEncoderMATree* tree) {
+  frame_settings->values.cparams.ma_tree_out =
+      tree != nullptr ? &tree->tree : nullptr;
+  return JxlErrorOrStatus::Success();
+}
+
+JxlEncoderStatus JxlEncoderFrameSettingsSetMATree(
+    JxlEncoderFrameSettings* frame_settings, const JxlEncoderMATree* tree) {
+  if (tree == nullptr) {
+    frame_settings->values.cparams.custom_fixed_tree.clear();
+    return JxlErrorOrStatus::Success();
+  }
+  if (tree->tree.empty()) {
+    return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                         "MA tree was not collected from any frame");
+  }
+  frame_settings->values.cparams.custom_fixed_tree = tree->tree;
+  return JxlErrorOrStatus::Success();
+}
+
+JxlEncoderAnalysis* JxlEncoderAnalysisCreate() {
+  return new JxlEncoderAnalysis();
+}
+
+void JxlEncoderAnalysisDestroy(JxlEncoderAnalysis* analysis) {
+  delete analysis;
+}
+
+JxlEncoderStatus JxlEncoderFrameSettingsSetAnalysis(
+    JxlEncoderFrameSettings* frame_settings, JxlEncoderAnalysis* analysis) {
+  frame_settings->values.cparams.analysis =
+      analysis != nullptr ? &analysis->analysis : nullptr;
+  return JxlErrorOrStatus::Success();
+}
+
 JXL_EXPORT JxlEncoderStats* JxlEncoderStatsCreate() {
   JxlEncoderStats* result = new JxlEncoderStats();
   result->aux_out = jxl::make_unique<jxl::AuxOut>();
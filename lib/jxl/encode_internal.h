@@ -15,8 +15,10 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <functional>
 #include <map>
@@ -31,10 +33,13 @@
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/enc_fast_lossless.h"
+#include "lib/jxl/enc_heuristics.h"
 #include "lib/jxl/enc_params.h"
+#include "lib/jxl/enc_patch_dictionary.h"
 #include "lib/jxl/image_metadata.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 #include "lib/jxl/memory_manager_internal.h"
+#include "lib/jxl/modular/encoding/dec_ma.h"
 #include "lib/jxl/padded_bytes.h"
 
 namespace jxl {
@@ -91,6 +96,8 @@ typedef struct JxlEncoderFrameIndexBoxStruct {
   int32_t TDEN = 1000;
 
   std::vector<JxlEncoderFrameIndexBoxEntry> entries;
+  // Amount of entries with a non-zero duration.
+  uint64_t num_displayed_frames = 0;
 
   // That way we can ensure that every index box will have the first frame.
   // If the API user decides to mark it as an indexed frame, we call
@@ -107,6 +114,7 @@ typedef struct JxlEncoderFrameIndexBoxStruct {
         // API use for the first frame, let's clear the already recorded first
         // frame.
         entries.clear();
+        num_displayed_frames = 0;
       }
     }
     JxlEncoderFrameIndexBoxEntry e;
@@ -114,6 +122,7 @@ typedef struct JxlEncoderFrameIndexBoxStruct {
     e.OFFi = OFFi;
     e.duration = duration;
     entries.push_back(e);
+    if (duration > 0) ++num_displayed_frames;
   }
 } JxlEncoderFrameIndexBox;
 
@@ -129,6 +138,11 @@ typedef struct JxlEncoderFrameSettingsValuesStruct {
   std::string frame_name;
   JxlBitDepth image_bit_depth;
   bool frame_index_box = false;
+  // Every keyframe_interval-th displayed frame is indexed as a keyframe, if
+  // positive.
+  int64_t keyframe_interval = 0;
+  // See JXL_ENC_FRAME_SETTING_AUTO_CROP.
+  bool auto_crop = false;
   jxl::AuxOut* aux_out = nullptr;
 } JxlEncoderFrameSettingsValues;
 
@@ -272,6 +286,25 @@ class JxlEncoderChunkedFrameAdapter {
 
   bool StreamingInput() const { return has_input_source_; }
 
+  // The color channels, once the buffers are copied.
+  JxlPixelFormat ColorFormat() const { return channels_[0].format_; }
+  const uint8_t* ColorData(size_t* stride) const {
+    return static_cast<const uint8_t*>(
+        channels_[0].GetDataAt(0, 0, xsize, ysize, stride));
+  }
+
+  // Copies the color channels of the `xsize` x `ysize` rectangle at `x0`, `y0`
+  // of `from`, whose buffers are copied, with unaligned rows.
+  void CopyColorRect(const JxlEncoderChunkedFrameAdapter& from, size_t x0,
+                     size_t y0) {
+    JxlPixelFormat format = from.ColorFormat();
+    format.align = 0;
+    size_t row_offset;
+    const void* buffer =
+        from.channels_[0].GetDataAt(x0, y0, xsize, ysize, &row_offset);
+    channels_[0].CopyFromBuffer(buffer, format, xsize, ysize, row_offset);
+  }
+
   const size_t xsize;
   const size_t ysize;
 
@@ -375,12 +408,31 @@ struct JxlEncoderQueuedFrame {
   JxlEncoderFrameSettingsValues option_values;
   JxlEncoderChunkedFrameAdapter frame_data;
   std::vector<uint8_t> ec_initialized;
+  // The codestream of the frame, if it was encoded ahead of the frames before
+  // it, see JxlEncoderStruct::EncodeFramesAhead.
+  bool encoded_ahead = false;
+  std::vector<uint8_t> encoded;
 };
 
 struct JxlEncoderQueuedBox {
   BoxType type;
   std::vector<uint8_t> contents;
   bool compress_box;
+  // The contents of the brob box and the Brotli quality they were compressed
+  // with, if they were compressed before the box was processed, see
+  // JxlEncoderStruct::CompressBoxesAhead.
+  bool compressed_ahead = false;
+  int compressed_quality = 0;
+  std::vector<uint8_t> compressed;
+};
+
+// A brob box that was already compressed, see
+// JxlEncoderStruct::compressed_boxes.
+struct JxlEncoderCompressedBox {
+  BoxType type;
+  int quality;
+  std::vector<uint8_t> contents;
+  std::vector<uint8_t> compressed;
 };
 
 using FJXLFrameUniquePtr =
@@ -463,6 +515,11 @@ class JxlEncoderOutputProcessorWrapper {
   jxl::Status CopyOutput(std::vector<uint8_t>& output, uint8_t* next_out,
                          size_t& avail_out);
 
+  // From now on, keeps the output that cannot be written yet, e.g. the groups
+  // that follow the not yet known TOC when the output processor cannot seek,
+  // in a temporary file instead of memory.
+  jxl::Status EnableSpilling();
+
  private:
   jxl::Status ReleaseBuffer(size_t bytes_used);
 
@@ -471,6 +528,13 @@ class JxlEncoderOutputProcessorWrapper {
 
   bool AppendBufferToExternalProcessor(void* data, size_t count);
 
+  // Moves the `count` bytes of `data` to the end of the spill file and returns
+  // their offset in it.
+  jxl::StatusOr<uint64_t> Spill(const uint8_t* data, size_t count);
+
+  // Reads `count` bytes at `offset` of the spill file.
+  jxl::Status ReadSpilled(uint64_t offset, size_t count, uint8_t* data);
+
   struct InternalBuffer {
     explicit InternalBuffer(JxlMemoryManager* memory_manager)
         : owned_data(memory_manager) {
@@ -479,8 +543,15 @@ class JxlEncoderOutputProcessorWrapper {
     // Bytes in the range `[output_position_ - start_of_the_buffer,
     // written_bytes)` need to be flushed out.
     size_t written_bytes = 0;
-    // If data has been buffered, it is stored in `owned_data`.
+    // If data has been buffered, it is stored in `owned_data`, or in the
+    // spill file from `spill_offset` on if `spilled` is set.
     jxl::PaddedBytes owned_data;
+    bool spilled = false;
+    uint64_t spill_offset = 0;
+  };
+
+  struct FileCloser {
+    void operator()(FILE* file) const { fclose(file); }
   };
 
   // Invariant: `internal_buffers_` does not contain chunks that are entirely
@@ -502,6 +573,11 @@ class JxlEncoderOutputProcessorWrapper {
 
   JxlMemoryManager* memory_manager_;
   std::unique_ptr<JxlEncoderOutputProcessor> external_output_processor_;
+
+  std::unique_ptr<FILE, FileCloser> spill_file_;
+  uint64_t spill_file_size_ = 0;
+  // Bytes read back from the spill file before writing them out.
+  std::vector<uint8_t> spill_chunk_;
 };
 
 class JxlOutputProcessorBuffer {
@@ -654,11 +730,53 @@ struct JxlEncoderStruct {
   bool intensity_target_set;
   bool allow_expert_options = false;
   int brotli_effort = -1;
+  // Maximum amount of queued frames encoded at once, see
+  // JxlEncoderSetParallelFrames.
+  size_t parallel_frames = 0;
+  // See JxlEncoderSetCancelCallback. `cancelled` is set once the callback
+  // returned true.
+  JxlEncoderCancelCallback cancel_callback = nullptr;
+  void* cancel_opaque = nullptr;
+  std::atomic<bool> cancelled{false};
+
+  // The last compressed brob boxes. Unlike the rest of the state, they are kept
+  // by JxlEncoderReset, so that the same metadata added to each image encoded
+  // with the encoder is only compressed once.
+  static constexpr size_t kMaxCompressedBoxes = 4;
+  std::vector<jxl::JxlEncoderCompressedBox> compressed_boxes;
+  // What the heuristics of the last frame encoded with
+  // JXL_ENC_FRAME_SETTING_REUSE_PREVIOUS_HEURISTICS decided. Cleared by
+  // JxlEncoderReset.
+  jxl::FrameHeuristicsHistory heuristics_history;
+  // The patch dictionary that the decoder has as reference frame, for the
+  // frames encoded with JXL_ENC_FRAME_SETTING_SHARED_PATCHES. Cleared by
+  // JxlEncoderReset and by the frames encoded without it.
+  jxl::SharedPatchDictionary shared_patches;
+  // The color channels of the last frame added with
+  // JXL_ENC_FRAME_SETTING_AUTO_CROP, to find what changed in the next one.
+  // Cleared by JxlEncoderReset.
+  std::vector<uint8_t> auto_crop_pixels;
+  JxlPixelFormat auto_crop_format;
+  size_t auto_crop_stride = 0;
 
   // Takes the first frame in the input_queue, encodes it, and appends
   // the bytes to the output_byte_queue.
   jxl::Status ProcessOneEnqueuedInput();
 
+  // If the first item of the input_queue is a frame, encodes it together with
+  // the frames queued after it at once, one frame per thread.
+  jxl::Status EncodeFramesAhead();
+
+  // Compresses the queued boxes that are to be brob compressed at once, one
+  // box per thread, or takes their compressed contents from compressed_boxes.
+  jxl::Status CompressBoxesAhead();
+
+  // Calls cancel_callback, for CompressParams::cancel.
+  static JXL_BOOL CheckCancelled(void* opaque);
+
+  // Returns the Brotli quality of the brob boxes.
+  int BrobQuality() const { return brotli_effort >= 0 ? brotli_effort : 4; }
+
   bool MustUseContainer() const {
     return use_container || (codestream_level != 5 && codestream_level != -1) ||
            store_jpeg_metadata || use_boxes;
@@ -681,6 +799,14 @@ struct JxlEncoderFrameSettingsStruct {
   jxl::JxlEncoderFrameSettingsValues values;
 };
 
+struct JxlEncoderMATreeStruct {
+  jxl::Tree tree;
+};
+
+struct JxlEncoderAnalysisStruct {
+  jxl::FrameAnalysis analysis;
+};
+
 struct JxlEncoderStatsStruct {
   std::unique_ptr<jxl::AuxOut> aux_out;
 };
@@ -12,12 +12,17 @@
 #include <jxl/encode.h>
 #include <jxl/encode_cxx.h>
 #include <jxl/memory_manager.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
 #include <jxl/types.h>
 
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstring>
 #include <mutex>
 #include <ostream>
@@ -39,6 +44,8 @@
 #include "lib/jxl/common.h"  // JXL_HIGH_PRECISION
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/encode_internal.h"
+#include "lib/jxl/modular/encoding/context_predict.h"
+#include "lib/jxl/modular/encoding/dec_ma.h"
 #include "lib/jxl/modular/options.h"
 #include "lib/jxl/test_image.h"
 #include "lib/jxl/test_memory_manager.h"
@@ -506,6 +513,23 @@ TEST(EncodeTest, FrameSettingsTest) {
     EXPECT_EQ(5, enc->last_used_cparams.center_x);
   }
 
+  {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+    EXPECT_EQ(JXL_ENC_ERROR,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_PROGRESSIVE_LAYOUT, 2));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_PROGRESSIVE_LAYOUT, 1));
+    // Several groups, so that the sections are actually reordered.
+    VerifyFrameEncoding(300, 260, enc.get(), frame_settings, 60000,
+                        /*lossy_use_original_profile=*/false);
+    EXPECT_EQ(true, enc->last_used_cparams.progressive_layout);
+  }
+
   {
     JxlEncoderPtr enc = JxlEncoderMake(nullptr);
     EXPECT_NE(nullptr, enc.get());
@@ -1042,6 +1066,84 @@ static void ProcessEncoder(JxlEncoder* enc, std::vector<uint8_t>& compressed,
   EXPECT_EQ(JXL_ENC_SUCCESS, process_result);
 }
 
+TEST(EncodeTest, YCbCr420FrameTest) {
+  const size_t xsize = 130;
+  const size_t ysize = 70;
+  const size_t cxsize = (xsize + 1) / 2;
+  const size_t cysize = (ysize + 1) / 2;
+  // Smooth planes, for which the position of the chroma samples matters
+  // little.
+  std::vector<uint8_t> y_plane(xsize * ysize);
+  std::vector<uint8_t> cb_plane(cxsize * cysize);
+  std::vector<uint8_t> cr_plane(cxsize * cysize);
+  for (size_t y = 0; y < ysize; y++) {
+    for (size_t x = 0; x < xsize; x++) {
+      y_plane[y * xsize + x] = 40 + x + y;
+    }
+  }
+  for (size_t y = 0; y < cysize; y++) {
+    for (size_t x = 0; x < cxsize; x++) {
+      cb_plane[y * cxsize + x] = 100 + x / 2;
+      cr_plane[y * cxsize + x] = 150 - y;
+    }
+  }
+  JxlYCbCrImage image = {{y_plane.data(), cb_plane.data(), cr_plane.data()},
+                         {xsize, cxsize, cxsize},
+                         JXL_TRUE,
+                         JXL_TRUE};
+
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+  JxlBasicInfo basic_info;
+  JxlEncoderInitBasicInfo(&basic_info);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = JXL_TRUE;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE));
+  EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderAddYCbCrFrame(frame_settings, &image));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameLossless(frame_settings, JXL_FALSE));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameDistance(frame_settings, 1.0f));
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderAddYCbCrFrame(frame_settings, &image));
+  JxlEncoderCloseInput(enc.get());
+  std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size() - (next_out - compressed.data());
+  ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+
+  jxl::extras::JXLDecompressParams dparams;
+  dparams.accepted_formats = {{3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0}};
+  jxl::extras::PackedPixelFile ppf;
+  ASSERT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(), dparams,
+                             nullptr, &ppf));
+  ASSERT_EQ(ppf.xsize(), xsize);
+  ASSERT_EQ(ppf.ysize(), ysize);
+  const jxl::extras::PackedImage& color = ppf.frames[0].color;
+  int max_diff = 0;
+  for (size_t y = 0; y < ysize; y++) {
+    for (size_t x = 0; x < xsize; x++) {
+      // The JFIF conversion to RGB.
+      const float luma = y_plane[y * xsize + x];
+      const float cb = cb_plane[(y / 2) * cxsize + x / 2] - 128.0f;
+      const float cr = cr_plane[(y / 2) * cxsize + x / 2] - 128.0f;
+      const float expected[3] = {luma + 1.402f * cr,
+                                 luma - 0.344136f * cb - 0.714136f * cr,
+                                 luma + 1.772f * cb};
+      for (size_t c = 0; c < 3; c++) {
+        const int decoded = *color.const_pixels(y, x, c);
+        const float clamped = std::min(std::max(expected[c], 0.0f), 255.0f);
+        const int diff = decoded - static_cast<int>(std::lround(clamped));
+        max_diff = std::max(max_diff, std::abs(diff));
+      }
+    }
+  }
+  EXPECT_LE(max_diff, 8);
+}
+
 TEST(EncodeTest, BasicInfoTest) {
   JxlEncoderPtr enc = JxlEncoderMake(nullptr);
   EXPECT_NE(nullptr, enc.get());
@@ -1257,6 +1359,250 @@ TEST(EncodeTest, AnimationHeaderTest) {
 
   EXPECT_EQ(true, seen_frame);
 }
+
+TEST(EncodeTest, ParallelFramesTest) {
+  const size_t xsize = 40;
+  const size_t ysize = 24;
+  const size_t num_frames = 7;
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  const auto encode = [&](size_t parallel_frames) {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetParallelFrames(enc.get(), parallel_frames));
+    JxlBasicInfo basic_info;
+    jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    basic_info.have_animation = JXL_TRUE;
+    basic_info.animation.tps_numerator = 100;
+    basic_info.animation.tps_denominator = 1;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+    for (size_t i = 0; i < num_frames; ++i) {
+      std::vector<uint8_t> pixels =
+          jxl::test::GetSomeTestImage(xsize, ysize, 4, i);
+      JxlFrameHeader header;
+      JxlEncoderInitFrameHeader(&header);
+      header.duration = 1 + i % 2;
+      if (i % 3 == 2) header.layer_info.blend_info.blendmode = JXL_BLEND_BLEND;
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderSetFrameHeader(frame_settings, &header));
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                        pixels.data(), pixels.size()));
+    }
+    JxlEncoderCloseInput(enc.get());
+    std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+    uint8_t* next_out = compressed.data();
+    size_t avail_out = compressed.size() - (next_out - compressed.data());
+    ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+    EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderSetParallelFrames(enc.get(), 2));
+    return compressed;
+  };
+
+  // Encoding does not depend on the threads, so the codestreams are the same.
+  std::vector<uint8_t> compressed = encode(0);
+  for (size_t parallel_frames : {2, 3, 16}) {
+    EXPECT_EQ(compressed, encode(parallel_frames));
+  }
+}
+
+TEST(EncodeTest, CancelCallbackTest) {
+  const size_t xsize = 512;
+  const size_t ysize = 256;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  struct CancelState {
+    std::atomic<size_t> num_calls{0};
+    bool cancel;
+  };
+  const auto encode = [&](CancelState* state) {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetCancelCallback(
+                  enc.get(),
+                  [](void* opaque) {
+                    CancelState* state = static_cast<CancelState*>(opaque);
+                    state->num_calls++;
+                    return TO_JXL_BOOL(state->cancel);
+                  },
+                  state));
+    JxlBasicInfo basic_info;
+    jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      pixels.data(), pixels.size()));
+    JxlEncoderCloseInput(enc.get());
+    std::vector<uint8_t> compressed(1 << 20);
+    uint8_t* next_out = compressed.data();
+    size_t avail_out = compressed.size();
+    JxlEncoderStatus status =
+        JxlEncoderProcessOutput(enc.get(), &next_out, &avail_out);
+    if (status == JXL_ENC_ERROR) {
+      EXPECT_EQ(JXL_ENC_ERR_CANCELLED, JxlEncoderGetError(enc.get()));
+    }
+    return status;
+  };
+
+  CancelState state;
+  state.cancel = false;
+  EXPECT_EQ(JXL_ENC_SUCCESS, encode(&state));
+  EXPECT_GT(state.num_calls, 0u);
+
+  state.cancel = true;
+  state.num_calls = 0;
+  EXPECT_EQ(JXL_ENC_ERROR, encode(&state));
+  EXPECT_GT(state.num_calls, 0u);
+}
+
+TEST(EncodeTest, MATreeReuseTest) {
+  const size_t xsize = 64;
+  const size_t ysize = 48;
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  const auto encode = [&](size_t seed, const JxlEncoderMATree* use_tree,
+                          JxlEncoderMATree* collect_tree) {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlBasicInfo basic_info;
+    jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    basic_info.uses_original_profile = JXL_TRUE;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetCodestreamLevel(enc.get(), 10));
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_EFFORT, 7));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetMATree(frame_settings, use_tree));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderCollectMATree(frame_settings, collect_tree));
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(xsize, ysize, 4, seed);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      pixels.data(), pixels.size()));
+    JxlEncoderCloseInput(enc.get());
+    std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+    uint8_t* next_out = compressed.data();
+    size_t avail_out = compressed.size() - (next_out - compressed.data());
+    ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+    return compressed;
+  };
+
+  JxlEncoderMATree* tree = JxlEncoderMATreeCreate();
+  {
+    // A tree that was never collected cannot be used.
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+    EXPECT_EQ(JXL_ENC_ERROR,
+              JxlEncoderFrameSettingsSetMATree(frame_settings, tree));
+  }
+  std::vector<uint8_t> learned = encode(0, nullptr, tree);
+  EXPECT_FALSE(tree->tree.empty());
+  // The image the tree was learned from is coded the same with it.
+  EXPECT_TRUE(SameDecodedPixels(learned, encode(0, tree, nullptr)));
+  EXPECT_TRUE(SameDecodedPixels(encode(1, nullptr, nullptr),
+                                encode(1, tree, nullptr)));
+  // A tree that only uses the gradient property and predictor, with leaf
+  // offsets (which libjxl never learns), is decoded with a lookup table.
+  tree->tree = {jxl::PropertyDecisionNode::Split(jxl::kGradientProp, 0, 1),
+                jxl::PropertyDecisionNode::Leaf(jxl::Predictor::Gradient, 3),
+                jxl::PropertyDecisionNode::Leaf(jxl::Predictor::Gradient, -2)};
+  EXPECT_TRUE(SameDecodedPixels(encode(1, nullptr, nullptr),
+                                encode(1, tree, nullptr)));
+  JxlEncoderMATreeDestroy(tree);
+}
+
+TEST(EncodeTest, AnalysisReuseTest) {
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  const auto encode = [&](size_t xsize, size_t ysize, float distance,
+                          int64_t resampling, int64_t effort,
+                          JxlEncoderAnalysis* analysis) {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    EXPECT_NE(nullptr, enc.get());
+    JxlBasicInfo basic_info;
+    jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetFrameDistance(frame_settings, distance));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_RESAMPLING,
+                  resampling));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_EFFORT, effort));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetAnalysis(frame_settings, analysis));
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      pixels.data(), pixels.size()));
+    JxlEncoderCloseInput(enc.get());
+    std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+    uint8_t* next_out = compressed.data();
+    size_t avail_out = compressed.size() - (next_out - compressed.data());
+    ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+    return compressed;
+  };
+
+  JxlEncoderAnalysis* analysis = JxlEncoderAnalysisCreate();
+  // The first encoding fills the analysis, including the linear image that
+  // only the butteraugli iterations of the slower efforts need.
+  EXPECT_EQ(encode(96, 80, 1.0f, 1, 7, nullptr),
+            encode(96, 80, 1.0f, 1, 7, analysis));
+  EXPECT_FALSE(analysis->analysis.opsin.xsize() == 0);
+  EXPECT_FALSE(analysis->analysis.linear.xsize() == 0);
+  EXPECT_TRUE(analysis->analysis.has_interleaved_alpha);
+  // The following ones give the same codestreams as without it.
+  EXPECT_EQ(encode(96, 80, 3.0f, 1, 7, nullptr),
+            encode(96, 80, 3.0f, 1, 7, analysis));
+  EXPECT_EQ(encode(96, 80, 2.0f, 2, 7, nullptr),
+            encode(96, 80, 2.0f, 2, 7, analysis));
+  EXPECT_EQ(encode(96, 80, 1.5f, 1, 8, nullptr),
+            encode(96, 80, 1.5f, 1, 8, analysis));
+  // An analysis of another size is replaced.
+  EXPECT_EQ(encode(64, 48, 1.0f, 1, 7, nullptr),
+            encode(64, 48, 1.0f, 1, 7, analysis));
+  EXPECT_EQ(64u, analysis->analysis.opsin.xsize());
+  JxlEncoderAnalysisDestroy(analysis);
+}
+
 TEST(EncodeTest, CroppedFrameTest) {
   JxlEncoderPtr enc = JxlEncoderMake(nullptr);
   EXPECT_NE(nullptr, enc.get());
@@ -1479,6 +1825,67 @@ std::string nameBoxTest(
          "_BoxSize_" + std::to_string((std::get<1>(info.param)));
 }
 
+JXL_BOXES_TEST(EncodeTest, CompressBoxesAheadTest) {
+  const size_t xsize = 40;
+  const size_t ysize = 24;
+  JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  std::vector<std::vector<uint8_t>> contents;
+  for (size_t i = 0; i < 3; ++i) {
+    contents.push_back(jxl::test::GetSomeTestImage(64, 64, 4, i + 1));
+  }
+  const auto encode = [&](JxlEncoder* enc) {
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderUseBoxes(enc));
+    JxlBasicInfo basic_info;
+    jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc, &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc, &color_encoding));
+    const char* types[3] = {"Exif", "xml ", "abcd"};
+    for (size_t i = 0; i < 3; ++i) {
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddBox(enc, types[i], contents[i].data(),
+                                 contents[i].size(), JXL_TRUE));
+    }
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc, nullptr);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      pixels.data(), pixels.size()));
+    JxlEncoderCloseInput(enc);
+    std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+    uint8_t* next_out = compressed.data();
+    size_t avail_out = compressed.size() - (next_out - compressed.data());
+    ProcessEncoder(enc, compressed, next_out, avail_out);
+    return compressed;
+  };
+
+  JxlEncoderPtr serial_enc = JxlEncoderMake(nullptr);
+  const std::vector<uint8_t> expected = encode(serial_enc.get());
+
+  // The boxes are compressed at once on the runner.
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(nullptr, 4);
+  const auto set_runner = [&]() {
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetParallelRunner(enc.get(), JxlThreadParallelRunner,
+                                          runner.get()));
+  };
+  set_runner();
+  EXPECT_EQ(expected, encode(enc.get()));
+  EXPECT_EQ(3u, enc->compressed_boxes.size());
+
+  // The same boxes are taken from the cache after a reset.
+  JxlEncoderReset(enc.get());
+  set_runner();
+  EXPECT_EQ(expected, encode(enc.get()));
+  EXPECT_EQ(3u, enc->compressed_boxes.size());
+}
+
 JXL_GTEST_INSTANTIATE_TEST_SUITE_P(
     EncodeBoxParamsTest, EncodeBoxTest,
     testing::Combine(testing::Values(false, true),
@@ -2032,6 +2439,355 @@ JXL_GTEST_INSTANTIATE_TEST_SUITE_P(
     EncoderStreamingTest, EncoderStreamingTest,
     testing::ValuesIn(StreamingTestParam::All()));
 
+TEST(EncoderTest, FastLosslessExtraChannels) {
+  size_t xsize = 257;
+  size_t ysize = 259;
+  jxl::test::TestImage image;
+  ASSERT_TRUE(image.SetDimensions(xsize, ysize));
+  image.SetDataType(JXL_TYPE_UINT16);
+  ASSERT_TRUE(image.SetChannels(3));
+  image.SetAllBitDepths(16);
+  JXL_TEST_ASSIGN_OR_DIE(auto frame0, image.AddFrame());
+  frame0.RandomFill();
+  jxl::test::TestImage ec_image;
+  ASSERT_TRUE(ec_image.SetDimensions(xsize, ysize));
+  ec_image.SetDataType(JXL_TYPE_UINT16);
+  ASSERT_TRUE(ec_image.SetChannels(1));
+  ec_image.SetAllBitDepths(16);
+  JXL_TEST_ASSIGN_OR_DIE(auto frame1, ec_image.AddFrame());
+  frame1.RandomFill(1);
+  const auto& frame = image.ppf().frames[0].color;
+  const auto& ec_frame = ec_image.ppf().frames[0].color;
+  JxlBasicInfo basic_info = image.ppf().info;
+  basic_info.num_extra_channels = 2;
+  basic_info.alpha_bits = 16;
+  basic_info.uses_original_profile = JXL_TRUE;
+
+  // The extra channels are only available when the frame is added for the
+  // chunked input, which can then use the fast lossless encoder for them.
+  std::vector<uint8_t> compressed[2];
+  for (bool chunked : {false, true}) {
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    ASSERT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+    JxlExtraChannelInfo depth_info;
+    JxlEncoderInitExtraChannelInfo(JXL_CHANNEL_DEPTH, &depth_info);
+    depth_info.bits_per_sample = 16;
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetExtraChannelInfo(enc.get(), 1, &depth_info));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings, JXL_ENC_FRAME_SETTING_EFFORT, 1));
+    if (chunked) {
+      JxlChunkedFrameInputSourceAdapter chunked_frame_adapter(frame.Copy(),
+                                                              ec_frame.Copy());
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddChunkedFrame(
+                    frame_settings, JXL_TRUE,
+                    chunked_frame_adapter.GetInputSource()));
+    } else {
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddImageFrame(frame_settings, &frame.format,
+                                        frame.pixels(), frame.pixels_size));
+      for (uint32_t ec = 0; ec < 2; ec++) {
+        EXPECT_EQ(JXL_ENC_SUCCESS,
+                  JxlEncoderSetExtraChannelBuffer(
+                      frame_settings, &ec_frame.format, ec_frame.pixels(),
+                      ec_frame.pixels_size, ec));
+      }
+      JxlEncoderCloseInput(enc.get());
+    }
+    std::vector<uint8_t>& out = compressed[chunked ? 1 : 0];
+    out.resize(64);
+    uint8_t* next_out = out.data();
+    size_t avail_out = out.size();
+    ProcessEncoder(enc.get(), out, next_out, avail_out);
+  }
+  EXPECT_TRUE(SameDecodedPixels(compressed[0], compressed[1]));
+}
+
+TEST(EncoderTest, FastLosslessGroupAnalysis) {
+  // A single group, whose tree is the global one, and several groups with a
+  // tree each.
+  for (size_t xsize : {200, 600}) {
+    size_t ysize = 300;
+    jxl::test::TestImage image;
+    ASSERT_TRUE(image.SetDimensions(xsize, ysize));
+    image.SetDataType(JXL_TYPE_UINT16);
+    ASSERT_TRUE(image.SetChannels(4));
+    image.SetAllBitDepths(12);
+    JXL_TEST_ASSIGN_OR_DIE(auto frame0, image.AddFrame());
+    frame0.RandomFill();
+    const auto& frame = image.ppf().frames[0].color;
+    JxlBasicInfo basic_info = image.ppf().info;
+    basic_info.uses_original_profile = JXL_TRUE;
+
+    // Effort 1 samples the image for global prefix codes, effort 2 analyzes
+    // each group.
+    std::vector<uint8_t> compressed[2];
+    for (int effort : {1, 2}) {
+      JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+      ASSERT_NE(nullptr, enc.get());
+      JxlEncoderFrameSettings* frame_settings =
+          JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+      JxlColorEncoding color_encoding;
+      JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE));
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderFrameSettingsSetOption(
+                    frame_settings, JXL_ENC_FRAME_SETTING_EFFORT, effort));
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddImageFrame(frame_settings, &frame.format,
+                                        frame.pixels(), frame.pixels_size));
+      JxlEncoderCloseInput(enc.get());
+      std::vector<uint8_t>& out = compressed[effort - 1];
+      out.resize(64);
+      uint8_t* next_out = out.data();
+      size_t avail_out = out.size();
+      ProcessEncoder(enc.get(), out, next_out, avail_out);
+    }
+    EXPECT_TRUE(SameDecodedPixels(compressed[0], compressed[1]));
+  }
+}
+
+TEST(EncoderTest, SpillToDisk) {
+  size_t xsize = 257;
+  size_t ysize = 259;
+  jxl::test::TestImage image;
+  ASSERT_TRUE(image.SetDimensions(xsize, ysize));
+  image.SetDataType(JXL_TYPE_UINT8);
+  ASSERT_TRUE(image.SetChannels(3));
+  image.SetAllBitDepths(8);
+  JXL_TEST_ASSIGN_OR_DIE(auto frame0, image.AddFrame());
+  frame0.RandomFill();
+  const auto& frame = image.ppf().frames[0].color;
+  JxlBasicInfo basic_info = image.ppf().info;
+
+  // Neither an output processor that cannot seek nor JxlEncoderProcessOutput
+  // can write the groups before the box header and the TOC, so these are held
+  // back in both cases. Spilling them must not change the output.
+  for (bool use_output_processor : {false, true}) {
+    std::vector<uint8_t> compressed[2];
+    for (int spill : {0, 1}) {
+      JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+      ASSERT_NE(nullptr, enc.get());
+      JxlEncoderFrameSettings* frame_settings =
+          JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+      JxlColorEncoding color_encoding;
+      JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+      EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderUseContainer(enc.get(), JXL_TRUE));
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderFrameSettingsSetOption(
+                    frame_settings, JXL_ENC_FRAME_SETTING_BUFFERING, 3));
+      EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderFrameSettingsSetOption(
+                                     frame_settings,
+                                     JXL_ENC_FRAME_SETTING_SPILL_TO_DISK,
+                                     spill));
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddImageFrame(frame_settings, &frame.format,
+                                        frame.pixels(), frame.pixels_size));
+      JxlEncoderCloseInput(enc.get());
+      if (use_output_processor) {
+        JxlStreamingAdapter streaming_adapter(enc.get(),
+                                              /*return_large_buffers=*/true,
+                                              /*can_seek=*/false);
+        EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderFlushInput(enc.get()));
+        streaming_adapter.CheckFinalWatermarkPosition();
+        compressed[spill] = std::move(streaming_adapter).output();
+      } else {
+        compressed[spill].resize(64);
+        uint8_t* next_out = compressed[spill].data();
+        size_t avail_out = compressed[spill].size();
+        ProcessEncoder(enc.get(), compressed[spill], next_out, avail_out);
+      }
+    }
+    EXPECT_EQ(compressed[0], compressed[1]);
+  }
+}
+
+TEST(EncoderTest, ReusePreviousHeuristics) {
+  size_t xsize = 256;
+  size_t ysize = 256;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  // The last frame only differs in a corner.
+  std::vector<uint8_t> changed_pixels = pixels;
+  for (size_t y = 0; y < 16; ++y) {
+    for (size_t i = 0; i < 16 * 3 * 2; ++i) {
+      changed_pixels[y * xsize * 3 * 2 + i] ^= 0x80;
+    }
+  }
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = JXL_FALSE;
+  basic_info.have_animation = JXL_TRUE;
+  basic_info.animation.tps_numerator = 10;
+  basic_info.animation.tps_denominator = 1;
+
+  std::vector<uint8_t> compressed[2];
+  for (int reuse : {0, 1}) {
+    SCOPED_TRACE(testing::Message() << "reuse: " << reuse);
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    ASSERT_NE(nullptr, enc.get());
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings,
+                  JXL_ENC_FRAME_SETTING_REUSE_PREVIOUS_HEURISTICS, reuse));
+    JxlFrameHeader header;
+    JxlEncoderInitFrameHeader(&header);
+    header.duration = 1;
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetFrameHeader(frame_settings, &header));
+    for (const std::vector<uint8_t>* frame :
+         {&pixels, &pixels, &changed_pixels}) {
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                        frame->data(), frame->size()));
+    }
+    JxlEncoderCloseInput(enc.get());
+    compressed[reuse].resize(64);
+    uint8_t* next_out = compressed[reuse].data();
+    size_t avail_out = compressed[reuse].size();
+    ProcessEncoder(enc.get(), compressed[reuse], next_out, avail_out);
+    EXPECT_EQ(reuse == 1, !enc->heuristics_history.ac_context_maps.empty());
+    JxlEncoderReset(enc.get());
+    EXPECT_TRUE(enc->heuristics_history.ac_context_maps.empty());
+
+    jxl::extras::JXLDecompressParams dparams;
+    jxl::test::DefaultAcceptedFormats(dparams);
+    jxl::extras::PackedPixelFile ppf;
+    ASSERT_TRUE(DecodeImageJXL(compressed[reuse].data(),
+                               compressed[reuse].size(), dparams, nullptr,
+                               &ppf, nullptr));
+    EXPECT_EQ(3u, ppf.frames.size());
+  }
+  // Reusing the heuristics trades a little density for speed.
+  EXPECT_LE(compressed[1].size(), compressed[0].size() * 11 / 10);
+}
+
+TEST(EncoderTest, AutoCrop) {
+  size_t xsize = 64;
+  size_t ysize = 48;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  const size_t row_size = xsize * 3 * 2;
+  std::vector<std::vector<uint8_t>> frames(3);
+  frames[0] = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  // Pixels x in [10, 20) of rows [5, 9) change, then nothing does.
+  frames[1] = frames[0];
+  for (size_t y = 5; y < 9; ++y) {
+    for (size_t i = 10 * 6; i < 20 * 6; ++i) frames[1][y * row_size + i] ^= 1;
+  }
+  frames[2] = frames[1];
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = JXL_TRUE;
+  basic_info.have_animation = JXL_TRUE;
+  basic_info.animation.tps_numerator = 10;
+  basic_info.animation.tps_denominator = 1;
+
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  ASSERT_NE(nullptr, enc.get());
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderFrameSettingsSetOption(
+                frame_settings, JXL_ENC_FRAME_SETTING_AUTO_CROP, 1));
+  JxlFrameHeader header;
+  JxlEncoderInitFrameHeader(&header);
+  header.duration = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameHeader(frame_settings, &header));
+  for (const std::vector<uint8_t>& frame : frames) {
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      frame.data(), frame.size()));
+  }
+  JxlEncoderCloseInput(enc.get());
+  std::vector<uint8_t> compressed(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size();
+  ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+
+  // The frames as encoded, before blending.
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  ASSERT_NE(nullptr, dec.get());
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCoalescing(dec.get(), JXL_FALSE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FRAME));
+  JxlDecoderSetInput(dec.get(), compressed.data(), compressed.size());
+  JxlDecoderCloseInput(dec.get());
+  std::vector<JxlLayerInfo> layers;
+  for (JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+       status != JXL_DEC_SUCCESS;
+       status = JxlDecoderProcessInput(dec.get())) {
+    ASSERT_EQ(JXL_DEC_FRAME, status);
+    JxlFrameHeader frame_header;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetFrameHeader(dec.get(), &frame_header));
+    layers.push_back(frame_header.layer_info);
+  }
+  ASSERT_EQ(3u, layers.size());
+  EXPECT_FALSE(layers[0].have_crop);
+  EXPECT_TRUE(layers[1].have_crop);
+  EXPECT_EQ(10, layers[1].crop_x0);
+  EXPECT_EQ(5, layers[1].crop_y0);
+  EXPECT_EQ(10u, layers[1].xsize);
+  EXPECT_EQ(4u, layers[1].ysize);
+  EXPECT_EQ(1u, layers[1].blend_info.source);
+  EXPECT_TRUE(layers[2].have_crop);
+  EXPECT_EQ(1u, layers[2].xsize);
+  EXPECT_EQ(1u, layers[2].ysize);
+
+  // The displayed frames are the input ones.
+  jxl::extras::JXLDecompressParams dparams;
+  dparams.accepted_formats = {pixel_format};
+  jxl::extras::PackedPixelFile ppf;
+  ASSERT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(), dparams,
+                             nullptr, &ppf, nullptr));
+  ASSERT_EQ(frames.size(), ppf.frames.size());
+  for (size_t i = 0; i < frames.size(); ++i) {
+    SCOPED_TRACE(testing::Message() << "frame: " << i);
+    const jxl::extras::PackedImage& color = ppf.frames[i].color;
+    ASSERT_EQ(frames[i].size(), color.pixels_size);
+    EXPECT_EQ(0, memcmp(frames[i].data(), color.pixels(), frames[i].size()));
+  }
+}
+
 TEST(EncoderTest, CMYK) {
   size_t xsize = 257;
   size_t ysize = 259;
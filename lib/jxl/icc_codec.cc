@@ -7,8 +7,12 @@
 
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 
+#include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/fields.h"
@@ -27,21 +31,58 @@ namespace {
 // scanline order but with missing elements skipped (which may occur in multiple
 // locations), the output is the result matrix in scanline order (with
 // no need to skip missing elements as they are past the end of the data).
-void Shuffle(JxlMemoryManager* memory_manager, uint8_t* data, size_t size,
-             size_t width) {
+// The output must not overlap the input.
+void Shuffle(const uint8_t* in, size_t size, size_t width, uint8_t* out) {
   size_t height = (size + width - 1) / width;  // amount of rows of output
-  PaddedBytes result(memory_manager, size);
   // i = output index, j input index
   size_t s = 0;
   size_t j = 0;
   for (size_t i = 0; i < size; i++) {
-    result[i] = data[j];
+    out[i] = in[j];
     j += height;
     if (j >= size) j = ++s;
   }
+}
 
-  for (size_t i = 0; i < size; i++) {
-    data[i] = result[i];
+template <size_t kWidth>
+uint32_t LoadPredictedValue(const uint8_t* p) {
+  if (kWidth == 1) return p[0];
+  if (kWidth == 2) return LoadBE16(p);
+  return LoadBE32(p);
+}
+
+// Adds the prediction of LinearPredictICCValue to the residuals in
+// data[start, start + num), in place. The prediction is computed once per
+// integer of kWidth bytes; it only depends on bytes before the integer since
+// the stride is at least kWidth. The arithmetic wraps around the same way as
+// in the kWidth-byte integers, for their low bytes.
+template <size_t kWidth, int kOrder>
+void AddLinearPrediction(uint8_t* data, size_t start, size_t num,
+                         size_t stride) {
+  for (size_t i = 0; i < num; i += kWidth) {
+    uint8_t* p = data + start + i;
+    const uint32_t p1 = LoadPredictedValue<kWidth>(p - stride);
+    const uint32_t p2 = LoadPredictedValue<kWidth>(p - stride * 2);
+    const uint32_t p3 = LoadPredictedValue<kWidth>(p - stride * 3);
+    uint32_t pred = p1;
+    if (kOrder == 1) pred = 2 * p1 - p2;
+    if (kOrder == 2) pred = 3 * p1 - 3 * p2 + p3;
+    const size_t n = std::min(kWidth, num - i);
+    for (size_t k = 0; k < n; ++k) {
+      p[k] += static_cast<uint8_t>(pred >> (8 * (kWidth - 1 - k)));
+    }
+  }
+}
+
+template <size_t kWidth>
+void AddLinearPrediction(uint8_t* data, size_t start, size_t num,
+                         size_t stride, int order) {
+  if (order == 0) {
+    AddLinearPrediction<kWidth, 0>(data, start, num, stride);
+  } else if (order == 1) {
+    AddLinearPrediction<kWidth, 1>(data, start, num, stride);
+  } else {
+    AddLinearPrediction<kWidth, 2>(data, start, num, stride);
   }
 }
 
@@ -217,26 +258,18 @@ Status UnpredictICC(const uint8_t* enc, size_t size, PaddedBytes* result) {
       if (cpos >= commands_end) return JXL_FAILURE("Out of bounds");
       uint64_t num = DecodeVarInt(enc, size, &cpos);
       JXL_RETURN_IF_ERROR(CheckOutOfBounds(pos, num, size));
-      for (size_t i = 0; i < num; i++) {
-        result->push_back(enc[pos++]);
-      }
+      result->append(enc + pos, enc + pos + num);
+      pos += num;
     } else if (command == kCommandShuffle2 || command == kCommandShuffle4) {
       if (cpos >= commands_end) return JXL_FAILURE("Out of bounds");
       uint64_t num = DecodeVarInt(enc, size, &cpos);
       JXL_RETURN_IF_ERROR(CheckOutOfBounds(pos, num, size));
-      PaddedBytes shuffled(memory_manager, num);
-      for (size_t i = 0; i < num; i++) {
-        shuffled[i] = enc[pos + i];
-      }
-      if (command == kCommandShuffle2) {
-        Shuffle(memory_manager, shuffled.data(), num, 2);
-      } else if (command == kCommandShuffle4) {
-        Shuffle(memory_manager, shuffled.data(), num, 4);
-      }
-      for (size_t i = 0; i < num; i++) {
-        result->push_back(shuffled[i]);
-        pos++;
-      }
+      size_t start = result->size();
+      result->resize(start + num);
+      if (result->size() != start + num) return JXL_FAILURE("Out of memory");
+      Shuffle(enc + pos, num, command == kCommandShuffle2 ? 2 : 4,
+              result->data() + start);
+      pos += num;
     } else if (command == kCommandPredict) {
       JXL_RETURN_IF_ERROR(CheckOutOfBounds(cpos, 2, commands_end));
       uint8_t flags = enc[cpos++];
@@ -268,17 +301,22 @@ Status UnpredictICC(const uint8_t* enc, size_t size, PaddedBytes* result) {
       uint64_t num = DecodeVarInt(enc, size, &cpos);  // in bytes
       JXL_RETURN_IF_ERROR(CheckOutOfBounds(pos, num, size));
 
-      PaddedBytes shuffled(memory_manager, num);
-      for (size_t i = 0; i < num; i++) {
-        shuffled[i] = enc[pos + i];
-      }
-      if (width > 1) Shuffle(memory_manager, shuffled.data(), num, width);
-
+      // The residuals are shuffled into place, then the prediction is added.
       size_t start = result->size();
-      for (size_t i = 0; i < num; i++) {
-        uint8_t predicted = LinearPredictICCValue(result->data(), start, i,
-                                                  stride, width, order);
-        result->push_back(predicted + shuffled[i]);
+      result->resize(start + num);
+      if (result->size() != start + num) return JXL_FAILURE("Out of memory");
+      uint8_t* out = result->data();
+      if (width > 1) {
+        Shuffle(enc + pos, num, width, out + start);
+      } else {
+        memcpy(out + start, enc + pos, num);
+      }
+      if (width == 1) {
+        AddLinearPrediction<1>(out, start, num, stride, order);
+      } else if (width == 2) {
+        AddLinearPrediction<2>(out, start, num, stride, order);
+      } else {
+        AddLinearPrediction<4>(out, start, num, stride, order);
       }
       pos += num;
     } else if (command == kCommandXYZ) {
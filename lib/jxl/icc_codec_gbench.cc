@@ -0,0 +1,89 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/memory_manager.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/span.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/enc_aux_out.h"
+#include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/enc_icc_codec.h"
+#include "lib/jxl/icc_codec.h"
+#include "lib/jxl/padded_bytes.h"
+#include "tools/no_memory_manager.h"
+
+namespace jxl {
+namespace {
+
+#define QUIT(M)           \
+  state.SkipWithError(M); \
+  return;
+
+#define BM_CHECK(C) \
+  if (!(C)) {       \
+    QUIT(#C)        \
+  }
+
+// The sRGB profile followed by `extra` bytes of 16-bit ramps, like the lookup
+// tables of large camera or printer profiles.
+IccBytes LargeProfile(size_t extra) {
+  IccBytes icc = ColorEncoding::SRGB().ICC();
+  for (size_t i = 0; i < extra / 2; ++i) {
+    const uint32_t value = (i * 37) & 0xFFFF;
+    icc.push_back(value >> 8);
+    icc.push_back(value & 0xFF);
+  }
+  StoreBE32(icc.size(), icc.data());
+  return icc;
+}
+
+void BM_IccEncode(benchmark::State& state) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  const IccBytes icc = LargeProfile(state.range());
+  for (auto _ : state) {
+    (void)_;
+    // All but the first iteration use the cache of encoded profiles.
+    BitWriter writer{memory_manager};
+    BM_CHECK(WriteICC(Bytes(icc), &writer, LayerType::Header, nullptr));
+  }
+  state.SetBytesProcessed(icc.size() * state.iterations());
+}
+
+void BM_IccDecode(benchmark::State& state) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  const IccBytes icc = LargeProfile(state.range());
+  BitWriter writer{memory_manager};
+  BM_CHECK(WriteICC(Bytes(icc), &writer, LayerType::Header, nullptr));
+  {
+    BitWriter::Allotment allotment(&writer, kBitsPerByte);
+    writer.ZeroPadToByte();
+    BM_CHECK(allotment.ReclaimAndCharge(&writer, LayerType::Header, nullptr));
+  }
+  for (auto _ : state) {
+    (void)_;
+    BitReader reader(writer.GetSpan());
+    ICCReader icc_reader{memory_manager};
+    PaddedBytes decoded{memory_manager};
+    bool ok = icc_reader.Init(&reader, /*output_limit=*/0) &&
+              icc_reader.Process(&reader, &decoded);
+    BM_CHECK(reader.Close());
+    BM_CHECK(ok && decoded.size() == icc.size());
+  }
+  state.SetBytesProcessed(icc.size() * state.iterations());
+}
+
+BENCHMARK(BM_IccEncode)->Range(1 << 10, 1 << 21);
+BENCHMARK(BM_IccDecode)->Range(1 << 10, 1 << 21);
+
+}  // namespace
+}  // namespace jxl
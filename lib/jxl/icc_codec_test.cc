@@ -160,6 +160,40 @@ TEST(IccCodecTest, Icc) {
   }
 }
 
+// The second encoding of a profile is taken from the cache of encoded
+// profiles, also when it does not start at a byte boundary.
+TEST(IccCodecTest, CachedIcc) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  IccBytes profile;
+  Bytes(kTestProfile, sizeof(kTestProfile)).AppendTo(profile);
+  std::vector<std::vector<uint8_t>> encoded;
+  for (size_t i = 0; i < 2; ++i) {
+    BitWriter writer{memory_manager};
+    {
+      BitWriter::Allotment allotment(&writer, 3);
+      writer.Write(3, 5);
+      ASSERT_TRUE(
+          allotment.ReclaimAndCharge(&writer, LayerType::Header, nullptr));
+    }
+    ASSERT_TRUE(WriteICC(Span<const uint8_t>(profile), &writer,
+                         LayerType::Header, nullptr));
+    {
+      BitWriter::Allotment allotment(&writer, kBitsPerByte);
+      writer.ZeroPadToByte();
+      ASSERT_TRUE(
+          allotment.ReclaimAndCharge(&writer, LayerType::Header, nullptr));
+    }
+    BitReader reader(writer.GetSpan());
+    EXPECT_EQ(5, reader.ReadFixedBits<3>());
+    std::vector<uint8_t> dec;
+    ASSERT_TRUE(test::ReadICC(&reader, &dec));
+    ASSERT_TRUE(reader.Close());
+    EXPECT_EQ(profile, dec);
+    encoded.push_back(writer.GetSpan().Copy());
+  }
+  EXPECT_EQ(encoded[0], encoded[1]);
+}
+
 // kTestProfile after encoding with the ICC codec
 static const unsigned char kEncodedTestProfile[] = {
     0x1f, 0x8b, 0x1,  0x13, 0x10, 0x0,  0x0,  0x0,  0x20, 0x4c, 0xcc, 0x3,
@@ -70,6 +70,12 @@ struct PlaneBase {
     return true;
   }
 
+  // Whether ShrinkTo(xsize, ysize) is allowed, i.e. the storage is large
+  // enough for an image of that size.
+  bool CanShrinkTo(const size_t xsize, const size_t ysize) const {
+    return xsize <= orig_xsize_ && ysize <= orig_ysize_;
+  }
+
   // How many pixels.
   JXL_INLINE size_t xsize() const { return xsize_; }
   JXL_INLINE size_t ysize() const { return ysize_; }
@@ -290,6 +296,10 @@ class Image3 {
     return true;
   }
 
+  bool CanShrinkTo(const size_t xsize, const size_t ysize) const {
+    return planes_[0].CanShrinkTo(xsize, ysize);
+  }
+
   // Sizes of all three images are guaranteed to be equal.
   JXL_INLINE JxlMemoryManager* memory_manager() const {
     return planes_[0].memory_manager();
@@ -326,6 +336,19 @@ using Image3I = Image3<int32_t>;
 using Image3F = Image3<float>;
 using Image3D = Image3<double>;
 
+// Sets *image to an image of the given size, reusing its storage if it is
+// large enough. As with Create, the contents are uninitialized.
+template <typename ImageT>
+Status ReuseOrCreate(JxlMemoryManager* memory_manager, const size_t xsize,
+                     const size_t ysize, ImageT* image) {
+  if (image->memory_manager() == memory_manager &&
+      image->CanShrinkTo(xsize, ysize)) {
+    return image->ShrinkTo(xsize, ysize);
+  }
+  JXL_ASSIGN_OR_RETURN(*image, ImageT::Create(memory_manager, xsize, ysize));
+  return true;
+}
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_IMAGE_H_
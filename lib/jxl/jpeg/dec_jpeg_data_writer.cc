@@ -779,7 +779,6 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
   // DC-only is defined by [0..0] spectral range.
   const bool want_ac = ((Ss != 0) || (Se != 0));
   const bool want_dc = (Ss == 0);
-  // TODO(user): support streaming decoding again.
   const bool complete_ac = true;
   const bool has_ac = true;
   if (want_ac && !has_ac) return SerializationStatus::NEEDS_MORE_INPUT;
@@ -797,7 +796,10 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
   //     complete ? MCU_rows : parsing_state.internal->ac_dc.next_mcu_y *
   //     v_group;
   (void)complete;
-  const int last_mcu_y = complete ? MCU_rows : 0;
+  const int last_mcu_y =
+      state->available_mcu_rows < 0
+          ? MCU_rows
+          : std::min(MCU_rows, state->available_mcu_rows);
 
   for (; ss.mcu_y < last_mcu_y; ++ss.mcu_y) {
     for (int mcu_x = 0; mcu_x < MCUs_per_row; ++mcu_x) {
@@ -834,7 +836,10 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
           for (int ix = 0; ix < n_blocks_x; ++ix) {
             int block_y = ss.mcu_y * n_blocks_y + iy;
             int block_x = mcu_x * n_blocks_x + ix;
-            int block_idx = block_y * c.width_in_blocks + block_x;
+            int block_idx =
+                (block_y - static_cast<int>(c.first_block_row)) *
+                    c.width_in_blocks +
+                block_x;
             if (ss.block_scan_index == ss.next_reset_point) {
               Flush(coding_state, bw);
               ss.next_reset_point = get_next_reset_point();
@@ -973,18 +978,23 @@ SerializationStatus SerializeSection(uint8_t marker, SerializationState* state,
   }
 }
 
-// TODO(veluca): add streaming support again.
+// When streaming (ss->available_mcu_rows >= 0), returns true once the
+// available MCU rows are serialized, and keeps in the output queue what |out|
+// does not accept.
 Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
                          SerializationState* ss) {
+  const bool streaming = ss->available_mcu_rows >= 0;
   const auto maybe_push_output = [&]() -> Status {
     if (ss->stage != SerializationState::STAGE_ERROR) {
       while (!ss->output_queue.empty()) {
         auto& chunk = ss->output_queue.front();
         size_t num_written = out(chunk.next, chunk.len);
         if (num_written == 0 && chunk.len > 0) {
+          if (streaming) return true;
           return StatusMessage(Status(StatusCode::kNotEnoughBytes),
                                "Failed to write output");
         }
+        chunk.next += num_written;
         chunk.len -= num_written;
         if (chunk.len == 0) {
           ss->output_queue.pop_front();
@@ -1031,6 +1041,7 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
         }
         JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
         if (status == SerializationStatus::NEEDS_MORE_INPUT) {
+          if (streaming) return true;
           return JXL_FAILURE("Incomplete serialization data");
         } else if (status != SerializationStatus::DONE) {
           ss->stage = SerializationState::STAGE_ERROR;
@@ -1042,7 +1053,7 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
       }
 
       case SerializationState::STAGE_DONE:
-        JXL_ENSURE(ss->output_queue.empty());
+        JXL_ENSURE(streaming || ss->output_queue.empty());
         if (ss->pad_bits != nullptr && ss->pad_bits != ss->pad_bits_end) {
           return JXL_FAILURE("Invalid number of padding bits.");
         }
@@ -1061,5 +1072,52 @@ Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out) {
   return WriteJpegInternal(jpg, out, ss.get());
 }
 
+bool JpegStreamWriter::CanStream(const JPEGData& jpg) {
+  if (jpg.scan_info.size() != 1) return false;
+  if (jpg.scan_info[0].num_components != jpg.components.size()) return false;
+  size_t num_sof = 0;
+  for (uint8_t marker : jpg.marker_order) {
+    if (marker == 0xC2 || marker == 0xCA) return false;
+    if (marker == 0xC0 || marker == 0xC1 || marker == 0xC9) ++num_sof;
+  }
+  return num_sof == 1;
+}
+
+void JpegStreamWriter::Start(JPEGOutput out) {
+  out_ = std::move(out);
+  ss_ = jxl::make_unique<SerializationState>();
+  ss_->available_mcu_rows = 0;
+}
+
+Status JpegStreamWriter::WriteMcuRows(const JPEGData& jpg,
+                                      size_t num_mcu_rows) {
+  JXL_ENSURE(ss_ != nullptr);
+  JXL_ENSURE(static_cast<int>(num_mcu_rows) >= ss_->available_mcu_rows);
+  ss_->available_mcu_rows = static_cast<int>(num_mcu_rows);
+  return WriteJpegInternal(jpg, out_, ss_.get());
+}
+
+Status JpegStreamWriter::Flush() {
+  JXL_ENSURE(ss_ != nullptr);
+  while (!ss_->output_queue.empty()) {
+    auto& chunk = ss_->output_queue.front();
+    size_t num_written = out_(chunk.next, chunk.len);
+    if (num_written == 0 && chunk.len > 0) break;
+    chunk.next += num_written;
+    chunk.len -= num_written;
+    if (chunk.len == 0) ss_->output_queue.pop_front();
+  }
+  return true;
+}
+
+bool JpegStreamWriter::HasPendingOutput() const {
+  return ss_ != nullptr && !ss_->output_queue.empty();
+}
+
+bool JpegStreamWriter::IsDone() const {
+  return ss_ != nullptr && ss_->stage == SerializationState::STAGE_DONE &&
+         ss_->output_queue.empty();
+}
+
 }  // namespace jpeg
 }  // namespace jxl
@@ -12,7 +12,9 @@
 #include <stdint.h>
 
 #include <functional>
+#include <memory>
 
+#include "lib/jxl/base/status.h"
 #include "lib/jxl/jpeg/dec_jpeg_serialization_state.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 
@@ -25,6 +27,36 @@ using JPEGOutput = std::function<size_t(const uint8_t* buf, size_t len)>;
 
 Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out);
 
+// Writes a JPEG whose coefficients become available incrementally, a few MCU
+// rows at a time, e.g. while the JPEG XL frame is being decoded. Only JPEGs
+// with a single sequential scan containing all the components can be written
+// this way. The coefficients of each component may be a window of block rows
+// starting at JPEGComponent::first_block_row.
+class JpegStreamWriter {
+ public:
+  static bool CanStream(const JPEGData& jpg);
+
+  // Starts a new JPEG; the bytes not accepted by |out| are kept until the
+  // next call to WriteMcuRows or Flush.
+  void Start(JPEGOutput out);
+
+  // Serializes the JPEG up to the first |num_mcu_rows| MCU rows of the scan,
+  // or up to the end if all the MCU rows are available.
+  Status WriteMcuRows(const JPEGData& jpg, size_t num_mcu_rows);
+
+  // Writes pending bytes to the output until it stops accepting them.
+  Status Flush();
+
+  bool HasPendingOutput() const;
+
+  // Returns whether the whole JPEG was serialized and written to the output.
+  bool IsDone() const;
+
+ private:
+  JPEGOutput out_;
+  std::unique_ptr<SerializationState> ss_;
+};
+
 }  // namespace jpeg
 }  // namespace jxl
 
@@ -91,6 +91,9 @@ struct SerializationState {
   const uint8_t* pad_bits_end = nullptr;
   bool seen_dri_marker = false;
   bool is_progressive = false;
+  // Number of MCU rows of the scan whose coefficients are available, or -1 if
+  // all of them are (i.e. the output is not streamed).
+  int available_mcu_rows = -1;
 
   EncodeScanState scan_state;
 };
@@ -386,7 +386,25 @@ Status EncodeJPEGData(JxlMemoryManager* memory_manager, JPEGData& jpeg_data,
   return true;
 }
 
-Status DecodeImageJPG(const Span<const uint8_t> bytes, CodecInOut* io) {
+Status ReadJPEGForTranscoding(const Span<const uint8_t> bytes,
+                              JPEGData* jpeg_data, Blobs* blobs,
+                              ThreadPool* pool) {
+  if (!IsJPG(bytes)) return false;
+  if (!jpeg::ReadJpeg(bytes.data(), bytes.size(), jpeg::JpegReadMode::kReadAll,
+                      jpeg_data, pool)) {
+    return JXL_FAILURE("Error reading JPEG");
+  }
+  JXL_RETURN_IF_ERROR(SetBlobsFromJpegData(*jpeg_data, blobs));
+  YCbCrChromaSubsampling cs;
+  JXL_RETURN_IF_ERROR(SetChromaSubsamplingFromJpegData(*jpeg_data, &cs));
+  ColorTransform color_transform;
+  JXL_RETURN_IF_ERROR(
+      SetColorTransformFromJpegData(*jpeg_data, &color_transform));
+  return true;
+}
+
+Status DecodeImageJPG(const Span<const uint8_t> bytes, CodecInOut* io,
+                      ThreadPool* pool) {
   if (!IsJPG(bytes)) return false;
   JxlMemoryManager* memory_manager = io->memory_manager;
   io->frames.clear();
@@ -394,12 +412,9 @@ Status DecodeImageJPG(const Span<const uint8_t> bytes, CodecInOut* io) {
   io->frames.emplace_back(memory_manager, &io->metadata.m);
   io->Main().jpeg_data = make_unique<jpeg::JPEGData>();
   jpeg::JPEGData* jpeg_data = io->Main().jpeg_data.get();
-  if (!jpeg::ReadJpeg(bytes.data(), bytes.size(), jpeg::JpegReadMode::kReadAll,
-                      jpeg_data)) {
-    return JXL_FAILURE("Error reading JPEG");
-  }
+  JXL_RETURN_IF_ERROR(
+      ReadJPEGForTranscoding(bytes, jpeg_data, &io->blobs, pool));
   SetColorEncodingFromJpegData(*jpeg_data, &io->metadata.m.color_encoding);
-  JXL_RETURN_IF_ERROR(SetBlobsFromJpegData(*jpeg_data, &io->blobs));
   JXL_RETURN_IF_ERROR(SetChromaSubsamplingFromJpegData(
       *jpeg_data, &io->Main().chroma_subsampling));
   JXL_RETURN_IF_ERROR(
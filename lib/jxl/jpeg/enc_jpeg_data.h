@@ -11,6 +11,7 @@
 #include <cstdint>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/color_encoding_internal.h"
@@ -21,6 +22,7 @@
 namespace jxl {
 
 class CodecInOut;
+struct Blobs;
 
 namespace jpeg {
 Status EncodeJPEGData(JxlMemoryManager* memory_manager, JPEGData& jpeg_data,
@@ -34,11 +36,21 @@ Status SetChromaSubsamplingFromJpegData(const JPEGData& jpg,
 Status SetColorTransformFromJpegData(const JPEGData& jpg,
                                      ColorTransform* color_transform);
 
+/**
+ * Parses bytes containing JPEG codestream into `jpeg_data` and its metadata
+ * into `blobs`, and checks that it can be transcoded losslessly, without
+ * allocating an image for the pixels.
+ */
+Status ReadJPEGForTranscoding(Span<const uint8_t> bytes, JPEGData* jpeg_data,
+                              Blobs* blobs, ThreadPool* pool = nullptr);
+
 /**
  * Decodes bytes containing JPEG codestream into a CodecInOut as coefficients
- * only, for lossless JPEG transcoding.
+ * only, for lossless JPEG transcoding. The entropy-coded data is decoded in
+ * parallel on `pool` where the restart markers allow it.
  */
-Status DecodeImageJPG(Span<const uint8_t> bytes, CodecInOut* io);
+Status DecodeImageJPG(Span<const uint8_t> bytes, CodecInOut* io,
+                      ThreadPool* pool = nullptr);
 
 }  // namespace jpeg
 }  // namespace jxl
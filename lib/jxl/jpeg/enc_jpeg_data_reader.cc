@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/frame_dimensions.h"
@@ -436,15 +437,20 @@ struct BitReaderState {
   // Returns false if there is inconsistent or invalid padding or the stream
   // ended too early.
   bool FinishStream(JPEGData* jpg, size_t* pos) {
+    return FinishStream(&jpg->has_zero_padding_bit, &jpg->padding_bits, pos);
+  }
+
+  bool FinishStream(bool* has_zero_padding_bit,
+                    std::vector<uint8_t>* padding_bits, size_t* pos) {
     int npadbits = bits_left_ & 7;
     if (npadbits > 0) {
       uint64_t padmask = (1ULL << npadbits) - 1;
       uint64_t padbits = (val_ >> (bits_left_ - npadbits)) & padmask;
       if (padbits != padmask) {
-        jpg->has_zero_padding_bit = true;
+        *has_zero_padding_bit = true;
       }
       for (int i = npadbits - 1; i >= 0; --i) {
-        jpg->padding_bits.push_back((padbits >> i) & 1);
+        padding_bits->push_back((padbits >> i) & 1);
       }
     }
     // Give back some bytes that we did not use.
@@ -744,11 +750,45 @@ bool ProcessRestart(const uint8_t* data, const size_t len,
   return true;
 }
 
+// Returns the positions of the restart markers that end each of the first
+// num_intervals - 1 restart intervals of the scan starting at pos, or an empty
+// vector if the scan does not have the expected sequence of restart markers.
+std::vector<size_t> FindRestartMarkers(const uint8_t* data, const size_t len,
+                                       size_t pos, size_t num_intervals) {
+  std::vector<size_t> markers;
+  while (markers.size() + 1 < num_intervals) {
+    const void* next = memchr(data + pos, 0xff, len - pos);
+    if (next == nullptr) break;
+    pos = static_cast<const uint8_t*>(next) - data;
+    if (pos + 1 >= len) break;
+    if (data[pos + 1] == 0) {
+      pos += 2;
+      continue;
+    }
+    if (data[pos + 1] != 0xd0 + static_cast<int>(markers.size() & 0x7)) break;
+    markers.push_back(pos);
+    pos += 2;
+  }
+  if (markers.size() + 1 < num_intervals) markers.clear();
+  return markers;
+}
+
+// Extra information about one restart interval decoded on its own, to be
+// appended to the JPEGData in the order of the intervals.
+struct RestartIntervalInfo {
+  bool has_zero_padding_bit = false;
+  std::vector<uint8_t> padding_bits;
+  std::vector<uint32_t> reset_points;
+  std::vector<JPEGScanInfo::ExtraZeroRunInfo> extra_zero_runs;
+  size_t end_pos = 0;
+};
+
 bool ProcessScan(const uint8_t* data, const size_t len,
                  const std::vector<HuffmanTableEntry>& dc_huff_lut,
                  const std::vector<HuffmanTableEntry>& ac_huff_lut,
                  uint16_t scan_progression[kMaxComponents][kDCTBlockSize],
-                 bool is_progressive, size_t* pos, JPEGData* jpg) {
+                 bool is_progressive, ThreadPool* pool, size_t* pos,
+                 JPEGData* jpg) {
   if (!ProcessSOS(data, len, pos, jpg)) {
     return false;
   }
@@ -773,7 +813,6 @@ bool ProcessScan(const uint8_t* data, const size_t len,
   int restarts_to_go = jpg->restart_interval;
   int next_restart_marker = 0;
   int eobrun = -1;
-  int block_scan_index = 0;
   const int Al = is_progressive ? scan_info->Al : 0;
   const int Ah = is_progressive ? scan_info->Ah : 0;
   const int Ss = is_progressive ? scan_info->Ss : 0;
@@ -800,13 +839,129 @@ bool ProcessScan(const uint8_t* data, const size_t len,
   if (Al > 10) {
     return JXL_FAILURE("Scan parameter Al=%d is not supported.", Al);
   }
-  for (int mcu_y = 0; mcu_y < MCU_rows; ++mcu_y) {
-    for (int mcu_x = 0; mcu_x < MCUs_per_row; ++mcu_x) {
+  int blocks_per_MCU = 0;
+  for (size_t i = 0; i < scan_info->num_components; ++i) {
+    const JPEGComponent& c = jpg->components[scan_info->components[i].comp_idx];
+    blocks_per_MCU += is_interleaved ? c.h_samp_factor * c.v_samp_factor : 1;
+  }
+  // Decodes one MCU. Only writes the coefficients of the blocks of this MCU
+  // and the output arguments, so that MCUs of different restart intervals can
+  // be decoded concurrently.
+  const auto decode_mcu =
+      [&](int mcu, BitReaderState* br, int* eobrun, coeff_t* last_dc_coeff,
+          std::vector<uint32_t>* reset_points,
+          std::vector<JPEGScanInfo::ExtraZeroRunInfo>* extra_zero_runs) {
+        const int mcu_y = mcu / MCUs_per_row;
+        const int mcu_x = mcu % MCUs_per_row;
+        uint32_t block_scan_index = mcu * blocks_per_MCU;
+        for (size_t i = 0; i < scan_info->num_components; ++i) {
+          JPEGComponentScanInfo* si = &scan_info->components[i];
+          JPEGComponent* c = &jpg->components[si->comp_idx];
+          const HuffmanTableEntry* dc_lut =
+              &dc_huff_lut[si->dc_tbl_idx * kJpegHuffmanLutSize];
+          const HuffmanTableEntry* ac_lut =
+              &ac_huff_lut[si->ac_tbl_idx * kJpegHuffmanLutSize];
+          int nblocks_y = is_interleaved ? c->v_samp_factor : 1;
+          int nblocks_x = is_interleaved ? c->h_samp_factor : 1;
+          for (int iy = 0; iy < nblocks_y; ++iy) {
+            for (int ix = 0; ix < nblocks_x; ++ix) {
+              int block_y = mcu_y * nblocks_y + iy;
+              int block_x = mcu_x * nblocks_x + ix;
+              int block_idx = block_y * c->width_in_blocks + block_x;
+              bool reset_state = false;
+              int num_zero_runs = 0;
+              coeff_t* coeffs = &c->coeffs[block_idx * kDCTBlockSize];
+              if (Ah == 0) {
+                if (!DecodeDCTBlock(dc_lut, ac_lut, Ss, Se, Al, eobrun,
+                                    &reset_state, &num_zero_runs, br, jpg,
+                                    &last_dc_coeff[si->comp_idx], coeffs)) {
+                  return false;
+                }
+              } else {
+                if (!RefineDCTBlock(ac_lut, Ss, Se, Al, eobrun, &reset_state,
+                                    br, jpg, coeffs)) {
+                  return false;
+                }
+              }
+              if (reset_state) {
+                reset_points->emplace_back(block_scan_index);
+              }
+              if (num_zero_runs > 0) {
+                JPEGScanInfo::ExtraZeroRunInfo info;
+                info.block_idx = block_scan_index;
+                info.num_extra_zero_runs = num_zero_runs;
+                extra_zero_runs->push_back(info);
+              }
+              ++block_scan_index;
+            }
+          }
+        }
+        return true;
+      };
+  const int num_MCUs = MCU_rows * MCUs_per_row;
+  const int restart_interval = jpg->restart_interval;
+  const size_t num_intervals =
+      restart_interval > 0 ? DivCeil(num_MCUs, restart_interval) : 1;
+  std::vector<size_t> restart_markers;
+  if (pool != nullptr && num_intervals > 1) {
+    restart_markers = FindRestartMarkers(data, len, *pos, num_intervals);
+  }
+  if (!restart_markers.empty()) {
+    // The restart intervals are independent, and decoding them on their own
+    // gives the same coefficients and extra information as decoding the scan
+    // sequentially, which also requires each interval to end exactly at the
+    // next restart marker.
+    std::vector<RestartIntervalInfo> intervals(num_intervals);
+    const auto decode_interval = [&](const uint32_t task,
+                                     size_t /* thread */) -> Status {
+      RestartIntervalInfo* info = &intervals[task];
+      BitReaderState br(data, len,
+                        task == 0 ? *pos : restart_markers[task - 1] + 2);
+      coeff_t last_dc_coeff[kMaxComponents] = {0};
+      int eobrun = -1;
+      const int mcu_begin = static_cast<int>(task) * restart_interval;
+      const int mcu_end = std::min(num_MCUs, mcu_begin + restart_interval);
+      for (int mcu = mcu_begin; mcu < mcu_end; ++mcu) {
+        if (!decode_mcu(mcu, &br, &eobrun, last_dc_coeff, &info->reset_points,
+                        &info->extra_zero_runs)) {
+          return JXL_FAILURE("Invalid restart interval %u.", task);
+        }
+      }
+      if (eobrun > 0) {
+        return JXL_FAILURE("End-of-block run too long.");
+      }
+      if (!br.FinishStream(&info->has_zero_padding_bit, &info->padding_bits,
+                           &info->end_pos)) {
+        return JXL_FAILURE("Invalid scan.");
+      }
+      if (task + 1 < num_intervals &&
+          info->end_pos != restart_markers[task]) {
+        return JXL_FAILURE("Could not process restart.");
+      }
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_intervals, ThreadPool::NoInit,
+                                  decode_interval, "DecodeRestartIntervals"));
+    for (RestartIntervalInfo& info : intervals) {
+      jpg->has_zero_padding_bit |= info.has_zero_padding_bit;
+      jpg->padding_bits.insert(jpg->padding_bits.end(),
+                               info.padding_bits.begin(),
+                               info.padding_bits.end());
+      scan_info->reset_points.insert(scan_info->reset_points.end(),
+                                     info.reset_points.begin(),
+                                     info.reset_points.end());
+      scan_info->extra_zero_runs.insert(scan_info->extra_zero_runs.end(),
+                                        info.extra_zero_runs.begin(),
+                                        info.extra_zero_runs.end());
+    }
+    *pos = intervals.back().end_pos;
+  } else {
+    for (int mcu = 0; mcu < num_MCUs; ++mcu) {
       // Handle the restart intervals.
-      if (jpg->restart_interval > 0) {
+      if (restart_interval > 0) {
         if (restarts_to_go == 0) {
           if (ProcessRestart(data, len, &next_restart_marker, &br, jpg)) {
-            restarts_to_go = jpg->restart_interval;
+            restarts_to_go = restart_interval;
             memset(static_cast<void*>(last_dc_coeff), 0, sizeof(last_dc_coeff));
             if (eobrun > 0) {
               return JXL_FAILURE("End-of-block run too long.");
@@ -818,56 +973,17 @@ bool ProcessScan(const uint8_t* data, const size_t len,
         }
         --restarts_to_go;
       }
-      // Decode one MCU.
-      for (size_t i = 0; i < scan_info->num_components; ++i) {
-        JPEGComponentScanInfo* si = &scan_info->components[i];
-        JPEGComponent* c = &jpg->components[si->comp_idx];
-        const HuffmanTableEntry* dc_lut =
-            &dc_huff_lut[si->dc_tbl_idx * kJpegHuffmanLutSize];
-        const HuffmanTableEntry* ac_lut =
-            &ac_huff_lut[si->ac_tbl_idx * kJpegHuffmanLutSize];
-        int nblocks_y = is_interleaved ? c->v_samp_factor : 1;
-        int nblocks_x = is_interleaved ? c->h_samp_factor : 1;
-        for (int iy = 0; iy < nblocks_y; ++iy) {
-          for (int ix = 0; ix < nblocks_x; ++ix) {
-            int block_y = mcu_y * nblocks_y + iy;
-            int block_x = mcu_x * nblocks_x + ix;
-            int block_idx = block_y * c->width_in_blocks + block_x;
-            bool reset_state = false;
-            int num_zero_runs = 0;
-            coeff_t* coeffs = &c->coeffs[block_idx * kDCTBlockSize];
-            if (Ah == 0) {
-              if (!DecodeDCTBlock(dc_lut, ac_lut, Ss, Se, Al, &eobrun,
-                                  &reset_state, &num_zero_runs, &br, jpg,
-                                  &last_dc_coeff[si->comp_idx], coeffs)) {
-                return false;
-              }
-            } else {
-              if (!RefineDCTBlock(ac_lut, Ss, Se, Al, &eobrun, &reset_state,
-                                  &br, jpg, coeffs)) {
-                return false;
-              }
-            }
-            if (reset_state) {
-              scan_info->reset_points.emplace_back(block_scan_index);
-            }
-            if (num_zero_runs > 0) {
-              JPEGScanInfo::ExtraZeroRunInfo info;
-              info.block_idx = block_scan_index;
-              info.num_extra_zero_runs = num_zero_runs;
-              scan_info->extra_zero_runs.push_back(info);
-            }
-            ++block_scan_index;
-          }
-        }
+      if (!decode_mcu(mcu, &br, &eobrun, last_dc_coeff,
+                      &scan_info->reset_points, &scan_info->extra_zero_runs)) {
+        return false;
       }
     }
-  }
-  if (eobrun > 0) {
-    return JXL_FAILURE("End-of-block run too long.");
-  }
-  if (!br.FinishStream(jpg, pos)) {
-    return JXL_FAILURE("Invalid scan.");
+    if (eobrun > 0) {
+      return JXL_FAILURE("End-of-block run too long.");
+    }
+    if (!br.FinishStream(jpg, pos)) {
+      return JXL_FAILURE("Invalid scan.");
+    }
   }
   if (*pos > len) {
     return JXL_FAILURE("Unexpected end of file during scan. pos=%" PRIuS
@@ -917,7 +1033,7 @@ size_t FindNextMarker(const uint8_t* data, const size_t len, size_t pos) {
 }  // namespace
 
 bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
-              JPEGData* jpg) {
+              JPEGData* jpg, ThreadPool* pool) {
   size_t pos = 0;
   // Check SOI marker.
   JXL_JPEG_EXPECT_MARKER();
@@ -975,7 +1091,8 @@ bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
       case 0xda:
         if (mode == JpegReadMode::kReadAll) {
           ok = ProcessScan(data, len, dc_huff_lut, ac_huff_lut,
-                           scan_progression, is_progressive, &pos, jpg);
+                           scan_progression, is_progressive, pool, &pos,
+                           jpg);
         }
         break;
       case 0xdb:
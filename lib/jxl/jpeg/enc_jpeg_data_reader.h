@@ -11,6 +11,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 
 namespace jxl {
@@ -25,10 +26,12 @@ enum class JpegReadMode {
 // Parses the JPEG stream contained in data[*pos ... len) and fills in *jpg with
 // the parsed information.
 // If mode is kReadHeader, it fills in only the image dimensions in *jpg.
+// If pool is not null, the restart intervals of the scans are decoded in
+// parallel.
 // Returns false if the data is not valid JPEG, or if it contains an unsupported
 // JPEG feature.
 bool ReadJpeg(const uint8_t* data, size_t len, JpegReadMode mode,
-              JPEGData* jpg);
+              JPEGData* jpg, ThreadPool* pool = nullptr);
 
 }  // namespace jpeg
 }  // namespace jxl
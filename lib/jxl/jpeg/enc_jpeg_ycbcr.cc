@@ -0,0 +1,162 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/jpeg/enc_jpeg_ycbcr.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/frame_dimensions.h"
+#include "lib/jxl/jpeg/jpeg_data.h"
+
+namespace jxl {
+namespace jpeg {
+
+namespace {
+
+// Tables K.1 and K.2 of the JPEG specification, in natural order.
+constexpr int kBaseQuantTables[2][kDCTBlockSize] = {
+    {16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+     14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+     18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+     49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99},
+    {17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+     24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+     99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+     99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99},
+};
+
+// The quality scaling of libjpeg's jpeg_set_quality.
+JPEGQuantTable ScaledQuantTable(size_t index, int quality) {
+  const int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+  JPEGQuantTable table;
+  for (size_t k = 0; k < kDCTBlockSize; k++) {
+    table.values[k] =
+        Clamp1((kBaseQuantTables[index][k] * scale + 50) / 100, 1, 255);
+  }
+  table.index = index;
+  table.is_last = true;
+  return table;
+}
+
+// DCT basis of the JPEG specification, with the normalization of A.3.3:
+// basis[u][x] = C(u) / 2 * cos((2x + 1) u pi / 16).
+std::array<float, kDCTBlockSize> DCTBasis() {
+  std::array<float, kDCTBlockSize> basis;
+  for (size_t u = 0; u < 8; u++) {
+    const double c = u == 0 ? 1.0 / std::sqrt(2.0) : 1.0;
+    for (size_t x = 0; x < 8; x++) {
+      basis[u * 8 + x] =
+          static_cast<float>(c / 2 * std::cos((2 * x + 1) * u * kPi / 16));
+    }
+  }
+  return basis;
+}
+
+// Writes the quantized DCT of the 8x8 level-shifted `samples` to `out`.
+void QuantizedDCT(const float* basis, const float* samples,
+                  const int32_t* quant, coeff_t* out) {
+  float rows[kDCTBlockSize];
+  for (size_t y = 0; y < 8; y++) {
+    for (size_t u = 0; u < 8; u++) {
+      float sum = 0;
+      for (size_t x = 0; x < 8; x++) {
+        sum += basis[u * 8 + x] * samples[y * 8 + x];
+      }
+      rows[y * 8 + u] = sum;
+    }
+  }
+  for (size_t v = 0; v < 8; v++) {
+    for (size_t u = 0; u < 8; u++) {
+      float sum = 0;
+      for (size_t y = 0; y < 8; y++) {
+        sum += basis[v * 8 + y] * rows[y * 8 + u];
+      }
+      out[v * 8 + u] =
+          static_cast<coeff_t>(std::lround(sum / quant[v * 8 + u]));
+    }
+  }
+}
+
+}  // namespace
+
+int JPEGQualityFromDistance(float distance) {
+  // Inverse of the mapping of jpegli_quality_to_distance for qualities of 30
+  // and above, extended linearly below.
+  const float quality = 100.0f - (distance - 0.1f) / 0.09f;
+  return Clamp1(static_cast<int>(std::lround(quality)), 1, 100);
+}
+
+Status JPEGDataFromYCbCr(const YCbCrPlanes& input, size_t xsize, size_t ysize,
+                         int quality, ThreadPool* pool, JPEGData* jpg) {
+  JXL_ENSURE(xsize != 0 && ysize != 0);
+  JXL_ENSURE(quality >= 1 && quality <= 100);
+  jpg->width = xsize;
+  jpg->height = ysize;
+  jpg->quant = {ScaledQuantTable(0, quality), ScaledQuantTable(1, quality)};
+  jpg->quant[0].is_last = false;
+  const size_t max_h = input.chroma_half_width ? 2 : 1;
+  const size_t max_v = input.chroma_half_height ? 2 : 1;
+  const size_t mcu_cols = DivCeil(xsize, max_h * kBlockDim);
+  const size_t mcu_rows = DivCeil(ysize, max_v * kBlockDim);
+  jpg->components.resize(3);
+  for (size_t c = 0; c < 3; c++) {
+    JPEGComponent& component = jpg->components[c];
+    component.id = c + 1;
+    component.h_samp_factor = c == 0 ? max_h : 1;
+    component.v_samp_factor = c == 0 ? max_v : 1;
+    component.quant_idx = c == 0 ? 0 : 1;
+    component.width_in_blocks = mcu_cols * component.h_samp_factor;
+    component.height_in_blocks = mcu_rows * component.v_samp_factor;
+    component.coeffs.resize(static_cast<size_t>(component.width_in_blocks) *
+                            component.height_in_blocks * kDCTBlockSize);
+  }
+
+  const std::array<float, kDCTBlockSize> basis = DCTBasis();
+  const size_t rows0 = jpg->components[0].height_in_blocks;
+  const size_t rows1 = jpg->components[1].height_in_blocks;
+  // One task per block row of a component.
+  const auto process_row = [&](const uint32_t task,
+                               size_t /*thread*/) -> Status {
+    const size_t c = task < rows0 ? 0 : task < rows0 + rows1 ? 1 : 2;
+    const size_t by = task - (c == 0 ? 0 : c == 1 ? rows0 : rows0 + rows1);
+    JPEGComponent& component = jpg->components[c];
+    const size_t plane_xsize =
+        DivCeil(xsize * component.h_samp_factor, max_h);
+    const size_t plane_ysize =
+        DivCeil(ysize * component.v_samp_factor, max_v);
+    const int32_t* quant = jpg->quant[component.quant_idx].values.data();
+    float samples[kDCTBlockSize];
+    for (size_t bx = 0; bx < component.width_in_blocks; bx++) {
+      // The blocks past the edges repeat the last row and column.
+      for (size_t y = 0; y < 8; y++) {
+        const size_t py = std::min(by * 8 + y, plane_ysize - 1);
+        const uint8_t* row = input.planes[c] + py * input.row_strides[c];
+        for (size_t x = 0; x < 8; x++) {
+          const size_t px = std::min(bx * 8 + x, plane_xsize - 1);
+          samples[y * 8 + x] = row[px] - 128.0f;
+        }
+      }
+      QuantizedDCT(basis.data(), samples, quant,
+                   &component.coeffs[(by * component.width_in_blocks + bx) *
+                                     kDCTBlockSize]);
+    }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, rows0 + 2 * rows1,
+                                ThreadPool::NoInit, process_row,
+                                "JPEGDataFromYCbCr"));
+  return true;
+}
+
+}  // namespace jpeg
+}  // namespace jxl
@@ -0,0 +1,46 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_JPEG_ENC_JPEG_YCBCR_H_
+#define LIB_JXL_JPEG_ENC_JPEG_YCBCR_H_
+
+// Quantized DCT coefficients of YCbCr pixels, for encoding them through the
+// JPEG transcoding path.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/jpeg/jpeg_data.h"
+
+namespace jxl {
+namespace jpeg {
+
+struct YCbCrPlanes {
+  // 8-bit full-range YCbCr samples, as in JFIF.
+  const uint8_t* planes[3];
+  size_t row_strides[3];
+  // Whether Cb and Cr have half the resolution of Y in each direction,
+  // rounded up, with the chroma sample positions of JPEG.
+  bool chroma_half_width;
+  bool chroma_half_height;
+};
+
+// Returns the JPEG quality whose scaled libjpeg quantization tables give about
+// the butteraugli `distance`.
+int JPEGQualityFromDistance(float distance);
+
+// Fills `jpg` with the coefficients that a baseline JPEG encoder would write
+// for the `xsize` x `ysize` image `input`, quantized with the libjpeg
+// quantization tables scaled to `quality`. Only the fields that transcoding
+// uses are set, there is no JPEG codestream to reconstruct.
+Status JPEGDataFromYCbCr(const YCbCrPlanes& input, size_t xsize, size_t ysize,
+                         int quality, ThreadPool* pool, JPEGData* jpg);
+
+}  // namespace jpeg
+}  // namespace jxl
+
+#endif  // LIB_JXL_JPEG_ENC_JPEG_YCBCR_H_
@@ -137,7 +137,8 @@ struct JPEGComponent {
         v_samp_factor(1),
         quant_idx(0),
         width_in_blocks(0),
-        height_in_blocks(0) {}
+        height_in_blocks(0),
+        first_block_row(0) {}
 
   // One-byte id of the component.
   uint32_t id;
@@ -154,6 +155,9 @@ struct JPEGComponent {
   // The DCT coefficients of this component, laid out block-by-block, divided
   // through the quantization matrix values.
   std::vector<coeff_t> coeffs;
+  // The block row of the first coefficients in |coeffs|. Non-zero only when
+  // the decoder keeps a window of block rows instead of the whole component.
+  uint32_t first_block_row;
 };
 
 enum class AppMarkerType : uint32_t {
@@ -54,6 +54,7 @@ struct AuxOut;
 namespace {
 using extras::JXLCompressParams;
 using extras::JXLDecompressParams;
+using extras::PackedImage;
 using extras::PackedPixelFile;
 using test::ButteraugliDistance;
 using test::ComputeDistance2;
@@ -149,6 +150,167 @@ TEST(JxlTest, RoundtripSmallD1) {
     EXPECT_EQ(ppf_out.info.intensity_target, t.ppf().info.intensity_target);
   }
 }
+
+TEST(JxlTest, RoundtripTargetButteraugliScore) {
+  ThreadPoolForTests pool(4);
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+  ASSERT_TRUE(t.SetDimensions(t.ppf().info.xsize / 2, t.ppf().info.ysize / 2));
+
+  // The search starts from the default distance of 1 and has to move away
+  // from it in both directions.
+  for (float target : {0.6f, 2.5f}) {
+    JXLCompressParams cparams;
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 7);  // kSquirrel
+    cparams.AddFloatOption(JXL_ENC_FRAME_SETTING_TARGET_BUTTERAUGLI_SCORE,
+                           target);
+    PackedPixelFile ppf_out;
+    Roundtrip(t.ppf(), cparams, {}, pool.get(), &ppf_out);
+    const double distance = ButteraugliDistance(t.ppf(), ppf_out);
+    EXPECT_SLIGHTLY_BELOW(distance, target * 1.1f);
+    EXPECT_GT(distance, target * 0.7f);
+  }
+}
+
+TEST(JxlTest, RoundtripTargetSize) {
+  ThreadPoolForTests pool(4);
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+
+  for (int64_t target : {8000, 30000}) {
+    JXLCompressParams cparams;
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 7);  // kSquirrel
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_TARGET_SIZE, target);
+    PackedPixelFile ppf_out;
+    const size_t size = Roundtrip(t.ppf(), cparams, {}, pool.get(), &ppf_out);
+    EXPECT_NEAR(size, target, target * 0.15);
+  }
+}
+
+TEST(JxlTest, RoundtripAcStrategyPruning) {
+  ThreadPoolForTests pool(4);
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+
+  size_t sizes[2];
+  double distances[2];
+  for (int pruning : {0, 3}) {
+    JXLCompressParams cparams;
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 7);  // kSquirrel
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_AC_STRATEGY_PRUNING, pruning);
+    PackedPixelFile ppf_out;
+    sizes[pruning != 0] = Roundtrip(t.ppf(), cparams, {}, pool.get(), &ppf_out);
+    distances[pruning != 0] = ButteraugliDistance(t.ppf(), ppf_out);
+  }
+  // Pruning only skips candidates that rarely win.
+  EXPECT_NEAR(sizes[1], sizes[0], sizes[0] * 0.05);
+  EXPECT_NEAR(distances[1], distances[0], distances[0] * 0.1);
+}
+
+TEST(JxlTest, RoundtripDecoderFastPaths) {
+  ThreadPoolForTests pool(4);
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+
+  for (bool lossless : {false, true}) {
+    size_t sizes[2];
+    for (int fast_paths : {0, 1}) {
+      JXLCompressParams cparams;
+      cparams.AddOption(JXL_ENC_FRAME_SETTING_DECODER_FAST_PATHS, fast_paths);
+      if (lossless) {
+        cparams.AddOption(JXL_ENC_FRAME_SETTING_MODULAR, 1);
+        cparams.AddOption(JXL_ENC_FRAME_SETTING_COLOR_TRANSFORM, 1);
+        cparams.distance = 0;
+      } else {
+        cparams.distance = 4.0f;
+      }
+      PackedPixelFile ppf_out;
+      sizes[fast_paths] =
+          Roundtrip(t.ppf(), cparams, {}, pool.get(), &ppf_out);
+      if (lossless) {
+        EXPECT_EQ(ComputeDistance2(t.ppf(), ppf_out), 0.0);
+      } else {
+        EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 7.0);
+      }
+    }
+    // The faster decoding costs a few percent of size.
+    EXPECT_LT(sizes[1], sizes[0] * 1.1);
+  }
+}
+
+TEST(JxlTest, RoundtripSampledHistograms) {
+  ThreadPoolForTests pool(4);
+  const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+
+  for (bool lossless : {false, true}) {
+    size_t sizes[2];
+    for (int sampled : {0, 1}) {
+      JXLCompressParams cparams;
+      cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 3);
+      cparams.AddOption(JXL_ENC_FRAME_SETTING_SAMPLED_HISTOGRAMS, sampled);
+      if (lossless) {
+        cparams.AddOption(JXL_ENC_FRAME_SETTING_MODULAR, 1);
+        cparams.distance = 0;
+      } else {
+        cparams.distance = 2.0f;
+      }
+      PackedPixelFile ppf_out;
+      sizes[sampled] = Roundtrip(t.ppf(), cparams, {}, pool.get(), &ppf_out);
+      if (lossless) {
+        EXPECT_EQ(ComputeDistance2(t.ppf(), ppf_out), 0.0);
+      } else {
+        EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 3.5);
+      }
+    }
+    // The histograms of a quarter of the groups are almost as good.
+    EXPECT_LT(sizes[1], sizes[0] * 1.05);
+  }
+}
+
+TEST(JxlTest, RoundtripTimeBudget) {
+  ThreadPoolForTests pool(4);
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+
+  // The budget is used up before the searches start, which are then skipped
+  // but still give valid output.
+  for (bool lossless : {false, true}) {
+    JXLCompressParams cparams;
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 9);  // kTortoise
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_TIME_BUDGET, 1);
+    if (lossless) {
+      cparams.AddOption(JXL_ENC_FRAME_SETTING_MODULAR, 1);
+      cparams.AddOption(JXL_ENC_FRAME_SETTING_COLOR_TRANSFORM, 1);
+      cparams.distance = 0;
+    }
+    PackedPixelFile ppf_out;
+    Roundtrip(t.ppf(), cparams, {}, pool.get(), &ppf_out);
+    if (lossless) {
+      EXPECT_EQ(ComputeDistance2(t.ppf(), ppf_out), 0.0);
+    } else {
+      EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 2.0);
+    }
+  }
+}
+
 TEST(JxlTest, RoundtripResample2) {
   ThreadPool* pool = nullptr;
   const std::vector<uint8_t> orig =
@@ -938,6 +1100,43 @@ TEST(JxlTest, RoundtripAlphaPremultiplied) {
   }
 }
 
+TEST(JxlTest, RoundtripAlphaPremultiplyOnDecode) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/tmshre_riaphotographs_alpha.png");
+  CodecInOut io{memory_manager};
+  CodecInOut io_premul{memory_manager};
+  ASSERT_TRUE(SetFromBytes(Bytes(orig), &io));
+  ASSERT_TRUE(SetFromBytes(Bytes(orig), &io_premul));
+  ASSERT_TRUE(io.ShrinkTo(300, 300));
+  ASSERT_TRUE(io_premul.ShrinkTo(300, 300));
+  EXPECT_TRUE(PremultiplyAlpha(io_premul));
+
+  CompressParams cparams;
+  cparams.butteraugli_distance = 1.0;
+  cparams.SetCms(*JxlGetDefaultCms());
+  std::vector<uint8_t> compressed;
+  EXPECT_TRUE(test::EncodeFile(cparams, &io, &compressed));
+
+  for (bool use_image_callback : {false, true}) {
+    for (JxlDataType data_type :
+         {JXL_TYPE_UINT8, JXL_TYPE_UINT16, JXL_TYPE_FLOAT}) {
+      CodecInOut io2{memory_manager};
+      JXLDecompressParams dparams;
+      dparams.use_image_callback = use_image_callback;
+      dparams.premultiply_alpha = true;
+      dparams.accepted_formats = {{4, data_type, JXL_LITTLE_ENDIAN, 0}};
+      EXPECT_TRUE(test::DecodeFile(dparams, Bytes(compressed), &io2));
+      EXPECT_TRUE(io2.Main().AlphaIsPremultiplied());
+      EXPECT_SLIGHTLY_BELOW(
+          ButteraugliDistance(io_premul.frames, io2.frames, ButteraugliParams(),
+                              *JxlGetDefaultCms(),
+                              /*distmap=*/nullptr),
+          1.111);
+    }
+  }
+}
+
 TEST(JxlTest, RoundtripAlphaResampling) {
   ThreadPool* pool = nullptr;
   const std::vector<uint8_t> orig =
@@ -951,6 +1150,7 @@ TEST(JxlTest, RoundtripAlphaResampling) {
   JXLCompressParams cparams;
   cparams.alpha_distance = 1.0;
   cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 5);  // kHare
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_RESPONSIVE, 1);
   cparams.AddOption(JXL_ENC_FRAME_SETTING_RESAMPLING, 2);
   cparams.AddOption(JXL_ENC_FRAME_SETTING_EXTRA_CHANNEL_RESAMPLING, 2);
 
@@ -972,6 +1172,7 @@ TEST(JxlTest, RoundtripAlphaResamplingOnlyAlpha) {
   JXLCompressParams cparams;
   cparams.alpha_distance = 1.0;
   cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 3);  // kFalcon
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_RESPONSIVE, 1);
   cparams.AddOption(JXL_ENC_FRAME_SETTING_EXTRA_CHANNEL_RESAMPLING, 2);
 
   PackedPixelFile ppf_out;
@@ -979,6 +1180,47 @@ TEST(JxlTest, RoundtripAlphaResamplingOnlyAlpha) {
   EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 1.52);
 }
 
+TEST(JxlTest, RoundtripAlphaFastLossy) {
+  ThreadPoolForTests pool(4);
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/tmshre_riaphotographs_alpha.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+  ASSERT_TRUE(t.ppf().info.alpha_bits > 0);
+  const PackedImage& color = t.ppf().frames[0].color;
+  ASSERT_EQ(color.format.num_channels, 4);
+  ASSERT_EQ(color.format.data_type, JXL_TYPE_UINT8);
+
+  // At the default effort, lossy alpha is quantized without Squeeze.
+  JXLCompressParams cparams;
+  cparams.alpha_distance = 0.0;
+  PackedPixelFile ppf_lossless;
+  size_t lossless_size =
+      Roundtrip(t.ppf(), cparams, {}, pool.get(), &ppf_lossless);
+  cparams.alpha_distance = 2.0;
+  PackedPixelFile ppf_out;
+  EXPECT_LT(Roundtrip(t.ppf(), cparams, {}, pool.get(), &ppf_out),
+            lossless_size);
+  EXPECT_LE(ButteraugliDistance(t.ppf(), ppf_out), 1.6);
+
+  // Fully transparent and fully opaque pixels are kept.
+  const PackedImage& color_out = ppf_out.frames[0].color;
+  ASSERT_EQ(color_out.format.num_channels, 4);
+  ASSERT_EQ(color_out.format.data_type, JXL_TYPE_UINT8);
+  for (size_t y = 0; y < color.ysize; y++) {
+    for (size_t x = 0; x < color.xsize; x++) {
+      const uint8_t alpha = *color.const_pixels(y, x, 3);
+      const uint8_t alpha_out = *color_out.const_pixels(y, x, 3);
+      if (alpha == 0 || alpha == 255) {
+        ASSERT_EQ(alpha, alpha_out) << "x=" << x << " y=" << y;
+      } else {
+        ASSERT_NEAR(alpha, alpha_out, 3) << "x=" << x << " y=" << y;
+      }
+    }
+  }
+}
+
 TEST(JxlTest, RoundtripAlphaNonMultipleOf8) {
   ThreadPool* pool = nullptr;
   const std::vector<uint8_t> orig =
@@ -1025,6 +1267,7 @@ TEST(JxlTest, RoundtripAlpha16) {
 
   JXLCompressParams cparams;
   cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 6);  // kWombat
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_RESPONSIVE, 1);
   cparams.distance = 0.5;
   cparams.alpha_distance = 0.5;
 
@@ -1243,6 +1486,27 @@ TEST(JxlTest, RoundtripDots) {
   EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 0.14);
 }
 
+// The dots are searched in stripes of rows in parallel, which must find the
+// same dots as a single thread.
+TEST(JxlTest, RoundtripDotsThreadsConsistent) {
+  ThreadPoolForTests pool(8);
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/cvo9xd_keong_macan_srgb8.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+
+  JXLCompressParams cparams;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 7);  // kSquirrel
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_DOTS, 1);
+  cparams.distance = 0.04;
+
+  PackedPixelFile ppf_out;
+  const size_t size_serial = Roundtrip(t.ppf(), cparams, {}, nullptr, &ppf_out);
+  EXPECT_EQ(Roundtrip(t.ppf(), cparams, {}, pool.get(), &ppf_out),
+            size_serial);
+}
+
 TEST(JxlTest, RoundtripDisablePerceptual) {
   ThreadPool* pool = nullptr;
   const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
@@ -1269,6 +1533,31 @@ TEST(JxlTest, RoundtripDisablePerceptual) {
   EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 11.0);
 }
 
+TEST(JxlTest, RoundtripStaticEntropyCodes) {
+  ThreadPool* pool = nullptr;
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+  ASSERT_TRUE(t.SetDimensions(t.ppf().info.xsize / 4, t.ppf().info.ysize / 4));
+
+  for (int effort : {1, 3}) {
+    JXLCompressParams cparams;
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, effort);
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_STATIC_ENTROPY_CODES, 1);
+    cparams.distance = 1.0;
+    PackedPixelFile ppf_out;
+    EXPECT_GT(Roundtrip(t.ppf(), cparams, {}, pool, &ppf_out), 0u);
+    EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 2.0);
+
+    cparams.distance = 0.0;
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_MODULAR, 1);
+    EXPECT_GT(Roundtrip(t.ppf(), cparams, {}, pool, &ppf_out), 0u);
+    EXPECT_EQ(ComputeDistance2(t.ppf(), ppf_out), 0.0);
+  }
+}
+
 TEST(JxlTest, RoundtripNoise) {
   ThreadPool* pool = nullptr;
   const std::vector<uint8_t> orig =
@@ -1396,6 +1685,36 @@ TEST(JxlTest, RoundtripAnimationPatches) {
   EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 1.85);
 }
 
+TEST(JxlTest, RoundtripAnimationSharedPatches) {
+  if (!jxl::extras::CanDecode(jxl::extras::Codec::kGIF)) {
+    fprintf(stderr, "Skipping test because of missing GIF decoder.\n");
+    return;
+  }
+  ThreadPool* pool = nullptr;
+  const std::vector<uint8_t> orig = ReadTestData("jxl/animation_patches.gif");
+
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+  ASSERT_EQ(2u, t.ppf().frames.size());
+
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(t.ppf().frames[0].color.format);
+
+  size_t sizes[2];
+  for (int shared : {0, 1}) {
+    JXLCompressParams cparams;
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_PATCHES, 1);
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_SHARED_PATCHES, shared);
+    PackedPixelFile ppf_out;
+    sizes[shared] = Roundtrip(t.ppf(), cparams, dparams, pool, &ppf_out);
+    EXPECT_EQ(ppf_out.frames.size(), t.ppf().frames.size());
+    EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(t.ppf(), ppf_out), 1.85);
+  }
+  // The second frame uses the dictionary of the first one.
+  EXPECT_LT(sizes[1], sizes[0]);
+}
+
 size_t RoundtripJpeg(const std::vector<uint8_t>& jpeg_in, ThreadPool* pool) {
   std::vector<uint8_t> compressed;
   EXPECT_TRUE(extras::EncodeImageJXL({}, extras::PackedPixelFile(), &jpeg_in,
@@ -1945,5 +2264,61 @@ JXL_GTEST_INSTANTIATE_TEST_SUITE_P(
     JxlStreamingTest, JxlStreamingEncodingTest,
     testing::ValuesIn(StreamingEncodingTestParam::All()));
 
+JXL_SLOW_TEST(JxlTest, StreamingLosslessGlobalTree) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
+  jxl::test::TestImage image;
+  ASSERT_TRUE(image.DecodeFromBytes(orig));
+  // Only as tall as needed to get two DC groups side by side.
+  ASSERT_TRUE(image.SetDimensions(image.ppf().xsize(), 128));
+
+  JXLCompressParams cparams;
+  cparams.distance = 0.0f;
+  cparams.allow_expert_options = true;
+  // From effort 10, lossless frames use a global tree.
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 10);
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_BUFFERING, 3);
+
+  ThreadPoolForTests pool(8);
+  PackedPixelFile ppf_out;
+  Roundtrip(image.ppf(), cparams, {}, pool.get(), &ppf_out);
+  EXPECT_EQ(0.0f, ComputeDistance2(image.ppf(), ppf_out));
+}
+
+JXL_SLOW_TEST(JxlTest, StreamingButteraugliIterations) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
+  jxl::test::TestImage image;
+  ASSERT_TRUE(image.DecodeFromBytes(orig));
+
+  JXLCompressParams cparams;
+  cparams.distance = 1.0f;
+  // The butteraugli iterations of effort 8 run on each DC group.
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 8);
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_BUFFERING, 3);
+
+  ThreadPoolForTests pool(8);
+  PackedPixelFile ppf_out;
+  Roundtrip(image.ppf(), cparams, {}, pool.get(), &ppf_out);
+  EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(image.ppf(), ppf_out, pool.get()),
+                        1.6f);
+}
+
+TEST(JxlTest, LosslessSingleLargeGroupWithPool) {
+  const std::vector<uint8_t> orig = ReadTestData(
+      "external/wesaturate/500px/tmshre_riaphotographs_alpha.png");
+  jxl::test::TestImage image;
+  ASSERT_TRUE(image.DecodeFromBytes(orig));
+
+  JXLCompressParams cparams;
+  cparams.distance = 0.0f;
+  // A single 1024x1024 group, which is decoded with the pool used within the
+  // group, including for the alpha channel.
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_MODULAR_GROUP_SIZE, 3);
+
+  ThreadPoolForTests pool(8);
+  PackedPixelFile ppf_out;
+  Roundtrip(image.ppf(), cparams, {}, pool.get(), &ppf_out);
+  EXPECT_EQ(0.0f, ComputeDistance2(image.ppf(), ppf_out));
+}
+
 }  // namespace
 }  // namespace jxl
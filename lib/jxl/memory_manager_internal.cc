@@ -19,11 +19,36 @@
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/simd_util.h"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
 namespace jxl {
 
 namespace {
 
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+// Size of the transparent huge pages on x86-64 and most arm64 kernels.
+constexpr size_t kHugePageSize = size_t{1} << 21;
+// Allocations of large images, e.g. planes of 100 MP frames, are backed by
+// huge pages, which avoids most TLB misses in the passes going down the
+// columns. Smaller allocations would waste too much memory by rounding up.
+constexpr size_t kMinHugePageAllocation = size_t{32} << 20;
+#endif
+
 void* MemoryManagerDefaultAlloc(void* opaque, size_t size) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (size >= kMinHugePageAllocation) {
+    // Whole huge pages, so that the hint does not apply to other allocations.
+    const size_t huge_size = RoundUpTo(size, kHugePageSize);
+    void* address = nullptr;
+    if (posix_memalign(&address, kHugePageSize, huge_size) != 0) return nullptr;
+    // Only a hint, which the kernel ignores if huge pages are disabled, so
+    // that failures are not errors.
+    (void)madvise(address, huge_size, MADV_HUGEPAGE);
+    return address;
+  }
+#endif
   return malloc(size);
 }
 
@@ -569,6 +569,15 @@ inline PredictionResult PredictNoTreeNoWP(size_t w,
       /*references=*/nullptr, /*wp_state=*/nullptr, /*predictions=*/nullptr);
 }
 
+// Only use for y > 1, x > 1, x < w-2
+JXL_INLINE PredictionResult PredictNoTreeNoWPNEC(
+    size_t w, const pixel_type *JXL_RESTRICT pp, const intptr_t onerow,
+    const int x, const int y, Predictor predictor) {
+  return detail::Predict<detail::kNoEdgeCases>(
+      /*p=*/nullptr, w, pp, onerow, x, y, predictor, /*lookup=*/nullptr,
+      /*references=*/nullptr, /*wp_state=*/nullptr, /*predictions=*/nullptr);
+}
+
 inline PredictionResult PredictNoTreeWP(size_t w,
                                         const pixel_type *JXL_RESTRICT pp,
                                         const intptr_t onerow, const int x,
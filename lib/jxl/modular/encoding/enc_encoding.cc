@@ -11,11 +11,13 @@
 #include <cstdint>
 #include <cstdlib>
 #include <limits>
+#include <memory>
 #include <queue>
 #include <utility>
 #include <vector>
 
 #include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/enc_ans.h"
@@ -294,7 +296,7 @@ StatusOr<Tree> LearnTree(
     TreeSamples &&tree_samples, size_t total_pixels,
     const ModularOptions &options,
     const std::vector<ModularMultiplierInfo> &multiplier_info = {},
-    StaticPropRange static_prop_range = {}) {
+    StaticPropRange static_prop_range = {}, ThreadPool *pool = nullptr) {
   Tree tree;
   for (size_t i = 0; i < kNumStaticProperties; i++) {
     if (static_prop_range[i][1] == 0) {
@@ -315,7 +317,7 @@ StatusOr<Tree> LearnTree(
   JXL_RETURN_IF_ERROR(ComputeBestTree(
       tree_samples, options.splitting_heuristics_node_threshold * required_cost,
       multiplier_info, static_prop_range, options.fast_decode_multiplier,
-      &tree));
+      &tree, pool));
   return tree;
 }
 
@@ -360,8 +362,14 @@ Status EncodeModularChannelMAANS(const Image &image, pixel_type chan,
   if (is_wp_only) {
     is_wp_only = TreeToLookupTable(tree, *tree_lut);
   }
+  // Gradient-only trees with multipliers, as used for pre-quantized channels.
+  std::unique_ptr<TreeLut<uint8_t, false, true>> tree_mul_lut;
   if (is_gradient_only) {
     is_gradient_only = TreeToLookupTable(tree, *tree_lut);
+    if (!is_gradient_only) {
+      tree_mul_lut = jxl::make_unique<TreeLut<uint8_t, false, true>>();
+      if (!TreeToLookupTable(tree, *tree_mul_lut)) tree_mul_lut.reset();
+    }
   }
 
   if (is_wp_only && !skip_encoder_fast_path) {
@@ -436,6 +444,31 @@ Status EncodeModularChannelMAANS(const Image &image, pixel_type chan,
         *tokenp++ = Token(ctx_id, PackSigned(residual));
       }
     }
+  } else if (tree_mul_lut && !skip_encoder_fast_path) {
+    for (size_t c = 0; c < 3; c++) {
+      FillImage(static_cast<float>(PredictorColor(Predictor::Gradient)[c]),
+                &predictor_img.Plane(c));
+    }
+    const intptr_t onerow = channel.plane.PixelsPerRow();
+    for (size_t y = 0; y < channel.h; y++) {
+      const pixel_type *JXL_RESTRICT r = channel.Row(y);
+      for (size_t x = 0; x < channel.w; x++) {
+        pixel_type_w left = (x ? r[x - 1] : y ? *(r + x - onerow) : 0);
+        pixel_type_w top = (y ? *(r + x - onerow) : left);
+        pixel_type_w topleft = (x && y ? *(r + x - 1 - onerow) : left);
+        int32_t guess = ClampedGradient(top, left, topleft);
+        uint32_t pos =
+            kPropRangeFast +
+            std::min<pixel_type_w>(
+                std::max<pixel_type_w>(-kPropRangeFast, top + left - topleft),
+                kPropRangeFast - 1);
+        uint32_t ctx_id = tree_mul_lut->context_lookup[pos];
+        int32_t multiplier = tree_mul_lut->multipliers[pos];
+        int32_t residual = r[x] - guess;
+        JXL_DASSERT(residual % multiplier == 0);
+        *tokenp++ = Token(ctx_id, PackSigned(residual / multiplier));
+      }
+    }
   } else if (tree.size() == 1 && tree[0].predictor == Predictor::Zero &&
              tree[0].multiplier == 1 && tree[0].predictor_offset == 0 &&
              !skip_encoder_fast_path) {
@@ -10,6 +10,7 @@
 #include <cstdint>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_bit_writer.h"
@@ -31,7 +32,7 @@ StatusOr<Tree> LearnTree(
     TreeSamples &&tree_samples, size_t total_pixels,
     const ModularOptions &options,
     const std::vector<ModularMultiplierInfo> &multiplier_info = {},
-    StaticPropRange static_prop_range = {});
+    StaticPropRange static_prop_range = {}, ThreadPool *pool = nullptr);
 
 // TODO(veluca): make cleaner interfaces.
 
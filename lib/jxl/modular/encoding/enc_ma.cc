@@ -6,6 +6,7 @@
 #include "lib/jxl/modular/encoding/enc_ma.h"
 
 #include <algorithm>
+#include <array>
 #include <cstdlib>
 #include <limits>
 #include <numeric>
@@ -19,12 +20,14 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/fast_math-inl.h"
 #include "lib/jxl/base/random.h"
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/modular/encoding/context_predict.h"
 #include "lib/jxl/modular/options.h"
 #include "lib/jxl/pack_signed.h"
+#include "lib/jxl/trace_internal.h"
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
@@ -160,10 +163,201 @@ void SplitTreeSamples(TreeSamples &tree_samples, size_t begin, size_t pos,
   }
 }
 
-void FindBestSplit(TreeSamples &tree_samples, float threshold,
-                   const std::vector<ModularMultiplierInfo> &mul_info,
-                   StaticPropRange initial_static_prop_range,
-                   float fast_decode_multiplier, Tree *tree) {
+// A candidate split of a node, with the estimated cost of both sides.
+struct SplitInfo {
+  size_t prop = 0;
+  uint32_t val = 0;
+  size_t pos = 0;
+  float lcost = std::numeric_limits<float>::max();
+  float rcost = std::numeric_limits<float>::max();
+  Predictor lpred = Predictor::Zero;
+  Predictor rpred = Predictor::Zero;
+  float Cost() const { return lcost + rcost; }
+};
+
+enum SplitKind {
+  kSplitStaticConstant,
+  kSplitStatic,
+  kSplitNonstatic,
+  kSplitNoWP,
+  kNumSplitKinds
+};
+
+using SplitCandidates = std::array<SplitInfo, kNumSplitKinds>;
+
+// Per-thread scratch space for evaluating the splits along one property.
+struct SplitScratch {
+  std::vector<int> prop_value_used_count;
+  // Both are all zeros between calls to FindBestSplitForProperty.
+  std::vector<int> count_increase;
+  std::vector<size_t> extra_bits_increase;
+  struct CostInfo {
+    float cost = std::numeric_limits<float>::max();
+    float extra_cost = 0;
+    float Cost() const { return cost + extra_cost; }
+    Predictor pred;  // will be uninitialized in some cases, but never used.
+  };
+  std::vector<CostInfo> costs_l;
+  std::vector<CostInfo> costs_r;
+  std::vector<int32_t> counts_above;
+  std::vector<int32_t> counts_below;
+};
+
+// Nodes with fewer distinct samples than this evaluate their properties on
+// the calling thread; dispatching to the pool costs more than it saves.
+constexpr size_t kMinSamplesForParallelSplit = 4096;
+
+// For the property `prop`, computes which of its values are used, and what
+// tokens correspond to those usages. Then, iterates through the values, and
+// computes the entropy of each side of the split (of the form `prop >
+// threshold`). Stores the cheapest split of each kind in `best`.
+void FindBestSplitForProperty(const TreeSamples &tree_samples, size_t prop,
+                              size_t begin, size_t end, size_t max_symbols,
+                              const std::vector<int32_t> &counts,
+                              const std::vector<uint32_t> &tot_extra_bits,
+                              const PropertyDecisionNode &node,
+                              uint64_t used_properties,
+                              float change_pred_penalty, SplitScratch *scratch,
+                              SplitCandidates *best) {
+  size_t num_predictors = tree_samples.NumPredictors();
+  std::vector<int> &prop_value_used_count = scratch->prop_value_used_count;
+  std::vector<int> &count_increase = scratch->count_increase;
+  std::vector<size_t> &extra_bits_increase = scratch->extra_bits_increase;
+  std::vector<SplitScratch::CostInfo> &costs_l = scratch->costs_l;
+  std::vector<SplitScratch::CostInfo> &costs_r = scratch->costs_r;
+  std::vector<int32_t> &counts_above = scratch->counts_above;
+  std::vector<int32_t> &counts_below = scratch->counts_below;
+  counts_above.resize(max_symbols);
+  counts_below.resize(max_symbols);
+
+  costs_l.clear();
+  costs_r.clear();
+  size_t prop_size = tree_samples.NumPropertyValues(prop);
+  if (count_increase.size() < prop_size * max_symbols) {
+    count_increase.resize(prop_size * max_symbols);
+  }
+  if (extra_bits_increase.size() < prop_size) {
+    extra_bits_increase.resize(prop_size);
+  }
+  // Clear prop_value_used_count (which cannot be cleared "on the go")
+  prop_value_used_count.clear();
+  prop_value_used_count.resize(prop_size);
+
+  size_t first_used = prop_size;
+  size_t last_used = 0;
+
+  // TODO(veluca): consider finding multiple splits along a single
+  // property at the same time, possibly with a bottom-up approach.
+  for (size_t i = begin; i < end; i++) {
+    size_t p = tree_samples.Property(prop, i);
+    prop_value_used_count[p]++;
+    last_used = std::max(last_used, p);
+    first_used = std::min(first_used, p);
+  }
+  costs_l.resize(last_used - first_used);
+  costs_r.resize(last_used - first_used);
+  // For all predictors, compute the right and left costs of each split.
+  for (size_t pred = 0; pred < num_predictors; pred++) {
+    // Compute cost and histogram increments for each property value.
+    for (size_t i = begin; i < end; i++) {
+      size_t p = tree_samples.Property(prop, i);
+      size_t cnt = tree_samples.Count(i);
+      size_t sym = tree_samples.Token(pred, i);
+      count_increase[p * max_symbols + sym] += cnt;
+      extra_bits_increase[p] += tree_samples.NBits(pred, i) * cnt;
+    }
+    memcpy(counts_above.data(), counts.data() + pred * max_symbols,
+           max_symbols * sizeof counts_above[0]);
+    memset(counts_below.data(), 0, max_symbols * sizeof counts_below[0]);
+    size_t extra_bits_below = 0;
+    // Exclude last used: this ensures neither counts_above nor
+    // counts_below is empty.
+    for (size_t i = first_used; i < last_used; i++) {
+      if (!prop_value_used_count[i]) continue;
+      extra_bits_below += extra_bits_increase[i];
+      // The increase for this property value has been used, and will not
+      // be used again: clear it. Also below.
+      extra_bits_increase[i] = 0;
+      for (size_t sym = 0; sym < max_symbols; sym++) {
+        counts_above[sym] -= count_increase[i * max_symbols + sym];
+        counts_below[sym] += count_increase[i * max_symbols + sym];
+        count_increase[i * max_symbols + sym] = 0;
+      }
+      float rcost = EstimateBits(counts_above.data(), max_symbols) +
+                    tot_extra_bits[pred] - extra_bits_below;
+      float lcost =
+          EstimateBits(counts_below.data(), max_symbols) + extra_bits_below;
+      JXL_DASSERT(extra_bits_below <= tot_extra_bits[pred]);
+      float penalty = 0;
+      // Never discourage moving away from the Weighted predictor.
+      if (tree_samples.PredictorFromIndex(pred) != node.predictor &&
+          node.predictor != Predictor::Weighted) {
+        penalty = change_pred_penalty;
+      }
+      // If everything else is equal, disfavour Weighted (slower) and
+      // favour Zero (faster if it's the only predictor used in a
+      // group+channel combination)
+      if (tree_samples.PredictorFromIndex(pred) == Predictor::Weighted) {
+        penalty += 1e-8;
+      }
+      if (tree_samples.PredictorFromIndex(pred) == Predictor::Zero) {
+        penalty -= 1e-8;
+      }
+      if (rcost + penalty < costs_r[i - first_used].Cost()) {
+        costs_r[i - first_used].cost = rcost;
+        costs_r[i - first_used].extra_cost = penalty;
+        costs_r[i - first_used].pred = tree_samples.PredictorFromIndex(pred);
+      }
+      if (lcost + penalty < costs_l[i - first_used].Cost()) {
+        costs_l[i - first_used].cost = lcost;
+        costs_l[i - first_used].extra_cost = penalty;
+        costs_l[i - first_used].pred = tree_samples.PredictorFromIndex(pred);
+      }
+    }
+  }
+  // Iterate through the possible splits and find the one with minimum sum
+  // of costs of the two sides.
+  size_t split = begin;
+  for (size_t i = first_used; i < last_used; i++) {
+    if (!prop_value_used_count[i]) continue;
+    split += prop_value_used_count[i];
+    float rcost = costs_r[i - first_used].cost;
+    float lcost = costs_l[i - first_used].cost;
+    // WP was not used + we would use the WP property or predictor
+    bool adds_wp =
+        (tree_samples.PropertyFromIndex(prop) == kWPProp &&
+         (used_properties & (1LU << prop)) == 0) ||
+        ((costs_l[i - first_used].pred == Predictor::Weighted ||
+          costs_r[i - first_used].pred == Predictor::Weighted) &&
+         node.predictor != Predictor::Weighted);
+    bool zero_entropy_side = rcost == 0 || lcost == 0;
+
+    SplitInfo &best_of_kind =
+        (*best)[prop < kNumStaticProperties
+                    ? (zero_entropy_side ? kSplitStaticConstant : kSplitStatic)
+                    : (adds_wp ? kSplitNonstatic : kSplitNoWP)];
+    if (lcost + rcost < best_of_kind.Cost()) {
+      best_of_kind.prop = prop;
+      best_of_kind.val = i;
+      best_of_kind.pos = split;
+      best_of_kind.lcost = lcost;
+      best_of_kind.lpred = costs_l[i - first_used].pred;
+      best_of_kind.rcost = rcost;
+      best_of_kind.rpred = costs_r[i - first_used].pred;
+    }
+  }
+  // Clear extra_bits_increase and cost_increase for last_used.
+  extra_bits_increase[last_used] = 0;
+  for (size_t sym = 0; sym < max_symbols; sym++) {
+    count_increase[last_used * max_symbols + sym] = 0;
+  }
+}
+
+Status FindBestSplit(TreeSamples &tree_samples, float threshold,
+                     const std::vector<ModularMultiplierInfo> &mul_info,
+                     StaticPropRange initial_static_prop_range,
+                     float fast_decode_multiplier, Tree *tree,
+                     ThreadPool *pool) {
   struct NodeInfo {
     size_t pos;
     size_t begin;
@@ -178,6 +372,9 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
   size_t num_predictors = tree_samples.NumPredictors();
   size_t num_properties = tree_samples.NumProperties();
 
+  std::vector<SplitScratch> scratch(1);
+  std::vector<SplitCandidates> prop_candidates(num_properties);
+
   // TODO(veluca): consider parallelizing the search (processing multiple nodes
   // at a time).
   while (!nodes.empty()) {
@@ -189,21 +386,11 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
     nodes.pop_back();
     if (begin == end) continue;
 
-    struct SplitInfo {
-      size_t prop = 0;
-      uint32_t val = 0;
-      size_t pos = 0;
-      float lcost = std::numeric_limits<float>::max();
-      float rcost = std::numeric_limits<float>::max();
-      Predictor lpred = Predictor::Zero;
-      Predictor rpred = Predictor::Zero;
-      float Cost() const { return lcost + rcost; }
-    };
-
-    SplitInfo best_split_static_constant;
-    SplitInfo best_split_static;
-    SplitInfo best_split_nonstatic;
-    SplitInfo best_split_nowp;
+    SplitCandidates candidates;
+    SplitInfo &best_split_static_constant = candidates[kSplitStaticConstant];
+    SplitInfo &best_split_static = candidates[kSplitStatic];
+    SplitInfo &best_split_nonstatic = candidates[kSplitNonstatic];
+    SplitInfo &best_split_nowp = candidates[kSplitNoWP];
 
     JXL_DASSERT(begin <= end);
     JXL_DASSERT(end <= tree_samples.NumDistinctSamples());
@@ -269,156 +456,45 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
       }
     }
 
-    if (best != &forced_split) {
-      std::vector<int> prop_value_used_count;
-      std::vector<int> count_increase;
-      std::vector<size_t> extra_bits_increase;
-      // For each property, compute which of its values are used, and what
-      // tokens correspond to those usages. Then, iterate through the values,
-      // and compute the entropy of each side of the split (of the form `prop >
-      // threshold`). Finally, find the split that minimizes the cost.
-      struct CostInfo {
-        float cost = std::numeric_limits<float>::max();
-        float extra_cost = 0;
-        float Cost() const { return cost + extra_cost; }
-        Predictor pred;  // will be uninitialized in some cases, but never used.
-      };
-      std::vector<CostInfo> costs_l;
-      std::vector<CostInfo> costs_r;
-
-      std::vector<int32_t> counts_above(max_symbols);
-      std::vector<int32_t> counts_below(max_symbols);
-
+    if (best != &forced_split && base_bits > threshold) {
       // The lower the threshold, the higher the expected noisiness of the
       // estimate. Thus, discourage changing predictors.
       float change_pred_penalty = 800.0f / (100.0f + threshold);
-      for (size_t prop = 0; prop < num_properties && base_bits > threshold;
-           prop++) {
-        costs_l.clear();
-        costs_r.clear();
-        size_t prop_size = tree_samples.NumPropertyValues(prop);
-        if (extra_bits_increase.size() < prop_size) {
-          count_increase.resize(prop_size * max_symbols);
-          extra_bits_increase.resize(prop_size);
-        }
-        // Clear prop_value_used_count (which cannot be cleared "on the go")
-        prop_value_used_count.clear();
-        prop_value_used_count.resize(prop_size);
-
-        size_t first_used = prop_size;
-        size_t last_used = 0;
-
-        // TODO(veluca): consider finding multiple splits along a single
-        // property at the same time, possibly with a bottom-up approach.
-        for (size_t i = begin; i < end; i++) {
-          size_t p = tree_samples.Property(prop, i);
-          prop_value_used_count[p]++;
-          last_used = std::max(last_used, p);
-          first_used = std::min(first_used, p);
-        }
-        costs_l.resize(last_used - first_used);
-        costs_r.resize(last_used - first_used);
-        // For all predictors, compute the right and left costs of each split.
-        for (size_t pred = 0; pred < num_predictors; pred++) {
-          // Compute cost and histogram increments for each property value.
-          for (size_t i = begin; i < end; i++) {
-            size_t p = tree_samples.Property(prop, i);
-            size_t cnt = tree_samples.Count(i);
-            size_t sym = tree_samples.Token(pred, i);
-            count_increase[p * max_symbols + sym] += cnt;
-            extra_bits_increase[p] += tree_samples.NBits(pred, i) * cnt;
-          }
-          memcpy(counts_above.data(), counts.data() + pred * max_symbols,
-                 max_symbols * sizeof counts_above[0]);
-          memset(counts_below.data(), 0, max_symbols * sizeof counts_below[0]);
-          size_t extra_bits_below = 0;
-          // Exclude last used: this ensures neither counts_above nor
-          // counts_below is empty.
-          for (size_t i = first_used; i < last_used; i++) {
-            if (!prop_value_used_count[i]) continue;
-            extra_bits_below += extra_bits_increase[i];
-            // The increase for this property value has been used, and will not
-            // be used again: clear it. Also below.
-            extra_bits_increase[i] = 0;
-            for (size_t sym = 0; sym < max_symbols; sym++) {
-              counts_above[sym] -= count_increase[i * max_symbols + sym];
-              counts_below[sym] += count_increase[i * max_symbols + sym];
-              count_increase[i * max_symbols + sym] = 0;
-            }
-            float rcost = EstimateBits(counts_above.data(), max_symbols) +
-                          tot_extra_bits[pred] - extra_bits_below;
-            float lcost = EstimateBits(counts_below.data(), max_symbols) +
-                          extra_bits_below;
-            JXL_DASSERT(extra_bits_below <= tot_extra_bits[pred]);
-            float penalty = 0;
-            // Never discourage moving away from the Weighted predictor.
-            if (tree_samples.PredictorFromIndex(pred) !=
-                    (*tree)[pos].predictor &&
-                (*tree)[pos].predictor != Predictor::Weighted) {
-              penalty = change_pred_penalty;
-            }
-            // If everything else is equal, disfavour Weighted (slower) and
-            // favour Zero (faster if it's the only predictor used in a
-            // group+channel combination)
-            if (tree_samples.PredictorFromIndex(pred) == Predictor::Weighted) {
-              penalty += 1e-8;
-            }
-            if (tree_samples.PredictorFromIndex(pred) == Predictor::Zero) {
-              penalty -= 1e-8;
-            }
-            if (rcost + penalty < costs_r[i - first_used].Cost()) {
-              costs_r[i - first_used].cost = rcost;
-              costs_r[i - first_used].extra_cost = penalty;
-              costs_r[i - first_used].pred =
-                  tree_samples.PredictorFromIndex(pred);
-            }
-            if (lcost + penalty < costs_l[i - first_used].Cost()) {
-              costs_l[i - first_used].cost = lcost;
-              costs_l[i - first_used].extra_cost = penalty;
-              costs_l[i - first_used].pred =
-                  tree_samples.PredictorFromIndex(pred);
-            }
-          }
+      const PropertyDecisionNode &node = (*tree)[pos];
+      const auto eval_property = [&](const uint32_t prop,
+                                     size_t thread) -> Status {
+        prop_candidates[prop] = SplitCandidates();
+        FindBestSplitForProperty(tree_samples, prop, begin, end, max_symbols,
+                                 counts, tot_extra_bits, node, used_properties,
+                                 change_pred_penalty, &scratch[thread],
+                                 &prop_candidates[prop]);
+        return true;
+      };
+      if (pool != nullptr && end - begin >= kMinSamplesForParallelSplit) {
+        const auto init_scratch = [&](size_t num_threads) -> Status {
+          if (scratch.size() < num_threads) scratch.resize(num_threads);
+          return true;
+        };
+        JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_properties, init_scratch,
+                                      eval_property, "FindBestSplit"));
+      } else {
+        for (uint32_t prop = 0; prop < num_properties; prop++) {
+          JXL_RETURN_IF_ERROR(eval_property(prop, 0));
         }
-        // Iterate through the possible splits and find the one with minimum sum
-        // of costs of the two sides.
-        size_t split = begin;
-        for (size_t i = first_used; i < last_used; i++) {
-          if (!prop_value_used_count[i]) continue;
-          split += prop_value_used_count[i];
-          float rcost = costs_r[i - first_used].cost;
-          float lcost = costs_l[i - first_used].cost;
-          // WP was not used + we would use the WP property or predictor
-          bool adds_wp =
-              (tree_samples.PropertyFromIndex(prop) == kWPProp &&
-               (used_properties & (1LU << prop)) == 0) ||
-              ((costs_l[i - first_used].pred == Predictor::Weighted ||
-                costs_r[i - first_used].pred == Predictor::Weighted) &&
-               (*tree)[pos].predictor != Predictor::Weighted);
-          bool zero_entropy_side = rcost == 0 || lcost == 0;
-
-          SplitInfo &best =
-              prop < kNumStaticProperties
-                  ? (zero_entropy_side ? best_split_static_constant
-                                       : best_split_static)
-                  : (adds_wp ? best_split_nonstatic : best_split_nowp);
-          if (lcost + rcost < best.Cost()) {
-            best.prop = prop;
-            best.val = i;
-            best.pos = split;
-            best.lcost = lcost;
-            best.lpred = costs_l[i - first_used].pred;
-            best.rcost = rcost;
-            best.rpred = costs_r[i - first_used].pred;
+      }
+      // Merge in property order, keeping the first of equally good splits:
+      // this picks the same split as a single pass over all the properties.
+      for (size_t prop = 0; prop < num_properties; prop++) {
+        for (size_t kind = 0; kind < kNumSplitKinds; kind++) {
+          const SplitInfo &split = prop_candidates[prop][kind];
+          if (split.Cost() < candidates[kind].Cost()) {
+            candidates[kind] = split;
           }
         }
-        // Clear extra_bits_increase and cost_increase for last_used.
-        extra_bits_increase[last_used] = 0;
-        for (size_t sym = 0; sym < max_symbols; sym++) {
-          count_increase[last_used * max_symbols + sym] = 0;
-        }
       }
+    }
 
+    if (best != &forced_split) {
       // Try to avoid introducing WP.
       if (best_split_nowp.Cost() + threshold < base_bits &&
           best_split_nowp.Cost() <= fast_decode_multiplier * best->Cost()) {
@@ -465,6 +541,7 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
                                used_properties, new_sp_range});
     }
   }
+  return true;
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -480,7 +557,9 @@ HWY_EXPORT(FindBestSplit);  // Local function.
 Status ComputeBestTree(TreeSamples &tree_samples, float threshold,
                        const std::vector<ModularMultiplierInfo> &mul_info,
                        StaticPropRange static_prop_range,
-                       float fast_decode_multiplier, Tree *tree) {
+                       float fast_decode_multiplier, Tree *tree,
+                       ThreadPool *pool) {
+  JXL_TRACE_SCOPE("ComputeBestTree");
   // TODO(veluca): take into account that different contexts can have different
   // uint configs.
   //
@@ -494,10 +573,9 @@ Status ComputeBestTree(TreeSamples &tree_samples, float threshold,
 
   JXL_ENSURE(tree_samples.NumDistinctSamples() <=
              std::numeric_limits<uint32_t>::max());
-  HWY_DYNAMIC_DISPATCH(FindBestSplit)
-  (tree_samples, threshold, mul_info, static_prop_range, fast_decode_multiplier,
-   tree);
-  return true;
+  return HWY_DYNAMIC_DISPATCH(FindBestSplit)(
+      tree_samples, threshold, mul_info, static_prop_range,
+      fast_decode_multiplier, tree, pool);
 }
 
 #if JXL_CXX_LANG < JXL_CXX_17
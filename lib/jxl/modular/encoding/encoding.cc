@@ -16,6 +16,7 @@
 #include <utility>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/scope_guard.h"
 #include "lib/jxl/base/status.h"
@@ -139,13 +140,149 @@ FlatTree FilterTree(const Tree &global_tree,
 }
 
 namespace detail {
+
+// Adds the prediction of `predictor`, which must only depend on the row above,
+// to the residuals already decoded into `row`. No pixel of `row` is read, so
+// (unlike the decoding of the residuals) this loop vectorizes.
+template <Predictor predictor>
+void AddTopRowPrediction(const pixel_type *JXL_RESTRICT rtop, size_t w,
+                         pixel_type *JXL_RESTRICT row) {
+  const auto add = [](pixel_type &p, pixel_type_w top, pixel_type_w topleft,
+                      pixel_type_w topright) {
+    p = p + PredictOne(predictor, /*left=*/0, top, /*toptop=*/0, topleft,
+                       topright, /*leftleft=*/0, /*toprightright=*/0,
+                       /*wp_pred=*/0);
+  };
+  if (w == 1) {
+    add(row[0], rtop[0], rtop[0], rtop[0]);
+    return;
+  }
+  add(row[0], rtop[0], rtop[0], rtop[1]);
+  for (size_t x = 1; x + 1 < w; x++) {
+    add(row[x], rtop[x], rtop[x - 1], rtop[x + 1]);
+  }
+  add(row[w - 1], rtop[w - 1], rtop[w - 2], rtop[w - 1]);
+}
+
+// Decodes a channel whose tree is a single leaf, with the predictor known at
+// compile time so that no property is computed and the predictor switch is
+// folded away.
+template <bool uses_lz77, Predictor predictor>
+void DecodeFixedPredictorChannel(BitReader *br, ANSSymbolReader *reader,
+                                 size_t ctx_id, int32_t multiplier,
+                                 int64_t offset, Channel &channel) {
+  constexpr bool kTopRowOnly =
+      predictor == Predictor::Top || predictor == Predictor::TopLeft ||
+      predictor == Predictor::TopRight || predictor == Predictor::Average2 ||
+      predictor == Predictor::Average3;
+  const auto make_pixel = [&](uint64_t v, pixel_type_w guess) -> pixel_type {
+    JXL_DASSERT((v & 0xFFFFFFFF) == v);
+    pixel_type_w val = UnpackSigned(v);
+    // if it overflows, it overflows, and we have a problem anyway
+    return val * multiplier + offset + guess;
+  };
+  const auto decode_pixel = [&](pixel_type *JXL_RESTRICT p, size_t x,
+                                size_t y, bool nec) {
+    const intptr_t onerow = channel.plane.PixelsPerRow();
+    PredictionResult res =
+        nec ? PredictNoTreeNoWPNEC(channel.w, p, onerow, x, y, predictor)
+            : PredictNoTreeNoWP(channel.w, p, onerow, x, y, predictor);
+    uint64_t v =
+        reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(ctx_id, br);
+    *p = make_pixel(v, res.guess);
+  };
+  for (size_t y = 0; y < channel.h; y++) {
+    pixel_type *JXL_RESTRICT r = channel.Row(y);
+    if (kTopRowOnly && y > 0) {
+      for (size_t x = 0; x < channel.w; x++) {
+        uint64_t v =
+            reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(ctx_id, br);
+        r[x] = make_pixel(v, 0);
+      }
+      AddTopRowPrediction<predictor>(channel.Row(y - 1), channel.w, r);
+    } else if (y > 1 && channel.w > 8) {
+      for (size_t x = 0; x < 2; x++) decode_pixel(r + x, x, y, false);
+      for (size_t x = 2; x < channel.w - 2; x++) {
+        decode_pixel(r + x, x, y, true);
+      }
+      for (size_t x = channel.w - 2; x < channel.w; x++) {
+        decode_pixel(r + x, x, y, false);
+      }
+    } else {
+      for (size_t x = 0; x < channel.w; x++) decode_pixel(r + x, x, y, false);
+    }
+  }
+}
+
+// Dispatches to the DecodeFixedPredictorChannel instance for `predictor`.
+// Returns false, without decoding anything, for the weighted predictor.
+template <bool uses_lz77>
+bool DecodeFixedPredictorChannel(BitReader *br, ANSSymbolReader *reader,
+                                 Predictor predictor, size_t ctx_id,
+                                 int32_t multiplier, int64_t offset,
+                                 Channel &channel) {
+#define JXL_FIXED_PREDICTOR_CASE(P)                       \
+  case Predictor::P:                                      \
+    DecodeFixedPredictorChannel<uses_lz77, Predictor::P>( \
+        br, reader, ctx_id, multiplier, offset, channel); \
+    return true;
+  switch (predictor) {
+    JXL_FIXED_PREDICTOR_CASE(Zero)
+    JXL_FIXED_PREDICTOR_CASE(Left)
+    JXL_FIXED_PREDICTOR_CASE(Top)
+    JXL_FIXED_PREDICTOR_CASE(Average0)
+    JXL_FIXED_PREDICTOR_CASE(Select)
+    JXL_FIXED_PREDICTOR_CASE(Gradient)
+    JXL_FIXED_PREDICTOR_CASE(TopRight)
+    JXL_FIXED_PREDICTOR_CASE(TopLeft)
+    JXL_FIXED_PREDICTOR_CASE(LeftLeft)
+    JXL_FIXED_PREDICTOR_CASE(Average1)
+    JXL_FIXED_PREDICTOR_CASE(Average2)
+    JXL_FIXED_PREDICTOR_CASE(Average3)
+    JXL_FIXED_PREDICTOR_CASE(Average4)
+    default:
+      return false;
+  }
+#undef JXL_FIXED_PREDICTOR_CASE
+}
+
+// Decodes a channel whose (filtered) tree only splits on the gradient
+// property and only uses the gradient predictor, replacing the tree walk with
+// a lookup in `tree_lut`.
+template <bool uses_lz77, bool has_offsets>
+void DecodeGradientLutChannel(BitReader *br, ANSSymbolReader *reader,
+                              const TreeLut<uint8_t, true, false> &tree_lut,
+                              Channel &channel) {
+  const intptr_t onerow = channel.plane.PixelsPerRow();
+  for (size_t y = 0; y < channel.h; y++) {
+    pixel_type *JXL_RESTRICT r = channel.Row(y);
+    for (size_t x = 0; x < channel.w; x++) {
+      pixel_type_w left = (x ? r[x - 1] : y ? *(r + x - onerow) : 0);
+      pixel_type_w top = (y ? *(r + x - onerow) : left);
+      pixel_type_w topleft = (x && y ? *(r + x - 1 - onerow) : left);
+      pixel_type_w guess = ClampedGradient(top, left, topleft);
+      uint32_t pos =
+          kPropRangeFast +
+          std::min<pixel_type_w>(
+              std::max<pixel_type_w>(-kPropRangeFast, top + left - topleft),
+              kPropRangeFast - 1);
+      uint32_t ctx_id = tree_lut.context_lookup[pos];
+      if (has_offsets) guess += tree_lut.offsets[pos];
+      uint64_t v =
+          reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(ctx_id, br);
+      JXL_DASSERT((v & 0xFFFFFFFF) == v);
+      r[x] = UnpackSigned(v) + guess;
+    }
+  }
+}
+
 template <bool uses_lz77>
 Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
                                  const std::vector<uint8_t> &context_map,
                                  const Tree &global_tree,
                                  const weighted::Header &wp_header,
                                  pixel_type chan, size_t group_id,
-                                 TreeLut<uint8_t, false, false> &tree_lut,
+                                 TreeLut<uint8_t, true, false> &tree_lut,
                                  Image *image, uint32_t &fl_run,
                                  uint32_t &fl_v) {
   JxlMemoryManager *memory_manager = image->memory_manager();
@@ -196,8 +333,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
       uint32_t value;
       if (reader->IsSingleValueAndAdvance(ctx_id, &value,
                                           channel.w * channel.h)) {
-        // Special-case: histogram has a single symbol, with no extra bits, and
-        // we use ANS mode.
+        // Special-case: histogram has a single symbol, with no extra bits.
         JXL_DEBUG_V(8, "Fastest track.");
         pixel_type v = make_pixel(value, multiplier, offset);
         for (size_t y = 0; y < channel.h; y++) {
@@ -206,7 +342,17 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
         }
       } else {
         JXL_DEBUG_V(8, "Fast track.");
-        if (multiplier == 1 && offset == 0) {
+        if (!uses_lz77 && multiplier == 1 && offset == 0) {
+          for (size_t y = 0; y < channel.h; y++) {
+            pixel_type *JXL_RESTRICT r = channel.Row(y);
+            // The tokens are decoded in place.
+            uint32_t *JXL_RESTRICT v = reinterpret_cast<uint32_t *>(r);
+            reader->ReadHybridUintClusteredRow(ctx_id, br, v, channel.w);
+            for (size_t x = 0; x < channel.w; x++) {
+              r[x] = UnpackSigned(v[x]);
+            }
+          }
+        } else if (multiplier == 1 && offset == 0) {
           for (size_t y = 0; y < channel.h; y++) {
             pixel_type *JXL_RESTRICT r = channel.Row(y);
             for (size_t x = 0; x < channel.w; x++) {
@@ -266,19 +412,35 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
                multiplier == 1) {
       JXL_DEBUG_V(8, "Gradient very fast track.");
       const intptr_t onerow = channel.plane.PixelsPerRow();
+      // Without LZ77, the tokens of a row are decoded before predicting it.
+      std::vector<uint32_t> row_tokens(uses_lz77 ? 0 : channel.w);
       for (size_t y = 0; y < channel.h; y++) {
         pixel_type *JXL_RESTRICT r = channel.Row(y);
+        if (!uses_lz77) {
+          reader->ReadHybridUintClusteredRow(ctx_id, br, row_tokens.data(),
+                                             channel.w);
+        }
         for (size_t x = 0; x < channel.w; x++) {
           pixel_type left = (x ? r[x - 1] : y ? *(r + x - onerow) : 0);
           pixel_type top = (y ? *(r + x - onerow) : left);
           pixel_type topleft = (x && y ? *(r + x - 1 - onerow) : left);
           pixel_type guess = ClampedGradient(top, left, topleft);
-          uint64_t v = reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(
-              ctx_id, br);
+          uint64_t v =
+              uses_lz77
+                  ? reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(
+                        ctx_id, br)
+                  : row_tokens[x];
           r[x] = make_pixel(v, 1, guess);
         }
       }
       return true;
+    } else if (DecodeFixedPredictorChannel<uses_lz77>(
+                   br, reader, predictor, ctx_id, multiplier, offset,
+                   channel)) {
+      // Also reached by trees that only split on the channel and group IDs,
+      // which FilterTree reduces to a single leaf.
+      JXL_DEBUG_V(8, "Fixed predictor fast track.");
+      return true;
     }
   }
 
@@ -291,28 +453,23 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
     is_gradient_only = TreeToLookupTable(tree, tree_lut);
   }
 
+  // The lookup table holds the leaf offsets, but only the gradient track
+  // applies them.
+  const bool tree_has_offsets =
+      std::any_of(tree.begin(), tree.end(), [](const FlatDecisionNode &node) {
+        return node.property0 == -1 && node.predictor_offset != 0;
+      });
+
   if (is_gradient_only) {
     JXL_DEBUG_V(8, "Gradient fast track.");
-    const intptr_t onerow = channel.plane.PixelsPerRow();
-    for (size_t y = 0; y < channel.h; y++) {
-      pixel_type *JXL_RESTRICT r = channel.Row(y);
-      for (size_t x = 0; x < channel.w; x++) {
-        pixel_type_w left = (x ? r[x - 1] : y ? *(r + x - onerow) : 0);
-        pixel_type_w top = (y ? *(r + x - onerow) : left);
-        pixel_type_w topleft = (x && y ? *(r + x - 1 - onerow) : left);
-        int32_t guess = ClampedGradient(top, left, topleft);
-        uint32_t pos =
-            kPropRangeFast +
-            std::min<pixel_type_w>(
-                std::max<pixel_type_w>(-kPropRangeFast, top + left - topleft),
-                kPropRangeFast - 1);
-        uint32_t ctx_id = tree_lut.context_lookup[pos];
-        uint64_t v =
-            reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(ctx_id, br);
-        r[x] = make_pixel(v, 1, guess);
-      }
+    if (tree_has_offsets) {
+      DecodeGradientLutChannel<uses_lz77, /*has_offsets=*/true>(
+          br, reader, tree_lut, channel);
+    } else {
+      DecodeGradientLutChannel<uses_lz77, /*has_offsets=*/false>(
+          br, reader, tree_lut, channel);
     }
-  } else if (!uses_lz77 && is_wp_only && channel.w > 8) {
+  } else if (!uses_lz77 && is_wp_only && !tree_has_offsets && channel.w > 8) {
     JXL_DEBUG_V(8, "WP fast track.");
     weighted::State wp_state(wp_header, channel.w, channel.h);
     Properties properties(1);
@@ -487,7 +644,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
                                  const Tree &global_tree,
                                  const weighted::Header &wp_header,
                                  pixel_type chan, size_t group_id,
-                                 TreeLut<uint8_t, false, false> &tree_lut,
+                                 TreeLut<uint8_t, true, false> &tree_lut,
                                  Image *image, uint32_t &fl_run,
                                  uint32_t &fl_v) {
   if (reader->UsesLZ77()) {
@@ -503,6 +660,32 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
 
 GroupHeader::GroupHeader() { Bundle::Init(this); }
 
+namespace {
+
+// Returns the index after `transform` of the first of the trailing channels
+// that are skipped from `first_skipped` on, or kNoSkippedChannels if the
+// transform uses them.
+size_t FirstSkippedChannel(const Transform &transform, size_t first_skipped) {
+  if (first_skipped == kNoSkippedChannels) return first_skipped;
+  switch (transform.id) {
+    case TransformId::kRCT:
+      if (transform.begin_c + 3 <= first_skipped) return first_skipped;
+      break;
+    case TransformId::kPalette:
+      // The palette is inserted as the first meta-channel, and the index
+      // channel replaces the num_c channels.
+      if (transform.begin_c + transform.num_c <= first_skipped) {
+        return first_skipped + 2 - transform.num_c;
+      }
+      break;
+    default:
+      break;
+  }
+  return kNoSkippedChannels;
+}
+
+}  // namespace
+
 Status ValidateChannelDimensions(const Image &image,
                                  const ModularOptions &options) {
   size_t nb_channels = image.channel.size();
@@ -552,7 +735,9 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
   JXL_DEBUG_V(3, "Image data underwent %" PRIuS " transformations: ",
               header.transforms.size());
   image.transform = header.transforms;
+  size_t first_skipped = options->skip_channels_from;
   for (Transform &transform : image.transform) {
+    first_skipped = FirstSkippedChannel(transform, first_skipped);
     JXL_RETURN_IF_ERROR(transform.MetaApply(image));
   }
   if (image.error) {
@@ -608,6 +793,9 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
       max_tree_size += pixels;
     }
     max_tree_size = std::min(static_cast<uint64_t>(1 << 20), max_tree_size);
+    if (options->max_tree_nodes != 0) {
+      max_tree_size = std::min(options->max_tree_nodes, max_tree_size);
+    }
     JXL_RETURN_IF_ERROR(
         DecodeTree(memory_manager, br, &tree_storage, max_tree_size));
     JXL_RETURN_IF_ERROR(DecodeHistograms(memory_manager, br,
@@ -626,19 +814,26 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
   // Read channels
   JXL_ASSIGN_OR_RETURN(ANSSymbolReader reader,
                        ANSSymbolReader::Create(code, br, distance_multiplier));
-  auto tree_lut = jxl::make_unique<TreeLut<uint8_t, false, false>>();
+  auto tree_lut = jxl::make_unique<TreeLut<uint8_t, true, false>>();
   uint32_t fl_run = 0;
   uint32_t fl_v = 0;
+  bool skipped = false;
   for (; next_channel < nb_channels; next_channel++) {
     Channel &channel = image.channel[next_channel];
     if (!channel.w || !channel.h) {
       continue;  // skip empty channels
     }
+    if (next_channel >= first_skipped) {
+      // The remaining tokens of the stream are not needed.
+      skipped = true;
+      break;
+    }
     if (next_channel >= image.nb_meta_channels &&
         (channel.w > options->max_chan_size ||
          channel.h > options->max_chan_size)) {
       break;
     }
+    JXL_RETURN_IF_ERROR(channel.EnsureAllocated());
     JXL_RETURN_IF_ERROR(DecodeModularChannelMAANS(
         br, &reader, *context_map, *tree, header.wp_header, next_channel,
         group_id, *tree_lut, &image, fl_run, fl_v));
@@ -653,6 +848,14 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
   // Make sure no zero-filling happens even if next_channel < nb_channels.
   scope_guard.Disarm();
 
+  if (skipped) {
+    for (; next_channel < nb_channels; next_channel++) {
+      Channel &channel = image.channel[next_channel];
+      JXL_RETURN_IF_ERROR(channel.EnsureAllocated());
+      ZeroFillImage(&channel.plane);
+    }
+    return true;
+  }
   if (!reader.CheckANSFinalState()) {
     return JXL_FAILURE("ANS decode final state failed");
   }
@@ -664,7 +867,7 @@ Status ModularGenericDecompress(BitReader *br, Image &image,
                                 ModularOptions *options, bool undo_transforms,
                                 const Tree *tree, const ANSCode *code,
                                 const std::vector<uint8_t> *ctx_map,
-                                bool allow_truncated_group) {
+                                bool allow_truncated_group, ThreadPool *pool) {
   std::vector<std::pair<uint32_t, uint32_t>> req_sizes;
   req_sizes.reserve(image.channel.size());
   for (const auto &c : image.channel) {
@@ -677,7 +880,7 @@ Status ModularGenericDecompress(BitReader *br, Image &image,
                                   code, ctx_map, allow_truncated_group);
   if (!allow_truncated_group) JXL_RETURN_IF_ERROR(dec_status);
   if (dec_status.IsFatalError()) return dec_status;
-  if (undo_transforms) image.undo_transforms(header->wp_header);
+  if (undo_transforms) image.undo_transforms(header->wp_header, pool);
   if (image.error) return JXL_FAILURE("Corrupt file. Aborting.");
   JXL_DEBUG_V(4,
               "Modular-decoded a %" PRIuS "x%" PRIuS " nbchans=%" PRIuS
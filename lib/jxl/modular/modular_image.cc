@@ -7,6 +7,10 @@
 
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
 #if JXL_DEBUG_V_LEVEL >= 1
 #include <sstream>
 #endif
@@ -17,6 +21,63 @@
 
 namespace jxl {
 
+namespace {
+
+bool RowFitsInt16(const pixel_type* JXL_RESTRICT row, size_t xsize) {
+  pixel_type min = 0;
+  pixel_type max = 0;
+  for (size_t x = 0; x < xsize; x++) {
+    min = std::min(min, row[x]);
+    max = std::max(max, row[x]);
+  }
+  return min >= std::numeric_limits<int16_t>::min() &&
+         max <= std::numeric_limits<int16_t>::max();
+}
+
+}  // namespace
+
+Status Channel::Compact() {
+  if (compact() || plane.xsize() == 0 || plane.ysize() == 0) return true;
+  for (size_t y = 0; y < plane.ysize(); y++) {
+    if (!RowFitsInt16(plane.ConstRow(y), plane.xsize())) return true;
+  }
+  JXL_ASSIGN_OR_RETURN(compact_plane,
+                       Plane<int16_t>::Create(memory_manager_, plane.xsize(),
+                                              plane.ysize()));
+  for (size_t y = 0; y < plane.ysize(); y++) {
+    const pixel_type* JXL_RESTRICT row_in = plane.ConstRow(y);
+    int16_t* JXL_RESTRICT row_out = compact_plane.Row(y);
+    for (size_t x = 0; x < plane.xsize(); x++) {
+      row_out[x] = static_cast<int16_t>(row_in[x]);
+    }
+  }
+  plane = Plane<pixel_type>();
+  return true;
+}
+
+Status Channel::Expand() {
+  if (!compact()) return true;
+  JXL_ASSIGN_OR_RETURN(
+      plane, Plane<pixel_type>::Create(memory_manager_, compact_plane.xsize(),
+                                       compact_plane.ysize()));
+  for (size_t y = 0; y < plane.ysize(); y++) {
+    const int16_t* JXL_RESTRICT row_in = compact_plane.ConstRow(y);
+    pixel_type* JXL_RESTRICT row_out = plane.Row(y);
+    for (size_t x = 0; x < plane.xsize(); x++) {
+      row_out[x] = row_in[x];
+    }
+  }
+  compact_plane = Plane<int16_t>();
+  return true;
+}
+
+Status Channel::AllocateCompact() {
+  plane = Plane<pixel_type>();
+  JXL_ASSIGN_OR_RETURN(compact_plane,
+                       Plane<int16_t>::Create(memory_manager_, w, h));
+  return true;
+}
+
 void Image::undo_transforms(const weighted::Header &wp_header,
                             jxl::ThreadPool *pool) {
   while (!transform.empty()) {
@@ -78,6 +139,14 @@ StatusOr<Image> Image::Clone(const Image &that) {
   clone.error = that.error;
   clone.transform = that.transform;
   for (const Channel &ch : that.channel) {
+    if (ch.compact()) {
+      Channel a = Channel::CreateUnallocated(memory_manager, ch.w, ch.h,
+                                             ch.hshift, ch.vshift);
+      JXL_RETURN_IF_ERROR(a.AllocateCompact());
+      JXL_RETURN_IF_ERROR(CopyImageTo(ch.compact_plane, &a.compact_plane));
+      clone.channel.push_back(std::move(a));
+      continue;
+    }
     JXL_ASSIGN_OR_RETURN(Channel a, Channel::Create(memory_manager, ch.w, ch.h,
                                                     ch.hshift, ch.vshift));
     JXL_RETURN_IF_ERROR(CopyImageTo(ch.plane, &a.plane));
@@ -22,8 +22,9 @@
 
 namespace jxl {
 
-typedef int32_t pixel_type;  // can use int16_t if it's only for 8-bit images.
-                             // Need some wiggle room for YCoCg / Squeeze etc
+typedef int32_t pixel_type;  // Need some wiggle room for YCoCg / Squeeze etc.
+                             // Channels at rest can use 16-bit storage, see
+                             // Channel::Compact().
 
 typedef int64_t pixel_type_w;
 
@@ -34,6 +35,9 @@ struct Header;
 class Channel {
  public:
   jxl::Plane<pixel_type> plane;
+  // Storage of a compact channel, in which case `plane` is not allocated and
+  // Row() cannot be used; see Compact().
+  jxl::Plane<int16_t> compact_plane;
   size_t w, h;
   int hshift, vshift;  // w ~= image.w >> hshift;  h ~= image.h >> vshift
   Channel(const Channel& other) = delete;
@@ -43,7 +47,14 @@ class Channel {
                                   size_t ih, int hsh = 0, int vsh = 0) {
     JXL_ASSIGN_OR_RETURN(Plane<pixel_type> plane,
                          Plane<pixel_type>::Create(memory_manager, iw, ih));
-    return Channel(std::move(plane), iw, ih, hsh, vsh);
+    return Channel(memory_manager, std::move(plane), iw, ih, hsh, vsh);
+  }
+
+  // Creates a channel without a plane; it is allocated by the first call to
+  // EnsureAllocated() or shrink().
+  static Channel CreateUnallocated(JxlMemoryManager* memory_manager, size_t iw,
+                                   size_t ih, int hsh = 0, int vsh = 0) {
+    return Channel(memory_manager, Plane<pixel_type>(), iw, ih, hsh, vsh);
   }
 
   // Move assignment
@@ -52,17 +63,20 @@ class Channel {
     h = other.h;
     hshift = other.hshift;
     vshift = other.vshift;
+    memory_manager_ = other.memory_manager_;
     plane = std::move(other.plane);
+    compact_plane = std::move(other.compact_plane);
     return *this;
   }
 
   // Move constructor
   Channel(Channel&& other) noexcept = default;
 
-  JxlMemoryManager* memory_manager() const { return plane.memory_manager(); };
+  JxlMemoryManager* memory_manager() const { return memory_manager_; };
 
   Status shrink() {
     if (plane.xsize() == w && plane.ysize() == h) return true;
+    compact_plane = Plane<int16_t>();
     JXL_ASSIGN_OR_RETURN(plane,
                          Plane<pixel_type>::Create(memory_manager(), w, h));
     return true;
@@ -72,6 +86,18 @@ class Channel {
     h = nh;
     return shrink();
   }
+  Status EnsureAllocated() { return shrink(); }
+
+  // A compact channel stores its values as int16_t, which halves the memory
+  // of 8 to 14-bit channels that are kept between the processing steps.
+  bool compact() const { return compact_plane.xsize() != 0; }
+  // Switches to 16-bit storage if all the values fit; otherwise, or if the
+  // plane is not allocated, the channel is left as is.
+  Status Compact();
+  // Restores the 32-bit plane of a compact channel.
+  Status Expand();
+  // Allocates the 16-bit storage, without initializing it.
+  Status AllocateCompact();
 
   JXL_INLINE pixel_type* Row(const size_t y) { return plane.Row(y); }
   JXL_INLINE const pixel_type* Row(const size_t y) const {
@@ -79,8 +105,15 @@ class Channel {
   }
 
  private:
-  Channel(jxl::Plane<pixel_type>&& p, size_t iw, size_t ih, int hsh, int vsh)
-      : plane(std::move(p)), w(iw), h(ih), hshift(hsh), vshift(vsh) {}
+  Channel(JxlMemoryManager* memory_manager, jxl::Plane<pixel_type>&& p,
+          size_t iw, size_t ih, int hsh, int vsh)
+      : plane(std::move(p)),
+        w(iw),
+        h(ih),
+        hshift(hsh),
+        vshift(vsh),
+        memory_manager_(memory_manager) {}
+  JxlMemoryManager* memory_manager_;
 };
 
 class Transform;
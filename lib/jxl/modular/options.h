@@ -56,6 +56,8 @@ struct ModularMultiplierInfo {
   uint32_t multiplier;
 };
 
+constexpr size_t kNoSkippedChannels = ~static_cast<size_t>(0);
+
 struct ModularOptions {
   /// Used in both encode and decode:
 
@@ -66,6 +68,15 @@ struct ModularOptions {
   // Used during decoding for validation of transforms (sqeeezing) scheme.
   size_t group_dim = 0x1FFFFFFF;
 
+  // Used during decoding: if not 0, limits the number of nodes of local MA
+  // trees on top of the limit derived from the channel sizes.
+  uint64_t max_tree_nodes = 0;
+
+  // Used during decoding: the channels from this index on, before the
+  // transforms, are zero-filled instead of decoded if no transform of the
+  // stream uses them.
+  size_t skip_channels_from = kNoSkippedChannels;
+
   /// Encode options:
   // Fraction of pixels to look at to learn a MA tree
   // Number of iterations to do to learn a MA tree
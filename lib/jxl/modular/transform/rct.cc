@@ -85,12 +85,28 @@ void InvRCTRow(const pixel_type* in0, const pixel_type* in1,
   }
 }
 
+void InvRCTImageRow(Image& input, size_t begin_c, size_t rct_type, size_t y) {
+  size_t m = begin_c;
+  int permutation = rct_type / 7;
+  int custom = rct_type % 7;
+  constexpr decltype(&InvRCTRow<0>) inv_rct_row[] = {
+      InvRCTRow<0>, InvRCTRow<1>, InvRCTRow<2>, InvRCTRow<3>,
+      InvRCTRow<4>, InvRCTRow<5>, InvRCTRow<6>};
+  const pixel_type* in0 = input.channel[m].Row(y);
+  const pixel_type* in1 = input.channel[m + 1].Row(y);
+  const pixel_type* in2 = input.channel[m + 2].Row(y);
+  pixel_type* out0 = input.channel[m + (permutation % 3)].Row(y);
+  pixel_type* out1 =
+      input.channel[m + ((permutation + 1 + permutation / 3) % 3)].Row(y);
+  pixel_type* out2 =
+      input.channel[m + ((permutation + 2 - permutation / 3) % 3)].Row(y);
+  inv_rct_row[custom](in0, in1, in2, out0, out1, out2, input.channel[m].w);
+}
+
 Status InvRCT(Image& input, size_t begin_c, size_t rct_type, ThreadPool* pool) {
   JXL_RETURN_IF_ERROR(CheckEqualChannels(input, begin_c, begin_c + 2));
   size_t m = begin_c;
-  Channel& c0 = input.channel[m + 0];
-  size_t w = c0.w;
-  size_t h = c0.h;
+  size_t h = input.channel[m].h;
   if (rct_type == 0) {  // noop
     return true;
   }
@@ -116,21 +132,9 @@ Status InvRCT(Image& input, size_t begin_c, size_t rct_type, ThreadPool* pool) {
         std::move(ch2);
     return true;
   }
-  constexpr decltype(&InvRCTRow<0>) inv_rct_row[] = {
-      InvRCTRow<0>, InvRCTRow<1>, InvRCTRow<2>, InvRCTRow<3>,
-      InvRCTRow<4>, InvRCTRow<5>, InvRCTRow<6>};
   const auto process_row = [&](const uint32_t task,
                                size_t /* thread */) -> Status {
-    const size_t y = task;
-    const pixel_type* in0 = input.channel[m].Row(y);
-    const pixel_type* in1 = input.channel[m + 1].Row(y);
-    const pixel_type* in2 = input.channel[m + 2].Row(y);
-    pixel_type* out0 = input.channel[m + (permutation % 3)].Row(y);
-    pixel_type* out1 =
-        input.channel[m + ((permutation + 1 + permutation / 3) % 3)].Row(y);
-    pixel_type* out2 =
-        input.channel[m + ((permutation + 2 - permutation / 3) % 3)].Row(y);
-    inv_rct_row[custom](in0, in1, in2, out0, out1, out2, w);
+    HWY_NAMESPACE::InvRCTImageRow(input, begin_c, rct_type, task);
     return true;
   };
   JXL_RETURN_IF_ERROR(
@@ -150,5 +154,10 @@ Status InvRCT(Image& input, size_t begin_c, size_t rct_type, ThreadPool* pool) {
   return HWY_DYNAMIC_DISPATCH(InvRCT)(input, begin_c, rct_type, pool);
 }
 
+HWY_EXPORT(InvRCTImageRow);
+void InvRCTImageRow(Image& input, size_t begin_c, size_t rct_type, size_t y) {
+  HWY_DYNAMIC_DISPATCH(InvRCTImageRow)(input, begin_c, rct_type, y);
+}
+
 }  // namespace jxl
 #endif
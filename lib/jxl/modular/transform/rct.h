@@ -14,6 +14,12 @@ namespace jxl {
 
 Status InvRCT(Image& input, size_t begin_c, size_t rct_type, ThreadPool* pool);
 
+// Undoes RCT `rct_type` on row `y` of the channels `begin_c` to `begin_c + 2`
+// of `input`, in place, so that the inverse RCT can be fused into another
+// row-wise pass. The channels must have the same size, and all rows must be
+// processed before the channels are used in any other way.
+void InvRCTImageRow(Image& input, size_t begin_c, size_t rct_type, size_t y);
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_MODULAR_TRANSFORM_RCT_H_
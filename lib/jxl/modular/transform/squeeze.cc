@@ -101,7 +101,56 @@ JXL_INLINE void FastUnsqueeze(const pixel_type *JXL_RESTRICT p_residual,
 
 #endif
 
-Status InvHSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
+// Storage of a channel that is unsqueezed several times. Outputs are
+// allocated with the final size of the channel, so that the plane of the
+// previous level can be reused for the next output instead of allocating a
+// bigger plane at every level.
+struct SqueezeStorage {
+  size_t final_w = 0;
+  size_t final_h = 0;
+  // Index of the squeeze step that unsqueezes this channel last (the lowest
+  // one, since steps are undone in reverse order); -1 if the channel is
+  // unsqueezed at most once, in which case no storage is reused.
+  int last_step = -1;
+  Plane<pixel_type> spare;
+};
+
+StatusOr<Channel> CreateUnsqueezedChannel(JxlMemoryManager *memory_manager,
+                                          size_t w, size_t h, int hshift,
+                                          int vshift,
+                                          SqueezeStorage *storage) {
+  if (storage == nullptr || w > storage->final_w || h > storage->final_h) {
+    return Channel::Create(memory_manager, w, h, hshift, vshift);
+  }
+  JXL_ASSIGN_OR_RETURN(Channel out,
+                       Channel::Create(memory_manager, 0, 0, hshift, vshift));
+  if (storage->spare.CanShrinkTo(w, h)) {
+    out.plane = std::move(storage->spare);
+  } else {
+    JXL_ASSIGN_OR_RETURN(out.plane,
+                         Plane<pixel_type>::Create(memory_manager,
+                                                   storage->final_w,
+                                                   storage->final_h));
+  }
+  JXL_RETURN_IF_ERROR(out.plane.ShrinkTo(w, h));
+  out.w = w;
+  out.h = h;
+  return out;
+}
+
+// Replaces channel `c` with `chout`, keeping the plane of the input in
+// `storage` if it can hold a later output.
+void ReplaceUnsqueezedChannel(Image &input, uint32_t c, Channel &&chout,
+                              SqueezeStorage *storage) {
+  if (storage != nullptr &&
+      input.channel[c].plane.CanShrinkTo(storage->final_w, storage->final_h)) {
+    storage->spare = std::move(input.channel[c].plane);
+  }
+  input.channel[c] = std::move(chout);
+}
+
+Status InvHSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool,
+                   SqueezeStorage *storage) {
   JXL_ENSURE(c < input.channel.size());
   JXL_ENSURE(rc < input.channel.size());
   Channel &chin = input.channel[c];
@@ -118,9 +167,10 @@ Status InvHSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
   }
 
   // Note: chin.w >= chin_residual.w and at most 1 different.
-  JXL_ASSIGN_OR_RETURN(Channel chout,
-                       Channel::Create(memory_manager, chin.w + chin_residual.w,
-                                       chin.h, chin.hshift - 1, chin.vshift));
+  JXL_ASSIGN_OR_RETURN(
+      Channel chout,
+      CreateUnsqueezedChannel(memory_manager, chin.w + chin_residual.w, chin.h,
+                              chin.hshift - 1, chin.vshift, storage));
   JXL_DEBUG_V(4,
               "Undoing horizontal squeeze of channel %i using residuals in "
               "channel %i (going from width %" PRIuS " to %" PRIuS ")",
@@ -128,7 +178,7 @@ Status InvHSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
 
   if (chin_residual.h == 0) {
     // Short-circuit: channel with no pixels.
-    input.channel[c] = std::move(chout);
+    ReplaceUnsqueezedChannel(input, c, std::move(chout), storage);
     return true;
   }
   auto unsqueeze_row = [&](size_t y, size_t x0) {
@@ -211,11 +261,12 @@ Status InvHSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, DivCeil(chin.h, kRowsPerThread),
                                 ThreadPool::NoInit, unsqueeze_span,
                                 "InvHorizontalSqueeze"));
-  input.channel[c] = std::move(chout);
+  ReplaceUnsqueezedChannel(input, c, std::move(chout), storage);
   return true;
 }
 
-Status InvVSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
+Status InvVSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool,
+                   SqueezeStorage *storage) {
   JXL_ENSURE(c < input.channel.size());
   JXL_ENSURE(rc < input.channel.size());
   const Channel &chin = input.channel[c];
@@ -234,8 +285,8 @@ Status InvVSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
   // Note: chin.h >= chin_residual.h and at most 1 different.
   JXL_ASSIGN_OR_RETURN(
       Channel chout,
-      Channel::Create(memory_manager, chin.w, chin.h + chin_residual.h,
-                      chin.hshift, chin.vshift - 1));
+      CreateUnsqueezedChannel(memory_manager, chin.w, chin.h + chin_residual.h,
+                              chin.hshift, chin.vshift - 1, storage));
   JXL_DEBUG_V(
       4,
       "Undoing vertical squeeze of channel %i using residuals in channel "
@@ -244,7 +295,7 @@ Status InvVSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
 
   if (chin_residual.w == 0) {
     // Short-circuit: channel with no pixels.
-    input.channel[c] = std::move(chout);
+    ReplaceUnsqueezedChannel(input, c, std::move(chout), storage);
     return true;
   }
 
@@ -301,12 +352,62 @@ Status InvVSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
       p_out[x] = p_avg[x];
     }
   }
-  input.channel[c] = std::move(chout);
+  ReplaceUnsqueezedChannel(input, c, std::move(chout), storage);
+  return true;
+}
+
+// Computes the final size of each channel that is unsqueezed more than once,
+// and which squeeze step unsqueezes it last. `ids` is updated like the
+// channel list, so that it maps channel indices to `storage` entries.
+Status PlanSqueezeStorage(const Image &input,
+                          const std::vector<SqueezeParams> &parameters,
+                          std::vector<size_t> *ids,
+                          std::vector<SqueezeStorage> *storage) {
+  std::vector<size_t> num_steps(input.channel.size());
+  ids->resize(input.channel.size());
+  storage->resize(input.channel.size());
+  for (size_t i = 0; i < input.channel.size(); i++) {
+    (*ids)[i] = i;
+    (*storage)[i].final_w = input.channel[i].w;
+    (*storage)[i].final_h = input.channel[i].h;
+  }
+  std::vector<size_t> sim_ids = *ids;
+  for (int i = parameters.size() - 1; i >= 0; i--) {
+    JXL_RETURN_IF_ERROR(
+        CheckMetaSqueezeParams(parameters[i], sim_ids.size()));
+    uint32_t beginc = parameters[i].begin_c;
+    uint32_t endc = parameters[i].begin_c + parameters[i].num_c - 1;
+    uint32_t offset = parameters[i].in_place
+                          ? endc + 1
+                          : sim_ids.size() + beginc - endc - 1;
+    for (uint32_t c = beginc; c <= endc; c++) {
+      uint32_t rc = offset + c - beginc;
+      if (rc >= sim_ids.size()) return JXL_FAILURE("Invalid squeeze");
+      SqueezeStorage &st = (*storage)[sim_ids[c]];
+      const SqueezeStorage &residual = (*storage)[sim_ids[rc]];
+      if (parameters[i].horizontal) {
+        st.final_w += residual.final_w;
+      } else {
+        st.final_h += residual.final_h;
+      }
+      st.last_step = i;
+      num_steps[sim_ids[c]]++;
+    }
+    sim_ids.erase(sim_ids.begin() + offset,
+                  sim_ids.begin() + offset + (endc - beginc + 1));
+  }
+  // Channels unsqueezed only once keep their exact size.
+  for (size_t i = 0; i < storage->size(); i++) {
+    if (num_steps[i] < 2) (*storage)[i].last_step = -1;
+  }
   return true;
 }
 
 Status InvSqueeze(Image &input, const std::vector<SqueezeParams> &parameters,
                   ThreadPool *pool) {
+  std::vector<size_t> ids;
+  std::vector<SqueezeStorage> storage;
+  JXL_RETURN_IF_ERROR(PlanSqueezeStorage(input, parameters, &ids, &storage));
   for (int i = parameters.size() - 1; i >= 0; i--) {
     JXL_RETURN_IF_ERROR(
         CheckMetaSqueezeParams(parameters[i], input.channel.size()));
@@ -335,14 +436,19 @@ Status InvSqueeze(Image &input, const std::vector<SqueezeParams> &parameters,
           (input.channel[c].h < input.channel[rc].h)) {
         return JXL_FAILURE("Corrupted squeeze transform");
       }
+      SqueezeStorage *st = &storage[ids[c]];
+      if (st->last_step == -1) st = nullptr;
       if (horizontal) {
-        JXL_RETURN_IF_ERROR(InvHSqueeze(input, c, rc, pool));
+        JXL_RETURN_IF_ERROR(InvHSqueeze(input, c, rc, pool, st));
       } else {
-        JXL_RETURN_IF_ERROR(InvVSqueeze(input, c, rc, pool));
+        JXL_RETURN_IF_ERROR(InvVSqueeze(input, c, rc, pool, st));
       }
+      if (st != nullptr && st->last_step == i) st->spare = Plane<pixel_type>();
     }
     input.channel.erase(input.channel.begin() + offset,
                         input.channel.begin() + offset + (endc - beginc + 1));
+    ids.erase(ids.begin() + offset,
+              ids.begin() + offset + (endc - beginc + 1));
   }
   return true;
 }
@@ -0,0 +1,129 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/memory_manager.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/modular/encoding/context_predict.h"
+#include "lib/jxl/modular/encoding/enc_encoding.h"
+#include "lib/jxl/modular/encoding/encoding.h"
+#include "lib/jxl/modular/modular_image.h"
+#include "lib/jxl/modular/options.h"
+#include "tools/no_memory_manager.h"
+
+namespace jxl {
+namespace {
+
+#define QUIT(M)           \
+  state.SkipWithError(M); \
+  return;
+
+#define BM_CHECK(C) \
+  if (!(C)) {       \
+    QUIT(#C)        \
+  }
+
+// Tree shapes that the modular decoder has dedicated tracks for, and the
+// generic case.
+enum class TreeShape {
+  kSingleLeafGradient,
+  kSingleLeafTop,
+  kGradientOnly,
+  kWPOnly,
+  kLearned,
+};
+
+void BM_ModularDecode(benchmark::State& state, TreeShape shape) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  const size_t kNumIter = 5;
+  size_t xsize = state.range();
+  size_t ysize = state.range();
+
+  JXL_ASSIGN_OR_QUIT(Image image,
+                     Image::Create(memory_manager, xsize, ysize,
+                                   /*bitdepth=*/8, 3),
+                     "Failed to allocate image.");
+  Rng rng(0);
+  for (size_t c = 0; c < image.channel.size(); c++) {
+    for (size_t y = 0; y < ysize; y++) {
+      pixel_type* JXL_RESTRICT row = image.channel[c].Row(y);
+      for (size_t x = 0; x < xsize; x++) {
+        row[x] = ((x + y) / (c + 1) + rng.UniformU(0, 8)) & 0xFF;
+      }
+    }
+  }
+
+  ModularOptions options;
+  switch (shape) {
+    case TreeShape::kSingleLeafGradient:
+      options.predictor = Predictor::Gradient;
+      options.splitting_heuristics_properties = {0};
+      break;
+    case TreeShape::kSingleLeafTop:
+      options.predictor = Predictor::Top;
+      options.splitting_heuristics_properties = {0};
+      break;
+    case TreeShape::kGradientOnly:
+      options.predictor = Predictor::Gradient;
+      options.splitting_heuristics_properties = {0, kGradientProp};
+      break;
+    case TreeShape::kWPOnly:
+      options.predictor = Predictor::Weighted;
+      options.splitting_heuristics_properties = {0, kWPProp};
+      break;
+    case TreeShape::kLearned:
+      options.predictor = Predictor::Gradient;
+      break;
+  }
+  BitWriter writer{memory_manager};
+  BM_CHECK(ModularGenericCompress(image, options, &writer));
+  writer.ZeroPadToByte();
+
+  JXL_ASSIGN_OR_QUIT(Image decoded,
+                     Image::Create(memory_manager, xsize, ysize,
+                                   /*bitdepth=*/8, 3),
+                     "Failed to allocate image.");
+  for (auto _ : state) {
+    (void)_;
+    for (size_t i = 0; i < kNumIter; ++i) {
+      BitReader reader(writer.GetSpan());
+      Status status = ModularGenericDecompress(
+          &reader, decoded, /*header=*/nullptr, /*group_id=*/0, &options);
+      BM_CHECK(reader.Close() && status);
+    }
+  }
+
+  // Pixels per second.
+  state.SetItemsProcessed(kNumIter * state.iterations() * xsize * ysize *
+                          image.channel.size());
+}
+
+BENCHMARK_CAPTURE(BM_ModularDecode, SingleLeafGradient,
+                  TreeShape::kSingleLeafGradient)
+    ->RangeMultiplier(2)
+    ->Range(256, 1024);
+BENCHMARK_CAPTURE(BM_ModularDecode, SingleLeafTop, TreeShape::kSingleLeafTop)
+    ->RangeMultiplier(2)
+    ->Range(256, 1024);
+BENCHMARK_CAPTURE(BM_ModularDecode, GradientOnly, TreeShape::kGradientOnly)
+    ->RangeMultiplier(2)
+    ->Range(256, 1024);
+BENCHMARK_CAPTURE(BM_ModularDecode, WPOnly, TreeShape::kWPOnly)
+    ->RangeMultiplier(2)
+    ->Range(256, 1024);
+BENCHMARK_CAPTURE(BM_ModularDecode, Learned, TreeShape::kLearned)
+    ->RangeMultiplier(2)
+    ->Range(256, 1024);
+
+}  // namespace
+}  // namespace jxl
@@ -94,6 +94,30 @@ JXL_TSAN_SLOW_TEST(ModularTest, RoundtripLosslessGroups1024) {
   TestLosslessGroups(3);
 }
 
+TEST(ModularTest, LearnedTreeDoesNotDependOnThreads) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+  ASSERT_TRUE(t.SetDimensions(t.ppf().xsize() / 4, t.ppf().ysize() / 4));
+
+  extras::JXLCompressParams cparams;
+  cparams.distance = 0.0f;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, 9);
+  extras::JXLDecompressParams dparams;
+  dparams.accepted_formats = {{3, JXL_TYPE_UINT16, JXL_LITTLE_ENDIAN, 0}};
+
+  extras::PackedPixelFile ppf_serial;
+  size_t serial_size =
+      Roundtrip(t.ppf(), cparams, dparams, nullptr, &ppf_serial);
+  test::ThreadPoolForTests pool(8);
+  extras::PackedPixelFile ppf_parallel;
+  size_t parallel_size =
+      Roundtrip(t.ppf(), cparams, dparams, pool.get(), &ppf_parallel);
+  EXPECT_EQ(serial_size, parallel_size);
+  EXPECT_EQ(0.0f, test::ComputeDistance2(t.ppf(), ppf_parallel));
+}
+
 TEST(ModularTest, RoundtripLosslessCustomWpPermuteRCT) {
   const std::vector<uint8_t> orig =
       ReadTestData("external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
@@ -273,6 +297,65 @@ TEST(ModularTest, RoundtripExtraProperties) {
   }
 }
 
+TEST(ModularTest, RoundtripFixedPredictors) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  // Sizes that exercise the edge cases (single column, first rows) as well
+  // as the paths that skip them.
+  const std::pair<size_t, size_t> kSizes[] = {{1, 7}, {3, 5}, {37, 23}};
+  for (size_t i = 0; i < kNumModularPredictors; i++) {
+    for (const auto& size : kSizes) {
+      const size_t xsize = size.first;
+      const size_t ysize = size.second;
+      JXL_TEST_ASSIGN_OR_DIE(Image image,
+                             Image::Create(memory_manager, xsize, ysize,
+                                           /*bitdepth=*/8, 3));
+      ModularOptions options;
+      options.predictor = static_cast<Predictor>(i);
+      // Only split on the channel, so that the tree of each channel is a
+      // single leaf.
+      options.splitting_heuristics_properties = {0};
+      Rng rng(i);
+      for (size_t c = 0; c < image.channel.size(); c++) {
+        for (size_t y = 0; y < ysize; y++) {
+          for (size_t x = 0; x < xsize; x++) {
+            image.channel[c].plane.Row(y)[x] =
+                (x * (c + 1) + y * 3 + rng.UniformU(0, 40)) & 0xFF;
+          }
+        }
+      }
+      BitWriter writer{memory_manager};
+      ASSERT_TRUE(ModularGenericCompress(image, options, &writer));
+      writer.ZeroPadToByte();
+      JXL_TEST_ASSIGN_OR_DIE(
+          Image decoded, Image::Create(memory_manager, xsize, ysize,
+                                       /*bitdepth=*/8, image.channel.size()));
+      for (size_t c = 0; c < image.channel.size(); c++) {
+        JXL_TEST_ASSIGN_OR_DIE(decoded.channel[c],
+                               Channel::Create(memory_manager, xsize, ysize));
+      }
+      Status status = true;
+      {
+        BitReader reader(writer.GetSpan());
+        BitReaderScopedCloser closer(reader, status);
+        ASSERT_TRUE(ModularGenericDecompress(&reader, decoded,
+                                             /*header=*/nullptr,
+                                             /*group_id=*/0, &options));
+      }
+      ASSERT_TRUE(status);
+      for (size_t c = 0; c < image.channel.size(); c++) {
+        for (size_t y = 0; y < ysize; y++) {
+          for (size_t x = 0; x < xsize; x++) {
+            ASSERT_EQ(image.channel[c].plane.Row(y)[x],
+                      decoded.channel[c].plane.Row(y)[x])
+                << "predictor = " << i << ", c = " << c << ", x = " << x
+                << ", y = " << y;
+          }
+        }
+      }
+    }
+  }
+}
+
 struct RoundtripLosslessConfig {
   int bitdepth;
   int responsive;
@@ -468,6 +551,31 @@ void WriteHistograms(BitWriter* writer) {
   writer->Write(32, 0x10003);  // all bit lengths 8
 }
 
+TEST(ModularTest, CompactChannel) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  JXL_TEST_ASSIGN_OR_DIE(Channel ch, Channel::Create(memory_manager, 5, 3));
+  for (size_t y = 0; y < ch.h; y++) {
+    for (size_t x = 0; x < ch.w; x++) {
+      ch.Row(y)[x] = static_cast<int>(x + 1) * (y % 2 ? -6553 : 6553);
+    }
+  }
+  ASSERT_TRUE(ch.Compact());
+  ASSERT_TRUE(ch.compact());
+  EXPECT_EQ(0, ch.plane.xsize());
+  ASSERT_TRUE(ch.Expand());
+  ASSERT_FALSE(ch.compact());
+  for (size_t y = 0; y < ch.h; y++) {
+    for (size_t x = 0; x < ch.w; x++) {
+      EXPECT_EQ(static_cast<int>(x + 1) * (y % 2 ? -6553 : 6553), ch.Row(y)[x]);
+    }
+  }
+  // Kept as 32-bit when a value does not fit.
+  ch.Row(2)[4] = 32768;
+  ASSERT_TRUE(ch.Compact());
+  EXPECT_FALSE(ch.compact());
+  EXPECT_EQ(32768, ch.Row(2)[4]);
+}
+
 TEST(ModularTest, PredictorIntegerOverflow) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
   const size_t xsize = 1;
@@ -14,6 +14,20 @@
 
 namespace jxl {
 
+namespace {
+
+// The decoder reuses the storage of the previous frame (or image) when it is
+// large enough, since none of these images carry information between frames.
+template <typename ImageT>
+Status AllocateImage(JxlMemoryManager* memory_manager, size_t xsize,
+                     size_t ysize, bool reuse, ImageT* image) {
+  if (reuse) return ReuseOrCreate(memory_manager, xsize, ysize, image);
+  JXL_ASSIGN_OR_RETURN(*image, ImageT::Create(memory_manager, xsize, ysize));
+  return true;
+}
+
+}  // namespace
+
 Status InitializePassesSharedState(const FrameHeader& frame_header,
                                    PassesSharedState* JXL_RESTRICT shared,
                                    bool encoder) {
@@ -25,16 +39,16 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
   const FrameDimensions& frame_dim = shared->frame_dim;
   JxlMemoryManager* memory_manager = shared->memory_manager;
 
-  JXL_ASSIGN_OR_RETURN(
-      shared->ac_strategy,
-      AcStrategyImage::Create(memory_manager, frame_dim.xsize_blocks,
-                              frame_dim.ysize_blocks));
-  JXL_ASSIGN_OR_RETURN(shared->raw_quant_field,
-                       ImageI::Create(memory_manager, frame_dim.xsize_blocks,
-                                      frame_dim.ysize_blocks));
-  JXL_ASSIGN_OR_RETURN(shared->epf_sharpness,
-                       ImageB::Create(memory_manager, frame_dim.xsize_blocks,
-                                      frame_dim.ysize_blocks));
+  const bool reuse = !encoder;
+  JXL_RETURN_IF_ERROR(AllocateImage(memory_manager, frame_dim.xsize_blocks,
+                                    frame_dim.ysize_blocks, reuse,
+                                    &shared->ac_strategy));
+  JXL_RETURN_IF_ERROR(AllocateImage(memory_manager, frame_dim.xsize_blocks,
+                                    frame_dim.ysize_blocks, reuse,
+                                    &shared->raw_quant_field));
+  JXL_RETURN_IF_ERROR(AllocateImage(memory_manager, frame_dim.xsize_blocks,
+                                    frame_dim.ysize_blocks, reuse,
+                                    &shared->epf_sharpness));
   JXL_ASSIGN_OR_RETURN(
       shared->cmap, ColorCorrelationMap::Create(memory_manager, frame_dim.xsize,
                                                 frame_dim.ysize));
@@ -50,9 +64,9 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
                                 kCoeffOrderMaxSize);
   }
 
-  JXL_ASSIGN_OR_RETURN(shared->quant_dc,
-                       ImageB::Create(memory_manager, frame_dim.xsize_blocks,
-                                      frame_dim.ysize_blocks));
+  JXL_RETURN_IF_ERROR(AllocateImage(memory_manager, frame_dim.xsize_blocks,
+                                    frame_dim.ysize_blocks, reuse,
+                                    &shared->quant_dc));
 
   bool use_dc_frame = ((frame_header.flags & FrameHeader::kUseDcFrame) != 0u);
   if (!encoder && use_dc_frame) {
@@ -70,9 +84,9 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
     }
     ZeroFillImage(&shared->quant_dc);
   } else {
-    JXL_ASSIGN_OR_RETURN(shared->dc_storage,
-                         Image3F::Create(memory_manager, frame_dim.xsize_blocks,
-                                         frame_dim.ysize_blocks));
+    JXL_RETURN_IF_ERROR(AllocateImage(memory_manager, frame_dim.xsize_blocks,
+                                      frame_dim.ysize_blocks, reuse,
+                                      &shared->dc_storage));
     shared->dc = &shared->dc_storage;
   }
 
@@ -9,6 +9,11 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/status.h"
@@ -1180,45 +1185,117 @@ const QuantEncoding* DequantMatrices::Library() {
   return reinterpret_cast<const QuantEncoding*>(kDequantLibrary.data());
 }
 
-DequantMatrices::DequantMatrices() {
-  encodings_.resize(kNumQuantTables, QuantEncoding::Library<0>());
-  size_t pos = 0;
-  size_t offsets[kNumQuantTables * 3];
-  for (size_t i = 0; i < static_cast<size_t>(kNumQuantTables); i++) {
-    size_t num = required_size_x[i] * required_size_y[i] * kDCTBlockSize;
-    for (size_t c = 0; c < 3; c++) {
-      offsets[3 * i + c] = pos + c * num;
-    }
-    pos += 3 * num;
+namespace {
+
+void AppendFloats(const float* values, size_t num,
+                  std::vector<uint32_t>* key) {
+  for (size_t i = 0; i < num; i++) {
+    uint32_t bits;
+    memcpy(&bits, &values[i], sizeof(bits));
+    key->push_back(bits);
   }
-  for (size_t i = 0; i < AcStrategy::kNumValidStrategies; i++) {
-    for (size_t c = 0; c < 3; c++) {
-      table_offsets_[i * 3 + c] =
-          offsets[static_cast<size_t>(kAcStrategyToQuantTableMap[i]) * 3 + c];
-    }
+}
+
+void AppendDctParams(const DctQuantWeightParams& params,
+                     std::vector<uint32_t>* key) {
+  key->push_back(params.num_distance_bands);
+  for (size_t c = 0; c < 3; c++) {
+    AppendFloats(params.distance_bands[c].data(), params.num_distance_bands,
+                 key);
   }
 }
 
-Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
-  const QuantEncoding* library = Library();
+// The parameters that ComputeQuantTable uses for `table`. Returns false for
+// RAW encodings, which are mostly unique to their image.
+bool ComputedTableKey(const QuantEncodingInternal& encoding, size_t table,
+                      std::vector<uint32_t>* key) {
+  key->push_back(table);
+  key->push_back(encoding.mode);
+  switch (encoding.mode) {
+    case QuantEncoding::kQuantModeID:
+      AppendFloats(encoding.idweights[0].data(), 3 * 3, key);
+      return true;
+    case QuantEncoding::kQuantModeDCT2:
+      AppendFloats(encoding.dct2weights[0].data(), 3 * 6, key);
+      return true;
+    case QuantEncoding::kQuantModeDCT4:
+      AppendDctParams(encoding.dct_params, key);
+      AppendFloats(encoding.dct4multipliers[0].data(), 3 * 2, key);
+      return true;
+    case QuantEncoding::kQuantModeDCT4X8:
+      AppendDctParams(encoding.dct_params, key);
+      AppendFloats(encoding.dct4x8multipliers.data(), 3, key);
+      return true;
+    case QuantEncoding::kQuantModeDCT:
+      AppendDctParams(encoding.dct_params, key);
+      return true;
+    case QuantEncoding::kQuantModeAFV:
+      AppendDctParams(encoding.dct_params, key);
+      AppendDctParams(encoding.dct_params_afv_4x4, key);
+      AppendFloats(encoding.afv_weights[0].data(), 3 * 9, key);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Above this many entries, the cache is emptied before adding new tables.
+// The instances that use the removed tables keep them alive.
+constexpr size_t kMaxCachedEntries = size_t{1} << 24;
 
-  if (!table_storage_) {
-    table_storage_ = hwy::AllocateAligned<float>(2 * kTotalTableSize);
-    table_ = table_storage_.get();
-    inv_table_ = table_storage_.get() + kTotalTableSize;
+}  // namespace
+
+StatusOr<std::shared_ptr<const DequantMatrices::ComputedTable>>
+DequantMatrices::GetComputedTable(const QuantEncoding& encoding,
+                                  size_t table) {
+  using Cache =
+      std::map<std::vector<uint32_t>, std::shared_ptr<const ComputedTable>>;
+  // Never destroyed, since decoders may still run while the process exits.
+  static std::mutex* mutex = new std::mutex();
+  static Cache* cache = new Cache();
+  static size_t cached_entries = 0;
+
+  std::vector<uint32_t> key;
+  const bool cacheable = ComputedTableKey(encoding, table, &key);
+  if (cacheable) {
+    std::lock_guard<std::mutex> lock(*mutex);
+    auto it = cache->find(key);
+    if (it != cache->end()) {
+      return std::shared_ptr<const ComputedTable>(it->second);
+    }
   }
 
-  size_t offsets[kNumQuantTables * 3 + 1];
+  // Computed outside of the lock, another thread may add the same table
+  // meanwhile.
+  auto computed = std::make_shared<ComputedTable>();
+  computed->num =
+      required_size_x[table] * required_size_y[table] * kDCTBlockSize;
+  computed->storage = hwy::AllocateAligned<float>(6 * computed->num);
+  JXL_ENSURE(computed->storage);
   size_t pos = 0;
-  for (size_t i = 0; i < kNumQuantTables; i++) {
-    size_t num = required_size_x[i] * required_size_y[i] * kDCTBlockSize;
-    for (size_t c = 0; c < 3; c++) {
-      offsets[3 * i + c] = pos + c * num;
-    }
-    pos += 3 * num;
+  JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ComputeQuantTable)(
+      encoding, computed->storage.get(),
+      computed->storage.get() + 3 * computed->num, table, QuantTable(table),
+      &pos));
+  JXL_ENSURE(pos == 3 * computed->num);
+  if (!cacheable) return std::shared_ptr<const ComputedTable>(computed);
+
+  std::lock_guard<std::mutex> lock(*mutex);
+  if (cached_entries + 6 * computed->num > kMaxCachedEntries) {
+    cache->clear();
+    cached_entries = 0;
   }
-  offsets[kNumQuantTables * 3] = pos;
-  JXL_ENSURE(pos == kTotalTableSize);
+  auto inserted = cache->emplace(std::move(key), computed);
+  if (inserted.second) cached_entries += 6 * computed->num;
+  return std::shared_ptr<const ComputedTable>(inserted.first->second);
+}
+
+DequantMatrices::DequantMatrices() {
+  encodings_.resize(kNumQuantTables, QuantEncoding::Library<0>());
+}
+
+Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
+  const QuantEncoding* library = Library();
 
   uint32_t kind_mask = 0;
   for (size_t i = 0; i < AcStrategy::kNumValidStrategies; i++) {
@@ -1236,19 +1313,22 @@ Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
   for (size_t table = 0; table < kNumQuantTables; table++) {
     if ((1 << table) & computed_kind_mask) continue;
     if ((1 << table) & ~kind_mask) continue;
-    size_t pos = offsets[table * 3];
-    if (encodings_[table].mode == QuantEncoding::kQuantModeLibrary) {
-      JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ComputeQuantTable)(
-          library[table], table_storage_.get(),
-          table_storage_.get() + kTotalTableSize, table, QuantTable(table),
-          &pos));
-    } else {
-      JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ComputeQuantTable)(
-          encodings_[table], table_storage_.get(),
-          table_storage_.get() + kTotalTableSize, table, QuantTable(table),
-          &pos));
+    const QuantEncoding& encoding =
+        encodings_[table].mode == QuantEncoding::kQuantModeLibrary
+            ? library[table]
+            : encodings_[table];
+    JXL_ASSIGN_OR_RETURN(computed_tables_[table],
+                         GetComputedTable(encoding, table));
+  }
+  for (size_t i = 0; i < AcStrategy::kNumValidStrategies; i++) {
+    if (!(acs_mask & (1u << i))) continue;
+    const ComputedTable& computed = *computed_tables_[static_cast<size_t>(
+        kAcStrategyToQuantTableMap[i])];
+    for (size_t c = 0; c < 3; c++) {
+      tables_[i * 3 + c] = computed.storage.get() + c * computed.num;
+      inv_tables_[i * 3 + c] =
+          computed.storage.get() + (3 + c) * computed.num;
     }
-    JXL_ENSURE(pos == offsets[table * 3 + 3]);
   }
   computed_mask_ |= acs_mask;
 
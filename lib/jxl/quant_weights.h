@@ -11,6 +11,7 @@
 #include <array>
 #include <cstdint>
 #include <cstring>
+#include <memory>
 #include <hwy/aligned_allocator.h>
 #include <vector>
 
@@ -370,13 +371,13 @@ class DequantMatrices {
   // Returns aligned memory.
   JXL_INLINE const float* Matrix(AcStrategyType quant_kind, size_t c) const {
     JXL_DASSERT((1 << static_cast<uint32_t>(quant_kind)) & computed_mask_);
-    return &table_[table_offsets_[static_cast<size_t>(quant_kind) * 3 + c]];
+    return tables_[static_cast<size_t>(quant_kind) * 3 + c];
   }
 
   JXL_INLINE const float* InvMatrix(AcStrategyType quant_kind, size_t c) const {
     size_t quant_table_idx = static_cast<uint32_t>(quant_kind);
     JXL_DASSERT((1 << quant_table_idx) & computed_mask_);
-    return &inv_table_[table_offsets_[quant_table_idx * 3 + c]];
+    return inv_tables_[quant_table_idx * 3 + c];
   }
 
   // DC quants are used in modular mode for XYB multipliers.
@@ -418,19 +419,32 @@ class DequantMatrices {
   // MUST be equal `sum(dot(required_size_x, required_size_y))`.
   static constexpr size_t kSumRequiredXy = 2056;
 
+  // The computed matrices are immutable and shared by all the instances, of
+  // both the decoder and the encoder, that use the same encodings.
   Status EnsureComputed(uint32_t acs_mask);
 
  private:
-  static constexpr size_t kTotalTableSize = kSumRequiredXy * kDCTBlockSize * 3;
+  // Matrices and inverse matrices of the three channels of one QuantTable.
+  struct ComputedTable {
+    hwy::AlignedFreeUniquePtr<float[]> storage;
+    // Number of entries of each matrix.
+    size_t num;
+  };
+
+  // Returns the matrices for `encoding` of `table` from the process-wide
+  // cache, computing them if needed. Thread-safe.
+  static StatusOr<std::shared_ptr<const ComputedTable>> GetComputedTable(
+      const QuantEncoding& encoding, size_t table);
 
   uint32_t computed_mask_ = 0;
-  // kTotalTableSize entries followed by kTotalTableSize for inv_table
-  hwy::AlignedFreeUniquePtr<float[]> table_storage_;
-  const float* table_;
-  const float* inv_table_;
+  std::array<std::shared_ptr<const ComputedTable>, kNumQuantTables>
+      computed_tables_;
+  // Matrices and inverse matrices of each AC strategy and channel, owned by
+  // `computed_tables_`.
+  const float* tables_[AcStrategy::kNumValidStrategies * 3] = {};
+  const float* inv_tables_[AcStrategy::kNumValidStrategies * 3] = {};
   float dc_quant_[3] = {kDCQuant[0], kDCQuant[1], kDCQuant[2]};
   float inv_dc_quant_[3] = {kInvDCQuant[0], kInvDCQuant[1], kInvDCQuant[2]};
-  size_t table_offsets_[AcStrategy::kNumValidStrategies * 3];
   std::vector<QuantEncoding> encodings_;
 };
 
@@ -178,6 +178,27 @@ TEST(QuantWeightsTest, RAW) {
   RoundtripMatrices(encodings);
 }
 
+TEST(QuantWeightsTest, SharedBetweenInstances) {
+  DequantMatrices a;
+  DequantMatrices b;
+  ASSERT_TRUE(a.EnsureComputed(~0u));
+  ASSERT_TRUE(b.EnsureComputed(1));
+  EXPECT_EQ(a.Matrix(AcStrategyType::DCT, 1), b.Matrix(AcStrategyType::DCT, 1));
+  EXPECT_EQ(a.InvMatrix(AcStrategyType::DCT, 2),
+            b.InvMatrix(AcStrategyType::DCT, 2));
+
+  // Different parameters are computed separately.
+  std::vector<QuantEncoding> encodings(kNumQuantTables,
+                                       QuantEncoding::Library<0>());
+  encodings[static_cast<size_t>(QuantTable::DCT)] = QuantEncoding::DCT(
+      DctQuantWeightParams({{{{1000.0f, -0.5f}}, {{200.0f, -0.5f}},
+                             {{500.0f, -0.5f}}}},
+                           2));
+  b.SetEncodings(encodings);
+  ASSERT_TRUE(b.EnsureComputed(1));
+  EXPECT_NE(a.Matrix(AcStrategyType::DCT, 1), b.Matrix(AcStrategyType::DCT, 1));
+}
+
 class QuantWeightsTargetTest : public hwy::TestWithParamTarget {};
 HWY_TARGET_INSTANTIATE_TEST_SUITE_P(QuantWeightsTargetTest);
 
@@ -13,12 +13,47 @@
 
 #include "lib/jxl/base/arch_macros.h"
 #include "lib/jxl/base/common.h"
+#include "lib/jxl/base/float.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/dec_stats.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_ops.h"
+#include "lib/jxl/trace_internal.h"
 
 namespace jxl {
+namespace {
+
+Status CopyToHalf(const Rect& rect_from, const ImageF& from,
+                  const Rect& rect_to, Plane<uint16_t>* to) {
+  JXL_ENSURE(SameSize(rect_from, rect_to));
+  JXL_ENSURE(rect_to.IsInside(*to));
+  for (size_t y = 0; y < rect_from.ysize(); ++y) {
+    const float* JXL_RESTRICT row_from = rect_from.ConstRow(from, y);
+    uint16_t* JXL_RESTRICT row_to = rect_to.Row(to, y);
+    for (size_t x = 0; x < rect_from.xsize(); ++x) {
+      row_to[x] = detail::StoreFloat16(row_from[x]);
+    }
+  }
+  return true;
+}
+
+Status CopyFromHalf(const Rect& rect_from, const Plane<uint16_t>& from,
+                    const Rect& rect_to, ImageF* to) {
+  JXL_ENSURE(SameSize(rect_from, rect_to));
+  JXL_ENSURE(rect_to.IsInside(*to));
+  for (size_t y = 0; y < rect_from.ysize(); ++y) {
+    const uint16_t* JXL_RESTRICT row_from = rect_from.ConstRow(from, y);
+    float* JXL_RESTRICT row_to = rect_to.Row(to, y);
+    for (size_t x = 0; x < rect_from.xsize(); ++x) {
+      row_to[x] = detail::LoadFloat16(row_from[x]);
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
 std::pair<size_t, size_t>
 LowMemoryRenderPipeline::ColorDimensionsToChannelDimensions(
     std::pair<size_t, size_t> in, size_t c, size_t stage) const {
@@ -56,30 +91,42 @@ Status LowMemoryRenderPipeline::SaveBorders(size_t group_id, size_t c,
   size_t borderx_write = borders.first;
   size_t bordery_write = borders.second;
 
+  const auto store = [&](const Rect& from, const Rect& to,
+                         bool horizontal) -> Status {
+    if (half_precision_borders_) {
+      return CopyToHalf(from, in, to,
+                        horizontal ? &half_borders_horizontal_[c]
+                                   : &half_borders_vertical_[c]);
+    }
+    return CopyImageTo(
+        from, in, to,
+        horizontal ? &borders_horizontal_[c] : &borders_vertical_[c]);
+  };
+
   if (gy > 0) {
     Rect from(group_data_x_border_, group_data_y_border_, x1 - x0,
               bordery_write);
     Rect to(x0, (gy * 2 - 1) * bordery_write, x1 - x0, bordery_write);
-    JXL_RETURN_IF_ERROR(CopyImageTo(from, in, to, &borders_horizontal_[c]));
+    JXL_RETURN_IF_ERROR(store(from, to, /*horizontal=*/true));
   }
   if (gy + 1 < frame_dimensions_.ysize_groups) {
     Rect from(group_data_x_border_,
               group_data_y_border_ + y1 - y0 - bordery_write, x1 - x0,
               bordery_write);
     Rect to(x0, (gy * 2) * bordery_write, x1 - x0, bordery_write);
-    JXL_RETURN_IF_ERROR(CopyImageTo(from, in, to, &borders_horizontal_[c]));
+    JXL_RETURN_IF_ERROR(store(from, to, /*horizontal=*/true));
   }
   if (gx > 0) {
     Rect from(group_data_x_border_, group_data_y_border_, borderx_write,
               y1 - y0);
     Rect to((gx * 2 - 1) * borderx_write, y0, borderx_write, y1 - y0);
-    JXL_RETURN_IF_ERROR(CopyImageTo(from, in, to, &borders_vertical_[c]));
+    JXL_RETURN_IF_ERROR(store(from, to, /*horizontal=*/false));
   }
   if (gx + 1 < frame_dimensions_.xsize_groups) {
     Rect from(group_data_x_border_ + x1 - x0 - borderx_write,
               group_data_y_border_, borderx_write, y1 - y0);
     Rect to((gx * 2) * borderx_write, y0, borderx_write, y1 - y0);
-    JXL_RETURN_IF_ERROR(CopyImageTo(from, in, to, &borders_vertical_[c]));
+    JXL_RETURN_IF_ERROR(store(from, to, /*horizontal=*/false));
   }
   return true;
 }
@@ -105,6 +152,19 @@ Status LowMemoryRenderPipeline::LoadBorders(size_t group_id, size_t c,
   size_t borderx_write = borders.first;
   size_t bordery_write = borders.second;
 
+  const auto load = [&](const Rect& from, const Rect& to,
+                        bool horizontal) -> Status {
+    if (half_precision_borders_) {
+      return CopyFromHalf(from,
+                          horizontal ? half_borders_horizontal_[c]
+                                     : half_borders_vertical_[c],
+                          to, out);
+    }
+    return CopyImageTo(
+        from, horizontal ? borders_horizontal_[c] : borders_vertical_[c], to,
+        out);
+  };
+
   // Limits of the area to copy from, in image coordinates.
   JXL_ENSURE(r.x0() == 0 || (r.x0() << base_color_shift_) >= paddingx);
   size_t x0src = DivCeil(r.x0() << base_color_shift_, 1 << hshift);
@@ -132,42 +192,38 @@ Status LowMemoryRenderPipeline::LoadBorders(size_t group_id, size_t c,
   // Copy other groups' borders from the border storage.
   if (y0src < y0) {
     JXL_ENSURE(gy > 0);
-    JXL_RETURN_IF_ERROR(CopyImageTo(
+    JXL_RETURN_IF_ERROR(load(
         Rect(x0src, (gy * 2 - 2) * bordery_write, x1src - x0src, bordery_write),
-        borders_horizontal_[c],
         Rect(group_data_x_border_ + x0src - x0,
              group_data_y_border_ - bordery_write, x1src - x0src,
              bordery_write),
-        out));
+        /*horizontal=*/true));
   }
   if (y1src > y1) {
     // When copying the bottom border we must not be on the bottom groups.
     JXL_ENSURE(gy + 1 < frame_dimensions_.ysize_groups);
-    JXL_RETURN_IF_ERROR(CopyImageTo(
+    JXL_RETURN_IF_ERROR(load(
         Rect(x0src, (gy * 2 + 1) * bordery_write, x1src - x0src, bordery_write),
-        borders_horizontal_[c],
         Rect(group_data_x_border_ + x0src - x0, group_data_y_border_ + y1 - y0,
              x1src - x0src, bordery_write),
-        out));
+        /*horizontal=*/true));
   }
   if (x0src < x0) {
     JXL_ENSURE(gx > 0);
-    JXL_RETURN_IF_ERROR(CopyImageTo(
+    JXL_RETURN_IF_ERROR(load(
         Rect((gx * 2 - 2) * borderx_write, y0src, borderx_write, y1src - y0src),
-        borders_vertical_[c],
         Rect(group_data_x_border_ - borderx_write,
              group_data_y_border_ + y0src - y0, borderx_write, y1src - y0src),
-        out));
+        /*horizontal=*/false));
   }
   if (x1src > x1) {
     // When copying the right border we must not be on the rightmost groups.
     JXL_ENSURE(gx + 1 < frame_dimensions_.xsize_groups);
-    JXL_RETURN_IF_ERROR(CopyImageTo(
+    JXL_RETURN_IF_ERROR(load(
         Rect((gx * 2 + 1) * borderx_write, y0src, borderx_write, y1src - y0src),
-        borders_vertical_[c],
         Rect(group_data_x_border_ + x1 - x0, group_data_y_border_ + y0src - y0,
              borderx_write, y1src - y0src),
-        out));
+        /*horizontal=*/false));
   }
   return true;
 }
@@ -184,7 +240,12 @@ size_t LowMemoryRenderPipeline::GroupInputYSize(size_t c) const {
 
 Status LowMemoryRenderPipeline::EnsureBordersStorage() {
   const auto& shifts = channel_shifts_[0];
-  if (borders_horizontal_.size() < shifts.size()) {
+  if (half_precision_borders_) {
+    if (half_borders_horizontal_.size() < shifts.size()) {
+      half_borders_horizontal_.resize(shifts.size());
+      half_borders_vertical_.resize(shifts.size());
+    }
+  } else if (borders_horizontal_.size() < shifts.size()) {
     borders_horizontal_.resize(shifts.size());
     borders_vertical_.resize(shifts.size());
   }
@@ -201,12 +262,27 @@ Status LowMemoryRenderPipeline::EnsureBordersStorage() {
     size_t downsampled_ysize = DivCeil(frame_dimensions_.ysize_upsampled_padded,
                                        1 << shifts[c].second);
     Rect horizontal = Rect(0, 0, downsampled_xsize, bordery * num_yborders);
+    Rect vertical = Rect(0, 0, borderx * num_xborders, downsampled_ysize);
+    if (half_precision_borders_) {
+      if (!SameSize(horizontal, half_borders_horizontal_[c])) {
+        JXL_ASSIGN_OR_RETURN(
+            half_borders_horizontal_[c],
+            Plane<uint16_t>::Create(memory_manager_, horizontal.xsize(),
+                                          horizontal.ysize()));
+      }
+      if (!SameSize(vertical, half_borders_vertical_[c])) {
+        JXL_ASSIGN_OR_RETURN(
+            half_borders_vertical_[c],
+            Plane<uint16_t>::Create(memory_manager_, vertical.xsize(),
+                                          vertical.ysize()));
+      }
+      continue;
+    }
     if (!SameSize(horizontal, borders_horizontal_[c])) {
       JXL_ASSIGN_OR_RETURN(borders_horizontal_[c],
                            ImageF::Create(memory_manager_, horizontal.xsize(),
                                           horizontal.ysize()));
     }
-    Rect vertical = Rect(0, 0, borderx * num_xborders, downsampled_ysize);
     if (!SameSize(vertical, borders_vertical_[c])) {
       JXL_ASSIGN_OR_RETURN(
           borders_vertical_[c],
@@ -580,6 +656,11 @@ class Rows {
   std::vector<std::vector<RowInfo>> rows_;
 };
 
+// Number of pixels of a row that trailing stages process at once. This is a
+// multiple of the widest vectors, so that vectorized stages do not go past the
+// end of a chunk.
+constexpr size_t kTrailingStagesChunkSize = 256;
+
 }  // namespace
 
 Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
@@ -706,6 +787,25 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
   int num_extra_rows = *std::max_element(virtual_ypadding_for_output_.begin(),
                                          virtual_ypadding_for_output_.end());
 
+  // The rows of the stages interleave, so only their total time is recorded.
+  TraceStageTimes stage_times(stages_.size());
+  std::vector<uint64_t> stage_nanos(stats_ ? stages_.size() : 0);
+
+  // The rows that the trailing stages process, see below.
+  ssize_t full_image_y0 =
+      std::max<ssize_t>(frame_y0 + image_area_rect.y0(), 0);
+  ssize_t full_image_y1 = std::min<ssize_t>(frame_y0 + image_area_rect.y1(),
+                                            full_image_ysize);
+  for (size_t i = first_trailing_stage_; i < stages_.size(); i++) {
+    size_t x0 = i < first_image_dim_stage_ ? full_image_x0 - frame_x0
+                                           : full_image_x0;
+    size_t y0 = i < first_image_dim_stage_ ? full_image_y0 - frame_y0
+                                           : full_image_y0;
+    Rect rect(x0, y0, full_image_x1 - full_image_x0,
+              std::max<ssize_t>(full_image_y1 - full_image_y0, 0));
+    JXL_RETURN_IF_ERROR(stages_[i]->BeginRect(thread_id, rect));
+  }
+
   for (int vy = -num_extra_rows;
        vy < static_cast<int>(image_area_rect.ysize()) + num_extra_rows; vy++) {
     for (size_t i = 0; i < first_trailing_stage_; i++) {
@@ -732,9 +832,13 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
       prepare_io_rows(y, i);
 
       // Produce output rows.
+      const uint64_t stage_start = stats_ ? DecoderStatsNow() : 0;
+      stage_times.Begin();
       JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
           input_rows[i], output_rows, xpadding_for_output_[i],
           group_rect[i].xsize(), group_rect[i].x0(), image_y, thread_id));
+      stage_times.End(i);
+      if (stats_) stage_nanos[i] += DecoderStatsNow() - stage_start;
     }
 
     // Process trailing stages, i.e. the final set of non-kInOut stages; they
@@ -767,18 +871,41 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
       continue;
     }
 
-    for (size_t i = first_trailing_stage_; i < stages_.size(); i++) {
-      // Before the first_image_dim_stage_, coordinates are relative to the
-      // current frame.
-      size_t x0 =
-          i < first_image_dim_stage_ ? full_image_x0 - frame_x0 : full_image_x0;
-      size_t y =
-          i < first_image_dim_stage_ ? full_image_y - frame_y0 : full_image_y;
-      JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
-          input_rows[first_trailing_stage_], output_rows,
-          /*xextra=*/0, full_image_x1 - full_image_x0, x0, y, thread_id));
+    // Trailing stages only work on the pixels at the same position, so wide
+    // rows are split in chunks that go through all of these stages while they
+    // are still in cache.
+    const size_t xsize = full_image_x1 - full_image_x0;
+    for (size_t cx = 0; cx < xsize; cx += kTrailingStagesChunkSize) {
+      const size_t chunk_xsize = std::min(kTrailingStagesChunkSize, xsize - cx);
+      if (cx != 0) {
+        for (size_t c = 0; c < input_data.size(); c++) {
+          input_rows[first_trailing_stage_][c][0] += kTrailingStagesChunkSize;
+        }
+      }
+      for (size_t i = first_trailing_stage_; i < stages_.size(); i++) {
+        // Before the first_image_dim_stage_, coordinates are relative to the
+        // current frame.
+        size_t x0 = i < first_image_dim_stage_ ? full_image_x0 - frame_x0
+                                               : full_image_x0;
+        size_t y =
+            i < first_image_dim_stage_ ? full_image_y - frame_y0 : full_image_y;
+        const uint64_t stage_start = stats_ ? DecoderStatsNow() : 0;
+        stage_times.Begin();
+        JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
+            input_rows[first_trailing_stage_], output_rows,
+            /*xextra=*/0, chunk_xsize, x0 + cx, y, thread_id));
+        stage_times.End(i);
+        if (stats_) stage_nanos[i] += DecoderStatsNow() - stage_start;
+      }
     }
   }
+  for (size_t i = first_trailing_stage_; i < stages_.size(); i++) {
+    JXL_RETURN_IF_ERROR(stages_[i]->EndRect(thread_id));
+  }
+  stage_times.Record([this](size_t i) { return stages_[i]->GetName(); });
+  for (size_t i = 0; i < stage_nanos.size(); i++) {
+    AddStageTime(i, stage_nanos[i]);
+  }
   return true;
 }
 
@@ -792,6 +919,11 @@ Status LowMemoryRenderPipeline::RenderPadding(size_t thread_id, Rect rect) {
     input_rows[c][0] = out_of_frame_data_[thread_id].Row(c);
   }
 
+  const size_t first_rect_stage =
+      std::max(first_image_dim_stage_, first_trailing_stage_);
+  for (size_t i = first_rect_stage; i < stages_.size(); i++) {
+    JXL_RETURN_IF_ERROR(stages_[i]->BeginRect(thread_id, rect));
+  }
   for (size_t y = 0; y < rect.ysize(); y++) {
     stages_[first_image_dim_stage_ - 1]->ProcessPaddingRow(
         input_rows, rect.xsize(), rect.x0(), rect.y0() + y);
@@ -801,11 +933,61 @@ Status LowMemoryRenderPipeline::RenderPadding(size_t thread_id, Rect rect) {
           /*xextra=*/0, rect.xsize(), rect.x0(), rect.y0() + y, thread_id));
     }
   }
+  for (size_t i = first_rect_stage; i < stages_.size(); i++) {
+    JXL_RETURN_IF_ERROR(stages_[i]->EndRect(thread_id));
+  }
   return true;
 }
 
+void LowMemoryRenderPipeline::SetRenderRect(const Rect& rect) {
+  // Rendered rects must keep the alignment of the rects produced by the group
+  // border assigner, both for vectorized stages and for subsampled channels;
+  // multiples of 64 are sufficient for all of them.
+  constexpr size_t kRenderRectAlign = 64;
+  size_t x0 = (rect.x0() >> base_color_shift_) / kRenderRectAlign *
+              kRenderRectAlign;
+  size_t y0 = (rect.y0() >> base_color_shift_) / kRenderRectAlign *
+              kRenderRectAlign;
+  size_t x1 = RoundUpTo(DivCeil(rect.x1(), size_t{1} << base_color_shift_),
+                        kRenderRectAlign);
+  size_t y1 = RoundUpTo(DivCeil(rect.y1(), size_t{1} << base_color_shift_),
+                        kRenderRectAlign);
+  render_rect_ = Rect(x0, y0, x1 - x0, y1 - y0);
+  has_render_rect_ = true;
+}
+
+bool LowMemoryRenderPipeline::GroupNeeded(size_t group_id) const {
+  return !has_render_rect_ || GroupTouches(group_id, render_rect_);
+}
+
+bool LowMemoryRenderPipeline::GroupContributesTo(size_t group_id,
+                                                 const Rect& rect) const {
+  size_t x0 = rect.x0() >> base_color_shift_;
+  size_t y0 = rect.y0() >> base_color_shift_;
+  size_t x1 = DivCeil(rect.x1(), size_t{1} << base_color_shift_);
+  size_t y1 = DivCeil(rect.y1(), size_t{1} << base_color_shift_);
+  return GroupTouches(group_id, Rect(x0, y0, x1 - x0, y1 - y0));
+}
+
+bool LowMemoryRenderPipeline::GroupTouches(size_t group_id,
+                                           const Rect& rect) const {
+  size_t gy = group_id / frame_dimensions_.xsize_groups;
+  size_t gx = group_id % frame_dimensions_.xsize_groups;
+  size_t group_dim = frame_dimensions_.group_dim;
+  // Pixels within group_border_ of a group may only be rendered once that
+  // group is done.
+  size_t x0 = gx * group_dim;
+  size_t y0 = gy * group_dim;
+  x0 = x0 > group_border_.first ? x0 - group_border_.first : 0;
+  y0 = y0 > group_border_.second ? y0 - group_border_.second : 0;
+  size_t x1 = (gx + 1) * group_dim + group_border_.first;
+  size_t y1 = (gy + 1) * group_dim + group_border_.second;
+  return x0 < rect.x1() && rect.x0() < x1 && y0 < rect.y1() && rect.y0() < y1;
+}
+
 Status LowMemoryRenderPipeline::ProcessBuffers(size_t group_id,
                                                size_t thread_id) {
+  JXL_TRACE_SCOPE("RenderPipeline::ProcessBuffers", group_id);
   std::vector<ImageF>& input_data =
       group_data_[use_group_ids_ ? group_id : thread_id];
 
@@ -888,7 +1070,15 @@ Status LowMemoryRenderPipeline::ProcessBuffers(size_t group_id,
                                    group_border_.second, ready_rects,
                                    &num_ready_rects);
   for (size_t i = 0; i < num_ready_rects; i++) {
-    const Rect& image_max_color_channel_rect = ready_rects[i];
+    Rect image_max_color_channel_rect = ready_rects[i];
+    if (has_render_rect_) {
+      image_max_color_channel_rect =
+          image_max_color_channel_rect.Intersection(render_rect_);
+      if (image_max_color_channel_rect.xsize() == 0 ||
+          image_max_color_channel_rect.ysize() == 0) {
+        continue;
+      }
+    }
     for (size_t c = 0; c < input_data.size(); c++) {
       JXL_RETURN_IF_ERROR(LoadBorders(group_id, c, image_max_color_channel_rect,
                                       &input_data[c]));
@@ -26,8 +26,12 @@ namespace jxl {
 // amount of buffers.
 class LowMemoryRenderPipeline final : public RenderPipeline {
  public:
-  explicit LowMemoryRenderPipeline(JxlMemoryManager* memory_manager)
-      : RenderPipeline(memory_manager) {}
+  // If `half_precision_borders` is true, the borders between groups are kept
+  // as half floats, which halves the memory they use.
+  explicit LowMemoryRenderPipeline(JxlMemoryManager* memory_manager,
+                                   bool half_precision_borders = false)
+      : RenderPipeline(memory_manager),
+        half_precision_borders_(half_precision_borders) {}
 
  private:
   std::vector<std::pair<ImageF*, Rect>> PrepareBuffers(
@@ -39,9 +43,19 @@ class LowMemoryRenderPipeline final : public RenderPipeline {
 
   void ClearDone(size_t i) override { group_border_assigner_.ClearDone(i); }
 
+  void SetRenderRect(const Rect& rect) override;
+
+  bool GroupNeeded(size_t group_id) const override;
+
+  bool GroupContributesTo(size_t group_id, const Rect& rect) const override;
+
   Status Init() override;
 
   Status EnsureBordersStorage();
+
+  // Whether the group contributes to `rect`, in max color channel
+  // coordinates.
+  bool GroupTouches(size_t group_id, const Rect& rect) const;
   size_t GroupInputXSize(size_t c) const;
   size_t GroupInputYSize(size_t c) const;
   Status RenderRect(size_t thread_id, std::vector<ImageF>& input_data,
@@ -64,6 +78,10 @@ class LowMemoryRenderPipeline final : public RenderPipeline {
   // of next group.
   std::vector<ImageF> borders_horizontal_;
   std::vector<ImageF> borders_vertical_;
+  // Same as above, used instead when half_precision_borders_ is set.
+  bool half_precision_borders_;
+  std::vector<Plane<uint16_t>> half_borders_horizontal_;
+  std::vector<Plane<uint16_t>> half_borders_vertical_;
 
   // Manages the status of borders.
   GroupBorderAssigner group_border_assigner_;
@@ -117,6 +135,11 @@ class LowMemoryRenderPipeline final : public RenderPipeline {
   size_t full_image_xsize_;
   size_t full_image_ysize_;
   size_t first_image_dim_stage_;
+
+  // Area to render, in color-channel-pixels; if not set, the whole frame is
+  // rendered.
+  bool has_render_rect_ = false;
+  Rect render_rect_;
 };
 
 }  // namespace jxl
@@ -7,12 +7,18 @@
 
 #include <jxl/memory_manager.h>
 
+#include <jxl/stats.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <utility>
 
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/sanitizers.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/dec_stats.h"
 #include "lib/jxl/render_pipeline/low_memory_render_pipeline.h"
 #include "lib/jxl/render_pipeline/simple_render_pipeline.h"
 
@@ -39,7 +45,8 @@ StatusOr<std::unique_ptr<RenderPipeline>> RenderPipeline::Builder::Finalize(
   if (use_simple_implementation_) {
     res = jxl::make_unique<SimpleRenderPipeline>(memory_manager_);
   } else {
-    res = jxl::make_unique<LowMemoryRenderPipeline>(memory_manager_);
+    res = jxl::make_unique<LowMemoryRenderPipeline>(
+        memory_manager_, use_half_precision_borders_);
   }
 
   res->padding_.resize(stages_.size());
@@ -93,10 +100,18 @@ StatusOr<std::unique_ptr<RenderPipeline>> RenderPipeline::Builder::Finalize(
     }
   }
   res->stages_ = std::move(stages_);
+  res->stats_ = stats_;
   JXL_RETURN_IF_ERROR(res->Init());
   return res;
 }
 
+void RenderPipeline::AddStageTime(size_t stage, uint64_t nanos) const {
+  const bool is_cms = strcmp(stages_[stage]->GetName(), "Cms") == 0;
+  stats_->AddRenderTime(
+      is_cms ? JXL_DEC_STATS_CMS_TIME_US : JXL_DEC_STATS_RENDER_TIME_US,
+      nanos);
+}
+
 RenderPipelineInput RenderPipeline::GetInputBuffers(size_t group_id,
                                                     size_t thread_id) {
   RenderPipelineInput ret;
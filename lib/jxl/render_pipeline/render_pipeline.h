@@ -17,6 +17,7 @@
 
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/dec_stats.h"
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
@@ -74,6 +75,13 @@ class RenderPipeline {
     // the pipeline.
     void UseSimpleImplementation() { use_simple_implementation_ = true; }
 
+    // Stores the borders between groups in half precision in the low-memory
+    // implementation of the pipeline.
+    void UseHalfPrecisionBorders() { use_half_precision_borders_ = true; }
+
+    // Accounts the time of the stages to `stats`, if not null.
+    void SetStats(DecoderStats* stats) { stats_ = stats; }
+
     // Finalizes setup of the pipeline. Shifts for all channels should be 0 at
     // this point.
     StatusOr<std::unique_ptr<RenderPipeline>> Finalize(
@@ -84,6 +92,8 @@ class RenderPipeline {
     std::vector<std::unique_ptr<RenderPipelineStage>> stages_;
     size_t num_c_;
     bool use_simple_implementation_ = false;
+    bool use_half_precision_borders_ = false;
+    DecoderStats* stats_ = nullptr;
   };
 
   friend class Builder;
@@ -116,6 +126,21 @@ class RenderPipeline {
 
   virtual void ClearDone(size_t i) {}
 
+  // Restricts rendering to the given rect, in upsampled frame coordinates.
+  // Pixels outside of it may be left unrendered. Must be called after
+  // Finalize() and before any input is provided.
+  virtual void SetRenderRect(const Rect& rect) {}
+
+  // Returns false if the given group does not contribute to the render rect,
+  // in which case no input needs to be provided for it.
+  virtual bool GroupNeeded(size_t group_id) const { return true; }
+
+  // Returns false if the given group does not contribute to the pixels of
+  // `rect`, in upsampled frame coordinates.
+  virtual bool GroupContributesTo(size_t group_id, const Rect& rect) const {
+    return true;
+  }
+
  protected:
   explicit RenderPipeline(JxlMemoryManager* memory_manager)
       : memory_manager_(memory_manager) {}
@@ -133,6 +158,11 @@ class RenderPipeline {
 
   std::vector<uint8_t> group_completed_passes_;
 
+  // If not null, the implementations time their stages and report them with
+  // AddStageTime.
+  DecoderStats* stats_ = nullptr;
+  void AddStageTime(size_t stage, uint64_t nanos) const;
+
   friend class RenderPipelineInput;
 
  private:
@@ -11,6 +11,7 @@
 #include <vector>
 
 #include "lib/jxl/base/arch_macros.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/frame_header.h"
 
@@ -125,6 +126,12 @@ class RenderPipelineStage {
 
   virtual Status PrepareForThreads(size_t num_threads) { return true; }
 
+  // Called by `thread_id` before and after it processes all the rows of
+  // `rect`, in the same coordinates as the `xpos` and `ypos` of ProcessRow.
+  // Only called for the final stages that have no kInOut channels.
+  virtual Status BeginRect(size_t thread_id, const Rect& rect) { return true; }
+  virtual Status EndRect(size_t thread_id) { return true; }
+
   // Returns a pointer to the input row of channel `c` with offset `y`.
   // `y` must be in [-settings_.border_y, settings_.border_y]. `c` must be such
   // that `GetChannelMode(c) != kIgnored`. The returned pointer points to the
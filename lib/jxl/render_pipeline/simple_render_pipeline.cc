@@ -15,8 +15,10 @@
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/sanitizers.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/dec_stats.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+#include "lib/jxl/trace_internal.h"
 
 namespace jxl {
 
@@ -81,6 +83,19 @@ Status SimpleRenderPipeline::ProcessBuffers(size_t group_id, size_t thread_id) {
   if (PassesWithAllInput() <= processed_passes_) return true;
   processed_passes_++;
 
+  // The final stages without kInOut channels process the whole image as a
+  // single rect.
+  size_t first_trailing_stage = stages_.size();
+  for (; first_trailing_stage > 0; first_trailing_stage--) {
+    const auto& stage = stages_[first_trailing_stage - 1];
+    bool has_inout = false;
+    for (size_t c = 0; c < channel_data_.size(); c++) {
+      has_inout |=
+          stage->GetChannelMode(c) == RenderPipelineChannelMode::kInOut;
+    }
+    if (has_inout) break;
+  }
+
   for (size_t stage_id = 0; stage_id < stages_.size(); stage_id++) {
     const auto& stage = stages_[stage_id];
     // Prepare buffers for kInOut channels.
@@ -176,7 +191,13 @@ Status SimpleRenderPipeline::ProcessBuffers(size_t group_id, size_t thread_id) {
 
     // Run the pipeline.
     {
+      JXL_TRACE_SCOPE(stage->GetName());
+      const uint64_t stage_start = stats_ ? DecoderStatsNow() : 0;
       JXL_RETURN_IF_ERROR(stage->SetInputSizes(input_sizes));
+      if (stage_id >= first_trailing_stage) {
+        JXL_RETURN_IF_ERROR(
+            stage->BeginRect(thread_id, Rect(0, 0, xsize, ysize)));
+      }
       int border_y = stage->settings_.border_y;
       for (size_t y = 0; y < ysize; y++) {
         // Prepare input rows.
@@ -203,6 +224,10 @@ Status SimpleRenderPipeline::ProcessBuffers(size_t group_id, size_t thread_id) {
                                               /*xextra=*/0, xsize,
                                               /*xpos=*/0, y, thread_id));
       }
+      if (stage_id >= first_trailing_stage) {
+        JXL_RETURN_IF_ERROR(stage->EndRect(thread_id));
+      }
+      if (stats_) AddStageTime(stage_id, DecoderStatsNow() - stage_start);
     }
 
     // Move new channels to current channels.
@@ -34,28 +34,28 @@ class BlendingStage : public RenderPipelineStage {
     info_ = frame_header_.blending_info;
     const std::vector<BlendingInfo>& ec_info =
         frame_header_.extra_channel_blending_info;
-    const ImageBundle& bg = *state_.reference_frames[info_.source].frame;
+    const ReferceFrame& bg = state_.reference_frames[info_.source];
     bg_ = &bg;
     if (bg.xsize() == 0 || bg.ysize() == 0) {
       zeroes_.resize(image_xsize_, 0.f);
-    } else if (state_.reference_frames[info_.source].ib_is_in_xyb) {
+    } else if (bg.ib_is_in_xyb) {
       initialized_ = JXL_FAILURE(
           "Trying to blend XYB reference frame %i and non-XYB frame",
           info_.source);
       return;
     } else if (std::any_of(ec_info.begin(), ec_info.end(),
                            [this](const BlendingInfo& info) {
-                             const ImageBundle& bg =
-                                 *state_.reference_frames[info.source].frame;
+                             const ReferceFrame& bg =
+                                 state_.reference_frames[info.source];
                              return bg.xsize() == 0 || bg.ysize() == 0;
                            })) {
       zeroes_.resize(image_xsize_, 0.f);
     }
 
-    auto verify_bg_size = [&](const ImageBundle& bg) -> Status {
+    auto verify_bg_size = [&](const ReferceFrame& bg) -> Status {
       if (bg.xsize() != 0 && bg.ysize() != 0 &&
           (bg.xsize() < image_xsize_ || bg.ysize() < image_ysize_ ||
-           bg.origin.x0 != 0 || bg.origin.y0 != 0)) {
+           bg.frame->origin.x0 != 0 || bg.frame->origin.y0 != 0)) {
         return JXL_FAILURE("Trying to use a %" PRIuS "x%" PRIuS
                            " crop as a background",
                            bg.xsize(), bg.ysize());
@@ -65,9 +65,11 @@ class BlendingStage : public RenderPipelineStage {
 
     Status ok = verify_bg_size(bg);
     for (const auto& info : ec_info) {
-      const ImageBundle& bg = *state_.reference_frames[info.source].frame;
+      const ReferceFrame& bg = state_.reference_frames[info.source];
       if (!!ok) ok = verify_bg_size(bg);
+      if (!bg.half_planes.empty()) has_half_bg_ = true;
     }
+    if (!bg.half_planes.empty()) has_half_bg_ = true;
     if (!ok) {
       initialized_ = ok;
       return;
@@ -115,6 +117,16 @@ class BlendingStage : public RenderPipelineStage {
 
   Status IsInitialized() const override { return initialized_; }
 
+  Status PrepareForThreads(size_t num_threads) override {
+    // Rows of backgrounds stored as 16-bit floats are converted here.
+    if (!has_half_bg_) return true;
+    JXL_ASSIGN_OR_RETURN(
+        bg_rows_,
+        ImageF::Create(state_.memory_manager, image_xsize_,
+                       num_threads * (extra_channel_info_->size() + 3)));
+    return true;
+  }
+
   Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
                     size_t xextra, size_t xsize, size_t xpos, size_t ypos,
                     size_t thread_id) const final {
@@ -141,24 +153,20 @@ class BlendingStage : public RenderPipelineStage {
     }
     std::vector<const float*> bg_row_ptrs_(input_rows.size());
     std::vector<float*> fg_row_ptrs_(input_rows.size());
-    size_t num_c = std::min(input_rows.size(), extra_channel_info_->size() + 3);
+    const size_t num_bg_c = extra_channel_info_->size() + 3;
+    size_t num_c = std::min(input_rows.size(), num_bg_c);
     for (size_t c = 0; c < num_c; ++c) {
       fg_row_ptrs_[c] = GetInputRow(input_rows, c, 0) + offset;
-      if (c < 3) {
-        bg_row_ptrs_[c] = bg_->xsize() != 0 && bg_->ysize() != 0
-                              ? bg_->color().ConstPlaneRow(c, bg_ypos) + bg_xpos
-                              : zeroes_.data();
-      } else {
-        const ImageBundle& ec_bg =
-            *state_
-                 .reference_frames
-                     [frame_header_.extra_channel_blending_info[c - 3].source]
-                 .frame;
-        bg_row_ptrs_[c] =
-            ec_bg.xsize() != 0 && ec_bg.ysize() != 0
-                ? ec_bg.extra_channels()[c - 3].ConstRow(bg_ypos) + bg_xpos
-                : zeroes_.data();
-      }
+      const ReferceFrame& bg =
+          c < 3 ? *bg_
+                : state_.reference_frames
+                      [frame_header_.extra_channel_blending_info[c - 3].source];
+      float* buffer = bg.half_planes.empty()
+                          ? nullptr
+                          : bg_rows_.Row(thread_id * num_bg_c + c);
+      bg_row_ptrs_[c] = bg.xsize() != 0 && bg.ysize() != 0
+                            ? bg.ConstRow(c, bg_ypos, bg_xpos, xsize, buffer)
+                            : zeroes_.data();
     }
     return PerformBlending(memory_manager, bg_row_ptrs_.data(),
                            fg_row_ptrs_.data(), fg_row_ptrs_.data(), 0, xsize,
@@ -181,29 +189,18 @@ class BlendingStage : public RenderPipelineStage {
 
   void ProcessPaddingRow(const RowInfo& output_rows, size_t xsize, size_t xpos,
                          size_t ypos) const override {
-    if (bg_->xsize() == 0 || bg_->ysize() == 0) {
-      for (size_t c = 0; c < 3; ++c) {
-        memset(GetInputRow(output_rows, c, 0), 0, xsize * sizeof(float));
-      }
-    } else {
-      for (size_t c = 0; c < 3; ++c) {
-        memcpy(GetInputRow(output_rows, c, 0),
-               bg_->color().ConstPlaneRow(c, ypos) + xpos,
-               xsize * sizeof(float));
-      }
-    }
-    for (size_t ec = 0; ec < extra_channel_info_->size(); ++ec) {
-      const ImageBundle& ec_bg =
-          *state_
-               .reference_frames[frame_header_.extra_channel_blending_info[ec]
-                                     .source]
-               .frame;
-      if (ec_bg.xsize() == 0 || ec_bg.ysize() == 0) {
-        memset(GetInputRow(output_rows, 3 + ec, 0), 0, xsize * sizeof(float));
+    for (size_t c = 0; c < extra_channel_info_->size() + 3; ++c) {
+      const ReferceFrame& bg =
+          c < 3 ? *bg_
+                : state_.reference_frames
+                      [frame_header_.extra_channel_blending_info[c - 3].source];
+      float* row = GetInputRow(output_rows, c, 0);
+      if (bg.xsize() == 0 || bg.ysize() == 0) {
+        memset(row, 0, xsize * sizeof(float));
       } else {
-        memcpy(GetInputRow(output_rows, 3 + ec, 0),
-               ec_bg.extra_channels()[ec].ConstRow(ypos) + xpos,
-               xsize * sizeof(float));
+        // Rows stored as 16-bit floats are converted directly to the output.
+        const float* bg_row = bg.ConstRow(c, ypos, xpos, xsize, row);
+        if (bg_row != row) memcpy(row, bg_row, xsize * sizeof(float));
       }
     }
   }
@@ -214,8 +211,11 @@ class BlendingStage : public RenderPipelineStage {
   const FrameHeader& frame_header_;
   const PassesSharedState& state_;
   BlendingInfo info_;
-  const ImageBundle* bg_;
+  const ReferceFrame* bg_;
   Status initialized_ = true;
+  bool has_half_bg_ = false;
+  // One row per thread and channel, for backgrounds stored as 16-bit floats.
+  mutable ImageF bg_rows_;
   size_t image_xsize_;
   size_t image_ysize_;
   std::vector<PatchBlending> blending_info_;
@@ -5,7 +5,12 @@
 
 #include "lib/jxl/render_pipeline/stage_cms.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/color_encoding_internal.h"
@@ -16,12 +21,28 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
+#include "lib/jxl/cms/transfer_functions-inl.h"
 #include "lib/jxl/dec_xyb-inl.h"
 
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
 
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::AllTrue;
+using hwy::HWY_NAMESPACE::And;
+using hwy::HWY_NAMESPACE::ConvertTo;
+using hwy::HWY_NAMESPACE::FirstN;
+using hwy::HWY_NAMESPACE::Floor;
+using hwy::HWY_NAMESPACE::GatherIndex;
+using hwy::HWY_NAMESPACE::Ge;
+using hwy::HWY_NAMESPACE::IfThenElse;
+using hwy::HWY_NAMESPACE::IfThenElseZero;
+using hwy::HWY_NAMESPACE::Le;
+using hwy::HWY_NAMESPACE::Max;
+using hwy::HWY_NAMESPACE::Min;
+using hwy::HWY_NAMESPACE::Rebind;
+
 class CmsStage : public RenderPipelineStage {
  public:
   explicit CmsStage(OutputEncodingInfo output_encoding_info)
@@ -50,6 +71,10 @@ class CmsStage : public RenderPipelineStage {
     float* JXL_RESTRICT row0 = GetInputRow(input_rows, 0, 0);
     float* JXL_RESTRICT row1 = GetInputRow(input_rows, 1, 0);
     float* JXL_RESTRICT row2 = GetInputRow(input_rows, 2, 0);
+    if (!lut_.empty() && InLutRange(row0, row1, row2, xsize)) {
+      ApplyLut(row0, row1, row2, xsize);
+      return true;
+    }
     float* mutable_buf_src = color_space_transform->BufSrc(thread_id);
 
     for (size_t x = 0; x < xsize; x++) {
@@ -81,6 +106,123 @@ class CmsStage : public RenderPipelineStage {
   size_t xsize_;
   std::unique_ptr<jxl::ColorSpaceTransform> color_space_transform;
   ColorEncoding c_src_;
+  // Output of the CMS at the sRGB-encoded grid points (r, g, b) / (n - 1),
+  // interleaved, at ((r * n + g) * n + b) * 3.
+  std::vector<float> lut_;
+
+  // Whether the linear input values are all within the grid of the lookup
+  // table, i.e. in [0, 1] (and not NaN).
+  static bool InLutRange(const float* JXL_RESTRICT row0,
+                         const float* JXL_RESTRICT row1,
+                         const float* JXL_RESTRICT row2, size_t xsize) {
+    const HWY_FULL(float) d;
+    const size_t N = Lanes(d);
+    const auto zero = Zero(d);
+    const auto one = Set(d, 1.0f);
+    size_t x = 0;
+    for (; x + N <= xsize; x += N) {
+      for (const float* row : {row0, row1, row2}) {
+        const auto v = Load(d, row + x);
+        if (!AllTrue(d, And(Ge(v, zero), Le(v, one)))) return false;
+      }
+    }
+    for (; x < xsize; x++) {
+      for (const float* row : {row0, row1, row2}) {
+        if (!(row[x] >= 0.0f && row[x] <= 1.0f)) return false;
+      }
+    }
+    return true;
+  }
+
+  // Tetrahedral interpolation of the lookup table. The rows are padded to a
+  // multiple of the vector size; the lanes past xsize are computed from zeros.
+  void ApplyLut(float* JXL_RESTRICT row0, float* JXL_RESTRICT row1,
+                float* JXL_RESTRICT row2, size_t xsize) const {
+    const HWY_FULL(float) d;
+    const Rebind<int32_t, decltype(d)> di;
+    const size_t N = Lanes(d);
+    const size_t n = output_encoding_info_.cms_lut_size;
+    const TF_SRGB tf_srgb;
+    const auto scale = Set(d, n - 1);
+    const auto max_index = Set(d, n - 2);
+    const auto stride_r = Set(d, n * n * 3);
+    const auto stride_g = Set(d, n * 3);
+    const auto stride_b = Set(d, 3);
+    const auto stride_rgb = Add(stride_r, Add(stride_g, stride_b));
+    const auto one = Set(d, 1.0f);
+    const float* JXL_RESTRICT lut = lut_.data();
+    for (size_t x = 0; x < xsize; x += N) {
+      const auto m = FirstN(d, xsize - x);
+      const auto r = Mul(
+          tf_srgb.EncodedFromDisplay(d, IfThenElseZero(m, Load(d, row0 + x))),
+          scale);
+      const auto g = Mul(
+          tf_srgb.EncodedFromDisplay(d, IfThenElseZero(m, Load(d, row1 + x))),
+          scale);
+      const auto b = Mul(
+          tf_srgb.EncodedFromDisplay(d, IfThenElseZero(m, Load(d, row2 + x))),
+          scale);
+      const auto ri = Min(Floor(r), max_index);
+      const auto gi = Min(Floor(g), max_index);
+      const auto bi = Min(Floor(b), max_index);
+      const auto fr = Sub(r, ri);
+      const auto fg = Sub(g, gi);
+      const auto fb = Sub(b, bi);
+      // The tetrahedron is walked from the base corner along the axis with
+      // the largest fraction, then along the one with the smallest last.
+      const auto fmax = Max(fr, Max(fg, fb));
+      const auto fmin = Min(fr, Min(fg, fb));
+      const auto fmid = Sub(Sub(Add(fr, Add(fg, fb)), fmax), fmin);
+      const auto first =
+          IfThenElse(And(Ge(fr, fg), Ge(fr, fb)), stride_r,
+                     IfThenElse(Ge(fg, fb), stride_g, stride_b));
+      const auto last =
+          IfThenElse(And(Le(fb, fg), Le(fb, fr)), stride_b,
+                     IfThenElse(Le(fg, fr), stride_g, stride_r));
+      // The indices are below 2^24, hence exact in floating point.
+      const auto base = MulAdd(ri, stride_r, MulAdd(gi, stride_g,
+                                                    Mul(bi, stride_b)));
+      const auto idx0 = ConvertTo(di, base);
+      const auto idx1 = ConvertTo(di, Add(base, first));
+      const auto idx2 = ConvertTo(di, Add(base, Sub(stride_rgb, last)));
+      const auto idx3 = ConvertTo(di, Add(base, stride_rgb));
+      const auto w0 = Sub(one, fmax);
+      const auto w1 = Sub(fmax, fmid);
+      const auto w2 = Sub(fmid, fmin);
+      float* JXL_RESTRICT rows[3] = {row0, row1, row2};
+      for (size_t c = 0; c < 3; c++) {
+        auto out = Mul(fmin, GatherIndex(d, lut + c, idx3));
+        out = MulAdd(w2, GatherIndex(d, lut + c, idx2), out);
+        out = MulAdd(w1, GatherIndex(d, lut + c, idx1), out);
+        out = MulAdd(w0, GatherIndex(d, lut + c, idx0), out);
+        Store(out, d, rows[c] + x);
+      }
+    }
+  }
+
+  // Runs the CMS on the grid points of the lookup table.
+  Status BakeLut() {
+    const size_t n = output_encoding_info_.cms_lut_size;
+    std::vector<float> grid(n);
+    for (size_t i = 0; i < n; i++) {
+      const double v = static_cast<double>(i) / (n - 1);
+      grid[i] = v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+    }
+    const size_t num_points = n * n * n;
+    lut_.resize(num_points * 3);
+    float* buf_src = color_space_transform->BufSrc(0);
+    for (size_t begin = 0; begin < num_points; begin += xsize_) {
+      const size_t end = std::min(num_points, begin + xsize_);
+      for (size_t i = begin; i < end; i++) {
+        buf_src[3 * (i - begin) + 0] = grid[i / (n * n)];
+        buf_src[3 * (i - begin) + 1] = grid[(i / n) % n];
+        buf_src[3 * (i - begin) + 2] = grid[i % n];
+      }
+      JXL_RETURN_IF_ERROR(color_space_transform->Run(
+          0, buf_src, lut_.data() + 3 * begin, end - begin));
+    }
+    return true;
+  }
 
   Status SetInputSizes(
       const std::vector<std::pair<size_t, size_t>>& input_sizes) override {
@@ -99,6 +241,12 @@ class CmsStage : public RenderPipelineStage {
     JXL_RETURN_IF_ERROR(color_space_transform->Init(
         c_src_, output_encoding_info_.color_encoding,
         output_encoding_info_.desired_intensity_target, xsize_, num_threads));
+    lut_.clear();
+    if (output_encoding_info_.cms_lut_size >= 2 && c_src_.Channels() == 3 &&
+        !c_src_.IsCMYK() &&
+        output_encoding_info_.color_encoding.Channels() == 3) {
+      JXL_RETURN_IF_ERROR(BakeLut());
+    }
     return true;
   }
 };
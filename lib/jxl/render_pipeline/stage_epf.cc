@@ -5,6 +5,8 @@
 
 #include "lib/jxl/render_pipeline/stage_epf.h"
 
+#include <cstring>
+
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/status.h"
@@ -38,45 +40,72 @@ JXL_INLINE Vec<DF> Weight(Vec<DF> sad, Vec<DF> inv_sigma, Vec<DF> thres) {
   return ZeroIfNegative(v);
 }
 
+// Calls `filter(x, bx)` for the vectors of the row in [x0, x1) that lie in a
+// block `bx` with a sigma of at least kMinSigma, and copies the center rows
+// `in` to `out` in the runs of other blocks, which the filter leaves as is.
+// With `kLumaOnly`, only the rows of the Y channel are used.
+template <bool kLumaOnly, typename Filter>
+JXL_INLINE void ForEachFilteredVector(const float* JXL_RESTRICT row_sigma,
+                                      float* JXL_RESTRICT const in[3],
+                                      float* JXL_RESTRICT const out[3],
+                                      ssize_t x0, ssize_t x1, size_t xpos,
+                                      const Filter& filter) {
+  const ssize_t N = Lanes(DF());
+  ssize_t copy_begin = x0;
+  const auto copy = [&](ssize_t copy_end) {
+    if (copy_end <= copy_begin) return;
+    for (size_t c = kLumaOnly ? 1 : 0; c < (kLumaOnly ? 2 : 3); c++) {
+      memcpy(out[c] + copy_begin, in[c] + copy_begin,
+             (copy_end - copy_begin) * sizeof(float));
+    }
+  };
+  ssize_t x = x0;
+  for (; x < x1; x += N) {
+    size_t bx = (x + xpos + kSigmaPadding * kBlockDim) / kBlockDim;
+    if (row_sigma[bx] < kMinSigma) continue;
+    copy(x);
+    filter(x, bx);
+    copy_begin = x + N;
+  }
+  copy(x);
+}
+
 // 5x5 plus-shaped kernel with 5 SADs per pixel (3x3 plus-shaped). So this makes
 // this filter a 7x7 filter.
 class EPF0Stage : public RenderPipelineStage {
  public:
-  EPF0Stage(LoopFilter lf, const ImageF& sigma)
+  EPF0Stage(LoopFilter lf, const ImageF& sigma, bool luma_only)
       : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
             /*shift=*/0, /*border=*/3)),
         lf_(std::move(lf)),
-        sigma_(&sigma) {}
+        sigma_(&sigma),
+        luma_only_(luma_only) {}
 
-  template <bool aligned>
+  template <bool aligned, bool kLumaOnly>
   JXL_INLINE void AddPixel(int row, float* JXL_RESTRICT rows[3][7], ssize_t x,
                            Vec<DF> sad, Vec<DF> inv_sigma,
                            Vec<DF>* JXL_RESTRICT X, Vec<DF>* JXL_RESTRICT Y,
                            Vec<DF>* JXL_RESTRICT B,
                            Vec<DF>* JXL_RESTRICT w) const {
-    auto cx = aligned ? Load(DF(), rows[0][3 + row] + x)
-                      : LoadU(DF(), rows[0][3 + row] + x);
-    auto cy = aligned ? Load(DF(), rows[1][3 + row] + x)
-                      : LoadU(DF(), rows[1][3 + row] + x);
-    auto cb = aligned ? Load(DF(), rows[2][3 + row] + x)
-                      : LoadU(DF(), rows[2][3 + row] + x);
+    const auto load = [&](size_t c) {
+      return aligned ? Load(DF(), rows[c][3 + row] + x)
+                     : LoadU(DF(), rows[c][3 + row] + x);
+    };
 
     auto weight = Weight(sad, inv_sigma, Set(DF(), lf_.epf_pass1_zeroflush));
     *w = Add(*w, weight);
-    *X = MulAdd(weight, cx, *X);
-    *Y = MulAdd(weight, cy, *Y);
-    *B = MulAdd(weight, cb, *B);
+    if (!kLumaOnly) *X = MulAdd(weight, load(0), *X);
+    *Y = MulAdd(weight, load(1), *Y);
+    if (!kLumaOnly) *B = MulAdd(weight, load(2), *B);
   }
 
-  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
-                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
-                    size_t thread_id) const final {
+  template <bool kLumaOnly>
+  Status ProcessRows(const RowInfo& input_rows, const RowInfo& output_rows,
+                     size_t xextra, size_t xsize, size_t xpos,
+                     size_t ypos) const {
+    constexpr size_t kFirstC = kLumaOnly ? 1 : 0;
+    constexpr size_t kEndC = kLumaOnly ? 2 : 3;
     DF df;
-
-    using V = decltype(Zero(df));
-    V t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, tA, tB;  // NOLINT
-    V* sads[12] = {&t0, &t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8, &t9, &tA, &tB};
-
     xextra = RoundUpTo(xextra, Lanes(df));
     const float* JXL_RESTRICT row_sigma =
         sigma_->Row(ypos / kBlockDim + kSigmaPadding);
@@ -89,7 +118,7 @@ class EPF0Stage : public RenderPipelineStage {
     HWY_ALIGN float sad_mul_border[kBlockDim] = {bsm, bsm, bsm, bsm,
                                                  bsm, bsm, bsm, bsm};
     float* JXL_RESTRICT rows[3][7];
-    for (size_t c = 0; c < 3; c++) {
+    for (size_t c = kFirstC; c < kEndC; c++) {
       for (int i = 0; i < 7; i++) {
         rows[c][i] = GetInputRow(input_rows, c, i - 3);
       }
@@ -100,22 +129,22 @@ class EPF0Stage : public RenderPipelineStage {
             ? sad_mul_border
             : sad_mul_center;
 
-    for (ssize_t x = -xextra; x < static_cast<ssize_t>(xsize + xextra);
-         x += Lanes(df)) {
-      size_t bx = (x + xpos + kSigmaPadding * kBlockDim) / kBlockDim;
+    float* JXL_RESTRICT center[3] = {};
+    float* JXL_RESTRICT out[3] = {};
+    for (size_t c = kFirstC; c < kEndC; c++) {
+      center[c] = rows[c][3];
+      out[c] = GetOutputRow(output_rows, c, 0);
+    }
+    const auto filter = [&](ssize_t x, size_t bx) {
       size_t ix = (x + xpos) % kBlockDim;
 
-      if (row_sigma[bx] < kMinSigma) {
-        for (size_t c = 0; c < 3; c++) {
-          auto px = Load(df, rows[c][3 + 0] + x);
-          StoreU(px, df, GetOutputRow(output_rows, c, 0) + x);
-        }
-        continue;
-      }
-
       const auto sm = Load(df, sad_mul + ix);
       const auto inv_sigma = Mul(Set(df, row_sigma[bx]), sm);
 
+      using V = decltype(Zero(df));
+      V t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, tA, tB;  // NOLINT
+      V* sads[12] = {&t0, &t1, &t2, &t3, &t4, &t5,
+                     &t6, &t7, &t8, &t9, &tA, &tB};
       for (auto& sad : sads) *sad = Zero(df);
       constexpr std::array<int, 2> sads_off[12] = {
           {{-2, 0}}, {{-1, -1}}, {{-1, 0}}, {{-1, 1}}, {{0, -2}}, {{0, -1}},
@@ -123,25 +152,28 @@ class EPF0Stage : public RenderPipelineStage {
       };
 
       // compute sads
-      // TODO(veluca): consider unrolling and optimizing this.
-      for (size_t c = 0; c < 3; c++) {
+      for (size_t c = kFirstC; c < kEndC; c++) {
         auto scale = Set(df, lf_.epf_channel_scale[c]);
+        // The plus around the center pixel is shared by all the SADs.
+        const auto r_c = Load(df, rows[c][3] + x);
+        const auto r_t = Load(df, rows[c][2] + x);
+        const auto r_l = LoadU(df, rows[c][3] + x - 1);
+        const auto r_b = Load(df, rows[c][4] + x);
+        const auto r_r = LoadU(df, rows[c][3] + x + 1);
         for (size_t i = 0; i < 12; i++) {
-          auto sad = Zero(df);
-          constexpr std::array<int, 2> plus_off[] = {
-              {{0, 0}}, {{-1, 0}}, {{0, -1}}, {{1, 0}}, {{0, 1}}};
-          for (const auto& off : plus_off) {
-            const auto r11 = LoadU(df, rows[c][3 + off[0]] + x + off[1]);
-            const auto c11 = LoadU(df, rows[c][3 + sads_off[i][0] + off[0]] +
-                                           x + sads_off[i][1] + off[1]);
-            sad = Add(sad, AbsDiff(r11, c11));
-          }
+          const int dy = sads_off[i][0];
+          const ssize_t ox = x + sads_off[i][1];
+          auto sad = AbsDiff(r_c, LoadU(df, rows[c][3 + dy] + ox));
+          sad = Add(sad, AbsDiff(r_t, LoadU(df, rows[c][2 + dy] + ox)));
+          sad = Add(sad, AbsDiff(r_l, LoadU(df, rows[c][3 + dy] + ox - 1)));
+          sad = Add(sad, AbsDiff(r_b, LoadU(df, rows[c][4 + dy] + ox)));
+          sad = Add(sad, AbsDiff(r_r, LoadU(df, rows[c][3 + dy] + ox + 1)));
           *sads[i] = MulAdd(sad, scale, *sads[i]);
         }
       }
-      const auto x_cc = Load(df, rows[0][3 + 0] + x);
+      const auto x_cc = kLumaOnly ? Zero(df) : Load(df, rows[0][3 + 0] + x);
       const auto y_cc = Load(df, rows[1][3 + 0] + x);
-      const auto b_cc = Load(df, rows[2][3 + 0] + x);
+      const auto b_cc = kLumaOnly ? Zero(df) : Load(df, rows[2][3 + 0] + x);
 
       auto w = Set(df, 1);
       auto X = x_cc;
@@ -149,25 +181,37 @@ class EPF0Stage : public RenderPipelineStage {
       auto B = b_cc;
 
       for (size_t i = 0; i < 12; i++) {
-        AddPixel</*aligned=*/false>(/*row=*/sads_off[i][0], rows,
-                                    x + sads_off[i][1], *sads[i], inv_sigma, &X,
-                                    &Y, &B, &w);
+        AddPixel</*aligned=*/false, kLumaOnly>(
+            /*row=*/sads_off[i][0], rows, x + sads_off[i][1], *sads[i],
+            inv_sigma, &X, &Y, &B, &w);
       }
 #if JXL_HIGH_PRECISION
       auto inv_w = Div(Set(df, 1.0f), w);
 #else
       auto inv_w = ApproximateReciprocal(w);
 #endif
-      StoreU(Mul(X, inv_w), df, GetOutputRow(output_rows, 0, 0) + x);
-      StoreU(Mul(Y, inv_w), df, GetOutputRow(output_rows, 1, 0) + x);
-      StoreU(Mul(B, inv_w), df, GetOutputRow(output_rows, 2, 0) + x);
-    }
+      if (!kLumaOnly) StoreU(Mul(X, inv_w), df, out[0] + x);
+      StoreU(Mul(Y, inv_w), df, out[1] + x);
+      if (!kLumaOnly) StoreU(Mul(B, inv_w), df, out[2] + x);
+    };
+    ForEachFilteredVector<kLumaOnly>(row_sigma, center, out, -xextra,
+                                     xsize + xextra, xpos, filter);
     return true;
   }
 
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    return luma_only_ ? ProcessRows<true>(input_rows, output_rows, xextra,
+                                          xsize, xpos, ypos)
+                      : ProcessRows<false>(input_rows, output_rows, xextra,
+                                           xsize, xpos, ypos);
+  }
+
   RenderPipelineChannelMode GetChannelMode(size_t c) const final {
-    return c < 3 ? RenderPipelineChannelMode::kInOut
-                 : RenderPipelineChannelMode::kIgnored;
+    return (c == 1 || (c < 3 && !luma_only_))
+               ? RenderPipelineChannelMode::kInOut
+               : RenderPipelineChannelMode::kIgnored;
   }
 
   const char* GetName() const override { return "EPF0"; }
@@ -175,41 +219,44 @@ class EPF0Stage : public RenderPipelineStage {
  private:
   LoopFilter lf_;
   const ImageF* sigma_;
+  bool luma_only_;
 };
 
 // 3x3 plus-shaped kernel with 5 SADs per pixel (also 3x3 plus-shaped). So this
 // makes this filter a 5x5 filter.
 class EPF1Stage : public RenderPipelineStage {
  public:
-  EPF1Stage(LoopFilter lf, const ImageF& sigma)
+  EPF1Stage(LoopFilter lf, const ImageF& sigma, bool luma_only)
       : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
             /*shift=*/0, /*border=*/2)),
         lf_(std::move(lf)),
-        sigma_(&sigma) {}
+        sigma_(&sigma),
+        luma_only_(luma_only) {}
 
-  template <bool aligned>
+  template <bool aligned, bool kLumaOnly>
   JXL_INLINE void AddPixel(int row, float* JXL_RESTRICT rows[3][5], ssize_t x,
                            Vec<DF> sad, Vec<DF> inv_sigma,
                            Vec<DF>* JXL_RESTRICT X, Vec<DF>* JXL_RESTRICT Y,
                            Vec<DF>* JXL_RESTRICT B,
                            Vec<DF>* JXL_RESTRICT w) const {
-    auto cx = aligned ? Load(DF(), rows[0][2 + row] + x)
-                      : LoadU(DF(), rows[0][2 + row] + x);
-    auto cy = aligned ? Load(DF(), rows[1][2 + row] + x)
-                      : LoadU(DF(), rows[1][2 + row] + x);
-    auto cb = aligned ? Load(DF(), rows[2][2 + row] + x)
-                      : LoadU(DF(), rows[2][2 + row] + x);
+    const auto load = [&](size_t c) {
+      return aligned ? Load(DF(), rows[c][2 + row] + x)
+                     : LoadU(DF(), rows[c][2 + row] + x);
+    };
 
     auto weight = Weight(sad, inv_sigma, Set(DF(), lf_.epf_pass1_zeroflush));
     *w = Add(*w, weight);
-    *X = MulAdd(weight, cx, *X);
-    *Y = MulAdd(weight, cy, *Y);
-    *B = MulAdd(weight, cb, *B);
+    if (!kLumaOnly) *X = MulAdd(weight, load(0), *X);
+    *Y = MulAdd(weight, load(1), *Y);
+    if (!kLumaOnly) *B = MulAdd(weight, load(2), *B);
   }
 
-  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
-                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
-                    size_t thread_id) const final {
+  template <bool kLumaOnly>
+  Status ProcessRows(const RowInfo& input_rows, const RowInfo& output_rows,
+                     size_t xextra, size_t xsize, size_t xpos,
+                     size_t ypos) const {
+    constexpr size_t kFirstC = kLumaOnly ? 1 : 0;
+    constexpr size_t kEndC = kLumaOnly ? 2 : 3;
     DF df;
     xextra = RoundUpTo(xextra, Lanes(df));
     const float* JXL_RESTRICT row_sigma =
@@ -224,7 +271,7 @@ class EPF1Stage : public RenderPipelineStage {
                                                  bsm, bsm, bsm, bsm};
 
     float* JXL_RESTRICT rows[3][5];
-    for (size_t c = 0; c < 3; c++) {
+    for (size_t c = kFirstC; c < kEndC; c++) {
       for (int i = 0; i < 5; i++) {
         rows[c][i] = GetInputRow(input_rows, c, i - 2);
       }
@@ -235,19 +282,15 @@ class EPF1Stage : public RenderPipelineStage {
             ? sad_mul_border
             : sad_mul_center;
 
-    for (ssize_t x = -xextra; x < static_cast<ssize_t>(xsize + xextra);
-         x += Lanes(df)) {
-      size_t bx = (x + xpos + kSigmaPadding * kBlockDim) / kBlockDim;
+    float* JXL_RESTRICT center[3] = {};
+    float* JXL_RESTRICT out[3] = {};
+    for (size_t c = kFirstC; c < kEndC; c++) {
+      center[c] = rows[c][2];
+      out[c] = GetOutputRow(output_rows, c, 0);
+    }
+    const auto filter = [&](ssize_t x, size_t bx) {
       size_t ix = (x + xpos) % kBlockDim;
 
-      if (row_sigma[bx] < kMinSigma) {
-        for (size_t c = 0; c < 3; c++) {
-          auto px = Load(df, rows[c][2 + 0] + x);
-          Store(px, df, GetOutputRow(output_rows, c, 0) + x);
-        }
-        continue;
-      }
-
       const auto sm = Load(df, sad_mul + ix);
       const auto inv_sigma = Mul(Set(df, row_sigma[bx]), sm);
       auto sad0 = Zero(df);
@@ -256,7 +299,7 @@ class EPF1Stage : public RenderPipelineStage {
       auto sad3 = Zero(df);
 
       // compute sads
-      for (size_t c = 0; c < 3; c++) {
+      for (size_t c = kFirstC; c < kEndC; c++) {
         // center px = 22, px above = 21
         auto t = Undefined(df);
 
@@ -314,9 +357,9 @@ class EPF1Stage : public RenderPipelineStage {
         sad2 = MulAdd(sad2c, scale, sad2);
         sad3 = MulAdd(sad3c, scale, sad3);
       }
-      const auto x_cc = Load(df, rows[0][2 + 0] + x);
+      const auto x_cc = kLumaOnly ? Zero(df) : Load(df, rows[0][2 + 0] + x);
       const auto y_cc = Load(df, rows[1][2 + 0] + x);
-      const auto b_cc = Load(df, rows[2][2 + 0] + x);
+      const auto b_cc = kLumaOnly ? Zero(df) : Load(df, rows[2][2 + 0] + x);
 
       auto w = Set(df, 1);
       auto X = x_cc;
@@ -324,31 +367,43 @@ class EPF1Stage : public RenderPipelineStage {
       auto B = b_cc;
 
       // Top row
-      AddPixel</*aligned=*/true>(/*row=*/-1, rows, x, sad0, inv_sigma, &X, &Y,
-                                 &B, &w);
+      AddPixel</*aligned=*/true, kLumaOnly>(/*row=*/-1, rows, x, sad0,
+                                            inv_sigma, &X, &Y, &B, &w);
       // Center
-      AddPixel</*aligned=*/false>(/*row=*/0, rows, x - 1, sad1, inv_sigma, &X,
-                                  &Y, &B, &w);
-      AddPixel</*aligned=*/false>(/*row=*/0, rows, x + 1, sad2, inv_sigma, &X,
-                                  &Y, &B, &w);
+      AddPixel</*aligned=*/false, kLumaOnly>(/*row=*/0, rows, x - 1, sad1,
+                                             inv_sigma, &X, &Y, &B, &w);
+      AddPixel</*aligned=*/false, kLumaOnly>(/*row=*/0, rows, x + 1, sad2,
+                                             inv_sigma, &X, &Y, &B, &w);
       // Bottom
-      AddPixel</*aligned=*/true>(/*row=*/1, rows, x, sad3, inv_sigma, &X, &Y,
-                                 &B, &w);
+      AddPixel</*aligned=*/true, kLumaOnly>(/*row=*/1, rows, x, sad3,
+                                            inv_sigma, &X, &Y, &B, &w);
 #if JXL_HIGH_PRECISION
       auto inv_w = Div(Set(df, 1.0f), w);
 #else
       auto inv_w = ApproximateReciprocal(w);
 #endif
-      Store(Mul(X, inv_w), df, GetOutputRow(output_rows, 0, 0) + x);
-      Store(Mul(Y, inv_w), df, GetOutputRow(output_rows, 1, 0) + x);
-      Store(Mul(B, inv_w), df, GetOutputRow(output_rows, 2, 0) + x);
-    }
+      if (!kLumaOnly) Store(Mul(X, inv_w), df, out[0] + x);
+      Store(Mul(Y, inv_w), df, out[1] + x);
+      if (!kLumaOnly) Store(Mul(B, inv_w), df, out[2] + x);
+    };
+    ForEachFilteredVector<kLumaOnly>(row_sigma, center, out, -xextra,
+                                     xsize + xextra, xpos, filter);
     return true;
   }
 
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    return luma_only_ ? ProcessRows<true>(input_rows, output_rows, xextra,
+                                          xsize, xpos, ypos)
+                      : ProcessRows<false>(input_rows, output_rows, xextra,
+                                           xsize, xpos, ypos);
+  }
+
   RenderPipelineChannelMode GetChannelMode(size_t c) const final {
-    return c < 3 ? RenderPipelineChannelMode::kInOut
-                 : RenderPipelineChannelMode::kIgnored;
+    return (c == 1 || (c < 3 && !luma_only_))
+               ? RenderPipelineChannelMode::kInOut
+               : RenderPipelineChannelMode::kIgnored;
   }
 
   const char* GetName() const override { return "EPF1"; }
@@ -356,46 +411,57 @@ class EPF1Stage : public RenderPipelineStage {
  private:
   LoopFilter lf_;
   const ImageF* sigma_;
+  bool luma_only_;
 };
 
 // 3x3 plus-shaped kernel with 1 SAD per pixel. So this makes this filter a 3x3
 // filter.
 class EPF2Stage : public RenderPipelineStage {
  public:
-  EPF2Stage(LoopFilter lf, const ImageF& sigma)
+  EPF2Stage(LoopFilter lf, const ImageF& sigma, bool luma_only)
       : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
             /*shift=*/0, /*border=*/1)),
         lf_(std::move(lf)),
-        sigma_(&sigma) {}
+        sigma_(&sigma),
+        luma_only_(luma_only) {}
 
-  template <bool aligned>
+  template <bool aligned, bool kLumaOnly>
   JXL_INLINE void AddPixel(int row, float* JXL_RESTRICT rows[3][3], ssize_t x,
                            Vec<DF> rx, Vec<DF> ry, Vec<DF> rb,
                            Vec<DF> inv_sigma, Vec<DF>* JXL_RESTRICT X,
                            Vec<DF>* JXL_RESTRICT Y, Vec<DF>* JXL_RESTRICT B,
                            Vec<DF>* JXL_RESTRICT w) const {
-    auto cx = aligned ? Load(DF(), rows[0][1 + row] + x)
-                      : LoadU(DF(), rows[0][1 + row] + x);
-    auto cy = aligned ? Load(DF(), rows[1][1 + row] + x)
-                      : LoadU(DF(), rows[1][1 + row] + x);
-    auto cb = aligned ? Load(DF(), rows[2][1 + row] + x)
-                      : LoadU(DF(), rows[2][1 + row] + x);
-
-    auto sad = Mul(AbsDiff(cx, rx), Set(DF(), lf_.epf_channel_scale[0]));
+    const auto load = [&](size_t c) {
+      return aligned ? Load(DF(), rows[c][1 + row] + x)
+                     : LoadU(DF(), rows[c][1 + row] + x);
+    };
+    const auto cx = kLumaOnly ? Zero(DF()) : load(0);
+    const auto cy = load(1);
+    const auto cb = kLumaOnly ? Zero(DF()) : load(2);
+
+    auto sad = Zero(DF());
+    if (!kLumaOnly) {
+      sad = Mul(AbsDiff(cx, rx), Set(DF(), lf_.epf_channel_scale[0]));
+    }
     sad = MulAdd(AbsDiff(cy, ry), Set(DF(), lf_.epf_channel_scale[1]), sad);
-    sad = MulAdd(AbsDiff(cb, rb), Set(DF(), lf_.epf_channel_scale[2]), sad);
+    if (!kLumaOnly) {
+      sad = MulAdd(AbsDiff(cb, rb), Set(DF(), lf_.epf_channel_scale[2]), sad);
+    }
 
     auto weight = Weight(sad, inv_sigma, Set(DF(), lf_.epf_pass2_zeroflush));
 
     *w = Add(*w, weight);
-    *X = MulAdd(weight, cx, *X);
+    if (!kLumaOnly) *X = MulAdd(weight, cx, *X);
     *Y = MulAdd(weight, cy, *Y);
-    *B = MulAdd(weight, cb, *B);
+    if (!kLumaOnly) *B = MulAdd(weight, cb, *B);
   }
 
-  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
-                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
-                    size_t thread_id) const final {
+  template <bool kLumaOnly>
+  Status ProcessRows(const RowInfo& input_rows, const RowInfo& output_rows,
+                     size_t xextra, size_t xsize, size_t xpos,
+                     size_t ypos) const {
+    constexpr size_t kFirstC = kLumaOnly ? 1 : 0;
+    constexpr size_t kEndC = kLumaOnly ? 2 : 3;
     DF df;
     xextra = RoundUpTo(xextra, Lanes(df));
     const float* JXL_RESTRICT row_sigma =
@@ -410,7 +476,7 @@ class EPF2Stage : public RenderPipelineStage {
                                                  bsm, bsm, bsm, bsm};
 
     float* JXL_RESTRICT rows[3][3];
-    for (size_t c = 0; c < 3; c++) {
+    for (size_t c = kFirstC; c < kEndC; c++) {
       for (int i = 0; i < 3; i++) {
         rows[c][i] = GetInputRow(input_rows, c, i - 1);
       }
@@ -421,25 +487,21 @@ class EPF2Stage : public RenderPipelineStage {
             ? sad_mul_border
             : sad_mul_center;
 
-    for (ssize_t x = -xextra; x < static_cast<ssize_t>(xsize + xextra);
-         x += Lanes(df)) {
-      size_t bx = (x + xpos + kSigmaPadding * kBlockDim) / kBlockDim;
+    float* JXL_RESTRICT center[3] = {};
+    float* JXL_RESTRICT out[3] = {};
+    for (size_t c = kFirstC; c < kEndC; c++) {
+      center[c] = rows[c][1];
+      out[c] = GetOutputRow(output_rows, c, 0);
+    }
+    const auto filter = [&](ssize_t x, size_t bx) {
       size_t ix = (x + xpos) % kBlockDim;
 
-      if (row_sigma[bx] < kMinSigma) {
-        for (size_t c = 0; c < 3; c++) {
-          auto px = Load(df, rows[c][1 + 0] + x);
-          Store(px, df, GetOutputRow(output_rows, c, 0) + x);
-        }
-        continue;
-      }
-
       const auto sm = Load(df, sad_mul + ix);
       const auto inv_sigma = Mul(Set(df, row_sigma[bx]), sm);
 
-      const auto x_cc = Load(df, rows[0][1 + 0] + x);
+      const auto x_cc = kLumaOnly ? Zero(df) : Load(df, rows[0][1 + 0] + x);
       const auto y_cc = Load(df, rows[1][1 + 0] + x);
-      const auto b_cc = Load(df, rows[2][1 + 0] + x);
+      const auto b_cc = kLumaOnly ? Zero(df) : Load(df, rows[2][1 + 0] + x);
 
       auto w = Set(df, 1);
       auto X = x_cc;
@@ -447,31 +509,45 @@ class EPF2Stage : public RenderPipelineStage {
       auto B = b_cc;
 
       // Top row
-      AddPixel</*aligned=*/true>(/*row=*/-1, rows, x, x_cc, y_cc, b_cc,
-                                 inv_sigma, &X, &Y, &B, &w);
+      AddPixel</*aligned=*/true, kLumaOnly>(/*row=*/-1, rows, x, x_cc, y_cc,
+                                            b_cc, inv_sigma, &X, &Y, &B, &w);
       // Center
-      AddPixel</*aligned=*/false>(/*row=*/0, rows, x - 1, x_cc, y_cc, b_cc,
-                                  inv_sigma, &X, &Y, &B, &w);
-      AddPixel</*aligned=*/false>(/*row=*/0, rows, x + 1, x_cc, y_cc, b_cc,
-                                  inv_sigma, &X, &Y, &B, &w);
+      AddPixel</*aligned=*/false, kLumaOnly>(/*row=*/0, rows, x - 1, x_cc,
+                                             y_cc, b_cc, inv_sigma, &X, &Y, &B,
+                                             &w);
+      AddPixel</*aligned=*/false, kLumaOnly>(/*row=*/0, rows, x + 1, x_cc,
+                                             y_cc, b_cc, inv_sigma, &X, &Y, &B,
+                                             &w);
       // Bottom
-      AddPixel</*aligned=*/true>(/*row=*/1, rows, x, x_cc, y_cc, b_cc,
-                                 inv_sigma, &X, &Y, &B, &w);
+      AddPixel</*aligned=*/true, kLumaOnly>(/*row=*/1, rows, x, x_cc, y_cc,
+                                            b_cc, inv_sigma, &X, &Y, &B, &w);
 #if JXL_HIGH_PRECISION
       auto inv_w = Div(Set(df, 1.0f), w);
 #else
       auto inv_w = ApproximateReciprocal(w);
 #endif
-      Store(Mul(X, inv_w), df, GetOutputRow(output_rows, 0, 0) + x);
-      Store(Mul(Y, inv_w), df, GetOutputRow(output_rows, 1, 0) + x);
-      Store(Mul(B, inv_w), df, GetOutputRow(output_rows, 2, 0) + x);
-    }
+      if (!kLumaOnly) Store(Mul(X, inv_w), df, out[0] + x);
+      Store(Mul(Y, inv_w), df, out[1] + x);
+      if (!kLumaOnly) Store(Mul(B, inv_w), df, out[2] + x);
+    };
+    ForEachFilteredVector<kLumaOnly>(row_sigma, center, out, -xextra,
+                                     xsize + xextra, xpos, filter);
     return true;
   }
 
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    return luma_only_ ? ProcessRows<true>(input_rows, output_rows, xextra,
+                                          xsize, xpos, ypos)
+                      : ProcessRows<false>(input_rows, output_rows, xextra,
+                                           xsize, xpos, ypos);
+  }
+
   RenderPipelineChannelMode GetChannelMode(size_t c) const final {
-    return c < 3 ? RenderPipelineChannelMode::kInOut
-                 : RenderPipelineChannelMode::kIgnored;
+    return (c == 1 || (c < 3 && !luma_only_))
+               ? RenderPipelineChannelMode::kInOut
+               : RenderPipelineChannelMode::kIgnored;
   }
 
   const char* GetName() const override { return "EPF2"; }
@@ -479,21 +555,25 @@ class EPF2Stage : public RenderPipelineStage {
  private:
   LoopFilter lf_;
   const ImageF* sigma_;
+  bool luma_only_;
 };
 
 std::unique_ptr<RenderPipelineStage> GetEPFStage0(const LoopFilter& lf,
-                                                  const ImageF& sigma) {
-  return jxl::make_unique<EPF0Stage>(lf, sigma);
+                                                  const ImageF& sigma,
+                                                  bool luma_only) {
+  return jxl::make_unique<EPF0Stage>(lf, sigma, luma_only);
 }
 
 std::unique_ptr<RenderPipelineStage> GetEPFStage1(const LoopFilter& lf,
-                                                  const ImageF& sigma) {
-  return jxl::make_unique<EPF1Stage>(lf, sigma);
+                                                  const ImageF& sigma,
+                                                  bool luma_only) {
+  return jxl::make_unique<EPF1Stage>(lf, sigma, luma_only);
 }
 
 std::unique_ptr<RenderPipelineStage> GetEPFStage2(const LoopFilter& lf,
-                                                  const ImageF& sigma) {
-  return jxl::make_unique<EPF2Stage>(lf, sigma);
+                                                  const ImageF& sigma,
+                                                  bool luma_only) {
+  return jxl::make_unique<EPF2Stage>(lf, sigma, luma_only);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -510,15 +590,16 @@ HWY_EXPORT(GetEPFStage2);
 
 std::unique_ptr<RenderPipelineStage> GetEPFStage(const LoopFilter& lf,
                                                  const ImageF& sigma,
-                                                 EpfStage epf_stage) {
+                                                 EpfStage epf_stage,
+                                                 bool luma_only) {
   if (lf.epf_iters == 0) return nullptr;
   switch (epf_stage) {
     case EpfStage::Zero:
-      return HWY_DYNAMIC_DISPATCH(GetEPFStage0)(lf, sigma);
+      return HWY_DYNAMIC_DISPATCH(GetEPFStage0)(lf, sigma, luma_only);
     case EpfStage::One:
-      return HWY_DYNAMIC_DISPATCH(GetEPFStage1)(lf, sigma);
+      return HWY_DYNAMIC_DISPATCH(GetEPFStage1)(lf, sigma, luma_only);
     case EpfStage::Two:
-      return HWY_DYNAMIC_DISPATCH(GetEPFStage2)(lf, sigma);
+      return HWY_DYNAMIC_DISPATCH(GetEPFStage2)(lf, sigma, luma_only);
   }
   JXL_DEBUG_ABORT("internal: unexpected EpfStage: %d",
                   static_cast<int>(epf_stage));
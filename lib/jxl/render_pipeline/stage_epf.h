@@ -21,9 +21,12 @@ enum class EpfStage : uint8_t { Zero, One, Two };
 // `sigma` will be accessed with an offset of (kSigmaPadding, kSigmaPadding),
 // and should have (kSigmaBorder, kSigmaBorder) mirrored sigma values available
 // around the main image. See also filters.(h|cc)
+// If `luma_only`, only the Y channel is filtered, with weights computed from Y
+// alone, and the X and B channels are ignored.
 std::unique_ptr<RenderPipelineStage> GetEPFStage(const LoopFilter& lf,
                                                  const ImageF& sigma,
-                                                 EpfStage epf_stage);
+                                                 EpfStage epf_stage,
+                                                 bool luma_only);
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_EPF_H_
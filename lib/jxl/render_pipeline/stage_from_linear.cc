@@ -16,6 +16,7 @@
 #include "lib/jxl/cms/tone_mapping-inl.h"
 #include "lib/jxl/cms/transfer_functions-inl.h"
 #include "lib/jxl/common.h"  // JXL_HIGH_PRECISION
+#include "lib/jxl/dec_xyb-inl.h"
 
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
@@ -153,25 +154,99 @@ std::unique_ptr<FromLinearStage<Op>> MakeFromLinearStage(Op&& op) {
   return jxl::make_unique<FromLinearStage<Op>>(std::forward<Op>(op));
 }
 
-std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
-    const OutputEncodingInfo& output_encoding_info) {
+// XYBStage and FromLinearStage in one pass, so that the linear pixels are
+// never stored. The opsin inverse matrix of the output encoding info already
+// converts to the output primaries.
+template <typename Op>
+class XYBToEncodedStage : public RenderPipelineStage {
+ public:
+  XYBToEncodedStage(const OpsinParams& opsin_params, Op op)
+      : RenderPipelineStage(RenderPipelineStage::Settings()),
+        opsin_params_(opsin_params),
+        op_(std::move(op)) {}
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    const HWY_FULL(float) d;
+    JXL_ENSURE(xextra == 0);
+    const size_t xsize_v = RoundUpTo(xsize, Lanes(d));
+    float* JXL_RESTRICT row0 = GetInputRow(input_rows, 0, 0);
+    float* JXL_RESTRICT row1 = GetInputRow(input_rows, 1, 0);
+    float* JXL_RESTRICT row2 = GetInputRow(input_rows, 2, 0);
+    // All calculations are lane-wise, still some might require
+    // value-dependent behaviour (e.g. NearestInt). Temporary unpoison last
+    // vector tail.
+    msan::UnpoisonMemory(row0 + xsize, sizeof(float) * (xsize_v - xsize));
+    msan::UnpoisonMemory(row1 + xsize, sizeof(float) * (xsize_v - xsize));
+    msan::UnpoisonMemory(row2 + xsize, sizeof(float) * (xsize_v - xsize));
+    for (size_t x = 0; x < xsize; x += Lanes(d)) {
+      const auto in_opsin_x = LoadU(d, row0 + x);
+      const auto in_opsin_y = LoadU(d, row1 + x);
+      const auto in_opsin_b = LoadU(d, row2 + x);
+      auto r = Undefined(d);
+      auto g = Undefined(d);
+      auto b = Undefined(d);
+      XybToRgb(d, in_opsin_x, in_opsin_y, in_opsin_b, opsin_params_, &r, &g,
+               &b);
+      op_.Transform(d, &r, &g, &b);
+      StoreU(r, d, row0 + x);
+      StoreU(g, d, row1 + x);
+      StoreU(b, d, row2 + x);
+    }
+    msan::PoisonMemory(row0 + xsize, sizeof(float) * (xsize_v - xsize));
+    msan::PoisonMemory(row1 + xsize, sizeof(float) * (xsize_v - xsize));
+    msan::PoisonMemory(row2 + xsize, sizeof(float) * (xsize_v - xsize));
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c < 3 ? RenderPipelineChannelMode::kInPlace
+                 : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "XYBToEncoded"; }
+
+ private:
+  const OpsinParams opsin_params_;
+  Op op_;
+};
+
+struct MakeFromLinear {
+  template <typename Op>
+  std::unique_ptr<RenderPipelineStage> operator()(Op&& op) const {
+    return MakeFromLinearStage(std::forward<Op>(op));
+  }
+};
+
+struct MakeXYBToEncoded {
+  const OpsinParams& opsin_params;
+  template <typename Op>
+  std::unique_ptr<RenderPipelineStage> operator()(Op&& op) const {
+    return jxl::make_unique<XYBToEncodedStage<Op>>(opsin_params,
+                                                   std::forward<Op>(op));
+  }
+};
+
+// Calls `make` with the transfer function op of the output encoding.
+template <typename Make>
+std::unique_ptr<RenderPipelineStage> MakeWithOp(
+    const OutputEncodingInfo& output_encoding_info, const Make& make) {
   const auto& tf = output_encoding_info.color_encoding.Tf();
   if (tf.IsLinear()) {
-    return MakeFromLinearStage(MakePerChannelOp(OpLinear()));
+    return make(MakePerChannelOp(OpLinear()));
   } else if (tf.IsSRGB()) {
-    return MakeFromLinearStage(MakePerChannelOp(OpRgb()));
+    return make(MakePerChannelOp(OpRgb()));
   } else if (tf.IsPQ()) {
-    return MakeFromLinearStage(
+    return make(
         MakePerChannelOp(OpPq(output_encoding_info.orig_intensity_target)));
   } else if (tf.IsHLG()) {
-    return MakeFromLinearStage(
-        OpHlg(output_encoding_info.luminances,
-              output_encoding_info.desired_intensity_target));
+    return make(OpHlg(output_encoding_info.luminances,
+                      output_encoding_info.desired_intensity_target));
   } else if (tf.Is709()) {
-    return MakeFromLinearStage(MakePerChannelOp(Op709()));
+    return make(MakePerChannelOp(Op709()));
   } else if (tf.have_gamma || tf.IsDCI()) {
-    return MakeFromLinearStage(
-        MakePerChannelOp(OpGamma{output_encoding_info.inverse_gamma}));
+    return make(MakePerChannelOp(OpGamma{output_encoding_info.inverse_gamma}));
   } else {
     // This is a programming error.
     JXL_DEBUG_ABORT("Invalid target encoding");
@@ -179,6 +254,17 @@ std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
   }
 }
 
+std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
+    const OutputEncodingInfo& output_encoding_info) {
+  return MakeWithOp(output_encoding_info, MakeFromLinear());
+}
+
+std::unique_ptr<RenderPipelineStage> GetXYBToEncodedStage(
+    const OutputEncodingInfo& output_encoding_info) {
+  return MakeWithOp(output_encoding_info,
+                    MakeXYBToEncoded{output_encoding_info.opsin_params});
+}
+
 }  // namespace
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
@@ -189,11 +275,17 @@ HWY_AFTER_NAMESPACE();
 namespace jxl {
 
 HWY_EXPORT(GetFromLinearStage);
+HWY_EXPORT(GetXYBToEncodedStage);
 
 std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
     const OutputEncodingInfo& output_encoding_info) {
   return HWY_DYNAMIC_DISPATCH(GetFromLinearStage)(output_encoding_info);
 }
 
+std::unique_ptr<RenderPipelineStage> GetXYBToEncodedStage(
+    const OutputEncodingInfo& output_encoding_info) {
+  return HWY_DYNAMIC_DISPATCH(GetXYBToEncodedStage)(output_encoding_info);
+}
+
 }  // namespace jxl
 #endif
@@ -15,6 +15,12 @@ namespace jxl {
 std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
     const OutputEncodingInfo& output_encoding_info);
 
+// Converts the color channels from XYB to the specified output encoding in a
+// single pass; equivalent to GetXYBStage followed by GetFromLinearStage. The
+// output encoding must not be XYB.
+std::unique_ptr<RenderPipelineStage> GetXYBToEncodedStage(
+    const OutputEncodingInfo& output_encoding_info);
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_FROM_LINEAR_H_
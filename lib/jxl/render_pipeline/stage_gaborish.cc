@@ -21,9 +21,10 @@ using hwy::HWY_NAMESPACE::MulAdd;
 
 class GaborishStage : public RenderPipelineStage {
  public:
-  explicit GaborishStage(const LoopFilter& lf)
+  GaborishStage(const LoopFilter& lf, bool luma_only)
       : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
-            /*shift=*/0, /*border=*/1)) {
+            /*shift=*/0, /*border=*/1)),
+        luma_only_(luma_only) {
     weights_[0] = 1;
     weights_[1] = lf.gab_x_weight1;
     weights_[2] = lf.gab_x_weight2;
@@ -49,6 +50,7 @@ class GaborishStage : public RenderPipelineStage {
                     size_t thread_id) const final {
     const HWY_FULL(float) d;
     for (size_t c = 0; c < 3; c++) {
+      if (luma_only_ && c != 1) continue;
       float* JXL_RESTRICT row_t = GetInputRow(input_rows, c, -1);
       float* JXL_RESTRICT row_m = GetInputRow(input_rows, c, 0);
       float* JXL_RESTRICT row_b = GetInputRow(input_rows, c, 1);
@@ -88,18 +90,21 @@ class GaborishStage : public RenderPipelineStage {
 #undef LoadMaybeU
 
   RenderPipelineChannelMode GetChannelMode(size_t c) const final {
-    return c < 3 ? RenderPipelineChannelMode::kInOut
-                 : RenderPipelineChannelMode::kIgnored;
+    return (c == 1 || (c < 3 && !luma_only_))
+               ? RenderPipelineChannelMode::kInOut
+               : RenderPipelineChannelMode::kIgnored;
   }
 
   const char* GetName() const override { return "Gab"; }
 
  private:
   float weights_[9];
+  bool luma_only_;
 };
 
-std::unique_ptr<RenderPipelineStage> GetGaborishStage(const LoopFilter& lf) {
-  return jxl::make_unique<GaborishStage>(lf);
+std::unique_ptr<RenderPipelineStage> GetGaborishStage(const LoopFilter& lf,
+                                                      bool luma_only) {
+  return jxl::make_unique<GaborishStage>(lf, luma_only);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -112,9 +117,10 @@ namespace jxl {
 
 HWY_EXPORT(GetGaborishStage);
 
-std::unique_ptr<RenderPipelineStage> GetGaborishStage(const LoopFilter& lf) {
+std::unique_ptr<RenderPipelineStage> GetGaborishStage(const LoopFilter& lf,
+                                                      bool luma_only) {
   if (lf.gab != 1) return nullptr;
-  return HWY_DYNAMIC_DISPATCH(GetGaborishStage)(lf);
+  return HWY_DYNAMIC_DISPATCH(GetGaborishStage)(lf, luma_only);
 }
 
 }  // namespace jxl
@@ -18,7 +18,9 @@
 namespace jxl {
 
 // Applies decoder-side Gaborish with the given settings. `lf.gab` must be 1.
-std::unique_ptr<RenderPipelineStage> GetGaborishStage(const LoopFilter& lf);
+// If `luma_only`, only the Y channel is filtered.
+std::unique_ptr<RenderPipelineStage> GetGaborishStage(const LoopFilter& lf,
+                                                      bool luma_only);
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_GABORISH_H_
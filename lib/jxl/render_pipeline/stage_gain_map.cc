@@ -0,0 +1,256 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/render_pipeline/stage_gain_map.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/status.h"
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/render_pipeline/stage_gain_map.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/jxl/base/fast_math-inl.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::IfThenZeroElse;
+using hwy::HWY_NAMESPACE::Le;
+using hwy::HWY_NAMESPACE::Min;
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::Sub;
+using hwy::HWY_NAMESPACE::ZeroIfNegative;
+
+class GainMapStage : public RenderPipelineStage {
+ public:
+  explicit GainMapStage(const GainMap* gain_map)
+      : RenderPipelineStage(RenderPipelineStage::Settings()),
+        gain_map_(gain_map) {}
+
+  Status SetInputSizes(
+      const std::vector<std::pair<size_t, size_t>>& input_sizes) override {
+    JXL_ENSURE(input_sizes.size() >= 3);
+    JXL_ENSURE(!gain_map_->planes.empty());
+    xsize_ = input_sizes[0].first;
+    ysize_ = input_sizes[0].second;
+    // Bilinear sampling positions of the gain map for each column.
+    const size_t map_xsize = gain_map_->planes[0].xsize();
+    x0_.resize(xsize_);
+    x1_.resize(xsize_);
+    fx_.resize(xsize_);
+    for (size_t x = 0; x < xsize_; x++) {
+      SamplePosition(x, xsize_, map_xsize, &x0_[x], &x1_[x], &fx_[x]);
+    }
+    return true;
+  }
+
+  Status PrepareForThreads(size_t num_threads) override {
+    const HWY_FULL(float) d;
+    gains_.resize(num_threads);
+    for (auto& gains : gains_) {
+      gains.resize(RoundUpTo(xsize_, Lanes(d)));
+    }
+    return true;
+  }
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    const HWY_FULL(float) d;
+    JXL_ENSURE(xextra == 0);
+    JXL_ENSURE(xpos + xsize <= xsize_ && ypos < ysize_);
+    const size_t map_ysize = gain_map_->planes[0].ysize();
+    size_t y0;
+    size_t y1;
+    float fy;
+    SamplePosition(ypos, ysize_, map_ysize, &y0, &y1, &fy);
+    float* JXL_RESTRICT gains = gains_[thread_id].data();
+    const auto weight = Set(d, gain_map_->weight);
+    for (size_t c = 0; c < 3; c++) {
+      const ImageF& plane =
+          gain_map_->planes[std::min(c, gain_map_->planes.size() - 1)];
+      const float* JXL_RESTRICT row_map0 = plane.ConstRow(y0);
+      const float* JXL_RESTRICT row_map1 = plane.ConstRow(y1);
+      for (size_t x = 0; x < xsize; x++) {
+        const size_t ix = xpos + x;
+        const float top =
+            row_map0[x0_[ix]] + (row_map0[x1_[ix]] - row_map0[x0_[ix]]) *
+                                    fx_[ix];
+        const float bottom =
+            row_map1[x0_[ix]] + (row_map1[x1_[ix]] - row_map1[x0_[ix]]) *
+                                    fx_[ix];
+        gains[x] = top + (bottom - top) * fy;
+      }
+      for (size_t x = xsize; x < RoundUpTo(xsize, Lanes(d)); x++) {
+        gains[x] = 0.0f;
+      }
+
+      const bool has_gamma = gain_map_->inv_gamma[c] != 1.0f;
+      const auto inv_gamma = Set(d, gain_map_->inv_gamma[c]);
+      const auto gain_min = Set(d, gain_map_->gain_min[c]);
+      const auto gain_range =
+          Set(d, gain_map_->gain_max[c] - gain_map_->gain_min[c]);
+      const auto base_offset = Set(d, gain_map_->base_offset[c]);
+      const auto alternate_offset = Set(d, gain_map_->alternate_offset[c]);
+      const auto one = Set(d, 1.0f);
+      float* JXL_RESTRICT row = GetInputRow(input_rows, c, 0);
+      for (size_t x = 0; x < xsize; x += Lanes(d)) {
+        auto g = Min(ZeroIfNegative(LoadU(d, gains + x)), one);
+        if (has_gamma) {
+          g = IfThenZeroElse(Le(g, Set(d, 1e-6f)), FastPowf(d, g, inv_gamma));
+        }
+        const auto log_gain = MulAdd(g, gain_range, gain_min);
+        const auto gain = FastPow2f(d, Mul(log_gain, weight));
+        const auto v = LoadU(d, row + x);
+        StoreU(Sub(Mul(Add(v, base_offset), gain), alternate_offset), d,
+               row + x);
+      }
+    }
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c < 3 ? RenderPipelineChannelMode::kInPlace
+                 : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "GainMap"; }
+
+ private:
+  // Maps the pixel `pos` of `size` pixels to the centers of the gain map
+  // pixels, of which there are `map_size`.
+  static void SamplePosition(size_t pos, size_t size, size_t map_size,
+                             size_t* p0, size_t* p1, float* f) {
+    const float p = std::max(
+        0.0f, (pos + 0.5f) * map_size / static_cast<float>(size) - 0.5f);
+    *p0 = std::min(static_cast<size_t>(p), map_size - 1);
+    *p1 = std::min(*p0 + 1, map_size - 1);
+    *f = p - *p0;
+  }
+
+  const GainMap* gain_map_;
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+  std::vector<size_t> x0_;
+  std::vector<size_t> x1_;
+  std::vector<float> fx_;
+  // Per-thread interpolated gain map values of a row.
+  mutable std::vector<std::vector<float>> gains_;
+};
+
+std::unique_ptr<RenderPipelineStage> GetGainMapStage(const GainMap* gain_map) {
+  return jxl::make_unique<GainMapStage>(gain_map);
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+
+HWY_EXPORT(GetGainMapStage);
+
+std::unique_ptr<RenderPipelineStage> GetGainMapStage(const GainMap* gain_map) {
+  return HWY_DYNAMIC_DISPATCH(GetGainMapStage)(gain_map);
+}
+
+Status GainMap::SetMetadata(const uint8_t* data, size_t size,
+                            float display_headroom) {
+  size_t pos = 0;
+  const auto read = [&](size_t bytes, uint32_t* value) -> Status {
+    if (size - pos < bytes) {
+      return JXL_FAILURE("Gain map metadata is too short");
+    }
+    *value = bytes == 1   ? data[pos]
+             : bytes == 2 ? LoadBE16(data + pos)
+                          : LoadBE32(data + pos);
+    pos += bytes;
+    return true;
+  };
+  uint32_t minimum_version;
+  uint32_t writer_version;
+  uint32_t flags;
+  JXL_RETURN_IF_ERROR(read(2, &minimum_version));
+  JXL_RETURN_IF_ERROR(read(2, &writer_version));
+  if (minimum_version != 0) {
+    return JXL_FAILURE("Unsupported gain map metadata version %u",
+                       minimum_version);
+  }
+  JXL_RETURN_IF_ERROR(read(1, &flags));
+  const size_t num_channels = (flags & 0x80) ? 3 : 1;
+  const bool use_common_denominator = (flags & 0x08) != 0;
+  uint32_t common_denominator = 0;
+  if (use_common_denominator) {
+    JXL_RETURN_IF_ERROR(read(4, &common_denominator));
+  }
+  // Fractions are stored as a numerator and, unless there is a common
+  // denominator, a denominator.
+  const auto read_fraction = [&](bool is_signed, float* value) -> Status {
+    uint32_t numerator;
+    uint32_t denominator = common_denominator;
+    JXL_RETURN_IF_ERROR(read(4, &numerator));
+    if (!use_common_denominator) {
+      JXL_RETURN_IF_ERROR(read(4, &denominator));
+    }
+    if (denominator == 0) {
+      return JXL_FAILURE("Invalid gain map metadata fraction");
+    }
+    const double n = is_signed ? static_cast<int32_t>(numerator)
+                               : static_cast<double>(numerator);
+    *value = static_cast<float>(n / denominator);
+    return true;
+  };
+  float base_headroom;
+  float alternate_headroom;
+  JXL_RETURN_IF_ERROR(read_fraction(/*is_signed=*/false, &base_headroom));
+  JXL_RETURN_IF_ERROR(read_fraction(/*is_signed=*/false, &alternate_headroom));
+  for (size_t c = 0; c < num_channels; c++) {
+    float gamma;
+    JXL_RETURN_IF_ERROR(read_fraction(/*is_signed=*/true, &gain_min[c]));
+    JXL_RETURN_IF_ERROR(read_fraction(/*is_signed=*/true, &gain_max[c]));
+    JXL_RETURN_IF_ERROR(read_fraction(/*is_signed=*/false, &gamma));
+    JXL_RETURN_IF_ERROR(read_fraction(/*is_signed=*/true, &base_offset[c]));
+    JXL_RETURN_IF_ERROR(
+        read_fraction(/*is_signed=*/true, &alternate_offset[c]));
+    if (gamma <= 0) return JXL_FAILURE("Invalid gain map gamma");
+    inv_gamma[c] = 1.0f / gamma;
+  }
+  for (size_t c = num_channels; c < 3; c++) {
+    gain_min[c] = gain_min[0];
+    gain_max[c] = gain_max[0];
+    inv_gamma[c] = inv_gamma[0];
+    base_offset[c] = base_offset[0];
+    alternate_offset[c] = alternate_offset[0];
+  }
+  // The headrooms are log2 of the peak relative to the SDR white.
+  if (alternate_headroom == base_headroom) {
+    weight = 0.0f;
+  } else {
+    weight = (std::log2(display_headroom) - base_headroom) /
+             (alternate_headroom - base_headroom);
+    weight = std::min(1.0f, std::max(0.0f, weight));
+  }
+  return true;
+}
+
+}  // namespace jxl
+#endif
@@ -0,0 +1,48 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_RENDER_PIPELINE_STAGE_GAIN_MAP_H_
+#define LIB_JXL_RENDER_PIPELINE_STAGE_GAIN_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+
+namespace jxl {
+
+// A gain map (ISO 21496-1) and its parameters for a given display headroom.
+struct GainMap {
+  // One plane, or one per color channel, of encoded gain map values in
+  // [0, 1]. The gain map is stretched over the whole frame.
+  std::vector<ImageF> planes;
+  // Per color channel parameters: log2 of the gains of the values 0 and 1,
+  // the inverse of the gamma of the encoding of the gain map values, and the
+  // offsets added to the base and subtracted from the output.
+  float gain_min[3];
+  float gain_max[3];
+  float inv_gamma[3];
+  float base_offset[3];
+  float alternate_offset[3];
+  // Fraction of the log2 gains that is applied for the display headroom.
+  float weight;
+
+  // Parses the ISO 21496-1 gain map metadata and sets the parameters for a
+  // display whose peak is `display_headroom` times the SDR white.
+  Status SetMetadata(const uint8_t* data, size_t size, float display_headroom);
+};
+
+// Applies `gain_map` to the linear color channels:
+// out = (in + base_offset) * 2^(weight * log2 gain) - alternate_offset.
+// `gain_map` must outlive the stage.
+std::unique_ptr<RenderPipelineStage> GetGainMapStage(const GainMap* gain_map);
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_RENDER_PIPELINE_STAGE_GAIN_MAP_H_
@@ -0,0 +1,92 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/render_pipeline/stage_hook.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+
+namespace jxl {
+namespace {
+
+class RenderHookStage : public RenderPipelineStage {
+ public:
+  explicit RenderHookStage(const RenderHook& hook)
+      : RenderPipelineStage(RenderPipelineStage::Settings()), hook_(hook) {}
+
+  RenderHookStage(const RenderHookStage&) = delete;
+  RenderHookStage& operator=(const RenderHookStage&) = delete;
+  RenderHookStage(RenderHookStage&&) = delete;
+  RenderHookStage& operator=(RenderHookStage&&) = delete;
+
+  ~RenderHookStage() override { Destroy(); }
+
+  Status SetInputSizes(
+      const std::vector<std::pair<size_t, size_t>>& input_sizes) override {
+    num_channels_ = input_sizes.size();
+    xsize_ = 0;
+    for (const auto& size : input_sizes) {
+      xsize_ = std::max(xsize_, size.first);
+    }
+    return true;
+  }
+
+  Status PrepareForThreads(size_t num_threads) override {
+    Destroy();
+    run_opaque_ = hook_.init(hook_.init_opaque, num_threads, xsize_);
+    JXL_RETURN_IF_ERROR(run_opaque_ != nullptr);
+    row_pointers_.resize(num_threads);
+    for (auto& rows : row_pointers_) rows.resize(num_channels_);
+    return true;
+  }
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    JXL_ENSURE(run_opaque_ != nullptr);
+    JXL_ENSURE(thread_id < row_pointers_.size());
+    float** rows = row_pointers_[thread_id].data();
+    for (size_t c = 0; c < num_channels_; c++) {
+      rows[c] = GetInputRow(input_rows, c, 0);
+    }
+    hook_.run(run_opaque_, thread_id, xpos, ypos, xsize, rows);
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return RenderPipelineChannelMode::kInPlace;
+  }
+
+  const char* GetName() const override { return "RenderHook"; }
+
+ private:
+  void Destroy() {
+    if (run_opaque_ == nullptr) return;
+    if (hook_.destroy != nullptr) hook_.destroy(run_opaque_);
+    run_opaque_ = nullptr;
+  }
+
+  RenderHook hook_;
+  size_t num_channels_ = 0;
+  size_t xsize_ = 0;
+  void* run_opaque_ = nullptr;
+  // Per-thread storage for the row pointers passed to the hook.
+  mutable std::vector<std::vector<float*>> row_pointers_;
+};
+
+}  // namespace
+
+std::unique_ptr<RenderPipelineStage> GetRenderHookStage(const RenderHook& hook) {
+  return jxl::make_unique<RenderHookStage>(hook);
+}
+
+}  // namespace jxl
@@ -0,0 +1,34 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_RENDER_PIPELINE_STAGE_HOOK_H_
+#define LIB_JXL_RENDER_PIPELINE_STAGE_HOOK_H_
+
+#include <jxl/decode.h>
+
+#include <cstddef>
+#include <memory>
+
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+
+namespace jxl {
+
+// Callbacks set with JxlDecoderSetRenderHook.
+struct RenderHook {
+  bool IsPresent() const { return run != nullptr; }
+
+  JxlImageOutInitCallback init = nullptr;
+  JxlRenderHookRunCallback run = nullptr;
+  JxlImageOutDestroyCallback destroy = nullptr;
+  void* init_opaque = nullptr;
+};
+
+// Passes the rows of all channels to the callbacks of `hook`, which may
+// modify them in place.
+std::unique_ptr<RenderPipelineStage> GetRenderHookStage(const RenderHook& hook);
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_RENDER_PIPELINE_STAGE_HOOK_H_
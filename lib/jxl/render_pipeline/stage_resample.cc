@@ -0,0 +1,272 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/render_pipeline/stage_resample.h"
+
+#include <jxl/decode.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/image_bundle.h"
+#include "lib/jxl/image_ops.h"
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+
+namespace jxl {
+
+namespace {
+
+// The sums are kept as multiples of 2^-32.
+constexpr double kFixedScale = 4294967296.0;
+constexpr double kMaxFixed = 72057594037927936.0;  // 2^56
+constexpr size_t kNumRowMutexes = 64;
+
+int64_t ToFixed(float v) {
+  double f = static_cast<double>(v) * kFixedScale;
+  if (!(std::abs(f) <= kMaxFixed)) {
+    // Also maps NaN to 0.
+    f = f > 0 ? kMaxFixed : (f < 0 ? -kMaxFixed : 0);
+  }
+  return std::llround(f);
+}
+
+double Lanczos3(double x) {
+  if (x == 0) return 1.0;
+  if (std::abs(x) >= 3) return 0.0;
+  const double px = kPi * x;
+  return 3 * std::sin(px) * std::sin(px / 3) / (px * px);
+}
+
+}  // namespace
+
+void ResampledImage::Taps::OutputRange(size_t pos, size_t size, size_t* begin,
+                                       size_t* end) const {
+  *begin = std::upper_bound(this->end.begin(), this->end.end(), pos) -
+           this->end.begin();
+  *end = std::lower_bound(start.begin(), start.end(), pos + size) -
+         start.begin();
+  *end = std::max(*begin, *end);
+}
+
+ResampledImage::Taps ResampledImage::ComputeTaps(size_t in_size,
+                                                 size_t out_size,
+                                                 JxlResampleFilter filter) {
+  const double scale = static_cast<double>(in_size) / out_size;
+  const int64_t last = static_cast<int64_t>(in_size) - 1;
+  std::vector<std::vector<double>> weights(out_size);
+  Taps taps;
+  taps.start.resize(out_size);
+  taps.end.resize(out_size);
+  taps.stride = 0;
+  for (size_t i = 0; i < out_size; i++) {
+    int64_t lo;
+    int64_t hi;
+    std::vector<double>& w = weights[i];
+    if (filter == JXL_RESAMPLE_FILTER_BOX) {
+      // Area of the input pixels covered by the output pixel.
+      const double x0 = i * scale;
+      const double x1 = (i + 1) * scale;
+      lo = std::min(static_cast<int64_t>(std::floor(x0)), last);
+      hi = std::min(static_cast<int64_t>(std::ceil(x1)) - 1, last);
+      hi = std::max(hi, lo);
+      for (int64_t x = lo; x <= hi; x++) {
+        w.push_back(std::max(0.0, std::min<double>(x + 1, x1) -
+                                      std::max<double>(x, x0)));
+      }
+    } else {
+      // The filter is widened when downsampling, to avoid aliasing. Taps
+      // outside of the input use the nearest edge pixel.
+      const double center = (i + 0.5) * scale - 0.5;
+      const double factor = std::max(scale, 1.0);
+      const int64_t first =
+          static_cast<int64_t>(std::ceil(center - 3 * factor));
+      const int64_t after =
+          static_cast<int64_t>(std::floor(center + 3 * factor)) + 1;
+      lo = Clamp1<int64_t>(first, 0, last);
+      hi = Clamp1<int64_t>(after - 1, 0, last);
+      w.resize(hi - lo + 1);
+      for (int64_t x = first; x < after; x++) {
+        w[Clamp1<int64_t>(x, lo, hi) - lo] += Lanczos3((x - center) / factor);
+      }
+    }
+    double sum = 0;
+    for (double v : w) sum += v;
+    if (sum != 0) {
+      for (double& v : w) v /= sum;
+    }
+    taps.start[i] = lo;
+    taps.end[i] = hi + 1;
+    taps.stride = std::max(taps.stride, w.size());
+  }
+  taps.weights.resize(out_size * taps.stride);
+  for (size_t i = 0; i < out_size; i++) {
+    std::copy(weights[i].begin(), weights[i].end(),
+              taps.weights.begin() + i * taps.stride);
+  }
+  return taps;
+}
+
+Status ResampledImage::SetInputSizes(
+    const std::vector<std::pair<size_t, size_t>>& input_sizes) {
+  JXL_ENSURE(input_sizes.size() >= 3);
+  JXL_ENSURE(xsize_ > 0 && ysize_ > 0);
+  for (size_t c = 1; c < input_sizes.size(); c++) {
+    JXL_ENSURE(input_sizes[c].first == input_sizes[0].first);
+    JXL_ENSURE(input_sizes[c].second == input_sizes[0].second);
+  }
+  in_xsize_ = input_sizes[0].first;
+  in_ysize_ = input_sizes[0].second;
+  x_taps_ = ComputeTaps(in_xsize_, xsize_, filter_);
+  y_taps_ = ComputeTaps(in_ysize_, ysize_, filter_);
+  sums_.clear();
+  for (size_t c = 0; c < input_sizes.size(); c++) {
+    JXL_ASSIGN_OR_RETURN(
+        Plane<int64_t> sums,
+        Plane<int64_t>::Create(memory_manager_, xsize_, ysize_));
+    ZeroFillImage(&sums);
+    sums_.emplace_back(std::move(sums));
+  }
+  row_mutexes_ = std::vector<std::mutex>(kNumRowMutexes);
+  return true;
+}
+
+Status ResampledImage::PrepareForThreads(size_t num_threads) {
+  temp_rows_.resize(num_threads);
+  row_pointers_.resize(num_threads);
+  for (size_t t = 0; t < num_threads; t++) {
+    temp_rows_[t].resize(sums_.size() * xsize_);
+    row_pointers_[t].resize(sums_.size());
+  }
+  return true;
+}
+
+Status ResampledImage::AddRow(const float* const* rows, size_t xpos,
+                              size_t ypos, size_t xsize, size_t thread_id) {
+  if (ypos >= in_ysize_ || xpos >= in_xsize_) return true;
+  xsize = std::min(xsize, in_xsize_ - xpos);
+  size_t ty0;
+  size_t ty1;
+  y_taps_.OutputRange(ypos, 1, &ty0, &ty1);
+  size_t tx0;
+  size_t tx1;
+  x_taps_.OutputRange(xpos, xsize, &tx0, &tx1);
+  if (ty0 == ty1 || tx0 == tx1) return true;
+  JXL_ENSURE(thread_id < temp_rows_.size());
+  float* JXL_RESTRICT temp = temp_rows_[thread_id].data();
+
+  // Horizontal pass over the part of the row that is available.
+  const size_t xend = xpos + xsize;
+  for (size_t c = 0; c < sums_.size(); c++) {
+    const float* JXL_RESTRICT row = rows[c];
+    float* JXL_RESTRICT out = temp + c * xsize_;
+    for (size_t tx = tx0; tx < tx1; tx++) {
+      const size_t start = x_taps_.start[tx];
+      const float* JXL_RESTRICT w =
+          x_taps_.weights.data() + tx * x_taps_.stride;
+      const size_t begin = std::max(start, xpos);
+      const size_t end = std::min<size_t>(x_taps_.end[tx], xend);
+      float sum = 0;
+      for (size_t x = begin; x < end; x++) sum += w[x - start] * row[x - xpos];
+      out[tx] = sum;
+    }
+  }
+
+  // Vertical pass, accumulating into all the output rows that use this row.
+  for (size_t ty = ty0; ty < ty1; ty++) {
+    const float wy = y_taps_.weights[ty * y_taps_.stride + ypos -
+                                     y_taps_.start[ty]];
+    if (wy == 0) continue;
+    std::lock_guard<std::mutex> lock(row_mutexes_[ty % kNumRowMutexes]);
+    for (size_t c = 0; c < sums_.size(); c++) {
+      const float* JXL_RESTRICT in = temp + c * xsize_;
+      int64_t* JXL_RESTRICT sums = sums_[c].Row(ty);
+      for (size_t tx = tx0; tx < tx1; tx++) {
+        sums[tx] += ToFixed(wy * in[tx]);
+      }
+    }
+  }
+  return true;
+}
+
+Status ResampledImage::ToImageBundle(const ColorEncoding& color_encoding,
+                                     ImageBundle* ib) const {
+  JXL_ENSURE(sums_.size() >= 3);
+  const auto to_float = [&](size_t c, ImageF* plane) {
+    for (size_t y = 0; y < ysize_; y++) {
+      const int64_t* JXL_RESTRICT sums = sums_[c].ConstRow(y);
+      float* JXL_RESTRICT row = plane->Row(y);
+      for (size_t x = 0; x < xsize_; x++) {
+        row[x] = static_cast<float>(sums[x] * (1.0 / kFixedScale));
+      }
+    }
+  };
+  JXL_ASSIGN_OR_RETURN(Image3F color,
+                       Image3F::Create(memory_manager_, xsize_, ysize_));
+  for (size_t c = 0; c < 3; c++) {
+    to_float(c, &color.Plane(c));
+  }
+  JXL_RETURN_IF_ERROR(ib->SetFromImage(std::move(color), color_encoding));
+  ib->extra_channels().clear();
+  for (size_t c = 3; c < sums_.size(); c++) {
+    JXL_ASSIGN_OR_RETURN(ImageF ch,
+                         ImageF::Create(memory_manager_, xsize_, ysize_));
+    to_float(c, &ch);
+    ib->extra_channels().emplace_back(std::move(ch));
+  }
+  return true;
+}
+
+class ResampleStage : public RenderPipelineStage {
+ public:
+  explicit ResampleStage(ResampledImage* image)
+      : RenderPipelineStage(RenderPipelineStage::Settings()), image_(image) {}
+
+  Status SetInputSizes(
+      const std::vector<std::pair<size_t, size_t>>& input_sizes) override {
+    num_channels_ = input_sizes.size();
+    return image_->SetInputSizes(input_sizes);
+  }
+
+  Status PrepareForThreads(size_t num_threads) override {
+    return image_->PrepareForThreads(num_threads);
+  }
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    const float** rows = image_->RowPointers(thread_id);
+    for (size_t c = 0; c < num_channels_; c++) {
+      rows[c] = GetInputRow(input_rows, c, 0);
+    }
+    return image_->AddRow(rows, xpos, ypos, xsize, thread_id);
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return RenderPipelineChannelMode::kInput;
+  }
+
+  const char* GetName() const override { return "Resample"; }
+
+ private:
+  ResampledImage* image_;
+  size_t num_channels_ = 0;
+};
+
+std::unique_ptr<RenderPipelineStage> GetResampleStage(ResampledImage* image) {
+  return jxl::make_unique<ResampleStage>(image);
+}
+
+}  // namespace jxl
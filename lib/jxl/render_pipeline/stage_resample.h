@@ -0,0 +1,107 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_RENDER_PIPELINE_STAGE_RESAMPLE_H_
+#define LIB_JXL_RENDER_PIPELINE_STAGE_RESAMPLE_H_
+
+#include <jxl/decode.h>
+#include <jxl/memory_manager.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/image_bundle.h"
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+
+namespace jxl {
+
+// The output of the render pipeline resampled to a given size with a
+// separable filter. The rows of the frame are added to it as they are
+// rendered, in any order and from any thread, so that the frame is never
+// stored at its full resolution. Each row must be added exactly once.
+class ResampledImage {
+ public:
+  ResampledImage(JxlMemoryManager* memory_manager, size_t xsize, size_t ysize,
+                 JxlResampleFilter filter)
+      : memory_manager_(memory_manager),
+        xsize_(xsize),
+        ysize_(ysize),
+        filter_(filter) {}
+
+  size_t xsize() const { return xsize_; }
+  size_t ysize() const { return ysize_; }
+
+  // Computes the filter taps for an input of the given per-channel sizes and
+  // clears the accumulated pixels.
+  Status SetInputSizes(
+      const std::vector<std::pair<size_t, size_t>>& input_sizes);
+
+  Status PrepareForThreads(size_t num_threads);
+
+  // Storage for one row pointer per channel, to pass to AddRow.
+  const float** RowPointers(size_t thread_id) {
+    return row_pointers_[thread_id].data();
+  }
+
+  // Adds the pixels [xpos, xpos + xsize) of the input row `ypos`, one row
+  // pointer per channel, to the output.
+  Status AddRow(const float* const* rows, size_t xpos, size_t ypos,
+                size_t xsize, size_t thread_id);
+
+  // Stores the resampled image, with the extra channels, in `ib`.
+  Status ToImageBundle(const ColorEncoding& color_encoding,
+                       ImageBundle* ib) const;
+
+ private:
+  // Contributions of a range of input pixels to each output pixel along one
+  // axis, for the output pixel i: the input pixels [start[i], end[i]) with
+  // the weights at weights[i * stride]. start and end are non-decreasing.
+  struct Taps {
+    std::vector<uint32_t> start;
+    std::vector<uint32_t> end;
+    std::vector<float> weights;
+    size_t stride;
+
+    // Output pixels [*begin, *end) to which the input pixels [pos, pos + size)
+    // contribute.
+    void OutputRange(size_t pos, size_t size, size_t* begin,
+                     size_t* end) const;
+  };
+
+  static Taps ComputeTaps(size_t in_size, size_t out_size,
+                          JxlResampleFilter filter);
+
+  JxlMemoryManager* memory_manager_;
+  size_t xsize_;
+  size_t ysize_;
+  JxlResampleFilter filter_;
+  size_t in_xsize_ = 0;
+  size_t in_ysize_ = 0;
+  Taps x_taps_;
+  Taps y_taps_;
+  // Sums in fixed point, so that the result does not depend on the order in
+  // which rows and groups are added.
+  std::vector<Plane<int64_t>> sums_;
+  // Protect the rows of sums_, striped by row index.
+  std::vector<std::mutex> row_mutexes_;
+  // Per-thread horizontally resampled rows, for all channels.
+  std::vector<std::vector<float>> temp_rows_;
+  std::vector<std::vector<const float*>> row_pointers_;
+};
+
+// Adds the pixels of all channels to `image`. Must be the last stage of the
+// pipeline; `image` must outlive it.
+std::unique_ptr<RenderPipelineStage> GetResampleStage(ResampledImage* image);
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_RENDER_PIPELINE_STAGE_RESAMPLE_H_
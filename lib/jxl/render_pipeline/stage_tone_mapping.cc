@@ -5,6 +5,11 @@
 
 #include "lib/jxl/render_pipeline/stage_tone_mapping.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
 #include "lib/jxl/base/sanitizers.h"
 
 #undef HWY_TARGET_INCLUDE
@@ -19,6 +24,18 @@ HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
 
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::AllTrue;
+using hwy::HWY_NAMESPACE::And;
+using hwy::HWY_NAMESPACE::ConvertTo;
+using hwy::HWY_NAMESPACE::GatherIndex;
+using hwy::HWY_NAMESPACE::Ge;
+using hwy::HWY_NAMESPACE::Le;
+using hwy::HWY_NAMESPACE::Max;
+using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::Sqrt;
+
 class ToneMappingStage : public RenderPipelineStage {
  public:
   explicit ToneMappingStage(OutputEncodingInfo output_encoding_info)
@@ -53,6 +70,9 @@ class ToneMappingStage : public RenderPipelineStage {
       from_desired_intensity_target_ =
           output_encoding_info_.desired_intensity_target / 10000.f;
     }
+    if (IsNeeded() && output_encoding_info_.tone_mapping_lut_size >= 2) {
+      BakeLut(output_encoding_info_.tone_mapping_lut_size);
+    }
   }
 
   bool IsNeeded() const { return tone_mapper_ || hlg_ootf_; }
@@ -83,10 +103,8 @@ class ToneMappingStage : public RenderPipelineStage {
       r = Mul(r, Set(d, to_intensity_target_));
       g = Mul(g, Set(d, to_intensity_target_));
       b = Mul(b, Set(d, to_intensity_target_));
-      if (tone_mapper_) {
-        tone_mapper_->ToneMap(&r, &g, &b);
-      } else {
-        hlg_ootf_->Apply(&r, &g, &b);
+      if (lut_.empty() || !ApplyLut(d, &r, &g, &b)) {
+        MapLuminance(&r, &g, &b);
       }
       if (tone_mapper_ || hlg_ootf_->WarrantsGamutMapping()) {
         GamutMap(&r, &g, &b, output_encoding_info_.luminances);
@@ -113,6 +131,66 @@ class ToneMappingStage : public RenderPipelineStage {
 
  private:
   using ToneMapper = Rec2408ToneMapper<HWY_FULL(float)>;
+
+  template <typename V>
+  void MapLuminance(V* r, V* g, V* b) const {
+    if (tone_mapper_) {
+      tone_mapper_->ToneMap(r, g, b);
+    } else {
+      hlg_ootf_->Apply(r, g, b);
+    }
+  }
+
+  // Tabulates the output luminance of grey pixels, at luminances that are
+  // uniformly spaced in the square root domain, which is closer to the
+  // perceptual spacing.
+  void BakeLut(size_t lut_size) {
+    const HWY_FULL(float) d;
+    const Vector3& luminances = output_encoding_info_.luminances;
+    const float white = luminances[0] + luminances[1] + luminances[2];
+    lut_scale_ = lut_size - 1;
+    lut_.resize(RoundUpTo(lut_size, Lanes(d)));
+    for (size_t i = 0; i < lut_.size(); i++) {
+      const float s = std::min<size_t>(i, lut_size - 1) / lut_scale_;
+      lut_[i] = s * s / white;
+    }
+    for (size_t i = 0; i < lut_.size(); i += Lanes(d)) {
+      auto r = LoadU(d, lut_.data() + i);
+      auto g = r;
+      auto b = r;
+      MapLuminance(&r, &g, &b);
+      StoreU(Mul(Set(d, white), r), d, lut_.data() + i);
+    }
+    lut_.resize(lut_size);
+  }
+
+  // Scales the pixels to the tabulated luminance if all of them are within
+  // the range of the table.
+  template <typename D, typename V>
+  bool ApplyLut(D d, V* r, V* g, V* b) const {
+    const Vector3& luminances = output_encoding_info_.luminances;
+    const V y = MulAdd(Set(d, luminances[0]), *r,
+                       MulAdd(Set(d, luminances[1]), *g,
+                              Mul(Set(d, luminances[2]), *b)));
+    if (!AllTrue(d, And(Ge(y, Zero(d)), Le(y, Set(d, 1.0f))))) return false;
+    const Rebind<int32_t, D> di;
+    const V pos = Mul(Sqrt(y), Set(d, lut_scale_));
+    // pos is non-negative, so the conversion rounds down.
+    const auto idx =
+        Min(ConvertTo(di, pos), Set(di, static_cast<int32_t>(lut_.size() - 2)));
+    const V frac = Sub(pos, ConvertTo(d, idx));
+    const V lo = GatherIndex(d, lut_.data(), idx);
+    const V hi = GatherIndex(d, lut_.data(), Add(idx, Set(di, 1)));
+    const V new_y = MulAdd(frac, Sub(hi, lo), lo);
+    // The multiplier is bounded for the pixels that are so dark that the
+    // exact curve replaces them with grey.
+    const V ratio = Div(new_y, Max(y, Set(d, 1e-9f)));
+    *r = Mul(*r, ratio);
+    *g = Mul(*g, ratio);
+    *b = Mul(*b, ratio);
+    return true;
+  }
+
   OutputEncodingInfo output_encoding_info_;
   std::unique_ptr<ToneMapper> tone_mapper_;
   std::unique_ptr<HlgOOTF> hlg_ootf_;
@@ -121,6 +199,9 @@ class ToneMappingStage : public RenderPipelineStage {
   // require it.
   float to_intensity_target_ = 1.f;
   float from_desired_intensity_target_ = 1.f;
+  // Output luminance at the input luminances (i / lut_scale_)^2, if enabled.
+  std::vector<float> lut_;
+  float lut_scale_ = 0.f;
 };
 
 std::unique_ptr<RenderPipelineStage> GetToneMappingStage(
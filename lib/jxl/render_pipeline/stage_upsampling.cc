@@ -5,6 +5,8 @@
 
 #include "lib/jxl/render_pipeline/stage_upsampling.h"
 
+#include <cstring>
+
 #include "lib/jxl/base/sanitizers.h"
 #include "lib/jxl/base/status.h"
 
@@ -36,14 +38,34 @@ class UpsamplingStage : public RenderPipelineStage {
                            : shift == 2 ? ups_factors.upsampling4_weights
                                         : ups_factors.upsampling8_weights;
     size_t N = 1 << (shift - 1);
+    // Weights of the top-left quadrant of output phases; the others are
+    // mirrored.
+    float kernel[4][4][5][5];
     for (size_t i = 0; i < 5 * N; i++) {
       for (size_t j = 0; j < 5 * N; j++) {
         size_t y = std::min(i, j);
         size_t x = std::max(i, j);
-        kernel_[j / 5][i / 5][j % 5][i % 5] =
+        kernel[j / 5][i / 5][j % 5][i % 5] =
             weights[5 * N * y - y * (y - 1) / 2 + x - y];
       }
     }
+    // Expands them to the 5x5 weights of each of the 2N x 2N output phases,
+    // so that ProcessRowImpl does no index arithmetic.
+    const size_t num_phases = 2 * N;
+    for (size_t oy = 0; oy < num_phases; oy++) {
+      for (size_t ox = 0; ox < num_phases; ox++) {
+        const bool flip_y = oy >= N;
+        const bool flip_x = ox >= N;
+        const size_t ky = flip_y ? num_phases - 1 - oy : oy;
+        const size_t kx = flip_x ? num_phases - 1 - ox : ox;
+        for (size_t iy = 0; iy < 5; iy++) {
+          for (size_t ix = 0; ix < 5; ix++) {
+            phase_kernel_[oy][ox][iy * 5 + ix] =
+                kernel[ky][kx][flip_y ? 4 - iy : iy][flip_x ? 4 - ix : ix];
+          }
+        }
+      }
+    }
   }
 
   Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
@@ -85,26 +107,6 @@ class UpsamplingStage : public RenderPipelineStage {
   const char* GetName() const override { return "Upsample"; }
 
  private:
-  template <size_t N>
-  JXL_INLINE float Kernel(size_t x, size_t y, ssize_t ix, ssize_t iy) const {
-    static_assert(N == 2 || N == 4 || N == 8, "N must be 2, 4, or 8");
-    ix += 2;
-    iy += 2;
-    if (N == 2) {
-      return kernel_[0][0][y % 2 ? 4 - iy : iy][x % 2 ? 4 - ix : ix];
-    }
-    if (N == 4) {
-      return kernel_[y % 4 < 2 ? y % 2 : 1 - y % 2]
-                    [x % 4 < 2 ? x % 2 : 1 - x % 2][y % 4 < 2 ? iy : 4 - iy]
-                    [x % 4 < 2 ? ix : 4 - ix];
-    }
-    if (N == 8) {
-      return kernel_[y % 8 < 4 ? y % 4 : 3 - y % 4]
-                    [x % 8 < 4 ? x % 4 : 3 - x % 4][y % 8 < 4 ? iy : 4 - iy]
-                    [x % 8 < 4 ? ix : 4 - ix];
-    }
-  }
-
   template <ssize_t N>
   void ProcessRowImpl(const RowInfo& input_rows, const RowInfo& output_rows,
                       ssize_t x0, ssize_t x1) const {
@@ -131,24 +133,42 @@ class UpsamplingStage : public RenderPipelineStage {
       ups[7] = &ups7;
     }
 
+    const float* JXL_RESTRICT rows[5];
+    for (ssize_t iy = -2; iy <= 2; iy++) {
+      rows[iy + 2] = GetInputRow(input_rows, c_, iy);
+    }
+    float* JXL_RESTRICT dst_rows[N];
     for (size_t oy = 0; oy < N; oy++) {
-      float* dst_row = GetOutputRow(output_rows, c_, oy);
-      for (ssize_t x = x0; x < x1; x += Lanes(df)) {
+      dst_rows[oy] = GetOutputRow(output_rows, c_, oy);
+    }
+
+    // All the N x N output phases of an input neighborhood are computed
+    // together: its bounds are only computed once, and its pixels stay in L1
+    // (or registers) for the N * N dot products with the precomputed weights.
+    for (ssize_t x = x0; x < x1; x += Lanes(df)) {
+      auto min = LoadU(df, rows[2] + x);
+      auto max = min;
+      for (size_t iy = 0; iy < 5; iy++) {
+        for (ssize_t ix = -2; ix <= 2; ix++) {
+          auto v = LoadU(df, rows[iy] + x + ix);
+          min = Min(v, min);
+          max = Max(v, max);
+        }
+      }
+      for (size_t oy = 0; oy < N; oy++) {
         for (size_t ox = 0; ox < N; ox++) {
+          const float* JXL_RESTRICT weights = phase_kernel_[oy][ox];
           auto result = Zero(df);
-          auto min = LoadU(df, GetInputRow(input_rows, c_, 0) + x);
-          auto max = min;
-          for (ssize_t iy = -2; iy <= 2; iy++) {
+          for (size_t iy = 0; iy < 5; iy++) {
             for (ssize_t ix = -2; ix <= 2; ix++) {
-              auto v = LoadU(df, GetInputRow(input_rows, c_, iy) + x + ix);
-              result = MulAdd(Set(df, Kernel<N>(ox, oy, ix, iy)), v, result);
-              min = Min(v, min);
-              max = Max(v, max);
+              auto v = LoadU(df, rows[iy] + x + ix);
+              result = MulAdd(Set(df, weights[iy * 5 + ix + 2]), v, result);
             }
           }
           // Avoid overshooting.
           *ups[ox] = Clamp(result, min, max);
         }
+        float* dst_row = dst_rows[oy];
         if (N == 2) {
           StoreInterleaved(df, ups0, ups1, dst_row + x * N);
         }
@@ -164,7 +184,8 @@ class UpsamplingStage : public RenderPipelineStage {
   }
 
   size_t c_;
-  float kernel_[4][4][5][5];
+  // 5x5 weights of each output phase.
+  float phase_kernel_[8][8][25];
 };
 
 std::unique_ptr<RenderPipelineStage> GetUpsamplingStage(
@@ -191,5 +212,50 @@ std::unique_ptr<RenderPipelineStage> GetUpsamplingStage(
   return HWY_DYNAMIC_DISPATCH(GetUpsamplingStage)(ups_factors, c, shift);
 }
 
+class NearestUpsamplingStage : public RenderPipelineStage {
+ public:
+  NearestUpsamplingStage(size_t c, size_t shift)
+      : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
+            /*shift=*/shift, /*border=*/0)),
+        c_(c) {}
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    const ssize_t N = 1 << settings_.shift_x;
+    const float* JXL_RESTRICT src = GetInputRow(input_rows, c_, 0);
+    const ssize_t x0 = -static_cast<ssize_t>(xextra);
+    const ssize_t x1 = xsize + xextra;
+    float* JXL_RESTRICT dst0 = GetOutputRow(output_rows, c_, 0);
+    for (ssize_t x = x0; x < x1; x++) {
+      for (ssize_t i = 0; i < N; i++) dst0[x * N + i] = src[x];
+    }
+    for (ssize_t oy = 1; oy < N; oy++) {
+      memcpy(GetOutputRow(output_rows, c_, oy) + x0 * N, dst0 + x0 * N,
+             (x1 - x0) * N * sizeof(float));
+    }
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c == c_ ? RenderPipelineChannelMode::kInOut
+                   : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "NearestUpsample"; }
+
+ private:
+  size_t c_;
+};
+
+std::unique_ptr<RenderPipelineStage> GetNearestUpsamplingStage(size_t c,
+                                                               size_t shift) {
+  if ((shift < 1) || (shift > 3)) {
+    JXL_DEBUG_ABORT("internal: (shift != 0) && (shift <= 3)");
+    return nullptr;
+  }
+  return jxl::make_unique<NearestUpsamplingStage>(c, shift);
+}
+
 }  // namespace jxl
 #endif
@@ -21,6 +21,11 @@ namespace jxl {
 // Upsamples the given channel by the given factor.
 std::unique_ptr<RenderPipelineStage> GetUpsamplingStage(
     const CustomTransformData& ups_factors, size_t c, size_t shift);
+
+// Upsamples the given channel by the given factor by repeating each pixel,
+// which is much faster than the upsampling kernels but blocky.
+std::unique_ptr<RenderPipelineStage> GetNearestUpsamplingStage(size_t c,
+                                                               size_t shift);
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_UPSAMPLING_H_
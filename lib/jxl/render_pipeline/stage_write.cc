@@ -11,6 +11,7 @@
 #include <type_traits>
 
 #include "lib/jxl/alpha.h"
+#include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/sanitizers.h"
@@ -32,6 +33,7 @@ namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::BitCast;
 using hwy::HWY_NAMESPACE::Clamp;
 using hwy::HWY_NAMESPACE::Div;
 using hwy::HWY_NAMESPACE::Max;
@@ -39,6 +41,7 @@ using hwy::HWY_NAMESPACE::Mul;
 using hwy::HWY_NAMESPACE::NearestInt;
 using hwy::HWY_NAMESPACE::Or;
 using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::ShiftLeft;
 using hwy::HWY_NAMESPACE::ShiftLeftSame;
 using hwy::HWY_NAMESPACE::ShiftRightSame;
 using hwy::HWY_NAMESPACE::VFromD;
@@ -114,21 +117,35 @@ VFromD<Rebind<T, DF>> MakeUnsigned(VFromD<DF> v, size_t x0, size_t y0,
   return DemoteTo(DU(), NearestInt(v));
 }
 
+// Returns the color `v` multiplied by `alpha` if `premul`.
+HWY_INLINE VFromD<DF> MaybePremultiply(bool premul, VFromD<DF> v,
+                                       VFromD<DF> alpha) {
+  return premul ? Mul(v, alpha) : v;
+}
+
+// Converts `v` to integers in [0, mul], without dithering.
+VFromD<Rebind<int32_t, DF>> Quantize(VFromD<DF> v, VFromD<DF> mul) {
+  return NearestInt(Clamp(Mul(v, mul), Zero(DF()), mul));
+}
+
 class WriteToOutputStage : public RenderPipelineStage {
  public:
-  WriteToOutputStage(const ImageOutput& main_output, size_t width,
-                     size_t height, bool has_alpha, bool unpremul_alpha,
+  WriteToOutputStage(const ImageOutput& main_output, const Rect& output_rect,
+                     bool has_alpha, bool unpremul_alpha, bool premul_alpha,
                      size_t alpha_c, Orientation undo_orientation,
                      const std::vector<ImageOutput>& extra_output,
                      JxlMemoryManager* memory_manager)
       : RenderPipelineStage(RenderPipelineStage::Settings()),
-        width_(width),
-        height_(height),
+        x0_(output_rect.x0()),
+        y0_(output_rect.y0()),
+        width_(output_rect.xsize()),
+        height_(output_rect.ysize()),
         main_(main_output),
         num_color_(main_.num_channels_ < 3 ? 1 : 3),
         want_alpha_(main_.num_channels_ == 2 || main_.num_channels_ == 4),
         has_alpha_(has_alpha),
         unpremul_alpha_(unpremul_alpha),
+        premul_alpha_(has_alpha && want_alpha_ && premul_alpha),
         alpha_c_(alpha_c),
         flip_x_(ShouldFlipX(undo_orientation)),
         flip_y_(ShouldFlipY(undo_orientation)),
@@ -164,23 +181,29 @@ class WriteToOutputStage : public RenderPipelineStage {
                     size_t xextra, size_t xsize, size_t xpos, size_t ypos,
                     size_t thread_id) const final {
     JXL_ENSURE(xextra == 0);
-    JXL_ENSURE(main_.run_opaque_ || main_.buffer_);
-    if (ypos >= height_) return true;
-    if (xpos >= width_) return true;
+    JXL_ENSURE(main_.run_opaque_ || main_.tile_callback_.IsPresent() ||
+               main_.buffer_ || !main_.channels_.empty());
+    if (ypos < y0_ || ypos - y0_ >= height_) return true;
+    if (xpos + xsize <= x0_ || xpos >= x0_ + width_) return true;
+    ypos -= y0_;
     if (flip_y_) {
       ypos = height_ - 1u - ypos;
     }
-    size_t limit = std::min(xsize, width_ - xpos);
+    // Number of input pixels to the left of the output region.
+    size_t skip = xpos < x0_ ? x0_ - xpos : 0;
+    xpos = xpos + skip - x0_;
+    size_t limit = std::min(xsize - skip, width_ - xpos);
     for (size_t x0 = 0; x0 < limit; x0 += kMaxPixelsPerCall) {
       size_t xstart = xpos + x0;
       size_t len = std::min<size_t>(kMaxPixelsPerCall, limit - x0);
 
       const float* line_buffers[4];
       for (size_t c = 0; c < num_color_; c++) {
-        line_buffers[c] = GetInputRow(input_rows, c, 0) + x0;
+        line_buffers[c] = GetInputRow(input_rows, c, 0) + skip + x0;
       }
       if (has_alpha_) {
-        line_buffers[num_color_] = GetInputRow(input_rows, alpha_c_, 0) + x0;
+        line_buffers[num_color_] =
+            GetInputRow(input_rows, alpha_c_, 0) + skip + x0;
       } else {
         // opaque_alpha_ is a way to set all values to 1.0f.
         line_buffers[num_color_] = opaque_alpha_.data();
@@ -190,7 +213,8 @@ class WriteToOutputStage : public RenderPipelineStage {
       }
       OutputBuffers(main_, thread_id, ypos, xstart, len, line_buffers);
       for (const auto& extra : extra_channels_) {
-        line_buffers[0] = GetInputRow(input_rows, extra.channel_index_, 0) + x0;
+        line_buffers[0] =
+            GetInputRow(input_rows, extra.channel_index_, 0) + skip + x0;
         OutputBuffers(extra, thread_id, ypos, xstart, len, line_buffers);
       }
     }
@@ -215,35 +239,70 @@ class WriteToOutputStage : public RenderPipelineStage {
   struct Output {
     explicit Output(const ImageOutput& image_out)
         : pixel_callback_(image_out.callback),
+          tile_callback_(image_out.tile_callback),
           buffer_(image_out.buffer),
           buffer_size_(image_out.buffer_size),
           stride_(image_out.stride),
           num_channels_(image_out.format.num_channels),
+          samples_per_pixel_(image_out.format.data_type == JXL_TYPE_RGB10A2
+                                 ? 1
+                                 : num_channels_),
           swap_endianness_(SwapEndianness(image_out.format.endianness)),
           data_type_(image_out.format.data_type),
-          bits_per_sample_(image_out.bits_per_sample) {}
+          bits_per_sample_(image_out.bits_per_sample),
+          channels_(image_out.channels) {
+      if (channels_.empty()) return;
+      size_t sample_size = data_type_ == JXL_TYPE_UINT8   ? 1
+                           : data_type_ == JXL_TYPE_FLOAT ? 4
+                                                          : 2;
+      uint8_t* base = static_cast<uint8_t*>(channels_[0].base);
+      interleaved_ = true;
+      for (size_t c = 0; c < channels_.size(); ++c) {
+        interleaved_ &=
+            channels_[c].base == base + c * sample_size &&
+            channels_[c].pixel_stride == num_channels_ * sample_size &&
+            channels_[c].row_stride == channels_[0].row_stride;
+      }
+    }
 
     Status PrepareForThreads(size_t num_threads) {
-      if (pixel_callback_.IsPresent()) {
+      if (tile_callback_.IsPresent()) {
+        return true;
+      } else if (pixel_callback_.IsPresent()) {
         run_opaque_ =
             pixel_callback_.Init(num_threads, /*num_pixels=*/kMaxPixelsPerCall);
         JXL_RETURN_IF_ERROR(run_opaque_ != nullptr);
-      } else {
+      } else if (channels_.empty()) {
         JXL_RETURN_IF_ERROR(buffer_ != nullptr);
       }
       return true;
     }
 
+    // Size in bytes of one output pixel.
+    size_t PixelSize() const {
+      if (data_type_ == JXL_TYPE_UINT8) return samples_per_pixel_;
+      if (data_type_ == JXL_TYPE_UINT16 || data_type_ == JXL_TYPE_FLOAT16) {
+        return 2 * samples_per_pixel_;
+      }
+      return 4 * samples_per_pixel_;
+    }
+
     PixelCallback pixel_callback_;
+    TileCallback tile_callback_;
     void* run_opaque_ = nullptr;
     void* buffer_ = nullptr;
     size_t buffer_size_;
     size_t stride_;
     size_t num_channels_;
+    // Number of output values per pixel, 1 for packed formats.
+    size_t samples_per_pixel_;
     bool swap_endianness_;
     JxlDataType data_type_;
     size_t bits_per_sample_;
     size_t channel_index_;  // used for extra_channels
+    std::vector<JxlChannelBuffer> channels_;
+    // Whether channels_ describes rows of interleaved pixels without gaps.
+    bool interleaved_ = false;
   };
 
   Status PrepareForThreads(size_t num_threads) override {
@@ -251,6 +310,9 @@ class WriteToOutputStage : public RenderPipelineStage {
     for (auto& extra : extra_channels_) {
       JXL_RETURN_IF_ERROR(extra.PrepareForThreads(num_threads));
     }
+    if (CollectsTiles()) {
+      tiles_.resize(num_threads);
+    }
     temp_out_.resize(num_threads);
     for (AlignedMemory& temp : temp_out_) {
       size_t alloc_size =
@@ -268,6 +330,92 @@ class WriteToOutputStage : public RenderPipelineStage {
     }
     return true;
   }
+
+  // Whether the main output of each rect is collected in the tile of the
+  // thread: for a tile callback, and for transposed outputs to a buffer or a
+  // pixel callback, which would otherwise receive each input row as an output
+  // column, one pixel at a time.
+  bool CollectsTiles() const {
+    return main_.tile_callback_.IsPresent() ||
+           (transpose_ && main_.channels_.empty());
+  }
+
+  // Whether `out` is written to the tile of the thread.
+  bool UsesTile(const Output& out, size_t thread_id) const {
+    if (out.tile_callback_.IsPresent()) return true;
+    return &out == &main_ && thread_id < tiles_.size() &&
+           tiles_[thread_id].rect.xsize() != 0;
+  }
+
+  // Sets up the tile of the thread to collect the output rows of `rect`.
+  Status BeginRect(size_t thread_id, const Rect& rect) override {
+    if (!CollectsTiles()) return true;
+    Tile& tile = tiles_[thread_id];
+    Rect visible = rect.Intersection(Rect(x0_, y0_, width_, height_));
+    if (visible.xsize() == 0 || visible.ysize() == 0) {
+      tile.rect = Rect();
+      return true;
+    }
+    size_t x0 = visible.x0() - x0_;
+    size_t y0 = visible.y0() - y0_;
+    size_t xsize = visible.xsize();
+    size_t ysize = visible.ysize();
+    if (flip_x_) x0 = width_ - x0 - xsize;
+    if (flip_y_) y0 = height_ - y0 - ysize;
+    if (transpose_) {
+      std::swap(x0, y0);
+      std::swap(xsize, ysize);
+    }
+    if (!main_.tile_callback_.IsPresent() &&
+        xsize * ysize > kMaxBufferedTilePixels) {
+      // Written directly, e.g. the whole image of the simple pipeline.
+      tile.rect = Rect();
+      return true;
+    }
+    tile.rect = Rect(x0, y0, xsize, ysize);
+    tile.stride = xsize * main_.PixelSize();
+    if (tile.stride * ysize > tile.capacity) {
+      tile.capacity = tile.stride * ysize;
+      JXL_ASSIGN_OR_RETURN(
+          tile.pixels, AlignedMemory::Create(memory_manager_, tile.capacity));
+    }
+    return true;
+  }
+
+  Status EndRect(size_t thread_id) override {
+    if (!CollectsTiles()) return true;
+    const Tile& tile = tiles_[thread_id];
+    if (tile.rect.xsize() == 0 || tile.rect.ysize() == 0) return true;
+    if (main_.tile_callback_.IsPresent()) {
+      main_.tile_callback_.run(main_.tile_callback_.opaque, thread_id,
+                               tile.rect.x0(), tile.rect.y0(),
+                               tile.rect.xsize(), tile.rect.ysize(),
+                               tile.pixels.address<void>(), tile.stride);
+      return true;
+    }
+    // The transposed rows are now output rows, written as in the upright case.
+    const size_t pixel_size = main_.PixelSize();
+    const uint8_t* row = tile.pixels.address<uint8_t>();
+    for (size_t y = tile.rect.y0(); y < tile.rect.y1();
+         ++y, row += tile.stride) {
+      if (main_.run_opaque_) {
+        for (size_t x = 0; x < tile.rect.xsize(); x += kMaxPixelsPerCall) {
+          const size_t len =
+              std::min(kMaxPixelsPerCall, tile.rect.xsize() - x);
+          main_.pixel_callback_.run(main_.run_opaque_, thread_id,
+                                    tile.rect.x0() + x, y, len,
+                                    row + x * pixel_size);
+        }
+      } else {
+        const size_t offset = y * main_.stride_ + tile.rect.x0() * pixel_size;
+        JXL_DASSERT(offset + tile.stride <= main_.buffer_size_);
+        memcpy(static_cast<uint8_t*>(main_.buffer_) + offset, row,
+               tile.stride);
+      }
+    }
+    return true;
+  }
+
   static bool ShouldFlipX(Orientation undo_orientation) {
     return (undo_orientation == Orientation::kFlipHorizontal ||
             undo_orientation == Orientation::kRotate180 ||
@@ -326,7 +474,7 @@ class WriteToOutputStage : public RenderPipelineStage {
       if (out.data_type_ == JXL_TYPE_UINT16) {
         StoreUnsignedRow(out, input, len, temp, xstart, ypos);
       } else {
-        StoreFloat16Row(out, input, len, temp);
+        StoreFloat16Row(out, Premultiplies(out), input, len, temp);
       }
       if (out.swap_endianness_) {
         const HWY_FULL(uint16_t) du;
@@ -338,9 +486,18 @@ class WriteToOutputStage : public RenderPipelineStage {
         }
       }
       WriteToOutput(out, thread_id, ypos, xstart, len, temp);
+    } else if (out.data_type_ == JXL_TYPE_RGB10A2) {
+      uint32_t* JXL_RESTRICT temp = temp_out_[thread_id].address<uint32_t>();
+      StoreRGB10A2Row(Premultiplies(out), input, len, temp);
+      if (out.swap_endianness_) {
+        for (size_t j = 0; j < len; ++j) {
+          temp[j] = JXL_BSWAP32(temp[j]);
+        }
+      }
+      WriteToOutput(out, thread_id, ypos, xstart, len, temp);
     } else if (out.data_type_ == JXL_TYPE_FLOAT) {
       float* JXL_RESTRICT temp = temp_out_[thread_id].address<float>();
-      StoreFloatRow(out, input, len, temp);
+      StoreFloatRow(out, Premultiplies(out), input, len, temp);
       if (out.swap_endianness_) {
         size_t output_len = len * out.num_channels_;
         for (size_t j = 0; j < output_len; ++j) {
@@ -374,10 +531,16 @@ class WriteToOutputStage : public RenderPipelineStage {
     *xstart = width_ - *xstart - len;
   }
 
+  // Whether the colors of `out` are premultiplied in the Store*Row functions.
+  bool Premultiplies(const Output& out) const {
+    return premul_alpha_ && &out == &main_;
+  }
+
   template <typename T>
   void StoreUnsignedRow(const Output& out, const float* input[4], size_t len,
                         T* output, size_t xstart, size_t ypos) const {
     const HWY_FULL(float) d;
+    const bool premul = Premultiplies(out);
     auto mul = Set(d, (1u << (out.bits_per_sample_)) - 1);
     const Rebind<T, decltype(d)> du;
     const size_t padding = RoundUpTo(len, Lanes(d)) - len;
@@ -391,10 +554,11 @@ class WriteToOutputStage : public RenderPipelineStage {
       }
     } else if (out.num_channels_ == 2) {
       for (size_t i = 0; i < len; i += Lanes(d)) {
-        StoreInterleaved2(
-            MakeUnsigned<T>(LoadU(d, &input[0][i]), xstart + i, ypos, mul),
-            MakeUnsigned<T>(LoadU(d, &input[1][i]), xstart + i, ypos, mul), du,
-            &output[2 * i]);
+        const auto a = LoadU(d, &input[1][i]);
+        const auto v0 = MaybePremultiply(premul, LoadU(d, &input[0][i]), a);
+        StoreInterleaved2(MakeUnsigned<T>(v0, xstart + i, ypos, mul),
+                          MakeUnsigned<T>(a, xstart + i, ypos, mul), du,
+                          &output[2 * i]);
       }
     } else if (out.num_channels_ == 3) {
       for (size_t i = 0; i < len; i += Lanes(d)) {
@@ -406,20 +570,24 @@ class WriteToOutputStage : public RenderPipelineStage {
       }
     } else if (out.num_channels_ == 4) {
       for (size_t i = 0; i < len; i += Lanes(d)) {
-        StoreInterleaved4(
-            MakeUnsigned<T>(LoadU(d, &input[0][i]), xstart + i, ypos, mul),
-            MakeUnsigned<T>(LoadU(d, &input[1][i]), xstart + i, ypos, mul),
-            MakeUnsigned<T>(LoadU(d, &input[2][i]), xstart + i, ypos, mul),
-            MakeUnsigned<T>(LoadU(d, &input[3][i]), xstart + i, ypos, mul), du,
-            &output[4 * i]);
+        const auto a = LoadU(d, &input[3][i]);
+        const auto v0 = MaybePremultiply(premul, LoadU(d, &input[0][i]), a);
+        const auto v1 = MaybePremultiply(premul, LoadU(d, &input[1][i]), a);
+        const auto v2 = MaybePremultiply(premul, LoadU(d, &input[2][i]), a);
+        StoreInterleaved4(MakeUnsigned<T>(v0, xstart + i, ypos, mul),
+                          MakeUnsigned<T>(v1, xstart + i, ypos, mul),
+                          MakeUnsigned<T>(v2, xstart + i, ypos, mul),
+                          MakeUnsigned<T>(a, xstart + i, ypos, mul), du,
+                          &output[4 * i]);
       }
     }
     msan::PoisonMemory(output + out.num_channels_ * len,
                        sizeof(output[0]) * out.num_channels_ * padding);
   }
 
-  static void StoreFloat16Row(const Output& out, const float* input[4],
-                              size_t len, uint16_t* output) {
+  static void StoreFloat16Row(const Output& out, bool premul,
+                              const float* input[4], size_t len,
+                              uint16_t* output) {
     const HWY_FULL(float) d;
     const Rebind<uint16_t, decltype(d)> du;
     const Rebind<hwy::float16_t, decltype(d)> df16;
@@ -434,8 +602,8 @@ class WriteToOutputStage : public RenderPipelineStage {
       }
     } else if (out.num_channels_ == 2) {
       for (size_t i = 0; i < len; i += Lanes(d)) {
-        auto v0 = LoadU(d, &input[0][i]);
         auto v1 = LoadU(d, &input[1][i]);
+        auto v0 = MaybePremultiply(premul, LoadU(d, &input[0][i]), v1);
         StoreInterleaved2(BitCast(du, DemoteTo(df16, v0)),
                           BitCast(du, DemoteTo(df16, v1)), du, &output[2 * i]);
       }
@@ -450,10 +618,10 @@ class WriteToOutputStage : public RenderPipelineStage {
       }
     } else if (out.num_channels_ == 4) {
       for (size_t i = 0; i < len; i += Lanes(d)) {
-        auto v0 = LoadU(d, &input[0][i]);
-        auto v1 = LoadU(d, &input[1][i]);
-        auto v2 = LoadU(d, &input[2][i]);
         auto v3 = LoadU(d, &input[3][i]);
+        auto v0 = MaybePremultiply(premul, LoadU(d, &input[0][i]), v3);
+        auto v1 = MaybePremultiply(premul, LoadU(d, &input[1][i]), v3);
+        auto v2 = MaybePremultiply(premul, LoadU(d, &input[2][i]), v3);
         StoreInterleaved4(BitCast(du, DemoteTo(df16, v0)),
                           BitCast(du, DemoteTo(df16, v1)),
                           BitCast(du, DemoteTo(df16, v2)),
@@ -464,15 +632,46 @@ class WriteToOutputStage : public RenderPipelineStage {
                        sizeof(output[0]) * out.num_channels_ * padding);
   }
 
-  static void StoreFloatRow(const Output& out, const float* input[4],
-                            size_t len, float* output) {
+  // Packs 4 channels to 10 bits each for the colors and 2 bits for alpha.
+  static void StoreRGB10A2Row(bool premul, const float* input[4], size_t len,
+                              uint32_t* output) {
+    const HWY_FULL(float) d;
+    const Rebind<uint32_t, decltype(d)> du;
+    const auto mul_color = Set(d, 1023.0f);
+    const auto mul_alpha = Set(d, 3.0f);
+    const size_t padding = RoundUpTo(len, Lanes(d)) - len;
+    for (size_t c = 0; c < 4; ++c) {
+      msan::UnpoisonMemory(input[c] + len, sizeof(input[c][0]) * padding);
+    }
+    for (size_t i = 0; i < len; i += Lanes(d)) {
+      const auto alpha = LoadU(d, input[3] + i);
+      const auto r = BitCast(
+          du, Quantize(MaybePremultiply(premul, LoadU(d, input[0] + i), alpha),
+                       mul_color));
+      const auto g = BitCast(
+          du, Quantize(MaybePremultiply(premul, LoadU(d, input[1] + i), alpha),
+                       mul_color));
+      const auto b = BitCast(
+          du, Quantize(MaybePremultiply(premul, LoadU(d, input[2] + i), alpha),
+                       mul_color));
+      const auto a = BitCast(du, Quantize(alpha, mul_alpha));
+      const auto rg = Or(r, ShiftLeft<10>(g));
+      const auto ba = Or(ShiftLeft<20>(b), ShiftLeft<30>(a));
+      StoreU(Or(rg, ba), du, output + i);
+    }
+    msan::PoisonMemory(output + len, sizeof(output[0]) * padding);
+  }
+
+  static void StoreFloatRow(const Output& out, bool premul,
+                            const float* input[4], size_t len, float* output) {
     const HWY_FULL(float) d;
     if (out.num_channels_ == 1) {
       memcpy(output, input[0], len * sizeof(output[0]));
     } else if (out.num_channels_ == 2) {
       for (size_t i = 0; i < len; i += Lanes(d)) {
-        StoreInterleaved2(LoadU(d, &input[0][i]), LoadU(d, &input[1][i]), d,
-                          &output[2 * i]);
+        const auto a = LoadU(d, &input[1][i]);
+        StoreInterleaved2(MaybePremultiply(premul, LoadU(d, &input[0][i]), a),
+                          a, d, &output[2 * i]);
       }
     } else if (out.num_channels_ == 3) {
       for (size_t i = 0; i < len; i += Lanes(d)) {
@@ -481,9 +680,11 @@ class WriteToOutputStage : public RenderPipelineStage {
       }
     } else {
       for (size_t i = 0; i < len; i += Lanes(d)) {
-        StoreInterleaved4(LoadU(d, &input[0][i]), LoadU(d, &input[1][i]),
-                          LoadU(d, &input[2][i]), LoadU(d, &input[3][i]), d,
-                          &output[4 * i]);
+        const auto a = LoadU(d, &input[3][i]);
+        StoreInterleaved4(MaybePremultiply(premul, LoadU(d, &input[0][i]), a),
+                          MaybePremultiply(premul, LoadU(d, &input[1][i]), a),
+                          MaybePremultiply(premul, LoadU(d, &input[2][i]), a),
+                          a, d, &output[4 * i]);
       }
     }
   }
@@ -491,17 +692,26 @@ class WriteToOutputStage : public RenderPipelineStage {
   template <typename T>
   void WriteToOutput(const Output& out, size_t thread_id, size_t ypos,
                      size_t xstart, size_t len, T* output) const {
+    if (UsesTile(out, thread_id)) {
+      WriteToTile(out, thread_id, ypos, xstart, len, output);
+      return;
+    }
+    if (!out.channels_.empty()) {
+      WriteToChannels(out, ypos, xstart, len, output);
+      return;
+    }
     if (transpose_) {
-      // TODO(szabadka) Buffer 8x8 chunks and transpose with SIMD.
+      // Only for the extra channels and the rects above
+      // kMaxBufferedTilePixels; the main output is collected in tiles.
       if (out.run_opaque_) {
-        for (size_t i = 0, j = 0; i < len; ++i, j += out.num_channels_) {
+        for (size_t i = 0, j = 0; i < len; ++i, j += out.samples_per_pixel_) {
           out.pixel_callback_.run(out.run_opaque_, thread_id, ypos, xstart + i,
                                   1, output + j);
         }
       } else {
-        const size_t pixel_stride = out.num_channels_ * sizeof(T);
+        const size_t pixel_stride = out.samples_per_pixel_ * sizeof(T);
         const size_t offset = xstart * out.stride_ + ypos * pixel_stride;
-        for (size_t i = 0, j = 0; i < len; ++i, j += out.num_channels_) {
+        for (size_t i = 0, j = 0; i < len; ++i, j += out.samples_per_pixel_) {
           const size_t ix = offset + i * out.stride_;
           JXL_DASSERT(ix + pixel_stride <= out.buffer_size_);
           memcpy(reinterpret_cast<uint8_t*>(out.buffer_) + ix, output + j,
@@ -513,7 +723,7 @@ class WriteToOutputStage : public RenderPipelineStage {
         out.pixel_callback_.run(out.run_opaque_, thread_id, xstart, ypos, len,
                                 output);
       } else {
-        const size_t pixel_stride = out.num_channels_ * sizeof(T);
+        const size_t pixel_stride = out.samples_per_pixel_ * sizeof(T);
         const size_t offset = ypos * out.stride_ + xstart * pixel_stride;
         JXL_DASSERT(offset + len * pixel_stride <= out.buffer_size_);
         memcpy(reinterpret_cast<uint8_t*>(out.buffer_) + offset, output,
@@ -522,7 +732,66 @@ class WriteToOutputStage : public RenderPipelineStage {
     }
   }
 
+  // Copies the pixels of `output` to the tile of the thread.
+  template <typename T>
+  void WriteToTile(const Output& out, size_t thread_id, size_t ypos,
+                   size_t xstart, size_t len, const T* output) const {
+    const Tile& tile = tiles_[thread_id];
+    const size_t pixel_stride = out.samples_per_pixel_ * sizeof(T);
+    uint8_t* JXL_RESTRICT pixels = tile.pixels.address<uint8_t>();
+    if (transpose_) {
+      // In transposed output, input rows are written as tile columns.
+      JXL_DASSERT(ypos >= tile.rect.x0() && ypos < tile.rect.x1());
+      JXL_DASSERT(xstart >= tile.rect.y0() && xstart + len <= tile.rect.y1());
+      uint8_t* pos = pixels + (xstart - tile.rect.y0()) * tile.stride +
+                     (ypos - tile.rect.x0()) * pixel_stride;
+      for (size_t i = 0, j = 0; i < len;
+           ++i, j += out.samples_per_pixel_, pos += tile.stride) {
+        memcpy(pos, output + j, pixel_stride);
+      }
+    } else {
+      JXL_DASSERT(ypos >= tile.rect.y0() && ypos < tile.rect.y1());
+      JXL_DASSERT(xstart >= tile.rect.x0() && xstart + len <= tile.rect.x1());
+      memcpy(pixels + (ypos - tile.rect.y0()) * tile.stride +
+                 (xstart - tile.rect.x0()) * pixel_stride,
+             output, len * pixel_stride);
+    }
+  }
+
+  // Scatters the interleaved samples of `output` to the channel buffers.
+  template <typename T>
+  void WriteToChannels(const Output& out, size_t ypos, size_t xstart,
+                       size_t len, const T* output) const {
+    const size_t num_channels = out.num_channels_;
+    if (!transpose_ && out.interleaved_) {
+      const JxlChannelBuffer& channel = out.channels_[0];
+      memcpy(static_cast<uint8_t*>(channel.base) + ypos * channel.row_stride +
+                 xstart * channel.pixel_stride,
+             output, len * num_channels * sizeof(T));
+      return;
+    }
+    for (size_t c = 0; c < num_channels; ++c) {
+      const JxlChannelBuffer& channel = out.channels_[c];
+      // In transposed output, input rows are written as output columns.
+      const size_t x = transpose_ ? ypos : xstart;
+      const size_t y = transpose_ ? xstart : ypos;
+      const size_t offset = y * channel.row_stride + x * channel.pixel_stride;
+      const size_t step =
+          transpose_ ? channel.row_stride : channel.pixel_stride;
+      uint8_t* JXL_RESTRICT pos = static_cast<uint8_t*>(channel.base) + offset;
+      for (size_t i = 0; i < len; ++i, pos += step) {
+        memcpy(pos, output + i * num_channels + c, sizeof(T));
+      }
+    }
+  }
+
   static constexpr size_t kMaxPixelsPerCall = 1024;
+  // Largest rect whose transposed pixels are collected in a tile. The tiles of
+  // the groups stay in the cache while consecutive input rows fill adjacent
+  // pixels of each tile row.
+  static constexpr size_t kMaxBufferedTilePixels = 1 << 20;
+  size_t x0_;
+  size_t y0_;
   size_t width_;
   size_t height_;
   Output main_;  // color + alpha
@@ -530,12 +799,24 @@ class WriteToOutputStage : public RenderPipelineStage {
   bool want_alpha_;
   bool has_alpha_;
   bool unpremul_alpha_;
+  // Whether the colors of the main output are multiplied by the alpha in the
+  // conversion to the output format.
+  bool premul_alpha_;
   size_t alpha_c_;
   bool flip_x_;
   bool flip_y_;
   bool transpose_;
   std::vector<Output> extra_channels_;
   std::vector<float> opaque_alpha_;
+  // Output rows of the rect being rendered by each thread, see CollectsTiles.
+  struct Tile {
+    AlignedMemory pixels;
+    size_t capacity = 0;
+    // In output coordinates.
+    Rect rect;
+    size_t stride = 0;
+  };
+  std::vector<Tile> tiles_;
   JxlMemoryManager* memory_manager_;
   std::vector<AlignedMemory> temp_in_;
   std::vector<AlignedMemory> temp_out_;
@@ -546,12 +827,13 @@ constexpr size_t WriteToOutputStage::kMaxPixelsPerCall;
 #endif
 
 std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
-    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
-    bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
-    std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager) {
+    const ImageOutput& main_output, const Rect& output_rect, bool has_alpha,
+    bool unpremul_alpha, bool premul_alpha, size_t alpha_c,
+    Orientation undo_orientation, std::vector<ImageOutput>& extra_output,
+    JxlMemoryManager* memory_manager) {
   return jxl::make_unique<WriteToOutputStage>(
-      main_output, width, height, has_alpha, unpremul_alpha, alpha_c,
-      undo_orientation, extra_output, memory_manager);
+      main_output, output_rect, has_alpha, unpremul_alpha, premul_alpha,
+      alpha_c, undo_orientation, extra_output, memory_manager);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -685,12 +967,13 @@ std::unique_ptr<RenderPipelineStage> GetWriteToImage3FStage(
 }
 
 std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
-    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
-    bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
-    std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager) {
+    const ImageOutput& main_output, const Rect& output_rect, bool has_alpha,
+    bool unpremul_alpha, bool premul_alpha, size_t alpha_c,
+    Orientation undo_orientation, std::vector<ImageOutput>& extra_output,
+    JxlMemoryManager* memory_manager) {
   return HWY_DYNAMIC_DISPATCH(GetWriteToOutputStage)(
-      main_output, width, height, has_alpha, unpremul_alpha, alpha_c,
-      undo_orientation, extra_output, memory_manager);
+      main_output, output_rect, has_alpha, unpremul_alpha, premul_alpha,
+      alpha_c, undo_orientation, extra_output, memory_manager);
 }
 
 }  // namespace jxl
@@ -12,6 +12,7 @@
 #include <memory>
 #include <vector>
 
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/dec_cache.h"
 #include "lib/jxl/dec_xyb.h"
 #include "lib/jxl/image.h"
@@ -28,10 +29,14 @@ std::unique_ptr<RenderPipelineStage> GetWriteToImageBundleStage(
 std::unique_ptr<RenderPipelineStage> GetWriteToImage3FStage(
     JxlMemoryManager* memory_manager, Image3F* image);
 
-// Gets a stage to write to a pixel callback or image buffer.
+// Gets a stage to write to a pixel callback or image buffer. Only the pixels
+// inside `output_rect` (in image coordinates, before applying
+// `undo_orientation`) are written, relative to its origin. With
+// `premul_alpha`, the colors are multiplied by the alpha as they are converted.
 std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
-    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
-    bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
+    const ImageOutput& main_output, const Rect& output_rect, bool has_alpha,
+    bool unpremul_alpha, bool premul_alpha, size_t alpha_c,
+    Orientation undo_orientation,
     std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager);
 
 }  // namespace jxl
@@ -5,6 +5,8 @@
 
 #include "lib/jxl/render_pipeline/stage_xyb.h"
 
+#include <cstring>
+
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/sanitizers.h"
 
@@ -119,6 +121,37 @@ std::unique_ptr<RenderPipelineStage> GetXYBStage(
   return HWY_DYNAMIC_DISPATCH(GetXYBStage)(output_encoding_info);
 }
 
+namespace {
+class NeutralChromaStage : public RenderPipelineStage {
+ public:
+  NeutralChromaStage()
+      : RenderPipelineStage(RenderPipelineStage::Settings()) {}
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    float* JXL_RESTRICT row_x = GetInputRow(input_rows, 0, 0) - xextra;
+    const float* JXL_RESTRICT row_y = GetInputRow(input_rows, 1, 0) - xextra;
+    float* JXL_RESTRICT row_b = GetInputRow(input_rows, 2, 0) - xextra;
+    const size_t num = xsize + 2 * xextra;
+    memset(row_x, 0, num * sizeof(float));
+    memcpy(row_b, row_y, num * sizeof(float));
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c < 3 ? RenderPipelineChannelMode::kInPlace
+                 : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "NeutralChroma"; }
+};
+}  // namespace
+
+std::unique_ptr<RenderPipelineStage> GetNeutralChromaStage() {
+  return make_unique<NeutralChromaStage>();
+}
+
 #if !JXL_HIGH_PRECISION
 namespace {
 class FastXYBStage : public RenderPipelineStage {
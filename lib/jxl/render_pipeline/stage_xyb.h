@@ -16,6 +16,10 @@ namespace jxl {
 std::unique_ptr<RenderPipelineStage> GetXYBStage(
     const OutputEncodingInfo& output_encoding_info);
 
+// Replaces the X and B channels with the ones of the neutral colors of the
+// same luma (X = 0, B = Y), for frames of which only Y is decoded.
+std::unique_ptr<RenderPipelineStage> GetNeutralChromaStage();
+
 // Gets a stage to convert with fixed point arithmetic from XYB to sRGB8 and
 // write to a uint8 buffer.
 std::unique_ptr<RenderPipelineStage> GetFastXYBTosRGB8Stage(
@@ -0,0 +1,121 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/render_pipeline/stage_ycbcr_planes.h"
+
+#include <jxl/decode.h>
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+
+namespace jxl {
+
+class WriteToYCbCrPlaneStage : public RenderPipelineStage {
+ public:
+  WriteToYCbCrPlaneStage(size_t c, JxlDataType data_type,
+                         const JxlChannelBuffer& plane)
+      : RenderPipelineStage(RenderPipelineStage::Settings()),
+        c_(c),
+        data_type_(data_type),
+        plane_(plane),
+        // Channel 1 holds Y.
+        offset_(c == 1 ? 128.0f / 255 : 0.0f) {}
+
+  Status SetInputSizes(
+      const std::vector<std::pair<size_t, size_t>>& input_sizes) override {
+    JXL_ENSURE(c_ < input_sizes.size());
+    xsize_ = input_sizes[c_].first;
+    ysize_ = input_sizes[c_].second;
+    return true;
+  }
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    if (ypos >= ysize_ || xpos >= xsize_) return true;
+    xsize = std::min(xsize, xsize_ - xpos);
+    const float* JXL_RESTRICT row = GetInputRow(input_rows, c_, 0);
+    uint8_t* JXL_RESTRICT out = static_cast<uint8_t*>(plane_.base) +
+                                ypos * plane_.row_stride +
+                                xpos * plane_.pixel_stride;
+    if (data_type_ == JXL_TYPE_UINT8) {
+      for (size_t x = 0; x < xsize; ++x, out += plane_.pixel_stride) {
+        float v = std::round((row[x] + offset_) * 255.0f);
+        *out = static_cast<uint8_t>(Clamp1(v, 0.0f, 255.0f));
+      }
+    } else {
+      JXL_ENSURE(data_type_ == JXL_TYPE_FLOAT);
+      for (size_t x = 0; x < xsize; ++x, out += plane_.pixel_stride) {
+        float v = row[x] + offset_;
+        memcpy(out, &v, sizeof(v));
+      }
+    }
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c == c_ ? RenderPipelineChannelMode::kInput
+                   : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "WriteYCbCrPlane"; }
+
+ private:
+  size_t c_;
+  JxlDataType data_type_;
+  JxlChannelBuffer plane_;
+  float offset_;
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+};
+
+class SkipChromaUpsamplingStage : public RenderPipelineStage {
+ public:
+  SkipChromaUpsamplingStage(size_t c, bool horizontal)
+      : RenderPipelineStage(
+            horizontal ? RenderPipelineStage::Settings::ShiftX(1, 0)
+                       : RenderPipelineStage::Settings::ShiftY(1, 0)),
+        c_(c) {}
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c == c_ ? RenderPipelineChannelMode::kInOut
+                   : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "SkipChromaUps"; }
+
+ private:
+  size_t c_;
+};
+
+std::unique_ptr<RenderPipelineStage> GetWriteToYCbCrPlaneStage(
+    size_t c, JxlDataType data_type, const JxlChannelBuffer& plane) {
+  return jxl::make_unique<WriteToYCbCrPlaneStage>(c, data_type, plane);
+}
+
+std::unique_ptr<RenderPipelineStage> GetSkipChromaUpsamplingStage(
+    size_t c, bool horizontal) {
+  return jxl::make_unique<SkipChromaUpsamplingStage>(c, horizontal);
+}
+
+}  // namespace jxl
@@ -0,0 +1,33 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_RENDER_PIPELINE_STAGE_YCBCR_PLANES_H_
+#define LIB_JXL_RENDER_PIPELINE_STAGE_YCBCR_PLANES_H_
+
+#include <jxl/decode.h>
+#include <jxl/types.h>
+
+#include <cstddef>
+#include <memory>
+
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+
+namespace jxl {
+
+// Writes the color channel `c` of a YCbCr frame, at the resolution it has in
+// the pipeline, to `plane` as full-range samples with an offset of 128/255 on
+// Y, like JPEG does (Cb and Cr are already centered).
+std::unique_ptr<RenderPipelineStage> GetWriteToYCbCrPlaneStage(
+    size_t c, JxlDataType data_type, const JxlChannelBuffer& plane);
+
+// Doubles the resolution of channel `c`, either horizontally or vertically,
+// without computing any pixels; used in place of chroma upsampling when the
+// channel is only written at its native resolution.
+std::unique_ptr<RenderPipelineStage> GetSkipChromaUpsamplingStage(
+    size_t c, bool horizontal);
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_RENDER_PIPELINE_STAGE_YCBCR_PLANES_H_
@@ -819,6 +819,198 @@ TEST(RoundtripTest, MultiFrameTest) {
   }
 }
 
+// Skipping to a frame or a time of an animation with keyframes in the frame
+// index gives the same frame as decoding all frames.
+TEST(RoundtripTest, KeyframeSeekTest) {
+  JxlPixelFormat pixel_format =
+      JxlPixelFormat{3, JXL_TYPE_UINT16, JXL_NATIVE_ENDIAN, 0};
+  const size_t xsize = 61;
+  const size_t ysize = 71;
+  const size_t nb_frames = 12;
+  // use a vertical filmstrip of nb_frames frames
+  const std::vector<uint8_t> original_bytes =
+      GetTestImage<uint16_t>(xsize, ysize * nb_frames, pixel_format);
+  const size_t oneframesize = original_bytes.size() / nb_frames;
+
+  JxlEncoder* enc = JxlEncoderCreate(nullptr);
+  ASSERT_NE(nullptr, enc);
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderUseContainer(enc, true));
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = JXL_FALSE;
+  basic_info.have_animation = JXL_TRUE;
+  basic_info.animation.tps_numerator = 10;
+  basic_info.animation.tps_denominator = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc, &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetColorEncoding(enc, &color_encoding));
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc, nullptr);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderFrameSettingsSetOption(
+                frame_settings, JXL_ENC_FRAME_SETTING_KEYFRAME_INTERVAL, 4));
+  JxlFrameHeader frame_header;
+  JxlEncoderInitFrameHeader(&frame_header);
+  std::vector<uint64_t> start_ticks(nb_frames + 1, 0);
+  for (size_t i = 0; i < nb_frames; i++) {
+    frame_header.duration = i + 1;
+    frame_header.is_last = TO_JXL_BOOL(i + 1 == nb_frames);
+    start_ticks[i + 1] = start_ticks[i] + frame_header.duration;
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetFrameHeader(frame_settings, &frame_header));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(
+                  frame_settings, &pixel_format,
+                  original_bytes.data() + oneframesize * i, oneframesize));
+  }
+  JxlEncoderCloseInput(enc);
+  std::vector<uint8_t> compressed;
+  EncodeWithEncoder(enc, &compressed);
+  JxlEncoderDestroy(enc);
+
+  // Decodes the next frame, checking that it is frame `i`.
+  const auto decode_frame = [&](JxlDecoder* dec, size_t i) {
+    std::vector<uint8_t> pixels(oneframesize);
+    EXPECT_EQ(JXL_DEC_FRAME, JxlDecoderProcessInput(dec));
+    JxlFrameHeader header;
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetFrameHeader(dec, &header));
+    EXPECT_EQ(i + 1, header.duration);
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetImageOutBuffer(dec, &pixel_format, pixels.data(),
+                                          pixels.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    return pixels;
+  };
+  const auto create_decoder = [&]() {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO |
+                                                 JXL_DEC_FRAME |
+                                                 JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetPersistentInput(dec, compressed.data(),
+                                           compressed.size()));
+    EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+    return dec;
+  };
+
+  std::vector<std::vector<uint8_t>> frames;
+  JxlDecoder* dec = create_decoder();
+  for (size_t i = 0; i < nb_frames; i++) frames.push_back(decode_frame(dec, i));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+
+  for (size_t target : {0, 3, 4, 5, 10, 11}) {
+    dec = create_decoder();
+    JxlDecoderSkipFrames(dec, target);
+    EXPECT_EQ(frames[target], decode_frame(dec, target));
+    if (target + 2 < nb_frames) {
+      // Skipping again from there, and then decoding the next frames.
+      JxlDecoderSkipFrames(dec, 1);
+      EXPECT_EQ(frames[target + 2], decode_frame(dec, target + 2));
+    }
+    JxlDecoderDestroy(dec);
+  }
+
+  for (size_t target : {0, 5, 9, 11}) {
+    dec = create_decoder();
+    // The middle of the frame (end - 1 for the shortest one).
+    uint64_t ticks = (start_ticks[target] + start_ticks[target + 1]) / 2;
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSkipToTime(dec, ticks));
+    EXPECT_EQ(frames[target], decode_frame(dec, target));
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSkipToTime(dec, ticks));
+    JxlDecoderDestroy(dec);
+  }
+}
+
+TEST(RoundtripTest, ParallelFramesTest) {
+  JxlPixelFormat pixel_format =
+      JxlPixelFormat{4, JXL_TYPE_UINT16, JXL_NATIVE_ENDIAN, 0};
+  const size_t xsize = 37;
+  const size_t ysize = 29;
+  const size_t nb_frames = 7;
+  // use a vertical filmstrip of nb_frames frames
+  const std::vector<uint8_t> original_bytes =
+      GetTestImage<uint16_t>(xsize, ysize * nb_frames, pixel_format);
+  const size_t oneframesize = original_bytes.size() / nb_frames;
+
+  JxlEncoder* enc = JxlEncoderCreate(nullptr);
+  ASSERT_NE(nullptr, enc);
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = JXL_FALSE;
+  basic_info.have_animation = JXL_TRUE;
+  basic_info.animation.tps_numerator = 10;
+  basic_info.animation.tps_denominator = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc, &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetColorEncoding(enc, &color_encoding));
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc, nullptr);
+  JxlFrameHeader frame_header;
+  JxlEncoderInitFrameHeader(&frame_header);
+  frame_header.duration = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameHeader(frame_settings, &frame_header));
+  for (size_t i = 0; i < nb_frames; i++) {
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(
+                  frame_settings, &pixel_format,
+                  original_bytes.data() + oneframesize * i, oneframesize));
+  }
+  JxlEncoderCloseInput(enc);
+  std::vector<uint8_t> compressed;
+  EncodeWithEncoder(enc, &compressed);
+  JxlEncoderDestroy(enc);
+
+  const auto decode_frames = [&](size_t parallel_frames) {
+    std::vector<std::vector<uint8_t>> frames;
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetParallelFrames(dec, parallel_frames));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+    JxlDecoderCloseInput(dec);
+    for (;;) {
+      JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+      if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+        frames.emplace_back(oneframesize);
+        EXPECT_EQ(JXL_DEC_SUCCESS,
+                  JxlDecoderSetImageOutBuffer(dec, &pixel_format,
+                                              frames.back().data(),
+                                              frames.back().size()));
+      } else if (status != JXL_DEC_FULL_IMAGE) {
+        EXPECT_EQ(JXL_DEC_SUCCESS, status);
+        break;
+      }
+    }
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetParallelFrames(dec, 2));
+    JxlDecoderDestroy(dec);
+    return frames;
+  };
+
+  std::vector<std::vector<uint8_t>> frames = decode_frames(0);
+  ASSERT_EQ(nb_frames, frames.size());
+  for (size_t parallel_frames : {2, 3, 16}) {
+    std::vector<std::vector<uint8_t>> parallel = decode_frames(parallel_frames);
+    ASSERT_EQ(nb_frames, parallel.size());
+    for (size_t i = 0; i < nb_frames; i++) {
+      EXPECT_EQ(0u, jxl::test::ComparePixels(frames[i].data(),
+                                             parallel[i].data(), xsize, ysize,
+                                             pixel_format, pixel_format));
+    }
+  }
+}
+
 static const unsigned char kEncodedTestProfile[] = {
     0x1f, 0x8b, 0x1,  0x13, 0x10, 0x0,  0x0,  0x0,  0x20, 0x4c, 0xcc, 0x3,
     0xe7, 0xa0, 0xa5, 0xa2, 0x90, 0xa4, 0x27, 0xe8, 0x79, 0x1d, 0xe3, 0x26,
@@ -69,29 +69,40 @@ float ContinuousIDCT(const Dct32& dct, const float t) {
   return GetLane(SumOfLanes(df, result));
 }
 
+// Draws [x0, x1) of one row of a segment. The values that do not depend on x
+// are only broadcast once per call.
 template <typename DF>
-void DrawSegment(DF df, const SplineSegment& segment, const bool add,
-                 const size_t y, const size_t x, float* JXL_RESTRICT rows[3]) {
+void DrawSegmentPixels(DF df, const SplineSegment& segment, const bool add,
+                       const size_t y, ssize_t x, const ssize_t x1,
+                       float* JXL_RESTRICT rows[3]) {
   Rebind<int32_t, DF> di;
   const auto inv_sigma = Set(df, segment.inv_sigma);
   const auto half = Set(df, 0.5f);
   const auto one_over_2s2 = Set(df, 0.353553391f);
   const auto sigma_over_4_times_intensity =
       Set(df, segment.sigma_over_4_times_intensity);
-  const auto dx = Sub(ConvertTo(df, Iota(di, x)), Set(df, segment.center_x));
-  const auto dy = Set(df, y - segment.center_y);
-  const auto sqd = MulAdd(dx, dx, Mul(dy, dy));
-  const auto distance = Sqrt(sqd);
-  const auto one_dimensional_factor =
-      Sub(FastErff(df, Mul(MulAdd(distance, half, one_over_2s2), inv_sigma)),
-          FastErff(df, Mul(MulSub(distance, half, one_over_2s2), inv_sigma)));
-  auto local_intensity =
-      Mul(sigma_over_4_times_intensity,
-          Mul(one_dimensional_factor, one_dimensional_factor));
-  for (size_t c = 0; c < 3; ++c) {
-    const auto cm = Set(df, add ? segment.color[c] : -segment.color[c]);
-    const auto in = LoadU(df, rows[c] + x);
-    StoreU(MulAdd(cm, local_intensity, in), df, rows[c] + x);
+  const auto center_x = Set(df, segment.center_x);
+  const float dy = y - segment.center_y;
+  const auto dy2 = Set(df, dy * dy);
+  const auto cm0 = Set(df, add ? segment.color[0] : -segment.color[0]);
+  const auto cm1 = Set(df, add ? segment.color[1] : -segment.color[1]);
+  const auto cm2 = Set(df, add ? segment.color[2] : -segment.color[2]);
+  const ssize_t N = Lanes(df);
+  for (; x + N <= x1; x += N) {
+    const auto dx = Sub(ConvertTo(df, Iota(di, x)), center_x);
+    const auto distance = Sqrt(MulAdd(dx, dx, dy2));
+    const auto one_dimensional_factor =
+        Sub(FastErff(df, Mul(MulAdd(distance, half, one_over_2s2), inv_sigma)),
+            FastErff(df, Mul(MulSub(distance, half, one_over_2s2), inv_sigma)));
+    const auto local_intensity =
+        Mul(sigma_over_4_times_intensity,
+            Mul(one_dimensional_factor, one_dimensional_factor));
+    StoreU(MulAdd(cm0, local_intensity, LoadU(df, rows[0] + x)), df,
+           rows[0] + x);
+    StoreU(MulAdd(cm1, local_intensity, LoadU(df, rows[1] + x)), df,
+           rows[1] + x);
+    StoreU(MulAdd(cm2, local_intensity, LoadU(df, rows[2] + x)), df,
+           rows[2] + x);
   }
 }
 
@@ -102,19 +113,21 @@ void DrawSegment(const SplineSegment& segment, const bool add, const size_t y,
   // one-past-the-end
   x1 = std::min<ssize_t>(
       x1, std::llround(segment.center_x + segment.maximum_distance) + 1);
+  if (x >= x1) return;
   HWY_FULL(float) df;
-  for (; x + static_cast<ssize_t>(Lanes(df)) <= x1; x += Lanes(df)) {
-    DrawSegment(df, segment, add, y, x, rows);
-  }
-  for (; x < x1; ++x) {
-    DrawSegment(HWY_CAPPED(float, 1)(), segment, add, y, x, rows);
-  }
+  const ssize_t N = Lanes(df);
+  const ssize_t xend = x + (x1 - x) / N * N;
+  DrawSegmentPixels(df, segment, add, y, x, xend, rows);
+  DrawSegmentPixels(HWY_CAPPED(float, 1)(), segment, add, y, xend, x1, rows);
 }
 
+// Also records, for each row and each bin of kSplineBinSize columns of the
+// image that the segment reaches, the pair (row * num_bins + bin, segment).
 void ComputeSegments(const Spline::Point& center, const float intensity,
                      const float color[3], const float sigma,
+                     const size_t image_xsize, const size_t image_ysize,
                      std::vector<SplineSegment>& segments,
-                     std::vector<std::pair<size_t, size_t>>& segments_by_y) {
+                     std::vector<std::pair<size_t, size_t>>& segments_by_bin) {
   // Sanity check sigma, inverse sigma and intensity
   if (!(std::isfinite(sigma) && sigma != 0.0f && std::isfinite(1.0f / sigma) &&
         std::isfinite(intensity))) {
@@ -143,11 +156,24 @@ void ComputeSegments(const Spline::Point& center, const float intensity,
   segment.inv_sigma = 1.0f / sigma;
   segment.sigma_over_4_times_intensity = .25f * sigma * intensity;
   segment.maximum_distance = maximum_distance;
-  ssize_t y0 = std::llround(center.y - maximum_distance);
-  ssize_t y1 =
-      std::llround(center.y + maximum_distance) + 1;  // one-past-the-end
-  for (ssize_t y = std::max<ssize_t>(y0, 0); y < y1; y++) {
-    segments_by_y.emplace_back(y, segments.size());
+  // Ranges of rows and of columns reached, one-past-the-end, clamped to the
+  // image. Segments entirely outside of the image are not stored.
+  const ssize_t y0 = std::max<ssize_t>(
+      std::llround(center.y - maximum_distance), 0);
+  const ssize_t y1 = std::min<ssize_t>(
+      std::llround(center.y + maximum_distance) + 1, image_ysize);
+  const ssize_t x0 = std::max<ssize_t>(
+      std::llround(center.x - maximum_distance), 0);
+  const ssize_t x1 = std::min<ssize_t>(
+      std::llround(center.x + maximum_distance) + 1, image_xsize);
+  if (y0 >= y1 || x0 >= x1) return;
+  const size_t num_bins = DivCeil(image_xsize, kSplineBinSize);
+  const size_t bin0 = x0 / kSplineBinSize;
+  const size_t bin1 = (x1 - 1) / kSplineBinSize + 1;
+  for (ssize_t y = y0; y < y1; y++) {
+    for (size_t bin = bin0; bin < bin1; bin++) {
+      segments_by_bin.emplace_back(y * num_bins + bin, segments.size());
+    }
   }
   segments.push_back(segment);
 }
@@ -156,18 +182,28 @@ void DrawSegments(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
                   float* JXL_RESTRICT row_b, size_t y, size_t x0, size_t x1,
                   const bool add, const SplineSegment* segments,
                   const size_t* segment_indices,
-                  const size_t* segment_y_start) {
+                  const size_t* segment_bin_start, const size_t num_bins) {
   float* JXL_RESTRICT rows[3] = {row_x - x0, row_y - x0, row_b - x0};
-  for (size_t i = segment_y_start[y]; i < segment_y_start[y + 1]; i++) {
-    DrawSegment(segments[segment_indices[i]], add, y, x0, x1, rows);
+  // Each bin only draws its own columns, so that every pixel still gets the
+  // contributions of its segments in the same order.
+  for (size_t bin = x0 / kSplineBinSize;
+       bin < num_bins && bin * kSplineBinSize < x1; bin++) {
+    const size_t bx0 = std::max(x0, bin * kSplineBinSize);
+    const size_t bx1 = std::min(x1, (bin + 1) * kSplineBinSize);
+    const size_t key = y * num_bins + bin;
+    for (size_t i = segment_bin_start[key]; i < segment_bin_start[key + 1];
+         i++) {
+      DrawSegment(segments[segment_indices[i]], add, y, bx0, bx1, rows);
+    }
   }
 }
 
 void SegmentsFromPoints(
     const Spline& spline,
     const std::vector<std::pair<Spline::Point, float>>& points_to_draw,
-    const float arc_length, std::vector<SplineSegment>& segments,
-    std::vector<std::pair<size_t, size_t>>& segments_by_y) {
+    const float arc_length, const size_t image_xsize,
+    const size_t image_ysize, std::vector<SplineSegment>& segments,
+    std::vector<std::pair<size_t, size_t>>& segments_by_bin) {
   const float inv_arc_length = 1.0f / arc_length;
   int k = 0;
   for (const auto& point_to_draw : points_to_draw) {
@@ -183,7 +219,8 @@ void SegmentsFromPoints(
     }
     const float sigma =
         ContinuousIDCT(spline.sigma_dct, (32 - 1) * progress_along_arc);
-    ComputeSegments(point, multiplier, color, sigma, segments, segments_by_y);
+    ComputeSegments(point, multiplier, color, sigma, image_xsize, image_ysize,
+                    segments, segments_by_bin);
   }
 }
 }  // namespace
@@ -564,11 +601,13 @@ void Splines::Clear() {
   starting_points_.clear();
   segments_.clear();
   segment_indices_.clear();
-  segment_y_start_.clear();
+  segment_bin_start_.clear();
+  num_bins_ = 0;
 }
 
 Status Splines::Decode(JxlMemoryManager* memory_manager, jxl::BitReader* br,
-                       const size_t num_pixels) {
+                       const size_t num_pixels,
+                       const size_t max_control_points_limit) {
   std::vector<uint8_t> context_map;
   ANSCode code;
   JXL_RETURN_IF_ERROR(DecodeHistograms(memory_manager, br, kNumSplineContexts,
@@ -579,6 +618,9 @@ Status Splines::Decode(JxlMemoryManager* memory_manager, jxl::BitReader* br,
       decoder.ReadHybridUint(kNumSplinesContext, br, context_map);
   size_t max_control_points = std::min(
       kMaxNumControlPoints, num_pixels / kMaxNumControlPointsPerPixelRatio);
+  if (max_control_points_limit != 0) {
+    max_control_points = std::min(max_control_points, max_control_points_limit);
+  }
   if (num_splines > max_control_points ||
       num_splines + 1 > max_control_points) {
     return JXL_FAILURE("Too many splines: %" PRIuS, num_splines);
@@ -625,12 +667,11 @@ void Splines::SubtractFrom(Image3F* const opsin) const {
 Status Splines::InitializeDrawCache(const size_t image_xsize,
                                     const size_t image_ysize,
                                     const ColorCorrelation& color_correlation) {
-  // TODO(veluca): avoid storing segments that are entirely outside image
-  // boundaries.
   segments_.clear();
   segment_indices_.clear();
-  segment_y_start_.clear();
-  std::vector<std::pair<size_t, size_t>> segments_by_y;
+  segment_bin_start_.clear();
+  num_bins_ = DivCeil(image_xsize, kSplineBinSize);
+  std::vector<std::pair<size_t, size_t>> segments_by_bin;
   std::vector<Spline::Point> intermediate_points;
   uint64_t total_estimated_area_reached = 0;
   std::vector<Spline> splines;
@@ -680,22 +721,21 @@ Status Splines::InitializeDrawCache(const size_t image_xsize,
       continue;
     }
     HWY_DYNAMIC_DISPATCH(SegmentsFromPoints)
-    (spline, points_to_draw, arc_length, segments_, segments_by_y);
+    (spline, points_to_draw, arc_length, image_xsize, image_ysize, segments_,
+     segments_by_bin);
   }
 
   // TODO(eustas): consider linear sorting here.
-  std::sort(segments_by_y.begin(), segments_by_y.end());
-  segment_indices_.resize(segments_by_y.size());
-  segment_y_start_.resize(image_ysize + 1);
-  for (size_t i = 0; i < segments_by_y.size(); i++) {
-    segment_indices_[i] = segments_by_y[i].second;
-    size_t y = segments_by_y[i].first;
-    if (y < image_ysize) {
-      segment_y_start_[y + 1]++;
-    }
+  std::sort(segments_by_bin.begin(), segments_by_bin.end());
+  const size_t num_keys = image_ysize * num_bins_;
+  segment_indices_.resize(segments_by_bin.size());
+  segment_bin_start_.resize(num_keys + 1);
+  for (size_t i = 0; i < segments_by_bin.size(); i++) {
+    segment_indices_[i] = segments_by_bin[i].second;
+    segment_bin_start_[segments_by_bin[i].first + 1]++;
   }
-  for (size_t y = 0; y < image_ysize; y++) {
-    segment_y_start_[y + 1] += segment_y_start_[y];
+  for (size_t key = 0; key < num_keys; key++) {
+    segment_bin_start_[key + 1] += segment_bin_start_[key];
   }
   return true;
 }
@@ -707,7 +747,7 @@ void Splines::ApplyToRow(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
   if (segments_.empty()) return;
   HWY_DYNAMIC_DISPATCH(DrawSegments)
   (row_x, row_y, row_b, y, x0, x1, add, segments_.data(),
-   segment_indices_.data(), segment_y_start_.data());
+   segment_indices_.data(), segment_bin_start_.data(), num_bins_);
 }
 
 template <bool add>
@@ -98,6 +98,9 @@ struct SplineSegment {
   float color[3];
 };
 
+// Width of the column bins of the spline drawing cache.
+constexpr size_t kSplineBinSize = 64;
+
 class Splines {
  public:
   Splines() = default;
@@ -112,8 +115,10 @@ class Splines {
 
   void Clear();
 
+  // If `max_control_points_limit` is not 0, it further limits the number of
+  // control points on top of the limit derived from `num_pixels`.
   Status Decode(JxlMemoryManager* memory_manager, BitReader* br,
-                size_t num_pixels);
+                size_t num_pixels, size_t max_control_points_limit = 0);
 
   void AddTo(Image3F* opsin, const Rect& opsin_rect) const;
   void AddToRow(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
@@ -148,8 +153,12 @@ class Splines {
   std::vector<QuantizedSpline> splines_;
   std::vector<Spline::Point> starting_points_;
   std::vector<SplineSegment> segments_;
+  // Indices in segments_ of the segments that reach each bin of
+  // kSplineBinSize columns of each row, for the bin `y * num_bins_ + bin`
+  // between segment_bin_start_[y * num_bins_ + bin] and the next start.
   std::vector<size_t> segment_indices_;
-  std::vector<size_t> segment_y_start_;
+  std::vector<size_t> segment_bin_start_;
+  size_t num_bins_ = 0;
 };
 
 }  // namespace jxl
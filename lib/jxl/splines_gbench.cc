@@ -7,9 +7,11 @@
 #include <vector>
 
 #include "benchmark/benchmark.h"
+#include "lib/jxl/base/random.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/chroma_from_luma.h"
+#include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/splines.h"
 #include "tools/no_memory_manager.h"
@@ -72,7 +74,56 @@ void BM_Splines(benchmark::State& state) {
   state.SetItemsProcessed(n * state.iterations());
 }
 
+// Many short splines spread over a large image, as produced by vector art.
+void BM_ManySplines(benchmark::State& state) {
+  const size_t num_splines = state.range();
+  const size_t kSize = 1024;
+
+  Rng rng(0);
+  std::vector<QuantizedSpline> quantized_splines;
+  std::vector<Spline::Point> starting_points;
+  for (size_t i = 0; i < num_splines; ++i) {
+    const float x = rng.UniformF(0, kSize);
+    const float y = rng.UniformF(0, kSize);
+    Spline spline{
+        /*control_points=*/{{x, y}, {x + 20, y + 10}, {x + 5, y + 30}},
+        /*color_dct=*/
+        {Dct32{0.03125f, 0.00625f}, Dct32{0.5f, 0.125f}, Dct32{0.25f}},
+        /*sigma_dct=*/{1.5f}};
+    JXL_ASSIGN_OR_QUIT(
+        QuantizedSpline qspline,
+        QuantizedSpline::Create(spline, kQuantizationAdjustment, kYToX, kYToB),
+        "Failed to create spline.");
+    quantized_splines.emplace_back(std::move(qspline));
+    starting_points.push_back(spline.control_points.front());
+  }
+  Splines splines(kQuantizationAdjustment, std::move(quantized_splines),
+                  std::move(starting_points));
+
+  JXL_ASSIGN_OR_QUIT(
+      Image3F drawing_area,
+      Image3F::Create(jpegxl::tools::NoMemoryManager(), kSize, kSize),
+      "Failed to allocate drawing plane.");
+  ZeroFillImage(&drawing_area);
+  BM_CHECK(splines.InitializeDrawCache(
+      drawing_area.xsize(), drawing_area.ysize(), color_correlation));
+  for (auto _ : state) {
+    (void)_;
+    // Rows are drawn one group at a time, as in the render pipeline.
+    for (size_t y0 = 0; y0 < kSize; y0 += kGroupDim) {
+      for (size_t x0 = 0; x0 < kSize; x0 += kGroupDim) {
+        splines.AddTo(&drawing_area,
+                      Rect(x0, y0, kGroupDim, kGroupDim, kSize, kSize));
+      }
+    }
+  }
+
+  // Pixels per second.
+  state.SetItemsProcessed(kSize * kSize * state.iterations());
+}
+
 BENCHMARK(BM_Splines)->Range(1, 1 << 10);
+BENCHMARK(BM_ManySplines)->Range(1 << 6, 1 << 12);
 
 }  // namespace
 }  // namespace jxl
@@ -329,6 +329,20 @@ TEST(SplinesTest, Drawing) {
                                           color_correlation));
   splines.AddTo(&image, Rect(image));
 
+  // Drawing rectangles that do not line up with the column bins gives the
+  // same pixels.
+  JXL_TEST_ASSIGN_OR_DIE(Image3F tiled,
+                         Image3F::Create(memory_manager, 320, 320));
+  ZeroFillImage(&tiled);
+  const size_t kTileSize = 100;
+  for (size_t y0 = 0; y0 < tiled.ysize(); y0 += kTileSize) {
+    for (size_t x0 = 0; x0 < tiled.xsize(); x0 += kTileSize) {
+      splines.AddTo(&tiled, Rect(x0, y0, kTileSize, kTileSize, tiled.xsize(),
+                                 tiled.ysize()));
+    }
+  }
+  JXL_TEST_ASSERT_OK(SamePixels(image, tiled, _));
+
   CodecInOut io_actual{memory_manager};
   JXL_TEST_ASSIGN_OR_DIE(Image3F image2,
                          Image3F::Create(memory_manager, 320, 320));
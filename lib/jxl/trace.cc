@@ -0,0 +1,179 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/trace_internal.h"
+
+#include <jxl/trace.h>
+#include <jxl/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+#if JPEGXL_ENABLE_TRACING
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace jxl {
+
+#if JPEGXL_ENABLE_TRACING
+namespace {
+
+struct TraceEvent {
+  const char* name;
+  int64_t arg;
+  uint64_t start;
+  uint64_t end;
+};
+
+// The events of one thread. The registry keeps them after the thread exits,
+// e.g. with the thread pool of a decoder that is already destroyed.
+struct ThreadEvents {
+  size_t thread_index;
+  // Only contended by JxlTraceStart.
+  std::mutex mutex;
+  std::vector<TraceEvent> events;
+};
+
+struct TraceRegistry {
+  std::atomic<bool> enabled{false};
+  std::atomic<uint64_t> epoch{0};
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadEvents>> threads;
+};
+
+TraceRegistry& Registry() {
+  // Never destroyed, since threads may still record while the process exits.
+  static TraceRegistry* registry = new TraceRegistry();
+  return *registry;
+}
+
+ThreadEvents* CurrentThreadEvents() {
+  thread_local ThreadEvents* current = nullptr;
+  if (current == nullptr) {
+    TraceRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.emplace_back(jxl::make_unique<ThreadEvents>());
+    current = registry.threads.back().get();
+    current->thread_index = registry.threads.size();
+  }
+  return current;
+}
+
+void AppendEscaped(const char* name, std::string* out) {
+  for (const char* c = name; *c != 0; ++c) {
+    if (*c == '"' || *c == '\\') out->push_back('\\');
+    if (static_cast<unsigned char>(*c) >= 0x20) out->push_back(*c);
+  }
+}
+
+}  // namespace
+
+bool TraceEnabled() {
+  return Registry().enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t TraceNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void TraceRecord(const char* name, int64_t arg, uint64_t start, uint64_t end) {
+  ThreadEvents* thread = CurrentThreadEvents();
+  std::lock_guard<std::mutex> lock(thread->mutex);
+  thread->events.push_back({name, arg, start, end});
+}
+
+std::map<std::string, uint64_t> TraceTotals() {
+  TraceRegistry& registry = Registry();
+  const uint64_t epoch = registry.epoch;
+  std::map<std::string, uint64_t> totals;
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (const auto& thread : registry.threads) {
+    std::lock_guard<std::mutex> thread_lock(thread->mutex);
+    for (const TraceEvent& event : thread->events) {
+      if (event.start < epoch) continue;
+      totals[event.name] += event.end - event.start;
+    }
+  }
+  return totals;
+}
+#endif  // JPEGXL_ENABLE_TRACING
+
+}  // namespace jxl
+
+JXL_BOOL JxlTraceStart(void) {
+#if JPEGXL_ENABLE_TRACING
+  jxl::TraceRegistry& registry = jxl::Registry();
+  {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& thread : registry.threads) {
+      std::lock_guard<std::mutex> thread_lock(thread->mutex);
+      thread->events.clear();
+    }
+  }
+  registry.epoch = jxl::TraceNow();
+  registry.enabled = true;
+  return JXL_TRUE;
+#else
+  return JXL_FALSE;
+#endif
+}
+
+void JxlTraceStop(void) {
+#if JPEGXL_ENABLE_TRACING
+  jxl::Registry().enabled = false;
+#endif
+}
+
+void JxlTraceWriteJSON(JxlTraceWriteFunc write, void* opaque) {
+#if JPEGXL_ENABLE_TRACING
+  jxl::TraceRegistry& registry = jxl::Registry();
+  const uint64_t epoch = registry.epoch;
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (const auto& thread : registry.threads) {
+    std::lock_guard<std::mutex> thread_lock(thread->mutex);
+    for (const jxl::TraceEvent& event : thread->events) {
+      if (event.start < epoch) continue;
+      out += first ? "\n" : ",\n";
+      first = false;
+      out += "{\"name\":\"";
+      jxl::AppendEscaped(event.name, &out);
+      char buffer[160];
+      snprintf(buffer, sizeof(buffer),
+               "\",\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu64
+               ",\"ts\":%.3f,\"dur\":%.3f",
+               static_cast<uint64_t>(thread->thread_index),
+               (event.start - epoch) * 1e-3, (event.end - event.start) * 1e-3);
+      out += buffer;
+      if (event.arg >= 0) {
+        snprintf(buffer, sizeof(buffer), ",\"args\":{\"index\":%" PRId64 "}",
+                 event.arg);
+        out += buffer;
+      }
+      out += "}";
+      if (out.size() >= 1 << 16) {
+        write(opaque, out.data(), out.size());
+        out.clear();
+      }
+    }
+  }
+  out += "\n]}\n";
+  write(opaque, out.data(), out.size());
+#else
+  static const char kEmpty[] = "{\"traceEvents\":[]}\n";
+  write(opaque, kEmpty, sizeof(kEmpty) - 1);
+#endif
+}
@@ -0,0 +1,109 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_TRACE_INTERNAL_H_
+#define LIB_JXL_TRACE_INTERNAL_H_
+
+// Recording of the durations of the stages of the encoder and decoder, see
+// jxl/trace.h. Everything here compiles to nothing unless the library is built
+// with JPEGXL_ENABLE_TRACING.
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "lib/jxl/base/common.h"
+
+#ifndef JPEGXL_ENABLE_TRACING
+#define JPEGXL_ENABLE_TRACING 0
+#endif
+
+namespace jxl {
+
+#if JPEGXL_ENABLE_TRACING
+// Whether JxlTraceStart was called, and not JxlTraceStop since.
+bool TraceEnabled();
+// Monotonic time in nanoseconds.
+uint64_t TraceNow();
+// Records that `name`, which must outlive the trace, ran on the calling thread
+// from `start` to `end`. `arg`, e.g. the index of the group, is omitted if
+// negative.
+void TraceRecord(const char* name, int64_t arg, uint64_t start, uint64_t end);
+// Total durations in nanoseconds of the spans recorded since JxlTraceStart, by
+// name, summed over all threads. Must not be called while recording.
+std::map<std::string, uint64_t> TraceTotals();
+#else
+constexpr bool TraceEnabled() { return false; }
+inline uint64_t TraceNow() { return 0; }
+inline void TraceRecord(const char* /*name*/, int64_t /*arg*/,
+                        uint64_t /*start*/, uint64_t /*end*/) {}
+inline std::map<std::string, uint64_t> TraceTotals() { return {}; }
+#endif
+
+// Records the lifetime of the object as a span named `name`.
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name, int64_t arg = -1)
+      : name_(TraceEnabled() ? name : nullptr),
+        arg_(arg),
+        start_(name_ ? TraceNow() : 0) {}
+  ~TraceScope() {
+    if (name_) TraceRecord(name_, arg_, start_, TraceNow());
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  const char* name_;
+  int64_t arg_;
+  uint64_t start_;
+};
+
+// Accumulates the time spent in each of several stages whose calls are
+// interleaved, e.g. row by row, which would be too many spans to record one by
+// one. Record() then adds one span per stage, laid end to end from the
+// creation of the object.
+class TraceStageTimes {
+ public:
+  explicit TraceStageTimes(size_t num_stages)
+      : start_(TraceEnabled() ? TraceNow() : 0),
+        durations_(TraceEnabled() ? num_stages : 0) {}
+
+  // Call before and after each call of a stage.
+  void Begin() {
+    if (!durations_.empty()) stage_start_ = TraceNow();
+  }
+  void End(size_t stage) {
+    if (!durations_.empty()) durations_[stage] += TraceNow() - stage_start_;
+  }
+
+  // `name(i)` is the name of the i-th stage.
+  template <typename Name>
+  void Record(const Name& name, int64_t arg = -1) const {
+    uint64_t start = start_;
+    for (size_t i = 0; i < durations_.size(); ++i) {
+      if (durations_[i] == 0) continue;
+      TraceRecord(name(i), arg, start, start + durations_[i]);
+      start += durations_[i];
+    }
+  }
+
+ private:
+  uint64_t start_;
+  uint64_t stage_start_ = 0;
+  std::vector<uint64_t> durations_;
+};
+
+}  // namespace jxl
+
+// Records the rest of the enclosing scope as a span named `name`, optionally
+// with an integer argument.
+#define JXL_TRACE_SCOPE(...) \
+  ::jxl::TraceScope JXL_JOIN(trace_scope_, __LINE__)(__VA_ARGS__)
+
+#endif  // LIB_JXL_TRACE_INTERNAL_H_
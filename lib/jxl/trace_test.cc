@@ -0,0 +1,71 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/trace.h>
+#include <jxl/types.h>
+
+#include <cstddef>
+#include <string>
+#include <thread>  // NOLINT
+
+#include "lib/jxl/testing.h"
+#include "lib/jxl/trace_internal.h"
+
+namespace jxl {
+namespace {
+
+std::string WriteJSON() {
+  std::string json;
+  JxlTraceWriteJSON(
+      [](void* opaque, const char* data, size_t size) {
+        static_cast<std::string*>(opaque)->append(data, size);
+      },
+      &json);
+  return json;
+}
+
+TEST(TraceTest, RecordsScopesOfAllThreads) {
+  if (!JxlTraceStart()) {
+    EXPECT_EQ(WriteJSON(), "{\"traceEvents\":[]}\n");
+    GTEST_SKIP() << "Built without JPEGXL_ENABLE_TRACING";
+  }
+  {
+    JXL_TRACE_SCOPE("TraceTestOuter");
+    std::thread thread([] { JXL_TRACE_SCOPE("TraceTestGroup", 3); });
+    thread.join();
+    TraceStageTimes stage_times(2);
+    for (size_t i = 0; i < 2; ++i) {
+      stage_times.Begin();
+      std::this_thread::yield();
+      stage_times.End(i);
+    }
+    const char* names[] = {"TraceTestStage0", "TraceTestStage1"};
+    stage_times.Record([&](size_t i) { return names[i]; });
+  }
+  JxlTraceStop();
+  {
+    // Not recorded after JxlTraceStop.
+    JXL_TRACE_SCOPE("TraceTestStopped");
+  }
+  const std::string json = WriteJSON();
+  EXPECT_NE(json.find("\"name\":\"TraceTestOuter\""), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"TraceTestGroup\""), std::string::npos);
+  EXPECT_NE(json.find("\"args\":{\"index\":3}"), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"TraceTestStage0\""), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"TraceTestStage1\""), std::string::npos);
+  EXPECT_EQ(json.find("TraceTestStopped"), std::string::npos);
+  const auto totals = TraceTotals();
+  EXPECT_EQ(totals.count("TraceTestOuter"), 1);
+  EXPECT_EQ(totals.count("TraceTestGroup"), 1);
+  EXPECT_EQ(totals.count("TraceTestStopped"), 0);
+
+  // Starting again discards the previous trace.
+  ASSERT_TRUE(JxlTraceStart());
+  JxlTraceStop();
+  EXPECT_EQ(WriteJSON().find("TraceTestOuter"), std::string::npos);
+}
+
+}  // namespace
+}  // namespace jxl
@@ -0,0 +1,25 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/types.h>
+#include <jxl/warm_up.h>
+
+#include <hwy/targets.h>
+
+#include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/quant_weights.h"
+
+JXL_BOOL JxlWarmUp(void) {
+  // Done by the first HWY_DYNAMIC_DISPATCH call otherwise.
+  hwy::GetChosenTarget().Update(hwy::SupportedTargets());
+  for (bool is_gray : {false, true}) {
+    (void)jxl::ColorEncoding::SRGB(is_gray);
+    (void)jxl::ColorEncoding::LinearSRGB(is_gray);
+  }
+  // The tables of the library encodings, which are shared by all the frames
+  // that use them.
+  jxl::DequantMatrices matrices;
+  return TO_JXL_BOOL(matrices.EnsureComputed(~0u));
+}
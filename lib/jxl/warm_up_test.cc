@@ -0,0 +1,34 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/types.h>
+#include <jxl/warm_up.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "lib/extras/dec/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace {
+
+TEST(WarmUpTest, DecodesAfterWarmUp) {
+  EXPECT_TRUE(JxlWarmUp());
+  // Repeated calls are cheap and harmless.
+  EXPECT_TRUE(JxlWarmUp());
+  const std::vector<uint8_t> compressed =
+      test::ReadTestData("jxl/spline_on_first_frame.jxl");
+  extras::PackedPixelFile ppf;
+  ASSERT_TRUE(extras::DecodeImageJXL(compressed.data(), compressed.size(),
+                                     extras::JXLDecompressParams(),
+                                     /*decoded_bytes=*/nullptr, &ppf));
+  EXPECT_EQ(ppf.frames.size(), 1u);
+}
+
+}  // namespace
+}  // namespace jxl
@@ -14,6 +14,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <hwy/highway.h>
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
@@ -22,6 +23,9 @@ namespace {
 
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::BitCast;
+using hwy::HWY_NAMESPACE::Or;
+using hwy::HWY_NAMESPACE::Repartition;
 using hwy::HWY_NAMESPACE::ShiftLeft;
 using hwy::HWY_NAMESPACE::ShiftRight;
 using hwy::HWY_NAMESPACE::Xor;
@@ -83,6 +87,38 @@ class Xorshift128Plus {
 #endif
   }
 
+  // Same as Fill followed by reading the bits as 2 * N uint32_t, each turned
+  // into a float in [1, 2) with 23 random mantissa bits, but without the
+  // round trip through memory. `floats` must be aligned.
+  HWY_INLINE HWY_MAYBE_UNUSED void FillFloats(float* HWY_RESTRICT floats) {
+#if HWY_CAP_INTEGER64
+    const HWY_FULL(uint64_t) d;
+    const Repartition<uint32_t, decltype(d)> du;
+    const Repartition<float, decltype(d)> df;
+    const auto one = Set(du, 0x3F800000);
+    for (size_t i = 0; i < N; i += Lanes(d)) {
+      auto s1 = Load(d, s0_ + i);
+      const auto s0 = Load(d, s1_ + i);
+      const auto bits = BitCast(du, Add(s1, s0));
+      Store(s0, d, s0_ + i);
+      s1 = Xor(s1, ShiftLeft<23>(s1));
+      Store(BitCast(df, Or(ShiftRight<9>(bits), one)), df, floats + 2 * i);
+      s1 = Xor(s1, Xor(s0, Xor(ShiftRight<18>(s1), ShiftRight<5>(s0))));
+      Store(s1, d, s1_ + i);
+    }
+#else
+    HWY_ALIGN uint64_t random_bits[N];
+    Fill(random_bits);
+    for (size_t i = 0; i < 2 * N; ++i) {
+      uint32_t bits;
+      memcpy(&bits, reinterpret_cast<const uint32_t*>(random_bits) + i,
+             sizeof(bits));
+      bits = (bits >> 9) | 0x3F800000;
+      memcpy(floats + i, &bits, sizeof(bits));
+    }
+#endif
+  }
+
  private:
   static uint64_t SplitMix64(uint64_t z) {
     z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <cstring>
 #include <vector>
 
 #undef HWY_TARGET_INCLUDE
@@ -330,6 +331,27 @@ void TestFloat() {
                         "TestXorShift"));
 }
 
+// FillFloats matches Fill followed by the conversion of TestFloat.
+void TestFillFloats() {
+  HWY_ALIGN Xorshift128Plus rng(12345);
+  HWY_ALIGN Xorshift128Plus rng_floats(12345);
+  HWY_ALIGN uint64_t batch[Xorshift128Plus::N];
+  HWY_ALIGN float floats[Xorshift128Plus::N * 2];
+  for (size_t reps = 0; reps < 100; ++reps) {
+    rng.Fill(batch);
+    rng_floats.FillFloats(floats);
+    for (size_t i = 0; i < Xorshift128Plus::N * 2; ++i) {
+      uint32_t bits;
+      memcpy(&bits, reinterpret_cast<const uint32_t*>(batch) + i,
+             sizeof(bits));
+      bits = (bits >> 9) | 0x3F800000;
+      uint32_t float_bits;
+      memcpy(&float_bits, floats + i, sizeof(float_bits));
+      ASSERT_EQ(bits, float_bits) << "Where reps=" << reps << " i=" << i;
+    }
+  }
+}
+
 // Not more than one 64-bit zero
 void TestNotZero() {
   test::ThreadPoolForTests pool(8);
@@ -373,6 +395,7 @@ HWY_EXPORT_AND_TEST_P(Xorshift128Test, TestNotZero);
 HWY_EXPORT_AND_TEST_P(Xorshift128Test, TestGolden);
 HWY_EXPORT_AND_TEST_P(Xorshift128Test, TestSeedChanges);
 HWY_EXPORT_AND_TEST_P(Xorshift128Test, TestFloat);
+HWY_EXPORT_AND_TEST_P(Xorshift128Test, TestFillFloats);
 
 }  // namespace jxl
 #endif
@@ -39,6 +39,33 @@ if(benchmark_FOUND)
     jxl_tool
     benchmark::benchmark
   )
+  if(JPEGXL_ENABLE_JPEGLI)
+    target_sources(jxl_gbench PRIVATE "${JPEGXL_INTERNAL_JPEGLI_GBENCH_SOURCES}")
+    target_link_libraries(jxl_gbench jpegli-static)
+  endif()
+
+  # Runs the end-to-end decoding benchmarks and writes their results, including
+  # the MP/s and peak memory counters, to jxl_decode_gbench.json.
+  add_custom_target(jxl_decode_gbench
+    COMMAND jxl_gbench
+      --benchmark_filter=BM_Decode
+      --benchmark_out=${CMAKE_CURRENT_BINARY_DIR}/jxl_decode_gbench.json
+      --benchmark_out_format=json
+    DEPENDS jxl_gbench
+    USES_TERMINAL
+  )
+
+  # Runs the encoder stage benchmarks and writes their results to
+  # jxl_encode_gbench.json. The per-stage counters are only measured when
+  # JPEGXL_ENABLE_TRACING is on.
+  add_custom_target(jxl_encode_gbench
+    COMMAND jxl_gbench
+      --benchmark_filter=BM_EncodeStages
+      --benchmark_out=${CMAKE_CURRENT_BINARY_DIR}/jxl_encode_gbench.json
+      --benchmark_out_format=json
+    DEPENDS jxl_gbench
+    USES_TERMINAL
+  )
 else()
   message(STATUS "benchmark NOT found")
 endif() # benchmark_FOUND
@@ -16,6 +16,7 @@ list(APPEND JPEGXL_EXTRAS_CORE_SOURCES
   "${JPEGXL_INTERNAL_CODEC_JXL_SOURCES}"
   "${JPEGXL_INTERNAL_CODEC_PGX_SOURCES}"
   "${JPEGXL_INTERNAL_CODEC_PNM_SOURCES}"
+  "${JPEGXL_INTERNAL_CODEC_Y4M_SOURCES}"
   "${JPEGXL_INTERNAL_CODEC_NPY_SOURCES}"
   extras/dec/gif.cc
   extras/dec/gif.h
@@ -105,6 +105,11 @@ libjxl_codec_pnm_sources = [
     "extras/enc/pnm.h",
 ]
 
+libjxl_codec_y4m_sources = [
+    "extras/dec/y4m.cc",
+    "extras/dec/y4m.h",
+]
+
 libjxl_dec_box_sources = [
     "jxl/box_content_decoder.cc",
     "jxl/box_content_decoder.h",
@@ -132,6 +137,7 @@ libjxl_dec_sources = [
     "jxl/ans_common.cc",
     "jxl/ans_common.h",
     "jxl/ans_params.h",
+    "jxl/arena_memory_manager.cc",
     "jxl/blending.cc",
     "jxl/blending.h",
     "jxl/chroma_from_luma.cc",
@@ -173,12 +179,16 @@ libjxl_dec_sources = [
     "jxl/dec_group_border.h",
     "jxl/dec_huffman.cc",
     "jxl/dec_huffman.h",
+    "jxl/dec_memory.cc",
+    "jxl/dec_memory.h",
     "jxl/dec_modular.cc",
     "jxl/dec_modular.h",
     "jxl/dec_noise.cc",
     "jxl/dec_noise.h",
     "jxl/dec_patch_dictionary.cc",
     "jxl/dec_patch_dictionary.h",
+    "jxl/dec_stats.cc",
+    "jxl/dec_stats.h",
     "jxl/dec_transforms-inl.h",
     "jxl/dec_xyb-inl.h",
     "jxl/dec_xyb.cc",
@@ -267,10 +277,16 @@ libjxl_dec_sources = [
     "jxl/render_pipeline/stage_from_linear.h",
     "jxl/render_pipeline/stage_gaborish.cc",
     "jxl/render_pipeline/stage_gaborish.h",
+    "jxl/render_pipeline/stage_gain_map.cc",
+    "jxl/render_pipeline/stage_gain_map.h",
+    "jxl/render_pipeline/stage_hook.cc",
+    "jxl/render_pipeline/stage_hook.h",
     "jxl/render_pipeline/stage_noise.cc",
     "jxl/render_pipeline/stage_noise.h",
     "jxl/render_pipeline/stage_patches.cc",
     "jxl/render_pipeline/stage_patches.h",
+    "jxl/render_pipeline/stage_resample.cc",
+    "jxl/render_pipeline/stage_resample.h",
     "jxl/render_pipeline/stage_splines.cc",
     "jxl/render_pipeline/stage_splines.h",
     "jxl/render_pipeline/stage_spot.cc",
@@ -287,6 +303,8 @@ libjxl_dec_sources = [
     "jxl/render_pipeline/stage_xyb.h",
     "jxl/render_pipeline/stage_ycbcr.cc",
     "jxl/render_pipeline/stage_ycbcr.h",
+    "jxl/render_pipeline/stage_ycbcr_planes.cc",
+    "jxl/render_pipeline/stage_ycbcr_planes.h",
     "jxl/simd_util-inl.h",
     "jxl/simd_util.cc",
     "jxl/simd_util.h",
@@ -294,7 +312,10 @@ libjxl_dec_sources = [
     "jxl/splines.h",
     "jxl/toc.cc",
     "jxl/toc.h",
+    "jxl/trace.cc",
+    "jxl/trace_internal.h",
     "jxl/transpose-inl.h",
+    "jxl/warm_up.cc",
     "jxl/xorshift128plus-inl.h",
 ]
 
@@ -324,6 +345,8 @@ libjxl_enc_sources = [
     "jxl/enc_coeff_order.h",
     "jxl/enc_comparator.cc",
     "jxl/enc_comparator.h",
+    "jxl/enc_content_classifier.cc",
+    "jxl/enc_content_classifier.h",
     "jxl/enc_context_map.cc",
     "jxl/enc_context_map.h",
     "jxl/enc_debug_image.cc",
@@ -390,6 +413,8 @@ libjxl_enc_sources = [
     "jxl/jpeg/enc_jpeg_data_reader.h",
     "jxl/jpeg/enc_jpeg_huffman_decode.cc",
     "jxl/jpeg/enc_jpeg_huffman_decode.h",
+    "jxl/jpeg/enc_jpeg_ycbcr.cc",
+    "jxl/jpeg/enc_jpeg_ycbcr.h",
     "jxl/modular/encoding/enc_debug_tree.cc",
     "jxl/modular/encoding/enc_debug_tree.h",
     "jxl/modular/encoding/enc_encoding.cc",
@@ -409,6 +434,8 @@ libjxl_enc_sources = [
 libjxl_extras_for_tools_sources = [
     "extras/codec.cc",
     "extras/codec.h",
+    "extras/codestream_mosaic.cc",
+    "extras/codestream_mosaic.h",
     "extras/hlg.cc",
     "extras/hlg.h",
     "extras/metrics.cc",
@@ -422,6 +449,12 @@ libjxl_extras_for_tools_sources = [
 libjxl_extras_sources = [
     "extras/alpha_blend.cc",
     "extras/alpha_blend.h",
+    "extras/async_input.cc",
+    "extras/async_input.h",
+    "extras/async_output.cc",
+    "extras/async_output.h",
+    "extras/box_rewrite.cc",
+    "extras/box_rewrite.h",
     "extras/common.cc",
     "extras/common.h",
     "extras/compressed_icc.cc",
@@ -435,10 +468,14 @@ libjxl_extras_sources = [
     "extras/enc/encode.h",
     "extras/exif.cc",
     "extras/exif.h",
+    "extras/frame_queue.cc",
+    "extras/frame_queue.h",
     "extras/gain_map.cc",
     "extras/mmap.cc",
     "extras/mmap.h",
     "extras/packed_image.h",
+    "extras/pyramid.cc",
+    "extras/pyramid.h",
     "extras/size_constraints.h",
     "extras/time.cc",
     "extras/time.h",
@@ -446,12 +483,22 @@ libjxl_extras_sources = [
 
 libjxl_gbench_sources = [
     "extras/tone_mapping_gbench.cc",
+    "jxl/dct_gbench.cc",
     "jxl/dec_external_image_gbench.cc",
+    "jxl/decode_gbench.cc",
     "jxl/enc_external_image_gbench.cc",
+    "jxl/enc_fast_lossless_gbench.cc",
+    "jxl/enc_stages_gbench.cc",
+    "jxl/icc_codec_gbench.cc",
+    "jxl/modular_gbench.cc",
     "jxl/splines_gbench.cc",
     "jxl/tf_gbench.cc",
 ]
 
+libjxl_jpegli_gbench_sources = [
+    "jpegli/color_quantize_gbench.cc",
+]
+
 libjxl_jpegli_lib_version = 62
 
 libjxl_jpegli_libjpeg_helper_files = [
@@ -468,6 +515,7 @@ libjxl_jpegli_sources = [
     "jpegli/bitstream.h",
     "jpegli/color_quantize.cc",
     "jpegli/color_quantize.h",
+    "jpegli/color_transform-inl.h",
     "jpegli/color_transform.cc",
     "jpegli/color_transform.h",
     "jpegli/common.cc",
@@ -547,6 +595,7 @@ libjxl_minor_version = 10
 libjxl_patch_version = 2
 
 libjxl_public_headers = [
+    "include/jxl/arena_memory_manager.h",
     "include/jxl/cms.h",
     "include/jxl/cms_interface.h",
     "include/jxl/codestream_header.h",
@@ -560,7 +609,9 @@ libjxl_public_headers = [
     "include/jxl/memory_manager.h",
     "include/jxl/parallel_runner.h",
     "include/jxl/stats.h",
+    "include/jxl/trace.h",
     "include/jxl/types.h",
+    "include/jxl/warm_up.h",
 ]
 
 libjxl_testlib_files = [
@@ -580,16 +631,23 @@ libjxl_testlib_files = [
 ]
 
 libjxl_tests = [
+    "extras/async_input_test.cc",
+    "extras/async_output_test.cc",
+    "extras/box_rewrite_test.cc",
     "extras/codec_test.cc",
+    "extras/codestream_mosaic_test.cc",
     "extras/compressed_icc_test.cc",
     "extras/dec/color_description_test.cc",
     "extras/dec/pgx_test.cc",
+    "extras/dec/y4m_test.cc",
     "extras/gain_map_test.cc",
     "extras/jpegli_test.cc",
+    "extras/pyramid_test.cc",
     "jxl/ac_strategy_test.cc",
     "jxl/alpha_test.cc",
     "jxl/ans_common_test.cc",
     "jxl/ans_test.cc",
+    "jxl/arena_memory_manager_test.cc",
     "jxl/bit_reader_test.cc",
     "jxl/bits_test.cc",
     "jxl/blending_test.cc",
@@ -603,6 +661,7 @@ libjxl_tests = [
     "jxl/convolve_test.cc",
     "jxl/data_parallel_test.cc",
     "jxl/dct_test.cc",
+    "jxl/dec_memory_test.cc",
     "jxl/decode_test.cc",
     "jxl/enc_external_image_test.cc",
     "jxl/enc_gaborish_test.cc",
@@ -637,6 +696,8 @@ libjxl_tests = [
     "jxl/speed_tier_test.cc",
     "jxl/splines_test.cc",
     "jxl/toc_test.cc",
+    "jxl/trace_test.cc",
+    "jxl/warm_up_test.cc",
     "jxl/xorshift128plus_test.cc",
     "threads/thread_parallel_runner_test.cc",
 ]
@@ -644,13 +705,19 @@ libjxl_tests = [
 libjxl_threads_public_headers = [
     "include/jxl/resizable_parallel_runner.h",
     "include/jxl/resizable_parallel_runner_cxx.h",
+    "include/jxl/shared_parallel_runner.h",
+    "include/jxl/shared_parallel_runner_cxx.h",
     "include/jxl/thread_parallel_runner.h",
     "include/jxl/thread_parallel_runner_cxx.h",
+    "include/jxl/work_stealing_parallel_runner.h",
+    "include/jxl/work_stealing_parallel_runner_cxx.h",
 ]
 
 libjxl_threads_sources = [
     "threads/resizable_parallel_runner.cc",
+    "threads/shared_parallel_runner.cc",
     "threads/thread_parallel_runner.cc",
     "threads/thread_parallel_runner_internal.cc",
     "threads/thread_parallel_runner_internal.h",
+    "threads/work_stealing_parallel_runner.cc",
 ]
@@ -102,6 +102,11 @@ set(JPEGXL_INTERNAL_CODEC_PNM_SOURCES
   extras/enc/pnm.h
 )
 
+set(JPEGXL_INTERNAL_CODEC_Y4M_SOURCES
+  extras/dec/y4m.cc
+  extras/dec/y4m.h
+)
+
 set(JPEGXL_INTERNAL_DEC_BOX_SOURCES
   jxl/box_content_decoder.cc
   jxl/box_content_decoder.h
@@ -129,6 +134,7 @@ set(JPEGXL_INTERNAL_DEC_SOURCES
   jxl/ans_common.cc
   jxl/ans_common.h
   jxl/ans_params.h
+  jxl/arena_memory_manager.cc
   jxl/blending.cc
   jxl/blending.h
   jxl/chroma_from_luma.cc
@@ -170,12 +176,16 @@ set(JPEGXL_INTERNAL_DEC_SOURCES
   jxl/dec_group_border.h
   jxl/dec_huffman.cc
   jxl/dec_huffman.h
+  jxl/dec_memory.cc
+  jxl/dec_memory.h
   jxl/dec_modular.cc
   jxl/dec_modular.h
   jxl/dec_noise.cc
   jxl/dec_noise.h
   jxl/dec_patch_dictionary.cc
   jxl/dec_patch_dictionary.h
+  jxl/dec_stats.cc
+  jxl/dec_stats.h
   jxl/dec_transforms-inl.h
   jxl/dec_xyb-inl.h
   jxl/dec_xyb.cc
@@ -264,10 +274,16 @@ set(JPEGXL_INTERNAL_DEC_SOURCES
   jxl/render_pipeline/stage_from_linear.h
   jxl/render_pipeline/stage_gaborish.cc
   jxl/render_pipeline/stage_gaborish.h
+  jxl/render_pipeline/stage_gain_map.cc
+  jxl/render_pipeline/stage_gain_map.h
+  jxl/render_pipeline/stage_hook.cc
+  jxl/render_pipeline/stage_hook.h
   jxl/render_pipeline/stage_noise.cc
   jxl/render_pipeline/stage_noise.h
   jxl/render_pipeline/stage_patches.cc
   jxl/render_pipeline/stage_patches.h
+  jxl/render_pipeline/stage_resample.cc
+  jxl/render_pipeline/stage_resample.h
   jxl/render_pipeline/stage_splines.cc
   jxl/render_pipeline/stage_splines.h
   jxl/render_pipeline/stage_spot.cc
@@ -284,6 +300,8 @@ set(JPEGXL_INTERNAL_DEC_SOURCES
   jxl/render_pipeline/stage_xyb.h
   jxl/render_pipeline/stage_ycbcr.cc
   jxl/render_pipeline/stage_ycbcr.h
+  jxl/render_pipeline/stage_ycbcr_planes.cc
+  jxl/render_pipeline/stage_ycbcr_planes.h
   jxl/simd_util-inl.h
   jxl/simd_util.cc
   jxl/simd_util.h
@@ -291,7 +309,10 @@ set(JPEGXL_INTERNAL_DEC_SOURCES
   jxl/splines.h
   jxl/toc.cc
   jxl/toc.h
+  jxl/trace.cc
+  jxl/trace_internal.h
   jxl/transpose-inl.h
+  jxl/warm_up.cc
   jxl/xorshift128plus-inl.h
 )
 
@@ -321,6 +342,8 @@ set(JPEGXL_INTERNAL_ENC_SOURCES
   jxl/enc_coeff_order.h
   jxl/enc_comparator.cc
   jxl/enc_comparator.h
+  jxl/enc_content_classifier.cc
+  jxl/enc_content_classifier.h
   jxl/enc_context_map.cc
   jxl/enc_context_map.h
   jxl/enc_debug_image.cc
@@ -387,6 +410,8 @@ set(JPEGXL_INTERNAL_ENC_SOURCES
   jxl/jpeg/enc_jpeg_data_reader.h
   jxl/jpeg/enc_jpeg_huffman_decode.cc
   jxl/jpeg/enc_jpeg_huffman_decode.h
+  jxl/jpeg/enc_jpeg_ycbcr.cc
+  jxl/jpeg/enc_jpeg_ycbcr.h
   jxl/modular/encoding/enc_debug_tree.cc
   jxl/modular/encoding/enc_debug_tree.h
   jxl/modular/encoding/enc_encoding.cc
@@ -406,6 +431,8 @@ set(JPEGXL_INTERNAL_ENC_SOURCES
 set(JPEGXL_INTERNAL_EXTRAS_FOR_TOOLS_SOURCES
   extras/codec.cc
   extras/codec.h
+  extras/codestream_mosaic.cc
+  extras/codestream_mosaic.h
   extras/hlg.cc
   extras/hlg.h
   extras/metrics.cc
@@ -419,6 +446,12 @@ set(JPEGXL_INTERNAL_EXTRAS_FOR_TOOLS_SOURCES
 set(JPEGXL_INTERNAL_EXTRAS_SOURCES
   extras/alpha_blend.cc
   extras/alpha_blend.h
+  extras/async_input.cc
+  extras/async_input.h
+  extras/async_output.cc
+  extras/async_output.h
+  extras/box_rewrite.cc
+  extras/box_rewrite.h
   extras/common.cc
   extras/common.h
   extras/compressed_icc.cc
@@ -432,10 +465,14 @@ set(JPEGXL_INTERNAL_EXTRAS_SOURCES
   extras/enc/encode.h
   extras/exif.cc
   extras/exif.h
+  extras/frame_queue.cc
+  extras/frame_queue.h
   extras/gain_map.cc
   extras/mmap.cc
   extras/mmap.h
   extras/packed_image.h
+  extras/pyramid.cc
+  extras/pyramid.h
   extras/size_constraints.h
   extras/time.cc
   extras/time.h
@@ -443,12 +480,22 @@ set(JPEGXL_INTERNAL_EXTRAS_SOURCES
 
 set(JPEGXL_INTERNAL_GBENCH_SOURCES
   extras/tone_mapping_gbench.cc
+  jxl/dct_gbench.cc
   jxl/dec_external_image_gbench.cc
+  jxl/decode_gbench.cc
   jxl/enc_external_image_gbench.cc
+  jxl/enc_fast_lossless_gbench.cc
+  jxl/enc_stages_gbench.cc
+  jxl/icc_codec_gbench.cc
+  jxl/modular_gbench.cc
   jxl/splines_gbench.cc
   jxl/tf_gbench.cc
 )
 
+set(JPEGXL_INTERNAL_JPEGLI_GBENCH_SOURCES
+  jpegli/color_quantize_gbench.cc
+)
+
 set(JPEGXL_INTERNAL_JPEGLI_LIBJPEG_HELPER_FILES
   jpegli/libjpeg_test_util.cc
   jpegli/libjpeg_test_util.h
@@ -463,6 +510,7 @@ set(JPEGXL_INTERNAL_JPEGLI_SOURCES
   jpegli/bitstream.h
   jpegli/color_quantize.cc
   jpegli/color_quantize.h
+  jpegli/color_transform-inl.h
   jpegli/color_transform.cc
   jpegli/color_transform.h
   jpegli/common.cc
@@ -536,6 +584,7 @@ set(JPEGXL_INTERNAL_JPEGLI_WRAPPER_SOURCES
 )
 
 set(JPEGXL_INTERNAL_PUBLIC_HEADERS
+  include/jxl/arena_memory_manager.h
   include/jxl/cms.h
   include/jxl/cms_interface.h
   include/jxl/codestream_header.h
@@ -549,7 +598,9 @@ set(JPEGXL_INTERNAL_PUBLIC_HEADERS
   include/jxl/memory_manager.h
   include/jxl/parallel_runner.h
   include/jxl/stats.h
+  include/jxl/trace.h
   include/jxl/types.h
+  include/jxl/warm_up.h
 )
 
 set(JPEGXL_INTERNAL_TESTLIB_FILES
@@ -569,16 +620,23 @@ set(JPEGXL_INTERNAL_TESTLIB_FILES
 )
 
 set(JPEGXL_INTERNAL_TESTS
+  extras/async_input_test.cc
+  extras/async_output_test.cc
+  extras/box_rewrite_test.cc
   extras/codec_test.cc
+  extras/codestream_mosaic_test.cc
   extras/compressed_icc_test.cc
   extras/dec/color_description_test.cc
   extras/dec/pgx_test.cc
+  extras/dec/y4m_test.cc
   extras/gain_map_test.cc
   extras/jpegli_test.cc
+  extras/pyramid_test.cc
   jxl/ac_strategy_test.cc
   jxl/alpha_test.cc
   jxl/ans_common_test.cc
   jxl/ans_test.cc
+  jxl/arena_memory_manager_test.cc
   jxl/bit_reader_test.cc
   jxl/bits_test.cc
   jxl/blending_test.cc
@@ -592,6 +650,7 @@ set(JPEGXL_INTERNAL_TESTS
   jxl/convolve_test.cc
   jxl/data_parallel_test.cc
   jxl/dct_test.cc
+  jxl/dec_memory_test.cc
   jxl/decode_test.cc
   jxl/enc_external_image_test.cc
   jxl/enc_gaborish_test.cc
@@ -626,6 +685,8 @@ set(JPEGXL_INTERNAL_TESTS
   jxl/speed_tier_test.cc
   jxl/splines_test.cc
   jxl/toc_test.cc
+  jxl/trace_test.cc
+  jxl/warm_up_test.cc
   jxl/xorshift128plus_test.cc
   threads/thread_parallel_runner_test.cc
 )
@@ -633,13 +694,19 @@ set(JPEGXL_INTERNAL_TESTS
 set(JPEGXL_INTERNAL_THREADS_PUBLIC_HEADERS
   include/jxl/resizable_parallel_runner.h
   include/jxl/resizable_parallel_runner_cxx.h
+  include/jxl/shared_parallel_runner.h
+  include/jxl/shared_parallel_runner_cxx.h
   include/jxl/thread_parallel_runner.h
   include/jxl/thread_parallel_runner_cxx.h
+  include/jxl/work_stealing_parallel_runner.h
+  include/jxl/work_stealing_parallel_runner_cxx.h
 )
 
 set(JPEGXL_INTERNAL_THREADS_SOURCES
   threads/resizable_parallel_runner.cc
+  threads/shared_parallel_runner.cc
   threads/thread_parallel_runner.cc
   threads/thread_parallel_runner_internal.cc
   threads/thread_parallel_runner_internal.h
+  threads/work_stealing_parallel_runner.cc
 )
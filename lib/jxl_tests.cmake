@@ -29,6 +29,7 @@ endif()
 list(APPEND JPEGXL_INTERNAL_TESTS
   # TODO(deymo): Move this to tools/
   ../tools/djxl_fuzzer_test.cc
+  ../tools/djxl_slow_fuzzer_test.cc
   ../tools/gauss_blur_test.cc
 )
 
@@ -61,6 +62,8 @@ foreach (TESTFILE IN LISTS JPEGXL_INTERNAL_TESTS)
   get_filename_component(TESTNAME ${TESTFILE} NAME_WE)
   if(TESTFILE STREQUAL ../tools/djxl_fuzzer_test.cc)
     add_executable(${TESTNAME} ${TESTFILE} ../tools/djxl_fuzzer.cc)
+  elseif(TESTFILE STREQUAL ../tools/djxl_slow_fuzzer_test.cc)
+    add_executable(${TESTNAME} ${TESTFILE} ../tools/djxl_slow_fuzzer.cc)
   else()
     add_executable(${TESTNAME} ${TESTFILE})
   endif()
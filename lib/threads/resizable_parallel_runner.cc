@@ -193,8 +193,10 @@ JXL_THREADS_EXPORT void JxlResizableParallelRunnerDestroy(void* runner_opaque) {
 
 JXL_THREADS_EXPORT uint32_t
 JxlResizableParallelRunnerSuggestThreads(uint64_t xsize, uint64_t ysize) {
-  // ~one thread per group.
-  return std::min<uint64_t>(std::thread::hardware_concurrency(),
-                            xsize * ysize / (256 * 256));
+  // ~one thread per group, counting the partial groups at the borders, since
+  // these are the tasks of the per-group passes. Run() additionally wakes no
+  // more workers than there are tasks in each call.
+  const uint64_t num_groups = ((xsize + 255) / 256) * ((ysize + 255) / 256);
+  return std::min<uint64_t>(std::thread::hardware_concurrency(), num_groups);
 }
 }
@@ -0,0 +1,238 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/jxl_threads_export.h>
+#include <jxl/memory_manager.h>
+#include <jxl/parallel_runner.h>
+#include <jxl/shared_parallel_runner.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jpegxl {
+namespace {
+
+// A set of worker threads that executes the tasks of the calls of all the
+// runners attached to it.
+class SharedThreadPool {
+ public:
+  explicit SharedThreadPool(size_t num_worker_threads)
+      : num_workers_(num_worker_threads) {
+    workers_.reserve(num_workers_);
+    for (size_t i = 0; i < num_workers_; ++i) {
+      workers_.emplace_back([this, i]() { WorkerBody(i); });
+    }
+  }
+
+  ~SharedThreadPool() {
+    {
+      std::unique_lock<std::mutex> l(mutex_);
+      quit_ = true;
+      work_available_.notify_all();
+    }
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  SharedThreadPool(const SharedThreadPool&) = delete;
+  SharedThreadPool& operator=(const SharedThreadPool&) = delete;
+
+  JxlParallelRetCode Run(int32_t priority, void* jxl_opaque,
+                         JxlParallelRunInit init, JxlParallelRunFunction func,
+                         uint32_t start, uint32_t end) {
+    if (start >= end) return 0;
+    if (num_workers_ == 0 || start + 1 == end) {
+      JxlParallelRetCode ret = init(jxl_opaque, 1);
+      if (ret != 0) return ret;
+      for (uint32_t task = start; task < end; ++task) {
+        func(jxl_opaque, task, 0);
+      }
+      return 0;
+    }
+
+    // Workers use their index as thread id, the caller uses num_workers_.
+    JxlParallelRetCode ret = init(jxl_opaque, num_workers_ + 1);
+    if (ret != 0) return ret;
+
+    Job job;
+    job.func = func;
+    job.opaque = jxl_opaque;
+    job.next_task.store(start);
+    job.end_task = end;
+    job.pending.store(end - start);
+    job.priority = priority;
+    {
+      std::unique_lock<std::mutex> l(mutex_);
+      job.sequence = next_sequence_++;
+      jobs_.push_back(&job);
+      // Make busy workers reconsider which job they work on.
+      epoch_++;
+      work_available_.notify_all();
+    }
+
+    RunTasks(&job, num_workers_, /*preemptible=*/false);
+
+    std::unique_lock<std::mutex> l(mutex_);
+    RemoveJob(&job);
+    while (job.pending.load() != 0 || job.num_workers != 0) {
+      job_done_.wait(l);
+    }
+    return 0;
+  }
+
+ private:
+  struct Job {
+    JxlParallelRunFunction func;
+    void* opaque;
+    std::atomic<uint32_t> next_task;
+    uint32_t end_task;
+    // Number of tasks that are not yet finished.
+    std::atomic<uint32_t> pending;
+    int32_t priority;
+    uint64_t sequence;
+    // Number of workers executing tasks of this job, protected by mutex_.
+    size_t num_workers = 0;
+  };
+
+  void WorkerBody(size_t worker_id) {
+    std::unique_lock<std::mutex> l(mutex_);
+    while (!quit_) {
+      Job* job = SelectJob();
+      if (job == nullptr) {
+        work_available_.wait(l);
+        continue;
+      }
+      job->num_workers++;
+      l.unlock();
+      RunTasks(job, worker_id, /*preemptible=*/true);
+      l.lock();
+      job->num_workers--;
+      if (job->num_workers == 0 && job->pending.load() == 0) {
+        job_done_.notify_all();
+      }
+    }
+  }
+
+  // Executes tasks of `job` until there are none left to start or, if
+  // `preemptible`, until a new job is submitted.
+  void RunTasks(Job* job, size_t thread_id, bool preemptible) {
+    uint64_t epoch = epoch_.load();
+    while (!preemptible || epoch_.load(std::memory_order_relaxed) == epoch) {
+      uint32_t task = job->next_task.fetch_add(1);
+      if (task >= job->end_task) return;
+      job->func(job->opaque, task, thread_id);
+      if (job->pending.fetch_sub(1) == 1) {
+        std::unique_lock<std::mutex> l(mutex_);
+        job_done_.notify_all();
+      }
+    }
+  }
+
+  // Returns the job with the highest priority that still has tasks to start,
+  // preferring the ones with fewer workers, then the oldest. Must be called
+  // with mutex_ held.
+  Job* SelectJob() {
+    Job* best = nullptr;
+    for (size_t i = 0; i < jobs_.size();) {
+      Job* job = jobs_[i];
+      if (job->next_task.load() >= job->end_task) {
+        jobs_[i] = jobs_.back();
+        jobs_.pop_back();
+        continue;
+      }
+      if (best == nullptr || job->priority > best->priority ||
+          (job->priority == best->priority &&
+           (job->num_workers < best->num_workers ||
+            (job->num_workers == best->num_workers &&
+             job->sequence < best->sequence)))) {
+        best = job;
+      }
+      ++i;
+    }
+    return best;
+  }
+
+  // Must be called with mutex_ held.
+  void RemoveJob(Job* job) {
+    auto it = std::find(jobs_.begin(), jobs_.end(), job);
+    if (it != jobs_.end()) jobs_.erase(it);
+  }
+
+  const size_t num_workers_;
+  std::vector<std::thread> workers_;
+
+  // Protects all the remaining variables and the num_workers field of jobs.
+  std::mutex mutex_;
+  // Signaled when a job is submitted or the pool is being destroyed.
+  std::condition_variable work_available_;
+  // Signaled when a job may have completed.
+  std::condition_variable job_done_;
+  // Jobs that may still have tasks to start.
+  std::vector<Job*> jobs_;
+  uint64_t next_sequence_ = 0;
+  // Incremented whenever a job is submitted; written with mutex_ held, but
+  // read without it by the workers to check for preemption.
+  std::atomic<uint64_t> epoch_{0};
+  bool quit_ = false;
+};
+
+struct SharedParallelRunner {
+  SharedThreadPool* pool;
+  std::atomic<int32_t> priority;
+};
+
+}  // namespace
+}  // namespace jpegxl
+
+extern "C" {
+JXL_THREADS_EXPORT void* JxlSharedThreadPoolCreate(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads) {
+  return new jpegxl::SharedThreadPool(num_worker_threads);
+}
+
+JXL_THREADS_EXPORT void JxlSharedThreadPoolDestroy(void* pool) {
+  delete static_cast<jpegxl::SharedThreadPool*>(pool);
+}
+
+JXL_THREADS_EXPORT void* JxlSharedThreadPoolGetDefault() {
+  // Never destroyed, so that it can be used until the process exits.
+  static jpegxl::SharedThreadPool* pool =
+      new jpegxl::SharedThreadPool(std::thread::hardware_concurrency());
+  return pool;
+}
+
+JXL_THREADS_EXPORT JxlParallelRetCode JxlSharedParallelRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
+  auto* runner = static_cast<jpegxl::SharedParallelRunner*>(runner_opaque);
+  return runner->pool->Run(runner->priority.load(), jpegxl_opaque, init, func,
+                           start_range, end_range);
+}
+
+JXL_THREADS_EXPORT void* JxlSharedParallelRunnerCreate(void* pool,
+                                                       int32_t priority) {
+  auto* runner = new jpegxl::SharedParallelRunner();
+  runner->pool = static_cast<jpegxl::SharedThreadPool*>(pool);
+  runner->priority.store(priority);
+  return runner;
+}
+
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerSetPriority(void* runner_opaque,
+                                                           int32_t priority) {
+  static_cast<jpegxl::SharedParallelRunner*>(runner_opaque)
+      ->priority.store(priority);
+}
+
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerDestroy(void* runner_opaque) {
+  delete static_cast<jpegxl::SharedParallelRunner*>(runner_opaque);
+}
+}
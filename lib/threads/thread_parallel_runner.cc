@@ -6,11 +6,14 @@
 #include <jxl/memory_manager.h>
 #include <jxl/parallel_runner.h>
 #include <jxl/thread_parallel_runner.h>
+#include <jxl/types.h>
 #include <string.h>
 
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <thread>
+#include <vector>
 
 #include "lib/threads/thread_parallel_runner_internal.h"
 
@@ -62,6 +65,48 @@ void ThreadMemoryManagerFree(const JxlMemoryManager* memory_manager,
   memory_manager->free(memory_manager->opaque, address);
 }
 
+// Parses a Linux cpulist such as "0-3,8,10-11". Returns false on errors.
+bool ParseCpuList(const char* list, std::vector<uint32_t>* cpus) {
+  const char* pos = list;
+  for (;;) {
+    char* end;
+    const unsigned long first = strtoul(pos, &end, 10);  // NOLINT
+    if (end == pos) return false;
+    unsigned long last = first;  // NOLINT
+    pos = end;
+    if (*pos == '-') {
+      ++pos;
+      last = strtoul(pos, &end, 10);
+      if (end == pos || last < first) return false;
+      pos = end;
+    }
+    for (unsigned long cpu = first; cpu <= last; ++cpu) {  // NOLINT
+      cpus->push_back(static_cast<uint32_t>(cpu));
+    }
+    if (*pos != ',') break;
+    ++pos;
+  }
+  return *pos == '\0' || *pos == '\n';
+}
+
+// CPUs of a NUMA node, empty if the node does not exist or on platforms
+// without /sys.
+std::vector<uint32_t> NodeCpus(uint32_t node) {
+  std::vector<uint32_t> cpus;
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist",
+           node);
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) return cpus;
+  char list[4096];
+  if (fgets(list, sizeof(list), file) == nullptr ||
+      !ParseCpuList(list, &cpus)) {
+    cpus.clear();
+  }
+  fclose(file);
+  return cpus;
+}
+
 }  // namespace
 
 JxlParallelRetCode JxlThreadParallelRunner(
@@ -102,6 +147,31 @@ void JxlThreadParallelRunnerDestroy(void* runner_opaque) {
   }
 }
 
+JXL_BOOL JxlThreadParallelRunnerSetAffinity(void* runner_opaque,
+                                            const uint32_t* cpus,
+                                            size_t num_cpus) {
+  jpegxl::ThreadParallelRunner* runner =
+      reinterpret_cast<jpegxl::ThreadParallelRunner*>(runner_opaque);
+  if (!runner || !cpus || num_cpus == 0) return JXL_FALSE;
+  std::vector<std::vector<uint32_t>> cpu_sets;
+  for (size_t i = 0; i < num_cpus; ++i) cpu_sets.push_back({cpus[i]});
+  return TO_JXL_BOOL(runner->SetAffinity(cpu_sets));
+}
+
+JXL_BOOL JxlThreadParallelRunnerSetNodeAffinity(void* runner_opaque,
+                                                const uint32_t* nodes,
+                                                size_t num_nodes) {
+  jpegxl::ThreadParallelRunner* runner =
+      reinterpret_cast<jpegxl::ThreadParallelRunner*>(runner_opaque);
+  if (!runner || !nodes || num_nodes == 0) return JXL_FALSE;
+  std::vector<std::vector<uint32_t>> cpu_sets;
+  for (size_t i = 0; i < num_nodes; ++i) {
+    cpu_sets.push_back(NodeCpus(nodes[i]));
+    if (cpu_sets.back().empty()) return JXL_FALSE;
+  }
+  return TO_JXL_BOOL(runner->SetAffinity(cpu_sets));
+}
+
 // Get default value for num_worker_threads parameter of
 // InitJxlThreadParallelRunner.
 size_t JxlThreadParallelRunnerDefaultNumWorkerThreads() {
@@ -14,6 +14,11 @@
 #include <cstdint>
 #include <mutex>
 #include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 #include "lib/jxl/base/compiler_specific.h"
 
@@ -32,8 +37,8 @@ JxlParallelRetCode ThreadParallelRunner::Runner(
   if (ret != JXL_PARALLEL_RET_SUCCESS) return ret;
 
   // Use a sequential run when num_worker_threads_ is zero since we have no
-  // worker threads.
-  if (self->num_worker_threads_ == 0) {
+  // worker threads, and for a single task, which is not worth waking them up.
+  if (self->num_worker_threads_ == 0 || end_range - start_range == 1) {
     const size_t thread = 0;
     for (uint32_t task = start_range; task < end_range; ++task) {
       func(jpegxl_opaque, task, thread);
@@ -161,6 +166,38 @@ ThreadParallelRunner::ThreadParallelRunner(const int num_worker_threads)
   }
 }
 
+bool ThreadParallelRunner::SetAffinity(
+    const std::vector<std::vector<uint32_t>>& cpu_sets) {
+#if defined(__linux__)
+  if (cpu_sets.empty()) return false;
+  for (const std::vector<uint32_t>& cpus : cpu_sets) {
+    if (cpus.empty()) return false;
+    for (uint32_t cpu : cpus) {
+      if (cpu >= CPU_SETSIZE) return false;
+    }
+  }
+  // With zero workers, the tasks run on the calling thread, which is not ours
+  // to pin.
+  if (num_worker_threads_ == 0) return true;
+  std::atomic<bool> ok{true};
+  // Each worker pins itself, so that this does not depend on pthreads.
+  const auto pin = [&](const uint32_t /* task */, const size_t thread) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t cpu : cpu_sets[thread % cpu_sets.size()]) {
+      CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      ok.store(false, std::memory_order_relaxed);
+    }
+  };
+  RunOnEachThread(pin);
+  return ok.load(std::memory_order_relaxed);
+#else
+  return false;
+#endif
+}
+
 ThreadParallelRunner::~ThreadParallelRunner() {
   if (num_worker_threads_ != 0) {
     StartWorkers(kWorkerExit);
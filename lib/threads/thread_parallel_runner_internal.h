@@ -85,6 +85,11 @@ class ThreadParallelRunner {
     WorkersReadyBarrier();
   }
 
+  // Restricts worker thread i to the CPUs of cpu_sets[i % cpu_sets.size()].
+  // Returns false if not supported on this platform or rejected by the OS.
+  // Must not be called during Runner().
+  bool SetAffinity(const std::vector<std::vector<uint32_t>>& cpu_sets);
+
   JxlMemoryManager memory_manager;
 
  private:
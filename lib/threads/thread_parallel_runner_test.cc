@@ -3,11 +3,23 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#include <jxl/shared_parallel_runner.h>
+#include <jxl/shared_parallel_runner_cxx.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+#include <jxl/work_stealing_parallel_runner.h>
+#include <jxl/work_stealing_parallel_runner_cxx.h>
+
 #include <algorithm>
 #include <atomic>
 #include <cstdint>
+#include <thread>
 #include <vector>
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/test_utils.h"
@@ -125,5 +137,171 @@ TEST(ThreadParallelRunnerTest, TestCounter) {
   EXPECT_EQ(expected, counters[0].counter);
 }
 
+TEST(ThreadParallelRunnerTest, TestAffinity) {
+  auto runner = JxlThreadParallelRunnerMake(nullptr, 4);
+  uint32_t no_cpus = 0;
+  EXPECT_FALSE(JxlThreadParallelRunnerSetAffinity(runner.get(), &no_cpus, 0));
+#if defined(__linux__)
+  // Any CPU this process may run on.
+  cpu_set_t allowed;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+  uint32_t cpu = 0;
+  while (!CPU_ISSET(cpu, &allowed)) ++cpu;
+  ASSERT_TRUE(JxlThreadParallelRunnerSetAffinity(runner.get(), &cpu, 1));
+  jxl::ThreadPool pool(JxlThreadParallelRunner, runner.get());
+  std::atomic<int> num_elsewhere{0};
+  const auto check_cpu = [&](const uint32_t /* task */,
+                             size_t /* thread */) -> jxl::Status {
+    if (sched_getcpu() != static_cast<int>(cpu)) num_elsewhere++;
+    return true;
+  };
+  EXPECT_TRUE(RunOnPool(&pool, 0, 64, jxl::ThreadPool::NoInit, check_cpu,
+                        "TestAffinity"));
+  EXPECT_EQ(0, num_elsewhere.load());
+#else
+  EXPECT_FALSE(JxlThreadParallelRunnerSetAffinity(runner.get(), &no_cpus, 1));
+#endif
+}
+
+TEST(WorkStealingParallelRunnerTest, TestPool) {
+  for (int num_threads = 0; num_threads <= 8; ++num_threads) {
+    JxlWorkStealingParallelRunnerPtr runner =
+        JxlWorkStealingParallelRunnerMake(nullptr, num_threads);
+    jxl::ThreadPool pool(JxlWorkStealingParallelRunner, runner.get());
+    for (int num_tasks = 0; num_tasks < 40; ++num_tasks) {
+      std::vector<std::atomic<int>> visited(num_tasks);
+      for (auto& v : visited) v = 0;
+      size_t num_init_threads = 0;
+      const auto init = [&num_init_threads](size_t num) -> jxl::Status {
+        num_init_threads = num;
+        return true;
+      };
+      const auto do_task = [&](const int task,
+                               const int thread) -> jxl::Status {
+        EXPECT_GE(task, 7);
+        EXPECT_LT(task, 7 + num_tasks);
+        EXPECT_LT(static_cast<size_t>(thread), num_init_threads);
+        visited[task - 7]++;
+        return true;
+      };
+      EXPECT_TRUE(
+          RunOnPool(&pool, 7, 7 + num_tasks, init, do_task, "TestPool"));
+      for (const auto& v : visited) EXPECT_EQ(1, v.load());
+    }
+  }
+}
+
+// Tasks may run the pool again, and several threads may share it.
+TEST(WorkStealingParallelRunnerTest, TestNestedAndConcurrent) {
+  JxlWorkStealingParallelRunnerPtr runner =
+      JxlWorkStealingParallelRunnerMake(nullptr, 6);
+  jxl::ThreadPool pool(JxlWorkStealingParallelRunner, runner.get());
+  const uint32_t kOuter = 13;
+  const uint32_t kInner = 57;
+
+  const auto run_nested = [&](std::atomic<uint64_t>* total) {
+    std::vector<uint64_t> outer_sums(kOuter);
+    const auto outer = [&](const uint32_t i, size_t thread) -> jxl::Status {
+      std::vector<uint64_t> per_thread;
+      const auto init = [&per_thread](size_t num) -> jxl::Status {
+        per_thread.assign(num, 0);
+        return true;
+      };
+      const auto inner = [&](const uint32_t j, size_t thread) -> jxl::Status {
+        EXPECT_LT(thread, per_thread.size());
+        per_thread[thread] += i * kInner + j;
+        return true;
+      };
+      JXL_RETURN_IF_ERROR(RunOnPool(&pool, 0, kInner, init, inner, "Inner"));
+      for (uint64_t sum : per_thread) outer_sums[i] += sum;
+      return true;
+    };
+    EXPECT_TRUE(RunOnPool(&pool, 0, kOuter, jxl::ThreadPool::NoInit, outer,
+                          "Outer"));
+    for (uint64_t sum : outer_sums) *total += sum;
+  };
+
+  const uint64_t n = kOuter * kInner;
+  const uint64_t expected = n * (n - 1) / 2;
+  for (int iter = 0; iter < 10; ++iter) {
+    std::atomic<uint64_t> totals[3] = {{0}, {0}, {0}};
+    std::thread t1(run_nested, &totals[1]);
+    std::thread t2(run_nested, &totals[2]);
+    run_nested(&totals[0]);
+    t1.join();
+    t2.join();
+    for (const auto& total : totals) EXPECT_EQ(expected, total.load());
+  }
+}
+
+// Several runners with different priorities share the threads of one pool,
+// with concurrent and nested calls.
+TEST(SharedParallelRunnerTest, TestConcurrentRunners) {
+  for (size_t num_threads : {0, 1, 5}) {
+    JxlSharedThreadPoolPtr shared =
+        JxlSharedThreadPoolMake(nullptr, num_threads);
+    const uint32_t kOuter = 11;
+    const uint32_t kInner = 37;
+
+    const auto run_nested = [&](int32_t priority,
+                                std::atomic<uint64_t>* total) {
+      JxlSharedParallelRunnerPtr runner =
+          JxlSharedParallelRunnerMake(shared.get(), priority);
+      jxl::ThreadPool pool(JxlSharedParallelRunner, runner.get());
+      std::vector<uint64_t> outer_sums(kOuter);
+      const auto outer = [&](const uint32_t i, size_t thread) -> jxl::Status {
+        std::vector<uint64_t> per_thread;
+        const auto init = [&per_thread](size_t num) -> jxl::Status {
+          per_thread.assign(num, 0);
+          return true;
+        };
+        const auto inner = [&](const uint32_t j,
+                               size_t thread) -> jxl::Status {
+          EXPECT_LT(thread, per_thread.size());
+          per_thread[thread] += i * kInner + j;
+          return true;
+        };
+        JXL_RETURN_IF_ERROR(
+            RunOnPool(&pool, 0, kInner, init, inner, "Inner"));
+        for (uint64_t sum : per_thread) outer_sums[i] += sum;
+        return true;
+      };
+      EXPECT_TRUE(RunOnPool(&pool, 0, kOuter, jxl::ThreadPool::NoInit, outer,
+                            "Outer"));
+      for (uint64_t sum : outer_sums) *total += sum;
+    };
+
+    const uint64_t n = kOuter * kInner;
+    const uint64_t expected = n * (n - 1) / 2;
+    for (int iter = 0; iter < 5; ++iter) {
+      std::atomic<uint64_t> totals[3] = {{0}, {0}, {0}};
+      std::thread t1(run_nested, 1, &totals[1]);
+      std::thread t2(run_nested, -1, &totals[2]);
+      run_nested(0, &totals[0]);
+      t1.join();
+      t2.join();
+      for (const auto& total : totals) EXPECT_EQ(expected, total.load());
+    }
+  }
+}
+
+TEST(SharedParallelRunnerTest, TestDefaultPool) {
+  JxlSharedParallelRunnerPtr runner =
+      JxlSharedParallelRunnerMake(JxlSharedThreadPoolGetDefault(), 0);
+  jxl::ThreadPool pool(JxlSharedParallelRunner, runner.get());
+  std::vector<std::atomic<int>> visited(100);
+  for (auto& v : visited) v = 0;
+  const auto do_task = [&](const uint32_t task, size_t thread) -> jxl::Status {
+    visited[task]++;
+    return true;
+  };
+  EXPECT_TRUE(RunOnPool(&pool, 0, visited.size(), jxl::ThreadPool::NoInit,
+                        do_task, "TestDefaultPool"));
+  JxlSharedParallelRunnerSetPriority(runner.get(), 3);
+  EXPECT_TRUE(RunOnPool(&pool, 0, visited.size(), jxl::ThreadPool::NoInit,
+                        do_task, "TestDefaultPool"));
+  for (const auto& v : visited) EXPECT_EQ(2, v.load());
+}
+
 }  // namespace
 }  // namespace jpegxl
@@ -0,0 +1,283 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/jxl_threads_export.h>
+#include <jxl/memory_manager.h>
+#include <jxl/parallel_runner.h>
+#include <jxl/work_stealing_parallel_runner.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jpegxl {
+namespace {
+
+// A thread pool where each thread owns a deque of task ranges. The owner
+// splits ranges from the back of its deque, while other threads steal from
+// the front, where the largest ranges are. Calls to Run() may be nested and
+// concurrent: the calling thread participates in the execution of its own call
+// until it completes.
+class WorkStealingParallelRunner {
+ public:
+  explicit WorkStealingParallelRunner(size_t num_worker_threads)
+      : num_workers_(num_worker_threads),
+        // One deque per worker, plus one shared by all external callers.
+        queues_(num_worker_threads + 1) {
+    workers_.reserve(num_workers_);
+    for (size_t i = 0; i < num_workers_; ++i) {
+      workers_.emplace_back([this, i]() { WorkerBody(i); });
+    }
+  }
+
+  ~WorkStealingParallelRunner() {
+    {
+      std::unique_lock<std::mutex> l(mutex_);
+      quit_ = true;
+      epoch_++;
+      wakeup_.notify_all();
+    }
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  WorkStealingParallelRunner(const WorkStealingParallelRunner&) = delete;
+  WorkStealingParallelRunner& operator=(const WorkStealingParallelRunner&) =
+      delete;
+
+  JxlParallelRetCode Run(void* jxl_opaque, JxlParallelRunInit init,
+                         JxlParallelRunFunction func, uint32_t start,
+                         uint32_t end) {
+    if (start >= end) return 0;
+    if (num_workers_ == 0 || start + 1 == end) {
+      JxlParallelRetCode ret = init(jxl_opaque, 1);
+      if (ret != 0) return ret;
+      for (uint32_t task = start; task < end; ++task) {
+        func(jxl_opaque, task, 0);
+      }
+      return 0;
+    }
+
+    // Workers use their own index as thread id; external callers use
+    // num_workers_, which is safe since they only execute tasks of their own
+    // call.
+    JxlParallelRetCode ret = init(jxl_opaque, num_workers_ + 1);
+    if (ret != 0) return ret;
+
+    size_t queue = num_workers_;
+    if (current_runner_ == this) queue = current_worker_;
+
+    Job job;
+    job.func = func;
+    job.opaque = jxl_opaque;
+    job.pending.store(end - start);
+    Push(queue, Range{&job, start, end});
+
+    while (job.pending.load() != 0) {
+      Range range;
+      if (FindWork(queue, &job, &range)) {
+        Execute(queue, range);
+        continue;
+      }
+      uint64_t epoch = PrepareToSleep();
+      if (job.pending.load() == 0 || FindWork(queue, &job, &range)) {
+        num_sleeping_--;
+        if (job.pending.load() != 0) Execute(queue, range);
+        continue;
+      }
+      Sleep(epoch);
+    }
+    return 0;
+  }
+
+ private:
+  struct Job {
+    JxlParallelRunFunction func;
+    void* opaque;
+    // Number of tasks that are not yet finished.
+    std::atomic<uint32_t> pending;
+  };
+
+  struct Range {
+    Job* job;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Range> ranges;
+  };
+
+  void WorkerBody(size_t worker_id) {
+    current_runner_ = this;
+    current_worker_ = worker_id;
+    while (true) {
+      Range range;
+      if (FindWork(worker_id, /*job=*/nullptr, &range)) {
+        Execute(worker_id, range);
+        continue;
+      }
+      uint64_t epoch = PrepareToSleep();
+      if (FindWork(worker_id, /*job=*/nullptr, &range)) {
+        num_sleeping_--;
+        Execute(worker_id, range);
+        continue;
+      }
+      if (!Sleep(epoch)) return;
+    }
+  }
+
+  // Executes the first task of `range`, after making the rest of it available
+  // to other threads by splitting it in halves.
+  void Execute(size_t queue, Range range) {
+    while (range.end - range.begin > 1) {
+      uint32_t mid = range.begin + (range.end - range.begin) / 2;
+      Push(queue, Range{range.job, mid, range.end});
+      range.end = mid;
+    }
+    Job* job = range.job;
+    job->func(job->opaque, range.begin, queue);
+    if (job->pending.fetch_sub(1) == 1) {
+      // `job` may be destroyed as soon as its caller sees no pending tasks.
+      WakeUp();
+    }
+  }
+
+  void Push(size_t queue, const Range& range) {
+    {
+      std::unique_lock<std::mutex> l(queues_[queue].mutex);
+      queues_[queue].ranges.push_back(range);
+    }
+    if (num_sleeping_.load() != 0) WakeUp();
+  }
+
+  // Looks for a range to execute, first at the back of the given queue and
+  // then at the front of the other queues. If `job` is not null, only ranges
+  // of that job are considered.
+  bool FindWork(size_t queue, const Job* job, Range* range) {
+    if (TakeFrom(queue, job, /*from_back=*/true, range)) return true;
+    for (size_t i = 1; i < queues_.size(); ++i) {
+      size_t victim = (queue + i) % queues_.size();
+      if (TakeFrom(victim, job, /*from_back=*/false, range)) return true;
+    }
+    return false;
+  }
+
+  bool TakeFrom(size_t queue, const Job* job, bool from_back, Range* range) {
+    std::unique_lock<std::mutex> l(queues_[queue].mutex);
+    std::deque<Range>& ranges = queues_[queue].ranges;
+    if (ranges.empty()) return false;
+    if (job == nullptr) {
+      if (from_back) {
+        *range = ranges.back();
+        ranges.pop_back();
+      } else {
+        *range = ranges.front();
+        ranges.pop_front();
+      }
+      return true;
+    }
+    if (from_back) {
+      for (size_t i = ranges.size(); i > 0; --i) {
+        if (ranges[i - 1].job == job) {
+          *range = ranges[i - 1];
+          ranges.erase(ranges.begin() + (i - 1));
+          return true;
+        }
+      }
+    } else {
+      for (size_t i = 0; i < ranges.size(); ++i) {
+        if (ranges[i].job == job) {
+          *range = ranges[i];
+          ranges.erase(ranges.begin() + i);
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Registers the calling thread as sleeping. The caller must look for work
+  // once more before calling Sleep() with the returned epoch, so that work
+  // pushed concurrently is never missed.
+  uint64_t PrepareToSleep() {
+    std::unique_lock<std::mutex> l(mutex_);
+    num_sleeping_++;
+    return epoch_;
+  }
+
+  // Waits until WakeUp() is called after PrepareToSleep() returned `epoch`.
+  // Returns false if the runner is being destroyed.
+  bool Sleep(uint64_t epoch) {
+    std::unique_lock<std::mutex> l(mutex_);
+    while (epoch_ == epoch && !quit_) {
+      wakeup_.wait(l);
+    }
+    num_sleeping_--;
+    return !quit_;
+  }
+
+  void WakeUp() {
+    std::unique_lock<std::mutex> l(mutex_);
+    epoch_++;
+    wakeup_.notify_all();
+  }
+
+  const size_t num_workers_;
+  std::vector<Queue> queues_;
+  std::vector<std::thread> workers_;
+
+  // Protects epoch_ and quit_, and is used to wait on wakeup_.
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  // Incremented whenever new work is available, a job completes, or the
+  // runner is being destroyed.
+  uint64_t epoch_ = 0;
+  bool quit_ = false;
+  // Number of threads between PrepareToSleep() and the end of Sleep().
+  std::atomic<size_t> num_sleeping_{0};
+
+  // Runner and index of the worker running on the current thread, if any.
+  static thread_local WorkStealingParallelRunner* current_runner_;
+  static thread_local size_t current_worker_;
+};
+
+thread_local WorkStealingParallelRunner*
+    WorkStealingParallelRunner::current_runner_ = nullptr;
+thread_local size_t WorkStealingParallelRunner::current_worker_ = 0;
+
+}  // namespace
+}  // namespace jpegxl
+
+extern "C" {
+JXL_THREADS_EXPORT JxlParallelRetCode JxlWorkStealingParallelRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
+  return static_cast<jpegxl::WorkStealingParallelRunner*>(runner_opaque)
+      ->Run(jpegxl_opaque, init, func, start_range, end_range);
+}
+
+JXL_THREADS_EXPORT void* JxlWorkStealingParallelRunnerCreate(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads) {
+  return new jpegxl::WorkStealingParallelRunner(num_worker_threads);
+}
+
+JXL_THREADS_EXPORT void JxlWorkStealingParallelRunnerDestroy(
+    void* runner_opaque) {
+  delete static_cast<jpegxl::WorkStealingParallelRunner*>(runner_opaque);
+}
+
+JXL_THREADS_EXPORT size_t
+JxlWorkStealingParallelRunnerDefaultNumWorkerThreads() {
+  return std::thread::hardware_concurrency();
+}
+}
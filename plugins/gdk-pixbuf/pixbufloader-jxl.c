@@ -6,7 +6,7 @@
 #include <jxl/codestream_header.h>
 #include <jxl/decode.h>
 #include <jxl/encode.h>
-#include <jxl/resizable_parallel_runner.h>
+#include <jxl/shared_parallel_runner.h>
 #include <jxl/types.h>
 
 #define GDK_PIXBUF_ENABLE_BACKEND
@@ -40,17 +40,38 @@ struct _GdkPixbufJxlAnimation {
   GArray *frames;
 
   // JPEG XL decoder and related structures.
-  JxlParallelRunner *parallel_runner;
+  void *parallel_runner;
   JxlDecoder *decoder;
   JxlPixelFormat pixel_format;
 
+  // Input not consumed by the decoder yet, starting at `input_offset`. While
+  // `keep_input` is set, the consumed input is kept as well, so that decoding
+  // can start again from the beginning.
+  GByteArray *input;
+  size_t input_offset;
+  gboolean keep_input;
+
+  // The image is decoded directly at a smaller size requested by the size
+  // callback (e.g. for thumbnails). If the decoder cannot resample this image,
+  // it is decoded again from the start into `full_size`, which is then scaled
+  // into the frame (`restarted` is set).
+  gboolean resampling;
+  gboolean restarted;
+  GdkPixbuf *full_size;
+
+  // Whether the decoder has an output buffer for the current frame, which
+  // allows showing the partially decoded frame.
+  gboolean output_buffer_set;
+
   // Decoding is `done` when JXL_DEC_SUCCESS is received; calling
   // load_increment afterwards gives an error.
   gboolean done;
 
-  // Image information.
+  // Image information; xsize and ysize are the size of the output pixbufs.
   size_t xsize;
   size_t ysize;
+  size_t image_xsize;
+  size_t image_ysize;
   gboolean alpha_premultiplied;
   gboolean has_animation;
   gboolean has_alpha;
@@ -140,8 +161,10 @@ static void gdk_pixbuf_jxl_animation_finalize(GObject *obj) {
     }
     g_array_free(decoder_state->frames, /*free_segment=*/TRUE);
   }
-  JxlResizableParallelRunnerDestroy(decoder_state->parallel_runner);
+  JxlSharedParallelRunnerDestroy(decoder_state->parallel_runner);
   JxlDecoderDestroy(decoder_state->decoder);
+  if (decoder_state->input != NULL) g_byte_array_unref(decoder_state->input);
+  g_clear_object(&decoder_state->full_size);
   g_free(decoder_state->icc_base64);
 }
 
@@ -280,8 +303,12 @@ static gpointer begin_load(GdkPixbufModuleSizeFunc size_func,
     goto cleanup;
   }
 
-  if (!(decoder_state->parallel_runner =
-            JxlResizableParallelRunnerCreate(NULL))) {
+  decoder_state->input = g_byte_array_new();
+  decoder_state->keep_input = TRUE;
+
+  // All the loaders of the process share the same threads.
+  if (!(decoder_state->parallel_runner = JxlSharedParallelRunnerCreate(
+            JxlSharedThreadPoolGetDefault(), /*priority=*/0))) {
     g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
                 "Creation of the JXL parallel runner failed");
     goto cleanup;
@@ -296,7 +323,7 @@ static gpointer begin_load(GdkPixbufModuleSizeFunc size_func,
   JxlDecoderStatus status;
 
   if ((status = JxlDecoderSetParallelRunner(
-           decoder_state->decoder, JxlResizableParallelRunner,
+           decoder_state->decoder, JxlSharedParallelRunner,
            decoder_state->parallel_runner)) != JXL_DEC_SUCCESS) {
     g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
                 "JxlDecoderSetParallelRunner failed: %x", status);
@@ -316,8 +343,6 @@ static gpointer begin_load(GdkPixbufModuleSizeFunc size_func,
 
   return decoder_state;
 cleanup:
-  JxlResizableParallelRunnerDestroy(decoder_state->parallel_runner);
-  JxlDecoderDestroy(decoder_state->decoder);
   g_object_unref(decoder_state);
   return NULL;
 }
@@ -337,7 +362,11 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
 
   JxlDecoderStatus status;
 
-  if ((status = JxlDecoderSetInput(decoder_state->decoder, buf, size)) !=
+  g_byte_array_append(decoder_state->input, buf, size);
+  if ((status = JxlDecoderSetInput(
+           decoder_state->decoder,
+           decoder_state->input->data + decoder_state->input_offset,
+           decoder_state->input->len - decoder_state->input_offset)) !=
       JXL_DEC_SUCCESS) {
     // Should never happen if things are done properly.
     g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
@@ -349,11 +378,34 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
     status = JxlDecoderProcessInput(decoder_state->decoder);
     switch (status) {
       case JXL_DEC_NEED_MORE_INPUT: {
-        JxlDecoderReleaseInput(decoder_state->decoder);
+        size_t remaining = JxlDecoderReleaseInput(decoder_state->decoder);
+        decoder_state->input_offset = decoder_state->input->len - remaining;
+        if (!decoder_state->keep_input) {
+          g_byte_array_remove_range(decoder_state->input, 0,
+                                    decoder_state->input_offset);
+          decoder_state->input_offset = 0;
+        }
+        // Show what is decoded so far of the first frame, e.g. the DC or the
+        // first passes of a progressive image. Resampled output cannot be
+        // flushed.
+        if (decoder_state->output_buffer_set && !decoder_state->resampling &&
+            decoder_state->full_size == NULL &&
+            decoder_state->frames->len == 1 &&
+            decoder_state->area_updated_callback &&
+            JxlDecoderFlushImage(decoder_state->decoder) == JXL_DEC_SUCCESS) {
+          GdkPixbuf *output = g_array_index(decoder_state->frames,
+                                            GdkPixbufJxlAnimationFrame, 0)
+                                  .data;
+          decoder_state->area_updated_callback(
+              output, 0, 0, gdk_pixbuf_get_width(output),
+              gdk_pixbuf_get_height(output), decoder_state->user_data);
+        }
         return TRUE;
       }
 
       case JXL_DEC_BASIC_INFO: {
+        // Already handled before decoding started again.
+        if (decoder_state->restarted) break;
         JxlBasicInfo info;
         if (JxlDecoderGetBasicInfo(decoder_state->decoder, &info) !=
             JXL_DEC_SUCCESS) {
@@ -363,8 +415,8 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
         }
         decoder_state->pixel_format.num_channels = info.alpha_bits > 0 ? 4 : 3;
         decoder_state->alpha_premultiplied = info.alpha_premultiplied;
-        decoder_state->xsize = info.xsize;
-        decoder_state->ysize = info.ysize;
+        decoder_state->xsize = decoder_state->image_xsize = info.xsize;
+        decoder_state->ysize = decoder_state->image_ysize = info.ysize;
         decoder_state->has_animation = info.have_animation;
         decoder_state->has_alpha = info.alpha_bits > 0;
         if (info.have_animation) {
@@ -386,10 +438,18 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
           return TRUE;
         }
 
-        // Set an appropriate number of threads for the image size.
-        JxlResizableParallelRunnerSetThreads(
-            decoder_state->parallel_runner,
-            JxlResizableParallelRunnerSuggestThreads(info.xsize, info.ysize));
+        // Decode still images directly at a smaller requested size, instead
+        // of letting GDK scale down the full image.
+        if (!info.have_animation &&
+            ((guint)width < info.xsize || (guint)height < info.ysize) &&
+            JxlDecoderSetOutputSize(decoder_state->decoder, width, height,
+                                    JXL_RESAMPLE_FILTER_BOX) ==
+                JXL_DEC_SUCCESS) {
+          decoder_state->resampling = TRUE;
+          decoder_state->xsize = width;
+          decoder_state->ysize = height;
+        }
+        decoder_state->keep_input = decoder_state->resampling;
         break;
       }
 
@@ -407,6 +467,7 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
           JxlDecoderSetPreferredColorProfile(decoder_state->decoder,
                                              &color_encoding);
         }
+        if (decoder_state->icc_base64 != NULL) break;
         if (JXL_DEC_SUCCESS != JxlDecoderGetICCProfileSize(
                                    decoder_state->decoder,
                                    JXL_COLOR_PROFILE_TARGET_DATA, &icc_size)) {
@@ -440,7 +501,18 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
       }
 
       case JXL_DEC_FRAME: {
-        // TODO(veluca): support rescaling.
+        if (decoder_state->restarted && decoder_state->frames->len == 1) {
+          decoder_state->full_size = gdk_pixbuf_new(
+              GDK_COLORSPACE_RGB, decoder_state->has_alpha,
+              /*bits_per_sample=*/8, decoder_state->image_xsize,
+              decoder_state->image_ysize);
+          if (decoder_state->full_size == NULL) {
+            g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                        "Failed to allocate output pixel buffer");
+            return FALSE;
+          }
+          break;
+        }
         JxlFrameHeader frame_header;
         if (JxlDecoderGetFrameHeader(decoder_state->decoder, &frame_header) !=
             JXL_DEC_SUCCESS) {
@@ -486,9 +558,12 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
 
       case JXL_DEC_NEED_IMAGE_OUT_BUFFER: {
         GdkPixbuf *output =
-            g_array_index(decoder_state->frames, GdkPixbufJxlAnimationFrame,
-                          decoder_state->frames->len - 1)
-                .data;
+            decoder_state->full_size != NULL
+                ? decoder_state->full_size
+                : g_array_index(decoder_state->frames,
+                                GdkPixbufJxlAnimationFrame,
+                                decoder_state->frames->len - 1)
+                      .data;
         decoder_state->pixel_format.align = gdk_pixbuf_get_rowstride(output);
         guint size;
         guchar *dst = gdk_pixbuf_get_pixels_with_length(output, &size);
@@ -499,11 +574,24 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
                       "JxlDecoderSetImageOutBuffer failed");
           return FALSE;
         }
+        decoder_state->output_buffer_set = TRUE;
         break;
       }
 
       case JXL_DEC_FULL_IMAGE: {
-        // TODO(veluca): consider doing partial updates.
+        decoder_state->output_buffer_set = FALSE;
+        if (decoder_state->full_size != NULL) {
+          GdkPixbuf *output = g_array_index(decoder_state->frames,
+                                            GdkPixbufJxlAnimationFrame, 0)
+                                  .data;
+          gdk_pixbuf_scale(
+              decoder_state->full_size, output, 0, 0,
+              gdk_pixbuf_get_width(output), gdk_pixbuf_get_height(output), 0,
+              0, (double)decoder_state->xsize / decoder_state->image_xsize,
+              (double)decoder_state->ysize / decoder_state->image_ysize,
+              GDK_INTERP_BILINEAR);
+          g_clear_object(&decoder_state->full_size);
+        }
         if (decoder_state->area_updated_callback) {
           GdkPixbuf *output = g_array_index(decoder_state->frames,
                                             GdkPixbufJxlAnimationFrame, 0)
@@ -523,6 +611,34 @@ static gboolean load_increment(gpointer context, const guchar *buf, guint size,
         return TRUE;
       }
 
+      case JXL_DEC_ERROR: {
+        if (!decoder_state->resampling || decoder_state->frames->len != 1) {
+          g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE,
+                      "JXL decoding failed");
+          return FALSE;
+        }
+        // This image cannot be resampled by the decoder: decode it again at
+        // full size.
+        decoder_state->resampling = FALSE;
+        decoder_state->restarted = TRUE;
+        decoder_state->keep_input = FALSE;
+        decoder_state->output_buffer_set = FALSE;
+        decoder_state->input_offset = 0;
+        JxlDecoderReleaseInput(decoder_state->decoder);
+        JxlDecoderRewind(decoder_state->decoder);
+        if (JxlDecoderSetOutputSize(decoder_state->decoder, 0, 0,
+                                    JXL_RESAMPLE_FILTER_BOX) !=
+                JXL_DEC_SUCCESS ||
+            JxlDecoderSetInput(decoder_state->decoder,
+                               decoder_state->input->data,
+                               decoder_state->input->len) != JXL_DEC_SUCCESS) {
+          g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                      "JXL decoder logic error");
+          return FALSE;
+        }
+        break;
+      }
+
       default: {
         g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
                     "Unexpected JxlDecoderProcessInput return code: %x",
@@ -654,7 +770,8 @@ static gboolean jxl_image_saver(FILE *f, GdkPixbuf *pixbuf, gchar **keys,
     return FALSE;
   }
 
-  parallel_runner = JxlResizableParallelRunnerCreate(NULL);
+  parallel_runner =
+      JxlSharedParallelRunnerCreate(JxlSharedThreadPoolGetDefault(), 0);
   if (!parallel_runner) {
     JxlEncoderDestroy(encoder);
     g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
@@ -662,14 +779,10 @@ static gboolean jxl_image_saver(FILE *f, GdkPixbuf *pixbuf, gchar **keys,
     return FALSE;
   }
 
-  JxlResizableParallelRunnerSetThreads(
-      parallel_runner, JxlResizableParallelRunnerSuggestThreads(
-                           output_info.xsize, output_info.ysize));
-
-  status = JxlEncoderSetParallelRunner(encoder, JxlResizableParallelRunner,
+  status = JxlEncoderSetParallelRunner(encoder, JxlSharedParallelRunner,
                                        parallel_runner);
   if (status != JXL_ENC_SUCCESS) {
-    JxlResizableParallelRunnerDestroy(parallel_runner);
+    JxlSharedParallelRunnerDestroy(parallel_runner);
     JxlEncoderDestroy(encoder);
     g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
                 "JxlDecoderSetParallelRunner failed: %x", status);
@@ -686,7 +799,7 @@ static gboolean jxl_image_saver(FILE *f, GdkPixbuf *pixbuf, gchar **keys,
 
   status = JxlEncoderSetBasicInfo(encoder, &output_info);
   if (status != JXL_ENC_SUCCESS) {
-    JxlResizableParallelRunnerDestroy(parallel_runner);
+    JxlSharedParallelRunnerDestroy(parallel_runner);
     JxlEncoderDestroy(encoder);
     g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
                 "JxlEncoderSetBasicInfo failed: %x", status);
@@ -696,7 +809,7 @@ static gboolean jxl_image_saver(FILE *f, GdkPixbuf *pixbuf, gchar **keys,
   JxlColorEncodingSetToSRGB(&color_profile, JXL_FALSE);
   status = JxlEncoderSetColorEncoding(encoder, &color_profile);
   if (status != JXL_ENC_SUCCESS) {
-    JxlResizableParallelRunnerDestroy(parallel_runner);
+    JxlSharedParallelRunnerDestroy(parallel_runner);
     JxlEncoderDestroy(encoder);
     g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
                 "JxlEncoderSetColorEncoding failed: %x", status);
@@ -711,7 +824,7 @@ static gboolean jxl_image_saver(FILE *f, GdkPixbuf *pixbuf, gchar **keys,
                                    gdk_pixbuf_read_pixels(pixbuf),
                                    gdk_pixbuf_get_byte_length(pixbuf));
   if (status != JXL_ENC_SUCCESS) {
-    JxlResizableParallelRunnerDestroy(parallel_runner);
+    JxlSharedParallelRunnerDestroy(parallel_runner);
     JxlEncoderDestroy(encoder);
     g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
                 "JxlEncoderAddImageFrame failed: %x", status);
@@ -731,7 +844,7 @@ static gboolean jxl_image_saver(FILE *f, GdkPixbuf *pixbuf, gchar **keys,
       offset = next_out - compressed->data;
       g_byte_array_set_size(compressed, compressed->len * 2);
     } else if (status == JXL_ENC_ERROR) {
-      JxlResizableParallelRunnerDestroy(parallel_runner);
+      JxlSharedParallelRunnerDestroy(parallel_runner);
       JxlEncoderDestroy(encoder);
       g_set_error(error, G_FILE_ERROR, 0, "JxlEncoderProcessOutput failed: %x",
                   status);
@@ -739,7 +852,7 @@ static gboolean jxl_image_saver(FILE *f, GdkPixbuf *pixbuf, gchar **keys,
     }
   } while (status != JXL_ENC_SUCCESS);
 
-  JxlResizableParallelRunnerDestroy(parallel_runner);
+  JxlSharedParallelRunnerDestroy(parallel_runner);
   JxlEncoderDestroy(encoder);
 
   g_byte_array_set_size(compressed, next_out - compressed->data);
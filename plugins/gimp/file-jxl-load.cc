@@ -51,7 +51,6 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
   gint32 layer;
 
   gpointer pixels_buffer_1 = nullptr;
-  gpointer pixels_buffer_2 = nullptr;
   size_t buffer_size = 0;
 
   GimpImageBaseType image_type = GIMP_RGB;
@@ -83,21 +82,21 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
 
   gimp_load_progress.update();
 
-  // multi-threaded parallel runner.
-  auto runner = JxlResizableParallelRunnerMake(nullptr);
+  // multi-threaded parallel runner, sharing the threads of the process.
+  auto runner =
+      JxlSharedParallelRunnerMake(JxlSharedThreadPoolGetDefault(), 0);
 
   auto dec = JxlDecoderMake(nullptr);
   if (JXL_DEC_SUCCESS !=
       JxlDecoderSubscribeEvents(
           dec.get(), JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING |
-                         JXL_DEC_FULL_IMAGE | JXL_DEC_FRAME_PROGRESSION |
-                         JXL_DEC_FRAME)) {
+                         JXL_DEC_FULL_IMAGE | JXL_DEC_FRAME)) {
     g_printerr(LOAD_PROC " Error: JxlDecoderSubscribeEvents failed\n");
     return false;
   }
 
   if (JXL_DEC_SUCCESS != JxlDecoderSetParallelRunner(dec.get(),
-                                                     JxlResizableParallelRunner,
+                                                     JxlSharedParallelRunner,
                                                      runner.get())) {
     g_printerr(LOAD_PROC " Error: JxlDecoderSetParallelRunner failed\n");
     return false;
@@ -112,12 +111,6 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
   // grand decode loop...
   JxlDecoderSetInput(dec.get(), compressed.data(), compressed.size());
 
-  if (JXL_DEC_SUCCESS != JxlDecoderSetProgressiveDetail(
-                             dec.get(), JxlProgressiveDetail::kPasses)) {
-    g_printerr(LOAD_PROC " Error: JxlDecoderSetProgressiveDetail failed\n");
-    return false;
-  }
-
   while (true) {
     gimp_load_progress.update();
 
@@ -136,9 +129,6 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
         tps_denom = animation.tps_denominator;
         tps_numerator = animation.tps_numerator;
       }
-
-      JxlResizableParallelRunnerSetThreads(
-          runner.get(), JxlResizableParallelRunnerSuggestThreads(xsize, ysize));
     } else if (status == JXL_DEC_COLOR_ENCODING) {
       // check for ICC profile
       size_t icc_size = 0;
@@ -387,9 +377,7 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
       gimp_image_insert_layer(*image_id, layer, /*parent_id=*/-1,
                               /*position=*/0);
 
-      pixels_buffer_2 = g_malloc(buffer_size);
       GeglBuffer *buffer = gimp_drawable_get_buffer(layer);
-      const Babl *destination_format = gegl_buffer_set_format(buffer, nullptr);
 
       std::string babl_format_str = "";
       if (is_gray) {
@@ -404,16 +392,15 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
 
       const Babl *source_format = babl_format(babl_format_str.c_str());
 
-      babl_process(babl_fish(source_format, destination_format),
-                   pixels_buffer_1, pixels_buffer_2, xsize * ysize);
-
-      gegl_buffer_set(buffer, GEGL_RECTANGLE(0, 0, xsize, ysize), 0, nullptr,
-                      pixels_buffer_2, GEGL_AUTO_ROWSTRIDE);
+      // GEGL converts to the layer format while writing the tiles, without
+      // an intermediate copy of the whole frame.
+      gegl_buffer_set(buffer, GEGL_RECTANGLE(0, 0, xsize, ysize), 0,
+                      source_format, pixels_buffer_1, GEGL_AUTO_ROWSTRIDE);
       gimp_item_transform_translate(layer, crop_x0, crop_y0);
 
       g_clear_object(&buffer);
       g_free(pixels_buffer_1);
-      g_free(pixels_buffer_2);
+      pixels_buffer_1 = nullptr;
       if (stop_processing) status = JXL_DEC_SUCCESS;
       g_free(layer_name);
       layer_idx++;
@@ -451,10 +438,11 @@ bool LoadJpegXlImage(const gchar *const filename, gint32 *const image_id) {
       // It's not required to call JxlDecoderReleaseInput(dec.get())
       // since the decoder will be destroyed.
       break;
-    } else if (status == JXL_DEC_NEED_MORE_INPUT ||
-               status == JXL_DEC_FRAME_PROGRESSION) {
-      stop_processing = status != JXL_DEC_FRAME_PROGRESSION;
-      if (JxlDecoderFlushImage(dec.get()) == JXL_DEC_SUCCESS) {
+    } else if (status == JXL_DEC_NEED_MORE_INPUT) {
+      // Truncated file: keep what was decoded of the current frame.
+      stop_processing = true;
+      if (pixels_buffer_1 != nullptr &&
+          JxlDecoderFlushImage(dec.get()) == JXL_DEC_SUCCESS) {
         status = JXL_DEC_FULL_IMAGE;
         continue;
       }
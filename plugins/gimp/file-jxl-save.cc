@@ -707,19 +707,15 @@ bool SaveJpegXlImage(const gint32 image_id, const gint32 drawable_id,
 
   gimp_save_progress.update();
 
-  // multi-threaded parallel runner.
-  auto runner = JxlResizableParallelRunnerMake(nullptr);
-
-  JxlResizableParallelRunnerSetThreads(
-      runner.get(),
-      JxlResizableParallelRunnerSuggestThreads(jxl_save_opts.basic_info.xsize,
-                                               jxl_save_opts.basic_info.ysize));
+  // multi-threaded parallel runner, sharing the threads of the process.
+  auto runner =
+      JxlSharedParallelRunnerMake(JxlSharedThreadPoolGetDefault(), 0);
 
   auto enc = JxlEncoderMake(/*memory_manager=*/nullptr);
   JxlEncoderUseContainer(enc.get(), jxl_save_opts.use_container);
 
   if (JXL_ENC_SUCCESS != JxlEncoderSetParallelRunner(enc.get(),
-                                                     JxlResizableParallelRunner,
+                                                     JxlSharedParallelRunner,
                                                      runner.get())) {
     g_printerr(SAVE_PROC " Error: JxlEncoderSetParallelRunner failed\n");
     return false;
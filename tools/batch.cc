@@ -0,0 +1,105 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/batch.h"
+
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/printf_macros.h"
+
+namespace jpegxl {
+namespace tools {
+
+bool ReadBatchManifest(const std::string& path, std::vector<BatchJob>* jobs) {
+  std::ifstream manifest(path);
+  if (!manifest) {
+    fprintf(stderr, "Could not open the batch manifest %s\n", path.c_str());
+    return false;
+  }
+  jobs->clear();
+  std::string line;
+  while (std::getline(manifest, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty() || line[0] == '#') continue;
+    size_t separator = line.find('\t');
+    if (separator == std::string::npos) separator = line.find(' ');
+    BatchJob job;
+    job.input = line.substr(0, separator);
+    if (separator != std::string::npos) job.output = line.substr(separator + 1);
+    jobs->push_back(std::move(job));
+  }
+  return manifest.eof();
+}
+
+std::string CsvField(const std::string& field) {
+  if (field.find_first_of(",\"\n") == std::string::npos) return field;
+  std::string quoted = "\"";
+  for (char c : field) {
+    if (c == '"') quoted += '"';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+BatchRunner::BatchRunner(size_t num_worker_threads, size_t num_parallel_jobs) {
+  num_parallel_jobs = std::max<size_t>(num_parallel_jobs, 1);
+  threads_per_job_ = num_worker_threads / num_parallel_jobs;
+  for (size_t i = 0; i < num_parallel_jobs; ++i) {
+    runners_.push_back(JxlThreadParallelRunnerMake(
+        /*memory_manager=*/nullptr, threads_per_job_));
+  }
+}
+
+size_t BatchRunner::Run(const std::vector<BatchJob>& jobs,
+                        const ProcessJob& process, bool quiet) {
+  std::atomic<size_t> next_job{0};
+  std::atomic<size_t> num_failed{0};
+  std::atomic<size_t> total_pixels{0};
+  const auto worker = [&](void* runner) {
+    for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+      size_t num_pixels = 0;
+      if (!process(jobs[i], runner, &num_pixels)) {
+        fprintf(stderr, "Failed to process %s\n", jobs[i].input.c_str());
+        num_failed++;
+      }
+      total_pixels += num_pixels;
+    }
+  };
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < runners_.size(); ++i) {
+    threads.emplace_back(worker, runners_[i].get());
+  }
+  worker(runners_[0].get());
+  for (std::thread& thread : threads) thread.join();
+  const double elapsed =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  if (!quiet) {
+    fprintf(stderr,
+            "Processed %" PRIuS " files (%" PRIuS
+            " failed) in %.3f s, %.3f files/s, %.3f MP/s, %" PRIuS
+            " jobs x %" PRIuS " threads.\n",
+            jobs.size(), num_failed.load(), elapsed, jobs.size() / elapsed,
+            total_pixels.load() * 1e-6 / elapsed, runners_.size(),
+            threads_per_job_);
+  }
+  return num_failed;
+}
+
+}  // namespace tools
+}  // namespace jpegxl
@@ -0,0 +1,122 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_BATCH_H_
+#define TOOLS_BATCH_H_
+
+// Processing of many files in one invocation of a tool.
+
+#include <jxl/thread_parallel_runner_cxx.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace jpegxl {
+namespace tools {
+
+struct BatchJob {
+  std::string input;
+  // Empty if the manifest only names the input.
+  std::string output;
+};
+
+// Reads a manifest with one job per line: the input path, then the output
+// path, separated by a tab, or by the first space if there is no tab. Empty
+// lines and lines starting with '#' are skipped.
+bool ReadBatchManifest(const std::string& path, std::vector<BatchJob>* jobs);
+
+// Returns `field` as a CSV field, quoted if needed.
+std::string CsvField(const std::string& field);
+
+// Runs the jobs of a batch, up to `num_parallel_jobs` at the same time, which
+// share `num_worker_threads` threads. The thread pools are made once for the
+// whole batch.
+class BatchRunner {
+ public:
+  // Processes `job` with `runner`, a JxlThreadParallelRunner, and adds the
+  // number of processed pixels to `*num_pixels`. Returns false on failure.
+  using ProcessJob = std::function<bool(const BatchJob& job, void* runner,
+                                        size_t* num_pixels)>;
+
+  BatchRunner(size_t num_worker_threads, size_t num_parallel_jobs);
+
+  // Number of worker threads of the runner of each job.
+  size_t threads_per_job() const { return threads_per_job_; }
+
+  // Returns the number of jobs that failed, and prints the throughput of the
+  // whole batch unless `quiet`.
+  size_t Run(const std::vector<BatchJob>& jobs, const ProcessJob& process,
+             bool quiet);
+
+ private:
+  size_t threads_per_job_;
+  std::vector<JxlThreadParallelRunnerPtr> runners_;
+};
+
+// Shares what is computed from the input of the jobs, e.g. a decoded reference
+// image, between all the jobs of a batch with the same input, so it is only
+// computed once. Each one is dropped after its last job, so that with the jobs
+// of an input listed together only a few are kept at any time.
+template <typename T>
+class BatchInputCache {
+ public:
+  // Returns nullptr on failure.
+  using Compute = std::function<std::unique_ptr<T>(const std::string& input)>;
+
+  explicit BatchInputCache(const std::vector<BatchJob>& jobs) {
+    for (const BatchJob& job : jobs) entries_[job.input].num_uses++;
+  }
+
+  // Returns the value for the input of `job`, computing it with `compute` if
+  // no other job did, or waiting for the job that is computing it. Returns
+  // nullptr if computing it failed. Every call must be followed by a
+  // Release(job) once the value is no longer used.
+  std::shared_ptr<const T> Acquire(const BatchJob& job,
+                                   const Compute& compute) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Entry& entry = entries_.at(job.input);
+    cv_.wait(lock, [&entry] { return !entry.computing; });
+    if (!entry.computed) {
+      entry.computing = true;
+      lock.unlock();
+      std::shared_ptr<const T> value = compute(job.input);
+      lock.lock();
+      entry.value = std::move(value);
+      entry.computing = false;
+      entry.computed = true;
+      cv_.notify_all();
+    }
+    return entry.value;
+  }
+
+  void Release(const BatchJob& job) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& entry = entries_.at(job.input);
+    if (--entry.num_uses == 0) entry.value = nullptr;
+  }
+
+ private:
+  struct Entry {
+    size_t num_uses = 0;
+    bool computing = false;
+    bool computed = false;
+    std::shared_ptr<const T> value;
+  };
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::unordered_map<std::string, Entry> entries_;
+};
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_BATCH_H_
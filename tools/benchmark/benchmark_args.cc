@@ -79,6 +79,27 @@ Status BenchmarkArgs::AddCommandLineOptions() {
             "name of the file where to write the metric value (as a single "
             "floating point number) as the third argument.",
             "");
+  AddString(&trace, "trace",
+            "Record the time spent in each stage of the library and write it "
+            "to this file as Chrome trace JSON, e.g. for Perfetto. Requires a "
+            "library built with JPEGXL_ENABLE_TRACING.");
+  AddUnsigned(&num_shards, "num_shards",
+              "Splits the sorted input files into this many shards and only "
+              "benchmarks the one selected by --shard_index, e.g. to run the "
+              "shards on several machines and combine them with "
+              "--merge_stats.",
+              1);
+  AddUnsigned(&shard_index, "shard_index",
+              "Which shard of the input files to benchmark, from 0 to "
+              "num_shards - 1.",
+              0);
+  AddString(&stats_out, "stats_out",
+            "Writes the statistics of each image and codec to this file, for "
+            "--merge_stats.");
+  AddString(&merge_stats, "merge_stats",
+            "Comma separated list of files written by --stats_out. Instead of "
+            "running the benchmark, prints the report of all their images "
+            "together, including the distance percentiles.");
   AddFlag(
       &print_more_stats, "print_more_stats",
       "Prints codec-specific stats. Not safe for concurrent benchmark runs.",
@@ -213,6 +234,24 @@ Status BenchmarkArgs::AddCommandLineOptions() {
       "Distance numbers and compression speeds shown in the table are invalid.",
       false);
 
+  AddString(&latency, "latency",
+            "If 'encode' or 'decode', only times the encoder or the decoder "
+            "of each codec, without computing any metric. Each image is "
+            "encoded beforehand if needed, then each task runs alone with "
+            "--warmup_reps untimed and --encode_reps or --decode_reps timed "
+            "iterations, and the median and p99 latencies are printed per "
+            "image size bucket.");
+  AddUnsigned(&warmup_reps, "warmup_reps",
+              "Untimed iterations before the timed ones with --latency.", 1);
+  AddFlag(&pin_threads, "pin_threads",
+          "With --latency, pins the main thread and each inner thread to its "
+          "own CPU. Only supported on Linux.",
+          false);
+  AddFlag(&perf_counters, "perf_counters",
+          "With --latency, also reports the CPU cycles, instructions, cache "
+          "misses and branch misses per pixel, with Linux perf_event.",
+          false);
+
   AddUnsigned(
       &generations, "generations",
       "If nonzero, enables generation loss testing with this number of "
@@ -238,10 +277,36 @@ Status BenchmarkArgs::AddCommandLineOptions() {
 }
 
 Status BenchmarkArgs::ValidateArgs() {
+  if (!merge_stats.empty()) {
+    if (!input.empty() || !stats_out.empty() || write_html_report) {
+      fprintf(stderr,
+              "--merge_stats cannot be combined with --input, --stats_out or "
+              "--write_html_report.\n");
+      return false;
+    }
+    if (print_details_csv) print_details = true;
+    return true;
+  }
   if (input.empty()) {
     fprintf(stderr, "Missing --input filename(s).\n");
     return false;
   }
+  if (!latency.empty() && latency != "encode" && latency != "decode") {
+    fprintf(stderr, "--latency must be 'encode' or 'decode'.\n");
+    return false;
+  }
+  if (perf_counters && latency.empty()) {
+    fprintf(stderr, "--perf_counters requires --latency.\n");
+    return false;
+  }
+  if (latency == "encode" && decode_only) {
+    fprintf(stderr, "--latency=encode cannot be used with --decode_only.\n");
+    return false;
+  }
+  if (num_shards == 0 || shard_index >= num_shards) {
+    fprintf(stderr, "--shard_index must be less than --num_shards.\n");
+    return false;
+  }
   if (jxl::extras::CodecFromPath(output_extension) ==
       jxl::extras::Codec::kUnknown) {
     JXL_WARNING("Unrecognized output_extension %s, try .png",
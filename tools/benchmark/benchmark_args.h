@@ -156,6 +156,18 @@ struct BenchmarkArgs {
 
   std::string extra_metrics;
 
+  std::string trace;
+
+  size_t num_shards;
+  size_t shard_index;
+  std::string stats_out;
+  std::string merge_stats;
+
+  std::string latency;
+  size_t warmup_reps;
+  bool pin_threads;
+  bool perf_counters;
+
   jpegxl::tools::CommandLineParser cmdline;
 
  private:
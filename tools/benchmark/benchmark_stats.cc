@@ -13,6 +13,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <string>
 #include <vector>
@@ -172,6 +173,43 @@ std::string FormatFloat(const ColumnDescriptor& label, double value) {
   return result;
 }
 
+void AppendList(const std::vector<float>& values, std::string* out) {
+  out->push_back('\t');
+  for (size_t i = 0; i < values.size(); i++) {
+    if (i != 0) out->push_back(',');
+    *out += StringPrintf("%.9g", values[i]);
+  }
+}
+
+::jxl::Status ParseSize(const std::string& s, size_t* value) {
+  char* end;
+  *value = strtoull(s.c_str(), &end, 10);
+  if (s.empty() || *end != 0) {
+    return JXL_FAILURE("Invalid integer %s", s.c_str());
+  }
+  return true;
+}
+
+template <typename T>
+::jxl::Status ParseReal(const std::string& s, T* value) {
+  char* end;
+  *value = strtod(s.c_str(), &end);
+  if (s.empty() || *end != 0) {
+    return JXL_FAILURE("Invalid number %s", s.c_str());
+  }
+  return true;
+}
+
+::jxl::Status ParseList(const std::string& s, std::vector<float>* values) {
+  values->clear();
+  if (s.empty()) return true;
+  for (const std::string& item : SplitString(s, ',')) {
+    values->emplace_back();
+    JXL_RETURN_IF_ERROR(ParseReal(item, &values->back()));
+  }
+  return true;
+}
+
 }  // namespace
 
 std::string StringPrintf(const char* format, ...) {
@@ -250,6 +288,41 @@ void BenchmarkStats::Assimilate(const BenchmarkStats& victim) {
   return true;
 }
 
+std::string BenchmarkStats::Serialize() const {
+  std::string out = StringPrintf(
+      "%" PRIuS "\t%" PRIuS "\t%" PRIuS "\t%" PRIuS "\t%" PRIuS
+      "\t%.17g\t%.17g\t%.9g\t%.17g\t%.17g\t%.17g",
+      total_input_files, total_input_pixels, total_compressed_size,
+      total_adj_compressed_size, total_errors, total_time_encode,
+      total_time_decode, max_distance, distance_p_norm, psnr, ssimulacra2);
+  AppendList(distances, &out);
+  AppendList(pnorms, &out);
+  AppendList(ssimulacra2s, &out);
+  AppendList(extra_metrics, &out);
+  return out;
+}
+
+::jxl::Status BenchmarkStats::Deserialize(const std::string& fields) {
+  std::vector<std::string> f = SplitString(fields, '\t');
+  if (f.size() != 15) return JXL_FAILURE("Expected 15 statistics fields");
+  JXL_RETURN_IF_ERROR(ParseSize(f[0], &total_input_files));
+  JXL_RETURN_IF_ERROR(ParseSize(f[1], &total_input_pixels));
+  JXL_RETURN_IF_ERROR(ParseSize(f[2], &total_compressed_size));
+  JXL_RETURN_IF_ERROR(ParseSize(f[3], &total_adj_compressed_size));
+  JXL_RETURN_IF_ERROR(ParseSize(f[4], &total_errors));
+  JXL_RETURN_IF_ERROR(ParseReal(f[5], &total_time_encode));
+  JXL_RETURN_IF_ERROR(ParseReal(f[6], &total_time_decode));
+  JXL_RETURN_IF_ERROR(ParseReal(f[7], &max_distance));
+  JXL_RETURN_IF_ERROR(ParseReal(f[8], &distance_p_norm));
+  JXL_RETURN_IF_ERROR(ParseReal(f[9], &psnr));
+  JXL_RETURN_IF_ERROR(ParseReal(f[10], &ssimulacra2));
+  JXL_RETURN_IF_ERROR(ParseList(f[11], &distances));
+  JXL_RETURN_IF_ERROR(ParseList(f[12], &pnorms));
+  JXL_RETURN_IF_ERROR(ParseList(f[13], &ssimulacra2s));
+  JXL_RETURN_IF_ERROR(ParseList(f[14], &extra_metrics));
+  return true;
+}
+
 std::vector<ColumnValue> BenchmarkStats::ComputeColumns(
     const std::string& codec_desc) const {
   const double comp_bpp = total_compressed_size * 8.0 / total_input_pixels;
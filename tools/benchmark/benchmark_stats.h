@@ -50,6 +50,13 @@ struct BenchmarkStats {
 
   ::jxl::Status PrintMoreStats() const;
 
+  // Serializes the statistics of one task as tab-separated fields, for
+  // --stats_out. The encoder statistics in jxl_stats are not included.
+  std::string Serialize() const;
+
+  // Parses the result of Serialize into *this, for --merge_stats.
+  ::jxl::Status Deserialize(const std::string& fields);
+
   size_t total_input_files = 0;
   size_t total_input_pixels = 0;
   size_t total_compressed_size = 0;
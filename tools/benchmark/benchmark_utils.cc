@@ -7,11 +7,16 @@
 
 #include "tools/benchmark/benchmark_utils.h"
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
 #include "lib/jxl/base/status.h"
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
 // Not supported on Windows due to Linux-specific functions.
 // Not supported in Android NDK before API 28.
 #if !defined(_WIN32) && !defined(__EMSCRIPTEN__) && \
@@ -114,3 +119,21 @@ Status RunCommand(const std::string& command,
 }  // namespace jpegxl
 
 #endif  // _MSC_VER
+
+namespace jpegxl {
+namespace tools {
+
+Status PinCurrentThread(size_t cpu) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % CPU_SETSIZE, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return JXL_FAILURE("Not supported on this build");
+#endif
+}
+
+}  // namespace tools
+}  // namespace jpegxl
@@ -6,6 +6,7 @@
 #ifndef TOOLS_BENCHMARK_BENCHMARK_UTILS_H_
 #define TOOLS_BENCHMARK_BENCHMARK_UTILS_H_
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -36,6 +37,10 @@ Status RunCommand(const std::string& command,
                   const std::vector<std::string>& arguments,
                   bool quiet = false);
 
+// Restricts the calling thread to the given logical CPU, modulo the maximum
+// supported number of CPUs. Only supported on Linux.
+Status PinCurrentThread(size_t cpu);
+
 }  // namespace tools
 }  // namespace jpegxl
 
@@ -10,7 +10,9 @@
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -60,6 +62,7 @@
 #include "tools/speed_stats.h"
 #include "tools/ssimulacra2.h"
 #include "tools/thread_pool_internal.h"
+#include "tools/tracing.h"
 
 namespace jpegxl {
 namespace tools {
@@ -883,12 +886,78 @@ struct StatPrinter {
   std::mutex mutex;
 };
 
+// The iterations of the --latency mode for one codec and size bucket.
+struct LatencySamples {
+  size_t num_images = 0;
+  std::vector<double> seconds;
+  std::vector<double> mps;
+  // Of the timed iterations, with --perf_counters.
+  PerfCounts perf_counts;
+  size_t perf_pixels = 0;
+};
+
+constexpr size_t kNumLatencyBuckets = 5;
+const char* const kLatencyBucketNames[kNumLatencyBuckets] = {
+    "<0.25MP", "0.25-1MP", "1-4MP", "4-16MP", ">=16MP"};
+
+size_t LatencyBucket(size_t pixels) {
+  size_t bucket = 0;
+  size_t limit = 1 << 18;
+  while (bucket + 1 < kNumLatencyBuckets && pixels >= limit) {
+    bucket++;
+    limit *= 4;
+  }
+  return bucket;
+}
+
+// Nearest-rank percentile, p in (0, 1].
+double Percentile(std::vector<double> values, double p) {
+  std::sort(values.begin(), values.end());
+  size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+  return values[std::min(std::max<size_t>(rank, 1), values.size()) - 1];
+}
+
+void PrintLatency(const std::vector<std::string>& methods,
+                  const std::vector<std::vector<LatencySamples>>& samples) {
+  size_t width = strlen("Encoding");
+  for (const auto& method : methods) width = std::max(width, method.size());
+  const bool perf = Args()->perf_counters;
+  printf("%-*s %9s %7s %8s %11s %11s %11s", static_cast<int>(width),
+         "Encoding", "Size", "Images", "Samples", "Median ms", "P99 ms",
+         "Median MP/s");
+  if (perf) {
+    printf(" %9s %6s %9s %9s", "Cycles/px", "IPC", "CMiss/px", "BMiss/px");
+  }
+  printf("\n%s\n", std::string(width + 63 + (perf ? 37 : 0), '-').c_str());
+  for (size_t m = 0; m < methods.size(); ++m) {
+    for (size_t b = 0; b < kNumLatencyBuckets; ++b) {
+      const LatencySamples& s = samples[m][b];
+      if (s.seconds.empty()) continue;
+      printf("%-*s %9s %7" PRIuS " %8" PRIuS " %11.3f %11.3f %11.3f",
+             static_cast<int>(width), methods[m].c_str(),
+             kLatencyBucketNames[b], s.num_images, s.seconds.size(),
+             Percentile(s.seconds, 0.5) * 1e3,
+             Percentile(s.seconds, 0.99) * 1e3, Percentile(s.mps, 0.5));
+      if (perf) {
+        const PerfCounts& c = s.perf_counts;
+        const double px = std::max<size_t>(s.perf_pixels, 1);
+        printf(" %9.2f %6.2f %9.4f %9.4f", c.cycles / px,
+               c.cycles ? static_cast<double>(c.instructions) / c.cycles : 0.0,
+               c.cache_misses / px, c.branch_misses / px);
+      }
+      printf("\n");
+    }
+  }
+  fflush(stdout);
+}
+
 class Benchmark {
   using StringVec = std::vector<std::string>;
 
  public:
   // Return the exit code of the program.
   static Status Run() {
+    if (!Args()->merge_stats.empty()) return MergeStats();
     JxlMemoryManager default_memory_manager;
     JXL_RETURN_IF_ERROR(
         jxl::MemoryManagerInit(&default_memory_manager, nullptr));
@@ -915,13 +984,22 @@ class Benchmark {
       std::vector<PackedPixelFile> loaded_images =
           LoadImages(fnames, pool->get());
 
-      if (RunTasks(methods, extra_metrics_names, extra_metrics_commands, fnames,
-                   loaded_images, pool->get(), inner_pools, &tasks) != 0) {
+      const size_t errors =
+          Args()->latency.empty()
+              ? RunTasks(methods, extra_metrics_names, extra_metrics_commands,
+                         fnames, loaded_images, pool->get(), inner_pools,
+                         &tasks)
+              : RunLatency(methods, fnames, loaded_images, &tasks);
+      if (errors != 0) {
         ok = false;
         if (!Args()->silent_errors) {
           fprintf(stderr, "There were error(s) in the benchmark.\n");
         }
       }
+      if (!Args()->stats_out.empty()) {
+        JXL_RETURN_IF_ERROR(WriteStats(methods, extra_metrics_names, fnames,
+                                       tasks, Args()->stats_out));
+      }
     }
 
     memory_manager.PrintStats();
@@ -930,6 +1008,244 @@ class Benchmark {
   }
 
  private:
+  static constexpr const char* kStatsHeader = "benchmark_xl_stats\t1";
+
+  // Writes one line per task, which MergeStats reads back.
+  static Status WriteStats(const StringVec& methods,
+                           const StringVec& extra_metrics_names,
+                           const StringVec& fnames,
+                           const std::vector<Task>& tasks,
+                           const std::string& path) {
+    std::string out = kStatsHeader;
+    out += '\t';
+    for (size_t i = 0; i < extra_metrics_names.size(); i++) {
+      if (i != 0) out += ',';
+      out += extra_metrics_names[i];
+    }
+    out += '\n';
+    for (const Task& t : tasks) {
+      out += methods[t.idx_method] + '\t' + fnames[t.idx_image] + '\t' +
+             t.stats.Serialize() + '\n';
+    }
+    if (!WriteFile(path, out)) {
+      return JXL_FAILURE("Could not write %s", path.c_str());
+    }
+    return true;
+  }
+
+  // Returns the index of `name` in `names`, appending it if missing.
+  static size_t IndexOf(const std::string& name, StringVec* names) {
+    auto it = std::find(names->begin(), names->end(), name);
+    if (it != names->end()) return it - names->begin();
+    names->push_back(name);
+    return names->size() - 1;
+  }
+
+  // Prints the report of the tasks of all the --merge_stats files as if they
+  // had run in a single benchmark.
+  static Status MergeStats() {
+    StringVec methods;
+    StringVec extra_metrics_names;
+    StringVec fnames;
+    std::vector<Task> tasks;
+    bool first = true;
+    for (const std::string& path : SplitString(Args()->merge_stats, ',')) {
+      if (path.empty()) continue;
+      std::vector<uint8_t> contents;
+      if (!ReadFile(path, &contents)) {
+        return JXL_FAILURE("Could not read %s", path.c_str());
+      }
+      StringVec lines =
+          SplitString(std::string(contents.begin(), contents.end()), '\n');
+      const std::string header = std::string(kStatsHeader) + '\t';
+      if (lines[0].compare(0, header.size(), header) != 0) {
+        return JXL_FAILURE("%s was not written by --stats_out", path.c_str());
+      }
+      const std::string names = lines[0].substr(header.size());
+      StringVec file_names;
+      if (!names.empty()) file_names = SplitString(names, ',');
+      if (!first && file_names != extra_metrics_names) {
+        return JXL_FAILURE("%s has different extra metrics", path.c_str());
+      }
+      extra_metrics_names = file_names;
+      first = false;
+      for (size_t i = 1; i < lines.size(); i++) {
+        const std::string& line = lines[i];
+        if (line.empty()) continue;
+        size_t method_end = line.find('\t');
+        size_t fname_end = method_end == std::string::npos
+                               ? std::string::npos
+                               : line.find('\t', method_end + 1);
+        if (fname_end == std::string::npos) {
+          return JXL_FAILURE("Invalid line %" PRIuS " of %s", i + 1,
+                             path.c_str());
+        }
+        tasks.emplace_back();
+        Task& t = tasks.back();
+        t.idx_method = IndexOf(line.substr(0, method_end), &methods);
+        t.idx_image = IndexOf(
+            line.substr(method_end + 1, fname_end - method_end - 1), &fnames);
+        t.image = nullptr;
+        JXL_RETURN_IF_ERROR(t.stats.Deserialize(line.substr(fname_end + 1)));
+      }
+    }
+    if (tasks.empty()) return JXL_FAILURE("No results to merge");
+
+    // Same order as CreateTasks, each image must have a result of each codec.
+    std::sort(tasks.begin(), tasks.end(), [](const Task& a, const Task& b) {
+      return a.idx_image != b.idx_image ? a.idx_image < b.idx_image
+                                        : a.idx_method < b.idx_method;
+    });
+    bool complete = tasks.size() == methods.size() * fnames.size();
+    for (size_t i = 0; complete && i < tasks.size(); ++i) {
+      complete = tasks[i].idx_image == i / methods.size() &&
+                 tasks[i].idx_method == i % methods.size();
+    }
+    if (!complete) {
+      return JXL_FAILURE(
+          "The merged files must have one result of each codec per image");
+    }
+
+    StatPrinter printer(methods, extra_metrics_names, fnames, tasks);
+    if (Args()->print_details_csv) PrintDetailsCsvHeader(extra_metrics_names);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      JXL_RETURN_IF_ERROR(printer.TaskDone(i, tasks[i]));
+    }
+    return true;
+  }
+
+  // Pins the main thread to CPU 0 and each of the `num_threads` threads of
+  // `pool` to the next CPUs.
+  static Status PinThreads(ThreadPool* pool, size_t num_threads) {
+    JXL_RETURN_IF_ERROR(PinCurrentThread(0));
+    if (num_threads == 0) return true;
+    // Each task waits for all the others so that each thread runs one.
+    std::mutex mutex;
+    std::condition_variable started;
+    size_t num_started = 0;
+    std::atomic<bool> ok{true};
+    const auto pin = [&](const uint32_t task, size_t /*thread*/) -> Status {
+      if (!PinCurrentThread(1 + task)) ok = false;
+      std::unique_lock<std::mutex> lock(mutex);
+      if (++num_started == num_threads) started.notify_all();
+      started.wait(lock, [&] { return num_started == num_threads; });
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(jxl::RunOnPool(pool, 0, num_threads,
+                                       ThreadPool::NoInit, pin, "Pin"));
+    return ok.load();
+  }
+
+  static Status Encode(const std::string& filename,
+                       const PackedPixelFile& ppf, ImageCodec* codec,
+                       ThreadPool* pool, std::vector<uint8_t>* compressed,
+                       jpegxl::tools::SpeedStats* speed_stats) {
+    std::string ext = FileExtension(filename);
+    if (codec->CanRecompressJpeg() && (ext == ".jpg" || ext == ".jpeg")) {
+      std::vector<uint8_t> data_in;
+      JXL_RETURN_IF_ERROR(ReadFile(filename, &data_in));
+      return codec->RecompressJpeg(filename, data_in, compressed, speed_stats);
+    }
+    if (ppf.frames.size() != 1) {
+      return JXL_FAILURE("multiframe input image not supported");
+    }
+    return codec->Compress(filename, ppf, pool, compressed, speed_stats);
+  }
+
+  // Times the encoder or decoder of each task alone, for --latency. Returns
+  // the number of errors.
+  static size_t RunLatency(const StringVec& methods, const StringVec& fnames,
+                           const std::vector<PackedPixelFile>& loaded_images,
+                           std::vector<Task>* tasks) {
+    const bool encode = Args()->latency == "encode";
+    const size_t reps = encode ? Args()->encode_reps : Args()->decode_reps;
+    const size_t num_inner =
+        NumInnerThreads(std::thread::hardware_concurrency(), 0);
+    ThreadPoolInternal inner_pool(num_inner);
+    ThreadPool* pool = inner_pool.get();
+    if (Args()->pin_threads && !PinThreads(pool, num_inner)) {
+      fprintf(stderr, "Could not pin the threads to CPUs.\n");
+    }
+    fprintf(stderr,
+            "Timing the %s of %" PRIuS " tasks one at a time with %" PRIuS
+            " inner threads\n",
+            encode ? "encoder" : "decoder", tasks->size(), num_inner);
+
+    std::vector<std::vector<LatencySamples>> samples(
+        methods.size(), std::vector<LatencySamples>(kNumLatencyBuckets));
+    size_t errors = 0;
+    for (Task& t : *tasks) {
+      const std::string& filename = fnames[t.idx_image];
+      const PackedPixelFile& ppf = loaded_images[t.idx_image];
+      ImageCodec* codec = t.codec.get();
+      std::vector<uint8_t> compressed;
+      PackedPixelFile decoded;
+      jpegxl::tools::SpeedStats untimed;
+      // The bitstream to decode is encoded before timing.
+      bool ok = Args()->decode_only
+                    ? ReadFile(filename, &compressed)
+                    : static_cast<bool>(Encode(filename, ppf, codec, pool,
+                                               &compressed, &untimed));
+      if (ok && !encode) {
+        ok = static_cast<bool>(codec->Decompress(
+            filename, Bytes(compressed), pool, &decoded, &untimed));
+      }
+      size_t pixels = 0;
+      for (const auto& frame : encode ? ppf.frames : decoded.frames) {
+        pixels += frame.color.xsize * frame.color.ysize;
+      }
+      std::vector<double> seconds;
+      PerfCounts perf_counts;
+      for (size_t i = 0; ok && i < Args()->warmup_reps + reps; ++i) {
+        jpegxl::tools::SpeedStats speed_stats;
+        {
+          ScopedPerfCounts scoped_perf_counts(&speed_stats);
+          if (encode) {
+            ok = static_cast<bool>(Encode(filename, ppf, codec, pool,
+                                          &compressed, &speed_stats));
+          } else {
+            ok = static_cast<bool>(codec->Decompress(
+                filename, Bytes(compressed), pool, &decoded, &speed_stats));
+          }
+        }
+        jpegxl::tools::SpeedStats::Summary summary;
+        ok = ok && speed_stats.GetSummary(&summary);
+        if (ok && i >= Args()->warmup_reps) {
+          seconds.push_back(summary.central_tendency);
+          perf_counts += speed_stats.perf_counts();
+        }
+      }
+      if (!ok || pixels == 0) {
+        errors++;
+        if (!Args()->silent_errors) {
+          fprintf(stderr, "%s failed on %s\n", methods[t.idx_method].c_str(),
+                  filename.c_str());
+        }
+        continue;
+      }
+      LatencySamples& s = samples[t.idx_method][LatencyBucket(pixels)];
+      s.num_images++;
+      s.perf_counts += perf_counts;
+      s.perf_pixels += pixels * seconds.size();
+      for (double sec : seconds) {
+        s.seconds.push_back(sec);
+        s.mps.push_back(pixels * 1E-6 / sec);
+      }
+    }
+    PrintLatency(methods, samples);
+    return errors;
+  }
+
+  static void PrintDetailsCsvHeader(const StringVec& extra_metrics_names) {
+    printf(
+        "method,image,error,size,pixels,enc_speed,dec_speed,"
+        "bpp,maxnorm,ssimulacra2,psnr,pnorm,bppp,qabpp");
+    for (const std::string& s : extra_metrics_names) {
+      printf(",%s", s.c_str());
+    }
+    printf("\n");
+  }
+
   static size_t NumOuterThreads(const size_t num_hw_threads,
                                 const size_t num_tasks) {
     // Default to #cores
@@ -1092,7 +1408,8 @@ class Benchmark {
     if (fnames.empty()) {
       JPEGXL_TOOLS_ABORT("No input file matches pattern");
     }
-    if (Args()->print_details) {
+    // Sharding needs the same order in all the processes.
+    if (Args()->print_details || Args()->num_shards > 1) {
       std::sort(fnames.begin(), fnames.end());
     }
 
@@ -1100,6 +1417,17 @@ class Benchmark {
       fnames = SampleFromInput(fnames, Args()->sample_tmp_dir,
                                Args()->num_samples, Args()->sample_dimensions);
     }
+    if (Args()->num_shards > 1) {
+      StringVec shard;
+      for (size_t i = Args()->shard_index; i < fnames.size();
+           i += Args()->num_shards) {
+        shard.push_back(fnames[i]);
+      }
+      if (shard.empty()) {
+        JPEGXL_TOOLS_ABORT("No input file in this shard");
+      }
+      fnames = std::move(shard);
+    }
     return fnames;
   }
 
@@ -1174,16 +1502,7 @@ class Benchmark {
       const std::vector<std::unique_ptr<ThreadPoolInternal>>& inner_pools,
       std::vector<Task>* tasks) {
     StatPrinter printer(methods, extra_metrics_names, fnames, *tasks);
-    if (Args()->print_details_csv) {
-      // Print CSV header
-      printf(
-          "method,image,error,size,pixels,enc_speed,dec_speed,"
-          "bpp,maxnorm,ssimulacra2,psnr,pnorm,bppp,qabpp");
-      for (const std::string& s : extra_metrics_names) {
-        printf(",%s", s.c_str());
-      }
-      printf("\n");
-    }
+    if (Args()->print_details_csv) PrintDetailsCsvHeader(extra_metrics_names);
 
     std::vector<uint64_t> errors_thread;
 
@@ -1234,7 +1553,18 @@ int BenchmarkMain(int argc, const char** argv) {
     fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
     return EXIT_FAILURE;
   }
-  return Benchmark::Run() ? EXIT_SUCCESS : EXIT_FAILURE;
+  // Before creating the thread pools, whose threads are counted only if they
+  // start afterwards.
+  if (Args()->perf_counters && !StartPerfCounters()) {
+    fprintf(stderr,
+            "Hardware performance counters are not available, see "
+            "/proc/sys/kernel/perf_event_paranoid.\n");
+    return EXIT_FAILURE;
+  }
+  if (!StartTracing(Args()->trace)) return EXIT_FAILURE;
+  bool ok = static_cast<bool>(Benchmark::Run());
+  if (!FinishTracing(Args()->trace)) return EXIT_FAILURE;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 }  // namespace
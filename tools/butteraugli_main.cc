@@ -8,10 +8,14 @@
 #include <jxl/memory_manager.h>
 #include <jxl/types.h>
 
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>  // NOLINT
 #include <vector>
 
 #include "lib/extras/codec.h"
@@ -19,6 +23,8 @@
 #include "lib/extras/metrics.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/packed_image_convert.h"
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
@@ -28,12 +34,17 @@
 #include "lib/jxl/enc_butteraugli_comparator.h"
 #include "lib/jxl/enc_comparator.h"
 #include "lib/jxl/image.h"
+#include "tools/batch.h"
 #include "tools/file_io.h"
 #include "tools/no_memory_manager.h"
 #include "tools/thread_pool_internal.h"
 
 namespace {
 
+using jpegxl::tools::BatchInputCache;
+using jpegxl::tools::BatchJob;
+using jpegxl::tools::BatchRunner;
+using jpegxl::tools::CsvField;
 using jpegxl::tools::ThreadPoolInternal;
 using jxl::ButteraugliParams;
 using jxl::CodecInOut;
@@ -54,6 +65,53 @@ Status WriteImage(const Image3F& image, const std::string& filename) {
          jpegxl::tools::WriteFile(filename, encoded);
 }
 
+Status LoadImage(const std::string& pathname,
+                 const jxl::extras::ColorHints& color_hints,
+                 jxl::ThreadPool* pool, CodecInOut* io) {
+  std::vector<uint8_t> encoded;
+  if (!jpegxl::tools::ReadFile(pathname, &encoded)) {
+    fprintf(stderr, "Failed to read image from %s\n", pathname.c_str());
+    return false;
+  }
+  if (!jxl::SetFromBytes(jxl::Bytes(encoded), color_hints, io, pool)) {
+    fprintf(stderr, "Failed to decode image from %s\n", pathname.c_str());
+    return false;
+  }
+  return true;
+}
+
+ButteraugliParams MakeButteraugliParams(float intensity_target) {
+  ButteraugliParams butteraugli_params;
+  butteraugli_params.hf_asymmetry = 1.0f;
+  butteraugli_params.xmul = 1.0f;
+  butteraugli_params.intensity_target = intensity_target;
+  return butteraugli_params;
+}
+
+// Computes the butteraugli distance and its p-norm between two decoded images.
+Status CompareImages(const CodecInOut& io1, const CodecInOut& io2,
+                     const ButteraugliParams& butteraugli_params, double p,
+                     jxl::ThreadPool* pool, float* distance, double* pnorm,
+                     ImageF* distmap) {
+  if (io1.xsize() != io2.xsize()) {
+    fprintf(stderr, "Width mismatch: %" PRIuS " %" PRIuS "\n", io1.xsize(),
+            io2.xsize());
+    return false;
+  }
+  if (io1.ysize() != io2.ysize()) {
+    fprintf(stderr, "Height mismatch: %" PRIuS " %" PRIuS "\n", io1.ysize(),
+            io2.ysize());
+    return false;
+  }
+  const JxlCmsInterface& cms = *JxlGetDefaultCms();
+  JxlButteraugliComparator comparator(butteraugli_params, cms, pool);
+  JXL_RETURN_IF_ERROR(ComputeScore(io1.Main(), io2.Main(), &comparator, cms,
+                                   distance, distmap, pool,
+                                   /* ignore_alpha */ false));
+  *pnorm = jxl::ComputeDistanceP(*distmap, butteraugli_params, p);
+  return true;
+}
+
 Status RunButteraugli(const char* pathname1, const char* pathname2,
                       const std::string& distmap_filename,
                       const std::string& raw_distmap_filename,
@@ -72,43 +130,17 @@ Status RunButteraugli(const char* pathname1, const char* pathname2,
   CodecInOut* io[2] = {&io1, &io2};
   ThreadPoolInternal pool(4);
   for (size_t i = 0; i < 2; ++i) {
-    std::vector<uint8_t> encoded;
-    if (!jpegxl::tools::ReadFile(pathname[i], &encoded)) {
-      fprintf(stderr, "Failed to read image from %s\n", pathname[i]);
-      return false;
-    }
-    if (!jxl::SetFromBytes(jxl::Bytes(encoded), color_hints, io[i],
-                           pool.get())) {
-      fprintf(stderr, "Failed to decode image from %s\n", pathname[i]);
-      return false;
-    }
-  }
-
-  if (io1.xsize() != io2.xsize()) {
-    fprintf(stderr, "Width mismatch: %" PRIuS " %" PRIuS "\n", io1.xsize(),
-            io2.xsize());
-    return false;
-  }
-  if (io1.ysize() != io2.ysize()) {
-    fprintf(stderr, "Height mismatch: %" PRIuS " %" PRIuS "\n", io1.ysize(),
-            io2.ysize());
-    return false;
+    JXL_RETURN_IF_ERROR(LoadImage(pathname[i], color_hints, pool.get(), io[i]));
   }
 
   ImageF distmap;
-  ButteraugliParams butteraugli_params;
-  butteraugli_params.hf_asymmetry = 1.0f;
-  butteraugli_params.xmul = 1.0f;
-  butteraugli_params.intensity_target = intensity_target;
-  const JxlCmsInterface& cms = *JxlGetDefaultCms();
-  JxlButteraugliComparator comparator(butteraugli_params, cms);
+  ButteraugliParams butteraugli_params =
+      MakeButteraugliParams(intensity_target);
   float distance;
-  JXL_RETURN_IF_ERROR(ComputeScore(io1.Main(), io2.Main(), &comparator, cms,
-                                   &distance, &distmap, pool.get(),
-                                   /* ignore_alpha */ false));
+  double pnorm;
+  JXL_RETURN_IF_ERROR(CompareImages(io1, io2, butteraugli_params, p,
+                                    pool.get(), &distance, &pnorm, &distmap));
   printf("%.10f\n", distance);
-
-  double pnorm = jxl::ComputeDistanceP(distmap, butteraugli_params, p);
   printf("%g-norm: %f\n", p, pnorm);
 
   if (!distmap_filename.empty()) {
@@ -131,31 +163,67 @@ Status RunButteraugli(const char* pathname1, const char* pathname2,
   return true;
 }
 
+// Compares all the (reference, distorted) pairs of `manifest`, `num_jobs` at
+// the same time, and prints the results as CSV lines as they complete. Each
+// reference is decoded once for all its pairs.
+Status RunButteraugliBatch(const std::string& manifest, size_t num_jobs,
+                           const std::string& colorspace_hint, double p,
+                           float intensity_target) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  jxl::extras::ColorHints color_hints;
+  if (!colorspace_hint.empty()) {
+    color_hints.Add("color_space", colorspace_hint);
+  }
+  std::vector<BatchJob> jobs;
+  JXL_RETURN_IF_ERROR(jpegxl::tools::ReadBatchManifest(manifest, &jobs));
+  const ButteraugliParams butteraugli_params =
+      MakeButteraugliParams(intensity_target);
+
+  BatchInputCache<CodecInOut> references(jobs);
+  std::mutex output_mutex;
+  printf("reference,distorted,distance,%g-norm\n", p);
+  const auto compare = [&](const BatchJob& job, void* runner,
+                           size_t* num_pixels) {
+    jxl::ThreadPool pool(JxlThreadParallelRunner, runner);
+    const auto load_reference = [&](const std::string& pathname) {
+      auto io = jxl::make_unique<CodecInOut>(memory_manager);
+      if (!LoadImage(pathname, color_hints, &pool, io.get())) io = nullptr;
+      return io;
+    };
+    std::shared_ptr<const CodecInOut> reference =
+        references.Acquire(job, load_reference);
+    CodecInOut distorted{memory_manager};
+    ImageF distmap;
+    float distance = 0.0f;
+    double pnorm = 0.0;
+    bool ok = reference &&
+              LoadImage(job.output, color_hints, &pool, &distorted) &&
+              CompareImages(*reference, distorted, butteraugli_params, p,
+                            &pool, &distance, &pnorm, &distmap);
+    references.Release(job);
+    if (!ok) return false;
+    *num_pixels += distorted.xsize() * distorted.ysize();
+    std::lock_guard<std::mutex> lock(output_mutex);
+    printf("%s,%s,%.10f,%f\n", CsvField(job.input).c_str(),
+           CsvField(job.output).c_str(), distance, pnorm);
+    return true;
+  };
+  BatchRunner batch(std::thread::hardware_concurrency(), num_jobs);
+  return batch.Run(jobs, compare, /*quiet=*/false) == 0;
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
-  if (argc < 3) {
-    fprintf(stderr,
-            "Usage: %s <reference> <distorted>\n"
-            "  [--distmap <distmap>]\n"
-            "  [--rawdistmap <distmap.pfm>]\n"
-            "  [--intensity_target <intensity_target>]\n"
-            "  [--colorspace <colorspace_hint>]\n"
-            "  [--pnorm <pth norm>]\n"
-            "NOTE: images get converted to linear sRGB for butteraugli. Images"
-            " without attached profiles (such as ppm or pfm) are interpreted"
-            " as nonlinear sRGB. The hint format is RGB_D65_SRG_Rel_Lin for"
-            " linear sRGB. Intensity target is viewing conditions screen nits"
-            ", defaults to 80.\n",
-            argv[0]);
-    return 1;
-  }
+  std::vector<const char*> pathnames;
   std::string distmap;
   std::string raw_distmap;
   std::string colorspace;
+  std::string batch;
+  size_t batch_jobs = 1;
   double p = 3;
   float intensity_target = 80.0;  // sRGB intensity target.
-  for (int i = 3; i < argc; i++) {
+  for (int i = 1; i < argc; i++) {
     if (std::string(argv[i]) == "--distmap" && i + 1 < argc) {
       distmap = argv[++i];
     } else if (std::string(argv[i]) == "--rawdistmap" && i + 1 < argc) {
@@ -171,13 +239,53 @@ int main(int argc, char** argv) {
         fprintf(stderr, "Failed to parse pnorm \"%s\".\n", argv[i]);
         return 1;
       }
+    } else if (std::string(argv[i]) == "--batch" && i + 1 < argc) {
+      batch = argv[++i];
+    } else if (std::string(argv[i]) == "--batch_jobs" && i + 1 < argc) {
+      batch_jobs = std::stoul(std::string(argv[++i]));
+    } else if (argv[i][0] != '-' && pathnames.size() < 2) {
+      pathnames.push_back(argv[i]);
     } else {
       fprintf(stderr, "Unrecognized flag \"%s\".\n", argv[i]);
       return 1;
     }
   }
+  if (batch.empty() ? pathnames.size() != 2 : !pathnames.empty()) {
+    fprintf(stderr,
+            "Usage: %s <reference> <distorted>\n"
+            "  [--distmap <distmap>]\n"
+            "  [--rawdistmap <distmap.pfm>]\n"
+            "  [--intensity_target <intensity_target>]\n"
+            "  [--colorspace <colorspace_hint>]\n"
+            "  [--pnorm <pth norm>]\n"
+            "or: %s --batch <pairs> [--batch_jobs <N>]\n"
+            "  [--intensity_target <intensity_target>]\n"
+            "  [--colorspace <colorspace_hint>]\n"
+            "  [--pnorm <pth norm>]\n"
+            "NOTE: images get converted to linear sRGB for butteraugli. Images"
+            " without attached profiles (such as ppm or pfm) are interpreted"
+            " as nonlinear sRGB. The hint format is RGB_D65_SRG_Rel_Lin for"
+            " linear sRGB. Intensity target is viewing conditions screen nits"
+            ", defaults to 80.\n"
+            "In batch mode, each line of <pairs> holds the paths of a reference"
+            " and a distorted image, separated by a tab or a space, and the"
+            " results are printed as CSV. <N> pairs are compared at the same"
+            " time.\n",
+            argv[0], argv[0]);
+    return 1;
+  }
+  if (!batch.empty()) {
+    if (!distmap.empty() || !raw_distmap.empty()) {
+      fprintf(stderr, "--distmap and --rawdistmap can not be used in batch "
+                      "mode.\n");
+      return 1;
+    }
+    Status result = RunButteraugliBatch(batch, batch_jobs, colorspace, p,
+                                        intensity_target);
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
-  Status result = RunButteraugli(argv[1], argv[2], distmap, raw_distmap,
-                                 colorspace, p, intensity_target);
+  Status result = RunButteraugli(pathnames[0], pathnames[1], distmap,
+                                 raw_distmap, colorspace, p, intensity_target);
   return result ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -29,13 +29,18 @@
 #include <string>
 #include <vector>
 
+#include "lib/extras/async_output.h"
+#include "lib/extras/dec/apng.h"
 #include "lib/extras/dec/color_hints.h"
 #include "lib/extras/dec/decode.h"
+#include "lib/extras/dec/exr.h"
 #include "lib/extras/dec/pnm.h"
+#include "lib/extras/dec/y4m.h"
 #include "lib/extras/enc/jxl.h"
+#include "lib/extras/frame_queue.h"
 #include "lib/extras/packed_image.h"
+#include "lib/extras/pyramid.h"
 #include "lib/extras/time.h"
-#include "lib/jxl/base/c_callback_support.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/exif.h"
 #include "lib/jxl/base/override.h"
@@ -43,10 +48,12 @@
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "tools/args.h"
+#include "tools/batch.h"
 #include "tools/cmdline.h"
 #include "tools/codec_config.h"
 #include "tools/file_io.h"
 #include "tools/speed_stats.h"
+#include "tools/tracing.h"
 
 namespace jpegxl {
 namespace tools {
@@ -311,6 +318,17 @@ struct CompressArgs {
         "upsampling), 0 means nearest neighbor (useful for pixel art)",
         &upsampling_mode, &ParseInt64, 2);
 
+    cmdline->AddOptionValue(
+        '\0', "pyramid_levels", "N",
+        "Also write N-1 lower resolution levels of the image, each half the "
+        "size\n"
+        "    of the previous one, e.g. for deep-zoom viewers. Level L is "
+        "written to\n"
+        "    OUTPUT with _L inserted before the extension. The input is only "
+        "decoded\n"
+        "    once. Default is 1 (no other levels).",
+        &pyramid_levels, &ParseUnsigned, 2);
+
     cmdline->AddOptionValue(
         '\0', "epf", "-1|0|1|2|3",
         "Edge preserving filter level, 0-3. "
@@ -345,9 +363,38 @@ struct CompressArgs {
                             "How many times to compress. (For benchmarking).",
                             &num_reps, &ParseUnsigned, 3);
 
+    cmdline->AddOptionValue(
+        '\0', "batch", "MANIFEST",
+        "Compress all the files listed in MANIFEST instead of INPUT to "
+        "OUTPUT.\n"
+        "    Each line holds an input and an output path, separated by a tab "
+        "or a space.",
+        &batch, &ParseString, 1);
+    cmdline->AddOptionValue('\0', "batch_jobs", "N",
+                            "Number of files of a --batch that are compressed "
+                            "at the same time, sharing the threads. Default: "
+                            "1.",
+                            &batch_jobs, &ParseUnsigned, 1);
+
+    cmdline->AddOptionValue(
+        '\0', "trace", "FILE",
+        "Record the time spent in each stage of the library and write it to "
+        "FILE\n"
+        "    as Chrome trace JSON, e.g. for Perfetto. Requires a library built "
+        "with\n"
+        "    JPEGXL_ENABLE_TRACING.",
+        &trace, &ParseString, 2);
+
+    cmdline->AddOptionFlag(
+        '\0', "perf_counters",
+        "Also report the CPU cycles, instructions, cache misses and branch\n"
+        "    misses of each run, with Linux perf_event.",
+        &perf_counters, &SetBooleanTrue, 2);
+
     cmdline->AddOptionFlag('\0', "streaming_input",
                            "Enable streaming processing of the input file "
-                           "(works only for PPM and PGM input files).",
+                           "(works only for PPM, PGM, non-interlaced "
+                           "non-animated PNG and EXR input files).",
                            &streaming_input, &SetBooleanTrue, 3);
     cmdline->AddOptionFlag('\0', "streaming_output",
                            "Enable incremental writing of the output file.",
@@ -480,6 +527,10 @@ struct CompressArgs {
   size_t override_bitdepth = 0;
   size_t num_reps = 1;
   int32_t num_threads = -1;
+  std::string batch;
+  size_t batch_jobs = 1;
+  std::string trace;
+  bool perf_counters = false;
   float intensity_target = 0;
 
   // Whether to perform lossless transcoding with kVarDCT or kJPEG encoding.
@@ -497,6 +548,7 @@ struct CompressArgs {
   bool modular_lossy_palette = false;
   int64_t progressive_dc = -1;
   int64_t upsampling_mode = -1;
+  size_t pyramid_levels = 1;
   int32_t premultiply = -1;
   bool already_downsampled = false;
   jxl::Override jpeg_reconstruction_cfl = jxl::Override::kDefault;
@@ -563,6 +615,49 @@ std::string DistanceFromArgs(const CompressArgs& args) {
   return buf;
 }
 
+// Returns `path` with "_<level>" inserted before its extension.
+std::string PyramidLevelPath(const std::string& path, size_t level) {
+  size_t dot = path.find_last_of('.');
+  const size_t slash = path.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    dot = path.size();
+  }
+  return path.substr(0, dot) + "_" + std::to_string(level) + path.substr(dot);
+}
+
+// Encodes the levels of the pyramid after the full resolution one, each from
+// the previous level.
+jxl::Status EncodePyramidLevels(const CompressArgs& args,
+                                jxl::extras::JXLCompressParams params,
+                                const jxl::extras::PackedPixelFile& ppf,
+                                CommandLineParser& cmdline) {
+  // Each level is a file of its own.
+  params.output_processor = {};
+  jxl::extras::PackedPixelFile level_ppf;
+  const jxl::extras::PackedPixelFile* previous = &ppf;
+  for (size_t level = 1; level < args.pyramid_levels; ++level) {
+    JXL_ASSIGN_OR_RETURN(level_ppf,
+                         jxl::extras::DownsamplePackedPixelFile(*previous));
+    previous = &level_ppf;
+    std::vector<uint8_t> compressed;
+    if (!EncodeImageJXL(params, level_ppf, /*jpeg_bytes=*/nullptr,
+                        &compressed)) {
+      return JXL_FAILURE("Failed to encode pyramid level %" PRIuS, level);
+    }
+    if (args.file_out != nullptr && !args.disable_output) {
+      const std::string path = PyramidLevelPath(args.file_out, level);
+      if (!jpegxl::tools::WriteFile(path, compressed)) {
+        return JXL_FAILURE("Could not write %s", path.c_str());
+      }
+    }
+    cmdline.VerbosePrintf(1, "Pyramid level %" PRIuS ": %" PRIuS "x%" PRIuS
+                          ", %" PRIuS " bytes\n",
+                          level, level_ppf.xsize(), level_ppf.ysize(),
+                          compressed.size());
+  }
+  return true;
+}
+
 void PrintMode(jxl::extras::PackedPixelFile& ppf, const double decode_mps,
                size_t num_bytes, const CompressArgs& args,
                jpegxl::tools::CommandLineParser& cmdline) {
@@ -939,7 +1034,13 @@ void ProcessFlags(const jxl::extras::Codec codec,
       });
 }
 
+// Writes the output file on its own thread while the encoder goes on.
 struct JxlOutputProcessor {
+  JxlOutputProcessor()
+      : processor([this](uint64_t position, const uint8_t* data, size_t size) {
+          return Write(position, data, size);
+        }) {}
+
   bool SetOutputPath(const std::string& path) {
     outfile = jxl::make_unique<FileWrapper>(path, "wb");
     if (!*outfile) {
@@ -952,116 +1053,95 @@ struct JxlOutputProcessor {
     return true;
   }
 
-  JxlEncoderOutputProcessor GetOutputProcessor() {
-    return JxlEncoderOutputProcessor{
-        this, METHOD_TO_C_CALLBACK(&JxlOutputProcessor::GetBuffer),
-        METHOD_TO_C_CALLBACK(&JxlOutputProcessor::ReleaseBuffer),
-        METHOD_TO_C_CALLBACK(&JxlOutputProcessor::Seek),
-        METHOD_TO_C_CALLBACK(&JxlOutputProcessor::SetFinalizedPosition)};
-  }
-
-  void* GetBuffer(size_t* size) {
-    *size = std::min<size_t>(*size, 1u << 16);
-    if (output.size() < *size) {
-      output.resize(*size);
+  jxl::Status Write(uint64_t position, const uint8_t* data, size_t size) {
+    if (!outfile) return true;
+    if (position != file_position &&
+        fseek(*outfile, position, SEEK_SET) != 0) {
+      return JXL_FAILURE("Failed to seek output.");
     }
-    return output.data();
-  }
-
-  void ReleaseBuffer(size_t written_bytes) {
-    if (*outfile &&
-        fwrite(output.data(), 1, written_bytes, *outfile) != written_bytes) {
-      JXL_WARNING("Failed to write %" PRIuS " bytes to output", written_bytes);
-    }
-    output.clear();
-  }
-
-  void Seek(uint64_t position) {  // NOLINT
-    if (*outfile && fseek(*outfile, position, SEEK_SET) != 0) {
-      JXL_WARNING("Failed to seek output.");
+    if (fwrite(data, 1, size, *outfile) != size) {
+      return JXL_FAILURE("Failed to write %" PRIuS " bytes to output", size);
     }
+    file_position = position + size;
+    return true;
   }
 
-  void SetFinalizedPosition(uint64_t finalized_position) {
-    this->finalized_position = finalized_position;
-  }
-
-  std::vector<uint8_t> output;
-  size_t finalized_position = 0;
   std::unique_ptr<FileWrapper> outfile;
+  uint64_t file_position = 0;
+  // Declared last, so that its thread stops before the file is closed.
+  jxl::extras::AsyncOutputProcessor processor;
 };
 
-}  // namespace tools
-}  // namespace jpegxl
-
-int main(int argc, char** argv) {
-  std::string version = jpegxl::tools::CodecConfigString(JxlEncoderVersion());
-  jpegxl::tools::CompressArgs args;
-  jpegxl::tools::CommandLineParser cmdline;
-  args.AddCommandLineOptions(&cmdline);
-
-  if (!cmdline.Parse(argc, const_cast<const char**>(argv))) {
-    // Parse already printed the actual error cause.
-    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
-    return jpegxl::tools::CjxlRetCode::ERR_PARSE;
-  }
-
-  if (args.version) {
-    fprintf(stdout, "cjxl %s\n", version.c_str());
-    fprintf(stdout, "Copyright (c) the JPEG XL Project\n");
-    return jpegxl::tools::CjxlRetCode::OK;
-  }
-
-  if (!args.quiet) {
-    fprintf(stderr, "JPEG XL encoder %s\n", version.c_str());
-  }
-
-  if (cmdline.HelpFlagPassed() || !args.file_in) {
-    cmdline.PrintHelp();
-    return jpegxl::tools::CjxlRetCode::OK;
-  }
-
-  if (!args.file_out && !args.disable_output) {
-    std::cerr
-        << "No output file specified and --disable_output flag not passed.\n"
-        << std::flush;
-    exit(EXIT_FAILURE);
-  }
-
-  if (args.file_out && args.disable_output && !args.quiet) {
-    fprintf(stderr,
-            "Encoding will be performed, but the result will be discarded.\n");
-  }
-
+// Compresses args.file_in to args.file_out with `runner`, a
+// JxlThreadParallelRunner with `num_worker_threads` threads, and adds the
+// number of input pixels to *num_pixels.
+int CompressFile(CompressArgs args, CommandLineParser& cmdline, void* runner,
+                 size_t num_worker_threads, size_t* num_pixels) {
   jxl::extras::JXLCompressParams params;
+  // Declared before `ppf`, since its frame queue may still be decoding it.
+  std::vector<uint8_t> image_data;
   jxl::extras::PackedPixelFile ppf;
   jxl::extras::Codec codec = jxl::extras::Codec::kUnknown;
-  std::vector<uint8_t> image_data;
   std::vector<uint8_t>* jpeg_bytes = nullptr;
   size_t input_bytes = 0;
   double decode_mps = 0;
   size_t pixels = 0;
   bool try_non_streaming = true;
+  // The chunked decoders must outlive the encoding of `ppf`.
   jxl::extras::ChunkedPNMDecoder pnm_dec;
+  jxl::extras::ChunkedPNGDecoder png_dec;
+  jxl::extras::ChunkedEXRDecoder exr_dec;
   if (args.streaming_input) {
-    bool ok = [&]() -> jxl::Status {
+    const auto& color_hints = args.color_hints_proxy.target;
+    const auto init_pnm = [&]() -> jxl::Status {
       JXL_ASSIGN_OR_RETURN(pnm_dec,
                            jxl::extras::ChunkedPNMDecoder::Init(args.file_in));
+      JXL_RETURN_IF_ERROR(pnm_dec.InitializePPF(color_hints, &ppf));
+      codec = jxl::extras::Codec::kPNM;
+      return true;
+    };
+    const auto init_png = [&]() -> jxl::Status {
+      JXL_ASSIGN_OR_RETURN(png_dec,
+                           jxl::extras::ChunkedPNGDecoder::Init(args.file_in));
+      JXL_RETURN_IF_ERROR(png_dec.InitializePPF(color_hints, &ppf));
+      codec = jxl::extras::Codec::kPNG;
       return true;
-    }();
+    };
+    const auto init_exr = [&]() -> jxl::Status {
+      JXL_ASSIGN_OR_RETURN(exr_dec,
+                           jxl::extras::ChunkedEXRDecoder::Init(args.file_in));
+      JXL_RETURN_IF_ERROR(exr_dec.InitializePPF(color_hints, &ppf));
+      codec = jxl::extras::Codec::kEXR;
+      return true;
+    };
+    bool ok = init_pnm() ||
+              (jxl::extras::CanDecodeAPNG() && init_png()) ||
+              (jxl::extras::CanDecodeEXR() && init_exr());
     if (!ok) {
-      std::cerr << "Warning PPM/PGM streaming decoding failed, trying "
+      std::cerr << "Warning streaming decoding failed, trying "
                    "non-streaming mode.\n"
                 << std::flush;
+      ppf = jxl::extras::PackedPixelFile();
     } else {  // ok
-      JXL_RETURN_IF_ERROR(
-          pnm_dec.InitializePPF(args.color_hints_proxy.target, &ppf));
-      codec = jxl::extras::Codec::kPNM;
       args.lossless_jpeg = JXL_FALSE;
       pixels = ppf.info.xsize * ppf.info.ysize;
       try_non_streaming = false;
     }
   }
+  if (try_non_streaming && args.num_reps == 1 && args.frame_indexing.empty() &&
+      jxl::extras::CodecFromPath(args.file_in) == jxl::extras::Codec::kY4M) {
+    // Video frames are read from the file while the previous ones are
+    // encoded, instead of loading the whole sequence first.
+    if (!jxl::extras::DecodeY4MFilePipelined(
+            args.file_in, args.color_hints_proxy.target, &ppf)) {
+      std::cerr << "Getting pixel data failed.\n" << std::flush;
+      return EXIT_FAILURE;
+    }
+    codec = jxl::extras::Codec::kY4M;
+    args.lossless_jpeg = JXL_FALSE;
+    pixels = ppf.info.xsize * ppf.info.ysize;
+    try_non_streaming = false;
+  }
   if (try_non_streaming) {
     // Loading the input.
     // Depending on flags-settings, we want to either load a JPEG and
@@ -1070,28 +1150,36 @@ int main(int argc, char** argv) {
     jpegxl::tools::FileWrapper f(args.file_in, "rb");
     if (!f) {
       std::cerr << "Reading image data failed.\n" << std::flush;
-      exit(EXIT_FAILURE);
+      return EXIT_FAILURE;
     }
     if (!jpegxl::tools::ReadFile(f, &image_data)) {
       std::cerr << "Reading image data failed.\n" << std::flush;
-      exit(EXIT_FAILURE);
+      return EXIT_FAILURE;
     }
     input_bytes = image_data.size();
     if (!jpegxl::tools::IsJPG(image_data)) args.lossless_jpeg = JXL_FALSE;
     ProcessFlags(codec, ppf, jpeg_bytes, &cmdline, &args, &params);
     if (!FROM_JXL_BOOL(args.lossless_jpeg)) {
       const double t0 = jxl::Now();
-      jxl::Status status = jxl::extras::DecodeBytes(
-          jxl::Bytes(image_data), args.color_hints_proxy.target, &ppf, nullptr,
-          &codec);
+      // Animations are encoded while they are decoded, unless the frames are
+      // needed more than once or their number is needed up front.
+      const bool pipelined =
+          args.num_reps == 1 && args.frame_indexing.empty();
+      jxl::Status status =
+          pipelined ? jxl::extras::DecodeBytesPipelined(
+                          jxl::Bytes(image_data), args.color_hints_proxy.target,
+                          &ppf, nullptr, &codec)
+                    : jxl::extras::DecodeBytes(jxl::Bytes(image_data),
+                                               args.color_hints_proxy.target,
+                                               &ppf, nullptr, &codec);
 
       if (!status) {
         std::cerr << "Getting pixel data failed.\n" << std::flush;
-        exit(EXIT_FAILURE);
+        return EXIT_FAILURE;
       }
-      if (ppf.frames.empty()) {
+      if (ppf.frames.empty() && !ppf.frame_queue) {
         std::cerr << "No frames on input file.\n" << std::flush;
-        exit(EXIT_FAILURE);
+        return EXIT_FAILURE;
       }
       pixels = ppf.info.xsize * ppf.info.ysize;
       const double t1 = jxl::Now();
@@ -1106,9 +1194,8 @@ int main(int argc, char** argv) {
       }
       jpeg_bytes = &image_data;
       if (args.allow_jpeg_reconstruction) {
-        (void)args.color_hints_proxy.target.Foreach([](const std::string& key,
-                                                       const std::string& value)
-                                                        -> jxl::Status {
+        const auto check_strip = [](const std::string& key,
+                                    const std::string& value) -> jxl::Status {
           if (value.empty()) {
             if (key != "jumbf") {
               std::cerr
@@ -1117,17 +1204,29 @@ int main(int argc, char** argv) {
                      "Note that with that setting byte exact reconstruction "
                      "of the JPEG file won't be possible.\n"
                   << std::flush;
-              exit(EXIT_FAILURE);
+              return false;
             }
           }
           return true;
-        });
+        };
+        if (!args.color_hints_proxy.target.Foreach(check_strip)) {
+          return EXIT_FAILURE;
+        }
       }
     }
   }
 
   ProcessFlags(codec, ppf, jpeg_bytes, &cmdline, &args, &params);
 
+  if (args.pyramid_levels > 1 &&
+      (jpeg_bytes || !ppf.chunked_frames.empty() || ppf.frame_queue)) {
+    std::cerr << "--pyramid_levels needs the decoded pixels of the input, it "
+                 "cannot be used with --streaming_input nor with lossless "
+                 "JPEG transcoding.\n"
+              << std::flush;
+    return EXIT_FAILURE;
+  }
+
   if (!args.quiet) {
     PrintMode(ppf, decode_mps, input_bytes, args, cmdline);
   }
@@ -1155,15 +1254,8 @@ int main(int argc, char** argv) {
     }
   }
 
-  size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
-  int64_t flag_num_worker_threads = args.num_threads;
-  if (flag_num_worker_threads > -1) {
-    num_worker_threads = flag_num_worker_threads;
-  }
-  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(
-      /*memory_manager=*/nullptr, num_worker_threads);
   params.runner = JxlThreadParallelRunner;
-  params.runner_opaque = runner.get();
+  params.runner_opaque = runner;
 
   if (args.streaming_input) {
     params.options.emplace_back(JXL_ENC_FRAME_SETTING_BUFFERING,
@@ -1178,26 +1270,36 @@ int main(int argc, char** argv) {
         !output_processor.SetOutputPath(args.file_out)) {
       return EXIT_FAILURE;
     }
-    params.output_processor = output_processor.GetOutputProcessor();
+    params.output_processor = output_processor.processor.GetOutputProcessor();
   }
   std::vector<uint8_t> compressed;
   for (size_t num_rep = 0; num_rep < args.num_reps; ++num_rep) {
-    if (args.streaming_output) {
-      output_processor.Seek(0);
-      output_processor.SetFinalizedPosition(0);
+    if (args.streaming_output && !output_processor.processor.Reset()) {
+      fprintf(stderr, "Writing the output failed.\n");
+      return EXIT_FAILURE;
     }
     const double t0 = jxl::Now();
-    if (!EncodeImageJXL(params, ppf, jpeg_bytes,
-                        args.streaming_output ? nullptr : &compressed)) {
-      fprintf(stderr, "EncodeImageJXL() failed.\n");
-      return EXIT_FAILURE;
+    {
+      jpegxl::tools::ScopedPerfCounts perf_counts(&stats);
+      if (!EncodeImageJXL(params, ppf, jpeg_bytes,
+                          args.streaming_output ? nullptr : &compressed)) {
+        fprintf(stderr, "EncodeImageJXL() failed.\n");
+        return EXIT_FAILURE;
+      }
+      if (args.streaming_output && !output_processor.processor.Flush()) {
+        fprintf(stderr, "Writing the output failed.\n");
+        return EXIT_FAILURE;
+      }
     }
     const double t1 = jxl::Now();
     stats.NotifyElapsed(t1 - t0);
     stats.SetImageSize(ppf.info.xsize, ppf.info.ysize);
   }
+  const size_t num_frames =
+      ppf.num_frames() + (ppf.frame_queue ? ppf.frame_queue->num_frames() : 0);
+  *num_pixels += pixels * num_frames;
   size_t compressed_size = args.streaming_output
-                               ? output_processor.finalized_position
+                               ? output_processor.processor.finalized_position()
                                : compressed.size();
 
   if (!args.streaming_output && have_file_out && !args.disable_output) {
@@ -1206,6 +1308,11 @@ int main(int argc, char** argv) {
       return EXIT_FAILURE;
     }
   }
+  if (args.pyramid_levels > 1 &&
+      !EncodePyramidLevels(args, params, ppf, cmdline)) {
+    std::cerr << "Could not encode the pyramid levels.\n" << std::flush;
+    return EXIT_FAILURE;
+  }
   if (!args.quiet) {
     if (compressed_size < 100000) {
       cmdline.VerbosePrintf(0, "Compressed to %" PRIuS " bytes ",
@@ -1222,8 +1329,8 @@ int main(int argc, char** argv) {
     if (!FROM_JXL_BOOL(args.lossless_jpeg)) {
       const double bpp =
           static_cast<double>(compressed_size * jxl::kBitsPerByte) / pixels;
-      cmdline.VerbosePrintf(0, "(%.3f bpp%s).\n", bpp / ppf.num_frames(),
-                            ppf.num_frames() == 1 ? "" : "/frame");
+      cmdline.VerbosePrintf(0, "(%.3f bpp%s).\n", bpp / num_frames,
+                            num_frames == 1 ? "" : "/frame");
       JPEGXL_TOOLS_CHECK(stats.Print(num_worker_threads));
     } else {
       cmdline.VerbosePrintf(0, "\n");
@@ -1231,3 +1338,101 @@ int main(int argc, char** argv) {
   }
   return EXIT_SUCCESS;
 }
+
+}  // namespace tools
+}  // namespace jpegxl
+
+int main(int argc, char** argv) {
+  std::string version = jpegxl::tools::CodecConfigString(JxlEncoderVersion());
+  jpegxl::tools::CompressArgs args;
+  jpegxl::tools::CommandLineParser cmdline;
+  args.AddCommandLineOptions(&cmdline);
+
+  if (!cmdline.Parse(argc, const_cast<const char**>(argv))) {
+    // Parse already printed the actual error cause.
+    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
+    return jpegxl::tools::CjxlRetCode::ERR_PARSE;
+  }
+
+  if (args.version) {
+    fprintf(stdout, "cjxl %s\n", version.c_str());
+    fprintf(stdout, "Copyright (c) the JPEG XL Project\n");
+    return jpegxl::tools::CjxlRetCode::OK;
+  }
+
+  if (!args.quiet) {
+    fprintf(stderr, "JPEG XL encoder %s\n", version.c_str());
+  }
+
+  if (cmdline.HelpFlagPassed() || (!args.file_in && args.batch.empty())) {
+    cmdline.PrintHelp();
+    return jpegxl::tools::CjxlRetCode::OK;
+  }
+
+  if (!args.batch.empty() && args.file_in) {
+    std::cerr << "--batch can not be used together with INPUT and OUTPUT.\n"
+              << std::flush;
+    return jpegxl::tools::CjxlRetCode::ERR_INVALID_ARG;
+  }
+
+  if (args.batch.empty() && !args.file_out && !args.disable_output) {
+    std::cerr
+        << "No output file specified and --disable_output flag not passed.\n"
+        << std::flush;
+    exit(EXIT_FAILURE);
+  }
+
+  if ((args.file_out || !args.batch.empty()) && args.disable_output &&
+      !args.quiet) {
+    fprintf(stderr,
+            "Encoding will be performed, but the result will be discarded.\n");
+  }
+
+  size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+  int64_t flag_num_worker_threads = args.num_threads;
+  if (flag_num_worker_threads > -1) {
+    num_worker_threads = flag_num_worker_threads;
+  }
+
+  if (args.perf_counters && !jpegxl::tools::StartPerfCounters()) {
+    fprintf(stderr,
+            "Hardware performance counters are not available, see "
+            "/proc/sys/kernel/perf_event_paranoid.\n");
+    return EXIT_FAILURE;
+  }
+  if (!jpegxl::tools::StartTracing(args.trace)) return EXIT_FAILURE;
+  int status;
+  if (!args.batch.empty()) {
+    std::vector<jpegxl::tools::BatchJob> jobs;
+    if (!jpegxl::tools::ReadBatchManifest(args.batch, &jobs)) {
+      return jpegxl::tools::CjxlRetCode::ERR_LOAD_INPUT;
+    }
+    // The thread pools and the process-wide state, e.g. the CPU dispatch and
+    // the color management, are set up once for all the files.
+    jpegxl::tools::BatchRunner batch(num_worker_threads, args.batch_jobs);
+    const auto compress_job = [&](const jpegxl::tools::BatchJob& job,
+                                  void* runner, size_t* num_pixels) {
+      if (job.output.empty() && !args.disable_output) {
+        std::cerr << "No output file specified for " << job.input << ".\n"
+                  << std::flush;
+        return false;
+      }
+      jpegxl::tools::CompressArgs job_args = args;
+      job_args.file_in = job.input.c_str();
+      job_args.file_out = job.output.empty() ? nullptr : job.output.c_str();
+      return jpegxl::tools::CompressFile(job_args, cmdline, runner,
+                                         batch.threads_per_job(),
+                                         num_pixels) == EXIT_SUCCESS;
+    };
+    size_t num_failed = batch.Run(jobs, compress_job, args.quiet);
+    status = num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  } else {
+    JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(
+        /*memory_manager=*/nullptr, num_worker_threads);
+    size_t num_pixels = 0;
+    status = jpegxl::tools::CompressFile(args, cmdline, runner.get(),
+                                         num_worker_threads, &num_pixels);
+  }
+  if (!jpegxl::tools::FinishTracing(args.trace)) return EXIT_FAILURE;
+  return status;
+}
@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+# Copyright (c) the JPEG XL Project Authors. All rights reserved.
+#
+# Use of this source code is governed by a BSD-style
+# license that can be found in the LICENSE file.
+"""JPEG XL conformance corpus decoding performance runner.
+
+Tool to measure the decoding speed and peak memory of a decoder on the
+conformance corpus, and to compare them against a stored baseline.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+MPS_RE = re.compile(r'([0-9.]+) MP/s')
+
+
+def Failure(message):
+    print(f"\033[91m{message}\033[0m", flush=True)
+    return False
+
+
+def CorpusTests(corpus):
+    """Returns the corpus directory and the test ids of the corpus."""
+    # Like conformance.py, we can pass either the .txt file or the directory
+    # which defaults to the full corpus.
+    if os.path.isdir(corpus):
+        corpus_dir = corpus
+        corpus_txt = os.path.join(corpus, 'corpus.txt')
+    else:
+        corpus_dir = os.path.dirname(corpus)
+        corpus_txt = corpus
+    with open(corpus_txt, 'r') as f:
+        test_ids = [line.rstrip('\n') for line in f if line.strip()]
+    return corpus_dir, test_ids
+
+
+def RunDecoder(args, input_filename, num_threads):
+    """Decodes input_filename with num_threads threads.
+
+    Returns the median speed in MP/s reported by the decoder and the peak
+    resident memory in KiB of the decoder process, or None on failure.
+    """
+    cmd = [
+        args.decoder, input_filename, '--disable_output',
+        f'--num_reps={args.num_reps}', f'--num_threads={num_threads}'
+    ]
+    proc = subprocess.Popen(cmd,
+                            stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE,
+                            universal_newlines=True)
+    # Read the output before waiting, the decoder could block on a full pipe.
+    output = proc.stderr.read()
+    proc.stderr.close()
+    # The resource usage of this child only, not of all the children so far.
+    _, status, rusage = os.wait4(proc.pid, 0)
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    if proc.returncode != 0:
+        Failure(f"Running the decoder ({' '.join(cmd)}) returned error")
+        print(output, flush=True)
+        return None
+    match = MPS_RE.search(output)
+    if not match:
+        Failure(f"No speed in the decoder output: {output}")
+        return None
+    return {'mps': float(match.group(1)), 'peak_kib': rusage.ru_maxrss}
+
+
+def CheckRegression(test_id, num_threads, result, baseline, args):
+    """Compares a result against the baseline of the same test and threads."""
+    reference = baseline.get(test_id, {}).get(str(num_threads))
+    if reference is None:
+        print(f"{test_id}: no baseline for {num_threads} threads", flush=True)
+        return True
+    ok = True
+    min_mps = reference['mps'] * (1.0 - args.max_slowdown)
+    if result['mps'] < min_mps:
+        ok = Failure(f"{test_id}: {num_threads} threads: speed regressed: "
+                     f"{result['mps']:.3f} < {min_mps:.3f} MP/s "
+                     f"(baseline {reference['mps']:.3f})")
+    max_kib = reference['peak_kib'] * (1.0 + args.max_memory_growth)
+    if result['peak_kib'] > max_kib:
+        ok = Failure(f"{test_id}: {num_threads} threads: peak memory "
+                     f"regressed: {result['peak_kib']} > {max_kib:.0f} KiB "
+                     f"(baseline {reference['peak_kib']})")
+    return ok
+
+
+def PerformanceTestRunner(args):
+    ok = True
+    corpus_dir, test_ids = CorpusTests(args.corpus)
+    thread_counts = [int(t) for t in args.num_threads.split(',')]
+
+    baseline = {}
+    if args.baseline and not args.update_baseline:
+        with open(args.baseline, 'r') as f:
+            baseline = json.load(f)
+
+    results = {}
+    for test_id in test_ids:
+        print(f"\033[94m\033[1mMeasuring {test_id}\033[0m", flush=True)
+        input_filename = os.path.join(corpus_dir, test_id, 'input.jxl')
+        for num_threads in thread_counts:
+            result = RunDecoder(args, input_filename, num_threads)
+            if result is None:
+                ok = False
+                continue
+            print(f"{num_threads} threads: {result['mps']:.3f} MP/s, "
+                  f"peak memory {result['peak_kib']} KiB", flush=True)
+            results.setdefault(test_id, {})[str(num_threads)] = result
+            if baseline:
+                ok = ok & CheckRegression(test_id, num_threads, result,
+                                          baseline, args)
+
+    if args.update_baseline:
+        with open(args.baseline, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write('\n')
+    if args.results:
+        with open(args.results, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write('\n')
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--decoder',
+                        metavar='DECODER',
+                        required=True,
+                        help='path to the djxl binary under test.')
+    parser.add_argument(
+        '--corpus',
+        metavar='CORPUS',
+        required=True,
+        help=('path to the corpus directory or corpus descriptor'
+              ' text file.'))
+    parser.add_argument(
+        '--num_threads',
+        metavar='N[,N...]',
+        default=f'1,{os.cpu_count() or 1}',
+        help='comma-separated thread counts to decode each sample with.')
+    parser.add_argument('--num_reps',
+                        metavar='N',
+                        type=int,
+                        default=5,
+                        help='number of decodes per sample and thread count.')
+    parser.add_argument(
+        '--baseline',
+        metavar='BASELINE',
+        help='JSON file with the results to compare against.')
+    parser.add_argument(
+        '--update_baseline', action='store_true',
+        help='If set, writes the results to the baseline file instead.')
+    parser.add_argument('--results',
+                        metavar='RESULTS',
+                        help='JSON file to write the results to.')
+    parser.add_argument(
+        '--max_slowdown',
+        type=float,
+        default=0.1,
+        help='largest tolerated fraction of speed lost against the baseline.')
+    parser.add_argument(
+        '--max_memory_growth',
+        type=float,
+        default=0.1,
+        help=('largest tolerated fraction of peak memory gained against the'
+              ' baseline.'))
+    args = parser.parse_args()
+    if args.update_baseline and not args.baseline:
+        parser.error('--update_baseline requires --baseline')
+    if not PerformanceTestRunner(args):
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
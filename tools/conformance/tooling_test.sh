@@ -55,6 +55,22 @@ main() {
   "${MYDIR}/conformance.py" \
     --decoder="${decoder}" \
     --corpus="${tmpdir}"
+
+  # The performance runner must accept a baseline it has written itself.
+  local baseline="${tmpdir}/baseline.json"
+  "${MYDIR}/performance.py" \
+    --decoder="${decoder}" \
+    --corpus="${tmpdir}" \
+    --num_reps=1 \
+    --baseline="${baseline}" \
+    --update_baseline
+  "${MYDIR}/performance.py" \
+    --decoder="${decoder}" \
+    --corpus="${tmpdir}" \
+    --num_reps=1 \
+    --baseline="${baseline}" \
+    --max_slowdown=1 \
+    --max_memory_growth=10
 }
 
 main "$@"
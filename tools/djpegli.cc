@@ -42,6 +42,12 @@ struct Args {
                             "or 16. Has no impact on PFM output.",
                             &bitdepth, &ParseUnsigned);
 
+    cmdline->AddOptionFlag('\0', "xyb_to_srgb",
+                           "Converts the images of cjpegli --xyb to sRGB in "
+                           "the decoder instead of keeping their XYB ICC "
+                           "profile, which is faster.",
+                           &xyb_to_srgb, &SetBooleanTrue);
+
     cmdline->AddOptionValue('\0', "num_reps", "N",
                             "Sets the number of times to decompress the image. "
                             "Used for benchmarking, the default is 1.",
@@ -55,6 +61,7 @@ struct Args {
   const char* file_out = nullptr;
   bool disable_output = false;
   size_t bitdepth = 8;
+  bool xyb_to_srgb = false;
   size_t num_reps = 1;
   bool quiet = false;
 };
@@ -76,6 +83,7 @@ void SetDecompressParams(const Args& args, const std::string& extension,
     params->output_data_type = JXL_TYPE_UINT16;
     params->output_endianness = JXL_BIG_ENDIAN;
   }
+  params->xyb_to_srgb = args.xyb_to_srgb;
   if (extension == ".pgm") {
     params->force_grayscale = true;
   } else if (extension == ".ppm") {
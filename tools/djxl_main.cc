@@ -25,13 +25,19 @@
 #include "lib/extras/dec/jxl.h"
 #include "lib/extras/enc/encode.h"
 #include "lib/extras/enc/jpg.h"
+#include "lib/extras/mmap.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/time.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/span.h"
+#include "lib/jxl/base/status.h"
+#include "tools/batch.h"
 #include "tools/cmdline.h"
 #include "tools/codec_config.h"
 #include "tools/file_io.h"
 #include "tools/speed_stats.h"
+#include "tools/tracing.h"
 
 namespace jpegxl {
 namespace tools {
@@ -143,6 +149,34 @@ struct DecompressArgs {
                             "Useful for benchmarking. Default is 1.",
                             &num_reps, &ParseUnsigned, 2);
 
+    cmdline->AddOptionValue(
+        '\0', "batch", "MANIFEST",
+        "Decompress all the files listed in MANIFEST instead of INPUT to "
+        "OUTPUT.\n"
+        "    Each line holds an input and an output path, separated by a tab "
+        "or a space.",
+        &batch, &ParseString, 2);
+    cmdline->AddOptionValue('\0', "batch_jobs", "N",
+                            "Number of files of a --batch that are "
+                            "decompressed at the same time, sharing the "
+                            "threads. Default: 1.",
+                            &batch_jobs, &ParseUnsigned, 2);
+
+    cmdline->AddOptionValue(
+        '\0', "trace", "FILE",
+        "Record the time spent in each stage of the library and write it to "
+        "FILE\n"
+        "    as Chrome trace JSON, e.g. for Perfetto. Requires a library built "
+        "with\n"
+        "    JPEGXL_ENABLE_TRACING.",
+        &trace, &ParseString, 2);
+
+    cmdline->AddOptionFlag(
+        '\0', "perf_counters",
+        "Also report the CPU cycles, instructions, cache misses and branch\n"
+        "    misses of each run, with Linux perf_event.",
+        &perf_counters, &SetBooleanTrue, 2);
+
     cmdline->AddOptionFlag('\0', "disable_output",
                            "No output file will be written (for benchmarking)",
                            &disable_output, &SetBooleanTrue, 2);
@@ -239,6 +273,10 @@ struct DecompressArgs {
   bool version = false;
   bool verbose = false;
   size_t num_reps = 1;
+  std::string batch;
+  size_t batch_jobs = 1;
+  std::string trace;
+  bool perf_counters = false;
   bool disable_output = false;
   int32_t num_threads = -1;
   int bits_per_sample = -1;
@@ -346,14 +384,16 @@ bool ParseBackgroundColor(const std::string& background_desc,
 }
 
 bool DecompressJxlReconstructJPEG(const jpegxl::tools::DecompressArgs& args,
-                                  const std::vector<uint8_t>& compressed,
+                                  jxl::Span<const uint8_t> compressed,
                                   void* runner,
                                   std::vector<uint8_t>* jpeg_bytes,
                                   jpegxl::tools::SpeedStats* stats) {
   const double t0 = jxl::Now();
+  jpegxl::tools::ScopedPerfCounts perf_counts(stats);
   jxl::extras::PackedPixelFile ppf;  // for JxlBasicInfo
   jxl::extras::JXLDecompressParams dparams;
   dparams.allow_partial_input = args.allow_partial_files;
+  dparams.persistent_input = true;
   dparams.runner = JxlThreadParallelRunner;
   dparams.runner_opaque = runner;
   if (!jxl::extras::DecodeImageJXL(compressed.data(), compressed.size(),
@@ -371,11 +411,13 @@ bool DecompressJxlReconstructJPEG(const jpegxl::tools::DecompressArgs& args,
 
 bool DecompressJxlToPackedPixelFile(
     const jpegxl::tools::DecompressArgs& args,
-    const std::vector<uint8_t>& compressed,
+    jxl::Span<const uint8_t> compressed,
     const std::vector<JxlPixelFormat>& accepted_formats, void* runner,
     jxl::extras::PackedPixelFile* ppf, size_t* decoded_bytes,
-    jpegxl::tools::SpeedStats* stats) {
+    jpegxl::tools::SpeedStats* stats,
+    jxl::extras::JXLRowOutput* row_output = nullptr) {
   jxl::extras::JXLDecompressParams dparams;
+  dparams.row_output = row_output;
   dparams.max_downsampling = args.downsampling;
   dparams.accepted_formats = accepted_formats;
   dparams.display_nits = args.display_nits;
@@ -384,6 +426,7 @@ bool DecompressJxlToPackedPixelFile(
   dparams.runner = JxlThreadParallelRunner;
   dparams.runner_opaque = runner;
   dparams.allow_partial_input = args.allow_partial_files;
+  dparams.persistent_input = true;
   if (args.bits_per_sample == 0) {
     dparams.output_bitdepth.type = JXL_BIT_DEPTH_FROM_CODESTREAM;
   } else if (args.bits_per_sample > 0) {
@@ -391,9 +434,12 @@ bool DecompressJxlToPackedPixelFile(
     dparams.output_bitdepth.bits_per_sample = args.bits_per_sample;
   }
   const double t0 = jxl::Now();
-  if (!jxl::extras::DecodeImageJXL(compressed.data(), compressed.size(),
-                                   dparams, decoded_bytes, ppf)) {
-    return false;
+  {
+    jpegxl::tools::ScopedPerfCounts perf_counts(stats);
+    if (!jxl::extras::DecodeImageJXL(compressed.data(), compressed.size(),
+                                     dparams, decoded_bytes, ppf)) {
+      return false;
+    }
   }
   const double t1 = jxl::Now();
   if (stats) {
@@ -403,43 +449,85 @@ bool DecompressJxlToPackedPixelFile(
   return true;
 }
 
-}  // namespace
-
-int main(int argc, const char* argv[]) {
-  std::string version = jpegxl::tools::CodecConfigString(JxlDecoderVersion());
-  jpegxl::tools::DecompressArgs args;
-  jpegxl::tools::CommandLineParser cmdline;
-  args.AddCommandLineOptions(&cmdline);
-
-  if (!cmdline.Parse(argc, argv)) {
-    // Parse already printed the actual error cause.
-    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
-    return EXIT_FAILURE;
-  }
-
-  if (args.version) {
-    fprintf(stdout, "djxl %s\n", version.c_str());
-    fprintf(stdout, "Copyright (c) the JPEG XL Project\n");
-    return EXIT_SUCCESS;
-  }
-  if (!args.quiet) {
-    fprintf(stderr, "JPEG XL decoder %s\n", version.c_str());
+// Writes the decoded rows to the output file as they are decoded, through a
+// row encoder, instead of encoding the whole image at the end.
+class RowFileWriter : public jxl::extras::JXLRowOutput {
+ public:
+  RowFileWriter(jxl::extras::RowEncoder* encoder,
+                const jxl::extras::PackedMetadata& metadata, FILE* file)
+      : encoder_(encoder), metadata_(metadata), file_(file) {}
+
+  jxl::Status Start(const jxl::extras::PackedPixelFile& ppf,
+                    const JxlPixelFormat& format) override {
+    // The metadata boxes can follow the codestream, so they are taken from a
+    // metadata-only pass over the input instead.
+    jxl::extras::PackedPixelFile header;
+    header.info = ppf.info;
+    header.color_encoding = ppf.color_encoding;
+    header.icc = ppf.icc;
+    header.primary_color_representation = ppf.primary_color_representation;
+    header.metadata = metadata_;
+    JXL_RETURN_IF_ERROR(encoder_->StartImage(header, format, &bytes_));
+    return Flush();
+  }
+
+  jxl::Status AddRow(const uint8_t* row) override {
+    JXL_RETURN_IF_ERROR(encoder_->AddRow(row, &bytes_));
+    return Flush();
+  }
+
+  jxl::Status Finish() {
+    JXL_RETURN_IF_ERROR(encoder_->Finish(&bytes_));
+    return Flush();
+  }
+
+ private:
+  jxl::Status Flush() {
+    if (fwrite(bytes_.data(), 1, bytes_.size(), file_) != bytes_.size()) {
+      return JXL_FAILURE("Could not write to file");
+    }
+    bytes_.clear();
+    return true;
   }
 
-  if (cmdline.HelpFlagPassed() || !args.file_in) {
-    cmdline.PrintHelp();
-    return EXIT_SUCCESS;
-  }
+  jxl::extras::RowEncoder* encoder_;
+  const jxl::extras::PackedMetadata& metadata_;
+  FILE* file_;
+  std::vector<uint8_t> bytes_;
+};
 
-  if (!args.ValidateArgs(cmdline)) {
-    // ValidateArgs already printed the actual error cause.
-    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
-    return EXIT_FAILURE;
+// Maps the input file in memory, so that only the parts of it that are
+// decoded are read, or reads it whole if it cannot be mapped (e.g. stdin).
+bool LoadInput(const char* file_in, jxl::MemoryMappedFile* mapped_file,
+               std::vector<uint8_t>* buffer,
+               jxl::Span<const uint8_t>* compressed) {
+  if (strcmp(file_in, "-") != 0) {
+    const auto map_file = [&]() -> jxl::Status {
+      JXL_ASSIGN_OR_RETURN(*mapped_file, jxl::MemoryMappedFile::Init(file_in));
+      return true;
+    };
+    if (map_file() && mapped_file->size() > 0) {
+      *compressed = jxl::Bytes(mapped_file->data(), mapped_file->size());
+      return true;
+    }
   }
+  if (!jpegxl::tools::ReadFile(file_in, buffer)) return false;
+  *compressed = jxl::Bytes(*buffer);
+  return true;
+}
 
-  std::vector<uint8_t> compressed;
+// Decompresses args.file_in to args.file_out with `runner`, a
+// JxlThreadParallelRunner with `num_worker_threads` threads, and adds the
+// number of decoded pixels to *num_pixels.
+int DecompressFile(jpegxl::tools::DecompressArgs args,
+                   const jpegxl::tools::CommandLineParser& cmdline,
+                   void* runner, size_t num_worker_threads,
+                   size_t* num_pixels) {
+  jxl::MemoryMappedFile mapped_file;
+  std::vector<uint8_t> buffer;
+  jxl::Span<const uint8_t> compressed;
   // Reading compressed JPEG XL input
-  if (!jpegxl::tools::ReadFile(args.file_in, &compressed)) {
+  if (!LoadInput(args.file_in, &mapped_file, &buffer, &compressed)) {
     fprintf(stderr, "couldn't load %s\n", args.file_in);
     return EXIT_FAILURE;
   }
@@ -448,18 +536,6 @@ int main(int argc, const char* argv[]) {
                           compressed.size());
   }
 
-  if (!args.file_out && !args.disable_output) {
-    std::cerr
-        << "No output file specified and --disable_output flag not passed.\n"
-        << std::flush;
-    return EXIT_FAILURE;
-  }
-
-  if (args.file_out && args.disable_output && !args.quiet) {
-    fprintf(stderr,
-            "Decoding will be performed, but the result will be discarded.\n");
-  }
-
   std::string filename_out;
   std::string extension;
   if (!args.output_format.empty()) extension = "." + args.output_format;
@@ -483,15 +559,6 @@ int main(int argc, const char* argv[]) {
   }
 
   jpegxl::tools::SpeedStats stats;
-  size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
-  {
-    int64_t flag_num_worker_threads = args.num_threads;
-    if (flag_num_worker_threads > -1) {
-      num_worker_threads = flag_num_worker_threads;
-    }
-  }
-  auto runner = JxlThreadParallelRunnerMake(
-      /*memory_manager=*/nullptr, num_worker_threads);
 
   bool decode_to_pixels = (codec != jxl::extras::Codec::kJPG);
   if (args.opt_jpeg_quality_id >= 0 &&
@@ -504,7 +571,7 @@ int main(int argc, const char* argv[]) {
   if (!decode_to_pixels) {
     std::vector<uint8_t> bytes;
     for (size_t i = 0; i < num_reps; ++i) {
-      if (!DecompressJxlReconstructJPEG(args, compressed, runner.get(), &bytes,
+      if (!DecompressJxlReconstructJPEG(args, compressed, runner, &bytes,
                                         &stats)) {
         if (bytes.empty()) {
           if (!args.quiet) {
@@ -556,70 +623,136 @@ int main(int argc, const char* argv[]) {
         }
       }
     }
-    jxl::extras::PackedPixelFile ppf;
-    size_t decoded_bytes = 0;
-    for (size_t i = 0; i < num_reps; ++i) {
-      if (!DecompressJxlToPackedPixelFile(args, compressed, accepted_formats,
-                                          runner.get(), &ppf, &decoded_bytes,
-                                          &stats)) {
+    // Still images without extra channels are written row by row while they
+    // are decoded, when the output format allows it and nothing else needs
+    // the whole image.
+    std::unique_ptr<jxl::extras::RowEncoder> row_encoder;
+    if (encoder && num_reps == 1 && !args.alpha_blend &&
+        !args.allow_partial_files && args.downsampling <= 1 &&
+        args.preview_out.empty() && args.metadata_out.empty()) {
+      row_encoder = encoder->CreateRowEncoder();
+    }
+    jxl::extras::PackedPixelFile metadata_ppf;
+    if (row_encoder) {
+      if (!DecompressJxlToPackedPixelFile(args, compressed, {}, runner,
+                                          &metadata_ppf, nullptr, nullptr)) {
         fprintf(stderr, "DecompressJxlToPackedPixelFile failed\n");
         return EXIT_FAILURE;
       }
-    }
-    if (!args.quiet) cmdline.VerbosePrintf(0, "Decoded to pixels.\n");
-    if (args.print_read_bytes) {
-      fprintf(stderr, "Decoded bytes: %" PRIuS "\n", decoded_bytes);
-    }
-    // When --disable_output was parsed, `filename_out` is empty and we don't
-    // need to write files.
-    if (encoder) {
-      if (args.alpha_blend) {
-        float background[3];
-        if (!ParseBackgroundColor(args.background_spec, background)) {
-          fprintf(stderr, "Invalid background color %s\n",
-                  args.background_spec.c_str());
-        }
-        if (!AlphaBlend(&ppf, background)) {
-          fprintf(stderr, "AlphaBlend failed\n");
-          return EXIT_FAILURE;
+      // An alpha channel that the output format can not interleave is decoded
+      // as an extra channel.
+      bool accepts_alpha = false;
+      for (const JxlPixelFormat& format : accepted_formats) {
+        if (format.num_channels == 2 || format.num_channels == 4) {
+          accepts_alpha = true;
         }
       }
-      std::ostringstream os;
-      os << args.jpeg_quality;
-      encoder->SetOption("q", os.str());
-      if (args.use_sjpeg) {
-        encoder->SetOption("jpeg_encoder", "sjpeg");
+      const JxlBasicInfo& info = metadata_ppf.info;
+      const uint32_t num_alpha =
+          (info.alpha_bits != 0 && accepts_alpha) ? 1 : 0;
+      if (info.have_animation || info.num_extra_channels > num_alpha) {
+        row_encoder.reset();
       }
-      jxl::extras::EncodedImage encoded_image;
-      if (!args.quiet) cmdline.VerbosePrintf(2, "Encoding decoded image\n");
-      if (!encoder->Encode(ppf, &encoded_image, nullptr)) {
-        fprintf(stderr, "Encode failed\n");
+    }
+    if (row_encoder) {
+      jpegxl::tools::FileWrapper file(filename_out, "wb");
+      if (!file) {
+        fprintf(stderr, "Could not open %s for writing\n",
+                filename_out.c_str());
         return EXIT_FAILURE;
       }
-      size_t nlayers = args.output_extra_channels
-                           ? 1 + encoded_image.extra_channel_bitstreams.size()
-                           : 1;
-      size_t nframes = args.output_frames ? encoded_image.bitstreams.size() : 1;
-      for (size_t i = 0; i < nlayers; ++i) {
-        for (size_t j = 0; j < nframes; ++j) {
-          const std::vector<uint8_t>& bitstream =
-              (i == 0 ? encoded_image.bitstreams[j]
-                      : encoded_image.extra_channel_bitstreams[i - 1][j]);
-          std::string fn =
-              Filename(filename_out, extension, i, j, nlayers, nframes);
-          if (!jpegxl::tools::WriteFile(fn, bitstream)) {
+      RowFileWriter writer(row_encoder.get(), metadata_ppf.metadata, file);
+      jxl::extras::PackedPixelFile ppf;
+      size_t decoded_bytes = 0;
+      if (!DecompressJxlToPackedPixelFile(args, compressed, accepted_formats,
+                                          runner, &ppf, &decoded_bytes,
+                                          &stats, &writer) ||
+          !writer.Finish()) {
+        fprintf(stderr, "DecompressJxlToPackedPixelFile failed\n");
+        return EXIT_FAILURE;
+      }
+      *num_pixels += static_cast<size_t>(ppf.info.xsize) * ppf.info.ysize;
+      if (!args.quiet) {
+        cmdline.VerbosePrintf(0, "Decoded to pixels.\n");
+        cmdline.VerbosePrintf(1, "Wrote output to %s\n", filename_out.c_str());
+      }
+      if (args.print_read_bytes) {
+        fprintf(stderr, "Decoded bytes: %" PRIuS "\n", decoded_bytes);
+      }
+      if (!WriteOptionalOutput(args.icc_out, ppf.icc) ||
+          !WriteOptionalOutput(args.orig_icc_out, ppf.orig_icc)) {
+        return EXIT_FAILURE;
+      }
+    } else {
+      jxl::extras::PackedPixelFile ppf;
+      size_t decoded_bytes = 0;
+      for (size_t i = 0; i < num_reps; ++i) {
+        if (!DecompressJxlToPackedPixelFile(args, compressed, accepted_formats,
+                                            runner, &ppf, &decoded_bytes,
+                                            &stats)) {
+          fprintf(stderr, "DecompressJxlToPackedPixelFile failed\n");
+          return EXIT_FAILURE;
+        }
+      }
+      *num_pixels += static_cast<size_t>(ppf.info.xsize) * ppf.info.ysize *
+                     ppf.num_frames();
+      if (!args.quiet) cmdline.VerbosePrintf(0, "Decoded to pixels.\n");
+      if (args.print_read_bytes) {
+        fprintf(stderr, "Decoded bytes: %" PRIuS "\n", decoded_bytes);
+      }
+      // When --disable_output was parsed, `filename_out` is empty and we don't
+      // need to write files.
+      if (encoder) {
+        if (args.alpha_blend) {
+          float background[3];
+          if (!ParseBackgroundColor(args.background_spec, background)) {
+            fprintf(stderr, "Invalid background color %s\n",
+                    args.background_spec.c_str());
+          }
+          if (!AlphaBlend(&ppf, background)) {
+            fprintf(stderr, "AlphaBlend failed\n");
             return EXIT_FAILURE;
           }
-          if (!args.quiet)
-            cmdline.VerbosePrintf(1, "Wrote output to %s\n", fn.c_str());
         }
-      }
-      if (!WriteOptionalOutput(args.preview_out,
-                               encoded_image.preview_bitstream) ||
-          !WriteOptionalOutput(args.icc_out, ppf.icc) ||
-          !WriteOptionalOutput(args.orig_icc_out, ppf.orig_icc) ||
-          !WriteOptionalOutput(args.metadata_out, encoded_image.metadata)) {
-        return EXIT_FAILURE;
+        std::ostringstream os;
+        os << args.jpeg_quality;
+        encoder->SetOption("q", os.str());
+        if (args.use_sjpeg) {
+          encoder->SetOption("jpeg_encoder", "sjpeg");
+        }
+        jxl::extras::EncodedImage encoded_image;
+        if (!args.quiet) cmdline.VerbosePrintf(2, "Encoding decoded image\n");
+        jxl::ThreadPool pool(JxlThreadParallelRunner, runner);
+        if (!encoder->Encode(ppf, &encoded_image, &pool)) {
+          fprintf(stderr, "Encode failed\n");
+          return EXIT_FAILURE;
+        }
+        size_t nlayers = args.output_extra_channels
+                             ? 1 + encoded_image.extra_channel_bitstreams.size()
+                             : 1;
+        size_t nframes =
+            args.output_frames ? encoded_image.bitstreams.size() : 1;
+        for (size_t i = 0; i < nlayers; ++i) {
+          for (size_t j = 0; j < nframes; ++j) {
+            const std::vector<uint8_t>& bitstream =
+                (i == 0 ? encoded_image.bitstreams[j]
+                        : encoded_image.extra_channel_bitstreams[i - 1][j]);
+            std::string fn =
+                Filename(filename_out, extension, i, j, nlayers, nframes);
+            if (!jpegxl::tools::WriteFile(fn, bitstream)) {
+              return EXIT_FAILURE;
+            }
+            if (!args.quiet)
+              cmdline.VerbosePrintf(1, "Wrote output to %s\n", fn.c_str());
+          }
+        }
+        if (!WriteOptionalOutput(args.preview_out,
+                                 encoded_image.preview_bitstream) ||
+            !WriteOptionalOutput(args.icc_out, ppf.icc) ||
+            !WriteOptionalOutput(args.orig_icc_out, ppf.orig_icc) ||
+            !WriteOptionalOutput(args.metadata_out, encoded_image.metadata)) {
+          return EXIT_FAILURE;
+        }
       }
     }
   }
@@ -629,3 +762,107 @@ int main(int argc, const char* argv[]) {
 
   return EXIT_SUCCESS;
 }
+
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  std::string version = jpegxl::tools::CodecConfigString(JxlDecoderVersion());
+  jpegxl::tools::DecompressArgs args;
+  jpegxl::tools::CommandLineParser cmdline;
+  args.AddCommandLineOptions(&cmdline);
+
+  if (!cmdline.Parse(argc, argv)) {
+    // Parse already printed the actual error cause.
+    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (args.version) {
+    fprintf(stdout, "djxl %s\n", version.c_str());
+    fprintf(stdout, "Copyright (c) the JPEG XL Project\n");
+    return EXIT_SUCCESS;
+  }
+  if (!args.quiet) {
+    fprintf(stderr, "JPEG XL decoder %s\n", version.c_str());
+  }
+
+  if (cmdline.HelpFlagPassed() || (!args.file_in && args.batch.empty())) {
+    cmdline.PrintHelp();
+    return EXIT_SUCCESS;
+  }
+
+  if (!args.ValidateArgs(cmdline)) {
+    // ValidateArgs already printed the actual error cause.
+    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (!args.batch.empty() && args.file_in) {
+    fprintf(stderr,
+            "--batch can not be used together with INPUT and OUTPUT.\n");
+    return EXIT_FAILURE;
+  }
+
+  if (args.batch.empty() && !args.file_out && !args.disable_output) {
+    std::cerr
+        << "No output file specified and --disable_output flag not passed.\n"
+        << std::flush;
+    return EXIT_FAILURE;
+  }
+
+  if ((args.file_out || !args.batch.empty()) && args.disable_output &&
+      !args.quiet) {
+    fprintf(stderr,
+            "Decoding will be performed, but the result will be discarded.\n");
+  }
+
+  size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+  {
+    int64_t flag_num_worker_threads = args.num_threads;
+    if (flag_num_worker_threads > -1) {
+      num_worker_threads = flag_num_worker_threads;
+    }
+  }
+
+  if (args.perf_counters && !jpegxl::tools::StartPerfCounters()) {
+    fprintf(stderr,
+            "Hardware performance counters are not available, see "
+            "/proc/sys/kernel/perf_event_paranoid.\n");
+    return EXIT_FAILURE;
+  }
+  if (!jpegxl::tools::StartTracing(args.trace)) return EXIT_FAILURE;
+  int status;
+  if (!args.batch.empty()) {
+    std::vector<jpegxl::tools::BatchJob> jobs;
+    if (!jpegxl::tools::ReadBatchManifest(args.batch, &jobs)) {
+      return EXIT_FAILURE;
+    }
+    // The thread pools and the process-wide state, e.g. the CPU dispatch and
+    // the color management, are set up once for all the files.
+    jpegxl::tools::BatchRunner batch(num_worker_threads, args.batch_jobs);
+    const auto decompress_job = [&](const jpegxl::tools::BatchJob& job,
+                                    void* runner, size_t* num_pixels) {
+      if (job.output.empty() && !args.disable_output) {
+        fprintf(stderr, "No output file specified for %s.\n",
+                job.input.c_str());
+        return false;
+      }
+      jpegxl::tools::DecompressArgs job_args = args;
+      job_args.file_in = job.input.c_str();
+      job_args.file_out = job.output.empty() ? nullptr : job.output.c_str();
+      return DecompressFile(job_args, cmdline, runner,
+                            batch.threads_per_job(),
+                            num_pixels) == EXIT_SUCCESS;
+    };
+    size_t num_failed = batch.Run(jobs, decompress_job, args.quiet);
+    status = num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  } else {
+    auto runner = JxlThreadParallelRunnerMake(
+        /*memory_manager=*/nullptr, num_worker_threads);
+    size_t num_pixels = 0;
+    status = DecompressFile(args, cmdline, runner.get(), num_worker_threads,
+                            &num_pixels);
+  }
+  if (!jpegxl::tools::FinishTracing(args.trace)) return EXIT_FAILURE;
+  return status;
+}
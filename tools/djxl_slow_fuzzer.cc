@@ -0,0 +1,131 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Fuzzer looking for inputs that are slow to decode rather than for crashes:
+// it aborts when the decoding takes longer than a budget proportional to the
+// size of the input and of the decoded frames, e.g. because of pathological
+// MA trees, splines or patches.
+
+#include <jxl/codestream_header.h>
+#include <jxl/decode.h>
+#include <jxl/decode_cxx.h>
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/fuzztest.h"
+
+namespace {
+
+// Larger images are skipped, their decoding time is not interesting.
+constexpr uint64_t kMaxPixels = 1 << 22;
+
+// The budget is generous enough for builds with sanitizers, which are about
+// ten times slower than the usual decoding speed.
+constexpr double kFixedSeconds = 0.5;
+constexpr double kSecondsPerByte = 2e-6;
+constexpr double kSecondsPerPixel = 2e-6;
+
+constexpr size_t kNumBudgetBuckets = 16;
+
+#if defined(__linux__) && defined(__clang__)
+// libFuzzer treats these as additional coverage, so that the inputs getting
+// closer to the budget are kept in the corpus.
+__attribute__((used, section("__libfuzzer_extra_counters")))
+uint8_t budget_counters[kNumBudgetBuckets];
+#else
+uint8_t budget_counters[kNumBudgetBuckets];
+#endif
+
+// Decodes all the frames on the calling thread, so that the time does not
+// depend on the number of cores. `num_pixels` is the size of all the frames
+// that started decoding. Returns false if the input is rejected.
+bool DecodeAllFrames(const uint8_t* data, size_t size, uint64_t* num_pixels) {
+  auto dec = JxlDecoderMake(nullptr);
+  if (JXL_DEC_SUCCESS !=
+      JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO | JXL_DEC_FRAME |
+                                               JXL_DEC_FULL_IMAGE)) {
+    return false;
+  }
+  JxlDecoderSetInput(dec.get(), data, size);
+  JxlDecoderCloseInput(dec.get());
+  JxlBasicInfo info;
+  const JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_BASIC_INFO) {
+      if (JXL_DEC_SUCCESS != JxlDecoderGetBasicInfo(dec.get(), &info)) {
+        return false;
+      }
+      if (static_cast<uint64_t>(info.xsize) * info.ysize > kMaxPixels) {
+        return false;
+      }
+    } else if (status == JXL_DEC_FRAME) {
+      *num_pixels += static_cast<uint64_t>(info.xsize) * info.ysize;
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      size_t buffer_size;
+      if (JXL_DEC_SUCCESS !=
+          JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size)) {
+        return false;
+      }
+      pixels.resize(buffer_size);
+      if (JXL_DEC_SUCCESS != JxlDecoderSetImageOutBuffer(dec.get(), &format,
+                                                         pixels.data(),
+                                                         pixels.size())) {
+        return false;
+      }
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      continue;
+    } else if (status == JXL_DEC_SUCCESS) {
+      return true;
+    } else {
+      return false;
+    }
+  }
+}
+
+int DoTestOneInput(const uint8_t* data, size_t size) {
+  uint64_t num_pixels = 0;
+  const auto start = std::chrono::steady_clock::now();
+  const bool decoded = DecodeAllFrames(data, size, &num_pixels);
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  const double budget = kFixedSeconds + kSecondsPerByte * size +
+                        kSecondsPerPixel * static_cast<double>(num_pixels);
+  const size_t bucket = std::min(
+      kNumBudgetBuckets - 1, static_cast<size_t>(seconds / budget *
+                                                 (kNumBudgetBuckets - 1)));
+  budget_counters[bucket]++;
+  if (seconds > budget) {
+    fprintf(stderr,
+            "Decoding %s after %.3f s, over the budget of %.3f s for %" PRIuS
+            " bytes and %.0f pixels.\n",
+            decoded ? "succeeded" : "failed", seconds, budget, size,
+            static_cast<double>(num_pixels));
+    abort();
+  }
+  return 0;
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  return DoTestOneInput(data, size);
+}
+
+void TestOneInput(const std::vector<uint8_t>& data) {
+  DoTestOneInput(data.data(), data.size());
+}
+
+FUZZ_TEST(DjxlSlowFuzzTest, TestOneInput);
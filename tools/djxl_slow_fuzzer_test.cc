@@ -0,0 +1,99 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/memory_manager.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/chroma_from_luma.h"
+#include "lib/jxl/codec_in_out.h"
+#include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/enc_params.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/image_ops.h"
+#include "lib/jxl/splines.h"
+#include "lib/jxl/test_memory_manager.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+// Aborts if the input takes longer than its budget to decode.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+namespace jxl {
+namespace {
+
+// Inputs close to the decoder limits, which are expensive per byte. Inputs
+// found by the fuzzer can be added the same way as in djxl_fuzzer_test.
+
+void ExpectWithinBudget(CompressParams cparams, Image3F&& image) {
+  JxlMemoryManager* memory_manager = test::MemoryManager();
+  CodecInOut io{memory_manager};
+  ASSERT_TRUE(io.SetFromImage(std::move(image), ColorEncoding::SRGB()));
+  io.metadata.m.SetUintSamples(8);
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(test::EncodeFile(cparams, &io, &compressed));
+  LLVMFuzzerTestOneInput(compressed.data(), compressed.size());
+}
+
+JXL_SLOW_TEST(DjxlSlowFuzzerTest, LargeMATree) {
+  JxlMemoryManager* memory_manager = test::MemoryManager();
+  constexpr size_t kSize = 256;
+  JXL_TEST_ASSIGN_OR_DIE(Image3F image,
+                         Image3F::Create(memory_manager, kSize, kSize));
+  // Noise makes the tree learning split until the tree size limit.
+  Rng rng(0);
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < kSize; ++y) {
+      float* row = image.PlaneRow(c, y);
+      for (size_t x = 0; x < kSize; ++x) {
+        row[x] = rng.UniformU(0, 256) * (1.0f / 255);
+      }
+    }
+  }
+  CompressParams cparams;
+  cparams.SetLossless();
+  cparams.speed_tier = SpeedTier::kTortoise;
+  ExpectWithinBudget(cparams, std::move(image));
+}
+
+TEST(DjxlSlowFuzzerTest, ManySplines) {
+  JxlMemoryManager* memory_manager = test::MemoryManager();
+  constexpr size_t kSize = 256;
+  JXL_TEST_ASSIGN_OR_DIE(Image3F image,
+                         Image3F::Create(memory_manager, kSize, kSize));
+  FillImage(0.5f, &image);
+  // Wide splines crossing the whole image back and forth.
+  const ColorCorrelation color_correlation{};
+  std::vector<QuantizedSpline> splines;
+  std::vector<Spline::Point> starting_points;
+  for (size_t i = 0; i < 64; ++i) {
+    Spline spline;
+    for (size_t j = 0; j < 16; ++j) {
+      spline.control_points.emplace_back((j % 2) * (kSize - 1.0f),
+                                         (i * 4 + j * 16) % kSize);
+    }
+    spline.color_dct = {Dct32{0.03125f}, Dct32{0.5f}, Dct32{0.25f}};
+    spline.sigma_dct = {4.0f};
+    JXL_TEST_ASSIGN_OR_DIE(
+        QuantizedSpline qspline,
+        QuantizedSpline::Create(spline, /*quantization_adjustment=*/0,
+                                color_correlation.YtoXRatio(0),
+                                color_correlation.YtoBRatio(0)));
+    splines.emplace_back(std::move(qspline));
+    starting_points.push_back(spline.control_points.front());
+  }
+  CompressParams cparams;
+  cparams.custom_splines = Splines(/*quantization_adjustment=*/0,
+                                   std::move(splines),
+                                   std::move(starting_points));
+  ExpectWithinBudget(cparams, std::move(image));
+}
+
+}  // namespace
+}  // namespace jxl
@@ -29,10 +29,11 @@ int main(int argc, char** argv) {
   size_t num_reps = argc >= 5 ? atoi(argv[4]) : 1;
   size_t num_threads = argc >= 6 ? atoi(argv[5]) : 0;
 
-  if (effort < 0 || effort > 127) {
-    fprintf(
-        stderr,
-        "Effort should be between 0 and 127 (default is 2, more is slower)\n");
+  if (effort < 0 || effort > FJXL_GROUP_ANALYSIS_EFFORT) {
+    fprintf(stderr,
+            "Effort should be between 0 and %d (default is 2, more is "
+            "slower)\n",
+            FJXL_GROUP_ANALYSIS_EFFORT);
     return 1;
   }
 
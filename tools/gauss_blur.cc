@@ -18,7 +18,7 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
-#include "lib/jxl/base/common.h"             // RoundUpTo
+#include "lib/jxl/base/common.h"             // RoundUpTo, DivCeil
 #include "lib/jxl/base/compiler_specific.h"  // JXL_RESTRICT
 #include "lib/jxl/base/matrix_ops.h"         // Inv3x3Matrix
 HWY_BEFORE_NAMESPACE();
@@ -370,27 +370,46 @@ void VerticalStrip(const hwy::AlignedUniquePtr<RecursiveGaussian>& rg,
   }
 }
 
-// Apply 1D vertical scan to multiple columns (one per vector lane).
-// Not yet parallelized.
-void FastGaussianVertical(const hwy::AlignedUniquePtr<RecursiveGaussian>& rg,
-                          const size_t xsize, const size_t ysize,
-                          const GetConstRow& in, const GetRow& out,
-                          ThreadPool* /* pool */) {
+// Apply 1D vertical scan to multiple columns (one per vector lane). Each
+// strip of columns is independent and is a task on `pool`.
+Status FastGaussianVertical(const hwy::AlignedUniquePtr<RecursiveGaussian>& rg,
+                            const size_t xsize, const size_t ysize,
+                            const GetConstRow& in, const GetRow& out,
+                            ThreadPool* pool) {
   const HWY_FULL(float) df;
   constexpr size_t kCacheLineLanes = 64 / sizeof(float);
   constexpr size_t kVN = MaxLanes(df);
   constexpr size_t kCacheLineVectors =
       (kVN < kCacheLineLanes) ? (kCacheLineLanes / kVN) : 4;
   constexpr size_t kFastPace = kCacheLineVectors * kVN;
-
-  // TODO(eustas): why pool is unused?
-  size_t x = 0;
-  for (; x + kFastPace <= xsize; x += kFastPace) {
-    VerticalStrip<kCacheLineVectors>(rg, x, ysize, in, out);
-  }
-  for (; x < xsize; x += kVN) {
-    VerticalStrip<1>(rg, x, ysize, in, out);
-  }
+  // Strips of several cache lines amortize the row lookups (and prefetches)
+  // of each row over more columns. They are only used when there are enough of
+  // them to keep the threads of the pool busy.
+  constexpr size_t kWideVectors = 4 * kCacheLineVectors;
+  constexpr size_t kWidePace = kWideVectors * kVN;
+  constexpr size_t kMinWideStrips = 8;
+
+  const size_t num_wide =
+      xsize >= kMinWideStrips * kWidePace ? xsize / kWidePace : 0;
+  const size_t fast_x = num_wide * kWidePace;
+  const size_t num_fast = (xsize - fast_x) / kFastPace;
+  const size_t slow_x = fast_x + num_fast * kFastPace;
+  const size_t num_slow = DivCeil(xsize - slow_x, kVN);
+  const auto process_strip = [&](const uint32_t task,
+                                 size_t /*thread*/) -> Status {
+    if (task < num_wide) {
+      VerticalStrip<kWideVectors>(rg, task * kWidePace, ysize, in, out);
+    } else if (task < num_wide + num_fast) {
+      const size_t x = fast_x + (task - num_wide) * kFastPace;
+      VerticalStrip<kCacheLineVectors>(rg, x, ysize, in, out);
+    } else {
+      const size_t x = slow_x + (task - num_wide - num_fast) * kVN;
+      VerticalStrip<1>(rg, x, ysize, in, out);
+    }
+    return true;
+  };
+  return RunOnPool(pool, 0, num_wide + num_fast + num_slow, ThreadPool::NoInit,
+                   process_strip, "FastGaussianVertical");
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -533,9 +552,8 @@ Status FastGaussian(const hwy::AlignedUniquePtr<RecursiveGaussian>& rg,
                     const GetRow& out, ThreadPool* pool) {
   JXL_RETURN_IF_ERROR(FastGaussianHorizontal(rg, xsize, ysize, in, temp, pool));
   GetConstRow temp_in = [&](size_t y) { return temp(y); };
-  HWY_DYNAMIC_DISPATCH(FastGaussianVertical)
-  (rg, xsize, ysize, temp_in, out, pool);
-  return true;
+  return HWY_DYNAMIC_DISPATCH(FastGaussianVertical)(rg, xsize, ysize, temp_in,
+                                                    out, pool);
 }
 
 }  // namespace jxl
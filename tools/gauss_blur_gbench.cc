@@ -6,12 +6,16 @@
 #include <jxl/memory_manager.h>
 
 #include <hwy/targets.h>
+#include <memory>
 
 #include "benchmark/benchmark.h"
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/image_ops.h"
 #include "tools/gauss_blur.h"
 #include "tools/no_memory_manager.h"
+#include "tools/thread_pool_internal.h"
 
 namespace jxl {
 namespace {
@@ -53,12 +57,21 @@ void BM_GaussBlur1d(benchmark::State& state) {
   state.SetItemsProcessed(length * state.iterations());
 }
 
+// Range 0 is the image size, and range 1, if given, the number of threads of
+// the pool that runs the horizontal and vertical passes.
 void BM_GaussBlur2d(benchmark::State& state) {
   JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
   // See GaussBlur1d for SIMD changes.
 
-  const size_t xsize = state.range();
+  const size_t xsize = state.range(0);
   const size_t ysize = xsize;
+  std::unique_ptr<jpegxl::tools::ThreadPoolInternal> pool_internal;
+  ThreadPool* pool = nullptr;
+  if (state.range(1) > 0) {
+    pool_internal = jxl::make_unique<jpegxl::tools::ThreadPoolInternal>(
+        state.range(1));
+    pool = pool_internal->get();
+  }
   const double sigma = 7.0;  // (from Butteraugli application)
   JXL_ASSIGN_OR_QUIT(ImageF in, ImageF::Create(memory_manager, xsize, ysize),
                      "Failed to allocate image.");
@@ -74,7 +87,7 @@ void BM_GaussBlur2d(benchmark::State& state) {
     BM_CHECK(FastGaussian(
         rg, in.xsize(), in.ysize(), [&](size_t y) { return in.ConstRow(y); },
         [&](size_t y) { return temp.Row(y); },
-        [&](size_t y) { return out.Row(y); }));
+        [&](size_t y) { return out.Row(y); }, pool));
     // Prevent optimizing out
     BM_CHECK(std::abs(out.ConstRow(ysize / 2)[xsize / 2] - expected) /
                  expected <
@@ -84,7 +97,10 @@ void BM_GaussBlur2d(benchmark::State& state) {
 }
 
 BENCHMARK(BM_GaussBlur1d)->Range(1 << 8, 1 << 14);
-BENCHMARK(BM_GaussBlur2d)->Range(1 << 7, 1 << 10);
+BENCHMARK(BM_GaussBlur2d)->Ranges({{1 << 7, 1 << 10}, {0, 0}});
+BENCHMARK(BM_GaussBlur2d)
+    ->ArgsProduct({{1 << 10, 1 << 12}, {1, 4, 8}})
+    ->UseRealTime();
 
 }  // namespace
 }  // namespace jxl
@@ -241,6 +241,13 @@ TEST(GaussBlurTest, Test2D) {
   }
 }
 
+// Wide enough for the strips of several cache lines of the vertical pass.
+TEST(GaussBlurTest, Test2DWide) {
+  for (double sigma : {2.5, 7.0}) {
+    TestDirac2D(1030, 49, sigma);
+  }
+}
+
 // Slow (44 sec). To run, remove the disabled prefix.
 TEST(GaussBlurTest, DISABLED_SlowTestDirac1D) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
@@ -363,6 +370,33 @@ TEST(GaussBlurTest, TestRandom) {
   TestRandomForSizes(-6.0f, 6.0f, 7.0f);
 }
 
+TEST(GaussBlurTest, PoolMatchesSequential) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  // Not a multiple of the strip width, so both kinds of strips are used.
+  const size_t xsize = 333;
+  const size_t ysize = 257;
+  JXL_TEST_ASSIGN_OR_DIE(ImageF in,
+                         ImageF::Create(memory_manager, xsize, ysize));
+  RandomFillImage(&in, -1.0f, 1.0f, 1234);
+  JXL_TEST_ASSIGN_OR_DIE(ImageF temp,
+                         ImageF::Create(memory_manager, xsize, ysize));
+  JXL_TEST_ASSIGN_OR_DIE(ImageF out,
+                         ImageF::Create(memory_manager, xsize, ysize));
+  JXL_TEST_ASSIGN_OR_DIE(ImageF out_pool,
+                         ImageF::Create(memory_manager, xsize, ysize));
+  const auto rg = CreateRecursiveGaussian(3.0);
+  ASSERT_TRUE(FastGaussian(
+      rg, xsize, ysize, [&](size_t y) { return in.ConstRow(y); },
+      [&](size_t y) { return temp.Row(y); },
+      [&](size_t y) { return out.Row(y); }));
+  test::ThreadPoolForTests pool(4);
+  ASSERT_TRUE(FastGaussian(
+      rg, xsize, ysize, [&](size_t y) { return in.ConstRow(y); },
+      [&](size_t y) { return temp.Row(y); },
+      [&](size_t y) { return out_pool.Row(y); }, pool.get()));
+  JXL_TEST_ASSERT_OK(SamePixels(out, out_pool, _));
+}
+
 TEST(GaussBlurTest, TestSign) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
   const size_t xsize = 500;
@@ -3,12 +3,17 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <vector>
 
 #include "lib/extras/dec/decode.h"
 #include "lib/extras/packed_image_convert.h"
 #include "lib/extras/tone_mapping.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/matrix_ops.h"
 #include "lib/jxl/cms/jxl_cms_internal.h"
 #include "lib/jxl/image_bundle.h"
@@ -111,29 +116,51 @@ int main(int argc, const char** argv) {
                           : luminance_info.kind == LuminanceInfo::Kind::kWhite
                               ? luminance_info.luminance
                               : 0.f;
-  bool out_of_gamut = false;
-  for (size_t y = 0; y < image.ysize(); ++y) {
+  // Per-thread statistics of the rows, merged after the pass.
+  struct RowStats {
+    float max_value = 0.f;
+    float max_relative_luminance = 0.f;
+    bool out_of_gamut = false;
+  };
+  std::vector<RowStats> stats;
+  const auto init = [&](size_t num_threads) -> jxl::Status {
+    stats.resize(num_threads);
+    return true;
+  };
+  const auto process_row = [&](const uint32_t y,
+                               size_t thread) -> jxl::Status {
+    RowStats& s = stats[thread];
     const float* const rows[3] = {image.Main().color()->ConstPlaneRow(0, y),
                                   image.Main().color()->ConstPlaneRow(1, y),
                                   image.Main().color()->ConstPlaneRow(2, y)};
     for (size_t x = 0; x < image.xsize(); ++x) {
-      if (!out_of_gamut &&
-          (rows[0][x] < 0 || rows[1][x] < 0 || rows[2][x] < 0)) {
-        out_of_gamut = true;
-        fprintf(stderr,
-                "WARNING: found colors outside of the Rec. 2020 gamut.\n");
+      if (rows[0][x] < 0 || rows[1][x] < 0 || rows[2][x] < 0) {
+        s.out_of_gamut = true;
       }
-      max_value = std::max(
-          max_value, std::max(rows[0][x], std::max(rows[1][x], rows[2][x])));
+      s.max_value = std::max(
+          s.max_value, std::max(rows[0][x], std::max(rows[1][x], rows[2][x])));
       const float luminance = primaries_xyz[0][1] * rows[0][x] +
                               primaries_xyz[1][1] * rows[1][x] +
                               primaries_xyz[2][1] * rows[2][x];
-      if (luminance_info.kind == LuminanceInfo::Kind::kMaximum &&
-          luminance > max_relative_luminance) {
-        max_relative_luminance = luminance;
-        white_luminance = luminance_info.luminance / luminance;
-      }
+      s.max_relative_luminance = std::max(s.max_relative_luminance, luminance);
     }
+    return true;
+  };
+  JPEGXL_TOOLS_CHECK(jxl::RunOnPool(pool.get(), 0, image.ysize(), init,
+                                    process_row, "ImageStats"));
+  bool out_of_gamut = false;
+  for (const RowStats& s : stats) {
+    out_of_gamut |= s.out_of_gamut;
+    max_value = std::max(max_value, s.max_value);
+    max_relative_luminance =
+        std::max(max_relative_luminance, s.max_relative_luminance);
+  }
+  if (out_of_gamut) {
+    fprintf(stderr, "WARNING: found colors outside of the Rec. 2020 gamut.\n");
+  }
+  if (luminance_info.kind == LuminanceInfo::Kind::kMaximum &&
+      max_relative_luminance > 0) {
+    white_luminance = luminance_info.luminance / max_relative_luminance;
   }
 
   bool needs_gamut_mapping = false;
@@ -102,6 +102,8 @@ static inline jxl::Status Encode(const jxl::CodecInOut& io,
       break;
     case jxl::extras::Codec::kGIF:
       return JXL_FAILURE("Encoding to GIF is not implemented");
+    case jxl::extras::Codec::kY4M:
+      return JXL_FAILURE("Encoding to Y4M is not implemented");
     case jxl::extras::Codec::kEXR:
       format.data_type = JXL_TYPE_FLOAT;
       encoder = jxl::extras::GetEXREncoder();
@@ -5,6 +5,8 @@
 
 #include <jxl/cms.h>
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 
@@ -60,38 +62,44 @@ V ComputeLuminance(const float intensity_target, const V r, const V g,
 }
 
 StatusOr<ImageF> DownsampledLuminances(const Image3F& image,
-                                       const float intensity_target) {
+                                       const float intensity_target,
+                                       ThreadPool* pool) {
   HWY_CAPPED(float, kDownsampling) d;
   JXL_ASSIGN_OR_RETURN(ImageF result,
                        ImageF::Create(jpegxl::tools::NoMemoryManager(),
                                       DivCeil(image.xsize(), kDownsampling),
                                       DivCeil(image.ysize(), kDownsampling)));
   FillImage(.5f * kDefaultIntensityTarget, &result);
-  for (size_t y = 0; y < image.ysize(); ++y) {
-    const float* const JXL_RESTRICT rows[3] = {image.ConstPlaneRow(0, y),
-                                               image.ConstPlaneRow(1, y),
-                                               image.ConstPlaneRow(2, y)};
-    float* const JXL_RESTRICT result_row = result.Row(y / kDownsampling);
-
-    for (size_t x = 0; x < image.xsize(); x += kDownsampling) {
-      auto max = Set(d, result_row[x / kDownsampling]);
-      for (size_t kx = 0; kx < kDownsampling && x + kx < image.xsize();
-           kx += Lanes(d)) {
-        max =
-            Max(max, ComputeLuminance(
-                         intensity_target, Load(d, rows[0] + x + kx),
-                         Load(d, rows[1] + x + kx), Load(d, rows[2] + x + kx)));
+  HWY_FULL(float) df;
+  // Each task reduces the block of image rows of one row of the result.
+  const auto process_row = [&](const int32_t ry,
+                               const int32_t /*thread_id*/) -> Status {
+    float* const JXL_RESTRICT result_row = result.Row(ry);
+    const size_t y_end =
+        std::min<size_t>((ry + 1) * kDownsampling, image.ysize());
+    for (size_t y = ry * kDownsampling; y < y_end; ++y) {
+      const float* const JXL_RESTRICT rows[3] = {image.ConstPlaneRow(0, y),
+                                                 image.ConstPlaneRow(1, y),
+                                                 image.ConstPlaneRow(2, y)};
+      for (size_t x = 0; x < image.xsize(); x += kDownsampling) {
+        auto max = Set(d, result_row[x / kDownsampling]);
+        for (size_t kx = 0; kx < kDownsampling && x + kx < image.xsize();
+             kx += Lanes(d)) {
+          max = Max(max, ComputeLuminance(intensity_target,
+                                          Load(d, rows[0] + x + kx),
+                                          Load(d, rows[1] + x + kx),
+                                          Load(d, rows[2] + x + kx)));
+        }
+        result_row[x / kDownsampling] = GetLane(MaxOfLanes(d, max));
       }
-      result_row[x / kDownsampling] = GetLane(MaxOfLanes(d, max));
     }
-  }
-  HWY_FULL(float) df;
-  for (size_t y = 0; y < result.ysize(); ++y) {
-    float* const JXL_RESTRICT row = result.Row(y);
     for (size_t x = 0; x < result.xsize(); x += Lanes(df)) {
-      Store(FastLog2f(df, Load(df, row + x)), df, row + x);
+      Store(FastLog2f(df, Load(df, result_row + x)), df, result_row + x);
     }
-  }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, result.ysize(), &ThreadPool::NoInit,
+                                process_row, "DownsampledLuminances"));
   return result;
 }
 
@@ -248,7 +256,8 @@ Status ProcessFrame(CodecInOut* image, float preserve_saturation,
   Image3F color = std::move(*image->Main().color());
   JXL_ASSIGN_OR_RETURN(
       ImageF subsampled_image,
-      HWY_DYNAMIC_DISPATCH(DownsampledLuminances)(color, intensity_target));
+      HWY_DYNAMIC_DISPATCH(DownsampledLuminances)(color, intensity_target,
+                                                  pool));
 
   JXL_RETURN_IF_ERROR(Blur(&subsampled_image));
   ImageF blurred_luminances = std::move(subsampled_image);
@@ -282,7 +291,7 @@ Status ProcessFrame(CodecInOut* image, float preserve_saturation,
 }  // namespace jxl
 
 int main(int argc, const char** argv) {
-  jpegxl::tools::ThreadPoolInternal pool(8);
+  jpegxl::tools::ThreadPoolInternal pool;
 
   jpegxl::tools::CommandLineParser parser;
   float preserve_saturation = .4f;
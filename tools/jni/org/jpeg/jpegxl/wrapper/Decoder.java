@@ -5,6 +5,8 @@
 
 package org.jpeg.jpegxl.wrapper;
 
+import java.io.IOException;
+import java.io.InputStream;
 import java.nio.Buffer;
 import java.nio.ByteBuffer;
 
@@ -32,6 +34,34 @@ public class Decoder {
     return new ImageData(basicInfo.width, basicInfo.height, pixels, icc, pixelFormat);
   }
 
+  /**
+   * Decoding of a stream that is read in chunks as the decoder needs them, e.g.
+   * from the network. Exceptions thrown by the stream are rethrown.
+   */
+  public static ImageData decode(InputStream stream, PixelFormat pixelFormat)
+      throws IOException {
+    ImageData imageData = DecoderJni.decodeStream(stream, pixelFormat);
+    if (imageData == null) {
+      throw new IllegalStateException("Decoding failed");
+    }
+    return imageData;
+  }
+
+  /**
+   * Decoding into the pixels of an android.graphics.Bitmap, without copies.
+   *
+   * The bitmap must be mutable, have the size of the image and the ARGB_8888 or
+   * RGBA_F16 config. The alpha is not premultiplied, call
+   * Bitmap.setPremultiplied(false) before drawing images with alpha. Only
+   * supported on Android.
+   */
+  public static void decodeToBitmap(Buffer data, Object bitmap) {
+    Status status = DecoderJni.decodeToBitmap(data, bitmap);
+    if (status != Status.OK) {
+      throw new IllegalStateException("Decoding failed");
+    }
+  }
+
   public static StreamInfo decodeInfo(byte[] data) {
     return decodeInfo(ByteBuffer.wrap(data));
   }
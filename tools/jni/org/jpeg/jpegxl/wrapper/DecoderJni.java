@@ -5,6 +5,8 @@
 
 package org.jpeg.jpegxl.wrapper;
 
+import java.io.IOException;
+import java.io.InputStream;
 import java.nio.Buffer;
 
 /**
@@ -15,6 +17,9 @@ import java.nio.Buffer;
 class DecoderJni {
   private static native void nativeGetBasicInfo(int[] context, Buffer data);
   private static native void nativeGetPixels(int[] context, Buffer data, Buffer pixels, Buffer icc);
+  private static native void nativeDecodeStream(int[] context, InputStream stream, Buffer[] buffers)
+      throws IOException;
+  private static native void nativeDecodeToBitmap(int[] context, Buffer data, Object bitmap);
 
   static Status makeStatus(int statusCode) {
     switch (statusCode) {
@@ -68,6 +73,35 @@ class DecoderJni {
     return makeStatus(context[0]);
   }
 
+  /**
+   * Decoding of a stream that is read in chunks; the pixels and ICC buffers are
+   * allocated by the native code.
+   */
+  static ImageData decodeStream(InputStream stream, PixelFormat pixelFormat)
+      throws IOException {
+    int[] context = new int[4];
+    context[0] = pixelFormat.ordinal();
+    Buffer[] buffers = new Buffer[2];
+    nativeDecodeStream(context, stream, buffers);
+    if (makeStatus(context[0]) != Status.OK) {
+      return null;
+    }
+    return new ImageData(context[1], context[2], buffers[0], buffers[1], pixelFormat);
+  }
+
+  /** Decoding into the pixels of an android.graphics.Bitmap. */
+  static Status decodeToBitmap(Buffer data, Object bitmap) {
+    if (!data.isDirect()) {
+      throw new IllegalArgumentException("data must be direct buffer");
+    }
+    if (bitmap == null) {
+      throw new IllegalArgumentException("bitmap is null");
+    }
+    int[] context = new int[1];
+    nativeDecodeToBitmap(context, data, bitmap);
+    return makeStatus(context[0]);
+  }
+
   /** Utility library, disable object construction. */
   private DecoderJni() {}
 }
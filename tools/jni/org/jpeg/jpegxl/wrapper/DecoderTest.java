@@ -5,6 +5,9 @@
 
 package org.jpeg.jpegxl.wrapper;
 
+import java.io.ByteArrayInputStream;
+import java.io.IOException;
+import java.io.InputStream;
 import java.nio.ByteBuffer;
 
 public class DecoderTest {
@@ -114,8 +117,57 @@ public class DecoderTest {
     }
   }
 
+  // Returns at most 5 bytes per read, like a slow network connection.
+  static InputStream makeSlowStream(byte[] src, int length) {
+    return new ByteArrayInputStream(src, 0, length) {
+      @Override
+      public synchronized int read(byte[] b, int off, int len) {
+        return super.read(b, off, Math.min(len, 5));
+      }
+    };
+  }
+
+  static void testStream() throws IOException {
+    ImageData imageData = Decoder.decode(
+        makeSlowStream(SIMPLE_IMAGE_BYTES, SIMPLE_IMAGE_BYTES.length), PixelFormat.RGBA_8888);
+    checkSimpleImageData(imageData);
+    if (imageData.pixels.limit() != SIMPLE_IMAGE_DIM * SIMPLE_IMAGE_DIM * 4) {
+      throw new IllegalStateException("Unexpected pixels size");
+    }
+  }
+
+  static void testTruncatedStream() throws IOException {
+    try {
+      Decoder.decode(makeSlowStream(SIMPLE_IMAGE_BYTES, SIMPLE_IMAGE_BYTES.length - 1),
+          PixelFormat.RGBA_8888);
+    } catch (IllegalStateException ex) {
+      return;
+    }
+    throw new IllegalStateException("Expected decoding to fail");
+  }
+
+  static void testStreamException() {
+    InputStream failing = new InputStream() {
+      @Override
+      public int read() throws IOException {
+        throw new IOException("expected");
+      }
+
+      @Override
+      public int read(byte[] b, int off, int len) throws IOException {
+        throw new IOException("expected");
+      }
+    };
+    try {
+      Decoder.decode(failing, PixelFormat.RGBA_8888);
+    } catch (IOException ex) {
+      return;
+    }
+    throw new IllegalStateException("Expected IOException");
+  }
+
   // Simple executable to avoid extra dependencies.
-  public static void main(String[] args) {
+  public static void main(String[] args) throws IOException {
     testRgba();
     testRgbaF16();
     testRgb();
@@ -123,5 +175,8 @@ public class DecoderTest {
     testGetInfoNoAlpha();
     testGetInfoAlpha();
     testNotEnoughInput();
+    testStream();
+    testTruncatedStream();
+    testStreamException();
   }
 }
@@ -0,0 +1,32 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package org.jpeg.jpegxl.wrapper;
+
+import java.nio.Buffer;
+
+/** JPEG XL JNI encoder wrapper. */
+public class Encoder {
+  /** Utility library, disable object construction. */
+  private Encoder() {}
+
+  /**
+   * One-shot encoding of sRGB pixels (linear sRGB for the F16 formats).
+   *
+   * @param distance Butteraugli distance, 0 for lossless, 1 is visually lossless
+   * @param effort encoder effort, from 1 (fastest) to 10
+   */
+  public static byte[] encode(Buffer pixels, int width, int height, PixelFormat pixelFormat,
+      float distance, int effort) {
+    if ((width <= 0) || (height <= 0)) {
+      throw new IllegalArgumentException("invalid image dimensions");
+    }
+    byte[] result = EncoderJni.encode(pixels, width, height, pixelFormat, distance, effort);
+    if (result == null) {
+      throw new IllegalStateException("Encoding failed");
+    }
+    return result;
+  }
+}
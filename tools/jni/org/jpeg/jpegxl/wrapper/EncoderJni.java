@@ -0,0 +1,38 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package org.jpeg.jpegxl.wrapper;
+
+import java.nio.Buffer;
+
+/**
+ * Low level JNI wrapper.
+ *
+ * This class is package-private, should be only be used by high level wrapper.
+ */
+class EncoderJni {
+  private static native byte[] nativeEncode(int[] context, float distance, Buffer pixels);
+
+  /** One-shot encoding. */
+  static byte[] encode(Buffer pixels, int width, int height, PixelFormat pixelFormat,
+      float distance, int effort) {
+    if (!pixels.isDirect()) {
+      throw new IllegalArgumentException("pixels must be direct buffer");
+    }
+    int[] context = new int[4];
+    context[0] = pixelFormat.ordinal();
+    context[1] = width;
+    context[2] = height;
+    context[3] = effort;
+    byte[] result = nativeEncode(context, distance, pixels);
+    if (DecoderJni.makeStatus(context[0]) != Status.OK) {
+      return null;
+    }
+    return result;
+  }
+
+  /** Utility library, disable object construction. */
+  private EncoderJni() {}
+}
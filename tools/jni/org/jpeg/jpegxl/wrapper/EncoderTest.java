@@ -0,0 +1,77 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package org.jpeg.jpegxl.wrapper;
+
+import java.nio.ByteBuffer;
+
+/** Tests for JPEG XL encoder wrapper. */
+public class EncoderTest {
+  static {
+    String jniLibrary = System.getProperty("org.jpeg.jpegxl.wrapper.lib");
+    if (jniLibrary != null) {
+      try {
+        System.load(new java.io.File(jniLibrary).getAbsolutePath());
+      } catch (UnsatisfiedLinkError ex) {
+        String message =
+            "If the nested exception message says that some standard library (stdc++, tcmalloc,"
+            + " etc.) was not found, it is likely that JDK discovered by the build system"
+            + " overrides library search path. Try specifying a different JDK via JAVA_HOME"
+            + " environment variable and doing a clean build.";
+        throw new RuntimeException(message, ex);
+      }
+    }
+  }
+
+  static void checkTrue(boolean condition) {
+    if (!condition) {
+      throw new IllegalStateException("check failed");
+    }
+  }
+
+  static ByteBuffer makeGradient(int width, int height) {
+    ByteBuffer pixels = ByteBuffer.allocateDirect(width * height * 4);
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        pixels.put((byte) (x * 4));
+        pixels.put((byte) (y * 4));
+        pixels.put((byte) 128);
+        pixels.put((byte) 255);
+      }
+    }
+    pixels.rewind();
+    return pixels;
+  }
+
+  static void testLosslessRoundtrip() {
+    ByteBuffer pixels = makeGradient(64, 64);
+    byte[] encoded = Encoder.encode(pixels, 64, 64, PixelFormat.RGBA_8888, 0.0f, 7);
+    ByteBuffer data = ByteBuffer.allocateDirect(encoded.length);
+    data.put(encoded);
+    ImageData imageData = Decoder.decode(data, PixelFormat.RGBA_8888);
+    checkTrue(imageData.width == 64);
+    checkTrue(imageData.height == 64);
+    checkTrue(((ByteBuffer) imageData.pixels).equals(pixels));
+  }
+
+  static void testLossy() {
+    ByteBuffer pixels = makeGradient(64, 64);
+    byte[] encoded = Encoder.encode(pixels, 64, 64, PixelFormat.RGBA_8888, 1.0f, 3);
+    checkTrue(encoded.length > 0);
+    ByteBuffer data = ByteBuffer.allocateDirect(encoded.length);
+    data.put(encoded);
+    StreamInfo streamInfo = Decoder.decodeInfo(data);
+    checkTrue(streamInfo.status == Status.OK);
+    checkTrue(streamInfo.width == 64);
+    checkTrue(streamInfo.height == 64);
+    checkTrue(streamInfo.alphaBits == 8);
+  }
+
+  // Simple executable to avoid extra dependencies.
+  public static void main(String[] args) {
+    testLosslessRoundtrip();
+    testLossy();
+  }
+}
@@ -8,11 +8,17 @@
 #include <jni.h>
 #include <jxl/codestream_header.h>
 #include <jxl/decode.h>
-#include <jxl/thread_parallel_runner.h>
+#include <jxl/shared_parallel_runner.h>
 #include <jxl/types.h>
 
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <vector>
+
+#ifdef __ANDROID__
+#include <android/bitmap.h>
+#endif
 
 namespace {
 
@@ -65,45 +71,136 @@ JxlPixelFormat ToPixelFormat(size_t pixel_format) {
   }
 }
 
-Status DoDecode(JNIEnv* env, jobject data_buffer, size_t* info_pixels_size,
-                size_t* info_icc_size, JxlBasicInfo* info, size_t pixel_format,
-                jobject pixels_buffer, jobject icc_buffer) {
-  if (data_buffer == nullptr) return FAILURE("No data buffer");
+// Size of the chunks read from a java.io.InputStream.
+constexpr const size_t kStreamChunkSize = 64 << 10;
 
+// Encoded stream: either a direct buffer holding all of it, or an InputStream
+// that is read in chunks as the decoder needs more input.
+struct Input {
   uint8_t* data = nullptr;
-  size_t data_size = 0;
-  if (!BufferToSpan(env, data_buffer, &data, &data_size)) {
+  size_t size = 0;
+  jobject stream = nullptr;
+  bool stream_ended = false;
+  // Bytes read from the stream and not consumed by the decoder yet.
+  std::vector<uint8_t> buffered;
+};
+
+Status InitInput(JNIEnv* env, jobject data_buffer, Input* input) {
+  if (data_buffer == nullptr) return FAILURE("No data buffer");
+  if (!BufferToSpan(env, data_buffer, &input->data, &input->size)) {
     return FAILURE("Failed to access data buffer");
   }
+  return Status::OK;
+}
 
-  uint8_t* pixels = nullptr;
-  size_t pixels_size = 0;
-  if (!BufferToSpan(env, pixels_buffer, &pixels, &pixels_size)) {
-    return FAILURE("Failed to access pixels buffer");
+// Appends the next chunk of the stream to the unconsumed input. An exception
+// thrown by the stream is left pending, and rethrown when the native method
+// returns.
+Status ReadMoreInput(JNIEnv* env, JxlDecoder* dec, Input* input) {
+  if (input->stream == nullptr || input->stream_ended) {
+    return Status::NOT_ENOUGH_INPUT;
+  }
+  size_t unconsumed = JxlDecoderReleaseInput(dec);
+  input->buffered.erase(input->buffered.begin(),
+                        input->buffered.end() - unconsumed);
+  jclass stream_class = env->GetObjectClass(input->stream);
+  jmethodID read = env->GetMethodID(stream_class, "read", "([BII)I");
+  env->DeleteLocalRef(stream_class);
+  if (read == nullptr) return FAILURE("No InputStream.read");
+  jbyteArray chunk = env->NewByteArray(kStreamChunkSize);
+  if (chunk == nullptr) return FAILURE("Failed to allocate chunk");
+  jint num_read = env->CallIntMethod(input->stream, read, chunk, 0,
+                                     static_cast<jint>(kStreamChunkSize));
+  Status status = Status::OK;
+  if (env->ExceptionCheck()) {
+    status = FAILURE("Failed to read stream");
+  } else if (num_read < 0) {
+    // Once closed, the decoder either finishes without the optional trailing
+    // boxes or reports the truncated input as an error.
+    input->stream_ended = true;
+    JxlDecoderCloseInput(dec);
+  } else {
+    size_t size = input->buffered.size();
+    input->buffered.resize(size + num_read);
+    jbyte* dest = reinterpret_cast<jbyte*>(input->buffered.data() + size);
+    env->GetByteArrayRegion(chunk, 0, num_read, dest);
+  }
+  env->DeleteLocalRef(chunk);
+  if (!IsOk(status)) return status;
+  if (JXL_DEC_SUCCESS != JxlDecoderSetInput(dec, input->buffered.data(),
+                                            input->buffered.size())) {
+    return FAILURE("Failed to set input");
   }
+  return Status::OK;
+}
+
+// Allocates a direct ByteBuffer and stores it in buffers[index].
+Status AllocateDirectBuffer(JNIEnv* env, jobjectArray buffers, jsize index,
+                            size_t size, uint8_t** data) {
+  jclass byte_buffer_class = env->FindClass("java/nio/ByteBuffer");
+  if (byte_buffer_class == nullptr) return FAILURE("No ByteBuffer");
+  jmethodID allocate_direct = env->GetStaticMethodID(
+      byte_buffer_class, "allocateDirect", "(I)Ljava/nio/ByteBuffer;");
+  if (allocate_direct == nullptr) return FAILURE("No allocateDirect");
+  jint buffer_size = 0;
+  if (!StaticCast(size, &buffer_size)) return FAILURE("Buffer too large");
+  jobject buffer = env->CallStaticObjectMethod(byte_buffer_class,
+                                               allocate_direct, buffer_size);
+  env->DeleteLocalRef(byte_buffer_class);
+  if (buffer == nullptr || env->ExceptionCheck()) {
+    return FAILURE("Failed to allocate buffer");
+  }
+  env->SetObjectArrayElement(buffers, index, buffer);
+  size_t capacity = 0;
+  bool ok = BufferToSpan(env, buffer, data, &capacity);
+  env->DeleteLocalRef(buffer);
+  if (!ok || capacity < size) return FAILURE("Failed to access buffer");
+  return Status::OK;
+}
+
+// What to extract from the encoded stream; outputs that are not wanted are
+// null.
+struct DecodeRequest {
+  size_t pixel_format = kNoPixelFormat;
+  // Row stride of the pixels, 0 for packed rows.
+  size_t align = 0;
+  // Expected dimensions, e.g. of a bitmap, 0 if any.
+  size_t xsize = 0;
+  size_t ysize = 0;
 
+  size_t* info_pixels_size = nullptr;
+  size_t* info_icc_size = nullptr;
+  JxlBasicInfo* info = nullptr;
+
+  uint8_t* pixels = nullptr;
+  size_t pixels_size = 0;
   uint8_t* icc = nullptr;
   size_t icc_size = 0;
-  if (!BufferToSpan(env, icc_buffer, &icc, &icc_size)) {
-    return FAILURE("Failed to access ICC buffer");
-  }
 
+  // If not null, the pixels and the ICC profile are decoded into direct
+  // ByteBuffers allocated once their size is known, and stored in this array.
+  jobjectArray out_buffers = nullptr;
+};
+
+Status DoDecode(JNIEnv* env, Input* input, DecodeRequest* request) {
   JxlDecoder* dec = JxlDecoderCreate(nullptr);
 
-  constexpr size_t kNumThreads = 0;  // Do everything in this thread.
-  void* runner = JxlThreadParallelRunnerCreate(nullptr, kNumThreads);
+  // The runner is cheap to create: the worker threads belong to the
+  // process-wide pool, which is sized to the device and reused by all calls.
+  void* runner =
+      JxlSharedParallelRunnerCreate(JxlSharedThreadPoolGetDefault(), 0);
 
   struct Defer {
     JxlDecoder* dec;
     void* runner;
     ~Defer() {
-      JxlThreadParallelRunnerDestroy(runner);
       JxlDecoderDestroy(dec);
+      JxlSharedParallelRunnerDestroy(runner);
     }
   } defer{dec, runner};
 
   auto status =
-      JxlDecoderSetParallelRunner(dec, JxlThreadParallelRunner, runner);
+      JxlDecoderSetParallelRunner(dec, JxlSharedParallelRunner, runner);
   if (status != JXL_DEC_SUCCESS) {
     return FAILURE("Failed to set parallel runner");
   }
@@ -112,66 +209,97 @@ Status DoDecode(JNIEnv* env, jobject data_buffer, size_t* info_pixels_size,
   if (status != JXL_DEC_SUCCESS) {
     return FAILURE("Failed to subscribe for events");
   }
-  status = JxlDecoderSetInput(dec, data, data_size);
-  if (status != JXL_DEC_SUCCESS) {
-    return FAILURE("Failed to set input");
-  }
-  status = JxlDecoderProcessInput(dec);
-  if (status == JXL_DEC_NEED_MORE_INPUT) {
-    return Status::NOT_ENOUGH_INPUT;
-  }
-  if (status != JXL_DEC_BASIC_INFO) {
-    return FAILURE("Unexpected notification (want: basic info)");
-  }
-  if (info_pixels_size) {
-    JxlPixelFormat format = ToPixelFormat(pixel_format);
-    status = JxlDecoderImageOutBufferSize(dec, &format, info_pixels_size);
-    if (status != JXL_DEC_SUCCESS) {
-      return FAILURE("Failed to get pixels size");
-    }
-  }
-  if (info) {
-    status = JxlDecoderGetBasicInfo(dec, info);
+  if (input->stream == nullptr) {
+    status = JxlDecoderSetInput(dec, input->data, input->size);
     if (status != JXL_DEC_SUCCESS) {
-      return FAILURE("Failed to get basic info");
+      return FAILURE("Failed to set input");
     }
   }
-  status = JxlDecoderProcessInput(dec);
-  if (status != JXL_DEC_COLOR_ENCODING) {
-    return FAILURE("Unexpected notification (want: color encoding)");
-  }
-  if (info_icc_size) {
-    status = JxlDecoderGetICCProfileSize(dec, JXL_COLOR_PROFILE_TARGET_DATA,
-                                         info_icc_size);
-    if (status != JXL_DEC_SUCCESS) *info_icc_size = 0;
-  }
-  if (icc && icc_size > 0) {
-    status = JxlDecoderGetColorAsICCProfile(dec, JXL_COLOR_PROFILE_TARGET_DATA,
-                                            icc, icc_size);
-    if (status != JXL_DEC_SUCCESS) {
-      return FAILURE("Failed to get ICC");
-    }
-  }
-  if (pixels) {
-    JxlPixelFormat format = ToPixelFormat(pixel_format);
+  bool want_pixels =
+      (request->pixels != nullptr) || (request->out_buffers != nullptr);
+  bool has_out_buffer = false;
+  for (;;) {
     status = JxlDecoderProcessInput(dec);
-    if (status != JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
-      return FAILURE("Unexpected notification (want: need out buffer)");
-    }
-    status = JxlDecoderSetImageOutBuffer(dec, &format, pixels, pixels_size);
-    if (status != JXL_DEC_SUCCESS) {
-      return FAILURE("Failed to set out buffer");
-    }
-    status = JxlDecoderProcessInput(dec);
-    if (status != JXL_DEC_FULL_IMAGE) {
-      return FAILURE("Unexpected notification (want: full image)");
-    }
-    status = JxlDecoderProcessInput(dec);
-    if (status != JXL_DEC_SUCCESS) {
-      return FAILURE("Unexpected notification (want: success)");
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      Status input_status = ReadMoreInput(env, dec, input);
+      if (!IsOk(input_status)) return input_status;
+    } else if (status == JXL_DEC_BASIC_INFO) {
+      JxlBasicInfo info;
+      if (JxlDecoderGetBasicInfo(dec, &info) != JXL_DEC_SUCCESS) {
+        return FAILURE("Failed to get basic info");
+      }
+      if ((request->xsize != 0 && request->xsize != info.xsize) ||
+          (request->ysize != 0 && request->ysize != info.ysize)) {
+        return FAILURE("Unexpected image size");
+      }
+      if (request->info) *request->info = info;
+      if (request->info_pixels_size) {
+        JxlPixelFormat format = ToPixelFormat(request->pixel_format);
+        status = JxlDecoderImageOutBufferSize(dec, &format,
+                                              request->info_pixels_size);
+        if (status != JXL_DEC_SUCCESS) {
+          return FAILURE("Failed to get pixels size");
+        }
+      }
+    } else if (status == JXL_DEC_COLOR_ENCODING) {
+      size_t icc_size = 0;
+      status = JxlDecoderGetICCProfileSize(dec, JXL_COLOR_PROFILE_TARGET_DATA,
+                                           &icc_size);
+      if (status != JXL_DEC_SUCCESS) icc_size = 0;
+      if (request->info_icc_size) *request->info_icc_size = icc_size;
+      if (request->out_buffers) {
+        Status alloc_status = AllocateDirectBuffer(
+            env, request->out_buffers, 1, icc_size, &request->icc);
+        if (!IsOk(alloc_status)) return alloc_status;
+        request->icc_size = icc_size;
+      }
+      if (request->icc && request->icc_size > 0) {
+        status = JxlDecoderGetColorAsICCProfile(
+            dec, JXL_COLOR_PROFILE_TARGET_DATA, request->icc,
+            request->icc_size);
+        if (status != JXL_DEC_SUCCESS) {
+          return FAILURE("Failed to get ICC");
+        }
+      }
+      if (!want_pixels) return Status::OK;
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      // Only the first frame is decoded.
+      if (!want_pixels || has_out_buffer) {
+        return FAILURE("Unexpected notification (need out buffer)");
+      }
+      JxlPixelFormat format = ToPixelFormat(request->pixel_format);
+      format.align = request->align;
+      if (request->out_buffers) {
+        size_t pixels_size = 0;
+        status = JxlDecoderImageOutBufferSize(dec, &format, &pixels_size);
+        if (status != JXL_DEC_SUCCESS) {
+          return FAILURE("Failed to get pixels size");
+        }
+        Status alloc_status = AllocateDirectBuffer(
+            env, request->out_buffers, 0, pixels_size, &request->pixels);
+        if (!IsOk(alloc_status)) return alloc_status;
+        request->pixels_size = pixels_size;
+      }
+      status = JxlDecoderSetImageOutBuffer(dec, &format, request->pixels,
+                                           request->pixels_size);
+      if (status != JXL_DEC_SUCCESS) {
+        return FAILURE("Failed to set out buffer");
+      }
+      has_out_buffer = true;
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      // Continue until the end of the stream.
+    } else if (status == JXL_DEC_SUCCESS) {
+      return Status::OK;
+    } else {
+      return FAILURE("Unexpected notification");
     }
   }
+}
 
+Status CheckPixelFormat(size_t pixel_format) {
+  if (pixel_format > kLastPixelFormat) {
+    return FAILURE("Unrecognized pixel format");
+  }
   return Status::OK;
 }
 
@@ -203,18 +331,21 @@ Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeGetBasicInfo(
     }
   }
 
+  Input input;
+  if (IsOk(status)) {
+    status = InitInput(env, data_buffer, &input);
+  }
+
   if (IsOk(status)) {
+    DecodeRequest request;
+    request.pixel_format = pixel_format;
+    request.info = &info;
     bool want_output_size = (pixel_format != kNoPixelFormat);
     if (want_output_size) {
-      status = DoDecode(
-          env, data_buffer, &pixels_size, &icc_size, &info, pixel_format,
-          /* pixels_buffer= */ nullptr, /* icc_buffer= */ nullptr);
-    } else {
-      status =
-          DoDecode(env, data_buffer, /* info_pixels_size= */ nullptr,
-                   /* info_icc_size= */ nullptr, &info, pixel_format,
-                   /* pixels_buffer= */ nullptr, /* icc_buffer= */ nullptr);
+      request.info_pixels_size = &pixels_size;
+      request.info_icc_size = &icc_size;
     }
+    status = DoDecode(env, &input, &request);
   }
 
   if (IsOk(status)) {
@@ -252,16 +383,132 @@ JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeGetPixels(
   if (IsOk(status)) {
     // Unlike getBasicInfo, "no-pixel-format" is not supported.
     pixel_format = context[0];
-    if (pixel_format > kLastPixelFormat) {
-      status = FAILURE("Unrecognized pixel format");
-    }
+    status = CheckPixelFormat(pixel_format);
+  }
+
+  Input input;
+  if (IsOk(status)) {
+    status = InitInput(env, data_buffer, &input);
+  }
+
+  DecodeRequest request;
+  request.pixel_format = pixel_format;
+  if (IsOk(status) && (pixels_buffer == nullptr ||
+                       !BufferToSpan(env, pixels_buffer, &request.pixels,
+                                     &request.pixels_size))) {
+    status = FAILURE("Failed to access pixels buffer");
+  }
+  if (IsOk(status) &&
+      !BufferToSpan(env, icc_buffer, &request.icc, &request.icc_size)) {
+    status = FAILURE("Failed to access ICC buffer");
+  }
+
+  if (IsOk(status)) {
+    status = DoDecode(env, &input, &request);
+  }
+
+  context[0] = static_cast<int>(status);
+  env->SetIntArrayRegion(ctx, 0, 1, context);
+}
+
+/**
+ * Decode a stream read in chunks.
+ *
+ * @param ctx {in_pixel_format_out_status, out_width, out_height,
+ *             out_alpha_bits} tuple
+ * @param stream [in] InputStream with encoded JXL stream
+ * @param buffers [out] {pixels, icc} direct buffers allocated for the image
+ */
+JNIEXPORT void JNICALL
+Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeDecodeStream(
+    JNIEnv* env, jobject /* jobj */, jintArray ctx, jobject stream,
+    jobjectArray buffers) {
+  jint context[4] = {0};
+  env->GetIntArrayRegion(ctx, 0, 1, context);
+
+  Status status = CheckPixelFormat(context[0]);
+  if (IsOk(status) && (stream == nullptr || buffers == nullptr ||
+                       env->GetArrayLength(buffers) < 2)) {
+    status = FAILURE("Invalid arguments");
+  }
+
+  JxlBasicInfo info = {};
+  if (IsOk(status)) {
+    Input input;
+    input.stream = stream;
+    DecodeRequest request;
+    request.pixel_format = context[0];
+    request.info = &info;
+    request.out_buffers = buffers;
+    status = DoDecode(env, &input, &request);
+  }
+
+  if (IsOk(status)) {
+    bool ok = true;
+    ok &= StaticCast(info.xsize, context + 1);
+    ok &= StaticCast(info.ysize, context + 2);
+    ok &= StaticCast(info.alpha_bits, context + 3);
+    if (!ok) status = FAILURE("Invalid value");
   }
 
+  // Let the exception thrown by the stream or the allocations propagate.
+  if (env->ExceptionCheck()) return;
+
+  context[0] = static_cast<int>(status);
+  env->SetIntArrayRegion(ctx, 0, 4, context);
+}
+
+/**
+ * Decode directly into the pixels of an android.graphics.Bitmap.
+ *
+ * @param ctx {out_status} tuple
+ * @param data [in] Buffer with encoded JXL stream
+ * @param bitmap [in] mutable ARGB_8888 or RGBA_F16 Bitmap of the image size
+ */
+JNIEXPORT void JNICALL
+Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeDecodeToBitmap(
+    JNIEnv* env, jobject /* jobj */, jintArray ctx, jobject data_buffer,
+    jobject bitmap) {
+  jint context[1] = {0};
+
+  Input input;
+  Status status = InitInput(env, data_buffer, &input);
+
+#ifdef __ANDROID__
+  AndroidBitmapInfo bitmap_info;
+  DecodeRequest request;
+  if (IsOk(status) && AndroidBitmap_getInfo(env, bitmap, &bitmap_info) !=
+                          ANDROID_BITMAP_RESULT_SUCCESS) {
+    status = FAILURE("Failed to get bitmap info");
+  }
   if (IsOk(status)) {
-    status = DoDecode(env, data_buffer, /* info_pixels_size= */ nullptr,
-                      /* info_icc_size= */ nullptr, /* info= */ nullptr,
-                      pixel_format, pixels_buffer, icc_buffer);
+    if (bitmap_info.format == ANDROID_BITMAP_FORMAT_RGBA_8888) {
+      request.pixel_format = 0;
+    } else if (bitmap_info.format == ANDROID_BITMAP_FORMAT_RGBA_F16) {
+      request.pixel_format = 1;
+    } else {
+      status = FAILURE("Unsupported bitmap format");
+    }
+  }
+  void* pixels = nullptr;
+  if (IsOk(status) && AndroidBitmap_lockPixels(env, bitmap, &pixels) !=
+                          ANDROID_BITMAP_RESULT_SUCCESS) {
+    status = FAILURE("Failed to lock bitmap pixels");
   }
+  if (IsOk(status)) {
+    request.xsize = bitmap_info.width;
+    request.ysize = bitmap_info.height;
+    request.align = bitmap_info.stride;
+    request.pixels = static_cast<uint8_t*>(pixels);
+    request.pixels_size =
+        static_cast<size_t>(bitmap_info.stride) * bitmap_info.height;
+    status = DoDecode(env, &input, &request);
+    AndroidBitmap_unlockPixels(env, bitmap);
+  }
+#else
+  (void)bitmap;
+  if (IsOk(status)) status = FAILURE("Bitmaps are only supported on Android");
+#endif
 
   context[0] = static_cast<int>(status);
   env->SetIntArrayRegion(ctx, 0, 1, context);
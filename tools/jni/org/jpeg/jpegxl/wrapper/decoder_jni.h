@@ -36,6 +36,31 @@ JNIEXPORT void JNICALL Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeGetPixels(
     JNIEnv* env, jobject /*jobj*/, jintArray ctx, jobject data_buffer,
     jobject pixels_buffer, jobject icc_buffer);
 
+/**
+ * Decode a stream read in chunks.
+ *
+ * @param ctx {in_pixel_format_out_status, out_width, out_height,
+ *             out_alpha_bits} tuple
+ * @param stream [in] InputStream with encoded JXL stream
+ * @param buffers [out] {pixels, icc} direct buffers allocated for the image
+ */
+JNIEXPORT void JNICALL
+Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeDecodeStream(
+    JNIEnv* env, jobject /*jobj*/, jintArray ctx, jobject stream,
+    jobjectArray buffers);
+
+/**
+ * Decode directly into the pixels of an android.graphics.Bitmap.
+ *
+ * @param ctx {out_status} tuple
+ * @param data [in] Buffer with encoded JXL stream
+ * @param bitmap [in] mutable ARGB_8888 or RGBA_F16 Bitmap of the image size
+ */
+JNIEXPORT void JNICALL
+Java_org_jpeg_jpegxl_wrapper_DecoderJni_nativeDecodeToBitmap(
+    JNIEnv* env, jobject /*jobj*/, jintArray ctx, jobject data_buffer,
+    jobject bitmap);
+
 #ifdef __cplusplus
 }
 #endif
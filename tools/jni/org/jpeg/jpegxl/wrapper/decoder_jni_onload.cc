@@ -6,6 +6,7 @@
 #include <jni.h>
 
 #include "tools/jni/org/jpeg/jpegxl/wrapper/decoder_jni.h"
+#include "tools/jni/org/jpeg/jpegxl/wrapper/encoder_jni.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,6 +17,14 @@ static char* kGetBasicInfoSig = const_cast<char*>("([ILjava/nio/Buffer;)V");
 static char* kGetPixelsName = const_cast<char*>("nativeGetPixels");
 static char* kGetPixelsInfoSig = const_cast<char*>(
     "([ILjava/nio/Buffer;Ljava/nio/Buffer;Ljava/nio/Buffer;)V");
+static char* kDecodeStreamName = const_cast<char*>("nativeDecodeStream");
+static char* kDecodeStreamSig =
+    const_cast<char*>("([ILjava/io/InputStream;[Ljava/nio/Buffer;)V");
+static char* kDecodeToBitmapName = const_cast<char*>("nativeDecodeToBitmap");
+static char* kDecodeToBitmapSig =
+    const_cast<char*>("([ILjava/nio/Buffer;Ljava/lang/Object;)V");
+static char* kEncodeName = const_cast<char*>("nativeEncode");
+static char* kEncodeSig = const_cast<char*>("([IFLjava/nio/Buffer;)[B");
 
 #define JXL_JNI_METHOD(NAME) \
   (reinterpret_cast<void*>(  \
@@ -23,12 +32,21 @@ static char* kGetPixelsInfoSig = const_cast<char*>(
 
 static const JNINativeMethod kDecoderMethods[] = {
     {kGetBasicInfoName, kGetBasicInfoSig, JXL_JNI_METHOD(GetBasicInfo)},
-    {kGetPixelsName, kGetPixelsInfoSig, JXL_JNI_METHOD(GetPixels)}};
+    {kGetPixelsName, kGetPixelsInfoSig, JXL_JNI_METHOD(GetPixels)},
+    {kDecodeStreamName, kDecodeStreamSig, JXL_JNI_METHOD(DecodeStream)},
+    {kDecodeToBitmapName, kDecodeToBitmapSig, JXL_JNI_METHOD(DecodeToBitmap)}};
 
-static const size_t kNumDecoderMethods = 2;
+static const size_t kNumDecoderMethods = 4;
 
 #undef JXL_JNI_METHOD
 
+static const JNINativeMethod kEncoderMethods[] = {
+    {kEncodeName, kEncodeSig,
+     reinterpret_cast<void*>(
+         Java_org_jpeg_jpegxl_wrapper_EncoderJni_nativeEncode)}};
+
+static const size_t kNumEncoderMethods = 1;
+
 JNIEXPORT jint JNI_OnLoad(JavaVM* vm, void* reserved) {
   JNIEnv* env;
   if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
@@ -44,6 +62,15 @@ JNIEXPORT jint JNI_OnLoad(JavaVM* vm, void* reserved) {
     return -1;
   }
 
+  clazz = env->FindClass("org/jpeg/jpegxl/wrapper/EncoderJni");
+  if (clazz == nullptr) {
+    return -1;
+  }
+
+  if (env->RegisterNatives(clazz, kEncoderMethods, kNumEncoderMethods) < 0) {
+    return -1;
+  }
+
   return JNI_VERSION_1_6;
 }
 
@@ -0,0 +1,192 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/jni/org/jpeg/jpegxl/wrapper/encoder_jni.h"
+
+#include <jni.h>
+#include <jxl/codestream_header.h>
+#include <jxl/color_encoding.h>
+#include <jxl/encode.h>
+#include <jxl/shared_parallel_runner.h>
+#include <jxl/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+enum class Status { OK = 0, FATAL_ERROR = -1 };
+
+bool IsOk(Status status) { return status == Status::OK; }
+
+#define FAILURE(M) Status::FATAL_ERROR
+
+// Same numbering as PixelFormat.java and the decoder.
+constexpr const size_t kLastPixelFormat = 3;
+
+JxlPixelFormat ToPixelFormat(size_t pixel_format) {
+  uint32_t num_channels = (pixel_format == 0 || pixel_format == 1) ? 4 : 3;
+  JxlDataType data_type =
+      (pixel_format == 0 || pixel_format == 2) ? JXL_TYPE_UINT8
+                                               : JXL_TYPE_FLOAT16;
+  return {num_channels, data_type, JXL_LITTLE_ENDIAN, /*align=*/0};
+}
+
+Status DoEncode(const uint8_t* pixels, size_t pixels_size, size_t width,
+                size_t height, size_t pixel_format, float distance,
+                int effort, std::vector<uint8_t>* compressed) {
+  JxlEncoder* enc = JxlEncoderCreate(nullptr);
+
+  // Same process-wide pool as the decoder; no thread is created per image.
+  void* runner =
+      JxlSharedParallelRunnerCreate(JxlSharedThreadPoolGetDefault(), 0);
+
+  struct Defer {
+    JxlEncoder* enc;
+    void* runner;
+    ~Defer() {
+      JxlEncoderDestroy(enc);
+      JxlSharedParallelRunnerDestroy(runner);
+    }
+  } defer{enc, runner};
+
+  if (JXL_ENC_SUCCESS !=
+      JxlEncoderSetParallelRunner(enc, JxlSharedParallelRunner, runner)) {
+    return FAILURE("Failed to set parallel runner");
+  }
+
+  JxlPixelFormat format = ToPixelFormat(pixel_format);
+  bool lossless = (distance == 0.0f);
+  JxlBasicInfo info;
+  JxlEncoderInitBasicInfo(&info);
+  info.xsize = width;
+  info.ysize = height;
+  if (format.data_type == JXL_TYPE_FLOAT16) {
+    info.bits_per_sample = 16;
+    info.exponent_bits_per_sample = 5;
+  } else {
+    info.bits_per_sample = 8;
+  }
+  if (format.num_channels == 4) {
+    info.num_extra_channels = 1;
+    info.alpha_bits = info.bits_per_sample;
+    info.alpha_exponent_bits = info.exponent_bits_per_sample;
+  }
+  info.uses_original_profile = TO_JXL_BOOL(lossless);
+  if (JXL_ENC_SUCCESS != JxlEncoderSetBasicInfo(enc, &info)) {
+    return FAILURE("Failed to set basic info");
+  }
+
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  if (format.data_type == JXL_TYPE_FLOAT16) {
+    color_encoding.transfer_function = JXL_TRANSFER_FUNCTION_LINEAR;
+  }
+  if (JXL_ENC_SUCCESS != JxlEncoderSetColorEncoding(enc, &color_encoding)) {
+    return FAILURE("Failed to set color encoding");
+  }
+
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc, nullptr);
+  if (lossless) {
+    if (JXL_ENC_SUCCESS != JxlEncoderSetFrameLossless(frame_settings, 1)) {
+      return FAILURE("Failed to set lossless");
+    }
+  } else if (JXL_ENC_SUCCESS !=
+             JxlEncoderSetFrameDistance(frame_settings, distance)) {
+    return FAILURE("Invalid distance");
+  }
+  if (JXL_ENC_SUCCESS != JxlEncoderFrameSettingsSetOption(
+                             frame_settings, JXL_ENC_FRAME_SETTING_EFFORT,
+                             effort)) {
+    return FAILURE("Invalid effort");
+  }
+  if (JXL_ENC_SUCCESS != JxlEncoderAddImageFrame(frame_settings, &format,
+                                                 pixels, pixels_size)) {
+    return FAILURE("Failed to add image frame");
+  }
+  JxlEncoderCloseInput(enc);
+
+  compressed->resize(64 << 10);
+  uint8_t* next_out = compressed->data();
+  size_t avail_out = compressed->size();
+  JxlEncoderStatus status = JXL_ENC_NEED_MORE_OUTPUT;
+  while (status == JXL_ENC_NEED_MORE_OUTPUT) {
+    status = JxlEncoderProcessOutput(enc, &next_out, &avail_out);
+    if (status == JXL_ENC_NEED_MORE_OUTPUT) {
+      size_t offset = next_out - compressed->data();
+      compressed->resize(compressed->size() * 2);
+      next_out = compressed->data() + offset;
+      avail_out = compressed->size() - offset;
+    }
+  }
+  if (status != JXL_ENC_SUCCESS) return FAILURE("Failed to encode");
+  compressed->resize(next_out - compressed->data());
+  return Status::OK;
+}
+
+}  // namespace
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+JNIEXPORT jbyteArray JNICALL
+Java_org_jpeg_jpegxl_wrapper_EncoderJni_nativeEncode(
+    JNIEnv* env, jobject /* jobj */, jintArray ctx, jfloat distance,
+    jobject pixels_buffer) {
+  jint context[4] = {0};
+  env->GetIntArrayRegion(ctx, 0, 4, context);
+
+  Status status = Status::OK;
+  size_t pixel_format = context[0];
+  if (pixel_format > kLastPixelFormat) {
+    status = FAILURE("Unrecognized pixel format");
+  }
+  if (IsOk(status) && (context[1] <= 0 || context[2] <= 0)) {
+    status = FAILURE("Invalid image dimensions");
+  }
+
+  const uint8_t* pixels = nullptr;
+  size_t pixels_size = 0;
+  if (IsOk(status)) {
+    pixels = reinterpret_cast<const uint8_t*>(
+        env->GetDirectBufferAddress(pixels_buffer));
+    jlong capacity = env->GetDirectBufferCapacity(pixels_buffer);
+    if (pixels == nullptr || capacity < 0) {
+      status = FAILURE("Failed to access pixels buffer");
+    } else {
+      pixels_size = static_cast<size_t>(capacity);
+    }
+  }
+
+  std::vector<uint8_t> compressed;
+  if (IsOk(status)) {
+    status = DoEncode(pixels, pixels_size, context[1], context[2],
+                      pixel_format, distance, context[3], &compressed);
+  }
+
+  jbyteArray result = nullptr;
+  if (IsOk(status)) {
+    result = env->NewByteArray(static_cast<jsize>(compressed.size()));
+    if (result == nullptr) {
+      status = FAILURE("Failed to allocate output");
+    } else {
+      env->SetByteArrayRegion(result, 0, static_cast<jsize>(compressed.size()),
+                              reinterpret_cast<jbyte*>(compressed.data()));
+    }
+  }
+
+  context[0] = static_cast<int>(status);
+  env->SetIntArrayRegion(ctx, 0, 1, context);
+  return result;
+}
+
+#undef FAILURE
+
+#ifdef __cplusplus
+}
+#endif
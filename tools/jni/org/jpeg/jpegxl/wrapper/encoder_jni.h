@@ -0,0 +1,33 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_JNI_ORG_JPEG_JPEGXL_WRAPPER_ENCODER_JNI
+#define TOOLS_JNI_ORG_JPEG_JPEGXL_WRAPPER_ENCODER_JNI
+
+#include <jni.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Encode an image.
+ *
+ * @param ctx {in_pixel_format_out_status, in_width, in_height, in_effort}
+ *            tuple
+ * @param distance [in] Butteraugli distance, 0 for lossless
+ * @param pixels [in] Buffer with packed pixels in the given pixel format
+ * @return encoded JXL stream, null on failure
+ */
+JNIEXPORT jbyteArray JNICALL
+Java_org_jpeg_jpegxl_wrapper_EncoderJni_nativeEncode(
+    JNIEnv* env, jobject /*jobj*/, jintArray ctx, jfloat distance,
+    jobject pixels_buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TOOLS_JNI_ORG_JPEG_JPEGXL_WRAPPER_ENCODER_JNI
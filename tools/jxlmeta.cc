@@ -0,0 +1,123 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Changes the metadata boxes of a JPEG XL file, or switches it between a bare
+// codestream and a container, without decoding the image.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lib/extras/box_rewrite.h"
+#include "tools/cmdline.h"
+#include "tools/file_io.h"
+
+namespace {
+
+bool AppendString(const char* arg, std::vector<std::string>* out) {
+  out->emplace_back(arg);
+  return true;
+}
+
+// Adds a box of the type `type` with the contents of the file `filename`,
+// replacing the existing ones.
+bool AddBoxFromFile(const std::string& type, const std::string& filename,
+                    jxl::extras::JXLBoxRewriteParams* params) {
+  std::vector<uint8_t> contents;
+  if (!jpegxl::tools::ReadFile(filename, &contents)) {
+    fprintf(stderr, "Could not read %s\n", filename.c_str());
+    return false;
+  }
+  params->remove_types.push_back(type);
+  params->add_boxes.push_back({type, std::move(contents)});
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+  jpegxl::tools::CommandLineParser parser;
+  const char* input_filename = nullptr;
+  auto input_option = parser.AddPositionalOption(
+      "INPUT", true, "input JPEG XL file", &input_filename, 0);
+  const char* output_filename = nullptr;
+  auto output_option = parser.AddPositionalOption(
+      "OUTPUT", true, "output JPEG XL file", &output_filename, 0);
+
+  std::string exif;
+  parser.AddOptionValue('\0', "exif", "FILE",
+                        "Replaces the Exif boxes by the contents of FILE, "
+                        "which include the 4-byte TIFF header offset.",
+                        &exif, &jpegxl::tools::ParseString);
+  std::string xmp;
+  parser.AddOptionValue('\0', "xmp", "FILE",
+                        "Replaces the XMP boxes by the contents of FILE.", &xmp,
+                        &jpegxl::tools::ParseString);
+  std::string gain_map;
+  parser.AddOptionValue('\0', "gain_map", "FILE",
+                        "Replaces the gain map boxes (jhgm) by the contents of "
+                        "FILE.",
+                        &gain_map, &jpegxl::tools::ParseString);
+  std::vector<std::string> remove_types;
+  parser.AddOptionValue('\0', "remove", "TYPE",
+                        "Removes the boxes of this 4-character type, also when "
+                        "they are brob compressed, e.g. --remove=Exif. Can be "
+                        "repeated.",
+                        &remove_types, &AppendString);
+  bool codestream = false;
+  parser.AddOptionFlag('\0', "codestream",
+                       "Writes a bare codestream instead of a container, which "
+                       "fails if boxes other than the codestream remain.",
+                       &codestream, &jpegxl::tools::SetBooleanTrue);
+  size_t jxlp_size = 0;
+  parser.AddOptionValue('\0', "jxlp_size", "N",
+                        "Splits the codestream into jxlp boxes of at most N "
+                        "bytes. 0 = a single jxlc box (default).",
+                        &jxlp_size, &jpegxl::tools::ParseUnsigned);
+
+  if (!parser.Parse(argc, argv)) {
+    fprintf(stderr, "See -h for help.\n");
+    return EXIT_FAILURE;
+  }
+  if (parser.HelpFlagPassed()) {
+    parser.PrintHelp();
+    return EXIT_SUCCESS;
+  }
+  if (!parser.GetOption(input_option)->matched() ||
+      !parser.GetOption(output_option)->matched()) {
+    fprintf(stderr, "Missing input or output filename.\nSee -h for help.\n");
+    return EXIT_FAILURE;
+  }
+
+  jxl::extras::JXLBoxRewriteParams params;
+  params.remove_types = remove_types;
+  params.use_container = !codestream;
+  params.jxlp_size = jxlp_size;
+  if ((!exif.empty() && !AddBoxFromFile("Exif", exif, &params)) ||
+      (!xmp.empty() && !AddBoxFromFile("xml ", xmp, &params)) ||
+      (!gain_map.empty() && !AddBoxFromFile("jhgm", gain_map, &params))) {
+    return EXIT_FAILURE;
+  }
+
+  std::vector<uint8_t> input;
+  if (!jpegxl::tools::ReadFile(input_filename, &input)) {
+    fprintf(stderr, "Could not read %s\n", input_filename);
+    return EXIT_FAILURE;
+  }
+  std::vector<uint8_t> output;
+  if (!jxl::extras::RewriteJXLBoxes(input.data(), input.size(), params,
+                                    &output)) {
+    fprintf(stderr, "Could not rewrite the boxes of %s\n", input_filename);
+    return EXIT_FAILURE;
+  }
+  if (!jpegxl::tools::WriteFile(output_filename, output)) {
+    fprintf(stderr, "Could not write %s\n", output_filename);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
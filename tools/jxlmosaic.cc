@@ -0,0 +1,111 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Combines JPEG XL tiles into one image, or crops one, without decoding or
+// re-encoding them.
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lib/extras/codestream_mosaic.h"
+#include "tools/cmdline.h"
+#include "tools/file_io.h"
+#include "tools/no_memory_manager.h"
+
+namespace {
+
+struct TileArg {
+  int32_t x0;
+  int32_t y0;
+  std::string filename;
+};
+
+// Parses "X,Y,FILE".
+bool ParseTile(const char* arg, std::vector<TileArg>* out) {
+  TileArg tile;
+  int consumed = 0;
+  if (sscanf(arg, "%" SCNd32 ",%" SCNd32 ",%n", &tile.x0, &tile.y0,
+             &consumed) != 2 ||
+      arg[consumed] == '\0') {
+    fprintf(stderr, "Invalid tile %s, expected X,Y,FILE\n", arg);
+    return false;
+  }
+  tile.filename = arg + consumed;
+  out->push_back(tile);
+  return true;
+}
+
+// Parses "WxH".
+bool ParseSize(const char* arg, std::pair<size_t, size_t>* size) {
+  char end;
+  if (sscanf(arg, "%zux%zu%c", &size->first, &size->second, &end) != 2 ||
+      size->first == 0 || size->second == 0) {
+    fprintf(stderr, "Invalid size %s, expected WxH\n", arg);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+  jpegxl::tools::CommandLineParser parser;
+  const char* output_filename = nullptr;
+  auto output_option = parser.AddPositionalOption(
+      "OUTPUT", true, "output JPEG XL codestream", &output_filename, 0);
+  std::pair<size_t, size_t> size = {0, 0};
+  parser.AddOptionValue('\0', "size", "WxH", "Size of the output image.",
+                        &size, &ParseSize);
+  std::vector<TileArg> tiles;
+  parser.AddOptionValue('\0', "tile", "X,Y,FILE",
+                        "Places the JPEG XL image FILE with its top-left "
+                        "corner at (X, Y). Can be repeated, later tiles are "
+                        "over the earlier ones. A single tile at a negative "
+                        "position crops it.",
+                        &tiles, &ParseTile);
+
+  if (!parser.Parse(argc, argv)) {
+    fprintf(stderr, "See -h for help.\n");
+    return EXIT_FAILURE;
+  }
+  if (parser.HelpFlagPassed()) {
+    parser.PrintHelp();
+    return EXIT_SUCCESS;
+  }
+  if (!parser.GetOption(output_option)->matched() || size.first == 0 ||
+      tiles.empty()) {
+    fprintf(stderr, "Missing output, size or tiles.\nSee -h for help.\n");
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::vector<uint8_t>> inputs(tiles.size());
+  std::vector<jxl::extras::JXLMosaicTile> mosaic_tiles;
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    if (!jpegxl::tools::ReadFile(tiles[i].filename, &inputs[i])) {
+      fprintf(stderr, "Could not read %s\n", tiles[i].filename.c_str());
+      return EXIT_FAILURE;
+    }
+    mosaic_tiles.push_back(
+        {inputs[i].data(), inputs[i].size(), tiles[i].x0, tiles[i].y0});
+  }
+  std::vector<uint8_t> output;
+  if (!jxl::extras::ComposeJXLMosaic(jpegxl::tools::NoMemoryManager(),
+                                     mosaic_tiles, size.first, size.second,
+                                     &output)) {
+    fprintf(stderr, "Could not combine the tiles\n");
+    return EXIT_FAILURE;
+  }
+  if (!jpegxl::tools::WriteFile(output_filename, output)) {
+    fprintf(stderr, "Could not write %s\n", output_filename);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -92,6 +92,8 @@ def SplitLibFiles(repo_files):
   jpegli_libjpeg_helper_files, jpegli_testlib_files = Filter(
     jpegli_testlib_files, ContainsFn('libjpeg_test_util'))
   gbench_sources, srcs = Filter(srcs, HasSuffixFn('_gbench.cc'))
+  jpegli_gbench_sources, jpegli_srcs = Filter(
+      jpegli_srcs, HasSuffixFn('_gbench.cc'))
 
   extras_sources, srcs = Filter(srcs, HasPrefixFn('extras/'))
   lib_srcs, srcs = Filter(srcs, HasPrefixFn('jxl/'))
@@ -110,7 +112,7 @@ def SplitLibFiles(repo_files):
       public_headers, ContainsFn('_parallel_runner'))
 
   codec_names = ['apng', 'exr', 'gif', 'jpegli', 'jpg', 'jxl', 'npy', 'pgx',
-    'pnm']
+    'pnm', 'y4m']
   codecs = {}
   for codec in codec_names:
     codec_sources, extras_sources = Filter(extras_sources, HasPrefixFn(
@@ -150,6 +152,7 @@ def SplitLibFiles(repo_files):
     'extras_for_tools_sources': extras_for_tools_sources,
     'extras_sources': extras_sources,
     'gbench_sources': gbench_sources,
+    'jpegli_gbench_sources': jpegli_gbench_sources,
     'jpegli_sources': jpegli_sources,
     'jpegli_testlib_files': jpegli_testlib_files,
     'jpegli_libjpeg_helper_files': jpegli_libjpeg_helper_files,
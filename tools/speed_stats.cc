@@ -11,9 +11,88 @@
 #include <cstdio>
 #include <string>
 
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
 namespace jpegxl {
 namespace tools {
 
+namespace {
+
+#if defined(__linux__)
+// File descriptors of the cycles, instructions, cache misses and branch
+// misses counters, in the order of PerfCounts.
+int perf_fds[4] = {-1, -1, -1, -1};
+
+int OpenPerfCounter(uint64_t config) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  // Also count the threads created afterwards, e.g. the thread pool.
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return static_cast<int>(syscall(__NR_perf_event_open, &attr, /*pid=*/0,
+                                  /*cpu=*/-1, /*group_fd=*/-1, /*flags=*/0));
+}
+
+bool ReadPerfCounter(int fd, uint64_t* count) {
+  uint64_t values[3];  // value, time enabled, time running
+  if (read(fd, values, sizeof(values)) != sizeof(values)) return false;
+  *count = values[2] == 0 ? 0
+                          : static_cast<uint64_t>(
+                                values[0] * (static_cast<double>(values[1]) /
+                                             values[2]));
+  return true;
+}
+#endif
+
+}  // namespace
+
+bool StartPerfCounters() {
+#if defined(__linux__)
+  if (perf_fds[0] >= 0) return true;
+  const uint64_t configs[4] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+  for (size_t i = 0; i < 4; ++i) {
+    perf_fds[i] = OpenPerfCounter(configs[i]);
+    if (perf_fds[i] < 0) {
+      for (size_t j = 0; j <= i; ++j) {
+        if (perf_fds[j] >= 0) close(perf_fds[j]);
+        perf_fds[j] = -1;
+      }
+      return false;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool ReadPerfCounters(PerfCounts* counts) {
+#if defined(__linux__)
+  if (perf_fds[0] < 0) return false;
+  return ReadPerfCounter(perf_fds[0], &counts->cycles) &&
+         ReadPerfCounter(perf_fds[1], &counts->instructions) &&
+         ReadPerfCounter(perf_fds[2], &counts->cache_misses) &&
+         ReadPerfCounter(perf_fds[3], &counts->branch_misses);
+#else
+  (void)counts;
+  return false;
+#endif
+}
+
 void SpeedStats::NotifyElapsed(double elapsed_seconds) {
   if (elapsed_seconds > 0.0) {
     elapsed_.push_back(elapsed_seconds);
@@ -105,6 +184,20 @@ bool SpeedStats::Print(size_t worker_threads) {
           static_cast<int>(xsize_), static_cast<int>(ysize_), mps_stats.c_str(),
           mbs_stats.c_str(), static_cast<int>(elapsed_.size()),
           static_cast<int>(worker_threads));
+  if (perf_runs_ > 0) {
+    const PerfCounts& c = perf_counts_;
+    // Per pixel if the image size is known, else per run.
+    const size_t pixels = xsize_ * ysize_;
+    const double units =
+        static_cast<double>(perf_runs_) * std::max<size_t>(pixels, 1);
+    fprintf(stderr,
+            "%.2f cycles, %.2f instructions (IPC %.2f), %.4f cache misses, "
+            "%.4f branch misses per %s.\n",
+            c.cycles / units, c.instructions / units,
+            c.cycles ? static_cast<double>(c.instructions) / c.cycles : 0.0,
+            c.cache_misses / units, c.branch_misses / units,
+            pixels != 0 ? "pixel" : "run");
+  }
   return true;
 }
 
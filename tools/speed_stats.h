@@ -14,10 +14,47 @@
 namespace jpegxl {
 namespace tools {
 
+// Counts of hardware events, in user space.
+struct PerfCounts {
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t cache_misses = 0;
+  uint64_t branch_misses = 0;
+
+  PerfCounts& operator+=(const PerfCounts& other) {
+    cycles += other.cycles;
+    instructions += other.instructions;
+    cache_misses += other.cache_misses;
+    branch_misses += other.branch_misses;
+    return *this;
+  }
+};
+
+// Starts counting the hardware events of the process with Linux perf_event.
+// Only the calling thread and the threads it creates afterwards are counted,
+// so this must be called before creating the thread pools. Returns false if
+// the counters are not available, e.g. not on Linux, or when the kernel
+// forbids them (see /proc/sys/kernel/perf_event_paranoid).
+bool StartPerfCounters();
+
+// Returns the events counted since StartPerfCounters, or false if the
+// counters were not started. Counters multiplexed by the kernel are scaled.
+bool ReadPerfCounters(PerfCounts* counts);
+
 class SpeedStats {
  public:
   void NotifyElapsed(double elapsed_seconds);
 
+  // Adds the hardware events of one run.
+  void NotifyPerfCounts(const PerfCounts& counts) {
+    perf_counts_ += counts;
+    perf_runs_++;
+  }
+
+  // Sum of the hardware events of the runs and their number.
+  const PerfCounts& perf_counts() const { return perf_counts_; }
+  size_t perf_runs() const { return perf_runs_; }
+
   struct Summary {
     // How central_tendency was computed - depends on number of reps.
     const char* type;
@@ -47,6 +84,8 @@ class SpeedStats {
 
  private:
   std::vector<double> elapsed_;
+  PerfCounts perf_counts_;
+  size_t perf_runs_ = 0;
   size_t xsize_ = 0;
   size_t ysize_ = 0;
 
@@ -55,6 +94,30 @@ class SpeedStats {
   size_t file_size_ = 0;
 };
 
+// Adds the hardware events between construction and destruction to `stats`,
+// if it is not null and StartPerfCounters succeeded.
+class ScopedPerfCounts {
+ public:
+  explicit ScopedPerfCounts(SpeedStats* stats)
+      : stats_(stats && ReadPerfCounters(&begin_) ? stats : nullptr) {}
+  ~ScopedPerfCounts() {
+    PerfCounts end;
+    if (!stats_ || !ReadPerfCounters(&end)) return;
+    PerfCounts counts;
+    counts.cycles = end.cycles - begin_.cycles;
+    counts.instructions = end.instructions - begin_.instructions;
+    counts.cache_misses = end.cache_misses - begin_.cache_misses;
+    counts.branch_misses = end.branch_misses - begin_.branch_misses;
+    stats_->NotifyPerfCounts(counts);
+  }
+  ScopedPerfCounts(const ScopedPerfCounts&) = delete;
+  ScopedPerfCounts& operator=(const ScopedPerfCounts&) = delete;
+
+ private:
+  PerfCounts begin_;
+  SpeedStats* stats_;
+};
+
 }  // namespace tools
 }  // namespace jpegxl
 
@@ -32,14 +32,18 @@ Design:
 #include <cstdio>
 #include <hwy/aligned_allocator.h>
 #include <utility>
+#include <vector>
 
+#include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/enc_xyb.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
+#include "lib/jxl/image_ops.h"
 #include "tools/gauss_blur.h"
 #include "tools/no_memory_manager.h"
 
@@ -53,6 +57,8 @@ using jxl::StatusOr;
 
 const float kC2 = 0.0009f;
 const int kNumScales = 6;
+static_assert(kSsimulacra2TileAlign == 1 << (kNumScales - 1),
+              "Tiles must start at pixels of all the scales");
 
 StatusOr<Image3F> Downsample(const Image3F& in, size_t fx, size_t fy) {
   const size_t out_xsize = (in.xsize() + fx - 1) / fx;
@@ -104,21 +110,22 @@ class Blur {
     return result;
   }
 
-  Status BlurPlane(const ImageF& in, ImageF* JXL_RESTRICT out) {
+  Status BlurPlane(const ImageF& in, ImageF* JXL_RESTRICT out,
+                   jxl::ThreadPool* pool) {
     JXL_RETURN_IF_ERROR(FastGaussian(
         rg_, in.xsize(), in.ysize(), [&](size_t y) { return in.ConstRow(y); },
         [&](size_t y) { return temp_.Row(y); },
-        [&](size_t y) { return out->Row(y); }));
+        [&](size_t y) { return out->Row(y); }, pool));
     return true;
   }
 
-  StatusOr<Image3F> operator()(const Image3F& in) {
+  StatusOr<Image3F> operator()(const Image3F& in, jxl::ThreadPool* pool) {
     JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
     JXL_ASSIGN_OR_RETURN(
         Image3F out, Image3F::Create(memory_manager, in.xsize(), in.ysize()));
-    JXL_RETURN_IF_ERROR(BlurPlane(in.Plane(0), &out.Plane(0)));
-    JXL_RETURN_IF_ERROR(BlurPlane(in.Plane(1), &out.Plane(1)));
-    JXL_RETURN_IF_ERROR(BlurPlane(in.Plane(2), &out.Plane(2)));
+    JXL_RETURN_IF_ERROR(BlurPlane(in.Plane(0), &out.Plane(0), pool));
+    JXL_RETURN_IF_ERROR(BlurPlane(in.Plane(1), &out.Plane(1), pool));
+    JXL_RETURN_IF_ERROR(BlurPlane(in.Plane(2), &out.Plane(2), pool));
     return out;
   }
 
@@ -138,18 +145,20 @@ double quartic(double x) {
   x *= x;
   return x;
 }
+// Adds the sums over 'rect' of the SSIM' errors and of their fourth powers to
+// 'plane_sums'.
 void SSIMMap(const Image3F& m1, const Image3F& m2, const Image3F& s11,
-             const Image3F& s22, const Image3F& s12, double* plane_averages) {
-  const double onePerPixels = 1.0 / (m1.ysize() * m1.xsize());
+             const Image3F& s22, const Image3F& s12, const jxl::Rect& rect,
+             double* plane_sums) {
   for (size_t c = 0; c < 3; ++c) {
     double sum1[2] = {0.0};
-    for (size_t y = 0; y < m1.ysize(); ++y) {
+    for (size_t y = rect.y0(); y < rect.y1(); ++y) {
       const float* JXL_RESTRICT row_m1 = m1.PlaneRow(c, y);
       const float* JXL_RESTRICT row_m2 = m2.PlaneRow(c, y);
       const float* JXL_RESTRICT row_s11 = s11.PlaneRow(c, y);
       const float* JXL_RESTRICT row_s22 = s22.PlaneRow(c, y);
       const float* JXL_RESTRICT row_s12 = s12.PlaneRow(c, y);
-      for (size_t x = 0; x < m1.xsize(); ++x) {
+      for (size_t x = rect.x0(); x < rect.x1(); ++x) {
         float mu1 = row_m1[x];
         float mu2 = row_m2[x];
         float mu11 = mu1 * mu1;
@@ -180,22 +189,23 @@ void SSIMMap(const Image3F& m1, const Image3F& m2, const Image3F& s11,
         sum1[1] += quartic(d);
       }
     }
-    plane_averages[c * 2] = onePerPixels * sum1[0];
-    plane_averages[c * 2 + 1] = sqrt(sqrt(onePerPixels * sum1[1]));
+    plane_sums[c * 2] += sum1[0];
+    plane_sums[c * 2 + 1] += sum1[1];
   }
 }
 
+// Same as SSIMMap for the artifact and detail lost errors.
 void EdgeDiffMap(const Image3F& img1, const Image3F& mu1, const Image3F& img2,
-                 const Image3F& mu2, double* plane_averages) {
-  const double onePerPixels = 1.0 / (img1.ysize() * img1.xsize());
+                 const Image3F& mu2, const jxl::Rect& rect,
+                 double* plane_sums) {
   for (size_t c = 0; c < 3; ++c) {
     double sum1[4] = {0.0};
-    for (size_t y = 0; y < img1.ysize(); ++y) {
+    for (size_t y = rect.y0(); y < rect.y1(); ++y) {
       const float* JXL_RESTRICT row1 = img1.PlaneRow(c, y);
       const float* JXL_RESTRICT row2 = img2.PlaneRow(c, y);
       const float* JXL_RESTRICT rowm1 = mu1.PlaneRow(c, y);
       const float* JXL_RESTRICT rowm2 = mu2.PlaneRow(c, y);
-      for (size_t x = 0; x < img1.xsize(); ++x) {
+      for (size_t x = rect.x0(); x < rect.x1(); ++x) {
         double d1 = (1.0 + std::abs(row2[x] - rowm2[x])) /
                         (1.0 + std::abs(row1[x] - rowm1[x])) -
                     1.0;
@@ -213,13 +223,70 @@ void EdgeDiffMap(const Image3F& img1, const Image3F& mu1, const Image3F& img2,
         sum1[3] += quartic(detail_lost);
       }
     }
-    plane_averages[c * 4] = onePerPixels * sum1[0];
-    plane_averages[c * 4 + 1] = sqrt(sqrt(onePerPixels * sum1[1]));
-    plane_averages[c * 4 + 2] = onePerPixels * sum1[2];
-    plane_averages[c * 4 + 3] = sqrt(sqrt(onePerPixels * sum1[3]));
+    for (size_t i = 0; i < 4; ++i) plane_sums[c * 4 + i] += sum1[i];
   }
 }
 
+// Turns the sums of SSIMMap and EdgeDiffMap over all the pixels of each scale
+// of a 'xsize' x 'ysize' image into the 1-norms and 4-norms of the errors.
+Msssim NormsFromSums(const std::vector<MsssimScale>& sums, size_t xsize,
+                     size_t ysize) {
+  const auto norm = [](double sum, size_t i, double onePerPixels) {
+    return (i % 2 == 0) ? onePerPixels * sum : sqrt(sqrt(onePerPixels * sum));
+  };
+  Msssim msssim;
+  for (const MsssimScale& sum : sums) {
+    const double onePerPixels = 1.0 / (ysize * xsize);
+    MsssimScale sscale;
+    for (size_t i = 0; i < 3 * 2; ++i) {
+      sscale.avg_ssim[i] = norm(sum.avg_ssim[i], i, onePerPixels);
+    }
+    for (size_t i = 0; i < 3 * 4; ++i) {
+      sscale.avg_edgediff[i] = norm(sum.avg_edgediff[i], i, onePerPixels);
+    }
+    msssim.scales.push_back(sscale);
+    xsize = jxl::DivCeil(xsize, 2);
+    ysize = jxl::DivCeil(ysize, 2);
+  }
+  return msssim;
+}
+
+// Returns the number of scales computed for a 'xsize' x 'ysize' image.
+size_t NumScales(size_t xsize, size_t ysize) {
+  size_t num_scales = 0;
+  for (; num_scales < kNumScales; ++num_scales) {
+    if (xsize < 8 || ysize < 8) break;
+    if (num_scales) {
+      xsize = jxl::DivCeil(xsize, 2);
+      ysize = jxl::DivCeil(ysize, 2);
+    }
+  }
+  return num_scales;
+}
+
+// Returns a copy of 'rect' of 'in', with its extra channels.
+StatusOr<ImageBundle> CropBundle(const ImageBundle& in, const jxl::Rect& rect) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  ImageBundle out(memory_manager, in.metadata());
+  JXL_ASSIGN_OR_RETURN(
+      Image3F color,
+      Image3F::Create(memory_manager, rect.xsize(), rect.ysize()));
+  JXL_RETURN_IF_ERROR(
+      jxl::CopyImageTo(rect, in.color(), jxl::Rect(color), &color));
+  JXL_RETURN_IF_ERROR(out.SetFromImage(std::move(color), in.c_current()));
+  std::vector<ImageF> extra_channels;
+  for (const ImageF& in_ec : in.extra_channels()) {
+    JXL_ASSIGN_OR_RETURN(
+        ImageF ec, ImageF::Create(memory_manager, rect.xsize(), rect.ysize()));
+    JXL_RETURN_IF_ERROR(jxl::CopyImageTo(rect, in_ec, jxl::Rect(ec), &ec));
+    extra_channels.push_back(std::move(ec));
+  }
+  if (!extra_channels.empty()) {
+    JXL_RETURN_IF_ERROR(out.SetExtraChannels(std::move(extra_channels)));
+  }
+  return out;
+}
+
 /* Get all components in more or less 0..1 range
    Range of Rec2020 with these adjustments:
     X: 0.017223..0.998838
@@ -259,6 +326,36 @@ void AlphaBlend(ImageBundle& img, float bg) {
   }
 }
 
+// Returns a linear sRGB copy of 'in' without extra channels, with alpha
+// blended against 'bg'.
+StatusOr<ImageBundle> ToLinearSRGB(const ImageBundle& in, float bg,
+                                   jxl::ThreadPool* pool) {
+  JXL_ASSIGN_OR_RETURN(ImageBundle out, in.Copy());
+  if (in.HasAlpha()) AlphaBlend(out, bg);
+  out.ClearExtraChannels();
+  JXL_RETURN_IF_ERROR(out.TransformTo(
+      jxl::ColorEncoding::LinearSRGB(out.IsGray()), *JxlGetDefaultCms(), pool));
+  return out;
+}
+
+// Replaces the linear sRGB image 'img' with its 2x2 downscale.
+Status DownsampleLinear(ImageBundle& img) {
+  JXL_ASSIGN_OR_RETURN(Image3F tmp, Downsample(*img.color(), 2, 2));
+  return img.SetFromImage(std::move(tmp),
+                          jxl::ColorEncoding::LinearSRGB(img.IsGray()));
+}
+
+// Converts the linear sRGB image 'img' to positive XYB.
+StatusOr<Image3F> PositiveXYB(const ImageBundle& img, jxl::ThreadPool* pool) {
+  JXL_ASSIGN_OR_RETURN(Image3F xyb,
+                       Image3F::Create(jpegxl::tools::NoMemoryManager(),
+                                       img.xsize(), img.ysize()));
+  JXL_RETURN_IF_ERROR(
+      jxl::ToXYB(img, pool, &xyb, *JxlGetDefaultCms(), nullptr));
+  MakePositiveXYB(xyb);
+  return xyb;
+}
+
 }  // namespace
 
 /*
@@ -444,86 +541,138 @@ double Msssim::Score() const {
   return ssim;
 }
 
-StatusOr<Msssim> ComputeSSIMULACRA2(const ImageBundle& orig,
-                                    const ImageBundle& dist, float bg) {
+StatusOr<Ssimulacra2Reference> Ssimulacra2Reference::Create(
+    const ImageBundle& orig, float bg, jxl::ThreadPool* pool) {
   JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
-  Msssim msssim;
+  Ssimulacra2Reference reference;
+  reference.bg_ = bg;
+  reference.xsize_ = orig.xsize();
+  reference.ysize_ = orig.ysize();
 
+  JXL_ASSIGN_OR_RETURN(ImageBundle orig2, ToLinearSRGB(orig, bg, pool));
   JXL_ASSIGN_OR_RETURN(
-      Image3F img1,
-      Image3F::Create(memory_manager, orig.xsize(), orig.ysize()));
-  JXL_ASSIGN_OR_RETURN(
-      Image3F img2,
-      Image3F::Create(memory_manager, img1.xsize(), img1.ysize()));
-
-  JXL_ASSIGN_OR_RETURN(ImageBundle orig2, orig.Copy());
-  JXL_ASSIGN_OR_RETURN(ImageBundle dist2, dist.Copy());
-
-  if (orig.HasAlpha()) AlphaBlend(orig2, bg);
-  if (dist.HasAlpha()) AlphaBlend(dist2, bg);
-  orig2.ClearExtraChannels();
-  dist2.ClearExtraChannels();
-
-  JXL_RETURN_IF_ERROR(orig2.TransformTo(
-      jxl::ColorEncoding::LinearSRGB(orig2.IsGray()), *JxlGetDefaultCms()));
-  JXL_RETURN_IF_ERROR(dist2.TransformTo(
-      jxl::ColorEncoding::LinearSRGB(dist2.IsGray()), *JxlGetDefaultCms()));
-
-  JXL_RETURN_IF_ERROR(
-      jxl::ToXYB(orig2, nullptr, &img1, *JxlGetDefaultCms(), nullptr));
-  JXL_RETURN_IF_ERROR(
-      jxl::ToXYB(dist2, nullptr, &img2, *JxlGetDefaultCms(), nullptr));
-  MakePositiveXYB(img1);
-  MakePositiveXYB(img2);
-
-  JXL_ASSIGN_OR_RETURN(
-      Image3F mul, Image3F::Create(memory_manager, img1.xsize(), img1.ysize()));
-  JXL_ASSIGN_OR_RETURN(Blur blur, Blur::Create(img1.xsize(), img1.ysize()));
+      Image3F mul, Image3F::Create(memory_manager, orig.xsize(), orig.ysize()));
+  JXL_ASSIGN_OR_RETURN(Blur blur, Blur::Create(orig.xsize(), orig.ysize()));
 
+  size_t xsize = orig.xsize();
+  size_t ysize = orig.ysize();
   for (int scale = 0; scale < kNumScales; scale++) {
-    if (img1.xsize() < 8 || img1.ysize() < 8) {
+    if (xsize < 8 || ysize < 8) {
       break;
     }
     if (scale) {
-      JXL_ASSIGN_OR_RETURN(Image3F tmp, Downsample(*orig2.color(), 2, 2));
-      JXL_RETURN_IF_ERROR(orig2.SetFromImage(
-          std::move(tmp), jxl::ColorEncoding::LinearSRGB(orig2.IsGray())));
-      JXL_ASSIGN_OR_RETURN(tmp, Downsample(*dist2.color(), 2, 2));
-      JXL_RETURN_IF_ERROR(dist2.SetFromImage(
-          std::move(tmp), jxl::ColorEncoding::LinearSRGB(dist2.IsGray())));
-      JXL_RETURN_IF_ERROR(img1.ShrinkTo(orig2.xsize(), orig2.ysize()));
-      JXL_RETURN_IF_ERROR(img2.ShrinkTo(orig2.xsize(), orig2.ysize()));
-      JXL_RETURN_IF_ERROR(
-          jxl::ToXYB(orig2, nullptr, &img1, *JxlGetDefaultCms(), nullptr));
-      JXL_RETURN_IF_ERROR(
-          jxl::ToXYB(dist2, nullptr, &img2, *JxlGetDefaultCms(), nullptr));
-      MakePositiveXYB(img1);
-      MakePositiveXYB(img2);
+      JXL_RETURN_IF_ERROR(DownsampleLinear(orig2));
     }
-    JXL_RETURN_IF_ERROR(mul.ShrinkTo(img1.xsize(), img1.ysize()));
-    JXL_RETURN_IF_ERROR(blur.ShrinkTo(img1.xsize(), img1.ysize()));
+    Scale s;
+    JXL_ASSIGN_OR_RETURN(s.xyb, PositiveXYB(orig2, pool));
+    xsize = s.xyb.xsize();
+    ysize = s.xyb.ysize();
+    JXL_RETURN_IF_ERROR(mul.ShrinkTo(xsize, ysize));
+    JXL_RETURN_IF_ERROR(blur.ShrinkTo(xsize, ysize));
+
+    Multiply(s.xyb, s.xyb, &mul);
+    JXL_ASSIGN_OR_RETURN(s.sigma_sq, blur(mul, pool));
+    JXL_ASSIGN_OR_RETURN(s.mu, blur(s.xyb, pool));
+    reference.scales_.push_back(std::move(s));
+  }
+  return reference;
+}
+
+StatusOr<Msssim> Ssimulacra2Reference::Compare(const ImageBundle& distorted,
+                                               jxl::ThreadPool* pool) const {
+  std::vector<MsssimScale> sums(scales_.size(), MsssimScale{});
+  JXL_RETURN_IF_ERROR(
+      AddSums(distorted, jxl::Rect(0, 0, xsize_, ysize_), pool, &sums));
+  return NormsFromSums(sums, xsize_, ysize_);
+}
+
+Status Ssimulacra2Reference::AddSums(const ImageBundle& distorted,
+                                     const jxl::Rect& rect,
+                                     jxl::ThreadPool* pool,
+                                     std::vector<MsssimScale>* sums) const {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  if (distorted.xsize() != xsize_ || distorted.ysize() != ysize_) {
+    return JXL_FAILURE("Image size mismatch");
+  }
 
-    Multiply(img1, img1, &mul);
-    JXL_ASSIGN_OR_RETURN(Image3F sigma1_sq, blur(mul));
+  JXL_ASSIGN_OR_RETURN(ImageBundle dist2, ToLinearSRGB(distorted, bg_, pool));
+  JXL_ASSIGN_OR_RETURN(Image3F mul,
+                       Image3F::Create(memory_manager, xsize_, ysize_));
+  JXL_ASSIGN_OR_RETURN(Blur blur, Blur::Create(xsize_, ysize_));
+
+  for (size_t scale = 0; scale < scales_.size(); scale++) {
+    const Scale& ref = scales_[scale];
+    if (scale) {
+      JXL_RETURN_IF_ERROR(DownsampleLinear(dist2));
+    }
+    JXL_ASSIGN_OR_RETURN(Image3F img2, PositiveXYB(dist2, pool));
+    JXL_RETURN_IF_ERROR(mul.ShrinkTo(img2.xsize(), img2.ysize()));
+    JXL_RETURN_IF_ERROR(blur.ShrinkTo(img2.xsize(), img2.ysize()));
 
     Multiply(img2, img2, &mul);
-    JXL_ASSIGN_OR_RETURN(Image3F sigma2_sq, blur(mul));
+    JXL_ASSIGN_OR_RETURN(Image3F sigma2_sq, blur(mul, pool));
 
-    Multiply(img1, img2, &mul);
-    JXL_ASSIGN_OR_RETURN(Image3F sigma12, blur(mul));
+    Multiply(ref.xyb, img2, &mul);
+    JXL_ASSIGN_OR_RETURN(Image3F sigma12, blur(mul, pool));
 
-    JXL_ASSIGN_OR_RETURN(Image3F mu1, blur(img1));
-    JXL_ASSIGN_OR_RETURN(Image3F mu2, blur(img2));
+    JXL_ASSIGN_OR_RETURN(Image3F mu2, blur(img2, pool));
 
-    MsssimScale sscale;
-    SSIMMap(mu1, mu2, sigma1_sq, sigma2_sq, sigma12, sscale.avg_ssim);
-    EdgeDiffMap(img1, mu1, img2, mu2, sscale.avg_edgediff);
-    msssim.scales.push_back(sscale);
+    JXL_ASSIGN_OR_RETURN(jxl::Rect scale_rect,
+                         rect.CeilShiftRight({scale, scale}));
+    MsssimScale& sum = (*sums)[scale];
+    SSIMMap(ref.mu, mu2, ref.sigma_sq, sigma2_sq, sigma12, scale_rect,
+            sum.avg_ssim);
+    EdgeDiffMap(ref.xyb, ref.mu, img2, mu2, scale_rect, sum.avg_edgediff);
   }
-  return msssim;
+  return true;
+}
+
+StatusOr<Msssim> ComputeSSIMULACRA2(const ImageBundle& orig,
+                                    const ImageBundle& dist, float bg,
+                                    jxl::ThreadPool* pool) {
+  JXL_ASSIGN_OR_RETURN(Ssimulacra2Reference reference,
+                       Ssimulacra2Reference::Create(orig, bg, pool));
+  return reference.Compare(dist, pool);
 }
 
 StatusOr<Msssim> ComputeSSIMULACRA2(const ImageBundle& orig,
                                     const ImageBundle& distorted) {
   return ComputeSSIMULACRA2(orig, distorted, 0.5f);
 }
+
+StatusOr<Msssim> ComputeSSIMULACRA2Tiled(const ImageBundle& orig,
+                                         const ImageBundle& distorted,
+                                         float bg, size_t tile_size,
+                                         jxl::ThreadPool* pool) {
+  const size_t xsize = orig.xsize();
+  const size_t ysize = orig.ysize();
+  if (distorted.xsize() != xsize || distorted.ysize() != ysize) {
+    return JXL_FAILURE("Image size mismatch");
+  }
+  if (tile_size == 0 || tile_size % kSsimulacra2TileAlign != 0) {
+    return JXL_FAILURE("Invalid tile size %" PRIuS, tile_size);
+  }
+  const size_t num_scales = NumScales(xsize, ysize);
+  std::vector<MsssimScale> sums(num_scales, MsssimScale{});
+  const jxl::Rect full(0, 0, xsize, ysize);
+  for (size_t y0 = 0; y0 < ysize; y0 += tile_size) {
+    for (size_t x0 = 0; x0 < xsize; x0 += tile_size) {
+      const jxl::Rect tile(x0, y0, tile_size, tile_size, xsize, ysize);
+      // Starts at a multiple of kSsimulacra2TileAlign too, so that the
+      // downscales of the crops are those of the full images.
+      const jxl::Rect context = tile.Extend(kSsimulacra2TileMargin, full);
+      JXL_ASSIGN_OR_RETURN(ImageBundle orig_crop, CropBundle(orig, context));
+      JXL_ASSIGN_OR_RETURN(ImageBundle distorted_crop,
+                           CropBundle(distorted, context));
+      JXL_ASSIGN_OR_RETURN(Ssimulacra2Reference reference,
+                           Ssimulacra2Reference::Create(orig_crop, bg, pool));
+      // The margin keeps the crops large enough for all the scales.
+      JXL_ENSURE(reference.scales_.size() == num_scales);
+      const jxl::Rect interior(x0 - context.x0(), y0 - context.y0(),
+                               tile.xsize(), tile.ysize());
+      JXL_RETURN_IF_ERROR(
+          reference.AddSums(distorted_crop, interior, pool, &sums));
+    }
+  }
+  return NormsFromSums(sums, xsize, ysize);
+}
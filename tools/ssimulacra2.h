@@ -6,9 +6,13 @@
 #ifndef TOOLS_SSIMULACRA2_H_
 #define TOOLS_SSIMULACRA2_H_
 
+#include <cstddef>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
 
 struct MsssimScale {
@@ -22,13 +26,79 @@ struct Msssim {
   double Score() const;
 };
 
+// Tiles of ComputeSSIMULACRA2Tiled start at multiples of this (the downscaling
+// factor of the last scale), so that they start at pixels of all the scales.
+constexpr size_t kSsimulacra2TileAlign = 32;
+
+// Context that ComputeSSIMULACRA2Tiled keeps around each tile. At the 1:32
+// scale it is still more than ten standard deviations of the blurs.
+constexpr size_t kSsimulacra2TileMargin = 512;
+
+// Reference image of SSIMULACRA 2 with everything that only depends on it
+// (XYB conversion, downscales and blurs of all scales) computed once, to score
+// several distorted images against it.
+class Ssimulacra2Reference {
+ public:
+  // In case of alpha transparency, assumes a gray background of intensity 'bg'
+  // (in range 0..1). The blurs run on 'pool', which may be null.
+  static jxl::StatusOr<Ssimulacra2Reference> Create(
+      const jxl::ImageBundle &orig, float bg = 0.5f,
+      jxl::ThreadPool *pool = nullptr);
+
+  // Computes the SSIMULACRA 2 score of 'distorted', which must have the size
+  // of the reference and is blended against the same background.
+  jxl::StatusOr<Msssim> Compare(const jxl::ImageBundle &distorted,
+                                jxl::ThreadPool *pool = nullptr) const;
+
+ private:
+  struct Scale {
+    jxl::Image3F xyb;       // Positive XYB.
+    jxl::Image3F mu;        // Blurred xyb.
+    jxl::Image3F sigma_sq;  // Blurred xyb * xyb.
+  };
+
+  friend jxl::StatusOr<Msssim> ComputeSSIMULACRA2Tiled(
+      const jxl::ImageBundle &orig, const jxl::ImageBundle &distorted,
+      float bg, size_t tile_size, jxl::ThreadPool *pool);
+
+  Ssimulacra2Reference() = default;
+
+  // Adds the sums of the error maps of 'distorted' over 'rect' of each scale
+  // (given in pixels of the 1:1 scale, starting at a multiple of
+  // kSsimulacra2TileAlign) to 'sums', which has one entry per scale.
+  jxl::Status AddSums(const jxl::ImageBundle &distorted, const jxl::Rect &rect,
+                      jxl::ThreadPool *pool,
+                      std::vector<MsssimScale> *sums) const;
+
+  float bg_ = 0.5f;
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+  std::vector<Scale> scales_;
+};
+
 // Computes the SSIMULACRA 2 score between reference image 'orig' and
 // distorted image 'distorted'. In case of alpha transparency, assume
 // a gray background if intensity 'bg' (in range 0..1).
 jxl::StatusOr<Msssim> ComputeSSIMULACRA2(const jxl::ImageBundle &orig,
                                          const jxl::ImageBundle &distorted,
-                                         float bg);
+                                         float bg,
+                                         jxl::ThreadPool *pool = nullptr);
 jxl::StatusOr<Msssim> ComputeSSIMULACRA2(const jxl::ImageBundle &orig,
                                          const jxl::ImageBundle &distorted);
 
+// Same as ComputeSSIMULACRA2, but computed one 'tile_size' x 'tile_size' tile
+// at a time from crops that extend kSsimulacra2TileMargin pixels beyond it, so
+// that the temporary images only scale with the tile size and not with the
+// images, e.g. to compare gigapixel images. 'tile_size' must be a multiple of
+// kSsimulacra2TileAlign. The downscales of the crops are exactly those of the
+// full images; the scores only differ from the ones of ComputeSSIMULACRA2 by
+// the summation order and by the tails of the blurs beyond the margin, i.e.
+// by float rounding. Each tile recomputes its context, which costs
+// ((tile_size + 2 * kSsimulacra2TileMargin) / tile_size)^2 times the work at
+// most.
+jxl::StatusOr<Msssim> ComputeSSIMULACRA2Tiled(const jxl::ImageBundle &orig,
+                                              const jxl::ImageBundle &distorted,
+                                              float bg, size_t tile_size,
+                                              jxl::ThreadPool *pool = nullptr);
+
 #endif  // TOOLS_SSIMULACRA2_H_
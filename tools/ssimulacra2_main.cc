@@ -5,26 +5,39 @@
 
 #include <jxl/memory_manager.h>
 
+#include <jxl/thread_parallel_runner.h>
+
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>  // NOLINT
 #include <vector>
 
 #include "lib/extras/codec.h"
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/codec_in_out.h"
+#include "tools/batch.h"
 #include "tools/file_io.h"
 #include "tools/no_memory_manager.h"
 #include "tools/ssimulacra2.h"
+#include "tools/thread_pool_internal.h"
 
 #define QUIT(M)               \
   fprintf(stderr, "%s\n", M); \
   return EXIT_FAILURE;
 
 int PrintUsage(char** argv) {
-  fprintf(stderr, "Usage: %s orig.png distorted.png\n", argv[0]);
+  fprintf(stderr, "Usage: %s orig.png distorted.png [--tile_size N]\n",
+          argv[0]);
   fprintf(stderr,
           "Returns a score in range -inf..100, which correlates to subjective "
           "visual quality:\n");
@@ -48,11 +61,128 @@ int PrintUsage(char** argv) {
   fprintf(stderr,
           "                             average output of cjxl -q 90 or "
           "mozjpeg -quality 90)\n");
+  fprintf(stderr,
+          "With --tile_size, the score is computed one NxN tile at a time, "
+          "which bounds\nthe memory for large images; N must be a multiple "
+          "of %" PRIuS ".\n",
+          kSsimulacra2TileAlign);
+  fprintf(stderr, "\nOr: %s --batch pairs.txt [--batch_jobs N]\n", argv[0]);
+  fprintf(stderr,
+          "Scores all the pairs of pairs.txt, one \"orig distorted\" pair per "
+          "line\n(separated by a tab or a space), N at the same time, and "
+          "prints the scores as CSV.\n");
   return 1;
 }
 
+namespace {
+
+jxl::Status LoadImage(const std::string& pathname, const char* purpose,
+                      jxl::CodecInOut* io) {
+  std::vector<uint8_t> encoded;
+  if (!jpegxl::tools::ReadFile(pathname, &encoded)) {
+    fprintf(stderr, "Could not load %s image: %s\n", purpose,
+            pathname.c_str());
+    return false;
+  }
+  if (!jxl::SetFromBytes(jxl::Bytes(encoded), jxl::extras::ColorHints(), io)) {
+    fprintf(stderr, "Could not decode %s image: %s\n", purpose,
+            pathname.c_str());
+    return false;
+  }
+  if (io->xsize() < 8 || io->ysize() < 8) {
+    fprintf(stderr, "Minimum image size is 8x8 pixels.\n");
+    return false;
+  }
+  return true;
+}
+
+// A reference image prepared for scoring; in case of alpha transparency it is
+// blended against a dark and a bright background, and the worst of both
+// scores is taken.
+struct PreparedReference {
+  size_t xsize;
+  size_t ysize;
+  std::vector<Ssimulacra2Reference> backgrounds;
+};
+
+jxl::Status RunSsimulacra2Batch(const std::string& manifest, size_t num_jobs) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  std::vector<jpegxl::tools::BatchJob> jobs;
+  JXL_RETURN_IF_ERROR(jpegxl::tools::ReadBatchManifest(manifest, &jobs));
+
+  jpegxl::tools::BatchInputCache<PreparedReference> references(jobs);
+  std::mutex output_mutex;
+  printf("orig,distorted,score\n");
+  const auto score = [&](const jpegxl::tools::BatchJob& job, void* runner,
+                         size_t* num_pixels) -> bool {
+    jxl::ThreadPool pool(JxlThreadParallelRunner, runner);
+    const auto prepare = [&](const std::string& pathname)
+        -> std::unique_ptr<PreparedReference> {
+      jxl::CodecInOut io{memory_manager};
+      if (!LoadImage(pathname, "original", &io)) return nullptr;
+      auto reference = jxl::make_unique<PreparedReference>();
+      reference->xsize = io.xsize();
+      reference->ysize = io.ysize();
+      std::vector<float> backgrounds = {0.5f};
+      if (io.Main().HasAlpha()) backgrounds = {0.1f, 0.9f};
+      for (float bg : backgrounds) {
+        auto background = Ssimulacra2Reference::Create(io.Main(), bg, &pool);
+        if (!background.ok()) return nullptr;
+        reference->backgrounds.emplace_back(std::move(background).value_());
+      }
+      return reference;
+    };
+    std::shared_ptr<const PreparedReference> reference =
+        references.Acquire(job, prepare);
+    const auto compare = [&](double* result) -> jxl::Status {
+      JXL_RETURN_IF_ERROR(reference != nullptr);
+      jxl::CodecInOut io{memory_manager};
+      JXL_RETURN_IF_ERROR(LoadImage(job.output, "distorted", &io));
+      if (io.xsize() != reference->xsize || io.ysize() != reference->ysize) {
+        return JXL_FAILURE("Image size mismatch.");
+      }
+      *result = 100.0;
+      for (const Ssimulacra2Reference& background : reference->backgrounds) {
+        JXL_ASSIGN_OR_RETURN(Msssim msssim,
+                             background.Compare(io.Main(), &pool));
+        *result = std::min(*result, msssim.Score());
+      }
+      *num_pixels += io.xsize() * io.ysize();
+      return true;
+    };
+    double result;
+    bool ok = compare(&result);
+    references.Release(job);
+    if (!ok) return false;
+    std::lock_guard<std::mutex> lock(output_mutex);
+    printf("%s,%s,%.8f\n", jpegxl::tools::CsvField(job.input).c_str(),
+           jpegxl::tools::CsvField(job.output).c_str(), result);
+    return true;
+  };
+  jpegxl::tools::BatchRunner batch(std::thread::hardware_concurrency(),
+                                   num_jobs);
+  return batch.Run(jobs, score, /*quiet=*/false) == 0;
+}
+
+}  // namespace
+
 int main(int argc, char** argv) {
-  if (argc != 3) return PrintUsage(argv);
+  if (argc >= 3 && std::string(argv[1]) == "--batch") {
+    size_t num_jobs = 1;
+    if (argc == 5 && std::string(argv[3]) == "--batch_jobs") {
+      num_jobs = std::stoul(argv[4]);
+    } else if (argc != 3) {
+      return PrintUsage(argv);
+    }
+    return RunSsimulacra2Batch(argv[2], num_jobs) ? EXIT_SUCCESS
+                                                  : EXIT_FAILURE;
+  }
+  size_t tile_size = 0;
+  if (argc == 5 && std::string(argv[3]) == "--tile_size") {
+    tile_size = std::stoul(argv[4]);
+  } else if (argc != 3) {
+    return PrintUsage(argv);
+  }
   JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
 
   jxl::CodecInOut io1{memory_manager};
@@ -60,39 +190,30 @@ int main(int argc, char** argv) {
   jxl::CodecInOut* io[2] = {&io1, &io2};
   const char* purpose[] = {"original", "distorted"};
   for (size_t i = 0; i < 2; ++i) {
-    std::vector<uint8_t> encoded;
-    if (!jpegxl::tools::ReadFile(argv[1 + i], &encoded)) {
-      fprintf(stderr, "Could not load %s image: %s\n", purpose[i], argv[1 + i]);
-      return 1;
-    }
-    if (!jxl::SetFromBytes(jxl::Bytes(encoded), jxl::extras::ColorHints(),
-                           io[i])) {
-      fprintf(stderr, "Could not decode %s image: %s\n", purpose[i],
-              argv[1 + i]);
-      return 1;
-    }
-    if (io[i]->xsize() < 8 || io[i]->ysize() < 8) {
-      QUIT("Minimum image size is 8x8 pixels.");
-    }
+    if (!LoadImage(argv[1 + i], purpose[i], io[i])) return 1;
   }
 
   if (io1.xsize() != io2.xsize() || io1.ysize() != io2.ysize()) {
     QUIT("Image size mismatch.");
   }
 
+  jpegxl::tools::ThreadPoolInternal pool;
+  const auto compute = [&](float bg) {
+    return tile_size ? ComputeSSIMULACRA2Tiled(io1.Main(), io2.Main(), bg,
+                                               tile_size, pool.get())
+                     : ComputeSSIMULACRA2(io1.Main(), io2.Main(), bg,
+                                          pool.get());
+  };
   if (!io1.Main().HasAlpha()) {
-    JXL_ASSIGN_OR_QUIT(Msssim msssim,
-                       ComputeSSIMULACRA2(io1.Main(), io2.Main()),
+    JXL_ASSIGN_OR_QUIT(Msssim msssim, compute(0.5f),
                        "ComputeSSIMULACRA2 failed.");
     printf("%.8f\n", msssim.Score());
   } else {
     // in case of alpha transparency: blend against dark and bright backgrounds
     // and return the worst of both scores
-    JXL_ASSIGN_OR_QUIT(Msssim msssim0,
-                       ComputeSSIMULACRA2(io1.Main(), io2.Main(), 0.1f),
+    JXL_ASSIGN_OR_QUIT(Msssim msssim0, compute(0.1f),
                        "ComputeSSIMULACRA2 failed.");
-    JXL_ASSIGN_OR_QUIT(Msssim msssim1,
-                       ComputeSSIMULACRA2(io1.Main(), io2.Main(), 0.9f),
+    JXL_ASSIGN_OR_QUIT(Msssim msssim1, compute(0.9f),
                        "ComputeSSIMULACRA2 failed.");
     printf("%.8f\n", std::min(msssim0.Score(), msssim1.Score()));
   }
@@ -0,0 +1,57 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_TRACING_H_
+#define TOOLS_TRACING_H_
+
+// Handling of the --trace flag of the tools, see jxl/trace.h.
+
+#include <jxl/trace.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+namespace jpegxl {
+namespace tools {
+
+// Starts recording the trace of the library if `path` is not empty. Returns
+// false if the library was built without tracing.
+static inline bool StartTracing(const std::string& path) {
+  if (path.empty()) return true;
+  if (!JxlTraceStart()) {
+    fprintf(stderr,
+            "Tracing is not available, the library was built without "
+            "JPEGXL_ENABLE_TRACING.\n");
+    return false;
+  }
+  return true;
+}
+
+// Stops recording and writes the trace to `path` as Chrome trace JSON, if
+// `path` is not empty.
+static inline bool FinishTracing(const std::string& path) {
+  if (path.empty()) return true;
+  JxlTraceStop();
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    fprintf(stderr, "Could not open %s for writing the trace.\n", path.c_str());
+    return false;
+  }
+  const auto write = [](void* opaque, const char* data, size_t size) {
+    fwrite(data, 1, size, static_cast<FILE*>(opaque));
+  };
+  JxlTraceWriteJSON(write, file);
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Could not write the trace to %s.\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_TRACING_H_